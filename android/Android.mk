@@ -85,6 +85,7 @@ LOCAL_SRC_FILES := \
 	bluez/lib/uuid.c \
 	bluez/btio/btio.c \
 	bluez/src/sdp-client.c \
+	bluez/profiles/network/bnep-tap.c \
 	bluez/profiles/network/bnep.c \
 	bluez/attrib/gattrib.c \
 	bluez/attrib/gatt.c \
@@ -267,6 +268,9 @@ LOCAL_SRC_FILES := \
 	bluez/btio/btio.c \
 	bluez/lib/bluetooth.c \
 	bluez/lib/hci.c \
+	bluez/src/shared/io-glib.c \
+	bluez/src/shared/util.c \
+	bluez/profiles/network/bnep-tap.c \
 	bluez/profiles/network/bnep.c \
 	bluez/tools/bneptest.c \
 
@@ -352,6 +356,9 @@ LOCAL_SRC_FILES := \
 	bluez/monitor/ll.c \
 	bluez/monitor/hwdb.c \
 	bluez/monitor/keys.c \
+	bluez/monitor/filter.c \
+	bluez/monitor/latency.c \
+	bluez/monitor/publish.c \
 	bluez/monitor/ellisys.c \
 	bluez/monitor/analyze.c \
 	bluez/monitor/intel.c \
@@ -415,6 +422,7 @@ LOCAL_SRC_FILES := \
 	bluez/android/hal-audio.c \
 	bluez/android/hal-audio-sbc.c \
 	bluez/android/hal-audio-aptx.c \
+	bluez/android/hal-utils.c \
 
 LOCAL_C_INCLUDES = \
 	$(LOCAL_PATH)/bluez \
@@ -447,16 +455,19 @@ include $(BUILD_SHARED_LIBRARY)
 include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := bluez/android/hal-sco.c \
+	bluez/android/hal-msbc.c \
 	bluez/android/hal-utils.c
 
 LOCAL_C_INCLUDES = \
 	$(call include-path-for, system-core) \
 	$(call include-path-for, libhardware) \
 	$(call include-path-for, audio-utils) \
+	$(call include-path-for, sbc) \
 
 LOCAL_SHARED_LIBRARIES := \
 	libcutils \
 	libaudioutils \
+	libsbc \
 
 LOCAL_CFLAGS := $(BLUEZ_COMMON_CFLAGS) -Wno-declaration-after-statement
 
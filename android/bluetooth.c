@@ -3033,9 +3033,11 @@ static struct device *create_device_from_info(GKeyFile *key_file,
 			for (i = 0; i < 16; i++)
 				sscanf((*uuid) + (i * 2), "%02hhX", &u[i]);
 
-			dev->uuids = g_slist_append(dev->uuids, u);
+			dev->uuids = g_slist_prepend(dev->uuids, u);
 		}
 
+		dev->uuids = g_slist_reverse(dev->uuids);
+
 		g_strfreev(uuids);
 	}
 
@@ -4879,7 +4881,7 @@ static uint8_t get_device_timestamp(struct device *dev)
 	return HAL_STATUS_SUCCESS;
 }
 
-static void get_remote_device_props(struct device *dev)
+static void get_remote_device_props(struct device *dev, bool batched)
 {
 	uint8_t buf[IPC_MTU];
 	struct hal_ev_remote_device_props *ev = (void *) buf;
@@ -4936,7 +4938,11 @@ static void get_remote_device_props(struct device *dev)
 						sizeof(timestamp), &timestamp);
 	ev->num_props++;
 
-	ipc_send_notif(hal_ipc, HAL_SERVICE_ID_BLUETOOTH,
+	if (batched)
+		ipc_send_notif_batched(hal_ipc, HAL_SERVICE_ID_BLUETOOTH,
+					HAL_EV_REMOTE_DEVICE_PROPS, size, buf);
+	else
+		ipc_send_notif(hal_ipc, HAL_SERVICE_ID_BLUETOOTH,
 					HAL_EV_REMOTE_DEVICE_PROPS, size, buf);
 }
 
@@ -4944,11 +4950,15 @@ static void send_bonded_devices_props(void)
 {
 	GSList *l;
 
+	/* Many bonds would otherwise cost one IPC write per device */
 	for (l = bonded_devices; l; l = g_slist_next(l)) {
 		struct device *dev = l->data;
 
-		get_remote_device_props(dev);
+		get_remote_device_props(dev, true);
 	}
+
+	/* Framework expects them before the enable command completes */
+	ipc_flush_notif(hal_ipc);
 }
 
 static void handle_enable_cmd(const void *buf, uint16_t len)
@@ -5021,7 +5031,7 @@ static void handle_get_remote_device_props_cmd(const void *buf, uint16_t len)
 		goto failed;
 	}
 
-	get_remote_device_props(dev);
+	get_remote_device_props(dev, false);
 
 	status = HAL_STATUS_SUCCESS;
 
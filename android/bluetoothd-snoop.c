@@ -26,8 +26,10 @@
 #endif
 
 #include <ctype.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 #if defined(ANDROID)
 #include <sys/capability.h>
 #endif
@@ -42,9 +44,193 @@
 
 #define DEFAULT_SNOOP_FILE "/sdcard/btsnoop_hci.log"
 
+#define SNOOP_BUFFER_SIZE	(64 * 1024)
+#define SNOOP_FLUSH_INTERVAL	1000
+
+#define DEFAULT_ROTATE_SIZE	16		/* MiB per file */
+#define DEFAULT_ROTATE_FILES	2
+#define DEFAULT_HISTORY_TIME	60		/* seconds */
+#define HISTORY_BUFFER_SIZE	(2 * 1024 * 1024)
+
+/* Packets fetched from the monitor socket with a single system call */
+#define MONITOR_BATCH		16
+
+struct monitor_msg {
+	struct mgmt_hdr hdr;
+	uint8_t buf[BTSNOOP_MAX_PACKET_SIZE];
+	unsigned char control[32];
+	struct iovec iov[2];
+};
+
+/*
+ * Last seconds of traffic kept in memory, so snooping can run without
+ * storage cost and still provide a log when something went wrong.
+ */
+struct history_rec {
+	uint64_t ts;
+	uint32_t flags;
+	uint16_t len;
+	uint16_t wrap;
+	uint8_t data[0];
+} __attribute__((packed));
+
+static struct {
+	uint8_t *buf;
+	size_t size;
+	size_t head;
+	size_t tail;
+	size_t used;
+	uint64_t max_age;
+} history;
+
 static struct btsnoop *snoop = NULL;
-static uint8_t monitor_buf[BTSNOOP_MAX_PACKET_SIZE];
+static struct monitor_msg monitor_msgs[MONITOR_BATCH];
+static struct mmsghdr monitor_mmsg[MONITOR_BATCH];
 static int monitor_fd = -1;
+static const char *snoop_path = DEFAULT_SNOOP_FILE;
+
+static bool history_init(unsigned int seconds)
+{
+	if (!seconds)
+		return true;
+
+	history.buf = malloc(HISTORY_BUFFER_SIZE);
+	if (!history.buf)
+		return false;
+
+	history.size = HISTORY_BUFFER_SIZE;
+	history.max_age = seconds * 1000000ull;
+
+	return true;
+}
+
+static struct history_rec *history_oldest(void)
+{
+	struct history_rec *rec;
+
+	/* A record that didn't fit at the end was placed at the start */
+	if (history.size - history.tail < sizeof(*rec)) {
+		history.used -= history.size - history.tail;
+		history.tail = 0;
+	}
+
+	rec = (struct history_rec *) (history.buf + history.tail);
+	if (rec->wrap) {
+		history.used -= history.size - history.tail;
+		history.tail = 0;
+		rec = (struct history_rec *) history.buf;
+	}
+
+	return rec;
+}
+
+static void history_pop(void)
+{
+	struct history_rec *rec = history_oldest();
+
+	history.tail += sizeof(*rec) + rec->len;
+	history.used -= sizeof(*rec) + rec->len;
+
+	if (!history.used)
+		history.head = history.tail = 0;
+}
+
+static void history_add(struct timeval *tv, uint32_t flags,
+					const void *data, uint16_t size)
+{
+	struct history_rec *rec;
+	size_t len = sizeof(*rec) + size, pad = 0;
+	uint64_t ts;
+
+	if (!history.buf)
+		return;
+
+	ts = tv ? tv->tv_sec * 1000000ull + tv->tv_usec : 0;
+
+	while (history.used && history_oldest()->ts + history.max_age < ts)
+		history_pop();
+
+	if (history.size - history.head < len)
+		pad = history.size - history.head;
+
+	while (history.used && history.size - history.used < pad + len)
+		history_pop();
+
+	/* Popping everything resets the ring, no padding needed anymore */
+	if (!history.used)
+		pad = 0;
+
+	if (pad) {
+		if (pad >= sizeof(*rec)) {
+			rec = (struct history_rec *) (history.buf + history.head);
+			rec->wrap = 1;
+		}
+
+		history.used += pad;
+		history.head = 0;
+	}
+
+	rec = (struct history_rec *) (history.buf + history.head);
+	rec->ts = ts;
+	rec->flags = flags;
+	rec->len = size;
+	rec->wrap = 0;
+	memcpy(rec->data, data, size);
+
+	history.head += len;
+	history.used += len;
+
+	if (history.head == history.size)
+		history.head = 0;
+}
+
+static void history_dump(void)
+{
+	struct btsnoop *dump;
+	char *path;
+	size_t tail, used;
+
+	if (!history.buf) {
+		error("bluetoothd_snoop: no history available");
+		return;
+	}
+
+	if (asprintf(&path, "%s.last", snoop_path) < 0)
+		return;
+
+	dump = btsnoop_create(path, BTSNOOP_FORMAT_HCI);
+	if (!dump) {
+		error("bluetoothd_snoop: failed to create %s", path);
+		free(path);
+		return;
+	}
+
+	/* Walk a copy of the ring, capturing continues afterwards */
+	tail = history.tail;
+	used = history.used;
+
+	while (history.used) {
+		struct history_rec *rec = history_oldest();
+		struct timeval tv;
+
+		tv.tv_sec = rec->ts / 1000000;
+		tv.tv_usec = rec->ts % 1000000;
+
+		btsnoop_write(dump, &tv, rec->flags, 0, rec->data, rec->len);
+
+		history.tail += sizeof(*rec) + rec->len;
+		history.used -= sizeof(*rec) + rec->len;
+	}
+
+	history.tail = tail;
+	history.used = used;
+
+	btsnoop_unref(dump);
+
+	info("bluetoothd_snoop: history written to %s", path);
+
+	free(path);
+}
 
 static void signal_callback(int signum, void *user_data)
 {
@@ -53,6 +239,9 @@ static void signal_callback(int signum, void *user_data)
 	case SIGTERM:
 		mainloop_quit();
 		break;
+	case SIGUSR1:
+		history_dump();
+		break;
 	}
 }
 
@@ -81,77 +270,118 @@ static uint32_t get_flags_from_opcode(uint16_t opcode)
 	return 0xff;
 }
 
+static void monitor_msg_process(struct msghdr *msg, ssize_t len)
+{
+	struct monitor_msg *mmsg = msg->msg_iov[0].iov_base;
+	struct cmsghdr *cmsg;
+	struct timeval *tv = NULL;
+	struct timeval ctv;
+	uint16_t opcode, index, pktlen;
+	uint32_t flags;
+
+	if (len < MGMT_HDR_SIZE)
+		return;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+				cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET)
+			continue;
+
+		if (cmsg->cmsg_type == SCM_TIMESTAMP) {
+			memcpy(&ctv, CMSG_DATA(cmsg), sizeof(ctv));
+			tv = &ctv;
+		}
+	}
+
+	opcode = btohs(mmsg->hdr.opcode);
+	index  = btohs(mmsg->hdr.index);
+	pktlen = btohs(mmsg->hdr.len);
+
+	if (index)
+		return;
+
+	flags = get_flags_from_opcode(opcode);
+	if (flags == 0xff)
+		return;
+
+	history_add(tv, flags, mmsg->buf, pktlen);
+
+	if (snoop)
+		btsnoop_write(snoop, tv, flags, 0, mmsg->buf, pktlen);
+}
+
 static void data_callback(int fd, uint32_t events, void *user_data)
 {
-	unsigned char control[32];
-	struct mgmt_hdr hdr;
-	struct msghdr msg;
-	struct iovec iov[2];
+	int i, count;
 
 	if (events & (EPOLLERR | EPOLLHUP)) {
 		mainloop_remove_fd(monitor_fd);
 		return;
 	}
 
-	iov[0].iov_base = &hdr;
-	iov[0].iov_len = MGMT_HDR_SIZE;
-	iov[1].iov_base = monitor_buf;
-	iov[1].iov_len = sizeof(monitor_buf);
-
-	memset(&msg, 0, sizeof(msg));
-	msg.msg_iov = iov;
-	msg.msg_iovlen = 2;
-	msg.msg_control = control;
-	msg.msg_controllen = sizeof(control);
-
-	while (true) {
-		struct cmsghdr *cmsg;
-		struct timeval *tv = NULL;
-		struct timeval ctv;
-		uint16_t opcode, index, pktlen;
-		uint32_t flags;
-		ssize_t len;
-
-		len = recvmsg(monitor_fd, &msg, MSG_DONTWAIT);
-		if (len < 0)
-			break;
+	do {
+		for (i = 0; i < MONITOR_BATCH; i++) {
+			struct msghdr *msg = &monitor_mmsg[i].msg_hdr;
 
-		if (len < MGMT_HDR_SIZE)
-			break;
+			/* The kernel shrinks the control length on receive */
+			msg->msg_controllen = sizeof(monitor_msgs[i].control);
+		}
 
-		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
-					cmsg = CMSG_NXTHDR(&msg, cmsg)) {
-			if (cmsg->cmsg_level != SOL_SOCKET)
-				continue;
+		count = recvmmsg(monitor_fd, monitor_mmsg, MONITOR_BATCH,
+							MSG_DONTWAIT, NULL);
 
-			if (cmsg->cmsg_type == SCM_TIMESTAMP) {
-				memcpy(&ctv, CMSG_DATA(cmsg), sizeof(ctv));
-				tv = &ctv;
-			}
-		}
+		for (i = 0; i < count; i++)
+			monitor_msg_process(&monitor_mmsg[i].msg_hdr,
+						monitor_mmsg[i].msg_len);
+	} while (count == MONITOR_BATCH);
+}
 
-		opcode = btohs(hdr.opcode);
-		index  = btohs(hdr.index);
-		pktlen = btohs(hdr.len);
+static void monitor_msg_init(void)
+{
+	int i;
 
-		if (index)
-			continue;
+	memset(monitor_mmsg, 0, sizeof(monitor_mmsg));
+
+	for (i = 0; i < MONITOR_BATCH; i++) {
+		struct monitor_msg *mmsg = &monitor_msgs[i];
+		struct msghdr *msg = &monitor_mmsg[i].msg_hdr;
 
-		flags = get_flags_from_opcode(opcode);
-		if (flags != 0xff)
-			btsnoop_write(snoop, tv, flags, 0, monitor_buf, pktlen);
+		mmsg->iov[0].iov_base = &mmsg->hdr;
+		mmsg->iov[0].iov_len = MGMT_HDR_SIZE;
+		mmsg->iov[1].iov_base = mmsg->buf;
+		mmsg->iov[1].iov_len = sizeof(mmsg->buf);
+
+		msg->msg_iov = mmsg->iov;
+		msg->msg_iovlen = 2;
+		msg->msg_control = mmsg->control;
+		msg->msg_controllen = sizeof(mmsg->control);
 	}
 }
 
-static int open_monitor(const char *path)
+static int open_monitor(const char *path, unsigned int rotate_size,
+						unsigned int rotate_files)
 {
 	struct sockaddr_hci addr;
 	int opt = 1;
 
+	if (!path)
+		goto monitor;
+
 	snoop = btsnoop_create(path, BTSNOOP_FORMAT_HCI);
 	if (!snoop)
 		return -1;
 
+	if (rotate_size)
+		btsnoop_set_rotate(snoop, rotate_size * 1024 * 1024, 0,
+								rotate_files);
+
+	/* Writing from another thread keeps the capture overhead low */
+	if (btsnoop_set_buffer(snoop, SNOOP_BUFFER_SIZE, SNOOP_FLUSH_INTERVAL))
+		btsnoop_start_writer(snoop);
+
+monitor:
+	monitor_msg_init();
+
 	monitor_fd = socket(AF_BLUETOOTH, SOCK_RAW | SOCK_CLOEXEC, BTPROTO_HCI);
 	if (monitor_fd < 0)
 		goto failed;
@@ -216,34 +446,101 @@ static void set_capabilities(void)
 #endif
 }
 
+static void usage(void)
+{
+	printf("bluetoothd-snoop - Bluetooth snoop daemon\n"
+		"Usage:\n");
+	printf("\tbluetoothd-snoop [options] [file]\n");
+	printf("options:\n"
+		"\t-s, --rotate-size <MiB>  Rotate log above size (default %u)\n"
+		"\t-n, --rotate-files <n>   Rotated files to keep (default %u)\n"
+		"\t-t, --history <seconds>  Traffic kept in memory (default %u)\n"
+		"\t-m, --memory-only        Only keep traffic in memory\n"
+		"\t-h, --help               Show help options\n",
+		DEFAULT_ROTATE_SIZE, DEFAULT_ROTATE_FILES,
+		DEFAULT_HISTORY_TIME);
+	printf("\nSend SIGUSR1 to write the history to <file>.last\n");
+}
+
+static const struct option main_options[] = {
+	{ "rotate-size",  required_argument, NULL, 's' },
+	{ "rotate-files", required_argument, NULL, 'n' },
+	{ "history",      required_argument, NULL, 't' },
+	{ "memory-only",  no_argument,       NULL, 'm' },
+	{ "help",         no_argument,       NULL, 'h' },
+	{ }
+};
+
 int main(int argc, char *argv[])
 {
-	const char *path;
+	unsigned int rotate_size = DEFAULT_ROTATE_SIZE;
+	unsigned int rotate_files = DEFAULT_ROTATE_FILES;
+	unsigned int history_time = DEFAULT_HISTORY_TIME;
+	bool memory_only = false;
 	sigset_t mask;
 
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "s:n:t:mh", main_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 's':
+			rotate_size = atoi(optarg);
+			break;
+		case 'n':
+			rotate_files = atoi(optarg);
+			break;
+		case 't':
+			history_time = atoi(optarg);
+			break;
+		case 'm':
+			memory_only = true;
+			break;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind > 1) {
+		fprintf(stderr, "Invalid command line parameters\n");
+		return EXIT_FAILURE;
+	}
+
+	if (argc - optind > 0)
+		snoop_path = argv[optind];
+
+	if (memory_only && !history_time) {
+		fprintf(stderr, "Memory only mode requires history\n");
+		return EXIT_FAILURE;
+	}
+
 	__btd_log_init(NULL, 0);
 
 	DBG("");
 
 	set_capabilities();
 
-	if (argc > 1)
-		path = argv[1];
-	else
-		path = DEFAULT_SNOOP_FILE;
-
 	mainloop_init();
 
 	sigemptyset(&mask);
 	sigaddset(&mask, SIGINT);
 	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGUSR1);
 
 	mainloop_set_signal(&mask, signal_callback, NULL, NULL);
 
-	if (!strcmp(DEFAULT_SNOOP_FILE, path))
+	if (!memory_only && !strcmp(DEFAULT_SNOOP_FILE, snoop_path))
 		rename(DEFAULT_SNOOP_FILE, DEFAULT_SNOOP_FILE ".old");
 
-	if (open_monitor(path) < 0) {
+	if (!history_init(history_time) ||
+			open_monitor(memory_only ? NULL : snoop_path,
+					rotate_size, rotate_files) < 0) {
 		error("bluetoothd_snoop: start failed");
 		return EXIT_FAILURE;
 	}
@@ -254,6 +551,8 @@ int main(int argc, char *argv[])
 
 	close_monitor();
 
+	free(history.buf);
+
 	info("bluetoothd_snoop: stopped");
 
 	__btd_log_cleanup();
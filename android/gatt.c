@@ -99,6 +99,16 @@ struct pending_trans_data {
 	uint8_t opcode;
 	struct gatt_db_attribute *attrib;
 	unsigned int serial_id;
+	uint16_t offset;
+};
+
+/* Value served for an app attribute without asking the app every time */
+struct attr_cache {
+	int32_t server_if;
+	uint8_t mode;
+	bool valid;
+	uint16_t len;
+	uint8_t *value;
 };
 
 struct gatt_app {
@@ -120,6 +130,16 @@ struct element_id {
 	uint8_t instance;
 };
 
+/*
+ * Instance ids of services, characteristics and descriptors are handed out
+ * in order as they get cached, so a table indexed by instance id resolves
+ * HAL element ids without walking the queues.
+ */
+struct inst_index {
+	void **entries;
+	unsigned int len;
+};
+
 struct descriptor {
 	struct element_id id;
 	uint16_t handle;
@@ -131,6 +151,7 @@ struct characteristic {
 	uint16_t end_handle;
 
 	struct queue *descriptors;
+	struct inst_index descr_index;
 };
 
 struct service {
@@ -141,6 +162,7 @@ struct service {
 	bool primary;
 
 	struct queue *chars;
+	struct inst_index char_index;
 	struct queue *included;	/* Valid only for primary services */
 	bool incl_search_done;
 };
@@ -162,6 +184,7 @@ struct gatt_device {
 	GAttrib *attrib;
 	GIOChannel *att_io;
 	struct queue *services;
+	struct inst_index srvc_index;
 	bool partial_srvc_search;
 
 	guint watch_id;
@@ -201,6 +224,14 @@ static struct queue *gatt_apps = NULL;
 static struct queue *gatt_devices = NULL;
 static struct queue *app_connections = NULL;
 
+/* Lookup indexes over the queues above, these keep the iteration order */
+static GHashTable *apps_by_id = NULL;
+static GHashTable *devices_by_addr = NULL;
+static GHashTable *connections_by_id = NULL;
+
+/* Cached server attribute values by handle */
+static GHashTable *attr_caches = NULL;
+
 static struct queue *services_sdp = NULL;
 
 static struct queue *listen_apps = NULL;
@@ -298,6 +329,68 @@ static void element_id_to_hal_gatt_id(const struct element_id *from,
 	uuid2android(&from->uuid, to->uuid);
 }
 
+static void inst_index_add(struct inst_index *index, uint8_t instance,
+								void *entry)
+{
+	if (instance >= index->len) {
+		unsigned int len = MAX(index->len * 2, 8u);
+
+		while (len <= instance)
+			len *= 2;
+
+		len = MIN(len, UINT8_MAX + 1u);
+
+		index->entries = g_renew(void *, index->entries, len);
+		memset(index->entries + index->len, 0,
+				(len - index->len) * sizeof(void *));
+		index->len = len;
+	}
+
+	/* Keep the first one, as the queue lookups used to */
+	if (!index->entries[instance])
+		index->entries[instance] = entry;
+}
+
+static void *inst_index_get(const struct inst_index *index, uint8_t instance)
+{
+	if (instance >= index->len)
+		return NULL;
+
+	return index->entries[instance];
+}
+
+/* First entry with an instance id higher than the given one */
+static void *inst_index_next(const struct inst_index *index, uint8_t instance)
+{
+	unsigned int i;
+
+	for (i = instance + 1; i < index->len; i++) {
+		if (index->entries[i])
+			return index->entries[i];
+	}
+
+	return NULL;
+}
+
+static void inst_index_clear(struct inst_index *index)
+{
+	g_free(index->entries);
+	index->entries = NULL;
+	index->len = 0;
+}
+
+static guint bdaddr_hash(gconstpointer key)
+{
+	const bdaddr_t *addr = key;
+
+	return get_le32(&addr->b[0]) ^ get_le16(&addr->b[4]);
+}
+
+static gboolean bdaddr_equal(gconstpointer a, gconstpointer b)
+{
+	return !bacmp(a, b);
+}
+
 static void destroy_characteristic(void *data)
 {
 	struct characteristic *chars = data;
@@ -306,6 +399,7 @@ static void destroy_characteristic(void *data)
 		return;
 
 	queue_destroy(chars->descriptors, free);
+	inst_index_clear(&chars->descr_index);
 	free(chars);
 }
 
@@ -317,6 +411,7 @@ static void destroy_service(void *data)
 		return;
 
 	queue_destroy(srvc->chars, destroy_characteristic);
+	inst_index_clear(&srvc->char_index);
 
 	/*
 	 * Included services we keep on two queues.
@@ -348,15 +443,7 @@ static bool match_app_by_id(const void *data, const void *user_data)
 
 static struct gatt_app *find_app_by_id(int32_t id)
 {
-	return queue_find(gatt_apps, match_app_by_id, INT_TO_PTR(id));
-}
-
-static bool match_device_by_bdaddr(const void *data, const void *user_data)
-{
-	const struct gatt_device *dev = data;
-	const bdaddr_t *addr = user_data;
-
-	return !bacmp(&dev->bdaddr, addr);
+	return g_hash_table_lookup(apps_by_id, INT_TO_PTR(id));
 }
 
 static bool match_device_by_state(const void *data, const void *user_data)
@@ -401,8 +488,7 @@ static struct app_connection *find_connection_by_id(int32_t conn_id)
 {
 	struct app_connection *conn;
 
-	conn = queue_find(app_connections, match_connection_by_id,
-							INT_TO_PTR(conn_id));
+	conn = g_hash_table_lookup(connections_by_id, INT_TO_PTR(conn_id));
 	if (conn && conn->device->state == DEVICE_CONNECTED)
 		return conn;
 
@@ -427,7 +513,7 @@ static bool match_connection_by_app(const void *data, const void *user_data)
 
 static struct gatt_device *find_device_by_addr(const bdaddr_t *addr)
 {
-	return queue_find(gatt_devices, match_device_by_bdaddr, addr);
+	return g_hash_table_lookup(devices_by_addr, addr);
 }
 
 static struct gatt_device *find_pending_device(void)
@@ -478,16 +564,6 @@ static bool match_srvc_by_range(const void *data, const void *user_data)
 	return !memcmp(&srvc->prim.range, range, sizeof(srvc->prim.range));
 }
 
-static bool match_char_by_higher_inst_id(const void *data,
-							const void *user_data)
-{
-	const struct characteristic *ch = data;
-	uint8_t inst_id = PTR_TO_INT(user_data);
-
-	/* For now we match inst_id as it is unique, we'll match uuids later */
-	return inst_id < ch->id.instance;
-}
-
 static bool match_descr_by_element_id(const void *data, const void *user_data)
 {
 	const struct element_id *exp_id = user_data;
@@ -499,16 +575,6 @@ static bool match_descr_by_element_id(const void *data, const void *user_data)
 	return false;
 }
 
-static bool match_descr_by_higher_inst_id(const void *data,
-							const void *user_data)
-{
-	const struct descriptor *descr = data;
-	uint8_t instance = PTR_TO_INT(user_data);
-
-	/* For now we match instance as it is unique */
-	return instance < descr->id.instance;
-}
-
 static bool match_notification(const void *a, const void *b)
 {
 	const struct notification_data *a1 = a;
@@ -537,6 +603,57 @@ static bool match_char_by_element_id(const void *data, const void *user_data)
 	return false;
 }
 
+/*
+ * Instance ids only repeat once they wrapped around, so fall back to walking
+ * the queue when the indexed entry has another uuid.
+ */
+static struct service *find_srvc_by_element_id(struct gatt_device *dev,
+						const struct element_id *id)
+{
+	struct service *srvc = inst_index_get(&dev->srvc_index, id->instance);
+
+	if (!srvc || !bt_uuid_cmp(&srvc->id.uuid, &id->uuid))
+		return srvc;
+
+	return queue_find(dev->services, match_srvc_by_element_id, id);
+}
+
+static struct characteristic *find_char_by_element_id(struct service *srvc,
+						const struct element_id *id)
+{
+	struct characteristic *ch;
+
+	ch = inst_index_get(&srvc->char_index, id->instance);
+	if (!ch || !bt_uuid_cmp(&ch->id.uuid, &id->uuid))
+		return ch;
+
+	return queue_find(srvc->chars, match_char_by_element_id, id);
+}
+
+static struct descriptor *find_descr_by_element_id(struct characteristic *ch,
+						const struct element_id *id)
+{
+	struct descriptor *descr;
+
+	descr = inst_index_get(&ch->descr_index, id->instance);
+	if (!descr || !bt_uuid_cmp(&descr->id.uuid, &id->uuid))
+		return descr;
+
+	return queue_find(ch->descriptors, match_descr_by_element_id, id);
+}
+
+static void device_add_service(struct gatt_device *dev, struct service *srvc)
+{
+	queue_push_tail(dev->services, srvc);
+	inst_index_add(&dev->srvc_index, srvc->id.instance, srvc);
+}
+
+static void device_clear_services(struct gatt_device *dev)
+{
+	queue_remove_all(dev->services, NULL, NULL, destroy_service);
+	inst_index_clear(&dev->srvc_index);
+}
+
 static void destroy_notification(void *data)
 {
 	struct notification_data *notification = data;
@@ -644,7 +761,7 @@ static void connection_cleanup(struct gatt_device *device)
 
 	/* If device is not bonded service cache should be refreshed */
 	if (!bt_device_is_bonded(&device->bdaddr))
-		queue_remove_all(device->services, NULL, NULL, destroy_service);
+		device_clear_services(device);
 
 	device_set_state(device, DEVICE_DISCONNECTED);
 
@@ -693,6 +810,10 @@ static void destroy_gatt_app(void *data)
 
 	free_adv_instance(app->adv);
 
+	if (apps_by_id && g_hash_table_lookup(apps_by_id,
+						INT_TO_PTR(app->id)) == app)
+		g_hash_table_remove(apps_by_id, INT_TO_PTR(app->id));
+
 	free(app);
 }
 
@@ -729,11 +850,16 @@ static void destroy_device(void *data)
 		return;
 
 	queue_destroy(dev->services, destroy_service);
+	inst_index_clear(&dev->srvc_index);
 	queue_destroy(dev->pending_requests, destroy_pending_request);
 	queue_destroy(dev->autoconnect_apps, NULL);
 
 	bt_auto_connect_remove(&dev->bdaddr);
 
+	if (devices_by_addr &&
+			g_hash_table_lookup(devices_by_addr, &dev->bdaddr) == dev)
+		g_hash_table_remove(devices_by_addr, &dev->bdaddr);
+
 	free(dev);
 }
 
@@ -771,6 +897,7 @@ static struct gatt_device *create_device(const bdaddr_t *addr)
 	dev->pending_requests = queue_new();
 
 	queue_push_head(gatt_devices, dev);
+	g_hash_table_insert(devices_by_addr, &dev->bdaddr, dev);
 
 	return device_ref(dev);
 }
@@ -872,6 +999,10 @@ static void destroy_connection(void *data)
 	if (!conn)
 		return;
 
+	if (connections_by_id && g_hash_table_lookup(connections_by_id,
+						INT_TO_PTR(conn->id)) == conn)
+		g_hash_table_remove(connections_by_id, INT_TO_PTR(conn->id));
+
 	if (conn->timeout_id > 0)
 		g_source_remove(conn->timeout_id);
 
@@ -1119,6 +1250,8 @@ static struct app_connection *create_connection(struct gatt_device *device,
 	new_conn->transactions = queue_new();
 
 	queue_push_head(app_connections, new_conn);
+	g_hash_table_insert(connections_by_id, INT_TO_PTR(new_conn->id),
+								new_conn);
 
 	new_conn->device = device_ref(device);
 
@@ -1222,7 +1355,7 @@ static void discover_srvc_by_uuid_cb(uint8_t status, GSList *ranges,
 			goto reply;
 		}
 
-		queue_push_tail(dev->services, s);
+		device_add_service(dev, s);
 
 		send_client_primary_notify(s, INT_TO_PTR(cb_data->conn->id));
 
@@ -1279,7 +1412,7 @@ static void discover_srvc_all_cb(uint8_t status, GSList *services,
 		if (!p)
 			continue;
 
-		queue_push_tail(dev->services, p);
+		device_add_service(dev, p);
 
 		DBG("attr handle = 0x%04x, end grp handle = 0x%04x uuid: %s",
 			prim->range.start, prim->range.end, prim->uuid);
@@ -1765,6 +1898,7 @@ static struct gatt_app *register_app(const uint8_t *uuid, gatt_type_t type)
 	app->id = application_id++;
 
 	queue_push_head(gatt_apps, app);
+	g_hash_table_insert(apps_by_id, INT_TO_PTR(app->id), app);
 
 	if (app->type == GATT_SERVER)
 		queue_push_tail(listen_apps, INT_TO_PTR(app->id));
@@ -1942,6 +2076,71 @@ static void clear_autoconnect_devices(void *data, void *user_data)
 			remove_autoconnect_device(dev);
 }
 
+static void free_attr_cache(void *data)
+{
+	struct attr_cache *cache = data;
+
+	free(cache->value);
+	free(cache);
+}
+
+static bool attr_cache_set(struct attr_cache *cache, const uint8_t *value,
+								uint16_t len)
+{
+	uint8_t *copy = NULL;
+
+	if (len) {
+		copy = malloc(len);
+		if (!copy)
+			return false;
+
+		memcpy(copy, value, len);
+	}
+
+	free(cache->value);
+	cache->value = copy;
+	cache->len = len;
+	cache->valid = true;
+
+	return true;
+}
+
+static void attr_cache_invalidate(uint16_t handle)
+{
+	struct attr_cache *cache;
+
+	cache = g_hash_table_lookup(attr_caches, UINT_TO_PTR(handle));
+	if (!cache || !cache->valid)
+		return;
+
+	free(cache->value);
+	cache->value = NULL;
+	cache->len = 0;
+	cache->valid = false;
+}
+
+static gboolean match_cache_by_server(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	struct attr_cache *cache = value;
+
+	return cache->server_if == PTR_TO_INT(user_data);
+}
+
+struct handle_range {
+	uint16_t start;
+	uint16_t end;
+};
+
+static gboolean match_cache_by_range(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	struct handle_range *range = user_data;
+	uint16_t handle = PTR_TO_UINT(key);
+
+	return handle >= range->start && handle <= range->end;
+}
+
 static uint8_t unregister_app(int client_if)
 {
 	struct gatt_app *cl;
@@ -1960,6 +2159,11 @@ static uint8_t unregister_app(int client_if)
 		return HAL_STATUS_FAILED;
 	}
 
+	g_hash_table_remove(apps_by_id, INT_TO_PTR(client_if));
+
+	g_hash_table_foreach_remove(attr_caches, match_cache_by_server,
+							INT_TO_PTR(client_if));
+
 	/* Destroy app connections with proper notifications for this app. */
 	queue_remove_all(app_connections, match_connection_by_app, cl,
 							destroy_connection);
@@ -2233,7 +2437,7 @@ static void handle_client_refresh(const void *buf, uint16_t len)
 		goto done;
 	}
 
-	queue_remove_all(dev->services, NULL, NULL, destroy_service);
+	device_clear_services(dev);
 
 	status = HAL_STATUS_SUCCESS;
 
@@ -2421,7 +2625,7 @@ static void get_included_cb(uint8_t status, GSList *included, void *user_data)
 		 * 2. on special queue inside primary service
 		 */
 		queue_push_tail(service->included, incl);
-		queue_push_tail(conn->device->services, incl);
+		device_add_service(conn->device, incl);
 	}
 
 	/*
@@ -2469,8 +2673,7 @@ static bool find_service(int32_t conn_id, struct element_id *service_id,
 		return false;
 	}
 
-	srvc = queue_find(conn->device->services, match_srvc_by_element_id,
-								service_id);
+	srvc = find_srvc_by_element_id(conn->device, service_id);
 	if (!srvc) {
 		error("gatt: Service with inst_id: %d not found",
 							service_id->instance);
@@ -2621,6 +2824,7 @@ static void cache_all_srvc_chars(struct service *srvc, GSList *characteristics)
 				ch->ch.handle, ch->end_handle, ch->ch.uuid);
 
 		queue_push_tail(srvc->chars, ch);
+		inst_index_add(&srvc->char_index, ch->id.instance, ch);
 	}
 }
 
@@ -2701,8 +2905,8 @@ static void handle_client_get_characteristic(const void *buf, uint16_t len)
 	}
 
 	if (cmd->continuation)
-		ch = queue_find(srvc->chars, match_char_by_higher_inst_id,
-					INT_TO_PTR(cmd->char_id[0].inst_id));
+		ch = inst_index_next(&srvc->char_index,
+						cmd->char_id[0].inst_id);
 	else
 		ch = queue_peek_head(srvc->chars);
 
@@ -2778,6 +2982,7 @@ static void gatt_discover_desc_cb(guint8 status, GSList *descs,
 		DBG("attr handle = 0x%04x, uuid: %s", desc->handle, desc->uuid);
 
 		queue_push_tail(ch->descriptors, descr);
+		inst_index_add(&ch->descr_index, descr->id.instance, descr);
 	}
 
 reply:
@@ -2855,7 +3060,7 @@ static void handle_client_get_descriptor(const void *buf, uint16_t len)
 		goto failed;
 	}
 
-	ch = queue_find(srvc->chars, match_char_by_element_id, &char_id);
+	ch = find_char_by_element_id(srvc, &char_id);
 	if (!ch) {
 		error("gatt: Get descr. could not find characteristic");
 
@@ -2876,9 +3081,8 @@ static void handle_client_get_descriptor(const void *buf, uint16_t len)
 
 	/* Send from cache */
 	if (cmd->continuation)
-		descr = queue_find(ch->descriptors,
-					match_descr_by_higher_inst_id,
-					INT_TO_PTR(cmd->descr_id[0].inst_id));
+		descr = inst_index_next(&ch->descr_index,
+						cmd->descr_id[0].inst_id);
 	else
 		descr = queue_peek_head(ch->descriptors);
 
@@ -3076,7 +3280,7 @@ static void handle_client_read_characteristic(const void *buf, uint16_t len)
 	}
 
 	/* search characteristics by element id */
-	ch = queue_find(srvc->chars, match_char_by_element_id, &char_id);
+	ch = find_char_by_element_id(srvc, &char_id);
 	if (!ch) {
 		error("gatt: Characteristic with inst_id: %d not found",
 							cmd->char_id.inst_id);
@@ -3207,7 +3411,7 @@ static void handle_client_write_characteristic(const void *buf, uint16_t len)
 	}
 
 	/* search characteristics by instance id */
-	ch = queue_find(srvc->chars, match_char_by_element_id, &char_id);
+	ch = find_char_by_element_id(srvc, &char_id);
 	if (!ch) {
 		error("gatt: Characteristic with inst_id: %d not found",
 							cmd->char_id.inst_id);
@@ -3407,7 +3611,7 @@ static void handle_client_read_descriptor(const void *buf, uint16_t len)
 		goto failed;
 	}
 
-	ch = queue_find(srvc->chars, match_char_by_element_id, &char_id);
+	ch = find_char_by_element_id(srvc, &char_id);
 	if (!ch) {
 		error("gatt: Read descr. could not find characteristic");
 
@@ -3415,8 +3619,7 @@ static void handle_client_read_descriptor(const void *buf, uint16_t len)
 		goto failed;
 	}
 
-	descr = queue_find(ch->descriptors, match_descr_by_element_id,
-								&descr_id);
+	descr = find_descr_by_element_id(ch, &descr_id);
 	if (!descr) {
 		error("gatt: Read descr. could not find descriptor");
 
@@ -3532,7 +3735,7 @@ static void handle_client_write_descriptor(const void *buf, uint16_t len)
 		goto failed;
 	}
 
-	ch = queue_find(srvc->chars, match_char_by_element_id, &char_id);
+	ch = find_char_by_element_id(srvc, &char_id);
 	if (!ch) {
 		error("gatt: Write descr. could not find characteristic");
 
@@ -3540,8 +3743,7 @@ static void handle_client_write_descriptor(const void *buf, uint16_t len)
 		goto failed;
 	}
 
-	descr = queue_find(ch->descriptors, match_descr_by_element_id,
-								&descr_id);
+	descr = find_descr_by_element_id(ch, &descr_id);
 	if (!descr) {
 		error("gatt: Write descr. could not find descriptor");
 
@@ -3678,8 +3880,9 @@ static void handle_notification(const uint8_t *pdu, uint16_t len,
 	ev->len = len - data_offset;
 	memcpy(ev->value, pdu + data_offset, len - data_offset);
 
-	ipc_send_notif(hal_ipc, HAL_SERVICE_ID_GATT, HAL_EV_GATT_CLIENT_NOTIFY,
-						sizeof(*ev) + ev->len, ev);
+	ipc_send_notif_batched(hal_ipc, HAL_SERVICE_ID_GATT,
+					HAL_EV_GATT_CLIENT_NOTIFY,
+					sizeof(*ev) + ev->len, ev);
 }
 
 static void send_register_for_notification_ev(int32_t id, int32_t registered,
@@ -3726,15 +3929,14 @@ static void handle_client_register_for_notification(const void *buf,
 	conn_id = conn->id;
 
 	hal_srvc_id_to_element_id(&cmd->srvc_id, &match_id);
-	service = queue_find(conn->device->services, match_srvc_by_element_id,
-								&match_id);
+	service = find_srvc_by_element_id(conn->device, &match_id);
 	if (!service) {
 		status = HAL_STATUS_FAILED;
 		goto failed;
 	}
 
 	hal_gatt_id_to_element_id(&cmd->char_id, &match_id);
-	c = queue_find(service->chars, match_char_by_element_id, &match_id);
+	c = find_char_by_element_id(service, &match_id);
 	if (!c) {
 		status = HAL_STATUS_FAILED;
 		goto failed;
@@ -4075,8 +4277,7 @@ static void handle_client_test_command(const void *buf, uint16_t len)
 		status = handle_connect(test_client_if, &bdaddr, false);
 		break;
 	case GATT_CLIENT_TEST_CMD_DISCONNECT:
-		app = queue_find(gatt_apps, match_app_by_id,
-						INT_TO_PTR(test_client_if));
+		app = find_app_by_id(test_client_if);
 		queue_remove_all(app_connections, match_connection_by_app, app,
 							destroy_connection);
 
@@ -4735,6 +4936,29 @@ static bool get_dst_addr(struct bt_att *att, bdaddr_t *dst)
 	return true;
 }
 
+static bool read_from_cache(struct gatt_db_attribute *attrib, unsigned int id,
+							uint16_t offset)
+{
+	struct attr_cache *cache;
+	uint16_t handle = gatt_db_attribute_get_handle(attrib);
+
+	cache = g_hash_table_lookup(attr_caches, UINT_TO_PTR(handle));
+	if (!cache || !cache->valid)
+		return false;
+
+	if (offset > cache->len) {
+		gatt_db_attribute_read_result(attrib, id,
+						BT_ATT_ERROR_INVALID_OFFSET,
+						NULL, 0);
+		return true;
+	}
+
+	gatt_db_attribute_read_result(attrib, id, 0, cache->value + offset,
+							cache->len - offset);
+
+	return true;
+}
+
 static void read_cb(struct gatt_db_attribute *attrib, unsigned int id,
 			uint16_t offset, uint8_t opcode, struct bt_att *att,
 			void *user_data)
@@ -4748,6 +4972,10 @@ static void read_cb(struct gatt_db_attribute *attrib, unsigned int id,
 
 	DBG("id %u", id);
 
+	/* Static values don't need a round trip to the application */
+	if (read_from_cache(attrib, id, offset))
+		return;
+
 	app = find_app_by_id(app_id);
 	if (!app) {
 		error("gatt: read_cb, cound not found app id");
@@ -4769,6 +4997,7 @@ static void read_cb(struct gatt_db_attribute *attrib, unsigned int id,
 
 	/* Store the request data, complete callback and transaction id */
 	transaction = conn_add_transact(conn, opcode, attrib, id);
+	transaction->offset = offset;
 
 	bdaddr2android(&bdaddr, ev.bdaddr);
 	ev.conn_id = conn->id;
@@ -4825,6 +5054,9 @@ static void write_cb(struct gatt_db_attribute *attrib, unsigned int id,
 	if (opcode == ATT_OP_PREP_WRITE_REQ)
 		conn->wait_execute_write = true;
 
+	/* The application may derive the value from what is written */
+	attr_cache_invalidate(gatt_db_attribute_get_handle(attrib));
+
 	/* Store the request data, complete callback and transaction id */
 	transaction = conn_add_transact(conn, opcode, attrib, id);
 
@@ -5295,6 +5527,7 @@ static void handle_server_delete_service(const void *buf, uint16_t len)
 	struct hal_ev_gatt_server_service_deleted ev;
 	struct gatt_app *server;
 	struct gatt_db_attribute *attrib;
+	struct handle_range range;
 	uint8_t status;
 
 	DBG("");
@@ -5313,6 +5546,11 @@ static void handle_server_delete_service(const void *buf, uint16_t len)
 		goto failed;
 	}
 
+	if (gatt_db_attribute_get_service_handles(attrib, &range.start,
+								&range.end))
+		g_hash_table_foreach_remove(attr_caches, match_cache_by_range,
+									&range);
+
 	if (!gatt_db_remove_service(gatt_db, attrib)) {
 		status = HAL_STATUS_FAILED;
 		goto failed;
@@ -5365,6 +5603,9 @@ static void handle_server_send_indication(const void *buf, uint16_t len)
 		goto reply;
 	}
 
+	/* Value changed, next read has to come from the application */
+	attr_cache_invalidate(cmd->attribute_handle);
+
 	pdu = g_attrib_get_buffer(conn->device->attrib, &mtu);
 
 	if (cmd->confirm) {
@@ -5416,6 +5657,20 @@ static bool pending_execute_write(void)
 	return queue_find(app_connections, find_conn_waiting_exec_write, NULL);
 }
 
+static void cache_response(struct gatt_db_attribute *attrib,
+					const uint8_t *value, uint16_t len)
+{
+	struct attr_cache *cache;
+	uint16_t handle = gatt_db_attribute_get_handle(attrib);
+
+	cache = g_hash_table_lookup(attr_caches, UINT_TO_PTR(handle));
+	if (!cache || cache->valid || cache->mode != HAL_GATT_CACHE_RESPONSE)
+		return;
+
+	if (!attr_cache_set(cache, value, len))
+		error("gatt: Failed to cache value of handle 0x%04x", handle);
+}
+
 static void handle_server_send_response(const void *buf, uint16_t len)
 {
 	const struct hal_cmd_gatt_server_send_response *cmd = buf;
@@ -5468,6 +5723,10 @@ static void handle_server_send_response(const void *buf, uint16_t len)
 		 */
 	}
 
+	if (transaction->opcode < ATT_OP_WRITE_REQ && !transaction->offset &&
+								!cmd->status)
+		cache_response(transaction->attrib, cmd->data, cmd->len);
+
 	/* Cast status to uint8_t, due to (byte) cast in java layer. */
 	if (transaction->opcode < ATT_OP_WRITE_REQ)
 		gatt_db_attribute_read_result(transaction->attrib,
@@ -5492,6 +5751,61 @@ reply:
 			HAL_OP_GATT_SERVER_SEND_RESPONSE, status);
 }
 
+static void handle_server_set_cached_value(const void *buf, uint16_t len)
+{
+	const struct hal_cmd_gatt_server_set_cached_value *cmd = buf;
+	struct attr_cache *cache;
+	uint8_t status;
+
+	DBG("handle 0x%04x mode %u", cmd->attr_handle, cmd->mode);
+
+	if (len != sizeof(*cmd) + cmd->len) {
+		error("gatt: Invalid set cached value size (%u bytes), "
+							"terminating", len);
+		raise(SIGTERM);
+		return;
+	}
+
+	if (!find_app_by_id(cmd->server_if) ||
+			!gatt_db_get_attribute(gatt_db, cmd->attr_handle) ||
+			cmd->len > GATT_MAX_ATTR_LEN ||
+			(cmd->mode == HAL_GATT_CACHE_RESPONSE && cmd->len)) {
+		status = HAL_STATUS_INVALID;
+		goto reply;
+	}
+
+	if (cmd->mode == HAL_GATT_CACHE_DISABLED) {
+		g_hash_table_remove(attr_caches, UINT_TO_PTR(cmd->attr_handle));
+		status = HAL_STATUS_SUCCESS;
+		goto reply;
+	}
+
+	if (cmd->mode != HAL_GATT_CACHE_VALUE &&
+				cmd->mode != HAL_GATT_CACHE_RESPONSE) {
+		status = HAL_STATUS_INVALID;
+		goto reply;
+	}
+
+	cache = new0(struct attr_cache, 1);
+	cache->server_if = cmd->server_if;
+	cache->mode = cmd->mode;
+
+	if (cmd->mode == HAL_GATT_CACHE_VALUE &&
+			!attr_cache_set(cache, cmd->value, cmd->len)) {
+		free(cache);
+		status = HAL_STATUS_NOMEM;
+		goto reply;
+	}
+
+	g_hash_table_replace(attr_caches, UINT_TO_PTR(cmd->attr_handle), cache);
+
+	status = HAL_STATUS_SUCCESS;
+
+reply:
+	ipc_send_rsp(hal_ipc, HAL_SERVICE_ID_GATT,
+			HAL_OP_GATT_SERVER_SET_CACHED_VALUE, status);
+}
+
 static void handle_client_scan_filter_setup(const void *buf, uint16_t len)
 {
 	const struct hal_cmd_gatt_client_scan_filter_setup *cmd = buf;
@@ -6130,6 +6444,9 @@ static const struct ipc_handler cmd_handlers[] = {
 	/* HAL_OP_GATT_CLIENT_READ_BATCHSCAN_REPORTS */
 	{ handle_client_read_batchscan_reports, false,
 		sizeof(struct hal_cmd_gatt_client_read_batchscan_reports) },
+	/* HAL_OP_GATT_SERVER_SET_CACHED_VALUE */
+	{ handle_server_set_cached_value, true,
+		sizeof(struct hal_cmd_gatt_server_set_cached_value) },
 };
 
 static uint8_t read_by_type(const uint8_t *cmd, uint16_t cmd_len,
@@ -7245,6 +7562,11 @@ bool bt_gatt_register(struct ipc *ipc, const bdaddr_t *addr)
 	gatt_devices = queue_new();
 	gatt_apps = queue_new();
 	app_connections = queue_new();
+	devices_by_addr = g_hash_table_new(bdaddr_hash, bdaddr_equal);
+	apps_by_id = g_hash_table_new(NULL, NULL);
+	connections_by_id = g_hash_table_new(NULL, NULL);
+	attr_caches = g_hash_table_new_full(NULL, NULL, NULL,
+							free_attr_cache);
 	listen_apps = queue_new();
 	services_sdp = queue_new();
 	gatt_db = gatt_db_new();
@@ -7289,6 +7611,20 @@ failed:
 	queue_destroy(app_connections, NULL);
 	app_connections = NULL;
 
+	if (devices_by_addr) {
+		g_hash_table_destroy(devices_by_addr);
+		devices_by_addr = NULL;
+
+		g_hash_table_destroy(apps_by_id);
+		apps_by_id = NULL;
+
+		g_hash_table_destroy(connections_by_id);
+		connections_by_id = NULL;
+
+		g_hash_table_destroy(attr_caches);
+		attr_caches = NULL;
+	}
+
 	queue_destroy(listen_apps, NULL);
 	listen_apps = NULL;
 
@@ -7330,6 +7666,18 @@ void bt_gatt_unregister(void)
 	queue_destroy(gatt_devices, destroy_device);
 	gatt_devices = NULL;
 
+	g_hash_table_destroy(devices_by_addr);
+	devices_by_addr = NULL;
+
+	g_hash_table_destroy(apps_by_id);
+	apps_by_id = NULL;
+
+	g_hash_table_destroy(connections_by_id);
+	connections_by_id = NULL;
+
+	g_hash_table_destroy(attr_caches);
+	attr_caches = NULL;
+
 	queue_destroy(services_sdp, free_service_sdp_record);
 	services_sdp = NULL;
 
@@ -380,6 +380,7 @@ static bool sbc_update_qos(void *codec_data, uint8_t op)
 	struct sbc_data *sbc_data = (struct sbc_data *) codec_data;
 	uint8_t curr_bitpool = sbc_data->enc.bitpool;
 	uint8_t new_bitpool = curr_bitpool;
+	uint8_t min_bitpool, max_bitpool;
 
 	switch (op) {
 	case QOS_POLICY_DEFAULT:
@@ -387,10 +388,24 @@ static bool sbc_update_qos(void *codec_data, uint8_t op)
 		break;
 
 	case QOS_POLICY_DECREASE:
-		if (curr_bitpool > SBC_QUALITY_MIN_BITPOOL) {
+		min_bitpool = sbc_data->sbc.min_bitpool;
+		if (min_bitpool < SBC_QUALITY_MIN_BITPOOL)
+			min_bitpool = SBC_QUALITY_MIN_BITPOOL;
+
+		if (curr_bitpool > min_bitpool) {
 			new_bitpool = curr_bitpool - SBC_QUALITY_STEP;
-			if (new_bitpool < SBC_QUALITY_MIN_BITPOOL)
-				new_bitpool = SBC_QUALITY_MIN_BITPOOL;
+			if (new_bitpool < min_bitpool)
+				new_bitpool = min_bitpool;
+		}
+		break;
+
+	case QOS_POLICY_INCREASE:
+		max_bitpool = sbc_data->sbc.max_bitpool;
+
+		if (curr_bitpool < max_bitpool) {
+			new_bitpool = curr_bitpool + SBC_QUALITY_STEP;
+			if (new_bitpool > max_bitpool)
+				new_bitpool = max_bitpool;
 		}
 		break;
 	}
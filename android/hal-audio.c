@@ -15,18 +15,26 @@
  *
  */
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
 #include <errno.h>
 #include <pthread.h>
 #include <poll.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 
+#include <cutils/properties.h>
 #include <hardware/audio.h>
 #include <hardware/hardware.h>
 
@@ -44,6 +52,22 @@
 
 #define MAX_DELAY	100000 /* 100ms */
 
+/*
+ * Link quality is sampled over QOS_WINDOW media packets. A window in which
+ * more than QOS_CONGESTED_MAX packets found the socket congested lowers the
+ * codec quality; QOS_CLEAN_WINDOWS clean windows in a row raise it again.
+ */
+#define QOS_WINDOW		20
+#define QOS_CONGESTED_MAX	(QOS_WINDOW / 4)
+#define QOS_CLEAN_WINDOWS	10
+
+/*
+ * Media packets are encoded ahead and sent in batches of up to MEDIA_BATCH
+ * with a single sendmmsg() per wakeup. The first packet of a batch is sent
+ * on time, the others ahead of time, which the sink buffers absorb.
+ */
+#define MEDIA_BATCH		3
+
 static const uint8_t a2dp_src_uuid[] = {
 		0x00, 0x00, 0x11, 0x0a, 0x00, 0x00, 0x10, 0x00,
 		0x80, 0x00, 0x00, 0x80, 0x5f, 0x9b, 0x34, 0xfb };
@@ -54,6 +78,21 @@ static int audio_sk = -1;
 static pthread_t ipc_th = 0;
 static pthread_mutex_t sk_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+ * Optional tuning of the IPC thread and of the thread writing the stream
+ * so playback survives background load: scheduling policy (a2dpsched set
+ * to fifo or rr) and priority (a2dpprio), CPU affinity (a2dpcpus, a comma
+ * separated list of CPUs) and locking the media packets in memory
+ * (a2dpmlock).
+ */
+static struct {
+	int policy;
+	int priority;
+	bool has_cpus;
+	cpu_set_t cpus;
+	bool mlock;
+} rt_config;
+
 static void timespec_add(struct timespec *base, uint64_t time_us,
 							struct timespec *res)
 {
@@ -109,6 +148,21 @@ static struct {
 
 #define MAX_AUDIO_ENDPOINTS NUM_CODECS
 
+struct pacing_stats {
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t eagain;
+	uint64_t stalls;
+	uint64_t encoded;
+	uint64_t encode_time;
+	uint64_t late;
+	uint64_t dropped;
+	uint64_t resyncs;
+	uint64_t wakeups;
+	uint64_t jitter_sum;
+	uint64_t jitter_max;
+};
+
 struct audio_endpoint {
 	uint8_t id;
 	const struct audio_codec *codec;
@@ -116,13 +170,26 @@ struct audio_endpoint {
 	int fd;
 
 	struct media_packet *mp;
+	size_t mp_size;
 	size_t mp_data_len;
 
+	struct iovec iov[MEDIA_BATCH];
+	struct mmsghdr msg[MEDIA_BATCH];
+	unsigned int batch;
+	uint32_t batch_samples;
+
 	uint16_t seq;
 	uint32_t samples;
 	struct timespec start;
 
 	bool resync;
+
+	int sndbuf;
+	unsigned int qos_packets;
+	unsigned int qos_congested;
+	unsigned int qos_clean;
+
+	struct pacing_stats stats;
 };
 
 static struct audio_endpoint audio_endpoints[MAX_AUDIO_ENDPOINTS];
@@ -482,6 +549,115 @@ static void unregister_endpoints(void)
 	}
 }
 
+static int get_send_buffer_size(int fd)
+{
+	int size;
+	socklen_t optlen = sizeof(size);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, &optlen) < 0) {
+		int err = errno;
+		warn("getsockopt(SO_SNDBUF) failed (%d)", err);
+		return 0;
+	}
+
+	return size;
+}
+
+static void set_send_buffer_size(int fd, int size)
+{
+	if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) < 0) {
+		int err = errno;
+		warn("setsockopt(SO_SNDBUF) failed (%d)", err);
+	}
+}
+
+static void load_rt_config(void)
+{
+	char value[PROPERTY_VALUE_MAX];
+	char *cpu, *saveptr;
+	int min, max;
+
+	memset(&rt_config, 0, sizeof(rt_config));
+	rt_config.policy = SCHED_OTHER;
+
+	if (get_config("a2dpsched", value, NULL) > 0) {
+		if (!strcasecmp(value, "fifo"))
+			rt_config.policy = SCHED_FIFO;
+		else if (!strcasecmp(value, "rr"))
+			rt_config.policy = SCHED_RR;
+	}
+
+	if (rt_config.policy != SCHED_OTHER) {
+		min = sched_get_priority_min(rt_config.policy);
+		max = sched_get_priority_max(rt_config.policy);
+
+		rt_config.priority = min;
+
+		if (get_config("a2dpprio", value, NULL) > 0)
+			rt_config.priority = atoi(value);
+
+		if (rt_config.priority < min)
+			rt_config.priority = min;
+		else if (rt_config.priority > max)
+			rt_config.priority = max;
+	}
+
+	if (get_config("a2dpcpus", value, NULL) > 0) {
+		CPU_ZERO(&rt_config.cpus);
+
+		for (cpu = strtok_r(value, ",", &saveptr); cpu;
+					cpu = strtok_r(NULL, ",", &saveptr)) {
+			int n = atoi(cpu);
+
+			if (n < 0 || n >= CPU_SETSIZE)
+				continue;
+
+			CPU_SET(n, &rt_config.cpus);
+			rt_config.has_cpus = true;
+		}
+	}
+
+	if (get_config("a2dpmlock", value, NULL) > 0)
+		rt_config.mlock = !strcasecmp(value, "true") ||
+							!strcmp(value, "1");
+
+	DBG("policy %d priority %d cpus %s mlock %s", rt_config.policy,
+				rt_config.priority,
+				rt_config.has_cpus ? "set" : "any",
+				rt_config.mlock ? "on" : "off");
+}
+
+/* Applies the configured scheduling to the calling thread */
+static void apply_rt_config(const char *name)
+{
+	struct sched_param param;
+	int err;
+
+	if (rt_config.policy != SCHED_OTHER) {
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = rt_config.priority;
+
+		err = pthread_setschedparam(pthread_self(), rt_config.policy,
+								&param);
+		if (err)
+			warn("audio: Failed to set %s thread priority (%d)",
+								name, err);
+	}
+
+	if (rt_config.has_cpus && sched_setaffinity(0, sizeof(rt_config.cpus),
+							&rt_config.cpus) < 0) {
+		err = errno;
+		warn("audio: Failed to set %s thread affinity (%d)", name,
+									err);
+	}
+}
+
+static struct media_packet *get_mediapacket(struct audio_endpoint *ep,
+							unsigned int index)
+{
+	return (void *) ((uint8_t *) ep->mp + index * ep->mp_size);
+}
+
 static bool open_endpoint(struct audio_endpoint **epp,
 						struct audio_input_config *cfg)
 {
@@ -522,23 +698,51 @@ static bool open_endpoint(struct audio_endpoint **epp,
 
 	ep->fd = fd;
 
+	/*
+	 * Make room for a whole batch in the send buffer, getsockopt() returns
+	 * twice the value set (see man 7 socket).
+	 */
+	ep->sndbuf = get_send_buffer_size(fd);
+	if (ep->sndbuf < 2 * (MEDIA_BATCH + 1) * mtu) {
+		set_send_buffer_size(fd, (MEDIA_BATCH + 1) * mtu);
+		ep->sndbuf = get_send_buffer_size(fd);
+	}
+
+	memset(&ep->stats, 0, sizeof(ep->stats));
+
 	codec = ep->codec;
 	codec->init(preset, payload_len, &ep->codec_data);
 	codec->get_config(ep->codec_data, cfg);
 
-	ep->mp = calloc(mtu, 1);
+	ep->mp = calloc(MEDIA_BATCH, mtu);
 	if (!ep->mp)
 		goto failed;
 
-	if (ep->codec->use_rtp) {
-		struct media_packet_rtp *mp_rtp =
-					(struct media_packet_rtp *) ep->mp;
-		mp_rtp->hdr.v = 2;
-		mp_rtp->hdr.pt = 0x60;
-		mp_rtp->hdr.ssrc = htonl(1);
+	/* Avoid page faults on the write path */
+	if (rt_config.mlock && mlock(ep->mp, MEDIA_BATCH * mtu) < 0) {
+		int err = errno;
+		warn("audio: Failed to lock media packets (%d)", err);
 	}
 
+	ep->mp_size = mtu;
 	ep->mp_data_len = payload_len;
+	ep->batch = 0;
+
+	memset(ep->msg, 0, sizeof(ep->msg));
+
+	for (i = 0; i < MEDIA_BATCH; i++) {
+		ep->iov[i].iov_base = get_mediapacket(ep, i);
+		ep->msg[i].msg_hdr.msg_iov = &ep->iov[i];
+		ep->msg[i].msg_hdr.msg_iovlen = 1;
+
+		if (ep->codec->use_rtp) {
+			struct media_packet_rtp *mp_rtp = ep->iov[i].iov_base;
+
+			mp_rtp->hdr.v = 2;
+			mp_rtp->hdr.pt = 0x60;
+			mp_rtp->hdr.ssrc = htonl(1);
+		}
+	}
 
 	free(preset);
 
@@ -559,6 +763,9 @@ static void close_endpoint(struct audio_endpoint *ep)
 		ep->fd = -1;
 	}
 
+	if (rt_config.mlock && ep->mp)
+		munlock(ep->mp, MEDIA_BATCH * ep->mp_size);
+
 	free(ep->mp);
 
 	ep->codec->cleanup(ep->codec_data);
@@ -573,6 +780,10 @@ static bool resume_endpoint(struct audio_endpoint *ep)
 	ep->samples = 0;
 	ep->resync = false;
 
+	ep->qos_packets = 0;
+	ep->qos_congested = 0;
+	ep->qos_clean = 0;
+
 	ep->codec->update_qos(ep->codec_data, QOS_POLICY_DEFAULT);
 
 	return true;
@@ -624,141 +835,271 @@ static bool wait_for_endpoint(struct audio_endpoint *ep, bool *writable)
 	return true;
 }
 
-static bool write_to_endpoint(struct audio_endpoint *ep, size_t bytes)
+/*
+ * For Bluetooth sockets TIOCOUTQ reports the free space left in the send
+ * buffer, so the socket is considered congested once more than half of
+ * SO_SNDBUF is still waiting to be sent.
+ */
+static bool endpoint_congested(struct audio_endpoint *ep)
 {
-	struct media_packet *mp = (struct media_packet *) ep->mp;
-	int ret;
+	int space;
 
-	while (true) {
-		ret = write(ep->fd, mp, bytes);
+	if (ep->sndbuf <= 0)
+		return false;
 
-		if (ret >= 0)
-			break;
+	if (ioctl(ep->fd, TIOCOUTQ, &space) < 0)
+		return false;
 
-		/*
-		 * this should not happen so let's issue warning, but do not
-		 * fail, we can try to write next packet
-		 */
-		if (errno == EAGAIN) {
-			ret = errno;
-			warn("write failed (%d)", ret);
-			break;
+	return space < ep->sndbuf / 2;
+}
+
+static void update_link_quality(struct audio_endpoint *ep, bool dropped)
+{
+	if (dropped || endpoint_congested(ep))
+		ep->qos_congested++;
+
+	if (++ep->qos_packets < QOS_WINDOW)
+		return;
+
+	if (ep->qos_congested > QOS_CONGESTED_MAX) {
+		ep->codec->update_qos(ep->codec_data, QOS_POLICY_DECREASE);
+		ep->qos_clean = 0;
+	} else if (ep->qos_congested) {
+		ep->qos_clean = 0;
+	} else if (++ep->qos_clean >= QOS_CLEAN_WINDOWS) {
+		ep->codec->update_qos(ep->codec_data, QOS_POLICY_INCREASE);
+		ep->qos_clean = 0;
+	}
+
+	ep->qos_packets = 0;
+	ep->qos_congested = 0;
+}
+
+/*
+ * The socket is almost always writable, so try to send first and only
+ * poll when it is full. Packets that can't be sent before the poll timeout
+ * are dropped.
+ */
+static bool write_to_endpoint(struct audio_endpoint *ep)
+{
+	unsigned int sent = 0;
+	bool writable;
+	int ret;
+
+	while (sent < ep->batch) {
+		ret = sendmmsg(ep->fd, &ep->msg[sent], ep->batch - sent,
+								MSG_DONTWAIT);
+
+		if (ret >= 0) {
+			for (; ret > 0; ret--)
+				ep->stats.bytes += ep->msg[sent++].msg_len;
+			continue;
 		}
 
-		if (errno != EINTR) {
+		if (errno == EINTR)
+			continue;
+
+		if (errno != EAGAIN) {
 			ret = errno;
 			error("write failed (%d)", ret);
 			return false;
 		}
+
+		ep->stats.eagain++;
+
+		/* wait some time for socket to be ready for write,
+		 * but we'll just skip writing data if timeout occurs
+		 */
+		if (!wait_for_endpoint(ep, &writable))
+			return false;
+
+		if (!writable) {
+			ep->stats.stalls++;
+			break;
+		}
 	}
 
+	ep->stats.packets += sent;
+	ep->stats.dropped += ep->batch - sent;
+
+	for (; ep->batch > 0; ep->batch--)
+		update_link_quality(ep, ep->batch > sent);
+
 	return true;
 }
 
+static bool stream_lagging(struct a2dp_stream_out *out)
+{
+	struct audio_endpoint *ep = out->ep;
+	struct timespec current;
+	uint64_t audio_sent, audio_passed;
+
+	clock_gettime(CLOCK_MONOTONIC, &current);
+	audio_sent = ep->samples * 1000000ll / out->cfg.rate;
+	audio_passed = timespec_diff_us(&current, &ep->start);
+
+	return audio_sent <= audio_passed;
+}
+
+/*
+ * Packets are dropped until the stream is back in sync, so there is no
+ * point in encoding them. Returns the number of bytes to skip or 0 if the
+ * packet has to be encoded.
+ */
+static size_t skip_mediapacket(struct a2dp_stream_out *out, size_t len)
+{
+	struct audio_endpoint *ep = out->ep;
+	size_t size;
+
+	if (!ep->resync || !stream_lagging(out))
+		return 0;
+
+	size = ep->codec->get_buffer_size(ep->codec_data);
+
+	return size < len ? size : len;
+}
+
+/* Records how late the thread woke up for a media packet deadline */
+static void update_jitter(struct audio_endpoint *ep, struct timespec *anchor)
+{
+	struct timespec current;
+	uint64_t jitter;
+
+	clock_gettime(CLOCK_MONOTONIC, &current);
+	jitter = timespec_diff_us(&current, anchor);
+
+	ep->stats.wakeups++;
+	ep->stats.jitter_sum += jitter;
+	if (jitter > ep->stats.jitter_max)
+		ep->stats.jitter_max = jitter;
+}
+
+static bool flush_mediapackets(struct a2dp_stream_out *out)
+{
+	struct audio_endpoint *ep = out->ep;
+	struct timespec current;
+	uint64_t audio_sent, audio_passed;
+	int ret;
+
+	/* calculate where are we and where we should be */
+	clock_gettime(CLOCK_MONOTONIC, &current);
+	if (!ep->batch_samples)
+		memcpy(&ep->start, &current, sizeof(ep->start));
+	audio_sent = ep->batch_samples * 1000000ll / out->cfg.rate;
+	audio_passed = timespec_diff_us(&current, &ep->start);
+
+	/*
+	 * if we're ahead of stream then wait for next write point,
+	 * if we're lagging more than 100ms then stop writing and just
+	 * skip data until we're back in sync
+	 */
+	if (audio_sent > audio_passed) {
+		struct timespec anchor;
+
+		ep->resync = false;
+
+		timespec_add(&ep->start, audio_sent, &anchor);
+
+		while (true) {
+			ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+								&anchor, NULL);
+
+			if (!ret) {
+				update_jitter(ep, &anchor);
+				break;
+			}
+
+			if (ret != EINTR) {
+				error("clock_nanosleep failed (%d)", ret);
+				return false;
+			}
+		}
+	} else if (!ep->resync) {
+		uint64_t diff = audio_passed - audio_sent;
+
+		if (diff > ep->codec->get_mediapacket_duration(ep->codec_data))
+			ep->stats.late++;
+
+		if (diff > MAX_DELAY) {
+			warn("lag is %jums, resyncing", diff / 1000);
+
+			ep->codec->update_qos(ep->codec_data,
+							QOS_POLICY_DECREASE);
+			ep->resync = true;
+			ep->qos_clean = 0;
+			ep->stats.resyncs++;
+		}
+	}
+
+	/* in resync mode we'll just drop mediapackets */
+	if (ep->resync) {
+		ep->batch = 0;
+		return true;
+	}
+
+	return write_to_endpoint(ep);
+}
+
 static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 								size_t bytes)
 {
 	struct audio_endpoint *ep = out->ep;
-	struct media_packet *mp = (struct media_packet *) ep->mp;
-	struct media_packet_rtp *mp_rtp = (struct media_packet_rtp *) ep->mp;
-	size_t free_space = ep->mp_data_len;
 	size_t consumed = 0;
 
 	while (consumed < bytes) {
+		struct media_packet *mp = get_mediapacket(ep, ep->batch);
+		struct media_packet_rtp *mp_rtp = (void *) mp;
+		struct timespec start, end;
 		size_t written = 0;
 		ssize_t read;
 		uint32_t samples;
-		int ret;
-		struct timespec current;
-		uint64_t audio_sent, audio_passed;
-		bool do_write = false;
+
+		read = skip_mediapacket(out, bytes - consumed);
+		if (read > 0) {
+			ep->seq++;
+			goto next;
+		}
 
 		/*
-		 * prepare media packet in advance so we don't waste time after
-		 * wakeup
+		 * prepare media packets in advance so we don't waste time
+		 * after wakeup
 		 */
 		if (ep->codec->use_rtp) {
 			mp_rtp->hdr.sequence_number = htons(ep->seq++);
 			mp_rtp->hdr.timestamp = htonl(ep->samples);
 		}
+		clock_gettime(CLOCK_MONOTONIC, &start);
 		read = ep->codec->encode_mediapacket(ep->codec_data,
 						buffer + consumed,
 						bytes - consumed, mp,
-						free_space, &written);
+						ep->mp_data_len, &written);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		ep->stats.encoded++;
+		ep->stats.encode_time += timespec_diff_us(&end, &start);
 
 		/*
 		 * not much we can do here, let's just ignore remaining
 		 * data and continue
 		 */
 		if (read <= 0)
-			return true;
-
-		/* calculate where are we and where we should be */
-		clock_gettime(CLOCK_MONOTONIC, &current);
-		if (!ep->samples)
-			memcpy(&ep->start, &current, sizeof(ep->start));
-		audio_sent = ep->samples * 1000000ll / out->cfg.rate;
-		audio_passed = timespec_diff_us(&current, &ep->start);
-
-		/*
-		 * if we're ahead of stream then wait for next write point,
-		 * if we're lagging more than 100ms then stop writing and just
-		 * skip data until we're back in sync
-		 */
-		if (audio_sent > audio_passed) {
-			struct timespec anchor;
-
-			ep->resync = false;
-
-			timespec_add(&ep->start, audio_sent, &anchor);
-
-			while (true) {
-				ret = clock_nanosleep(CLOCK_MONOTONIC,
-							TIMER_ABSTIME, &anchor,
-							NULL);
-
-				if (!ret)
-					break;
-
-				if (ret != EINTR) {
-					error("clock_nanosleep failed (%d)",
-									ret);
-					return false;
-				}
-			}
-		} else if (!ep->resync) {
-			uint64_t diff = audio_passed - audio_sent;
-
-			if (diff > MAX_DELAY) {
-				warn("lag is %jums, resyncing", diff / 1000);
-
-				ep->codec->update_qos(ep->codec_data,
-							QOS_POLICY_DECREASE);
-				ep->resync = true;
-			}
-		}
+			break;
 
 		/* we send data only in case codec encoded some data, i.e. some
 		 * codecs do internal buffering and output data only if full
 		 * frame can be encoded
-		 * in resync mode we'll just drop mediapackets
 		 */
-		if (written > 0 && !ep->resync) {
-			/* wait some time for socket to be ready for write,
-			 * but we'll just skip writing data if timeout occurs
-			 */
-			if (!wait_for_endpoint(ep, &do_write))
-				return false;
+		if (written > 0) {
+			if (ep->codec->use_rtp)
+				written += sizeof(struct rtp_header);
 
-			if (do_write) {
-				if (ep->codec->use_rtp)
-					written += sizeof(struct rtp_header);
+			if (!ep->batch)
+				ep->batch_samples = ep->samples;
 
-				if (!write_to_endpoint(ep, written))
-					return false;
-			}
+			ep->iov[ep->batch++].iov_len = written;
 		}
 
+next:
 		/*
 		 * AudioFlinger provides 16bit PCM, so sample size is 2 bytes
 		 * multiplied by number of channels. Number of channels is
@@ -767,8 +1108,14 @@ static bool write_data(struct a2dp_stream_out *out, const void *buffer,
 		samples = read / (2 * popcount(out->cfg.channels));
 		ep->samples += samples;
 		consumed += read;
+
+		if (ep->batch == MEDIA_BATCH && !flush_mediapackets(out))
+			return false;
 	}
 
+	if (ep->batch > 0)
+		return flush_mediapackets(out);
+
 	return true;
 }
 
@@ -790,6 +1137,9 @@ static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
 		if (!resume_endpoint(out->ep))
 			return -1;
 
+		/* Writes happen on the thread of the caller */
+		apply_rt_config("write");
+
 		out->audio_state = AUDIO_A2DP_STATE_STARTED;
 	}
 
@@ -910,8 +1260,37 @@ static int out_standby(struct audio_stream *stream)
 
 static int out_dump(const struct audio_stream *stream, int fd)
 {
+	struct a2dp_stream_out *out = (struct a2dp_stream_out *) stream;
+	struct audio_endpoint *ep = out->ep;
+	struct pacing_stats *stats = &ep->stats;
+	int space;
+
 	DBG("");
-	return -ENOSYS;
+
+	dprintf(fd, "A2DP output stream:\n");
+	dprintf(fd, "  packets sent: %ju\n", stats->packets);
+	dprintf(fd, "  bytes sent: %ju\n", stats->bytes);
+	dprintf(fd, "  packets dropped: %ju\n", stats->dropped);
+	dprintf(fd, "  EAGAIN/stalls: %ju/%ju\n", stats->eagain,
+							stats->stalls);
+
+	/* Same TIOCOUTQ semantics as in endpoint_congested() */
+	if (ep->fd >= 0 && ep->sndbuf > 0 &&
+				ioctl(ep->fd, TIOCOUTQ, &space) == 0 &&
+				space < ep->sndbuf)
+		dprintf(fd, "  queued bytes: %d\n", ep->sndbuf - space);
+
+	dprintf(fd, "  late packets: %ju\n", stats->late);
+	dprintf(fd, "  resyncs: %ju\n", stats->resyncs);
+	dprintf(fd, "  wakeup jitter avg/max: %ju/%ju us\n",
+				stats->wakeups ?
+				stats->jitter_sum / stats->wakeups : 0,
+				stats->jitter_max);
+	dprintf(fd, "  encode time avg: %ju us\n",
+				stats->encoded ?
+				stats->encode_time / stats->encoded : 0);
+
+	return 0;
 }
 
 static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
@@ -1441,6 +1820,8 @@ static void *ipc_handler(void *data)
 
 	DBG("");
 
+	apply_rt_config("IPC");
+
 	while (!done) {
 		DBG("Waiting for connection ...");
 
@@ -1569,6 +1950,8 @@ static int audio_open(const hw_module_t *module, const char *name,
 		return -EINVAL;
 	}
 
+	load_rt_config();
+
 	err = audio_ipc_init();
 	if (err < 0)
 		return err;
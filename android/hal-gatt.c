@@ -1992,8 +1992,15 @@ static bt_status_t init(const btgatt_callbacks_t *callbacks)
 
 	cbs = callbacks;
 
-	hal_ipc_register(HAL_SERVICE_ID_GATT, ev_handlers,
-				sizeof(ev_handlers)/sizeof(ev_handlers[0]));
+	/*
+	 * GATT callbacks may be slow and come in bursts, give them their own
+	 * thread so they don't delay notifications of other services.
+	 */
+	if (!hal_ipc_register_threaded(HAL_SERVICE_ID_GATT, ev_handlers,
+				sizeof(ev_handlers)/sizeof(ev_handlers[0]))) {
+		cbs = NULL;
+		return BT_STATUS_NOMEM;
+	}
 
 	cmd.service_id = HAL_SERVICE_ID_GATT;
 	cmd.mode = HAL_MODE_DEFAULT;
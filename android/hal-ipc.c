@@ -19,6 +19,7 @@
 #include <errno.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/mman.h>
 #include <stdbool.h>
 #include <poll.h>
 #include <unistd.h>
@@ -43,13 +44,153 @@ static pthread_mutex_t cmd_sk_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static pthread_t notif_th = 0;
 
+static struct ipc_shm_ring *shm_ring = NULL;
+static uint32_t shm_size = 0;
+
+struct notif_node {
+	struct notif_node *next;
+	const struct hal_ipc_handler *handler;
+	int fd;
+	uint16_t len;
+	uint8_t payload[0];
+};
+
+struct dispatch_queue {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct notif_node *head;
+	struct notif_node *tail;
+	bool quit;
+	bool detached;
+};
+
 struct service_handler {
 	const struct hal_ipc_handler *handler;
 	uint8_t size;
+	struct dispatch_queue *queue;
 };
 
 static struct service_handler services[HAL_SERVICE_ID_MAX + 1];
 
+/* Protects queue pointers against unregister from other threads */
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void queue_free(struct dispatch_queue *queue)
+{
+	struct notif_node *node;
+
+	/* Callbacks must not run once the service is gone, drop the rest */
+	while ((node = queue->head)) {
+		queue->head = node->next;
+
+		if (node->fd >= 0)
+			close(node->fd);
+
+		free(node);
+	}
+
+	pthread_cond_destroy(&queue->cond);
+	pthread_mutex_destroy(&queue->mutex);
+	free(queue);
+}
+
+static void *dispatch_handler(void *data)
+{
+	struct dispatch_queue *queue = data;
+	struct notif_node *node;
+	bool detached;
+
+	bt_thread_associate();
+
+	pthread_mutex_lock(&queue->mutex);
+
+	while (true) {
+		while (!queue->head && !queue->quit)
+			pthread_cond_wait(&queue->cond, &queue->mutex);
+
+		if (queue->quit)
+			break;
+
+		node = queue->head;
+		queue->head = node->next;
+		if (!queue->head)
+			queue->tail = NULL;
+
+		pthread_mutex_unlock(&queue->mutex);
+
+		node->handler->handler(node->payload, node->len, node->fd);
+		free(node);
+
+		pthread_mutex_lock(&queue->mutex);
+	}
+
+	detached = queue->detached;
+
+	pthread_mutex_unlock(&queue->mutex);
+
+	bt_thread_disassociate();
+
+	if (detached)
+		queue_free(queue);
+
+	return NULL;
+}
+
+static bool queue_push(struct dispatch_queue *queue,
+			const struct hal_ipc_handler *handler, void *buf,
+			uint16_t len, int fd)
+{
+	struct notif_node *node;
+
+	node = malloc(sizeof(*node) + len);
+	if (!node) {
+		error("IPC: failed to queue notification");
+		return false;
+	}
+
+	node->next = NULL;
+	node->handler = handler;
+	node->fd = fd;
+	node->len = len;
+	memcpy(node->payload, buf, len);
+
+	pthread_mutex_lock(&queue->mutex);
+
+	if (queue->tail)
+		queue->tail->next = node;
+	else
+		queue->head = node;
+
+	queue->tail = node;
+
+	pthread_cond_signal(&queue->cond);
+	pthread_mutex_unlock(&queue->mutex);
+
+	return true;
+}
+
+static void queue_destroy(struct dispatch_queue *queue)
+{
+	bool self = pthread_equal(queue->thread, pthread_self());
+
+	pthread_mutex_lock(&queue->mutex);
+	queue->quit = true;
+	queue->detached = self;
+	pthread_cond_signal(&queue->cond);
+	pthread_mutex_unlock(&queue->mutex);
+
+	/* Unregister from one of its own callbacks, thread frees on exit */
+	if (self) {
+		pthread_detach(queue->thread);
+		return;
+	}
+
+	pthread_join(queue->thread, NULL);
+
+	queue_free(queue);
+}
+
 void hal_ipc_register(uint8_t service, const struct hal_ipc_handler *handlers,
 								uint8_t size)
 {
@@ -57,10 +198,53 @@ void hal_ipc_register(uint8_t service, const struct hal_ipc_handler *handlers,
 	services[service].size = size;
 }
 
+bool hal_ipc_register_threaded(uint8_t service,
+				const struct hal_ipc_handler *handlers,
+				uint8_t size)
+{
+	struct dispatch_queue *queue;
+	int err;
+
+	queue = calloc(1, sizeof(*queue));
+	if (!queue)
+		return false;
+
+	pthread_mutex_init(&queue->mutex, NULL);
+	pthread_cond_init(&queue->cond, NULL);
+
+	err = pthread_create(&queue->thread, NULL, dispatch_handler, queue);
+	if (err) {
+		error("Failed to start dispatch thread: %d (%s)", err,
+							strerror(err));
+		pthread_cond_destroy(&queue->cond);
+		pthread_mutex_destroy(&queue->mutex);
+		free(queue);
+		return false;
+	}
+
+	pthread_mutex_lock(&queue_mutex);
+	services[service].queue = queue;
+	pthread_mutex_unlock(&queue_mutex);
+
+	hal_ipc_register(service, handlers, size);
+
+	return true;
+}
+
 void hal_ipc_unregister(uint8_t service)
 {
+	struct dispatch_queue *queue;
+
 	services[service].handler = NULL;
 	services[service].size = 0;
+
+	pthread_mutex_lock(&queue_mutex);
+	queue = services[service].queue;
+	services[service].queue = NULL;
+	pthread_mutex_unlock(&queue_mutex);
+
+	if (queue)
+		queue_destroy(queue);
 }
 
 static bool handle_msg(void *buf, ssize_t len, int fd)
@@ -122,20 +306,129 @@ static bool handle_msg(void *buf, ssize_t len, int fd)
 		return false;
 	}
 
+	pthread_mutex_lock(&queue_mutex);
+
+	if (services[msg->service_id].queue) {
+		bool ret;
+
+		ret = queue_push(services[msg->service_id].queue, handler,
+						msg->payload, msg->len, fd);
+		pthread_mutex_unlock(&queue_mutex);
+
+		return ret;
+	}
+
+	pthread_mutex_unlock(&queue_mutex);
+
 	handler->handler(msg->payload, msg->len, fd);
 
 	return true;
 }
 
+static bool handle_batch(void *buf, ssize_t len, int fd)
+{
+	struct ipc_hdr *msg = buf;
+	uint8_t *ptr = msg->payload;
+	uint16_t left;
+
+	if (len != (ssize_t) (sizeof(*msg) + msg->len) || fd >= 0) {
+		error("IPC: batch malformed (%zd bytes)", len);
+		return false;
+	}
+
+	left = msg->len;
+
+	while (left) {
+		struct ipc_hdr *sub = (struct ipc_hdr *) ptr;
+		uint16_t size;
+
+		if (left < sizeof(*sub) || left - sizeof(*sub) < sub->len) {
+			error("IPC: batch truncated (%u bytes left)", left);
+			return false;
+		}
+
+		if (sub->service_id == HAL_SERVICE_ID_CORE &&
+						sub->opcode == IPC_OP_BATCH) {
+			error("IPC: nested batch");
+			return false;
+		}
+
+		size = sizeof(*sub) + sub->len;
+
+		if (!handle_msg(sub, size, -1))
+			return false;
+
+		ptr += size;
+		left -= size;
+	}
+
+	return true;
+}
+
+static bool handle_notif(void *buf, ssize_t len, int fd)
+{
+	struct ipc_hdr *hdr = buf;
+
+	if (len >= (ssize_t) sizeof(*hdr) &&
+				hdr->service_id == HAL_SERVICE_ID_CORE &&
+				hdr->opcode == IPC_OP_BATCH)
+		return handle_batch(buf, len, fd);
+
+	return handle_msg(buf, len, fd);
+}
+
+static bool handle_shm(void *buf, ssize_t len, int fd)
+{
+	struct ipc_hdr *msg = buf;
+	struct ipc_shm_notif *ev = (struct ipc_shm_notif *) msg->payload;
+	struct ipc_hdr *sub;
+	uint32_t off;
+	bool ret;
+
+	if (!shm_ring || fd >= 0 ||
+			len != (ssize_t) (sizeof(*msg) + sizeof(*ev)) ||
+			msg->len != sizeof(*ev)) {
+		error("IPC: shared memory message malformed (%zd bytes)", len);
+		return false;
+	}
+
+	off = ev->pos & (shm_size - 1);
+
+	if (ev->len < sizeof(*sub) || ev->len > shm_size - off) {
+		error("IPC: shared memory message out of range (%u@%u)",
+							ev->len, off);
+		return false;
+	}
+
+	sub = (struct ipc_hdr *) (shm_ring->data + off);
+
+	if (sub->service_id == HAL_SERVICE_ID_CORE &&
+						sub->opcode == IPC_OP_SHM) {
+		error("IPC: nested shared memory message");
+		return false;
+	}
+
+	/* Handlers run directly on the ring, it is released afterwards */
+	ret = handle_notif(sub, ev->len, -1);
+
+	__sync_synchronize();
+
+	shm_ring->tail = ev->pos + ev->len;
+
+	return ret;
+}
+
 static void *notification_handler(void *data)
 {
 	struct msghdr msg;
 	struct iovec iv;
 	struct cmsghdr *cmsg;
 	char cmsgbuf[CMSG_SPACE(sizeof(int))];
-	char buf[IPC_MTU];
+	char buf[IPC_BATCH_MTU];
+	struct ipc_hdr *hdr = (struct ipc_hdr *) buf;
 	ssize_t ret;
 	int fd;
+	bool ok;
 
 	bt_thread_associate();
 
@@ -185,7 +478,14 @@ static void *notification_handler(void *data)
 			}
 		}
 
-		if (!handle_msg(buf, ret, fd))
+		if (ret >= (ssize_t) sizeof(*hdr) &&
+				hdr->service_id == HAL_SERVICE_ID_CORE &&
+				hdr->opcode == IPC_OP_SHM)
+			ok = handle_shm(buf, ret, fd);
+		else
+			ok = handle_notif(buf, ret, fd);
+
+		if (!ok)
 			goto failed;
 	}
 
@@ -234,6 +534,53 @@ static int accept_connection(int sk)
 	return new_sk;
 }
 
+static void shm_setup(void)
+{
+	struct hal_cmd_shm_setup cmd;
+	struct hal_rsp_shm_setup rsp;
+	size_t rsp_len = sizeof(rsp);
+	void *ptr;
+	int status, fd = -1;
+
+	cmd.size = IPC_SHM_SIZE;
+
+	status = hal_ipc_cmd(HAL_SERVICE_ID_CORE, HAL_OP_SHM_SETUP,
+				sizeof(cmd), &cmd, &rsp_len, &rsp, &fd);
+	if (status != BT_STATUS_SUCCESS || fd < 0 ||
+			rsp_len != sizeof(rsp) || rsp.size < IPC_SHM_MIN_SIZE ||
+			rsp.size > IPC_SHM_MAX_SIZE ||
+			(rsp.size & (rsp.size - 1))) {
+		info("IPC: shared memory transport not used");
+		goto done;
+	}
+
+	ptr = mmap(NULL, sizeof(*shm_ring) + rsp.size, PROT_READ | PROT_WRITE,
+							MAP_SHARED, fd, 0);
+	if (ptr == MAP_FAILED) {
+		error("IPC: failed to map shared memory: %s", strerror(errno));
+		goto done;
+	}
+
+	shm_ring = ptr;
+	shm_size = rsp.size;
+
+	info("IPC: shared memory transport (%u bytes)", shm_size);
+
+done:
+	if (fd >= 0)
+		close(fd);
+}
+
+static void shm_cleanup(void)
+{
+	if (!shm_ring)
+		return;
+
+	munmap(shm_ring, sizeof(*shm_ring) + shm_size);
+	shm_ring = NULL;
+	shm_size = 0;
+}
+
 bool hal_ipc_accept(void)
 {
 	int err;
@@ -249,11 +596,15 @@ bool hal_ipc_accept(void)
 		return false;
 	}
 
+	/* Needs to be mapped before notifications may reference it */
+	shm_setup();
+
 	err = pthread_create(&notif_th, NULL, notification_handler, NULL);
 	if (err) {
 		notif_th = 0;
 		error("Failed to start notification thread: %d (%s)", err,
 							strerror(err));
+		shm_cleanup();
 		close(cmd_sk);
 		cmd_sk = -1;
 		close(notif_sk);
@@ -324,6 +675,8 @@ void hal_ipc_cleanup(void)
 
 	pthread_join(notif_th, NULL);
 	notif_th = 0;
+
+	shm_cleanup();
 }
 
 int hal_ipc_cmd(uint8_t service_id, uint8_t opcode, uint16_t len, void *param,
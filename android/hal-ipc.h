@@ -30,4 +30,7 @@ int hal_ipc_cmd(uint8_t service_id, uint8_t opcode, uint16_t len, void *param,
 
 void hal_ipc_register(uint8_t service, const struct hal_ipc_handler *handlers,
 								uint8_t size);
+bool hal_ipc_register_threaded(uint8_t service,
+				const struct hal_ipc_handler *handlers,
+				uint8_t size);
 void hal_ipc_unregister(uint8_t service);
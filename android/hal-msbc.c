@@ -0,0 +1,223 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sbc/sbc.h>
+
+#include "hal-log.h"
+#include "hal-msbc.h"
+
+#define MSBC_SYNC		0xad
+#define MSBC_FRAME_SIZE		57
+#define H2_HDR_SIZE		2
+#define H2_SYNC			0x01
+
+/* Lost frames are replayed with decreasing gain, then muted */
+#define PLC_MAX_FRAMES		4
+
+/* Sequence number bits of the second H2 header byte */
+static const uint8_t h2_seq[] = { 0x08, 0x38, 0xc8, 0xf8 };
+
+struct msbc_codec {
+	sbc_t enc;
+	sbc_t dec;
+	uint8_t seq;
+
+	/* Received data not yet decoded, realigned on H2 headers */
+	uint8_t rx[MSBC_PACKET_SIZE * 2];
+	size_t rx_len;
+	int last_seq;
+
+	int16_t last[MSBC_SAMPLES];
+	unsigned int lost;
+};
+
+struct msbc_codec *msbc_codec_new(void)
+{
+	struct msbc_codec *codec;
+
+	codec = calloc(1, sizeof(*codec));
+	if (!codec)
+		return NULL;
+
+	if (sbc_init_msbc(&codec->enc, 0) < 0) {
+		free(codec);
+		return NULL;
+	}
+
+	if (sbc_init_msbc(&codec->dec, 0) < 0) {
+		sbc_finish(&codec->enc);
+		free(codec);
+		return NULL;
+	}
+
+	codec->enc.endian = SBC_LE;
+	codec->dec.endian = SBC_LE;
+	codec->last_seq = -1;
+
+	return codec;
+}
+
+void msbc_codec_free(struct msbc_codec *codec)
+{
+	if (!codec)
+		return;
+
+	sbc_finish(&codec->enc);
+	sbc_finish(&codec->dec);
+	free(codec);
+}
+
+bool msbc_encode(struct msbc_codec *codec, const int16_t *pcm,
+							uint8_t *packet)
+{
+	ssize_t len, written = 0;
+
+	packet[0] = H2_SYNC;
+	packet[1] = h2_seq[codec->seq];
+	codec->seq = (codec->seq + 1) % sizeof(h2_seq);
+
+	len = sbc_encode(&codec->enc, pcm, MSBC_SAMPLES * sizeof(int16_t),
+				packet + H2_HDR_SIZE, MSBC_FRAME_SIZE,
+				&written);
+	if (len < 0 || written != MSBC_FRAME_SIZE) {
+		error("mSBC: failed to encode frame (%zd)", len);
+		return false;
+	}
+
+	/* Pad to the packet size expected by transparent SCO */
+	memset(packet + H2_HDR_SIZE + MSBC_FRAME_SIZE, 0,
+			MSBC_PACKET_SIZE - H2_HDR_SIZE - MSBC_FRAME_SIZE);
+
+	return true;
+}
+
+static int h2_header_seq(const uint8_t *hdr)
+{
+	size_t i;
+
+	if (hdr[0] != H2_SYNC)
+		return -1;
+
+	for (i = 0; i < sizeof(h2_seq); i++) {
+		if (hdr[1] == h2_seq[i])
+			return i;
+	}
+
+	return -1;
+}
+
+/* Replay the last good frame, halving its gain for every frame lost */
+static void conceal_frame(struct msbc_codec *codec, int16_t *pcm)
+{
+	unsigned int i;
+
+	if (++codec->lost >= PLC_MAX_FRAMES) {
+		memset(pcm, 0, MSBC_SAMPLES * sizeof(int16_t));
+		return;
+	}
+
+	for (i = 0; i < MSBC_SAMPLES; i++)
+		pcm[i] = codec->last[i] >> codec->lost;
+}
+
+static bool decode_frame(struct msbc_codec *codec, const uint8_t *frame,
+								int16_t *pcm)
+{
+	size_t written = 0;
+	ssize_t len;
+
+	len = sbc_decode(&codec->dec, frame, MSBC_FRAME_SIZE, pcm,
+				MSBC_SAMPLES * sizeof(int16_t), &written);
+	if (len < 0 || written != MSBC_SAMPLES * sizeof(int16_t))
+		return false;
+
+	memcpy(codec->last, pcm, sizeof(codec->last));
+	codec->lost = 0;
+
+	return true;
+}
+
+/*
+ * Takes data as read from the SCO socket, which need not be aligned to
+ * packets, and decodes each complete packet as soon as it is available.
+ * Frames missing from the sequence or failing to decode are concealed so
+ * the output stays continuous. Returns the number of samples written.
+ */
+size_t msbc_decode(struct msbc_codec *codec, const uint8_t *data,
+					size_t len, int16_t *pcm, size_t max)
+{
+	size_t samples = 0;
+
+	while (len) {
+		size_t n = sizeof(codec->rx) - codec->rx_len;
+		size_t i;
+
+		if (n > len)
+			n = len;
+
+		memcpy(codec->rx + codec->rx_len, data, n);
+		codec->rx_len += n;
+		data += n;
+		len -= n;
+
+		for (i = 0; i + MSBC_PACKET_SIZE <= codec->rx_len;) {
+			const uint8_t *pkt = codec->rx + i;
+			int seq = h2_header_seq(pkt);
+			int missing;
+
+			if (seq < 0 || pkt[H2_HDR_SIZE] != MSBC_SYNC) {
+				i++;
+				continue;
+			}
+
+			missing = codec->last_seq < 0 ? 0 :
+				(seq - codec->last_seq - 1 + sizeof(h2_seq)) %
+								sizeof(h2_seq);
+			codec->last_seq = seq;
+
+			for (; missing > 0 && samples + MSBC_SAMPLES <= max;
+								missing--) {
+				conceal_frame(codec, pcm + samples);
+				samples += MSBC_SAMPLES;
+			}
+
+			i += MSBC_PACKET_SIZE;
+
+			if (samples + MSBC_SAMPLES > max) {
+				DBG("mSBC: output full, frame dropped");
+				continue;
+			}
+
+			if (!decode_frame(codec, pkt + H2_HDR_SIZE,
+							pcm + samples))
+				conceal_frame(codec, pcm + samples);
+
+			samples += MSBC_SAMPLES;
+		}
+
+		/* Keep what may still be the start of a packet */
+		if (i + MSBC_PACKET_SIZE > codec->rx_len && i < codec->rx_len)
+			memmove(codec->rx, codec->rx + i, codec->rx_len - i);
+
+		codec->rx_len -= i;
+	}
+
+	return samples;
+}
@@ -0,0 +1,31 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#define MSBC_RATE		16000
+#define MSBC_SAMPLES		120	/* 7.5 ms of mono PCM per frame */
+#define MSBC_PACKET_SIZE	60	/* H2 header, SBC frame and padding */
+
+/* Most samples msbc_decode() produces out of one packet worth of data */
+#define MSBC_DECODE_SAMPLES	(MSBC_SAMPLES * 4)
+
+struct msbc_codec;
+
+struct msbc_codec *msbc_codec_new(void);
+void msbc_codec_free(struct msbc_codec *codec);
+
+bool msbc_encode(struct msbc_codec *codec, const int16_t *pcm,
+							uint8_t *packet);
+size_t msbc_decode(struct msbc_codec *codec, const uint8_t *data,
+					size_t len, int16_t *pcm, size_t max);
@@ -95,6 +95,15 @@ struct hal_cmd_configuration {
 	struct hal_config_prop props[0];
 } __attribute__((packed));
 
+#define HAL_OP_SHM_SETUP		0x04
+struct hal_cmd_shm_setup {
+	uint32_t size;
+} __attribute__((packed));
+
+struct hal_rsp_shm_setup {
+	uint32_t size;
+} __attribute__((packed));
+
 /* Bluetooth Core HAL API */
 
 #define HAL_OP_ENABLE			0x01
@@ -1188,6 +1197,19 @@ struct hal_cmd_gatt_client_read_batchscan_reports {
 	int32_t scan_mode;
 } __attribute__((packed));
 
+#define HAL_GATT_CACHE_DISABLED		0x00
+#define HAL_GATT_CACHE_VALUE		0x01
+#define HAL_GATT_CACHE_RESPONSE		0x02
+
+#define HAL_OP_GATT_SERVER_SET_CACHED_VALUE		0x33
+struct hal_cmd_gatt_server_set_cached_value {
+	int32_t server_if;
+	uint16_t attr_handle;
+	uint8_t mode;
+	uint16_t len;
+	uint8_t value[0];
+} __attribute__((packed));
+
 /* Handsfree client HAL API */
 
 #define HAL_OP_HF_CLIENT_CONNECT		0x01
@@ -18,6 +18,8 @@
 #include <errno.h>
 #include <pthread.h>
 #include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,6 +35,7 @@
 #include "sco-msg.h"
 #include "ipc-common.h"
 #include "hal-log.h"
+#include "hal-msbc.h"
 #include "hal.h"
 
 #define AUDIO_STREAM_DEFAULT_RATE	44100
@@ -45,11 +48,22 @@
 
 #define SOCKET_POLL_TIMEOUT_MS		500
 
+/*
+ * The RX jitter buffer holds back this much audio, in ms, on top of what is
+ * being read. It grows by a step on every underrun and shrinks by one after
+ * JB_STABLE_READS reads in a row without one.
+ */
+#define JB_MIN_MS			0
+#define JB_MAX_MS			60
+#define JB_STEP_MS			5
+#define JB_STABLE_READS			200
+
 static int listen_sk = -1;
 static int ipc_sk = -1;
 
 static int sco_fd = -1;
 static uint16_t sco_mtu = 0;
+static uint8_t sco_codec = SCO_CODEC_CVSD;
 static pthread_mutex_t sco_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static pthread_t ipc_th = 0;
@@ -77,9 +91,17 @@ struct sco_stream_out {
 	size_t samples;
 	struct timespec start;
 
+	uint64_t late;		/* Resyncs after falling behind */
+	uint64_t busy;		/* Writes refused by the socket */
+
 	struct resampler_itfe *resampler;
 	int16_t *resample_buf;
 	uint32_t resample_frame_num;
+	uint32_t sco_rate;
+
+	struct msbc_codec *msbc;
+	int16_t msbc_pcm[MSBC_SAMPLES];
+	size_t msbc_len;
 
 	bt_bdaddr_t bd_addr;
 };
@@ -94,8 +116,38 @@ static void sco_close_socket(void)
 	shutdown(sco_fd, SHUT_RDWR);
 	close(sco_fd);
 	sco_fd = -1;
+	sco_codec = SCO_CODEC_CVSD;
+}
+
+/* Wideband speech runs at 16 kHz and is carried as mSBC */
+static uint32_t sco_get_rate(void)
+{
+	if (sco_codec == SCO_CODEC_MSBC)
+		return MSBC_RATE;
+
+	return AUDIO_STREAM_SCO_RATE;
 }
 
+static size_t sco_bytes_to_samples(size_t bytes)
+{
+	if (sco_codec == SCO_CODEC_MSBC)
+		return bytes * MSBC_SAMPLES / MSBC_PACKET_SIZE;
+
+	return bytes / sizeof(int16_t);
+}
+
+struct jitter_buffer {
+	int16_t *data;
+	size_t size;
+	size_t len;
+	size_t target;		/* Samples held back on top of a read */
+	unsigned int stable;
+	bool primed;
+
+	uint64_t underruns;
+	uint64_t overruns;
+};
+
 struct sco_stream_in {
 	struct audio_stream_in stream;
 
@@ -104,6 +156,13 @@ struct sco_stream_in {
 	struct resampler_itfe *resampler;
 	int16_t *resample_buf;
 	uint32_t resample_frame_num;
+	uint32_t sco_rate;
+
+	struct msbc_codec *msbc;
+	int16_t msbc_pcm[MSBC_DECODE_SAMPLES];
+
+	uint8_t *rx_buf;
+	struct jitter_buffer jb;
 
 	bt_bdaddr_t bd_addr;
 };
@@ -302,6 +361,11 @@ static int ipc_get_sco_fd(bt_bdaddr_t *bd_addr)
 
 		/* Sometimes mtu returned is wrong */
 		sco_mtu = /* rsp.mtu */ 48;
+
+		if (ret == SCO_STATUS_SUCCESS && rsp_len == sizeof(rsp))
+			sco_codec = rsp.codec;
+
+		DBG("codec %u", sco_codec);
 	}
 
 	pthread_mutex_unlock(&sco_mutex);
@@ -374,7 +438,7 @@ static bool write_data(struct sco_stream_out *out, const uint8_t *buffer,
 		if (!out->samples)
 			memcpy(&out->start, &now, sizeof(out->start));
 
-		audio_sent_us = out->samples * 1000000ll / AUDIO_STREAM_SCO_RATE;
+		audio_sent_us = out->samples * 1000000ll / sco_get_rate();
 		audio_passed_us = timespec_diff_us(&now, &out->start);
 		if ((int) (audio_sent_us - audio_passed_us) > 1500) {
 			struct timespec timeout = {0,
@@ -385,6 +449,7 @@ static bool write_data(struct sco_stream_out *out, const uint8_t *buffer,
 			nanosleep(&timeout, NULL);
 		} else if ((int)(audio_passed_us - audio_sent_us) > 50000) {
 			DBG("\n\nResync\n\n");
+			out->late++;
 			out->samples = 0;
 			memcpy(&out->start, &now, sizeof(out->start));
 		}
@@ -416,7 +481,7 @@ static bool write_data(struct sco_stream_out *out, const uint8_t *buffer,
 			} else
 				written += ret;
 
-			out->samples += ret / 2;
+			out->samples += sco_bytes_to_samples(ret);
 
 			DBG("written %d samples %zd total %zd bytes",
 					ret, out->samples, written);
@@ -426,6 +491,7 @@ static bool write_data(struct sco_stream_out *out, const uint8_t *buffer,
 		if (errno == EAGAIN) {
 			ret = errno;
 			warn("write failed (%d)", ret);
+			out->busy++;
 			continue;
 		}
 
@@ -442,6 +508,119 @@ static bool write_data(struct sco_stream_out *out, const uint8_t *buffer,
 	return true;
 }
 
+/* Frames are sent as soon as they are complete to stay within one frame */
+static bool write_msbc(struct sco_stream_out *out, const int16_t *pcm,
+							size_t samples)
+{
+	uint8_t packet[MSBC_PACKET_SIZE];
+
+	while (samples) {
+		size_t len = MSBC_SAMPLES - out->msbc_len;
+
+		if (len > samples)
+			len = samples;
+
+		memcpy(out->msbc_pcm + out->msbc_len, pcm,
+						len * sizeof(int16_t));
+		out->msbc_len += len;
+		pcm += len;
+		samples -= len;
+
+		if (out->msbc_len < MSBC_SAMPLES)
+			break;
+
+		out->msbc_len = 0;
+
+		if (!msbc_encode(out->msbc, out->msbc_pcm, packet))
+			continue;
+
+		if (!write_data(out, packet, sizeof(packet)))
+			return false;
+	}
+
+	return true;
+}
+
+static void out_release_resampler(struct sco_stream_out *out)
+{
+	if (out->resampler) {
+		release_resampler(out->resampler);
+		out->resampler = NULL;
+	}
+
+	free(out->resample_buf);
+	out->resample_buf = NULL;
+}
+
+/* The SCO rate depends on the codec, which may only be known on write */
+static int out_setup_codec(struct sco_stream_out *out)
+{
+	size_t resample_size;
+	int chan_num, ret;
+
+	if (sco_codec != SCO_CODEC_MSBC && out->msbc) {
+		msbc_codec_free(out->msbc);
+		out->msbc = NULL;
+	}
+
+	if (sco_codec == SCO_CODEC_MSBC && !out->msbc) {
+		out->msbc = msbc_codec_new();
+		if (!out->msbc) {
+			error("Failed to create mSBC codec");
+			return -ENOMEM;
+		}
+
+		out->msbc_len = 0;
+	}
+
+	if (out->sco_rate == sco_get_rate())
+		return 0;
+
+	out_release_resampler(out);
+
+	out->sco_rate = sco_get_rate();
+
+	if (out->cfg.rate == out->sco_rate)
+		return 0;
+
+	/* Channel numbers for resampler */
+	chan_num = 1;
+
+	ret = create_resampler(out->cfg.rate, out->sco_rate, chan_num,
+						RESAMPLER_QUALITY_VOIP, NULL,
+						&out->resampler);
+	if (ret) {
+		error("Failed to create resampler (%s)", strerror(-ret));
+		return ret;
+	}
+
+	out->resample_frame_num = get_resample_frame_num(out->sco_rate,
+							out->cfg.rate,
+							out->cfg.frame_num, 1);
+
+	if (!out->resample_frame_num) {
+		error("frame num is too small to resample, discard it");
+		out_release_resampler(out);
+		return -EINVAL;
+	}
+
+	resample_size = sizeof(int16_t) * chan_num * out->resample_frame_num;
+
+	out->resample_buf = malloc(resample_size);
+	if (!out->resample_buf) {
+		error("failed to allocate resample buffer for %u frames",
+						out->resample_frame_num);
+		out_release_resampler(out);
+		return -ENOMEM;
+	}
+
+	DBG("Resampler: input %d output %d chan %d frames %u size %zd",
+				out->cfg.rate, out->sco_rate, chan_num,
+				out->resample_frame_num, resample_size);
+
+	return 0;
+}
+
 static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
 								size_t bytes)
 {
@@ -460,6 +639,9 @@ static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
 	if (ipc_get_sco_fd(&out->bd_addr) != SCO_STATUS_SUCCESS)
 		return -1;
 
+	if (out_setup_codec(out) < 0)
+		return -1;
+
 	if (!out->downmix_buf) {
 		error("sco: downmix buffer not initialized");
 		return -1;
@@ -490,6 +672,13 @@ static ssize_t out_write(struct audio_stream_out *stream, const void *buffer,
 						frame_num, output_frame_num);
 	}
 
+	if (out->msbc) {
+		if (!write_msbc(out, send_buf, output_frame_num))
+			return -1;
+
+		return bytes;
+	}
+
 	total = output_frame_num * sizeof(int16_t) * 1;
 
 	DBG("total %zd", total);
@@ -570,9 +759,17 @@ static int out_standby(struct audio_stream *stream)
 
 static int out_dump(const struct audio_stream *stream, int fd)
 {
+	struct sco_stream_out *out = (struct sco_stream_out *) stream;
+
 	DBG("");
 
-	return -ENOSYS;
+	dprintf(fd, "SCO output stream:\n");
+	dprintf(fd, "  codec: %s\n", out->msbc ? "mSBC" : "CVSD");
+	dprintf(fd, "  samples sent: %zu\n", out->samples);
+	dprintf(fd, "  resyncs: %ju\n", out->late);
+	dprintf(fd, "  busy writes: %ju\n", out->busy);
+
+	return 0;
 }
 
 static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
@@ -639,8 +836,7 @@ static int sco_open_output_stream_real(struct audio_hw_device *dev,
 {
 	struct sco_dev *adev = (struct sco_dev *) dev;
 	struct sco_stream_out *out;
-	int chan_num, ret;
-	size_t resample_size;
+	int ret;
 
 	DBG("config %p device flags 0x%02x", config, devices);
 
@@ -712,50 +908,18 @@ static int sco_open_output_stream_real(struct audio_hw_device *dev,
 		return -ENOMEM;
 	}
 
-	if (out->cfg.rate == AUDIO_STREAM_SCO_RATE)
-		goto skip_resampler;
-
-	/* Channel numbers for resampler */
-	chan_num = 1;
-
-	ret = create_resampler(out->cfg.rate, AUDIO_STREAM_SCO_RATE, chan_num,
-						RESAMPLER_QUALITY_DEFAULT, NULL,
-						&out->resampler);
-	if (ret) {
-		error("Failed to create resampler (%s)", strerror(-ret));
-		goto failed;
-	}
-
-	out->resample_frame_num = get_resample_frame_num(AUDIO_STREAM_SCO_RATE,
-							out->cfg.rate,
-							out->cfg.frame_num, 1);
-
-	if (!out->resample_frame_num) {
-		error("frame num is too small to resample, discard it");
+	ret = out_setup_codec(out);
+	if (ret < 0)
 		goto failed;
-	}
 
-	resample_size = sizeof(int16_t) * chan_num * out->resample_frame_num;
-
-	out->resample_buf = malloc(resample_size);
-	if (!out->resample_buf) {
-		error("failed to allocate resample buffer for %u frames",
-						out->resample_frame_num);
-		goto failed;
-	}
-
-	DBG("Resampler: input %d output %d chan %d frames %u size %zd",
-				out->cfg.rate, AUDIO_STREAM_SCO_RATE, chan_num,
-				out->resample_frame_num, resample_size);
-skip_resampler:
 	*stream_out = &out->stream;
 	adev->out = out;
 	sco_stream_out = out;
 
 	return 0;
 failed:
-	if (out->resampler)
-		release_resampler(out->resampler);
+	out_release_resampler(out);
+	msbc_codec_free(out->msbc);
 
 	free(out->cache);
 	free(out->downmix_buf);
@@ -800,10 +964,8 @@ static void sco_close_output_stream(struct audio_hw_device *dev,
 
 	DBG("dev %p stream %p fd %d", dev, out, sco_fd);
 
-	if (out->resampler) {
-		release_resampler(out->resampler);
-		free(out->resample_buf);
-	}
+	out_release_resampler(out);
+	msbc_codec_free(out->msbc);
 
 	free(out->cache);
 	free(out->downmix_buf);
@@ -956,9 +1118,19 @@ static int in_standby(struct audio_stream *stream)
 
 static int in_dump(const struct audio_stream *stream, int fd)
 {
+	struct sco_stream_in *in = (struct sco_stream_in *) stream;
+	struct jitter_buffer *jb = &in->jb;
+
 	DBG("");
 
-	return -ENOSYS;
+	dprintf(fd, "SCO input stream:\n");
+	dprintf(fd, "  codec: %s\n", in->msbc ? "mSBC" : "CVSD");
+	dprintf(fd, "  jitter buffer: %zu samples, target %zu\n", jb->len,
+								jb->target);
+	dprintf(fd, "  underruns: %ju\n", jb->underruns);
+	dprintf(fd, "  overruns: %ju\n", jb->overruns);
+
+	return 0;
 }
 
 static int in_set_parameters(struct audio_stream *stream, const char *kvpairs)
@@ -999,20 +1171,71 @@ static int in_set_gain(struct audio_stream_in *stream, float gain)
 	return -ENOSYS;
 }
 
-static bool read_data(struct sco_stream_in *in, char *buffer, size_t bytes)
+static size_t jb_ms_to_samples(struct sco_stream_in *in, unsigned int ms)
+{
+	return in->sco_rate / 1000 * ms;
+}
+
+static bool jb_push(struct jitter_buffer *jb, const int16_t *pcm,
+							size_t samples)
+{
+	if (jb->len + samples > jb->size) {
+		size_t size = jb->len + samples;
+		int16_t *data;
+
+		data = realloc(jb->data, size * sizeof(int16_t));
+		if (!data)
+			return false;
+
+		jb->data = data;
+		jb->size = size;
+	}
+
+	memcpy(jb->data + jb->len, pcm, samples * sizeof(int16_t));
+	jb->len += samples;
+
+	return true;
+}
+
+static void jb_pop(struct jitter_buffer *jb, int16_t *pcm, size_t samples)
+{
+	if (pcm)
+		memcpy(pcm, jb->data, samples * sizeof(int16_t));
+
+	jb->len -= samples;
+	memmove(jb->data, jb->data + samples, jb->len * sizeof(int16_t));
+}
+
+static void jb_reset(struct jitter_buffer *jb)
+{
+	free(jb->data);
+	memset(jb, 0, sizeof(*jb));
+}
+
+/*
+ * Reads one SCO packet into the jitter buffer. Without wait only data the
+ * controller already delivered is taken.
+ */
+static bool read_packet(struct sco_stream_in *in, bool wait)
 {
 	struct pollfd pfd;
-	size_t len, read_bytes = 0;
+	int ret;
 
 	pfd.fd = sco_fd;
 	pfd.events = POLLIN | POLLHUP | POLLNVAL;
 
-	while (bytes > read_bytes) {
-		int ret;
-
+	while (1) {
 		/* poll for reading */
-		if (poll(&pfd, 1, SOCKET_POLL_TIMEOUT_MS) == 0) {
-			DBG("timeout fd %d", sco_fd);
+		ret = poll(&pfd, 1, wait ? SOCKET_POLL_TIMEOUT_MS : 0);
+		if (ret == 0) {
+			if (wait)
+				DBG("timeout fd %d", sco_fd);
+			return false;
+		}
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
 			return false;
 		}
 
@@ -1021,15 +1244,9 @@ static bool read_data(struct sco_stream_in *in, char *buffer, size_t bytes)
 			return false;
 		}
 
-		len = bytes - read_bytes > sco_mtu ? sco_mtu :
-							bytes - read_bytes;
-
-		ret = read(sco_fd, buffer + read_bytes, len);
-		if (ret > 0) {
-			read_bytes += ret;
-			DBG("read %d total %zd", ret, read_bytes);
-			continue;
-		}
+		ret = read(sco_fd, in->rx_buf, sco_mtu);
+		if (ret > 0)
+			break;
 
 		if (errno == EAGAIN) {
 			ret = errno;
@@ -1039,17 +1256,164 @@ static bool read_data(struct sco_stream_in *in, char *buffer, size_t bytes)
 
 		if (errno != EINTR) {
 			ret = errno;
-			error("read failed (%d) fd %d bytes %zd", ret, sco_fd,
-									bytes);
+			error("read failed (%d) fd %d", ret, sco_fd);
 			return false;
 		}
 	}
 
-	DBG("read %zd bytes", read_bytes);
+	if (in->msbc) {
+		size_t samples;
+
+		samples = msbc_decode(in->msbc, in->rx_buf, ret, in->msbc_pcm,
+							MSBC_DECODE_SAMPLES);
+
+		return jb_push(&in->jb, in->msbc_pcm, samples);
+	}
+
+	return jb_push(&in->jb, (int16_t *) in->rx_buf, ret / sizeof(int16_t));
+}
+
+static bool read_data(struct sco_stream_in *in, int16_t *pcm, size_t samples)
+{
+	struct jitter_buffer *jb = &in->jb;
+	size_t step = jb_ms_to_samples(in, JB_STEP_MS);
+	size_t limit;
+
+	/* Take whatever already arrived so bursts are absorbed */
+	while (read_packet(in, false))
+		;
+
+	if (jb->len < samples) {
+		if (jb->primed) {
+			jb->underruns++;
+
+			if (jb->target + step <= jb_ms_to_samples(in,
+								JB_MAX_MS))
+				jb->target += step;
+
+			DBG("underrun, target %zu samples", jb->target);
+		}
+
+		/* (Re)build the cushion before handing out audio */
+		while (jb->len < samples + jb->target) {
+			if (!read_packet(in, true))
+				return false;
+		}
+
+		jb->primed = true;
+		jb->stable = 0;
+	} else if (++jb->stable >= JB_STABLE_READS) {
+		if (jb->target >= jb_ms_to_samples(in, JB_MIN_MS) + step)
+			jb->target -= step;
+
+		jb->stable = 0;
+	}
+
+	/* Drop the oldest audio when a burst would add to the latency */
+	limit = samples + 2 * (jb->target > step ? jb->target : step);
+	if (jb->len > limit) {
+		jb->overruns++;
+		jb_pop(jb, NULL, jb->len - samples - jb->target);
+	}
+
+	jb_pop(jb, pcm, samples);
+
+	DBG("read %zu samples, %zu buffered", samples, jb->len);
 
 	return true;
 }
 
+static void in_release_codec(struct sco_stream_in *in)
+{
+	msbc_codec_free(in->msbc);
+	in->msbc = NULL;
+
+	free(in->rx_buf);
+	in->rx_buf = NULL;
+
+	jb_reset(&in->jb);
+}
+
+static void in_release_resampler(struct sco_stream_in *in)
+{
+	if (in->resampler) {
+		release_resampler(in->resampler);
+		in->resampler = NULL;
+	}
+
+	free(in->resample_buf);
+	in->resample_buf = NULL;
+}
+
+/* The SCO rate depends on the codec, which may only be known on read */
+static int in_setup_codec(struct sco_stream_in *in)
+{
+	size_t resample_size;
+	int chan_num, ret;
+
+	if (sco_codec != SCO_CODEC_MSBC && in->msbc)
+		in_release_codec(in);
+
+	if (!in->rx_buf && sco_mtu) {
+		in->rx_buf = malloc(sco_mtu);
+		if (!in->rx_buf)
+			return -ENOMEM;
+	}
+
+	if (sco_codec == SCO_CODEC_MSBC && !in->msbc) {
+		in->msbc = msbc_codec_new();
+		if (!in->msbc) {
+			error("Failed to create mSBC codec");
+			in_release_codec(in);
+			return -ENOMEM;
+		}
+
+		jb_reset(&in->jb);
+	}
+
+	if (in->sco_rate == sco_get_rate())
+		return 0;
+
+	in_release_resampler(in);
+	jb_reset(&in->jb);
+
+	in->sco_rate = sco_get_rate();
+
+	if (in->cfg.rate == in->sco_rate)
+		return 0;
+
+	/* Channel numbers for resampler */
+	chan_num = 1;
+
+	ret = create_resampler(in->sco_rate, in->cfg.rate, chan_num,
+						RESAMPLER_QUALITY_VOIP, NULL,
+						&in->resampler);
+	if (ret) {
+		error("Failed to create resampler (%s)", strerror(-ret));
+		return ret;
+	}
+
+	in->resample_frame_num = get_resample_frame_num(in->sco_rate,
+							in->cfg.rate,
+							in->cfg.frame_num, 0);
+
+	resample_size = sizeof(int16_t) * chan_num * in->resample_frame_num;
+
+	in->resample_buf = malloc(resample_size);
+	if (!in->resample_buf) {
+		error("failed to allocate resample buffer for %d frames",
+							in->resample_frame_num);
+		in_release_resampler(in);
+		return -ENOMEM;
+	}
+
+	DBG("Resampler: input %d output %d chan %d frames %u size %zd",
+				in->sco_rate, in->cfg.rate, chan_num,
+				in->resample_frame_num, resample_size);
+
+	return 0;
+}
+
 static ssize_t in_read(struct audio_stream_in *stream, void *buffer,
 								size_t bytes)
 {
@@ -1076,13 +1440,16 @@ static ssize_t in_read(struct audio_stream_in *stream, void *buffer,
 	if (ipc_get_sco_fd(&in->bd_addr) != SCO_STATUS_SUCCESS)
 		return -1;
 
-	if (!in->resampler && in->cfg.rate != AUDIO_STREAM_SCO_RATE) {
+	if (in_setup_codec(in) < 0)
+		return -1;
+
+	if (!in->resampler && in->cfg.rate != in->sco_rate) {
 		error("Cannot find resampler");
 		return -1;
 	}
 
 	if (in->resampler) {
-		input_frame_num = get_resample_frame_num(AUDIO_STREAM_SCO_RATE,
+		input_frame_num = get_resample_frame_num(in->sco_rate,
 							in->cfg.rate,
 							frame_num, 0);
 		if (input_frame_num > in->resample_frame_num) {
@@ -1096,7 +1463,7 @@ static ssize_t in_read(struct audio_stream_in *stream, void *buffer,
 		total = input_frame_num * sizeof(int16_t) * 1;
 	}
 
-	if(!read_data(in, read_buf, total))
+	if (!read_data(in, read_buf, total / sizeof(int16_t)))
 		return -1;
 
 	if (in->resampler) {
@@ -1137,8 +1504,7 @@ static int sco_open_input_stream_real(struct audio_hw_device *dev,
 {
 	struct sco_dev *sco_dev = (struct sco_dev *) dev;
 	struct sco_stream_in *in;
-	int chan_num, ret;
-	size_t resample_size;
+	int ret;
 
 	DBG("config %p device flags 0x%02x", config, devices);
 
@@ -1194,45 +1560,18 @@ static int sco_open_input_stream_real(struct audio_hw_device *dev,
 
 	in->cfg.frame_num = IN_STREAM_FRAMES;
 
-	if (in->cfg.rate == AUDIO_STREAM_SCO_RATE)
-		goto skip_resampler;
-
-	/* Channel numbers for resampler */
-	chan_num = 1;
-
-	ret = create_resampler(AUDIO_STREAM_SCO_RATE, in->cfg.rate, chan_num,
-						RESAMPLER_QUALITY_DEFAULT, NULL,
-						&in->resampler);
-	if (ret) {
-		error("Failed to create resampler (%s)", strerror(-ret));
+	ret = in_setup_codec(in);
+	if (ret < 0)
 		goto failed;
-	}
 
-	in->resample_frame_num = get_resample_frame_num(AUDIO_STREAM_SCO_RATE,
-							in->cfg.rate,
-							in->cfg.frame_num, 0);
-
-	resample_size = sizeof(int16_t) * chan_num * in->resample_frame_num;
-
-	in->resample_buf = malloc(resample_size);
-	if (!in->resample_buf) {
-		error("failed to allocate resample buffer for %d frames",
-							in->resample_frame_num);
-		goto failed;
-	}
-
-	DBG("Resampler: input %d output %d chan %d frames %u size %zd",
-				AUDIO_STREAM_SCO_RATE, in->cfg.rate, chan_num,
-				in->resample_frame_num, resample_size);
-skip_resampler:
 	*stream_in = &in->stream;
 	sco_dev->in = in;
 	sco_stream_in = in;
 
 	return 0;
 failed:
-	if (in->resampler)
-		release_resampler(in->resampler);
+	in_release_resampler(in);
+	in_release_codec(in);
 	free(in);
 failed2:
 	*stream_in = NULL;
@@ -1276,10 +1615,8 @@ static void sco_close_input_stream(struct audio_hw_device *dev,
 
 	DBG("dev %p stream %p fd %d", dev, in, sco_fd);
 
-	if (in->resampler) {
-		release_resampler(in->resampler);
-		free(in->resample_buf);
-	}
+	in_release_resampler(in);
+	in_release_codec(in);
 
 	free(in);
 	sco_dev->in = NULL;
@@ -131,6 +131,7 @@ struct hf_device {
 
 	uint8_t negotiated_codec;
 	uint8_t proposed_codec;
+	uint8_t sco_codec;
 	struct hfp_codec codecs[CODECS_COUNT];
 
 	guint ring;
@@ -988,10 +989,13 @@ static bool connect_sco(struct hf_device *dev)
 	uint16_t voice_settings;
 
 	if (codec_negotiation_supported(dev) &&
-			dev->negotiated_codec != CODEC_ID_CVSD)
+			dev->negotiated_codec != CODEC_ID_CVSD) {
 		voice_settings = BT_VOICE_TRANSPARENT;
-	else
+		dev->sco_codec = SCO_CODEC_MSBC;
+	} else {
 		voice_settings = BT_VOICE_CVSD_16BIT;
+		dev->sco_codec = SCO_CODEC_CVSD;
+	}
 
 	if (!bt_sco_connect(sco, &dev->bdaddr, voice_settings))
 		return false;
@@ -2699,6 +2703,7 @@ static bool confirm_sco_cb(const bdaddr_t *addr, uint16_t *voice_settings)
 
 	/* If HF initiate SCO there must be no WBS used */
 	*voice_settings = 0;
+	dev->sco_codec = SCO_CODEC_CVSD;
 
 	set_audio_state(dev, HAL_EV_HANDSFREE_AUDIO_STATE_CONNECTING);
 	return true;
@@ -2913,7 +2918,10 @@ static void bt_sco_get_fd(const void *buf, uint16_t len)
 	if (!dev || !bt_sco_get_fd_and_mtu(sco, &fd, &rsp.mtu))
 		goto failed;
 
-	DBG("fd %d mtu %u", fd, rsp.mtu);
+	/* Transparent data is mSBC encoded by the audio HAL */
+	rsp.codec = dev->sco_codec;
+
+	DBG("fd %d mtu %u codec %u", fd, rsp.mtu, rsp.codec);
 
 	ipc_send_rsp_full(sco_ipc, SCO_SERVICE_ID, SCO_OP_GET_FD,
 							sizeof(rsp), &rsp, fd);
@@ -23,6 +23,9 @@
 
 #define IPC_MTU 1024
 
+/* Upper bound of a batched notification including its own header */
+#define IPC_BATCH_MTU (IPC_MTU * 8)
+
 #define IPC_STATUS_SUCCESS	0x00
 
 struct ipc_hdr {
@@ -36,3 +39,24 @@ struct ipc_hdr {
 struct ipc_status {
 	uint8_t code;
 } __attribute__((packed));
+
+/* Sent on service 0, payload is a sequence of complete ipc_hdr messages */
+#define IPC_OP_BATCH		0x81
+
+/* Shared memory ring, data size is a power of two between these bounds */
+#define IPC_SHM_MIN_SIZE	IPC_BATCH_MTU
+#define IPC_SHM_MAX_SIZE	(1024 * 1024)
+#define IPC_SHM_SIZE		(64 * 1024)
+
+struct ipc_shm_ring {
+	uint32_t tail;
+	uint32_t size;
+	uint8_t  data[0];
+} __attribute__((packed));
+
+/* Sent on service 0, signals a complete ipc_hdr message placed in the ring */
+#define IPC_OP_SHM		0x83
+struct ipc_shm_notif {
+	uint32_t pos;
+	uint32_t len;
+} __attribute__((packed));
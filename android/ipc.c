@@ -33,6 +33,8 @@
 #include <stdbool.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <glib.h>
 
@@ -59,12 +61,34 @@ struct ipc {
 	GIOChannel *notif_io;
 	guint notif_watch;
 
+	uint8_t *batch;
+	uint16_t batch_len;
+	unsigned int batch_count;
+	guint batch_id;
+
+	struct ipc_shm_ring *shm;
+	uint32_t shm_size;
+	uint32_t shm_head;
+
 	ipc_disconnect_cb disconnect_cb;
 	void *disconnect_cb_data;
 };
 
 static void ipc_disconnect(struct ipc *ipc, bool in_cleanup)
 {
+	if (ipc->batch_id) {
+		g_source_remove(ipc->batch_id);
+		ipc->batch_id = 0;
+	}
+
+	ipc->batch_len = 0;
+	ipc->batch_count = 0;
+
+	if (ipc->shm) {
+		munmap(ipc->shm, sizeof(*ipc->shm) + ipc->shm_size);
+		ipc->shm = NULL;
+	}
+
 	if (ipc->cmd_watch) {
 		g_source_remove(ipc->cmd_watch);
 		ipc->cmd_watch = 0;
@@ -325,6 +349,7 @@ void ipc_cleanup(struct ipc *ipc)
 {
 	ipc_disconnect(ipc, true);
 
+	g_free(ipc->batch);
 	g_free(ipc->services);
 	g_free(ipc);
 }
@@ -407,14 +432,209 @@ void ipc_send_notif(struct ipc *ipc, uint8_t service_id, uint8_t opcode,
 	return ipc_send_notif_with_fd(ipc, service_id, opcode, len, param, -1);
 }
 
+/* Below this the signaling message costs about as much as the copy */
+#define IPC_SHM_THRESHOLD	128
+
+int ipc_shm_setup(struct ipc *ipc, uint32_t *size)
+{
+	struct ipc_shm_ring *ring;
+	uint32_t len;
+	int fd, err;
+
+	if (!ipc->notif_io)
+		return -ENOTCONN;
+
+	if (ipc->shm)
+		return -EALREADY;
+
+	/* Free running positions need a power of two ring to stay valid */
+	for (len = IPC_SHM_MIN_SIZE; len < *size && len < IPC_SHM_MAX_SIZE;)
+		len <<= 1;
+
+#ifdef __NR_memfd_create
+	fd = syscall(__NR_memfd_create, "bluetoothd-ipc", 0);
+#else
+	fd = -1;
+	errno = ENOSYS;
+#endif
+	if (fd < 0)
+		return -errno;
+
+	if (ftruncate(fd, sizeof(*ring) + len) < 0)
+		goto failed;
+
+	ring = mmap(NULL, sizeof(*ring) + len, PROT_READ | PROT_WRITE,
+							MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED)
+		goto failed;
+
+	ring->tail = 0;
+	ring->size = len;
+
+	ipc->shm = ring;
+	ipc->shm_size = len;
+	ipc->shm_head = 0;
+
+	*size = len;
+
+	return fd;
+
+failed:
+	err = errno;
+	close(fd);
+	return -err;
+}
+
+static bool ipc_shm_send(struct ipc *ipc, uint8_t service_id, uint8_t opcode,
+						uint16_t len, void *param)
+{
+	struct ipc_shm_ring *ring = ipc->shm;
+	struct ipc_shm_notif ev;
+	struct ipc_hdr *hdr;
+	uint32_t size = sizeof(*hdr) + len;
+	uint32_t off, skip = 0;
+
+	/* Pairs with the barrier before the HAL releases a message */
+	__sync_synchronize();
+
+	off = ipc->shm_head & (ipc->shm_size - 1);
+
+	/* Messages are never split, the gap is released with the next one */
+	if (off + size > ipc->shm_size)
+		skip = ipc->shm_size - off;
+
+	if (ipc->shm_head - ring->tail + skip + size > ipc->shm_size)
+		return false;
+
+	ipc->shm_head += skip;
+	off = ipc->shm_head & (ipc->shm_size - 1);
+
+	hdr = (struct ipc_hdr *) (ring->data + off);
+	hdr->service_id = service_id;
+	hdr->opcode = opcode;
+	hdr->len = len;
+	memcpy(hdr->payload, param, len);
+
+	ev.pos = ipc->shm_head;
+	ev.len = size;
+
+	ipc->shm_head += size;
+
+	/* Message must be visible before the HAL is told about it */
+	__sync_synchronize();
+
+	ipc_send(g_io_channel_unix_get_fd(ipc->notif_io), 0, IPC_OP_SHM,
+							sizeof(ev), &ev, -1);
+
+	return true;
+}
+
+static void ipc_send_notif_msg(struct ipc *ipc, uint8_t service_id,
+				uint8_t opcode, uint16_t len, void *param,
+				int fd)
+{
+	/* Ring full falls back to the socket, ordering is kept either way */
+	if (ipc->shm && fd < 0 && len >= IPC_SHM_THRESHOLD &&
+			ipc_shm_send(ipc, service_id, opcode, len, param))
+		return;
+
+	ipc_send(g_io_channel_unix_get_fd(ipc->notif_io), service_id, opcode,
+								len, param, fd);
+}
+
+static void ipc_batch_flush(struct ipc *ipc)
+{
+	struct ipc_hdr *hdr = (struct ipc_hdr *) ipc->batch;
+
+	if (ipc->batch_id) {
+		g_source_remove(ipc->batch_id);
+		ipc->batch_id = 0;
+	}
+
+	if (!ipc->batch_count)
+		return;
+
+	/* Don't pay for the extra header if there is nothing to coalesce */
+	if (ipc->batch_count == 1)
+		ipc_send_notif_msg(ipc, hdr->service_id, hdr->opcode, hdr->len,
+							hdr->payload, -1);
+	else
+		ipc_send_notif_msg(ipc, 0, IPC_OP_BATCH, ipc->batch_len,
+							ipc->batch, -1);
+
+	ipc->batch_len = 0;
+	ipc->batch_count = 0;
+}
+
+static gboolean batch_flush_cb(gpointer user_data)
+{
+	struct ipc *ipc = user_data;
+
+	ipc->batch_id = 0;
+
+	ipc_batch_flush(ipc);
+
+	return FALSE;
+}
+
+void ipc_flush_notif(struct ipc *ipc)
+{
+	if (!ipc || !ipc->notif_io)
+		return;
+
+	ipc_batch_flush(ipc);
+}
+
+void ipc_send_notif_batched(struct ipc *ipc, uint8_t service_id,
+					uint8_t opcode, uint16_t len, void *param)
+{
+	const size_t max = IPC_BATCH_MTU - sizeof(struct ipc_hdr);
+	struct ipc_hdr *hdr;
+	size_t size;
+
+	if (!ipc || !ipc->notif_io)
+		return;
+
+	size = sizeof(*hdr) + len;
+	if (size > max) {
+		ipc_send_notif(ipc, service_id, opcode, len, param);
+		return;
+	}
+
+	if (ipc->batch_len + size > max)
+		ipc_batch_flush(ipc);
+
+	if (!ipc->batch)
+		ipc->batch = g_malloc(max);
+
+	hdr = (struct ipc_hdr *) (ipc->batch + ipc->batch_len);
+	hdr->service_id = service_id;
+	hdr->opcode = opcode;
+	hdr->len = len;
+	if (len)
+		memcpy(hdr->payload, param, len);
+
+	ipc->batch_len += size;
+	ipc->batch_count++;
+
+	/*
+	 * Idle sources only run once no other events are pending, so a burst
+	 * handled within one mainloop iteration ends up in a single write.
+	 */
+	if (!ipc->batch_id)
+		ipc->batch_id = g_idle_add(batch_flush_cb, ipc);
+}
+
 void ipc_send_notif_with_fd(struct ipc *ipc, uint8_t service_id, uint8_t opcode,
 					uint16_t len, void *param, int fd)
 {
 	if (!ipc || !ipc->notif_io)
 		return;
 
-	ipc_send(g_io_channel_unix_get_fd(ipc->notif_io), service_id, opcode,
-								len, param, fd);
+	/* Keep notifications in order with respect to pending batched ones */
+	ipc_batch_flush(ipc);
+
+	ipc_send_notif_msg(ipc, service_id, opcode, len, param, fd);
 }
 
 void ipc_register(struct ipc *ipc, uint8_t service,
@@ -36,12 +36,17 @@ struct ipc *ipc_init(const char *path, size_t size, int max_service_id,
 					ipc_disconnect_cb cb, void *cb_data);
 void ipc_cleanup(struct ipc *ipc);
 
+int ipc_shm_setup(struct ipc *ipc, uint32_t *size);
+
 void ipc_send_rsp(struct ipc *ipc, uint8_t service_id, uint8_t opcode,
 								uint8_t status);
 void ipc_send_rsp_full(struct ipc *ipc, uint8_t service_id, uint8_t opcode,
 					uint16_t len, void *param, int fd);
 void ipc_send_notif(struct ipc *ipc, uint8_t service_id, uint8_t opcode,
 						uint16_t len, void *param);
+void ipc_send_notif_batched(struct ipc *ipc, uint8_t service_id,
+					uint8_t opcode, uint16_t len, void *param);
+void ipc_flush_notif(struct ipc *ipc);
 void ipc_send_notif_with_fd(struct ipc *ipc, uint8_t service_id, uint8_t opcode,
 					uint16_t len, void *param, int fd);
 
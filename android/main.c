@@ -473,6 +473,31 @@ static void configuration(const void *buf, uint16_t len)
 							HAL_STATUS_SUCCESS);
 }
 
+static void shm_setup(const void *buf, uint16_t len)
+{
+	const struct hal_cmd_shm_setup *cmd = buf;
+	struct hal_rsp_shm_setup rsp;
+	int fd;
+
+	rsp.size = cmd->size;
+
+	fd = ipc_shm_setup(hal_ipc, &rsp.size);
+	if (fd < 0) {
+		info("Shared memory transport unavailable: %s",
+							strerror(-fd));
+		ipc_send_rsp(hal_ipc, HAL_SERVICE_ID_CORE, HAL_OP_SHM_SETUP,
+							HAL_STATUS_UNSUPPORTED);
+		return;
+	}
+
+	DBG("size %u", rsp.size);
+
+	ipc_send_rsp_full(hal_ipc, HAL_SERVICE_ID_CORE, HAL_OP_SHM_SETUP,
+							sizeof(rsp), &rsp, fd);
+
+	close(fd);
+}
+
 static const struct ipc_handler cmd_handlers[] = {
 	/* HAL_OP_REGISTER_MODULE */
 	{ service_register, false, sizeof(struct hal_cmd_register_module) },
@@ -480,6 +505,8 @@ static const struct ipc_handler cmd_handlers[] = {
 	{ service_unregister, false, sizeof(struct hal_cmd_unregister_module) },
 	/* HAL_OP_CONFIGURATION */
 	{ configuration, true, sizeof(struct hal_cmd_configuration) },
+	/* HAL_OP_SHM_SETUP */
+	{ shm_setup, false, sizeof(struct hal_cmd_shm_setup) },
 };
 
 static void bluetooth_stopped(void)
@@ -35,6 +35,10 @@ struct sco_cmd_get_fd {
 	uint8_t bdaddr[6];
 } __attribute__((packed));
 
+#define SCO_CODEC_CVSD			0x01
+#define SCO_CODEC_MSBC			0x02
+
 struct sco_rsp_get_fd {
 	uint16_t mtu;
+	uint8_t codec;
 } __attribute__((packed));
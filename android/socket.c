@@ -29,6 +29,7 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #include "lib/bluetooth.h"
 #include "btio/btio.h"
@@ -80,6 +81,12 @@ struct rfcomm_sock {
 
 	uint8_t *buf;
 	int buf_size;
+
+	/* Kernel side forwarding, falls back to buf per direction */
+	int pipe_fd[2];
+	int pipe_size;
+	bool bt_splice;
+	bool jv_splice;
 };
 
 struct rfcomm_channel {
@@ -102,6 +109,35 @@ static uint32_t test_sdp_record_uuid16 = 0;
 static uint32_t test_sdp_record_uuid32 = 0;
 static uint32_t test_sdp_record_uuid128 = 0;
 
+static void rfsock_set_pipe(struct rfcomm_sock *rfsock)
+{
+	if (pipe2(rfsock->pipe_fd, O_CLOEXEC) < 0) {
+		error("pipe2(): %s, using copy path", strerror(errno));
+		rfsock->pipe_fd[0] = -1;
+		rfsock->pipe_fd[1] = -1;
+		return;
+	}
+
+	rfsock->pipe_size = rfsock->buf_size;
+
+#ifdef F_SETPIPE_SZ
+	if (fcntl(rfsock->pipe_fd[1], F_SETPIPE_SZ, rfsock->pipe_size) < 0)
+		DBG("F_SETPIPE_SZ: %s", strerror(errno));
+
+	rfsock->pipe_size = fcntl(rfsock->pipe_fd[1], F_GETPIPE_SZ);
+	if (rfsock->pipe_size <= 0)
+		rfsock->pipe_size = MIN(rfsock->buf_size, 4096);
+
+	rfsock->pipe_size = MIN(rfsock->pipe_size, rfsock->buf_size);
+#else
+	/* One page always fits into an empty pipe */
+	rfsock->pipe_size = MIN(rfsock->buf_size, 4096);
+#endif
+
+	rfsock->bt_splice = true;
+	rfsock->jv_splice = true;
+}
+
 static int rfsock_set_buffer(struct rfcomm_sock *rfsock)
 {
 	socklen_t len = sizeof(int);
@@ -128,6 +164,8 @@ static int rfsock_set_buffer(struct rfcomm_sock *rfsock)
 	rfsock->buf = g_malloc(size);
 	rfsock->buf_size = size;
 
+	rfsock_set_pipe(rfsock);
+
 	return 0;
 }
 
@@ -162,6 +200,12 @@ static void cleanup_rfsock(gpointer data)
 	if (rfsock->buf)
 		g_free(rfsock->buf);
 
+	if (rfsock->pipe_fd[0] >= 0)
+		close(rfsock->pipe_fd[0]);
+
+	if (rfsock->pipe_fd[1] >= 0)
+		close(rfsock->pipe_fd[1]);
+
 	g_free(rfsock);
 }
 
@@ -180,6 +224,8 @@ static struct rfcomm_sock *create_rfsock(int bt_sock, int *hal_sock)
 	rfsock->jv_sock = fds[0];
 	*hal_sock = fds[1];
 	rfsock->bt_sock = bt_sock;
+	rfsock->pipe_fd[0] = -1;
+	rfsock->pipe_fd[1] = -1;
 
 	DBG("rfsock %p", rfsock);
 
@@ -563,11 +609,74 @@ static int try_write_all(int fd, unsigned char *buf, int len)
 	return sent;
 }
 
+/*
+ * Move data from src to dst through the pipe so it never enters user space.
+ * Returns the bytes forwarded, 0 when src had nothing or -1 on error. If src
+ * doesn't support splice, *splice_ok is cleared and the copy path is used.
+ */
+static int try_splice_all(struct rfcomm_sock *rfsock, int src, int dst,
+								bool *splice_ok)
+{
+	ssize_t len, sent, total;
+
+	len = splice(src, NULL, rfsock->pipe_fd[1], NULL, rfsock->pipe_size,
+							SPLICE_F_MOVE);
+	if (len < 0) {
+		if (errno == EINVAL || errno == ENOSYS) {
+			DBG("splice unsupported, using copy path");
+			*splice_ok = false;
+			return 0;
+		}
+
+		if (errno != EINTR && errno != EAGAIN)
+			error("splice(): %s", strerror(errno));
+
+		/* Read again */
+		return 0;
+	}
+
+	for (total = len; len > 0; len -= sent) {
+		sent = splice(rfsock->pipe_fd[0], NULL, dst, NULL, len,
+							SPLICE_F_MOVE);
+		if (sent < 0) {
+			if (errno == EINTR || errno == EAGAIN) {
+				sent = 0;
+				continue;
+			}
+
+			return -1;
+		}
+	}
+
+	return total;
+}
+
+static int forward_data(struct rfcomm_sock *rfsock, int src, int dst,
+								bool *splice_ok)
+{
+	int len;
+
+	if (*splice_ok) {
+		len = try_splice_all(rfsock, src, dst, splice_ok);
+		if (*splice_ok)
+			return len;
+	}
+
+	len = read(src, rfsock->buf, rfsock->buf_size);
+	if (len <= 0) {
+		error("read(): %s", strerror(errno));
+		/* Read again */
+		return 0;
+	}
+
+	return try_write_all(dst, rfsock->buf, len);
+}
+
 static gboolean jv_sock_client_event_cb(GIOChannel *io, GIOCondition cond,
 								gpointer data)
 {
 	struct rfcomm_sock *rfsock = data;
-	int len, sent;
+	int sent;
 
 	if (cond & G_IO_HUP) {
 		DBG("Socket %d hang up", g_io_channel_unix_get_fd(io));
@@ -579,14 +688,8 @@ static gboolean jv_sock_client_event_cb(GIOChannel *io, GIOCondition cond,
 		goto fail;
 	}
 
-	len = read(rfsock->jv_sock, rfsock->buf, rfsock->buf_size);
-	if (len <= 0) {
-		error("read(): %s", strerror(errno));
-		/* Read again */
-		return TRUE;
-	}
-
-	sent = try_write_all(rfsock->bt_sock, rfsock->buf, len);
+	sent = forward_data(rfsock, rfsock->jv_sock, rfsock->bt_sock,
+							&rfsock->jv_splice);
 	if (sent < 0) {
 		error("write(): %s", strerror(errno));
 		goto fail;
@@ -606,7 +709,7 @@ static gboolean bt_sock_event_cb(GIOChannel *io, GIOCondition cond,
 								gpointer data)
 {
 	struct rfcomm_sock *rfsock = data;
-	int len, sent;
+	int sent;
 
 	if (cond & G_IO_HUP) {
 		DBG("Socket %d hang up", g_io_channel_unix_get_fd(io));
@@ -618,14 +721,8 @@ static gboolean bt_sock_event_cb(GIOChannel *io, GIOCondition cond,
 		goto fail;
 	}
 
-	len = read(rfsock->bt_sock, rfsock->buf, rfsock->buf_size);
-	if (len <= 0) {
-		error("read(): %s", strerror(errno));
-		/* Read again */
-		return TRUE;
-	}
-
-	sent = try_write_all(rfsock->jv_sock, rfsock->buf, len);
+	sent = forward_data(rfsock, rfsock->bt_sock, rfsock->jv_sock,
+							&rfsock->bt_splice);
 	if (sent < 0) {
 		error("write(): %s", strerror(errno));
 		goto fail;
@@ -35,6 +35,7 @@
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/mman.h>
 
 #include <glib.h>
 #include "src/shared/util.h"
@@ -53,6 +54,10 @@ struct test_data {
 	uint8_t service;
 	const struct ipc_handler *handlers;
 	uint8_t handlers_size;
+	unsigned int batched;
+	uint16_t notif_len;
+	const void *notif;
+	uint16_t notif_size;
 };
 
 struct context {
@@ -115,6 +120,8 @@ static gboolean notif_watch(GIOChannel *io, GIOCondition cond,
 {
 	struct context *context = user_data;
 	const struct test_data *test_data = context->data;
+	uint8_t buf[128];
+	int sk;
 
 	if (cond & (G_IO_HUP | G_IO_ERR | G_IO_NVAL)) {
 		g_assert(test_data->disconnect);
@@ -122,6 +129,14 @@ static gboolean notif_watch(GIOChannel *io, GIOCondition cond,
 	}
 
 	g_assert(!test_data->disconnect);
+	g_assert(test_data->notif);
+
+	sk = g_io_channel_unix_get_fd(io);
+
+	g_assert(read(sk, buf, sizeof(buf)) == test_data->notif_size);
+	g_assert(!memcmp(test_data->notif, buf, test_data->notif_size));
+
+	context_quit(context);
 
 	return TRUE;
 }
@@ -162,7 +177,8 @@ static gboolean connect_handler(GIOChannel *io, GIOCondition cond,
 		context->cmd_io = new_io;
 	}
 
-	if (context->cmd_source && context->notif_source && !test_data->cmd)
+	if (context->cmd_source && context->notif_source && !test_data->cmd &&
+							!test_data->notif)
 		context_quit(context);
 
 	return TRUE;
@@ -344,6 +360,100 @@ static void test_cmd_reg_1(gconstpointer data)
 	ipc = NULL;
 }
 
+static struct ipc_shm_ring *shm_ring = NULL;
+static uint32_t shm_size = 0;
+
+static gboolean send_notif(gpointer user_data)
+{
+	struct context *context = user_data;
+	const struct test_data *test_data = context->data;
+	uint8_t param[] = { 'a', 'b' };
+	unsigned int i;
+
+	for (i = 0; i < test_data->batched; i++)
+		ipc_send_notif_batched(ipc, 1, 0x81, sizeof(param), param);
+
+	return FALSE;
+}
+
+static gboolean send_shm_notif(gpointer user_data)
+{
+	struct context *context = user_data;
+	const struct test_data *test_data = context->data;
+	uint8_t param[IPC_MTU];
+	void *ptr;
+	int fd;
+
+	shm_size = 0;
+
+	fd = ipc_shm_setup(ipc, &shm_size);
+	g_assert(fd >= 0);
+	g_assert(shm_size == IPC_SHM_MIN_SIZE);
+
+	ptr = mmap(NULL, sizeof(*shm_ring) + shm_size, PROT_READ | PROT_WRITE,
+							MAP_SHARED, fd, 0);
+	g_assert(ptr != MAP_FAILED);
+	close(fd);
+
+	shm_ring = ptr;
+	g_assert(shm_ring->size == shm_size);
+
+	g_assert(ipc_shm_setup(ipc, &shm_size) == -EALREADY);
+
+	memset(param, 0xaa, test_data->notif_len);
+	ipc_send_notif(ipc, 1, 0x81, test_data->notif_len, param);
+
+	return FALSE;
+}
+
+static void test_notif(gconstpointer data)
+{
+	struct context *context = create_context(data);
+
+	ipc = ipc_init(HAL_SK_PATH, sizeof(HAL_SK_PATH), SERVICE_ID_MAX,
+						true, NULL, NULL);
+
+	g_assert(ipc);
+
+	g_idle_add(send_notif, context);
+
+	execute_context(context);
+
+	ipc_cleanup(ipc);
+	ipc = NULL;
+}
+
+static void test_notif_shm(gconstpointer data)
+{
+	struct context *context = create_context(data);
+	const struct test_data *test_data = data;
+	const struct ipc_hdr *hdr;
+	unsigned int i;
+
+	ipc = ipc_init(HAL_SK_PATH, sizeof(HAL_SK_PATH), SERVICE_ID_MAX,
+						true, NULL, NULL);
+
+	g_assert(ipc);
+
+	g_idle_add(send_shm_notif, context);
+
+	execute_context(context);
+
+	hdr = (const struct ipc_hdr *) shm_ring->data;
+	g_assert(hdr->service_id == 1);
+	g_assert(hdr->opcode == 0x81);
+	g_assert(hdr->len == test_data->notif_len);
+
+	for (i = 0; i < hdr->len; i++)
+		g_assert(hdr->payload[i] == 0xaa);
+
+	munmap(shm_ring, sizeof(*shm_ring) + shm_size);
+	shm_ring = NULL;
+
+	ipc_cleanup(ipc);
+	ipc = NULL;
+}
+
 static void test_cmd_handler_1(const void *buf, uint16_t len)
 {
 	ipc_send_rsp(ipc, 0, 1, 0);
@@ -538,6 +648,41 @@ static const struct test_data test_cmd_msg_invalid_2 = {
 	.disconnect = true,
 };
 
+static const uint8_t test_notif_single_pdu[] = {
+	0x01, 0x81, 0x02, 0x00, 'a', 'b',
+};
+
+static const struct test_data test_notif_batch_single = {
+	.batched = 1,
+	.notif = test_notif_single_pdu,
+	.notif_size = sizeof(test_notif_single_pdu),
+};
+
+static const uint8_t test_notif_batch_pdu[] = {
+	0x00, IPC_OP_BATCH, 0x12, 0x00,
+	0x01, 0x81, 0x02, 0x00, 'a', 'b',
+	0x01, 0x81, 0x02, 0x00, 'a', 'b',
+	0x01, 0x81, 0x02, 0x00, 'a', 'b',
+};
+
+static const struct test_data test_notif_batch_3 = {
+	.batched = 3,
+	.notif = test_notif_batch_pdu,
+	.notif_size = sizeof(test_notif_batch_pdu),
+};
+
+static const uint8_t test_notif_shm_pdu[] = {
+	0x00, IPC_OP_SHM, 0x08, 0x00,
+	0x00, 0x00, 0x00, 0x00,
+	0x04, 0x02, 0x00, 0x00,
+};
+
+static const struct test_data test_notif_shm_1 = {
+	.notif_len = 512,
+	.notif = test_notif_shm_pdu,
+	.notif_size = sizeof(test_notif_shm_pdu),
+};
+
 int main(int argc, char *argv[])
 {
 	g_test_init(&argc, &argv, NULL);
@@ -572,6 +717,12 @@ int main(int argc, char *argv[])
 				&test_cmd_msg_invalid_1, test_cmd_reg);
 	g_test_add_data_func("/android_ipc/msg_invalid_2",
 				&test_cmd_msg_invalid_2, test_cmd_reg);
+	g_test_add_data_func("/android_ipc/notif_batch_single",
+				&test_notif_batch_single, test_notif);
+	g_test_add_data_func("/android_ipc/notif_batch_3",
+				&test_notif_batch_3, test_notif);
+	g_test_add_data_func("/android_ipc/notif_shm",
+				&test_notif_shm_1, test_notif_shm);
 
 	return g_test_run();
 }
@@ -423,6 +423,14 @@ guint g_attrib_register(GAttrib *attrib, guint8 opcode, guint16 handle,
 	if (opcode == GATTRIB_ALL_REQS)
 		opcode = BT_ATT_ALL_REQUESTS;
 
+	/* Let bt_att dispatch by handle instead of walking every callback */
+	if (handle != GATTRIB_ALL_HANDLES &&
+				(opcode == BT_ATT_OP_HANDLE_VAL_NOT ||
+				opcode == BT_ATT_OP_HANDLE_VAL_IND))
+		return bt_att_register_handle(attrib->att, opcode, handle,
+						attrib_callback_notify, cb,
+						attrib_callbacks_remove);
+
 	return bt_att_register(attrib->att, opcode, attrib_callback_notify,
 						cb, attrib_callbacks_remove);
 }
@@ -79,12 +79,25 @@ struct set_opts {
 	int flushable;
 	uint32_t priority;
 	uint16_t voice;
+	uint8_t max_tx;
+	uint16_t txwin_size;
 };
 
 struct connect {
 	BtIOConnect connect;
 	gpointer user_data;
 	GDestroyNotify destroy;
+	BtIOType type;
+	bdaddr_t src;
+	bdaddr_t dst;
+	uint8_t dst_type;
+	uint8_t channel;
+	uint16_t psm;
+	uint16_t cid;
+	GIOChannel *io;		/* Only set while queued */
+	guint watch;		/* Only set while queued */
+	gint64 queued;
+	gint64 started;
 };
 
 struct accept {
@@ -149,11 +162,51 @@ static void server_remove(struct server *server)
 	g_free(server);
 }
 
+/*
+ * Outgoing connects in progress and the ones waiting for a free slot on
+ * their local adapter. The limit is shared by all users of the library
+ * within the process and disabled by default.
+ */
+static GSList *connect_active = NULL;
+static GSList *connect_queue = NULL;
+static unsigned int connect_max = 0;
+static guint connect_idle = 0;
+
+static BtIOConnectStats connect_stats = NULL;
+static gpointer connect_stats_data = NULL;
+
+static unsigned int connect_count(const bdaddr_t *src)
+{
+	unsigned int count = 0;
+	GSList *l;
+
+	for (l = connect_active; l; l = l->next) {
+		struct connect *conn = l->data;
+
+		if (!bacmp(&conn->src, src))
+			count++;
+	}
+
+	return count;
+}
+
+static gboolean connect_dequeue(gpointer user_data);
+
+static void connect_schedule(void)
+{
+	if (connect_queue && !connect_idle)
+		connect_idle = g_idle_add(connect_dequeue, NULL);
+}
+
 static void connect_remove(struct connect *conn)
 {
+	connect_active = g_slist_remove(connect_active, conn);
+
 	if (conn->destroy)
 		conn->destroy(conn->user_data);
 	g_free(conn);
+
+	connect_schedule();
 }
 
 static void accept_remove(struct accept *accept)
@@ -229,6 +282,11 @@ static gboolean connect_cb(GIOChannel *io, GIOCondition cond,
 	if (err < 0)
 		ERROR_FAILED(&gerr, "connect error", -err);
 
+	if (connect_stats)
+		connect_stats(io, -err, conn->started - conn->queued,
+				g_get_monotonic_time() - conn->started,
+				connect_stats_data);
+
 	conn->connect(io, gerr, conn->user_data);
 
 	g_clear_error(&gerr);
@@ -286,16 +344,12 @@ static void server_add(GIOChannel *io, BtIOConnect connect,
 					(GDestroyNotify) server_remove);
 }
 
-static void connect_add(GIOChannel *io, BtIOConnect connect,
-				gpointer user_data, GDestroyNotify destroy)
+static void connect_add(GIOChannel *io, struct connect *conn)
 {
-	struct connect *conn;
 	GIOCondition cond;
 
-	conn = g_new0(struct connect, 1);
-	conn->connect = connect;
-	conn->user_data = user_data;
-	conn->destroy = destroy;
+	conn->started = g_get_monotonic_time();
+	connect_active = g_slist_prepend(connect_active, conn);
 
 	cond = G_IO_OUT | G_IO_ERR | G_IO_HUP | G_IO_NVAL;
 	g_io_add_watch_full(io, G_PRIORITY_DEFAULT, cond, connect_cb, conn,
@@ -592,7 +646,8 @@ static gboolean get_key_size(int sock, int *size, GError **err)
 }
 
 static gboolean set_l2opts(int sock, uint16_t imtu, uint16_t omtu,
-						uint8_t mode, GError **err)
+				uint8_t mode, uint8_t max_tx,
+				uint16_t txwin_size, GError **err)
 {
 	struct l2cap_options l2o;
 	socklen_t len;
@@ -610,6 +665,10 @@ static gboolean set_l2opts(int sock, uint16_t imtu, uint16_t omtu,
 		l2o.omtu = omtu;
 	if (mode)
 		l2o.mode = mode;
+	if (max_tx)
+		l2o.max_tx = max_tx;
+	if (txwin_size)
+		l2o.txwin_size = txwin_size;
 
 	if (setsockopt(sock, SOL_L2CAP, L2CAP_OPTIONS, &l2o, sizeof(l2o)) < 0) {
 		ERROR_FAILED(err, "setsockopt(L2CAP_OPTIONS)", errno);
@@ -632,14 +691,16 @@ static gboolean set_le_imtu(int sock, uint16_t imtu, GError **err)
 
 static gboolean l2cap_set(int sock, uint8_t src_type, int sec_level,
 				uint16_t imtu, uint16_t omtu, uint8_t mode,
+				uint8_t max_tx, uint16_t txwin_size,
 				int master, int flushable, uint32_t priority,
 				GError **err)
 {
-	if (imtu || omtu || mode) {
+	if (imtu || omtu || mode || max_tx || txwin_size) {
 		gboolean ret;
 
 		if (src_type == BDADDR_BREDR)
-			ret = set_l2opts(sock, imtu, omtu, mode, err);
+			ret = set_l2opts(sock, imtu, omtu, mode, max_tx,
+							txwin_size, err);
 		else
 			ret = set_le_imtu(sock, imtu, err);
 
@@ -875,6 +936,12 @@ static gboolean parse_set_opts(struct set_opts *opts, GError **err,
 		case BT_IO_OPT_VOICE:
 			opts->voice = va_arg(args, int);
 			break;
+		case BT_IO_OPT_MAX_TX:
+			opts->max_tx = va_arg(args, int);
+			break;
+		case BT_IO_OPT_TX_WINDOW:
+			opts->txwin_size = va_arg(args, int);
+			break;
 		case BT_IO_OPT_INVALID:
 		case BT_IO_OPT_KEY_SIZE:
 		case BT_IO_OPT_SOURCE_CHANNEL:
@@ -1147,6 +1214,12 @@ parse_opts:
 			}
 			*(va_arg(args, uint32_t *)) = priority;
 			break;
+		case BT_IO_OPT_MAX_TX:
+			*(va_arg(args, uint8_t *)) = l2o.max_tx;
+			break;
+		case BT_IO_OPT_TX_WINDOW:
+			*(va_arg(args, uint16_t *)) = l2o.txwin_size;
+			break;
 		case BT_IO_OPT_INVALID:
 		case BT_IO_OPT_SOURCE_TYPE:
 		case BT_IO_OPT_CHANNEL:
@@ -1299,6 +1372,8 @@ static gboolean rfcomm_get(int sock, GError **err, BtIOOption opt1,
 		case BT_IO_OPT_FLUSHABLE:
 		case BT_IO_OPT_PRIORITY:
 		case BT_IO_OPT_VOICE:
+		case BT_IO_OPT_MAX_TX:
+		case BT_IO_OPT_TX_WINDOW:
 		case BT_IO_OPT_INVALID:
 		default:
 			g_set_error(err, BT_IO_ERROR, EINVAL,
@@ -1400,6 +1475,8 @@ static gboolean sco_get(int sock, GError **err, BtIOOption opt1, va_list args)
 		case BT_IO_OPT_FLUSHABLE:
 		case BT_IO_OPT_PRIORITY:
 		case BT_IO_OPT_VOICE:
+		case BT_IO_OPT_MAX_TX:
+		case BT_IO_OPT_TX_WINDOW:
 		case BT_IO_OPT_INVALID:
 		default:
 			g_set_error(err, BT_IO_ERROR, EINVAL,
@@ -1489,7 +1566,8 @@ gboolean bt_io_set(GIOChannel *io, GError **err, BtIOOption opt1, ...)
 	switch (type) {
 	case BT_IO_L2CAP:
 		return l2cap_set(sock, opts.src_type, opts.sec_level, opts.imtu,
-					opts.omtu, opts.mode, opts.master,
+					opts.omtu, opts.mode, opts.max_tx,
+					opts.txwin_size, opts.master,
 					opts.flushable, opts.priority, err);
 	case BT_IO_RFCOMM:
 		return rfcomm_set(sock, opts.sec_level, opts.master, err);
@@ -1539,6 +1617,7 @@ static GIOChannel *create_io(gboolean server, struct set_opts *opts,
 			goto failed;
 		if (!l2cap_set(sock, opts->src_type, opts->sec_level,
 				opts->imtu, opts->omtu, opts->mode,
+				opts->max_tx, opts->txwin_size,
 				opts->master, opts->flushable, opts->priority,
 				err))
 			goto failed;
@@ -1586,6 +1665,137 @@ failed:
 	return NULL;
 }
 
+static int connect_start(GIOChannel *io, struct connect *conn)
+{
+	int sock = g_io_channel_unix_get_fd(io);
+
+	switch (conn->type) {
+	case BT_IO_L2CAP:
+		return l2cap_connect(sock, &conn->dst, conn->dst_type,
+							conn->psm, conn->cid);
+	case BT_IO_RFCOMM:
+		return rfcomm_connect(sock, &conn->dst, conn->channel);
+	case BT_IO_SCO:
+		return sco_connect(sock, &conn->dst);
+	case BT_IO_INVALID:
+	default:
+		return -EINVAL;
+	}
+}
+
+static gboolean queue_cb(GIOChannel *io, GIOCondition cond,
+							gpointer user_data)
+{
+	struct connect *conn = user_data;
+	GError *gerr = NULL;
+
+	/* If the user aborted this connect attempt before it was started */
+	if ((cond & G_IO_NVAL) || check_nval(io))
+		return FALSE;
+
+	ERROR_FAILED(&gerr, "connect error", ECONNABORTED);
+	conn->connect(io, gerr, conn->user_data);
+	g_clear_error(&gerr);
+
+	return FALSE;
+}
+
+static void queue_remove(struct connect *conn)
+{
+	/* Handed over to connect_cb */
+	if (!conn->watch)
+		return;
+
+	connect_queue = g_slist_remove(connect_queue, conn);
+
+	g_io_channel_unref(conn->io);
+
+	if (conn->destroy)
+		conn->destroy(conn->user_data);
+	g_free(conn);
+}
+
+static void queue_add(GIOChannel *io, struct connect *conn)
+{
+	GIOCondition cond;
+
+	conn->io = g_io_channel_ref(io);
+
+	/*
+	 * A bound but unconnected socket reports no events, so this only
+	 * triggers when the user shuts the channel down while it is queued.
+	 */
+	cond = G_IO_ERR | G_IO_HUP | G_IO_NVAL;
+	conn->watch = g_io_add_watch_full(io, G_PRIORITY_DEFAULT, cond,
+						queue_cb, conn,
+						(GDestroyNotify) queue_remove);
+
+	connect_queue = g_slist_append(connect_queue, conn);
+}
+
+static gboolean connect_dequeue(gpointer user_data)
+{
+	GSList *l, *next;
+
+	connect_idle = 0;
+
+	for (l = connect_queue; l; l = next) {
+		struct connect *conn = l->data;
+		GIOChannel *io = conn->io;
+		GError *gerr = NULL;
+		guint watch;
+		int err;
+
+		next = l->next;
+
+		if (connect_max && connect_count(&conn->src) >= connect_max)
+			continue;
+
+		/* Already aborted, queue_cb takes care of it */
+		if (check_nval(io))
+			continue;
+
+		connect_queue = g_slist_delete_link(connect_queue, l);
+
+		watch = conn->watch;
+		conn->watch = 0;
+		conn->io = NULL;
+		g_source_remove(watch);
+
+		err = connect_start(io, conn);
+		if (err == 0) {
+			connect_add(io, conn);
+			g_io_channel_unref(io);
+			continue;
+		}
+
+		ERROR_FAILED(&gerr, "connect", -err);
+		conn->connect(io, gerr, conn->user_data);
+		g_clear_error(&gerr);
+
+		connect_remove(conn);
+		g_io_channel_unref(io);
+
+		/* The callback may have changed the queue */
+		next = connect_queue;
+	}
+
+	return FALSE;
+}
+
+void bt_io_set_max_connects(unsigned int max)
+{
+	connect_max = max;
+
+	connect_schedule();
+}
+
+void bt_io_set_connect_stats(BtIOConnectStats func, gpointer user_data)
+{
+	connect_stats = func;
+	connect_stats_data = user_data;
+}
+
 GIOChannel *bt_io_connect(BtIOConnect connect, gpointer user_data,
 				GDestroyNotify destroy, GError **gerr,
 				BtIOOption opt1, ...)
@@ -1593,7 +1803,8 @@ GIOChannel *bt_io_connect(BtIOConnect connect, gpointer user_data,
 	GIOChannel *io;
 	va_list args;
 	struct set_opts opts;
-	int err, sock;
+	struct connect *conn;
+	int err;
 	gboolean ret;
 
 	va_start(args, opt1);
@@ -1607,33 +1818,37 @@ GIOChannel *bt_io_connect(BtIOConnect connect, gpointer user_data,
 	if (io == NULL)
 		return NULL;
 
-	sock = g_io_channel_unix_get_fd(io);
-
-	switch (opts.type) {
-	case BT_IO_L2CAP:
-		err = l2cap_connect(sock, &opts.dst, opts.dst_type,
-							opts.psm, opts.cid);
-		break;
-	case BT_IO_RFCOMM:
-		err = rfcomm_connect(sock, &opts.dst, opts.channel);
-		break;
-	case BT_IO_SCO:
-		err = sco_connect(sock, &opts.dst);
-		break;
-	case BT_IO_INVALID:
-	default:
-		g_set_error(gerr, BT_IO_ERROR, EINVAL,
-					"Unknown BtIO type %d", opts.type);
-		return NULL;
+	conn = g_new0(struct connect, 1);
+	conn->connect = connect;
+	conn->user_data = user_data;
+	conn->destroy = destroy;
+	conn->type = opts.type;
+	bacpy(&conn->src, &opts.src);
+	bacpy(&conn->dst, &opts.dst);
+	conn->dst_type = opts.dst_type;
+	conn->channel = opts.channel;
+	conn->psm = opts.psm;
+	conn->cid = opts.cid;
+	conn->queued = g_get_monotonic_time();
+
+	/*
+	 * The socket is created and bound right away so that the caller
+	 * gets a usable channel, only connect() waits for a free slot.
+	 */
+	if (connect_max && connect_count(&opts.src) >= connect_max) {
+		queue_add(io, conn);
+		return io;
 	}
 
+	err = connect_start(io, conn);
 	if (err < 0) {
 		ERROR_FAILED(gerr, "connect", -err);
+		g_free(conn);
 		g_io_channel_unref(io);
 		return NULL;
 	}
 
-	connect_add(io, connect, user_data, destroy);
+	connect_add(io, conn);
 
 	return io;
 }
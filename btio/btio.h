@@ -56,6 +56,8 @@ typedef enum {
 	BT_IO_OPT_FLUSHABLE,
 	BT_IO_OPT_PRIORITY,
 	BT_IO_OPT_VOICE,
+	BT_IO_OPT_MAX_TX,
+	BT_IO_OPT_TX_WINDOW,
 } BtIOOption;
 
 typedef enum {
@@ -88,6 +90,22 @@ GIOChannel *bt_io_connect(BtIOConnect connect, gpointer user_data,
 				GDestroyNotify destroy, GError **gerr,
 				BtIOOption opt1, ...);
 
+/*
+ * Limit the number of outgoing connects in progress per local adapter,
+ * additional bt_io_connect calls are queued and started in order as
+ * earlier attempts complete. 0 means no limit, which is the default.
+ */
+void bt_io_set_max_connects(unsigned int max);
+
+/*
+ * Called for every completed connect attempt with 0 or the errno it
+ * failed with, and the time spent queued and connecting in microseconds.
+ */
+typedef void (*BtIOConnectStats)(GIOChannel *io, int err, gint64 queued,
+					gint64 connect, gpointer user_data);
+
+void bt_io_set_connect_stats(BtIOConnectStats func, gpointer user_data);
+
 GIOChannel *bt_io_listen(BtIOConnect connect, BtIOConfirm confirm,
 				gpointer user_data, GDestroyNotify destroy,
 				GError **err, BtIOOption opt1, ...);
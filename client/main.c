@@ -50,6 +50,10 @@
 #define PROMPT_ON	COLOR_BLUE "[bluetooth]" COLOR_OFF "# "
 #define PROMPT_OFF	"Waiting to connect to bluetoothd..."
 
+/* Device table display */
+#define DISPLAY_INTERVAL	1000
+#define DISPLAY_ROWS		25
+
 static DBusConnection *dbus_conn;
 
 static GDBusProxy *agent_manager;
@@ -59,8 +63,28 @@ struct adapter {
 	GDBusProxy *proxy;
 	GDBusProxy *ad_proxy;
 	GList *devices;
+	GList *devices_tail;
+	GHashTable *device_links;	/* Object path to devices link */
+	GHashTable *device_addrs;	/* Upper case address to proxy */
+};
+
+struct display_filter {
+	bool has_rssi;
+	int16_t rssi;
+	char *name;
+	char *address;
+	bool connected;
+	bool paired;
 };
 
+static struct {
+	bool table;
+	unsigned int interval;
+	guint timeout_id;
+	bool dirty;
+	struct display_filter filter;
+} display = { .interval = DISPLAY_INTERVAL };
+
 static struct adapter *default_ctrl;
 static GDBusProxy *default_dev;
 static GDBusProxy *default_attr;
@@ -387,9 +411,8 @@ static gboolean device_is_child(GDBusProxy *device, GDBusProxy *master)
 
 static gboolean service_is_child(GDBusProxy *service)
 {
-	GList *l;
 	DBusMessageIter iter;
-	const char *device, *path;
+	const char *device;
 
 	if (g_dbus_proxy_get_property(service, "Device", &iter) == FALSE)
 		return FALSE;
@@ -399,16 +422,7 @@ static gboolean service_is_child(GDBusProxy *service)
 	if (!default_ctrl)
 		return FALSE;
 
-	for (l = default_ctrl->devices; l; l = g_list_next(l)) {
-		struct GDBusProxy *proxy = l->data;
-
-		path = g_dbus_proxy_get_path(proxy);
-
-		if (!strcmp(path, device))
-			return TRUE;
-	}
-
-	return FALSE;
+	return g_hash_table_lookup(default_ctrl->device_links, device) != NULL;
 }
 
 static struct adapter *find_parent(GDBusProxy *device)
@@ -454,6 +468,166 @@ done:
 	g_free(desc);
 }
 
+static bool device_visible(GDBusProxy *proxy)
+{
+	const struct display_filter *filter = &display.filter;
+	DBusMessageIter iter;
+	const char *str;
+	dbus_bool_t val;
+	int16_t rssi;
+
+	if (filter->has_rssi) {
+		if (!g_dbus_proxy_get_property(proxy, "RSSI", &iter))
+			return false;
+
+		dbus_message_iter_get_basic(&iter, &rssi);
+		if (rssi < filter->rssi)
+			return false;
+	}
+
+	if (filter->address) {
+		if (!g_dbus_proxy_get_property(proxy, "Address", &iter))
+			return false;
+
+		dbus_message_iter_get_basic(&iter, &str);
+		if (g_ascii_strncasecmp(str, filter->address,
+						strlen(filter->address)))
+			return false;
+	}
+
+	if (filter->name) {
+		char *name;
+		bool found;
+
+		if (!g_dbus_proxy_get_property(proxy, "Alias", &iter))
+			return false;
+
+		dbus_message_iter_get_basic(&iter, &str);
+		name = g_ascii_strdown(str, -1);
+		found = strstr(name, filter->name) != NULL;
+		g_free(name);
+
+		if (!found)
+			return false;
+	}
+
+	if (filter->connected) {
+		if (!g_dbus_proxy_get_property(proxy, "Connected", &iter))
+			return false;
+
+		dbus_message_iter_get_basic(&iter, &val);
+		if (!val)
+			return false;
+	}
+
+	if (filter->paired) {
+		if (!g_dbus_proxy_get_property(proxy, "Paired", &iter))
+			return false;
+
+		dbus_message_iter_get_basic(&iter, &val);
+		if (!val)
+			return false;
+	}
+
+	return true;
+}
+
+/* Returns true if device events should be printed as they arrive */
+static bool device_print_event(GDBusProxy *proxy)
+{
+	if (display.table) {
+		display.dirty = true;
+		return false;
+	}
+
+	return device_visible(proxy);
+}
+
+static char *device_key(const char *address)
+{
+	return g_ascii_strup(address, -1);
+}
+
+static void device_store_add(struct adapter *adapter, GDBusProxy *proxy)
+{
+	DBusMessageIter iter;
+	const char *address;
+
+	if (!adapter->device_links) {
+		adapter->device_links = g_hash_table_new(g_str_hash,
+								g_str_equal);
+		adapter->device_addrs = g_hash_table_new_full(g_str_hash,
+							g_str_equal, g_free,
+							NULL);
+	}
+
+	/* Append through the tail, scans can bring in thousands */
+	if (!adapter->devices_tail) {
+		adapter->devices = g_list_append(NULL, proxy);
+		adapter->devices_tail = adapter->devices;
+	} else {
+		g_list_append(adapter->devices_tail, proxy);
+		adapter->devices_tail = adapter->devices_tail->next;
+	}
+
+	g_hash_table_insert(adapter->device_links,
+				(void *) g_dbus_proxy_get_path(proxy),
+				adapter->devices_tail);
+
+	if (g_dbus_proxy_get_property(proxy, "Address", &iter)) {
+		dbus_message_iter_get_basic(&iter, &address);
+		g_hash_table_insert(adapter->device_addrs, device_key(address),
+									proxy);
+	}
+}
+
+static void device_store_remove(struct adapter *adapter, GDBusProxy *proxy)
+{
+	const char *path = g_dbus_proxy_get_path(proxy);
+	DBusMessageIter iter;
+	GList *link;
+
+	if (!adapter->device_links)
+		return;
+
+	link = g_hash_table_lookup(adapter->device_links, path);
+	if (!link)
+		return;
+
+	g_hash_table_remove(adapter->device_links, path);
+
+	if (g_dbus_proxy_get_property(proxy, "Address", &iter)) {
+		const char *address;
+		char *key;
+
+		dbus_message_iter_get_basic(&iter, &address);
+		key = device_key(address);
+		g_hash_table_remove(adapter->device_addrs, key);
+		g_free(key);
+	}
+
+	if (adapter->devices_tail == link)
+		adapter->devices_tail = link->prev;
+
+	adapter->devices = g_list_delete_link(adapter->devices, link);
+}
+
+static GDBusProxy *find_device_by_address(struct adapter *adapter,
+							const char *address)
+{
+	GDBusProxy *proxy;
+	char *key;
+
+	if (!adapter->device_addrs)
+		return NULL;
+
+	key = device_key(address);
+	proxy = g_hash_table_lookup(adapter->device_addrs, key);
+	g_free(key);
+
+	return proxy;
+}
+
 static void device_added(GDBusProxy *proxy)
 {
 	DBusMessageIter iter;
@@ -464,8 +638,10 @@ static void device_added(GDBusProxy *proxy)
 		return;
 	}
 
-	adapter->devices = g_list_append(adapter->devices, proxy);
-	print_device(proxy, COLORED_NEW);
+	device_store_add(adapter, proxy);
+
+	if (device_print_event(proxy))
+		print_device(proxy, COLORED_NEW);
 
 	if (default_dev)
 		return;
@@ -567,9 +743,10 @@ static void device_removed(GDBusProxy *proxy)
 		return;
 	}
 
-	adapter->devices = g_list_remove(adapter->devices, proxy);
+	device_store_remove(adapter, proxy);
 
-	print_device(proxy, COLORED_DEL);
+	if (device_print_event(proxy))
+		print_device(proxy, COLORED_DEL);
 
 	if (default_dev == proxy)
 		set_default_device(NULL, NULL);
@@ -592,6 +769,10 @@ static void adapter_removed(GDBusProxy *proxy)
 
 			ctrl_list = g_list_remove_link(ctrl_list, ll);
 			g_list_free(adapter->devices);
+			if (adapter->device_links) {
+				g_hash_table_destroy(adapter->device_links);
+				g_hash_table_destroy(adapter->device_addrs);
+			}
 			g_free(adapter);
 			g_list_free(ll);
 			return;
@@ -687,7 +868,8 @@ static void property_changed(GDBusProxy *proxy, const char *name,
 					set_default_device(NULL, NULL);
 			}
 
-			print_iter(str, name, iter);
+			if (device_print_event(proxy))
+				print_iter(str, name, iter);
 			g_free(str);
 		}
 	} else if (!strcmp(interface, "org.bluez.Adapter1")) {
@@ -767,27 +949,6 @@ static struct adapter *find_ctrl_by_address(GList *source, const char *address)
 	return NULL;
 }
 
-static GDBusProxy *find_proxy_by_address(GList *source, const char *address)
-{
-	GList *list;
-
-	for (list = g_list_first(source); list; list = g_list_next(list)) {
-		GDBusProxy *proxy = list->data;
-		DBusMessageIter iter;
-		const char *str;
-
-		if (g_dbus_proxy_get_property(proxy, "Address", &iter) == FALSE)
-			continue;
-
-		dbus_message_iter_get_basic(&iter, &str);
-
-		if (!strcasecmp(str, address))
-			return proxy;
-	}
-
-	return NULL;
-}
-
 static gboolean check_default_ctrl(void)
 {
 	if (!default_ctrl) {
@@ -1382,6 +1543,191 @@ static void cmd_set_scan_filter_duplicate_data(int argc, char *argv[])
 	cmd_set_scan_filter_commit();
 }
 
+struct display_row {
+	GDBusProxy *proxy;
+	const char *address;
+	const char *name;
+	int16_t rssi;
+};
+
+static gint display_row_cmp(gconstpointer a, gconstpointer b)
+{
+	const struct display_row *ra = a;
+	const struct display_row *rb = b;
+
+	if (ra->rssi != rb->rssi)
+		return rb->rssi - ra->rssi;
+
+	return strcmp(ra->address, rb->address);
+}
+
+static void display_table(void)
+{
+	struct display_row *rows;
+	unsigned int count = 0, total = 0, i;
+	GList *l;
+
+	if (!default_ctrl)
+		return;
+
+	rows = g_new0(struct display_row, g_list_length(default_ctrl->devices));
+
+	for (l = default_ctrl->devices; l; l = g_list_next(l)) {
+		struct display_row *row = &rows[count];
+		DBusMessageIter iter;
+
+		total++;
+
+		if (!device_visible(l->data))
+			continue;
+
+		if (!g_dbus_proxy_get_property(l->data, "Address", &iter))
+			continue;
+
+		row->proxy = l->data;
+		dbus_message_iter_get_basic(&iter, &row->address);
+
+		if (g_dbus_proxy_get_property(row->proxy, "Alias", &iter))
+			dbus_message_iter_get_basic(&iter, &row->name);
+		else
+			row->name = "<unknown>";
+
+		if (g_dbus_proxy_get_property(row->proxy, "RSSI", &iter))
+			dbus_message_iter_get_basic(&iter, &row->rssi);
+		else
+			row->rssi = INT16_MIN;
+
+		count++;
+	}
+
+	qsort(rows, count, sizeof(*rows), display_row_cmp);
+
+	bt_shell_printf("%-17s %5s  %s\n", "Address", "RSSI", "Name");
+
+	for (i = 0; i < count && i < DISPLAY_ROWS; i++) {
+		if (rows[i].rssi == INT16_MIN)
+			bt_shell_printf("%-17s %5s  %s\n", rows[i].address, "-",
+							rows[i].name);
+		else
+			bt_shell_printf("%-17s %5d  %s\n", rows[i].address,
+						rows[i].rssi, rows[i].name);
+	}
+
+	bt_shell_printf("%u of %u devices shown\n", MIN(count, DISPLAY_ROWS),
+									total);
+
+	g_free(rows);
+}
+
+static gboolean display_timeout(gpointer user_data)
+{
+	if (!display.dirty)
+		return TRUE;
+
+	display.dirty = false;
+	display_table();
+
+	return TRUE;
+}
+
+static void cmd_display(int argc, char *argv[])
+{
+	if (argc < 1 || !strlen(argv[0])) {
+		bt_shell_printf("Display: %s, every %u ms\n",
+				display.table ? "table" : "events",
+				display.interval);
+		return;
+	}
+
+	if (!strcmp(argv[0], "events")) {
+		display.table = false;
+	} else if (!strcmp(argv[0], "table")) {
+		display.table = true;
+	} else {
+		bt_shell_printf("Invalid argument %s\n", argv[0]);
+		return;
+	}
+
+	if (argc > 1) {
+		char *endptr = NULL;
+		unsigned long interval;
+
+		interval = strtoul(argv[1], &endptr, 0);
+		if (!endptr || *endptr != '\0' || !interval ||
+							interval > 60000) {
+			bt_shell_printf("Invalid interval %s\n", argv[1]);
+			return;
+		}
+
+		display.interval = interval;
+	}
+
+	if (display.timeout_id) {
+		g_source_remove(display.timeout_id);
+		display.timeout_id = 0;
+	}
+
+	if (!display.table)
+		return;
+
+	display.dirty = true;
+	display.timeout_id = g_timeout_add(display.interval, display_timeout,
+									NULL);
+}
+
+static void display_filter_clear(struct display_filter *filter)
+{
+	g_free(filter->name);
+	g_free(filter->address);
+	memset(filter, 0, sizeof(*filter));
+}
+
+static void cmd_display_filter(int argc, char *argv[])
+{
+	struct display_filter filter;
+	int i;
+
+	memset(&filter, 0, sizeof(filter));
+
+	/* All terms have to match, no terms shows every device */
+	for (i = 0; i < argc; i++) {
+		const char *arg = argv[i];
+
+		if (!strncmp(arg, "rssi>=", 6)) {
+			char *endptr = NULL;
+			long rssi = strtol(arg + 6, &endptr, 0);
+
+			if (!endptr || *endptr != '\0' || rssi < INT16_MIN ||
+							rssi > INT16_MAX)
+				goto invalid;
+
+			filter.has_rssi = true;
+			filter.rssi = rssi;
+		} else if (!strncmp(arg, "name=", 5)) {
+			g_free(filter.name);
+			filter.name = g_ascii_strdown(arg + 5, -1);
+		} else if (!strncmp(arg, "address=", 8)) {
+			g_free(filter.address);
+			filter.address = g_strdup(arg + 8);
+		} else if (!strcmp(arg, "connected")) {
+			filter.connected = true;
+		} else if (!strcmp(arg, "paired")) {
+			filter.paired = true;
+		} else
+			goto invalid;
+	}
+
+	display_filter_clear(&display.filter);
+	display.filter = filter;
+	display.dirty = true;
+
+	return;
+
+invalid:
+	bt_shell_printf("Invalid filter term %s\n", argv[i]);
+	display_filter_clear(&filter);
+}
+
 static void clear_discovery_filter_setup(DBusMessageIter *iter, void *user_data)
 {
 	DBusMessageIter dict;
@@ -1430,7 +1776,7 @@ static struct GDBusProxy *find_device(int argc, char *argv[])
 	if (check_default_ctrl() == FALSE)
 		return NULL;
 
-	proxy = find_proxy_by_address(default_ctrl->devices, argv[0]);
+	proxy = find_device_by_address(default_ctrl, argv[0]);
 	if (!proxy) {
 		bt_shell_printf("Device %s not available\n", argv[0]);
 		return NULL;
@@ -1657,7 +2003,7 @@ static void cmd_remove(int argc, char *argv[])
 		return;
 	}
 
-	proxy = find_proxy_by_address(default_ctrl->devices, argv[0]);
+	proxy = find_device_by_address(default_ctrl, argv[0]);
 	if (!proxy) {
 		bt_shell_printf("Device %s not available\n", argv[0]);
 		return;
@@ -1696,7 +2042,7 @@ static void cmd_connect(int argc, char *argv[])
 	if (check_default_ctrl() == FALSE)
 		return;
 
-	proxy = find_proxy_by_address(default_ctrl->devices, argv[0]);
+	proxy = find_device_by_address(default_ctrl, argv[0]);
 	if (!proxy) {
 		bt_shell_printf("Device %s not available\n", argv[0]);
 		return;
@@ -2330,6 +2676,11 @@ static const struct bt_shell_menu scan_menu = {
 				mode_generator },
 	{ "set-filter-clear", "", cmd_set_scan_filter_clear,
 				"Clears discovery filter." },
+	{ "display", "[events/table] [interval_ms]", cmd_display,
+				"Print device events or a periodic table" },
+	{ "display-filter", "[rssi>=N] [name=str] [address=prefix] "
+				"[connected] [paired]", cmd_display_filter,
+				"Only show devices matching all terms" },
 	{ } },
 };
 
@@ -61,6 +61,10 @@ struct btdev {
 
 	struct btdev *conn;
 
+	unsigned int index;
+	struct btdev *bdaddr_next;
+	struct btdev *random_next;
+
 	bool auth_init;
 	uint8_t link_key[16];
 	uint16_t pin[16];
@@ -152,18 +156,27 @@ struct inquiry_data {
 	int num_resp;
 
 	int sent_count;
-	int iter;
+	unsigned int iter;
 };
 
 #define DEFAULT_INQUIRY_INTERVAL 100 /* 100 miliseconds */
 
-#define MAX_BTDEV_ENTRIES 16
+#define BTDEV_LIST_CHUNK 16
+#define BTDEV_HASH_SIZE 256
 
 static const uint8_t LINK_KEY_NONE[16] = { 0 };
 static const uint8_t LINK_KEY_DUMMY[16] = {	0, 1, 2, 3, 4, 5, 6, 7,
 						8, 9, 0, 1, 2, 3, 4, 5 };
 
-static struct btdev *btdev_list[MAX_BTDEV_ENTRIES] = { };
+/*
+ * Devices are kept in a growable table indexed by their slot number, which
+ * is also part of the generated address, plus hash tables for the public
+ * and random addresses so that lookups stay cheap with many devices.
+ */
+static struct btdev **btdev_list;
+static unsigned int btdev_list_size;
+static struct btdev *btdev_bdaddr_hash[BTDEV_HASH_SIZE];
+static struct btdev *btdev_random_hash[BTDEV_HASH_SIZE];
 
 static int get_hook_index(struct btdev *btdev, enum btdev_hook_type type,
 								uint16_t opcode)
@@ -193,43 +206,116 @@ static bool run_hooks(struct btdev *btdev, enum btdev_hook_type type,
 					btdev->hook_list[index]->user_data);
 }
 
-static inline int add_btdev(struct btdev *btdev)
+static unsigned int bdaddr_hash(const uint8_t *bdaddr)
 {
-	int i, index = -1;
+	unsigned int hash = 0;
+	int i;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
-		if (btdev_list[i] == NULL) {
-			index = i;
-			btdev_list[index] = btdev;
-			break;
+	for (i = 0; i < 6; i++)
+		hash = hash * 31 + bdaddr[i];
+
+	return hash % BTDEV_HASH_SIZE;
+}
+
+static void hash_del(struct btdev **table, struct btdev *btdev,
+					const uint8_t *bdaddr, bool random)
+{
+	struct btdev **entry = &table[bdaddr_hash(bdaddr)];
+
+	while (*entry) {
+		if (*entry == btdev) {
+			if (random)
+				*entry = btdev->random_next;
+			else
+				*entry = btdev->bdaddr_next;
+			return;
 		}
+
+		entry = random ? &(*entry)->random_next :
+						&(*entry)->bdaddr_next;
 	}
+}
 
-	return index;
+static void add_bdaddr(struct btdev *btdev)
+{
+	struct btdev **entry = &btdev_bdaddr_hash[bdaddr_hash(btdev->bdaddr)];
+
+	btdev->bdaddr_next = *entry;
+	*entry = btdev;
 }
 
-static inline int del_btdev(struct btdev *btdev)
+static void set_random_addr(struct btdev *btdev, const uint8_t *addr)
 {
-	int i, index = -1;
+	static const uint8_t addr_none[6] = { };
+	struct btdev **entry;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
-		if (btdev_list[i] == btdev) {
-			index = i;
-			btdev_list[index] = NULL;
-			break;
-		}
+	if (memcmp(btdev->random_addr, addr_none, 6))
+		hash_del(btdev_random_hash, btdev, btdev->random_addr, true);
+
+	memcpy(btdev->random_addr, addr, 6);
+
+	/* Devices without a random address are not looked up by it */
+	if (!memcmp(btdev->random_addr, addr_none, 6))
+		return;
+
+	entry = &btdev_random_hash[bdaddr_hash(btdev->random_addr)];
+	btdev->random_next = *entry;
+	*entry = btdev;
+}
+
+static inline int add_btdev(struct btdev *btdev)
+{
+	struct btdev **list;
+	unsigned int i, size;
+
+	for (i = 0; i < btdev_list_size; i++) {
+		if (btdev_list[i] == NULL)
+			goto done;
 	}
 
+	size = btdev_list_size + BTDEV_LIST_CHUNK;
+
+	list = realloc(btdev_list, size * sizeof(*list));
+	if (!list)
+		return -1;
+
+	memset(list + btdev_list_size, 0,
+			BTDEV_LIST_CHUNK * sizeof(*list));
+
+	btdev_list = list;
+	btdev_list_size = size;
+
+done:
+	btdev->index = i;
+	btdev_list[i] = btdev;
+
+	return i;
+}
+
+static inline int del_btdev(struct btdev *btdev)
+{
+	static const uint8_t addr_none[6] = { };
+	unsigned int index = btdev->index;
+
+	if (index >= btdev_list_size || btdev_list[index] != btdev)
+		return -1;
+
+	hash_del(btdev_bdaddr_hash, btdev, btdev->bdaddr, false);
+	set_random_addr(btdev, addr_none);
+
+	btdev_list[index] = NULL;
+
 	return index;
 }
 
 static inline struct btdev *find_btdev_by_bdaddr(const uint8_t *bdaddr)
 {
-	int i;
+	struct btdev *btdev;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
-		if (btdev_list[i] && !memcmp(btdev_list[i]->bdaddr, bdaddr, 6))
-			return btdev_list[i];
+	for (btdev = btdev_bdaddr_hash[bdaddr_hash(bdaddr)]; btdev;
+						btdev = btdev->bdaddr_next) {
+		if (!memcmp(btdev->bdaddr, bdaddr, 6))
+			return btdev;
 	}
 
 	return NULL;
@@ -238,21 +324,15 @@ static inline struct btdev *find_btdev_by_bdaddr(const uint8_t *bdaddr)
 static inline struct btdev *find_btdev_by_bdaddr_type(const uint8_t *bdaddr,
 							uint8_t bdaddr_type)
 {
-	int i;
-
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
-		int cmp;
-
-		if (!btdev_list[i])
-			continue;
+	struct btdev *btdev;
 
-		if (bdaddr_type == 0x01)
-			cmp = memcmp(btdev_list[i]->random_addr, bdaddr, 6);
-		else
-			cmp = memcmp(btdev_list[i]->bdaddr, bdaddr, 6);
+	if (bdaddr_type != 0x01)
+		return find_btdev_by_bdaddr(bdaddr);
 
-		if (!cmp)
-			return btdev_list[i];
+	for (btdev = btdev_random_hash[bdaddr_hash(bdaddr)]; btdev;
+						btdev = btdev->random_next) {
+		if (!memcmp(btdev->random_addr, bdaddr, 6))
+			return btdev;
 	}
 
 	return NULL;
@@ -297,12 +377,12 @@ static void hexdump(const unsigned char *buf, uint16_t len)
 	}
 }
 
-static void get_bdaddr(uint16_t id, uint8_t index, uint8_t *bdaddr)
+static void get_bdaddr(uint16_t id, unsigned int index, uint8_t *bdaddr)
 {
 	bdaddr[0] = id & 0xff;
 	bdaddr[1] = id >> 8;
-	bdaddr[2] = index;
-	bdaddr[3] = 0x01;
+	bdaddr[2] = index & 0xff;
+	bdaddr[3] = 0x01 + (index >> 8);
 	bdaddr[4] = 0xaa;
 	bdaddr[5] = 0x00;
 }
@@ -647,6 +727,7 @@ struct btdev *btdev_create(enum btdev_type type, uint16_t id)
 	}
 
 	get_bdaddr(id, index, btdev->bdaddr);
+	add_bdaddr(btdev);
 
 	return btdev;
 }
@@ -845,13 +926,13 @@ static bool inquiry_callback(void *user_data)
 	struct btdev *btdev = data->btdev;
 	struct bt_hci_evt_inquiry_complete ic;
 	int sent = data->sent_count;
-	int i;
+	unsigned int i;
 
 	/*Report devices only once and wait for inquiry timeout*/
-	if (data->iter == MAX_BTDEV_ENTRIES)
+	if (data->iter == btdev_list_size)
 		return true;
 
-	for (i = data->iter; i < MAX_BTDEV_ENTRIES; i++) {
+	for (i = data->iter; i < btdev_list_size; i++) {
 		/*Lets sent 10 inquiry results at once */
 		if (sent + 10 == data->sent_count)
 			break;
@@ -1848,11 +1929,11 @@ static uint8_t get_adv_report_type(uint8_t adv_type)
 static void le_set_adv_enable_complete(struct btdev *btdev)
 {
 	uint8_t report_type;
-	int i;
+	unsigned int i;
 
 	report_type = get_adv_report_type(btdev->le_adv_type);
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
+	for (i = 0; i < btdev_list_size; i++) {
 		if (!btdev_list[i] || btdev_list[i] == btdev)
 			continue;
 
@@ -1875,9 +1956,9 @@ static void le_set_adv_enable_complete(struct btdev *btdev)
 
 static void le_set_scan_enable_complete(struct btdev *btdev)
 {
-	int i;
+	unsigned int i;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
+	for (i = 0; i < btdev_list_size; i++) {
 		uint8_t report_type;
 
 		if (!btdev_list[i] || btdev_list[i] == btdev)
@@ -2938,7 +3019,7 @@ static void default_cmd(struct btdev *btdev, uint16_t opcode,
 		if (btdev->type == BTDEV_TYPE_BREDR)
 			goto unsupported;
 		lsra = data;
-		memcpy(btdev->random_addr, lsra->addr, 6);
+		set_random_addr(btdev, lsra->addr);
 		status = BT_HCI_ERR_SUCCESS;
 		cmd_complete(btdev, opcode, &status, sizeof(status));
 		break;
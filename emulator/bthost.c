@@ -32,10 +32,13 @@
 #include <string.h>
 #include <endian.h>
 #include <stdbool.h>
+#include <time.h>
+#include <sys/param.h>
 
 #include "lib/bluetooth.h"
 
 #include "src/shared/util.h"
+#include "src/shared/att-types.h"
 #include "monitor/bt.h"
 #include "monitor/rfcomm.h"
 #include "bthost.h"
@@ -53,6 +56,9 @@
 #define L2CAP_IT_FEAT_MASK	0x0002
 #define L2CAP_IT_FIXED_CHAN	0x0003
 
+/* ACL packets whose completion time is tracked per connection */
+#define TX_TIME_MAX		64
+
 /* RFCOMM setters */
 #define RFCOMM_ADDR(cr, dlci)	(((dlci & 0x3f) << 2) | (cr << 1) | 0x01)
 #define RFCOMM_CTRL(type, pf)	(((type & 0xef) | (pf << 4)))
@@ -154,15 +160,38 @@ struct btconn {
 	struct rfcomm_chan_hook *rfcomm_chan_hooks;
 	struct btconn *next;
 	void *smp_data;
+	struct traffic *traffic;
+	uint16_t acl_in_flight;
+	uint64_t tx_time[TX_TIME_MAX];
+	uint8_t tx_time_head;
+	uint8_t tx_time_count;
 };
 
 struct l2conn {
 	uint16_t scid;
 	uint16_t dcid;
 	uint16_t psm;
+	uint16_t tx_mps;
+	uint16_t tx_credits;
 	struct l2conn *next;
 };
 
+struct traffic {
+	uint8_t type;
+	uint16_t id;
+	uint16_t len;
+	uint32_t count;
+	uint32_t seq;
+	uint8_t *frame;
+	uint16_t frame_len;
+	uint16_t frame_off;
+	uint16_t in_flight;
+	uint64_t start;
+	struct bthost_traffic_stats stats;
+	bthost_traffic_cb cb;
+	void *user_data;
+};
+
 struct rcconn {
 	uint8_t channel;
 	uint16_t scid;
@@ -224,6 +253,14 @@ struct bthost {
 	bool conn_init;
 	bool le;
 	bool sc;
+	uint8_t buffer_reads;
+	bool buffers_read;
+	uint16_t acl_mtu;
+	uint16_t acl_pkts;
+	uint16_t le_mtu;
+	uint16_t le_pkts;
+	int acl_credits;
+	int le_credits;
 };
 
 struct bthost *bthost_create(void)
@@ -251,11 +288,20 @@ static void l2conn_free(struct l2conn *conn)
 	free(conn);
 }
 
+static void traffic_free(struct traffic *traffic)
+{
+	free(traffic->frame);
+	free(traffic);
+}
+
 static void btconn_free(struct btconn *conn)
 {
 	if (conn->smp_data)
 		smp_conn_del(conn->smp_data);
 
+	if (conn->traffic)
+		traffic_free(conn->traffic);
+
 	while (conn->l2conns) {
 		struct l2conn *l2conn = conn->l2conns;
 
@@ -383,6 +429,19 @@ static struct l2conn *btconn_find_l2cap_conn_by_scid(struct btconn *conn,
 	return NULL;
 }
 
+static struct l2conn *btconn_find_l2cap_conn_by_dcid(struct btconn *conn,
+								uint16_t dcid)
+{
+	struct l2conn *l2conn;
+
+	for (l2conn = conn->l2conns; l2conn != NULL; l2conn = l2conn->next) {
+		if (l2conn->dcid == dcid)
+			return l2conn;
+	}
+
+	return NULL;
+}
+
 static struct l2cap_conn_cb_data *bthost_find_l2cap_cb_by_psm(
 					struct bthost *bthost, uint16_t psm)
 {
@@ -504,6 +563,50 @@ static void send_packet(struct bthost *bthost, const struct iovec *iov,
 	bthost->send_handler(iov, iovlen, bthost->send_data);
 }
 
+static uint64_t get_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static int *conn_credits(struct bthost *bthost, struct btconn *conn)
+{
+	/* LE shares the ACL buffers if the controller has none of its own */
+	if (conn->addr_type != BDADDR_BREDR && bthost->le_pkts)
+		return &bthost->le_credits;
+
+	return &bthost->acl_credits;
+}
+
+static uint16_t conn_mtu(struct bthost *bthost, struct btconn *conn)
+{
+	if (conn->addr_type != BDADDR_BREDR && bthost->le_pkts)
+		return bthost->le_mtu;
+
+	return bthost->acl_mtu;
+}
+
+static void acl_packet_sent(struct bthost *bthost, struct btconn *conn,
+								bool timed)
+{
+	uint8_t idx;
+
+	if (!bthost->buffers_read)
+		return;
+
+	(*conn_credits(bthost, conn))--;
+	conn->acl_in_flight++;
+
+	if (conn->tx_time_count == TX_TIME_MAX)
+		return;
+
+	idx = (conn->tx_time_head + conn->tx_time_count++) % TX_TIME_MAX;
+	conn->tx_time[idx] = timed ? get_usec() : 0;
+}
+
 static void send_iov(struct bthost *bthost, uint16_t handle, uint16_t cid,
 					const struct iovec *iov, int iovcnt)
 {
@@ -511,6 +614,7 @@ static void send_iov(struct bthost *bthost, uint16_t handle, uint16_t cid,
 	struct bt_l2cap_hdr l2_hdr;
 	uint8_t pkt = BT_H4_ACL_PKT;
 	struct iovec pdu[3 + iovcnt];
+	struct btconn *conn;
 	int i, len = 0;
 
 	for (i = 0; i < iovcnt; i++) {
@@ -535,6 +639,10 @@ static void send_iov(struct bthost *bthost, uint16_t handle, uint16_t cid,
 	pdu[2].iov_len = sizeof(l2_hdr);
 
 	send_packet(bthost, pdu, 3 + iovcnt);
+
+	conn = bthost_find_conn(bthost, handle);
+	if (conn)
+		acl_packet_sent(bthost, conn, false);
 }
 
 static void send_acl(struct bthost *bthost, uint16_t handle, uint16_t cid,
@@ -739,6 +847,248 @@ static void next_cmd(struct bthost *bthost)
 	free(cmd);
 }
 
+static bool traffic_next_frame(struct btconn *conn, struct traffic *traffic)
+{
+	struct l2conn *l2conn = NULL;
+	uint8_t *pdu, *payload;
+	uint16_t cid, hdr_len;
+	uint16_t i;
+
+	if (traffic->count && traffic->seq == traffic->count)
+		return false;
+
+	switch (traffic->type) {
+	case BTHOST_TRAFFIC_L2CAP:
+		cid = traffic->id;
+		hdr_len = 0;
+		break;
+	case BTHOST_TRAFFIC_LE_COC:
+		l2conn = btconn_find_l2cap_conn_by_dcid(conn, traffic->id);
+		if (!l2conn || !l2conn->tx_credits)
+			return false;
+		cid = traffic->id;
+		hdr_len = 2;
+		break;
+	case BTHOST_TRAFFIC_ATT_WRITE:
+	case BTHOST_TRAFFIC_ATT_NOTIFY:
+		cid = 0x0004;
+		hdr_len = 3;
+		break;
+	default:
+		return false;
+	}
+
+	pdu = traffic->frame + sizeof(struct bt_l2cap_hdr);
+
+	put_le16(hdr_len + traffic->len, traffic->frame);
+	put_le16(cid, traffic->frame + 2);
+
+	switch (traffic->type) {
+	case BTHOST_TRAFFIC_LE_COC:
+		/* One SDU per K-frame, so the SDU length is always present */
+		put_le16(traffic->len, pdu);
+		l2conn->tx_credits--;
+		break;
+	case BTHOST_TRAFFIC_ATT_WRITE:
+		pdu[0] = BT_ATT_OP_WRITE_CMD;
+		put_le16(traffic->id, pdu + 1);
+		break;
+	case BTHOST_TRAFFIC_ATT_NOTIFY:
+		pdu[0] = BT_ATT_OP_HANDLE_VAL_NOT;
+		put_le16(traffic->id, pdu + 1);
+		break;
+	}
+
+	/* Sequence number first so the receiver can spot loss */
+	payload = pdu + hdr_len;
+
+	for (i = 0; i < traffic->len; i++)
+		payload[i] = i + traffic->seq;
+
+	if (traffic->len >= 4)
+		put_le32(traffic->seq, payload);
+
+	traffic->frame_len = sizeof(struct bt_l2cap_hdr) + hdr_len +
+								traffic->len;
+	traffic->frame_off = 0;
+	traffic->seq++;
+
+	traffic->stats.sdus++;
+	traffic->stats.bytes += traffic->len;
+
+	return true;
+}
+
+static void traffic_finish(struct btconn *conn)
+{
+	struct traffic *traffic = conn->traffic;
+	struct bthost_traffic_stats stats;
+	bthost_traffic_cb cb = traffic->cb;
+	void *user_data = traffic->user_data;
+
+	traffic->stats.duration = get_usec() - traffic->start;
+	stats = traffic->stats;
+
+	/* Free first so the callback can start another stream */
+	conn->traffic = NULL;
+	traffic_free(traffic);
+
+	if (cb)
+		cb(&stats, user_data);
+}
+
+static void traffic_pump(struct bthost *bthost, struct btconn *conn)
+{
+	struct traffic *traffic = conn->traffic;
+	struct bt_hci_acl_hdr acl_hdr;
+	uint8_t pkt = BT_H4_ACL_PKT;
+	struct iovec iov[3];
+	int *credits;
+	uint16_t mtu;
+
+	if (!traffic || !bthost->buffers_read)
+		return;
+
+	credits = conn_credits(bthost, conn);
+	mtu = conn_mtu(bthost, conn);
+
+	while (1) {
+		uint16_t frag;
+		uint8_t flags;
+
+		if (traffic->frame_off == traffic->frame_len &&
+				!traffic_next_frame(conn, traffic))
+			break;
+
+		if (*credits <= 0 || conn->tx_time_count == TX_TIME_MAX) {
+			traffic->stats.stalls++;
+			break;
+		}
+
+		frag = MIN(mtu, traffic->frame_len - traffic->frame_off);
+
+		/* Continuation fragments after the first one */
+		flags = traffic->frame_off ? 0x01 : 0x00;
+
+		acl_hdr.handle = cpu_to_le16(acl_handle_pack(conn->handle,
+									flags));
+		acl_hdr.dlen = cpu_to_le16(frag);
+
+		iov[0].iov_base = &pkt;
+		iov[0].iov_len = sizeof(pkt);
+		iov[1].iov_base = &acl_hdr;
+		iov[1].iov_len = sizeof(acl_hdr);
+		iov[2].iov_base = traffic->frame + traffic->frame_off;
+		iov[2].iov_len = frag;
+
+		send_packet(bthost, iov, 3);
+		acl_packet_sent(bthost, conn, true);
+
+		traffic->frame_off += frag;
+		traffic->in_flight++;
+		traffic->stats.acl_packets++;
+	}
+
+	if (traffic->count && traffic->seq == traffic->count &&
+				traffic->frame_off == traffic->frame_len &&
+				!traffic->in_flight)
+		traffic_finish(conn);
+}
+
+static void traffic_pump_all(struct bthost *bthost)
+{
+	struct btconn *conn, *next;
+
+	for (conn = bthost->conns; conn != NULL; conn = next) {
+		next = conn->next;
+		traffic_pump(bthost, conn);
+	}
+}
+
+static void acl_packets_completed(struct bthost *bthost, struct btconn *conn,
+								uint16_t count)
+{
+	struct traffic *traffic = conn->traffic;
+	uint64_t now = get_usec();
+	int *credits, max;
+
+	count = MIN(count, conn->acl_in_flight);
+	conn->acl_in_flight -= count;
+
+	credits = conn_credits(bthost, conn);
+	max = credits == &bthost->le_credits ? bthost->le_pkts :
+							bthost->acl_pkts;
+	*credits = MIN(*credits + count, max);
+
+	while (count-- && conn->tx_time_count) {
+		uint64_t sent = conn->tx_time[conn->tx_time_head];
+		uint64_t latency;
+
+		conn->tx_time_head = (conn->tx_time_head + 1) % TX_TIME_MAX;
+		conn->tx_time_count--;
+
+		if (!sent || !traffic)
+			continue;
+
+		latency = now - sent;
+
+		if (!traffic->stats.completed ||
+					latency < traffic->stats.latency_min)
+			traffic->stats.latency_min = latency;
+		if (latency > traffic->stats.latency_max)
+			traffic->stats.latency_max = latency;
+
+		traffic->stats.latency_total += latency;
+		traffic->stats.completed++;
+
+		if (traffic->in_flight)
+			traffic->in_flight--;
+	}
+}
+
+static void buffer_size_read(struct bthost *bthost)
+{
+	if (!bthost->buffer_reads || --bthost->buffer_reads)
+		return;
+
+	if (!bthost->acl_pkts) {
+		bthost->acl_pkts = 1;
+		bthost->acl_mtu = 27;
+	}
+
+	bthost->acl_credits = bthost->acl_pkts;
+	bthost->le_credits = bthost->le_pkts;
+	bthost->buffers_read = true;
+
+	traffic_pump_all(bthost);
+}
+
+static void read_buffer_size_complete(struct bthost *bthost, const void *data,
+								uint8_t len)
+{
+	const struct bt_hci_rsp_read_buffer_size *ev = data;
+
+	if (len >= sizeof(*ev) && !ev->status) {
+		bthost->acl_mtu = le16_to_cpu(ev->acl_mtu);
+		bthost->acl_pkts = le16_to_cpu(ev->acl_max_pkt);
+	}
+
+	buffer_size_read(bthost);
+}
+
+static void le_read_buffer_size_complete(struct bthost *bthost,
+						const void *data, uint8_t len)
+{
+	const struct bt_hci_rsp_le_read_buffer_size *ev = data;
+
+	if (len >= sizeof(*ev) && !ev->status) {
+		bthost->le_mtu = le16_to_cpu(ev->le_mtu);
+		bthost->le_pkts = ev->le_max_pkt;
+	}
+
+	buffer_size_read(bthost);
+}
+
 static void read_bd_addr_complete(struct bthost *bthost, const void *data,
 								uint8_t len)
 {
@@ -809,6 +1159,12 @@ static void evt_cmd_complete(struct bthost *bthost, const void *data,
 	case BT_HCI_CMD_READ_BD_ADDR:
 		read_bd_addr_complete(bthost, param, len - sizeof(*ev));
 		break;
+	case BT_HCI_CMD_READ_BUFFER_SIZE:
+		read_buffer_size_complete(bthost, param, len - sizeof(*ev));
+		break;
+	case BT_HCI_CMD_LE_READ_BUFFER_SIZE:
+		le_read_buffer_size_complete(bthost, param, len - sizeof(*ev));
+		break;
 	case BT_HCI_CMD_WRITE_SCAN_ENABLE:
 		break;
 	case BT_HCI_CMD_LE_SET_ADV_ENABLE:
@@ -868,6 +1224,10 @@ static void evt_cmd_status(struct bthost *bthost, const void *data,
 		bthost->cmd_complete_cb(opcode, ev->status, NULL, 0,
 						bthost->cmd_complete_data);
 
+	if (ev->status && (opcode == BT_HCI_CMD_READ_BUFFER_SIZE ||
+				opcode == BT_HCI_CMD_LE_READ_BUFFER_SIZE))
+		buffer_size_read(bthost);
+
 	next_cmd(bthost);
 }
 
@@ -961,6 +1321,12 @@ static void evt_disconn_complete(struct bthost *bthost, const void *data,
 		struct btconn *conn = *curr;
 
 		if (conn->handle == handle) {
+			/* Packets of a gone connection count as completed */
+			acl_packets_completed(bthost, conn,
+							conn->acl_in_flight);
+			if (conn->traffic)
+				traffic_finish(conn);
+
 			*curr = conn->next;
 			btconn_free(conn);
 		} else {
@@ -973,9 +1339,24 @@ static void evt_num_completed_packets(struct bthost *bthost, const void *data,
 								uint8_t len)
 {
 	const struct bt_hci_evt_num_completed_packets *ev = data;
+	const uint8_t *ptr = data + 1;
+	uint8_t i;
 
 	if (len < sizeof(*ev))
 		return;
+
+	if (len < 1 + ev->num_handles * 4)
+		return;
+
+	for (i = 0; i < ev->num_handles; i++, ptr += 4) {
+		struct btconn *conn;
+
+		conn = bthost_find_conn(bthost, acl_handle(get_le16(ptr)));
+		if (conn)
+			acl_packets_completed(bthost, conn, get_le16(ptr + 2));
+	}
+
+	traffic_pump_all(bthost);
 }
 
 static void evt_auth_complete(struct bthost *bthost, const void *data,
@@ -1727,6 +2108,18 @@ static bool l2cap_le_conn_req(struct bthost *bthost, struct btconn *conn,
 	l2cap_sig_send(bthost, conn, BT_L2CAP_PDU_LE_CONN_RSP, ident, &rsp,
 								sizeof(rsp));
 
+	if (!rsp.result) {
+		struct l2conn *l2conn;
+
+		l2conn = bthost_add_l2cap_conn(bthost, conn,
+						le16_to_cpu(rsp.dcid),
+						le16_to_cpu(req->scid), psm);
+		if (l2conn) {
+			l2conn->tx_mps = le16_to_cpu(req->mps);
+			l2conn->tx_credits = le16_to_cpu(req->credits);
+		}
+	}
+
 	return true;
 }
 
@@ -1734,11 +2127,37 @@ static bool l2cap_le_conn_rsp(struct bthost *bthost, struct btconn *conn,
 				uint8_t ident, const void *data, uint16_t len)
 {
 	const struct bt_l2cap_pdu_le_conn_rsp *rsp = data;
+	struct l2conn *l2conn;
 
 	if (len < sizeof(*rsp))
 		return false;
 	/* TODO add L2CAP connection before with proper PSM */
-	bthost_add_l2cap_conn(bthost, conn, 0, le16_to_cpu(rsp->dcid), 0);
+	l2conn = bthost_add_l2cap_conn(bthost, conn, 0,
+						le16_to_cpu(rsp->dcid), 0);
+	if (l2conn) {
+		l2conn->tx_mps = le16_to_cpu(rsp->mps);
+		l2conn->tx_credits = le16_to_cpu(rsp->credits);
+	}
+
+	return true;
+}
+
+static bool l2cap_le_flowctl_creds(struct bthost *bthost, struct btconn *conn,
+				uint8_t ident, const void *data, uint16_t len)
+{
+	const struct bt_l2cap_pdu_le_flowctl_creds *ind = data;
+	struct l2conn *l2conn;
+
+	if (len < sizeof(*ind))
+		return false;
+
+	l2conn = btconn_find_l2cap_conn_by_dcid(conn, le16_to_cpu(ind->cid));
+	if (!l2conn)
+		return true;
+
+	l2conn->tx_credits += le16_to_cpu(ind->credits);
+
+	traffic_pump(bthost, conn);
 
 	return true;
 }
@@ -1790,6 +2209,11 @@ static void l2cap_le_sig(struct bthost *bthost, struct btconn *conn,
 						data + sizeof(*hdr), hdr_len);
 		break;
 
+	case BT_L2CAP_PDU_LE_FLOWCTL_CREDS:
+		ret = l2cap_le_flowctl_creds(bthost, conn, hdr->ident,
+						data + sizeof(*hdr), hdr_len);
+		break;
+
 	default:
 		printf("Unknown L2CAP code 0x%02x\n", hdr->code);
 		ret = false;
@@ -2585,3 +3009,98 @@ void bthost_send_rfcomm_data(struct bthost *bthost, uint16_t handle,
 
 	free(uih_frame);
 }
+
+bool bthost_traffic_start(struct bthost *bthost, uint16_t handle, uint8_t type,
+				uint16_t id, uint16_t len, uint32_t count,
+				bthost_traffic_cb cb, void *user_data)
+{
+	struct traffic *traffic;
+	struct btconn *conn;
+	struct l2conn *l2conn;
+
+	conn = bthost_find_conn(bthost, handle);
+	if (!conn || conn->traffic)
+		return false;
+
+	switch (type) {
+	case BTHOST_TRAFFIC_L2CAP:
+		break;
+	case BTHOST_TRAFFIC_LE_COC:
+		l2conn = btconn_find_l2cap_conn_by_dcid(conn, id);
+		if (!l2conn || len + 2 > l2conn->tx_mps)
+			return false;
+		break;
+	case BTHOST_TRAFFIC_ATT_WRITE:
+	case BTHOST_TRAFFIC_ATT_NOTIFY:
+		if (len > UINT16_MAX - 3)
+			return false;
+		break;
+	default:
+		return false;
+	}
+
+	traffic = new0(struct traffic, 1);
+	if (!traffic)
+		return false;
+
+	traffic->frame = malloc(sizeof(struct bt_l2cap_hdr) + 3 + len);
+	if (!traffic->frame) {
+		free(traffic);
+		return false;
+	}
+
+	traffic->type = type;
+	traffic->id = id;
+	traffic->len = len;
+	traffic->count = count;
+	traffic->cb = cb;
+	traffic->user_data = user_data;
+	traffic->start = get_usec();
+
+	conn->traffic = traffic;
+
+	/* Flow control needs the controller buffers, read them once */
+	if (!bthost->buffers_read && !bthost->buffer_reads) {
+		bthost->buffer_reads++;
+		send_command(bthost, BT_HCI_CMD_READ_BUFFER_SIZE, NULL, 0);
+
+		if (bthost->features[4] & 0x40) {
+			bthost->buffer_reads++;
+			send_command(bthost, BT_HCI_CMD_LE_READ_BUFFER_SIZE,
+								NULL, 0);
+		}
+
+		return true;
+	}
+
+	traffic_pump(bthost, conn);
+
+	return true;
+}
+
+void bthost_traffic_stop(struct bthost *bthost, uint16_t handle)
+{
+	struct btconn *conn;
+
+	conn = bthost_find_conn(bthost, handle);
+	if (!conn || !conn->traffic)
+		return;
+
+	traffic_free(conn->traffic);
+	conn->traffic = NULL;
+}
+
+bool bthost_traffic_get_stats(struct bthost *bthost, uint16_t handle,
+					struct bthost_traffic_stats *stats)
+{
+	struct btconn *conn;
+
+	conn = bthost_find_conn(bthost, handle);
+	if (!conn || !conn->traffic)
+		return false;
+
+	*stats = conn->traffic->stats;
+	stats->duration = get_usec() - conn->traffic->start;
+
+	return true;
+}
@@ -134,6 +134,33 @@ void bthost_send_rfcomm_data(struct bthost *bthost, uint16_t handle,
 					uint8_t channel, const void *data,
 					uint16_t len);
 
+#define BTHOST_TRAFFIC_L2CAP		0x00
+#define BTHOST_TRAFFIC_LE_COC		0x01
+#define BTHOST_TRAFFIC_ATT_WRITE	0x02
+#define BTHOST_TRAFFIC_ATT_NOTIFY	0x03
+
+struct bthost_traffic_stats {
+	uint64_t sdus;
+	uint64_t bytes;
+	uint64_t acl_packets;
+	uint64_t completed;
+	uint64_t stalls;
+	uint64_t latency_min;
+	uint64_t latency_max;
+	uint64_t latency_total;
+	uint64_t duration;
+};
+
+typedef void (*bthost_traffic_cb) (const struct bthost_traffic_stats *stats,
+							void *user_data);
+
+bool bthost_traffic_start(struct bthost *bthost, uint16_t handle, uint8_t type,
+				uint16_t id, uint16_t len, uint32_t count,
+				bthost_traffic_cb cb, void *user_data);
+void bthost_traffic_stop(struct bthost *bthost, uint16_t handle);
+bool bthost_traffic_get_stats(struct bthost *bthost, uint16_t handle,
+					struct bthost_traffic_stats *stats);
+
 void bthost_start(struct bthost *bthost);
 
 /* LE SMP support */
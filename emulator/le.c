@@ -62,11 +62,26 @@
 #define DEFAULT_TX_PHYS		0x00
 #define DEFAULT_RX_PHYS		0x00
 
+#define ADV_LOAD_TICK		10	/* Report batch interval in msec */
+#define ADV_LOAD_RATE		1000	/* Default reports per second */
+#define ADV_LOAD_RPA_TIMEOUT	60	/* Address rotation in seconds */
+
 struct bt_peer {
 	uint8_t  addr_type;
 	uint8_t  addr[6];
 };
 
+struct adv_load {
+	int timeout_id;
+	unsigned int count;
+	unsigned int rate;
+	uint8_t data_len;
+	unsigned int next;
+	unsigned int credit;
+	uint32_t seed;
+	time_t start;
+};
+
 struct bt_le {
 	volatile int ref_count;
 	int vhci_fd;
@@ -133,6 +148,8 @@ struct bt_le {
 
 	struct bt_peer scan_cache[SCAN_CACHE_SIZE];
 	uint8_t scan_cache_count;
+
+	struct adv_load adv_load;
 };
 
 static bool is_in_white_list(struct bt_le *hci, uint8_t addr_type,
@@ -1952,8 +1969,52 @@ static void vhci_read_callback(int fd, uint32_t events, void *user_data)
 	}
 }
 
+static bool accept_adv_report(struct bt_le *hci, uint8_t addr_type,
+					const uint8_t addr[6],
+					uint8_t *report_addr_type,
+					uint8_t report_addr[6])
+{
+	resolve_peer_addr(hci, addr_type, addr, report_addr_type,
+							report_addr);
+
+	if (hci->le_scan_filter_policy == 0x01 ||
+				hci->le_scan_filter_policy == 0x03) {
+		if (!is_in_white_list(hci, *report_addr_type, report_addr))
+			return false;
+	}
+
+	if (hci->le_scan_filter_dup) {
+		if (!add_to_scan_cache(hci, *report_addr_type, report_addr))
+			return false;
+	}
+
+	return true;
+}
+
+static void send_adv_report(struct bt_le *hci, uint8_t event_type,
+				uint8_t addr_type, const uint8_t addr[6],
+				const void *data, uint8_t data_len,
+				int8_t rssi)
+{
+	uint8_t buf[100];
+	struct bt_hci_evt_le_adv_report *evt = (void *) buf;
+
+	memset(buf, 0, sizeof(buf));
+	evt->num_reports = 0x01;
+	evt->event_type = event_type;
+	evt->addr_type = addr_type;
+	memcpy(evt->addr, addr, 6);
+	evt->data_len = data_len;
+	memcpy(buf + sizeof(*evt), data, data_len);
+	buf[sizeof(*evt) + data_len] = rssi;
+
+	le_meta_event(hci, BT_HCI_EVT_LE_ADV_REPORT, buf,
+					sizeof(*evt) + data_len + 1);
+}
+
 static void phy_recv_callback(uint16_t type, const void *data,
-						size_t size, void *user_data)
+					size_t size, int8_t rssi,
+					void *user_data)
 {
 	struct bt_le *hci = user_data;
 
@@ -1964,61 +2025,197 @@ static void phy_recv_callback(uint16_t type, const void *data,
 
 		if (hci->scan_window_active) {
 			const struct bt_phy_pkt_adv *pkt = data;
-			uint8_t buf[100];
-			struct bt_hci_evt_le_adv_report *evt = (void *) buf;
 			uint8_t tx_addr_type, tx_addr[6];
 
 			if (hci->scan_chan_idx != pkt->chan_idx)
 				break;
 
-			resolve_peer_addr(hci, pkt->tx_addr_type, pkt->tx_addr,
-							&tx_addr_type, tx_addr);
-
-			if (hci->le_scan_filter_policy == 0x01 ||
-					hci->le_scan_filter_policy == 0x03) {
-				if (!is_in_white_list(hci, tx_addr_type,
-								tx_addr))
-					break;
-			}
-
-			if (hci->le_scan_filter_dup) {
-				if (!add_to_scan_cache(hci, tx_addr_type,
-								tx_addr))
-					break;
-			}
-
-			memset(buf, 0, sizeof(buf));
-			evt->num_reports = 0x01;
-			evt->event_type = pkt->pdu_type;
-			evt->addr_type = tx_addr_type;
-			memcpy(evt->addr, tx_addr, 6);
-			evt->data_len = pkt->adv_data_len;
-			memcpy(buf + sizeof(*evt), data + sizeof(*pkt),
-							pkt->adv_data_len);
+			if (!accept_adv_report(hci, pkt->tx_addr_type,
+							pkt->tx_addr,
+							&tx_addr_type, tx_addr))
+				break;
 
-			le_meta_event(hci, BT_HCI_EVT_LE_ADV_REPORT, buf,
-					sizeof(*evt) + pkt->adv_data_len + 1);
+			send_adv_report(hci, pkt->pdu_type, tx_addr_type,
+					tx_addr, data + sizeof(*pkt),
+					pkt->adv_data_len, rssi);
 
 			if (hci->le_scan_type == 0x00)
 				break;
 
-			memset(buf, 0, sizeof(buf));
-			evt->num_reports = 0x01;
-			evt->event_type = 0x04;
-			evt->addr_type = tx_addr_type;
-			memcpy(evt->addr, tx_addr, 6);
-			evt->data_len = pkt->scan_rsp_len;
-			memcpy(buf + sizeof(*evt), data + sizeof(*pkt) +
-							pkt->adv_data_len,
-							pkt->scan_rsp_len);
-
-			le_meta_event(hci, BT_HCI_EVT_LE_ADV_REPORT, buf,
-					sizeof(*evt) + pkt->scan_rsp_len + 1);
+			send_adv_report(hci, 0x04, tx_addr_type, tx_addr,
+					data + sizeof(*pkt) + pkt->adv_data_len,
+					pkt->scan_rsp_len, rssi);
 		}
 		break;
 	}
 }
 
+static uint32_t adv_load_hash(uint32_t a, uint32_t b)
+{
+	uint32_t h = a * 0x9e3779b1 ^ b;
+
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return h;
+}
+
+static uint32_t adv_load_random(struct adv_load *load)
+{
+	/* xorshift32, results only need to be cheap and reproducible */
+	load->seed ^= load->seed << 13;
+	load->seed ^= load->seed >> 17;
+	load->seed ^= load->seed << 5;
+
+	return load->seed;
+}
+
+static void adv_load_addr(struct adv_load *load, unsigned int index,
+								uint8_t addr[6])
+{
+	uint32_t epoch = (time(NULL) - load->start) / ADV_LOAD_RPA_TIMEOUT;
+	uint32_t h1 = adv_load_hash(index, epoch);
+	uint32_t h2 = adv_load_hash(h1, index);
+
+	/* Resolvable private address, rotated every ADV_LOAD_RPA_TIMEOUT */
+	put_le32(h1, addr);
+	put_le16(h2, addr + 4);
+	addr[5] = (addr[5] & 0x3f) | 0x40;
+}
+
+static uint8_t adv_load_data(struct adv_load *load, unsigned int index,
+								uint8_t *data)
+{
+	uint8_t len = 0;
+	int n;
+
+	/* Flags: LE General Discoverable, BR/EDR Not Supported */
+	data[len++] = 0x02;
+	data[len++] = 0x01;
+	data[len++] = 0x06;
+
+	/* Complete Local Name, data holds up to 31 octets */
+	n = snprintf((char *) data + len + 2, 31 - len - 2, "Load %u",
+									index);
+	if (n > 31 - len - 3)
+		n = 31 - len - 3;
+
+	data[len++] = n + 1;
+	data[len++] = 0x09;
+	len += n;
+
+	/* Pad with manufacturer data up to the configured length */
+	if (load->data_len > len + 4) {
+		uint8_t mlen = load->data_len - len - 2;
+		uint8_t i;
+
+		/* Manufacturer Specific Data, no company identifier */
+		data[len++] = mlen + 1;
+		data[len++] = 0xff;
+		put_le16(0xffff, data + len);
+		for (i = 2; i < mlen; i++)
+			data[len + i] = adv_load_hash(index, i);
+		len += mlen;
+	}
+
+	return len;
+}
+
+static int8_t adv_load_rssi(struct adv_load *load, unsigned int index)
+{
+	/* Fixed per advertiser distance between -95 and -35 with jitter */
+	int base = -95 + (int) (adv_load_hash(index, 0x55) % 61);
+	int jitter = (int) (adv_load_random(load) % 11) - 5;
+
+	return base + jitter;
+}
+
+static void adv_load_report(struct bt_le *hci, unsigned int index)
+{
+	struct adv_load *load = &hci->adv_load;
+	uint8_t addr[6], report_addr[6], report_addr_type;
+	uint8_t data[31];
+	uint8_t len;
+
+	adv_load_addr(load, index, addr);
+
+	if (!accept_adv_report(hci, 0x01, addr, &report_addr_type,
+								report_addr))
+		return;
+
+	len = adv_load_data(load, index, data);
+
+	send_adv_report(hci, 0x00, report_addr_type, report_addr, data, len,
+					adv_load_rssi(load, index));
+}
+
+static void adv_load_callback(int id, void *user_data)
+{
+	struct bt_le *hci = user_data;
+	struct adv_load *load = &hci->adv_load;
+	unsigned int reports;
+
+	if (!hci->le_scan_enable || !(hci->le_event_mask[0] & 0x02)) {
+		load->credit = 0;
+		goto done;
+	}
+
+	/* Carry remainders over so low rates still average out */
+	load->credit += load->rate * ADV_LOAD_TICK;
+	reports = load->credit / 1000;
+	load->credit %= 1000;
+
+	while (reports--) {
+		adv_load_report(hci, load->next);
+
+		if (++load->next >= load->count)
+			load->next = 0;
+	}
+
+done:
+	if (mainloop_modify_timeout(id, ADV_LOAD_TICK) < 0) {
+		fprintf(stderr, "Setting advertising load timeout failed\n");
+		load->timeout_id = -1;
+	}
+}
+
+bool bt_le_set_adv_load(struct bt_le *hci, unsigned int count,
+					unsigned int rate, uint8_t data_len)
+{
+	struct adv_load *load;
+
+	if (!hci)
+		return false;
+
+	load = &hci->adv_load;
+
+	if (load->timeout_id >= 0) {
+		mainloop_remove_timeout(load->timeout_id);
+		load->timeout_id = -1;
+	}
+
+	if (!count)
+		return true;
+
+	load->count = count;
+	load->rate = rate ? rate : ADV_LOAD_RATE;
+	load->data_len = data_len > 31 ? 31 : data_len;
+	load->next = 0;
+	load->credit = 0;
+	load->start = time(NULL);
+	load->seed = load->start | 1;
+
+	load->timeout_id = mainloop_add_timeout(ADV_LOAD_TICK,
+						adv_load_callback, hci, NULL);
+	if (load->timeout_id < 0)
+		return false;
+
+	return true;
+}
+
 struct bt_le *bt_le_new(void)
 {
 	unsigned char setup_cmd[2];
@@ -2031,6 +2228,7 @@ struct bt_le *bt_le_new(void)
 	hci->adv_timeout_id = -1;
 	hci->scan_timeout_id = -1;
 	hci->scan_window_active = false;
+	hci->adv_load.timeout_id = -1;
 
 	reset_defaults(hci);
 
@@ -2059,6 +2257,15 @@ struct bt_le *bt_le_new(void)
 	return bt_le_ref(hci);
 }
 
+bool bt_le_set_position(struct bt_le *hci, int16_t x, int16_t y,
+							int8_t tx_power)
+{
+	if (!hci)
+		return false;
+
+	return bt_phy_set_position(hci->phy, x, y, tx_power);
+}
+
 struct bt_le *bt_le_ref(struct bt_le *hci)
 {
 	if (!hci)
@@ -2078,6 +2285,7 @@ void bt_le_unref(struct bt_le *hci)
 		return;
 
 	stop_adv(hci);
+	bt_le_set_adv_load(hci, 0, 0, 0);
 
 	bt_crypto_unref(hci->crypto);
 	bt_phy_unref(hci->phy);
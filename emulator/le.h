@@ -23,6 +23,7 @@
  */
 
 #include <stdbool.h>
+#include <stdint.h>
 
 struct bt_le;
 
@@ -30,3 +31,8 @@ struct bt_le *bt_le_new(void);
 
 struct bt_le *bt_le_ref(struct bt_le *le);
 void bt_le_unref(struct bt_le *le);
+
+bool bt_le_set_adv_load(struct bt_le *le, unsigned int count,
+					unsigned int rate, uint8_t data_len);
+bool bt_le_set_position(struct bt_le *le, int16_t x, int16_t y,
+							int8_t tx_power);
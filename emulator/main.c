@@ -60,6 +60,8 @@ static void usage(void)
 		"\t-L                    Create LE only controller\n"
 		"\t-B                    Create BR/EDR only controller\n"
 		"\t-A                    Create AMP controller\n"
+		"\t-a count[,rate[,len]] Generate LE advertising load\n"
+		"\t-P x,y[,power]        Place LE controllers (meters, dBm)\n"
 		"\t-h, --help            Show help options\n");
 }
 
@@ -72,6 +74,8 @@ static const struct option main_options[] = {
 	{ "amp",     no_argument,       NULL, 'A' },
 	{ "letest",  optional_argument, NULL, 'U' },
 	{ "amptest", optional_argument, NULL, 'T' },
+	{ "adv-load", required_argument, NULL, 'a' },
+	{ "position", required_argument, NULL, 'P' },
 	{ "version", no_argument,	NULL, 'v' },
 	{ "help",    no_argument,	NULL, 'h' },
 	{ }
@@ -88,6 +92,12 @@ int main(int argc, char *argv[])
 	bool serial_enabled = false;
 	int letest_count = 0;
 	int amptest_count = 0;
+	unsigned int adv_load_count = 0;
+	unsigned int adv_load_rate = 0;
+	unsigned int adv_load_len = 0;
+	bool position = false;
+	double pos_x = 0, pos_y = 0;
+	int tx_power = 0;
 	int vhci_count = 0;
 	enum vhci_type vhci_type = VHCI_TYPE_BREDRLE;
 	sigset_t mask;
@@ -98,7 +108,7 @@ int main(int argc, char *argv[])
 	for (;;) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "Ssl::LBAUTvh",
+		opt = getopt_long(argc, argv, "Ssl::LBAUTa:P:vh",
 						main_options, NULL);
 		if (opt < 0)
 			break;
@@ -137,6 +147,24 @@ int main(int argc, char *argv[])
 			else
 				amptest_count = 1;
 			break;
+		case 'a':
+			if (sscanf(optarg, "%u,%u,%u", &adv_load_count,
+					&adv_load_rate, &adv_load_len) < 1) {
+				fprintf(stderr, "Invalid advertising load\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'P':
+			if (sscanf(optarg, "%lf,%lf,%d", &pos_x, &pos_y,
+							&tx_power) < 2 ||
+					pos_x < -3276 || pos_x > 3276 ||
+					pos_y < -3276 || pos_y > 3276 ||
+					tx_power < -127 || tx_power > 20) {
+				fprintf(stderr, "Invalid position\n");
+				return EXIT_FAILURE;
+			}
+			position = true;
+			break;
 		case 'v':
 			printf("%s\n", VERSION);
 			return EXIT_SUCCESS;
@@ -170,6 +198,19 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "Failed to create LE controller\n");
 			return EXIT_FAILURE;
 		}
+
+		/* The channel model works in decimeters */
+		if (position && !bt_le_set_position(le, pos_x * 10,
+							pos_y * 10, tx_power)) {
+			fprintf(stderr, "Failed to set position\n");
+			return EXIT_FAILURE;
+		}
+
+		if (!bt_le_set_adv_load(le, adv_load_count, adv_load_rate,
+							adv_load_len)) {
+			fprintf(stderr, "Failed to start advertising load\n");
+			return EXIT_FAILURE;
+		}
 	}
 
 	for (i = 0; i < amptest_count; i++) {
@@ -42,6 +42,15 @@
 
 #define BT_PHY_PORT 45023
 
+#define BT_PHY_FLAG_SIM		0x00000001
+
+#define SIM_CHANNELS		40
+#define SIM_PATH_LOSS_1M	40	/* dB at one meter on 2.4 GHz */
+#define SIM_PATH_LOSS_EXP	20	/* Path loss exponent times 10 */
+#define SIM_SENSITIVITY		-95	/* dBm */
+#define SIM_PER_MARGIN		10	/* dB above sensitivity without loss */
+#define SIM_AIR_OVERHEAD	10	/* Preamble, access address, header, CRC */
+
 struct bt_phy {
 	volatile int ref_count;
 	int rx_fd;
@@ -49,6 +58,14 @@ struct bt_phy {
 	uint64_t id;
 	bt_phy_callback_func_t callback;
 	void *user_data;
+
+	bool sim;
+	int16_t x;
+	int16_t y;
+	int8_t tx_power;
+	uint32_t seed;
+	uint64_t busy_until[SIM_CHANNELS];
+	struct bt_phy_stats stats;
 };
 
 struct bt_phy_hdr {
@@ -58,6 +75,14 @@ struct bt_phy_hdr {
 	uint16_t len;
 } __attribute__ ((packed));
 
+/* Follows the header when BT_PHY_FLAG_SIM is set */
+struct bt_phy_sim_hdr {
+	int16_t  x;
+	int16_t  y;
+	int8_t   tx_power;
+	uint64_t timestamp;
+} __attribute__ ((packed));
+
 static bool get_random_bytes(void *buf, size_t num_bytes)
 {
 	ssize_t len;
@@ -77,6 +102,108 @@ static bool get_random_bytes(void *buf, size_t num_bytes)
 	return true;
 }
 
+static uint64_t get_timestamp(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static uint32_t sim_random(struct bt_phy *phy)
+{
+	phy->seed ^= phy->seed << 13;
+	phy->seed ^= phy->seed >> 17;
+	phy->seed ^= phy->seed << 5;
+
+	return phy->seed;
+}
+
+/* 100 * log10 of the distance in meters, given its square in decimeters */
+static unsigned int sim_log_distance(uint64_t dist2)
+{
+	unsigned int log2 = 0;
+	uint64_t frac;
+
+	/* Clamp to one meter */
+	if (dist2 < 100)
+		return 0;
+
+	dist2 /= 100;
+
+	while ((dist2 >> log2) > 1)
+		log2++;
+
+	/* Linear interpolation of log2 in 1/256 units */
+	frac = ((dist2 - (1ULL << log2)) << 8) >> log2;
+
+	/* 100 * log10(sqrt(x)) = 15.0515 * log2(x) */
+	return ((log2 << 8) + frac) * 1505 / 25600;
+}
+
+static unsigned int sim_airtime(size_t size)
+{
+	/* LE 1M PHY, one microsecond per bit */
+	return (size + SIM_AIR_OVERHEAD) * 8;
+}
+
+/*
+ * Apply the channel model to a received packet and return false if it
+ * did not make it to the receiver. The transmitter's position, power
+ * and transmit time come with the packet, so every receiver evaluates
+ * its own link independently.
+ */
+static bool sim_receive(struct bt_phy *phy, const struct bt_phy_sim_hdr *sim,
+				uint16_t type, const void *data, size_t size,
+				int8_t *rssi)
+{
+	int64_t dx = (int16_t) le16_to_cpu(sim->x) - phy->x;
+	int64_t dy = (int16_t) le16_to_cpu(sim->y) - phy->y;
+	uint64_t start = le64_to_cpu(sim->timestamp);
+	unsigned int airtime = sim_airtime(size);
+	unsigned int loss;
+	uint8_t chan = 0;
+	int level, margin;
+
+	phy->stats.rx_airtime += airtime;
+
+	loss = SIM_PATH_LOSS_1M + sim_log_distance(dx * dx + dy * dy) *
+						SIM_PATH_LOSS_EXP / 10 / 10;
+	level = sim->tx_power - (int) loss;
+
+	if (level < SIM_SENSITIVITY) {
+		phy->stats.out_of_range++;
+		return false;
+	}
+
+	/* Packet error rate grows linearly towards the sensitivity */
+	margin = level - SIM_SENSITIVITY;
+	if (margin < SIM_PER_MARGIN &&
+			sim_random(phy) % (SIM_PER_MARGIN * 10) >=
+							(unsigned) margin * 10) {
+		phy->stats.errors++;
+		return false;
+	}
+
+	if ((type == BT_PHY_PKT_ADV || type == BT_PHY_PKT_CONN) && size > 0)
+		chan = *((const uint8_t *) data) % SIM_CHANNELS;
+
+	/* Overlapping transmissions on the same channel collide */
+	if (start < phy->busy_until[chan]) {
+		if (start + airtime > phy->busy_until[chan])
+			phy->busy_until[chan] = start + airtime;
+		phy->stats.collisions++;
+		return false;
+	}
+
+	phy->busy_until[chan] = start + airtime;
+
+	*rssi = level > 127 ? 127 : level;
+
+	return true;
+}
+
 static void phy_rx_callback(int fd, uint32_t events, void *user_data)
 {
 	struct bt_phy *phy = user_data;
@@ -84,7 +211,9 @@ static void phy_rx_callback(int fd, uint32_t events, void *user_data)
 	struct iovec iov[2];
 	struct bt_phy_hdr hdr;
 	unsigned char buf[4096];
+	unsigned char *data = buf;
 	ssize_t len;
+	int8_t rssi = 0;
 
 	if (events & (EPOLLERR | EPOLLHUP)) {
 		mainloop_remove_fd(fd);
@@ -110,12 +239,31 @@ static void phy_rx_callback(int fd, uint32_t events, void *user_data)
 	if (le64_to_cpu(hdr.id) == phy->id)
 		return;
 
-	if (len - sizeof(hdr) != le16_to_cpu(hdr.len))
+	len -= sizeof(hdr);
+
+	if (le32_to_cpu(hdr.flags) & BT_PHY_FLAG_SIM) {
+		const struct bt_phy_sim_hdr *sim = (void *) buf;
+
+		if ((size_t) len < sizeof(*sim))
+			return;
+
+		data += sizeof(*sim);
+		len -= sizeof(*sim);
+
+		if (len != le16_to_cpu(hdr.len))
+			return;
+
+		if (phy->sim && !sim_receive(phy, sim, le16_to_cpu(hdr.type),
+							data, len, &rssi))
+			return;
+	} else if (len != le16_to_cpu(hdr.len))
 		return;
 
+	phy->stats.rx_packets++;
+
 	if (phy->callback)
-		phy->callback(le16_to_cpu(hdr.type),
-				buf, len - sizeof(hdr), phy->user_data);
+		phy->callback(le16_to_cpu(hdr.type), data, len, rssi,
+							phy->user_data);
 }
 
 static int create_rx_socket(void)
@@ -183,6 +331,8 @@ struct bt_phy *bt_phy_new(void)
 		phy->id = random();
 	}
 
+	phy->seed = phy->id | 1;
+
 	bt_phy_send(phy, BT_PHY_PKT_NULL, NULL, 0);
 
 	return bt_phy_ref(phy);
@@ -226,9 +376,10 @@ bool bt_phy_send_vector(struct bt_phy *phy, uint16_t type,
 					const void *data3, size_t size3)
 {
 	struct bt_phy_hdr hdr;
+	struct bt_phy_sim_hdr sim;
 	struct sockaddr_in addr;
 	struct msghdr msg;
-	struct iovec iov[4];
+	struct iovec iov[5];
 	ssize_t len;
 
 	if (!phy)
@@ -247,7 +398,7 @@ bool bt_phy_send_vector(struct bt_phy *phy, uint16_t type,
 
 	memset(&hdr, 0, sizeof(hdr));
 	hdr.id = cpu_to_le64(phy->id);
-	hdr.flags = cpu_to_le32(0);
+	hdr.flags = cpu_to_le32(phy->sim ? BT_PHY_FLAG_SIM : 0);
 	hdr.type = cpu_to_le16(type);
 	hdr.len = cpu_to_le16(size1 + size2 + size3);
 
@@ -255,6 +406,17 @@ bool bt_phy_send_vector(struct bt_phy *phy, uint16_t type,
 	iov[msg.msg_iovlen].iov_len = sizeof(hdr);
 	msg.msg_iovlen++;
 
+	if (phy->sim) {
+		sim.x = cpu_to_le16(phy->x);
+		sim.y = cpu_to_le16(phy->y);
+		sim.tx_power = phy->tx_power;
+		sim.timestamp = cpu_to_le64(get_timestamp());
+
+		iov[msg.msg_iovlen].iov_base = &sim;
+		iov[msg.msg_iovlen].iov_len = sizeof(sim);
+		msg.msg_iovlen++;
+	}
+
 	if (data1 && size1 > 0) {
 		iov[msg.msg_iovlen].iov_base = (void *) data1;
 		iov[msg.msg_iovlen].iov_len = size1;
@@ -282,6 +444,9 @@ bool bt_phy_send_vector(struct bt_phy *phy, uint16_t type,
 	if (len < 0)
 		return false;
 
+	phy->stats.tx_packets++;
+	phy->stats.tx_airtime += sim_airtime(size1 + size2 + size3);
+
 	return true;
 }
 
@@ -296,3 +461,27 @@ bool bt_phy_register(struct bt_phy *phy, bt_phy_callback_func_t callback,
 
 	return true;
 }
+
+bool bt_phy_set_position(struct bt_phy *phy, int16_t x, int16_t y,
+							int8_t tx_power)
+{
+	if (!phy)
+		return false;
+
+	phy->sim = true;
+	phy->x = x;
+	phy->y = y;
+	phy->tx_power = tx_power;
+
+	return true;
+}
+
+bool bt_phy_get_stats(struct bt_phy *phy, struct bt_phy_stats *stats)
+{
+	if (!phy || !stats)
+		return false;
+
+	*stats = phy->stats;
+
+	return true;
+}
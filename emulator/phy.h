@@ -40,11 +40,26 @@ bool bt_phy_send_vector(struct bt_phy *phy, uint16_t type,
 					const void *data3, size_t size3);
 
 typedef void (*bt_phy_callback_func_t)(uint16_t type, const void *data,
-						size_t size, void *user_data);
+					size_t size, int8_t rssi,
+					void *user_data);
 
 bool bt_phy_register(struct bt_phy *phy, bt_phy_callback_func_t callback,
 							void *user_data);
 
+struct bt_phy_stats {
+	uint64_t tx_packets;
+	uint64_t rx_packets;
+	uint64_t tx_airtime;
+	uint64_t rx_airtime;
+	uint64_t out_of_range;
+	uint64_t errors;
+	uint64_t collisions;
+};
+
+bool bt_phy_set_position(struct bt_phy *phy, int16_t x, int16_t y,
+							int8_t tx_power);
+bool bt_phy_get_stats(struct bt_phy *phy, struct bt_phy_stats *stats);
+
 #define BT_PHY_PKT_NULL		0x0000
 
 #define BT_PHY_PKT_ADV		0x0001
@@ -78,10 +78,15 @@
 #define SMP_AUTH_SC		0x08
 #define SMP_AUTH_KEYPRESS	0x10
 
+/* Precomputed local key pairs, each one is only used for one pairing */
+#define KEY_POOL_DEPTH		2
+#define KEY_POOL_MAX_USES	1
+
 struct smp {
 	struct bthost *bthost;
 	struct smp_conn *conn;
 	struct bt_crypto *crypto;
+	struct ecc_key_pool *key_pool;
 };
 
 struct smp_conn {
@@ -221,7 +226,8 @@ static void smp_send(struct smp_conn *conn, uint8_t smp_cmd, const void *data,
 
 static bool send_public_key(struct smp_conn *conn)
 {
-	if (!ecc_make_key(conn->local_pk, conn->local_sk))
+	if (!ecc_key_pool_get(conn->smp->key_pool, conn->local_pk,
+							conn->local_sk))
 		return false;
 
 	smp_send(conn, BT_L2CAP_SMP_PUBLIC_KEY, conn->local_pk, 64);
@@ -896,6 +902,9 @@ void *smp_start(struct bthost *bthost)
 		return NULL;
 	}
 
+	/* Failing to create the pool only means keys are made on demand */
+	smp->key_pool = ecc_key_pool_new(KEY_POOL_DEPTH, KEY_POOL_MAX_USES);
+
 	smp->bthost = bthost;
 
 	return smp;
@@ -905,6 +914,7 @@ void smp_stop(void *smp_data)
 {
 	struct smp *smp = smp_data;
 
+	ecc_key_pool_free(smp->key_pool);
 	bt_crypto_unref(smp->crypto);
 
 	free(smp);
@@ -222,6 +222,7 @@ struct GDBusSecurityTable {
 
 void g_dbus_set_flags(int flags);
 int g_dbus_get_flags(void);
+unsigned long g_dbus_get_signals_sent(void);
 
 gboolean g_dbus_register_interface(DBusConnection *connection,
 					const char *path, const char *name,
@@ -55,7 +55,7 @@ struct generic_data {
 	GSList *objects;
 	GSList *added;
 	GSList *removed;
-	guint process_id;
+	GList *pending_link;
 	gboolean pending_prop;
 	char *introspect;
 	struct generic_data *parent;
@@ -67,6 +67,7 @@ struct interface_data {
 	const GDBusSignalTable *signals;
 	const GDBusPropertyTable *properties;
 	GSList *pending_prop;
+	DBusMessage *snapshot;
 	void *user_data;
 	GDBusDestroyFunction destroy;
 };
@@ -85,10 +86,18 @@ struct property_data {
 };
 
 static int global_flags = 0;
+static unsigned long signals_sent = 0;
 static struct generic_data *root;
-static GSList *pending = NULL;
 
-static gboolean process_changes(gpointer user_data);
+/*
+ * Objects with changes to emit, in the order they were first changed.
+ * A single idle source flushes all of them at once, so updating many
+ * objects costs one wakeup instead of one source per object.
+ */
+static GQueue pending = G_QUEUE_INIT;
+static guint pending_id = 0;
+
+static void process_changes(struct generic_data *data);
 static void process_properties_from_interface(struct generic_data *data,
 						struct interface_data *iface);
 static void process_property_changes(struct generic_data *data);
@@ -514,7 +523,7 @@ static void append_property(struct interface_data *iface,
 	dbus_message_iter_close_container(dict, &entry);
 }
 
-static void append_properties(struct interface_data *data,
+static void marshal_properties(struct interface_data *data,
 							DBusMessageIter *iter)
 {
 	DBusMessageIter dict;
@@ -543,6 +552,98 @@ static void append_properties(struct interface_data *data,
 	dbus_message_iter_close_container(iter, &dict);
 }
 
+static void copy_value(DBusMessageIter *src, DBusMessageIter *dst)
+{
+	int type = dbus_message_iter_get_arg_type(src);
+	DBusMessageIter src_sub, dst_sub;
+	char *sig = NULL;
+	int elem;
+
+	if (dbus_type_is_basic(type)) {
+		DBusBasicValue value;
+
+		dbus_message_iter_get_basic(src, &value);
+		dbus_message_iter_append_basic(dst, type, &value);
+		return;
+	}
+
+	dbus_message_iter_recurse(src, &src_sub);
+
+	switch (type) {
+	case DBUS_TYPE_ARRAY:
+		/* Element signature is the array signature minus the 'a' */
+		sig = dbus_message_iter_get_signature(src);
+		dbus_message_iter_open_container(dst, type, sig + 1, &dst_sub);
+
+		elem = dbus_message_iter_get_element_type(src);
+		if (dbus_type_is_fixed(elem) && elem != DBUS_TYPE_UNIX_FD) {
+			const void *array;
+			int n;
+
+			dbus_message_iter_get_fixed_array(&src_sub, &array, &n);
+			dbus_message_iter_append_fixed_array(&dst_sub, elem,
+								&array, n);
+			goto done;
+		}
+		break;
+	case DBUS_TYPE_VARIANT:
+		sig = dbus_message_iter_get_signature(&src_sub);
+		dbus_message_iter_open_container(dst, type, sig, &dst_sub);
+		break;
+	default:
+		dbus_message_iter_open_container(dst, type, NULL, &dst_sub);
+		break;
+	}
+
+	while (dbus_message_iter_get_arg_type(&src_sub) != DBUS_TYPE_INVALID) {
+		copy_value(&src_sub, &dst_sub);
+		dbus_message_iter_next(&src_sub);
+	}
+
+done:
+	dbus_message_iter_close_container(dst, &dst_sub);
+	dbus_free(sig);
+}
+
+static void invalidate_snapshot(struct interface_data *iface)
+{
+	if (iface->snapshot == NULL)
+		return;
+
+	dbus_message_unref(iface->snapshot);
+	iface->snapshot = NULL;
+}
+
+/*
+ * Properties of an interface are marshalled once into a snapshot which is
+ * copied into GetManagedObjects, GetAll and InterfacesAdded until one of
+ * them is reported as changed, so objects that don't change don't need
+ * their getters to run over and over.
+ */
+static void append_properties(struct interface_data *data,
+							DBusMessageIter *iter)
+{
+	DBusMessageIter src;
+
+	if (data->snapshot == NULL) {
+		data->snapshot = dbus_message_new(DBUS_MESSAGE_TYPE_SIGNAL);
+		if (data->snapshot == NULL) {
+			marshal_properties(data, iter);
+			return;
+		}
+
+		dbus_message_iter_init_append(data->snapshot, &src);
+		marshal_properties(data, &src);
+	}
+
+	if (!dbus_message_iter_init(data->snapshot, &src)) {
+		marshal_properties(data, iter);
+		return;
+	}
+
+	copy_value(&src, iter);
+}
+
 static void append_interface(gpointer data, gpointer user_data)
 {
 	struct interface_data *iface = data;
@@ -591,7 +692,8 @@ static void emit_interfaces_added(struct generic_data *data)
 	dbus_message_iter_close_container(&iter, &array);
 
 	/* Use dbus_connection_send to avoid recursive calls to g_dbus_flush */
-	dbus_connection_send(data->conn, signal, NULL);
+	if (dbus_connection_send(data->conn, signal, NULL))
+		signals_sent++;
 	dbus_message_unref(signal);
 }
 
@@ -633,22 +735,46 @@ static gboolean g_dbus_args_have_signature(const GDBusArgInfo *args,
 	return TRUE;
 }
 
-static void add_pending(struct generic_data *data)
+static void flush_pending(DBusConnection *connection)
 {
-	guint old_id = data->process_id;
+	GList *l = pending.head;
 
-	data->process_id = g_idle_add(process_changes, data);
+	/*
+	 * Emitting may unregister other objects or queue new changes so
+	 * restart from the head after every object instead of keeping a
+	 * pointer to the next link.
+	 */
+	while (l) {
+		struct generic_data *data = l->data;
 
-	if (old_id > 0) {
-		/*
-		 * If the element already had an old idler, remove the old one,
-		 * no need to re-add it to the pending list.
-		 */
-		g_source_remove(old_id);
-		return;
+		if (connection && data->conn != connection) {
+			l = l->next;
+			continue;
+		}
+
+		process_changes(data);
+		l = pending.head;
+	}
+}
+
+static gboolean process_pending(gpointer user_data)
+{
+	pending_id = 0;
+
+	flush_pending(NULL);
+
+	return FALSE;
+}
+
+static void add_pending(struct generic_data *data)
+{
+	if (data->pending_link == NULL) {
+		g_queue_push_tail(&pending, data);
+		data->pending_link = pending.tail;
 	}
 
-	pending = g_slist_append(pending, data);
+	if (pending_id == 0)
+		pending_id = g_idle_add(process_pending, NULL);
 }
 
 static gboolean remove_interface(struct generic_data *data, const char *name)
@@ -663,6 +789,8 @@ static gboolean remove_interface(struct generic_data *data, const char *name)
 
 	data->interfaces = g_slist_remove(data->interfaces, iface);
 
+	invalidate_snapshot(iface);
+
 	if (iface->destroy) {
 		iface->destroy(iface->user_data);
 		iface->user_data = NULL;
@@ -985,24 +1113,27 @@ static void emit_interfaces_removed(struct generic_data *data)
 	dbus_message_iter_close_container(&iter, &array);
 
 	/* Use dbus_connection_send to avoid recursive calls to g_dbus_flush */
-	dbus_connection_send(data->conn, signal, NULL);
+	if (dbus_connection_send(data->conn, signal, NULL))
+		signals_sent++;
 	dbus_message_unref(signal);
 }
 
 static void remove_pending(struct generic_data *data)
 {
-	if (data->process_id > 0) {
-		g_source_remove(data->process_id);
-		data->process_id = 0;
-	}
+	if (data->pending_link == NULL)
+		return;
+
+	g_queue_delete_link(&pending, data->pending_link);
+	data->pending_link = NULL;
 
-	pending = g_slist_remove(pending, data);
+	if (g_queue_is_empty(&pending) && pending_id > 0) {
+		g_source_remove(pending_id);
+		pending_id = 0;
+	}
 }
 
-static gboolean process_changes(gpointer user_data)
+static void process_changes(struct generic_data *data)
 {
-	struct generic_data *data = user_data;
-
 	remove_pending(data);
 
 	if (data->added != NULL)
@@ -1014,10 +1145,6 @@ static gboolean process_changes(gpointer user_data)
 
 	if (data->removed != NULL)
 		emit_interfaces_removed(data);
-
-	data->process_id = 0;
-
-	return FALSE;
 }
 
 static void generic_unregister(DBusConnection *connection, void *user_data)
@@ -1028,11 +1155,8 @@ static void generic_unregister(DBusConnection *connection, void *user_data)
 	if (parent != NULL)
 		parent->objects = g_slist_remove(parent->objects, data);
 
-	if (data->process_id > 0) {
-		g_source_remove(data->process_id);
-		data->process_id = 0;
+	if (data->pending_link != NULL)
 		process_changes(data);
-	}
 
 	g_slist_foreach(data->objects, reset_parent, data->parent);
 	g_slist_free(data->objects);
@@ -1477,17 +1601,7 @@ DBusMessage *g_dbus_create_reply(DBusMessage *message, int type, ...)
 
 static void g_dbus_flush(DBusConnection *connection)
 {
-	GSList *l;
-
-	for (l = pending; l;) {
-		struct generic_data *data = l->data;
-
-		l = l->next;
-		if (data->conn != connection)
-			continue;
-
-		process_changes(data);
-	}
+	flush_pending(connection);
 }
 
 gboolean g_dbus_send_message(DBusConnection *connection, DBusMessage *message)
@@ -1510,6 +1624,9 @@ gboolean g_dbus_send_message(DBusConnection *connection, DBusMessage *message)
 	g_dbus_flush(connection);
 
 	result = dbus_connection_send(connection, message, NULL);
+	if (result && dbus_message_get_type(message) ==
+						DBUS_MESSAGE_TYPE_SIGNAL)
+		signals_sent++;
 
 out:
 	dbus_message_unref(message);
@@ -1714,7 +1831,8 @@ static void process_properties_from_interface(struct generic_data *data,
 	iface->pending_prop = NULL;
 
 	/* Use dbus_connection_send to avoid recursive calls to g_dbus_flush */
-	dbus_connection_send(data->conn, signal, NULL);
+	if (dbus_connection_send(data->conn, signal, NULL))
+		signals_sent++;
 	dbus_message_unref(signal);
 }
 
@@ -1749,6 +1867,8 @@ void g_dbus_emit_property_changed_full(DBusConnection *connection,
 	if (iface == NULL)
 		return;
 
+	invalidate_snapshot(iface);
+
 	/*
 	 * If ObjectManager is attached, don't emit property changed if
 	 * interface is not yet published
@@ -1840,3 +1960,8 @@ int g_dbus_get_flags(void)
 {
 	return global_flags;
 }
+
+unsigned long g_dbus_get_signals_sent(void)
+{
+	return signals_sent;
+}
@@ -31,8 +31,19 @@
 #include "gobex-apparam.h"
 #include "gobex-debug.h"
 
+#define APPARAM_INLINE_SIZE 64
+
+/*
+ * Tags are kept encoded, back to back in the order they were set, so
+ * encoding is a single copy and no allocation is needed per tag. A
+ * request carries a handful of tags, which keeps the linear lookup
+ * cheaper than hashing; most of them fit the inline buffer.
+ */
 struct _GObexApparam {
-	GHashTable *tags;
+	guint8 *data;
+	gsize len;
+	gsize size;
+	guint8 buf[APPARAM_INLINE_SIZE];
 };
 
 struct apparam_tag {
@@ -49,59 +60,77 @@ struct apparam_tag {
 	} value;
 } __attribute__ ((packed));
 
-static struct apparam_tag *tag_new(guint8 id, guint8 len, const void *data)
+static GObexApparam *g_obex_apparam_new(void)
 {
-	struct apparam_tag *tag;
+	GObexApparam *apparam;
 
-	tag = g_malloc0(2 + len);
-	tag->id = id;
-	tag->len = len;
-	memcpy(tag->value.data, data, len);
+	apparam = g_new0(GObexApparam, 1);
+	apparam->data = apparam->buf;
+	apparam->size = sizeof(apparam->buf);
 
-	return tag;
+	return apparam;
 }
 
-static GObexApparam *g_obex_apparam_new(void)
+static struct apparam_tag *g_obex_apparam_find_tag(GObexApparam *apparam,
+								guint id)
 {
-	GObexApparam *apparam;
+	gsize offset = 0;
 
-	apparam = g_new0(GObexApparam, 1);
-	apparam->tags = g_hash_table_new_full(g_direct_hash, g_direct_equal,
-							NULL, g_free);
+	while (offset < apparam->len) {
+		struct apparam_tag *tag = (void *) (apparam->data + offset);
 
-	return apparam;
+		if (tag->id == id)
+			return tag;
+
+		offset += 2 + tag->len;
+	}
+
+	return NULL;
+}
+
+static void apparam_remove_tag(GObexApparam *apparam, struct apparam_tag *tag)
+{
+	guint8 *start = (guint8 *) tag;
+	gsize count = 2 + tag->len;
+	gsize tail = apparam->len - (start - apparam->data) - count;
+
+	memmove(start, start + count, tail);
+	apparam->len -= count;
 }
 
-static struct apparam_tag *apparam_tag_decode(const void *data, gsize size,
-							gsize *parsed)
+static void apparam_add_tag(GObexApparam *apparam, guint8 id, guint8 len,
+							const void *data)
 {
 	struct apparam_tag *tag;
-	const guint8 *ptr = data;
-	guint8 id;
-	guint8 len;
 
-	if (size < 2)
-		return NULL;
+	tag = g_obex_apparam_find_tag(apparam, id);
+	if (tag != NULL)
+		apparam_remove_tag(apparam, tag);
 
-	id = ptr[0];
-	len = ptr[1];
+	if (apparam->len + 2 + len > apparam->size) {
+		gsize size = MAX(apparam->size * 2, apparam->len + 2 + len);
 
-	if (len > size - 2)
-		return NULL;
+		if (apparam->data == apparam->buf) {
+			apparam->data = g_malloc(size);
+			memcpy(apparam->data, apparam->buf, apparam->len);
+		} else
+			apparam->data = g_realloc(apparam->data, size);
 
-	tag = tag_new(id, len, ptr + 2);
-	if (tag == NULL)
-		return NULL;
+		apparam->size = size;
+	}
 
-	*parsed = 2 + tag->len;
+	tag = (void *) (apparam->data + apparam->len);
+	tag->id = id;
+	tag->len = len;
+	memcpy(tag->value.data, data, len);
 
-	return tag;
+	apparam->len += 2 + len;
 }
 
 GObexApparam *g_obex_apparam_decode(const void *data, gsize size)
 {
 	GObexApparam *apparam;
-	GHashTable *tags;
+	const guint8 *ptr = data;
 	gsize count = 0;
 
 	if (size < 2)
@@ -109,20 +138,19 @@ GObexApparam *g_obex_apparam_decode(const void *data, gsize size)
 
 	apparam = g_obex_apparam_new();
 
-	tags = apparam->tags;
 	while (count < size) {
-		struct apparam_tag *tag;
-		gsize parsed;
-		guint id;
+		guint8 len;
 
-		tag = apparam_tag_decode(data + count, size - count, &parsed);
-		if (tag == NULL)
+		if (size - count < 2)
 			break;
 
-		id = tag->id;
-		g_hash_table_insert(tags, GUINT_TO_POINTER(id), tag);
+		len = ptr[count + 1];
+		if (len > size - count - 2)
+			break;
+
+		apparam_add_tag(apparam, ptr[count], len, ptr + count + 2);
 
-		count += parsed;
+		count += 2 + len;
 	}
 
 	if (count != size) {
@@ -133,53 +161,26 @@ GObexApparam *g_obex_apparam_decode(const void *data, gsize size)
 	return apparam;
 }
 
-static gssize tag_encode(struct apparam_tag *tag, void *buf, gsize len)
-{
-	gsize count = 2 + tag->len;
-
-	if (len < count)
-		return -ENOBUFS;
-
-	memcpy(buf, tag, count);
-
-	return count;
-}
-
 gssize g_obex_apparam_encode(GObexApparam *apparam, void *buf, gsize len)
 {
-	gsize count = 0;
-	gssize ret;
-	GHashTableIter iter;
-	gpointer key, value;
-
 	if (!apparam)
 		return 0;
 
-	g_hash_table_iter_init(&iter, apparam->tags);
-	while (g_hash_table_iter_next(&iter, &key, &value)) {
-		struct apparam_tag *tag = value;
-
-		ret = tag_encode(tag, buf + count, len - count);
-		if (ret < 0)
-			return ret;
+	if (len < apparam->len)
+		return -ENOBUFS;
 
-		count += ret;
-	}
+	memcpy(buf, apparam->data, apparam->len);
 
-	return count;
+	return apparam->len;
 }
 
 GObexApparam *g_obex_apparam_set_bytes(GObexApparam *apparam, guint8 id,
 						const void *value, gsize len)
 {
-	struct apparam_tag *tag;
-	guint uid = id;
-
 	if (apparam == NULL)
 		apparam = g_obex_apparam_new();
 
-	tag = tag_new(id, len, value);
-	g_hash_table_replace(apparam->tags, GUINT_TO_POINTER(uid), tag);
+	apparam_add_tag(apparam, id, len, value);
 
 	return apparam;
 }
@@ -239,12 +240,6 @@ GObexApparam *g_obex_apparam_set_string(GObexApparam *apparam, guint8 id,
 	return g_obex_apparam_set_bytes(apparam, id, value, len);
 }
 
-static struct apparam_tag *g_obex_apparam_find_tag(GObexApparam *apparam,
-								guint id)
-{
-	return g_hash_table_lookup(apparam->tags, GUINT_TO_POINTER(id));
-}
-
 gboolean g_obex_apparam_get_uint8(GObexApparam *apparam, guint8 id,
 							guint8 *dest)
 {
@@ -363,6 +358,8 @@ gboolean g_obex_apparam_get_bytes(GObexApparam *apparam, guint8 id,
 
 void g_obex_apparam_free(GObexApparam *apparam)
 {
-	g_hash_table_unref(apparam->tags);
+	if (apparam->data != apparam->buf)
+		g_free(apparam->data);
+
 	g_free(apparam);
 }
@@ -23,6 +23,7 @@
 #ifndef __GOBEX_DEFS_H
 #define __GOBEX_DEFS_H
 
+#include <sys/types.h>
 #include <glib.h>
 
 typedef enum {
@@ -44,6 +45,8 @@ typedef enum {
 } GObexError;
 
 typedef gssize (*GObexDataProducer) (void *buf, gsize len, gpointer user_data);
+typedef gssize (*GObexFdProducer) (int *fd, off_t *offset, gsize len,
+							gpointer user_data);
 typedef gboolean (*GObexDataConsumer) (const void *buf, gsize len,
 							gpointer user_data);
 
@@ -51,6 +51,33 @@ struct _GObexHeader {
 	} v;
 };
 
+/* A few freed headers are kept for reuse by the next packets */
+#define HEADER_POOL_SIZE	16
+
+static GObexHeader *header_pool[HEADER_POOL_SIZE];
+static guint header_pool_len = 0;
+
+static GObexHeader *header_alloc(void)
+{
+	GObexHeader *header;
+
+	if (header_pool_len == 0)
+		return g_new0(GObexHeader, 1);
+
+	header = header_pool[--header_pool_len];
+	memset(header, 0, sizeof(*header));
+
+	return header;
+}
+
+static void header_release(GObexHeader *header)
+{
+	if (header_pool_len < HEADER_POOL_SIZE)
+		header_pool[header_pool_len++] = header;
+	else
+		g_free(header);
+}
+
 static glong utf8_to_utf16(gunichar2 **utf16, const char *utf8) {
 	glong utf16_len;
 	int i;
@@ -154,7 +181,7 @@ GObexHeader *g_obex_header_decode(const void *data, gsize len,
 		return NULL;
 	}
 
-	header = g_new0(GObexHeader, 1);
+	header = header_alloc();
 
 	ptr = get_bytes(&header->id, ptr, sizeof(header->id));
 
@@ -304,7 +331,7 @@ void g_obex_header_free(GObexHeader *header)
 		g_assert_not_reached();
 	}
 
-	g_free(header);
+	header_release(header);
 }
 
 gboolean g_obex_header_get_unicode(GObexHeader *header, const char **str)
@@ -394,7 +421,7 @@ GObexHeader *g_obex_header_new_unicode(guint8 id, const char *str)
 	if (G_OBEX_HDR_ENC(id) != G_OBEX_HDR_ENC_UNICODE)
 		return NULL;
 
-	header = g_new0(GObexHeader, 1);
+	header = header_alloc();
 
 	header->id = id;
 
@@ -418,7 +445,7 @@ GObexHeader *g_obex_header_new_bytes(guint8 id, const void *data, gsize len)
 	if (G_OBEX_HDR_ENC(id) != G_OBEX_HDR_ENC_BYTES)
 		return NULL;
 
-	header = g_new0(GObexHeader, 1);
+	header = header_alloc();
 
 	header->id = id;
 	header->vlen = len;
@@ -454,7 +481,7 @@ GObexHeader *g_obex_header_new_uint8(guint8 id, guint8 val)
 	if (G_OBEX_HDR_ENC(id) != G_OBEX_HDR_ENC_UINT8)
 		return NULL;
 
-	header = g_new0(GObexHeader, 1);
+	header = header_alloc();
 
 	header->id = id;
 	header->vlen = 1;
@@ -475,7 +502,7 @@ GObexHeader *g_obex_header_new_uint32(guint8 id, guint32 val)
 	if (G_OBEX_HDR_ENC(id) != G_OBEX_HDR_ENC_UINT32)
 		return NULL;
 
-	header = g_new0(GObexHeader, 1);
+	header = header_alloc();
 
 	header->id = id;
 	header->vlen = 4;
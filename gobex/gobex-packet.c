@@ -26,6 +26,7 @@
 
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include "gobex-defs.h"
 #include "gobex-packet.h"
@@ -33,6 +34,13 @@
 
 #define FINAL_BIT 0x80
 
+/*
+ * Packets are created and freed for every exchange of a transfer, so a
+ * few freed ones are kept around for reuse instead of going back to the
+ * allocator.
+ */
+#define PACKET_POOL_SIZE 8
+
 struct _GObexPacket {
 	guint8 opcode;
 	gboolean final;
@@ -49,9 +57,34 @@ struct _GObexPacket {
 	GSList *headers;
 
 	GObexDataProducer get_body;
+	GObexFdProducer get_body_fd;
 	gpointer get_body_data;
 };
 
+static GObexPacket *packet_pool[PACKET_POOL_SIZE];
+static guint packet_pool_len = 0;
+
+static GObexPacket *packet_alloc(void)
+{
+	GObexPacket *pkt;
+
+	if (packet_pool_len == 0)
+		return g_new0(GObexPacket, 1);
+
+	pkt = packet_pool[--packet_pool_len];
+	memset(pkt, 0, sizeof(*pkt));
+
+	return pkt;
+}
+
+static void packet_release(GObexPacket *pkt)
+{
+	if (packet_pool_len < PACKET_POOL_SIZE)
+		packet_pool[packet_pool_len++] = pkt;
+	else
+		g_free(pkt);
+}
+
 GObexHeader *g_obex_packet_get_header(GObexPacket *pkt, guint8 id)
 {
 	GSList *l;
@@ -116,7 +149,7 @@ gboolean g_obex_packet_add_body(GObexPacket *pkt, GObexDataProducer func,
 {
 	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
 
-	if (pkt->get_body != NULL)
+	if (pkt->get_body != NULL || pkt->get_body_fd != NULL)
 		return FALSE;
 
 	pkt->get_body = func;
@@ -125,6 +158,26 @@ gboolean g_obex_packet_add_body(GObexPacket *pkt, GObexDataProducer func,
 	return TRUE;
 }
 
+/*
+ * The body is given as a range of the file descriptor returned by the
+ * producer. Encoding with g_obex_packet_encode_fd leaves it out of the
+ * buffer, so the caller can send it straight from the file after the
+ * header bytes; g_obex_packet_encode reads it into the buffer instead.
+ */
+gboolean g_obex_packet_add_body_fd(GObexPacket *pkt, GObexFdProducer func,
+							gpointer user_data)
+{
+	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", pkt->opcode);
+
+	if (pkt->get_body != NULL || pkt->get_body_fd != NULL)
+		return FALSE;
+
+	pkt->get_body_fd = func;
+	pkt->get_body_data = user_data;
+
+	return TRUE;
+}
+
 gboolean g_obex_packet_add_unicode(GObexPacket *pkt, guint8 id,
 							const char *str)
 {
@@ -234,7 +287,7 @@ GObexPacket *g_obex_packet_new_valist(guint8 opcode, gboolean final,
 
 	g_obex_debug(G_OBEX_DEBUG_PACKET, "opcode 0x%02x", opcode);
 
-	pkt = g_new0(GObexPacket, 1);
+	pkt = packet_alloc();
 
 	pkt->opcode = opcode;
 	pkt->final = final;
@@ -275,7 +328,7 @@ void g_obex_packet_free(GObexPacket *pkt)
 
 	g_slist_foreach(pkt->headers, (GFunc) g_obex_header_free, NULL);
 	g_slist_free(pkt->headers);
-	g_free(pkt);
+	packet_release(pkt);
 }
 
 static gboolean parse_headers(GObexPacket *pkt, const void *data, gsize len,
@@ -379,7 +432,31 @@ failed:
 	return NULL;
 }
 
-static gssize get_body(GObexPacket *pkt, guint8 *buf, gsize len)
+static gssize read_body_fd(int fd, off_t offset, guint8 *buf, gsize len)
+{
+	gsize count = 0;
+
+	while (count < len) {
+		ssize_t ret;
+
+		ret = pread(fd, buf + count, len - count, offset + count);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		if (ret == 0)
+			return -EIO;
+
+		count += ret;
+	}
+
+	return count;
+}
+
+static gssize get_body(GObexPacket *pkt, guint8 *buf, gsize len,
+				int *fd, off_t *offset)
 {
 	guint16 u16;
 	gssize ret;
@@ -389,7 +466,23 @@ static gssize get_body(GObexPacket *pkt, guint8 *buf, gsize len)
 	if (len < 3)
 		return -ENOBUFS;
 
-	ret = pkt->get_body(buf + 3, len - 3, pkt->get_body_data);
+	if (pkt->get_body_fd) {
+		int body_fd = -1;
+		off_t body_offset = 0;
+
+		ret = pkt->get_body_fd(&body_fd, &body_offset, len - 3,
+							pkt->get_body_data);
+		if (ret > (gssize) (len - 3))
+			return -ENOBUFS;
+
+		if (ret > 0 && fd) {
+			*fd = body_fd;
+			*offset = body_offset;
+		} else if (ret > 0)
+			ret = read_body_fd(body_fd, body_offset, buf + 3, ret);
+	} else
+		ret = pkt->get_body(buf + 3, len - 3, pkt->get_body_data);
+
 	if (ret < 0)
 		return ret;
 
@@ -404,7 +497,8 @@ static gssize get_body(GObexPacket *pkt, guint8 *buf, gsize len)
 	return ret;
 }
 
-gssize g_obex_packet_encode(GObexPacket *pkt, guint8 *buf, gsize len)
+static gssize packet_encode(GObexPacket *pkt, guint8 *buf, gsize len,
+				int *fd, off_t *offset, gsize *fd_len)
 {
 	gssize ret;
 	gsize count;
@@ -442,8 +536,8 @@ gssize g_obex_packet_encode(GObexPacket *pkt, guint8 *buf, gsize len)
 		count += ret;
 	}
 
-	if (pkt->get_body) {
-		ret = get_body(pkt, buf + count, len - count);
+	if (pkt->get_body || pkt->get_body_fd) {
+		ret = get_body(pkt, buf + count, len - count, fd, offset);
 		if (ret < 0)
 			return ret;
 		if (ret == 0) {
@@ -453,6 +547,14 @@ gssize g_obex_packet_encode(GObexPacket *pkt, guint8 *buf, gsize len)
 		}
 
 		count += ret + 3;
+
+		/* Body left in the file isn't part of the encoded bytes */
+		if (fd && *fd >= 0) {
+			*fd_len = ret;
+			u16 = g_htons(count);
+			memcpy(&buf[1], &u16, sizeof(u16));
+			return count - ret;
+		}
 	}
 
 	u16 = g_htons(count);
@@ -460,3 +562,18 @@ gssize g_obex_packet_encode(GObexPacket *pkt, guint8 *buf, gsize len)
 
 	return count;
 }
+
+gssize g_obex_packet_encode(GObexPacket *pkt, guint8 *buf, gsize len)
+{
+	return packet_encode(pkt, buf, len, NULL, NULL, NULL);
+}
+
+gssize g_obex_packet_encode_fd(GObexPacket *pkt, guint8 *buf, gsize len,
+				int *fd, off_t *offset, gsize *fd_len)
+{
+	*fd = -1;
+	*offset = 0;
+	*fd_len = 0;
+
+	return packet_encode(pkt, buf, len, fd, offset, fd_len);
+}
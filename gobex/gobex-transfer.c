@@ -50,10 +50,14 @@ struct transfer {
 	guint abort_id;
 
 	GObexDataProducer data_producer;
+	GObexFdProducer fd_producer;
 	GObexDataConsumer data_consumer;
 	GObexFunc complete_func;
 
 	gpointer user_data;
+
+	guint64 bytes;
+	gint64 start;
 };
 
 static void transfer_free(struct transfer *transfer)
@@ -94,12 +98,28 @@ static struct transfer *find_transfer(guint id)
 	return NULL;
 }
 
+static void transfer_stats(struct transfer *transfer)
+{
+	gint64 elapsed = g_get_monotonic_time() - transfer->start;
+
+	if (elapsed <= 0)
+		elapsed = 1;
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER,
+			"transfer %u: %" G_GUINT64_FORMAT " bytes in %"
+			G_GINT64_FORMAT " ms (%" G_GUINT64_FORMAT " bytes/s)",
+			transfer->id, transfer->bytes, elapsed / 1000,
+			transfer->bytes * G_USEC_PER_SEC / elapsed);
+}
+
 static void transfer_complete(struct transfer *transfer, GError *err)
 {
 	guint id = transfer->id;
 
 	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", id);
 
+	transfer_stats(transfer);
+
 	transfer->complete_func(transfer->obex, err, transfer->user_data);
 	/* Check if the complete_func removed the transfer */
 	if (find_transfer(id) == NULL)
@@ -138,6 +158,8 @@ static gssize put_get_data(void *buf, gsize len, gpointer user_data)
 		return ret;
 
 	if (ret > 0) {
+		transfer->bytes += ret;
+
 		/* Check if SRM is active */
 		if (!g_obex_srm_active(transfer->obex))
 			return ret;
@@ -178,6 +200,8 @@ static gboolean handle_get_body(struct transfer *transfer, GObexPacket *rsp,
 	if (len == 0)
 		return TRUE;
 
+	transfer->bytes += len;
+
 	ret = transfer->data_consumer(buf, len, transfer->user_data);
 	if (ret == FALSE)
 		g_set_error(err, G_OBEX_ERROR, G_OBEX_ERROR_CANCELLED,
@@ -260,6 +284,7 @@ static struct transfer *transfer_new(GObex *obex, guint8 opcode,
 	transfer->obex = g_obex_ref(obex);
 	transfer->complete_func = complete_func;
 	transfer->user_data = user_data;
+	transfer->start = g_get_monotonic_time();
 
 	transfers = g_slist_append(transfers, transfer);
 
@@ -353,6 +378,8 @@ static guint8 put_get_bytes(struct transfer *transfer, GObexPacket *req)
 	if (len == 0)
 		return rsp;
 
+	transfer->bytes += len;
+
 	if (transfer->data_consumer(buf, len, transfer->user_data) == FALSE)
 		rsp = G_OBEX_RSP_FORBIDDEN;
 
@@ -499,25 +526,34 @@ guint g_obex_get_req(GObex *obex, GObexDataConsumer data_func,
 	return transfer->id;
 }
 
-static gssize get_get_data(void *buf, gsize len, gpointer user_data)
+static gssize get_get_data(void *buf, gsize len, gpointer user_data);
+static gssize get_get_fd(int *fd, off_t *offset, gsize len,
+							gpointer user_data);
+
+static void add_get_body(struct transfer *transfer, GObexPacket *rsp)
+{
+	if (transfer->fd_producer)
+		g_obex_packet_add_body_fd(rsp, get_get_fd, transfer);
+	else
+		g_obex_packet_add_body(rsp, get_get_data, transfer);
+}
+
+static gssize get_get_result(struct transfer *transfer, gssize ret)
 {
-	struct transfer *transfer = user_data;
 	GObexPacket *req, *rsp;
 	GError *err = NULL;
-	gssize ret;
 	guint8 op;
 
-	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
-
-	ret = transfer->data_producer(buf, len, transfer->user_data);
 	if (ret > 0) {
+		transfer->bytes += ret;
+
 		if (!g_obex_srm_active(transfer->obex))
 			return ret;
 
 		/* Generate next response */
 		rsp = g_obex_packet_new(G_OBEX_RSP_CONTINUE, TRUE,
 							G_OBEX_HDR_INVALID);
-		g_obex_packet_add_body(rsp, get_get_data, transfer);
+		add_get_body(transfer, rsp);
 
 		if (!g_obex_send(transfer->obex, rsp, &err)) {
 			transfer_complete(transfer, err);
@@ -549,6 +585,31 @@ static gssize get_get_data(void *buf, gsize len, gpointer user_data)
 	return ret;
 }
 
+static gssize get_get_data(void *buf, gsize len, gpointer user_data)
+{
+	struct transfer *transfer = user_data;
+	gssize ret;
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
+
+	ret = transfer->data_producer(buf, len, transfer->user_data);
+
+	return get_get_result(transfer, ret);
+}
+
+static gssize get_get_fd(int *fd, off_t *offset, gsize len,
+							gpointer user_data)
+{
+	struct transfer *transfer = user_data;
+	gssize ret;
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
+
+	ret = transfer->fd_producer(fd, offset, len, transfer->user_data);
+
+	return get_get_result(transfer, ret);
+}
+
 static gboolean transfer_get_req_first(struct transfer *transfer,
 							GObexPacket *rsp)
 {
@@ -556,7 +617,7 @@ static gboolean transfer_get_req_first(struct transfer *transfer,
 
 	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
 
-	g_obex_packet_add_body(rsp, get_get_data, transfer);
+	add_get_body(transfer, rsp);
 
 	if (!g_obex_send(transfer->obex, rsp, &err)) {
 		transfer_complete(transfer, err);
@@ -576,7 +637,7 @@ static void transfer_get_req(GObex *obex, GObexPacket *req, gpointer user_data)
 	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "transfer %u", transfer->id);
 
 	rsp = g_obex_packet_new(G_OBEX_RSP_CONTINUE, TRUE, G_OBEX_HDR_INVALID);
-	g_obex_packet_add_body(rsp, get_get_data, transfer);
+	add_get_body(transfer, rsp);
 
 	if (!g_obex_send(obex, rsp, &err)) {
 		transfer_complete(transfer, err);
@@ -584,18 +645,12 @@ static void transfer_get_req(GObex *obex, GObexPacket *req, gpointer user_data)
 	}
 }
 
-guint g_obex_get_rsp_pkt(GObex *obex, GObexPacket *rsp,
-			GObexDataProducer data_func, GObexFunc complete_func,
-			gpointer user_data, GError **err)
+static guint transfer_get_rsp_start(struct transfer *transfer,
+							GObexPacket *rsp)
 {
-	struct transfer *transfer;
+	GObex *obex = transfer->obex;
 	guint id;
 
-	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "obex %p", obex);
-
-	transfer = transfer_new(obex, G_OBEX_OP_GET, complete_func, user_data);
-	transfer->data_producer = data_func;
-
 	if (!transfer_get_req_first(transfer, rsp))
 		return 0;
 
@@ -615,6 +670,34 @@ guint g_obex_get_rsp_pkt(GObex *obex, GObexPacket *rsp,
 	return transfer->id;
 }
 
+guint g_obex_get_rsp_pkt(GObex *obex, GObexPacket *rsp,
+			GObexDataProducer data_func, GObexFunc complete_func,
+			gpointer user_data, GError **err)
+{
+	struct transfer *transfer;
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "obex %p", obex);
+
+	transfer = transfer_new(obex, G_OBEX_OP_GET, complete_func, user_data);
+	transfer->data_producer = data_func;
+
+	return transfer_get_rsp_start(transfer, rsp);
+}
+
+guint g_obex_get_rsp_pkt_fd(GObex *obex, GObexPacket *rsp,
+			GObexFdProducer fd_func, GObexFunc complete_func,
+			gpointer user_data, GError **err)
+{
+	struct transfer *transfer;
+
+	g_obex_debug(G_OBEX_DEBUG_TRANSFER, "obex %p", obex);
+
+	transfer = transfer_new(obex, G_OBEX_OP_GET, complete_func, user_data);
+	transfer->fd_producer = fd_func;
+
+	return transfer_get_rsp_start(transfer, rsp);
+}
+
 guint g_obex_get_rsp(GObex *obex, GObexDataProducer data_func,
 			GObexFunc complete_func, gpointer user_data,
 			GError **err, guint first_hdr_id, ...)
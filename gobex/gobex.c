@@ -27,6 +27,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/sendfile.h>
 
 #include "gobex.h"
 #include "gobex-debug.h"
@@ -40,6 +41,9 @@
 
 #define G_OBEX_OP_NONE		0xff
 
+/* Packets written per wakeup while SRM lets them go out unanswered */
+#define G_OBEX_TX_BURST		16
+
 #define FINAL_BIT		0x80
 
 #define CONNID_INVALID		0xffffffff
@@ -78,6 +82,10 @@ struct _GObex {
 	size_t tx_data;
 	size_t tx_sent;
 
+	int tx_fd;
+	off_t tx_fd_offset;
+	size_t tx_fd_len;
+
 	gboolean suspended;
 	gboolean use_srm;
 
@@ -276,6 +284,9 @@ static gboolean write_stream(GObex *obex, GError **err)
 	buf = (char *) &obex->tx_buf[obex->tx_sent];
 	status = g_io_channel_write_chars(obex->io, buf, obex->tx_data,
 							&bytes_written, err);
+	if (status == G_IO_STATUS_AGAIN)
+		return TRUE;
+
 	if (status != G_IO_STATUS_NORMAL)
 		return FALSE;
 
@@ -296,6 +307,10 @@ static gboolean write_packet(GObex *obex, GError **err)
 	buf = (char *) &obex->tx_buf[obex->tx_sent];
 	status = g_io_channel_write_chars(obex->io, buf, obex->tx_data,
 							&bytes_written, err);
+	/* The socket buffer is full, retry the whole packet later */
+	if (status == G_IO_STATUS_AGAIN)
+		return TRUE;
+
 	if (status != G_IO_STATUS_NORMAL)
 		return FALSE;
 
@@ -310,6 +325,64 @@ static gboolean write_packet(GObex *obex, GError **err)
 	return TRUE;
 }
 
+static void tx_fd_clear(GObex *obex)
+{
+	if (obex->tx_fd >= 0)
+		close(obex->tx_fd);
+
+	obex->tx_fd = -1;
+	obex->tx_fd_len = 0;
+}
+
+/* Send the body left in the file after the packet header bytes */
+static gboolean write_body_fd(GObex *obex)
+{
+	int sk = g_io_channel_unix_get_fd(obex->io);
+	ssize_t ret;
+
+	ret = sendfile(sk, obex->tx_fd, &obex->tx_fd_offset, obex->tx_fd_len);
+	if (ret < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return TRUE;
+		return FALSE;
+	}
+
+	if (ret == 0)
+		return FALSE;
+
+	g_obex_debug(G_OBEX_DEBUG_DATA, "< body %zd bytes from fd", ret);
+
+	obex->tx_fd_len -= ret;
+	if (obex->tx_fd_len == 0)
+		tx_fd_clear(obex);
+
+	return TRUE;
+}
+
+static gssize encode_packet(GObex *obex, GObexPacket *pkt)
+{
+	gssize len;
+	int fd;
+
+	/* Packet based transports need the whole packet in one write */
+	if (obex->write != write_stream)
+		return g_obex_packet_encode(pkt, obex->tx_buf, obex->tx_mtu);
+
+	len = g_obex_packet_encode_fd(pkt, obex->tx_buf, obex->tx_mtu, &fd,
+					&obex->tx_fd_offset, &obex->tx_fd_len);
+	if (len < 0 || obex->tx_fd_len == 0)
+		return len;
+
+	/* The producer may close its fd before the body is sent */
+	obex->tx_fd = dup(fd);
+	if (obex->tx_fd < 0) {
+		obex->tx_fd_len = 0;
+		return -errno;
+	}
+
+	return len;
+}
+
 static void set_srmp(GObex *obex, guint8 srmp, gboolean outgoing)
 {
 	struct srm_config *config = obex->srm;
@@ -432,6 +505,7 @@ static gboolean write_data(GIOChannel *io, GIOCondition cond,
 							gpointer user_data)
 {
 	GObex *obex = user_data;
+	unsigned int burst = 0;
 
 	if (cond & G_IO_NVAL)
 		return FALSE;
@@ -439,7 +513,8 @@ static gboolean write_data(GIOChannel *io, GIOCondition cond,
 	if (cond & (G_IO_HUP | G_IO_ERR))
 		goto stop_tx;
 
-	if (obex->tx_data == 0) {
+next:
+	if (obex->tx_data == 0 && obex->tx_fd_len == 0) {
 		struct pending_pkt *p = g_queue_pop_head(obex->tx_queue);
 		ssize_t len;
 
@@ -458,7 +533,7 @@ static gboolean write_data(GIOChannel *io, GIOCondition cond,
 		}
 
 encode:
-		len = g_obex_packet_encode(p->pkt, obex->tx_buf, obex->tx_mtu);
+		len = encode_packet(obex, p->pkt);
 		if (len == -EAGAIN) {
 			g_queue_push_head(obex->tx_queue, p);
 			g_obex_suspend(obex);
@@ -493,16 +568,31 @@ encode:
 		return FALSE;
 	}
 
-	if (!obex->write(obex, NULL))
+	if (obex->tx_data > 0 && !obex->write(obex, NULL))
+		goto stop_tx;
+
+	if (obex->tx_data == 0 && obex->tx_fd_len > 0 && !write_body_fd(obex))
 		goto stop_tx;
 
+	/*
+	 * With SRM the packets don't wait for each other, so keep going
+	 * while the socket takes them instead of one packet per wakeup.
+	 */
+	if (obex->tx_data == 0 && obex->tx_fd_len == 0 &&
+			++burst < G_OBEX_TX_BURST &&
+			g_queue_get_length(obex->tx_queue) > 0 &&
+			g_obex_srm_active(obex))
+		goto next;
+
 done:
-	if (obex->tx_data > 0 || g_queue_get_length(obex->tx_queue) > 0)
+	if (obex->tx_data > 0 || obex->tx_fd_len > 0 ||
+				g_queue_get_length(obex->tx_queue) > 0)
 		return TRUE;
 
 stop_tx:
 	obex->rx_last_op = G_OBEX_OP_NONE;
 	obex->tx_data = 0;
+	tx_fd_clear(obex);
 	obex->write_source = 0;
 	return FALSE;
 }
@@ -995,7 +1085,8 @@ void g_obex_resume(GObex *obex)
 		g_obex_srm_resume(obex);
 
 done:
-	if (g_queue_get_length(obex->tx_queue) > 0 || obex->tx_data > 0)
+	if (g_queue_get_length(obex->tx_queue) > 0 || obex->tx_data > 0 ||
+							obex->tx_fd_len > 0)
 		enable_tx(obex);
 }
 
@@ -1052,8 +1143,14 @@ static void parse_connect_data(GObex *obex, GObexPacket *pkt)
 	obex->tx_mtu = g_ntohs(u16);
 	if (obex->io_tx_mtu > 0 && obex->tx_mtu > obex->io_tx_mtu)
 		obex->tx_mtu = obex->io_tx_mtu;
+	if (obex->tx_mtu < G_OBEX_MINIMUM_MTU)
+		obex->tx_mtu = G_OBEX_MINIMUM_MTU;
 	obex->tx_buf = g_realloc(obex->tx_buf, obex->tx_mtu);
 
+	g_obex_debug(G_OBEX_DEBUG_COMMAND, "tx_mtu %u rx_mtu %u srm %s",
+					obex->tx_mtu, obex->rx_mtu,
+					obex->use_srm ? "yes" : "no");
+
 	hdr = g_obex_packet_get_header(pkt, G_OBEX_HDR_CONNECTION);
 	if (hdr)
 		g_obex_header_get_uint32(hdr, &obex->conn_id);
@@ -1470,6 +1567,7 @@ GObex *g_obex_new(GIOChannel *io, GObexTransportType transport_type,
 	obex->tx_queue = g_queue_new();
 	obex->rx_buf = g_malloc(obex->rx_mtu);
 	obex->tx_buf = g_malloc(obex->tx_mtu);
+	obex->tx_fd = -1;
 
 	switch (transport_type) {
 	case G_OBEX_TRANSPORT_STREAM:
@@ -1533,6 +1631,8 @@ void g_obex_unref(GObex *obex)
 	if (obex->write_source > 0)
 		g_source_remove(obex->write_source);
 
+	tx_fd_clear(obex);
+
 	g_free(obex->rx_buf);
 	g_free(obex->tx_buf);
 	g_free(obex->srm);
@@ -74,25 +74,64 @@ bdaddr_t *strtoba(const char *str)
 	return ba;
 }
 
+/* Addresses are formatted and parsed without going through printf/scanf */
+static const char hex_digits[] = "0123456789ABCDEF";
+
+static inline int hex_value(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
+}
+
 int ba2str(const bdaddr_t *ba, char *str)
 {
-	return sprintf(str, "%2.2X:%2.2X:%2.2X:%2.2X:%2.2X:%2.2X",
-		ba->b[5], ba->b[4], ba->b[3], ba->b[2], ba->b[1], ba->b[0]);
+	int i;
+
+	for (i = 5; i >= 0; i--) {
+		*str++ = hex_digits[ba->b[i] >> 4];
+		*str++ = hex_digits[ba->b[i] & 0x0f];
+		*str++ = i ? ':' : '\0';
+	}
+
+	return 17;
 }
 
 int str2ba(const char *str, bdaddr_t *ba)
 {
+	bdaddr_t tmp;
 	int i;
 
-	if (bachk(str) < 0) {
-		memset(ba, 0, sizeof(*ba));
-		return -1;
+	if (!str)
+		goto failed;
+
+	for (i = 5; i >= 0; i--, str += 3) {
+		int hi = hex_value(str[0]);
+		int lo = hi < 0 ? -1 : hex_value(str[1]);
+
+		if (lo < 0)
+			goto failed;
+
+		if (str[2] != (i ? ':' : '\0'))
+			goto failed;
+
+		tmp.b[i] = (hi << 4) | lo;
 	}
 
-	for (i = 5; i >= 0; i--, str += 3)
-		ba->b[i] = strtol(str, NULL, 16);
+	bacpy(ba, &tmp);
 
 	return 0;
+
+failed:
+	memset(ba, 0, sizeof(*ba));
+	return -1;
 }
 
 int ba2oui(const bdaddr_t *ba, char *str)
@@ -1034,7 +1034,212 @@ int sdp_uuid_extract(const uint8_t *p, int bufsize, uuid_t *uuid, int *scanned)
 	return 0;
 }
 
-static sdp_data_t *extract_int(const void *p, int bufsize, int *len)
+/*
+ * Records extracted into an arena live in a few large blocks which are
+ * all released at once, instead of one allocation per data element.
+ */
+#define SDP_ARENA_BLOCK_SIZE	4096
+#define SDP_ARENA_ALIGN		(2 * sizeof(void *))
+#define SDP_ARENA_ROUND(n)	(((n) + SDP_ARENA_ALIGN - 1) & \
+						~(SDP_ARENA_ALIGN - 1))
+
+struct sdp_arena_block {
+	struct sdp_arena_block *next;
+	size_t size;
+	size_t used;
+};
+
+struct sdp_arena {
+	struct sdp_arena_block *blocks;
+};
+
+#define SDP_ARENA_HDR_SIZE	SDP_ARENA_ROUND(sizeof(struct sdp_arena_block))
+
+sdp_arena_t *sdp_arena_new(void)
+{
+	return calloc(1, sizeof(sdp_arena_t));
+}
+
+static void arena_blocks_free(struct sdp_arena_block *block)
+{
+	while (block) {
+		struct sdp_arena_block *next = block->next;
+
+		free(block);
+		block = next;
+	}
+}
+
+/*
+ * Release everything allocated from the arena, but keep its first block
+ * around for the next records.
+ */
+void sdp_arena_reset(sdp_arena_t *arena)
+{
+	struct sdp_arena_block *block;
+
+	if (!arena || !arena->blocks)
+		return;
+
+	/* The most recent standard block is always at the head */
+	block = arena->blocks;
+	arena_blocks_free(block->next);
+	block->next = NULL;
+	block->used = 0;
+}
+
+void sdp_arena_free(sdp_arena_t *arena)
+{
+	if (!arena)
+		return;
+
+	arena_blocks_free(arena->blocks);
+	free(arena);
+}
+
+static void *arena_alloc(sdp_arena_t *arena, size_t size)
+{
+	struct sdp_arena_block *block = arena->blocks;
+	void *ptr;
+
+	size = SDP_ARENA_ROUND(size);
+
+	if (size > SDP_ARENA_BLOCK_SIZE / 4) {
+		/* Big allocations get a block of their own */
+		block = malloc(SDP_ARENA_HDR_SIZE + size);
+		if (!block)
+			return NULL;
+
+		block->size = size;
+		block->used = size;
+
+		if (arena->blocks) {
+			block->next = arena->blocks->next;
+			arena->blocks->next = block;
+		} else {
+			block->next = NULL;
+			arena->blocks = block;
+		}
+
+		ptr = (uint8_t *) block + SDP_ARENA_HDR_SIZE;
+		goto done;
+	}
+
+	if (!block || block->size - block->used < size) {
+		block = malloc(SDP_ARENA_HDR_SIZE + SDP_ARENA_BLOCK_SIZE);
+		if (!block)
+			return NULL;
+
+		block->size = SDP_ARENA_BLOCK_SIZE;
+		block->used = 0;
+		block->next = arena->blocks;
+		arena->blocks = block;
+	}
+
+	ptr = (uint8_t *) block + SDP_ARENA_HDR_SIZE + block->used;
+	block->used += size;
+
+done:
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+static void *data_alloc(sdp_arena_t *arena, size_t size)
+{
+	if (arena)
+		return arena_alloc(arena, size);
+
+	return malloc(size);
+}
+
+static void data_release(sdp_arena_t *arena, void *ptr)
+{
+	/* Arena memory is only released with the whole arena */
+	if (!arena)
+		free(ptr);
+}
+
+static sdp_list_t *arena_list_insert_sorted(sdp_arena_t *arena,
+					sdp_list_t *list, void *d,
+					sdp_comp_func_t f)
+{
+	sdp_list_t *q, *p, *n;
+
+	n = arena_alloc(arena, sizeof(sdp_list_t));
+	if (!n)
+		return list;
+
+	n->data = d;
+	for (q = NULL, p = list; p; q = p, p = p->next)
+		if (f(p->data, d) >= 0)
+			break;
+
+	if (q)
+		q->next = n;
+	else
+		list = n;
+	n->next = p;
+
+	return list;
+}
+
+static void arena_pattern_add_uuid(sdp_arena_t *arena, sdp_record_t *rec,
+							const uuid_t *uuid)
+{
+	uuid_t uuid128, *u;
+
+	memset(&uuid128, 0, sizeof(uuid128));
+
+	switch (uuid->type) {
+	case SDP_UUID128:
+		uuid128 = *uuid;
+		break;
+	case SDP_UUID32:
+		sdp_uuid32_to_uuid128(&uuid128, uuid);
+		break;
+	case SDP_UUID16:
+		sdp_uuid16_to_uuid128(&uuid128, uuid);
+		break;
+	}
+
+	if (sdp_list_find(rec->pattern, &uuid128, sdp_uuid128_cmp))
+		return;
+
+	u = arena_alloc(arena, sizeof(*u));
+	if (!u)
+		return;
+
+	*u = uuid128;
+	rec->pattern = arena_list_insert_sorted(arena, rec->pattern, u,
+							sdp_uuid128_cmp);
+}
+
+static void arena_attr_replace(sdp_arena_t *arena, sdp_record_t *rec,
+						uint16_t attr, sdp_data_t *d)
+{
+	sdp_list_t *l, *prev = NULL;
+
+	/* A repeated attribute replaces the earlier one, as in the heap */
+	for (l = rec->attrlist; l; prev = l, l = l->next) {
+		sdp_data_t *p = l->data;
+
+		if (p->attrId != attr)
+			continue;
+
+		if (prev)
+			prev->next = l->next;
+		else
+			rec->attrlist = l->next;
+		break;
+	}
+
+	d->attrId = attr;
+	rec->attrlist = arena_list_insert_sorted(arena, rec->attrlist, d,
+							sdp_attrid_comp_func);
+}
+
+static sdp_data_t *extract_int(sdp_arena_t *arena, const void *p,
+						int bufsize, int *len)
 {
 	sdp_data_t *d;
 
@@ -1043,7 +1248,7 @@ static sdp_data_t *extract_int(const void *p, int bufsize, int *len)
 		return NULL;
 	}
 
-	d = malloc(sizeof(sdp_data_t));
+	d = data_alloc(arena, sizeof(sdp_data_t));
 	if (!d)
 		return NULL;
 
@@ -1062,7 +1267,7 @@ static sdp_data_t *extract_int(const void *p, int bufsize, int *len)
 	case SDP_UINT8:
 		if (bufsize < (int) sizeof(uint8_t)) {
 			SDPERR("Unexpected end of packet");
-			free(d);
+			data_release(arena, d);
 			return NULL;
 		}
 		*len += sizeof(uint8_t);
@@ -1072,7 +1277,7 @@ static sdp_data_t *extract_int(const void *p, int bufsize, int *len)
 	case SDP_UINT16:
 		if (bufsize < (int) sizeof(uint16_t)) {
 			SDPERR("Unexpected end of packet");
-			free(d);
+			data_release(arena, d);
 			return NULL;
 		}
 		*len += sizeof(uint16_t);
@@ -1082,7 +1287,7 @@ static sdp_data_t *extract_int(const void *p, int bufsize, int *len)
 	case SDP_UINT32:
 		if (bufsize < (int) sizeof(uint32_t)) {
 			SDPERR("Unexpected end of packet");
-			free(d);
+			data_release(arena, d);
 			return NULL;
 		}
 		*len += sizeof(uint32_t);
@@ -1092,7 +1297,7 @@ static sdp_data_t *extract_int(const void *p, int bufsize, int *len)
 	case SDP_UINT64:
 		if (bufsize < (int) sizeof(uint64_t)) {
 			SDPERR("Unexpected end of packet");
-			free(d);
+			data_release(arena, d);
 			return NULL;
 		}
 		*len += sizeof(uint64_t);
@@ -1102,23 +1307,23 @@ static sdp_data_t *extract_int(const void *p, int bufsize, int *len)
 	case SDP_UINT128:
 		if (bufsize < (int) sizeof(uint128_t)) {
 			SDPERR("Unexpected end of packet");
-			free(d);
+			data_release(arena, d);
 			return NULL;
 		}
 		*len += sizeof(uint128_t);
 		ntoh128((uint128_t *) p, &d->val.uint128);
 		break;
 	default:
-		free(d);
+		data_release(arena, d);
 		d = NULL;
 	}
 	return d;
 }
 
-static sdp_data_t *extract_uuid(const uint8_t *p, int bufsize, int *len,
-							sdp_record_t *rec)
+static sdp_data_t *extract_uuid(sdp_arena_t *arena, const uint8_t *p,
+				int bufsize, int *len, sdp_record_t *rec)
 {
-	sdp_data_t *d = malloc(sizeof(sdp_data_t));
+	sdp_data_t *d = data_alloc(arena, sizeof(sdp_data_t));
 
 	if (!d)
 		return NULL;
@@ -1126,11 +1331,13 @@ static sdp_data_t *extract_uuid(const uint8_t *p, int bufsize, int *len,
 	SDPDBG("Extracting UUID");
 	memset(d, 0, sizeof(sdp_data_t));
 	if (sdp_uuid_extract(p, bufsize, &d->val.uuid, len) < 0) {
-		free(d);
+		data_release(arena, d);
 		return NULL;
 	}
 	d->dtd = *p;
-	if (rec)
+	if (rec && arena)
+		arena_pattern_add_uuid(arena, rec, &d->val.uuid);
+	else if (rec)
 		sdp_pattern_add_uuid(rec, &d->val.uuid);
 	return d;
 }
@@ -1138,7 +1345,8 @@ static sdp_data_t *extract_uuid(const uint8_t *p, int bufsize, int *len,
 /*
  * Extract strings from the PDU (could be service description and similar info)
  */
-static sdp_data_t *extract_str(const void *p, int bufsize, int *len)
+static sdp_data_t *extract_str(sdp_arena_t *arena, const void *p,
+						int bufsize, int *len)
 {
 	char *s;
 	int n;
@@ -1149,7 +1357,7 @@ static sdp_data_t *extract_str(const void *p, int bufsize, int *len)
 		return NULL;
 	}
 
-	d = malloc(sizeof(sdp_data_t));
+	d = data_alloc(arena, sizeof(sdp_data_t));
 	if (!d)
 		return NULL;
 
@@ -1164,7 +1372,7 @@ static sdp_data_t *extract_str(const void *p, int bufsize, int *len)
 	case SDP_URL_STR8:
 		if (bufsize < (int) sizeof(uint8_t)) {
 			SDPERR("Unexpected end of packet");
-			free(d);
+			data_release(arena, d);
 			return NULL;
 		}
 		n = *(uint8_t *) p;
@@ -1176,7 +1384,7 @@ static sdp_data_t *extract_str(const void *p, int bufsize, int *len)
 	case SDP_URL_STR16:
 		if (bufsize < (int) sizeof(uint16_t)) {
 			SDPERR("Unexpected end of packet");
-			free(d);
+			data_release(arena, d);
 			return NULL;
 		}
 		n = bt_get_be16(p);
@@ -1186,20 +1394,20 @@ static sdp_data_t *extract_str(const void *p, int bufsize, int *len)
 		break;
 	default:
 		SDPERR("Sizeof text string > UINT16_MAX");
-		free(d);
+		data_release(arena, d);
 		return NULL;
 	}
 
 	if (bufsize < n) {
 		SDPERR("String too long to fit in packet");
-		free(d);
+		data_release(arena, d);
 		return NULL;
 	}
 
-	s = malloc(n + 1);
+	s = data_alloc(arena, n + 1);
 	if (!s) {
 		SDPERR("Not enough memory for incoming string");
-		free(d);
+		data_release(arena, d);
 		return NULL;
 	}
 	memset(s, 0, n + 1);
@@ -1268,12 +1476,15 @@ int sdp_extract_seqtype(const uint8_t *buf, int bufsize, uint8_t *dtdp, int *siz
 	return scanned;
 }
 
-static sdp_data_t *extract_seq(const void *p, int bufsize, int *len,
-							sdp_record_t *rec)
+static sdp_data_t *extract_attr(sdp_arena_t *arena, const uint8_t *p,
+				int bufsize, int *size, sdp_record_t *rec);
+
+static sdp_data_t *extract_seq(sdp_arena_t *arena, const void *p,
+				int bufsize, int *len, sdp_record_t *rec)
 {
 	int seqlen, n = 0;
 	sdp_data_t *curr, *prev;
-	sdp_data_t *d = malloc(sizeof(sdp_data_t));
+	sdp_data_t *d = data_alloc(arena, sizeof(sdp_data_t));
 
 	if (!d)
 		return NULL;
@@ -1288,7 +1499,7 @@ static sdp_data_t *extract_seq(const void *p, int bufsize, int *len,
 
 	if (*len > bufsize) {
 		SDPERR("Packet not big enough to hold sequence.");
-		free(d);
+		data_release(arena, d);
 		return NULL;
 	}
 
@@ -1297,7 +1508,7 @@ static sdp_data_t *extract_seq(const void *p, int bufsize, int *len,
 	prev = NULL;
 	while (n < seqlen) {
 		int attrlen = 0;
-		curr = sdp_extract_attr(p, bufsize, &attrlen, rec);
+		curr = extract_attr(arena, p, bufsize, &attrlen, rec);
 		if (curr == NULL)
 			break;
 
@@ -1317,8 +1528,8 @@ static sdp_data_t *extract_seq(const void *p, int bufsize, int *len,
 	return d;
 }
 
-sdp_data_t *sdp_extract_attr(const uint8_t *p, int bufsize, int *size,
-							sdp_record_t *rec)
+static sdp_data_t *extract_attr(sdp_arena_t *arena, const uint8_t *p,
+				int bufsize, int *size, sdp_record_t *rec)
 {
 	sdp_data_t *elem;
 	int n = 0;
@@ -1345,12 +1556,12 @@ sdp_data_t *sdp_extract_attr(const uint8_t *p, int bufsize, int *size,
 	case SDP_INT32:
 	case SDP_INT64:
 	case SDP_INT128:
-		elem = extract_int(p, bufsize, &n);
+		elem = extract_int(arena, p, bufsize, &n);
 		break;
 	case SDP_UUID16:
 	case SDP_UUID32:
 	case SDP_UUID128:
-		elem = extract_uuid(p, bufsize, &n, rec);
+		elem = extract_uuid(arena, p, bufsize, &n, rec);
 		break;
 	case SDP_TEXT_STR8:
 	case SDP_TEXT_STR16:
@@ -1358,7 +1569,7 @@ sdp_data_t *sdp_extract_attr(const uint8_t *p, int bufsize, int *size,
 	case SDP_URL_STR8:
 	case SDP_URL_STR16:
 	case SDP_URL_STR32:
-		elem = extract_str(p, bufsize, &n);
+		elem = extract_str(arena, p, bufsize, &n);
 		break;
 	case SDP_SEQ8:
 	case SDP_SEQ16:
@@ -1366,7 +1577,7 @@ sdp_data_t *sdp_extract_attr(const uint8_t *p, int bufsize, int *size,
 	case SDP_ALT8:
 	case SDP_ALT16:
 	case SDP_ALT32:
-		elem = extract_seq(p, bufsize, &n, rec);
+		elem = extract_seq(arena, p, bufsize, &n, rec);
 		break;
 	default:
 		SDPERR("Unknown data descriptor : 0x%x terminating", dtd);
@@ -1376,6 +1587,12 @@ sdp_data_t *sdp_extract_attr(const uint8_t *p, int bufsize, int *size,
 	return elem;
 }
 
+sdp_data_t *sdp_extract_attr(const uint8_t *p, int bufsize, int *size,
+							sdp_record_t *rec)
+{
+	return extract_attr(NULL, p, bufsize, size, rec);
+}
+
 #ifdef SDP_DEBUG
 static void attr_print_func(void *value, void *userData)
 {
@@ -1399,14 +1616,24 @@ void sdp_print_service_attr(sdp_list_t *svcAttrList)
 }
 #endif
 
-sdp_record_t *sdp_extract_pdu(const uint8_t *buf, int bufsize, int *scanned)
+static sdp_record_t *extract_pdu(sdp_arena_t *arena, const uint8_t *buf,
+						int bufsize, int *scanned)
 {
 	int extracted = 0, seqlen = 0;
 	uint8_t dtd;
 	uint16_t attr;
-	sdp_record_t *rec = sdp_record_alloc();
+	sdp_record_t *rec;
 	const uint8_t *p = buf;
 
+	if (arena) {
+		rec = arena_alloc(arena, sizeof(sdp_record_t));
+		if (!rec)
+			return NULL;
+
+		rec->handle = 0xffffffff;
+	} else
+		rec = sdp_record_alloc();
+
 	*scanned = sdp_extract_seqtype(buf, bufsize, &dtd, &seqlen);
 	p += *scanned;
 	bufsize -= *scanned;
@@ -1430,7 +1657,7 @@ sdp_record_t *sdp_extract_pdu(const uint8_t *buf, int bufsize, int *scanned)
 
 		SDPDBG("DTD of attrId : %d Attr id : 0x%x ", dtd, attr);
 
-		data = sdp_extract_attr(p + n, bufsize - n, &attrlen, rec);
+		data = extract_attr(arena, p + n, bufsize - n, &attrlen, rec);
 
 		SDPDBG("Attr id : 0x%x attrValueLength : %d", attr, attrlen);
 
@@ -1449,7 +1676,11 @@ sdp_record_t *sdp_extract_pdu(const uint8_t *buf, int bufsize, int *scanned)
 		extracted += n;
 		p += n;
 		bufsize -= n;
-		sdp_attr_replace(rec, attr, data);
+
+		if (arena)
+			arena_attr_replace(arena, rec, attr, data);
+		else
+			sdp_attr_replace(rec, attr, data);
 
 		SDPDBG("Extract PDU, seqLength: %d localExtractedLength: %d",
 							seqlen, extracted);
@@ -1462,6 +1693,24 @@ sdp_record_t *sdp_extract_pdu(const uint8_t *buf, int bufsize, int *scanned)
 	return rec;
 }
 
+sdp_record_t *sdp_extract_pdu(const uint8_t *buf, int bufsize, int *scanned)
+{
+	return extract_pdu(NULL, buf, bufsize, scanned);
+}
+
+/*
+ * Extract a record into an arena. The record must be treated as read only
+ * and is released together with the arena, never with sdp_record_free().
+ */
+sdp_record_t *sdp_extract_pdu_arena(sdp_arena_t *arena, const uint8_t *buf,
+						int bufsize, int *scanned)
+{
+	if (!arena)
+		return NULL;
+
+	return extract_pdu(arena, buf, bufsize, scanned);
+}
+
 static void sdp_copy_pattern(void *value, void *udata)
 {
 	uuid_t *uuid = value;
@@ -3711,10 +3960,13 @@ end:
 struct sdp_transaction {
 	sdp_callback_t *cb;	/* called when the transaction finishes */
 	void *udata;		/* client user data */
+	sdp_record_func_t *rec_cb;	/* called for each streamed record */
+	void *rec_udata;	/* user data passed to rec_cb */
 	uint8_t *reqbuf;	/* pointer to request PDU */
 	sdp_buf_t rsp_concat_buf;
 	uint32_t reqsize;	/* without cstate */
 	int err;		/* ZERO if success or the errno if failed */
+	int stream_seq;		/* outer sequence of a streamed rsp parsed */
 };
 
 /*
@@ -3785,6 +4037,157 @@ int sdp_set_notify(sdp_session_t *session, sdp_callback_t *func, void *udata)
 	return 0;
 }
 
+/*
+ * Sets a callback which gets each record of a service search attribute
+ * response as soon as the fragments received so far contain all of it,
+ * instead of waiting for the whole response to be reassembled. Records
+ * belong to the callback, which has to free them with sdp_record_free().
+ * The sdp_callback_t set with sdp_set_notify() is still called once the
+ * transaction finishes, with only the data which wasn't handed out as a
+ * record. Passing a NULL function disables streaming again.
+ *
+ * RETURN:
+ * 	 0 - Success
+ * 	-1 - Failure
+ */
+int sdp_set_record_notify(sdp_session_t *session, sdp_record_func_t *func,
+								void *udata)
+{
+	struct sdp_transaction *t;
+
+	if (!session || !session->priv)
+		return -1;
+
+	t = session->priv;
+	t->rec_cb = func;
+	t->rec_udata = udata;
+
+	return 0;
+}
+
+/*
+ * Parse the header of a data element sequence without logging errors for
+ * a header which is only incomplete.
+ * RETURN:
+ * 	 1 - header parsed
+ * 	 0 - more data is needed
+ * 	-1 - not a sequence
+ */
+static int stream_seq_header(const uint8_t *buf, size_t len, size_t *hdr,
+								size_t *seqlen)
+{
+	if (len < 1)
+		return 0;
+
+	switch (buf[0]) {
+	case SDP_SEQ8:
+	case SDP_ALT8:
+		*hdr = 1 + sizeof(uint8_t);
+		break;
+	case SDP_SEQ16:
+	case SDP_ALT16:
+		*hdr = 1 + sizeof(uint16_t);
+		break;
+	case SDP_SEQ32:
+	case SDP_ALT32:
+		*hdr = 1 + sizeof(uint32_t);
+		break;
+	default:
+		return -1;
+	}
+
+	if (len < *hdr)
+		return 0;
+
+	switch (*hdr) {
+	case 1 + sizeof(uint8_t):
+		*seqlen = buf[1];
+		break;
+	case 1 + sizeof(uint16_t):
+		*seqlen = bt_get_be16(buf + 1);
+		break;
+	default:
+		*seqlen = bt_get_be32(buf + 1);
+		break;
+	}
+
+	return 1;
+}
+
+/*
+ * Hand out every complete record at the front of the reassembly buffer and
+ * keep only the incomplete rest, so the buffer never holds more than one
+ * partial record. Once the last fragment arrived, whatever is left is
+ * parsed as leniently as sdp_extract_pdu() does for truncated records.
+ */
+static int stream_records(struct sdp_transaction *t, int last)
+{
+	sdp_buf_t *buf = &t->rsp_concat_buf;
+	size_t pos = 0, hdr, seqlen;
+	int ret;
+
+	if (!t->stream_seq) {
+		ret = stream_seq_header(buf->data, buf->data_size, &hdr,
+								&seqlen);
+		if (ret <= 0)
+			return ret;
+
+		pos = hdr;
+		t->stream_seq = 1;
+	}
+
+	while (pos < buf->data_size) {
+		sdp_record_t *rec;
+		int scanned = 0;
+
+		ret = stream_seq_header(buf->data + pos, buf->data_size - pos,
+								&hdr, &seqlen);
+		if (ret < 0)
+			return ret;
+
+		if (!ret || buf->data_size - pos - hdr < seqlen)
+			break;
+
+		rec = sdp_extract_pdu(buf->data + pos, hdr + seqlen, &scanned);
+		if (!rec)
+			return -1;
+
+		pos += hdr + seqlen;
+
+		t->rec_cb(rec, t->rec_udata);
+	}
+
+	while (last && t->stream_seq && pos < buf->data_size) {
+		sdp_record_t *rec;
+		int scanned = 0;
+
+		rec = sdp_extract_pdu(buf->data + pos, buf->data_size - pos,
+								&scanned);
+		if (!rec)
+			break;
+
+		if (!scanned) {
+			sdp_record_free(rec);
+			break;
+		}
+
+		/* A truncated record claims more data than there is */
+		if ((size_t) scanned > buf->data_size - pos)
+			pos = buf->data_size;
+		else
+			pos += scanned;
+
+		t->rec_cb(rec, t->rec_udata);
+	}
+
+	if (pos) {
+		buf->data_size -= pos;
+		memmove(buf->data, buf->data + pos, buf->data_size);
+	}
+
+	return 0;
+}
+
 /*
  * This function starts an asynchronous service search request.
  * The incoming and outgoing data are stored in the transaction structure
@@ -4040,6 +4443,7 @@ int sdp_service_search_attr_async(sdp_session_t *session, const sdp_list_t *sear
 	/* clean possible allocated buffer */
 	free(t->rsp_concat_buf.data);
 	memset(&t->rsp_concat_buf, 0, sizeof(sdp_buf_t));
+	t->stream_seq = 0;
 
 	if (!t->reqbuf) {
 		t->reqbuf = malloc(SDP_REQ_BUFFER_SIZE);
@@ -4321,6 +4725,14 @@ int sdp_process(sdp_session_t *session)
 	memcpy(targetPtr, pdata, rsp_count);
 	t->rsp_concat_buf.data_size += rsp_count;
 
+	if (t->rec_cb && pdu_id == SDP_SVC_SEARCH_ATTR_RSP &&
+				stream_records(t, !pcstate->length) < 0) {
+		t->err = EPROTO;
+		SDPERR("Protocol error: invalid record in response");
+		status = 0xffff;
+		goto end;
+	}
+
 	if (pcstate->length > 0) {
 		int reqsize, cstate_len;
 
@@ -117,6 +117,12 @@ typedef enum {
  */
 typedef void sdp_callback_t(uint8_t type, uint16_t status, uint8_t *rsp, size_t size, void *udata);
 
+/*
+ * 	Called for each record of a streamed service search attribute
+ * 	response, see sdp_set_record_notify.
+ */
+typedef void sdp_record_func_t(sdp_record_t *rec, void *udata);
+
 /*
  * create an L2CAP connection to a Bluetooth device
  *
@@ -140,6 +146,8 @@ sdp_session_t *sdp_create(int sk, uint32_t flags);
 int sdp_get_error(sdp_session_t *session);
 int sdp_process(sdp_session_t *session);
 int sdp_set_notify(sdp_session_t *session, sdp_callback_t *func, void *udata);
+int sdp_set_record_notify(sdp_session_t *session, sdp_record_func_t *func,
+								void *udata);
 
 int sdp_service_search_async(sdp_session_t *session, const sdp_list_t *search, uint16_t max_rec_num);
 int sdp_service_attr_async(sdp_session_t *session, uint32_t handle, sdp_attrreq_type_t reqtype, const sdp_list_t *attrid_list);
@@ -601,6 +609,15 @@ int sdp_set_supp_feat(sdp_record_t *rec, const sdp_list_t *sf);
 int sdp_get_supp_feat(const sdp_record_t *rec, sdp_list_t **seqp);
 
 sdp_record_t *sdp_extract_pdu(const uint8_t *pdata, int bufsize, int *scanned);
+
+typedef struct sdp_arena sdp_arena_t;
+
+sdp_arena_t *sdp_arena_new(void);
+void sdp_arena_reset(sdp_arena_t *arena);
+void sdp_arena_free(sdp_arena_t *arena);
+sdp_record_t *sdp_extract_pdu_arena(sdp_arena_t *arena, const uint8_t *pdata,
+						int bufsize, int *scanned);
+
 sdp_record_t *sdp_copy_record(sdp_record_t *rec);
 
 void sdp_data_print(sdp_data_t *data);
@@ -28,6 +28,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <errno.h>
 
 #include "lib/bluetooth.h"
@@ -123,29 +124,161 @@ int bt_uuid128_create(bt_uuid_t *btuuid, uint128_t value)
 	return 0;
 }
 
+static inline bool bt_uuid_is_short(const bt_uuid_t *uuid)
+{
+	return uuid->type == BT_UUID16 || uuid->type == BT_UUID32;
+}
+
+static inline uint32_t bt_uuid_short_value(const bt_uuid_t *uuid)
+{
+	return uuid->type == BT_UUID16 ? uuid->value.u16 : uuid->value.u32;
+}
+
 int bt_uuid_cmp(const bt_uuid_t *uuid1, const bt_uuid_t *uuid2)
 {
 	bt_uuid_t u1, u2;
 
+	/*
+	 * 16-bit UUIDs are the 32-bit UUIDs with the upper half zeroed, and
+	 * both end up big-endian in the first 4 bytes of the 128-bit form,
+	 * so comparing the values keeps the order of the 128-bit compare.
+	 */
+	if (bt_uuid_is_short(uuid1) && bt_uuid_is_short(uuid2)) {
+		uint32_t v1 = bt_uuid_short_value(uuid1);
+		uint32_t v2 = bt_uuid_short_value(uuid2);
+
+		return v1 < v2 ? -1 : v1 > v2;
+	}
+
 	bt_uuid_to_uuid128(uuid1, &u1);
 	bt_uuid_to_uuid128(uuid2, &u2);
 
 	return bt_uuid128_cmp(&u1, &u2);
 }
 
+/*
+ * Interned UUIDs are stored in their 128-bit form in an open addressing
+ * hash table and get a small identifier, starting from 1, which stays the
+ * same for as long as the process lives. The table is not thread safe.
+ */
+struct uuid_intern_entry {
+	uint128_t value;
+	unsigned int id;
+};
+
+#define MIN_INTERN_ENTRIES 64
+
+static struct uuid_intern_entry *intern_table;
+static unsigned int intern_size;
+static unsigned int intern_count;
+
+static unsigned int intern_hash(const uint128_t *value)
+{
+	unsigned int hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < sizeof(value->data); i++) {
+		hash ^= value->data[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static struct uuid_intern_entry *intern_find(const uint128_t *value)
+{
+	unsigned int i;
+
+	if (!intern_size)
+		return NULL;
+
+	for (i = intern_hash(value) & (intern_size - 1);;
+					i = (i + 1) & (intern_size - 1)) {
+		struct uuid_intern_entry *entry = &intern_table[i];
+
+		if (!entry->id || !memcmp(&entry->value, value,
+							sizeof(*value)))
+			return entry;
+	}
+}
+
+static int intern_grow(void)
+{
+	struct uuid_intern_entry *old = intern_table;
+	unsigned int i, old_size = intern_size;
+
+	intern_size = old_size ? old_size << 1 : MIN_INTERN_ENTRIES;
+	intern_table = calloc(intern_size, sizeof(*intern_table));
+	if (!intern_table) {
+		intern_table = old;
+		intern_size = old_size;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < old_size; i++) {
+		if (old[i].id)
+			*intern_find(&old[i].value) = old[i];
+	}
+
+	free(old);
+
+	return 0;
+}
+
+unsigned int bt_uuid_intern(const bt_uuid_t *uuid)
+{
+	struct uuid_intern_entry *entry;
+	bt_uuid_t u128;
+
+	if (uuid->type == BT_UUID_UNSPEC)
+		return 0;
+
+	bt_uuid_to_uuid128(uuid, &u128);
+
+	entry = intern_find(&u128.value.u128);
+	if (entry && entry->id)
+		return entry->id;
+
+	/* Keep the table at most half full so probe sequences stay short */
+	if ((intern_count + 1) * 2 > intern_size) {
+		if (intern_grow() < 0)
+			return 0;
+
+		entry = intern_find(&u128.value.u128);
+	}
+
+	entry->value = u128.value.u128;
+	entry->id = ++intern_count;
+
+	return entry->id;
+}
+
+unsigned int bt_uuid_intern_lookup(const bt_uuid_t *uuid)
+{
+	struct uuid_intern_entry *entry;
+	bt_uuid_t u128;
+
+	if (uuid->type == BT_UUID_UNSPEC)
+		return 0;
+
+	bt_uuid_to_uuid128(uuid, &u128);
+
+	entry = intern_find(&u128.value.u128);
+
+	return entry ? entry->id : 0;
+}
+
 /*
  * convert the UUID to string, copying a maximum of n characters.
  */
 int bt_uuid_to_string(const bt_uuid_t *uuid, char *str, size_t n)
 {
+	static const char digits[] = "0123456789abcdef";
+	char buf[MAX_LEN_UUID_STR];
 	bt_uuid_t tmp;
-	unsigned int   data0;
-	unsigned short data1;
-	unsigned short data2;
-	unsigned short data3;
-	unsigned int   data4;
-	unsigned short data5;
 	const uint8_t *data;
+	size_t i, len;
+	char *ptr = buf;
 
 	if (!uuid || uuid->type == BT_UUID_UNSPEC) {
 		snprintf(str, n, "NULL");
@@ -156,17 +289,26 @@ int bt_uuid_to_string(const bt_uuid_t *uuid, char *str, size_t n)
 	bt_uuid_to_uuid128(uuid, &tmp);
 	data = (uint8_t *) &tmp.value.u128;
 
-	memcpy(&data0, &data[0], 4);
-	memcpy(&data1, &data[4], 2);
-	memcpy(&data2, &data[6], 2);
-	memcpy(&data3, &data[8], 2);
-	memcpy(&data4, &data[10], 4);
-	memcpy(&data5, &data[14], 2);
+	for (i = 0; i < sizeof(tmp.value.u128); i++) {
+		if (i == 4 || i == 6 || i == 8 || i == 10)
+			*ptr++ = '-';
+
+		*ptr++ = digits[data[i] >> 4];
+		*ptr++ = digits[data[i] & 0x0f];
+	}
+
+	*ptr = '\0';
+
+	/* Truncate the same way snprintf() does */
+	if (!n)
+		return 0;
 
-	snprintf(str, n, "%.8x-%.4x-%.4x-%.4x-%.8x%.4x",
-				ntohl(data0), ntohs(data1),
-				ntohs(data2), ntohs(data3),
-				ntohl(data4), ntohs(data5));
+	len = ptr - buf;
+	if (len > n - 1)
+		len = n - 1;
+
+	memcpy(str, buf, len);
+	str[len] = '\0';
 
 	return 0;
 }
@@ -180,17 +322,51 @@ static inline int is_uuid128(const char *string)
 			string[23] == '-');
 }
 
-static inline int is_base_uuid128(const char *string)
+static inline int hex_value(char c)
 {
-	uint16_t uuid;
-	char dummy[2];
+	if (c >= '0' && c <= '9')
+		return c - '0';
 
-	if (!is_uuid128(string))
-		return 0;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
+}
+
+/* Decode a string already checked with is_uuid128() into big-endian */
+static int uuid128_decode(const char *string, uint128_t *u128)
+{
+	uint8_t *val = u128->data;
+	size_t i;
 
-	return sscanf(string,
-		"0000%04hx-0000-1000-8000-00805%1[fF]9%1[bB]34%1[fF]%1[bB]",
-		&uuid, dummy, dummy, dummy, dummy) == 5;
+	for (i = 0; i < sizeof(u128->data); i++) {
+		int hi, lo;
+
+		if (i == 4 || i == 6 || i == 8 || i == 10)
+			string++;
+
+		hi = hex_value(*string++);
+		lo = hex_value(*string++);
+		if (hi < 0 || lo < 0)
+			return -EINVAL;
+
+		val[i] = (hi << 4) | lo;
+	}
+
+	return 0;
+}
+
+static inline int is_base_uuid128(const uint128_t *u128)
+{
+	/* Everything but the 16-bit value has to match the base UUID */
+	return !memcmp(u128->data, bluetooth_base_uuid.data,
+						BASE_UUID16_OFFSET) &&
+		!memcmp(u128->data + BASE_UUID16_OFFSET + 2,
+			bluetooth_base_uuid.data + BASE_UUID16_OFFSET + 2,
+			sizeof(u128->data) - BASE_UUID16_OFFSET - 2);
 }
 
 static inline int is_uuid32(const char *string)
@@ -233,29 +409,14 @@ static int bt_string_to_uuid32(bt_uuid_t *uuid, const char *string)
 
 static int bt_string_to_uuid128(bt_uuid_t *uuid, const char *string)
 {
-	uint32_t data0, data4;
-	uint16_t data1, data2, data3, data5;
 	uint128_t u128;
-	uint8_t *val = (uint8_t *) &u128;
 
-	if (sscanf(string, "%08x-%04hx-%04hx-%04hx-%08x%04hx",
-				&data0, &data1, &data2,
-				&data3, &data4, &data5) != 6)
+	if (uuid128_decode(string, &u128) < 0)
 		return -EINVAL;
 
-	data0 = htonl(data0);
-	data1 = htons(data1);
-	data2 = htons(data2);
-	data3 = htons(data3);
-	data4 = htonl(data4);
-	data5 = htons(data5);
-
-	memcpy(&val[0], &data0, 4);
-	memcpy(&val[4], &data1, 2);
-	memcpy(&val[6], &data2, 2);
-	memcpy(&val[8], &data3, 2);
-	memcpy(&val[10], &data4, 4);
-	memcpy(&val[14], &data5, 2);
+	if (is_base_uuid128(&u128))
+		return bt_uuid16_create(uuid,
+				bt_get_be16(&u128.data[BASE_UUID16_OFFSET]));
 
 	bt_uuid128_create(uuid, u128);
 
@@ -264,9 +425,7 @@ static int bt_string_to_uuid128(bt_uuid_t *uuid, const char *string)
 
 int bt_string_to_uuid(bt_uuid_t *uuid, const char *string)
 {
-	if (is_base_uuid128(string))
-		return bt_string_to_uuid16(uuid, string + 4);
-	else if (is_uuid128(string))
+	if (is_uuid128(string))
 		return bt_string_to_uuid128(uuid, string);
 	else if (is_uuid32(string))
 		return bt_string_to_uuid32(uuid, string);
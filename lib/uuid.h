@@ -128,6 +128,7 @@ extern "C" {
 #define GATT_CHARAC_SOFTWARE_REVISION_STRING		0x2A28
 #define GATT_CHARAC_MANUFACTURER_NAME_STRING		0x2A29
 #define GATT_CHARAC_PNP_ID				0x2A50
+#define GATT_CHARAC_DB_HASH				0x2B2A
 
 /* GATT Characteristic Descriptors */
 #define GATT_CHARAC_EXT_PROPER_UUID			0x2900
@@ -173,6 +174,9 @@ int bt_uuid128_create(bt_uuid_t *btuuid, uint128_t value);
 int bt_uuid_cmp(const bt_uuid_t *uuid1, const bt_uuid_t *uuid2);
 void bt_uuid_to_uuid128(const bt_uuid_t *src, bt_uuid_t *dst);
 
+unsigned int bt_uuid_intern(const bt_uuid_t *uuid);
+unsigned int bt_uuid_intern_lookup(const bt_uuid_t *uuid);
+
 #define MAX_LEN_UUID_STR 37
 
 int bt_uuid_to_string(const bt_uuid_t *uuid, char *str, size_t n);
@@ -130,14 +130,93 @@ static int aes_ecb_setup(const uint8_t key[16])
 	return nfd;
 }
 
+/*
+ * Keyed AF_ALG sockets are kept around for the most recently used keys,
+ * so that encrypting or authenticating a PDU with a net or app key does
+ * not pay for creating, binding and keying a socket every time.
+ */
+#define ALG_CACHE_SIZE	8
+
+struct alg_ctx {
+	uint8_t key[16];
+	int fd;
+};
+
+struct alg_cache {
+	struct alg_ctx ctx[ALG_CACHE_SIZE];
+	unsigned int count;
+};
+
+static struct alg_cache ecb_cache;
+static struct alg_cache cmac_cache;
+
+static int alg_cache_get(struct alg_cache *cache, const uint8_t key[16],
+				int (*setup)(const uint8_t key[16]))
+{
+	struct alg_ctx ctx;
+	unsigned int i;
+
+	for (i = 0; i < cache->count; i++) {
+		if (!memcmp(cache->ctx[i].key, key, 16))
+			break;
+	}
+
+	if (i < cache->count) {
+		ctx = cache->ctx[i];
+	} else {
+		ctx.fd = setup(key);
+		if (ctx.fd < 0)
+			return -1;
+
+		memcpy(ctx.key, key, 16);
+
+		if (cache->count < ALG_CACHE_SIZE)
+			cache->count++;
+		else
+			close(cache->ctx[--i].fd);
+	}
+
+	/* Most recently used first, the last entry is evicted next */
+	memmove(&cache->ctx[1], &cache->ctx[0], i * sizeof(ctx));
+	cache->ctx[0] = ctx;
+
+	return ctx.fd;
+}
+
+static void alg_cache_put(struct alg_cache *cache, int fd, bool result)
+{
+	unsigned int i;
+
+	/* A socket that failed an operation is not trusted again */
+	if (result)
+		return;
+
+	for (i = 0; i < cache->count; i++) {
+		if (cache->ctx[i].fd != fd)
+			continue;
+
+		close(fd);
+		cache->count--;
+		memmove(&cache->ctx[i], &cache->ctx[i + 1],
+				(cache->count - i) * sizeof(cache->ctx[0]));
+		memset(&cache->ctx[cache->count], 0, sizeof(cache->ctx[0]));
+		break;
+	}
+}
+
 static bool aes_ecb(int fd, const uint8_t plaintext[16], uint8_t encrypted[16])
 {
 	return alg_encrypt(fd, plaintext, 16, encrypted, 16);
 }
 
-static void aes_ecb_destroy(int fd)
+static int aes_ecb_get(const uint8_t key[16])
 {
-	close(fd);
+	return alg_cache_get(&ecb_cache, key, aes_ecb_setup);
+}
+
+static void aes_ecb_put(int fd, bool result)
+{
+	alg_cache_put(&ecb_cache, fd, result);
 }
 
 static bool aes_ecb_one(const uint8_t key[16],
@@ -146,13 +225,13 @@ static bool aes_ecb_one(const uint8_t key[16],
 	bool result;
 	int fd;
 
-	fd = aes_ecb_setup(key);
+	fd = aes_ecb_get(key);
 	if (fd < 0)
 		return false;
 
 	result = aes_ecb(fd, plaintext, encrypted);
 
-	aes_ecb_destroy(fd);
+	aes_ecb_put(fd, result);
 
 	return result;
 }
@@ -205,17 +284,14 @@ static bool aes_cmac(int fd, const uint8_t *msg,
 	return true;
 }
 
-static void aes_cmac_destroy(int fd)
+static int aes_cmac_get(const uint8_t key[16])
 {
-	close(fd);
+	return alg_cache_get(&cmac_cache, key, aes_cmac_setup);
 }
 
-static int aes_cmac_N_start(const uint8_t N[16])
+static void aes_cmac_put(int fd, bool result)
 {
-	int fd;
-
-	fd = aes_cmac_setup(N);
-	return fd;
+	alg_cache_put(&cmac_cache, fd, result);
 }
 
 static bool aes_cmac_one(const uint8_t key[16], const void *msg,
@@ -224,13 +300,13 @@ static bool aes_cmac_one(const uint8_t key[16], const void *msg,
 	bool result;
 	int fd;
 
-	fd = aes_cmac_setup(key);
+	fd = aes_cmac_get(key);
 	if (fd < 0)
 		return false;
 
 	result = aes_cmac(fd, msg, msg_len, res);
 
-	aes_cmac_destroy(fd);
+	aes_cmac_put(fd, result);
 
 	return result;
 }
@@ -259,7 +335,7 @@ bool mesh_crypto_aes_ccm_encrypt(const uint8_t nonce[13], const uint8_t key[16],
 		return false;
 	}
 
-	fd = aes_ecb_setup(key);
+	fd = aes_ecb_get(key);
 	if (fd < 0)
 		return false;
 
@@ -401,7 +477,7 @@ bool mesh_crypto_aes_ccm_encrypt(const uint8_t nonce[13], const uint8_t key[16],
 	}
 
 done:
-	aes_ecb_destroy(fd);
+	aes_ecb_put(fd, result);
 
 	return result;
 }
@@ -423,7 +499,7 @@ bool mesh_crypto_aes_ccm_decrypt(const uint8_t nonce[13], const uint8_t key[16],
 	if (enc_msg_len < 5 || aad_len >= 0xff00)
 		return false;
 
-	fd = aes_ecb_setup(key);
+	fd = aes_ecb_get(key);
 	if (fd < 0)
 		return false;
 
@@ -569,7 +645,7 @@ bool mesh_crypto_aes_ccm_decrypt(const uint8_t nonce[13], const uint8_t key[16],
 	}
 
 done:
-	aes_ecb_destroy(fd);
+	aes_ecb_put(fd, result);
 
 	return result;
 }
@@ -606,7 +682,7 @@ bool mesh_crypto_k2(const uint8_t n[16], const uint8_t *p, size_t p_len,
 	if (!aes_cmac_one(stage, n, 16, t))
 		goto fail;
 
-	fd = aes_cmac_N_start(t);
+	fd = aes_cmac_get(t);
 	if (fd < 0)
 		goto fail;
 
@@ -638,7 +714,7 @@ bool mesh_crypto_k2(const uint8_t n[16], const uint8_t *p, size_t p_len,
 	success = true;
 
 done:
-	aes_cmac_destroy(fd);
+	aes_cmac_put(fd, success);
 fail:
 	g_free(stage);
 
@@ -54,6 +54,15 @@
 static struct io *write_io;
 static uint16_t write_mtu;
 
+/*
+ * Proxy PDUs waiting for room in the AcquireWrite pipe. When the pipe is
+ * full the queue is resumed from the write handler instead of dropping
+ * the PDU, and callers only see completion once it has been written.
+ */
+static GQueue write_queue = G_QUEUE_INIT;
+static bool write_flushing;
+static bool write_waiting;
+
 static struct io *notify_io;
 static uint16_t notify_mtu;
 
@@ -64,6 +73,8 @@ struct write_data {
 	GDBusReturnFunction cb;
 	uint8_t *gatt_data;
 	uint8_t gatt_len;
+	uint8_t sar;
+	bool started;
 };
 
 struct notify_data {
@@ -189,25 +200,23 @@ uint16_t mesh_gatt_sar(uint8_t **pkt, uint16_t size)
 	}
 }
 
-static bool pipe_write(struct io *io, void *user_data)
+static int pipe_send(struct io *io, struct write_data *data)
 {
-	struct write_data *data = user_data;
 	struct iovec iov[2];
-	uint8_t sar;
 	uint8_t max_len = write_mtu - 4;
 
-	if (data == NULL)
-		return true;
-
-	print_byte_array("GATT-TX:\t", data->gatt_data, data->gatt_len);
+	if (!data->started) {
+		print_byte_array("GATT-TX:\t", data->gatt_data,
+							data->gatt_len);
 
-	sar = data->gatt_data[0];
-
-	data->iov.iov_base = data->gatt_data + 1;
-	data->iov.iov_len--;
+		data->sar = data->gatt_data[0];
+		data->iov.iov_base = data->gatt_data + 1;
+		data->iov.iov_len--;
+		data->started = true;
+	}
 
-	iov[0].iov_base = &sar;
-	iov[0].iov_len = sizeof(sar);
+	iov[0].iov_base = &data->sar;
+	iov[0].iov_len = sizeof(data->sar);
 
 	while (1) {
 		int err;
@@ -215,36 +224,95 @@ static bool pipe_write(struct io *io, void *user_data)
 		iov[1] = data->iov;
 
 		err = io_send(io, iov, 2);
-		if (err < 0) {
-			rl_printf("Failed to write: %s\n", strerror(-err));
-			write_data_free(data);
-			return false;
-		}
+		if (err < 0)
+			return err;
 
-		switch (sar & GATT_SAR_MASK) {
+		switch (data->sar & GATT_SAR_MASK) {
 		case GATT_SAR_FIRST:
 		case GATT_SAR_CONTINUE:
 			data->gatt_len -= max_len;
 			data->iov.iov_base = data->iov.iov_base + max_len;
 
-			sar &= GATT_TYPE_MASK;
+			data->sar &= GATT_TYPE_MASK;
 			if (max_len < data->gatt_len) {
 				data->iov.iov_len = max_len;
-				sar |= GATT_SAR_CONTINUE;
+				data->sar |= GATT_SAR_CONTINUE;
 			} else {
 				data->iov.iov_len = data->gatt_len;
-				sar |= GATT_SAR_LAST;
+				data->sar |= GATT_SAR_LAST;
 			}
 
 			break;
 
 		default:
-			if(data->cb)
-				data->cb(NULL, data->user_data);
+			return 0;
+		}
+	}
+}
+
+static bool pipe_write_ready(struct io *io, void *user_data);
+
+static bool pipe_flush(struct io *io)
+{
+	struct write_data *data;
+	bool result = true;
+
+	/* Completion callbacks queue more PDUs, they get sent below */
+	if (write_flushing)
+		return true;
+
+	write_flushing = true;
+
+	while ((data = g_queue_peek_head(&write_queue))) {
+		int err;
+
+		err = pipe_send(io, data);
+		if (err == -EAGAIN || err == -EWOULDBLOCK) {
+			if (!write_waiting)
+				write_waiting = io_set_write_handler(io,
+							pipe_write_ready,
+							NULL, NULL);
+			break;
+		}
+
+		g_queue_pop_head(&write_queue);
+
+		if (err < 0) {
+			rl_printf("Failed to write: %s\n", strerror(-err));
 			write_data_free(data);
-			return true;
+			result = false;
+			continue;
 		}
+
+		if (data->cb)
+			data->cb(NULL, data->user_data);
+
+		write_data_free(data);
 	}
+
+	write_flushing = false;
+
+	return result;
+}
+
+static bool pipe_write_ready(struct io *io, void *user_data)
+{
+	pipe_flush(io);
+
+	/* Keep waiting only while the pipe is still backed up */
+	write_waiting = !g_queue_is_empty(&write_queue);
+
+	return write_waiting;
+}
+
+static bool pipe_write(struct io *io, void *user_data)
+{
+	struct write_data *data = user_data;
+
+	if (data)
+		g_queue_push_tail(&write_queue, data);
+
+	return pipe_flush(io);
 }
 
 static void write_reply(DBusMessage *message, void *user_data)
@@ -316,6 +384,12 @@ static void write_reply(DBusMessage *message, void *user_data)
 
 static void write_io_destroy(void)
 {
+	struct write_data *data;
+
+	while ((data = g_queue_pop_head(&write_queue)))
+		write_data_free(data);
+
+	write_waiting = false;
 	io_destroy(write_io);
 	write_io = NULL;
 	write_mtu = 0;
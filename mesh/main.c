@@ -2295,6 +2295,7 @@ int main(int argc, char *argv[])
 	dbus_connection_unref(dbus_conn);
 	g_main_loop_unref(main_loop);
 
+	prov_db_cleanup();
 	node_cleanup();
 
 	g_list_free(char_list);
@@ -69,8 +69,44 @@ struct mesh_net {
 	GList *msg_out;	/* Pre-Network encoded, might be multi-segment */
 	GList *pkt_out; /* Fully encoded packets awaiting Tx in order */
 	net_mesh_session_open_callback open_cb;
+	gint64 sar_rtt;	/* Smoothed segment to ACK round trip, in usec */
 };
 
+/*
+ * Segment timing. Outgoing segments are first retried after the slow
+ * GATT default; once ACKs have been seen the retry interval follows the
+ * measured round trip, but never drops below the minimum for the TTL.
+ * Incoming segments are acknowledged after a short delay, so a burst of
+ * segments is answered with a single Segment Acknowledgment.
+ */
+#define SAR_OUT_RETRY_DEFAULT	2000
+#define SAR_OUT_RETRY_MIN(ttl)	(200 + 50 * (ttl))
+#define SAR_IN_ACK_DELAY(ttl)	(150 + 50 * (ttl))
+
+/*
+ * Network message cache: the most recent PDUs by SRC, SEQ and IV Index,
+ * so that copies relayed or retransmitted by other nodes are dropped
+ * before being processed again. Entries are reused in arrival order and
+ * hashed into short chains, keeping both lookup and insert constant time.
+ * Chain links hold the entry index plus one, zero ends a chain.
+ */
+#define MSG_CACHE_SIZE		128
+#define MSG_CACHE_BUCKETS	64
+
+struct msg_cache_entry {
+	uint32_t iv_index;
+	uint32_t seq;
+	uint16_t src;
+	uint16_t next;
+};
+
+static struct msg_cache {
+	struct msg_cache_entry entries[MSG_CACHE_SIZE];
+	uint16_t buckets[MSG_CACHE_BUCKETS];
+	unsigned int count;
+	unsigned int oldest;
+} msg_cache;
+
 struct generic_key {
 	uint16_t	idx;
 };
@@ -117,6 +153,8 @@ struct mesh_pkt {
 struct mesh_sar_msg {
 	guint		ack_to;
 	guint		msg_to;
+	guint		ack_delay;
+	gint64		sent;
 	uint32_t	iv_index;
 	uint32_t	seqAuth;
 	uint32_t	ack;
@@ -229,6 +267,15 @@ static GList *virt_addrs = NULL;
 static GList *net_keys = NULL;
 static GList *app_keys = NULL;
 
+/*
+ * Network keys by NID, covering both the current and the key refresh
+ * variant, so an incoming PDU is only tried against the keys that can
+ * have encrypted it.
+ */
+#define NID_BUCKETS	0x80
+
+static GSList *nid_keys[NID_BUCKETS];
+
 /* Forward static declarations */
 static void resend_segs(struct mesh_sar_msg *sar);
 
@@ -269,6 +316,29 @@ uint16_t net_validate_proxy_beacon(const uint8_t *proxy_beacon)
 	return net_key->generic.idx;
 }
 
+static void nid_keys_remove(struct mesh_net_key *net_key)
+{
+	int i;
+
+	for (i = 0; i < NID_BUCKETS; i++)
+		nid_keys[i] = g_slist_remove(nid_keys[i], net_key);
+}
+
+static void nid_keys_update(struct mesh_net_key *net_key)
+{
+	uint8_t nid;
+
+	nid_keys_remove(net_key);
+
+	nid = net_key->current.nid;
+	if (nid < NID_BUCKETS)
+		nid_keys[nid] = g_slist_append(nid_keys[nid], net_key);
+
+	nid = net_key->new.nid;
+	if (nid < NID_BUCKETS && nid != net_key->current.nid)
+		nid_keys[nid] = g_slist_append(nid_keys[nid], net_key);
+}
+
 static int match_sar_dst(const void *a, const void *b)
 {
 	const struct mesh_sar_msg *sar = a;
@@ -457,6 +527,8 @@ bool keys_net_key_add(uint16_t net_idx, uint8_t *key, bool update)
 		if (!result)
 			net_key->new.nid = 0xff;
 
+		nid_keys_update(net_key);
+
 		return result;
 
 	} else if (l) {
@@ -498,6 +570,7 @@ bool keys_net_key_add(uint16_t net_idx, uint8_t *key, bool update)
 		}
 
 		net_keys = g_list_append(net_keys, net_key);
+		nid_keys_update(net_key);
 	}
 
 	return true;
@@ -579,7 +652,12 @@ bool keys_app_key_delete(uint16_t app_idx)
 
 bool keys_net_key_delete(uint16_t net_idx)
 {
+	struct mesh_net_key *net_key = find_net_key_by_idx(net_idx);
+
 	/* TODO: remove all associated app keys and bindings */
+	if (net_key)
+		nid_keys_remove(net_key);
+
 	return delete_key(&net_keys, net_idx);
 }
 
@@ -650,6 +728,13 @@ uint8_t *keys_app_key_get(uint16_t app_idx, bool current)
 
 void keys_cleanup_all(void)
 {
+	int i;
+
+	for (i = 0; i < NID_BUCKETS; i++) {
+		g_slist_free(nid_keys[i]);
+		nid_keys[i] = NULL;
+	}
+
 	g_list_free_full(app_keys, g_free);
 	g_list_free_full(net_keys, g_free);
 	app_keys = net_keys = NULL;
@@ -1138,7 +1223,7 @@ static struct mesh_net_key *net_packet_decode(bool proxy, uint32_t iv_index,
 		.net_key = NULL,
 	};
 
-	g_list_foreach(net_keys, try_decode, &decode);
+	g_slist_foreach(nid_keys[packet[0] & 0x7f], try_decode, &decode);
 
 	return decode.net_key;
 }
@@ -1153,6 +1238,9 @@ static void flush_sar(GList **list, struct mesh_sar_msg *sar)
 	if (sar->ack_to)
 		g_source_remove(sar->ack_to);
 
+	if (sar->ack_delay)
+		g_source_remove(sar->ack_delay);
+
 	g_free(sar);
 }
 
@@ -1331,6 +1419,7 @@ static void resend_segs(struct mesh_sar_msg *sar)
 	uint8_t i;
 
 	sar->activity_cnt = 0;
+	sar->sent = g_get_monotonic_time();
 
 	for (i = 0; i <= sar->segN; i++, ack <<= 1) {
 		if (!(ack & sar->ack))
@@ -1338,6 +1427,29 @@ static void resend_segs(struct mesh_sar_msg *sar)
 	}
 }
 
+static gboolean sar_out_ack_timeout(void *user_data);
+
+static guint sar_out_retry_interval(struct mesh_sar_msg *sar)
+{
+	gint64 interval;
+
+	if (!net.sar_rtt)
+		return SAR_OUT_RETRY_DEFAULT;
+
+	interval = 2 * net.sar_rtt / 1000;
+
+	return MAX(interval, SAR_OUT_RETRY_MIN(sar->ttl));
+}
+
+static void sar_out_ack_restart(struct mesh_sar_msg *sar)
+{
+	if (sar->ack_to)
+		g_source_remove(sar->ack_to);
+
+	sar->ack_to = g_timeout_add(sar_out_retry_interval(sar),
+						sar_out_ack_timeout, sar);
+}
+
 static bool ack_rxed(bool to, uint16_t src, uint16_t dst, bool obo,
 				uint16_t seq0, uint32_t ack_flags)
 {
@@ -1352,6 +1464,17 @@ static bool ack_rxed(bool to, uint16_t src, uint16_t dst, bool obo,
 
 	sar->ack |= (ack_flags & full_ack);
 
+	if (sar->sent) {
+		gint64 rtt = g_get_monotonic_time() - sar->sent;
+
+		if (net.sar_rtt)
+			net.sar_rtt = (7 * net.sar_rtt + rtt) / 8;
+		else
+			net.sar_rtt = rtt;
+
+		sar->sent = 0;
+	}
+
 	if (sar->ack == full_ack) {
 		/* Outbound message 100% received by remote node */
 		flush_sar(&net.msg_out, sar);
@@ -1365,6 +1488,9 @@ static bool ack_rxed(bool to, uint16_t src, uint16_t dst, bool obo,
 	if (net.pkt_out == NULL)
 		resend_segs(sar);
 
+	/* The remote is responsive, retry based on the fresh round trip */
+	sar_out_ack_restart(sar);
+
 	return true;
 }
 
@@ -1655,6 +1781,11 @@ static void send_sar_ack(struct mesh_sar_msg *sar)
 
 	sar->activity_cnt = 0;
 
+	if (sar->ack_delay) {
+		g_source_remove(sar->ack_delay);
+		sar->ack_delay = 0;
+	}
+
 	memset(ack, 0, sizeof(ack));
 	SET_TRANS_OPCODE(ack, NET_OP_SEG_ACKNOWLEDGE);
 	SET_TRANS_SEQ0(ack, sar->seqAuth);
@@ -1690,6 +1821,17 @@ static gboolean sar_out_msg_timeout(void *user_data)
 	return false;
 }
 
+static gboolean sar_in_ack_delay_timeout(void *user_data)
+{
+	struct mesh_sar_msg *sar = user_data;
+
+	sar->ack_delay = 0;
+
+	send_sar_ack(sar);
+
+	return false;
+}
+
 static gboolean sar_in_ack_timeout(void *user_data)
 {
 	struct mesh_sar_msg *sar = user_data;
@@ -1834,9 +1976,19 @@ static bool seg_rxed(uint16_t net_idx, uint32_t iv_index, bool ctl,
 	if (old_ack == sar->ack)
 		/* Let the timer generate repeat ACKs as needed */
 		send_ack = false;
-	else if ((last_ack_mask & sar->ack) == (last_ack_mask & full_ack))
-		/* If this was largest segO outstanding segment, we ACK */
-		send_ack = true;
+	else if (sar->ack != full_ack &&
+		(last_ack_mask & sar->ack) == (last_ack_mask & full_ack)) {
+		/*
+		 * This was the largest segO outstanding segment. Wait a
+		 * little so the retransmissions it precedes get covered
+		 * by the same ACK.
+		 */
+		if (!sar->ack_delay)
+			sar->ack_delay = g_timeout_add(
+						SAR_IN_ACK_DELAY(sar->ttl),
+						sar_in_ack_delay_timeout, sar);
+		send_ack = false;
+	}
 
 	if (send_ack)
 		send_sar_ack(sar);
@@ -1844,6 +1996,67 @@ static bool seg_rxed(uint16_t net_idx, uint32_t iv_index, bool ctl,
 	return result;
 }
 
+static unsigned int msg_cache_hash(uint16_t src, uint32_t seq)
+{
+	return (src ^ seq ^ (seq >> 12)) % MSG_CACHE_BUCKETS;
+}
+
+static void msg_cache_reset(void)
+{
+	memset(&msg_cache, 0, sizeof(msg_cache));
+}
+
+static void msg_cache_unlink(unsigned int index)
+{
+	struct msg_cache_entry *entry = &msg_cache.entries[index];
+	uint16_t *link;
+
+	link = &msg_cache.buckets[msg_cache_hash(entry->src, entry->seq)];
+
+	while (*link) {
+		if (*link == index + 1) {
+			*link = entry->next;
+			return;
+		}
+
+		link = &msg_cache.entries[*link - 1].next;
+	}
+}
+
+/* Returns true if the PDU was seen before, otherwise remembers it */
+static bool msg_cache_check(uint16_t src, uint32_t seq, uint32_t iv_index)
+{
+	unsigned int hash = msg_cache_hash(src, seq);
+	struct msg_cache_entry *entry;
+	unsigned int index;
+	uint16_t i;
+
+	for (i = msg_cache.buckets[hash]; i; i = entry->next) {
+		entry = &msg_cache.entries[i - 1];
+
+		if (entry->src == src && entry->seq == seq &&
+					entry->iv_index == iv_index)
+			return true;
+	}
+
+	if (msg_cache.count < MSG_CACHE_SIZE) {
+		index = msg_cache.count++;
+	} else {
+		index = msg_cache.oldest;
+		msg_cache.oldest = (msg_cache.oldest + 1) % MSG_CACHE_SIZE;
+		msg_cache_unlink(index);
+	}
+
+	entry = &msg_cache.entries[index];
+	entry->src = src;
+	entry->seq = seq;
+	entry->iv_index = iv_index;
+	entry->next = msg_cache.buckets[hash];
+	msg_cache.buckets[hash] = index + 1;
+
+	return false;
+}
+
 bool net_data_ready(uint8_t *msg, uint8_t len)
 {
 	uint8_t type = *msg++;
@@ -1872,6 +2085,10 @@ bool net_data_ready(uint8_t *msg, uint8_t len)
 	if (net_key == NULL)
 		return false;
 
+	/* Already processed this one, e.g. when relayed by several nodes */
+	if (msg_cache_check(PKT_SRC(msg), PKT_SEQ(msg), iv_index))
+		return true;
+
 	/* CTL packets have 64 bit network MIC, otherwise 32 bit MIC */
 	len -= PKT_CTL(msg) ? sizeof(uint64_t) : sizeof(uint32_t);
 
@@ -1928,6 +2145,7 @@ bool net_session_open(GDBusProxy *data_in, bool provisioner,
 	net.provisioner = provisioner;
 	net.open_cb = cb;
 	flush_pkt_list(&net.pkt_out);
+	msg_cache_reset();
 	return true;
 }
 
@@ -2147,7 +2365,9 @@ bool net_access_layer_send(uint8_t ttl, uint16_t src, uint32_t dst,
 
 	if (IS_UNICAST(dst) && segN) {
 		net.msg_out = g_list_append(net.msg_out, sar);
-		sar->ack_to = g_timeout_add(2000, sar_out_ack_timeout, sar);
+		sar->sent = g_get_monotonic_time();
+		sar->ack_to = g_timeout_add(sar_out_retry_interval(sar),
+						sar_out_ack_timeout, sar);
 		sar->msg_to = g_timeout_add(60000, sar_out_msg_timeout, sar);
 	} else
 		g_free(sar);
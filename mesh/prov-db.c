@@ -53,8 +53,24 @@
 
 #define CHECK_KEY_IDX_RANGE(x) (((x) >= 0) && ((x) <= 4095))
 
-static const char *prov_filename;
-static const char *local_filename;
+/* Batch write-back of back-to-back updates, e.g. while provisioning */
+#define PROV_DB_WRITE_DELAY	500
+
+struct prov_db {
+	const char *filename;
+	json_object *jmain;
+	GHashTable *nodes;
+	unsigned int write_id;
+};
+
+/*
+ * Both databases stay parsed in memory after they are read. Updates are
+ * applied to the cached JSON tree and written back to disk from a short
+ * timeout, so provisioning many nodes does not re-read and re-write the
+ * whole file for every change.
+ */
+static struct prov_db prov_db;
+static struct prov_db local_db;
 
 static char* prov_file_read(const char *filename)
 {
@@ -91,28 +107,158 @@ static char* prov_file_read(const char *filename)
 	return str;
 }
 
-static void prov_file_write(json_object *jmain, bool local)
+static bool prov_file_write(struct prov_db *db)
 {
 	FILE *outfile;
 	const char *out_str;
-	const char *out_filename;
+	char *tmp_filename;
+	size_t len;
+	bool res = false;
 
-	if (local)
-		out_filename = local_filename;
-	else
-		out_filename = prov_filename;
+	if (!db->filename || !db->jmain)
+		return false;
+
+	/*
+	 * Write to a temporary file and rename it over the database so an
+	 * interrupted write never leaves a truncated file behind.
+	 */
+	tmp_filename = g_strconcat(db->filename, ".tmp", NULL);
 
-	outfile = fopen(out_filename, "wr");
+	outfile = fopen(tmp_filename, "w");
 	if (!outfile) {
-		rl_printf("Failed to open file %s for writing\n", out_filename);
-		return;
+		rl_printf("Failed to open file %s for writing\n", tmp_filename);
+		goto done;
 	}
 
-	out_str = json_object_to_json_string_ext(jmain,
+	out_str = json_object_to_json_string_ext(db->jmain,
 						JSON_C_TO_STRING_PRETTY);
+	len = strlen(out_str);
+
+	if (fwrite(out_str, sizeof(char), len, outfile) != len ||
+			fflush(outfile) || fsync(fileno(outfile)) < 0) {
+		rl_printf("Failed to write file %s\n", tmp_filename);
+		fclose(outfile);
+		unlink(tmp_filename);
+		goto done;
+	}
 
-	fwrite(out_str, sizeof(char), strlen(out_str), outfile);
 	fclose(outfile);
+
+	if (rename(tmp_filename, db->filename) < 0) {
+		rl_printf("Failed to update file %s\n", db->filename);
+		unlink(tmp_filename);
+		goto done;
+	}
+
+	res = true;
+done:
+	g_free(tmp_filename);
+
+	return res;
+}
+
+static gboolean prov_db_write_cb(gpointer user_data)
+{
+	struct prov_db *db = user_data;
+
+	db->write_id = 0;
+	prov_file_write(db);
+
+	return FALSE;
+}
+
+static void prov_db_changed(bool local)
+{
+	struct prov_db *db = local ? &local_db : &prov_db;
+
+	if (db->write_id)
+		return;
+
+	db->write_id = g_timeout_add(PROV_DB_WRITE_DELAY, prov_db_write_cb,
+									db);
+}
+
+static void prov_db_flush(struct prov_db *db)
+{
+	if (!db->write_id)
+		return;
+
+	g_source_remove(db->write_id);
+	db->write_id = 0;
+
+	prov_file_write(db);
+}
+
+static void prov_db_close(struct prov_db *db)
+{
+	prov_db_flush(db);
+
+	if (db->nodes) {
+		g_hash_table_destroy(db->nodes);
+		db->nodes = NULL;
+	}
+
+	if (db->jmain) {
+		json_object_put(db->jmain);
+		db->jmain = NULL;
+	}
+}
+
+static uint16_t node_primary_addr(json_object *jnode)
+{
+	json_object *jconfig;
+	json_object *jelements;
+	json_object *jelement;
+	json_object *jvalue;
+	const char *str;
+	uint16_t addr;
+
+	json_object_object_get_ex(jnode, "configuration", &jconfig);
+	if (!jconfig)
+		return UNASSIGNED_ADDRESS;
+
+	json_object_object_get_ex(jconfig, "elements", &jelements);
+	if (!jelements)
+		return UNASSIGNED_ADDRESS;
+
+	jelement = json_object_array_get_idx(jelements, 0);
+	if (!jelement)
+		return UNASSIGNED_ADDRESS;
+
+	json_object_object_get_ex(jelement, "unicastAddress", &jvalue);
+	str = json_object_get_string(jvalue);
+	if (!str || sscanf(str, "%04hx", &addr) != 1)
+		return UNASSIGNED_ADDRESS;
+
+	return addr;
+}
+
+static void index_node(struct prov_db *db, json_object *jnode)
+{
+	uint16_t primary = node_primary_addr(jnode);
+
+	if (IS_UNASSIGNED(primary))
+		return;
+
+	g_hash_table_replace(db->nodes, GUINT_TO_POINTER(primary), jnode);
+}
+
+static json_object *get_jnode(struct mesh_node *node, bool local)
+{
+	json_object *jnode = NULL;
+
+	if (local) {
+		if (local_db.jmain)
+			json_object_object_get_ex(local_db.jmain, "node",
+								&jnode);
+		return jnode;
+	}
+
+	if (!prov_db.nodes)
+		return NULL;
+
+	return g_hash_table_lookup(prov_db.nodes,
+				GUINT_TO_POINTER(node_get_primary(node)));
 }
 
 static void put_uint16(json_object *jobject, const char *desc, uint16_t value)
@@ -485,84 +631,18 @@ static void add_key(json_object *jobject, const char *desc, uint8_t* key)
 	json_object_object_add(jobject, desc, jstring);
 }
 
-static json_object *find_node_by_primary(json_object *jmain, uint16_t primary)
-{
-	json_object *jarray;
-	int i, len;
-
-	json_object_object_get_ex(jmain, "nodes", &jarray);
-
-	if (!jarray)
-		return NULL;
-	len = json_object_array_length(jarray);
-
-	for (i = 0; i < len; ++i) {
-		json_object *jnode;
-		json_object *jconfig;
-		json_object *jelements;
-		json_object *jelement;
-		json_object *jvalue;
-		char *str;
-		uint16_t addr;
-
-		jnode = json_object_array_get_idx(jarray, i);
-		if (!jnode)
-			return NULL;
-
-		json_object_object_get_ex(jnode, "configuration", &jconfig);
-		if (!jconfig)
-			return NULL;
-
-		json_object_object_get_ex(jconfig, "elements", &jelements);
-		if (!jelements)
-			return NULL;
-
-		jelement = json_object_array_get_idx(jelements, 0);
-		if (!jelement)
-			return NULL;
-
-		json_object_object_get_ex(jelement, "unicastAddress",
-								&jvalue);
-		str = (char *)json_object_get_string(jvalue);
-		if (sscanf(str, "%04hx", &addr) != 1)
-				return NULL;
-
-		if (addr == primary)
-			return jnode;
-	}
-
-	return NULL;
-
-}
-
 void prov_db_print_node_composition(struct mesh_node *node)
 {
-	char *in_str;
 	const char *comp_str;
-	json_object *jmain;
 	json_object *jnode;
 	json_object *jcomp;
 	uint16_t primary = node_get_primary(node);
-	const char *filename;
 	bool res = false;
 
 	if (!node || !node_get_composition(node))
 		return;
 
-	if (node == node_get_local_node())
-		filename = local_filename;
-	else
-		filename = prov_filename;
-
-	in_str = prov_file_read(filename);
-	if (!in_str)
-		return;
-
-	jmain = json_tokener_parse(in_str);
-	if (!jmain)
-		goto done;
-
-	jnode = find_node_by_primary(jmain, primary);
+	jnode = get_jnode(node, node == node_get_local_node());
 	if (!jnode)
 		goto done;
 
@@ -582,17 +662,11 @@ done:
 	else
 		rl_printf("\tComposition data for node %4.4x not present\n",
 								primary);
-	g_free(in_str);
-
-	if (jmain)
-		json_object_put(jmain);
 }
 
 bool prov_db_add_node_composition(struct mesh_node *node, uint8_t *data,
 								uint16_t len)
 {
-	char *in_str;
-	json_object *jmain;
 	json_object *jnode;
 	json_object *jcomp;
 	json_object *jbool;
@@ -601,24 +675,14 @@ bool prov_db_add_node_composition(struct mesh_node *node, uint8_t *data,
 	struct mesh_node_composition *comp;
 	uint8_t num_ele;
 	int i;
-	uint16_t primary = node_get_primary(node);
-	bool res = NULL;
 
 	comp = node_get_composition(node);
 	if (!comp)
 		return false;
 
-	in_str = prov_file_read(prov_filename);
-	if (!in_str)
-		return false;
-
-	jmain = json_tokener_parse(in_str);
-	if (!jmain)
-		goto done;
-
-	jnode = find_node_by_primary(jmain, primary);
+	jnode = get_jnode(node, false);
 	if (!jnode)
-		goto done;
+		return false;
 
 	jcomp = json_object_new_object();
 
@@ -692,72 +756,34 @@ bool prov_db_add_node_composition(struct mesh_node *node, uint8_t *data,
 
 	json_object_object_add(jnode, "composition", jcomp);
 
-	prov_file_write(jmain, false);
-
-	res = true;;
-done:
-
-	g_free(in_str);
-
-	if(jmain)
-		json_object_put(jmain);
+	prov_db_changed(false);
 
-	return res;
+	return true;
 }
 
 bool prov_db_node_set_ttl(struct mesh_node *node, uint8_t ttl)
 {
-	char *in_str;
-	json_object *jmain;
 	json_object *jnode;
 	json_object *jconfig;
 	json_object *jvalue;
-	uint16_t primary = node_get_primary(node);
-	const char *filename;
 	bool local = node == node_get_local_node();
-	bool res = false;
-
-	if (local)
-		filename = local_filename;
-	else
-		filename = prov_filename;
-
-	in_str = prov_file_read(filename);
-	if (!in_str)
-		return false;
-
-	jmain = json_tokener_parse(in_str);
-	if (!jmain)
-		goto done;
-
-	if (local)
-		json_object_object_get_ex(jmain, "node", &jnode);
-	else
-		jnode = find_node_by_primary(jmain, primary);
 
+	jnode = get_jnode(node, local);
 	if (!jnode)
-		goto done;
+		return false;
 
 	json_object_object_get_ex(jnode, "configuration", &jconfig);
 	if (!jconfig)
-		goto done;
+		return false;
 
 	json_object_object_del(jconfig, "defaultTTL");
 
 	jvalue = json_object_new_int(ttl);
 	json_object_object_add(jconfig, "defaultTTL", jvalue);
 
-	prov_file_write(jmain, local);
-
-	res = true;
-done:
+	prov_db_changed(local);
 
-	g_free(in_str);
-
-	if(jmain)
-		json_object_put(jmain);
-
-	return res;
+	return true;
 
 }
 
@@ -777,107 +803,53 @@ static void set_local_iv_index(json_object *jobj, uint32_t idx, bool update)
 
 bool prov_db_local_set_iv_index(uint32_t iv_index, bool update, bool prov)
 {
-	char *in_str;
-	json_object *jmain;
 	json_object *jnode;
-	bool res = false;
 
-	in_str = prov_file_read(local_filename);
-	if (!in_str)
+	jnode = get_jnode(node_get_local_node(), true);
+	if (!jnode)
 		return false;
 
-	jmain = json_tokener_parse(in_str);
-	if (!jmain)
-		goto done;
-
-	json_object_object_get_ex(jmain, "node", &jnode);
 	set_local_iv_index(jnode, iv_index, update);
-	prov_file_write(jmain, true);
-
-	g_free(in_str);
-	json_object_put(jmain);
+	prov_db_changed(true);
 
 	/* If provisioner, save to global DB as well */
 	if (prov) {
-		in_str = prov_file_read(prov_filename);
-		if (!in_str)
+		if (!prov_db.jmain)
 			return false;
 
-		jmain = json_tokener_parse(in_str);
-		if (!jmain)
-			goto done;
-
-		set_local_iv_index(jmain, iv_index, update);
-		prov_file_write(jmain, false);
+		set_local_iv_index(prov_db.jmain, iv_index, update);
+		prov_db_changed(false);
 	}
 
-	res = true;
-done:
-
-	g_free(in_str);
-
-	if(jmain)
-		json_object_put(jmain);
-
-	return res;
-
+	return true;
 }
 
 bool prov_db_local_set_seq_num(uint32_t seq_num)
 {
-	char *in_str;
-	json_object *jmain;
 	json_object *jnode;
 	json_object *jvalue;
-	bool res = false;
 
-	in_str = prov_file_read(local_filename);
-	if (!in_str)
+	jnode = get_jnode(node_get_local_node(), true);
+	if (!jnode)
 		return false;
 
-	jmain = json_tokener_parse(in_str);
-	if (!jmain)
-		goto done;
-
-	json_object_object_get_ex(jmain, "node", &jnode);
-
 	json_object_object_del(jnode, "sequenceNumber");
 	jvalue = json_object_new_int(seq_num);
 	json_object_object_add(jnode, "sequenceNumber", jvalue);
 
-	prov_file_write(jmain, true);
-
-	res = true;
-done:
-
-	g_free(in_str);
+	prov_db_changed(true);
 
-	if(jmain)
-		json_object_put(jmain);
-
-	return res;
+	return true;
 }
 
 bool prov_db_node_set_iv_seq(struct mesh_node *node, uint32_t iv, uint32_t seq)
 {
-	char *in_str;
-	json_object *jmain;
 	json_object *jnode;
 	json_object *jvalue;
-	uint16_t primary = node_get_primary(node);
-	bool res = false;
-
-	in_str = prov_file_read(prov_filename);
-	if (!in_str)
-		return false;
-
-	jmain = json_tokener_parse(in_str);
-	if (!jmain)
-		goto done;
 
-	jnode = find_node_by_primary(jmain, primary);
+	jnode = get_jnode(node, false);
 	if (!jnode)
-		goto done;
+		return false;
 
 	json_object_object_del(jnode, "IVindex");
 
@@ -889,52 +861,25 @@ bool prov_db_node_set_iv_seq(struct mesh_node *node, uint32_t iv, uint32_t seq)
 	jvalue = json_object_new_int(seq);
 	json_object_object_add(jnode, "sequenceNumber", jvalue);
 
-	prov_file_write(jmain, false);
-
-	res = true;
-done:
-
-	g_free(in_str);
-
-	if(jmain)
-		json_object_put(jmain);
-
-	return res;
+	prov_db_changed(false);
 
+	return true;
 }
 
 bool prov_db_node_keys(struct mesh_node *node, GList *idxs, const char *desc)
 {
-	char *in_str;
-	json_object *jmain;
 	json_object *jnode;
 	json_object *jconfig;
 	json_object *jidxs;
-	uint16_t primary = node_get_primary(node);
-	const char *filename;
 	bool local = (node == node_get_local_node());
-	bool res = false;
-
-	if (local)
-		filename = local_filename;
-	else
-		filename = prov_filename;
-
-	in_str = prov_file_read(filename);
-	if (!in_str)
-		return false;
 
-	jmain = json_tokener_parse(in_str);
-	if (!jmain)
-		goto done;
-
-	jnode = find_node_by_primary(jmain, primary);
+	jnode = get_jnode(node, local);
 	if (!jnode)
-		goto done;
+		return false;
 
 	json_object_object_get_ex(jnode, "configuration", &jconfig);
 	if (!jconfig)
-		goto done;
+		return false;
 
 	json_object_object_del(jconfig, desc);
 
@@ -944,67 +889,35 @@ bool prov_db_node_keys(struct mesh_node *node, GList *idxs, const char *desc)
 		json_object_object_add(jconfig, desc, jidxs);
 	}
 
-	prov_file_write(jmain, local);
-
-	res = true;
-done:
-
-	g_free(in_str);
-
-	if(jmain)
-		json_object_put(jmain);
-
-	return res;
+	prov_db_changed(local);
 
+	return true;
 }
 
 static json_object *get_jmodel_obj(struct mesh_node *node, uint8_t ele_idx,
-					uint32_t model_id, json_object **jmain)
+					uint32_t model_id, bool local)
 {
-	char *in_str;
 	json_object *jnode;
 	json_object *jconfig;
 	json_object *jelements, *jelement;
 	json_object *jmodels, *jmodel = NULL;
-	uint16_t primary = node_get_primary(node);
-	const char *filename;
-	bool local = (node == node_get_local_node());
-
-	if (local)
-		filename = local_filename;
-	else
-		filename = prov_filename;
-
-	in_str = prov_file_read(filename);
-	if (!in_str)
-		return NULL;
-
-	*jmain = json_tokener_parse(in_str);
-	if (!(*jmain))
-		goto done;
-
-	if (local)
-		json_object_object_get_ex(*jmain, "node", &jnode);
-	else
-		jnode = find_node_by_primary(*jmain, primary);
 
+	jnode = get_jnode(node, local);
 	if (!jnode)
-		goto done;
+		return NULL;
 
 	/* Configuration is mandatory for nodes in provisioning database */
 	json_object_object_get_ex(jnode, "configuration", &jconfig);
 	if (!jconfig)
-		goto done;
+		return NULL;
 
 	json_object_object_get_ex(jconfig, "elements", &jelements);
-	if (!jelements) {
-		goto done;
-	}
+	if (!jelements)
+		return NULL;
 
 	jelement = json_object_array_get_idx(jelements, ele_idx);
-	if (!jelement) {
-		goto done;
-	}
+	if (!jelement)
+		return NULL;
 
 	json_object_object_get_ex(jelement, "models", &jmodels);
 
@@ -1027,27 +940,18 @@ static json_object *get_jmodel_obj(struct mesh_node *node, uint8_t ele_idx,
 		json_object_array_add(jmodels, jmodel);
 	}
 
-done:
-
-	g_free(in_str);
-
-	if(!jmodel && *jmain)
-		json_object_put(*jmain);
-
 	return jmodel;
-
 }
 
 bool prov_db_add_binding(struct mesh_node *node, uint8_t ele_idx,
 			uint32_t model_id, uint16_t app_idx)
 {
-	json_object *jmain;
 	json_object *jmodel;
 	json_object *jvalue;
 	json_object *jbindings = NULL;
 	bool local = (node == node_get_local_node());
 
-	jmodel = get_jmodel_obj(node, ele_idx, model_id, &jmain);
+	jmodel = get_jmodel_obj(node, ele_idx, model_id, local);
 
 	if (!jmodel)
 		return false;
@@ -1062,9 +966,7 @@ bool prov_db_add_binding(struct mesh_node *node, uint8_t ele_idx,
 	jvalue = json_object_new_int(app_idx);
 	json_object_array_add(jbindings, jvalue);
 
-	prov_file_write(jmain, local);
-
-	json_object_put(jmain);
+	prov_db_changed(local);
 
 	return true;
 }
@@ -1073,13 +975,12 @@ bool prov_db_node_set_model_pub(struct mesh_node *node, uint8_t ele_idx,
 							uint32_t model_id,
 						struct mesh_publication *pub)
 {
-	json_object *jmain;
 	json_object *jmodel;
 	json_object *jpub;
 	json_object *jvalue;
 	bool local = (node == node_get_local_node());
 
-	jmodel = get_jmodel_obj(node, ele_idx, model_id, &jmain);
+	jmodel = get_jmodel_obj(node, ele_idx, model_id, local);
 
 	if (!jmodel)
 		return false;
@@ -1099,17 +1000,13 @@ bool prov_db_node_set_model_pub(struct mesh_node *node, uint8_t ele_idx,
 	json_object_object_add(jmodel, "publish", jpub);
 
 done:
-	prov_file_write(jmain, local);
-
-	json_object_put(jmain);
+	prov_db_changed(local);
 
 	return true;
 }
 
 bool prov_db_add_new_node(struct mesh_node *node)
 {
-	char *in_str;
-	json_object *jmain;
 	json_object *jarray;
 	json_object *jnode;
 	json_object *jconfig;
@@ -1117,23 +1014,17 @@ bool prov_db_add_new_node(struct mesh_node *node)
 	uint8_t num_ele;
 	uint16_t primary;
 	int i;
-	bool first_node;
-	bool res = false;
 
-	in_str = prov_file_read(prov_filename);
-	if (!in_str)
+	if (!prov_db.jmain)
 		return false;
 
-	jmain = json_tokener_parse(in_str);
-	if (!jmain)
-		goto done;
-	json_object_object_get_ex(jmain, "nodes", &jarray);
+	num_ele = node_get_num_elements(node);
+	if (num_ele == 0)
+		return false;
 
-	if (!jarray) {
-		jarray = json_object_new_array();
-		first_node = true;
-	} else
-		first_node = false;
+	primary = node_get_primary(node);
+	if (IS_UNASSIGNED(primary))
+		return false;
 
 	jnode = json_object_new_object();
 
@@ -1144,16 +1035,8 @@ bool prov_db_add_new_node(struct mesh_node *node)
 	jconfig = json_object_new_object();
 	add_node_idxs(jconfig, "netKeys", node_get_net_keys(node));
 
-	num_ele = node_get_num_elements(node);
-	if (num_ele == 0)
-		goto done;
-
 	jelements = json_object_new_array();
 
-	primary = node_get_primary(node);
-	if (IS_UNASSIGNED(primary))
-		goto done;
-
 	for (i = 0; i < num_ele; ++i) {
 		json_object *jelement;
 		json_object *jint;
@@ -1174,22 +1057,18 @@ bool prov_db_add_new_node(struct mesh_node *node)
 
 	json_object_object_add(jnode, "configuration", jconfig);
 
-	json_object_array_add(jarray, jnode);
-
-	if (first_node)
-		json_object_object_add(jmain, "nodes", jarray);
-
-	prov_file_write(jmain, false);
-
-	res = true;
-done:
+	json_object_object_get_ex(prov_db.jmain, "nodes", &jarray);
+	if (!jarray) {
+		jarray = json_object_new_array();
+		json_object_object_add(prov_db.jmain, "nodes", jarray);
+	}
 
-	g_free(in_str);
+	json_object_array_add(jarray, jnode);
+	index_node(&prov_db, jnode);
 
-	if (jmain)
-		json_object_put(jmain);
+	prov_db_changed(false);
 
-	return res;
+	return true;
 }
 
 static bool parse_node_composition(struct mesh_node *node, json_object *jcomp)
@@ -1376,6 +1255,12 @@ bool prov_db_show(const char *filename)
 {
 	char *str;
 
+	/* Make sure pending updates are included */
+	if (prov_db.filename && !strcmp(filename, prov_db.filename))
+		prov_db_flush(&prov_db);
+	else if (local_db.filename && !strcmp(filename, local_db.filename))
+		prov_db_flush(&local_db);
+
 	str = prov_file_read(filename);
 	if (!str)
 		return false;
@@ -1385,7 +1270,7 @@ bool prov_db_show(const char *filename)
 	return true;
 }
 
-static bool read_json_db(const char *filename, bool provisioner, bool local)
+static bool read_json_db(struct prov_db *db, bool provisioner, bool local)
 {
 	char *str;
 	json_object *jmain;
@@ -1402,13 +1287,16 @@ static bool read_json_db(const char *filename, bool provisioner, bool local)
 	bool refresh = false;
 	bool res = false;
 
-	str = prov_file_read(filename);
+	str = prov_file_read(db->filename);
 	if (!str) return false;
 
 	jmain = json_tokener_parse(str);
 	if (!jmain)
 		goto done;
 
+	/* Updates triggered while parsing go to the tree being loaded */
+	db->jmain = jmain;
+
 	if (local) {
 		json_object *jnode;
 		bool result;
@@ -1570,6 +1458,8 @@ static bool read_json_db(const char *filename, bool provisioner, bool local)
 
 		if (!jnode || !parse_node(jnode, false))
 			goto done;
+
+		index_node(db, jnode);
 	}
 
 	res = true;
@@ -1577,23 +1467,49 @@ done:
 
 	g_free(str);
 
-	if (res && refresh)
-		prov_file_write(jmain, false);
+	if (!res) {
+		if (db->write_id) {
+			g_source_remove(db->write_id);
+			db->write_id = 0;
+		}
+
+		if (jmain)
+			json_object_put(jmain);
 
-	if (jmain)
-		json_object_put(jmain);
+		db->jmain = NULL;
+		g_hash_table_remove_all(db->nodes);
+		return false;
+	}
 
-	return res;
+	if (refresh)
+		prov_file_write(db);
+
+	return true;
+}
+
+static bool prov_db_open(struct prov_db *db, const char *filename,
+						bool provisioner, bool local)
+{
+	prov_db_close(db);
+
+	db->filename = filename;
+	db->nodes = g_hash_table_new(NULL, NULL);
+
+	return read_json_db(db, provisioner, local);
 }
 
 bool prov_db_read(const char *filename)
 {
-	prov_filename = filename;
-	return read_json_db(filename, true, false);
+	return prov_db_open(&prov_db, filename, true, false);
 }
 
 bool prov_db_read_local_node(const char *filename, bool provisioner)
 {
-	local_filename = filename;
-	return read_json_db(filename, provisioner, true);
+	return prov_db_open(&local_db, filename, provisioner, true);
+}
+
+void prov_db_cleanup(void)
+{
+	prov_db_close(&prov_db);
+	prov_db_close(&local_db);
 }
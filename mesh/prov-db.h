@@ -38,3 +38,4 @@ bool prov_db_node_set_model_pub(struct mesh_node *node, uint8_t ele_idx,
 							uint32_t model_id,
 						struct mesh_publication *pub);
 void prov_db_print_node_composition(struct mesh_node *node);
+void prov_db_cleanup(void);
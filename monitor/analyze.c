@@ -27,7 +27,10 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/time.h>
 
 #include "lib/bluetooth.h"
 
@@ -37,6 +40,99 @@
 #include "monitor/bt.h"
 #include "analyze.h"
 
+#define CONN_TYPE_ACL		0x00
+#define CONN_TYPE_SCO		0x01
+#define CONN_TYPE_LE		0x02
+#define CONN_TYPE_UNKNOWN	0xff
+
+#define NELEM(x) (sizeof(x) / sizeof((x)[0]))
+
+/* Upper bounds in milliseconds of the ATT latency histogram buckets */
+static const unsigned int att_buckets[] = {
+	1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000,
+};
+
+#define ATT_NUM_BUCKETS	(NELEM(att_buckets) + 1)
+
+enum analyze_format {
+	ANALYZE_FORMAT_TEXT,
+	ANALYZE_FORMAT_JSON,
+};
+
+struct samples {
+	uint32_t *values;
+	size_t num;
+	size_t alloc;
+};
+
+struct hci_cmd {
+	uint16_t opcode;
+	struct samples latency;
+};
+
+struct pending_cmd {
+	uint16_t opcode;
+	struct timeval tv;
+};
+
+struct l2cap_chan {
+	uint16_t psm;
+	uint16_t tx_cid;
+	uint16_t rx_cid;
+	uint8_t ident;
+	bool out;
+	bool pending;
+	unsigned long tx_num;
+	unsigned long rx_num;
+	unsigned long tx_bytes;
+	unsigned long rx_bytes;
+};
+
+struct interval_change {
+	struct timeval tv;
+	uint16_t interval;
+	uint16_t latency;
+	uint16_t timeout;
+};
+
+struct throughput {
+	unsigned long tx_bytes;
+	unsigned long rx_bytes;
+};
+
+struct att_request {
+	bool pending;
+	uint8_t opcode;
+	struct timeval tv;
+};
+
+struct hci_conn {
+	uint16_t handle;
+	uint8_t type;
+	uint8_t bdaddr[6];
+	bool terminated;
+	struct timeval time_connected;
+	struct timeval time_disconnected;
+	struct timeval time_first;
+	struct timeval time_last;
+	unsigned long tx_num;
+	unsigned long rx_num;
+	unsigned long tx_bytes;
+	unsigned long rx_bytes;
+	unsigned long tx_completed;
+	unsigned int in_flight;
+	unsigned int max_in_flight;
+	struct queue *interval_list;
+	struct throughput *tput;
+	size_t tput_len;
+	struct queue *chan_list;
+	struct l2cap_chan *tx_frag;
+	struct l2cap_chan *rx_frag;
+	struct att_request att_req[2];
+	unsigned long att_hist[ATT_NUM_BUCKETS];
+	struct samples att_latency;
+};
+
 struct hci_dev {
 	uint16_t index;
 	uint8_t type;
@@ -52,31 +148,226 @@ struct hci_dev {
 	unsigned long user_log;
 	unsigned long unknown;
 	uint16_t manufacturer;
+	uint16_t acl_max_pkt;
+	uint16_t le_max_pkt;
+	unsigned int in_flight;
+	unsigned int max_in_flight;
+	struct queue *conn_list;
+	struct queue *cmd_list;
+	struct queue *pending_cmds;
 };
 
 static struct queue *dev_list;
+static enum analyze_format output_format = ANALYZE_FORMAT_TEXT;
+static unsigned int num_devs_printed;
 
-static void dev_destroy(void *data)
+static uint32_t tv_diff_us(const struct timeval *start,
+						const struct timeval *end)
 {
-	struct hci_dev *dev = data;
-	const char *str;
+	struct timeval res;
+
+	if (timercmp(end, start, <))
+		return 0;
+
+	timersub(end, start, &res);
+
+	if (res.tv_sec > 3600)
+		return UINT32_MAX;
+
+	return res.tv_sec * 1000000 + res.tv_usec;
+}
+
+static void samples_add(struct samples *samples, uint32_t value)
+{
+	if (samples->num == samples->alloc) {
+		samples->alloc = samples->alloc ? samples->alloc * 2 : 64;
+		samples->values = realloc(samples->values,
+				samples->alloc * sizeof(*samples->values));
+	}
+
+	samples->values[samples->num++] = value;
+}
+
+static int samples_cmp(const void *a, const void *b)
+{
+	uint32_t va = *(const uint32_t *) a, vb = *(const uint32_t *) b;
+
+	return va < vb ? -1 : va > vb;
+}
+
+static void samples_sort(struct samples *samples)
+{
+	if (samples->num)
+		qsort(samples->values, samples->num, sizeof(*samples->values),
+								samples_cmp);
+}
+
+/* Samples have to be sorted */
+static uint32_t samples_percentile(const struct samples *samples,
+							unsigned int pct)
+{
+	if (!samples->num)
+		return 0;
+
+	return samples->values[(samples->num - 1) * pct / 100];
+}
+
+static uint32_t samples_avg(const struct samples *samples)
+{
+	uint64_t sum = 0;
+	size_t i;
+
+	if (!samples->num)
+		return 0;
+
+	for (i = 0; i < samples->num; i++)
+		sum += samples->values[i];
+
+	return sum / samples->num;
+}
 
-	switch (dev->type) {
+static const char *conn_type_str(uint8_t type)
+{
+	switch (type) {
+	case CONN_TYPE_ACL:
+		return "BR/EDR";
+	case CONN_TYPE_SCO:
+		return "SCO";
+	case CONN_TYPE_LE:
+		return "LE";
+	default:
+		return "unknown";
+	}
+}
+
+static void print_bdaddr(const uint8_t *bdaddr)
+{
+	printf("%2.2X:%2.2X:%2.2X:%2.2X:%2.2X:%2.2X",
+			bdaddr[5], bdaddr[4], bdaddr[3],
+			bdaddr[2], bdaddr[1], bdaddr[0]);
+}
+
+static void print_tput_text(const struct hci_conn *conn)
+{
+	unsigned long tx_peak = 0, rx_peak = 0;
+	uint32_t duration;
+	size_t i;
+
+	for (i = 0; i < conn->tput_len; i++) {
+		if (conn->tput[i].tx_bytes > tx_peak)
+			tx_peak = conn->tput[i].tx_bytes;
+		if (conn->tput[i].rx_bytes > rx_peak)
+			rx_peak = conn->tput[i].rx_bytes;
+	}
+
+	duration = tv_diff_us(&conn->time_first, &conn->time_last) / 1000;
+	if (!duration)
+		return;
+
+	printf("    Throughput TX %lu B/s (peak %lu B/s)\n",
+				conn->tx_bytes * 1000 / duration, tx_peak);
+	printf("    Throughput RX %lu B/s (peak %lu B/s)\n",
+				conn->rx_bytes * 1000 / duration, rx_peak);
+}
+
+static void print_chan_text(void *data, void *user_data)
+{
+	const struct l2cap_chan *chan = data;
+
+	printf("    Channel TX CID 0x%4.4x RX CID 0x%4.4x PSM 0x%4.4x:"
+			" TX %lu (%lu bytes) RX %lu (%lu bytes)\n",
+			chan->tx_cid, chan->rx_cid, chan->psm,
+			chan->tx_num, chan->tx_bytes,
+			chan->rx_num, chan->rx_bytes);
+}
+
+static void print_interval_text(void *data, void *user_data)
+{
+	const struct interval_change *change = data;
+
+	printf("    Interval %u.%2.2u msec latency %u timeout %u msec"
+			" at %lu.%6.6lu\n", change->interval * 5 / 4,
+			change->interval * 125 % 100, change->latency,
+			change->timeout * 10, change->tv.tv_sec,
+			change->tv.tv_usec);
+}
+
+static void print_conn_text(void *data, void *user_data)
+{
+	struct hci_conn *conn = data;
+	unsigned int i;
+
+	printf("  %s connection with handle %u ", conn_type_str(conn->type),
+								conn->handle);
+	print_bdaddr(conn->bdaddr);
+	printf("\n");
+
+	printf("    %lu TX packets (%lu bytes, %lu completed)\n",
+			conn->tx_num, conn->tx_bytes, conn->tx_completed);
+	printf("    %lu RX packets (%lu bytes)\n",
+					conn->rx_num, conn->rx_bytes);
+	printf("    %u max packets in flight\n", conn->max_in_flight);
+
+	print_tput_text(conn);
+
+	queue_foreach(conn->interval_list, print_interval_text, NULL);
+
+	if (conn->att_latency.num) {
+		printf("    %zu ATT transactions, latency min %u avg %u "
+			"p90 %u max %u usec\n", conn->att_latency.num,
+			samples_percentile(&conn->att_latency, 0),
+			samples_avg(&conn->att_latency),
+			samples_percentile(&conn->att_latency, 90),
+			samples_percentile(&conn->att_latency, 100));
+
+		for (i = 0; i < ATT_NUM_BUCKETS; i++) {
+			if (!conn->att_hist[i])
+				continue;
+
+			if (i < NELEM(att_buckets))
+				printf("      < %4u msec: %lu\n",
+					att_buckets[i], conn->att_hist[i]);
+			else
+				printf("      >=%4u msec: %lu\n",
+					att_buckets[i - 1], conn->att_hist[i]);
+		}
+	}
+
+	queue_foreach(conn->chan_list, print_chan_text, NULL);
+}
+
+static void print_cmd_text(void *data, void *user_data)
+{
+	const struct hci_cmd *cmd = data;
+
+	printf("  Command 0x%2.2x|0x%4.4x: %zu, latency min %u p50 %u p90 %u "
+			"p99 %u max %u usec\n", cmd->opcode >> 10,
+			cmd->opcode & 0x03ff, cmd->latency.num,
+			samples_percentile(&cmd->latency, 0),
+			samples_percentile(&cmd->latency, 50),
+			samples_percentile(&cmd->latency, 90),
+			samples_percentile(&cmd->latency, 99),
+			samples_percentile(&cmd->latency, 100));
+}
+
+static const char *dev_type_str(uint8_t type)
+{
+	switch (type) {
 	case 0x00:
-		str = "BR/EDR";
-		break;
+		return "BR/EDR";
 	case 0x01:
-		str = "AMP";
-		break;
+		return "AMP";
 	default:
-		str = "unknown";
-		break;
+		return "unknown";
 	}
+}
 
-	printf("Found %s controller with index %u\n", str, dev->index);
-	printf("  BD_ADDR %2.2X:%2.2X:%2.2X:%2.2X:%2.2X:%2.2X",
-			dev->bdaddr[5], dev->bdaddr[4], dev->bdaddr[3],
-			dev->bdaddr[2], dev->bdaddr[1], dev->bdaddr[0]);
+static void print_dev_text(struct hci_dev *dev)
+{
+	printf("Found %s controller with index %u\n", dev_type_str(dev->type),
+								dev->index);
+	printf("  BD_ADDR ");
+	print_bdaddr(dev->bdaddr);
 	if (dev->manufacturer != 0xffff)
 		printf(" (%s)", bt_compidtostr(dev->manufacturer));
 	printf("\n");
@@ -90,8 +381,227 @@ static void dev_destroy(void *data)
 	printf("  %lu system notes\n", dev->system_note);
 	printf("  %lu user logs\n", dev->user_log);
 	printf("  %lu unknown opcodes\n", dev->unknown);
+
+	if (dev->acl_max_pkt || dev->le_max_pkt)
+		printf("  %u ACL and %u LE controller buffers\n",
+					dev->acl_max_pkt, dev->le_max_pkt);
+
+	printf("  %u max packets in flight\n", dev->max_in_flight);
+
+	queue_foreach(dev->cmd_list, print_cmd_text, NULL);
+	queue_foreach(dev->conn_list, print_conn_text, NULL);
+
 	printf("\n");
+}
+
+static void print_json_sep(bool *first)
+{
+	if (!*first)
+		printf(",");
+
+	*first = false;
+}
+
+static void print_json_tv(const char *name, const struct timeval *tv)
+{
+	if (timerisset(tv))
+		printf("\"%s\":%lu.%6.6lu,", name, tv->tv_sec, tv->tv_usec);
+	else
+		printf("\"%s\":null,", name);
+}
+
+static void print_chan_json(void *data, void *user_data)
+{
+	const struct l2cap_chan *chan = data;
 
+	print_json_sep(user_data);
+
+	printf("{\"psm\":%u,\"tx_cid\":%u,\"rx_cid\":%u,"
+		"\"tx_packets\":%lu,\"tx_bytes\":%lu,"
+		"\"rx_packets\":%lu,\"rx_bytes\":%lu}",
+		chan->psm, chan->tx_cid, chan->rx_cid,
+		chan->tx_num, chan->tx_bytes, chan->rx_num, chan->rx_bytes);
+}
+
+static void print_interval_json(void *data, void *user_data)
+{
+	const struct interval_change *change = data;
+
+	print_json_sep(user_data);
+
+	printf("{\"time\":%lu.%6.6lu,\"interval\":%u,\"latency\":%u,"
+			"\"timeout\":%u}", change->tv.tv_sec,
+			change->tv.tv_usec, change->interval,
+			change->latency, change->timeout);
+}
+
+static void print_conn_json(void *data, void *user_data)
+{
+	struct hci_conn *conn = data;
+	bool first = true;
+	unsigned int i;
+	size_t n;
+
+	print_json_sep(user_data);
+
+	printf("{\"handle\":%u,\"type\":\"%s\",\"bdaddr\":\"", conn->handle,
+						conn_type_str(conn->type));
+	print_bdaddr(conn->bdaddr);
+	printf("\",");
+
+	print_json_tv("connected", &conn->time_connected);
+	print_json_tv("disconnected", &conn->time_disconnected);
+	print_json_tv("first_packet", &conn->time_first);
+	print_json_tv("last_packet", &conn->time_last);
+
+	printf("\"tx_packets\":%lu,\"tx_bytes\":%lu,\"tx_completed\":%lu,"
+		"\"rx_packets\":%lu,\"rx_bytes\":%lu,\"max_in_flight\":%u,",
+		conn->tx_num, conn->tx_bytes, conn->tx_completed,
+		conn->rx_num, conn->rx_bytes, conn->max_in_flight);
+
+	printf("\"throughput\":[");
+	for (n = 0; n < conn->tput_len; n++)
+		printf("%s[%zu,%lu,%lu]", n ? "," : "", n,
+					conn->tput[n].tx_bytes,
+					conn->tput[n].rx_bytes);
+	printf("],");
+
+	printf("\"interval_changes\":[");
+	queue_foreach(conn->interval_list, print_interval_json, &first);
+	printf("],");
+
+	printf("\"att_latency\":{\"count\":%zu,\"min\":%u,\"avg\":%u,"
+			"\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u,"
+			"\"histogram\":[", conn->att_latency.num,
+			samples_percentile(&conn->att_latency, 0),
+			samples_avg(&conn->att_latency),
+			samples_percentile(&conn->att_latency, 50),
+			samples_percentile(&conn->att_latency, 90),
+			samples_percentile(&conn->att_latency, 99),
+			samples_percentile(&conn->att_latency, 100));
+	for (i = 0; i < ATT_NUM_BUCKETS; i++) {
+		if (i < NELEM(att_buckets))
+			printf("%s{\"lt_ms\":%u,\"count\":%lu}", i ? "," : "",
+					att_buckets[i], conn->att_hist[i]);
+		else
+			printf(",{\"lt_ms\":null,\"count\":%lu}",
+							conn->att_hist[i]);
+	}
+	printf("]},");
+
+	first = true;
+	printf("\"channels\":[");
+	queue_foreach(conn->chan_list, print_chan_json, &first);
+	printf("]}");
+}
+
+static void print_cmd_json(void *data, void *user_data)
+{
+	const struct hci_cmd *cmd = data;
+
+	print_json_sep(user_data);
+
+	printf("{\"opcode\":%u,\"count\":%zu,\"min\":%u,\"p50\":%u,"
+			"\"p90\":%u,\"p99\":%u,\"max\":%u}", cmd->opcode,
+			cmd->latency.num,
+			samples_percentile(&cmd->latency, 0),
+			samples_percentile(&cmd->latency, 50),
+			samples_percentile(&cmd->latency, 90),
+			samples_percentile(&cmd->latency, 99),
+			samples_percentile(&cmd->latency, 100));
+}
+
+static void print_dev_json(struct hci_dev *dev)
+{
+	bool first = true;
+
+	if (num_devs_printed)
+		printf(",");
+
+	printf("\n{\"index\":%u,\"type\":\"%s\",\"bdaddr\":\"", dev->index,
+						dev_type_str(dev->type));
+	print_bdaddr(dev->bdaddr);
+	printf("\",");
+
+	if (dev->manufacturer != 0xffff)
+		printf("\"manufacturer\":%u,", dev->manufacturer);
+	else
+		printf("\"manufacturer\":null,");
+
+	printf("\"commands\":%lu,\"events\":%lu,\"acl_packets\":%lu,"
+		"\"sco_packets\":%lu,\"vendor_diagnostics\":%lu,"
+		"\"system_notes\":%lu,\"user_logs\":%lu,"
+		"\"unknown_opcodes\":%lu,\"acl_max_pkt\":%u,"
+		"\"le_max_pkt\":%u,\"max_in_flight\":%u,",
+		dev->num_cmd, dev->num_evt, dev->num_acl, dev->num_sco,
+		dev->vendor_diag, dev->system_note, dev->user_log,
+		dev->unknown, dev->acl_max_pkt, dev->le_max_pkt,
+		dev->max_in_flight);
+
+	printf("\"command_latency\":[");
+	queue_foreach(dev->cmd_list, print_cmd_json, &first);
+	printf("],");
+
+	first = true;
+	printf("\"connections\":[");
+	queue_foreach(dev->conn_list, print_conn_json, &first);
+	printf("]}");
+}
+
+static void sort_cmd(void *data, void *user_data)
+{
+	struct hci_cmd *cmd = data;
+
+	samples_sort(&cmd->latency);
+}
+
+static void sort_conn(void *data, void *user_data)
+{
+	struct hci_conn *conn = data;
+
+	samples_sort(&conn->att_latency);
+}
+
+static void cmd_destroy(void *data)
+{
+	struct hci_cmd *cmd = data;
+
+	free(cmd->latency.values);
+	free(cmd);
+}
+
+static void conn_destroy(void *data)
+{
+	struct hci_conn *conn = data;
+
+	queue_destroy(conn->interval_list, free);
+	queue_destroy(conn->chan_list, free);
+	free(conn->att_latency.values);
+	free(conn->tput);
+	free(conn);
+}
+
+static void dev_destroy(void *data)
+{
+	struct hci_dev *dev = data;
+
+	queue_foreach(dev->cmd_list, sort_cmd, NULL);
+	queue_foreach(dev->conn_list, sort_conn, NULL);
+
+	switch (output_format) {
+	case ANALYZE_FORMAT_TEXT:
+		print_dev_text(dev);
+		break;
+	case ANALYZE_FORMAT_JSON:
+		print_dev_json(dev);
+		break;
+	}
+
+	num_devs_printed++;
+
+	queue_destroy(dev->conn_list, conn_destroy);
+	queue_destroy(dev->cmd_list, cmd_destroy);
+	queue_destroy(dev->pending_cmds, free);
 	free(dev);
 }
 
@@ -103,6 +613,9 @@ static struct hci_dev *dev_alloc(uint16_t index)
 
 	dev->index = index;
 	dev->manufacturer = 0xffff;
+	dev->conn_list = queue_new();
+	dev->cmd_list = queue_new();
+	dev->pending_cmds = queue_new();
 
 	return dev;
 }
@@ -131,6 +644,35 @@ static struct hci_dev *dev_lookup(uint16_t index)
 	return dev;
 }
 
+static bool conn_match_handle(const void *a, const void *b)
+{
+	const struct hci_conn *conn = a;
+	uint16_t handle = PTR_TO_UINT(b);
+
+	return !conn->terminated && conn->handle == handle;
+}
+
+static struct hci_conn *conn_lookup(struct hci_dev *dev, uint16_t handle,
+								bool create)
+{
+	struct hci_conn *conn;
+
+	conn = queue_find(dev->conn_list, conn_match_handle,
+						UINT_TO_PTR(handle));
+	if (conn || !create)
+		return conn;
+
+	conn = new0(struct hci_conn, 1);
+	conn->handle = handle;
+	conn->type = CONN_TYPE_UNKNOWN;
+	conn->interval_list = queue_new();
+	conn->chan_list = queue_new();
+
+	queue_push_tail(dev->conn_list, conn);
+
+	return conn;
+}
+
 static void new_index(struct timeval *tv, uint16_t index,
 					const void *data, uint16_t size)
 {
@@ -163,8 +705,12 @@ static void command_pkt(struct timeval *tv, uint16_t index,
 					const void *data, uint16_t size)
 {
 	const struct bt_hci_cmd_hdr *hdr = data;
+	struct pending_cmd *pending;
 	struct hci_dev *dev;
 
+	if (size < sizeof(*hdr))
+		return;
+
 	data += sizeof(*hdr);
 	size -= sizeof(*hdr);
 
@@ -173,6 +719,53 @@ static void command_pkt(struct timeval *tv, uint16_t index,
 		return;
 
 	dev->num_cmd++;
+
+	pending = new0(struct pending_cmd, 1);
+	pending->opcode = le16_to_cpu(hdr->opcode);
+	pending->tv = *tv;
+
+	queue_push_tail(dev->pending_cmds, pending);
+}
+
+static bool match_pending_opcode(const void *a, const void *b)
+{
+	const struct pending_cmd *pending = a;
+
+	return pending->opcode == PTR_TO_UINT(b);
+}
+
+static bool match_cmd_opcode(const void *a, const void *b)
+{
+	const struct hci_cmd *cmd = a;
+
+	return cmd->opcode == PTR_TO_UINT(b);
+}
+
+static void cmd_done(struct hci_dev *dev, struct timeval *tv,
+							uint16_t opcode)
+{
+	struct pending_cmd *pending;
+	struct hci_cmd *cmd;
+
+	if (!opcode)
+		return;
+
+	pending = queue_remove_if(dev->pending_cmds, match_pending_opcode,
+							UINT_TO_PTR(opcode));
+	if (!pending)
+		return;
+
+	cmd = queue_find(dev->cmd_list, match_cmd_opcode,
+							UINT_TO_PTR(opcode));
+	if (!cmd) {
+		cmd = new0(struct hci_cmd, 1);
+		cmd->opcode = opcode;
+		queue_push_tail(dev->cmd_list, cmd);
+	}
+
+	samples_add(&cmd->latency, tv_diff_us(&pending->tv, tv));
+
+	free(pending);
 }
 
 static void rsp_read_bd_addr(struct hci_dev *dev, struct timeval *tv,
@@ -180,7 +773,12 @@ static void rsp_read_bd_addr(struct hci_dev *dev, struct timeval *tv,
 {
 	const struct bt_hci_rsp_read_bd_addr *rsp = data;
 
-	printf("Read BD Addr event with status 0x%2.2x\n", rsp->status);
+	if (size < sizeof(*rsp))
+		return;
+
+	if (output_format == ANALYZE_FORMAT_TEXT)
+		printf("Read BD Addr event with status 0x%2.2x\n",
+								rsp->status);
 
 	if (rsp->status)
 		return;
@@ -188,21 +786,243 @@ static void rsp_read_bd_addr(struct hci_dev *dev, struct timeval *tv,
 	memcpy(dev->bdaddr, rsp->bdaddr, 6);
 }
 
+static void rsp_read_buffer_size(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_rsp_read_buffer_size *rsp = data;
+
+	if (size < sizeof(*rsp) || rsp->status)
+		return;
+
+	dev->acl_max_pkt = le16_to_cpu(rsp->acl_max_pkt);
+}
+
+static void rsp_le_read_buffer_size(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_rsp_le_read_buffer_size *rsp = data;
+
+	if (size < sizeof(*rsp) || rsp->status)
+		return;
+
+	dev->le_max_pkt = rsp->le_max_pkt;
+}
+
 static void evt_cmd_complete(struct hci_dev *dev, struct timeval *tv,
 					const void *data, uint16_t size)
 {
 	const struct bt_hci_evt_cmd_complete *evt = data;
 	uint16_t opcode;
 
+	if (size < sizeof(*evt))
+		return;
+
 	data += sizeof(*evt);
 	size -= sizeof(*evt);
 
 	opcode = le16_to_cpu(evt->opcode);
 
+	cmd_done(dev, tv, opcode);
+
 	switch (opcode) {
 	case BT_HCI_CMD_READ_BD_ADDR:
 		rsp_read_bd_addr(dev, tv, data, size);
 		break;
+	case BT_HCI_CMD_READ_BUFFER_SIZE:
+		rsp_read_buffer_size(dev, tv, data, size);
+		break;
+	case BT_HCI_CMD_LE_READ_BUFFER_SIZE:
+		rsp_le_read_buffer_size(dev, tv, data, size);
+		break;
+	}
+}
+
+static void evt_cmd_status(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_cmd_status *evt = data;
+
+	if (size < sizeof(*evt))
+		return;
+
+	cmd_done(dev, tv, le16_to_cpu(evt->opcode));
+}
+
+static void conn_complete(struct hci_dev *dev, struct timeval *tv,
+				uint16_t handle, uint8_t type,
+				const uint8_t *bdaddr)
+{
+	struct hci_conn *conn;
+
+	conn = conn_lookup(dev, handle, true);
+
+	conn->type = type;
+	conn->time_connected = *tv;
+	memcpy(conn->bdaddr, bdaddr, 6);
+}
+
+static void evt_conn_complete(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_conn_complete *evt = data;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	conn_complete(dev, tv, le16_to_cpu(evt->handle) & 0x0fff,
+			evt->link_type == 0x01 ? CONN_TYPE_ACL : CONN_TYPE_SCO,
+			evt->bdaddr);
+}
+
+static void evt_sync_conn_complete(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_sync_conn_complete *evt = data;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	conn_complete(dev, tv, le16_to_cpu(evt->handle), CONN_TYPE_SCO,
+								evt->bdaddr);
+}
+
+static void evt_disconnect_complete(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_disconnect_complete *evt = data;
+	struct hci_conn *conn;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	conn = conn_lookup(dev, le16_to_cpu(evt->handle), false);
+	if (!conn)
+		return;
+
+	/* Outstanding packets are flushed by the controller */
+	dev->in_flight -= conn->in_flight < dev->in_flight ?
+					conn->in_flight : dev->in_flight;
+
+	conn->terminated = true;
+	conn->time_disconnected = *tv;
+}
+
+static void evt_num_completed_packets(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const uint8_t *num_handles = data;
+	const uint8_t *ptr = data + 1;
+	uint8_t i;
+
+	if (size < 1 || size - 1 < *num_handles * 4)
+		return;
+
+	for (i = 0; i < *num_handles; i++, ptr += 4) {
+		uint16_t count = get_le16(ptr + 2);
+		struct hci_conn *conn;
+
+		conn = conn_lookup(dev, get_le16(ptr) & 0x0fff, false);
+		if (!conn)
+			continue;
+
+		conn->tx_completed += count;
+
+		if (count > conn->in_flight)
+			count = conn->in_flight;
+
+		conn->in_flight -= count;
+		dev->in_flight -= count < dev->in_flight ?
+						count : dev->in_flight;
+	}
+}
+
+static void evt_le_conn_complete(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_le_conn_complete *evt = data;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	conn_complete(dev, tv, le16_to_cpu(evt->handle), CONN_TYPE_LE,
+							evt->peer_addr);
+}
+
+static void evt_le_enhanced_conn_complete(struct hci_dev *dev,
+					struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_le_enhanced_conn_complete *evt = data;
+
+	if (size < sizeof(*evt) || evt->status)
+		return;
+
+	conn_complete(dev, tv, le16_to_cpu(evt->handle), CONN_TYPE_LE,
+							evt->peer_addr);
+}
+
+static void conn_interval(struct hci_dev *dev, struct timeval *tv,
+				uint16_t handle, uint16_t interval,
+				uint16_t latency, uint16_t timeout)
+{
+	struct interval_change *change;
+	struct hci_conn *conn;
+
+	conn = conn_lookup(dev, handle, false);
+	if (!conn)
+		return;
+
+	change = new0(struct interval_change, 1);
+	change->tv = *tv;
+	change->interval = interval;
+	change->latency = latency;
+	change->timeout = timeout;
+
+	queue_push_tail(conn->interval_list, change);
+}
+
+static void evt_le_meta_event(struct hci_dev *dev, struct timeval *tv,
+					const void *data, uint16_t size)
+{
+	const struct bt_hci_evt_le_conn_complete *cc = data + 1;
+	const struct bt_hci_evt_le_enhanced_conn_complete *ecc = data + 1;
+	const struct bt_hci_evt_le_conn_update_complete *cu = data + 1;
+	uint8_t subevent;
+
+	if (size < 1)
+		return;
+
+	subevent = *((const uint8_t *) data);
+
+	data++;
+	size--;
+
+	switch (subevent) {
+	case BT_HCI_EVT_LE_CONN_COMPLETE:
+		evt_le_conn_complete(dev, tv, data, size);
+
+		if (size >= sizeof(*cc) && !cc->status)
+			conn_interval(dev, tv, le16_to_cpu(cc->handle),
+					le16_to_cpu(cc->interval),
+					le16_to_cpu(cc->latency),
+					le16_to_cpu(cc->supv_timeout));
+		break;
+	case BT_HCI_EVT_LE_ENHANCED_CONN_COMPLETE:
+		evt_le_enhanced_conn_complete(dev, tv, data, size);
+
+		if (size >= sizeof(*ecc) && !ecc->status)
+			conn_interval(dev, tv, le16_to_cpu(ecc->handle),
+					le16_to_cpu(ecc->interval),
+					le16_to_cpu(ecc->latency),
+					le16_to_cpu(ecc->supv_timeout));
+		break;
+	case BT_HCI_EVT_LE_CONN_UPDATE_COMPLETE:
+		if (size >= sizeof(*cu) && !cu->status)
+			conn_interval(dev, tv, le16_to_cpu(cu->handle),
+					le16_to_cpu(cu->interval),
+					le16_to_cpu(cu->latency),
+					le16_to_cpu(cu->supv_timeout));
+		break;
 	}
 }
 
@@ -212,6 +1032,9 @@ static void event_pkt(struct timeval *tv, uint16_t index,
 	const struct bt_hci_evt_hdr *hdr = data;
 	struct hci_dev *dev;
 
+	if (size < sizeof(*hdr))
+		return;
+
 	data += sizeof(*hdr);
 	size -= sizeof(*hdr);
 
@@ -222,17 +1045,283 @@ static void event_pkt(struct timeval *tv, uint16_t index,
 	dev->num_evt++;
 
 	switch (hdr->evt) {
+	case BT_HCI_EVT_CONN_COMPLETE:
+		evt_conn_complete(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_DISCONNECT_COMPLETE:
+		evt_disconnect_complete(dev, tv, data, size);
+		break;
 	case BT_HCI_EVT_CMD_COMPLETE:
 		evt_cmd_complete(dev, tv, data, size);
 		break;
+	case BT_HCI_EVT_CMD_STATUS:
+		evt_cmd_status(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_NUM_COMPLETED_PACKETS:
+		evt_num_completed_packets(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_SYNC_CONN_COMPLETE:
+		evt_sync_conn_complete(dev, tv, data, size);
+		break;
+	case BT_HCI_EVT_LE_META_EVENT:
+		evt_le_meta_event(dev, tv, data, size);
+		break;
+	}
+}
+
+static void conn_account(struct hci_conn *conn, struct timeval *tv, bool out,
+								uint16_t size)
+{
+	size_t sec;
+
+	if (!timerisset(&conn->time_first))
+		conn->time_first = *tv;
+
+	conn->time_last = *tv;
+
+	if (out) {
+		conn->tx_num++;
+		conn->tx_bytes += size;
+	} else {
+		conn->rx_num++;
+		conn->rx_bytes += size;
+	}
+
+	if (tv->tv_sec < conn->time_first.tv_sec)
+		return;
+
+	sec = tv->tv_sec - conn->time_first.tv_sec;
+	if (sec >= conn->tput_len) {
+		conn->tput = realloc(conn->tput, (sec + 1) *
+							sizeof(*conn->tput));
+		memset(conn->tput + conn->tput_len, 0,
+			(sec + 1 - conn->tput_len) * sizeof(*conn->tput));
+		conn->tput_len = sec + 1;
+	}
+
+	if (out)
+		conn->tput[sec].tx_bytes += size;
+	else
+		conn->tput[sec].rx_bytes += size;
+}
+
+static bool chan_match_tx_cid(const void *a, const void *b)
+{
+	const struct l2cap_chan *chan = a;
+
+	return !chan->pending && chan->tx_cid == PTR_TO_UINT(b);
+}
+
+static bool chan_match_rx_cid(const void *a, const void *b)
+{
+	const struct l2cap_chan *chan = a;
+
+	return !chan->pending && chan->rx_cid == PTR_TO_UINT(b);
+}
+
+static struct l2cap_chan *chan_lookup(struct hci_conn *conn, uint16_t cid,
+								bool out)
+{
+	struct l2cap_chan *chan;
+
+	chan = queue_find(conn->chan_list, out ? chan_match_tx_cid :
+					chan_match_rx_cid, UINT_TO_PTR(cid));
+	if (chan)
+		return chan;
+
+	/* Fixed channels use the same CID in both directions */
+	chan = new0(struct l2cap_chan, 1);
+	if (cid < 0x0040 || out)
+		chan->tx_cid = cid;
+	if (cid < 0x0040 || !out)
+		chan->rx_cid = cid;
+
+	queue_push_tail(conn->chan_list, chan);
+
+	return chan;
+}
+
+struct sig_match {
+	uint8_t ident;
+	bool out;
+};
+
+static bool chan_match_ident(const void *a, const void *b)
+{
+	const struct l2cap_chan *chan = a;
+	const struct sig_match *match = b;
+
+	return chan->pending && chan->ident == match->ident &&
+						chan->out == match->out;
+}
+
+static void sig_conn_req(struct hci_conn *conn, bool out, uint8_t ident,
+						uint16_t psm, uint16_t scid)
+{
+	struct l2cap_chan *chan;
+
+	chan = new0(struct l2cap_chan, 1);
+	chan->psm = psm;
+	chan->ident = ident;
+	chan->out = out;
+	chan->pending = true;
+
+	if (out)
+		chan->rx_cid = scid;
+	else
+		chan->tx_cid = scid;
+
+	queue_push_tail(conn->chan_list, chan);
+}
+
+static void sig_conn_rsp(struct hci_conn *conn, bool out, uint8_t ident,
+					uint16_t dcid, uint16_t result)
+{
+	struct sig_match match = { .ident = ident, .out = !out };
+	struct l2cap_chan *chan;
+
+	chan = queue_find(conn->chan_list, chan_match_ident, &match);
+	if (!chan)
+		return;
+
+	/* Pending results are followed by a final response */
+	if (result == 0x0001)
+		return;
+
+	if (result) {
+		queue_remove(conn->chan_list, chan);
+		free(chan);
+		return;
+	}
+
+	if (out)
+		chan->rx_cid = dcid;
+	else
+		chan->tx_cid = dcid;
+
+	chan->pending = false;
+}
+
+static void sig_pkt(struct hci_conn *conn, bool out, uint16_t cid,
+					const uint8_t *data, uint16_t size)
+{
+	while (size >= sizeof(struct bt_l2cap_hdr_sig)) {
+		const struct bt_l2cap_hdr_sig *hdr = (const void *) data;
+		uint16_t len = le16_to_cpu(hdr->len);
+
+		data += sizeof(*hdr);
+		size -= sizeof(*hdr);
+
+		if (len > size)
+			return;
+
+		switch (hdr->code) {
+		case BT_L2CAP_PDU_CONN_REQ:
+		case BT_L2CAP_PDU_LE_CONN_REQ:
+			if (len < 4)
+				break;
+
+			sig_conn_req(conn, out, hdr->ident, get_le16(data),
+							get_le16(data + 2));
+			break;
+		case BT_L2CAP_PDU_CONN_RSP:
+			if (len < 6)
+				break;
+
+			sig_conn_rsp(conn, out, hdr->ident, get_le16(data),
+							get_le16(data + 4));
+			break;
+		case BT_L2CAP_PDU_LE_CONN_RSP:
+			if (len < 10)
+				break;
+
+			sig_conn_rsp(conn, out, hdr->ident, get_le16(data),
+							get_le16(data + 8));
+			break;
+		}
+
+		/* LE signalling carries a single command per frame */
+		if (cid == 0x0005)
+			return;
+
+		data += len;
+		size -= len;
+	}
+}
+
+static bool att_is_request(uint8_t opcode)
+{
+	switch (opcode) {
+	case 0x02:	/* Exchange MTU Request */
+	case 0x04:	/* Find Information Request */
+	case 0x06:	/* Find By Type Value Request */
+	case 0x08:	/* Read By Type Request */
+	case 0x0a:	/* Read Request */
+	case 0x0c:	/* Read Blob Request */
+	case 0x0e:	/* Read Multiple Request */
+	case 0x10:	/* Read By Group Type Request */
+	case 0x12:	/* Write Request */
+	case 0x16:	/* Prepare Write Request */
+	case 0x18:	/* Execute Write Request */
+	case 0x1d:	/* Handle Value Indication */
+	case 0x20:	/* Read Multiple Variable Request */
+		return true;
+	}
+
+	return false;
+}
+
+static void att_pkt(struct hci_conn *conn, struct timeval *tv, bool out,
+					const uint8_t *data, uint16_t size)
+{
+	struct att_request *req;
+	uint32_t latency;
+	unsigned int i;
+
+	if (!size)
+		return;
+
+	if (att_is_request(data[0])) {
+		req = &conn->att_req[out];
+		req->pending = true;
+		req->opcode = data[0];
+		req->tv = *tv;
+		return;
+	}
+
+	/* Responses complete the request sent in the other direction */
+	req = &conn->att_req[!out];
+	if (!req->pending)
+		return;
+
+	if (data[0] != 0x01 && data[0] != req->opcode + 1)
+		return;
+
+	req->pending = false;
+
+	latency = tv_diff_us(&req->tv, tv);
+	samples_add(&conn->att_latency, latency);
+
+	for (i = 0; i < NELEM(att_buckets); i++) {
+		if (latency < att_buckets[i] * 1000)
+			break;
 	}
+
+	conn->att_hist[i]++;
 }
 
-static void acl_pkt(struct timeval *tv, uint16_t index,
+static void acl_pkt(struct timeval *tv, uint16_t index, bool out,
 					const void *data, uint16_t size)
 {
 	const struct bt_hci_acl_hdr *hdr = data;
+	const struct bt_l2cap_hdr *l2cap;
+	struct l2cap_chan **frag, *chan;
+	struct hci_conn *conn;
 	struct hci_dev *dev;
+	uint16_t handle, cid, len;
+
+	if (size < sizeof(*hdr))
+		return;
 
 	data += sizeof(*hdr);
 	size -= sizeof(*hdr);
@@ -242,14 +1331,83 @@ static void acl_pkt(struct timeval *tv, uint16_t index,
 		return;
 
 	dev->num_acl++;
+
+	handle = le16_to_cpu(hdr->handle);
+
+	conn = conn_lookup(dev, handle & 0x0fff, true);
+
+	conn_account(conn, tv, out, size);
+
+	if (out) {
+		if (++conn->in_flight > conn->max_in_flight)
+			conn->max_in_flight = conn->in_flight;
+
+		if (++dev->in_flight > dev->max_in_flight)
+			dev->max_in_flight = dev->in_flight;
+	}
+
+	frag = out ? &conn->tx_frag : &conn->rx_frag;
+
+	/* Continuation fragments belong to the channel of the start one */
+	if (((handle >> 12) & 0x03) == 0x01) {
+		chan = *frag;
+		if (!chan)
+			return;
+
+		goto done;
+	}
+
+	*frag = NULL;
+
+	if (size < sizeof(*l2cap))
+		return;
+
+	l2cap = data;
+	len = le16_to_cpu(l2cap->len);
+	cid = le16_to_cpu(l2cap->cid);
+
+	data += sizeof(*l2cap);
+	size -= sizeof(*l2cap);
+
+	if (len < size)
+		size = len;
+
+	switch (cid) {
+	case 0x0001:
+	case 0x0005:
+		sig_pkt(conn, out, cid, data, size);
+		break;
+	case 0x0004:
+		att_pkt(conn, tv, out, data, size);
+		break;
+	}
+
+	chan = chan_lookup(conn, cid, out);
+
+	*frag = chan;
+
+	size += sizeof(*l2cap);
+
+done:
+	if (out) {
+		chan->tx_num++;
+		chan->tx_bytes += size;
+	} else {
+		chan->rx_num++;
+		chan->rx_bytes += size;
+	}
 }
 
-static void sco_pkt(struct timeval *tv, uint16_t index,
+static void sco_pkt(struct timeval *tv, uint16_t index, bool out,
 					const void *data, uint16_t size)
 {
 	const struct bt_hci_sco_hdr *hdr = data;
+	struct hci_conn *conn;
 	struct hci_dev *dev;
 
+	if (size < sizeof(*hdr))
+		return;
+
 	data += sizeof(*hdr);
 	size -= sizeof(*hdr);
 
@@ -258,6 +1416,10 @@ static void sco_pkt(struct timeval *tv, uint16_t index,
 		return;
 
 	dev->num_sco++;
+
+	conn = conn_lookup(dev, le16_to_cpu(hdr->handle) & 0x0fff, true);
+
+	conn_account(conn, tv, out, size);
 }
 
 static void info_index(struct timeval *tv, uint16_t index,
@@ -324,6 +1486,23 @@ static void unknown_opcode(struct timeval *tv, uint16_t index,
 	dev->unknown++;
 }
 
+bool analyze_set_format(const char *format)
+{
+	if (!strcasecmp(format, "text"))
+		output_format = ANALYZE_FORMAT_TEXT;
+	else if (!strcasecmp(format, "json"))
+		output_format = ANALYZE_FORMAT_JSON;
+	else
+		return false;
+
+	return true;
+}
+
+bool analyze_is_text(void)
+{
+	return output_format == ANALYZE_FORMAT_TEXT;
+}
+
 void analyze_trace(const char *path)
 {
 	struct btsnoop *btsnoop_file;
@@ -348,6 +1527,9 @@ void analyze_trace(const char *path)
 
 	dev_list = queue_new();
 
+	if (output_format == ANALYZE_FORMAT_JSON)
+		printf("{\"controllers\":[");
+
 	while (1) {
 		unsigned char buf[BTSNOOP_MAX_PACKET_SIZE];
 		struct timeval tv;
@@ -372,11 +1554,13 @@ void analyze_trace(const char *path)
 			break;
 		case BTSNOOP_OPCODE_ACL_TX_PKT:
 		case BTSNOOP_OPCODE_ACL_RX_PKT:
-			acl_pkt(&tv, index, buf, pktlen);
+			acl_pkt(&tv, index, opcode == BTSNOOP_OPCODE_ACL_TX_PKT,
+							buf, pktlen);
 			break;
 		case BTSNOOP_OPCODE_SCO_TX_PKT:
 		case BTSNOOP_OPCODE_SCO_RX_PKT:
-			sco_pkt(&tv, index, buf, pktlen);
+			sco_pkt(&tv, index, opcode == BTSNOOP_OPCODE_SCO_TX_PKT,
+							buf, pktlen);
 			break;
 		case BTSNOOP_OPCODE_OPEN_INDEX:
 		case BTSNOOP_OPCODE_CLOSE_INDEX:
@@ -402,9 +1586,16 @@ void analyze_trace(const char *path)
 		num_packets++;
 	}
 
-	printf("Trace contains %lu packets\n\n", num_packets);
-
-	queue_destroy(dev_list, dev_destroy);
+	switch (output_format) {
+	case ANALYZE_FORMAT_TEXT:
+		printf("Trace contains %lu packets\n\n", num_packets);
+		queue_destroy(dev_list, dev_destroy);
+		break;
+	case ANALYZE_FORMAT_JSON:
+		queue_destroy(dev_list, dev_destroy);
+		printf("\n],\"packets\":%lu}\n", num_packets);
+		break;
+	}
 
 done:
 	btsnoop_unref(btsnoop_file);
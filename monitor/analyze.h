@@ -22,4 +22,8 @@
  *
  */
 
+#include <stdbool.h>
+
+bool analyze_set_format(const char *format);
+bool analyze_is_text(void);
 void analyze_trace(const char *path);
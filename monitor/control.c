@@ -53,11 +53,29 @@
 #include "hcidump.h"
 #include "ellisys.h"
 #include "tty.h"
+#include "filter.h"
+#include "publish.h"
 #include "control.h"
 
+#define WRITER_BUFFER_SIZE	(64 * 1024)
+#define WRITER_FLUSH_INTERVAL	1000
+#define WRITER_MAX_FILES	10
+
+#define CAPTURE_BUFFER_SIZE	(4 * 1024 * 1024)
+#define CAPTURE_RCVBUF_SIZE	(4 * 1024 * 1024)
+#define CAPTURE_BATCH		32
+
 static struct btsnoop *btsnoop_file = NULL;
 static bool hcidump_fallback = false;
 static bool decode_control = true;
+static bool capture_only = false;
+static size_t writer_max_size = 0;
+static unsigned int writer_max_age = 0;
+static bool reader_seek = false;
+static uint64_t reader_record = 0;
+static struct timeval reader_tv;
+static bool reader_seek_time = false;
+static bool writer_index = false;
 
 struct control_data {
 	uint16_t channel;
@@ -976,12 +994,15 @@ static void data_callback(int fd, uint32_t events, void *user_data)
 		case HCI_CHANNEL_MONITOR:
 			btsnoop_write_hci(btsnoop_file, tv, index, opcode, 0,
 							data->buf, pktlen);
+			publish_hci(tv, index, opcode, 0, data->buf, pktlen);
 			ellisys_inject_hci(tv, index, opcode,
 							data->buf, pktlen);
 			packet_monitor(tv, cred, index, opcode,
 							data->buf, pktlen);
 			break;
 		}
+
+		display_flush_packet();
 	}
 }
 
@@ -1050,6 +1071,140 @@ static int open_channel(uint16_t channel)
 	return 0;
 }
 
+/*
+ * In capture only mode the packets are not decoded, but read in batches
+ * and handed straight to the buffered writer, which drops records rather
+ * than stall the socket when the disk can't keep up.
+ */
+struct capture_data {
+	int fd;
+	uint32_t kernel_drops;
+	struct mmsghdr msgs[CAPTURE_BATCH];
+	struct iovec iov[CAPTURE_BATCH][2];
+	struct mgmt_hdr hdr[CAPTURE_BATCH];
+	unsigned char control[CAPTURE_BATCH][64];
+	unsigned char buf[CAPTURE_BATCH][BTSNOOP_MAX_PACKET_SIZE];
+};
+
+static void free_capture(void *user_data)
+{
+	struct capture_data *data = user_data;
+
+	close(data->fd);
+
+	free(data);
+}
+
+static void capture_packet(struct capture_data *data, unsigned int i)
+{
+	struct msghdr *msg = &data->msgs[i].msg_hdr;
+	struct timeval *tv = NULL;
+	struct timeval ctv;
+	struct cmsghdr *cmsg;
+	uint16_t opcode, index, pktlen;
+
+	if (data->msgs[i].msg_len < MGMT_HDR_SIZE)
+		return;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+					cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET)
+			continue;
+
+		if (cmsg->cmsg_type == SCM_TIMESTAMP) {
+			memcpy(&ctv, CMSG_DATA(cmsg), sizeof(ctv));
+			tv = &ctv;
+		}
+
+		if (cmsg->cmsg_type == SO_RXQ_OVFL)
+			memcpy(&data->kernel_drops, CMSG_DATA(cmsg),
+						sizeof(data->kernel_drops));
+	}
+
+	opcode = le16_to_cpu(data->hdr[i].opcode);
+	index  = le16_to_cpu(data->hdr[i].index);
+	pktlen = le16_to_cpu(data->hdr[i].len);
+
+	if (pktlen > data->msgs[i].msg_len - MGMT_HDR_SIZE)
+		pktlen = data->msgs[i].msg_len - MGMT_HDR_SIZE;
+
+	btsnoop_write_hci(btsnoop_file, tv, index, opcode,
+				data->kernel_drops, data->buf[i], pktlen);
+	publish_hci(tv, index, opcode, data->kernel_drops,
+						data->buf[i], pktlen);
+}
+
+static void capture_callback(int fd, uint32_t events, void *user_data)
+{
+	struct capture_data *data = user_data;
+	unsigned int i;
+	int count;
+
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		mainloop_remove_fd(data->fd);
+		return;
+	}
+
+	do {
+		for (i = 0; i < CAPTURE_BATCH; i++)
+			data->msgs[i].msg_hdr.msg_controllen =
+						sizeof(data->control[i]);
+
+		count = recvmmsg(data->fd, data->msgs, CAPTURE_BATCH,
+							MSG_DONTWAIT, NULL);
+		if (count < 0)
+			break;
+
+		for (i = 0; i < (unsigned int) count; i++)
+			capture_packet(data, i);
+	} while (count == CAPTURE_BATCH);
+}
+
+static int open_capture(void)
+{
+	struct capture_data *data;
+	int opt = 1, size = CAPTURE_RCVBUF_SIZE;
+	unsigned int i;
+
+	data = malloc(sizeof(*data));
+	if (!data)
+		return -1;
+
+	memset(data, 0, sizeof(*data));
+
+	data->fd = open_socket(HCI_CHANNEL_MONITOR);
+	if (data->fd < 0) {
+		free(data);
+		return -1;
+	}
+
+	/* Give bursts some room and report what the kernel dropped */
+	if (setsockopt(data->fd, SOL_SOCKET, SO_RCVBUFFORCE, &size,
+							sizeof(size)) < 0)
+		setsockopt(data->fd, SOL_SOCKET, SO_RCVBUF, &size,
+							sizeof(size));
+
+	setsockopt(data->fd, SOL_SOCKET, SO_RXQ_OVFL, &opt, sizeof(opt));
+
+	for (i = 0; i < CAPTURE_BATCH; i++) {
+		struct msghdr *msg = &data->msgs[i].msg_hdr;
+
+		data->iov[i][0].iov_base = &data->hdr[i];
+		data->iov[i][0].iov_len = MGMT_HDR_SIZE;
+		data->iov[i][1].iov_base = data->buf[i];
+		data->iov[i][1].iov_len = sizeof(data->buf[i]);
+
+		msg->msg_iov = data->iov[i];
+		msg->msg_iovlen = 2;
+		msg->msg_control = data->control[i];
+	}
+
+	mainloop_add_fd(data->fd, EPOLLIN, capture_callback, data,
+								free_capture);
+
+	return 0;
+}
+
 static void client_callback(int fd, uint32_t events, void *user_data)
 {
 	struct control_data *data = user_data;
@@ -1080,6 +1235,7 @@ static void client_callback(int fd, uint32_t events, void *user_data)
 
 		packet_monitor(NULL, NULL, index, opcode,
 					data->buf + MGMT_HDR_SIZE, pktlen);
+		display_flush_packet();
 
 		data->offset -= pktlen + MGMT_HDR_SIZE;
 
@@ -1307,8 +1463,11 @@ static void tty_callback(int fd, uint32_t events, void *user_data)
 
 		btsnoop_write_hci(btsnoop_file, tv, 0, opcode, drops,
 					hdr->ext_hdr + hdr->hdr_len, pktlen);
+		publish_hci(tv, 0, opcode, drops,
+					hdr->ext_hdr + hdr->hdr_len, pktlen);
 		packet_monitor(tv, NULL, 0, opcode,
 					hdr->ext_hdr + hdr->hdr_len, pktlen);
+		display_flush_packet();
 
 		data->offset -= 2 + data_len;
 
@@ -1371,11 +1530,109 @@ int control_tty(const char *path, unsigned int speed)
 	return 0;
 }
 
+void control_writer_index(void)
+{
+	writer_index = true;
+}
+
+void control_writer_rotate(size_t max_size, unsigned int max_age)
+{
+	writer_max_size = max_size;
+	writer_max_age = max_age;
+}
+
 bool control_writer(const char *path)
 {
 	btsnoop_file = btsnoop_create(path, BTSNOOP_FORMAT_MONITOR);
+	if (!btsnoop_file)
+		return false;
 
-	return !!btsnoop_file;
+	if (writer_max_size || writer_max_age)
+		btsnoop_set_rotate(btsnoop_file, writer_max_size,
+					writer_max_age, WRITER_MAX_FILES);
+
+	if (writer_index)
+		btsnoop_set_write_index(btsnoop_file, true);
+
+	/* Keep the file writes off the thread decoding the packets */
+	if (!btsnoop_set_buffer(btsnoop_file, capture_only ?
+				CAPTURE_BUFFER_SIZE : WRITER_BUFFER_SIZE,
+				WRITER_FLUSH_INTERVAL) ||
+				!btsnoop_start_writer(btsnoop_file))
+		fprintf(stderr, "Failed to start buffered writing\n");
+	else if (capture_only)
+		btsnoop_set_drop(btsnoop_file, true);
+
+	return true;
+}
+
+void control_cleanup(void)
+{
+	if (capture_only && btsnoop_get_drops(btsnoop_file))
+		fprintf(stderr, "Dropped %u packets while capturing\n",
+					btsnoop_get_drops(btsnoop_file));
+
+	btsnoop_unref(btsnoop_file);
+	btsnoop_file = NULL;
+}
+
+void control_reader_seek(uint64_t record)
+{
+	reader_record = record;
+	reader_seek = true;
+}
+
+void control_reader_seek_time(const struct timeval *tv)
+{
+	reader_tv = *tv;
+	reader_seek_time = true;
+}
+
+static bool reader_start(const char *path)
+{
+	uint16_t chunk_index, chunk_handle;
+	char *index_path;
+	bool result, skip;
+
+	/* Chunks without the filtered controller or handle are skipped */
+	filter_get_chunk(&chunk_index, &chunk_handle);
+	skip = chunk_index != 0xffff || chunk_handle != 0xffff;
+
+	if (!reader_seek && !reader_seek_time && !skip)
+		return true;
+
+	/* The index is kept next to the trace so it can be reused */
+	if (asprintf(&index_path, "%s.idx", path) < 0)
+		return false;
+
+	result = btsnoop_index(btsnoop_file, index_path);
+
+	free(index_path);
+
+	if (!result) {
+		fprintf(stderr, "Failed to index '%s'\n", path);
+		return false;
+	}
+
+	if (skip)
+		btsnoop_set_chunk_filter(btsnoop_file, chunk_index,
+							chunk_handle);
+
+	if (reader_seek && !btsnoop_seek(btsnoop_file, reader_record)) {
+		fprintf(stderr, "Record %llu not found in %llu records\n",
+				(unsigned long long) reader_record,
+				(unsigned long long)
+					btsnoop_get_count(btsnoop_file));
+		return false;
+	}
+
+	if (reader_seek_time && !btsnoop_seek_time(btsnoop_file,
+								&reader_tv)) {
+		fprintf(stderr, "No records after the given time\n");
+		return false;
+	}
+
+	return true;
 }
 
 void control_reader(const char *path)
@@ -1389,6 +1646,12 @@ void control_reader(const char *path)
 	if (!btsnoop_file)
 		return;
 
+	if (!reader_start(path)) {
+		btsnoop_unref(btsnoop_file);
+		btsnoop_file = NULL;
+		return;
+	}
+
 	format = btsnoop_get_format(btsnoop_file);
 
 	switch (format) {
@@ -1437,6 +1700,8 @@ void control_reader(const char *path)
 		break;
 	}
 
+	ellisys_flush();
+
 	close_pager();
 
 	btsnoop_unref(btsnoop_file);
@@ -1444,6 +1709,9 @@ void control_reader(const char *path)
 
 int control_tracing(void)
 {
+	if (capture_only)
+		return open_capture();
+
 	packet_add_filter(PACKET_FILTER_SHOW_INDEX);
 
 	if (server_fd >= 0)
@@ -1462,6 +1730,11 @@ int control_tracing(void)
 	return 0;
 }
 
+void control_capture(void)
+{
+	capture_only = true;
+}
+
 void control_disable_decoding(void)
 {
 	decode_control = false;
@@ -23,12 +23,20 @@
  */
 
 #include <stdint.h>
+#include <stddef.h>
+#include <sys/time.h>
 
 bool control_writer(const char *path);
+void control_writer_rotate(size_t max_size, unsigned int max_age);
+void control_writer_index(void);
+void control_cleanup(void);
 void control_reader(const char *path);
+void control_reader_seek(uint64_t record);
+void control_reader_seek_time(const struct timeval *tv);
 void control_server(const char *path);
 int control_tty(const char *path, unsigned int speed);
 int control_tracing(void);
+void control_capture(void);
 void control_disable_decoding(void);
 
 void control_message(uint16_t opcode, const void *data, uint16_t size);
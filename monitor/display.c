@@ -40,6 +40,7 @@
 #include "display.h"
 
 static pid_t pager_pid = 0;
+static bool buffer_packets = false;
 
 bool use_color(void)
 {
@@ -68,6 +69,28 @@ int num_columns(void)
 	return cached_num_columns;
 }
 
+/*
+ * A terminal makes stdout line buffered, costing a write for every line
+ * of a decoded packet. While tracing live the whole packet is buffered
+ * instead and written once it has been decoded.
+ */
+void display_buffer_packets(void)
+{
+	static char buf[65536];
+
+	if (!(isatty(STDOUT_FILENO) > 0))
+		return;
+
+	if (setvbuf(stdout, buf, _IOFBF, sizeof(buf)) == 0)
+		buffer_packets = true;
+}
+
+void display_flush_packet(void)
+{
+	if (buffer_packets)
+		fflush(stdout);
+}
+
 static void close_pipe(int p[])
 {
 	if (p[0] >= 0)
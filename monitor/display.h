@@ -52,10 +52,13 @@ bool use_color(void);
 
 #define print_indent(indent, color1, prefix, title, color2, fmt, args...) \
 do { \
-	printf("%*c%s%s%s%s" fmt "%s\n", (indent), ' ', \
-		use_color() ? (color1) : "", prefix, title, \
-		use_color() ? (color2) : "", ## args, \
-		use_color() ? COLOR_OFF : ""); \
+	if (use_color()) \
+		printf("%*c%s%s%s%s" fmt "%s\n", (indent), ' ', \
+			(color1), prefix, title, (color2), ## args, \
+			COLOR_OFF); \
+	else \
+		printf("%*c%s%s" fmt "\n", (indent), ' ', \
+			prefix, title, ## args); \
 } while (0)
 
 #define print_text(color, fmt, args...) \
@@ -66,5 +69,8 @@ do { \
 
 int num_columns(void);
 
+void display_buffer_packets(void);
+void display_flush_packet(void);
+
 void open_pager(void);
 void close_pager(void);
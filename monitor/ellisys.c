@@ -27,6 +27,7 @@
 #endif
 
 #include <stdio.h>
+#include <errno.h>
 #include <unistd.h>
 #include <string.h>
 #include <time.h>
@@ -38,10 +39,78 @@
 #include <arpa/inet.h>
 
 #include "src/shared/btsnoop.h"
+#include "src/shared/mainloop.h"
 #include "ellisys.h"
 
+/*
+ * Injection packets are queued and sent in batches, either when the
+ * batch is full or when the flush timer expires. The socket is never
+ * waited on, so when the analyzer can't keep up packets are dropped
+ * instead of delaying the capture.
+ */
+#define ELLISYS_BATCH		32
+#define ELLISYS_FLUSH_INTERVAL	10
+#define ELLISYS_HDR_SIZE	22
+
 static int ellisys_fd = -1;
 static uint16_t ellisys_index = 0xffff;
+static int flush_id = -1;
+static unsigned int msg_count;
+static unsigned long msg_drops;
+static struct mmsghdr msgs[ELLISYS_BATCH];
+static struct iovec msg_iov[ELLISYS_BATCH];
+static uint8_t msg_buf[ELLISYS_BATCH][ELLISYS_HDR_SIZE +
+						BTSNOOP_MAX_PACKET_SIZE];
+
+void ellisys_flush(void)
+{
+	unsigned int sent = 0;
+	int err;
+
+	if (flush_id >= 0) {
+		mainloop_remove_timeout(flush_id);
+		flush_id = -1;
+	}
+
+	while (sent < msg_count) {
+		err = sendmmsg(ellisys_fd, msgs + sent, msg_count - sent,
+								MSG_DONTWAIT);
+		if (err < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK &&
+					errno != ECONNREFUSED)
+				perror("Failed to send Ellisys injection packet");
+			/* Drop what didn't fit rather than block */
+			msg_drops += msg_count - sent;
+			break;
+		}
+
+		sent += err;
+	}
+
+	msg_count = 0;
+}
+
+static void flush_timeout(int id, void *user_data)
+{
+	ellisys_flush();
+}
+
+void ellisys_cleanup(void)
+{
+	if (ellisys_fd < 0)
+		return;
+
+	ellisys_flush();
+
+	if (msg_drops)
+		fprintf(stderr, "Dropped %lu Ellisys injection packets\n",
+								msg_drops);
+
+	close(ellisys_fd);
+	ellisys_fd = -1;
+}
 
 void ellisys_enable(const char *server, uint16_t port)
 {
@@ -73,6 +142,31 @@ void ellisys_enable(const char *server, uint16_t port)
 	ellisys_fd = fd;
 }
 
+static void queue_msg(const uint8_t *msg, const void *data, uint16_t size)
+{
+	uint8_t *buf = msg_buf[msg_count];
+
+	memcpy(buf, msg, ELLISYS_HDR_SIZE);
+	if (size > 0)
+		memcpy(buf + ELLISYS_HDR_SIZE, data, size);
+
+	msg_iov[msg_count].iov_base = buf;
+	msg_iov[msg_count].iov_len = ELLISYS_HDR_SIZE + size;
+
+	memset(&msgs[msg_count], 0, sizeof(msgs[msg_count]));
+	msgs[msg_count].msg_hdr.msg_iov = &msg_iov[msg_count];
+	msgs[msg_count].msg_hdr.msg_iovlen = 1;
+
+	if (++msg_count == ELLISYS_BATCH) {
+		ellisys_flush();
+		return;
+	}
+
+	if (flush_id < 0)
+		flush_id = mainloop_add_timeout(ELLISYS_FLUSH_INTERVAL,
+						flush_timeout, NULL, NULL);
+}
+
 void ellisys_inject_hci(struct timeval *tv, uint16_t index, uint16_t opcode,
 					const void *data, uint16_t size)
 {
@@ -92,8 +186,6 @@ void ellisys_inject_hci(struct timeval *tv, uint16_t index, uint16_t opcode,
 	long nsec;
 	time_t t;
 	struct tm tm;
-	struct iovec iov[2];
-	int iovcnt;
 
 	if (!tv)
 		return;
@@ -147,16 +239,8 @@ void ellisys_inject_hci(struct timeval *tv, uint16_t index, uint16_t opcode,
 		return;
 	}
 
-	iov[0].iov_base = msg;
-	iov[0].iov_len  = sizeof(msg);
-
-	if (size > 0) {
-		iov[1].iov_base = (void *) data;
-		iov[1].iov_len  = size;
-		iovcnt = 2;
-	} else
-		iovcnt = 1;
+	if (size > BTSNOOP_MAX_PACKET_SIZE)
+		size = BTSNOOP_MAX_PACKET_SIZE;
 
-	if (writev(ellisys_fd, iov, iovcnt) < 0)
-		perror("Failed to send Ellisys injection packet");
+	queue_msg(msg, data, size);
 }
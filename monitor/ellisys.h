@@ -25,6 +25,8 @@
 #include <stdint.h>
 
 void ellisys_enable(const char *server, uint16_t port);
+void ellisys_flush(void);
+void ellisys_cleanup(void);
 
 void ellisys_inject_hci(struct timeval *tv, uint16_t index, uint16_t opcode,
 					const void *data, uint16_t size);
@@ -0,0 +1,581 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2011-2014  Intel Corporation
+ *  Copyright (C) 2002-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "lib/bluetooth.h"
+
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/btsnoop.h"
+
+#include "filter.h"
+
+/*
+ * The filter is evaluated on the raw HCI headers before a packet is handed
+ * to the decoders, so packets that don't match cost next to nothing. All
+ * terms have to match. To be able to filter on address and PSM, connection
+ * and L2CAP signalling packets are parsed here as well.
+ */
+#define FILTER_INDEX	(1 << 0)
+#define FILTER_HANDLE	(1 << 1)
+#define FILTER_CID	(1 << 2)
+#define FILTER_PSM	(1 << 3)
+#define FILTER_ATT	(1 << 4)
+#define FILTER_ADDR	(1 << 5)
+#define FILTER_SINCE	(1 << 6)
+#define FILTER_UNTIL	(1 << 7)
+
+/* Terms that only data packets and their connection can match */
+#define FILTER_DATA	(FILTER_HANDLE | FILTER_CID | FILTER_PSM | \
+					FILTER_ATT | FILTER_ADDR)
+
+static struct {
+	unsigned long mask;
+	uint16_t index;
+	uint16_t handle;
+	uint16_t cid;
+	uint16_t psm;
+	uint8_t att;
+	bdaddr_t addr;
+	unsigned long since;
+	unsigned long until;
+} filter;
+
+struct filter_conn {
+	uint16_t index;
+	uint16_t handle;
+	bdaddr_t addr;
+	bool match;		/* Last start fragment matched */
+};
+
+struct filter_chan {
+	uint16_t index;
+	uint16_t handle;
+	uint16_t psm;
+	uint8_t ident;
+	uint16_t scid;
+	uint16_t dcid;
+};
+
+static struct queue *conn_list;
+static struct queue *chan_list;
+
+static bool parse_num(const char *str, unsigned long max,
+							unsigned long *val)
+{
+	char *end;
+
+	if (!*str)
+		return false;
+
+	*val = strtoul(str, &end, 0);
+
+	return !*end && *val <= max;
+}
+
+static bool parse_term(const char *term)
+{
+	const char *value = strchr(term, '=');
+	unsigned long val;
+	size_t len;
+
+	if (!value)
+		return false;
+
+	len = value++ - term;
+
+	if (len == 5 && !strncmp(term, "index", len)) {
+		if (!strncmp(value, "hci", 3))
+			value += 3;
+
+		if (!parse_num(value, UINT16_MAX, &val))
+			return false;
+
+		filter.index = val;
+		filter.mask |= FILTER_INDEX;
+	} else if (len == 6 && !strncmp(term, "handle", len)) {
+		if (!parse_num(value, 0x0eff, &val))
+			return false;
+
+		filter.handle = val;
+		filter.mask |= FILTER_HANDLE;
+	} else if (len == 3 && !strncmp(term, "cid", len)) {
+		if (!parse_num(value, UINT16_MAX, &val))
+			return false;
+
+		filter.cid = val;
+		filter.mask |= FILTER_CID;
+	} else if (len == 3 && !strncmp(term, "psm", len)) {
+		if (!parse_num(value, UINT16_MAX, &val))
+			return false;
+
+		filter.psm = val;
+		filter.mask |= FILTER_PSM;
+	} else if (len == 3 && !strncmp(term, "att", len)) {
+		if (!parse_num(value, UINT8_MAX, &val))
+			return false;
+
+		filter.att = val;
+		filter.mask |= FILTER_ATT;
+	} else if (len == 4 && !strncmp(term, "addr", len)) {
+		if (bachk(value) < 0)
+			return false;
+
+		str2ba(value, &filter.addr);
+		filter.mask |= FILTER_ADDR;
+	} else if (len == 5 && !strncmp(term, "since", len)) {
+		if (!parse_num(value, ULONG_MAX, &val))
+			return false;
+
+		filter.since = val;
+		filter.mask |= FILTER_SINCE;
+	} else if (len == 5 && !strncmp(term, "until", len)) {
+		if (!parse_num(value, ULONG_MAX, &val))
+			return false;
+
+		filter.until = val;
+		filter.mask |= FILTER_UNTIL;
+	} else
+		return false;
+
+	return true;
+}
+
+bool filter_parse(const char *expr)
+{
+	char *str, *term, *saveptr;
+	bool result = true;
+
+	str = strdup(expr);
+	if (!str)
+		return false;
+
+	for (term = strtok_r(str, " ,", &saveptr); term;
+				term = strtok_r(NULL, " ,", &saveptr)) {
+		if (!parse_term(term)) {
+			result = false;
+			break;
+		}
+	}
+
+	free(str);
+
+	if (!result) {
+		memset(&filter, 0, sizeof(filter));
+		return false;
+	}
+
+	if (filter.mask & FILTER_DATA) {
+		conn_list = queue_new();
+		chan_list = queue_new();
+	}
+
+	return true;
+}
+
+void filter_get_chunk(uint16_t *index, uint16_t *handle)
+{
+	*index = (filter.mask & FILTER_INDEX) ? filter.index : 0xffff;
+	*handle = (filter.mask & FILTER_HANDLE) ? filter.handle : 0xffff;
+}
+
+void filter_cleanup(void)
+{
+	queue_destroy(conn_list, free);
+	conn_list = NULL;
+
+	queue_destroy(chan_list, free);
+	chan_list = NULL;
+
+	memset(&filter, 0, sizeof(filter));
+}
+
+struct conn_match {
+	uint16_t index;
+	uint16_t handle;
+};
+
+static bool match_conn(const void *data, const void *match_data)
+{
+	const struct filter_conn *conn = data;
+	const struct conn_match *match = match_data;
+
+	return conn->index == match->index && conn->handle == match->handle;
+}
+
+static struct filter_conn *conn_lookup(uint16_t index, uint16_t handle,
+								bool create)
+{
+	struct conn_match match = { .index = index, .handle = handle };
+	struct filter_conn *conn;
+
+	conn = queue_find(conn_list, match_conn, &match);
+	if (conn || !create)
+		return conn;
+
+	conn = new0(struct filter_conn, 1);
+	conn->index = index;
+	conn->handle = handle;
+	queue_push_tail(conn_list, conn);
+
+	return conn;
+}
+
+static bool match_chan_conn(const void *data, const void *match_data)
+{
+	const struct filter_chan *chan = data;
+	const struct conn_match *match = match_data;
+
+	return chan->index == match->index && chan->handle == match->handle;
+}
+
+static void conn_remove(uint16_t index, uint16_t handle)
+{
+	struct conn_match match = { .index = index, .handle = handle };
+
+	free(queue_remove_if(conn_list, match_conn, &match));
+	queue_remove_all(chan_list, match_chan_conn, &match, free);
+}
+
+static bool conn_matches(struct filter_conn *conn)
+{
+	if ((filter.mask & FILTER_HANDLE) && conn->handle != filter.handle)
+		return false;
+
+	if ((filter.mask & FILTER_ADDR) &&
+				bacmp(&conn->addr, &filter.addr))
+		return false;
+
+	return true;
+}
+
+/* Returns whether the connection event concerns a matching connection */
+static bool conn_event(uint16_t index, uint16_t handle, const uint8_t *addr)
+{
+	struct filter_conn *conn = conn_lookup(index, handle, true);
+
+	memcpy(&conn->addr, addr, sizeof(conn->addr));
+
+	return conn_matches(conn);
+}
+
+static bool disconn_event(uint16_t index, uint16_t handle)
+{
+	struct filter_conn *conn = conn_lookup(index, handle, false);
+	bool result;
+
+	if (!conn)
+		return false;
+
+	result = conn_matches(conn);
+
+	conn_remove(index, handle);
+
+	return result;
+}
+
+static bool event_match(uint16_t index, const uint8_t *data, uint16_t size)
+{
+	if (size < 2 || size - 2 < data[1])
+		return false;
+
+	switch (data[0]) {
+	case 0x03:	/* Connection Complete */
+		if (size < 11 || data[2])
+			return false;
+
+		return conn_event(index, get_le16(data + 3) & 0x0fff, data + 5);
+	case 0x05:	/* Disconnection Complete */
+		if (size < 5 || data[2])
+			return false;
+
+		return disconn_event(index, get_le16(data + 3) & 0x0fff);
+	case 0x3e:	/* LE Meta Event */
+		if (size < 14)
+			return false;
+
+		/* LE Connection Complete and LE Enhanced Connection Complete */
+		if ((data[2] != 0x01 && data[2] != 0x0a) || data[3])
+			return false;
+
+		return conn_event(index, get_le16(data + 4) & 0x0fff, data + 8);
+	}
+
+	return false;
+}
+
+static bool match_chan_scid(struct filter_chan *chan, uint16_t index,
+					uint16_t handle, uint16_t scid)
+{
+	return chan->index == index && chan->handle == handle &&
+							chan->scid == scid;
+}
+
+static struct filter_chan *chan_find(uint16_t index, uint16_t handle,
+						uint16_t cid, uint8_t ident)
+{
+	const struct queue_entry *entry;
+
+	for (entry = queue_get_entries(chan_list); entry;
+						entry = entry->next) {
+		struct filter_chan *chan = entry->data;
+
+		if (chan->index != index || chan->handle != handle)
+			continue;
+
+		if (cid && (chan->scid == cid || chan->dcid == cid))
+			return chan;
+
+		if (!cid && !chan->dcid && chan->ident == ident)
+			return chan;
+	}
+
+	return NULL;
+}
+
+static void chan_request(uint16_t index, uint16_t handle, uint8_t ident,
+						uint16_t psm, uint16_t scid)
+{
+	struct filter_chan *chan = new0(struct filter_chan, 1);
+
+	chan->index = index;
+	chan->handle = handle;
+	chan->ident = ident;
+	chan->psm = psm;
+	chan->scid = scid;
+
+	queue_push_tail(chan_list, chan);
+}
+
+static void chan_response(struct filter_chan *chan, uint16_t dcid,
+							uint16_t result)
+{
+	if (!chan)
+		return;
+
+	/* Connection pending keeps the request around */
+	if (result == 0x0001)
+		return;
+
+	if (result) {
+		queue_remove(chan_list, chan);
+		free(chan);
+		return;
+	}
+
+	chan->dcid = dcid;
+}
+
+static void sig_command(uint16_t index, uint16_t handle, const uint8_t *data,
+							uint16_t len)
+{
+	struct filter_chan *chan = NULL;
+	uint8_t code = data[0], ident = data[1];
+	const struct queue_entry *entry;
+
+	data += 4;
+
+	switch (code) {
+	case 0x02:	/* Connection Request */
+	case 0x14:	/* LE Credit Based Connection Request */
+		if (len < 4)
+			return;
+
+		chan_request(index, handle, ident, get_le16(data),
+							get_le16(data + 2));
+		break;
+	case 0x03:	/* Connection Response */
+		if (len < 6)
+			return;
+
+		for (entry = queue_get_entries(chan_list); entry;
+						entry = entry->next) {
+			if (match_chan_scid(entry->data, index, handle,
+							get_le16(data + 2))) {
+				chan = entry->data;
+				break;
+			}
+		}
+
+		chan_response(chan, get_le16(data), get_le16(data + 4));
+		break;
+	case 0x15:	/* LE Credit Based Connection Response */
+		if (len < 10)
+			return;
+
+		chan_response(chan_find(index, handle, 0, ident),
+					get_le16(data), get_le16(data + 8));
+		break;
+	}
+}
+
+static void sig_packet(uint16_t index, uint16_t handle, uint16_t cid,
+					const uint8_t *data, uint16_t size)
+{
+	while (size >= 4) {
+		uint16_t len = get_le16(data + 2);
+
+		if (size - 4 < len)
+			return;
+
+		sig_command(index, handle, data, len);
+
+		/* LE signalling carries a single command per frame */
+		if (cid == 0x0005)
+			return;
+
+		data += 4 + len;
+		size -= 4 + len;
+	}
+}
+
+static bool acl_match(uint16_t index, const uint8_t *data, uint16_t size)
+{
+	struct filter_conn *conn;
+	uint16_t handle, flags, len, cid;
+
+	if (size < 4)
+		return false;
+
+	handle = get_le16(data) & 0x0fff;
+	flags = get_le16(data) >> 12;
+
+	conn = conn_lookup(index, handle, true);
+
+	/* Continuation fragments follow the start fragment */
+	if ((flags & 0x03) == 0x01)
+		return conn->match;
+
+	conn->match = false;
+
+	data += 4;
+	size -= 4;
+
+	if (size < 4)
+		return false;
+
+	len = get_le16(data);
+	cid = get_le16(data + 2);
+
+	data += 4;
+	size -= 4;
+
+	if (cid == 0x0001 || cid == 0x0005) {
+		sig_packet(index, handle, cid, data, size < len ? size : len);
+
+		/* Show signalling when filtering on channels for context */
+		if (!(filter.mask & (FILTER_CID | FILTER_PSM)))
+			return false;
+	} else {
+		if ((filter.mask & FILTER_CID) && cid != filter.cid)
+			return false;
+
+		if (filter.mask & FILTER_PSM) {
+			struct filter_chan *chan;
+
+			chan = chan_find(index, handle, cid, 0);
+			if (!chan || chan->psm != filter.psm)
+				return false;
+		}
+
+		if ((filter.mask & FILTER_ATT) && (cid != 0x0004 || !size ||
+							data[0] != filter.att))
+			return false;
+	}
+
+	conn->match = conn_matches(conn);
+
+	return conn->match;
+}
+
+static bool sco_match(uint16_t index, const uint8_t *data, uint16_t size)
+{
+	struct filter_conn *conn;
+
+	if (filter.mask & (FILTER_CID | FILTER_PSM | FILTER_ATT))
+		return false;
+
+	if (size < 3)
+		return false;
+
+	conn = conn_lookup(index, get_le16(data) & 0x0fff, true);
+
+	return conn_matches(conn);
+}
+
+bool filter_match(const struct timeval *tv, time_t origin, uint16_t index,
+				uint16_t opcode, const void *data, uint16_t size)
+{
+	bool result;
+
+	if (!filter.mask)
+		return true;
+
+	if ((filter.mask & FILTER_INDEX) && index != filter.index)
+		return false;
+
+	switch (opcode) {
+	case BTSNOOP_OPCODE_NEW_INDEX:
+	case BTSNOOP_OPCODE_DEL_INDEX:
+	case BTSNOOP_OPCODE_OPEN_INDEX:
+	case BTSNOOP_OPCODE_CLOSE_INDEX:
+	case BTSNOOP_OPCODE_INDEX_INFO:
+		/* Always shown, they describe the controllers */
+		return true;
+	}
+
+	/* Connection state has to be tracked before the time window opens */
+	if (!(filter.mask & FILTER_DATA))
+		result = true;
+	else if (opcode == BTSNOOP_OPCODE_EVENT_PKT)
+		result = event_match(index, data, size);
+	else if (opcode == BTSNOOP_OPCODE_ACL_TX_PKT ||
+					opcode == BTSNOOP_OPCODE_ACL_RX_PKT)
+		result = acl_match(index, data, size);
+	else if (opcode == BTSNOOP_OPCODE_SCO_TX_PKT ||
+					opcode == BTSNOOP_OPCODE_SCO_RX_PKT)
+		result = sco_match(index, data, size);
+	else
+		result = false;
+
+	if (!result || !tv)
+		return result;
+
+	if ((filter.mask & FILTER_SINCE) &&
+			(unsigned long) (tv->tv_sec - origin) < filter.since)
+		return false;
+
+	if ((filter.mask & FILTER_UNTIL) &&
+			(unsigned long) (tv->tv_sec - origin) >= filter.until)
+		return false;
+
+	return true;
+}
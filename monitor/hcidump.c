@@ -40,6 +40,7 @@
 
 #include "src/shared/mainloop.h"
 
+#include "display.h"
 #include "packet.h"
 #include "hcidump.h"
 
@@ -176,6 +177,8 @@ static void device_callback(int fd, uint32_t events, void *user_data)
 							buf + 1, len - 1);
 			break;
 		}
+
+		display_flush_packet();
 	}
 }
 
@@ -386,6 +389,8 @@ static void stack_internal_callback(int fd, uint32_t events, void *user_data)
 		packet_del_index(tv, sd->dev_id, str);
 		break;
 	}
+
+	display_flush_packet();
 }
 
 int hcidump_tracing(void)
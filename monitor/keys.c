@@ -38,11 +38,13 @@ static const uint8_t empty_key[16] = { 0x00, };
 static const uint8_t empty_addr[6] = { 0x00, };
 
 static struct bt_crypto *crypto;
+static struct bt_crypto_irk_table *irk_table;
 
 struct irk_data {
 	uint8_t key[16];
 	uint8_t addr[6];
 	uint8_t addr_type;
+	int index;
 };
 
 static struct queue *irk_list;
@@ -50,12 +52,14 @@ static struct queue *irk_list;
 void keys_setup(void)
 {
 	crypto = bt_crypto_new();
+	irk_table = bt_crypto_irk_table_new(crypto);
 
 	irk_list = queue_new();
 }
 
 void keys_cleanup(void)
 {
+	bt_crypto_irk_table_free(irk_table);
 	bt_crypto_unref(crypto);
 
 	queue_destroy(irk_list, free);
@@ -68,14 +72,18 @@ void keys_update_identity_key(const uint8_t key[16])
 	irk = queue_peek_tail(irk_list);
 	if (irk && !memcmp(irk->key, empty_key, 16)) {
 		memcpy(irk->key, key, 16);
+		irk->index = bt_crypto_irk_table_add(irk_table, key);
 		return;
 	}
 
 	irk = new0(struct irk_data, 1);
 	if (irk) {
 		memcpy(irk->key, key, 16);
-		if (!queue_push_tail(irk_list, irk))
+		irk->index = bt_crypto_irk_table_add(irk_table, key);
+		if (!queue_push_tail(irk_list, irk)) {
+			bt_crypto_irk_table_remove(irk_table, irk->index);
 			free(irk);
+		}
 	}
 }
 
@@ -94,28 +102,30 @@ void keys_update_identity_addr(const uint8_t addr[6], uint8_t addr_type)
 	if (irk) {
 		memcpy(irk->addr, addr, 6);
 		irk->addr_type = addr_type;
+		irk->index = -1;
 		if (!queue_push_tail(irk_list, irk))
 			free(irk);
 	}
 }
 
-static bool match_resolve_irk(const void *data, const void *match_data)
+static bool match_irk_index(const void *data, const void *match_data)
 {
 	const struct irk_data *irk = data;
-	const uint8_t *addr = match_data;
-	uint8_t local_hash[3];
-
-	bt_crypto_ah(crypto, irk->key, addr + 3, local_hash);
 
-	return !memcmp(addr, local_hash, 3);
+	return irk->index == PTR_TO_INT(match_data);
 }
 
 bool keys_resolve_identity(const uint8_t addr[6], uint8_t ident[6],
 							uint8_t *ident_type)
 {
 	struct irk_data *irk;
+	int index;
+
+	index = bt_crypto_irk_table_resolve(irk_table, addr);
+	if (index < 0)
+		return false;
 
-	irk = queue_find(irk_list, match_resolve_irk, addr);
+	irk = queue_find(irk_list, match_irk_index, INT_TO_PTR(index));
 
 	if (irk) {
 		memcpy(ident, irk->addr, 6);
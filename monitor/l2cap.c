@@ -88,7 +88,14 @@
 #define L2CAP_SAR_END		0x02
 #define L2CAP_SAR_CONTINUE	0x03
 
-#define MAX_CHAN 64
+/*
+ * Channels are kept in a table whose slot number is shown as the channel
+ * number, so a slot is only reused once its channel is released. To keep
+ * lookups cheap with many connections, the channels of each connection
+ * are chained in slot order from a hash of controller index and handle.
+ */
+#define MAX_CHAN 1024
+#define CHAN_HASH_SIZE 256
 
 struct chan_data {
 	uint16_t index;
@@ -101,9 +108,70 @@ struct chan_data {
 	uint8_t  mode;
 	uint8_t  ext_ctrl;
 	uint8_t  seq_num;
+	uint16_t next;		/* Slot + 1 of next channel on chain */
 };
 
 static struct chan_data chan_list[MAX_CHAN];
+static uint64_t chan_used[MAX_CHAN / 64];
+static uint16_t chan_hash[CHAN_HASH_SIZE];
+static unsigned int chan_amp_count;
+
+#define for_each_chan(i, head) \
+	for (i = (head) - 1; i >= 0; i = chan_list[i].next - 1)
+
+static uint16_t *chan_head(uint16_t index, uint16_t handle)
+{
+	return &chan_hash[(handle ^ (index << 5)) % CHAN_HASH_SIZE];
+}
+
+static int chan_alloc(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < MAX_CHAN / 64; i++) {
+		if (~chan_used[i])
+			return i * 64 + __builtin_ctzll(~chan_used[i]);
+	}
+
+	return -1;
+}
+
+static void chan_link(int n)
+{
+	struct chan_data *chan = &chan_list[n];
+	uint16_t *head = chan_head(chan->index, chan->handle);
+
+	/* Keep chains sorted, lookups return the lowest matching slot */
+	while (*head && *head - 1 < n)
+		head = &chan_list[*head - 1].next;
+
+	chan->next = *head;
+	*head = n + 1;
+
+	chan_used[n / 64] |= 1ull << (n % 64);
+
+	if (chan->ctrlid)
+		chan_amp_count++;
+}
+
+static void chan_unlink(int n)
+{
+	struct chan_data *chan = &chan_list[n];
+	uint16_t *head = chan_head(chan->index, chan->handle);
+
+	while (*head && *head - 1 != n)
+		head = &chan_list[*head - 1].next;
+
+	if (*head)
+		*head = chan->next;
+
+	chan->next = 0;
+
+	chan_used[n / 64] &= ~(1ull << (n % 64));
+
+	if (chan->ctrlid)
+		chan_amp_count--;
+}
 
 static void assign_scid(const struct l2cap_frame *frame,
 				uint16_t scid, uint16_t psm, uint8_t ctrlid)
@@ -111,12 +179,7 @@ static void assign_scid(const struct l2cap_frame *frame,
 	int i, n = -1;
 	uint8_t seq_num = 1;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (n < 0 && chan_list[i].handle == 0x0000) {
-			n = i;
-			continue;
-		}
-
+	for_each_chan(i, *chan_head(frame->index, frame->handle)) {
 		if (chan_list[i].index != frame->index)
 			continue;
 
@@ -138,6 +201,11 @@ static void assign_scid(const struct l2cap_frame *frame,
 		}
 	}
 
+	if (n < 0)
+		n = chan_alloc();
+	else
+		chan_unlink(n);
+
 	if (n < 0)
 		return;
 
@@ -156,13 +224,15 @@ static void assign_scid(const struct l2cap_frame *frame,
 	chan_list[n].mode = 0;
 
 	chan_list[n].seq_num = seq_num;
+
+	chan_link(n);
 }
 
 static void release_scid(const struct l2cap_frame *frame, uint16_t scid)
 {
 	int i;
 
-	for (i = 0; i < MAX_CHAN; i++) {
+	for_each_chan(i, *chan_head(frame->index, frame->handle)) {
 		if (chan_list[i].index != frame->index)
 			continue;
 
@@ -171,12 +241,12 @@ static void release_scid(const struct l2cap_frame *frame, uint16_t scid)
 
 		if (frame->in) {
 			if (chan_list[i].scid == scid) {
-				chan_list[i].handle = 0;
+				chan_unlink(i);
 				break;
 			}
 		} else {
 			if (chan_list[i].dcid == scid) {
-				chan_list[i].handle = 0;
+				chan_unlink(i);
 				break;
 			}
 		}
@@ -188,7 +258,7 @@ static void assign_dcid(const struct l2cap_frame *frame, uint16_t dcid,
 {
 	int i;
 
-	for (i = 0; i < MAX_CHAN; i++) {
+	for_each_chan(i, *chan_head(frame->index, frame->handle)) {
 		if (chan_list[i].index != frame->index)
 			continue;
 
@@ -226,12 +296,11 @@ static void assign_dcid(const struct l2cap_frame *frame, uint16_t dcid,
 	}
 }
 
-static void assign_mode(const struct l2cap_frame *frame,
-					uint8_t mode, uint16_t dcid)
+static int find_chan(const struct l2cap_frame *frame, uint16_t cid)
 {
 	int i;
 
-	for (i = 0; i < MAX_CHAN; i++) {
+	for_each_chan(i, *chan_head(frame->index, frame->handle)) {
 		if (chan_list[i].index != frame->index)
 			continue;
 
@@ -239,30 +308,60 @@ static void assign_mode(const struct l2cap_frame *frame,
 			continue;
 
 		if (frame->in) {
-			if (chan_list[i].scid == dcid) {
-				chan_list[i].mode = mode;
+			if (chan_list[i].scid == cid)
+				return i;
+		} else {
+			if (chan_list[i].dcid == cid)
+				return i;
+		}
+	}
+
+	return -1;
+}
+
+static void assign_mode(const struct l2cap_frame *frame,
+					uint8_t mode, uint16_t dcid)
+{
+	int i = find_chan(frame, dcid);
+
+	if (i >= 0)
+		chan_list[i].mode = mode;
+}
+
+static int get_chan_data_index(const struct l2cap_frame *frame)
+{
+	int i, n = -1;
+
+	for_each_chan(i, *chan_head(frame->index, frame->handle)) {
+		if (chan_list[i].index != frame->index ||
+						chan_list[i].ctrlid != 0)
+			continue;
+
+		if (chan_list[i].handle != frame->handle)
+			continue;
+
+		if (frame->in) {
+			if (chan_list[i].scid == frame->cid) {
+				n = i;
 				break;
 			}
 		} else {
-			if (chan_list[i].dcid == dcid) {
-				chan_list[i].mode = mode;
+			if (chan_list[i].dcid == frame->cid) {
+				n = i;
 				break;
 			}
 		}
 	}
-}
 
-static int get_chan_data_index(const struct l2cap_frame *frame)
-{
-	int i;
+	if (!chan_amp_count)
+		return n;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index &&
-					chan_list[i].ctrlid == 0)
+	/* Channels over AMP are addressed by controller id */
+	for (i = 0; i < (n < 0 ? MAX_CHAN : n); i++) {
+		if (!(chan_used[i / 64] & (1ull << (i % 64))))
 			continue;
 
-		if (chan_list[i].ctrlid != 0 &&
-					chan_list[i].ctrlid != frame->index)
+		if (!chan_list[i].ctrlid || chan_list[i].ctrlid != frame->index)
 			continue;
 
 		if (chan_list[i].handle != frame->handle)
@@ -277,7 +376,7 @@ static int get_chan_data_index(const struct l2cap_frame *frame)
 		}
 	}
 
-	return -1;
+	return n;
 }
 
 static uint16_t get_psm(const struct l2cap_frame *frame)
@@ -323,27 +422,10 @@ static uint8_t get_seq_num(const struct l2cap_frame *frame)
 static void assign_ext_ctrl(const struct l2cap_frame *frame,
 					uint8_t ext_ctrl, uint16_t dcid)
 {
-	int i;
-
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index)
-			continue;
-
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	int i = find_chan(frame, dcid);
 
-		if (frame->in) {
-			if (chan_list[i].scid == dcid) {
-				chan_list[i].ext_ctrl = ext_ctrl;
-				break;
-			}
-		} else {
-			if (chan_list[i].dcid == dcid) {
-				chan_list[i].ext_ctrl = ext_ctrl;
-				break;
-			}
-		}
-	}
+	if (i >= 0)
+		chan_list[i].ext_ctrl = ext_ctrl;
 }
 
 static uint8_t get_ext_ctrl(const struct l2cap_frame *frame)
@@ -459,23 +541,93 @@ static void l2cap_ctrl_parse(struct l2cap_frame *frame, uint32_t ctrl)
 		printf(" F-bit");
 }
 
-#define MAX_INDEX 16
+/*
+ * Fragments are reassembled per connection and direction, so interleaved
+ * fragments of different connections don't corrupt each other. Buffers of
+ * completed frames are kept in a small pool and reused.
+ */
+#define FRAG_HASH_SIZE	256
+#define FRAG_POOL_SIZE	8
+
+struct frag_data {
+	uint16_t index;
+	uint16_t handle;
+	bool in;
+	uint8_t *buf;
+	size_t size;
+	uint16_t pos;
+	uint16_t len;
+	uint16_t cid;
+	struct frag_data *next;
+};
 
-struct index_data {
-	void *frag_buf;
-	uint16_t frag_pos;
-	uint16_t frag_len;
-	uint16_t frag_cid;
+struct frag_buf {
+	uint8_t *data;
+	size_t size;
 };
 
-static struct index_data index_list[MAX_INDEX][2];
+static struct frag_data *frag_hash[FRAG_HASH_SIZE];
+static struct frag_buf frag_pool[FRAG_POOL_SIZE];
+static unsigned int frag_pool_len;
 
-static void clear_fragment_buffer(uint16_t index, bool in)
+static struct frag_data *get_fragment(uint16_t index, uint16_t handle,
+								bool in)
 {
-	free(index_list[index][in].frag_buf);
-	index_list[index][in].frag_buf = NULL;
-	index_list[index][in].frag_pos = 0;
-	index_list[index][in].frag_len = 0;
+	unsigned int hash = (handle ^ (index << 5) ^ (in << 4)) %
+							FRAG_HASH_SIZE;
+	struct frag_data *frag;
+
+	for (frag = frag_hash[hash]; frag; frag = frag->next) {
+		if (frag->index == index && frag->handle == handle &&
+							frag->in == in)
+			return frag;
+	}
+
+	frag = calloc(1, sizeof(*frag));
+	if (!frag)
+		return NULL;
+
+	frag->index = index;
+	frag->handle = handle;
+	frag->in = in;
+	frag->next = frag_hash[hash];
+	frag_hash[hash] = frag;
+
+	return frag;
+}
+
+static uint8_t *alloc_fragment_buffer(uint16_t len, size_t *size)
+{
+	unsigned int i;
+	uint8_t *buf;
+
+	for (i = 0; i < frag_pool_len; i++) {
+		if (frag_pool[i].size < len)
+			continue;
+
+		buf = frag_pool[i].data;
+		*size = frag_pool[i].size;
+		frag_pool[i] = frag_pool[--frag_pool_len];
+		return buf;
+	}
+
+	*size = len;
+
+	return malloc(len);
+}
+
+static void clear_fragment_buffer(struct frag_data *frag)
+{
+	if (frag->buf && frag_pool_len < FRAG_POOL_SIZE) {
+		frag_pool[frag_pool_len].data = frag->buf;
+		frag_pool[frag_pool_len].size = frag->size;
+		frag_pool_len++;
+	} else
+		free(frag->buf);
+
+	frag->buf = NULL;
+	frag->pos = 0;
+	frag->len = 0;
 }
 
 static void print_psm(uint16_t psm)
@@ -3124,10 +3276,12 @@ void l2cap_packet(uint16_t index, bool in, uint16_t handle, uint8_t flags,
 					const void *data, uint16_t size)
 {
 	const struct bt_l2cap_hdr *hdr = data;
+	struct frag_data *frag;
 	uint16_t len, cid;
 
-	if (index > MAX_INDEX - 1) {
-		print_text(COLOR_ERROR, "controller index too large");
+	frag = get_fragment(index, handle, in);
+	if (!frag) {
+		print_text(COLOR_ERROR, "failed fragment allocation");
 		packet_hexdump(data, size);
 		return;
 	}
@@ -3135,10 +3289,10 @@ void l2cap_packet(uint16_t index, bool in, uint16_t handle, uint8_t flags,
 	switch (flags) {
 	case 0x00:	/* start of a non-automatically-flushable PDU */
 	case 0x02:	/* start of an automatically-flushable PDU */
-		if (index_list[index][in].frag_len) {
+		if (frag->len) {
 			print_text(COLOR_ERROR, "unexpected start frame");
 			packet_hexdump(data, size);
-			clear_fragment_buffer(index, in);
+			clear_fragment_buffer(frag);
 			return;
 		}
 
@@ -3166,54 +3320,51 @@ void l2cap_packet(uint16_t index, bool in, uint16_t handle, uint8_t flags,
 			return;
 		}
 
-		index_list[index][in].frag_buf = malloc(len);
-		if (!index_list[index][in].frag_buf) {
+		frag->buf = alloc_fragment_buffer(len, &frag->size);
+		if (!frag->buf) {
 			print_text(COLOR_ERROR, "failed buffer allocation");
 			packet_hexdump(data, size);
 			return;
 		}
 
-		memcpy(index_list[index][in].frag_buf, data, size);
-		index_list[index][in].frag_pos = size;
-		index_list[index][in].frag_len = len - size;
-		index_list[index][in].frag_cid = cid;
+		memcpy(frag->buf, data, size);
+		frag->pos = size;
+		frag->len = len - size;
+		frag->cid = cid;
 		break;
 
 	case 0x01:	/* continuing fragment */
-		if (!index_list[index][in].frag_len) {
+		if (!frag->len) {
 			print_text(COLOR_ERROR, "unexpected continuation");
 			packet_hexdump(data, size);
 			return;
 		}
 
-		if (size > index_list[index][in].frag_len) {
+		if (size > frag->len) {
 			print_text(COLOR_ERROR, "fragment too long");
 			packet_hexdump(data, size);
-			clear_fragment_buffer(index, in);
+			clear_fragment_buffer(frag);
 			return;
 		}
 
-		memcpy(index_list[index][in].frag_buf +
-				index_list[index][in].frag_pos, data, size);
-		index_list[index][in].frag_pos += size;
-		index_list[index][in].frag_len -= size;
+		memcpy(frag->buf + frag->pos, data, size);
+		frag->pos += size;
+		frag->len -= size;
 
-		if (!index_list[index][in].frag_len) {
+		if (!frag->len) {
 			/* complete frame */
-			l2cap_frame(index, in, handle,
-					index_list[index][in].frag_cid,
-					index_list[index][in].frag_buf,
-					index_list[index][in].frag_pos);
-			clear_fragment_buffer(index, in);
+			l2cap_frame(index, in, handle, frag->cid, frag->buf,
+								frag->pos);
+			clear_fragment_buffer(frag);
 			return;
 		}
 		break;
 
 	case 0x03:	/* complete automatically-flushable PDU */
-		if (index_list[index][in].frag_len) {
+		if (frag->len) {
 			print_text(COLOR_ERROR, "unexpected complete frame");
 			packet_hexdump(data, size);
-			clear_fragment_buffer(index, in);
+			clear_fragment_buffer(frag);
 			return;
 		}
 
@@ -0,0 +1,329 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2011-2014  Intel Corporation
+ *  Copyright (C) 2002-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/mainloop.h"
+
+#include "packet.h"
+#include "latency.h"
+
+#define NELEM(x) (sizeof(x) / sizeof((x)[0]))
+
+/* Upper bounds in milliseconds of the histogram buckets */
+static const unsigned int buckets[] = {
+	1, 2, 5, 10, 20, 50, 100, 200, 500, 1000,
+};
+
+#define NUM_BUCKETS	(NELEM(buckets) + 1)
+
+/* Commands without response are dropped beyond this */
+#define MAX_PENDING	64
+
+#define NUM_SLOWEST	10
+
+struct opcode_stats {
+	uint16_t opcode;
+	unsigned long count;
+	uint64_t total;
+	uint32_t min;
+	uint32_t max;
+	unsigned long hist[NUM_BUCKETS];
+};
+
+struct pending_cmd {
+	uint16_t index;
+	uint16_t opcode;
+	struct timeval tv;
+};
+
+struct slow_cmd {
+	uint16_t index;
+	uint16_t opcode;
+	uint32_t latency;
+	struct timeval tv;
+};
+
+static bool enabled;
+static int timeout_id = -1;
+static struct queue *stats_list;
+static struct queue *pending_list;
+static struct slow_cmd slowest[NUM_SLOWEST];
+static unsigned int num_slowest;
+static struct timeval last_tv;
+static unsigned long num_dropped;
+
+static uint32_t tv_diff_us(const struct timeval *start,
+						const struct timeval *end)
+{
+	struct timeval res;
+
+	if (timercmp(end, start, <))
+		return 0;
+
+	timersub(end, start, &res);
+
+	if (res.tv_sec > 3600)
+		return UINT32_MAX;
+
+	return res.tv_sec * 1000000 + res.tv_usec;
+}
+
+static void print_opcode(uint16_t opcode)
+{
+	const char *str = packet_opcode_str(opcode);
+
+	printf("%s (0x%2.2x|0x%4.4x)", str ? str : "Unknown",
+					opcode >> 10, opcode & 0x03ff);
+}
+
+static void print_stats(void *data, void *user_data)
+{
+	const struct opcode_stats *stats = data;
+	unsigned int i;
+
+	printf("  ");
+	print_opcode(stats->opcode);
+	printf(": %lu, latency min %u avg %u max %u usec\n", stats->count,
+			stats->min, (uint32_t) (stats->total / stats->count),
+			stats->max);
+
+	printf("   ");
+	for (i = 0; i < NUM_BUCKETS; i++) {
+		if (i < NELEM(buckets))
+			printf(" <%ums %lu", buckets[i], stats->hist[i]);
+		else
+			printf(" >=%ums %lu", buckets[i - 1], stats->hist[i]);
+	}
+	printf("\n");
+}
+
+static void print_pending(void *data, void *user_data)
+{
+	const struct pending_cmd *pending = data;
+
+	printf("  hci%u ", pending->index);
+	print_opcode(pending->opcode);
+	printf(" pending for %u usec\n", tv_diff_us(&pending->tv, &last_tv));
+}
+
+void latency_report(void)
+{
+	unsigned int i;
+
+	if (!enabled)
+		return;
+
+	printf("= Command latency\n");
+
+	queue_foreach(stats_list, print_stats, NULL);
+
+	if (num_slowest)
+		printf("  Slowest commands:\n");
+
+	for (i = 0; i < num_slowest; i++) {
+		printf("  %2u. hci%u ", i + 1, slowest[i].index);
+		print_opcode(slowest[i].opcode);
+		printf(" %u usec at %lu.%6.6lu\n", slowest[i].latency,
+					(unsigned long) slowest[i].tv.tv_sec,
+					(unsigned long) slowest[i].tv.tv_usec);
+	}
+
+	queue_foreach(pending_list, print_pending, NULL);
+
+	if (num_dropped)
+		printf("  %lu commands without response\n", num_dropped);
+
+	fflush(stdout);
+}
+
+static void report_timeout(int id, void *user_data)
+{
+	unsigned int interval = PTR_TO_UINT(user_data);
+
+	latency_report();
+
+	mainloop_modify_timeout(id, interval * 1000);
+}
+
+bool latency_enable(unsigned int interval)
+{
+	if (enabled)
+		return true;
+
+	if (interval) {
+		timeout_id = mainloop_add_timeout(interval * 1000,
+						report_timeout,
+						UINT_TO_PTR(interval), NULL);
+		if (timeout_id < 0)
+			return false;
+	}
+
+	stats_list = queue_new();
+	pending_list = queue_new();
+	enabled = true;
+
+	return true;
+}
+
+void latency_cleanup(void)
+{
+	if (!enabled)
+		return;
+
+	if (timeout_id >= 0) {
+		mainloop_remove_timeout(timeout_id);
+		timeout_id = -1;
+	}
+
+	queue_destroy(stats_list, free);
+	stats_list = NULL;
+
+	queue_destroy(pending_list, free);
+	pending_list = NULL;
+
+	num_slowest = 0;
+	num_dropped = 0;
+	enabled = false;
+}
+
+void latency_command(const struct timeval *tv, uint16_t index,
+							uint16_t opcode)
+{
+	struct pending_cmd *pending;
+
+	if (!enabled || !tv)
+		return;
+
+	last_tv = *tv;
+
+	if (queue_length(pending_list) >= MAX_PENDING) {
+		free(queue_pop_head(pending_list));
+		num_dropped++;
+	}
+
+	pending = new0(struct pending_cmd, 1);
+	pending->index = index;
+	pending->opcode = opcode;
+	pending->tv = *tv;
+
+	queue_push_tail(pending_list, pending);
+}
+
+static bool match_pending(const void *data, const void *match_data)
+{
+	const struct pending_cmd *pending = data;
+	const struct pending_cmd *match = match_data;
+
+	return pending->index == match->index &&
+					pending->opcode == match->opcode;
+}
+
+static bool match_opcode(const void *data, const void *match_data)
+{
+	const struct opcode_stats *stats = data;
+
+	return stats->opcode == PTR_TO_UINT(match_data);
+}
+
+static void add_slowest(const struct pending_cmd *pending, uint32_t latency)
+{
+	unsigned int i;
+
+	for (i = num_slowest; i > 0; i--) {
+		if (slowest[i - 1].latency >= latency)
+			break;
+	}
+
+	if (i == NUM_SLOWEST)
+		return;
+
+	if (num_slowest < NUM_SLOWEST)
+		num_slowest++;
+
+	memmove(&slowest[i + 1], &slowest[i],
+			(num_slowest - i - 1) * sizeof(slowest[0]));
+
+	slowest[i].index = pending->index;
+	slowest[i].opcode = pending->opcode;
+	slowest[i].latency = latency;
+	slowest[i].tv = pending->tv;
+}
+
+void latency_response(const struct timeval *tv, uint16_t index,
+							uint16_t opcode)
+{
+	struct pending_cmd match = { .index = index, .opcode = opcode };
+	struct pending_cmd *pending;
+	struct opcode_stats *stats;
+	uint32_t latency;
+	unsigned int i;
+
+	if (!enabled || !tv || !opcode)
+		return;
+
+	last_tv = *tv;
+
+	pending = queue_remove_if(pending_list, match_pending, &match);
+	if (!pending)
+		return;
+
+	latency = tv_diff_us(&pending->tv, tv);
+
+	stats = queue_find(stats_list, match_opcode, UINT_TO_PTR(opcode));
+	if (!stats) {
+		stats = new0(struct opcode_stats, 1);
+		stats->opcode = opcode;
+		stats->min = UINT32_MAX;
+		queue_push_tail(stats_list, stats);
+	}
+
+	stats->count++;
+	stats->total += latency;
+
+	if (latency < stats->min)
+		stats->min = latency;
+
+	if (latency > stats->max)
+		stats->max = latency;
+
+	for (i = 0; i < NELEM(buckets); i++) {
+		if (latency < buckets[i] * 1000)
+			break;
+	}
+
+	stats->hist[i]++;
+
+	add_slowest(pending, latency);
+
+	free(pending);
+}
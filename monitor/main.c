@@ -36,9 +36,13 @@
 #include "src/shared/mainloop.h"
 #include "src/shared/tty.h"
 
+#include "display.h"
 #include "packet.h"
 #include "lmp.h"
 #include "keys.h"
+#include "filter.h"
+#include "latency.h"
+#include "publish.h"
 #include "analyze.h"
 #include "ellisys.h"
 #include "control.h"
@@ -50,6 +54,9 @@ static void signal_callback(int signum, void *user_data)
 	case SIGTERM:
 		mainloop_quit();
 		break;
+	case SIGUSR1:
+		latency_report();
+		break;
 	}
 }
 
@@ -60,11 +67,22 @@ static void usage(void)
 	printf("\tbtmon [options]\n");
 	printf("options:\n"
 		"\t-r, --read <file>      Read traces in btsnoop format\n"
+		"\t    --seek <num>       Start reading at record number\n"
+		"\t    --seek-time <sec>  Start reading at time since epoch\n"
 		"\t-w, --write <file>     Save traces in btsnoop format\n"
+		"\t    --rotate-size <n>  Start a new file after n MB\n"
+		"\t    --rotate-time <n>  Start a new file after n seconds\n"
+		"\t    --capture          Only write traces, without decoding\n"
+		"\t    --write-index      Index written traces for fast reading\n"
 		"\t-a, --analyze <file>   Analyze traces in btsnoop format\n"
+		"\t    --format <fmt>     Analyze output format (text, json)\n"
 		"\t-s, --server <socket>  Start monitor server socket\n"
+		"\t    --publish <socket> Stream traces to subscribers\n"
 		"\t-p, --priority <level> Show only priority or lower\n"
 		"\t-i, --index <num>      Show only specified controller\n"
+		"\t    --filter <expr>    Show only packets matching expression\n"
+		"\t    --latency <sec>    Report command latency every sec\n"
+		"\t                       (0 for only on SIGUSR1)\n"
 		"\t-d, --tty <tty>        Read data from TTY\n"
 		"\t-B, --tty-speed <rate> Set TTY speed (default 115200)\n"
 		"\t-t, --time             Show time instead of time offset\n"
@@ -79,11 +97,21 @@ static const struct option main_options[] = {
 	{ "tty",     required_argument, NULL, 'd' },
 	{ "tty-speed", required_argument, NULL, 'B' },
 	{ "read",    required_argument, NULL, 'r' },
+	{ "seek",    required_argument, NULL, 'k' },
+	{ "seek-time", required_argument, NULL, 'K' },
 	{ "write",   required_argument, NULL, 'w' },
+	{ "rotate-size", required_argument, NULL, 'z' },
+	{ "rotate-time", required_argument, NULL, 'Z' },
+	{ "capture", no_argument,       NULL, 'c' },
+	{ "write-index", no_argument,   NULL, 'x' },
 	{ "analyze", required_argument, NULL, 'a' },
+	{ "format",  required_argument, NULL, 'j' },
 	{ "server",  required_argument, NULL, 's' },
+	{ "publish", required_argument, NULL, 'P' },
 	{ "priority",required_argument, NULL, 'p' },
 	{ "index",   required_argument, NULL, 'i' },
+	{ "filter",  required_argument, NULL, 'F' },
+	{ "latency", required_argument, NULL, 'L' },
 	{ "time",    no_argument,       NULL, 't' },
 	{ "date",    no_argument,       NULL, 'T' },
 	{ "sco",     no_argument,	NULL, 'S' },
@@ -100,12 +128,20 @@ int main(int argc, char *argv[])
 	unsigned long filter_mask = 0;
 	const char *reader_path = NULL;
 	const char *writer_path = NULL;
+	const char *publish_path = NULL;
 	const char *analyze_path = NULL;
 	const char *ellisys_server = NULL;
 	const char *tty = NULL;
 	unsigned int tty_speed = B115200;
 	unsigned short ellisys_port = 0;
+	struct timeval seek_tv;
+	double seek_time;
+	unsigned long rotate_size = 0, rotate_time = 0;
+	unsigned long latency_interval = 0;
+	bool latency = false;
+	bool capture = false;
 	const char *str;
+	char *endptr;
 	int exit_status;
 	sigset_t mask;
 
@@ -136,12 +172,63 @@ int main(int argc, char *argv[])
 		case 'r':
 			reader_path = optarg;
 			break;
+		case 'k':
+			control_reader_seek(strtoull(optarg, &endptr, 10));
+			if (*endptr != '\0') {
+				fprintf(stderr, "Invalid record: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'K':
+			seek_time = strtod(optarg, &endptr);
+			if (*endptr != '\0' || seek_time < 0) {
+				fprintf(stderr, "Invalid time: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			seek_tv.tv_sec = seek_time;
+			seek_tv.tv_usec = (seek_time - seek_tv.tv_sec) * 1000000;
+			control_reader_seek_time(&seek_tv);
+			break;
 		case 'w':
 			writer_path = optarg;
 			break;
+		case 'z':
+			rotate_size = strtoul(optarg, &endptr, 10);
+			if (*endptr != '\0' || !rotate_size) {
+				fprintf(stderr, "Invalid size: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'Z':
+			rotate_time = strtoul(optarg, &endptr, 10);
+			if (*endptr != '\0' || !rotate_time) {
+				fprintf(stderr, "Invalid time: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'c':
+			capture = true;
+			break;
+		case 'x':
+			control_writer_index();
+			break;
 		case 'a':
 			analyze_path = optarg;
 			break;
+		case 'L':
+			latency_interval = strtoul(optarg, &endptr, 10);
+			if (*endptr != '\0') {
+				fprintf(stderr, "Invalid interval: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			latency = true;
+			break;
+		case 'j':
+			if (!analyze_set_format(optarg)) {
+				fprintf(stderr, "Unknown format: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
 		case 's':
 			if (strlen(optarg) > sizeof(addr.sun_path) - 1) {
 				fprintf(stderr, "Socket name too long\n");
@@ -149,6 +236,13 @@ int main(int argc, char *argv[])
 			}
 			control_server(optarg);
 			break;
+		case 'P':
+			if (strlen(optarg) > sizeof(addr.sun_path) - 1) {
+				fprintf(stderr, "Socket name too long\n");
+				return EXIT_FAILURE;
+			}
+			publish_path = optarg;
+			break;
 		case 'p':
 			packet_set_priority(optarg);
 			break;
@@ -163,6 +257,12 @@ int main(int argc, char *argv[])
 			}
 			packet_select_index(atoi(str));
 			break;
+		case 'F':
+			if (!filter_parse(optarg)) {
+				fprintf(stderr, "Invalid filter: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
 		case 't':
 			filter_mask &= ~PACKET_FILTER_SHOW_TIME_OFFSET;
 			filter_mask |= PACKET_FILTER_SHOW_TIME;
@@ -202,6 +302,17 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (capture && ((!writer_path && !publish_path) || reader_path ||
+						analyze_path || tty)) {
+		fprintf(stderr, "Capture requires writing or publishing\n");
+		return EXIT_FAILURE;
+	}
+
+	if (publish_path && (reader_path || analyze_path)) {
+		fprintf(stderr, "Publish requires live tracing\n");
+		return EXIT_FAILURE;
+	}
+
 	if (reader_path && analyze_path) {
 		fprintf(stderr, "Display and analyze can't be combined\n");
 		return EXIT_FAILURE;
@@ -210,15 +321,23 @@ int main(int argc, char *argv[])
 	sigemptyset(&mask);
 	sigaddset(&mask, SIGINT);
 	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGUSR1);
 
 	mainloop_set_signal(&mask, signal_callback, NULL, NULL);
 
-	printf("Bluetooth monitor ver %s\n", VERSION);
+	/* Keep machine readable analyze output free of the banner */
+	if (!analyze_path || analyze_is_text())
+		printf("Bluetooth monitor ver %s\n", VERSION);
 
 	keys_setup();
 
 	packet_set_filter(filter_mask);
 
+	if (latency && !latency_enable(latency_interval)) {
+		fprintf(stderr, "Failed to enable latency tracking\n");
+		return EXIT_FAILURE;
+	}
+
 	if (analyze_path) {
 		analyze_trace(analyze_path);
 		return EXIT_SUCCESS;
@@ -229,9 +348,16 @@ int main(int argc, char *argv[])
 			ellisys_enable(ellisys_server, ellisys_port);
 
 		control_reader(reader_path);
+		ellisys_cleanup();
+		latency_report();
 		return EXIT_SUCCESS;
 	}
 
+	control_writer_rotate(rotate_size * 1024 * 1024, rotate_time);
+
+	if (capture)
+		control_capture();
+
 	if (writer_path && !control_writer(writer_path)) {
 		printf("Failed to open '%s'\n", writer_path);
 		return EXIT_FAILURE;
@@ -240,6 +366,11 @@ int main(int argc, char *argv[])
 	if (ellisys_server)
 		ellisys_enable(ellisys_server, ellisys_port);
 
+	if (publish_path && !publish_enable(publish_path))
+		return EXIT_FAILURE;
+
+	display_buffer_packets();
+
 	if (!tty && control_tracing() < 0)
 		return EXIT_FAILURE;
 
@@ -248,7 +379,18 @@ int main(int argc, char *argv[])
 
 	exit_status = mainloop_run();
 
+	publish_cleanup();
+
+	ellisys_cleanup();
+
+	control_cleanup();
+
 	keys_cleanup();
 
+	filter_cleanup();
+
+	latency_report();
+	latency_cleanup();
+
 	return exit_status;
 }
@@ -49,6 +49,8 @@
 #include "ll.h"
 #include "hwdb.h"
 #include "keys.h"
+#include "filter.h"
+#include "latency.h"
 #include "uuid.h"
 #include "l2cap.h"
 #include "control.h"
@@ -174,51 +176,22 @@ static uint16_t get_format(uint32_t cookie)
 	return 0xffff;
 }
 
-#define MAX_CONN 16
-
-struct conn_data {
-	uint16_t handle;
-	uint8_t  type;
-};
-
-static struct conn_data conn_list[MAX_CONN];
+/* Connection types by handle, stored plus one so zero means unknown */
+static uint8_t conn_list[0x1000];
 
 static void assign_handle(uint16_t handle, uint8_t type)
 {
-	int i;
-
-	for (i = 0; i < MAX_CONN; i++) {
-		if (conn_list[i].handle == 0x0000) {
-			conn_list[i].handle = handle;
-			conn_list[i].type = type;
-			break;
-		}
-	}
+	conn_list[handle & 0x0fff] = type + 1;
 }
 
 static void release_handle(uint16_t handle)
 {
-	int i;
-
-	for (i = 0; i < MAX_CONN; i++) {
-		if (conn_list[i].handle == handle) {
-			conn_list[i].handle = 0x0000;
-			conn_list[i].type = 0x00;
-			break;
-		}
-	}
+	conn_list[handle & 0x0fff] = 0;
 }
 
 static uint8_t get_type(uint16_t handle)
 {
-	int i;
-
-	for (i = 0; i < MAX_CONN; i++) {
-		if (conn_list[i].handle == handle)
-			return conn_list[i].type;
-	}
-
-	return 0xff;
+	return conn_list[handle & 0x0fff] - 1;
 }
 
 bool packet_has_filter(unsigned long filter)
@@ -276,6 +249,70 @@ struct index_data {
 
 static struct index_data index_list[MAX_INDEX];
 
+static int append_str(char *buf, const char *str)
+{
+	size_t len = strlen(str);
+
+	memcpy(buf, str, len + 1);
+
+	return len;
+}
+
+/* Appends " %0<digits>lu" style numbers without going through printf */
+static int append_num(char *buf, char sep, unsigned long val, int digits)
+{
+	char tmp[24];
+	int len = 0, n = 0;
+
+	do {
+		tmp[len++] = '0' + val % 10;
+		val /= 10;
+	} while (val);
+
+	while (len < digits)
+		tmp[len++] = '0';
+
+	if (sep)
+		buf[n++] = sep;
+
+	while (len > 0)
+		buf[n++] = tmp[--len];
+
+	buf[n] = '\0';
+
+	return n;
+}
+
+static void print_spaces(int count)
+{
+	static const char spaces[] = "                                ";
+
+	while (count > 0) {
+		int n = count < (int) sizeof(spaces) - 1 ?
+					count : (int) sizeof(spaces) - 1;
+
+		fwrite(spaces, 1, n, stdout);
+		count -= n;
+	}
+}
+
+/*
+ * Consecutive packets mostly share the same second, so the broken down
+ * local time is only computed again when the second changes.
+ */
+static const struct tm *packet_localtime(time_t t)
+{
+	static time_t cached_t = ((time_t) -1);
+	static struct tm cached_tm;
+
+	if (t != cached_t) {
+		localtime_r(&t, &cached_tm);
+		cached_t = t;
+	}
+
+	return &cached_tm;
+}
+
 static void print_packet(struct timeval *tv, struct ucred *cred, char ident,
 					uint16_t index, const char *channel,
 					const char *color, const char *label,
@@ -287,11 +324,9 @@ static void print_packet(struct timeval *tv, struct ucred *cred, char ident,
 	static size_t last_frame;
 
 	if (channel) {
-		if (use_color()) {
-			n = sprintf(ts_str + ts_pos, "%s", COLOR_CHANNEL_LABEL);
-			if (n > 0)
-				ts_pos += n;
-		}
+		if (use_color())
+			ts_pos += append_str(ts_str + ts_pos,
+						COLOR_CHANNEL_LABEL);
 
 		n = sprintf(ts_str + ts_pos, " {%s}", channel);
 		if (n > 0) {
@@ -300,27 +335,22 @@ static void print_packet(struct timeval *tv, struct ucred *cred, char ident,
 		}
 	} else if (index != HCI_DEV_NONE &&
 				index_list[index].frame != last_frame) {
-		if (use_color()) {
-			n = sprintf(ts_str + ts_pos, "%s", COLOR_FRAME_LABEL);
-			if (n > 0)
-				ts_pos += n;
-		}
+		if (use_color())
+			ts_pos += append_str(ts_str + ts_pos, COLOR_FRAME_LABEL);
+
+		ts_str[ts_pos] = ' ';
+		n = append_num(ts_str + ts_pos + 1, '#',
+					index_list[index].frame, 0) + 1;
+		ts_pos += n;
+		ts_len += n;
 
-		n = sprintf(ts_str + ts_pos, " #%zu", index_list[index].frame);
-		if (n > 0) {
-			ts_pos += n;
-			ts_len += n;
-		}
 		last_frame = index_list[index].frame;
 	}
 
 	if ((filter_mask & PACKET_FILTER_SHOW_INDEX) &&
 					index != HCI_DEV_NONE) {
-		if (use_color()) {
-			n = sprintf(ts_str + ts_pos, "%s", COLOR_INDEX_LABEL);
-			if (n > 0)
-				ts_pos += n;
-		}
+		if (use_color())
+			ts_pos += append_str(ts_str + ts_pos, COLOR_INDEX_LABEL);
 
 		n = sprintf(ts_str + ts_pos, " [hci%d]", index);
 		if (n > 0) {
@@ -330,20 +360,15 @@ static void print_packet(struct timeval *tv, struct ucred *cred, char ident,
 	}
 
 	if (tv) {
-		time_t t = tv->tv_sec;
-		struct tm tm;
+		const struct tm *tm = packet_localtime(tv->tv_sec);
 
-		localtime_r(&t, &tm);
-
-		if (use_color()) {
-			n = sprintf(ts_str + ts_pos, "%s", COLOR_TIMESTAMP);
-			if (n > 0)
-				ts_pos += n;
-		}
+		if (use_color())
+			ts_pos += append_str(ts_str + ts_pos, COLOR_TIMESTAMP);
 
 		if (filter_mask & PACKET_FILTER_SHOW_DATE) {
 			n = sprintf(ts_str + ts_pos, " %04d-%02d-%02d",
-				tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+				tm->tm_year + 1900, tm->tm_mon + 1,
+				tm->tm_mday);
 			if (n > 0) {
 				ts_pos += n;
 				ts_len += n;
@@ -351,41 +376,38 @@ static void print_packet(struct timeval *tv, struct ucred *cred, char ident,
 		}
 
 		if (filter_mask & PACKET_FILTER_SHOW_TIME) {
-			n = sprintf(ts_str + ts_pos, " %02d:%02d:%02d.%06lu",
-				tm.tm_hour, tm.tm_min, tm.tm_sec, tv->tv_usec);
-			if (n > 0) {
-				ts_pos += n;
-				ts_len += n;
-			}
+			n = append_num(ts_str + ts_pos, ' ', tm->tm_hour, 2);
+			n += append_num(ts_str + ts_pos + n, ':', tm->tm_min, 2);
+			n += append_num(ts_str + ts_pos + n, ':', tm->tm_sec, 2);
+			n += append_num(ts_str + ts_pos + n, '.', tv->tv_usec, 6);
+			ts_pos += n;
+			ts_len += n;
 		}
 
 		if (filter_mask & PACKET_FILTER_SHOW_TIME_OFFSET) {
-			n = sprintf(ts_str + ts_pos, " %lu.%06lu",
-					tv->tv_sec - time_offset, tv->tv_usec);
-			if (n > 0) {
-				ts_pos += n;
-				ts_len += n;
-			}
+			n = append_num(ts_str + ts_pos, ' ',
+					tv->tv_sec - time_offset, 0);
+			n += append_num(ts_str + ts_pos + n, '.', tv->tv_usec, 6);
+			ts_pos += n;
+			ts_len += n;
 		}
 	}
 
 	if (use_color()) {
-		n = sprintf(ts_str + ts_pos, "%s", COLOR_OFF);
-		if (n > 0)
-			ts_pos += n;
+		ts_pos += append_str(ts_str + ts_pos, COLOR_OFF);
+		pos += append_str(line + pos, color);
 	}
 
-	if (use_color()) {
-		n = sprintf(line + pos, "%s", color);
-		if (n > 0)
-			pos += n;
-	}
+	line[pos++] = ident;
+	line[pos++] = ' ';
+	len += 2;
 
-	n = sprintf(line + pos, "%c %s", ident, label ? label : "");
-	if (n > 0) {
+	if (label) {
+		n = append_str(line + pos, label);
 		pos += n;
 		len += n;
-	}
+	} else
+		line[pos] = '\0';
 
 	if (text) {
 		int extra_len = extra ? strlen(extra) : 0;
@@ -408,11 +430,8 @@ static void print_packet(struct timeval *tv, struct ucred *cred, char ident,
 		}
 	}
 
-	if (use_color()) {
-		n = sprintf(line + pos, "%s", COLOR_OFF);
-		if (n > 0)
-			pos += n;
-	}
+	if (use_color())
+		pos += append_str(line + pos, COLOR_OFF);
 
 	if (extra) {
 		n = sprintf(line + pos, " %s", extra);
@@ -422,13 +441,23 @@ static void print_packet(struct timeval *tv, struct ucred *cred, char ident,
 		}
 	}
 
+	/* One write per line instead of a printf() per piece */
+	fwrite(line, 1, pos, stdout);
+
 	if (ts_len > 0) {
-		printf("%s", line);
-		if (len < col)
-			print_space(col - len - ts_len - 1);
-		printf("%s%s\n", use_color() ? COLOR_TIMESTAMP : "", ts_str);
-	} else
-		printf("%s\n", line);
+		/* Same padding as printf("%*c", n, ' ') used to give */
+		if (len < col) {
+			n = col - len - ts_len - 1;
+			print_spaces(n ? abs(n) : 1);
+		}
+
+		if (use_color())
+			fputs(COLOR_TIMESTAMP, stdout);
+
+		fwrite(ts_str, 1, ts_pos, stdout);
+	}
+
+	putchar('\n');
 }
 
 static const struct {
@@ -4012,6 +4041,14 @@ void packet_monitor(struct timeval *tv, struct ucred *cred,
 	if (tv && time_offset == ((time_t) -1))
 		time_offset = tv->tv_sec;
 
+	if (!filter_match(tv, time_offset, index, opcode, data, size)) {
+		/* Keep frame numbers stable with and without filter */
+		if (index < MAX_INDEX && opcode >= BTSNOOP_OPCODE_COMMAND_PKT &&
+				opcode <= BTSNOOP_OPCODE_SCO_RX_PKT)
+			index_list[index].frame++;
+		return;
+	}
+
 	switch (opcode) {
 	case BTSNOOP_OPCODE_NEW_INDEX:
 		ni = data;
@@ -10129,6 +10166,18 @@ void packet_user_logging(struct timeval *tv, struct ucred *cred,
 	print_packet(tv, cred, '=', index, NULL, color, label, message, NULL);
 }
 
+const char *packet_opcode_str(uint16_t opcode)
+{
+	int i;
+
+	for (i = 0; opcode_table[i].str; i++) {
+		if (opcode_table[i].opcode == opcode)
+			return opcode_table[i].str;
+	}
+
+	return NULL;
+}
+
 void packet_hci_command(struct timeval *tv, struct ucred *cred, uint16_t index,
 					const void *data, uint16_t size)
 {
@@ -10155,6 +10204,8 @@ void packet_hci_command(struct timeval *tv, struct ucred *cred, uint16_t index,
 	data += HCI_COMMAND_HDR_SIZE;
 	size -= HCI_COMMAND_HDR_SIZE;
 
+	latency_command(tv, index, opcode);
+
 	for (i = 0; opcode_table[i].str; i++) {
 		if (opcode_table[i].opcode == opcode) {
 			opcode_data = &opcode_table[i];
@@ -10258,6 +10309,11 @@ void packet_hci_event(struct timeval *tv, struct ucred *cred, uint16_t index,
 	data += HCI_EVENT_HDR_SIZE;
 	size -= HCI_EVENT_HDR_SIZE;
 
+	if (hdr->evt == BT_HCI_EVT_CMD_COMPLETE && size >= 3)
+		latency_response(tv, index, get_le16(data + 1));
+	else if (hdr->evt == BT_HCI_EVT_CMD_STATUS && size >= 4)
+		latency_response(tv, index, get_le16(data + 2));
+
 	for (i = 0; event_table[i].str; i++) {
 		if (event_table[i].event == hdr->evt) {
 			event_data = &event_table[i];
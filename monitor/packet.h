@@ -82,6 +82,8 @@ void packet_user_logging(struct timeval *tv, struct ucred *cred,
 					uint16_t index, uint8_t priority,
 					const char *ident, const char *message);
 
+const char *packet_opcode_str(uint16_t opcode);
+
 void packet_hci_command(struct timeval *tv, struct ucred *cred, uint16_t index,
 					const void *data, uint16_t size);
 void packet_hci_event(struct timeval *tv, struct ucred *cred, uint16_t index,
@@ -0,0 +1,361 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2011-2014  Intel Corporation
+ *  Copyright (C) 2002-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <endian.h>
+
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/btsnoop.h"
+#include "src/shared/mainloop.h"
+
+#include "publish.h"
+
+/*
+ * Subscribers receive a btsnoop monitor format stream: the file header
+ * once after connecting, followed by the records as they arrive. Each
+ * subscriber has its own ring buffer, so a slow consumer only affects
+ * itself. By default records that don't fit are dropped and accounted
+ * in the drops field of the next record; a subscriber can instead ask
+ * to be disconnected by writing PUBLISH_POLICY_DISCONNECT.
+ */
+#define PUBLISH_BUFFER_SIZE	(256 * 1024)
+#define PUBLISH_MAX_SUBSCRIBERS	16
+
+#define PUBLISH_POLICY_DROP		0x00
+#define PUBLISH_POLICY_DISCONNECT	0x01
+
+struct publish_hdr {
+	uint8_t		id[8];
+	uint32_t	version;
+	uint32_t	type;
+} __attribute__ ((packed));
+
+struct publish_pkt {
+	uint32_t	size;
+	uint32_t	len;
+	uint32_t	flags;
+	uint32_t	drops;
+	uint64_t	ts;
+} __attribute__ ((packed));
+
+struct subscriber {
+	int fd;
+	uint8_t policy;
+	uint8_t *buf;
+	size_t head;
+	size_t len;
+	uint32_t drops;
+	uint32_t events;
+};
+
+static int server_fd = -1;
+static struct queue *subscribers;
+
+static void free_subscriber(void *user_data)
+{
+	struct subscriber *sub = user_data;
+
+	queue_remove(subscribers, sub);
+
+	close(sub->fd);
+
+	free(sub->buf);
+	free(sub);
+}
+
+static void set_events(struct subscriber *sub, uint32_t events)
+{
+	if (sub->events == events)
+		return;
+
+	sub->events = events;
+	mainloop_modify_fd(sub->fd, events);
+}
+
+static bool ring_flush(struct subscriber *sub)
+{
+	while (sub->len) {
+		size_t chunk = PUBLISH_BUFFER_SIZE - sub->head;
+		ssize_t written;
+
+		if (chunk > sub->len)
+			chunk = sub->len;
+
+		written = send(sub->fd, sub->buf + sub->head, chunk,
+					MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (written < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				break;
+			return false;
+		}
+
+		sub->head = (sub->head + written) % PUBLISH_BUFFER_SIZE;
+		sub->len -= written;
+	}
+
+	set_events(sub, sub->len ? EPOLLIN | EPOLLOUT : EPOLLIN);
+
+	return true;
+}
+
+static void ring_put(struct subscriber *sub, const void *data, size_t size)
+{
+	size_t tail = (sub->head + sub->len) % PUBLISH_BUFFER_SIZE;
+	size_t chunk = PUBLISH_BUFFER_SIZE - tail;
+
+	if (chunk > size)
+		chunk = size;
+
+	memcpy(sub->buf + tail, data, chunk);
+	memcpy(sub->buf, data + chunk, size - chunk);
+
+	sub->len += size;
+}
+
+static void subscriber_callback(int fd, uint32_t events, void *user_data)
+{
+	struct subscriber *sub = user_data;
+
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		mainloop_remove_fd(sub->fd);
+		return;
+	}
+
+	if (events & EPOLLIN) {
+		uint8_t policy;
+		ssize_t len;
+
+		len = recv(sub->fd, &policy, sizeof(policy), MSG_DONTWAIT);
+		if (len == 0) {
+			mainloop_remove_fd(sub->fd);
+			return;
+		}
+
+		if (len == sizeof(policy) &&
+					policy <= PUBLISH_POLICY_DISCONNECT)
+			sub->policy = policy;
+	}
+
+	if ((events & EPOLLOUT) && !ring_flush(sub))
+		mainloop_remove_fd(sub->fd);
+}
+
+static void accept_callback(int fd, uint32_t events, void *user_data)
+{
+	static const struct publish_hdr hdr = {
+		.id = { 0x62, 0x74, 0x73, 0x6e, 0x6f, 0x6f, 0x70, 0x00 },
+	};
+	struct publish_hdr shdr = hdr;
+	struct subscriber *sub;
+	int nfd;
+
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		mainloop_remove_fd(fd);
+		return;
+	}
+
+	nfd = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+	if (nfd < 0) {
+		perror("Failed to accept subscriber socket");
+		return;
+	}
+
+	if (queue_length(subscribers) >= PUBLISH_MAX_SUBSCRIBERS) {
+		fprintf(stderr, "Too many subscribers\n");
+		close(nfd);
+		return;
+	}
+
+	sub = new0(struct subscriber, 1);
+	sub->fd = nfd;
+	sub->policy = PUBLISH_POLICY_DROP;
+	sub->events = EPOLLIN;
+	sub->buf = malloc(PUBLISH_BUFFER_SIZE);
+	if (!sub->buf) {
+		free(sub);
+		close(nfd);
+		return;
+	}
+
+	shdr.version = htobe32(1);
+	shdr.type = htobe32(BTSNOOP_FORMAT_MONITOR);
+	ring_put(sub, &shdr, sizeof(shdr));
+
+	queue_push_tail(subscribers, sub);
+
+	if (mainloop_add_fd(sub->fd, sub->events, subscriber_callback,
+						sub, free_subscriber) < 0) {
+		free_subscriber(sub);
+		return;
+	}
+
+	if (!ring_flush(sub))
+		mainloop_remove_fd(sub->fd);
+}
+
+bool publish_enable(const char *path)
+{
+	struct sockaddr_un addr;
+	size_t len;
+	int fd;
+
+	if (server_fd >= 0)
+		return true;
+
+	len = strlen(path);
+	if (len > sizeof(addr.sun_path) - 1) {
+		fprintf(stderr, "Socket name too long\n");
+		return false;
+	}
+
+	unlink(path);
+
+	fd = socket(PF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("Failed to open publish socket");
+		return false;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, path, len);
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		perror("Failed to bind publish socket");
+		close(fd);
+		return false;
+	}
+
+	if (listen(fd, 5) < 0) {
+		perror("Failed to listen publish socket");
+		close(fd);
+		return false;
+	}
+
+	if (mainloop_add_fd(fd, EPOLLIN, accept_callback, NULL, NULL) < 0) {
+		close(fd);
+		return false;
+	}
+
+	subscribers = queue_new();
+	server_fd = fd;
+
+	return true;
+}
+
+static void remove_subscriber(void *data, void *user_data)
+{
+	struct subscriber *sub = data;
+
+	/* Hand over what the socket still takes before closing */
+	ring_flush(sub);
+
+	mainloop_remove_fd(sub->fd);
+}
+
+void publish_cleanup(void)
+{
+	if (server_fd < 0)
+		return;
+
+	queue_foreach(subscribers, remove_subscriber, NULL);
+	queue_destroy(subscribers, NULL);
+	subscribers = NULL;
+
+	mainloop_remove_fd(server_fd);
+	close(server_fd);
+	server_fd = -1;
+}
+
+struct publish_record {
+	struct publish_pkt pkt;
+	uint32_t drops;
+	const void *data;
+	uint16_t size;
+};
+
+static void publish_subscriber(void *data, void *user_data)
+{
+	struct subscriber *sub = data;
+	struct publish_record *rec = user_data;
+	size_t need = sizeof(rec->pkt) + rec->size;
+
+	if (sub->len + need > PUBLISH_BUFFER_SIZE) {
+		if (sub->policy == PUBLISH_POLICY_DISCONNECT) {
+			mainloop_remove_fd(sub->fd);
+			return;
+		}
+
+		sub->drops++;
+		return;
+	}
+
+	rec->pkt.drops = htobe32(rec->drops + sub->drops);
+
+	ring_put(sub, &rec->pkt, sizeof(rec->pkt));
+	ring_put(sub, rec->data, rec->size);
+
+	/* Records queued in one mainloop iteration are sent together */
+	set_events(sub, EPOLLIN | EPOLLOUT);
+}
+
+void publish_hci(const struct timeval *tv, uint16_t index, uint16_t opcode,
+			uint32_t drops, const void *data, uint16_t size)
+{
+	struct publish_record rec;
+	struct timeval ctv;
+	uint64_t ts;
+
+	if (queue_isempty(subscribers))
+		return;
+
+	if (!tv) {
+		gettimeofday(&ctv, NULL);
+		tv = &ctv;
+	}
+
+	ts = (tv->tv_sec - 946684800ll) * 1000000ll + tv->tv_usec;
+
+	rec.pkt.size = htobe32(size);
+	rec.pkt.len = htobe32(size);
+	rec.pkt.flags = htobe32((index << 16) | opcode);
+	rec.pkt.ts = htobe64(ts + 0x00E03AB44A676000ll);
+	rec.drops = drops;
+	rec.data = data;
+	rec.size = size;
+
+	queue_foreach(subscribers, publish_subscriber, &rec);
+}
@@ -454,8 +454,20 @@ static int bluetooth_getpacketopt(GIOChannel *io, int *tx_mtu, int *rx_mtu)
 	if (getsockopt(sk, SOL_SOCKET, SO_TYPE, &type, &len) < 0)
 		return -errno;
 
-	if (type != SOCK_SEQPACKET)
+	/*
+	 * RFCOMM has no MTU of its own that matters to OBEX, so offer the
+	 * same packet size as over L2CAP instead of the small gobex default,
+	 * as the server side already does. The peer's CONNECT still caps it.
+	 */
+	if (type != SOCK_SEQPACKET) {
+		if (tx_mtu)
+			*tx_mtu = BT_TX_MTU;
+
+		if (rx_mtu)
+			*rx_mtu = BT_RX_MTU;
+
 		return -EINVAL;
+	}
 
 	if (!bt_io_get(io, NULL, BT_IO_OPT_OMTU, &omtu,
 						BT_IO_OPT_IMTU, &imtu,
@@ -63,6 +63,8 @@
 #define CHARSET_NATIVE 0
 #define CHARSET_UTF8 1
 
+#define MAP_CACHE_SIZE 4
+
 static const char * const filter_list[] = {
 	"subject",
 	"timestamp",
@@ -104,14 +106,30 @@ struct map_data {
 	int16_t mas_instance_id;
 	uint8_t supported_message_types;
 	uint32_t supported_features;
+	unsigned int listing;
 };
 
 struct pending_request {
 	struct map_data *map;
 	DBusMessage *msg;
 	char *folder;
+	gboolean complete;
+};
+
+/*
+ * Messages known from a device are kept after its session goes away, so a
+ * new session to the same MAS instance can show them again right away.
+ * While connected the event reports keep them up to date; a complete
+ * listing of a folder drops the ones the device no longer reports.
+ */
+struct map_cache {
+	char *destination;
+	int16_t mas_instance_id;
+	GSList *messages;
 };
 
+static GSList *map_caches = NULL;
+
 #define MAP_MSG_FLAG_PRIORITY	0x01
 #define MAP_MSG_FLAG_READ	0x02
 #define MAP_MSG_FLAG_SENT	0x04
@@ -136,11 +154,13 @@ struct map_msg {
 	uint8_t flags;
 	char *folder;
 	GDBusPendingPropertySet pending;
+	unsigned int listing;
 };
 
 struct map_parser {
 	struct pending_request *request;
 	DBusMessageIter *iter;
+	unsigned int count;
 };
 
 static DBusConnection *conn = NULL;
@@ -1146,6 +1166,9 @@ static void msg_element(GMarkupParseContext *ctxt, const char *element,
 	g_dbus_get_properties(conn, msg->path, MAP_MSG_INTERFACE, &entry);
 
 	dbus_message_iter_close_container(iter, &entry);
+
+	msg->listing = data->listing;
+	parser->count++;
 }
 
 static const GMarkupParser msg_parser = {
@@ -1156,6 +1179,18 @@ static const GMarkupParser msg_parser = {
 	NULL
 };
 
+static gboolean msg_listing_stale(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	struct map_msg *msg = value;
+	struct pending_request *request = user_data;
+
+	if (msg->listing == request->map->listing)
+		return FALSE;
+
+	return g_strcmp0(msg->folder, request->folder) == 0;
+}
+
 static void message_listing_cb(struct obc_session *session,
 						struct obc_transfer *transfer,
 						GError *err, void *user_data)
@@ -1203,15 +1238,22 @@ static void message_listing_cb(struct obc_session *session,
 					DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
 					&array);
 
-	parser = g_new(struct map_parser, 1);
+	parser = g_new0(struct map_parser, 1);
 	parser->request = request;
 	parser->iter = &array;
 
+	request->map->listing++;
+
 	ctxt = g_markup_parse_context_new(&msg_parser, 0, parser, NULL);
 	g_markup_parse_context_parse(ctxt, contents, size, NULL);
 	g_markup_parse_context_free(ctxt);
 	dbus_message_iter_close_container(&iter, &array);
 	g_free(contents);
+
+	if (request->complete && parser->count < DEFAULT_COUNT)
+		g_hash_table_foreach_remove(request->map->messages,
+						msg_listing_stale, request);
+
 	g_free(parser);
 
 done:
@@ -1235,7 +1277,8 @@ static char *get_absolute_folder(struct map_data *map, const char *subfolder)
 static DBusMessage *get_message_listing(struct map_data *map,
 							DBusMessage *message,
 							const char *folder,
-							GObexApparam *apparam)
+							GObexApparam *apparam,
+							gboolean complete)
 {
 	struct pending_request *request;
 	struct obc_transfer *transfer;
@@ -1252,6 +1295,7 @@ static DBusMessage *get_message_listing(struct map_data *map,
 
 	request = pending_request_new(map, message);
 	request->folder = get_absolute_folder(map, folder);
+	request->complete = complete;
 
 	if (!obc_session_queue(map->session, transfer, message_listing_cb,
 							request, &err)) {
@@ -1527,6 +1571,37 @@ static GObexApparam *parse_message_filters(GObexApparam *apparam,
 	return apparam;
 }
 
+/*
+ * A listing is complete, i.e. reports every message of the folder, when
+ * no filter or offset narrows it down. Fields and SubjectLength only
+ * change what is reported for each message.
+ */
+static gboolean message_filters_complete(DBusMessageIter *iter)
+{
+	DBusMessageIter array;
+
+	if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_ARRAY)
+		return TRUE;
+
+	dbus_message_iter_recurse(iter, &array);
+
+	while (dbus_message_iter_get_arg_type(&array) == DBUS_TYPE_DICT_ENTRY) {
+		const char *key;
+		DBusMessageIter entry;
+
+		dbus_message_iter_recurse(&array, &entry);
+		dbus_message_iter_get_basic(&entry, &key);
+
+		if (strcasecmp(key, "Fields") != 0 &&
+					strcasecmp(key, "SubjectLength") != 0)
+			return FALSE;
+
+		dbus_message_iter_next(&array);
+	}
+
+	return TRUE;
+}
+
 static DBusMessage *map_list_messages(DBusConnection *connection,
 					DBusMessage *message, void *user_data)
 {
@@ -1556,7 +1631,8 @@ static DBusMessage *map_list_messages(DBusConnection *connection,
 				ERROR_INTERFACE ".InvalidArguments", NULL);
 	}
 
-	return get_message_listing(map, message, folder, apparam);
+	return get_message_listing(map, message, folder, apparam,
+					message_filters_complete(&args));
 }
 
 static char **get_filter_strs(uint64_t filter, int *size)
@@ -1978,12 +2054,135 @@ static bool set_notification_registration(struct map_data *map, bool status)
 	return false;
 }
 
+static struct map_msg *map_msg_copy(const struct map_msg *msg)
+{
+	struct map_msg *copy;
+
+	copy = g_new0(struct map_msg, 1);
+	copy->handle = msg->handle;
+	copy->subject = g_strdup(msg->subject);
+	copy->timestamp = g_strdup(msg->timestamp);
+	copy->sender = g_strdup(msg->sender);
+	copy->sender_address = g_strdup(msg->sender_address);
+	copy->replyto = g_strdup(msg->replyto);
+	copy->recipient = g_strdup(msg->recipient);
+	copy->recipient_address = g_strdup(msg->recipient_address);
+	copy->type = g_strdup(msg->type);
+	copy->size = msg->size;
+	copy->status = g_strdup(msg->status);
+	copy->attachment_size = msg->attachment_size;
+	copy->flags = msg->flags;
+	copy->folder = g_strdup(msg->folder);
+
+	return copy;
+}
+
+static void map_cache_free(void *data)
+{
+	struct map_cache *cache = data;
+
+	g_slist_free_full(cache->messages, map_msg_free);
+	g_free(cache->destination);
+	g_free(cache);
+}
+
+static struct map_cache *map_cache_steal(struct map_data *map)
+{
+	const char *destination = obc_session_get_destination(map->session);
+	GSList *l;
+
+	for (l = map_caches; l; l = l->next) {
+		struct map_cache *cache = l->data;
+
+		if (cache->mas_instance_id != map->mas_instance_id)
+			continue;
+
+		if (g_strcmp0(cache->destination, destination))
+			continue;
+
+		map_caches = g_slist_delete_link(map_caches, l);
+		return cache;
+	}
+
+	return NULL;
+}
+
+static void map_cache_store(struct map_data *map)
+{
+	struct map_cache *cache;
+	GHashTableIter iter;
+	gpointer value;
+	GSList *l;
+
+	if (map->mas_instance_id < 0 || g_hash_table_size(map->messages) == 0)
+		return;
+
+	cache = map_cache_steal(map);
+	if (cache)
+		map_cache_free(cache);
+
+	cache = g_new0(struct map_cache, 1);
+	cache->destination = g_strdup(obc_session_get_destination(
+								map->session));
+	cache->mas_instance_id = map->mas_instance_id;
+
+	g_hash_table_iter_init(&iter, map->messages);
+	while (g_hash_table_iter_next(&iter, NULL, &value))
+		cache->messages = g_slist_prepend(cache->messages,
+							map_msg_copy(value));
+
+	map_caches = g_slist_prepend(map_caches, cache);
+
+	l = g_slist_nth(map_caches, MAP_CACHE_SIZE - 1);
+	if (l && l->next) {
+		g_slist_free_full(l->next, map_cache_free);
+		l->next = NULL;
+	}
+}
+
+static void map_cache_restore(struct map_data *map)
+{
+	struct map_cache *cache;
+	GSList *l;
+
+	if (map->mas_instance_id < 0)
+		return;
+
+	cache = map_cache_steal(map);
+	if (!cache)
+		return;
+
+	DBG("restoring %u messages", g_slist_length(cache->messages));
+
+	for (l = cache->messages; l; l = l->next) {
+		struct map_msg *old = l->data;
+		struct map_msg *msg;
+		char *path;
+
+		msg = map_msg_create(map, old->handle, old->folder, NULL);
+		if (!msg)
+			continue;
+
+		/* Take over everything but the object path and owner */
+		path = msg->path;
+		g_free(msg->folder);
+		*msg = *old;
+		msg->data = map;
+		msg->path = path;
+		memset(old, 0, sizeof(*old));
+	}
+
+	map_cache_free(cache);
+}
+
 static void map_free(void *data)
 {
 	struct map_data *map = data;
 
 	set_notification_registration(map, false);
 
+	map_cache_store(map);
+
 	obc_session_unref(map->session);
 	g_hash_table_unref(map->messages);
 	g_free(map);
@@ -2047,6 +2246,8 @@ static int map_probe(struct obc_session *session)
 		return -ENOMEM;
 	}
 
+	map_cache_restore(map);
+
 	return 0;
 }
 
@@ -2092,6 +2293,9 @@ void map_exit(void)
 {
 	DBG("");
 
+	g_slist_free_full(map_caches, map_cache_free);
+	map_caches = NULL;
+
 	dbus_connection_unref(conn);
 	conn = NULL;
 
@@ -114,6 +114,9 @@ struct obc_session {
 	guint process_id;
 	char *folder;
 	struct callback_data *callback;
+	guint batch_count;	/* Transfers completed since queue was idle */
+	guint64 batch_bytes;
+	gint64 batch_start;
 };
 
 static GSList *sessions = NULL;
@@ -381,7 +384,11 @@ static void transport_func(GIOChannel *io, GError *err, gpointer user_data)
 	else
 		type = G_OBEX_TRANSPORT_STREAM;
 
-	obex = g_obex_new(io, type, tx_mtu, rx_mtu);
+	DBG("%s transport, rx_mtu %d tx_mtu %d",
+			type == G_OBEX_TRANSPORT_PACKET ? "packet" : "stream",
+			rx_mtu, tx_mtu);
+
+	obex = g_obex_new(io, type, rx_mtu, tx_mtu);
 	if (obex == NULL)
 		goto done;
 
@@ -835,9 +842,43 @@ static int session_process_transfer(struct pending_request *p, GError **err)
 
 	DBG("Tranfer(%p) started", p->transfer);
 	p->session->p = p;
+
+	if (p->session->batch_start == 0)
+		p->session->batch_start = g_get_monotonic_time();
+
 	return 0;
 }
 
+/*
+ * OBEX allows a single operation at a time per connection, so queued
+ * transfers run back to back: the next one is started from the completion
+ * of the previous one. Report the aggregate throughput once the queue
+ * drains, which is what matters for bulk pushes of many small files.
+ */
+static void session_batch_done(struct obc_session *session)
+{
+	gint64 elapsed;
+
+	if (session->batch_start == 0)
+		return;
+
+	if (session->p != NULL || (session->queue &&
+					!g_queue_is_empty(session->queue)))
+		return;
+
+	elapsed = g_get_monotonic_time() - session->batch_start;
+
+	DBG("Session(%p) %u transfers, %" G_GUINT64_FORMAT " bytes in %"
+		G_GINT64_FORMAT " ms (%" G_GUINT64_FORMAT " bytes/s)", session,
+		session->batch_count, session->batch_bytes, elapsed / 1000,
+		elapsed > 0 ? session->batch_bytes * G_USEC_PER_SEC / elapsed :
+									0);
+
+	session->batch_count = 0;
+	session->batch_bytes = 0;
+	session->batch_start = 0;
+}
+
 guint obc_session_queue(struct obc_session *session,
 				struct obc_transfer *transfer,
 				session_callback_t func, void *user_data,
@@ -927,6 +968,12 @@ static void session_terminate_transfer(struct obc_session *session,
 
 	obc_session_ref(session);
 
+	if (gerr == NULL) {
+		session->batch_count++;
+		session->batch_bytes += obc_transfer_get_transferred(
+								p->transfer);
+	}
+
 	if (p->func)
 		p->func(session, p->transfer, gerr, p->data);
 
@@ -935,6 +982,8 @@ static void session_terminate_transfer(struct obc_session *session,
 	if (session->p == NULL)
 		session_process_queue(session);
 
+	session_batch_done(session);
+
 	obc_session_unref(session);
 }
 
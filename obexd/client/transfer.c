@@ -979,3 +979,8 @@ gint64 obc_transfer_get_size(struct obc_transfer *transfer)
 {
 	return transfer->size;
 }
+
+gint64 obc_transfer_get_transferred(struct obc_transfer *transfer)
+{
+	return transfer->transferred;
+}
@@ -96,6 +96,9 @@ static void connect_event(GIOChannel *io, GError *err, void *user_data)
 							BT_IO_OPT_INVALID);
 
 done:
+	DBG("%s transport, imtu %u omtu %u", stream ? "stream" : "packet",
+								imtu, omtu);
+
 	if (obex_server_new_connection(server, io, omtu, imtu, stream) < 0)
 		g_io_channel_shutdown(io, TRUE, NULL);
 
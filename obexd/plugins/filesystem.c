@@ -193,6 +193,8 @@ static void *filesystem_open(const char *name, int oflag, mode_t mode,
 	if (oflag == O_RDONLY) {
 		if (size)
 			*size = stats.st_size;
+		/* Let the kernel read ahead of the transfer */
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 		goto done;
 	}
 
@@ -242,6 +244,11 @@ static ssize_t filesystem_read(void *object, void *buf, size_t count)
 	return ret;
 }
 
+static int filesystem_get_fd(void *object)
+{
+	return GPOINTER_TO_INT(object);
+}
+
 static ssize_t filesystem_write(void *object, const void *buf, size_t count)
 {
 	ssize_t ret;
@@ -658,6 +665,7 @@ static struct obex_mime_type_driver file = {
 	.open = filesystem_open,
 	.close = filesystem_close,
 	.read = filesystem_read,
+	.get_fd = filesystem_get_fd,
 	.write = filesystem_write,
 	.remove = remove,
 	.move = filesystem_rename,
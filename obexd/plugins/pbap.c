@@ -65,16 +65,35 @@
 #define PHONEBOOKSIZE_TAG	0X08
 #define NEWMISSEDCALLS_TAG	0X09
 
+#define PULL_CACHE_SIZE		8
+
+#define ORDER_INDEXED		0x00
+#define ORDER_ALPHANUMERIC	0x01
+#define ORDER_PHONETIC		0x02
+#define ORDER_MAX		0x03
+
+/*
+ * Besides the entries the cache keeps one sorted view per listing order,
+ * built on first use, and the result of the last search. A head unit
+ * searching as the user types sends search values that extend the
+ * previous one, so only the previous matches have to be scanned again.
+ */
 struct cache {
 	gboolean valid;
 	uint32_t index;
 	GSList *entries;
+	GSList *sorted[ORDER_MAX];
+	uint8_t search_order;
+	uint8_t search_attrib;
+	char *search_value;
+	GSList *search_result;
 };
 
 struct cache_entry {
 	uint32_t handle;
 	char *id;
 	char *name;
+	char *name_key;
 	char *sound;
 	char *tel;
 };
@@ -89,13 +108,36 @@ struct pbap_session {
 
 struct pbap_object {
 	GString *buffer;
+	size_t offset;
 	GObexApparam *apparam;
 	gboolean firstpacket;
 	gboolean lastpart;
 	struct pbap_session *session;
 	void *request;
+	char *name;
+	char *revision;
+	GString *rendered;
 };
 
+/*
+ * Rendered PullPhoneBook results are kept across sessions, so car kits
+ * pulling the same phonebook on every connection are answered without
+ * the back-end rendering the vCards again. An entry is only used while
+ * the back-end reports the same revision for the phonebook, and only
+ * for the same format, filter and range.
+ */
+struct pull_cache {
+	char *name;
+	char *revision;
+	uint64_t filter;
+	uint8_t format;
+	uint16_t maxlistcount;
+	uint16_t liststartoffset;
+	GString *buffer;
+};
+
+static GSList *pull_cache_list = NULL;
+
 static const uint8_t PBAP_TARGET[TARGET_SIZE] = {
 			0x79, 0x61, 0x35, 0xF0,  0xF0, 0xC5, 0x11, 0xD8,
 			0x09, 0x66, 0x08, 0x00,  0x20, 0x0C, 0x9A, 0x66  };
@@ -109,6 +151,7 @@ static void cache_entry_free(void *data)
 
 	g_free(entry->id);
 	g_free(entry->name);
+	g_free(entry->name_key);
 	g_free(entry->sound);
 	g_free(entry->tel);
 	g_free(entry);
@@ -117,20 +160,13 @@ static void cache_entry_free(void *data)
 static gboolean entry_name_find(const struct cache_entry *entry,
 		const char *value)
 {
-	char *name;
-	gboolean ret;
-
 	if (!entry->name)
 		return FALSE;
 
 	if (strlen(value) == 0)
 		return TRUE;
 
-	name = g_utf8_strdown(entry->name, -1);
-	ret = (g_strstr_len(name, -1, value) ? TRUE : FALSE);
-	g_free(name);
-
-	return ret;
+	return (g_strstr_len(entry->name_key, -1, value) ? TRUE : FALSE);
 }
 
 static gboolean entry_sound_find(const struct cache_entry *entry,
@@ -165,12 +201,115 @@ static const char *cache_find(struct cache *cache, uint32_t handle)
 	return NULL;
 }
 
+static void cache_search_clear(struct cache *cache)
+{
+	g_slist_free(cache->search_result);
+	cache->search_result = NULL;
+	g_free(cache->search_value);
+	cache->search_value = NULL;
+}
+
+static void cache_index_clear(struct cache *cache)
+{
+	int i;
+
+	cache_search_clear(cache);
+
+	for (i = 0; i < ORDER_MAX; i++) {
+		g_slist_free(cache->sorted[i]);
+		cache->sorted[i] = NULL;
+	}
+}
+
 static void cache_clear(struct cache *cache)
 {
+	cache_index_clear(cache);
 	g_slist_free_full(cache->entries, cache_entry_free);
 	cache->entries = NULL;
 }
 
+static void pull_cache_free(void *data)
+{
+	struct pull_cache *entry = data;
+
+	g_free(entry->name);
+	g_free(entry->revision);
+	g_string_free(entry->buffer, TRUE);
+	g_free(entry);
+}
+
+static gboolean pull_cache_match(const struct pull_cache *entry,
+					const char *name,
+					const struct apparam_field *params)
+{
+	return g_str_equal(entry->name, name) &&
+			entry->filter == params->filter &&
+			entry->format == params->format &&
+			entry->maxlistcount == params->maxlistcount &&
+			entry->liststartoffset == params->liststartoffset;
+}
+
+static struct pull_cache *pull_cache_find(const char *name,
+					const char *revision,
+					const struct apparam_field *params)
+{
+	GSList *l;
+
+	for (l = pull_cache_list; l; l = l->next) {
+		struct pull_cache *entry = l->data;
+
+		if (!pull_cache_match(entry, name, params))
+			continue;
+
+		/* Contacts have changed since it was rendered */
+		if (g_strcmp0(entry->revision, revision) != 0) {
+			pull_cache_list = g_slist_delete_link(pull_cache_list,
+									l);
+			pull_cache_free(entry);
+			return NULL;
+		}
+
+		/* Keep the most recently used first */
+		pull_cache_list = g_slist_remove_link(pull_cache_list, l);
+		pull_cache_list = g_slist_concat(l, pull_cache_list);
+
+		return entry;
+	}
+
+	return NULL;
+}
+
+static void pull_cache_store(struct pbap_object *obj)
+{
+	struct apparam_field *params = obj->session->params;
+	struct pull_cache *entry;
+	GSList *last;
+
+	if (pull_cache_find(obj->name, obj->revision, params) == NULL) {
+		entry = g_new0(struct pull_cache, 1);
+		entry->name = obj->name;
+		entry->revision = obj->revision;
+		entry->filter = params->filter;
+		entry->format = params->format;
+		entry->maxlistcount = params->maxlistcount;
+		entry->liststartoffset = params->liststartoffset;
+		entry->buffer = obj->rendered;
+
+		obj->name = NULL;
+		obj->revision = NULL;
+		obj->rendered = NULL;
+
+		pull_cache_list = g_slist_prepend(pull_cache_list, entry);
+	}
+
+	if (g_slist_length(pull_cache_list) <= PULL_CACHE_SIZE)
+		return;
+
+	last = g_slist_last(pull_cache_list);
+	pull_cache_free(last->data);
+	pull_cache_list = g_slist_delete_link(pull_cache_list, last);
+}
+
 static void phonebook_size_result(const char *buffer, size_t bufsize,
 					int vcards, int missed,
 					gboolean lastpart, void *user_data)
@@ -232,6 +371,27 @@ static void query_result(const char *buffer, size_t bufsize, int vcards,
 		pbap->obj->buffer = g_string_append_len(pbap->obj->buffer,
 							buffer,	bufsize);
 
+	/*
+	 * Unread data has to stay in place until fully consumed, so only
+	 * the already sent prefix is dropped when a new part arrives.
+	 */
+	if (pbap->obj->offset > 0) {
+		g_string_erase(pbap->obj->buffer, 0, pbap->obj->offset);
+		pbap->obj->offset = 0;
+	}
+
+	/* New missed calls are reported per pull, don't replay them */
+	if (pbap->obj->rendered && missed > 0) {
+		g_string_free(pbap->obj->rendered, TRUE);
+		pbap->obj->rendered = NULL;
+	}
+
+	if (pbap->obj->rendered) {
+		g_string_append_len(pbap->obj->rendered, buffer, bufsize);
+		if (lastpart)
+			pull_cache_store(pbap->obj);
+	}
+
 	if (missed > 0)	{
 		DBG("missed %d", missed);
 
@@ -261,10 +421,17 @@ static void cache_entry_notify(const char *id, uint32_t handle,
 
 	entry->id = g_strdup(id);
 	entry->name = g_strdup(name);
+	entry->name_key = name ? g_utf8_strdown(name, -1) : NULL;
 	entry->sound = g_strdup(sound);
 	entry->tel = g_strdup(tel);
 
-	cache->entries = g_slist_append(cache->entries, entry);
+	/*
+	 * Entries are only ever looked up or sorted, so prepending keeps
+	 * building the cache linear. The sorted views are stable and keep
+	 * equal entries newest first, as inserting them one by one did.
+	 */
+	cache_index_clear(cache);
+	cache->entries = g_slist_prepend(cache->entries, entry);
 }
 
 static int alpha_sort(gconstpointer a, gconstpointer b)
@@ -295,13 +462,9 @@ static int phonetical_sort(gconstpointer a, gconstpointer b)
 	return g_strcmp0(e1->sound, e2->sound);
 }
 
-static GSList *sort_entries(GSList *l, uint8_t order, uint8_t search_attrib,
-							const char *value)
+static GSList *cache_sorted(struct cache *cache, uint8_t order)
 {
-	GSList *sorted = NULL;
-	cache_entry_find_f find;
 	GCompareFunc sort;
-	char *searchval;
 
 	/*
 	 * Default sorter is "Indexed". Some backends doesn't inform the index,
@@ -311,17 +474,39 @@ static GSList *sort_entries(GSList *l, uint8_t order, uint8_t search_attrib,
 	 * 0x02 = phonetic
 	 */
 	switch (order) {
-	case 0x01:
+	case ORDER_ALPHANUMERIC:
 		sort = alpha_sort;
 		break;
-	case 0x02:
+	case ORDER_PHONETIC:
 		sort = phonetical_sort;
 		break;
 	default:
+		order = ORDER_INDEXED;
 		sort = indexed_sort;
 		break;
 	}
 
+	if (!cache->sorted[order] && cache->entries)
+		cache->sorted[order] = g_slist_sort(
+					g_slist_copy(cache->entries), sort);
+
+	return cache->sorted[order];
+}
+
+/*
+ * Don't free the returned list: it is owned by the cache and only holds
+ * references to the "real" cache entries.
+ */
+static GSList *sort_entries(struct cache *cache, uint8_t order,
+				uint8_t search_attrib, const char *value)
+{
+	GSList *l, *result = NULL;
+	cache_entry_find_f find;
+	char *searchval;
+
+	if (!value)
+		return cache_sorted(cache, order);
+
 	/*
 	 * This implementation checks if the given field CONTAINS the
 	 * search value(case insensitive). Name is the default field
@@ -341,19 +526,37 @@ static GSList *sort_entries(GSList *l, uint8_t order, uint8_t search_attrib,
 			break;
 	}
 
-	searchval = value ? g_utf8_strdown(value, -1) : NULL;
+	searchval = g_utf8_strdown(value, -1);
+
+	if (cache->search_value && cache->search_order == order &&
+				cache->search_attrib == search_attrib) {
+		if (g_str_equal(cache->search_value, searchval)) {
+			g_free(searchval);
+			return cache->search_result;
+		}
+
+		/* Anything containing searchval contains its substrings */
+		if (strstr(searchval, cache->search_value))
+			l = cache->search_result;
+		else
+			l = cache_sorted(cache, order);
+	} else
+		l = cache_sorted(cache, order);
+
 	for (; l; l = l->next) {
 		struct cache_entry *entry = l->data;
 
-		if (searchval && !find(entry, (const char *) searchval))
-			continue;
-
-		sorted = g_slist_insert_sorted(sorted, entry, sort);
+		if (find(entry, (const char *) searchval))
+			result = g_slist_prepend(result, entry);
 	}
 
-	g_free(searchval);
+	cache_search_clear(cache);
+	cache->search_order = order;
+	cache->search_attrib = search_attrib;
+	cache->search_value = searchval;
+	cache->search_result = g_slist_reverse(result);
 
-	return sorted;
+	return cache->search_result;
 }
 
 static int generate_response(void *user_data)
@@ -378,11 +581,7 @@ static int generate_response(void *user_data)
 		return 0;
 	}
 
-	/*
-	 * Don't free the sorted list content: this list contains
-	 * only the reference for the "real" cache entry.
-	 */
-	sorted = sort_entries(pbap->cache.entries, pbap->params->order,
+	sorted = sort_entries(&pbap->cache, pbap->params->order,
 				pbap->params->searchattrib,
 				(const char *) pbap->params->searchval);
 
@@ -402,7 +601,6 @@ static int generate_response(void *user_data)
 
 	pbap->obj->buffer = g_string_append(pbap->obj->buffer,
 							VCARD_LISTING_END);
-	g_slist_free(sorted);
 
 	return 0;
 }
@@ -661,6 +859,9 @@ static void *vobject_pull_open(const char *name, int oflag, mode_t mode,
 				void *context, size_t *size, int *err)
 {
 	struct pbap_session *pbap = context;
+	struct pbap_object *obj;
+	struct pull_cache *cached;
+	char *revision = NULL;
 	phonebook_cb cb;
 	int ret;
 	void *request;
@@ -681,6 +882,27 @@ static void *vobject_pull_open(const char *name, int oflag, mode_t mode,
 	if (pbap->params->maxlistcount == 0)
 		cb = phonebook_size_result;
 	else
+		revision = phonebook_get_revision(name);
+
+	if (revision) {
+		cached = pull_cache_find(name, revision, pbap->params);
+		if (cached) {
+			DBG("cached revision %s", revision);
+			g_free(revision);
+
+			obj = vobject_create(pbap, NULL);
+			obj->buffer = g_string_new_len(cached->buffer->str,
+							cached->buffer->len);
+			obj->lastpart = TRUE;
+
+			if (err)
+				*err = 0;
+
+			return obj;
+		}
+	}
+
+	if (pbap->params->maxlistcount != 0)
 		cb = query_result;
 
 	request = phonebook_pull(name, pbap->params, cb, pbap, &ret);
@@ -688,17 +910,31 @@ static void *vobject_pull_open(const char *name, int oflag, mode_t mode,
 	if (ret < 0)
 		goto fail;
 
+	obj = vobject_create(pbap, request);
+
+	if (revision) {
+		obj->name = g_strdup(name);
+		obj->revision = revision;
+		obj->rendered = g_string_new(NULL);
+	}
+
 	/* reading first part of results from backend */
 	ret = phonebook_pull_read(request);
-	if (ret < 0)
-		goto fail;
+	if (ret < 0) {
+		vobject_close(obj);
+		if (err)
+			*err = ret;
+		return NULL;
+	}
 
 	if (err)
 		*err = 0;
 
-	return vobject_create(pbap, request);
+	return obj;
 
 fail:
+	g_free(revision);
+
 	if (err)
 		*err = ret;
 
@@ -723,6 +959,11 @@ static int vobject_close(void *object)
 	if (obj->request)
 		phonebook_req_finalize(obj->request);
 
+	if (obj->rendered)
+		g_string_free(obj->rendered, TRUE);
+
+	g_free(obj->name);
+	g_free(obj->revision);
 	g_free(obj);
 
 	return 0;
@@ -849,6 +1090,28 @@ static ssize_t vobject_pull_get_next_header(void *object, void *buf, size_t mtu,
 	return 0;
 }
 
+/*
+ * Unlike string_read() this leaves the buffer in place and only advances
+ * the read offset, so a large part is not shifted again for every packet.
+ */
+static ssize_t object_read(struct pbap_object *obj, void *buf, size_t count)
+{
+	GString *string = obj->buffer;
+	size_t len;
+
+	if (obj->offset >= string->len) {
+		g_string_truncate(string, 0);
+		obj->offset = 0;
+		return 0;
+	}
+
+	len = MIN(string->len - obj->offset, count);
+	memcpy(buf, string->str + obj->offset, len);
+	obj->offset += len;
+
+	return len;
+}
+
 static ssize_t vobject_pull_read(void *object, void *buf, size_t count)
 {
 	struct pbap_object *obj = object;
@@ -865,7 +1128,7 @@ static ssize_t vobject_pull_read(void *object, void *buf, size_t count)
 		return -EAGAIN;
 	}
 
-	len = string_read(obj->buffer, buf, count);
+	len = object_read(obj, buf, count);
 	if (len == 0 && !obj->lastpart) {
 		/* in case when buffer is empty and we know that more
 		 * data is still available in backend, requesting new
@@ -912,7 +1175,7 @@ static ssize_t vobject_list_read(void *object, void *buf, size_t count)
 	if (pbap->params->maxlistcount == 0)
 		return -ENOSTR;
 
-	return string_read(obj->buffer, buf, count);
+	return object_read(obj, buf, count);
 }
 
 static ssize_t vobject_vcard_read(void *object, void *buf, size_t count)
@@ -924,7 +1187,7 @@ static ssize_t vobject_vcard_read(void *object, void *buf, size_t count)
 	if (!obj->buffer)
 		return -EAGAIN;
 
-	return string_read(obj->buffer, buf, count);
+	return object_read(obj, buf, count);
 }
 
 static struct obex_mime_type_driver mime_pull = {
@@ -1001,6 +1264,9 @@ static void pbap_exit(void)
 	obex_mime_type_driver_unregister(&mime_list);
 	obex_mime_type_driver_unregister(&mime_vcard);
 	phonebook_exit();
+
+	g_slist_free_full(pull_cache_list, pull_cache_free);
+	pull_cache_list = NULL;
 }
 
 OBEX_PLUGIN_DEFINE(pbap, pbap_init, pbap_exit)
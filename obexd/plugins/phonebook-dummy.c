@@ -44,6 +44,8 @@
 #include "obexd/src/log.h"
 #include "phonebook.h"
 
+#define VCARDS_PART_COUNT 50 /* amount of vcards sent at once to PBAP core */
+
 typedef void (*vcard_func_t) (const char *file, VObject *vo, void *user_data);
 
 struct dummy_data {
@@ -53,6 +55,11 @@ struct dummy_data {
 	char *folder;
 	int fd;
 	guint id;
+	gboolean pull;
+	DIR *dp;
+	GSList *files;
+	GSList *next;
+	uint16_t count;
 };
 
 struct cache_query {
@@ -71,6 +78,10 @@ static void dummy_free(void *user_data)
 	if (dummy->fd >= 0)
 		close(dummy->fd);
 
+	if (dummy->dp)
+		closedir(dummy->dp);
+
+	g_slist_free_full(dummy->files, g_free);
 	g_free(dummy->folder);
 	g_free(dummy);
 }
@@ -117,22 +128,10 @@ static int handle_cmp(gconstpointer a, gconstpointer b)
 	return (i1 - i2);
 }
 
-static int foreach_vcard(DIR *dp, vcard_func_t func, uint16_t offset,
-			uint16_t maxlistcount, void *user_data, uint16_t *count)
+static GSList *sorted_vcards(DIR *dp)
 {
 	struct dirent *ep;
-	GSList *sorted = NULL, *l;
-	VObject *v;
-	FILE *fp;
-	int err, fd, folderfd;
-	uint16_t n = 0;
-
-	folderfd = dirfd(dp);
-	if (folderfd < 0) {
-		err = errno;
-		error("dirfd(): %s(%d)", strerror(err), err);
-		return -err;
-	}
+	GSList *sorted = NULL;
 
 	/*
 	 * Sorting vcards by file name. versionsort is a GNU extension.
@@ -160,12 +159,22 @@ static int foreach_vcard(DIR *dp, vcard_func_t func, uint16_t offset,
 		sorted = g_slist_insert_sorted(sorted, filename, handle_cmp);
 	}
 
-	/*
-	 * Filtering only the requested vCards attributes. Offset
-	 * shall be based on the first entry of the phonebook.
-	 */
-	for (l = g_slist_nth(sorted, offset);
-			l && n < maxlistcount; l = l->next) {
+	return sorted;
+}
+
+/*
+ * Parses up to max vCards starting at the given list position and returns
+ * the position where the next call should continue.
+ */
+static GSList *foreach_vcard_from(int folderfd, GSList *l, vcard_func_t func,
+				uint16_t max, void *user_data, uint16_t *count)
+{
+	VObject *v;
+	FILE *fp;
+	int err, fd;
+	uint16_t n = 0;
+
+	for (; l && n < max; l = l->next) {
 		const char *filename = l->data;
 
 		fd = openat(folderfd, filename, O_RDONLY);
@@ -186,11 +195,36 @@ static int foreach_vcard(DIR *dp, vcard_func_t func, uint16_t offset,
 		close(fd);
 	}
 
-	g_slist_free_full(sorted, g_free);
-
 	if (count)
 		*count = n;
 
+	return l;
+}
+
+static int foreach_vcard(DIR *dp, vcard_func_t func, uint16_t offset,
+			uint16_t maxlistcount, void *user_data, uint16_t *count)
+{
+	GSList *sorted;
+	int err, folderfd;
+
+	folderfd = dirfd(dp);
+	if (folderfd < 0) {
+		err = errno;
+		error("dirfd(): %s(%d)", strerror(err), err);
+		return -err;
+	}
+
+	sorted = sorted_vcards(dp);
+
+	/*
+	 * Filtering only the requested vCards attributes. Offset
+	 * shall be based on the first entry of the phonebook.
+	 */
+	foreach_vcard_from(folderfd, g_slist_nth(sorted, offset), func,
+					maxlistcount, user_data, count);
+
+	g_slist_free_full(sorted, g_free);
+
 	return 0;
 }
 
@@ -213,21 +247,19 @@ static void entry_concat(const char *filename, VObject *v, void *user_data)
 	g_string_append_len(buffer, tmp, len);
 }
 
+static void entry_count(const char *filename, VObject *v, void *user_data)
+{
+}
+
 static gboolean read_dir(void *user_data)
 {
 	struct dummy_data *dummy = user_data;
 	GString *buffer;
-	DIR *dp;
-	uint16_t count = 0, max, offset;
+	vcard_func_t func;
+	uint16_t count = 0, max, offset, part;
+	gboolean lastpart;
 
-	buffer = g_string_new("");
-
-	dp = opendir(dummy->folder);
-	if (dp == NULL) {
-		int err = errno;
-		DBG("opendir(): %s(%d)", strerror(err), err);
-		goto done;
-	}
+	dummy->id = 0;
 
 	/*
 	 * For PullPhoneBook function, the decision of returning the size
@@ -238,18 +270,46 @@ static gboolean read_dir(void *user_data)
 	if (dummy->apparams->maxlistcount == 0) {
 		max = 0xffff;
 		offset = 0;
+		part = max;
+		func = entry_count;
 	} else {
 		max = dummy->apparams->maxlistcount;
 		offset = dummy->apparams->liststartoffset;
+		part = MIN(VCARDS_PART_COUNT, max - dummy->count);
+		func = entry_concat;
 	}
 
-	foreach_vcard(dp, entry_concat, offset, max, buffer, &count);
+	buffer = g_string_new("");
+
+	if (dummy->dp == NULL) {
+		dummy->dp = opendir(dummy->folder);
+		if (dummy->dp == NULL) {
+			int err = errno;
+			DBG("opendir(): %s(%d)", strerror(err), err);
+			lastpart = TRUE;
+			goto done;
+		}
+
+		dummy->files = sorted_vcards(dummy->dp);
+		dummy->next = g_slist_nth(dummy->files, offset);
+	}
+
+	/*
+	 * Contacts are rendered in parts of VCARDS_PART_COUNT, the next
+	 * part is only produced once the PBAP core drained this one.
+	 */
+	dummy->next = foreach_vcard_from(dirfd(dummy->dp), dummy->next, func,
+						part, buffer, &count);
+	dummy->count += count;
+
+	lastpart = dummy->next == NULL || dummy->count >= max;
 
-	closedir(dp);
 done:
 	/* FIXME: Missing vCards fields filtering */
-	dummy->cb(buffer->str, buffer->len, count, 0, TRUE, dummy->user_data);
+	dummy->cb(buffer->str, buffer->len, count, 0, lastpart,
+							dummy->user_data);
 
+	/* dummy may be gone already once the last part was delivered */
 	g_string_free(buffer, TRUE);
 
 	return FALSE;
@@ -447,14 +507,74 @@ done:
 	return relative;
 }
 
+char *phonebook_get_revision(const char *name)
+{
+	struct dirent *ep;
+	struct stat st;
+	char *filename, *folder;
+	guint64 latest;
+	guint count = 0;
+	DIR *dp;
+
+	filename = g_build_filename(root_folder, name, NULL);
+	if (!g_str_has_suffix(filename, ".vcf")) {
+		g_free(filename);
+		return NULL;
+	}
+
+	folder = g_strndup(filename, strlen(filename) - 4);
+	g_free(filename);
+
+	dp = opendir(folder);
+	if (dp == NULL || fstat(dirfd(dp), &st) < 0) {
+		if (dp)
+			closedir(dp);
+		g_free(folder);
+		return NULL;
+	}
+
+	/* Adding or removing entries updates the folder itself */
+	latest = st.st_mtim.tv_sec * G_GUINT64_CONSTANT(1000000000) +
+							st.st_mtim.tv_nsec;
+
+	while ((ep = readdir(dp))) {
+		guint64 mtime;
+
+		if (!g_str_has_suffix(ep->d_name, ".vcf"))
+			continue;
+
+		if (fstatat(dirfd(dp), ep->d_name, &st, 0) < 0)
+			continue;
+
+		mtime = st.st_mtim.tv_sec * G_GUINT64_CONSTANT(1000000000) +
+							st.st_mtim.tv_nsec;
+		if (mtime > latest)
+			latest = mtime;
+
+		count++;
+	}
+
+	closedir(dp);
+	g_free(folder);
+
+	return g_strdup_printf("%u-%" G_GUINT64_FORMAT, count, latest);
+}
+
 void phonebook_req_finalize(void *request)
 {
 	struct dummy_data *dummy = request;
 
+	if (!dummy)
+		return;
+
 	/* dummy_data will be cleaned when request will be finished via
 	 * g_source_remove */
-	if (dummy && dummy->id)
+	if (dummy->id)
 		g_source_remove(dummy->id);
+
+	/* Pull requests outlive their idle sources, one per part */
+	if (dummy->pull)
+		dummy_free(dummy);
 }
 
 void *phonebook_pull(const char *name, const struct apparam_field *params,
@@ -493,6 +613,7 @@ void *phonebook_pull(const char *name, const struct apparam_field *params,
 	dummy->apparams = params;
 	dummy->folder = folder;
 	dummy->fd = -1;
+	dummy->pull = TRUE;
 
 	if (err)
 		*err = 0;
@@ -507,8 +628,11 @@ int phonebook_pull_read(void *request)
 	if (!dummy)
 		return -ENOENT;
 
+	if (dummy->id)
+		return 0;
+
 	dummy->id = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, read_dir, dummy,
-								dummy_free);
+									NULL);
 
 	return 0;
 }
@@ -534,6 +534,11 @@ done:
 	return fullname;
 }
 
+char *phonebook_get_revision(const char *name)
+{
+	return NULL;
+}
+
 void phonebook_req_finalize(void *request)
 {
 	struct query_context *data = request;
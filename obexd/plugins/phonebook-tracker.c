@@ -1564,6 +1564,12 @@ static int pull_newmissedcalls(const char **reply, int num_fields,
 	return 0;
 }
 
+char *phonebook_get_revision(const char *name)
+{
+	/* Tracker doesn't expose a cheap way to detect changes */
+	return NULL;
+}
+
 void phonebook_req_finalize(void *request)
 {
 	struct phonebook_data *data = request;
@@ -154,6 +154,17 @@ void *phonebook_get_entry(const char *folder, const char *id,
 void *phonebook_create_cache(const char *name, phonebook_entry_cb entry_cb,
 		phonebook_cache_ready_cb ready_cb, void *user_data, int *err);
 
+/*
+ * Returns a string identifying the current state of the contacts in the
+ * given phonebook object, which must change whenever any of them is added,
+ * removed or modified. PBAP core uses it to serve repeated pulls of the
+ * same object from rendered vCards. Back-ends that can't tell should
+ * return NULL, then every pull is rendered again.
+ *
+ * The returned string must be freed with g_free.
+ */
+char *phonebook_get_revision(const char *name);
+
 /*
  * Finalizes request to phonebook back-end and deallocates associated
  * resources. Operation is canceled if not completed. This function MUST
@@ -446,6 +446,39 @@ static gssize send_data(void *buf, gsize size, gpointer user_data)
 	return driver_read(os, buf, size);
 }
 
+static gssize send_data_fd(int *fd, off_t *offset, gsize size,
+							gpointer user_data)
+{
+	struct obex_session *os = user_data;
+	gsize len;
+
+	DBG("name=%s type=%s file=%p size=%zu", os->name, os->type, os->object,
+									size);
+
+	if (os->aborted)
+		return os->err < 0 ? os->err : -EPERM;
+
+	if (os->object == NULL)
+		return -EIO;
+
+	if (os->service->progress != NULL)
+		os->service->progress(os, os->service_data);
+
+	*fd = os->driver->get_fd(os->object);
+	if (*fd < 0)
+		return *fd;
+
+	/* The body is sent from the file, starting where the last ended */
+	*offset = os->offset;
+
+	len = MIN(size, (gsize) (os->size - os->offset));
+	os->offset += len;
+
+	DBG("%zu referenced", len);
+
+	return len;
+}
+
 static void transfer_complete(GObex *obex, GError *err, gpointer user_data)
 {
 	struct obex_session *os = user_data;
@@ -521,8 +554,17 @@ done:
 		g_obex_packet_add_header(rsp, hdr);
 	}
 
-	g_obex_get_rsp_pkt(os->obex, rsp, send_data, transfer_complete, os,
-									NULL);
+	/*
+	 * Objects backed by a regular file of known size are sent without
+	 * copying the body through obexd.
+	 */
+	if (os->driver->get_fd && os->size != OBJECT_SIZE_UNKNOWN &&
+				os->driver->get_fd(os->object) >= 0)
+		g_obex_get_rsp_pkt_fd(os->obex, rsp, send_data_fd,
+					transfer_complete, os, NULL);
+	else
+		g_obex_get_rsp_pkt(os->obex, rsp, send_data,
+					transfer_complete, os, NULL);
 
 	os->headers_sent = TRUE;
 
@@ -46,6 +46,7 @@
 #define ATT_CID 4
 
 #define UUID_GAP 0x1800
+#define UUID_DEVINFO 0x180a
 
 struct gatt_conn {
 	struct bt_att *att;
@@ -190,54 +191,94 @@ static void att_conn_callback(int fd, uint32_t events, void *user_data)
 	printf("New device connected\n");
 }
 
-static void gap_device_name_read(struct gatt_db_attribute *attrib,
+/*
+ * The database is described by constant tables so that it is populated in
+ * a single pass with exactly the handles it needs. Values are served
+ * straight from static storage through one read handler, so nothing is
+ * allocated for them.
+ */
+struct static_value {
+	const uint8_t *data;
+	const uint8_t *len;
+};
+
+struct static_chrc {
+	uint16_t uuid;
+	uint8_t props;
+	const struct static_value *value;
+};
+
+struct static_service {
+	uint16_t uuid;
+	const struct static_chrc *chrcs;
+	unsigned int num_chrcs;
+};
+
+static const struct static_value dev_name_value = {
+	.data = dev_name,
+	.len = &dev_name_len,
+};
+
+static const struct static_chrc gap_chrcs[] = {
+	{ GATT_CHARAC_DEVICE_NAME, BT_GATT_CHRC_PROP_READ, &dev_name_value },
+};
+
+static const struct static_service static_db[] = {
+	{ UUID_GAP, gap_chrcs, sizeof(gap_chrcs) / sizeof(gap_chrcs[0]) },
+	{ UUID_DEVINFO, NULL, 0 },
+};
+
+static void static_value_read(struct gatt_db_attribute *attrib,
 					unsigned int id, uint16_t offset,
 					uint8_t opcode, struct bt_att *att,
 					void *user_data)
 {
+	const struct static_value *value = user_data;
 	uint8_t error;
-	const uint8_t *value;
+	const uint8_t *data;
 	size_t len;
 
-	if (offset > dev_name_len) {
+	if (offset > *value->len) {
 		error = BT_ATT_ERROR_INVALID_OFFSET;
-		value = NULL;
-		len = dev_name_len;
+		data = NULL;
+		len = *value->len;
 	} else {
 		error = 0;
-		len = dev_name_len - offset;
-		value = len ? &dev_name[offset] : NULL;
+		len = *value->len - offset;
+		data = len ? &value->data[offset] : NULL;
 	}
 
-	gatt_db_attribute_read_result(attrib, id, error, value, len);
+	gatt_db_attribute_read_result(attrib, id, error, data, len);
 }
 
-static void populate_gap_service(struct gatt_db *db)
+static void populate_static_db(struct gatt_db *db)
 {
-	struct gatt_db_attribute *service;
-	bt_uuid_t uuid;
-
-	bt_uuid16_create(&uuid, UUID_GAP);
-	service = gatt_db_add_service(db, &uuid, true, 6);
-
-	bt_uuid16_create(&uuid, GATT_CHARAC_DEVICE_NAME);
-	gatt_db_service_add_characteristic(service, &uuid,
-					BT_ATT_PERM_READ,
-					BT_GATT_CHRC_PROP_READ,
-					gap_device_name_read, NULL, NULL);
-
-	gatt_db_service_set_active(service, true);
-}
-
-static void populate_devinfo_service(struct gatt_db *db)
-{
-	struct gatt_db_attribute *service;
-	bt_uuid_t uuid;
-
-	bt_uuid16_create(&uuid, 0x180a);
-	service = gatt_db_add_service(db, &uuid, true, 17);
-
-	gatt_db_service_set_active(service, true);
+	unsigned int i, n;
+
+	for (i = 0; i < sizeof(static_db) / sizeof(static_db[0]); i++) {
+		const struct static_service *svc = &static_db[i];
+		struct gatt_db_attribute *service;
+		bt_uuid_t uuid;
+
+		/* Service declaration plus declaration and value per chrc */
+		bt_uuid16_create(&uuid, svc->uuid);
+		service = gatt_db_add_service(db, &uuid, true,
+						1 + svc->num_chrcs * 2);
+		if (!service)
+			continue;
+
+		for (n = 0; n < svc->num_chrcs; n++) {
+			const struct static_chrc *chrc = &svc->chrcs[n];
+
+			bt_uuid16_create(&uuid, chrc->uuid);
+			gatt_db_service_add_characteristic(service, &uuid,
+					BT_ATT_PERM_READ, chrc->props,
+					static_value_read, NULL,
+					(void *) chrc->value);
+		}
+
+		gatt_db_service_set_active(service, true);
+	}
 }
 
 void gatt_server_start(void)
@@ -281,8 +322,7 @@ void gatt_server_start(void)
 		return;
 	}
 
-	populate_gap_service(gatt_db);
-	populate_devinfo_service(gatt_db);
+	populate_static_db(gatt_db);
 
 	gatt_cache = gatt_db_new();
 
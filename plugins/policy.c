@@ -61,7 +61,10 @@ struct reconnect_data {
 	GSList *services;
 	guint timer;
 	bool active;
+	bool waiting;		/* Backoff expired, waiting for a free slot */
+	bool connecting;	/* Holds one of the reconnect slots */
 	unsigned int attempt;
+	unsigned int rate;	/* Learned success rate in percent */
 };
 
 static const char *default_reconnect[] = {
@@ -75,7 +78,11 @@ static const int default_intervals[] = { 1, 2, 4, 8, 16, 32, 64 };
 static int *reconnect_intervals = NULL;
 static size_t reconnect_intervals_len = 0;
 
+static const size_t default_concurrency = 2;
+static size_t reconnect_concurrency = 0;
+
 static GSList *reconnects = NULL;
+static guint reconnect_idle = 0;
 
 static unsigned int service_id = 0;
 static GSList *devices = NULL;
@@ -512,10 +519,101 @@ static void target_cb(struct btd_service *service,
 	}
 }
 
+static unsigned int reconnect_connecting(void)
+{
+	unsigned int count = 0;
+	GSList *l;
+
+	for (l = reconnects; l; l = g_slist_next(l)) {
+		struct reconnect_data *reconnect = l->data;
+
+		if (reconnect->connecting)
+			count++;
+	}
+
+	return count;
+}
+
+static void reconnect_reset(struct reconnect_data *reconnect);
+
+static void reconnect_start(struct reconnect_data *reconnect)
+{
+	int err;
+
+	DBG("Reconnecting profiles");
+
+	err = btd_device_connect_services(reconnect->dev, reconnect->services);
+	if (err < 0) {
+		error("Reconnecting services failed: %s (%d)",
+							strerror(-err), -err);
+		reconnect_reset(reconnect);
+		return;
+	}
+
+	reconnect->attempt++;
+	reconnect->connecting = true;
+}
+
+/*
+ * Hand out the free slots to the waiting devices that came back most
+ * often so far, the others keep waiting until a slot frees up.
+ */
+static gboolean reconnect_next(gpointer user_data)
+{
+	reconnect_idle = 0;
+
+	while (!reconnect_concurrency ||
+			reconnect_connecting() < reconnect_concurrency) {
+		struct reconnect_data *best = NULL;
+		GSList *l;
+
+		for (l = reconnects; l; l = g_slist_next(l)) {
+			struct reconnect_data *reconnect = l->data;
+
+			if (!reconnect->waiting)
+				continue;
+
+			if (!best || reconnect->rate > best->rate)
+				best = reconnect;
+		}
+
+		if (!best)
+			break;
+
+		best->waiting = false;
+		reconnect_start(best);
+	}
+
+	return FALSE;
+}
+
+static void reconnect_release(struct reconnect_data *reconnect)
+{
+	if (!reconnect->connecting)
+		return;
+
+	reconnect->connecting = false;
+
+	if (!reconnect_idle)
+		reconnect_idle = g_idle_add(reconnect_next, NULL);
+}
+
+static void reconnect_learn(struct reconnect_data *reconnect, bool success)
+{
+	/* Exponentially weighted, so recent attempts count the most */
+	reconnect->rate = (reconnect->rate * 3 + (success ? 100 : 0)) / 4;
+
+	DBG("%s success rate %u%%", device_get_path(reconnect->dev),
+							reconnect->rate);
+}
+
 static void reconnect_reset(struct reconnect_data *reconnect)
 {
 	reconnect->attempt = 0;
 	reconnect->active = false;
+	reconnect->waiting = false;
+
+	reconnect_release(reconnect);
 
 	if (reconnect->timer > 0) {
 		g_source_remove(reconnect->timer);
@@ -547,6 +645,7 @@ static struct reconnect_data *reconnect_add(struct btd_service *service)
 	if (!reconnect) {
 		reconnect = g_new0(struct reconnect_data, 1);
 		reconnect->dev = dev;
+		reconnect->rate = 100;
 		reconnects = g_slist_append(reconnects, reconnect);
 	}
 
@@ -596,6 +695,8 @@ static void reconnect_remove(struct btd_service *service)
 	if (reconnect->timer > 0)
 		g_source_remove(reconnect->timer);
 
+	reconnect_release(reconnect);
+
 	g_free(reconnect);
 }
 
@@ -640,6 +741,18 @@ static void service_cb(struct btd_service *service,
 		return;
 	}
 
+	/*
+	 * A reconnect that failed above the link layer does not trigger
+	 * conn_fail_cb, so give its slot back when the service drops.
+	 */
+	if (new_state == BTD_SERVICE_STATE_DISCONNECTED &&
+				old_state == BTD_SERVICE_STATE_CONNECTING) {
+		reconnect = reconnect_find(btd_service_get_device(service));
+		if (reconnect)
+			reconnect_release(reconnect);
+		return;
+	}
+
 	if (new_state != BTD_SERVICE_STATE_CONNECTED)
 		return;
 
@@ -649,7 +762,12 @@ static void service_cb(struct btd_service *service,
 	 */
 	reconnect = reconnect_add(service);
 
+	if (reconnect->active)
+		reconnect_learn(reconnect, true);
+
 	reconnect->active = false;
+	reconnect->waiting = false;
+	reconnect_release(reconnect);
 
 	/*
 	 * Should this device be reconnected? A matching UUID might not
@@ -665,39 +783,46 @@ static void service_cb(struct btd_service *service,
 static gboolean reconnect_timeout(gpointer data)
 {
 	struct reconnect_data *reconnect = data;
-	int err;
-
-	DBG("Reconnecting profiles");
 
 	/* Mark the GSource as invalid */
 	reconnect->timer = 0;
 
-	err = btd_device_connect_services(reconnect->dev, reconnect->services);
-	if (err < 0) {
-		error("Reconnecting services failed: %s (%d)",
-							strerror(-err), -err);
-		reconnect_reset(reconnect);
+	if (reconnect_concurrency &&
+			reconnect_connecting() >= reconnect_concurrency) {
+		DBG("Waiting for a free reconnect slot");
+		reconnect->waiting = true;
 		return FALSE;
 	}
 
-	reconnect->attempt++;
+	reconnect_start(reconnect);
 
 	return FALSE;
 }
 
 static void reconnect_set_timer(struct reconnect_data *reconnect)
 {
-	static int timeout = 0;
+	unsigned int interval = 0, timeout;
 
 	reconnect->active = true;
 
 	if (reconnect->attempt < reconnect_intervals_len)
-		timeout = reconnect_intervals[reconnect->attempt];
+		interval = reconnect_intervals[reconnect->attempt];
+	else if (reconnect_intervals_len)
+		interval = reconnect_intervals[reconnect_intervals_len - 1];
 
-	DBG("attempt %u/%zu %d seconds", reconnect->attempt + 1,
+	/*
+	 * Pick a random point in the second half of the interval so that
+	 * devices lost at the same time don't all page in lockstep, and
+	 * stretch it up to twice as long for devices that rarely come back.
+	 */
+	timeout = interval * 1000 / 2;
+	timeout += g_random_int_range(0, timeout + 1);
+	timeout = timeout * (200 - reconnect->rate) / 100;
+
+	DBG("attempt %u/%zu %u ms", reconnect->attempt + 1,
 						reconnect_attempts, timeout);
 
-	reconnect->timer = g_timeout_add_seconds(timeout, reconnect_timeout,
+	reconnect->timer = g_timeout_add(timeout, reconnect_timeout,
 								reconnect);
 }
 
@@ -735,6 +860,9 @@ static void conn_fail_cb(struct btd_device *dev, uint8_t status)
 	if (!reconnect->active)
 		return;
 
+	reconnect_learn(reconnect, false);
+	reconnect_release(reconnect);
+
 	/* Give up if we were powered off */
 	if (status == MGMT_STATUS_NOT_POWERED) {
 		reconnect_reset(reconnect);
@@ -779,6 +907,7 @@ static int policy_init(void)
 						sizeof(*reconnect_intervals);
 		reconnect_intervals = g_memdup(default_intervals,
 						sizeof(default_intervals));
+		reconnect_concurrency = default_concurrency;
 		goto done;
 	}
 
@@ -812,6 +941,14 @@ static int policy_init(void)
 						sizeof(default_intervals));
 	}
 
+	reconnect_concurrency = g_key_file_get_integer(conf, "Policy",
+							"ReconnectConcurrency",
+							&gerr);
+	if (gerr) {
+		g_clear_error(&gerr);
+		reconnect_concurrency = default_concurrency;
+	}
+
 	auto_enable = g_key_file_get_boolean(conf, "Policy", "AutoEnable",
 									NULL);
 
@@ -837,6 +974,9 @@ static void policy_exit(void)
 
 	g_free(reconnect_intervals);
 
+	if (reconnect_idle > 0)
+		g_source_remove(reconnect_idle);
+
 	g_slist_free_full(reconnects, reconnect_destroy);
 
 	g_slist_free_full(devices, policy_remove);
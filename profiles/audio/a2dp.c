@@ -38,6 +38,7 @@
 #include "lib/sdp_lib.h"
 #include "lib/uuid.h"
 
+#include "src/hcid.h"
 #include "src/plugin.h"
 #include "src/adapter.h"
 #include "src/device.h"
@@ -45,6 +46,7 @@
 #include "src/service.h"
 #include "src/log.h"
 #include "src/sdpd.h"
+#include "src/metrics.h"
 #include "src/shared/queue.h"
 
 #include "btio/btio.h"
@@ -55,6 +57,7 @@
 #include "a2dp.h"
 #include "a2dp-codecs.h"
 #include "media.h"
+#include "encoder.h"
 
 /* The duration that streams without users are allowed to stay in
  * STREAMING state. */
@@ -843,6 +846,28 @@ static gboolean suspend_timeout(struct a2dp_sep *sep)
 	return FALSE;
 }
 
+static void suspend_timer_start(struct a2dp_sep *sep, struct avdtp *session)
+{
+	if (sep->suspend_timer)
+		return;
+
+	sep->session = avdtp_ref(session);
+	sep->suspend_timer = g_timeout_add_seconds(SUSPEND_TIMEOUT,
+						(GSourceFunc) suspend_timeout,
+						sep);
+}
+
+static void suspend_timer_stop(struct a2dp_sep *sep)
+{
+	if (!sep->suspend_timer)
+		return;
+
+	g_source_remove(sep->suspend_timer);
+	sep->suspend_timer = 0;
+	avdtp_unref(sep->session);
+	sep->session = NULL;
+}
+
 static gboolean start_ind(struct avdtp *session, struct avdtp_local_sep *sep,
 				struct avdtp_stream *stream, uint8_t *err,
 				void *user_data)
@@ -855,12 +880,8 @@ static gboolean start_ind(struct avdtp *session, struct avdtp_local_sep *sep,
 	else
 		DBG("Source %p: Start_Ind", sep);
 
-	if (!a2dp_sep->locked) {
-		a2dp_sep->session = avdtp_ref(session);
-		a2dp_sep->suspend_timer = g_timeout_add_seconds(SUSPEND_TIMEOUT,
-						(GSourceFunc) suspend_timeout,
-						a2dp_sep);
-	}
+	if (!a2dp_sep->locked)
+		suspend_timer_start(a2dp_sep, session);
 
 	if (!a2dp_sep->starting)
 		return TRUE;
@@ -914,12 +935,7 @@ static gboolean suspend_ind(struct avdtp *session, struct avdtp_local_sep *sep,
 	else
 		DBG("Source %p: Suspend_Ind", sep);
 
-	if (a2dp_sep->suspend_timer) {
-		g_source_remove(a2dp_sep->suspend_timer);
-		a2dp_sep->suspend_timer = 0;
-		avdtp_unref(a2dp_sep->session);
-		a2dp_sep->session = NULL;
-	}
+	suspend_timer_stop(a2dp_sep);
 
 	if (!a2dp_sep->suspending)
 		return TRUE;
@@ -2115,19 +2131,17 @@ unsigned int a2dp_resume(struct avdtp *session, struct a2dp_sep *sep,
 		setup->start = TRUE;
 		break;
 	case AVDTP_STATE_OPEN:
-		if (avdtp_start(session, sep->stream) < 0) {
+		suspend_timer_stop(sep);
+		/* Start may already be in flight from a2dp_prestart */
+		if (!sep->starting && avdtp_start(session, sep->stream) < 0) {
 			error("avdtp_start failed");
 			goto failed;
 		}
 		sep->starting = TRUE;
 		break;
 	case AVDTP_STATE_STREAMING:
-		if (!sep->suspending && sep->suspend_timer) {
-			g_source_remove(sep->suspend_timer);
-			sep->suspend_timer = 0;
-			avdtp_unref(sep->session);
-			sep->session = NULL;
-		}
+		if (!sep->suspending)
+			suspend_timer_stop(sep);
 		if (sep->suspending)
 			setup->start = TRUE;
 		else
@@ -2174,6 +2188,16 @@ unsigned int a2dp_suspend(struct avdtp *session, struct a2dp_sep *sep,
 		cb_data->source_id = g_idle_add(finalize_suspend, setup);
 		break;
 	case AVDTP_STATE_STREAMING:
+		/*
+		 * Keep a source streaming for a while so a resume shortly
+		 * after does not need another Start round trip.
+		 */
+		if (sep->type == AVDTP_SEP_TYPE_SOURCE && !sep->suspending) {
+			suspend_timer_start(sep, session);
+			cb_data->source_id = g_idle_add(finalize_suspend,
+								setup);
+			break;
+		}
 		if (avdtp_suspend(session, sep->stream) < 0) {
 			error("avdtp_suspend failed");
 			goto failed;
@@ -2195,6 +2219,29 @@ failed:
 	return 0;
 }
 
+/*
+ * Send Start ahead of an expected resume, e.g. when the remote sends an AVRCP
+ * Play, so the stream is already up when the transport is acquired.
+ */
+void a2dp_prestart(struct avdtp *session, struct a2dp_sep *sep)
+{
+	if (sep->locked || sep->starting || sep->suspending || !sep->stream)
+		return;
+
+	if (avdtp_sep_get_state(sep->lsep) != AVDTP_STATE_OPEN)
+		return;
+
+	if (avdtp_start(session, sep->stream) < 0)
+		return;
+
+	DBG("SEP %p prestarted", sep->lsep);
+
+	sep->starting = TRUE;
+
+	/* Suspend again if nobody ends up using the stream */
+	suspend_timer_start(sep, session);
+}
+
 gboolean a2dp_cancel(unsigned int id)
 {
 	GSList *ls;
@@ -2267,6 +2314,9 @@ gboolean a2dp_sep_unlock(struct a2dp_sep *sep, struct avdtp *session)
 		/* Set timer here */
 		break;
 	case AVDTP_STATE_STREAMING:
+		/* Left streaming on standby, the timer suspends it */
+		if (sep->suspend_timer)
+			break;
 		if (avdtp_suspend(session, sep->stream) == 0)
 			sep->suspending = TRUE;
 		break;
@@ -2532,8 +2582,60 @@ static struct btd_adapter_driver media_driver = {
 	.remove		= media_server_remove,
 };
 
+static void load_audio_config(void)
+{
+	GKeyFile *conf;
+	GError *gerr = NULL;
+	int val;
+
+	conf = btd_get_main_conf();
+	if (!conf)
+		return;
+
+	val = g_key_file_get_integer(conf, "Audio", "SocketPriority", &gerr);
+	if (gerr)
+		g_clear_error(&gerr);
+	else if (val > 0)
+		avdtp_set_socket_priority(val);
+
+	val = g_key_file_get_integer(conf, "Audio", "RealtimePriority",
+									&gerr);
+	if (gerr)
+		g_clear_error(&gerr);
+	else if (val > 0)
+		media_encoder_set_rt_priority(val);
+}
+
+static void a2dp_footprint(struct btd_footprint *footprint, void *user_data)
+{
+	GSList *l;
+	unsigned int setups_len;
+
+	for (l = servers; l; l = l->next) {
+		struct a2dp_server *server = l->data;
+		unsigned int seps = queue_length(server->seps);
+		unsigned int channels = queue_length(server->channels);
+
+		footprint->objects += 1 + seps + channels;
+		footprint->bytes += sizeof(*server) +
+				seps * sizeof(struct a2dp_sep) +
+				channels * sizeof(struct a2dp_channel) +
+				queue_get_footprint(server->seps) +
+				queue_get_footprint(server->channels);
+	}
+
+	setups_len = g_slist_length(setups);
+
+	footprint->objects += setups_len;
+	footprint->bytes += setups_len * sizeof(struct a2dp_setup);
+}
+
 static int a2dp_init(void)
 {
+	load_audio_config();
+
+	btd_metrics_register_footprint("audio", a2dp_footprint, NULL);
+
 	btd_register_adapter_driver(&media_driver);
 	btd_profile_register(&a2dp_source_profile);
 	btd_profile_register(&a2dp_sink_profile);
@@ -2543,10 +2645,18 @@ static int a2dp_init(void)
 
 static void a2dp_exit(void)
 {
+	btd_metrics_unregister_footprint("audio");
+
 	btd_unregister_adapter_driver(&media_driver);
 	btd_profile_unregister(&a2dp_source_profile);
 	btd_profile_unregister(&a2dp_sink_profile);
 }
 
-BLUETOOTH_PLUGIN_DEFINE(a2dp, VERSION, BLUETOOTH_PLUGIN_PRIORITY_DEFAULT,
-							a2dp_init, a2dp_exit)
+static const char * const a2dp_uuids[] = {
+	A2DP_SOURCE_UUID,
+	A2DP_SINK_UUID,
+	NULL
+};
+
+BLUETOOTH_PLUGIN_DEFINE_LAZY(a2dp, VERSION, BLUETOOTH_PLUGIN_PRIORITY_DEFAULT,
+					a2dp_init, a2dp_exit, a2dp_uuids)
@@ -64,6 +64,15 @@
 #define CONTROL_TIMEOUT		AVC_PRESS_TIMEOUT
 #define BROWSING_TIMEOUT	10
 
+/*
+ * Control channel commands are sent one at a time since AV/C targets are
+ * not required to handle more than one outstanding command, but browsing
+ * commands are plain AVRCP PDUs matched by transaction label so a few of
+ * them can be in flight at once to hide the round trip time.
+ */
+#define CONTROL_MAX_PENDING	1
+#define BROWSING_MAX_PENDING	4
+
 #define QUIRK_NO_RELEASE 1 << 0
 
 /* Message types */
@@ -173,7 +182,8 @@ struct avctp_channel {
 	uint16_t omtu;
 	uint8_t *buffer;
 	GSList *handlers;
-	struct avctp_pending_req *p;
+	GSList *pending;
+	unsigned int max_pending;
 	GQueue *queue;
 	GSList *processed;
 	guint process_id;
@@ -522,8 +532,8 @@ static void avctp_channel_destroy(struct avctp_channel *chan)
 	if (chan->watch)
 		g_source_remove(chan->watch);
 
-	if (chan->p)
-		pending_destroy(chan->p, NULL);
+	g_slist_foreach(chan->pending, pending_destroy, NULL);
+	g_slist_free(chan->pending);
 
 	if (chan->process_id > 0)
 		g_source_remove(chan->process_id);
@@ -619,31 +629,36 @@ static void avctp_set_state(struct avctp *session, avctp_state_t new_state,
 	}
 }
 
-static uint8_t chan_get_transaction(struct avctp_channel *chan)
+static bool transaction_in_use(GSList *list, uint8_t transaction)
 {
-	GSList *l, *tmp;
-	uint8_t transaction;
-
-	if (!chan->processed)
-		goto done;
-
-	tmp = g_slist_copy(chan->processed);
+	GSList *l;
 
-	/* Find first unused transaction id */
-	for (l = tmp; l; l = g_slist_next(l)) {
+	for (l = list; l; l = g_slist_next(l)) {
 		struct avctp_pending_req *req = l->data;
 
-		if (req->transaction == chan->transaction) {
-			chan->transaction++;
-			chan->transaction %= 16;
-			tmp = g_slist_delete_link(tmp, l);
-			l = tmp;
-		}
+		if (req->transaction == transaction)
+			return true;
 	}
 
-	g_slist_free(tmp);
+	return false;
+}
+
+static uint8_t chan_get_transaction(struct avctp_channel *chan)
+{
+	uint8_t transaction;
+	int i;
+
+	/* Find first transaction id not used by an outstanding request */
+	for (i = 0; i < 16; i++) {
+		if (!transaction_in_use(chan->pending, chan->transaction) &&
+				!transaction_in_use(chan->processed,
+							chan->transaction))
+			break;
+
+		chan->transaction++;
+		chan->transaction %= 16;
+	}
 
-done:
 	transaction = chan->transaction;
 
 	chan->transaction++;
@@ -773,8 +788,8 @@ done:
 
 static gboolean req_timeout(gpointer user_data)
 {
-	struct avctp_channel *chan = user_data;
-	struct avctp_pending_req *p = chan->p;
+	struct avctp_pending_req *p = user_data;
+	struct avctp_channel *chan = p->chan;
 
 	DBG("transaction %u retry %s", p->transaction, p->retry ? "true" :
 								"false");
@@ -788,8 +803,8 @@ static gboolean req_timeout(gpointer user_data)
 
 	p->err = -ETIMEDOUT;
 
+	chan->pending = g_slist_remove(chan->pending, p);
 	pending_destroy(p, NULL);
-	chan->p = NULL;
 
 	if (chan->process_id == 0)
 		chan->process_id = g_idle_add(process_queue, chan);
@@ -813,7 +828,7 @@ static int process_control(void *data)
 		p->retry = !p->retry;
 
 	p->timeout = g_timeout_add_seconds(CONTROL_TIMEOUT, req_timeout,
-								p->chan);
+									p);
 
 	return 0;
 }
@@ -830,7 +845,7 @@ static int process_browsing(void *data)
 		return ret;
 
 	p->timeout = g_timeout_add_seconds(BROWSING_TIMEOUT, req_timeout,
-								p->chan);
+									p);
 
 	return 0;
 }
@@ -838,28 +853,54 @@ static int process_browsing(void *data)
 static gboolean process_queue(void *user_data)
 {
 	struct avctp_channel *chan = user_data;
-	struct avctp_pending_req *p = chan->p;
+	struct avctp_pending_req *p;
 
 	chan->process_id = 0;
 
-	if (p != NULL)
-		return FALSE;
+	while (g_slist_length(chan->pending) < chan->max_pending) {
+		p = g_queue_pop_head(chan->queue);
+		if (p == NULL)
+			break;
 
-	while ((p = g_queue_pop_head(chan->queue))) {
+		if (p->process(p->data) < 0) {
+			pending_destroy(p, NULL);
+			continue;
+		}
 
-		if (p->process(p->data) == 0)
-			break;
+		chan->pending = g_slist_append(chan->pending, p);
+	}
 
-		pending_destroy(p, NULL);
+	return FALSE;
+}
+
+static struct avctp_pending_req *pending_find(struct avctp_channel *chan,
+							uint8_t transaction)
+{
+	GSList *l;
+
+	for (l = chan->pending; l; l = g_slist_next(l)) {
+		struct avctp_pending_req *p = l->data;
+
+		if (p->transaction == transaction)
+			return p;
 	}
 
-	if (p == NULL)
-		return FALSE;
+	return NULL;
+}
 
-	chan->p = p;
+static void pending_complete(struct avctp_channel *chan,
+						struct avctp_pending_req *p)
+{
+	chan->pending = g_slist_remove(chan->pending, p);
+	chan->processed = g_slist_prepend(chan->processed, p);
 
-	return FALSE;
+	if (p->timeout > 0) {
+		g_source_remove(p->timeout);
+		p->timeout = 0;
+	}
 
+	if (chan->process_id == 0)
+		chan->process_id = g_idle_add(process_queue, chan);
 }
 
 static void control_response(struct avctp_channel *control,
@@ -868,30 +909,17 @@ static void control_response(struct avctp_channel *control,
 					uint8_t *operands,
 					size_t operand_count)
 {
-	struct avctp_pending_req *p = control->p;
+	struct avctp_pending_req *p;
 	struct avctp_control_req *req;
 	GSList *l;
 
-	if (p && p->transaction == avctp->transaction) {
+	p = pending_find(control, avctp->transaction);
+	if (p) {
 		req = p->data;
-		if (req->op != avc->opcode)
-			goto done;
-
-		control->processed = g_slist_prepend(control->processed, p);
-
-		if (p->timeout > 0) {
-			g_source_remove(p->timeout);
-			p->timeout = 0;
-		}
-
-		control->p = NULL;
-
-		if (control->process_id == 0)
-			control->process_id = g_idle_add(process_queue,
-								control);
+		if (req->op == avc->opcode)
+			pending_complete(control, p);
 	}
 
-done:
 	for (l = control->processed; l; l = l->next) {
 		p = l->data;
 		req = p->data;
@@ -920,24 +948,13 @@ static void browsing_response(struct avctp_channel *browsing,
 					uint8_t *operands,
 					size_t operand_count)
 {
-	struct avctp_pending_req *p = browsing->p;
+	struct avctp_pending_req *p;
 	struct avctp_browsing_req *req;
 	GSList *l;
 
-	if (p && p->transaction == avctp->transaction) {
-		browsing->processed = g_slist_prepend(browsing->processed, p);
-
-		if (p->timeout > 0) {
-			g_source_remove(p->timeout);
-			p->timeout = 0;
-		}
-
-		browsing->p = NULL;
-
-		if (browsing->process_id == 0)
-			browsing->process_id = g_idle_add(process_queue,
-								browsing);
-	}
+	p = pending_find(browsing, avctp->transaction);
+	if (p)
+		pending_complete(browsing, p);
 
 	for (l = browsing->processed; l; l = l->next) {
 		p = l->data;
@@ -1194,8 +1211,9 @@ static void init_uinput(struct avctp *session)
 }
 
 static struct avctp_channel *avctp_channel_create(struct avctp *session,
-							GIOChannel *io,
-							GDestroyNotify destroy)
+						GIOChannel *io,
+						unsigned int max_pending,
+						GDestroyNotify destroy)
 {
 	struct avctp_channel *chan;
 
@@ -1203,6 +1221,7 @@ static struct avctp_channel *avctp_channel_create(struct avctp *session,
 	chan->session = session;
 	chan->io = g_io_channel_ref(io);
 	chan->queue = g_queue_new();
+	chan->max_pending = max_pending;
 	chan->destroy = destroy;
 
 	return chan;
@@ -1258,6 +1277,7 @@ static void avctp_connect_browsing_cb(GIOChannel *chan, GError *err,
 
 	if (browsing == NULL) {
 		browsing = avctp_channel_create(session, chan,
+						BROWSING_MAX_PENDING,
 						avctp_destroy_browsing);
 		session->browsing = browsing;
 	}
@@ -1314,7 +1334,8 @@ static void avctp_connect_cb(GIOChannel *chan, GError *err, gpointer data)
 	DBG("AVCTP: connected to %s", address);
 
 	if (session->control == NULL)
-		session->control = avctp_channel_create(session, chan, NULL);
+		session->control = avctp_channel_create(session, chan,
+						CONTROL_MAX_PENDING, NULL);
 
 	session->control->imtu = imtu;
 	session->control->omtu = omtu;
@@ -1436,7 +1457,8 @@ static void avctp_control_confirm(struct avctp *session, GIOChannel *chan,
 	}
 
 	avctp_set_state(session, AVCTP_STATE_CONNECTING, 0);
-	session->control = avctp_channel_create(session, chan, NULL);
+	session->control = avctp_channel_create(session, chan,
+						CONTROL_MAX_PENDING, NULL);
 
 	src = btd_adapter_get_address(device_get_adapter(dev));
 	dst = device_get_address(dev);
@@ -2058,7 +2080,8 @@ struct avctp *avctp_connect(struct btd_device *device)
 		return NULL;
 	}
 
-	session->control = avctp_channel_create(session, io, NULL);
+	session->control = avctp_channel_create(session, io,
+						CONTROL_MAX_PENDING, NULL);
 	session->initiator = true;
 	g_io_channel_unref(io);
 
@@ -2096,6 +2119,7 @@ int avctp_connect_browsing(struct avctp *session)
 	}
 
 	session->browsing = avctp_channel_create(session, io,
+						BROWSING_MAX_PENDING,
 						avctp_destroy_browsing);
 	g_io_channel_unref(io);
 
@@ -33,6 +33,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <assert.h>
+#include <limits.h>
 
 #include <glib.h>
 
@@ -45,8 +46,11 @@
 #include "src/log.h"
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
+#include "src/shared/trace.h"
+#include "src/shared/avdtp-types.h"
 #include "src/adapter.h"
 #include "src/device.h"
+#include "src/storage.h"
 
 #include "avdtp.h"
 #include "sink.h"
@@ -61,239 +65,12 @@ static unsigned int seids;
 # define MAX(x, y) ((x) > (y) ? (x) : (y))
 #endif
 
-#define AVDTP_DISCOVER				0x01
-#define AVDTP_GET_CAPABILITIES			0x02
-#define AVDTP_SET_CONFIGURATION			0x03
-#define AVDTP_GET_CONFIGURATION			0x04
-#define AVDTP_RECONFIGURE			0x05
-#define AVDTP_OPEN				0x06
-#define AVDTP_START				0x07
-#define AVDTP_CLOSE				0x08
-#define AVDTP_SUSPEND				0x09
-#define AVDTP_ABORT				0x0A
-#define AVDTP_SECURITY_CONTROL			0x0B
-#define AVDTP_GET_ALL_CAPABILITIES		0x0C
-#define AVDTP_DELAY_REPORT			0x0D
-
-#define AVDTP_PKT_TYPE_SINGLE			0x00
-#define AVDTP_PKT_TYPE_START			0x01
-#define AVDTP_PKT_TYPE_CONTINUE			0x02
-#define AVDTP_PKT_TYPE_END			0x03
-
-#define AVDTP_MSG_TYPE_COMMAND			0x00
-#define AVDTP_MSG_TYPE_GEN_REJECT		0x01
-#define AVDTP_MSG_TYPE_ACCEPT			0x02
-#define AVDTP_MSG_TYPE_REJECT			0x03
-
 #define REQ_TIMEOUT 6
 #define SUSPEND_TIMEOUT 10
 #define ABORT_TIMEOUT 2
 #define DISCONNECT_TIMEOUT 1
 #define START_TIMEOUT 1
 
-#if __BYTE_ORDER == __LITTLE_ENDIAN
-
-struct avdtp_common_header {
-	uint8_t message_type:2;
-	uint8_t packet_type:2;
-	uint8_t transaction:4;
-} __attribute__ ((packed));
-
-struct avdtp_single_header {
-	uint8_t message_type:2;
-	uint8_t packet_type:2;
-	uint8_t transaction:4;
-	uint8_t signal_id:6;
-	uint8_t rfa0:2;
-} __attribute__ ((packed));
-
-struct avdtp_start_header {
-	uint8_t message_type:2;
-	uint8_t packet_type:2;
-	uint8_t transaction:4;
-	uint8_t no_of_packets;
-	uint8_t signal_id:6;
-	uint8_t rfa0:2;
-} __attribute__ ((packed));
-
-struct avdtp_continue_header {
-	uint8_t message_type:2;
-	uint8_t packet_type:2;
-	uint8_t transaction:4;
-} __attribute__ ((packed));
-
-struct seid_info {
-	uint8_t rfa0:1;
-	uint8_t inuse:1;
-	uint8_t seid:6;
-	uint8_t rfa2:3;
-	uint8_t type:1;
-	uint8_t media_type:4;
-} __attribute__ ((packed));
-
-struct seid {
-	uint8_t rfa0:2;
-	uint8_t seid:6;
-} __attribute__ ((packed));
-
-#elif __BYTE_ORDER == __BIG_ENDIAN
-
-struct avdtp_common_header {
-	uint8_t transaction:4;
-	uint8_t packet_type:2;
-	uint8_t message_type:2;
-} __attribute__ ((packed));
-
-struct avdtp_single_header {
-	uint8_t transaction:4;
-	uint8_t packet_type:2;
-	uint8_t message_type:2;
-	uint8_t rfa0:2;
-	uint8_t signal_id:6;
-} __attribute__ ((packed));
-
-struct avdtp_start_header {
-	uint8_t transaction:4;
-	uint8_t packet_type:2;
-	uint8_t message_type:2;
-	uint8_t no_of_packets;
-	uint8_t rfa0:2;
-	uint8_t signal_id:6;
-} __attribute__ ((packed));
-
-struct avdtp_continue_header {
-	uint8_t transaction:4;
-	uint8_t packet_type:2;
-	uint8_t message_type:2;
-} __attribute__ ((packed));
-
-struct seid_info {
-	uint8_t seid:6;
-	uint8_t inuse:1;
-	uint8_t rfa0:1;
-	uint8_t media_type:4;
-	uint8_t type:1;
-	uint8_t rfa2:3;
-} __attribute__ ((packed));
-
-struct seid {
-	uint8_t seid:6;
-	uint8_t rfa0:2;
-} __attribute__ ((packed));
-
-#else
-#error "Unknown byte order"
-#endif
-
-/* packets */
-
-struct discover_resp {
-	struct seid_info seps[0];
-} __attribute__ ((packed));
-
-struct getcap_resp {
-	uint8_t caps[0];
-} __attribute__ ((packed));
-
-struct start_req {
-	struct seid first_seid;
-	struct seid other_seids[0];
-} __attribute__ ((packed));
-
-struct suspend_req {
-	struct seid first_seid;
-	struct seid other_seids[0];
-} __attribute__ ((packed));
-
-struct seid_rej {
-	uint8_t error;
-} __attribute__ ((packed));
-
-struct conf_rej {
-	uint8_t category;
-	uint8_t error;
-} __attribute__ ((packed));
-
-#if __BYTE_ORDER == __LITTLE_ENDIAN
-
-struct seid_req {
-	uint8_t rfa0:2;
-	uint8_t acp_seid:6;
-} __attribute__ ((packed));
-
-struct setconf_req {
-	uint8_t rfa0:2;
-	uint8_t acp_seid:6;
-	uint8_t rfa1:2;
-	uint8_t int_seid:6;
-
-	uint8_t caps[0];
-} __attribute__ ((packed));
-
-struct stream_rej {
-	uint8_t rfa0:2;
-	uint8_t acp_seid:6;
-	uint8_t error;
-} __attribute__ ((packed));
-
-struct reconf_req {
-	uint8_t rfa0:2;
-	uint8_t acp_seid:6;
-
-	uint8_t serv_cap;
-	uint8_t serv_cap_len;
-
-	uint8_t caps[0];
-} __attribute__ ((packed));
-
-struct delay_req {
-	uint8_t rfa0:2;
-	uint8_t acp_seid:6;
-	uint16_t delay;
-} __attribute__ ((packed));
-
-#elif __BYTE_ORDER == __BIG_ENDIAN
-
-struct seid_req {
-	uint8_t acp_seid:6;
-	uint8_t rfa0:2;
-} __attribute__ ((packed));
-
-struct setconf_req {
-	uint8_t acp_seid:6;
-	uint8_t rfa0:2;
-	uint8_t int_seid:6;
-	uint8_t rfa1:2;
-
-	uint8_t caps[0];
-} __attribute__ ((packed));
-
-struct stream_rej {
-	uint8_t acp_seid:6;
-	uint8_t rfa0:2;
-	uint8_t error;
-} __attribute__ ((packed));
-
-struct reconf_req {
-	uint8_t acp_seid:6;
-	uint8_t rfa0:2;
-
-	uint8_t serv_cap;
-	uint8_t serv_cap_len;
-
-	uint8_t caps[0];
-} __attribute__ ((packed));
-
-struct delay_req {
-	uint8_t acp_seid:6;
-	uint8_t rfa0:2;
-	uint16_t delay;
-} __attribute__ ((packed));
-
-#else
-#error "Unknown byte order"
-#endif
-
 struct in_buf {
 	gboolean active;
 	int no_of_packets;
@@ -415,6 +192,11 @@ struct avdtp {
 
 	/* Attempt stream setup instead of disconnecting */
 	gboolean stream_setup;
+
+	/* Remote SEPs were loaded from storage and not discovered since */
+	gboolean seps_cached;
+	/* A stream setup with the cached SEPs failed, discover again */
+	gboolean seps_stale;
 };
 
 static GSList *state_callbacks = NULL;
@@ -748,6 +530,14 @@ static gboolean transport_cb(GIOChannel *chan, GIOCondition cond,
 	return FALSE;
 }
 
+/* SO_PRIORITY of the stream transports, 0 leaves the default */
+static int socket_priority;
+
+void avdtp_set_socket_priority(int priority)
+{
+	socket_priority = priority;
+}
+
 static int get_send_buffer_size(int sk)
 {
 	int size;
@@ -813,6 +603,16 @@ static void handle_transport_connect(struct avdtp *session, GIOChannel *io,
 	stream->omtu = omtu;
 	stream->imtu = imtu;
 
+	if (socket_priority > 0) {
+		bt_io_set(stream->io, &err, BT_IO_OPT_PRIORITY,
+					socket_priority, BT_IO_OPT_INVALID);
+		if (err != NULL) {
+			error("Setting socket priority failed: %s",
+								err->message);
+			g_clear_error(&err);
+		}
+	}
+
 	/* Apply special settings only if local SEP is of type SRC */
 	if (sep->info.type != AVDTP_SEP_TYPE_SOURCE)
 		goto proceed;
@@ -933,6 +733,8 @@ static void handle_unanswered_req(struct avdtp *session,
 		break;
 	case AVDTP_SET_CONFIGURATION:
 		error("No reply to SetConfiguration request");
+		if (session->seps_cached)
+			session->seps_stale = TRUE;
 		if (lsep && lsep->cfm && lsep->cfm->set_configuration)
 			lsep->cfm->set_configuration(session, lsep, stream,
 							&err, lsep->user_data);
@@ -966,6 +768,8 @@ static void avdtp_sep_set_state(struct avdtp *session,
 				avdtp_statestr(state));
 	}
 
+	BT_TRACE3(avdtp_state, stream->rseid, sep->state, state);
+
 	old_state = sep->state;
 	sep->state = state;
 
@@ -1292,6 +1096,152 @@ static GSList *caps_to_list(uint8_t *data, int size,
 	return caps;
 }
 
+static void remote_seps_filename(struct avdtp *session, char *filename)
+{
+	char local[18], peer[18];
+
+	ba2str(btd_adapter_get_address(device_get_adapter(session->device)),
+								local);
+	ba2str(device_get_address(session->device), peer);
+
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
+}
+
+static void store_remote_sep(void *data, void *user_data)
+{
+	struct avdtp_remote_sep *sep = data;
+	GKeyFile *key_file = user_data;
+	GString *value;
+	char seid[3];
+	GSList *l;
+
+	if (!sep->codec)
+		return;
+
+	value = g_string_new(NULL);
+	g_string_printf(value, "%02hhx:%02hhx:", sep->type, sep->media_type);
+
+	for (l = sep->caps; l; l = l->next) {
+		uint8_t *cap = l->data;
+		int i;
+
+		/* Category and length followed by the payload */
+		for (i = 0; i < 2 + cap[1]; i++)
+			g_string_append_printf(value, "%02hhx", cap[i]);
+	}
+
+	sprintf(seid, "%02hhx", sep->seid);
+	g_key_file_set_string(key_file, "Endpoints", seid, value->str);
+
+	g_string_free(value, TRUE);
+}
+
+static void store_remote_seps(struct avdtp *session)
+{
+	char filename[PATH_MAX];
+	GKeyFile *key_file;
+
+	remote_seps_filename(session, filename);
+
+	key_file = storage_load(filename);
+
+	g_key_file_remove_group(key_file, "Endpoints", NULL);
+	g_slist_foreach(session->seps, store_remote_sep, key_file);
+
+	storage_save(filename, key_file);
+	g_key_file_unref(key_file);
+}
+
+static struct avdtp_remote_sep *load_remote_sep(const char *key,
+							const char *value)
+{
+	struct avdtp_remote_sep *sep;
+	uint8_t caps[512];
+	uint8_t seid, type, media_type;
+	size_t i, len;
+
+	if (sscanf(key, "%02hhx", &seid) != 1 || !seid || seid > MAX_SEID)
+		return NULL;
+
+	if (strlen(value) < 6 || value[5] != ':' ||
+			sscanf(value, "%02hhx:%02hhx:", &type, &media_type) != 2)
+		return NULL;
+
+	if (type != AVDTP_SEP_TYPE_SOURCE && type != AVDTP_SEP_TYPE_SINK)
+		return NULL;
+
+	value += 6;
+	len = strlen(value) / 2;
+	if (len > sizeof(caps))
+		return NULL;
+
+	for (i = 0; i < len; i++) {
+		if (sscanf(value + i * 2, "%02hhx", &caps[i]) != 1)
+			return NULL;
+	}
+
+	sep = g_new0(struct avdtp_remote_sep, 1);
+	sep->seid = seid;
+	sep->type = type;
+	sep->media_type = media_type;
+	sep->caps = caps_to_list(caps, len, &sep->codec,
+						&sep->delay_reporting);
+
+	if (!sep->codec) {
+		sep_free(sep);
+		return NULL;
+	}
+
+	return sep;
+}
+
+/*
+ * Use the SEPs found on the last connection so a known device can go
+ * straight to SetConfiguration without Discover and GetCapabilities.
+ */
+static void load_remote_seps(struct avdtp *session)
+{
+	char filename[PATH_MAX];
+	GKeyFile *key_file;
+	char **keys;
+	int i;
+
+	remote_seps_filename(session, filename);
+
+	key_file = storage_load(filename);
+
+	keys = g_key_file_get_keys(key_file, "Endpoints", NULL, NULL);
+
+	for (i = 0; keys && keys[i]; i++) {
+		struct avdtp_remote_sep *sep;
+		char *value;
+
+		value = g_key_file_get_string(key_file, "Endpoints", keys[i],
+									NULL);
+		if (!value)
+			continue;
+
+		sep = load_remote_sep(keys[i], value);
+		g_free(value);
+
+		if (!sep || find_remote_sep(session->seps, sep->seid)) {
+			if (sep)
+				sep_free(sep);
+			continue;
+		}
+
+		DBG("seid %d type %d media %d", sep->seid, sep->type,
+							sep->media_type);
+
+		session->seps = g_slist_append(session->seps, sep);
+	}
+
+	g_strfreev(keys);
+	g_key_file_unref(key_file);
+
+	session->seps_cached = session->seps != NULL;
+}
+
 static gboolean avdtp_unknown_cmd(struct avdtp *session, uint8_t transaction,
 							uint8_t signal_id)
 {
@@ -2362,6 +2312,8 @@ struct avdtp *avdtp_new(GIOChannel *chan, struct btd_device *device,
 
 	session->version = get_version(session);
 
+	load_remote_seps(session);
+
 	if (!chan)
 		return session;
 
@@ -2488,6 +2440,8 @@ static int cancel_request(struct avdtp *session, int err)
 		break;
 	case AVDTP_SET_CONFIGURATION:
 		error("SetConfiguration: %s (%d)", strerror(err), err);
+		if (session->seps_cached)
+			session->seps_stale = TRUE;
 		if (lsep && lsep->cfm && lsep->cfm->set_configuration)
 			lsep->cfm->set_configuration(session, lsep, stream,
 							&averr, lsep->user_data);
@@ -2843,8 +2797,12 @@ static gboolean avdtp_parse_resp(struct avdtp *session,
 		if (!avdtp_get_capabilities_resp(session, buf, size))
 			return FALSE;
 		if (!(next && (next->signal_id == AVDTP_GET_CAPABILITIES ||
-				next->signal_id == AVDTP_GET_ALL_CAPABILITIES)))
+				next->signal_id == AVDTP_GET_ALL_CAPABILITIES))) {
+			session->seps_cached = FALSE;
+			session->seps_stale = FALSE;
+			store_remote_seps(session);
 			finalize_discovery(session, 0);
+		}
 		return TRUE;
 	}
 
@@ -3193,6 +3151,31 @@ static gboolean process_discover(gpointer data)
 	return FALSE;
 }
 
+/*
+ * The cached SEPs no longer match the device, drop the ones not in use so
+ * the next discovery starts over.
+ */
+static void remove_unused_seps(struct avdtp *session)
+{
+	GSList *l, *next;
+
+	DBG("cached remote SEPs are stale");
+
+	for (l = session->seps; l; l = next) {
+		struct avdtp_remote_sep *sep = l->data;
+
+		next = l->next;
+
+		if (sep->stream)
+			continue;
+
+		session->seps = g_slist_delete_link(session->seps, l);
+		sep_free(sep);
+	}
+
+	session->seps_cached = FALSE;
+}
+
 int avdtp_discover(struct avdtp *session, avdtp_discover_cb_t cb,
 			void *user_data)
 {
@@ -3201,9 +3184,12 @@ int avdtp_discover(struct avdtp *session, avdtp_discover_cb_t cb,
 	if (session->discover)
 		return -EBUSY;
 
+	if (session->seps_stale)
+		remove_unused_seps(session);
+
 	session->discover = g_new0(struct discover_callback, 1);
 
-	if (session->seps) {
+	if (session->seps && !session->seps_stale) {
 		session->discover->cb = cb;
 		session->discover->user_data = user_data;
 		session->discover->id = g_idle_add(process_discover, session);
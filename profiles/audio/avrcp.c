@@ -217,14 +217,28 @@ struct avrcp_server {
 	GSList *sessions;
 };
 
+/*
+ * Encoded GetElementAttributes response body, shared by the player cache
+ * and any fragmented response still being sent from it.
+ */
+struct element_attrs {
+	unsigned int ref_count;
+	uint32_t *ids;
+	uint8_t count;
+	size_t *hdr_pos;
+	size_t size;
+	uint8_t *data;
+};
+
 struct pending_pdu {
 	uint8_t pdu_id;
-	GList *attr_ids;
-	uint16_t offset;
+	struct element_attrs *attrs;
+	size_t offset;
 };
 
 struct pending_list_items {
-	GSList *items;
+	GSList *items;		/* In reverse order until complete */
+	GHashTable *listed;
 	uint32_t start;
 	uint32_t end;
 	uint64_t total;
@@ -246,6 +260,8 @@ struct avrcp_player {
 	struct pending_list_items *p;
 	char *change_path;
 
+	struct element_attrs *elements;	/* Cache, reset on track change */
+
 	struct avrcp_player_cb *cb;
 	void *user_data;
 	GDestroyNotify destroy;
@@ -676,6 +692,11 @@ void avrcp_player_event(struct avrcp_player *player, uint8_t id,
 	int attr;
 	int val;
 
+	if (id == AVRCP_EVENT_TRACK_CHANGED) {
+		element_attrs_unref(player->elements);
+		player->elements = NULL;
+	}
+
 	if (player->sessions == NULL)
 		return;
 
@@ -805,98 +826,190 @@ static const char *player_get_metadata(struct avrcp_player *player,
 	return NULL;
 }
 
-static uint16_t player_write_media_attribute(struct avrcp_player *player,
-						uint32_t id, uint8_t *buf,
-						uint16_t *pos,
-						uint16_t *offset)
-{
+struct media_attribute_header {
+	uint32_t id;
+	uint16_t charset;
 	uint16_t len;
-	uint16_t attr_len;
-	const char *value = NULL;
+} __attribute__ ((packed));
+
+static struct element_attrs *element_attrs_new(struct avrcp_player *player,
+							GList *attr_ids)
+{
+	struct element_attrs *attrs;
+	GList *l;
+	size_t size = 0;
+	unsigned int i;
 
-	DBG("%u", id);
+	attrs = g_new0(struct element_attrs, 1);
+	attrs->ref_count = 1;
+	attrs->count = g_list_length(attr_ids);
+	attrs->ids = g_new(uint32_t, attrs->count);
+	attrs->hdr_pos = g_new(size_t, attrs->count);
 
-	value = player_get_metadata(player, id);
-	if (value == NULL) {
-		*offset = 0;
-		return 0;
+	for (l = attr_ids, i = 0; l; l = l->next, i++) {
+		const char *value;
+
+		attrs->ids[i] = GPOINTER_TO_UINT(l->data);
+
+		value = player_get_metadata(player, attrs->ids[i]);
+		size += sizeof(struct media_attribute_header);
+		if (value)
+			size += MIN(strlen(value), UINT16_MAX);
 	}
 
-	attr_len = strlen(value);
-	value = ((char *) value) + *offset;
-	len = attr_len - *offset;
+	attrs->data = g_malloc(size);
 
-	if (len > AVRCP_PDU_MTU - *pos) {
-		len = AVRCP_PDU_MTU - *pos;
-		*offset += len;
-	} else {
-		*offset = 0;
+	for (i = 0; i < attrs->count; i++) {
+		struct media_attribute_header *hdr;
+		const char *value;
+		uint16_t len = 0;
+
+		DBG("%u", attrs->ids[i]);
+
+		attrs->hdr_pos[i] = attrs->size;
+
+		value = player_get_metadata(player, attrs->ids[i]);
+		if (value)
+			len = MIN(strlen(value), UINT16_MAX);
+
+		hdr = (void *) &attrs->data[attrs->size];
+		hdr->id = htonl(attrs->ids[i]);
+		/* Always use UTF-8 */
+		hdr->charset = htons(AVRCP_CHARSET_UTF8);
+		hdr->len = htons(len);
+		attrs->size += sizeof(*hdr);
+
+		if (len)
+			memcpy(&attrs->data[attrs->size], value, len);
+
+		attrs->size += len;
 	}
 
-	memcpy(&buf[*pos], value, len);
-	*pos += len;
+	return attrs;
+}
+
+static struct element_attrs *element_attrs_ref(struct element_attrs *attrs)
+{
+	attrs->ref_count++;
 
-	return attr_len;
+	return attrs;
 }
 
-static GList *player_fill_media_attribute(struct avrcp_player *player,
-					GList *attr_ids, uint8_t *buf,
-					uint16_t *pos, uint16_t *offset)
+static void element_attrs_unref(struct element_attrs *attrs)
 {
-	struct media_attribute_header {
-		uint32_t id;
-		uint16_t charset;
-		uint16_t len;
-	} *hdr = NULL;
+	if (attrs == NULL || --attrs->ref_count > 0)
+		return;
+
+	g_free(attrs->ids);
+	g_free(attrs->hdr_pos);
+	g_free(attrs->data);
+	g_free(attrs);
+}
+
+static bool element_attrs_match(struct element_attrs *attrs, GList *attr_ids)
+{
+	unsigned int i;
 	GList *l;
 
-	for (l = attr_ids; l != NULL; l = g_list_delete_link(l, l)) {
-		uint32_t attr = GPOINTER_TO_UINT(l->data);
-		uint16_t attr_len;
+	if (g_list_length(attr_ids) != attrs->count)
+		return false;
 
-		if (*offset == 0) {
-			if (*pos + sizeof(*hdr) >= AVRCP_PDU_MTU)
-				break;
+	for (l = attr_ids, i = 0; l; l = l->next, i++) {
+		if (attrs->ids[i] != GPOINTER_TO_UINT(l->data))
+			return false;
+	}
 
-			hdr = (void *) &buf[*pos];
-			hdr->id = htonl(attr);
-			/* Always use UTF-8 */
-			hdr->charset = htons(AVRCP_CHARSET_UTF8);
-			*pos += sizeof(*hdr);
-		}
+	return true;
+}
+
+/*
+ * Controllers tend to poll the same attributes over and over, so keep the
+ * last encoded response until the metadata changes.
+ */
+static struct element_attrs *player_get_element_attrs(
+						struct avrcp_player *player,
+						GList *attr_ids)
+{
+	struct element_attrs *attrs;
+
+	if (player == NULL)
+		return element_attrs_new(NULL, attr_ids);
+
+	if (player->elements && element_attrs_match(player->elements,
+								attr_ids))
+		return element_attrs_ref(player->elements);
+
+	attrs = element_attrs_new(player, attr_ids);
 
-		attr_len = player_write_media_attribute(player, attr, buf,
-								pos, offset);
+	element_attrs_unref(player->elements);
+	player->elements = element_attrs_ref(attrs);
 
-		if (hdr != NULL)
-			hdr->len = htons(attr_len);
+	return attrs;
+}
 
-		if (*offset > 0)
+/*
+ * Copies as much of the response as fits in the PDU starting at offset.
+ * Attribute values may be split across fragments but headers never are.
+ * Returns true if there is more left to send.
+ */
+static bool element_attrs_fill(struct element_attrs *attrs, uint8_t *buf,
+					uint16_t *pos, size_t *offset)
+{
+	size_t end = *offset + AVRCP_PDU_MTU - *pos;
+	unsigned int i;
+
+	if (end > attrs->size)
+		end = attrs->size;
+
+	for (i = 0; i < attrs->count; i++) {
+		size_t hdr = attrs->hdr_pos[i];
+
+		if (hdr < *offset)
+			continue;
+
+		if (hdr >= end)
+			break;
+
+		if (*pos + (hdr - *offset) +
+				sizeof(struct media_attribute_header) >=
+							AVRCP_PDU_MTU) {
+			end = hdr;
 			break;
+		}
 	}
 
-	return l;
+	memcpy(&buf[*pos], &attrs->data[*offset], end - *offset);
+	*pos += end - *offset;
+	*offset = end;
+
+	return end < attrs->size;
 }
 
-static struct pending_pdu *pending_pdu_new(uint8_t pdu_id, GList *attr_ids,
-							unsigned int offset)
+static struct pending_pdu *pending_pdu_new(uint8_t pdu_id,
+						struct element_attrs *attrs,
+						size_t offset)
 {
 	struct pending_pdu *pending = g_new(struct pending_pdu, 1);
 
 	pending->pdu_id = pdu_id;
-	pending->attr_ids = attr_ids;
+	pending->attrs = attrs;
 	pending->offset = offset;
 
 	return pending;
 }
 
+static void pending_pdu_free(struct pending_pdu *pending)
+{
+	element_attrs_unref(pending->attrs);
+	g_free(pending);
+}
+
 static gboolean session_abort_pending_pdu(struct avrcp *session)
 {
 	if (session->pending_pdu == NULL)
 		return FALSE;
 
-	g_list_free(session->pending_pdu->attr_ids);
-	g_free(session->pending_pdu);
+	pending_pdu_free(session->pending_pdu);
 	session->pending_pdu = NULL;
 
 	return TRUE;
@@ -1126,7 +1239,8 @@ static uint8_t avrcp_handle_get_element_attributes(struct avrcp *session,
 	uint16_t pos;
 	uint8_t nattr;
 	GList *attr_ids;
-	uint16_t offset;
+	struct element_attrs *attrs;
+	size_t offset;
 
 	if (len < 9 || identifier != 0)
 		goto err;
@@ -1166,16 +1280,19 @@ static uint8_t avrcp_handle_get_element_attributes(struct avrcp *session,
 	if (!len)
 		goto err;
 
+	attrs = player_get_element_attrs(player, attr_ids);
+	g_list_free(attr_ids);
+
 	session_abort_pending_pdu(session);
 	pos = 1;
 	offset = 0;
-	attr_ids = player_fill_media_attribute(player, attr_ids, pdu->params,
-								&pos, &offset);
 
-	if (attr_ids != NULL) {
-		session->pending_pdu = pending_pdu_new(pdu->pdu_id, attr_ids,
+	if (element_attrs_fill(attrs, pdu->params, &pos, &offset)) {
+		session->pending_pdu = pending_pdu_new(pdu->pdu_id, attrs,
 								offset);
 		pdu->packet_type = AVRCP_PACKET_TYPE_START;
+	} else {
+		element_attrs_unref(attrs);
 	}
 
 	pdu->params[0] = len;
@@ -1435,6 +1552,9 @@ static bool avrcp_handle_play(struct avrcp *session)
 	if (player == NULL)
 		return false;
 
+	/* Playback is about to resume, get the stream started meanwhile */
+	media_transport_prestart(session->dev);
+
 	return player->cb->play(player->user_data);
 }
 
@@ -1611,7 +1731,6 @@ static uint8_t avrcp_handle_request_continuing(struct avrcp *session,
 						struct avrcp_header *pdu,
 						uint8_t transaction)
 {
-	struct avrcp_player *player = target_get_player(session);
 	uint16_t len = ntohs(pdu->params_len);
 	struct pending_pdu *pending;
 
@@ -1625,14 +1744,11 @@ static uint8_t avrcp_handle_request_continuing(struct avrcp *session,
 
 
 	len = 0;
-	pending->attr_ids = player_fill_media_attribute(player,
-							pending->attr_ids,
-							pdu->params, &len,
-							&pending->offset);
 	pdu->pdu_id = pending->pdu_id;
 
-	if (pending->attr_ids == NULL) {
-		g_free(session->pending_pdu);
+	if (!element_attrs_fill(pending->attrs, pdu->params, &len,
+							&pending->offset)) {
+		pending_pdu_free(pending);
 		session->pending_pdu = NULL;
 		pdu->packet_type = AVRCP_PACKET_TYPE_END;
 	} else {
@@ -2527,15 +2643,16 @@ static gboolean avrcp_list_items_rsp(struct avctp *conn, uint8_t *operands,
 			item = parse_media_folder(session, &operands[i], len);
 
 		if (item) {
-			if (g_slist_find(p->items, item))
+			if (g_hash_table_lookup(p->listed, item))
 				goto done;
-			p->items = g_slist_append(p->items, item);
+			g_hash_table_add(p->listed, item);
+			p->items = g_slist_prepend(p->items, item);
 		}
 
 		i += len;
 	}
 
-	items = g_slist_length(p->items);
+	items = g_hash_table_size(p->listed);
 
 	DBG("start %u end %u items %" PRIu64 " total %" PRIu64 "", p->start,
 						p->end, items, p->total);
@@ -2546,9 +2663,11 @@ static gboolean avrcp_list_items_rsp(struct avctp *conn, uint8_t *operands,
 	}
 
 done:
+	p->items = g_slist_reverse(p->items);
 	media_player_list_complete(player->user_data, p->items, err);
 
 	g_slist_free(p->items);
+	g_hash_table_destroy(p->listed);
 	g_free(p);
 	player->p = NULL;
 
@@ -2993,6 +3112,7 @@ static int ct_list_items(struct media_player *mp, const char *name,
 	avrcp_list_items(session, start, end);
 
 	p = g_new0(struct pending_list_items, 1);
+	p->listed = g_hash_table_new(NULL, NULL);
 	p->start = start;
 	p->end = end;
 	p->total = (uint64_t) (p->end - p->start) + 1;
@@ -3437,6 +3557,7 @@ static void player_destroy(gpointer data)
 	if (player->changed_id > 0)
 		g_source_remove(player->changed_id);
 
+	element_attrs_unref(player->elements);
 	g_slist_free(player->sessions);
 	g_free(player->path);
 	g_free(player->change_path);
@@ -4584,5 +4705,11 @@ static void avrcp_exit(void)
 	btd_profile_unregister(&avrcp_target_profile);
 }
 
-BLUETOOTH_PLUGIN_DEFINE(avrcp, VERSION, BLUETOOTH_PLUGIN_PRIORITY_DEFAULT,
-							avrcp_init, avrcp_exit)
+static const char * const avrcp_uuids[] = {
+	AVRCP_REMOTE_UUID,
+	AVRCP_TARGET_UUID,
+	NULL
+};
+
+BLUETOOTH_PLUGIN_DEFINE_LAZY(avrcp, VERSION, BLUETOOTH_PLUGIN_PRIORITY_DEFAULT,
+					avrcp_init, avrcp_exit, avrcp_uuids)
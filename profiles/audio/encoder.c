@@ -0,0 +1,690 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <time.h>
+
+#include <sbc/sbc.h>
+
+#include "src/log.h"
+#include "src/shared/util.h"
+#include "src/shared/io.h"
+#include "src/shared/queue.h"
+
+#include "a2dp-codecs.h"
+#include "encoder.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC		0x0001U
+#endif
+
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING	0x0002U
+#endif
+
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS		1033
+#endif
+
+#ifndef F_SEAL_SHRINK
+#define F_SEAL_SHRINK		0x0002
+#define F_SEAL_GROW		0x0004
+#endif
+
+/*
+ * Clients write interleaved 16 bit little endian PCM into a ring shared
+ * through a memfd. The file starts with the header below followed by the
+ * ring data. Positions are free running byte counters modulo 2^32: the
+ * client only advances write_pos once the data is in place and the daemon
+ * only advances read_pos once it has encoded the data.
+ */
+struct pcm_ring {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t channels;
+	uint32_t rate;
+	uint32_t size;			/* Ring data size, a power of two */
+	uint32_t frame_size;		/* PCM bytes per SBC frame */
+	uint32_t underruns;		/* Packets skipped for lack of data */
+	uint32_t dropped;		/* Packets dropped by a full link */
+	uint32_t reserved0;
+	uint32_t write_pos;
+	uint32_t reserved1[3];
+	uint32_t read_pos;
+	uint32_t reserved2[3];
+};
+
+#define PCM_RING_MAGIC		0x4d435042	/* "BPCM" */
+#define PCM_RING_VERSION	1
+
+/* Default ring size in packets worth of PCM */
+#define PCM_RING_PACKETS	32
+
+#define MAX_FRAMES_IN_PAYLOAD	15
+
+/* Packets sent at most per timer expiration to catch up after a stall */
+#define MAX_BURST		4
+
+#define RTP_HDR_LEN		12
+#define RTP_PAYLOAD_TYPE	96
+#define SBC_HDR_LEN		1
+
+/*
+ * Transports with the same configuration share one encoder: every packet is
+ * encoded once and sent to all of them. Sends never block so a congested
+ * sink only drops its own packets.
+ */
+struct encoder_sink {
+	int fd;
+	uint16_t mtu;
+	uint64_t packets;
+	uint64_t bytes;
+	unsigned int dropped;
+	unsigned int errors;
+};
+
+struct media_encoder {
+	sbc_t sbc;
+	uint8_t config[sizeof(a2dp_sbc_t)];
+	struct queue *sinks;
+	size_t packet_len;
+	int memfd;
+	struct pcm_ring *ring;
+	uint8_t *data;
+	size_t map_size;
+	struct io *timer;
+	size_t in_frame_len;
+	size_t out_frame_len;
+	unsigned int frames_per_packet;
+	unsigned int samples_per_frame;
+	uint8_t *packet;
+	uint8_t *frame;
+	uint16_t mtu;
+	bool rt;
+	uint16_t seq;
+	uint32_t timestamp;
+	uint64_t encoded;		/* Packets encoded */
+	uint64_t encode_time;		/* Time spent encoding them, in us */
+};
+
+/*
+ * Encoding runs on the main loop, so while any encoder exists the daemon
+ * can be switched to SCHED_FIFO with rt_priority and have its encoder
+ * buffers locked in memory.
+ */
+static int rt_priority;
+static unsigned int encoders;
+static int saved_policy = -1;
+static struct sched_param saved_param;
+
+static void rt_enter(void)
+{
+	struct sched_param param;
+
+	if (!rt_priority || encoders++)
+		return;
+
+	saved_policy = sched_getscheduler(0);
+	if (saved_policy < 0 || sched_getparam(0, &saved_param) < 0) {
+		saved_policy = -1;
+		return;
+	}
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = rt_priority;
+
+	if (sched_setscheduler(0, SCHED_FIFO, &param) < 0) {
+		error("Unable to set realtime priority: %s (%d)",
+						strerror(errno), errno);
+		saved_policy = -1;
+		return;
+	}
+
+	DBG("realtime priority %d", rt_priority);
+}
+
+static void rt_leave(void)
+{
+	if (!rt_priority || !encoders || --encoders)
+		return;
+
+	if (saved_policy < 0)
+		return;
+
+	if (sched_setscheduler(0, saved_policy, &saved_param) < 0)
+		error("Unable to restore scheduling: %s (%d)",
+						strerror(errno), errno);
+
+	saved_policy = -1;
+}
+
+static void encoder_lock(struct media_encoder *encoder)
+{
+	/* Best effort, RLIMIT_MEMLOCK may not allow it */
+	if (mlock(encoder->ring, encoder->map_size) < 0 ||
+			mlock(encoder->packet, encoder->mtu) < 0 ||
+			mlock(encoder->frame, encoder->in_frame_len) < 0)
+		DBG("mlock: %s (%d)", strerror(errno), errno);
+}
+
+void media_encoder_set_rt_priority(int priority)
+{
+	int max = sched_get_priority_max(SCHED_FIFO);
+
+	rt_priority = priority > max ? max : priority;
+}
+
+static int sbc_freq2int(uint8_t freq)
+{
+	switch (freq) {
+	case SBC_SAMPLING_FREQ_16000:
+		return 16000;
+	case SBC_SAMPLING_FREQ_32000:
+		return 32000;
+	case SBC_SAMPLING_FREQ_44100:
+		return 44100;
+	case SBC_SAMPLING_FREQ_48000:
+		return 48000;
+	default:
+		return 0;
+	}
+}
+
+static uint32_t align_power2(uint32_t u)
+{
+	uint32_t size = 1;
+
+	while (size < u)
+		size <<= 1;
+
+	return size;
+}
+
+static int pcm_memfd(void)
+{
+#ifdef SYS_memfd_create
+	return syscall(SYS_memfd_create, "bluez-pcm",
+					MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static bool ring_setup(struct media_encoder *encoder, uint32_t rate,
+							uint16_t channels)
+{
+	uint32_t size;
+	void *addr;
+
+	size = align_power2(encoder->in_frame_len * encoder->frames_per_packet *
+							PCM_RING_PACKETS);
+
+	encoder->memfd = pcm_memfd();
+	if (encoder->memfd < 0)
+		return false;
+
+	encoder->map_size = sizeof(struct pcm_ring) + size;
+
+	if (ftruncate(encoder->memfd, encoder->map_size) < 0)
+		return false;
+
+	/* Clients must not be able to resize the mapping under us */
+	if (fcntl(encoder->memfd, F_ADD_SEALS,
+					F_SEAL_SHRINK | F_SEAL_GROW) < 0)
+		return false;
+
+	addr = mmap(NULL, encoder->map_size, PROT_READ | PROT_WRITE,
+					MAP_SHARED, encoder->memfd, 0);
+	if (addr == MAP_FAILED)
+		return false;
+
+	encoder->ring = addr;
+	encoder->data = (uint8_t *) addr + sizeof(struct pcm_ring);
+
+	encoder->ring->magic = PCM_RING_MAGIC;
+	encoder->ring->version = PCM_RING_VERSION;
+	encoder->ring->channels = channels;
+	encoder->ring->rate = rate;
+	encoder->ring->size = size;
+	encoder->ring->frame_size = encoder->in_frame_len;
+
+	return true;
+}
+
+/* Returns the next frame of PCM, copying it out if it wraps the ring */
+static const uint8_t *ring_peek(struct media_encoder *encoder,
+							uint32_t offset)
+{
+	struct pcm_ring *ring = encoder->ring;
+	uint32_t pos = (ring->read_pos + offset) & (ring->size - 1);
+	size_t len = ring->size - pos;
+
+	if (len >= encoder->in_frame_len)
+		return encoder->data + pos;
+
+	memcpy(encoder->frame, encoder->data + pos, len);
+	memcpy(encoder->frame + len, encoder->data,
+					encoder->in_frame_len - len);
+
+	return encoder->frame;
+}
+
+static void sink_send(void *data, void *user_data)
+{
+	struct encoder_sink *sink = data;
+	struct media_encoder *encoder = user_data;
+	ssize_t ret;
+
+	ret = send(sink->fd, encoder->packet, encoder->packet_len,
+						MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (ret < 0) {
+		/* Drop rather than queue so latency stays bounded */
+		encoder->ring->dropped++;
+
+		if (errno == EAGAIN) {
+			sink->dropped++;
+			return;
+		}
+
+		sink->errors++;
+		DBG("send: %s (%d)", strerror(errno), errno);
+		return;
+	}
+
+	sink->packets++;
+	sink->bytes += ret;
+}
+
+static uint64_t time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void send_packet(struct media_encoder *encoder)
+{
+	struct pcm_ring *ring = encoder->ring;
+	uint8_t *payload = encoder->packet + RTP_HDR_LEN + SBC_HDR_LEN;
+	size_t avail, encoded = 0;
+	unsigned int frames = 0;
+	uint32_t consumed = 0;
+	uint64_t start;
+
+	avail = (uint32_t) (__atomic_load_n(&ring->write_pos,
+						__ATOMIC_ACQUIRE) -
+							ring->read_pos);
+
+	/* Ignore positions that make no sense instead of overreading */
+	if (avail > ring->size)
+		avail = 0;
+
+	start = time_us();
+
+	while (frames < encoder->frames_per_packet &&
+				avail - consumed >= encoder->in_frame_len) {
+		ssize_t written = 0;
+		ssize_t len;
+
+		len = sbc_encode(&encoder->sbc, ring_peek(encoder, consumed),
+					encoder->in_frame_len,
+					payload + encoded,
+					encoder->out_frame_len, &written);
+		if (len < 0) {
+			error("SBC: failed to encode frame (%zd)", len);
+			break;
+		}
+
+		consumed += len;
+		encoded += written;
+		frames++;
+	}
+
+	__atomic_store_n(&ring->read_pos, ring->read_pos + consumed,
+							__ATOMIC_RELEASE);
+
+	if (!frames) {
+		ring->underruns++;
+		return;
+	}
+
+	encoder->encoded++;
+	encoder->encode_time += time_us() - start;
+
+	encoder->packet[0] = 0x80;
+	encoder->packet[1] = RTP_PAYLOAD_TYPE;
+	put_be16(encoder->seq++, encoder->packet + 2);
+	put_be32(encoder->timestamp, encoder->packet + 4);
+	put_be32(1, encoder->packet + 8);
+	encoder->packet[RTP_HDR_LEN] = frames;
+
+	encoder->timestamp += frames * encoder->samples_per_frame;
+
+	encoder->packet_len = RTP_HDR_LEN + SBC_HDR_LEN + encoded;
+
+	queue_foreach(encoder->sinks, sink_send, encoder);
+}
+
+static bool timer_expired(struct io *io, void *user_data)
+{
+	struct media_encoder *encoder = user_data;
+	uint64_t expired;
+	unsigned int i;
+
+	if (read(io_get_fd(io), &expired, sizeof(expired)) !=
+							sizeof(expired))
+		return true;
+
+	for (i = 0; i < expired && i < MAX_BURST; i++)
+		send_packet(encoder);
+
+	return true;
+}
+
+static bool timer_setup(struct media_encoder *encoder)
+{
+	struct itimerspec its;
+	unsigned int duration;
+	int fd;
+
+	/* Frame duration is in microseconds */
+	duration = sbc_get_frame_duration(&encoder->sbc) *
+						encoder->frames_per_packet;
+	if (!duration)
+		return false;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	its.it_interval.tv_sec = duration / 1000000;
+	its.it_interval.tv_nsec = (duration % 1000000) * 1000;
+	its.it_value = its.it_interval;
+
+	if (timerfd_settime(fd, 0, &its, NULL) < 0) {
+		close(fd);
+		return false;
+	}
+
+	encoder->timer = io_new(fd);
+	if (!encoder->timer) {
+		close(fd);
+		return false;
+	}
+
+	io_set_close_on_destroy(encoder->timer, true);
+
+	return io_set_read_handler(encoder->timer, timer_expired, encoder,
+									NULL);
+}
+
+struct media_encoder *media_encoder_new(const uint8_t *config, size_t size,
+						int fd, uint16_t mtu)
+{
+	const a2dp_sbc_t *sbc = (const a2dp_sbc_t *) config;
+	struct media_encoder *encoder;
+	uint16_t channels;
+
+	if (size != sizeof(*sbc) || mtu <= RTP_HDR_LEN + SBC_HDR_LEN)
+		return NULL;
+
+	encoder = new0(struct media_encoder, 1);
+	encoder->sinks = queue_new();
+	encoder->memfd = -1;
+
+	memcpy(encoder->config, config, size);
+
+	if (sbc_init_a2dp(&encoder->sbc, 0L, config, size) < 0) {
+		free(encoder);
+		return NULL;
+	}
+
+	encoder->sbc.endian = SBC_LE;
+	encoder->sbc.bitpool = sbc->max_bitpool;
+
+	encoder->in_frame_len = sbc_get_codesize(&encoder->sbc);
+	encoder->out_frame_len = sbc_get_frame_length(&encoder->sbc);
+	if (!encoder->in_frame_len || !encoder->out_frame_len)
+		goto failed;
+
+	encoder->frames_per_packet = (mtu - RTP_HDR_LEN - SBC_HDR_LEN) /
+						encoder->out_frame_len;
+	if (!encoder->frames_per_packet)
+		goto failed;
+
+	if (encoder->frames_per_packet > MAX_FRAMES_IN_PAYLOAD)
+		encoder->frames_per_packet = MAX_FRAMES_IN_PAYLOAD;
+
+	channels = sbc->channel_mode == SBC_CHANNEL_MODE_MONO ? 1 : 2;
+	encoder->samples_per_frame = encoder->in_frame_len / (channels * 2);
+
+	encoder->mtu = mtu;
+	encoder->packet = malloc(mtu);
+	encoder->frame = malloc(encoder->in_frame_len);
+	if (!encoder->packet || !encoder->frame)
+		goto failed;
+
+	if (!ring_setup(encoder, sbc_freq2int(sbc->frequency), channels))
+		goto failed;
+
+	if (!timer_setup(encoder))
+		goto failed;
+
+	media_encoder_add_sink(encoder, config, size, fd, mtu);
+
+	if (rt_priority) {
+		encoder->rt = true;
+		encoder_lock(encoder);
+		rt_enter();
+	}
+
+	DBG("mtu %u frames %u frame length %zu ring %u", mtu,
+				encoder->frames_per_packet,
+				encoder->out_frame_len, encoder->ring->size);
+
+	return encoder;
+
+failed:
+	media_encoder_free(encoder);
+	return NULL;
+}
+
+void media_encoder_free(struct media_encoder *encoder)
+{
+	if (!encoder)
+		return;
+
+	if (encoder->rt) {
+		munlock(encoder->packet, encoder->mtu);
+		munlock(encoder->frame, encoder->in_frame_len);
+		rt_leave();
+	}
+
+	io_destroy(encoder->timer);
+	queue_destroy(encoder->sinks, free);
+
+	if (encoder->ring)
+		munmap(encoder->ring, encoder->map_size);
+
+	if (encoder->memfd >= 0)
+		close(encoder->memfd);
+
+	sbc_finish(&encoder->sbc);
+
+	free(encoder->packet);
+	free(encoder->frame);
+	free(encoder);
+}
+
+int media_encoder_get_fd(struct media_encoder *encoder)
+{
+	if (!encoder)
+		return -1;
+
+	return encoder->memfd;
+}
+
+bool media_encoder_add_sink(struct media_encoder *encoder,
+					const uint8_t *config, size_t size,
+					int fd, uint16_t mtu)
+{
+	struct encoder_sink *sink;
+	size_t max_len;
+
+	if (!encoder || size != sizeof(encoder->config) ||
+				memcmp(config, encoder->config, size))
+		return false;
+
+	/* Packets are shared, so they must fit the MTU of every sink */
+	max_len = RTP_HDR_LEN + SBC_HDR_LEN +
+			encoder->frames_per_packet * encoder->out_frame_len;
+	if (mtu < max_len)
+		return false;
+
+	sink = new0(struct encoder_sink, 1);
+	sink->fd = fd;
+	sink->mtu = mtu;
+
+	queue_push_tail(encoder->sinks, sink);
+
+	DBG("fd %d mtu %u sinks %u", fd, mtu,
+					queue_length(encoder->sinks));
+
+	return true;
+}
+
+static bool match_sink_fd(const void *data, const void *match_data)
+{
+	const struct encoder_sink *sink = data;
+
+	return sink->fd == PTR_TO_INT(match_data);
+}
+
+bool media_encoder_remove_sink(struct media_encoder *encoder, int fd)
+{
+	struct encoder_sink *sink;
+
+	if (!encoder)
+		return false;
+
+	sink = queue_remove_if(encoder->sinks, match_sink_fd, INT_TO_PTR(fd));
+	if (sink) {
+		DBG("fd %d packets %" PRIu64 " dropped %u errors %u", fd,
+				sink->packets, sink->dropped, sink->errors);
+		free(sink);
+	}
+
+	return !queue_isempty(encoder->sinks);
+}
+
+/*
+ * For Bluetooth sockets TIOCOUTQ reports the free space left in the send
+ * buffer, so what is still queued is SO_SNDBUF minus that.
+ */
+static unsigned int sink_queued(int fd)
+{
+	socklen_t optlen = sizeof(int);
+	int sndbuf, space;
+
+	if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &optlen) < 0)
+		return 0;
+
+	if (ioctl(fd, TIOCOUTQ, &space) < 0 || space >= sndbuf)
+		return 0;
+
+	return sndbuf - space;
+}
+
+/*
+ * Time in microseconds for a sample written to the ring now to be handed to
+ * the controller: what is already buffered in the ring, one packet worth of
+ * frames being collected and the packets still queued in the socket of fd.
+ */
+unsigned int media_encoder_get_latency(struct media_encoder *encoder, int fd)
+{
+	struct pcm_ring *ring;
+	unsigned int frame_duration, max_len;
+	uint32_t avail;
+
+	if (!encoder)
+		return 0;
+
+	ring = encoder->ring;
+	frame_duration = sbc_get_frame_duration(&encoder->sbc);
+
+	avail = __atomic_load_n(&ring->write_pos, __ATOMIC_ACQUIRE) -
+							ring->read_pos;
+	if (avail > ring->size)
+		avail = 0;
+
+	max_len = RTP_HDR_LEN + SBC_HDR_LEN +
+			encoder->frames_per_packet * encoder->out_frame_len;
+
+	return (avail / encoder->in_frame_len) * frame_duration +
+			encoder->frames_per_packet * frame_duration +
+			(sink_queued(fd) / max_len) *
+			encoder->frames_per_packet * frame_duration;
+}
+
+bool media_encoder_get_stats(struct media_encoder *encoder, int fd,
+					struct media_encoder_stats *stats)
+{
+	struct encoder_sink *sink;
+
+	if (!encoder)
+		return false;
+
+	sink = queue_find(encoder->sinks, match_sink_fd, INT_TO_PTR(fd));
+	if (!sink)
+		return false;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->packets = sink->packets;
+	stats->bytes = sink->bytes;
+	stats->dropped = sink->dropped;
+	stats->errors = sink->errors;
+	stats->underruns = encoder->ring->underruns;
+	stats->queued = sink_queued(fd);
+
+	if (encoder->encoded)
+		stats->encode_time = encoder->encode_time / encoder->encoded;
+
+	return true;
+}
@@ -0,0 +1,96 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+struct media_encoder;
+
+struct media_encoder_stats {
+	uint64_t packets;		/* Packets sent to the sink */
+	uint64_t bytes;			/* Bytes sent to the sink */
+	unsigned int dropped;		/* Packets dropped on a full socket */
+	unsigned int errors;		/* Packets failing to be sent */
+	unsigned int underruns;		/* Packets skipped for lack of PCM */
+	unsigned int encode_time;	/* Average per packet, in us */
+	unsigned int queued;		/* Bytes queued in the socket */
+};
+
+#ifdef HAVE_SBC_ENCODER
+
+struct media_encoder *media_encoder_new(const uint8_t *config, size_t size,
+						int fd, uint16_t mtu);
+void media_encoder_free(struct media_encoder *encoder);
+int media_encoder_get_fd(struct media_encoder *encoder);
+bool media_encoder_add_sink(struct media_encoder *encoder,
+					const uint8_t *config, size_t size,
+					int fd, uint16_t mtu);
+bool media_encoder_remove_sink(struct media_encoder *encoder, int fd);
+unsigned int media_encoder_get_latency(struct media_encoder *encoder, int fd);
+bool media_encoder_get_stats(struct media_encoder *encoder, int fd,
+					struct media_encoder_stats *stats);
+void media_encoder_set_rt_priority(int priority);
+
+#else
+
+static inline struct media_encoder *media_encoder_new(const uint8_t *config,
+						size_t size, int fd,
+						uint16_t mtu)
+{
+	return NULL;
+}
+
+static inline void media_encoder_free(struct media_encoder *encoder)
+{
+}
+
+static inline int media_encoder_get_fd(struct media_encoder *encoder)
+{
+	return -1;
+}
+
+static inline bool media_encoder_add_sink(struct media_encoder *encoder,
+					const uint8_t *config, size_t size,
+					int fd, uint16_t mtu)
+{
+	return false;
+}
+
+static inline bool media_encoder_remove_sink(struct media_encoder *encoder,
+									int fd)
+{
+	return false;
+}
+
+static inline unsigned int media_encoder_get_latency(
+					struct media_encoder *encoder, int fd)
+{
+	return 0;
+}
+
+static inline bool media_encoder_get_stats(struct media_encoder *encoder,
+					int fd, struct media_encoder_stats *stats)
+{
+	return false;
+}
+
+static inline void media_encoder_set_rt_priority(int priority)
+{
+}
+
+#endif
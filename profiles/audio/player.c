@@ -49,6 +49,13 @@
 #define MEDIA_FOLDER_INTERFACE "org.bluez.MediaFolder1"
 #define MEDIA_ITEM_INTERFACE "org.bluez.MediaItem1"
 
+/*
+ * Items listed in a folder are kept in least recently listed order and the
+ * oldest are destroyed once there are more than this, so browsing large
+ * libraries doesn't grow without bounds.
+ */
+#define MAX_FOLDER_ITEMS 1024
+
 struct player_callback {
 	const struct media_player_callback *cbs;
 	void *user_data;
@@ -69,6 +76,7 @@ struct media_item {
 	bool			playable;	/* Item playable flag */
 	uint64_t		uid;		/* Item uid */
 	GHashTable		*metadata;	/* Item metadata */
+	GList			link;		/* Folder items link */
 };
 
 struct media_folder {
@@ -76,7 +84,8 @@ struct media_folder {
 	struct media_item	*item;		/* Folder item */
 	uint32_t		number_of_items;/* Number of items */
 	GSList			*subfolders;
-	GSList			*items;
+	GQueue			items;		/* Most recently listed first */
+	GHashTable		*index;		/* Items by uid */
 	DBusMessage		*msg;
 };
 
@@ -569,6 +578,77 @@ static DBusMessage *media_player_rewind(DBusConnection *conn, DBusMessage *msg,
 	return g_dbus_create_reply(msg, DBUS_TYPE_INVALID);
 }
 
+static void media_item_free(struct media_item *item)
+{
+	if (item->metadata != NULL)
+		g_hash_table_unref(item->metadata);
+
+	g_free(item->path);
+	g_free(item->name);
+	g_free(item);
+}
+
+static void media_item_destroy(void *data)
+{
+	struct media_item *item = data;
+
+	DBG("%s", item->path);
+
+	g_dbus_unregister_interface(btd_get_dbus_connection(), item->path,
+						MEDIA_ITEM_INTERFACE);
+
+	media_item_free(item);
+}
+
+static void media_folder_remove_item(struct media_folder *folder,
+						struct media_item *item)
+{
+	g_queue_unlink(&folder->items, &item->link);
+
+	if (folder->index && item->uid > 0)
+		g_hash_table_remove(folder->index, &item->uid);
+
+	media_item_destroy(item);
+}
+
+static void media_folder_clear_items(struct media_folder *folder)
+{
+	while (folder->items.tail)
+		media_folder_remove_item(folder, folder->items.tail->data);
+
+	if (folder->index) {
+		g_hash_table_destroy(folder->index);
+		folder->index = NULL;
+	}
+}
+
+/* Moves the items just listed to the front of the folder */
+static void media_folder_touch_items(struct media_folder *folder,
+								GSList *items)
+{
+	GSList *l;
+
+	for (l = items; l; l = l->next) {
+		struct media_item *item = l->data;
+
+		/* Folder items are not on the list */
+		if (item->type == PLAYER_ITEM_TYPE_FOLDER)
+			continue;
+
+		g_queue_unlink(&folder->items, &item->link);
+		g_queue_push_head_link(&folder->items, &item->link);
+	}
+}
+
+static void media_folder_evict_items(struct media_folder *folder,
+							unsigned int keep)
+{
+	keep = MAX(keep, MAX_FOLDER_ITEMS);
+
+	while (folder->items.length > keep)
+		media_folder_remove_item(folder, folder->items.tail->data);
+}
+
 static void parse_folder_list(gpointer data, gpointer user_data)
 {
 	struct media_item *item = data;
@@ -644,6 +724,12 @@ void media_player_list_complete(struct media_player *mp, GSList *items,
 	g_slist_foreach(items, parse_folder_list, &array);
 	dbus_message_iter_close_container(&iter, &array);
 
+	media_folder_touch_items(folder, items);
+
+	/* Items of the current playlist must stay around */
+	if (folder != mp->playlist)
+		media_folder_evict_items(folder, g_slist_length(items));
+
 done:
 	g_dbus_send_message(btd_get_dbus_connection(), reply);
 	dbus_message_unref(folder->msg);
@@ -869,34 +955,12 @@ static DBusMessage *media_folder_list_items(DBusConnection *conn,
 	return NULL;
 }
 
-static void media_item_free(struct media_item *item)
-{
-	if (item->metadata != NULL)
-		g_hash_table_unref(item->metadata);
-
-	g_free(item->path);
-	g_free(item->name);
-	g_free(item);
-}
-
-static void media_item_destroy(void *data)
-{
-	struct media_item *item = data;
-
-	DBG("%s", item->path);
-
-	g_dbus_unregister_interface(btd_get_dbus_connection(), item->path,
-						MEDIA_ITEM_INTERFACE);
-
-	media_item_free(item);
-}
-
 static void media_folder_destroy(void *data)
 {
 	struct media_folder *folder = data;
 
 	g_slist_free_full(folder->subfolders, media_folder_destroy);
-	g_slist_free_full(folder->items, media_item_destroy);
+	media_folder_clear_items(folder);
 
 	if (folder->msg != NULL)
 		dbus_message_unref(folder->msg);
@@ -927,8 +991,7 @@ static void media_player_change_scope(struct media_player *mp,
 		goto done;
 
 cleanup:
-	g_slist_free_full(mp->scope->items, media_item_destroy);
-	mp->scope->items = NULL;
+	media_folder_clear_items(mp->scope);
 
 	/* Destroy search folder if it exists and is not being set as scope */
 	if (mp->search != NULL && folder != mp->search) {
@@ -1462,19 +1525,10 @@ void media_player_set_playlist(struct media_player *mp, const char *name)
 static struct media_item *media_folder_find_item(struct media_folder *folder,
 								uint64_t uid)
 {
-	GSList *l;
-
-	if (uid == 0)
+	if (uid == 0 || folder->index == NULL)
 		return NULL;
 
-	for (l = folder->items; l; l = l->next) {
-		struct media_item *item = l->data;
-
-		if (item->uid == uid)
-			return item;
-	}
-
-	return NULL;
+	return g_hash_table_lookup(folder->index, &uid);
 }
 
 static DBusMessage *media_item_play(DBusConnection *conn, DBusMessage *msg,
@@ -1783,7 +1837,17 @@ static struct media_item *media_folder_create_item(struct media_player *mp,
 	}
 
 	if (type != PLAYER_ITEM_TYPE_FOLDER) {
-		folder->items = g_slist_prepend(folder->items, item);
+		item->link.data = item;
+		g_queue_push_head_link(&folder->items, &item->link);
+
+		if (uid > 0) {
+			if (folder->index == NULL)
+				folder->index = g_hash_table_new(g_int64_hash,
+								g_int64_equal);
+
+			g_hash_table_insert(folder->index, &item->uid, item);
+		}
+
 		item->metadata = g_hash_table_new_full(g_str_hash, g_str_equal,
 							g_free, g_free);
 	}
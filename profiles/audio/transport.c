@@ -26,6 +26,7 @@
 #include <config.h>
 #endif
 
+#include <stdlib.h>
 #include <errno.h>
 
 #include <glib.h>
@@ -44,6 +45,7 @@
 #include "src/error.h"
 #include "src/shared/queue.h"
 
+#include "a2dp-codecs.h"
 #include "avdtp.h"
 #include "media.h"
 #include "transport.h"
@@ -51,9 +53,15 @@
 #include "sink.h"
 #include "source.h"
 #include "avrcp.h"
+#include "encoder.h"
 
 #define MEDIA_TRANSPORT_INTERFACE "org.bluez.MediaTransport1"
 
+/* Latency is resampled this often, in seconds, while encoding */
+#define LATENCY_INTERVAL 1
+/* Smaller latency changes, in 1/10 ms, are not signalled */
+#define LATENCY_THRESHOLD 10
+
 typedef enum {
 	TRANSPORT_STATE_IDLE,		/* Not acquired and suspended */
 	TRANSPORT_STATE_PENDING,	/* Playing but not acquired */
@@ -86,6 +94,8 @@ struct a2dp_transport {
 	struct avdtp		*session;
 	uint16_t		delay;
 	uint16_t		volume;
+	uint16_t		latency;	/* End to end, 1/10 ms */
+	guint			latency_timer;
 };
 
 struct media_transport {
@@ -98,6 +108,7 @@ struct media_transport {
 	int			fd;		/* Transport file descriptor */
 	uint16_t		imtu;		/* Transport input mtu */
 	uint16_t		omtu;		/* Transport output mtu */
+	struct media_encoder	*encoder;	/* In-daemon PCM encoder */
 	transport_state_t	state;
 	guint			hs_watch;
 	guint			source_watch;
@@ -247,12 +258,71 @@ static void media_owner_free(struct media_owner *owner)
 	g_free(owner);
 }
 
+/*
+ * End to end latency: the delay reported by the sink plus, when encoding in
+ * the daemon, the PCM ring, the frames being packed and the socket queue.
+ */
+static void transport_update_latency(struct media_transport *transport)
+{
+	struct a2dp_transport *a2dp = transport->data;
+	unsigned int latency;
+
+	latency = a2dp->delay + media_encoder_get_latency(transport->encoder,
+							transport->fd) / 100;
+	if (latency > UINT16_MAX)
+		latency = UINT16_MAX;
+
+	if (latency == a2dp->latency)
+		return;
+
+	/* Avoid flooding listeners with jitter of the queue depth */
+	if (latency && a2dp->latency &&
+			abs((int) latency - a2dp->latency) < LATENCY_THRESHOLD)
+		return;
+
+	a2dp->latency = latency;
+
+	g_dbus_emit_property_changed(btd_get_dbus_connection(),
+					transport->path,
+					MEDIA_TRANSPORT_INTERFACE, "Latency");
+}
+
+static gboolean latency_timeout(gpointer user_data)
+{
+	transport_update_latency(user_data);
+
+	return TRUE;
+}
+
+static void media_transport_stop_encoder(struct media_transport *transport)
+{
+	struct a2dp_transport *a2dp = transport->data;
+
+	if (a2dp->latency_timer) {
+		g_source_remove(a2dp->latency_timer);
+		a2dp->latency_timer = 0;
+	}
+
+	if (!transport->encoder)
+		return;
+
+	/* The encoder may still be feeding other transports */
+	if (!media_encoder_remove_sink(transport->encoder, transport->fd))
+		media_encoder_free(transport->encoder);
+
+	transport->encoder = NULL;
+
+	transport_update_latency(transport);
+}
+
 static void media_transport_remove_owner(struct media_transport *transport)
 {
 	struct media_owner *owner = transport->owner;
 
 	DBG("Transport %s Owner %s", transport->path, owner->name);
 
+	media_transport_stop_encoder(transport);
+
 	/* Reply if owner has a pending request */
 	if (owner->pending)
 		media_request_reply(owner->pending, EIO);
@@ -283,6 +353,59 @@ static gboolean media_transport_set_fd(struct media_transport *transport,
 	return TRUE;
 }
 
+static struct media_encoder *find_encoder(struct media_transport *transport)
+{
+	GSList *l;
+
+	for (l = transports; l; l = l->next) {
+		struct media_transport *t = l->data;
+
+		if (t == transport || !t->encoder)
+			continue;
+
+		if (media_encoder_add_sink(t->encoder, transport->configuration,
+						transport->size, transport->fd,
+						transport->omtu))
+			return t->encoder;
+	}
+
+	return NULL;
+}
+
+static gboolean reply_pcm(struct media_transport *transport,
+							DBusMessage *msg)
+{
+	struct a2dp_transport *a2dp = transport->data;
+	int fd;
+
+	/*
+	 * Fan out to every transport with the same configuration from a
+	 * single encoder and PCM ring.
+	 */
+	if (!transport->encoder)
+		transport->encoder = find_encoder(transport);
+
+	if (!transport->encoder)
+		transport->encoder = media_encoder_new(transport->configuration,
+						transport->size, transport->fd,
+						transport->omtu);
+
+	fd = media_encoder_get_fd(transport->encoder);
+	if (fd < 0)
+		return FALSE;
+
+	transport_update_latency(transport);
+
+	if (!a2dp->latency_timer)
+		a2dp->latency_timer = g_timeout_add_seconds(LATENCY_INTERVAL,
+							latency_timeout,
+							transport);
+
+	return g_dbus_send_reply(btd_get_dbus_connection(), msg,
+						DBUS_TYPE_UNIX_FD, &fd,
+						DBUS_TYPE_INVALID);
+}
+
 static void a2dp_resume_complete(struct avdtp *session, int err,
 							void *user_data)
 {
@@ -310,7 +433,11 @@ static void a2dp_resume_complete(struct avdtp *session, int err,
 
 	media_transport_set_fd(transport, fd, imtu, omtu);
 
-	ret = g_dbus_send_reply(btd_get_dbus_connection(), req->msg,
+	if (dbus_message_is_method_call(req->msg, MEDIA_TRANSPORT_INTERFACE,
+							"AcquirePCM"))
+		ret = reply_pcm(transport, req->msg);
+	else
+		ret = g_dbus_send_reply(btd_get_dbus_connection(), req->msg,
 						DBUS_TYPE_UNIX_FD, &fd,
 						DBUS_TYPE_UINT16, &imtu,
 						DBUS_TYPE_UINT16, &omtu,
@@ -476,6 +603,22 @@ static DBusMessage *acquire(DBusConnection *conn, DBusMessage *msg,
 	return NULL;
 }
 
+static DBusMessage *acquire_pcm(DBusConnection *conn, DBusMessage *msg,
+								void *data)
+{
+#ifdef HAVE_SBC_ENCODER
+	struct media_transport *transport = data;
+	struct media_endpoint *endpoint = transport->endpoint;
+
+	/* Only SBC streams towards a remote sink can be encoded here */
+	if (!strcasecmp(media_endpoint_get_uuid(endpoint), A2DP_SOURCE_UUID) &&
+			media_endpoint_get_codec(endpoint) == A2DP_CODEC_SBC)
+		return acquire(conn, msg, data);
+#endif
+
+	return btd_error_not_supported(msg);
+}
+
 static DBusMessage *try_acquire(DBusConnection *conn, DBusMessage *msg,
 								void *data)
 {
@@ -534,6 +677,8 @@ static DBusMessage *release(DBusConnection *conn, DBusMessage *msg,
 
 	transport_set_state(transport, TRANSPORT_STATE_SUSPENDING);
 
+	media_transport_stop_encoder(transport);
+
 	id = transport->suspend(transport, owner);
 	if (id == 0) {
 		media_transport_remove_owner(transport);
@@ -546,6 +691,47 @@ static DBusMessage *release(DBusConnection *conn, DBusMessage *msg,
 	return NULL;
 }
 
+static DBusMessage *get_statistics(DBusConnection *conn, DBusMessage *msg,
+								void *data)
+{
+	struct media_transport *transport = data;
+	struct media_encoder_stats stats;
+	DBusMessageIter iter, dict;
+	DBusMessage *reply;
+
+	/* Only streams encoded by the daemon are seen packet by packet */
+	if (!media_encoder_get_stats(transport->encoder, transport->fd,
+								&stats))
+		return btd_error_not_available(msg);
+
+	reply = dbus_message_new_method_return(msg);
+	if (!reply)
+		return NULL;
+
+	dbus_message_iter_init_append(reply, &iter);
+
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+					DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+					DBUS_TYPE_STRING_AS_STRING
+					DBUS_TYPE_VARIANT_AS_STRING
+					DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
+					&dict);
+
+	dict_append_entry(&dict, "Packets", DBUS_TYPE_UINT64, &stats.packets);
+	dict_append_entry(&dict, "Bytes", DBUS_TYPE_UINT64, &stats.bytes);
+	dict_append_entry(&dict, "Dropped", DBUS_TYPE_UINT32, &stats.dropped);
+	dict_append_entry(&dict, "Errors", DBUS_TYPE_UINT32, &stats.errors);
+	dict_append_entry(&dict, "Underruns", DBUS_TYPE_UINT32,
+							&stats.underruns);
+	dict_append_entry(&dict, "EncodeTime", DBUS_TYPE_UINT32,
+							&stats.encode_time);
+	dict_append_entry(&dict, "Queued", DBUS_TYPE_UINT32, &stats.queued);
+
+	dbus_message_iter_close_container(&iter, &dict);
+
+	return reply;
+}
+
 static gboolean get_device(const GDBusPropertyTable *property,
 					DBusMessageIter *iter, void *data)
 {
@@ -627,6 +813,27 @@ static gboolean get_delay(const GDBusPropertyTable *property,
 	return TRUE;
 }
 
+static gboolean latency_exists(const GDBusPropertyTable *property,
+								void *data)
+{
+	struct media_transport *transport = data;
+	struct a2dp_transport *a2dp = transport->data;
+
+	return a2dp->latency != 0;
+}
+
+static gboolean get_latency(const GDBusPropertyTable *property,
+					DBusMessageIter *iter, void *data)
+{
+	struct media_transport *transport = data;
+	struct a2dp_transport *a2dp = transport->data;
+
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_UINT16,
+							&a2dp->latency);
+
+	return TRUE;
+}
+
 static gboolean volume_exists(const GDBusPropertyTable *property, void *data)
 {
 	struct media_transport *transport = data;
@@ -700,6 +907,12 @@ static const GDBusMethodTable transport_methods[] = {
 							{ "mtu_w", "q" }),
 			try_acquire) },
 	{ GDBUS_ASYNC_METHOD("Release", NULL, NULL, release) },
+	{ GDBUS_EXPERIMENTAL_ASYNC_METHOD("AcquirePCM",
+			NULL, GDBUS_ARGS({ "fd", "h" }),
+			acquire_pcm) },
+	{ GDBUS_EXPERIMENTAL_METHOD("GetStatistics",
+			NULL, GDBUS_ARGS({ "statistics", "a{sv}" }),
+			get_statistics) },
 	{ },
 };
 
@@ -710,6 +923,8 @@ static const GDBusPropertyTable transport_properties[] = {
 	{ "Configuration", "ay", get_configuration },
 	{ "State", "s", get_state },
 	{ "Delay", "q", get_delay, NULL, delay_exists },
+	{ "Latency", "q", get_latency, NULL, latency_exists,
+					G_DBUS_PROPERTY_FLAG_EXPERIMENTAL },
 	{ "Volume", "q", get_volume, set_volume, volume_exists },
 	{ }
 };
@@ -721,6 +936,9 @@ static void destroy_a2dp(void *data)
 	if (a2dp->session)
 		avdtp_unref(a2dp->session);
 
+	if (a2dp->latency_timer)
+		g_source_remove(a2dp->latency_timer);
+
 	g_free(a2dp);
 }
 
@@ -899,6 +1117,8 @@ void media_transport_update_delay(struct media_transport *transport,
 	g_dbus_emit_property_changed(btd_get_dbus_connection(),
 					transport->path,
 					MEDIA_TRANSPORT_INTERFACE, "Delay");
+
+	transport_update_latency(transport);
 }
 
 struct btd_device *media_transport_get_dev(struct media_transport *transport)
@@ -966,3 +1186,32 @@ void media_transport_update_device_volume(struct btd_device *dev,
 			media_transport_update_volume(transport, volume);
 	}
 }
+
+void media_transport_prestart(struct btd_device *dev)
+{
+	GSList *l;
+
+	if (dev == NULL)
+		return;
+
+	for (l = transports; l; l = l->next) {
+		struct media_transport *transport = l->data;
+		struct a2dp_sep *sep;
+		struct a2dp_transport *a2dp;
+
+		if (transport->device != dev ||
+				transport->state != TRANSPORT_STATE_IDLE)
+			continue;
+
+		/* Only local sources have audio to send */
+		sep = media_endpoint_get_sep(transport->endpoint);
+		if (!sep || strcasecmp(media_endpoint_get_uuid(
+						transport->endpoint),
+						A2DP_SOURCE_UUID))
+			continue;
+
+		a2dp = transport->data;
+		if (a2dp->session)
+			a2dp_prestart(a2dp->session, sep);
+	}
+}
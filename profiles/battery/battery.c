@@ -44,6 +44,7 @@
 #include "src/shared/queue.h"
 #include "src/shared/gatt-db.h"
 #include "src/shared/gatt-client.h"
+#include "src/shared/gatt-batch.h"
 #include "src/plugin.h"
 #include "src/adapter.h"
 #include "src/device.h"
@@ -56,6 +57,16 @@
 
 #define BATT_UUID16 0x180f
 
+/*
+ * Batteries without notifications are read on one schedule shared by all
+ * devices. A battery is read once the poll interval has passed, or on any
+ * tick after half of it if its link was in use since the previous tick
+ * anyway. Property changes are flushed together after the emit delay.
+ */
+#define BATT_POLL_INTERVAL	600
+#define BATT_POLL_TICK		(BATT_POLL_INTERVAL / 4)
+#define BATT_EMIT_DELAY		5
+
 /* Generic Attribute/Access Service */
 struct batt {
 	char *path; /* D-Bus path of device */
@@ -66,13 +77,47 @@ struct batt {
 
 	unsigned int batt_level_cb_id;
 	uint16_t batt_level_io_handle;
+	uint8_t batt_level_props;
 
+	unsigned int initial_id;
 	uint8_t *initial_value;
 	uint8_t percentage;
+	bool changed;
+
+	bool polled;
+	unsigned int read_id;
+	gint64 last_read;
+	uint64_t last_pdus;
 };
 
+static struct queue *batteries = NULL;
+static guint poll_timer = 0;
+static guint emit_timer = 0;
+
+static gboolean poll_tick(gpointer user_data);
+
+static void batt_unlink(struct batt *batt)
+{
+	if (!queue_remove(batteries, batt))
+		return;
+
+	if (!queue_isempty(batteries))
+		return;
+
+	if (poll_timer > 0) {
+		g_source_remove(poll_timer);
+		poll_timer = 0;
+	}
+
+	if (emit_timer > 0) {
+		g_source_remove(emit_timer);
+		emit_timer = 0;
+	}
+}
+
 static void batt_free(struct batt *batt)
 {
+	batt_unlink(batt);
 	gatt_db_unref(batt->db);
 	bt_gatt_client_unref(batt->client);
 	btd_device_unref(batt->device);
@@ -82,6 +127,21 @@ static void batt_free(struct batt *batt)
 
 static void batt_reset(struct batt *batt)
 {
+	batt_unlink(batt);
+
+	if (batt->read_id > 0) {
+		bt_gatt_client_cancel(batt->client, batt->read_id);
+		batt->read_id = 0;
+	}
+
+	if (batt->initial_id > 0) {
+		bt_gatt_batch_cancel(btd_device_get_gatt_batch(batt->device),
+							batt->initial_id);
+		batt->initial_id = 0;
+	}
+
+	batt->polled = false;
+	batt->changed = false;
 	batt->attr = NULL;
 	gatt_db_unref(batt->db);
 	batt->db = NULL;
@@ -97,6 +157,28 @@ static void batt_reset(struct batt *batt)
 	}
 }
 
+static void emit_changed(void *data, void *user_data)
+{
+	struct batt *batt = data;
+
+	if (!batt->changed)
+		return;
+
+	batt->changed = false;
+
+	g_dbus_emit_property_changed(btd_get_dbus_connection(), batt->path,
+					BATTERY_INTERFACE, "Percentage");
+}
+
+static gboolean emit_timeout(gpointer user_data)
+{
+	emit_timer = 0;
+
+	queue_foreach(batteries, emit_changed, NULL);
+
+	return FALSE;
+}
+
 static void parse_battery_level(struct batt *batt,
 				const uint8_t *value)
 {
@@ -106,8 +188,12 @@ static void parse_battery_level(struct batt *batt,
 	if (batt->percentage != percentage) {
 		batt->percentage = percentage;
 		DBG("Battery Level updated: %d%%", percentage);
-		g_dbus_emit_property_changed(btd_get_dbus_connection(), batt->path,
-						BATTERY_INTERFACE, "Percentage");
+
+		/* Changes of all devices go out in one go */
+		batt->changed = true;
+		if (!emit_timer)
+			emit_timer = g_timeout_add_seconds(BATT_EMIT_DELAY,
+							emit_timeout, NULL);
 	}
 }
 
@@ -116,6 +202,9 @@ static void batt_io_value_cb(uint16_t value_handle, const uint8_t *value,
 {
 	struct batt *batt = user_data;
 
+	if (!length)
+		return;
+
 	if (value_handle == batt->batt_level_io_handle) {
 		parse_battery_level(batt, value);
 	} else {
@@ -123,6 +212,64 @@ static void batt_io_value_cb(uint16_t value_handle, const uint8_t *value,
 	}
 }
 
+static uint64_t link_pdus(struct batt *batt)
+{
+	struct bt_att_pdu_stats stats;
+
+	if (!btd_device_get_att_stats(batt->device, &stats))
+		return 0;
+
+	return stats.rx_pdus + stats.tx_pdus;
+}
+
+static void poll_read_cb(bool success, uint8_t att_ecode,
+					const uint8_t *value, uint16_t length,
+					void *user_data)
+{
+	struct batt *batt = user_data;
+
+	batt->read_id = 0;
+	batt->last_read = g_get_monotonic_time();
+	batt->last_pdus = link_pdus(batt);
+
+	if (!success) {
+		DBG("Reading battery level failed with ATT error: %u",
+								att_ecode);
+		return;
+	}
+
+	if (length)
+		parse_battery_level(batt, value);
+}
+
+static void poll_battery(void *data, void *user_data)
+{
+	struct batt *batt = data;
+	gint64 elapsed = g_get_monotonic_time() - batt->last_read;
+	const gint64 interval = BATT_POLL_INTERVAL * G_USEC_PER_SEC;
+	uint64_t pdus;
+
+	if (!batt->polled || batt->read_id > 0)
+		return;
+
+	pdus = link_pdus(batt);
+
+	if (elapsed >= interval || (elapsed >= interval / 2 &&
+						pdus != batt->last_pdus))
+		batt->read_id = bt_gatt_client_read_value(batt->client,
+						batt->batt_level_io_handle,
+						poll_read_cb, batt, NULL);
+
+	batt->last_pdus = pdus;
+}
+
+static gboolean poll_tick(gpointer user_data)
+{
+	queue_foreach(batteries, poll_battery, NULL);
+
+	return TRUE;
+}
+
 static gboolean property_get_percentage(
 					const GDBusPropertyTable *property,
 					DBusMessageIter *iter, void *data)
@@ -139,15 +286,12 @@ static const GDBusPropertyTable battery_properties[] = {
 	{ }
 };
 
-static void batt_io_ccc_written_cb(uint16_t att_ecode, void *user_data)
+static void batt_register(struct batt *batt, bool polled)
 {
-	struct batt *batt = user_data;
-
-	if (att_ecode != 0) {
-		error("Battery Level: notifications not enabled %s",
-		      att_ecode2str(att_ecode));
-		return;
-	}
+	/* The initial value is part of InterfacesAdded */
+	batt->percentage = batt->initial_value[0];
+	g_free(batt->initial_value);
+	batt->initial_value = NULL;
 
 	if (g_dbus_register_interface(btd_get_dbus_connection(),
 					batt->path, BATTERY_INTERFACE,
@@ -160,9 +304,33 @@ static void batt_io_ccc_written_cb(uint16_t att_ecode, void *user_data)
 		return;
 	}
 
-	parse_battery_level(batt, batt->initial_value);
-	g_free (batt->initial_value);
-	batt->initial_value = NULL;
+	batt->polled = polled;
+	batt->last_read = g_get_monotonic_time();
+	batt->last_pdus = link_pdus(batt);
+
+	if (!batteries)
+		batteries = queue_new();
+
+	queue_push_tail(batteries, batt);
+
+	if (polled && !poll_timer)
+		poll_timer = g_timeout_add_seconds(BATT_POLL_TICK, poll_tick,
+									NULL);
+}
+
+static void batt_io_ccc_written_cb(uint16_t att_ecode, void *user_data)
+{
+	struct batt *batt = user_data;
+
+	if (att_ecode != 0) {
+		error("Battery Level: notifications not enabled %s",
+		      att_ecode2str(att_ecode));
+		batt->batt_level_cb_id = 0;
+		batt_register(batt, true);
+		return;
+	}
+
+	batt_register(batt, false);
 
 	DBG("Battery Level: notification enabled");
 }
@@ -175,6 +343,8 @@ static void read_initial_battery_level_cb(bool success,
 {
 	struct batt *batt = user_data;
 
+	batt->initial_id = 0;
+
 	if (!success) {
 		DBG("Reading battery level failed with ATT errror: %u",
 								att_ecode);
@@ -186,6 +356,12 @@ static void read_initial_battery_level_cb(bool success,
 
 	batt->initial_value = g_memdup(value, length);
 
+	if (!(batt->batt_level_props & BT_GATT_CHRC_PROP_NOTIFY)) {
+		DBG("Battery Level: no notifications, polling");
+		batt_register(batt, true);
+		return;
+	}
+
 	/* request notify */
 	batt->batt_level_cb_id =
 		bt_gatt_client_register_notify(batt->client,
@@ -196,12 +372,20 @@ static void read_initial_battery_level_cb(bool success,
 		                               NULL);
 }
 
-static void handle_battery_level(struct batt *batt, uint16_t value_handle)
+static void handle_battery_level(struct batt *batt, uint16_t value_handle,
+							uint8_t properties)
 {
 	batt->batt_level_io_handle = value_handle;
-
-	if (!bt_gatt_client_read_value(batt->client, batt->batt_level_io_handle,
-						read_initial_battery_level_cb, batt, NULL))
+	batt->batt_level_props = properties;
+
+	/* Battery Level is a single uint8 percentage */
+	batt->initial_id = bt_gatt_batch_read(
+					btd_device_get_gatt_batch(batt->device),
+					batt->batt_level_io_handle, 1,
+					BT_GATT_BATCH_PRIORITY_DEFAULT,
+					read_initial_battery_level_cb, batt,
+					NULL);
+	if (!batt->initial_id)
 		DBG("Failed to send request to read battery level");
 }
 
@@ -219,16 +403,17 @@ static void handle_characteristic(struct gatt_db_attribute *attr,
 {
 	struct batt *batt = user_data;
 	uint16_t value_handle;
+	uint8_t properties;
 	bt_uuid_t uuid;
 
-	if (!gatt_db_attribute_get_char_data(attr, NULL, &value_handle, NULL,
-								NULL, &uuid)) {
+	if (!gatt_db_attribute_get_char_data(attr, NULL, &value_handle,
+						&properties, NULL, &uuid)) {
 		error("Failed to obtain characteristic data");
 		return;
 	}
 
 	if (uuid_cmp(GATT_CHARAC_BATTERY_LEVEL, &uuid)) {
-		handle_battery_level(batt, value_handle);
+		handle_battery_level(batt, value_handle, properties);
 	} else {
 		char uuid_str[MAX_LEN_UUID_STR];
 
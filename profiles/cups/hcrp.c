@@ -30,6 +30,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <signal.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 
@@ -56,6 +57,12 @@ struct hcrp_pdu_hdr {
 } __attribute__ ((packed));
 #define HCRP_PDU_HDR_SIZE 6
 
+/* Job data is read in large chunks and sent out in MTU sized packets */
+#define HCRP_BUF_SIZE (64 * 1024)
+
+/* Ask for more credit while this many packets can still be sent */
+#define HCRP_CREDIT_LOW_WATER 4
+
 struct hcrp_credit_grant_cp {
 	uint32_t credit;
 } __attribute__ ((packed));
@@ -111,20 +118,28 @@ static int hcrp_credit_grant(int sk, uint16_t tid, uint32_t credit)
 	return 0;
 }
 
-static int hcrp_credit_request(int sk, uint16_t tid, uint32_t *credit)
+/*
+ * Credit requests are split into sending and receiving the reply, so that
+ * data can keep flowing on the remaining credit while the request is
+ * outstanding.
+ */
+static int hcrp_credit_request_send(int sk, uint16_t tid)
 {
 	struct hcrp_pdu_hdr hdr;
-	struct hcrp_credit_request_rp rp;
-	unsigned char buf[128];
-	int len;
 
 	hdr.pid = htons(HCRP_PDU_CREDIT_REQUEST);
 	hdr.tid = htons(tid);
 	hdr.plen = htons(0);
-	memcpy(buf, &hdr, HCRP_PDU_HDR_SIZE);
-	len = write(sk, buf, HCRP_PDU_HDR_SIZE);
-	if (len < 0)
-		return len;
+
+	return write(sk, &hdr, HCRP_PDU_HDR_SIZE) < 0 ? -1 : 0;
+}
+
+static int hcrp_credit_request_recv(int sk, uint32_t *credit)
+{
+	struct hcrp_pdu_hdr hdr;
+	struct hcrp_credit_request_rp rp;
+	unsigned char buf[128];
+	int len;
 
 	len = read(sk, buf, sizeof(buf));
 	if (len < 0)
@@ -190,12 +205,14 @@ int hcrp_print(bdaddr_t *src, bdaddr_t *dst, unsigned short ctrl_psm, unsigned s
 	struct sockaddr_l2 addr;
 	struct l2cap_options opts;
 	socklen_t size;
-	unsigned char buf[2048];
+	static unsigned char buf[HCRP_BUF_SIZE];
+	struct pollfd pfd;
 	int i, ctrl_sk, data_sk, count, len, timeout = 0;
-	unsigned int mtu;
+	unsigned int mtu, pos, avail;
 	uint8_t status;
 	uint16_t tid = 0;
 	uint32_t tmp, credit = 0;
+	int pending = 0;
 
 	if ((ctrl_sk = socket(PF_BLUETOOTH, SOCK_SEQPACKET, BTPROTO_L2CAP)) < 0) {
 		perror("ERROR: Can't create socket");
@@ -319,12 +336,28 @@ int hcrp_print(bdaddr_t *src, bdaddr_t *dst, unsigned short ctrl_psm, unsigned s
 			lseek(fd, 0, SEEK_SET);
 		}
 
+		pos = avail = 0;
+
 		while (1) {
-			if (credit < mtu) {
+			if (!pending && credit < HCRP_CREDIT_LOW_WATER * mtu) {
 				tid = hcrp_get_next_tid(tid);
-				if (!hcrp_credit_request(ctrl_sk, tid, &tmp)) {
-					credit += tmp;
-					timeout = 0;
+				if (!hcrp_credit_request_send(ctrl_sk, tid))
+					pending = 1;
+			}
+
+			/* Only block on the reply once the credit ran out */
+			if (pending) {
+				pfd.fd = ctrl_sk;
+				pfd.events = POLLIN;
+				pfd.revents = 0;
+
+				if (poll(&pfd, 1, credit ? 0 : 1000) > 0) {
+					pending = 0;
+					if (!hcrp_credit_request_recv(ctrl_sk,
+									&tmp)) {
+						credit += tmp;
+						timeout = 0;
+					}
 				}
 			}
 
@@ -336,15 +369,28 @@ int hcrp_print(bdaddr_t *src, bdaddr_t *dst, unsigned short ctrl_psm, unsigned s
 					break;
 				}
 
-				sleep(1);
+				/* A pending request already waited in poll */
+				if (!pending)
+					sleep(1);
 				continue;
 			}
 
-			count = read(fd, buf, (credit > mtu) ? mtu : credit);
-			if (count <= 0)
-				break;
+			if (pos == avail) {
+				count = read(fd, buf, sizeof(buf));
+				if (count <= 0)
+					break;
+
+				pos = 0;
+				avail = count;
+			}
+
+			count = avail - pos;
+			if ((unsigned int) count > mtu)
+				count = mtu;
+			if ((uint32_t) count > credit)
+				count = credit;
 
-			len = write(data_sk, buf, count);
+			len = write(data_sk, buf + pos, count);
 			if (len < 0) {
 				perror("ERROR: Error writing to device");
 				close(data_sk);
@@ -355,6 +401,7 @@ int hcrp_print(bdaddr_t *src, bdaddr_t *dst, unsigned short ctrl_psm, unsigned s
 			if (len != count)
 				fprintf(stderr, "ERROR: Can't send complete data\n");
 
+			pos += len;
 			credit -= len;
 		}
 
@@ -44,6 +44,7 @@
 #include "src/shared/queue.h"
 #include "src/shared/gatt-db.h"
 #include "src/shared/gatt-client.h"
+#include "src/shared/gatt-batch.h"
 #include "attrib/att.h"
 #include "src/log.h"
 
@@ -71,10 +72,11 @@ static void read_pnpid_cb(bool success, uint8_t att_ecode, const uint8_t *value,
 
 static void handle_pnpid(struct btd_device *device, uint16_t value_handle)
 {
-	struct bt_gatt_client *client = btd_device_get_gatt_client(device);
+	struct bt_gatt_batch *batch = btd_device_get_gatt_batch(device);
 
-	if (!bt_gatt_client_read_value(client, value_handle,
-						read_pnpid_cb, device, NULL))
+	if (!bt_gatt_batch_read(batch, value_handle, PNP_ID_SIZE,
+					BT_GATT_BATCH_PRIORITY_HIGH,
+					read_pnpid_cb, device, NULL))
 		DBG("Failed to send request to read pnpid");
 }
 
@@ -40,6 +40,7 @@
 #include "src/shared/queue.h"
 #include "src/shared/gatt-db.h"
 #include "src/shared/gatt-client.h"
+#include "src/shared/gatt-batch.h"
 #include "src/plugin.h"
 #include "src/adapter.h"
 #include "src/device.h"
@@ -149,8 +150,11 @@ static void read_appearance_cb(bool success, uint8_t att_ecode,
 
 static void handle_appearance(struct gas *gas, uint16_t value_handle)
 {
-	if (!bt_gatt_client_read_value(gas->client, value_handle,
-						read_appearance_cb, gas, NULL))
+	struct bt_gatt_batch *batch = btd_device_get_gatt_batch(gas->device);
+
+	if (!bt_gatt_batch_read(batch, value_handle, 2,
+					BT_GATT_BATCH_PRIORITY_HIGH,
+					read_appearance_cb, gas, NULL))
 		DBG("Failed to send request to read appearance");
 }
 
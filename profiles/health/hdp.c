@@ -523,10 +523,26 @@ static void hdp_mdl_reconn_cb(struct mcap_mdl *mdl, GError *err, gpointer data)
 			DBUS_TYPE_INVALID);
 }
 
+static const struct mcap_dc_opts *app_dc_opts(struct hdp_application *app,
+						struct mcap_dc_opts *opts)
+{
+	if (!app)
+		return NULL;
+
+	memset(opts, 0, sizeof(*opts));
+	opts->imtu = app->mtu;
+	opts->omtu = app->mtu;
+	opts->max_tx = app->max_tx;
+	opts->txwin_size = app->txwin_size;
+
+	return opts;
+}
+
 static void hdp_get_dcpsm_cb(uint16_t dcpsm, gpointer user_data, GError *err)
 {
 	struct hdp_tmp_dc_data *hdp_conn = user_data;
 	struct hdp_channel *hdp_chann = hdp_conn->hdp_chann;
+	struct mcap_dc_opts opts;
 	GError *gerr = NULL;
 	uint8_t mode;
 
@@ -540,6 +556,9 @@ static void hdp_get_dcpsm_cb(uint16_t dcpsm, gpointer user_data, GError *err)
 	else
 		mode = L2CAP_MODE_STREAMING;
 
+	mcap_mdl_set_dc_opts(hdp_chann->mdl, app_dc_opts(hdp_chann->app,
+								&opts));
+
 	if (mcap_connect_mdl(hdp_chann->mdl, mode, dcpsm, hdp_conn->cb,
 					hdp_tmp_dc_data_ref(hdp_conn),
 					hdp_tmp_dc_data_destroy, &gerr))
@@ -1054,12 +1073,30 @@ static uint8_t hdp2l2cap_mode(uint8_t hdp_mode)
 								L2CAP_MODE_ERTM;
 }
 
+static gboolean set_data_chan(struct hdp_device *dev, uint8_t mode,
+						struct hdp_application *app)
+{
+	struct mcap_instance *mi = dev->hdp_adapter->mi;
+	struct mcap_dc_opts opts;
+	GError *err = NULL;
+
+	/* The parameters of the channel being accepted come from its MDEP */
+	if (!mcap_set_data_chan_mode(mi, mode, &err) ||
+			!mcap_set_data_chan_opts(mi, app_dc_opts(app, &opts),
+									&err)) {
+		error("Error: %s", err->message);
+		g_error_free(err);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 static uint8_t hdp_mcap_mdl_conn_req_cb(struct mcap_mcl *mcl, uint8_t mdepid,
 				uint16_t mdlid, uint8_t *conf, void *data)
 {
 	struct hdp_device *dev = data;
 	struct hdp_application *app;
-	GError *err = NULL;
 	GSList *l;
 
 	DBG("Data channel request");
@@ -1081,12 +1118,8 @@ static uint8_t hdp_mcap_mdl_conn_req_cb(struct mcap_mcl *mcl, uint8_t mdepid,
 			return MCAP_CONFIGURATION_REJECTED; /* not processed */
 		}
 
-		if (!mcap_set_data_chan_mode(dev->hdp_adapter->mi,
-						L2CAP_MODE_ERTM, &err)) {
-			error("Error: %s", err->message);
-			g_error_free(err);
+		if (!set_data_chan(dev, L2CAP_MODE_ERTM, NULL))
 			return MCAP_MDL_BUSY;
-		}
 
 		dev->ndc = create_channel(dev, *conf, NULL, mdlid, NULL, NULL);
 		if (dev->ndc == NULL)
@@ -1139,12 +1172,8 @@ static uint8_t hdp_mcap_mdl_conn_req_cb(struct mcap_mcl *mcl, uint8_t mdepid,
 		g_free(path);
 	}
 
-	if (!mcap_set_data_chan_mode(dev->hdp_adapter->mi,
-						hdp2l2cap_mode(*conf), &err)) {
-		error("Error: %s", err->message);
-		g_error_free(err);
+	if (!set_data_chan(dev, hdp2l2cap_mode(*conf), app))
 		return MCAP_MDL_BUSY;
-	}
 
 	dev->ndc = create_channel(dev, *conf, NULL, mdlid, app, NULL);
 	if (dev->ndc == NULL)
@@ -1157,7 +1186,6 @@ static uint8_t hdp_mcap_mdl_reconn_req_cb(struct mcap_mdl *mdl, void *data)
 {
 	struct hdp_device *dev = data;
 	struct hdp_channel *chan;
-	GError *err = NULL;
 	GSList *l;
 
 	l = g_slist_find_custom(dev->channels, mdl, cmp_chan_mdl);
@@ -1170,12 +1198,8 @@ static uint8_t hdp_mcap_mdl_reconn_req_cb(struct mcap_mdl *mdl, void *data)
 						chan->mdep != HDP_MDEP_ECHO)
 		return MCAP_UNSPECIFIED_ERROR;
 
-	if (!mcap_set_data_chan_mode(dev->hdp_adapter->mi,
-					hdp2l2cap_mode(chan->config), &err)) {
-		error("Error: %s", err->message);
-		g_error_free(err);
+	if (!set_data_chan(dev, hdp2l2cap_mode(chan->config), chan->app))
 		return MCAP_MDL_BUSY;
-	}
 
 	dev->ndc = hdp_channel_ref(chan);
 
@@ -2088,6 +2112,64 @@ static gboolean dev_property_get_main_channel(
 	return TRUE;
 }
 
+static DBusMessage *device_acquire_channels(DBusConnection *conn,
+					DBusMessage *msg, void *user_data)
+{
+	struct hdp_device *device = user_data;
+	DBusMessageIter iter, array, fds;
+	DBusMessage *reply;
+	GSList *chans = NULL, *l;
+
+	dbus_message_iter_init(msg, &iter);
+	dbus_message_iter_recurse(&iter, &array);
+
+	/* Check every channel first so that the reply is all or nothing */
+	while (dbus_message_iter_get_arg_type(&array) ==
+						DBUS_TYPE_OBJECT_PATH) {
+		struct hdp_channel *chan;
+		const char *path;
+
+		dbus_message_iter_get_basic(&array, &path);
+
+		l = g_slist_find_custom(device->channels, path, cmp_chan_path);
+		if (l == NULL) {
+			g_slist_free(chans);
+			return btd_error_invalid_args(msg);
+		}
+
+		chan = l->data;
+		if (mcap_mdl_get_fd(chan->mdl) < 0) {
+			g_slist_free(chans);
+			return btd_error_not_connected(msg);
+		}
+
+		chans = g_slist_append(chans, chan);
+		dbus_message_iter_next(&array);
+	}
+
+	reply = dbus_message_new_method_return(msg);
+	if (!reply) {
+		g_slist_free(chans);
+		return NULL;
+	}
+
+	dbus_message_iter_init_append(reply, &iter);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+					DBUS_TYPE_UNIX_FD_AS_STRING, &fds);
+
+	for (l = chans; l; l = l->next) {
+		struct hdp_channel *chan = l->data;
+		int fd = mcap_mdl_get_fd(chan->mdl);
+
+		dbus_message_iter_append_basic(&fds, DBUS_TYPE_UNIX_FD, &fd);
+	}
+
+	dbus_message_iter_close_container(&iter, &fds);
+	g_slist_free(chans);
+
+	return reply;
+}
+
 static void health_device_destroy(void *data)
 {
 	struct hdp_device *device = data;
@@ -2116,6 +2198,10 @@ static const GDBusMethodTable health_device_methods[] = {
 	{ GDBUS_ASYNC_METHOD("DestroyChannel",
 			GDBUS_ARGS({ "channel", "o" }), NULL,
 			device_destroy_channel) },
+	{ GDBUS_METHOD("AcquireChannels",
+			GDBUS_ARGS({ "channels", "ao" }),
+			GDBUS_ARGS({ "fds", "ah" }),
+			device_acquire_channels) },
 	{ }
 };
 
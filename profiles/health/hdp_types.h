@@ -73,6 +73,9 @@ struct hdp_application {
 	gboolean		role_set;	/* Flag for dictionary parsing */
 	uint8_t			chan_type;	/* QoS preferred by source applications */
 	gboolean		chan_type_set;	/* Flag for dictionary parsing */
+	uint16_t		mtu;		/* Data channel MTU, 0 for default */
+	uint8_t			max_tx;		/* ERTM max transmissions */
+	uint16_t		txwin_size;	/* ERTM transmit window */
 	char			*description;	/* Options description for SDP record */
 	uint8_t			id;		/* The identification is also the mdepid */
 	char			*oname;		/* Name of the owner application */
@@ -285,11 +285,96 @@ static gboolean parse_chan_type(DBusMessageIter *iter, gpointer data,
 	return TRUE;
 }
 
+static gboolean parse_uint(DBusMessageIter *iter, int type, void *val,
+					const char *name, GError **err)
+{
+	DBusMessageIter *value;
+	DBusMessageIter variant;
+	int ctype;
+
+	ctype = dbus_message_iter_get_arg_type(iter);
+	value = iter;
+	if (ctype == DBUS_TYPE_VARIANT) {
+		/* Get value inside the variable */
+		dbus_message_iter_recurse(iter, &variant);
+		ctype = dbus_message_iter_get_arg_type(&variant);
+		value = &variant;
+	}
+
+	if (ctype != type) {
+		g_set_error(err, HDP_ERROR, HDP_DIC_ENTRY_PARSE_ERROR,
+				"Final value for %s should be %s", name,
+				type == DBUS_TYPE_BYTE ? "byte" : "uint16");
+		return FALSE;
+	}
+
+	dbus_message_iter_get_basic(value, val);
+
+	return TRUE;
+}
+
+static gboolean parse_mtu(DBusMessageIter *iter, gpointer data, GError **err)
+{
+	struct hdp_application *app = data;
+
+	if (!parse_uint(iter, DBUS_TYPE_UINT16, &app->mtu, "MTU", err))
+		return FALSE;
+
+	/* L2CAP requires at least 48 octets on BR/EDR */
+	if (app->mtu < 48) {
+		g_set_error(err, HDP_ERROR, HDP_DIC_ENTRY_PARSE_ERROR,
+						"Invalid value for MTU");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean parse_max_tx(DBusMessageIter *iter, gpointer data,
+								GError **err)
+{
+	struct hdp_application *app = data;
+
+	if (!parse_uint(iter, DBUS_TYPE_BYTE, &app->max_tx, "MaxTransmit",
+									err))
+		return FALSE;
+
+	if (!app->max_tx) {
+		g_set_error(err, HDP_ERROR, HDP_DIC_ENTRY_PARSE_ERROR,
+					"Invalid value for MaxTransmit");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean parse_txwin(DBusMessageIter *iter, gpointer data,
+								GError **err)
+{
+	struct hdp_application *app = data;
+
+	if (!parse_uint(iter, DBUS_TYPE_UINT16, &app->txwin_size, "TxWindow",
+									err))
+		return FALSE;
+
+	/* Above 63 needs the extended window option */
+	if (!app->txwin_size || app->txwin_size > 0x3fff) {
+		g_set_error(err, HDP_ERROR, HDP_DIC_ENTRY_PARSE_ERROR,
+					"Invalid value for TxWindow");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 static struct dict_entry_func dict_parser[] = {
 	{"DataType",		parse_data_type},
 	{"Role",		parse_role},
 	{"Description",		parse_desc},
 	{"ChannelType",		parse_chan_type},
+	{"MTU",			parse_mtu},
+	{"MaxTransmit",		parse_max_tx},
+	{"TxWindow",		parse_txwin},
 	{NULL, NULL}
 };
 
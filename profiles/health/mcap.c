@@ -68,6 +68,8 @@ struct mcap_csp {
 	guint		ind_expected;	/* CSP-Master: indication expected */
 	uint8_t		csp_req;	/* CSP-Master: Request control flag */
 	guint		ind_timer;	/* CSP-Slave: indication timer */
+	guint		ind_period;	/* CSP-Slave: indication period (ms) */
+	uint64_t	ind_next;	/* CSP-Slave: next indication (us) */
 	guint		set_timer;	/* CSP-Slave: delayed set timer */
 	void		*set_data;	/* CSP-Slave: delayed set data */
 	void		*csp_priv_data;	/* CSP-Master: In-flight request data */
@@ -1714,6 +1716,25 @@ static void mcap_connect_mdl_cb(GIOChannel *chan, GError *conn_err,
 	cb(mdl, conn_err, user_data);
 }
 
+static void dc_opts_resolve(struct mcap_dc_opts *dst,
+					const struct mcap_dc_opts *src)
+{
+	dst->imtu = src && src->imtu ? src->imtu : MCAP_DC_MTU;
+	dst->omtu = src && src->omtu ? src->omtu : MCAP_DC_MTU;
+	dst->max_tx = src && src->max_tx ? src->max_tx : MCAP_DC_MAX_TX;
+	dst->txwin_size = src && src->txwin_size ? src->txwin_size :
+							MCAP_DC_TX_WINDOW;
+}
+
+void mcap_mdl_set_dc_opts(struct mcap_mdl *mdl,
+					const struct mcap_dc_opts *opts)
+{
+	if (opts)
+		mdl->opts = *opts;
+	else
+		memset(&mdl->opts, 0, sizeof(mdl->opts));
+}
+
 gboolean mcap_connect_mdl(struct mcap_mdl *mdl, uint8_t mode,
 					uint16_t dcpsm,
 					mcap_mdl_operation_cb connect_cb,
@@ -1722,6 +1743,7 @@ gboolean mcap_connect_mdl(struct mcap_mdl *mdl, uint8_t mode,
 					GError **err)
 {
 	struct mcap_mdl_op_cb *con;
+	struct mcap_dc_opts opts;
 
 	if (mdl->state != MDL_WAITING) {
 		g_set_error(err, MCAP_ERROR, MCAP_ERROR_INVALID_MDL,
@@ -1741,14 +1763,19 @@ gboolean mcap_connect_mdl(struct mcap_mdl *mdl, uint8_t mode,
 	con->destroy = destroy;
 	con->user_data = user_data;
 
+	dc_opts_resolve(&opts, &mdl->opts);
+
 	mdl->dc = bt_io_connect(mcap_connect_mdl_cb, con,
 				(GDestroyNotify) free_mcap_mdl_op, err,
 				BT_IO_OPT_SOURCE_BDADDR, &mdl->mcl->mi->src,
 				BT_IO_OPT_DEST_BDADDR, &mdl->mcl->addr,
 				BT_IO_OPT_PSM, dcpsm,
-				BT_IO_OPT_MTU, MCAP_DC_MTU,
+				BT_IO_OPT_IMTU, opts.imtu,
+				BT_IO_OPT_OMTU, opts.omtu,
 				BT_IO_OPT_SEC_LEVEL, mdl->mcl->mi->sec,
 				BT_IO_OPT_MODE, mode,
+				BT_IO_OPT_MAX_TX, opts.max_tx,
+				BT_IO_OPT_TX_WINDOW, opts.txwin_size,
 				BT_IO_OPT_INVALID);
 	if (!mdl->dc) {
 		DBG("MDL Connection error");
@@ -2233,6 +2260,28 @@ gboolean mcap_set_data_chan_mode(struct mcap_instance *mi, uint8_t mode,
 							BT_IO_OPT_INVALID);
 }
 
+gboolean mcap_set_data_chan_opts(struct mcap_instance *mi,
+					const struct mcap_dc_opts *opts,
+					GError **err)
+{
+	struct mcap_dc_opts dc;
+
+	if (!(mi && mi->dcio)) {
+		g_set_error(err, MCAP_ERROR, MCAP_ERROR_INVALID_ARGS,
+						"Invalid MCAP instance");
+		return FALSE;
+	}
+
+	/* Accepted channels inherit the options of the listening socket */
+	dc_opts_resolve(&dc, opts);
+
+	return bt_io_set(mi->dcio, err, BT_IO_OPT_IMTU, dc.imtu,
+					BT_IO_OPT_OMTU, dc.omtu,
+					BT_IO_OPT_MAX_TX, dc.max_tx,
+					BT_IO_OPT_TX_WINDOW, dc.txwin_size,
+					BT_IO_OPT_INVALID);
+}
+
 struct mcap_mdl *mcap_mdl_ref(struct mcap_mdl *mdl)
 {
 	mdl->ref++;
@@ -2706,6 +2755,66 @@ static gboolean sync_send_indication(gpointer user_data)
 	return !sent;
 }
 
+static gboolean sync_ind_timeout(gpointer user_data);
+
+static void sync_ind_schedule(struct mcap_mcl *mcl)
+{
+	struct mcap_csp *csp = mcl->csp;
+	struct timespec now;
+	uint64_t cur;
+	guint delay = 0;
+
+	clock_gettime(CLK, &now);
+	cur = time_us(&now);
+
+	/* Round up so that the indication never goes out early */
+	if (csp->ind_next > cur)
+		delay = (csp->ind_next - cur + 999) / 1000;
+
+	csp->ind_timer = g_timeout_add_full(G_PRIORITY_HIGH, delay,
+						sync_ind_timeout, mcl, NULL);
+}
+
+static gboolean sync_ind_timeout(gpointer user_data)
+{
+	struct mcap_mcl *mcl = user_data;
+	struct mcap_csp *csp = mcl->csp;
+	struct timespec now;
+	uint64_t cur;
+
+	csp->ind_timer = 0;
+
+	if (!sync_send_indication(mcl))
+		return FALSE;
+
+	/*
+	 * Deadlines advance by whole periods from the first one, so late
+	 * wakeups do not accumulate into drift like a re-armed interval.
+	 */
+	clock_gettime(CLK, &now);
+	cur = time_us(&now);
+
+	do {
+		csp->ind_next += csp->ind_period * 1000ull;
+	} while (csp->ind_next <= cur);
+
+	sync_ind_schedule(mcl);
+
+	return FALSE;
+}
+
+static void sync_ind_start(struct mcap_mcl *mcl, guint period)
+{
+	struct timespec now;
+
+	clock_gettime(CLK, &now);
+
+	mcl->csp->ind_period = period;
+	mcl->csp->ind_next = time_us(&now) + period * 1000ull;
+
+	sync_ind_schedule(mcl);
+}
+
 static gboolean proc_sync_set_req_phase2(gpointer user_data)
 {
 	struct mcap_mcl *mcl;
@@ -2726,6 +2835,7 @@ static gboolean proc_sync_set_req_phase2(gpointer user_data)
 		return FALSE;
 
 	mcl = user_data;
+	mcl->csp->set_timer = 0;
 
 	if (!mcl->csp->set_data)
 		return FALSE;
@@ -2778,12 +2888,8 @@ static gboolean proc_sync_set_req_phase2(gpointer user_data)
 		mcl->csp->ind_timer = 0;
 	}
 
-	if (update) {
-		int when = ind_freq + caps(mcl)->syncleadtime_ms;
-		mcl->csp->ind_timer = g_timeout_add(when,
-						sync_send_indication,
-						mcl);
-	}
+	if (update)
+		sync_ind_start(mcl, ind_freq + caps(mcl)->syncleadtime_ms);
 
 	send_sync_set_rsp(mcl, MCAP_SUCCESS, btclock, tmstamp, tmstampacc);
 
@@ -2913,9 +3019,9 @@ static void proc_sync_set_req(struct mcap_mcl *mcl, uint8_t *cmd, uint32_t len)
 
 	if (phase2_delay > 0) {
 		when = phase2_delay + caps(mcl)->syncleadtime_ms;
-		mcl->csp->set_timer = g_timeout_add(when,
+		mcl->csp->set_timer = g_timeout_add_full(G_PRIORITY_HIGH, when,
 						proc_sync_set_req_phase2,
-						mcl);
+						mcl, NULL);
 	} else
 		proc_sync_set_req_phase2(mcl);
 
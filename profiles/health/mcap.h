@@ -31,6 +31,10 @@
 #define MCAP_CC_MTU	48
 #define MCAP_DC_MTU	65535
 
+/* L2CAP defaults for ERTM data channels */
+#define MCAP_DC_MAX_TX		3
+#define MCAP_DC_TX_WINDOW	63
+
 /* MCAP Standard Op Codes */
 #define MCAP_ERROR_RSP			0x00
 #define MCAP_MD_CREATE_MDL_REQ		0x01
@@ -309,6 +313,14 @@ struct mcap_mcl {
 	struct mcap_csp		*csp;		/* CSP control structure */
 };
 
+/* L2CAP parameters of a data channel, zero fields keep the defaults */
+struct mcap_dc_opts {
+	uint16_t	imtu;		/* Incoming MTU */
+	uint16_t	omtu;		/* Outgoing MTU */
+	uint8_t		max_tx;		/* ERTM maximum transmissions */
+	uint16_t	txwin_size;	/* ERTM transmit window */
+};
+
 struct mcap_mdl {
 	struct mcap_mcl		*mcl;		/* MCL where this MDL belongs */
 	GIOChannel		*dc;		/* MCAP Data Channel IO */
@@ -316,6 +328,7 @@ struct mcap_mdl {
 	uint16_t		mdlid;		/* MDL id */
 	uint8_t			mdep_id;	/* MCAP Data End Point */
 	MDLState		state;		/* MDL state */
+	struct mcap_dc_opts	opts;		/* Data channel parameters */
 	int			ref;		/* References counter */
 };
 
@@ -429,6 +442,11 @@ uint16_t mcap_get_data_psm(struct mcap_instance *mi, GError **err);
 
 gboolean mcap_set_data_chan_mode(struct mcap_instance *mi, uint8_t mode,
 								GError **err);
+gboolean mcap_set_data_chan_opts(struct mcap_instance *mi,
+					const struct mcap_dc_opts *opts,
+					GError **err);
+void mcap_mdl_set_dc_opts(struct mcap_mdl *mdl,
+					const struct mcap_dc_opts *opts);
 
 int mcap_send_data(int sock, const void *buf, uint32_t size);
 
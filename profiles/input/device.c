@@ -31,7 +31,10 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <inttypes.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "lib/bluetooth.h"
 #include "lib/hidp.h"
@@ -58,6 +61,10 @@
 
 #define INPUT_INTERFACE "org.bluez.Input1"
 
+#define INPUT_INTR_BATCH	16	/* Reports read per wakeup */
+#define INPUT_STATS_INTERVAL	10	/* Seconds between rate reports */
+#define INPUT_FILTER_MAX	96	/* Largest report checked for repeats */
+
 enum reconnect_mode_t {
 	RECONNECT_NONE = 0,
 	RECONNECT_DEVICE,
@@ -84,13 +91,48 @@ struct input_device {
 	uint32_t		reconnect_attempt;
 	struct bt_uhid		*uhid;
 	bool			uhid_created;
+	struct uhid_event	*input_ev;
 	uint8_t			report_req_pending;
 	guint			report_req_timer;
 	uint32_t		report_rsp_id;
+	struct {
+		bool		enabled;
+		uint8_t		min_id;
+		uint8_t		data[INPUT_FILTER_MAX];
+		size_t		len;
+	} filter;
+	struct {
+		gint64		start;
+		gint64		last;
+		gint64		min_interval;
+		gint64		max_interval;
+		unsigned int	reports;
+		uint64_t	bytes;
+	} stats;
 };
 
 static int idle_timeout = 0;
 static bool uhid_enabled = false;
+static bool report_stats = false;
+static bool filter_reports = false;
+
+/*
+ * Game controllers keep streaming their complete state even when nothing
+ * changed, so a repeated report carries no new information for the uHID
+ * driver. Reports with an ID below min_id, like the Wii Remote status and
+ * acknowledgement reports, are always passed on.
+ */
+static const struct {
+	uint16_t vendor;
+	uint16_t product;
+	uint8_t min_id;
+} filter_devices[] = {
+	{ 0x054c, 0x0268, 0x00 },	/* Sixaxis / DualShock 3 */
+	{ 0x054c, 0x05c4, 0x00 },	/* DualShock 4 */
+	{ 0x054c, 0x09cc, 0x00 },	/* DualShock 4 (2nd gen) */
+	{ 0x057e, 0x0306, 0x30 },	/* Wii Remote */
+	{ 0x057e, 0x0330, 0x30 },	/* Wii Remote Plus */
+};
 
 void input_set_idle_timeout(int timeout)
 {
@@ -102,12 +144,23 @@ void input_enable_userspace_hid(bool state)
 	uhid_enabled = state;
 }
 
+void input_enable_report_stats(bool state)
+{
+	report_stats = state;
+}
+
+void input_enable_report_filter(bool state)
+{
+	filter_reports = state;
+}
+
 static void input_device_enter_reconnect_mode(struct input_device *idev);
 static int connection_disconnect(struct input_device *idev, uint32_t flags);
 
 static void input_device_free(struct input_device *idev)
 {
 	bt_uhid_unref(idev->uhid);
+	free(idev->input_ev);
 	btd_service_unref(idev->service);
 	btd_device_unref(idev->device);
 	g_free(idev->path);
@@ -228,31 +281,105 @@ static bool uhid_send_feature_answer(struct input_device *idev,
 	return true;
 }
 
-static bool uhid_send_input_report(struct input_device *idev,
-					const uint8_t *data, size_t size)
+static void input_stats_update(struct input_device *idev, size_t size)
 {
-	struct uhid_event ev;
-	int err;
+	gint64 now = g_get_monotonic_time();
+	gint64 elapsed;
+	char address[18];
 
-	if (data == NULL)
-		size = 0;
+	if (idev->stats.last) {
+		gint64 interval = now - idev->stats.last;
+
+		if (!idev->stats.min_interval ||
+					interval < idev->stats.min_interval)
+			idev->stats.min_interval = interval;
+
+		if (interval > idev->stats.max_interval)
+			idev->stats.max_interval = interval;
+	} else
+		idev->stats.start = now;
+
+	idev->stats.last = now;
+	idev->stats.reports++;
+	idev->stats.bytes += size;
 
-	if (size > sizeof(ev.u.input.data))
-		size = sizeof(ev.u.input.data);
+	elapsed = now - idev->stats.start;
+	if (elapsed < INPUT_STATS_INTERVAL * G_USEC_PER_SEC)
+		return;
+
+	ba2str(&idev->dst, address);
+
+	info("Input %s: %" PRIu64 " reports/s %" PRIu64 " bytes/s "
+		"interval %" PRId64 "-%" PRId64 " us", address,
+		(uint64_t) idev->stats.reports * G_USEC_PER_SEC / elapsed,
+		idev->stats.bytes * G_USEC_PER_SEC / elapsed,
+		idev->stats.min_interval, idev->stats.max_interval);
+
+	/* Keep the last timestamp so the next interval is still measured */
+	idev->stats.start = now;
+	idev->stats.min_interval = 0;
+	idev->stats.max_interval = 0;
+	idev->stats.reports = 0;
+	idev->stats.bytes = 0;
+}
+
+static void input_filter_init(struct input_device *idev, uint16_t vendor,
+							uint16_t product)
+{
+	unsigned int i;
+
+	idev->filter.enabled = false;
+	idev->filter.len = 0;
+
+	if (!filter_reports)
+		return;
+
+	for (i = 0; i < G_N_ELEMENTS(filter_devices); i++) {
+		if (filter_devices[i].vendor == vendor &&
+				filter_devices[i].product == product) {
+			idev->filter.enabled = true;
+			idev->filter.min_id = filter_devices[i].min_id;
+			return;
+		}
+	}
+}
+
+static bool input_filter_repeated(struct input_device *idev, size_t size)
+{
+	const uint8_t *data = idev->input_ev->u.input.data;
+
+	if (!idev->filter.enabled || size > sizeof(idev->filter.data))
+		return false;
+
+	if (data[0] < idev->filter.min_id)
+		return false;
+
+	if (size == idev->filter.len && !memcmp(idev->filter.data, data, size))
+		return true;
+
+	memcpy(idev->filter.data, data, size);
+	idev->filter.len = size;
+
+	return false;
+}
+
+static bool uhid_send_input_event(struct input_device *idev, size_t size)
+{
+	int err;
 
 	if (!idev->uhid_created) {
 		DBG("HID report (%zu bytes) dropped", size);
 		return false;
 	}
 
-	memset(&ev, 0, sizeof(ev));
-	ev.type = UHID_INPUT;
-	ev.u.input.size = size;
+	if (input_filter_repeated(idev, size))
+		return true;
 
-	if (size > 0)
-		memcpy(ev.u.input.data, data, size);
+	/* The report data was read straight into the event already */
+	idev->input_ev->type = UHID_INPUT;
+	idev->input_ev->u.input.size = size;
 
-	err = bt_uhid_send(idev->uhid, &ev);
+	err = bt_uhid_send(idev->uhid, idev->input_ev);
 	if (err < 0) {
 		error("bt_uhid_send: %s (%d)", strerror(-err), -err);
 		return false;
@@ -260,41 +387,68 @@ static bool uhid_send_input_report(struct input_device *idev,
 
 	DBG("HID report (%zu bytes)", size);
 
+	if (report_stats)
+		input_stats_update(idev, size);
+
 	return true;
 }
 
 static bool hidp_recv_intr_data(GIOChannel *chan, struct input_device *idev)
 {
+	struct iovec iov[2];
+	struct msghdr msg;
+	unsigned int count;
 	int fd;
 	ssize_t len;
 	uint8_t hdr;
-	uint8_t data[UHID_DATA_MAX + 1];
 
 	fd = g_io_channel_unix_get_fd(chan);
 
-	len = read(fd, data, sizeof(data));
-	if (len < 0) {
-		error("BT socket read error: %s (%d)", strerror(errno), errno);
-		return false;
+	if (!idev->input_ev) {
+		idev->input_ev = new0(struct uhid_event, 1);
+		if (!idev->input_ev)
+			return false;
 	}
 
-	if (len == 0) {
-		DBG("BT socket read returned 0 bytes");
-		return true;
-	}
+	/* Split off the HIDP header so the report lands in the event */
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = idev->input_ev->u.input.data;
+	iov[1].iov_len = sizeof(idev->input_ev->u.input.data);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	/* Drain whatever queued up since the last wakeup */
+	for (count = 0; count < INPUT_INTR_BATCH; count++) {
+		len = recvmsg(fd, &msg, MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				break;
+
+			error("BT socket read error: %s (%d)", strerror(errno),
+									errno);
+			return false;
+		}
 
-	hdr = data[0];
-	if (hdr != (HIDP_TRANS_DATA | HIDP_DATA_RTYPE_INPUT)) {
-		DBG("unsupported HIDP protocol header 0x%02x", hdr);
-		return true;
-	}
+		if (len == 0) {
+			DBG("BT socket read returned 0 bytes");
+			break;
+		}
 
-	if (len < 2) {
-		DBG("received empty HID report");
-		return true;
-	}
+		if (hdr != (HIDP_TRANS_DATA | HIDP_DATA_RTYPE_INPUT)) {
+			DBG("unsupported HIDP protocol header 0x%02x", hdr);
+			continue;
+		}
 
-	uhid_send_input_report(idev, data + 1, len - 1);
+		if (len < 2) {
+			DBG("received empty HID report");
+			continue;
+		}
+
+		uhid_send_input_event(idev, len - 1);
+	}
 
 	return true;
 }
@@ -313,6 +467,8 @@ static gboolean intr_watch_cb(GIOChannel *chan, GIOCondition cond, gpointer data
 
 	DBG("Device %s disconnected", address);
 
+	memset(&idev->stats, 0, sizeof(idev->stats));
+
 	/* Checking for ctrl_watch avoids a double g_io_channel_shutdown since
 	 * it's likely that ctrl_watch_cb has been queued for dispatching in
 	 * this mainloop iteration */
@@ -874,6 +1030,8 @@ static int uhid_connadd(struct input_device *idev, struct hidp_connadd_req *req)
 	bt_uhid_register(idev->uhid, UHID_OUTPUT, hidp_send_set_report, idev);
 	bt_uhid_register(idev->uhid, UHID_FEATURE, hidp_send_get_report, idev);
 
+	input_filter_init(idev, req->vendor, req->product);
+
 	idev->uhid_created = true;
 
 	return err;
@@ -941,10 +1099,9 @@ static int hidp_add_connection(struct input_device *idev)
 								dst_addr);
 	sprintf(handle, "0x%8.8X", idev->handle);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_load(filename);
 	str = g_key_file_get_string(key_file, "ServiceRecords", handle, NULL);
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 
 	if (!str) {
 		error("Rejected connection from unknown device %s", dst_addr);
@@ -1368,6 +1525,8 @@ int input_device_register(struct btd_service *service)
 			input_device_free(idev);
 			return -EIO;
 		}
+
+		bt_uhid_set_batch(idev->uhid, INPUT_INTR_BATCH);
 	}
 
 	if (g_dbus_register_interface(btd_get_dbus_connection(),
@@ -78,7 +78,11 @@
 
 #define HOG_REPORT_MAP_MAX_SIZE        512
 #define HID_INFO_SIZE			4
-#define ATT_NOTIFICATION_HEADER_SIZE	3
+#define ATT_NOTIFICATION_HANDLE_SIZE	2
+#define HOG_UHID_BATCH			16
+#define HOG_CACHE_VERSION		1
+#define HOG_CACHE_HEADER_SIZE		8
+#define HOG_CACHE_REPORT_SIZE		9
 
 struct bt_hog {
 	int			ref_count;
@@ -91,6 +95,7 @@ struct bt_hog {
 	GAttrib			*attrib;
 	GSList			*reports;
 	struct bt_uhid		*uhid;
+	struct uhid_event	*input_ev;
 	int			uhid_fd;
 	bool			uhid_created;
 	gboolean		has_report_id;
@@ -108,6 +113,14 @@ struct bt_hog {
 	struct queue		*bas;
 	GSList			*instances;
 	struct queue		*gatt_op;
+	uint8_t			*report_map;
+	uint16_t		report_map_len;
+	uint8_t			*cache;
+	size_t			cache_len;
+	bool			discovering;
+	guint			cache_id;
+	bt_hog_cache_func_t	cache_func;
+	void			*cache_data;
 };
 
 struct report {
@@ -118,7 +131,7 @@ struct report {
 	uint16_t		value_handle;
 	uint8_t			properties;
 	uint16_t		ccc_handle;
-	guint			notifyid;
+	unsigned int		notifyid;
 	uint16_t		len;
 	uint8_t			*value;
 };
@@ -152,10 +165,85 @@ static bool set_and_store_gatt_req(struct bt_hog *hog,
 	return queue_push_head(hog->gatt_op, req);
 }
 
+static void cache_store(struct bt_hog *hog)
+{
+	uint8_t *data, *ptr;
+	unsigned int count;
+	size_t len;
+	GSList *l;
+
+	count = g_slist_length(hog->reports);
+	if (count > UINT8_MAX)
+		return;
+
+	len = HOG_CACHE_HEADER_SIZE + hog->report_map_len + 1 +
+					count * HOG_CACHE_REPORT_SIZE;
+
+	data = g_malloc(len);
+
+	data[0] = HOG_CACHE_VERSION;
+	data[1] = hog->bcountrycode;
+	put_le16(hog->ctrlpt_handle, data + 2);
+	put_le16(hog->proto_mode_handle, data + 4);
+	put_le16(hog->report_map_len, data + 6);
+	memcpy(data + HOG_CACHE_HEADER_SIZE, hog->report_map,
+						hog->report_map_len);
+
+	ptr = data + HOG_CACHE_HEADER_SIZE + hog->report_map_len;
+	*ptr++ = count;
+
+	for (l = hog->reports; l; l = l->next) {
+		struct report *report = l->data;
+
+		ptr[0] = report->id;
+		ptr[1] = report->type;
+		put_le16(report->handle, ptr + 2);
+		put_le16(report->value_handle, ptr + 4);
+		ptr[6] = report->properties;
+		put_le16(report->ccc_handle, ptr + 7);
+		ptr += HOG_CACHE_REPORT_SIZE;
+	}
+
+	DBG("HoG storing report cache (%zu bytes)", len);
+
+	hog->cache_func(data, len, hog->cache_data);
+
+	g_free(data);
+}
+
+static gboolean cache_store_cb(gpointer user_data)
+{
+	struct bt_hog *hog = user_data;
+
+	hog->cache_id = 0;
+
+	/* Responses may have queued further requests in the meantime */
+	if (!hog->discovering || !queue_isempty(hog->gatt_op))
+		return FALSE;
+
+	hog->discovering = false;
+
+	if (hog->uhid_created && hog->cache_func && !hog->instances)
+		cache_store(hog);
+
+	return FALSE;
+}
+
 static void destroy_gatt_req(struct gatt_request *req)
 {
-	queue_remove(req->hog->gatt_op, req);
-	bt_hog_unref(req->hog);
+	struct bt_hog *hog = req->hog;
+
+	queue_remove(hog->gatt_op, req);
+
+	/*
+	 * Once the initial discovery runs out of requests every report
+	 * reference and the report map are known. Callbacks still update
+	 * their report after releasing the request, so store from idle.
+	 */
+	if (hog->discovering && !hog->cache_id && queue_isempty(hog->gatt_op))
+		hog->cache_id = g_idle_add(cache_store_cb, hog);
+
+	bt_hog_unref(hog);
 	free(req);
 }
 
@@ -289,44 +377,80 @@ static void find_included(struct bt_hog *hog, GAttrib *attrib,
 	free(req);
 }
 
-static void report_value_cb(const guint8 *pdu, guint16 len, gpointer user_data)
+static void report_value_cb(uint8_t opcode, const void *pdu,
+					uint16_t len, void *user_data)
 {
 	struct report *report = user_data;
 	struct bt_hog *hog = report->hog;
-	struct uhid_event ev;
+	struct uhid_event *ev = hog->input_ev;
 	uint8_t *buf;
 	int err;
 
-	if (len < ATT_NOTIFICATION_HEADER_SIZE) {
+	if (len < ATT_NOTIFICATION_HANDLE_SIZE) {
 		error("Malformed ATT notification");
 		return;
 	}
 
-	pdu += ATT_NOTIFICATION_HEADER_SIZE;
-	len -= ATT_NOTIFICATION_HEADER_SIZE;
+	pdu += ATT_NOTIFICATION_HANDLE_SIZE;
+	len -= ATT_NOTIFICATION_HANDLE_SIZE;
 
-	memset(&ev, 0, sizeof(ev));
-	ev.type = UHID_INPUT;
-	buf = ev.u.input.data;
+	/*
+	 * Only the header and the used part of the data are updated, the
+	 * kernel ignores anything past the reported size.
+	 */
+	ev->type = UHID_INPUT;
+	buf = ev->u.input.data;
 
 	if (hog->has_report_id) {
 		buf[0] = report->id;
-		len = MIN(len, sizeof(ev.u.input.data) - 1);
+		len = MIN(len, sizeof(ev->u.input.data) - 1);
 		memcpy(buf + 1, pdu, len);
-		ev.u.input.size = ++len;
+		ev->u.input.size = ++len;
 	} else {
-		len = MIN(len, sizeof(ev.u.input.data));
+		len = MIN(len, sizeof(ev->u.input.data));
 		memcpy(buf, pdu, len);
-		ev.u.input.size = len;
+		ev->u.input.size = len;
 	}
 
-	err = bt_uhid_send(hog->uhid, &ev);
+	err = bt_uhid_send(hog->uhid, ev);
 	if (err < 0) {
 		error("bt_uhid_send: %s (%d)", strerror(-err), -err);
 		return;
 	}
 }
 
+static void report_register(struct report *report)
+{
+	struct bt_hog *hog = report->hog;
+	struct bt_att *att = g_attrib_get_att(hog->attrib);
+
+	if (!hog->input_ev) {
+		hog->input_ev = new0(struct uhid_event, 1);
+		if (!hog->input_ev)
+			return;
+	}
+
+	/*
+	 * Go straight to bt_att instead of g_attrib_register, which would
+	 * allocate and copy a full PDU for every notification received.
+	 */
+	report->notifyid = bt_att_register_handle(att,
+					BT_ATT_OP_HANDLE_VAL_NOT,
+					report->value_handle,
+					report_value_cb, report, NULL);
+}
+
+static void report_unregister(struct report *report)
+{
+	struct bt_hog *hog = report->hog;
+
+	if (!report->notifyid)
+		return;
+
+	bt_att_unregister(g_attrib_get_att(hog->attrib), report->notifyid);
+	report->notifyid = 0;
+}
+
 static void report_ccc_written_cb(guint8 status, const guint8 *pdu,
 					guint16 plen, gpointer user_data)
 {
@@ -342,10 +466,7 @@ static void report_ccc_written_cb(guint8 status, const guint8 *pdu,
 		return;
 	}
 
-	report->notifyid = g_attrib_register(hog->attrib,
-					ATT_OP_HANDLE_NOTIFY,
-					report->value_handle,
-					report_value_cb, report, NULL);
+	report_register(report);
 
 	DBG("Report characteristic descriptor written: notifications enabled");
 }
@@ -934,33 +1055,13 @@ static char *item2string(char *str, uint8_t *buf, uint8_t len)
 	return str;
 }
 
-static void report_map_read_cb(guint8 status, const guint8 *pdu, guint16 plen,
-							gpointer user_data)
+static void uhid_create(struct bt_hog *hog, uint8_t *value, ssize_t vlen)
 {
-	struct gatt_request *req = user_data;
-	struct bt_hog *hog = req->user_data;
-	uint8_t value[HOG_REPORT_MAP_MAX_SIZE];
 	struct uhid_event ev;
-	ssize_t vlen;
 	char itemstr[20]; /* 5x3 (data) + 4 (continuation) + 1 (null) */
 	int i, err;
 	GError *gerr = NULL;
 
-	destroy_gatt_req(req);
-
-	DBG("HoG inspecting report map");
-
-	if (status != 0) {
-		error("Report Map read failed: %s", att_ecode2str(status));
-		return;
-	}
-
-	vlen = dec_read_resp(pdu, plen, value, sizeof(value));
-	if (vlen < 0) {
-		error("ATT protocol error");
-		return;
-	}
-
 	DBG("Report MAP:");
 	for (i = 0; i < vlen;) {
 		ssize_t ilen = 0;
@@ -1022,6 +1123,36 @@ static void report_map_read_cb(guint8 status, const guint8 *pdu, guint16 plen,
 	DBG("HoG created uHID device");
 }
 
+static void report_map_read_cb(guint8 status, const guint8 *pdu, guint16 plen,
+							gpointer user_data)
+{
+	struct gatt_request *req = user_data;
+	struct bt_hog *hog = req->user_data;
+	uint8_t value[HOG_REPORT_MAP_MAX_SIZE];
+	ssize_t vlen;
+
+	destroy_gatt_req(req);
+
+	DBG("HoG inspecting report map");
+
+	if (status != 0) {
+		error("Report Map read failed: %s", att_ecode2str(status));
+		return;
+	}
+
+	vlen = dec_read_resp(pdu, plen, value, sizeof(value));
+	if (vlen < 0) {
+		error("ATT protocol error");
+		return;
+	}
+
+	g_free(hog->report_map);
+	hog->report_map = g_memdup(value, vlen);
+	hog->report_map_len = vlen;
+
+	uhid_create(hog, value, vlen);
+}
+
 static void info_read_cb(guint8 status, const guint8 *pdu, guint16 plen,
 							gpointer user_data)
 {
@@ -1174,13 +1305,22 @@ static void hog_free(void *data)
 
 	bt_hog_detach(hog);
 
+	hog->discovering = false;
+
+	if (hog->cache_id > 0)
+		g_source_remove(hog->cache_id);
+
 	queue_destroy(hog->bas, (void *) bt_bas_unref);
 	g_slist_free_full(hog->instances, hog_free);
 
 	bt_scpp_unref(hog->scpp);
 	bt_dis_unref(hog->dis);
 	bt_uhid_unref(hog->uhid);
+	free(hog->input_ev);
 	g_slist_free_full(hog->reports, report_free);
+	g_free(hog->report_map);
+	g_free(hog->cache);
+
 	g_free(hog->name);
 	g_free(hog->primary);
 	queue_destroy(hog->gatt_op, (void *) destroy_gatt_req);
@@ -1337,6 +1477,8 @@ static struct bt_hog *hog_new(int fd, const char *name, uint16_t vendor,
 		return NULL;
 	}
 
+	bt_uhid_set_batch(hog->uhid, HOG_UHID_BATCH);
+
 	hog->name = g_strdup(name);
 	hog->vendor = vendor;
 	hog->product = product;
@@ -1565,6 +1707,144 @@ static void primary_cb(uint8_t status, GSList *services, void *user_data)
 	}
 }
 
+static int report_handle_cmp(const void *data, const void *user_data)
+{
+	const struct report *report = data;
+	uint16_t handle = GPOINTER_TO_UINT(user_data);
+
+	return report->handle - handle;
+}
+
+static bool cache_valid(struct bt_hog *hog, const uint8_t *data, size_t len)
+{
+	uint16_t map_len, start = 0x0001, end = 0xffff;
+	const uint8_t *ptr;
+	unsigned int count;
+
+	if (len < HOG_CACHE_HEADER_SIZE + 1 || data[0] != HOG_CACHE_VERSION)
+		return false;
+
+	map_len = get_le16(data + 6);
+	if (!map_len || map_len > HOG_REPORT_MAP_MAX_SIZE ||
+				len < HOG_CACHE_HEADER_SIZE + map_len + 1u)
+		return false;
+
+	ptr = data + HOG_CACHE_HEADER_SIZE + map_len;
+	count = *ptr++;
+
+	if (len != (size_t) (ptr - data) + count * HOG_CACHE_REPORT_SIZE)
+		return false;
+
+	if (hog->attr)
+		gatt_db_attribute_get_service_handles(hog->attr, &start, &end);
+
+	/* Stale entries from an older database would point elsewhere */
+	for (; count; count--, ptr += HOG_CACHE_REPORT_SIZE) {
+		uint16_t value_handle = get_le16(ptr + 4);
+
+		if (value_handle < start || value_handle > end)
+			return false;
+	}
+
+	return true;
+}
+
+static bool cache_apply(struct bt_hog *hog)
+{
+	const uint8_t *ptr;
+	uint8_t map[HOG_REPORT_MAP_MAX_SIZE];
+	uint16_t map_len;
+	unsigned int count;
+
+	/* Only single service devices are cached */
+	if (!hog->cache || hog->instances)
+		return false;
+
+	if (!cache_valid(hog, hog->cache, hog->cache_len)) {
+		DBG("HoG ignoring invalid report cache");
+		goto done;
+	}
+
+	hog->bcountrycode = hog->cache[1];
+	hog->ctrlpt_handle = get_le16(hog->cache + 2);
+	hog->proto_mode_handle = get_le16(hog->cache + 4);
+
+	map_len = get_le16(hog->cache + 6);
+	memcpy(map, hog->cache + HOG_CACHE_HEADER_SIZE, map_len);
+
+	ptr = hog->cache + HOG_CACHE_HEADER_SIZE + map_len;
+	count = *ptr++;
+
+	for (; count; count--, ptr += HOG_CACHE_REPORT_SIZE) {
+		uint16_t handle = get_le16(ptr + 2);
+		struct report *report;
+		GSList *l;
+
+		l = g_slist_find_custom(hog->reports, GUINT_TO_POINTER(handle),
+							report_handle_cmp);
+		if (l)
+			report = l->data;
+		else {
+			report = g_new0(struct report, 1);
+			report->hog = hog;
+			report->handle = handle;
+			hog->reports = g_slist_append(hog->reports, report);
+		}
+
+		report->id = ptr[0];
+		report->type = ptr[1];
+		report->value_handle = get_le16(ptr + 4);
+		report->properties = ptr[6];
+		report->ccc_handle = get_le16(ptr + 7);
+	}
+
+	g_free(hog->report_map);
+	hog->report_map = g_memdup(map, map_len);
+	hog->report_map_len = map_len;
+
+	uhid_create(hog, map, map_len);
+
+	/*
+	 * Protocol Mode falls back to Report Mode on every connection, a
+	 * write without response makes sure without waiting on a read.
+	 */
+	if (hog->uhid_created && hog->proto_mode_handle) {
+		uint8_t nval = HOG_PROTO_MODE_REPORT;
+
+		gatt_write_cmd(hog->attrib, hog->proto_mode_handle, &nval,
+						sizeof(nval), NULL, NULL);
+	}
+
+done:
+	g_free(hog->cache);
+	hog->cache = NULL;
+	hog->cache_len = 0;
+
+	return hog->uhid_created;
+}
+
+void bt_hog_set_cache_func(struct bt_hog *hog, bt_hog_cache_func_t func,
+							void *user_data)
+{
+	if (!hog)
+		return;
+
+	hog->cache_func = func;
+	hog->cache_data = user_data;
+}
+
+bool bt_hog_load_cache(struct bt_hog *hog, const void *data, size_t len)
+{
+	if (!hog || !data || !len || hog->uhid_created)
+		return false;
+
+	g_free(hog->cache);
+	hog->cache = g_memdup(data, len);
+	hog->cache_len = len;
+
+	return true;
+}
+
 bool bt_hog_attach(struct bt_hog *hog, void *gatt)
 {
 	GSList *l;
@@ -1593,8 +1873,12 @@ bool bt_hog_attach(struct bt_hog *hog, void *gatt)
 		bt_hog_attach(instance, gatt);
 	}
 
+	if (!hog->uhid_created && cache_apply(hog))
+		DBG("HoG restored from cache");
+
 	if (!hog->uhid_created) {
 		DBG("HoG discovering characteristics");
+		hog->discovering = true;
 		if (hog->attr)
 			gatt_db_service_foreach_char(hog->attr,
 							foreach_hog_chrc, hog);
@@ -1606,14 +1890,8 @@ bool bt_hog_attach(struct bt_hog *hog, void *gatt)
 		return true;
 	}
 
-	for (l = hog->reports; l; l = l->next) {
-		struct report *r = l->data;
-
-		r->notifyid = g_attrib_register(hog->attrib,
-					ATT_OP_HANDLE_NOTIFY,
-					r->value_handle,
-					report_value_cb, r, NULL);
-	}
+	for (l = hog->reports; l; l = l->next)
+		report_register(l->data);
 
 	return true;
 }
@@ -1625,6 +1903,14 @@ void bt_hog_detach(struct bt_hog *hog)
 	if (!hog->attrib)
 		return;
 
+	/* Whatever was discovered so far is incomplete, don't store it */
+	hog->discovering = false;
+
+	if (hog->cache_id > 0) {
+		g_source_remove(hog->cache_id);
+		hog->cache_id = 0;
+	}
+
 	queue_foreach(hog->bas, (void *) bt_bas_detach, NULL);
 
 	for (l = hog->instances; l; l = l->next) {
@@ -1633,14 +1919,8 @@ void bt_hog_detach(struct bt_hog *hog)
 		bt_hog_detach(instance);
 	}
 
-	for (l = hog->reports; l; l = l->next) {
-		struct report *r = l->data;
-
-		if (r->notifyid > 0) {
-			g_attrib_unregister(hog->attrib, r->notifyid);
-			r->notifyid = 0;
-		}
-	}
+	for (l = hog->reports; l; l = l->next)
+		report_unregister(l->data);
 
 	if (hog->scpp)
 		bt_scpp_detach(hog->scpp);
@@ -34,6 +34,13 @@ struct bt_hog *bt_hog_new(int fd, const char *name, uint16_t vendor,
 struct bt_hog *bt_hog_ref(struct bt_hog *hog);
 void bt_hog_unref(struct bt_hog *hog);
 
+typedef void (*bt_hog_cache_func_t)(const void *data, size_t len,
+							void *user_data);
+
+void bt_hog_set_cache_func(struct bt_hog *hog, bt_hog_cache_func_t func,
+							void *user_data);
+bool bt_hog_load_cache(struct bt_hog *hog, const void *data, size_t len);
+
 bool bt_hog_attach(struct bt_hog *hog, void *gatt);
 void bt_hog_detach(struct bt_hog *hog);
 
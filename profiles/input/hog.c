@@ -27,8 +27,11 @@
 #include <config.h>
 #endif
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <limits.h>
 #include <errno.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -42,6 +45,7 @@
 #include "lib/uuid.h"
 
 #include "src/log.h"
+#include "src/storage.h"
 #include "src/adapter.h"
 #include "src/device.h"
 #include "src/profile.h"
@@ -58,6 +62,8 @@
 #include "hog-lib.h"
 
 #define HOG_UUID		"00001812-0000-1000-8000-00805f9b34fb"
+#define HOG_CACHE_GROUP		"HoG"
+#define HOG_CACHE_KEY		"ReportCache"
 
 struct hog_device {
 	struct btd_device	*device;
@@ -67,6 +73,86 @@ struct hog_device {
 static gboolean suspend_supported = FALSE;
 static struct queue *devices = NULL;
 
+static void cache_filename(struct hog_device *dev, char *filename,
+								size_t size)
+{
+	struct btd_adapter *adapter = device_get_adapter(dev->device);
+	char src_addr[18], dst_addr[18];
+
+	ba2str(btd_adapter_get_address(adapter), src_addr);
+	ba2str(device_get_address(dev->device), dst_addr);
+
+	snprintf(filename, size, STORAGEDIR "/%s/cache/%s", src_addr,
+								dst_addr);
+}
+
+static void hog_cache_store(const void *data, size_t len, void *user_data)
+{
+	struct hog_device *dev = user_data;
+	const uint8_t *ptr = data;
+	char filename[PATH_MAX];
+	GKeyFile *key_file;
+	char *str;
+	size_t i;
+
+	/* Only bonded devices are expected to keep their CCC state */
+	if (!device_is_bonded(dev->device,
+				btd_device_get_bdaddr_type(dev->device)))
+		return;
+
+	str = g_malloc(len * 2 + 1);
+
+	for (i = 0; i < len; i++)
+		sprintf(str + (i * 2), "%2.2X", ptr[i]);
+
+	cache_filename(dev, filename, sizeof(filename));
+
+	key_file = storage_load(filename);
+	g_key_file_set_string(key_file, HOG_CACHE_GROUP, HOG_CACHE_KEY, str);
+	storage_save(filename, key_file);
+	g_key_file_unref(key_file);
+
+	g_free(str);
+}
+
+static void hog_cache_load(struct hog_device *dev)
+{
+	char filename[PATH_MAX];
+	GKeyFile *key_file;
+	uint8_t *data;
+	size_t i, len;
+	char *str;
+
+	if (!device_is_bonded(dev->device,
+				btd_device_get_bdaddr_type(dev->device)))
+		return;
+
+	cache_filename(dev, filename, sizeof(filename));
+
+	key_file = storage_load(filename);
+	str = g_key_file_get_string(key_file, HOG_CACHE_GROUP, HOG_CACHE_KEY,
+									NULL);
+	g_key_file_unref(key_file);
+
+	if (!str)
+		return;
+
+	len = strlen(str) / 2;
+	data = g_malloc(len);
+
+	for (i = 0; i < len; i++) {
+		char tmp[3] = { str[i * 2], str[i * 2 + 1], '\0' };
+
+		data[i] = strtol(tmp, NULL, 16);
+	}
+
+	if (len)
+		bt_hog_load_cache(dev->hog, data, len);
+
+	g_free(data);
+	g_free(str);
+}
+
 static void hog_device_accept(struct hog_device *dev, struct gatt_db *db)
 {
 	char name[248];
@@ -88,6 +174,12 @@ static void hog_device_accept(struct hog_device *dev, struct gatt_db *db)
 							product, version);
 
 	dev->hog = bt_hog_new_default(name, vendor, product, version, db);
+	if (!dev->hog)
+		return;
+
+	/* Reconnects can create the uHID device without any discovery */
+	bt_hog_set_cache_func(dev->hog, hog_cache_store, dev);
+	hog_cache_load(dev);
 }
 
 static struct hog_device *hog_device_new(struct btd_device *device)
@@ -237,5 +329,10 @@ static void hog_exit(void)
 	btd_profile_unregister(&hog_profile);
 }
 
-BLUETOOTH_PLUGIN_DEFINE(hog, VERSION, BLUETOOTH_PLUGIN_PRIORITY_DEFAULT,
-							hog_init, hog_exit)
+static const char * const hog_uuids[] = {
+	HOG_UUID,
+	NULL
+};
+
+BLUETOOTH_PLUGIN_DEFINE_LAZY(hog, VERSION, BLUETOOTH_PLUGIN_PRIORITY_DEFAULT,
+					hog_init, hog_exit, hog_uuids)
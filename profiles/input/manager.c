@@ -96,7 +96,7 @@ static int input_init(void)
 	config = load_config_file(CONFIGDIR "/input.conf");
 	if (config) {
 		int idle_timeout;
-		gboolean uhid_enabled;
+		gboolean uhid_enabled, report_stats, filter_reports;
 
 		idle_timeout = g_key_file_get_integer(config, "General",
 							"IdleTimeout", &err);
@@ -114,6 +114,24 @@ static int input_init(void)
 			input_enable_userspace_hid(uhid_enabled);
 		} else
 			g_clear_error(&err);
+
+		report_stats = g_key_file_get_boolean(config, "General",
+							"ReportStats", &err);
+		if (!err) {
+			DBG("input.conf: ReportStats=%s", report_stats ?
+							"true" : "false");
+			input_enable_report_stats(report_stats);
+		} else
+			g_clear_error(&err);
+
+		filter_reports = g_key_file_get_boolean(config, "General",
+						"FilterRepeatedReports", &err);
+		if (!err) {
+			DBG("input.conf: FilterRepeatedReports=%s",
+					filter_reports ? "true" : "false");
+			input_enable_report_filter(filter_reports);
+		} else
+			g_clear_error(&err);
 	}
 
 	btd_profile_register(&input_profile);
@@ -129,5 +147,10 @@ static void input_exit(void)
 	btd_profile_unregister(&input_profile);
 }
 
-BLUETOOTH_PLUGIN_DEFINE(input, VERSION, BLUETOOTH_PLUGIN_PRIORITY_DEFAULT,
-							input_init, input_exit)
+static const char * const input_uuids[] = {
+	HID_UUID,
+	NULL
+};
+
+BLUETOOTH_PLUGIN_DEFINE_LAZY(input, VERSION, BLUETOOTH_PLUGIN_PRIORITY_DEFAULT,
+					input_init, input_exit, input_uuids)
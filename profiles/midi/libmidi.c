@@ -77,7 +77,6 @@ inline static void append_timestamp_high_maybe(struct midi_write_parser *parser)
 	if (midi_write_has_data(parser))
 		return;
 
-	parser->rtime = g_get_monotonic_time() / 1000; /* convert µs to ms */
 	timestamp_high |= (parser->rtime & 0x1F80) >> 7;
 	/* set timestampHigh */
 	buffer_append_byte(&parser->midi_stream, timestamp_high);
@@ -87,6 +86,7 @@ inline static void append_timestamp_low(struct midi_write_parser *parser)
 {
 	const uint8_t timestamp_low = 0x80 | (parser->rtime & 0x7F);
 	buffer_append_byte(&parser->midi_stream, timestamp_low);
+	parser->ts_time = parser->rtime;
 }
 
 int midi_write_init(struct midi_write_parser *parser, size_t buffer_size)
@@ -94,6 +94,7 @@ int midi_write_init(struct midi_write_parser *parser, size_t buffer_size)
 	int err;
 
 	parser->rtime = 0;
+	parser->ts_time = -1;
 	parser->rstatus = SND_SEQ_EVENT_NONE;
 	parser->stream_size = buffer_size;
 
@@ -112,25 +113,14 @@ int midi_write_init(struct midi_write_parser *parser, size_t buffer_size)
 
 int midi_read_init(struct midi_read_parser *parser)
 {
-	int err;
-
-	parser->rstatus = 0;
 	parser->rtime = -1;
 	parser->timestamp = 0;
-	parser->timestamp_low = 0;
-	parser->timestamp_high = 0;
-
-	parser->sysex_stream.data = malloc(MIDI_SYSEX_MAX_SIZE);
-	if (!parser->sysex_stream.data)
-		return -ENOMEM;
-
+	parser->sysex_stream.data = parser->sysex_data;
 	parser->sysex_stream.len = 0;
 
-	err = snd_midi_event_new(MIDI_MSG_MAX_SIZE, &parser->midi_ev);
-	if (err < 0)
-		free(parser->sysex_stream.data);
+	midi_read_reset(parser);
 
-	return err;
+	return 0;
 }
 
 /* Algorithm:
@@ -199,47 +189,61 @@ static void read_ev_sysex(struct midi_write_parser *parser, const snd_seq_event_
 static void read_ev_others(struct midi_write_parser *parser, const snd_seq_event_t *ev,
                            midi_read_ev_cb write_cb, void *user_data)
 {
-	int length;
-
-	/* check for running status */
-	if (parser->rstatus != ev->type) {
+	uint8_t msg[MIDI_MSG_MAX_SIZE];
+	bool timestamp;
+	long length;
+
+	/* A new packet, or one following a SysEx, cannot rely on
+	   running status */
+	if (parser->rstatus == SND_SEQ_EVENT_NONE ||
+	    parser->rstatus == SND_SEQ_EVENT_SYSEX)
 		snd_midi_event_reset_decode(parser->midi_ev);
-		append_timestamp_low(parser);
-	}
 
-	/* each midi message has timestampLow byte to follow */
-	length = snd_midi_event_decode(parser->midi_ev,
-	                               parser->midi_stream.data +
-	                               parser->midi_stream.len,
-	                               parser_get_available_size(parser),
-	                               ev);
-
-	if (length == -ENOMEM) {
-		/* remove previously added timestampLow */
-		if (parser->rstatus != ev->type)
-			parser->midi_stream.len--;
+	length = snd_midi_event_decode(parser->midi_ev, msg, sizeof(msg), ev);
+	if (length <= 0)
+		return;
+
+	/* Every status byte needs a timestampLow in front of it, running
+	   status data only when the time moved since the last one */
+	timestamp = (msg[0] & 0x80) || parser->ts_time != parser->rtime;
+
+	if (parser_get_available_size(parser) < (size_t) length + timestamp) {
 		write_cb(parser, user_data);
 		/* cleanup state for next packet */
 		snd_midi_event_reset_decode(parser->midi_ev);
 		midi_write_reset(parser);
 		append_timestamp_high_maybe(parser);
-		append_timestamp_low(parser);
-		length = snd_midi_event_decode(parser->midi_ev,
-		                               parser->midi_stream.data +
-		                               parser->midi_stream.len,
-		                               parser_get_available_size(parser),
-		                               ev);
+
+		length = snd_midi_event_decode(parser->midi_ev, msg,
+		                               sizeof(msg), ev);
+		if (length <= 0)
+			return;
+
+		timestamp = true;
 	}
 
-	if (length > 0)
-		parser->midi_stream.len += length;
+	if (timestamp)
+		append_timestamp_low(parser);
+
+	buffer_append_data(&parser->midi_stream, msg, length);
 }
 
 void midi_read_ev(struct midi_write_parser *parser, const snd_seq_event_t *ev,
                   midi_read_ev_cb write_cb, void *user_data)
 {
+	int64_t rtime = g_get_monotonic_time() / 1000; /* convert µs to ms */
+
 	MIDI_ASSERT(write_cb);
 
+	/* Receivers can only tell that timestampLow wrapped once between two
+	   consecutive timestamps, so these must be less than 128ms apart */
+	if (midi_write_has_data(parser) && rtime - parser->rtime > 0x7F) {
+		write_cb(parser, user_data);
+		midi_write_reset(parser);
+	}
+
+	parser->rtime = rtime;
+
 	append_timestamp_high_maybe(parser);
 
 	/* SysEx is special case:
@@ -258,209 +262,291 @@ void midi_read_ev(struct midi_write_parser *parser, const snd_seq_event_t *ev,
 	}
 }
 
-static void update_ev_timestamp(struct midi_read_parser *parser,
-                                snd_seq_event_t *ev, uint16_t ts_low)
+/*
+ * How far the reconstructed time may run ahead of the local clock, and how
+ * far back a timestamp may go, before it is no longer treated as jitter.
+ */
+#define MIDI_TIMESTAMP_SLACK 1000
+
+static void update_timestamp(struct midi_read_parser *parser, uint8_t ts_low)
 {
-	int delta_timestamp;
-	int delta_rtime;
 	int64_t rtime_current;
 	uint16_t timestamp;
+	int64_t elapsed;
+	int delta;
 
-	/* time_low overwflow results on time_high to increment by one */
-	if (parser->timestamp_low > ts_low)
-		parser->timestamp_high++;
+	/* timestampLow wrapping within a packet carries into timestampHigh */
+	if (ts_low < parser->timestamp_low)
+		parser->timestamp_high = (parser->timestamp_high + 1) & 0x3F;
 
-	timestamp = (parser->timestamp_high << 7) | parser->timestamp_low;
+	parser->timestamp_low = ts_low;
+	timestamp = (parser->timestamp_high << 7) | ts_low;
 
 	rtime_current = g_get_monotonic_time() / 1000; /* convert µs to ms */
-	delta_timestamp = timestamp - (int)parser->timestamp;
-	delta_rtime = rtime_current - parser->rtime;
+	elapsed = rtime_current - parser->rtime;
 
-	if (delta_rtime > MIDI_MAX_TIMESTAMP)
+	/* After an idle period longer than the 13-bit timestamp range the
+	   delta is ambiguous, so anchor on the local clock again. */
+	if (parser->rtime < 0 || elapsed > MIDI_MAX_TIMESTAMP) {
 		parser->rtime = rtime_current;
-	else {
-
-		/* If delta_timestamp is way to big than delta_rtime,
-		   this means that the device sent a message in the past,
-		   so we have to compensate for this. */
-		if (delta_timestamp > 7000 && delta_rtime < 1000)
-			delta_timestamp = 0;
-
-		/* check if timestamp did overflow */
-		if (delta_timestamp < 0) {
-			/* same timestamp in the past problem */
-			if ((delta_timestamp + MIDI_MAX_TIMESTAMP) > 7000 &&
-			    delta_rtime < 1000)
-				delta_timestamp = 0;
-			else
-				delta_timestamp = delta_timestamp + MIDI_MAX_TIMESTAMP;
-		}
+		parser->timestamp = timestamp;
+		return;
+	}
+
+	delta = (timestamp - parser->timestamp) & MIDI_MAX_TIMESTAMP;
 
-		parser->rtime += delta_timestamp;
+	if (delta > elapsed + MIDI_TIMESTAMP_SLACK) {
+		/* A timestamp slightly older than the last one wraps around
+		   to almost a full period; keep the time monotonic. */
+		if (MIDI_MAX_TIMESTAMP + 1 - delta <= MIDI_TIMESTAMP_SLACK)
+			return;
+
+		/* Sender clock is running ahead of ours, resync to it */
+		delta = 0;
 	}
 
-	parser->timestamp += delta_timestamp;
-	if (parser->timestamp > MIDI_MAX_TIMESTAMP)
-		parser->timestamp %= MIDI_MAX_TIMESTAMP + 1;
+	parser->rtime += delta;
+	parser->timestamp = timestamp;
+}
+
+static void set_ev_time(const struct midi_read_parser *parser,
+                        snd_seq_event_t *ev)
+{
+	if (parser->rtime < 0)
+		return;
+
+	ev->flags &= ~SND_SEQ_TIME_STAMP_MASK;
+	ev->flags |= SND_SEQ_TIME_STAMP_REAL;
+	ev->time.time.tv_sec = parser->rtime / 1000;
+	ev->time.time.tv_nsec = (parser->rtime % 1000) * 1000000;
+}
 
-	/* set event timestamp */
-	/* TODO: update event timestamp here! */
+static void fill_note(snd_seq_event_t *ev, uint8_t status, const uint8_t *data)
+{
+	ev->data.note.channel = status & 0x0F;
+	ev->data.note.note = data[0];
+	ev->data.note.velocity = data[1];
 }
 
-static size_t handle_end_of_sysex(struct midi_read_parser *parser,
-                                  snd_seq_event_t *ev,
-                                  const uint8_t *data,
-                                  size_t sysex_length)
+static void fill_ctrl(snd_seq_event_t *ev, uint8_t status, const uint8_t *data)
 {
+	ev->data.control.channel = status & 0x0F;
+	ev->data.control.param = data[0];
+	ev->data.control.value = data[1];
+}
+
+static void fill_ctrl_value(snd_seq_event_t *ev, uint8_t status,
+                            const uint8_t *data)
+{
+	ev->data.control.channel = status & 0x0F;
+	ev->data.control.value = data[0];
+}
+
+static void fill_pitchbend(snd_seq_event_t *ev, uint8_t status,
+                           const uint8_t *data)
+{
+	ev->data.control.channel = status & 0x0F;
+	ev->data.control.value = (data[0] | (data[1] << 7)) - 8192;
+}
+
+static void fill_value(snd_seq_event_t *ev, uint8_t status,
+                       const uint8_t *data)
+{
+	ev->data.control.value = data[0];
+}
+
+static void fill_songpos(snd_seq_event_t *ev, uint8_t status,
+                         const uint8_t *data)
+{
+	ev->data.control.value = data[0] | (data[1] << 7);
+}
+
+struct midi_status {
+	snd_seq_event_type_t type;
+	uint8_t len;            /* data bytes following the status byte */
+	void (*fill)(snd_seq_event_t *ev, uint8_t status, const uint8_t *data);
+};
+
+/* Channel messages, indexed by the upper nibble of the status byte */
+static const struct midi_status channel_status[] = {
+	{ SND_SEQ_EVENT_NOTEOFF,	2, fill_note },
+	{ SND_SEQ_EVENT_NOTEON,		2, fill_note },
+	{ SND_SEQ_EVENT_KEYPRESS,	2, fill_note },
+	{ SND_SEQ_EVENT_CONTROLLER,	2, fill_ctrl },
+	{ SND_SEQ_EVENT_PGMCHANGE,	1, fill_ctrl_value },
+	{ SND_SEQ_EVENT_CHANPRESS,	1, fill_ctrl_value },
+	{ SND_SEQ_EVENT_PITCHBEND,	2, fill_pitchbend },
+};
+
+/* System messages, indexed by the lower nibble of the status byte */
+static const struct midi_status system_status[] = {
+	{ SND_SEQ_EVENT_SYSEX,		0, NULL },
+	{ SND_SEQ_EVENT_QFRAME,		1, fill_value },
+	{ SND_SEQ_EVENT_SONGPOS,	2, fill_songpos },
+	{ SND_SEQ_EVENT_SONGSEL,	1, fill_value },
+	{ SND_SEQ_EVENT_NONE,		0, NULL },
+	{ SND_SEQ_EVENT_NONE,		0, NULL },
+	{ SND_SEQ_EVENT_TUNE_REQUEST,	0, NULL },
+	{ SND_SEQ_EVENT_NONE,		0, NULL },
+	{ SND_SEQ_EVENT_CLOCK,		0, NULL },
+	{ SND_SEQ_EVENT_NONE,		0, NULL },
+	{ SND_SEQ_EVENT_START,		0, NULL },
+	{ SND_SEQ_EVENT_CONTINUE,	0, NULL },
+	{ SND_SEQ_EVENT_STOP,		0, NULL },
+	{ SND_SEQ_EVENT_NONE,		0, NULL },
+	{ SND_SEQ_EVENT_SENSING,	0, NULL },
+	{ SND_SEQ_EVENT_RESET,		0, NULL },
+};
+
+inline static const struct midi_status *status_lookup(uint8_t status)
+{
+	if (status >= 0xF0)
+		return &system_status[status & 0x0F];
+
+	return &channel_status[(status >> 4) - 8];
+}
+
+static bool sysex_append(struct midi_read_parser *parser, const uint8_t *data,
+                         size_t size)
+{
+	if (parser->sysex_stream.len + size > MIDI_SYSEX_MAX_SIZE) {
+		/* Too long to be delivered, drop what was collected so far */
+		parser->sysex_stream.len = 0;
+		return false;
+	}
+
+	buffer_append_data(&parser->sysex_stream, data, size);
+
+	return true;
+}
+
+static size_t handle_sysex(struct midi_read_parser *parser,
+                           snd_seq_event_t *ev, const uint8_t *data,
+                           size_t size)
+{
+	const uint8_t *pos;
+	size_t sysex_length;
 	uint8_t time_low;
 
+	pos = memchr(data, 0xF7, size);
+	if (!pos) {
+		/* Not complete yet, it continues on the next packet */
+		sysex_append(parser, data, size);
+		return size;
+	}
+
 	/* At this time, timestampLow is copied as the last byte,
 	   instead of 0xF7 */
-	buffer_append_data(&parser->sysex_stream, data, sysex_length);
+	sysex_length = pos - data;
+	if (!sysex_append(parser, data, sysex_length))
+		return sysex_length + 1;
 
-	time_low = buffer_reverse_get(&parser->sysex_stream, 0) & 0x7F;
+	time_low = buffer_reverse_get(&parser->sysex_stream, 0);
+	if (!(time_low & 0x80)) {
+		/* Malformed: no timestampLow before the end of SysEx */
+		parser->sysex_stream.len = 0;
+		return sysex_length + 1;
+	}
 
-	/* Remove timestamp byte */
+	/* Replace timestamp byte */
 	buffer_reverse_set(&parser->sysex_stream, 0, 0xF7);
 
-	/* Update event */
-	update_ev_timestamp(parser, ev, time_low);
+	update_timestamp(parser, time_low & 0x7F);
+	set_ev_time(parser, ev);
 	snd_seq_ev_set_sysex(ev, parser->sysex_stream.len,
 	                     parser->sysex_stream.data);
+	parser->sysex_stream.len = 0;
 
 	return sysex_length + 1; /* +1 because of timestampLow */
 }
 
-
-
 size_t midi_read_raw(struct midi_read_parser *parser, const uint8_t *data,
                     size_t size, snd_seq_event_t *ev /* OUT */)
 {
-	size_t midi_size = 0;
+	const struct midi_status *st;
+	uint8_t status;
 	size_t i = 0;
-	bool err = false;
+	size_t pos;
 
-	if (parser->timestamp_high == 0)
-		parser->timestamp_high = data[i++] & 0x3F;
+	ev->type = SND_SEQ_EVENT_NONE;
 
-	snd_midi_event_reset_encode(parser->midi_ev);
+	if (parser->timestamp_high < 0) {
+		parser->timestamp_high = data[i++] & 0x3F;
+		if (i == size)
+			return i;
+	}
 
 	/* timestamp byte */
 	if (data[i] & 0x80) {
-		update_ev_timestamp(parser, ev, data[i] & 0x7F);
+		update_timestamp(parser, data[i] & 0x7F);
 
 		/* check for wrong BLE-MIDI message size */
-		if (++i == size) {
-			err = true;
-			goto _finish;
-		}
+		if (++i == size)
+			return i;
 	}
 
-	/* cleanup sysex_stream if message is broken or is a new SysEx */
-	if (data[i] >= 0x80 && data[i] != 0xF7 && parser->sysex_stream.len > 0)
-		parser->sysex_stream.len = 0;
+	status = data[i];
 
-	switch (data[i]) {
-	case 0xF8 ... 0XFF:
-		/* System Real-Time Messages */
-		midi_size = 1;
-		break;
-
-		/* System Common Messages */
-	case 0xF0: /* SysEx Start */ {
-		uint8_t *pos;
+	/* System Real-Time messages may be interleaved within a SysEx, any
+	   other status byte means the SysEx got broken */
+	if (status >= 0x80 && status < 0xF8 && status != 0xF7)
+		parser->sysex_stream.len = 0;
 
+	if (status == 0xF0) {
 		/* cleanup Running Status Message */
 		parser->rstatus = 0;
+		return i + handle_sysex(parser, ev, data + i, size - i);
+	}
 
-		/* Avoid parsing if SysEx is contained in one BLE packet */
-		if ((pos = memchr(data + i, 0xF7, size - i))) {
-			const size_t sysex_length = pos - (data + i);
-			midi_size = handle_end_of_sysex(parser, ev, data + i,
-			                                sysex_length);
-		} else {
-			buffer_append_data(&parser->sysex_stream, data + i, size - i);
-			err = true; /* Not an actual error, just incomplete message */
-			midi_size = size - i;
+	if (status == 0xF7) {
+		/* SysEx End, timestampLow was already processed */
+		if (parser->sysex_stream.len > 0 &&
+		    sysex_append(parser, &status, 1)) {
+			set_ev_time(parser, ev);
+			snd_seq_ev_set_sysex(ev, parser->sysex_stream.len,
+			                     parser->sysex_stream.data);
+			parser->sysex_stream.len = 0;
 		}
 
-		goto _finish;
+		return i + 1;
 	}
 
-	case 0xF1:
-	case 0xF3:
-		midi_size = 2;
-		break;
-	case 0xF2:
-		midi_size = 3;
-		break;
-	case 0xF4:
-	case 0xF5: /* Ignore */
-		i++;
-		err = true;
-		goto _finish;
-		break;
-	case 0xF6:
-		midi_size = 1;
-		break;
-	case 0xF7: /* SysEx End */
-		buffer_append_byte(&parser->sysex_stream, 0xF7);
-		snd_seq_ev_set_sysex(ev, parser->sysex_stream.len,
-		                     parser->sysex_stream.data);
-
-		midi_size = 1; /* timestampLow was alredy processed */
-		goto _finish;
-
-	case 0x80 ... 0xEF:
-		/*
-		 * Channel Voice Messages, Channel Mode Messages
-		 * and Control Change Messages.
-		 */
-		parser->rstatus = data[i];
-		midi_size = (data[i] >= 0xC0 && data[i] <= 0xDF) ? 2 : 3;
-		break;
-
-	case 0x00 ... 0x7F:
-
-		/* Check for SysEx messages */
-		if (parser->sysex_stream.len > 0) {
-			uint8_t *pos;
-
-			if ((pos = memchr(data + i, 0xF7, size - i))) {
-				const size_t sysex_length = pos - (data + i);
-				midi_size = handle_end_of_sysex(parser, ev, data + i,
-				                                sysex_length);
-			} else {
-				buffer_append_data(&parser->sysex_stream, data + i, size - i);
-				err = true; /* Not an actual error, just incomplete message */
-				midi_size = size - i;
-			}
-
-			goto _finish;
-		}
+	if (status < 0x80) {
+		/* SysEx continuation */
+		if (parser->sysex_stream.len > 0)
+			return i + handle_sysex(parser, ev, data + i, size - i);
 
 		/* Running State Message was not set */
-		if (parser->rstatus == 0) {
-			midi_size = 1;
-			err = true;
-			goto _finish;
-		}
+		if (parser->rstatus == 0)
+			return i + 1;
 
-		snd_midi_event_encode_byte(parser->midi_ev, parser->rstatus, ev);
-		midi_size = (parser->rstatus >= 0xC0 && parser->rstatus <= 0xDF) ? 1 : 2;
-		break;
-	}
+		status = parser->rstatus;
+		pos = i;
+	} else {
+		if (status < 0xF0)
+			parser->rstatus = status;
 
-	if ((i + midi_size) > size) {
-		err = true;
-		goto _finish;
+		pos = i + 1;
 	}
 
-	snd_midi_event_encode(parser->midi_ev, data + i, midi_size, ev);
+	st = status_lookup(status);
+
+	/* Truncated message: drop the rest of the packet */
+	if (pos + st->len > size)
+		return size;
+
+	if (st->type == SND_SEQ_EVENT_NONE)
+		return pos + st->len;
+
+	memset(&ev->data, 0, sizeof(ev->data));
+	ev->type = st->type;
+	ev->flags &= ~SND_SEQ_EVENT_LENGTH_MASK;
+	ev->flags |= SND_SEQ_EVENT_LENGTH_FIXED;
+
+	if (st->fill)
+		st->fill(ev, status, data + pos);
 
-_finish:
-	if (err)
-		ev->type = SND_SEQ_EVENT_NONE;
+	set_ev_time(parser, ev);
 
-	return i + midi_size;
+	return pos + st->len;
 }
@@ -45,6 +45,7 @@ struct midi_buffer {
 
 struct midi_write_parser {
 	int64_t rtime;                  /* last writer's real time */
+	int64_t ts_time;                /* time of the last timestampLow written */
 	snd_seq_event_type_t rstatus;   /* running status event type */
 	struct midi_buffer midi_stream; /* MIDI I/O byte stream */
 	size_t stream_size;             /* what is the maximum size of the midi_stream array */
@@ -62,6 +63,7 @@ static inline void midi_write_free(struct midi_write_parser *parser)
 static inline void midi_write_reset(struct midi_write_parser *parser)
 {
 	parser->rstatus = SND_SEQ_EVENT_NONE;
+	parser->ts_time = -1;
 	parser->midi_stream.len = 0;
 }
 
@@ -83,7 +85,8 @@ static inline size_t midi_write_data_size(const struct midi_write_parser *parser
 typedef void (*midi_read_ev_cb)(const struct midi_write_parser *parser, void *);
 
 /* It creates BLE-MIDI raw packets from the a sequencer event. If the packet
-   is full, then it calls write_cb and resets its internal state as many times
+   is full, or the event is too far in time from the previous one to share the
+   packet, then it calls write_cb and resets its internal state as many times
    as necessary.
  */
 void midi_read_ev(struct midi_write_parser *parser, const snd_seq_event_t *ev,
@@ -94,30 +97,32 @@ void midi_read_ev(struct midi_write_parser *parser, const snd_seq_event_t *ev,
 struct midi_read_parser {
 	uint8_t rstatus;                 /* running status byte */
 	int64_t rtime;                   /* last reader's real time */
-	int16_t timestamp;               /* last MIDI-BLE timestamp */
-	int8_t timestamp_low;            /* MIDI-BLE timestampLow from the current packet */
-	int8_t timestamp_high;           /* MIDI-BLE timestampHigh from the current packet */
+	uint16_t timestamp;              /* last MIDI-BLE timestamp */
+	uint8_t timestamp_low;           /* MIDI-BLE timestampLow from the current packet */
+	int8_t timestamp_high;           /* MIDI-BLE timestampHigh from the current packet,
+	                                    negative until the header is parsed */
 	struct midi_buffer sysex_stream; /* SysEx stream */
-	snd_midi_event_t *midi_ev;       /* midi<->seq event */
+	uint8_t sysex_data[MIDI_SYSEX_MAX_SIZE];
 };
 
 int midi_read_init(struct midi_read_parser *parser);
 
 static inline void midi_read_free(struct midi_read_parser *parser)
 {
-	free(parser->sysex_stream.data);
-	snd_midi_event_free(parser->midi_ev);
+	parser->sysex_stream.len = 0;
 }
 
 static inline void midi_read_reset(struct midi_read_parser *parser)
 {
 	parser->rstatus = 0;
 	parser->timestamp_low = 0;
-	parser->timestamp_high = 0;
+	parser->timestamp_high = -1;
 }
 
 /* Parses raw BLE-MIDI messages and populates a sequencer event representing the
    current MIDI message. It returns how much raw data was processed.
+   The event is stamped with the sender's time reconstructed from the BLE-MIDI
+   timestamps, expressed in the g_get_monotonic_time() clock.
  */
 size_t midi_read_raw(struct midi_read_parser *parser, const uint8_t *data,
                      size_t size, snd_seq_event_t *ev /* OUT */);
@@ -32,6 +32,7 @@
 
 #include <errno.h>
 #include <alsa/asoundlib.h>
+#include <glib.h>
 
 #include "lib/bluetooth.h"
 #include "lib/sdp.h"
@@ -48,11 +49,17 @@
 #include "src/shared/gatt-db.h"
 #include "src/shared/gatt-client.h"
 #include "src/shared/io.h"
+#include "src/shared/timeout.h"
 #include "src/log.h"
 #include "attrib/att.h"
 
 #include "libmidi.h"
 
+/* Default time in ms outgoing events wait to share a BLE-MIDI packet */
+#define MIDI_OUTPUT_LATENCY 5
+
+static unsigned int conf_latency = MIDI_OUTPUT_LATENCY;
+
 struct midi {
 	struct btd_device *dev;
 	struct gatt_db *db;
@@ -69,8 +76,36 @@ struct midi {
 	/* MIDI parser*/
 	struct midi_read_parser midi_in;
 	struct midi_write_parser midi_out;
+	unsigned int flush_id;
 };
 
+static void midi_send(struct midi *midi, const struct midi_write_parser *parser)
+{
+	bt_gatt_client_write_without_response(midi->client,
+	                                      midi->midi_io_handle,
+	                                      false,
+	                                      midi_write_data(parser),
+	                                      midi_write_data_size(parser));
+}
+
+static void midi_flush(struct midi *midi)
+{
+	if (midi_write_has_data(&midi->midi_out))
+		midi_send(midi, &midi->midi_out);
+
+	midi_write_reset(&midi->midi_out);
+}
+
+static bool midi_flush_timeout(void *user_data)
+{
+	struct midi *midi = user_data;
+
+	midi->flush_id = 0;
+	midi_flush(midi);
+
+	return false;
+}
+
 static bool midi_write_cb(struct io *io, void *user_data)
 {
 	struct midi *midi = user_data;
@@ -78,11 +113,7 @@ static bool midi_write_cb(struct io *io, void *user_data)
 
 	void foreach_cb(const struct midi_write_parser *parser, void *user_data) {
 		struct midi *midi = user_data;
-		bt_gatt_client_write_without_response(midi->client,
-		                                      midi->midi_io_handle,
-		                                      false,
-		                                      midi_write_data(parser),
-		                                      midi_write_data_size(parser));
+		midi_send(midi, parser);
 	};
 
 	do {
@@ -97,14 +128,16 @@ static bool midi_write_cb(struct io *io, void *user_data)
 
 	} while (err > 0);
 
-	if (midi_write_has_data(&midi->midi_out))
-		bt_gatt_client_write_without_response(midi->client,
-		                                      midi->midi_io_handle,
-		                                      false,
-		                                      midi_write_data(&midi->midi_out),
-		                                      midi_write_data_size(&midi->midi_out));
+	/* Full packets have already been sent, hold on to the last one
+	   for a little while so that following events can fill it up */
+	if (!conf_latency) {
+		midi_flush(midi);
+		return true;
+	}
 
-	midi_write_reset(&midi->midi_out);
+	if (midi_write_has_data(&midi->midi_out) && !midi->flush_id)
+		midi->flush_id = timeout_add(conf_latency, midi_flush_timeout,
+		                             midi, NULL);
 
 	return true;
 }
@@ -115,6 +148,7 @@ static void midi_io_value_cb(uint16_t value_handle, const uint8_t *value,
 	struct midi *midi = user_data;
 	snd_seq_event_t ev;
 	unsigned int i = 0;
+	int err;
 
 	if (length < 3) {
 		warn("MIDI I/O: Wrong packet format: length is %u bytes but it should "
@@ -132,19 +166,27 @@ static void midi_io_value_cb(uint16_t value_handle, const uint8_t *value,
 	while (i < length) {
 		size_t count = midi_read_raw(&midi->midi_in, value + i, length - i, &ev);
 
-		if (count == 0)
-			goto _err;
+		if (count == 0) {
+			error("Wrong BLE-MIDI message");
+			break;
+		}
 
-		if (ev.type != SND_SEQ_EVENT_NONE)
-			snd_seq_event_output_direct(midi->seq_handle, &ev);
+		/* Events are queued on the output buffer and delivered to the
+		   sequencer all at once when the whole packet is parsed */
+		if (ev.type != SND_SEQ_EVENT_NONE) {
+			err = snd_seq_event_output(midi->seq_handle, &ev);
+			if (err < 0)
+				warn("MIDI I/O: Failed to queue event: %s",
+				     snd_strerror(err));
+		}
 
 		i += count;
 	}
 
-	return;
-
-_err:
-	error("Wrong BLE-MIDI message");
+	err = snd_seq_drain_output(midi->seq_handle);
+	if (err < 0)
+		warn("MIDI I/O: Failed to deliver events: %s",
+		     snd_strerror(err));
 }
 
 static void midi_io_ccc_written_cb(uint16_t att_ecode, void *user_data)
@@ -441,6 +483,11 @@ static int midi_disconnect(struct btd_service *service)
 		return -ENODEV;
 	}
 
+	if (midi->flush_id) {
+		timeout_remove(midi->flush_id);
+		midi->flush_id = 0;
+	}
+
 	midi_read_free(&midi->midi_in);
 	midi_write_free(&midi->midi_out);
 	io_destroy(midi->io);
@@ -473,8 +520,39 @@ static struct btd_profile midi_profile = {
 	.disconnect = midi_disconnect,
 };
 
+static void read_config(const char *file)
+{
+	GKeyFile *keyfile;
+	GError *err = NULL;
+	int latency;
+
+	keyfile = g_key_file_new();
+
+	if (!g_key_file_load_from_file(keyfile, file, 0, &err)) {
+		g_clear_error(&err);
+		goto done;
+	}
+
+	latency = g_key_file_get_integer(keyfile, "General", "OutputLatency",
+	                                 &err);
+	if (err) {
+		DBG("%s: %s", file, err->message);
+		g_clear_error(&err);
+	} else if (latency < 0)
+		error("%s: invalid OutputLatency %d", file, latency);
+	else
+		conf_latency = latency;
+
+done:
+	g_key_file_free(keyfile);
+
+	DBG("Config options: OutputLatency=%u", conf_latency);
+}
+
 static int midi_init(void)
 {
+	read_config(CONFIGDIR "/midi.conf");
+
 	return btd_profile_register(&midi_profile);
 }
 
@@ -483,5 +561,10 @@ static void midi_exit(void)
 	btd_profile_unregister(&midi_profile);
 }
 
-BLUETOOTH_PLUGIN_DEFINE(midi, VERSION, BLUETOOTH_PLUGIN_PRIORITY_HIGH,
-                        midi_init, midi_exit);
+static const char * const midi_uuids[] = {
+	MIDI_UUID,
+	NULL
+};
+
+BLUETOOTH_PLUGIN_DEFINE_LAZY(midi, VERSION, BLUETOOTH_PLUGIN_PRIORITY_HIGH,
+					midi_init, midi_exit, midi_uuids);
@@ -0,0 +1,615 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2017  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <linux/if_tun.h>
+
+#include "lib/bluetooth.h"
+#include "lib/l2cap.h"
+#include "lib/bnep.h"
+
+#include "src/log.h"
+#include "src/shared/util.h"
+#include "src/shared/io.h"
+
+#include "bnep-tap.h"
+
+#define TUN_DEVICE_FILE		"/dev/net/tun"
+
+#define ETH_ALEN		6
+#define ETH_HLEN		14
+#define ETH_FRAME_MAX		1514	/* Without FCS */
+
+#define BNEP_TAP_BATCH		32	/* Frames per wakeup and direction */
+#define BNEP_HDR_MAX		(1 + ETH_ALEN * 2 + 2)
+#define BNEP_RX_MAX		BNEP_MTU
+
+struct tx_slot {
+	uint8_t hdr[BNEP_HDR_MAX];
+	uint8_t frame[ETH_FRAME_MAX];
+	struct iovec iov[2];
+};
+
+struct bnep_tap {
+	int sk;
+	int tap_fd;
+	struct io *l2cap_io;
+	struct io *tap_io;
+	char iface[IFNAMSIZ];
+	uint8_t local[ETH_ALEN];
+	uint8_t remote[ETH_ALEN];
+	uint16_t omtu;
+
+	/* Frames read from the tap device, sent out in one sendmmsg */
+	struct tx_slot tx[BNEP_TAP_BATCH];
+	struct mmsghdr tx_msg[BNEP_TAP_BATCH];
+	unsigned int tx_head;
+	unsigned int tx_count;
+
+	uint8_t rx[BNEP_TAP_BATCH][BNEP_RX_MAX];
+	struct iovec rx_iov[BNEP_TAP_BATCH];
+	struct mmsghdr rx_msg[BNEP_TAP_BATCH];
+
+	struct bnep_tap_stats stats;
+
+	bnep_tap_disconnect_func_t disconn_cb;
+	void *disconn_data;
+};
+
+static bool tap_read_handler(struct io *io, void *user_data);
+
+bool bnep_tap_supported(void)
+{
+	return access(TUN_DEVICE_FILE, R_OK | W_OK) == 0;
+}
+
+static int tap_open(char *iface)
+{
+	struct ifreq ifr;
+	int fd;
+
+	fd = open(TUN_DEVICE_FILE, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	strncpy(ifr.ifr_name, iface, IFNAMSIZ - 1);
+
+	if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+		int err = -errno;
+
+		close(fd);
+		return err;
+	}
+
+	/* The kernel resolves templates like bnep%d, hand the name back */
+	strncpy(iface, ifr.ifr_name, IFNAMSIZ - 1);
+	iface[IFNAMSIZ - 1] = '\0';
+
+	return fd;
+}
+
+static int tap_set_hwaddr(const char *iface, const uint8_t *addr)
+{
+	struct ifreq ifr;
+	int sk, err = 0;
+
+	sk = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (sk < 0)
+		return -errno;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, iface, IFNAMSIZ - 1);
+	ifr.ifr_hwaddr.sa_family = ARPHRD_ETHER;
+	memcpy(ifr.ifr_hwaddr.sa_data, addr, ETH_ALEN);
+
+	if (ioctl(sk, SIOCSIFHWADDR, &ifr) < 0)
+		err = -errno;
+
+	close(sk);
+
+	return err;
+}
+
+static void send_ctrl_rsp(struct bnep_tap *tap, uint8_t ctrl, uint16_t resp)
+{
+	struct bnep_control_rsp rsp;
+
+	rsp.type = BNEP_CONTROL;
+	rsp.ctrl = ctrl;
+	rsp.resp = htons(resp);
+
+	if (send(tap->sk, &rsp, sizeof(rsp), MSG_DONTWAIT) < 0)
+		error("bnep: control response failed: %s", strerror(errno));
+}
+
+static void handle_control(struct bnep_tap *tap, const uint8_t *data,
+								size_t len)
+{
+	struct bnep_ctrl_cmd_not_understood_cmd rsp;
+
+	tap->stats.ctrl_frames++;
+
+	if (len < 1)
+		return;
+
+	switch (data[0]) {
+	case BNEP_FILTER_NET_TYPE_SET:
+		/* No filtering in userspace, accepting is always valid */
+		send_ctrl_rsp(tap, BNEP_FILTER_NET_TYPE_RSP, BNEP_SUCCESS);
+		break;
+	case BNEP_FILTER_MULT_ADDR_SET:
+		send_ctrl_rsp(tap, BNEP_FILTER_MULT_ADDR_RSP, BNEP_SUCCESS);
+		break;
+	case BNEP_SETUP_CONN_REQ:
+		/* The connection is already set up */
+		send_ctrl_rsp(tap, BNEP_SETUP_CONN_RSP, BNEP_CONN_NOT_ALLOWED);
+		break;
+	case BNEP_CMD_NOT_UNDERSTOOD:
+	case BNEP_SETUP_CONN_RSP:
+	case BNEP_FILTER_NET_TYPE_RSP:
+	case BNEP_FILTER_MULT_ADDR_RSP:
+		break;
+	default:
+		rsp.type = BNEP_CONTROL;
+		rsp.ctrl = BNEP_CMD_NOT_UNDERSTOOD;
+		rsp.unkn_ctrl = data[0];
+
+		if (send(tap->sk, &rsp, sizeof(rsp), MSG_DONTWAIT) < 0)
+			error("bnep: control response failed: %s",
+							strerror(errno));
+		break;
+	}
+}
+
+/*
+ * Turns a BNEP packet into an Ethernet header in eth and returns the
+ * offset of the payload, or a negative value if there is nothing to pass
+ * on to the tap device.
+ */
+static ssize_t decode_frame(struct bnep_tap *tap, const uint8_t *data,
+					size_t len, uint8_t eth[ETH_HLEN])
+{
+	const uint8_t *dst, *src, *proto;
+	uint8_t type;
+	size_t off;
+
+	if (len < 1)
+		return -EINVAL;
+
+	type = data[0] & BNEP_TYPE_MASK;
+
+	switch (type) {
+	case BNEP_CONTROL:
+		handle_control(tap, data + 1, len - 1);
+		return -EAGAIN;
+	case BNEP_GENERAL:
+		dst = data + 1;
+		src = data + 1 + ETH_ALEN;
+		proto = data + 1 + ETH_ALEN * 2;
+		off = 1 + ETH_ALEN * 2 + 2;
+		break;
+	case BNEP_COMPRESSED:
+		dst = tap->local;
+		src = tap->remote;
+		proto = data + 1;
+		off = 3;
+		break;
+	case BNEP_COMPRESSED_SRC_ONLY:
+		dst = tap->local;
+		src = data + 1;
+		proto = data + 1 + ETH_ALEN;
+		off = 1 + ETH_ALEN + 2;
+		break;
+	case BNEP_COMPRESSED_DST_ONLY:
+		dst = data + 1;
+		src = tap->remote;
+		proto = data + 1 + ETH_ALEN;
+		off = 1 + ETH_ALEN + 2;
+		break;
+	default:
+		return -EPROTO;
+	}
+
+	if (len < off)
+		return -EINVAL;
+
+	/* Extension headers are chained by their own extension bit */
+	if (data[0] & BNEP_EXT_HEADER) {
+		uint8_t ext;
+
+		do {
+			if (len < off + 2 || len < off + 2 + data[off + 1])
+				return -EINVAL;
+
+			ext = data[off];
+			off += 2 + data[off + 1];
+		} while (ext & BNEP_EXT_HEADER);
+	}
+
+	memcpy(eth, dst, ETH_ALEN);
+	memcpy(eth + ETH_ALEN, src, ETH_ALEN);
+	memcpy(eth + ETH_ALEN * 2, proto, 2);
+
+	return off;
+}
+
+static bool l2cap_read_handler(struct io *io, void *user_data)
+{
+	struct bnep_tap *tap = user_data;
+	int i, count;
+
+	/* Pick up everything the controller delivered since the last poll */
+	count = recvmmsg(tap->sk, tap->rx_msg, BNEP_TAP_BATCH, MSG_DONTWAIT,
+									NULL);
+	if (count < 0)
+		return errno == EAGAIN || errno == EINTR;
+
+	tap->stats.rx_syscalls++;
+
+	for (i = 0; i < count; i++) {
+		size_t len = tap->rx_msg[i].msg_len;
+		uint8_t eth[ETH_HLEN];
+		struct iovec iov[2];
+		ssize_t off;
+
+		tap->rx_msg[i].msg_len = 0;
+
+		off = decode_frame(tap, tap->rx[i], len, eth);
+		if (off == -EAGAIN)
+			continue;
+
+		if (off < 0) {
+			tap->stats.rx_dropped++;
+			continue;
+		}
+
+		/* Payload goes from the receive buffer straight to the tap */
+		iov[0].iov_base = eth;
+		iov[0].iov_len = ETH_HLEN;
+		iov[1].iov_base = tap->rx[i] + off;
+		iov[1].iov_len = len - off;
+
+		if (writev(tap->tap_fd, iov, 2) < 0) {
+			tap->stats.rx_dropped++;
+			continue;
+		}
+
+		tap->stats.rx_syscalls++;
+		tap->stats.rx_frames++;
+		tap->stats.rx_bytes += ETH_HLEN + len - off;
+	}
+
+	return true;
+}
+
+static size_t encode_header(struct bnep_tap *tap, uint8_t *hdr,
+							const uint8_t *frame)
+{
+	const uint8_t *dst = frame, *src = frame + ETH_ALEN;
+	bool dst_remote = !memcmp(dst, tap->remote, ETH_ALEN);
+	bool src_local = !memcmp(src, tap->local, ETH_ALEN);
+	uint8_t *ptr = hdr + 1;
+
+	/* Leave out whichever address the peer can infer from the link */
+	if (dst_remote && src_local) {
+		hdr[0] = BNEP_COMPRESSED;
+	} else if (dst_remote) {
+		hdr[0] = BNEP_COMPRESSED_SRC_ONLY;
+		memcpy(ptr, src, ETH_ALEN);
+		ptr += ETH_ALEN;
+	} else if (src_local) {
+		hdr[0] = BNEP_COMPRESSED_DST_ONLY;
+		memcpy(ptr, dst, ETH_ALEN);
+		ptr += ETH_ALEN;
+	} else {
+		hdr[0] = BNEP_GENERAL;
+		memcpy(ptr, dst, ETH_ALEN * 2);
+		ptr += ETH_ALEN * 2;
+	}
+
+	if (hdr[0] != BNEP_GENERAL)
+		tap->stats.tx_compressed++;
+
+	memcpy(ptr, frame + ETH_ALEN * 2, 2);
+	ptr += 2;
+
+	return ptr - hdr;
+}
+
+static bool tx_flush(struct bnep_tap *tap)
+{
+	int sent;
+
+	while (tap->tx_count) {
+		sent = sendmmsg(tap->sk, &tap->tx_msg[tap->tx_head],
+					tap->tx_count, MSG_DONTWAIT);
+		if (sent < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				return false;
+
+			/* Anything but backpressure loses the whole batch */
+			tap->stats.tx_dropped += tap->tx_count;
+			tap->tx_count = 0;
+			break;
+		}
+
+		tap->stats.tx_syscalls++;
+		tap->stats.tx_frames += sent;
+		tap->tx_head += sent;
+		tap->tx_count -= sent;
+	}
+
+	tap->tx_head = 0;
+
+	return true;
+}
+
+static bool l2cap_write_handler(struct io *io, void *user_data)
+{
+	struct bnep_tap *tap = user_data;
+
+	if (!tx_flush(tap))
+		return true;
+
+	/* Queue is empty again, resume reading from the tap device */
+	io_set_read_handler(tap->tap_io, tap_read_handler, tap, NULL);
+
+	return false;
+}
+
+static bool tap_read_handler(struct io *io, void *user_data)
+{
+	struct bnep_tap *tap = user_data;
+	unsigned int i;
+
+	for (i = 0; i < BNEP_TAP_BATCH; i++) {
+		struct tx_slot *slot = &tap->tx[i];
+		ssize_t len;
+		size_t hlen;
+
+		len = read(tap->tap_fd, slot->frame, sizeof(slot->frame));
+		if (len < 0)
+			break;
+
+		tap->stats.tx_syscalls++;
+
+		if (len < ETH_HLEN) {
+			tap->stats.tx_dropped++;
+			continue;
+		}
+
+		hlen = encode_header(tap, slot->hdr, slot->frame);
+
+		if (hlen + len - ETH_HLEN > tap->omtu) {
+			tap->stats.tx_dropped++;
+			continue;
+		}
+
+		slot->iov[0].iov_base = slot->hdr;
+		slot->iov[0].iov_len = hlen;
+		slot->iov[1].iov_base = slot->frame + ETH_HLEN;
+		slot->iov[1].iov_len = len - ETH_HLEN;
+
+		memset(&tap->tx_msg[tap->tx_count], 0,
+					sizeof(tap->tx_msg[tap->tx_count]));
+		tap->tx_msg[tap->tx_count].msg_hdr.msg_iov = slot->iov;
+		tap->tx_msg[tap->tx_count].msg_hdr.msg_iovlen = 2;
+		tap->tx_count++;
+
+		tap->stats.tx_bytes += len;
+	}
+
+	if (tx_flush(tap))
+		return true;
+
+	/*
+	 * The L2CAP socket is full. Stop reading from the tap device so its
+	 * queue applies backpressure, and resume once the batch is out.
+	 */
+	io_set_write_handler(tap->l2cap_io, l2cap_write_handler, tap, NULL);
+
+	return false;
+}
+
+static bool l2cap_disconnect_handler(struct io *io, void *user_data)
+{
+	struct bnep_tap *tap = user_data;
+
+	DBG("bnep: %s disconnected", tap->iface);
+
+	io_set_read_handler(tap->tap_io, NULL, NULL, NULL);
+
+	if (tap->disconn_cb)
+		tap->disconn_cb(tap->disconn_data);
+
+	return false;
+}
+
+static uint16_t get_omtu(int sk)
+{
+	struct l2cap_options opts;
+	socklen_t len = sizeof(opts);
+
+	memset(&opts, 0, sizeof(opts));
+
+	if (getsockopt(sk, SOL_L2CAP, L2CAP_OPTIONS, &opts, &len) < 0 ||
+								!opts.omtu)
+		return BNEP_MTU;
+
+	return opts.omtu;
+}
+
+static void setup_rx(struct bnep_tap *tap)
+{
+	unsigned int i;
+
+	for (i = 0; i < BNEP_TAP_BATCH; i++) {
+		tap->rx_iov[i].iov_base = tap->rx[i];
+		tap->rx_iov[i].iov_len = sizeof(tap->rx[i]);
+		tap->rx_msg[i].msg_hdr.msg_iov = &tap->rx_iov[i];
+		tap->rx_msg[i].msg_hdr.msg_iovlen = 1;
+	}
+}
+
+struct bnep_tap *bnep_tap_new(int sk, char *iface, const bdaddr_t *src,
+							const bdaddr_t *dst)
+{
+	struct bnep_tap *tap;
+	bdaddr_t addr;
+	int err;
+
+	if (sk < 0 || !iface || !src || !dst)
+		return NULL;
+
+	tap = new0(struct bnep_tap, 1);
+	tap->tap_fd = -1;
+
+	tap->sk = dup(sk);
+	if (tap->sk < 0)
+		goto failed;
+
+	fcntl(tap->sk, F_SETFL, fcntl(tap->sk, F_GETFL) | O_NONBLOCK);
+
+	tap->tap_fd = tap_open(iface);
+	if (tap->tap_fd < 0) {
+		error("bnep: Failed to create tap device %s: %s", iface,
+						strerror(-tap->tap_fd));
+		goto failed;
+	}
+
+	strncpy(tap->iface, iface, IFNAMSIZ - 1);
+
+	/* BNEP carries addresses in network order, like the kernel does */
+	baswap(&addr, src);
+	memcpy(tap->local, &addr, ETH_ALEN);
+	baswap(&addr, dst);
+	memcpy(tap->remote, &addr, ETH_ALEN);
+
+	err = tap_set_hwaddr(tap->iface, tap->local);
+	if (err < 0)
+		error("bnep: Failed to set %s address: %s", tap->iface,
+							strerror(-err));
+
+	tap->omtu = get_omtu(tap->sk);
+	setup_rx(tap);
+
+	tap->l2cap_io = io_new(tap->sk);
+	tap->tap_io = io_new(tap->tap_fd);
+	if (!tap->l2cap_io || !tap->tap_io)
+		goto failed;
+
+	io_set_close_on_destroy(tap->l2cap_io, true);
+	io_set_close_on_destroy(tap->tap_io, true);
+
+	io_set_read_handler(tap->l2cap_io, l2cap_read_handler, tap, NULL);
+	io_set_disconnect_handler(tap->l2cap_io, l2cap_disconnect_handler,
+								tap, NULL);
+	io_set_read_handler(tap->tap_io, tap_read_handler, tap, NULL);
+
+	DBG("bnep: %s in userspace, omtu %u", tap->iface, tap->omtu);
+
+	return tap;
+
+failed:
+	if (tap->l2cap_io)
+		io_destroy(tap->l2cap_io);
+	else if (tap->sk >= 0)
+		close(tap->sk);
+
+	if (tap->tap_io)
+		io_destroy(tap->tap_io);
+	else if (tap->tap_fd >= 0)
+		close(tap->tap_fd);
+
+	free(tap);
+
+	return NULL;
+}
+
+void bnep_tap_free(struct bnep_tap *tap)
+{
+	if (!tap)
+		return;
+
+	DBG("bnep: %s tx %" PRIu64 " frames %" PRIu64 " syscalls, "
+			"rx %" PRIu64 " frames %" PRIu64 " syscalls",
+			tap->iface, tap->stats.tx_frames,
+			tap->stats.tx_syscalls, tap->stats.rx_frames,
+			tap->stats.rx_syscalls);
+
+	/* Closing the tap fd removes the network interface as well */
+	io_destroy(tap->l2cap_io);
+	io_destroy(tap->tap_io);
+
+	free(tap);
+}
+
+const char *bnep_tap_get_iface(struct bnep_tap *tap)
+{
+	if (!tap)
+		return NULL;
+
+	return tap->iface;
+}
+
+bool bnep_tap_set_disconnect_handler(struct bnep_tap *tap,
+					bnep_tap_disconnect_func_t callback,
+					void *user_data)
+{
+	if (!tap)
+		return false;
+
+	tap->disconn_cb = callback;
+	tap->disconn_data = user_data;
+
+	return true;
+}
+
+bool bnep_tap_get_stats(struct bnep_tap *tap, struct bnep_tap_stats *stats)
+{
+	if (!tap || !stats)
+		return false;
+
+	*stats = tap->stats;
+
+	return true;
+}
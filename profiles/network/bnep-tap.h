@@ -0,0 +1,53 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2017  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+struct bnep_tap;
+
+struct bnep_tap_stats {
+	uint64_t tx_frames;		/* Ethernet frames sent over L2CAP */
+	uint64_t tx_bytes;
+	uint64_t tx_syscalls;
+	uint64_t tx_dropped;
+	uint64_t tx_compressed;		/* Frames sent without addresses */
+	uint64_t rx_frames;		/* Frames written to the tap device */
+	uint64_t rx_bytes;
+	uint64_t rx_syscalls;
+	uint64_t rx_dropped;
+	uint64_t ctrl_frames;
+};
+
+typedef void (*bnep_tap_disconnect_func_t)(void *user_data);
+
+bool bnep_tap_supported(void);
+
+struct bnep_tap *bnep_tap_new(int sk, char *iface, const bdaddr_t *src,
+							const bdaddr_t *dst);
+void bnep_tap_free(struct bnep_tap *tap);
+
+const char *bnep_tap_get_iface(struct bnep_tap *tap);
+
+bool bnep_tap_set_disconnect_handler(struct bnep_tap *tap,
+					bnep_tap_disconnect_func_t callback,
+					void *user_data);
+
+bool bnep_tap_get_stats(struct bnep_tap *tap, struct bnep_tap_stats *stats);
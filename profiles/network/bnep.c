@@ -26,7 +26,10 @@
 #endif
 
 #include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/param.h>
@@ -35,6 +38,8 @@
 #include <sys/wait.h>
 #include <net/if.h>
 #include <linux/sockios.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 
 #include <glib.h>
 
@@ -47,12 +52,25 @@
 #include "src/shared/util.h"
 #include "btio/btio.h"
 
+#include "bnep-tap.h"
 #include "bnep.h"
 
 #define CON_SETUP_RETRIES      3
 #define CON_SETUP_TO           9
+#define BRIDGE_BATCH_MAX       16
 
-static int ctl;
+static int ctl = -1;
+
+/* Run the BNEP data path over tap devices instead of the kernel module */
+static bool userspace;
+
+struct server_tap {
+	struct bnep_tap	*tap;
+	char	*bridge;
+	bdaddr_t	dst;
+};
+
+static GSList *server_taps;
 
 struct __service_16 {
 	uint16_t dst;
@@ -63,8 +81,10 @@ struct bnep {
 	GIOChannel	*io;
 	uint16_t	src;
 	uint16_t	dst;
+	bdaddr_t	src_addr;
 	bdaddr_t	dst_addr;
 	char	iface[16];
+	struct bnep_tap	*tap;
 	guint	attempts;
 	guint	setup_to;
 	guint	watch;
@@ -92,9 +112,44 @@ int bnep_init(void)
 	return 0;
 }
 
+bool bnep_set_userspace(bool enable)
+{
+	if (enable && !bnep_tap_supported()) {
+		error("bnep: tap devices are not available");
+		return false;
+	}
+
+	userspace = enable;
+
+	DBG("userspace data path %s", enable ? "enabled" : "disabled");
+
+	return true;
+}
+
+bool bnep_is_userspace(void)
+{
+	return userspace;
+}
+
+static void server_tap_free(void *data)
+{
+	struct server_tap *st = data;
+
+	bnep_tap_free(st->tap);
+	g_free(st->bridge);
+	g_free(st);
+}
+
 int bnep_cleanup(void)
 {
-	close(ctl);
+	g_slist_free_full(server_taps, server_tap_free);
+	server_taps = NULL;
+
+	if (ctl >= 0) {
+		close(ctl);
+		ctl = -1;
+	}
+
 	return 0;
 }
 
@@ -270,12 +325,27 @@ static gboolean bnep_setup_cb(GIOChannel *chan, GIOCondition cond,
 	setsockopt(sk, SOL_SOCKET, SO_RCVTIMEO, &timeo, sizeof(timeo));
 
 	sk = g_io_channel_unix_get_fd(session->io);
-	if (bnep_connadd(sk, session->src, session->iface) < 0)
-		goto failed;
 
-	if (bnep_if_up(session->iface) < 0) {
-		bnep_conndel(&session->dst_addr);
-		goto failed;
+	if (userspace) {
+		session->tap = bnep_tap_new(sk, session->iface,
+						&session->src_addr,
+						&session->dst_addr);
+		if (!session->tap)
+			goto failed;
+
+		if (bnep_if_up(session->iface) < 0) {
+			bnep_tap_free(session->tap);
+			session->tap = NULL;
+			goto failed;
+		}
+	} else {
+		if (bnep_connadd(sk, session->src, session->iface) < 0)
+			goto failed;
+
+		if (bnep_if_up(session->iface) < 0) {
+			bnep_conndel(&session->dst_addr);
+			goto failed;
+		}
 	}
 
 	session->watch = g_io_add_watch(session->io,
@@ -379,6 +449,7 @@ void bnep_free(struct bnep *session)
 		session->watch = 0;
 	}
 
+	bnep_tap_free(session->tap);
 	g_free(session);
 }
 
@@ -398,8 +469,10 @@ int bnep_connect(struct bnep *session, bnep_connect_cb conn_cb,
 	session->conn_data = conn_data;
 	session->disconn_data = disconn_data;
 
-	bt_io_get(session->io, &gerr, BT_IO_OPT_DEST_BDADDR, &session->dst_addr,
-							BT_IO_OPT_INVALID);
+	bt_io_get(session->io, &gerr, BT_IO_OPT_SOURCE_BDADDR,
+					&session->src_addr,
+					BT_IO_OPT_DEST_BDADDR, &session->dst_addr,
+					BT_IO_OPT_INVALID);
 	if (gerr) {
 		error("bnep: connect failed: %s", gerr->message);
 		g_error_free(gerr);
@@ -431,73 +504,242 @@ void bnep_disconnect(struct bnep *session)
 	}
 
 	bnep_if_down(session->iface);
+
+	if (session->tap) {
+		bnep_tap_free(session->tap);
+		session->tap = NULL;
+		return;
+	}
+
 	bnep_conndel(&session->dst_addr);
 }
 
-static int bnep_add_to_bridge(const char *devname, const char *bridge)
+struct bridge_req {
+	struct nlmsghdr nlh;
+	struct ifinfomsg ifi;
+	struct rtattr rta;
+	uint32_t master;
+};
+
+/*
+ * Sets the bridge master of up to BRIDGE_BATCH_MAX interfaces with one
+ * RTM_SETLINK request each, all sent in a single netlink message. The
+ * result of every request is stored in errs. A negative return means
+ * netlink could not be used at all.
+ */
+static int bridge_set_master(const char *bridge, const char * const *devs,
+					int *errs, unsigned int count)
 {
-	int ifindex;
-	struct ifreq ifr;
-	int sk, err = 0;
+	struct bridge_req reqs[BRIDGE_BATCH_MAX];
+	uint32_t buf[1024];
+	uint32_t master = 0;
+	unsigned int i, n = 0;
+	ssize_t len;
+	int sk;
 
-	if (!devname || !bridge)
-		return -EINVAL;
+	if (count > BRIDGE_BATCH_MAX)
+		return -E2BIG;
 
-	ifindex = if_nametoindex(devname);
+	if (bridge) {
+		master = if_nametoindex(bridge);
+		if (!master)
+			return -ENODEV;
+	}
 
-	sk = socket(AF_INET, SOCK_STREAM, 0);
+	sk = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
 	if (sk < 0)
-		return -1;
+		return -errno;
 
-	memset(&ifr, 0, sizeof(ifr));
-	strncpy(ifr.ifr_name, bridge, IFNAMSIZ - 1);
-	ifr.ifr_ifindex = ifindex;
+	memset(reqs, 0, sizeof(reqs));
 
-	if (ioctl(sk, SIOCBRADDIF, &ifr) < 0) {
-		err = -errno;
-		error("bnep: Can't add %s to the bridge %s: %s(%d)",
-					devname, bridge, strerror(-err), -err);
-	} else {
-		info("bnep: bridge %s: interface %s added", bridge, devname);
+	for (i = 0; i < count; i++) {
+		struct bridge_req *req = &reqs[n];
+
+		errs[i] = -ENODEV;
+
+		req->ifi.ifi_index = if_nametoindex(devs[i]);
+		if (!req->ifi.ifi_index)
+			continue;
+
+		req->nlh.nlmsg_len = sizeof(*req);
+		req->nlh.nlmsg_type = RTM_SETLINK;
+		req->nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+		req->nlh.nlmsg_seq = i + 1;
+		req->ifi.ifi_family = AF_UNSPEC;
+		req->rta.rta_type = IFLA_MASTER;
+		req->rta.rta_len = RTA_LENGTH(sizeof(req->master));
+		req->master = master;
+		n++;
 	}
 
+	if (!n)
+		goto done;
+
+	if (send(sk, reqs, n * sizeof(reqs[0]), 0) < 0) {
+		int err = -errno;
+
+		close(sk);
+		return err;
+	}
+
+	/* rtnetlink handles requests synchronously, the acks are queued */
+	while (n) {
+		struct nlmsghdr *nlh = (void *) buf;
+
+		len = recv(sk, buf, sizeof(buf), MSG_DONTWAIT);
+		if (len <= 0)
+			break;
+
+		for (; NLMSG_OK(nlh, (size_t) len);
+					nlh = NLMSG_NEXT(nlh, len)) {
+			struct nlmsgerr *nle = NLMSG_DATA(nlh);
+
+			if (nlh->nlmsg_type != NLMSG_ERROR ||
+					nlh->nlmsg_seq < 1 ||
+					nlh->nlmsg_seq > count)
+				continue;
+
+			errs[nlh->nlmsg_seq - 1] = nle->error;
+			n--;
+		}
+	}
+
+done:
 	close(sk);
 
-	return err;
+	return 0;
 }
 
-static int bnep_del_from_bridge(const char *devname, const char *bridge)
+static int bridge_ioctl(unsigned long req, const char *devname,
+							const char *bridge)
 {
-	int ifindex;
 	struct ifreq ifr;
 	int sk, err = 0;
 
-	if (!devname || !bridge)
-		return -EINVAL;
-
-	ifindex = if_nametoindex(devname);
-
 	sk = socket(AF_INET, SOCK_STREAM, 0);
 	if (sk < 0)
-		return -1;
+		return -errno;
 
 	memset(&ifr, 0, sizeof(ifr));
 	strncpy(ifr.ifr_name, bridge, IFNAMSIZ - 1);
-	ifr.ifr_ifindex = ifindex;
+	ifr.ifr_ifindex = if_nametoindex(devname);
 
-	if (ioctl(sk, SIOCBRDELIF, &ifr) < 0) {
+	if (ioctl(sk, req, &ifr) < 0)
 		err = -errno;
-		error("bnep: Can't delete %s from the bridge %s: %s(%d)",
-					devname, bridge, strerror(-err), -err);
-	} else {
-		info("bnep: bridge %s: interface %s removed", bridge, devname);
-	}
 
 	close(sk);
 
 	return err;
 }
 
+/*
+ * Adds or removes interfaces from a bridge, batching the netlink requests.
+ * Kernels without netlink bridge control fall back to one ioctl per
+ * interface. Returns the first error encountered.
+ */
+static int bridge_update(const char *bridge, const char * const *devs,
+					unsigned int count, bool add)
+{
+	int errs[BRIDGE_BATCH_MAX];
+	unsigned int i, n;
+	int err = 0;
+
+	if (!bridge)
+		return -EINVAL;
+
+	for (; count; devs += n, count -= n) {
+		n = MIN(count, BRIDGE_BATCH_MAX);
+
+		if (bridge_set_master(add ? bridge : NULL, devs, errs, n) < 0) {
+			for (i = 0; i < n; i++)
+				errs[i] = bridge_ioctl(add ? SIOCBRADDIF :
+							SIOCBRDELIF, devs[i],
+							bridge);
+		}
+
+		for (i = 0; i < n; i++) {
+			if (errs[i] < 0) {
+				error("bnep: Can't %s %s %s the bridge %s: "
+					"%s(%d)", add ? "add" : "delete",
+					devs[i], add ? "to" : "from", bridge,
+					strerror(-errs[i]), -errs[i]);
+				if (!err)
+					err = errs[i];
+				continue;
+			}
+
+			info("bnep: bridge %s: interface %s %s", bridge,
+					devs[i], add ? "added" : "removed");
+		}
+	}
+
+	return err;
+}
+
+static int bnep_add_to_bridge(const char *devname, const char *bridge)
+{
+	if (!devname || !bridge)
+		return -EINVAL;
+
+	return bridge_update(bridge, &devname, 1, true);
+}
+
+static int bnep_del_from_bridge(const char *devname, const char *bridge)
+{
+	if (!devname || !bridge)
+		return -EINVAL;
+
+	return bridge_update(bridge, &devname, 1, false);
+}
+
+static int read_if_stat(const char *iface, const char *name, uint64_t *val)
+{
+	char path[64], buf[32];
+	ssize_t len;
+	int fd;
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/%s",
+								iface, name);
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+
+	if (len <= 0)
+		return -EIO;
+
+	buf[len] = '\0';
+	*val = strtoull(buf, NULL, 10);
+
+	return 0;
+}
+
+int bnep_get_if_stats(const char *iface, struct bnep_if_stats *stats)
+{
+	int err;
+
+	if (!iface || !stats)
+		return -EINVAL;
+
+	/* Counters of both the kernel and the tap data path live here */
+	err = read_if_stat(iface, "rx_packets", &stats->rx_packets);
+	if (err < 0)
+		return err;
+
+	err = read_if_stat(iface, "rx_bytes", &stats->rx_bytes);
+	if (err < 0)
+		return err;
+
+	err = read_if_stat(iface, "tx_packets", &stats->tx_packets);
+	if (err < 0)
+		return err;
+
+	return read_if_stat(iface, "tx_bytes", &stats->tx_bytes);
+}
+
 static ssize_t bnep_send_ctrl_rsp(int sk, uint8_t ctrl, uint16_t resp)
 {
 	ssize_t sent;
@@ -647,6 +889,101 @@ reply:
 	return err;
 }
 
+static struct server_tap *find_server_tap(const char *iface,
+							const bdaddr_t *addr)
+{
+	GSList *l;
+
+	for (l = server_taps; l; l = l->next) {
+		struct server_tap *st = l->data;
+
+		if (!bacmp(&st->dst, addr) &&
+				!strcmp(bnep_tap_get_iface(st->tap), iface))
+			return st;
+	}
+
+	return NULL;
+}
+
+static void server_tap_release(struct server_tap *st)
+{
+	server_taps = g_slist_remove(server_taps, st);
+
+	bnep_if_down(bnep_tap_get_iface(st->tap));
+	server_tap_free(st);
+}
+
+static void server_tap_disconnected(void *user_data)
+{
+	struct server_tap *st = user_data;
+
+	bnep_del_from_bridge(bnep_tap_get_iface(st->tap), st->bridge);
+	server_tap_release(st);
+}
+
+static int bnep_server_add_tap(int sk, char *bridge, char *iface,
+					const bdaddr_t *addr,
+					uint8_t *setup_data, int len)
+{
+	struct sockaddr_l2 l2a;
+	socklen_t optlen = sizeof(l2a);
+	struct server_tap *st;
+	uint16_t rsp = BNEP_CONN_NOT_ALLOWED;
+	int err;
+
+	/* The setup request was only peeked at, the kernel is not there to
+	 * consume it */
+	if (read(sk, setup_data, len) != len) {
+		err = -EIO;
+		goto reply;
+	}
+
+	memset(&l2a, 0, sizeof(l2a));
+	if (getsockname(sk, (struct sockaddr *) &l2a, &optlen) < 0) {
+		err = -errno;
+		goto reply;
+	}
+
+	st = g_new0(struct server_tap, 1);
+	bacpy(&st->dst, addr);
+	st->bridge = g_strdup(bridge);
+
+	st->tap = bnep_tap_new(sk, iface, &l2a.l2_bdaddr, addr);
+	if (!st->tap) {
+		g_free(st->bridge);
+		g_free(st);
+		err = -EIO;
+		goto reply;
+	}
+
+	err = bnep_add_to_bridge(iface, bridge);
+	if (err < 0) {
+		server_tap_free(st);
+		goto reply;
+	}
+
+	err = bnep_if_up(iface);
+	if (err < 0) {
+		bnep_del_from_bridge(iface, bridge);
+		server_tap_free(st);
+		goto reply;
+	}
+
+	bnep_tap_set_disconnect_handler(st->tap, server_tap_disconnected, st);
+	server_taps = g_slist_prepend(server_taps, st);
+
+	rsp = BNEP_SUCCESS;
+
+reply:
+	if (bnep_send_ctrl_rsp(sk, BNEP_SETUP_CONN_RSP, rsp) < 0) {
+		err = -errno;
+		error("bnep: send ctrl rsp error: %s (%d)", strerror(-err),
+									-err);
+	}
+
+	return err;
+}
+
 int bnep_server_add(int sk, char *bridge, char *iface, const bdaddr_t *addr,
 						uint8_t *setup_data, int len)
 {
@@ -678,6 +1015,10 @@ int bnep_server_add(int sk, char *bridge, char *iface, const bdaddr_t *addr,
 		goto failed;
 	}
 
+	if (userspace)
+		return bnep_server_add_tap(sk, bridge, iface, addr, setup_data,
+									len);
+
 	feat = bnep_getsuppfeat();
 
 	/*
@@ -723,12 +1064,33 @@ failed:
 	return err;
 }
 
+void bnep_server_delete_batch(char *bridge, char **ifaces,
+				const bdaddr_t *addrs, unsigned int count)
+{
+	unsigned int i;
+
+	if (!bridge || !ifaces || !addrs || !count)
+		return;
+
+	bridge_update(bridge, (const char * const *) ifaces, count, false);
+
+	for (i = 0; i < count; i++) {
+		struct server_tap *st = find_server_tap(ifaces[i], &addrs[i]);
+
+		if (st) {
+			server_tap_release(st);
+			continue;
+		}
+
+		bnep_if_down(ifaces[i]);
+		bnep_conndel(&addrs[i]);
+	}
+}
+
 void bnep_server_delete(char *bridge, char *iface, const bdaddr_t *addr)
 {
 	if (!bridge || !iface || !addr)
 		return;
 
-	bnep_del_from_bridge(iface, bridge);
-	bnep_if_down(iface);
-	bnep_conndel(addr);
+	bnep_server_delete_batch(bridge, &iface, addr, 1);
 }
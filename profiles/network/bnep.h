@@ -23,9 +23,19 @@
 
 struct bnep;
 
+struct bnep_if_stats {
+	uint64_t rx_packets;
+	uint64_t rx_bytes;
+	uint64_t tx_packets;
+	uint64_t tx_bytes;
+};
+
 int bnep_init(void);
 int bnep_cleanup(void);
 
+bool bnep_set_userspace(bool enable);
+bool bnep_is_userspace(void);
+
 struct bnep *bnep_new(int sk, uint16_t local_role, uint16_t remote_role,
 								char *iface);
 void bnep_free(struct bnep *session);
@@ -40,3 +50,7 @@ void bnep_disconnect(struct bnep *session);
 int bnep_server_add(int sk, char *bridge, char *iface, const bdaddr_t *addr,
 						uint8_t *setup_data, int len);
 void bnep_server_delete(char *bridge, char *iface, const bdaddr_t *addr);
+void bnep_server_delete_batch(char *bridge, char **ifaces,
+				const bdaddr_t *addrs, unsigned int count);
+
+int bnep_get_if_stats(const char *iface, struct bnep_if_stats *stats);
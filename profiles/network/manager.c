@@ -47,6 +47,7 @@
 #include "server.h"
 
 static gboolean conf_security = TRUE;
+static gboolean conf_userspace = FALSE;
 
 static void read_config(const char *file)
 {
@@ -67,11 +68,19 @@ static void read_config(const char *file)
 		g_clear_error(&err);
 	}
 
+	conf_userspace = g_key_file_get_boolean(keyfile, "General",
+						"UserspaceBNEP", &err);
+	if (err) {
+		DBG("%s: %s", file, err->message);
+		g_clear_error(&err);
+	}
+
 done:
 	g_key_file_free(keyfile);
 
-	DBG("Config options: Security=%s",
-				conf_security ? "true" : "false");
+	DBG("Config options: Security=%s, UserspaceBNEP=%s",
+				conf_security ? "true" : "false",
+				conf_userspace ? "true" : "false");
 }
 
 static int panu_server_probe(struct btd_profile *p, struct btd_adapter *adapter)
@@ -174,10 +183,14 @@ static int network_init(void)
 	read_config(CONFIGDIR "/network.conf");
 
 	err = bnep_init();
-	if (err) {
-		if (err == -EPROTONOSUPPORT)
-			err = -ENOSYS;
+	if (err == -EPROTONOSUPPORT) {
+		/* Without the kernel module fall back to tap devices */
+		if (!bnep_set_userspace(true))
+			return -ENOSYS;
+	} else if (err) {
 		return err;
+	} else if (conf_userspace) {
+		bnep_set_userspace(true);
 	}
 
 	/*
@@ -206,5 +219,13 @@ static void network_exit(void)
 	bnep_cleanup();
 }
 
-BLUETOOTH_PLUGIN_DEFINE(network, VERSION,
-			BLUETOOTH_PLUGIN_PRIORITY_DEFAULT, network_init, network_exit)
+static const char * const network_uuids[] = {
+	PANU_UUID,
+	NAP_UUID,
+	GN_UUID,
+	NULL
+};
+
+BLUETOOTH_PLUGIN_DEFINE_LAZY(network, VERSION,
+			BLUETOOTH_PLUGIN_PRIORITY_DEFAULT, network_init,
+			network_exit, network_uuids)
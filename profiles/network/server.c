@@ -55,19 +55,26 @@
 #define NETWORK_SERVER_INTERFACE "org.bluez.NetworkServer1"
 #define BNEP_INTERFACE "bnep%d"
 #define SETUP_TIMEOUT		1
+#define STATS_INTERVAL		10
 
-/* Pending Authorization */
+/* Connection in setup or established */
 struct network_session {
+	struct network_adapter *na;	/* Adapter reference */
+	struct network_server *ns;	/* Server once setup completed */
 	bdaddr_t	dst;		/* Remote Bluetooth Address */
 	char		dev[16];	/* Interface name */
 	GIOChannel	*io;		/* Pending connect channel */
 	guint		watch;		/* BNEP socket watch */
+	guint		auth_id;	/* Pending authorization */
+	gint64		start;		/* Setup completion time */
+	struct bnep_if_stats stats;	/* Last sampled counters */
 };
 
 struct network_adapter {
 	struct btd_adapter *adapter;	/* Adapter pointer */
 	GIOChannel	*io;		/* Bnep socket */
-	struct network_session *setup;	/* Setup in progress */
+	GHashTable	*sessions;	/* Sessions by remote address */
+	guint		stats_id;	/* Throughput sampling timer */
 	GSList		*servers;	/* Server register to adapter */
 };
 
@@ -78,7 +85,6 @@ struct network_server {
 	char		*bridge;	/* Bridge name */
 	uint32_t	record_id;	/* Service record id */
 	uint16_t	id;		/* Service class identifier */
-	GSList		*sessions;	/* Active connections */
 	struct network_adapter *na;	/* Adapter reference */
 	guint		watch_id;	/* Client service watch */
 };
@@ -277,10 +283,25 @@ static sdp_record_t *server_record_new(const char *name, uint16_t id)
 	return record;
 }
 
+static guint bdaddr_hash(gconstpointer key)
+{
+	const bdaddr_t *bdaddr = key;
+
+	return get_le32(&bdaddr->b[0]) ^ get_le16(&bdaddr->b[4]);
+}
+
+static gboolean bdaddr_equal(gconstpointer a, gconstpointer b)
+{
+	return !bacmp(a, b);
+}
+
 static void session_free(void *data)
 {
 	struct network_session *session = data;
 
+	if (session->auth_id)
+		btd_cancel_authorization(session->auth_id);
+
 	if (session->watch)
 		g_source_remove(session->watch);
 
@@ -290,17 +311,101 @@ static void session_free(void *data)
 	g_free(session);
 }
 
-static void setup_destroy(void *user_data)
+static void session_remove(struct network_session *session)
 {
-	struct network_adapter *na = user_data;
-	struct network_session *setup = na->setup;
+	g_hash_table_remove(session->na->sessions, &session->dst);
+}
 
-	if (!setup)
+static void session_update_stats(struct network_session *session,
+							gboolean final)
+{
+	struct bnep_if_stats stats;
+	gint64 now = g_get_monotonic_time();
+	guint64 rx, tx;
+
+	/* The kernel removes its interface as soon as the link is gone */
+	if (bnep_get_if_stats(session->dev, &stats) < 0)
+		stats = session->stats;
+
+	rx = stats.rx_bytes - session->stats.rx_bytes;
+	tx = stats.tx_bytes - session->stats.tx_bytes;
+	session->stats = stats;
+
+	if (final) {
+		DBG("%s: rx %" G_GUINT64_FORMAT " bytes tx %"
+				G_GUINT64_FORMAT " bytes in %" G_GINT64_FORMAT
+				" s", session->dev, stats.rx_bytes,
+				stats.tx_bytes,
+				(now - session->start) / G_USEC_PER_SEC);
 		return;
+	}
+
+	DBG("%s: rx %" G_GUINT64_FORMAT " B/s tx %" G_GUINT64_FORMAT " B/s",
+					session->dev, rx / STATS_INTERVAL,
+					tx / STATS_INTERVAL);
+}
+
+static gboolean stats_sample(gpointer user_data)
+{
+	struct network_adapter *na = user_data;
+	struct network_session *session;
+	GHashTableIter iter;
+
+	g_hash_table_iter_init(&iter, na->sessions);
+
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &session)) {
+		if (session->ns)
+			session_update_stats(session, FALSE);
+	}
+
+	return TRUE;
+}
+
+static void session_stats_start(struct network_session *session)
+{
+	struct network_adapter *na = session->na;
+
+	session->start = g_get_monotonic_time();
+	bnep_get_if_stats(session->dev, &session->stats);
+
+	if (!na->stats_id)
+		na->stats_id = g_timeout_add_seconds(STATS_INTERVAL,
+							stats_sample, na);
+}
+
+static void session_stats_stop(struct network_session *session)
+{
+	struct network_adapter *na = session->na;
+	struct network_session *other;
+	GHashTableIter iter;
+
+	session_update_stats(session, TRUE);
 
-	na->setup = NULL;
+	g_hash_table_iter_init(&iter, na->sessions);
+
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &other)) {
+		if (other != session && other->ns)
+			return;
+	}
 
-	session_free(setup);
+	if (na->stats_id) {
+		g_source_remove(na->stats_id);
+		na->stats_id = 0;
+	}
+}
+
+static gboolean session_disconnected(GIOChannel *chan, GIOCondition cond,
+							gpointer user_data)
+{
+	struct network_session *session = user_data;
+
+	DBG("%s disconnected", session->dev);
+
+	session->watch = 0;
+	session_stats_stop(session);
+	session_remove(session);
+
+	return FALSE;
 }
 
 static gboolean bnep_setup(GIOChannel *chan,
@@ -308,7 +413,8 @@ static gboolean bnep_setup(GIOChannel *chan,
 {
 	const uint8_t bt_base[] = { 0x00, 0x00, 0x10, 0x00, 0x80, 0x00,
 					0x00, 0x80, 0x5F, 0x9B, 0x34, 0xFB };
-	struct network_adapter *na = user_data;
+	struct network_session *session = user_data;
+	struct network_adapter *na = session->na;
 	struct network_server *ns;
 	uint8_t packet[BNEP_MTU];
 	struct bnep_setup_conn_req *req = (void *) packet;
@@ -317,12 +423,15 @@ static gboolean bnep_setup(GIOChannel *chan,
 	int n, sk;
 	char *bridge = NULL;
 
+	/* The watch is gone once this returns */
+	session->watch = 0;
+
 	if (cond & G_IO_NVAL)
 		return FALSE;
 
 	if (cond & (G_IO_ERR | G_IO_HUP)) {
 		error("Hangup or error on BNEP socket");
-		return FALSE;
+		goto failed;
 	}
 
 	sk = g_io_channel_unix_get_fd(chan);
@@ -334,7 +443,7 @@ static gboolean bnep_setup(GIOChannel *chan,
 	n = recv(sk, packet, sizeof(packet), MSG_PEEK);
 	if (n < 0) {
 		error("read(): %s(%d)", strerror(errno), errno);
-		return FALSE;
+		goto failed;
 	}
 
 	/*
@@ -344,7 +453,7 @@ static gboolean bnep_setup(GIOChannel *chan,
 	 */
 	if (n < 3) {
 		error("To few setup connection request data received");
-		return FALSE;
+		goto failed;
 	}
 
 	switch (req->uuid_size) {
@@ -372,46 +481,59 @@ static gboolean bnep_setup(GIOChannel *chan,
 	else
 		bridge = ns->bridge;
 
-	strncpy(na->setup->dev, BNEP_INTERFACE, 16);
-	na->setup->dev[15] = '\0';
+	strncpy(session->dev, BNEP_INTERFACE, 16);
+	session->dev[15] = '\0';
 
-	if (bnep_server_add(sk, bridge, na->setup->dev, &na->setup->dst,
-							packet, n) < 0)
+	if (bnep_server_add(sk, bridge, session->dev, &session->dst,
+							packet, n) < 0) {
 		error("BNEP server cannot be added");
+		goto failed;
+	}
 
-	na->setup = NULL;
+	/* Keep the session around until the link goes away */
+	session->ns = ns;
+	session->watch = g_io_add_watch(chan, G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+					session_disconnected, session);
+	session_stats_start(session);
+
+	return FALSE;
+
+failed:
+	session_remove(session);
 
 	return FALSE;
 }
 
 static void connect_event(GIOChannel *chan, GError *err, gpointer user_data)
 {
-	struct network_adapter *na = user_data;
+	struct network_session *session = user_data;
 
 	if (err) {
 		error("%s", err->message);
-		setup_destroy(na);
+		session_remove(session);
 		return;
 	}
 
 	g_io_channel_set_close_on_unref(chan, TRUE);
 
-	na->setup->watch = g_io_add_watch_full(chan, G_PRIORITY_DEFAULT,
+	session->watch = g_io_add_watch(chan,
 				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
-				bnep_setup, na, setup_destroy);
+				bnep_setup, session);
 }
 
 static void auth_cb(DBusError *derr, void *user_data)
 {
-	struct network_adapter *na = user_data;
+	struct network_session *session = user_data;
 	GError *err = NULL;
 
+	session->auth_id = 0;
+
 	if (derr) {
 		error("Access denied: %s", derr->message);
 		goto reject;
 	}
 
-	if (!bt_io_accept(na->setup->io, connect_event, na, NULL,
+	if (!bt_io_accept(session->io, connect_event, session, NULL,
 							&err)) {
 		error("bt_io_accept: %s", err->message);
 		g_error_free(err);
@@ -421,17 +543,17 @@ static void auth_cb(DBusError *derr, void *user_data)
 	return;
 
 reject:
-	g_io_channel_shutdown(na->setup->io, TRUE, NULL);
-	setup_destroy(na);
+	g_io_channel_shutdown(session->io, TRUE, NULL);
+	session_remove(session);
 }
 
 static void confirm_event(GIOChannel *chan, gpointer user_data)
 {
 	struct network_adapter *na = user_data;
+	struct network_session *session;
 	bdaddr_t src, dst;
 	char address[18];
 	GError *err = NULL;
-	guint ret;
 
 	bt_io_get(chan, &err,
 			BT_IO_OPT_SOURCE_BDADDR, &src,
@@ -446,23 +568,27 @@ static void confirm_event(GIOChannel *chan, gpointer user_data)
 
 	DBG("BNEP: incoming connect from %s", address);
 
-	if (na->setup) {
-		error("Refusing connect from %s: setup in progress", address);
+	/* Each remote may only have one BNEP connection per adapter */
+	if (g_hash_table_lookup(na->sessions, &dst)) {
+		error("Refusing connect from %s: already connected", address);
 		goto drop;
 	}
 
 	if (!na->servers)
 		goto drop;
 
-	na->setup = g_new0(struct network_session, 1);
-	bacpy(&na->setup->dst, &dst);
-	na->setup->io = g_io_channel_ref(chan);
+	session = g_new0(struct network_session, 1);
+	session->na = na;
+	bacpy(&session->dst, &dst);
+	session->io = g_io_channel_ref(chan);
+	g_hash_table_insert(na->sessions, &session->dst, session);
 
-	ret = btd_request_authorization(&src, &dst, BNEP_SVC_UUID,
-					auth_cb, na);
-	if (ret == 0) {
+	session->auth_id = btd_request_authorization(&src, &dst,
+							BNEP_SVC_UUID,
+							auth_cb, session);
+	if (session->auth_id == 0) {
 		error("Refusing connect from %s", address);
-		setup_destroy(na);
+		session_remove(session);
 		goto drop;
 	}
 
@@ -502,20 +628,39 @@ static uint32_t register_server_record(struct network_server *ns)
 
 static void server_remove_sessions(struct network_server *ns)
 {
-	GSList *list;
+	struct network_session *session;
+	GHashTableIter iter;
+	GPtrArray *ifaces;
+	GArray *addrs;
 
-	for (list = ns->sessions; list; list = list->next) {
-		struct network_session *session = list->data;
+	ifaces = g_ptr_array_new();
+	addrs = g_array_new(FALSE, FALSE, sizeof(bdaddr_t));
 
-		if (*session->dev == '\0')
+	g_hash_table_iter_init(&iter, ns->na->sessions);
+
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &session)) {
+		if (session->ns != ns)
 			continue;
 
-		bnep_server_delete(ns->bridge, session->dev, &session->dst);
+		session_update_stats(session, TRUE);
+
+		g_ptr_array_add(ifaces, g_strdup(session->dev));
+		g_array_append_val(addrs, session->dst);
+		g_hash_table_iter_remove(&iter);
 	}
 
-	g_slist_free_full(ns->sessions, session_free);
+	if (ns->na->stats_id && !g_hash_table_size(ns->na->sessions)) {
+		g_source_remove(ns->na->stats_id);
+		ns->na->stats_id = 0;
+	}
+
+	/* Take all interfaces out of the bridge in one go */
+	bnep_server_delete_batch(ns->bridge, (char **) ifaces->pdata,
+					(bdaddr_t *) addrs->data, ifaces->len);
 
-	ns->sessions = NULL;
+	g_ptr_array_foreach(ifaces, (GFunc) g_free, NULL);
+	g_ptr_array_free(ifaces, TRUE);
+	g_array_free(addrs, TRUE);
 }
 
 static void server_disconnect(DBusConnection *conn, void *user_data)
@@ -606,7 +751,10 @@ static void adapter_free(struct network_adapter *na)
 		g_io_channel_unref(na->io);
 	}
 
-	setup_destroy(na);
+	if (na->stats_id)
+		g_source_remove(na->stats_id);
+
+	g_hash_table_destroy(na->sessions);
 	btd_adapter_unref(na->adapter);
 	g_free(na);
 }
@@ -660,6 +808,8 @@ static struct network_adapter *create_adapter(struct btd_adapter *adapter)
 
 	na = g_new0(struct network_adapter, 1);
 	na->adapter = btd_adapter_ref(adapter);
+	na->sessions = g_hash_table_new_full(bdaddr_hash, bdaddr_equal, NULL,
+								session_free);
 
 	na->io = bt_io_listen(NULL, confirm_event, na, NULL, &err,
 				BT_IO_OPT_SOURCE_BDADDR,
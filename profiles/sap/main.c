@@ -24,6 +24,9 @@
 
 #include <errno.h>
 
+#include "lib/bluetooth.h"
+#include "lib/uuid.h"
+
 #include "gdbus/gdbus.h"
 
 #include "src/plugin.h"
@@ -39,5 +42,11 @@ static void sap_exit(void)
 	sap_manager_exit();
 }
 
-BLUETOOTH_PLUGIN_DEFINE(sap, VERSION,
-		BLUETOOTH_PLUGIN_PRIORITY_DEFAULT, sap_init, sap_exit)
+static const char * const sap_uuids[] = {
+	SAP_UUID,
+	NULL
+};
+
+BLUETOOTH_PLUGIN_DEFINE_LAZY(sap, VERSION,
+		BLUETOOTH_PLUGIN_PRIORITY_DEFAULT, sap_init, sap_exit,
+		sap_uuids)
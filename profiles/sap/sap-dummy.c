@@ -28,6 +28,7 @@
 
 #include <glib.h>
 #include <stdint.h>
+#include <sys/uio.h>
 
 #include "gdbus/gdbus.h"
 
@@ -103,6 +104,7 @@ void sap_disconnect_req(void *sap_device, uint8_t linkloss)
 void sap_transfer_apdu_req(void *sap_device, struct sap_parameter *param)
 {
 	char apdu[] = "APDU response!";
+	struct iovec iov;
 
 	DBG("status: %d", sim_card_conn_status);
 
@@ -120,8 +122,9 @@ void sap_transfer_apdu_req(void *sap_device, struct sap_parameter *param)
 				SAP_RESULT_ERROR_NOT_ACCESSIBLE, NULL, 0);
 		break;
 	case SIM_CONNECTED:
-		sap_transfer_apdu_rsp(sap_device, SAP_RESULT_OK,
-						(uint8_t *)apdu, sizeof(apdu));
+		iov.iov_base = apdu;
+		iov.iov_len = sizeof(apdu);
+		sap_transfer_apdu_rsp_iov(sap_device, SAP_RESULT_OK, &iov, 1);
 		break;
 	}
 }
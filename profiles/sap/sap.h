@@ -166,6 +166,13 @@ int sap_connect_rsp(void *sap_device, uint8_t status);
 int sap_disconnect_rsp(void *sap_device);
 int sap_transfer_apdu_rsp(void *sap_device, uint8_t result,
 				uint8_t *sap_apdu_resp, uint16_t length);
+/*
+ * Same as sap_transfer_apdu_rsp but takes the response APDU as up to four
+ * fragments, e.g. data and status words as delivered by the modem, which
+ * are written to the client without being copied together first.
+ */
+int sap_transfer_apdu_rsp_iov(void *sap_device, uint8_t result,
+				const struct iovec *apdu, int iovcnt);
 int sap_transfer_atr_rsp(void *sap_device, uint8_t result,
 				uint8_t *sap_atr, uint16_t length);
 int sap_power_sim_off_rsp(void *sap_device, uint8_t result);
@@ -29,6 +29,8 @@
 #endif
 
 #include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
 #include <glib.h>
 
 #include "lib/sdp.h"
@@ -60,6 +62,11 @@
 #define SAP_TIMER_GRACEFUL_DISCONNECT 30
 #define SAP_TIMER_NO_ACTIVITY 30
 
+#define SAP_APDU_IOV_MAX 4
+#define SAP_APDU_RSP_HDR_SIZE (sizeof(struct sap_message) + \
+			PARAMETER_SIZE(SAP_PARAM_ID_RESULT_CODE_LEN) + \
+			sizeof(struct sap_parameter))
+
 enum {
 	SAP_STATE_DISCONNECTED,
 	SAP_STATE_CONNECT_IN_PROGRESS,
@@ -75,6 +82,14 @@ struct sap_connection {
 	uint32_t state;
 	uint8_t processing_req;
 	guint timer_id;
+	/*
+	 * Preallocated per connection so the APDU path does not need to
+	 * build and clear a full message on the stack for each request.
+	 * Reserved and padding bytes of rsp_hdr are never written and stay
+	 * zeroed from the allocation.
+	 */
+	uint8_t rsp_hdr[SAP_APDU_RSP_HDR_SIZE];
+	uint8_t buf[SAP_BUF_SIZE];
 };
 
 struct sap_server {
@@ -240,52 +255,40 @@ static sdp_record_t *create_sap_record(uint8_t channel)
 	return record;
 }
 
-static int send_message(struct sap_connection *conn, void *buf, size_t size)
+static int send_message_iov(struct sap_connection *conn,
+				const struct iovec *iov, int iovcnt,
+				size_t size)
 {
-	size_t written = 0;
-	GError *gerr = NULL;
-	GIOStatus gstatus;
+	ssize_t written;
 
 	SAP_VDBG("conn %p, size %zu", conn, size);
 
-	gstatus = g_io_channel_write_chars(conn->io, buf, size, &written,
-									&gerr);
-	if (gstatus != G_IO_STATUS_NORMAL) {
-		if (gerr)
-			g_error_free(gerr);
+	do {
+		written = writev(g_io_channel_unix_get_fd(conn->io), iov,
+								iovcnt);
+	} while (written < 0 && errno == EINTR);
 
-		error("write error (0x%02x).", gstatus);
+	if (written < 0) {
+		error("write error: %s (%d)", strerror(errno), errno);
 		return -EIO;
 	}
 
-	if (written != size) {
-		error("written %zu bytes out of %zu", written, size);
+	if ((size_t) written != size) {
+		error("written %zd bytes out of %zu", written, size);
 		return -EIO;
 	}
 
 	return written;
 }
 
-static int disconnect_ind(struct sap_connection *conn, uint8_t disc_type)
+static int send_message(struct sap_connection *conn, void *buf, size_t size)
 {
-	char buf[SAP_BUF_SIZE];
-	struct sap_message *msg = (struct sap_message *) buf;
-	struct sap_parameter *param = (struct sap_parameter *) msg->param;
-	size_t size = sizeof(struct sap_message);
+	struct iovec iov;
 
-	DBG("data %p state %d disc_type 0x%02x", conn, conn->state, disc_type);
+	iov.iov_base = buf;
+	iov.iov_len = size;
 
-	memset(buf, 0, sizeof(buf));
-	msg->id = SAP_DISCONNECT_IND;
-	msg->nparam = 0x01;
-
-	/* Add disconnection type param. */
-	param->id  = SAP_PARAM_ID_DISCONNECT_IND;
-	param->len = htons(SAP_PARAM_ID_DISCONNECT_IND_LEN);
-	*param->val = disc_type;
-	size += PARAMETER_SIZE(SAP_PARAM_ID_DISCONNECT_IND_LEN);
-
-	return send_message(conn, buf, size);
+	return send_message_iov(conn, &iov, 1, size);
 }
 
 static int sap_error_rsp(struct sap_connection *conn)
@@ -732,15 +735,17 @@ int sap_disconnect_rsp(void *sap_device)
 	return 0;
 }
 
-int sap_transfer_apdu_rsp(void *sap_device, uint8_t result, uint8_t *apdu,
-					uint16_t length)
+int sap_transfer_apdu_rsp_iov(void *sap_device, uint8_t result,
+					const struct iovec *apdu, int iovcnt)
 {
+	static const uint8_t padding[3];
 	struct sap_server *server = sap_device;
 	struct sap_connection *conn = server->conn;
-	char buf[SAP_BUF_SIZE];
-	struct sap_message *msg = (struct sap_message *) buf;
-	struct sap_parameter *param = (struct sap_parameter *) msg->param;
-	size_t size = sizeof(struct sap_message);
+	struct iovec iov[SAP_APDU_IOV_MAX + 2];
+	struct sap_message *msg;
+	struct sap_parameter *param;
+	size_t size, length = 0;
+	int i, n;
 
 	if (!conn)
 		return -EINVAL;
@@ -750,32 +755,65 @@ int sap_transfer_apdu_rsp(void *sap_device, uint8_t result, uint8_t *apdu,
 	if (conn->processing_req != SAP_TRANSFER_APDU_REQ)
 		return 0;
 
-	if (result == SAP_RESULT_OK && (!apdu || (apdu && length == 0x00)))
+	if (iovcnt < 0 || iovcnt > SAP_APDU_IOV_MAX || (iovcnt && !apdu))
 		return -EINVAL;
 
-	memset(buf, 0, sizeof(buf));
+	for (i = 0; i < iovcnt; i++)
+		length += apdu[i].iov_len;
+
+	if (result == SAP_RESULT_OK && length == 0)
+		return -EINVAL;
+
+	msg = (struct sap_message *) conn->rsp_hdr;
 	msg->id = SAP_TRANSFER_APDU_RESP;
 	msg->nparam = 0x01;
-	size += add_result_parameter(result, param);
+	size = sizeof(struct sap_message);
+	size += add_result_parameter(result, msg->param);
 
-	/* Add APDU response. */
+	iov[0].iov_base = conn->rsp_hdr;
+	iov[0].iov_len = size;
+	n = 1;
+
+	/* Add APDU response, sent straight from the driver's buffers. */
 	if (result == SAP_RESULT_OK) {
+		if (size + PARAMETER_SIZE(length) > SAP_BUF_SIZE)
+			return -EOVERFLOW;
+
 		msg->nparam++;
-		param = (struct sap_parameter *) &buf[size];
+		param = (struct sap_parameter *) &conn->rsp_hdr[size];
 		param->id = SAP_PARAM_ID_RESPONSE_APDU;
 		param->len = htons(length);
+		iov[0].iov_len += sizeof(struct sap_parameter);
 
-		size += PARAMETER_SIZE(length);
+		for (i = 0; i < iovcnt; i++) {
+			if (!apdu[i].iov_len)
+				continue;
 
-		if (size > SAP_BUF_SIZE)
-			return -EOVERFLOW;
+			iov[n++] = apdu[i];
+		}
 
-		memcpy(param->val, apdu, length);
+		if (PADDING4(length)) {
+			iov[n].iov_base = (void *) padding;
+			iov[n++].iov_len = PADDING4(length);
+		}
+
+		size += PARAMETER_SIZE(length);
 	}
 
 	conn->processing_req = SAP_NO_REQ;
 
-	return send_message(conn, buf, size);
+	return send_message_iov(conn, iov, n, size);
+}
+
+int sap_transfer_apdu_rsp(void *sap_device, uint8_t result, uint8_t *apdu,
+					uint16_t length)
+{
+	struct iovec iov;
+
+	iov.iov_base = apdu;
+	iov.iov_len = apdu ? length : 0;
+
+	return sap_transfer_apdu_rsp_iov(sap_device, result, &iov, 1);
 }
 
 int sap_transfer_atr_rsp(void *sap_device, uint8_t result, uint8_t *atr,
@@ -1097,7 +1135,8 @@ static void sap_server_remove_conn(struct sap_server *server)
 
 static gboolean sap_io_cb(GIOChannel *io, GIOCondition cond, gpointer data)
 {
-	char buf[SAP_BUF_SIZE];
+	struct sap_server *server = data;
+	struct sap_connection *conn = server->conn;
 	size_t bytes_read = 0;
 	GError *gerr = NULL;
 	GIOStatus gstatus;
@@ -1119,8 +1158,12 @@ static gboolean sap_io_cb(GIOChannel *io, GIOCondition cond, gpointer data)
 		return FALSE;
 	}
 
-	gstatus = g_io_channel_read_chars(io, buf, sizeof(buf) - 1,
-							&bytes_read, &gerr);
+	if (!conn)
+		return FALSE;
+
+	gstatus = g_io_channel_read_chars(io, (char *) conn->buf,
+						sizeof(conn->buf) - 1,
+						&bytes_read, &gerr);
 	if (gstatus != G_IO_STATUS_NORMAL) {
 		if (gerr)
 			g_error_free(gerr);
@@ -1128,7 +1171,7 @@ static gboolean sap_io_cb(GIOChannel *io, GIOCondition cond, gpointer data)
 		return TRUE;
 	}
 
-	if (handle_cmd(data, buf, bytes_read) < 0)
+	if (handle_cmd(server, conn->buf, bytes_read) < 0)
 		error("SAP protocol processing failure.");
 
 	return TRUE;
@@ -49,8 +49,6 @@
 #define SCAN_INTERVAL_WIN_UUID		0x2A4F
 #define SCAN_REFRESH_UUID		0x2A31
 
-#define SCAN_INTERVAL		0x0060
-#define SCAN_WINDOW		0x0030
 #define SERVER_REQUIRES_REFRESH	0x00
 
 struct scan {
@@ -60,10 +58,15 @@ struct scan {
 	struct gatt_db_attribute *attr;
 	uint16_t iwhandle;
 	guint refresh_cb_id;
+	uint16_t interval;
+	uint16_t window;
 };
 
+static struct queue *scans = NULL;
+
 static void scan_free(struct scan *scan)
 {
+	queue_remove(scans, scan);
 	bt_gatt_client_unregister_notify(scan->client, scan->refresh_cb_id);
 	gatt_db_unref(scan->db);
 	bt_gatt_client_unref(scan->client);
@@ -73,15 +76,46 @@ static void scan_free(struct scan *scan)
 
 static void write_scan_params(struct scan *scan)
 {
+	struct btd_adapter *adapter = device_get_adapter(scan->device);
 	uint8_t value[4];
 
-	put_le16(SCAN_INTERVAL, &value[0]);
-	put_le16(SCAN_WINDOW, &value[2]);
+	btd_adapter_get_scan_params(adapter, &scan->interval, &scan->window);
+
+	put_le16(scan->interval, &value[0]);
+	put_le16(scan->window, &value[2]);
 
 	bt_gatt_client_write_without_response(scan->client, scan->iwhandle,
 						false, value, sizeof(value));
 }
 
+static void update_scan_params(void *data, void *user_data)
+{
+	struct scan *scan = data;
+	struct btd_adapter *adapter = user_data;
+	uint16_t interval, window;
+
+	if (!scan->client || !scan->iwhandle)
+		return;
+
+	if (device_get_adapter(scan->device) != adapter)
+		return;
+
+	btd_adapter_get_scan_params(adapter, &interval, &window);
+
+	if (interval == scan->interval && window == scan->window)
+		return;
+
+	DBG("interval 0x%04x window 0x%04x", interval, window);
+
+	write_scan_params(scan);
+}
+
+static void scan_params_changed(struct btd_adapter *adapter,
+					uint16_t interval, uint16_t window)
+{
+	queue_foreach(scans, update_scan_params, adapter);
+}
+
 static void refresh_value_cb(uint16_t value_handle, const uint8_t *value,
 					uint16_t length, void *user_data)
 {
@@ -168,6 +202,7 @@ static void foreach_scan_param_service(struct gatt_db_attribute *attr,
 static void scan_reset(struct scan *scan)
 {
 	scan->attr = NULL;
+	scan->iwhandle = 0;
 	gatt_db_unref(scan->db);
 	scan->db = NULL;
 	bt_gatt_client_unref(scan->client);
@@ -260,6 +295,12 @@ static int scan_param_probe(struct btd_service *service)
 
 	scan->device = btd_device_ref(device);
 	btd_service_set_user_data(service, scan);
+
+	if (!scans)
+		scans = queue_new();
+
+	queue_push_tail(scans, scan);
+
 	return 0;
 }
 
@@ -274,12 +315,18 @@ static struct btd_profile scan_profile = {
 
 static int scan_param_init(void)
 {
+	btd_add_scan_params_cb(scan_params_changed);
+
 	return btd_profile_register(&scan_profile);
 }
 
 static void scan_param_exit(void)
 {
 	btd_profile_unregister(&scan_profile);
+	btd_remove_scan_params_cb(scan_params_changed);
+
+	queue_destroy(scans, NULL);
+	scans = NULL;
 }
 
 BLUETOOTH_PLUGIN_DEFINE(scanparam, VERSION,
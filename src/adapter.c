@@ -55,6 +55,7 @@
 
 #include "src/shared/mgmt.h"
 #include "src/shared/util.h"
+#include "src/shared/trace.h"
 #include "src/shared/queue.h"
 #include "src/shared/att.h"
 #include "src/shared/gatt-db.h"
@@ -76,6 +77,7 @@
 #include "gatt-database.h"
 #include "advertising.h"
 #include "eir.h"
+#include "metrics.h"
 
 #define ADAPTER_INTERFACE	"org.bluez.Adapter1"
 
@@ -89,10 +91,25 @@
 #define TEMP_DEV_TIMEOUT (3 * 60)
 #define BONDING_TIMEOUT (2 * 60)
 
+/*
+ * LE scan parameters in 0.625 ms units. The kernel uses them for its
+ * background scan and when creating LE connections, so they set both
+ * the scan duty cycle and how quickly a returning device is picked up.
+ */
+#define SCAN_FAST_INTERVAL	0x0060	/* 60 ms */
+#define SCAN_FAST_WINDOW	0x0030	/* 30 ms */
+#define SCAN_SLOW_INTERVAL	0x0800	/* 1.28 s */
+#define SCAN_SLOW_WINDOW	0x0100	/* 160 ms */
+#define SCAN_POWER_WINDOW	0x0012	/* 11.25 ms */
+#define SCAN_FAST_TIMEOUT	(30)
+
 #define SCAN_TYPE_BREDR (1 << BDADDR_BREDR)
 #define SCAN_TYPE_LE ((1 << BDADDR_LE_PUBLIC) | (1 << BDADDR_LE_RANDOM))
 #define SCAN_TYPE_DUAL (SCAN_TYPE_BREDR | SCAN_TYPE_LE)
 
+/* Commands for different controllers may be in flight at the same time */
+#define MGMT_MAX_PENDING	8
+
 #define HCI_RSSI_INVALID	127
 #define DISTANCE_VAL_INVALID	0x7FFF
 #define PATHLOSS_MAX		137
@@ -109,12 +126,17 @@ static GSList *adapters = NULL;
 
 static struct mgmt *mgmt_master = NULL;
 
+/* Controllers from the initial index list that are still being set up */
+static bool startup_listing = false;
+static unsigned int startup_pending = 0;
+
 static uint8_t mgmt_version = 0;
 static uint8_t mgmt_revision = 0;
 
 static GSList *adapter_drivers = NULL;
 
 static GSList *disconnect_list = NULL;
+static GSList *scan_params_list = NULL;
 static GSList *conn_fail_list = NULL;
 
 struct link_key_info {
@@ -158,6 +180,24 @@ struct discovery_filter {
 	bool duplicate;
 };
 
+/*
+ * Proximity limits of all clients sharing a UUID. Any of the clients passing
+ * is enough, so the lowest RSSI threshold and highest pathloss are kept.
+ */
+struct filter_proximity {
+	bool any;		/* A client without both limits set */
+	int16_t rssi;
+	uint16_t pathloss;
+};
+
+struct discovery_matcher {
+	bool all;		/* A client without filter */
+	bool duplicate;		/* A client wants duplicate data */
+	bool any_uuid;		/* A client without UUIDs */
+	struct filter_proximity proximity;	/* of clients without UUIDs */
+	GHashTable *uuids;	/* UUID string to struct filter_proximity */
+};
+
 struct watch_client {
 	struct btd_adapter *adapter;
 	DBusMessage *msg;
@@ -223,19 +263,29 @@ struct btd_adapter {
 					 */
 	/* current discovery filter, if any */
 	struct mgmt_cp_start_service_discovery *current_discovery_filter;
+	/* filters of discovery_list compiled for matching reports */
+	struct discovery_matcher *discovery_matcher;
 
 	GSList *discovery_found;	/* list of found devices */
 	guint discovery_idle_timeout;	/* timeout between discovery runs */
 	guint passive_scan_timeout;	/* timeout between passive scans */
+	uint16_t scan_interval;		/* LE scan parameters requested */
+	uint16_t scan_window;
+	guint scan_fast_timeout;	/* end of fast scanning burst */
 	guint temp_devices_timeout;	/* timeout for temporary devices */
 
 	guint pairable_timeout_id;	/* pairable timeout id */
+	unsigned int power_on_id;	/* pending restore of powered */
 	guint auth_idle_id;		/* Pending authorization dequeue */
 	GQueue *auths;			/* Ongoing and pending auths */
 	bool pincode_requested;		/* PIN requested during last bonding */
 	GSList *connections;		/* Connected devices */
 	GSList *devices;		/* Devices structure pointers */
+	GHashTable *devices_addr;	/* Devices by address */
+	GHashTable *devices_path;	/* Devices by object path */
 	GSList *connect_list;		/* Devices to connect when found */
+	GSList *auto_connect;		/* Kernel auto-connect scheduling */
+	guint auto_connect_id;		/* Pending auto-connect batch */
 	struct btd_device *connect_le;	/* LE device waiting to be connected */
 	sdp_list_t *services;		/* Services associated to adapter */
 
@@ -454,8 +504,6 @@ static void store_adapter_info(struct btd_adapter *adapter)
 {
 	GKeyFile *key_file;
 	char filename[PATH_MAX];
-	char *str;
-	gsize length = 0;
 	gboolean discoverable;
 
 	key_file = g_key_file_new();
@@ -485,19 +533,16 @@ static void store_adapter_info(struct btd_adapter *adapter)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/settings",
 						adapter_dir(adapter));
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
+	storage_save(filename, key_file);
 
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
 static void trigger_pairable_timeout(struct btd_adapter *adapter);
 static void adapter_start(struct btd_adapter *adapter);
 static void adapter_stop(struct btd_adapter *adapter);
 static void trigger_passive_scanning(struct btd_adapter *adapter);
+static void scan_schedule(struct btd_adapter *adapter);
 static bool set_mode(struct btd_adapter *adapter, uint16_t opcode,
 							uint8_t mode);
 
@@ -804,6 +849,128 @@ int adapter_set_name(struct btd_adapter *adapter, const char *name)
 	return set_name(adapter, name);
 }
 
+static guint bdaddr_hash(gconstpointer key)
+{
+	const bdaddr_t *bdaddr = key;
+
+	/* The lower bytes are the ones that differ most between devices */
+	return bdaddr->b[0] | bdaddr->b[1] << 8 | bdaddr->b[2] << 16 |
+							bdaddr->b[3] << 24;
+}
+
+static gboolean bdaddr_equal(gconstpointer a, gconstpointer b)
+{
+	return !bacmp(a, b);
+}
+
+static guint path_hash(gconstpointer key)
+{
+	const char *path = key;
+	guint hash = 5381;
+
+	/* Object paths are compared case insensitive */
+	for (; *path; path++)
+		hash = hash * 33 + g_ascii_tolower(*path);
+
+	return hash;
+}
+
+static gboolean path_equal(gconstpointer a, gconstpointer b)
+{
+	return !strcasecmp(a, b);
+}
+
+/*
+ * Every device is indexed by its current address and, when it differs,
+ * by the address used for the connection. Each address maps to the list
+ * of devices using it, which the lookups then match against the type.
+ */
+static void device_index_add(struct btd_adapter *adapter,
+				struct btd_device *device,
+				const bdaddr_t *bdaddr)
+{
+	GSList *list;
+
+	if (!bacmp(bdaddr, BDADDR_ANY))
+		return;
+
+	list = g_hash_table_lookup(adapter->devices_addr, bdaddr);
+	if (g_slist_find(list, device))
+		return;
+
+	list = g_slist_append(list, device);
+
+	g_hash_table_insert(adapter->devices_addr,
+				g_memdup(bdaddr, sizeof(*bdaddr)), list);
+}
+
+static void device_index_remove(struct btd_adapter *adapter,
+				struct btd_device *device,
+				const bdaddr_t *bdaddr)
+{
+	GSList *list;
+
+	list = g_hash_table_lookup(adapter->devices_addr, bdaddr);
+	if (!g_slist_find(list, device))
+		return;
+
+	list = g_slist_remove(list, device);
+	if (!list) {
+		g_hash_table_remove(adapter->devices_addr, bdaddr);
+		return;
+	}
+
+	g_hash_table_insert(adapter->devices_addr,
+				g_memdup(bdaddr, sizeof(*bdaddr)), list);
+}
+
+static void device_index_insert(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	device_index_add(adapter, device, device_get_address(device));
+	device_index_add(adapter, device, device_get_conn_address(device));
+
+	g_hash_table_insert(adapter->devices_path,
+				(gpointer) device_get_path(device), device);
+}
+
+static void device_index_delete(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	device_index_remove(adapter, device, device_get_address(device));
+	device_index_remove(adapter, device,
+					device_get_conn_address(device));
+
+	g_hash_table_remove(adapter->devices_path, device_get_path(device));
+}
+
+static gboolean free_device_index(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	g_slist_free(value);
+
+	return TRUE;
+}
+
+void btd_adapter_update_device_addr(struct btd_adapter *adapter,
+					struct btd_device *device,
+					const bdaddr_t *old_bdaddr)
+{
+	/* The old address might still be in use as the other one */
+	if (bacmp(old_bdaddr, device_get_address(device)) &&
+			bacmp(old_bdaddr, device_get_conn_address(device)))
+		device_index_remove(adapter, device, old_bdaddr);
+
+	device_index_add(adapter, device, device_get_address(device));
+	device_index_add(adapter, device, device_get_conn_address(device));
+}
+
+static struct btd_device *find_device_by_path(struct btd_adapter *adapter,
+							const char *path)
+{
+	return g_hash_table_lookup(adapter->devices_path, path);
+}
+
 struct btd_device *btd_adapter_find_device(struct btd_adapter *adapter,
 							const bdaddr_t *dst,
 							uint8_t bdaddr_type)
@@ -818,8 +985,8 @@ struct btd_device *btd_adapter_find_device(struct btd_adapter *adapter,
 	bacpy(&addr.bdaddr, dst);
 	addr.bdaddr_type = bdaddr_type;
 
-	list = g_slist_find_custom(adapter->devices, &addr,
-							device_addr_type_cmp);
+	list = g_hash_table_lookup(adapter->devices_addr, dst);
+	list = g_slist_find_custom(list, &addr, device_addr_type_cmp);
 	if (!list)
 		return NULL;
 
@@ -1145,6 +1312,7 @@ static struct btd_device *adapter_create_device(struct btd_adapter *adapter,
 		return NULL;
 
 	adapter->devices = g_slist_append(adapter->devices, device);
+	device_index_insert(adapter, device);
 
 	return device;
 }
@@ -1172,14 +1340,21 @@ static void service_auth_cancel(struct service_auth *auth)
 	g_free(auth);
 }
 
+static void auto_connect_forget(struct btd_adapter *adapter,
+						struct btd_device *device);
+static void auto_connect_connected(struct btd_adapter *adapter,
+						struct btd_device *device);
+
 void btd_adapter_remove_device(struct btd_adapter *adapter,
 				struct btd_device *dev)
 {
 	GList *l;
 
 	adapter->connect_list = g_slist_remove(adapter->connect_list, dev);
+	auto_connect_forget(adapter, dev);
 
 	adapter->devices = g_slist_remove(adapter->devices, dev);
+	device_index_delete(adapter, dev);
 
 	adapter->discovery_found = g_slist_remove(adapter->discovery_found,
 									dev);
@@ -1422,6 +1597,125 @@ static void free_discovery_filter(struct discovery_filter *discovery_filter)
 	g_free(discovery_filter);
 }
 
+static void proximity_init(struct filter_proximity *proximity)
+{
+	proximity->any = false;
+	proximity->rssi = DISTANCE_VAL_INVALID;
+	proximity->pathloss = DISTANCE_VAL_INVALID;
+}
+
+static void proximity_add(struct filter_proximity *proximity,
+					const struct discovery_filter *item)
+{
+	/* Missing one of the limits lets every report pass */
+	if (item->rssi == DISTANCE_VAL_INVALID ||
+				item->pathloss == DISTANCE_VAL_INVALID) {
+		proximity->any = true;
+		return;
+	}
+
+	if (proximity->rssi == DISTANCE_VAL_INVALID ||
+					item->rssi < proximity->rssi)
+		proximity->rssi = item->rssi;
+
+	if (proximity->pathloss == DISTANCE_VAL_INVALID ||
+					item->pathloss > proximity->pathloss)
+		proximity->pathloss = item->pathloss;
+}
+
+static bool proximity_match(const struct filter_proximity *proximity,
+				const struct eir_data *eir_data, int8_t rssi)
+{
+	if (proximity->any)
+		return true;
+
+	if (proximity->rssi != DISTANCE_VAL_INVALID &&
+						proximity->rssi <= rssi)
+		return true;
+
+	if (proximity->pathloss != DISTANCE_VAL_INVALID &&
+				eir_data->tx_power != 127 &&
+				eir_data->tx_power - rssi <= proximity->pathloss)
+		return true;
+
+	return false;
+}
+
+static struct discovery_matcher *discovery_matcher_new(GSList *clients)
+{
+	struct discovery_matcher *matcher;
+	GSList *l, *m;
+
+	matcher = g_new0(struct discovery_matcher, 1);
+	proximity_init(&matcher->proximity);
+
+	/* The keys belong to the filters, which outlive the matcher */
+	matcher->uuids = g_hash_table_new_full(g_str_hash, g_str_equal,
+								NULL, g_free);
+
+	for (l = clients; l; l = g_slist_next(l)) {
+		struct watch_client *client = l->data;
+		struct discovery_filter *item = client->discovery_filter;
+
+		if (!item) {
+			matcher->all = true;
+			continue;
+		}
+
+		if (item->duplicate)
+			matcher->duplicate = true;
+
+		if (!item->uuids) {
+			matcher->any_uuid = true;
+			proximity_add(&matcher->proximity, item);
+			continue;
+		}
+
+		for (m = item->uuids; m; m = g_slist_next(m)) {
+			struct filter_proximity *proximity;
+
+			proximity = g_hash_table_lookup(matcher->uuids,
+								m->data);
+			if (!proximity) {
+				proximity = g_new0(struct filter_proximity, 1);
+				proximity_init(proximity);
+				g_hash_table_insert(matcher->uuids, m->data,
+								proximity);
+			}
+
+			proximity_add(proximity, item);
+		}
+	}
+
+	return matcher;
+}
+
+static void discovery_matcher_free(struct discovery_matcher *matcher)
+{
+	if (!matcher)
+		return;
+
+	g_hash_table_destroy(matcher->uuids);
+	g_free(matcher);
+}
+
+static struct discovery_matcher *discovery_matcher_get(
+						struct btd_adapter *adapter)
+{
+	if (!adapter->discovery_matcher)
+		adapter->discovery_matcher = discovery_matcher_new(
+						adapter->discovery_list);
+
+	return adapter->discovery_matcher;
+}
+
+/* Needs to be called whenever the discovery clients or their filters change */
+static void discovery_matcher_reset(struct btd_adapter *adapter)
+{
+	discovery_matcher_free(adapter->discovery_matcher);
+	adapter->discovery_matcher = NULL;
+}
+
 static void trigger_start_discovery(struct btd_adapter *adapter, guint delay);
 
 static void start_discovery_complete(uint8_t status, uint16_t length,
@@ -1741,6 +2035,10 @@ static void invalidate_rssi_and_tx_power(gpointer a)
 
 	device_set_rssi(dev, 0);
 	device_set_tx_power(dev, 127);
+
+	/* Make the next report go through all the setters again */
+	device_set_adv_hash(dev, BDADDR_BREDR, 0, 0);
+	device_set_adv_hash(dev, BDADDR_LE_PUBLIC, 0, 0);
 }
 
 static gboolean remove_temp_devices(gpointer user_data)
@@ -1820,6 +2118,9 @@ static void discovery_remove(struct watch_client *client)
 	adapter->discovery_list = g_slist_remove(adapter->discovery_list,
 								client);
 
+	discovery_matcher_reset(adapter);
+	scan_schedule(adapter);
+
 	discovery_free(client);
 
 	/*
@@ -2207,6 +2508,9 @@ static DBusMessage *start_discovery(DBusConnection *conn,
 								client);
 
 done:
+	discovery_matcher_reset(adapter);
+	scan_schedule(adapter);
+
 	/*
 	 * Just trigger the discovery here. In case an already running
 	 * discovery in idle phase exists, it will be restarted right
@@ -2448,8 +2752,10 @@ static DBusMessage *set_discovery_filter(DBusConnection *conn,
 		free_discovery_filter(client->discovery_filter);
 		client->discovery_filter = discovery_filter;
 
-		if (is_discovering)
+		if (is_discovering) {
+			discovery_matcher_reset(adapter);
 			update_discovery_filter(adapter);
+		}
 
 		if (discovery_filter || is_discovering)
 			return dbus_message_new_method_return(msg);
@@ -2985,36 +3291,24 @@ static gboolean property_get_modalias(const GDBusPropertyTable *property,
 	return TRUE;
 }
 
-static int device_path_cmp(gconstpointer a, gconstpointer b)
-{
-	const struct btd_device *device = a;
-	const char *path = b;
-	const char *dev_path = device_get_path(device);
-
-	return strcasecmp(dev_path, path);
-}
-
 static DBusMessage *remove_device(DBusConnection *conn,
 					DBusMessage *msg, void *user_data)
 {
 	struct btd_adapter *adapter = user_data;
 	struct btd_device *device;
 	const char *path;
-	GSList *list;
 
 	if (dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &path,
 						DBUS_TYPE_INVALID) == FALSE)
 		return btd_error_invalid_args(msg);
 
-	list = g_slist_find_custom(adapter->devices, path, device_path_cmp);
-	if (!list)
+	device = find_device_by_path(adapter, path);
+	if (!device)
 		return btd_error_does_not_exist(msg);
 
 	if (!(adapter->current_settings & MGMT_SETTING_POWERED))
 		return btd_error_not_ready(msg);
 
-	device = list->data;
-
 	btd_device_set_temporary(device, true);
 
 	if (!btd_device_is_connected(device)) {
@@ -3312,6 +3606,7 @@ static int generate_and_write_irk(uint8_t *irk, GKeyFile *key_file,
 								str_irk_out);
 	str = g_key_file_to_data(key_file, &length, NULL);
 	g_file_set_contents(filename, str, length, NULL);
+	btd_metrics_inc(BTD_METRIC_STORAGE_WRITES);
 	g_free(str);
 	DBG("Generated IRK written to file");
 	return 0;
@@ -3397,6 +3692,155 @@ static int set_privacy(struct btd_adapter *adapter, uint8_t privacy)
 	return -1;
 }
 
+/*
+ * The key lists are written straight into mgmt command buffers while the
+ * storage directory is parsed, growing them as needed, and are then queued
+ * without another copy. The kernel replaces its whole list with every load
+ * command, so each list still has to be sent as a single command and is
+ * bounded by the maximum payload size.
+ */
+#define LOAD_BUF_CHUNK 64
+
+struct load_buf {
+	uint8_t *cp;
+	size_t hdr_size;
+	size_t entry_size;
+	uint16_t count;
+	uint16_t alloc;
+	uint16_t max_count;
+	bool overflow;
+};
+
+static void load_buf_init(struct load_buf *buf, size_t hdr_size,
+							size_t entry_size)
+{
+	memset(buf, 0, sizeof(*buf));
+
+	buf->hdr_size = hdr_size;
+	buf->entry_size = entry_size;
+	buf->max_count = (UINT16_MAX - hdr_size) / entry_size;
+	buf->cp = mgmt_buf_new(hdr_size);
+}
+
+static void *load_buf_add(struct load_buf *buf)
+{
+	uint8_t *cp;
+	size_t alloc;
+
+	if (!buf->cp)
+		return NULL;
+
+	if (buf->count == buf->max_count) {
+		buf->overflow = true;
+		return NULL;
+	}
+
+	if (buf->count == buf->alloc) {
+		alloc = buf->alloc ? buf->alloc * 2 : LOAD_BUF_CHUNK;
+		if (alloc > buf->max_count)
+			alloc = buf->max_count;
+
+		cp = mgmt_buf_resize(buf->cp, buf->hdr_size +
+						alloc * buf->entry_size);
+		if (!cp) {
+			mgmt_buf_free(buf->cp);
+			buf->cp = NULL;
+			return NULL;
+		}
+
+		memset(cp + buf->hdr_size + buf->alloc * buf->entry_size, 0,
+					(alloc - buf->alloc) * buf->entry_size);
+
+		buf->cp = cp;
+		buf->alloc = alloc;
+	}
+
+	return buf->cp + buf->hdr_size + buf->count++ * buf->entry_size;
+}
+
+static size_t load_buf_size(struct load_buf *buf)
+{
+	return buf->hdr_size + buf->count * buf->entry_size;
+}
+
+static void *load_buf_steal(struct load_buf *buf)
+{
+	void *cp = buf->cp;
+
+	buf->cp = NULL;
+
+	return cp;
+}
+
+static void load_buf_free(struct load_buf *buf)
+{
+	mgmt_buf_free(load_buf_steal(buf));
+}
+
+static void add_link_key(struct load_buf *buf, struct link_key_info *info)
+{
+	struct mgmt_link_key_info *key;
+
+	key = load_buf_add(buf);
+	if (!key)
+		return;
+
+	bacpy(&key->addr.bdaddr, &info->bdaddr);
+	key->addr.type = BDADDR_BREDR;
+	key->type = info->type;
+	memcpy(key->val, info->key, 16);
+	key->pin_len = info->pin_len;
+}
+
+static void add_ltk(void *data, void *user_data)
+{
+	struct smp_ltk_info *info = data;
+	struct load_buf *buf = user_data;
+	struct mgmt_ltk_info *key;
+
+	key = load_buf_add(buf);
+	if (!key)
+		return;
+
+	bacpy(&key->addr.bdaddr, &info->bdaddr);
+	key->addr.type = info->bdaddr_type;
+	memcpy(key->val, info->val, sizeof(info->val));
+	key->rand = cpu_to_le64(info->rand);
+	key->ediv = cpu_to_le16(info->ediv);
+	key->type = info->authenticated;
+	key->master = info->master;
+	key->enc_size = info->enc_size;
+}
+
+static void add_irk(struct load_buf *buf, struct irk_info *info)
+{
+	struct mgmt_irk_info *irk;
+
+	irk = load_buf_add(buf);
+	if (!irk)
+		return;
+
+	bacpy(&irk->addr.bdaddr, &info->bdaddr);
+	irk->addr.type = info->bdaddr_type;
+	memcpy(irk->val, info->val, sizeof(irk->val));
+}
+
+static void add_conn_param(struct load_buf *buf, struct conn_param *info)
+{
+	struct mgmt_conn_param *param;
+
+	param = load_buf_add(buf);
+	if (!param)
+		return;
+
+	bacpy(&param->addr.bdaddr, &info->bdaddr);
+	param->addr.type = info->bdaddr_type;
+	param->min_interval = htobs(info->min_interval);
+	param->max_interval = htobs(info->max_interval);
+	param->latency = htobs(info->latency);
+	param->timeout = htobs(info->timeout);
+}
+
 static void load_link_keys_complete(uint8_t status, uint16_t length,
 					const void *param, void *user_data)
 {
@@ -3412,14 +3856,11 @@ static void load_link_keys_complete(uint8_t status, uint16_t length,
 	DBG("link keys loaded for hci%u", adapter->dev_id);
 }
 
-static void load_link_keys(struct btd_adapter *adapter, GSList *keys,
+static void load_link_keys(struct btd_adapter *adapter, struct load_buf *keys,
 							bool debug_keys)
 {
 	struct mgmt_cp_load_link_keys *cp;
-	struct mgmt_link_key_info *key;
-	size_t key_count, cp_size;
 	unsigned int id;
-	GSList *l;
 
 	/*
 	 * If the controller does not support BR/EDR operation,
@@ -3431,20 +3872,21 @@ static void load_link_keys(struct btd_adapter *adapter, GSList *keys,
 	if (!(adapter->supported_settings & MGMT_SETTING_BREDR))
 		return;
 
-	key_count = g_slist_length(keys);
-
-	DBG("hci%u keys %zu debug_keys %d", adapter->dev_id, key_count,
+	DBG("hci%u keys %u debug_keys %d", adapter->dev_id, keys->count,
 								debug_keys);
 
-	cp_size = sizeof(*cp) + (key_count * sizeof(*key));
-
-	cp = g_try_malloc0(cp_size);
+	cp = (struct mgmt_cp_load_link_keys *) keys->cp;
 	if (cp == NULL) {
 		btd_error(adapter->dev_id, "No memory for link keys for hci%u",
 							adapter->dev_id);
 		return;
 	}
 
+	if (keys->overflow)
+		btd_error(adapter->dev_id, "Too many link keys for hci%u, "
+				"loading only %u", adapter->dev_id,
+				keys->count);
+
 	/*
 	 * Even if the list of stored keys is empty, it is important to
 	 * load an empty list into the kernel. That way it is ensured
@@ -3454,24 +3896,13 @@ static void load_link_keys(struct btd_adapter *adapter, GSList *keys,
 	 * behavior for debug keys.
 	 */
 	cp->debug_keys = debug_keys;
-	cp->key_count = htobs(key_count);
-
-	for (l = keys, key = cp->keys; l != NULL; l = g_slist_next(l), key++) {
-		struct link_key_info *info = l->data;
-
-		bacpy(&key->addr.bdaddr, &info->bdaddr);
-		key->addr.type = BDADDR_BREDR;
-		key->type = info->type;
-		memcpy(key->val, info->key, 16);
-		key->pin_len = info->pin_len;
-	}
+	cp->key_count = htobs(keys->count);
 
-	id = mgmt_send(adapter->mgmt, MGMT_OP_LOAD_LINK_KEYS,
-				adapter->dev_id, cp_size, cp,
+	id = mgmt_send_buf(adapter->mgmt, MGMT_OP_LOAD_LINK_KEYS,
+				adapter->dev_id, load_buf_size(keys),
+				load_buf_steal(keys),
 				load_link_keys_complete, adapter, NULL);
 
-	g_free(cp);
-
 	if (id == 0)
 		btd_error(adapter->dev_id, "Failed to load link keys for hci%u",
 							adapter->dev_id);
@@ -3511,12 +3942,9 @@ static void load_ltks_complete(uint8_t status, uint16_t length,
 	DBG("LTKs loaded for hci%u", adapter->dev_id);
 }
 
-static void load_ltks(struct btd_adapter *adapter, GSList *keys)
+static void load_ltks(struct btd_adapter *adapter, struct load_buf *keys)
 {
 	struct mgmt_cp_load_long_term_keys *cp;
-	struct mgmt_ltk_info *key;
-	size_t key_count, cp_size;
-	GSList *l;
 
 	/*
 	 * If the controller does not support Low Energy operation,
@@ -3531,46 +3959,33 @@ static void load_ltks(struct btd_adapter *adapter, GSList *keys)
 	if (!(adapter->supported_settings & MGMT_SETTING_LE))
 		return;
 
-	key_count = g_slist_length(keys);
+	DBG("hci%u keys %u", adapter->dev_id, keys->count);
 
-	DBG("hci%u keys %zu", adapter->dev_id, key_count);
-
-	cp_size = sizeof(*cp) + (key_count * sizeof(*key));
-
-	cp = g_try_malloc0(cp_size);
+	cp = (struct mgmt_cp_load_long_term_keys *) keys->cp;
 	if (cp == NULL) {
 		btd_error(adapter->dev_id, "No memory for LTKs for hci%u",
 							adapter->dev_id);
 		return;
 	}
 
+	if (keys->overflow)
+		btd_error(adapter->dev_id, "Too many LTKs for hci%u, "
+				"loading only %u", adapter->dev_id,
+				keys->count);
+
 	/*
 	 * Even if the list of stored keys is empty, it is important to
 	 * load an empty list into the kernel. That way it is ensured
 	 * that no old keys from a previous daemon are present.
 	 */
-	cp->key_count = htobs(key_count);
-
-	for (l = keys, key = cp->keys; l != NULL; l = g_slist_next(l), key++) {
-		struct smp_ltk_info *info = l->data;
+	cp->key_count = htobs(keys->count);
 
-		bacpy(&key->addr.bdaddr, &info->bdaddr);
-		key->addr.type = info->bdaddr_type;
-		memcpy(key->val, info->val, sizeof(info->val));
-		key->rand = cpu_to_le64(info->rand);
-		key->ediv = cpu_to_le16(info->ediv);
-		key->type = info->authenticated;
-		key->master = info->master;
-		key->enc_size = info->enc_size;
-	}
-
-	adapter->load_ltks_id = mgmt_send(adapter->mgmt,
+	adapter->load_ltks_id = mgmt_send_buf(adapter->mgmt,
 					MGMT_OP_LOAD_LONG_TERM_KEYS,
-					adapter->dev_id, cp_size, cp,
+					adapter->dev_id, load_buf_size(keys),
+					load_buf_steal(keys),
 					load_ltks_complete, adapter, NULL);
 
-	g_free(cp);
-
 	if (adapter->load_ltks_id == 0) {
 		btd_error(adapter->dev_id, "Failed to load LTKs for hci%u",
 							adapter->dev_id);
@@ -3607,13 +4022,10 @@ static void load_irks_complete(uint8_t status, uint16_t length,
 	DBG("IRKs loaded for hci%u", adapter->dev_id);
 }
 
-static void load_irks(struct btd_adapter *adapter, GSList *irks)
+static void load_irks(struct btd_adapter *adapter, struct load_buf *irks)
 {
 	struct mgmt_cp_load_irks *cp;
-	struct mgmt_irk_info *irk;
-	size_t irk_count, cp_size;
 	unsigned int id;
-	GSList *l;
 
 	/*
 	 * If the controller does not support LE Privacy operation,
@@ -3623,38 +4035,30 @@ static void load_irks(struct btd_adapter *adapter, GSList *irks)
 	if (!(adapter->supported_settings & MGMT_SETTING_PRIVACY))
 		return;
 
-	irk_count = g_slist_length(irks);
-
-	DBG("hci%u irks %zu", adapter->dev_id, irk_count);
-
-	cp_size = sizeof(*cp) + (irk_count * sizeof(*irk));
+	DBG("hci%u irks %u", adapter->dev_id, irks->count);
 
-	cp = g_try_malloc0(cp_size);
+	cp = (struct mgmt_cp_load_irks *) irks->cp;
 	if (cp == NULL) {
 		btd_error(adapter->dev_id, "No memory for IRKs for hci%u",
 							adapter->dev_id);
 		return;
 	}
 
+	if (irks->overflow)
+		btd_error(adapter->dev_id, "Too many IRKs for hci%u, "
+				"loading only %u", adapter->dev_id,
+				irks->count);
+
 	/*
 	 * Even if the list of stored keys is empty, it is important to
 	 * load an empty list into the kernel. That way we tell the
 	 * kernel that we are able to handle New IRK events.
 	 */
-	cp->irk_count = htobs(irk_count);
-
-	for (l = irks, irk = cp->irks; l != NULL; l = g_slist_next(l), irk++) {
-		struct irk_info *info = l->data;
-
-		bacpy(&irk->addr.bdaddr, &info->bdaddr);
-		irk->addr.type = info->bdaddr_type;
-		memcpy(irk->val, info->val, sizeof(irk->val));
-	}
+	cp->irk_count = htobs(irks->count);
 
-	id = mgmt_send(adapter->mgmt, MGMT_OP_LOAD_IRKS, adapter->dev_id,
-			cp_size, cp, load_irks_complete, adapter, NULL);
-
-	g_free(cp);
+	id = mgmt_send_buf(adapter->mgmt, MGMT_OP_LOAD_IRKS, adapter->dev_id,
+			load_buf_size(irks), load_buf_steal(irks),
+			load_irks_complete, adapter, NULL);
 
 	if (id == 0)
 		btd_error(adapter->dev_id, "Failed to IRKs for hci%u",
@@ -3676,13 +4080,11 @@ static void load_conn_params_complete(uint8_t status, uint16_t length,
 	DBG("Connection Parameters loaded for hci%u", adapter->dev_id);
 }
 
-static void load_conn_params(struct btd_adapter *adapter, GSList *params)
+static void load_conn_params(struct btd_adapter *adapter,
+						struct load_buf *params)
 {
 	struct mgmt_cp_load_conn_param *cp;
-	struct mgmt_conn_param *param;
-	size_t param_count, cp_size;
 	unsigned int id;
-	GSList *l;
 
 	/*
 	 * If the controller does not support Low Energy operation,
@@ -3692,36 +4094,24 @@ static void load_conn_params(struct btd_adapter *adapter, GSList *params)
 	if (!(adapter->supported_settings & MGMT_SETTING_LE))
 		return;
 
-	param_count = g_slist_length(params);
-
-	DBG("hci%u conn params %zu", adapter->dev_id, param_count);
-
-	cp_size = sizeof(*cp) + (param_count * sizeof(*param));
-
-	cp = g_try_malloc0(cp_size);
+	cp = (struct mgmt_cp_load_conn_param *) params->cp;
 	if (cp == NULL) {
 		btd_error(adapter->dev_id,
 			"Failed to allocate memory for connection parameters");
 		return;
 	}
 
-	cp->param_count = htobs(param_count);
-
-	for (l = params, param = cp->params; l; l = g_slist_next(l), param++) {
-		struct conn_param *info = l->data;
+	if (params->overflow)
+		btd_error(adapter->dev_id, "Too many connection parameters "
+				"for hci%u, loading only %u", adapter->dev_id,
+				params->count);
 
-		bacpy(&param->addr.bdaddr, &info->bdaddr);
-		param->addr.type = info->bdaddr_type;
-		param->min_interval = htobs(info->min_interval);
-		param->max_interval = htobs(info->max_interval);
-		param->latency = htobs(info->latency);
-		param->timeout = htobs(info->timeout);
-	}
-
-	id = mgmt_send(adapter->mgmt, MGMT_OP_LOAD_CONN_PARAM, adapter->dev_id,
-			cp_size, cp, load_conn_params_complete, adapter, NULL);
+	cp->param_count = htobs(params->count);
 
-	g_free(cp);
+	id = mgmt_send_buf(adapter->mgmt, MGMT_OP_LOAD_CONN_PARAM,
+			adapter->dev_id, load_buf_size(params),
+			load_buf_steal(params), load_conn_params_complete,
+			adapter, NULL);
 
 	if (id == 0)
 		btd_error(adapter->dev_id, "Load connection parameters failed");
@@ -3758,10 +4148,7 @@ static void probe_devices(void *user_data)
 static void load_devices(struct btd_adapter *adapter)
 {
 	char dirname[PATH_MAX];
-	GSList *keys = NULL;
-	GSList *ltks = NULL;
-	GSList *irks = NULL;
-	GSList *params = NULL;
+	struct load_buf keys, ltks, irks, params;
 	GSList *added_devices = NULL;
 	DIR *dir;
 	struct dirent *entry;
@@ -3776,6 +4163,15 @@ static void load_devices(struct btd_adapter *adapter)
 		return;
 	}
 
+	load_buf_init(&keys, sizeof(struct mgmt_cp_load_link_keys),
+					sizeof(struct mgmt_link_key_info));
+	load_buf_init(&ltks, sizeof(struct mgmt_cp_load_long_term_keys),
+					sizeof(struct mgmt_ltk_info));
+	load_buf_init(&irks, sizeof(struct mgmt_cp_load_irks),
+					sizeof(struct mgmt_irk_info));
+	load_buf_init(&params, sizeof(struct mgmt_cp_load_conn_param),
+					sizeof(struct mgmt_conn_param));
+
 	while ((entry = readdir(dir)) != NULL) {
 		struct btd_device *device;
 		char filename[PATH_MAX];
@@ -3785,6 +4181,7 @@ static void load_devices(struct btd_adapter *adapter)
 		struct irk_info *irk_info;
 		struct conn_param *param;
 		uint8_t bdaddr_type;
+		bdaddr_t addr;
 
 		if (entry->d_type == DT_UNKNOWN)
 			entry->d_type = util_get_dt(dirname, entry->d_name);
@@ -3795,27 +4192,29 @@ static void load_devices(struct btd_adapter *adapter)
 		snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 					adapter_dir(adapter), entry->d_name);
 
-		key_file = g_key_file_new();
-		g_key_file_load_from_file(key_file, filename, 0, NULL);
+		key_file = storage_load(filename);
 
 		key_info = get_key_info(key_file, entry->d_name);
 		if (key_info)
-			keys = g_slist_append(keys, key_info);
+			add_link_key(&keys, key_info);
 
 		bdaddr_type = get_le_addr_type(key_file);
 
 		ltk_info = get_ltk_info(key_file, entry->d_name, bdaddr_type);
-		ltks = g_slist_concat(ltks, ltk_info);
+		g_slist_foreach(ltk_info, add_ltk, &ltks);
 
 		irk_info = get_irk_info(key_file, entry->d_name, bdaddr_type);
 		if (irk_info)
-			irks = g_slist_append(irks, irk_info);
+			add_irk(&irks, irk_info);
 
 		param = get_conn_param(key_file, entry->d_name, bdaddr_type);
 		if (param)
-			params = g_slist_append(params, param);
+			add_conn_param(&params, param);
 
-		list = g_slist_find_custom(adapter->devices, entry->d_name,
+		str2ba(entry->d_name, &addr);
+
+		list = g_hash_table_lookup(adapter->devices_addr, &addr);
+		list = g_slist_find_custom(list, entry->d_name,
 							device_address_cmp);
 		if (list) {
 			device = list->data;
@@ -3829,6 +4228,7 @@ static void load_devices(struct btd_adapter *adapter)
 
 		btd_device_set_temporary(device, false);
 		adapter->devices = g_slist_append(adapter->devices, device);
+		device_index_insert(adapter, device);
 
 		/* TODO: register services from pre-loaded list of primaries */
 
@@ -3846,24 +4246,92 @@ device_exist:
 		}
 
 free:
-		g_key_file_free(key_file);
+		g_free(key_info);
+		g_slist_free_full(ltk_info, g_free);
+		g_free(irk_info);
+		g_free(param);
+		g_key_file_unref(key_file);
 	}
 
 	closedir(dir);
 
-	load_link_keys(adapter, keys, main_opts.debug_keys);
-	g_slist_free_full(keys, g_free);
+	load_link_keys(adapter, &keys, main_opts.debug_keys);
+	load_buf_free(&keys);
 
-	load_ltks(adapter, ltks);
-	g_slist_free_full(ltks, g_free);
-	load_irks(adapter, irks);
-	g_slist_free_full(irks, g_free);
-	load_conn_params(adapter, params);
-	g_slist_free_full(params, g_free);
+	load_ltks(adapter, &ltks);
+	load_buf_free(&ltks);
+	load_irks(adapter, &irks);
+	load_buf_free(&irks);
+	load_conn_params(adapter, &params);
+	load_buf_free(&params);
 
 	g_slist_free_full(added_devices, probe_devices);
 }
 
+int btd_adapter_load_conn_param(struct btd_adapter *adapter,
+				const bdaddr_t *peer, uint8_t bdaddr_type,
+				uint16_t min_interval, uint16_t max_interval,
+				uint16_t latency, uint16_t timeout)
+{
+	struct conn_param info;
+	struct load_buf params;
+
+	if (!(adapter->supported_settings & MGMT_SETTING_LE))
+		return -ENOTSUP;
+
+	bacpy(&info.bdaddr, peer);
+	info.bdaddr_type = bdaddr_type;
+	info.min_interval = min_interval;
+	info.max_interval = max_interval;
+	info.latency = latency;
+	info.timeout = timeout;
+
+	/*
+	 * A single entry leaves the parameters of other devices alone and
+	 * lets the kernel update the connection if it is the central.
+	 */
+	load_buf_init(&params, sizeof(struct mgmt_cp_load_conn_param),
+					sizeof(struct mgmt_conn_param));
+	add_conn_param(&params, &info);
+	load_conn_params(adapter, &params);
+	load_buf_free(&params);
+
+	return 0;
+}
+
+bool btd_adapter_get_conn_param(struct btd_adapter *adapter,
+				const bdaddr_t *peer, uint8_t bdaddr_type,
+				uint16_t *min_interval, uint16_t *max_interval,
+				uint16_t *latency, uint16_t *timeout)
+{
+	char device_addr[18];
+	char filename[PATH_MAX];
+	struct conn_param *param;
+	GKeyFile *key_file;
+
+	ba2str(peer, device_addr);
+
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
+					adapter_dir(adapter), device_addr);
+	key_file = storage_load(filename);
+
+	param = get_conn_param(key_file, device_addr, bdaddr_type);
+
+	g_key_file_unref(key_file);
+
+	if (!param)
+		return false;
+
+	*min_interval = param->min_interval;
+	*max_interval = param->max_interval;
+	*latency = param->latency;
+	*timeout = param->timeout;
+
+	g_free(param);
+
+	return true;
+}
+
 int btd_adapter_block_address(struct btd_adapter *adapter,
 				const bdaddr_t *bdaddr, uint8_t bdaddr_type)
 {
@@ -3989,6 +4457,9 @@ static void adapter_add_connection(struct btd_adapter *adapter,
 {
 	device_add_connection(device, bdaddr_type);
 
+	if (bdaddr_type != BDADDR_BREDR)
+		auto_connect_connected(adapter, device);
+
 	if (g_slist_find(adapter->connections, device)) {
 		btd_error(adapter->dev_id,
 				"Device is already marked as connected");
@@ -4105,6 +4576,155 @@ const char *btd_adapter_get_name(struct btd_adapter *adapter)
 	return NULL;
 }
 
+static void scan_params_notify(struct btd_adapter *adapter)
+{
+	GSList *l;
+
+	for (l = scan_params_list; l; l = g_slist_next(l)) {
+		btd_scan_params_cb scan_params_cb = l->data;
+		scan_params_cb(adapter, adapter->scan_interval,
+						adapter->scan_window);
+	}
+}
+
+static void set_scan_params_complete(uint8_t status, uint16_t length,
+					const void *param, void *user_data)
+{
+	struct btd_adapter *adapter = user_data;
+
+	if (status != MGMT_STATUS_SUCCESS) {
+		btd_error(adapter->dev_id,
+				"Failed to set scan parameters: %s (0x%02x)",
+				mgmt_errstr(status), status);
+		/* Retry on the next change */
+		adapter->scan_interval = 0;
+		adapter->scan_window = 0;
+		return;
+	}
+
+	DBG("scan interval 0x%04x window 0x%04x", adapter->scan_interval,
+							adapter->scan_window);
+
+	scan_params_notify(adapter);
+}
+
+/*
+ * Discovery clients are interactive and, with nothing to auto-connect,
+ * the parameters only apply to explicit connects, so both keep the fast
+ * kernel defaults. Background scanning for the connect list runs fast
+ * during a boost and otherwise at the duty cycle the ScanMode option
+ * trades for reconnect latency.
+ */
+static void scan_schedule(struct btd_adapter *adapter)
+{
+	struct mgmt_cp_set_scan_params cp;
+	uint16_t interval = SCAN_FAST_INTERVAL;
+	uint16_t window = SCAN_FAST_WINDOW;
+
+	if (!(adapter->supported_settings & MGMT_SETTING_LE))
+		return;
+
+	if (adapter->discovery_list || !adapter->connect_list)
+		goto done;
+
+	if (main_opts.scan_mode == BT_SCAN_LATENCY)
+		window = interval;
+	else if (!adapter->scan_fast_timeout) {
+		interval = SCAN_SLOW_INTERVAL;
+
+		if (main_opts.scan_mode == BT_SCAN_POWER)
+			window = SCAN_POWER_WINDOW;
+		else
+			window = SCAN_SLOW_WINDOW;
+	}
+
+done:
+
+	if (interval == adapter->scan_interval &&
+					window == adapter->scan_window)
+		return;
+
+	adapter->scan_interval = interval;
+	adapter->scan_window = window;
+
+	cp.interval = htobs(interval);
+	cp.window = htobs(window);
+
+	if (mgmt_send(adapter->mgmt, MGMT_OP_SET_SCAN_PARAMS,
+				adapter->dev_id, sizeof(cp), &cp,
+				set_scan_params_complete, adapter, NULL) > 0)
+		return;
+
+	btd_error(adapter->dev_id, "Failed to set scan parameters");
+
+	adapter->scan_interval = 0;
+	adapter->scan_window = 0;
+}
+
+static gboolean scan_fast_timeout(gpointer user_data)
+{
+	struct btd_adapter *adapter = user_data;
+
+	adapter->scan_fast_timeout = 0;
+
+	scan_schedule(adapter);
+
+	return FALSE;
+}
+
+void btd_adapter_scan_boost(struct btd_adapter *adapter)
+{
+	if (adapter->scan_fast_timeout > 0)
+		g_source_remove(adapter->scan_fast_timeout);
+
+	adapter->scan_fast_timeout = g_timeout_add_seconds(SCAN_FAST_TIMEOUT,
+							scan_fast_timeout,
+							adapter);
+
+	scan_schedule(adapter);
+}
+
+static void connect_list_changed(struct btd_adapter *adapter, bool added)
+{
+	/* Only the balanced mode spends a burst on getting devices back */
+	if (added && main_opts.scan_mode == BT_SCAN_BALANCED)
+		btd_adapter_scan_boost(adapter);
+	else
+		scan_schedule(adapter);
+}
+
+void btd_adapter_get_scan_params(struct btd_adapter *adapter,
+					uint16_t *interval, uint16_t *window)
+{
+	/* Nothing was set yet, report the kernel defaults */
+	if (!adapter->scan_interval) {
+		*interval = SCAN_FAST_INTERVAL;
+		*window = SCAN_FAST_WINDOW;
+		return;
+	}
+
+	*interval = adapter->scan_interval;
+	*window = adapter->scan_window;
+}
+
+void btd_add_scan_params_cb(btd_scan_params_cb func)
+{
+	scan_params_list = g_slist_append(scan_params_list, func);
+}
+
+void btd_remove_scan_params_cb(btd_scan_params_cb func)
+{
+	scan_params_list = g_slist_remove(scan_params_list, func);
+}
+
+static void scan_cleanup(struct btd_adapter *adapter)
+{
+	if (adapter->scan_fast_timeout > 0) {
+		g_source_remove(adapter->scan_fast_timeout);
+		adapter->scan_fast_timeout = 0;
+	}
+}
+
 int adapter_connect_list_add(struct btd_adapter *adapter,
 					struct btd_device *device)
 {
@@ -4141,6 +4761,8 @@ int adapter_connect_list_add(struct btd_adapter *adapter,
 	DBG("%s added to %s's connect_list", device_get_path(device),
 							adapter->system_name);
 
+	connect_list_changed(adapter, true);
+
 done:
 	if (!(adapter->current_settings & MGMT_SETTING_POWERED))
 		return 0;
@@ -4174,6 +4796,8 @@ void adapter_connect_list_remove(struct btd_adapter *adapter,
 	DBG("%s removed from %s's connect_list", device_get_path(device),
 							adapter->system_name);
 
+	connect_list_changed(adapter, false);
+
 	if (!adapter->connect_list) {
 		stop_passive_scanning(adapter);
 		return;
@@ -4231,47 +4855,362 @@ void adapter_whitelist_add(struct btd_adapter *adapter, struct btd_device *dev)
 	cp.addr.type = BDADDR_BREDR;
 	cp.action = 0x01;
 
-	mgmt_send(adapter->mgmt, MGMT_OP_ADD_DEVICE,
-				adapter->dev_id, sizeof(cp), &cp,
-				add_whitelist_complete, adapter, NULL);
+	mgmt_send(adapter->mgmt, MGMT_OP_ADD_DEVICE,
+				adapter->dev_id, sizeof(cp), &cp,
+				add_whitelist_complete, adapter, NULL);
+}
+
+static void remove_whitelist_complete(uint8_t status, uint16_t length,
+					const void *param, void *user_data)
+{
+	const struct mgmt_rp_remove_device *rp = param;
+	char addr[18];
+
+	if (length < sizeof(*rp)) {
+		error("Too small Remove Device complete event");
+		return;
+	}
+
+	ba2str(&rp->addr.bdaddr, addr);
+
+	if (status != MGMT_STATUS_SUCCESS) {
+		error("Failed to remove device %s: %s (0x%02x)",
+					addr, mgmt_errstr(status), status);
+		return;
+	}
+
+	DBG("%s removed from kernel whitelist", addr);
+}
+
+void adapter_whitelist_remove(struct btd_adapter *adapter, struct btd_device *dev)
+{
+	struct mgmt_cp_remove_device cp;
+
+	if (!kernel_conn_control)
+		return;
+
+	memset(&cp, 0, sizeof(cp));
+	bacpy(&cp.addr.bdaddr, device_get_address(dev));
+	cp.addr.type = BDADDR_BREDR;
+
+	mgmt_send(adapter->mgmt, MGMT_OP_REMOVE_DEVICE,
+				adapter->dev_id, sizeof(cp), &cp,
+				remove_whitelist_complete, adapter, NULL);
+}
+
+static void add_device_complete(uint8_t status, uint16_t length,
+					const void *param, void *user_data);
+
+/*
+ * With kernel connection control the LE auto-connect devices go through a
+ * small scheduler. Add Device and Remove Device commands are collected and
+ * sent in one batch from an idle callback, with the most recently connected
+ * devices first, and devices that keep failing to connect are taken out of
+ * the kernel list for an increasing time so they don't hold up the others.
+ */
+#define AUTO_CONNECT_MAX_FAILURES	3
+#define AUTO_CONNECT_BACKOFF_MIN	5
+#define AUTO_CONNECT_BACKOFF_MAX	300
+
+struct auto_connect {
+	struct btd_adapter *adapter;
+	struct btd_device *device;
+	struct mgmt_addr_info addr;
+	bool wanted;			/* Should be in the kernel list */
+	bool added;			/* Is in the kernel list */
+	unsigned int failures;		/* Consecutive connect failures */
+	guint backoff_id;
+};
+
+struct auto_connect_batch {
+	struct btd_adapter *adapter;
+	unsigned int count;
+	struct mgmt_cp_add_device cp[0];
+};
+
+static struct auto_connect *auto_connect_find(struct btd_adapter *adapter,
+						const bdaddr_t *bdaddr,
+						uint8_t bdaddr_type)
+{
+	GSList *l;
+
+	for (l = adapter->auto_connect; l; l = g_slist_next(l)) {
+		struct auto_connect *entry = l->data;
+
+		if (entry->addr.type == bdaddr_type &&
+				!bacmp(&entry->addr.bdaddr, bdaddr))
+			return entry;
+	}
+
+	return NULL;
+}
+
+static void auto_connect_free(struct auto_connect *entry)
+{
+	struct btd_adapter *adapter = entry->adapter;
+
+	adapter->auto_connect = g_slist_remove(adapter->auto_connect, entry);
+
+	if (entry->backoff_id)
+		g_source_remove(entry->backoff_id);
+
+	g_free(entry);
+}
+
+static gint auto_connect_cmp(gconstpointer a, gconstpointer b)
+{
+	const struct auto_connect *entry1 = a, *entry2 = b;
+	time_t last1, last2;
+
+	last1 = device_get_last_connected(entry1->device);
+	last2 = device_get_last_connected(entry2->device);
+
+	/* Most recently connected first */
+	return (last1 < last2) - (last1 > last2);
+}
+
+static void add_device_batch(struct auto_connect_batch *batch)
+{
+	struct btd_adapter *adapter = batch->adapter;
+	unsigned int i;
+
+	for (i = 0; i < batch->count; i++)
+		mgmt_send(adapter->mgmt, MGMT_OP_ADD_DEVICE, adapter->dev_id,
+					sizeof(batch->cp[i]), &batch->cp[i],
+					add_device_complete, adapter, NULL);
+}
+
+static void add_batch_complete(uint8_t status, uint16_t length,
+					const void *param, void *user_data)
+{
+	struct auto_connect_batch *batch = user_data;
+
+	if (status == MGMT_STATUS_SUCCESS) {
+		DBG("%u devices added to kernel connect list", batch->count);
+		return;
+	}
+
+	/*
+	 * The batch only reports the first failure, so resend the commands
+	 * one by one to find out which devices got rejected.
+	 */
+	btd_error(batch->adapter->dev_id,
+			"Failed to add devices: %s (0x%02x)",
+			mgmt_errstr(status), status);
+
+	add_device_batch(batch);
+}
+
+static void remove_batch_complete(uint8_t status, uint16_t length,
+					const void *param, void *user_data)
+{
+	struct btd_adapter *adapter = user_data;
+
+	if (status != MGMT_STATUS_SUCCESS) {
+		btd_error(adapter->dev_id,
+				"Failed to remove devices: %s (0x%02x)",
+				mgmt_errstr(status), status);
+		return;
+	}
+
+	DBG("devices removed from kernel connect list");
+}
+
+static void auto_connect_remove_batch(struct btd_adapter *adapter)
+{
+	struct mgmt_bulk_request *reqs;
+	struct mgmt_cp_remove_device *cp;
+	unsigned int count = 0;
+	GSList *l, *next;
+
+	for (l = adapter->auto_connect; l; l = g_slist_next(l)) {
+		struct auto_connect *entry = l->data;
+
+		if (entry->added && (!entry->wanted || entry->backoff_id))
+			count++;
+	}
+
+	if (!count)
+		return;
+
+	reqs = g_new0(struct mgmt_bulk_request, count);
+	cp = g_new0(struct mgmt_cp_remove_device, count);
+	count = 0;
+
+	for (l = adapter->auto_connect; l; l = next) {
+		struct auto_connect *entry = l->data;
+
+		next = g_slist_next(l);
+
+		if (!entry->added || (entry->wanted && !entry->backoff_id))
+			continue;
+
+		cp[count].addr = entry->addr;
+		reqs[count].opcode = MGMT_OP_REMOVE_DEVICE;
+		reqs[count].length = sizeof(cp[count]);
+		reqs[count].param = &cp[count];
+		count++;
+
+		entry->added = false;
+
+		if (!entry->wanted)
+			auto_connect_free(entry);
+	}
+
+	DBG("removing %u devices from kernel connect list", count);
+
+	if (!mgmt_send_bulk(adapter->mgmt, adapter->dev_id, reqs, count,
+					remove_batch_complete, adapter, NULL))
+		btd_error(adapter->dev_id, "Failed to remove devices");
+
+	g_free(cp);
+	g_free(reqs);
+}
+
+static void auto_connect_add_batch(struct btd_adapter *adapter)
+{
+	struct auto_connect_batch *batch;
+	struct mgmt_bulk_request *reqs;
+	GSList *list = NULL, *l;
+	unsigned int i, count;
+
+	for (l = adapter->auto_connect; l; l = g_slist_next(l)) {
+		struct auto_connect *entry = l->data;
+
+		if (entry->wanted && !entry->added && !entry->backoff_id)
+			list = g_slist_prepend(list, entry);
+	}
+
+	if (!list)
+		return;
+
+	list = g_slist_sort(list, auto_connect_cmp);
+	count = g_slist_length(list);
+
+	batch = g_malloc0(sizeof(*batch) + count * sizeof(batch->cp[0]));
+	batch->adapter = adapter;
+	batch->count = count;
+
+	reqs = g_new0(struct mgmt_bulk_request, count);
+
+	for (l = list, i = 0; l; l = g_slist_next(l), i++) {
+		struct auto_connect *entry = l->data;
+
+		batch->cp[i].addr = entry->addr;
+		batch->cp[i].action = 0x02;
+
+		reqs[i].opcode = MGMT_OP_ADD_DEVICE;
+		reqs[i].length = sizeof(batch->cp[i]);
+		reqs[i].param = &batch->cp[i];
+
+		entry->added = true;
+	}
+
+	g_slist_free(list);
+
+	DBG("adding %u devices to kernel connect list", count);
+
+	if (!mgmt_send_bulk(adapter->mgmt, adapter->dev_id, reqs, count,
+					add_batch_complete, batch, g_free)) {
+		add_device_batch(batch);
+		g_free(batch);
+	}
+
+	g_free(reqs);
+}
+
+static gboolean auto_connect_flush(gpointer user_data)
+{
+	struct btd_adapter *adapter = user_data;
+
+	adapter->auto_connect_id = 0;
+
+	/* Removals first to make room in the controller accept list */
+	auto_connect_remove_batch(adapter);
+	auto_connect_add_batch(adapter);
+
+	return FALSE;
+}
+
+static void auto_connect_schedule(struct btd_adapter *adapter)
+{
+	if (adapter->auto_connect_id)
+		return;
+
+	adapter->auto_connect_id = g_idle_add(auto_connect_flush, adapter);
+}
+
+static gboolean auto_connect_backoff(gpointer user_data)
+{
+	struct auto_connect *entry = user_data;
+
+	entry->backoff_id = 0;
+
+	DBG("%s back from connect backoff", device_get_path(entry->device));
+
+	auto_connect_schedule(entry->adapter);
+
+	return FALSE;
 }
 
-static void remove_whitelist_complete(uint8_t status, uint16_t length,
-					const void *param, void *user_data)
+static void auto_connect_failed(struct btd_adapter *adapter,
+					const struct mgmt_addr_info *addr)
 {
-	const struct mgmt_rp_remove_device *rp = param;
-	char addr[18];
+	struct auto_connect *entry;
+	unsigned int shift, timeout;
 
-	if (length < sizeof(*rp)) {
-		error("Too small Remove Device complete event");
+	entry = auto_connect_find(adapter, &addr->bdaddr, addr->type);
+	if (!entry || !entry->wanted || entry->backoff_id)
 		return;
-	}
-
-	ba2str(&rp->addr.bdaddr, addr);
 
-	if (status != MGMT_STATUS_SUCCESS) {
-		error("Failed to remove device %s: %s (0x%02x)",
-					addr, mgmt_errstr(status), status);
+	if (++entry->failures < AUTO_CONNECT_MAX_FAILURES)
 		return;
-	}
 
-	DBG("%s removed from kernel whitelist", addr);
+	shift = MIN(entry->failures - AUTO_CONNECT_MAX_FAILURES, 6);
+	timeout = MIN(AUTO_CONNECT_BACKOFF_MIN << shift,
+					AUTO_CONNECT_BACKOFF_MAX);
+
+	DBG("%s failed to connect %u times, backing off for %u seconds",
+				device_get_path(entry->device),
+				entry->failures, timeout);
+
+	entry->backoff_id = g_timeout_add_seconds(timeout,
+						auto_connect_backoff, entry);
+
+	auto_connect_schedule(adapter);
 }
 
-void adapter_whitelist_remove(struct btd_adapter *adapter, struct btd_device *dev)
+static void auto_connect_connected(struct btd_adapter *adapter,
+						struct btd_device *device)
 {
-	struct mgmt_cp_remove_device cp;
+	struct auto_connect *entry;
 
-	if (!kernel_conn_control)
-		return;
+	entry = auto_connect_find(adapter, device_get_address(device),
+					btd_device_get_bdaddr_type(device));
+	if (entry)
+		entry->failures = 0;
+}
 
-	memset(&cp, 0, sizeof(cp));
-	bacpy(&cp.addr.bdaddr, device_get_address(dev));
-	cp.addr.type = BDADDR_BREDR;
+static void auto_connect_forget(struct btd_adapter *adapter,
+						struct btd_device *device)
+{
+	struct auto_connect *entry;
 
-	mgmt_send(adapter->mgmt, MGMT_OP_REMOVE_DEVICE,
-				adapter->dev_id, sizeof(cp), &cp,
-				remove_whitelist_complete, adapter, NULL);
+	entry = auto_connect_find(adapter, device_get_address(device),
+					btd_device_get_bdaddr_type(device));
+	if (entry && entry->device == device)
+		auto_connect_free(entry);
+}
+
+static void auto_connect_cleanup(struct btd_adapter *adapter)
+{
+	if (adapter->auto_connect_id) {
+		g_source_remove(adapter->auto_connect_id);
+		adapter->auto_connect_id = 0;
+	}
+
+	while (adapter->auto_connect)
+		auto_connect_free(adapter->auto_connect->data);
 }
 
 static void add_device_complete(uint8_t status, uint16_t length,
@@ -4279,6 +5218,7 @@ static void add_device_complete(uint8_t status, uint16_t length,
 {
 	const struct mgmt_rp_add_device *rp = param;
 	struct btd_adapter *adapter = user_data;
+	struct auto_connect *entry;
 	struct btd_device *dev;
 	char addr[18];
 
@@ -4304,6 +5244,11 @@ static void add_device_complete(uint8_t status, uint16_t length,
 			addr, rp->addr.type, mgmt_errstr(status), status);
 		adapter->connect_list = g_slist_remove(adapter->connect_list,
 									dev);
+
+		entry = auto_connect_find(adapter, &rp->addr.bdaddr,
+							rp->addr.type);
+		if (entry)
+			auto_connect_free(entry);
 		return;
 	}
 
@@ -4313,10 +5258,9 @@ static void add_device_complete(uint8_t status, uint16_t length,
 void adapter_auto_connect_add(struct btd_adapter *adapter,
 					struct btd_device *device)
 {
-	struct mgmt_cp_add_device cp;
+	struct auto_connect *entry;
 	const bdaddr_t *bdaddr;
 	uint8_t bdaddr_type;
-	unsigned int id;
 
 	if (!kernel_conn_control)
 		return;
@@ -4335,49 +5279,33 @@ void adapter_auto_connect_add(struct btd_adapter *adapter,
 		return;
 	}
 
-	memset(&cp, 0, sizeof(cp));
-	bacpy(&cp.addr.bdaddr, bdaddr);
-	cp.addr.type = bdaddr_type;
-	cp.action = 0x02;
-
-	id = mgmt_send(adapter->mgmt, MGMT_OP_ADD_DEVICE,
-			adapter->dev_id, sizeof(cp), &cp, add_device_complete,
-			adapter, NULL);
-	if (id == 0)
-		return;
-
-	adapter->connect_list = g_slist_append(adapter->connect_list, device);
-}
-
-static void remove_device_complete(uint8_t status, uint16_t length,
-					const void *param, void *user_data)
-{
-	const struct mgmt_rp_remove_device *rp = param;
-	char addr[18];
+	entry = auto_connect_find(adapter, bdaddr, bdaddr_type);
+	if (!entry) {
+		entry = g_new0(struct auto_connect, 1);
+		entry->adapter = adapter;
+		bacpy(&entry->addr.bdaddr, bdaddr);
+		entry->addr.type = bdaddr_type;
 
-	if (length < sizeof(*rp)) {
-		error("Too small Remove Device complete event");
-		return;
+		adapter->auto_connect = g_slist_append(adapter->auto_connect,
+									entry);
 	}
 
-	ba2str(&rp->addr.bdaddr, addr);
+	entry->device = device;
+	entry->wanted = true;
 
-	if (status != MGMT_STATUS_SUCCESS) {
-		error("Failed to remove device %s (%u): %s (0x%02x)",
-			addr, rp->addr.type, mgmt_errstr(status), status);
-		return;
-	}
+	auto_connect_schedule(adapter);
+
+	adapter->connect_list = g_slist_append(adapter->connect_list, device);
 
-	DBG("%s (%u) removed from kernel connect list", addr, rp->addr.type);
+	connect_list_changed(adapter, true);
 }
 
 void adapter_auto_connect_remove(struct btd_adapter *adapter,
 					struct btd_device *device)
 {
-	struct mgmt_cp_remove_device cp;
+	struct auto_connect *entry;
 	const bdaddr_t *bdaddr;
 	uint8_t bdaddr_type;
-	unsigned int id;
 
 	if (!kernel_conn_control)
 		return;
@@ -4395,17 +5323,27 @@ void adapter_auto_connect_remove(struct btd_adapter *adapter,
 		return;
 	}
 
-	memset(&cp, 0, sizeof(cp));
-	bacpy(&cp.addr.bdaddr, bdaddr);
-	cp.addr.type = bdaddr_type;
+	entry = auto_connect_find(adapter, bdaddr, bdaddr_type);
+	if (entry) {
+		if (entry->backoff_id) {
+			g_source_remove(entry->backoff_id);
+			entry->backoff_id = 0;
+		}
 
-	id = mgmt_send(adapter->mgmt, MGMT_OP_REMOVE_DEVICE,
-			adapter->dev_id, sizeof(cp), &cp,
-			remove_device_complete, adapter, NULL);
-	if (id == 0)
-		return;
+		entry->device = NULL;
+		entry->wanted = false;
+		entry->failures = 0;
+
+		/* Nothing was sent to the kernel yet */
+		if (!entry->added)
+			auto_connect_free(entry);
+		else
+			auto_connect_schedule(adapter);
+	}
 
 	adapter->connect_list = g_slist_remove(adapter->connect_list, device);
+
+	connect_list_changed(adapter, false);
 }
 
 static void adapter_start(struct btd_adapter *adapter)
@@ -4415,6 +5353,9 @@ static void adapter_start(struct btd_adapter *adapter)
 
 	DBG("adapter %s has been enabled", adapter->path);
 
+	if (adapter->connect_list)
+		connect_list_changed(adapter, true);
+
 	trigger_passive_scanning(adapter);
 }
 
@@ -4482,11 +5423,15 @@ static void adapter_free(gpointer user_data)
 		adapter->pairable_timeout_id = 0;
 	}
 
+	discovery_matcher_reset(adapter);
+
 	if (adapter->passive_scan_timeout > 0) {
 		g_source_remove(adapter->passive_scan_timeout);
 		adapter->passive_scan_timeout = 0;
 	}
 
+	scan_cleanup(adapter);
+
 	if (adapter->load_ltks_timeout > 0)
 		g_source_remove(adapter->load_ltks_timeout);
 
@@ -4502,6 +5447,11 @@ static void adapter_free(gpointer user_data)
 	g_queue_foreach(adapter->auths, free_service_auth, NULL);
 	g_queue_free(adapter->auths);
 
+	g_hash_table_foreach_remove(adapter->devices_addr, free_device_index,
+									NULL);
+	g_hash_table_destroy(adapter->devices_addr);
+	g_hash_table_destroy(adapter->devices_path);
+
 	/*
 	 * Unregister all handlers for this specific index since
 	 * the adapter bound to them is no longer valid.
@@ -4582,6 +5532,7 @@ static void convert_names_entry(char *key, char *value, void *user_data)
 
 	data = g_key_file_to_data(key_file, &length, NULL);
 	g_file_set_contents(filename, data, length, NULL);
+	btd_metrics_inc(BTD_METRIC_STORAGE_WRITES);
 	g_free(data);
 
 	g_key_file_free(key_file);
@@ -4812,6 +5763,7 @@ static void convert_entry(char *key, char *value, void *user_data)
 	if (length > 0) {
 		create_file(filename, S_IRUSR | S_IWUSR);
 		g_file_set_contents(filename, data, length, NULL);
+		btd_metrics_inc(BTD_METRIC_STORAGE_WRITES);
 	}
 
 	g_free(data);
@@ -4908,6 +5860,7 @@ static void store_sdp_record(char *local, char *peer, int handle, char *value)
 	if (length > 0) {
 		create_file(filename, S_IRUSR | S_IWUSR);
 		g_file_set_contents(filename, data, length, NULL);
+		btd_metrics_inc(BTD_METRIC_STORAGE_WRITES);
 	}
 
 	g_free(data);
@@ -4982,6 +5935,7 @@ static void convert_sdp_entry(char *key, char *value, void *user_data)
 	if (length > 0) {
 		create_file(filename, S_IRUSR | S_IWUSR);
 		g_file_set_contents(filename, data, length, NULL);
+		btd_metrics_inc(BTD_METRIC_STORAGE_WRITES);
 	}
 
 	g_free(data);
@@ -5047,6 +6001,7 @@ static void convert_primaries_entry(char *key, char *value, void *user_data)
 
 	create_file(filename, S_IRUSR | S_IWUSR);
 	g_file_set_contents(filename, data, length, NULL);
+	btd_metrics_inc(BTD_METRIC_STORAGE_WRITES);
 
 	if (device_type < 0)
 		goto end;
@@ -5064,6 +6019,7 @@ static void convert_primaries_entry(char *key, char *value, void *user_data)
 	if (length > 0) {
 		create_file(filename, S_IRUSR | S_IWUSR);
 		g_file_set_contents(filename, data, length, NULL);
+		btd_metrics_inc(BTD_METRIC_STORAGE_WRITES);
 	}
 
 end:
@@ -5113,6 +6069,7 @@ static void convert_ccc_entry(char *key, char *value, void *user_data)
 	if (length > 0) {
 		create_file(filename, S_IRUSR | S_IWUSR);
 		g_file_set_contents(filename, data, length, NULL);
+		btd_metrics_inc(BTD_METRIC_STORAGE_WRITES);
 	}
 
 	g_free(data);
@@ -5160,6 +6117,7 @@ static void convert_gatt_entry(char *key, char *value, void *user_data)
 	if (length > 0) {
 		create_file(filename, S_IRUSR | S_IWUSR);
 		g_file_set_contents(filename, data, length, NULL);
+		btd_metrics_inc(BTD_METRIC_STORAGE_WRITES);
 	}
 
 	g_free(data);
@@ -5205,6 +6163,7 @@ static void convert_proximity_entry(char *key, char *value, void *user_data)
 	if (length > 0) {
 		create_file(filename, S_IRUSR | S_IWUSR);
 		g_file_set_contents(filename, data, length, NULL);
+		btd_metrics_inc(BTD_METRIC_STORAGE_WRITES);
 	}
 
 	g_free(data);
@@ -5305,6 +6264,7 @@ static void convert_config(struct btd_adapter *adapter, const char *filename,
 
 	data = g_key_file_to_data(key_file, &length, NULL);
 	g_file_set_contents(filename, data, length, NULL);
+	btd_metrics_inc(BTD_METRIC_STORAGE_WRITES);
 	g_free(data);
 }
 
@@ -5378,17 +6338,18 @@ static void load_config(struct btd_adapter *adapter)
 	struct stat st;
 	GError *gerr = NULL;
 
-	key_file = g_key_file_new();
-
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/settings",
 						adapter_dir(adapter));
 
 	if (stat(filename, &st) < 0) {
+		key_file = g_key_file_new();
 		convert_config(adapter, filename, key_file);
+		g_key_file_free(key_file);
+
 		convert_device_storage(adapter);
 	}
 
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_load(filename);
 
 	/* Get alias */
 	adapter->stored_alias = g_key_file_get_string(key_file, "General",
@@ -5426,7 +6387,7 @@ static void load_config(struct btd_adapter *adapter)
 		gerr = NULL;
 	}
 
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
 static struct btd_adapter *btd_adapter_new(uint16_t index)
@@ -5468,6 +6429,10 @@ static struct btd_adapter *btd_adapter_new(uint16_t index)
 
 	adapter->auths = g_queue_new();
 
+	adapter->devices_addr = g_hash_table_new_full(bdaddr_hash, bdaddr_equal,
+								g_free, NULL);
+	adapter->devices_path = g_hash_table_new(path_hash, path_equal);
+
 	return btd_adapter_ref(adapter);
 }
 
@@ -5481,12 +6446,20 @@ static void adapter_remove(struct btd_adapter *adapter)
 	g_slist_free(adapter->connect_list);
 	adapter->connect_list = NULL;
 
+	scan_cleanup(adapter);
+
 	for (l = adapter->devices; l; l = l->next)
 		device_remove(l->data, FALSE);
 
 	g_slist_free(adapter->devices);
 	adapter->devices = NULL;
 
+	auto_connect_cleanup(adapter);
+
+	g_hash_table_foreach_remove(adapter->devices_addr, free_device_index,
+									NULL);
+	g_hash_table_remove_all(adapter->devices_path);
+
 	discovery_cleanup(adapter);
 
 	unload_drivers(adapter);
@@ -5632,69 +6605,85 @@ static void adapter_msd_notify(struct btd_adapter *adapter,
 	}
 }
 
-static bool is_filter_match(GSList *discovery_filter, struct eir_data *eir_data,
-								int8_t rssi)
+static bool is_filter_match(struct btd_adapter *adapter,
+				struct eir_data *eir_data, int8_t rssi)
 {
-	GSList *l, *m;
-	bool got_match = false;
+	struct discovery_matcher *matcher = discovery_matcher_get(adapter);
+	GSList *l;
 
-	for (l = discovery_filter; l != NULL && got_match != true;
-							l = g_slist_next(l)) {
-		struct watch_client *client = l->data;
-		struct discovery_filter *item = client->discovery_filter;
+	/*
+	 * If one of currently running scans is regular scan, then
+	 * return all devices as matches
+	 */
+	if (matcher->all)
+		return true;
 
-		/*
-		 * If one of currently running scans is regular scan, then
-		 * return all devices as matches
-		 */
-		if (!item) {
-			got_match = true;
-			continue;
-		}
+	/* Clients with empty uuids want all devices in given proximity */
+	if (matcher->any_uuid &&
+			proximity_match(&matcher->proximity, eir_data, rssi))
+		return true;
 
-		/* if someone started discovery with empty uuids, he wants all
-		 * devices in given proximity.
-		 */
-		if (!item->uuids)
-			got_match = true;
-		else {
-			for (m = item->uuids; m != NULL && got_match != true;
-							m = g_slist_next(m)) {
-				/* m->data contains string representation of
-				 * uuid.
-				 */
-				if (g_slist_find_custom(eir_data->services,
-							m->data,
-							g_strcmp) != NULL)
-					got_match = true;
-			}
-		}
+	for (l = eir_data->services; l; l = g_slist_next(l)) {
+		struct filter_proximity *proximity;
 
-		if (got_match) {
-			/* we have service match, check proximity */
-			if (item->rssi == DISTANCE_VAL_INVALID ||
-			    item->rssi <= rssi ||
-			    item->pathloss == DISTANCE_VAL_INVALID ||
-			    (eir_data->tx_power != 127 &&
-			     eir_data->tx_power - rssi <= item->pathloss))
-				return true;
+		proximity = g_hash_table_lookup(matcher->uuids, l->data);
+		if (proximity && proximity_match(proximity, eir_data, rssi))
+			return true;
+	}
 
-			got_match = false;
-		}
+	return false;
+}
+
+static uint8_t adv_data_flags(const uint8_t *data, uint8_t data_len)
+{
+	struct eir_iter iter;
+	const uint8_t *field;
+	uint8_t type, len, flags = 0;
+
+	eir_iter_init(&iter, data, data_len);
+
+	while (eir_iter_next(&iter, &type, &field, &len)) {
+		if (type == EIR_FLAGS && len > 0)
+			flags = field[0];
 	}
 
-	return got_match;
+	return flags;
 }
 
-static void filter_duplicate_data(void *data, void *user_data)
+/* AD types present in a report, folded into 64 bits */
+static uint64_t adv_data_types(const uint8_t *data, uint8_t data_len)
 {
-	struct watch_client *client = data;
-	bool *duplicate = user_data;
+	struct eir_iter iter;
+	const uint8_t *field;
+	uint8_t type, len;
+	uint64_t types = 0;
 
-	if (*duplicate || !client->discovery_filter)
-		return;
+	eir_iter_init(&iter, data, data_len);
+
+	while (eir_iter_next(&iter, &type, &field, &len))
+		types |= UINT64_C(1) << (type & 63);
+
+	return types;
+}
+
+/*
+ * Most reports are repeats of a payload recently seen from the device, in
+ * which case everything derived from it is already up to date. Filtering,
+ * duplicate reporting and manufacturer data watchers need the fully parsed
+ * report every time though.
+ */
+static bool adv_data_unchanged(struct btd_adapter *adapter,
+					struct btd_device *dev,
+					uint8_t bdaddr_type, uint32_t hash)
+{
+	if (adapter->filtered_discovery || adapter->msd_callbacks)
+		return false;
+
+	if (adapter->discovery_list &&
+			discovery_matcher_get(adapter)->duplicate)
+		return false;
 
-	*duplicate = client->discovery_filter->duplicate;
+	return device_adv_hash_match(dev, bdaddr_type, hash);
 }
 
 static void update_found_devices(struct btd_adapter *adapter,
@@ -5709,6 +6698,32 @@ static void update_found_devices(struct btd_adapter *adapter,
 	bool name_known, discoverable;
 	char addr[18];
 	bool duplicate = false;
+	uint32_t hash;
+	uint8_t flags;
+
+	hash = eir_hash(data, data_len);
+
+	dev = btd_adapter_find_device(adapter, bdaddr, bdaddr_type);
+	if (dev && adv_data_unchanged(adapter, dev, bdaddr_type, hash)) {
+		device_update_last_seen(dev, bdaddr_type);
+
+		flags = adv_data_flags(data, data_len);
+		if (bdaddr_type != BDADDR_BREDR && flags &&
+						!(flags & EIR_BREDR_UNSUP))
+			device_update_last_seen(dev, BDADDR_BREDR);
+
+		if (!btd_device_is_connected(dev) &&
+					(device_is_temporary(dev) &&
+					!adapter->discovery_list))
+			return;
+
+		device_set_legacy(dev, legacy);
+		device_set_rssi(dev, rssi);
+
+		name_known = device_name_known(dev);
+
+		goto found;
+	}
 
 	memset(&eir_data, 0, sizeof(eir_data));
 	eir_parse(&eir_data, data, data_len);
@@ -5720,7 +6735,6 @@ static void update_found_devices(struct btd_adapter *adapter,
 
 	ba2str(bdaddr, addr);
 
-	dev = btd_adapter_find_device(adapter, bdaddr, bdaddr_type);
 	if (!dev) {
 		/*
 		 * If no client has requested discovery or the device is
@@ -5771,7 +6785,7 @@ static void update_found_devices(struct btd_adapter *adapter,
 	}
 
 	if (adapter->filtered_discovery &&
-	    !is_filter_match(adapter->discovery_list, &eir_data, rssi)) {
+	    !is_filter_match(adapter, &eir_data, rssi)) {
 		eir_data_free(&eir_data);
 		return;
 	}
@@ -5808,9 +6822,11 @@ static void update_found_devices(struct btd_adapter *adapter,
 
 	device_add_eir_uuids(dev, eir_data.services);
 
+	if (bdaddr_type == BDADDR_BREDR)
+		device_update_eir_hash(dev, eir_data.services);
+
 	if (adapter->discovery_list)
-		g_slist_foreach(adapter->discovery_list, filter_duplicate_data,
-								&duplicate);
+		duplicate = discovery_matcher_get(adapter)->duplicate;
 
 	if (eir_data.msd_list) {
 		device_set_manufacturer_data(dev, eir_data.msd_list, duplicate);
@@ -5825,6 +6841,10 @@ static void update_found_devices(struct btd_adapter *adapter,
 
 	eir_data_free(&eir_data);
 
+	device_set_adv_hash(dev, bdaddr_type, hash,
+					adv_data_types(data, data_len));
+
+found:
 	/*
 	 * Only if at least one client has requested discovery, maintain
 	 * list of found devices and name confirming for legacy devices.
@@ -5914,6 +6934,8 @@ static void device_found_callback(uint16_t index, uint16_t length,
 	DBG("hci%u addr %s, rssi %d flags 0x%04x eir_len %u",
 			index, addr, ev->rssi, flags, eir_len);
 
+	BT_TRACE3(device_found, index, ev->rssi, flags);
+
 	confirm_name = (flags & MGMT_DEV_FOUND_CONFIRM_NAME);
 	legacy = (flags & MGMT_DEV_FOUND_LEGACY_PAIRING);
 
@@ -5968,6 +6990,8 @@ static void adapter_stop(struct btd_adapter *adapter)
 	g_slist_free_full(adapter->set_filter_list, discovery_free);
 	adapter->set_filter_list = NULL;
 
+	discovery_matcher_reset(adapter);
+
 	g_slist_free_full(adapter->discovery_list, discovery_free);
 	adapter->discovery_list = NULL;
 
@@ -6274,12 +7298,63 @@ int btd_cancel_authorization(guint id)
 	return 0;
 }
 
+static void power_on_complete(uint8_t status, uint16_t length,
+					const void *param, void *user_data)
+{
+	struct btd_adapter *adapter = user_data;
+
+	adapter->power_on_id = 0;
+
+	set_mode_complete(status, length, param, user_data);
+}
+
+/*
+ * Bring the settings managed by the daemon back in line before powering
+ * on. While the controller is off the kernel only records the new flags
+ * and applies them as part of its power on sequence, instead of sending
+ * extra HCI commands for each one once powered. Everything is queued in
+ * one go so the commands follow each other without a round trip through
+ * the daemon in between.
+ */
+static void queue_power_on_plan(struct btd_adapter *adapter)
+{
+	uint32_t settings = adapter->current_settings;
+	uint32_t missing = adapter->supported_settings & ~settings;
+
+	if (!kernel_conn_control && !(settings & MGMT_SETTING_CONNECTABLE))
+		set_mode(adapter, MGMT_OP_SET_CONNECTABLE, 0x01);
+
+	if (main_opts.fast_conn &&
+			(missing & MGMT_SETTING_FAST_CONNECTABLE))
+		set_mode(adapter, MGMT_OP_SET_FAST_CONNECTABLE, 0x01);
+
+	if (adapter->stored_discoverable && !adapter->discoverable_timeout &&
+			!(settings & MGMT_SETTING_DISCOVERABLE))
+		set_discoverable(adapter, 0x01, 0);
+}
+
 int btd_adapter_restore_powered(struct btd_adapter *adapter)
 {
+	struct mgmt_mode cp;
+
 	if (adapter->current_settings & MGMT_SETTING_POWERED)
 		return 0;
 
-	set_mode(adapter, MGMT_OP_SET_POWERED, 0x01);
+	/* rfkill and the policy plugin can both request the same power on */
+	if (adapter->power_on_id)
+		return 0;
+
+	queue_power_on_plan(adapter);
+
+	memset(&cp, 0, sizeof(cp));
+	cp.val = 0x01;
+
+	adapter->power_on_id = mgmt_send(adapter->mgmt, MGMT_OP_SET_POWERED,
+				adapter->dev_id, sizeof(cp), &cp,
+				power_on_complete, adapter, NULL);
+	if (!adapter->power_on_id)
+		btd_error(adapter->dev_id, "Failed to set mode for index %u",
+							adapter->dev_id);
 
 	return 0;
 }
@@ -7024,17 +8099,14 @@ static void store_link_key(struct btd_adapter *adapter,
 	char device_addr[18];
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
-	gsize length = 0;
 	char key_str[33];
-	char *str;
 	int i;
 
 	ba2str(device_get_address(device), device_addr);
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 					adapter_dir(adapter), device_addr);
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_load(filename);
 
 	for (i = 0; i < 16; i++)
 		sprintf(key_str + (i * 2), "%2.2X", key[i]);
@@ -7044,13 +8116,9 @@ static void store_link_key(struct btd_adapter *adapter,
 	g_key_file_set_integer(key_file, "LinkKey", "Type", type);
 	g_key_file_set_integer(key_file, "LinkKey", "PINLength", pin_length);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
+	storage_save(filename, key_file);
 
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
 static void new_link_key_callback(uint16_t index, uint16_t length,
@@ -7110,8 +8178,6 @@ static void store_longtermkey(struct btd_adapter *adapter, const bdaddr_t *peer,
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
 	char key_str[33];
-	gsize length = 0;
-	char *str;
 	int i;
 
 	if (master != 0x00 && master != 0x01) {
@@ -7123,8 +8189,7 @@ static void store_longtermkey(struct btd_adapter *adapter, const bdaddr_t *peer,
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 					adapter_dir(adapter), device_addr);
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_load(filename);
 
 	/* Old files may contain this so remove it in case it exists */
 	g_key_file_remove_key(key_file, "LongTermKey", "Master", NULL);
@@ -7141,13 +8206,9 @@ static void store_longtermkey(struct btd_adapter *adapter, const bdaddr_t *peer,
 	g_key_file_set_integer(key_file, group, "EDiv", ediv);
 	g_key_file_set_uint64(key_file, group, "Rand", rand);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
+	storage_save(filename, key_file);
 
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
 static void new_long_term_key_callback(uint16_t index, uint16_t length,
@@ -7221,9 +8282,7 @@ static void store_csrk(struct btd_adapter *adapter, const bdaddr_t *peer,
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
 	char key_str[33];
-	gsize length = 0;
 	gboolean auth;
-	char *str;
 	int i;
 
 	switch (type) {
@@ -7253,8 +8312,7 @@ static void store_csrk(struct btd_adapter *adapter, const bdaddr_t *peer,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 					adapter_dir(adapter), device_addr);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_load(filename);
 
 	for (i = 0; i < 16; i++)
 		sprintf(key_str + (i * 2), "%2.2X", key[i]);
@@ -7263,13 +8321,9 @@ static void store_csrk(struct btd_adapter *adapter, const bdaddr_t *peer,
 	g_key_file_set_integer(key_file, group, "Counter", counter);
 	g_key_file_set_boolean(key_file, group, "Authenticated", auth);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
+	storage_save(filename, key_file);
 
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
 static void new_csrk_callback(uint16_t index, uint16_t length,
@@ -7314,30 +8368,23 @@ static void store_irk(struct btd_adapter *adapter, const bdaddr_t *peer,
 	char device_addr[18];
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
-	char *store_data;
 	char str[33];
-	size_t length = 0;
 	int i;
 
 	ba2str(peer, device_addr);
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 					adapter_dir(adapter), device_addr);
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_load(filename);
 
 	for (i = 0; i < 16; i++)
 		sprintf(str + (i * 2), "%2.2X", key[i]);
 
 	g_key_file_set_string(key_file, "IdentityResolvingKey", "Key", str);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	store_data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, store_data, length, NULL);
-	g_free(store_data);
+	storage_save(filename, key_file);
 
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
 static void new_irk_callback(uint16_t index, uint16_t length,
@@ -7402,8 +8449,6 @@ static void store_conn_param(struct btd_adapter *adapter, const bdaddr_t *peer,
 	char device_addr[18];
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
-	char *store_data;
-	size_t length = 0;
 
 	ba2str(peer, device_addr);
 
@@ -7411,8 +8456,7 @@ static void store_conn_param(struct btd_adapter *adapter, const bdaddr_t *peer,
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 					adapter_dir(adapter), device_addr);
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_load(filename);
 
 	g_key_file_set_integer(key_file, "ConnectionParameters",
 						"MinInterval", min_interval);
@@ -7423,13 +8467,9 @@ static void store_conn_param(struct btd_adapter *adapter, const bdaddr_t *peer,
 	g_key_file_set_integer(key_file, "ConnectionParameters",
 						"Timeout", timeout);
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	store_data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, store_data, length, NULL);
-	g_free(store_data);
+	storage_save(filename, key_file);
 
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
 static void new_conn_param(uint16_t index, uint16_t length,
@@ -7686,6 +8726,8 @@ static int adapter_register(struct btd_adapter *adapter)
 	if (powering_down)
 		return -EBUSY;
 
+	btd_startup_phase("hci%u info", adapter->dev_id);
+
 	adapter->path = g_strdup_printf("/org/bluez/hci%d", adapter->dev_id);
 
 	if (!g_dbus_register_interface(dbus_conn,
@@ -7736,9 +8778,12 @@ static int adapter_register(struct btd_adapter *adapter)
 	load_config(adapter);
 	fix_storage(adapter);
 	load_drivers(adapter);
+	btd_startup_phase("hci%u drivers", adapter->dev_id);
 	btd_profile_foreach(probe_profile, adapter);
+	btd_startup_phase("hci%u profiles", adapter->dev_id);
 	clear_blocked(adapter);
 	load_devices(adapter);
+	btd_startup_phase("hci%u devices", adapter->dev_id);
 
 	/* retrieve the active connections: address the scenario where
 	 * the are active connections before the daemon've started */
@@ -7757,6 +8802,8 @@ static int adapter_register(struct btd_adapter *adapter)
 
 	DBG("Adapter %s registered", adapter->path);
 
+	btd_startup_phase("hci%u ready", adapter->dev_id);
+
 	return 0;
 }
 
@@ -7947,6 +8994,8 @@ static void connect_failed_callback(uint16_t index, uint16_t length,
 	if (device) {
 		conn_fail_notify(device, ev->status);
 
+		auto_connect_failed(adapter, &ev->addr);
+
 		/* If the device is in a bonding process cancel any auth request
 		 * sent to the agent before proceeding, but keep the bonding
 		 * request structure. */
@@ -7980,15 +9029,12 @@ static void remove_keys(struct btd_adapter *adapter,
 	char device_addr[18];
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
-	gsize length = 0;
-	char *str;
 
 	ba2str(device_get_address(device), device_addr);
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
 					adapter_dir(adapter), device_addr);
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_load(filename);
 
 	if (type == BDADDR_BREDR) {
 		g_key_file_remove_group(key_file, "LinkKey", NULL);
@@ -7999,11 +9045,9 @@ static void remove_keys(struct btd_adapter *adapter,
 		g_key_file_remove_group(key_file, "IdentityResolvingKey", NULL);
 	}
 
-	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
+	storage_save(filename, key_file);
 
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
 static void unpaired_callback(uint16_t index, uint16_t length,
@@ -8135,6 +9179,7 @@ static bool get_static_addr(struct btd_adapter *adapter)
 
 	str = g_key_file_to_data(file, &len, NULL);
 	g_file_set_contents(STORAGEDIR "/addresses", str, len, NULL);
+	btd_metrics_inc(BTD_METRIC_STORAGE_WRITES);
 	g_free(str);
 
 	ret = true;
@@ -8172,6 +9217,12 @@ static bool set_static_addr(struct btd_adapter *adapter)
 	return false;
 }
 
+static void startup_adapter_done(void)
+{
+	if (startup_pending > 0 && --startup_pending == 0)
+		btd_startup_complete();
+}
+
 static void read_info_complete(uint8_t status, uint16_t length,
 					const void *param, void *user_data)
 {
@@ -8413,6 +9464,8 @@ static void read_info_complete(uint8_t status, uint16_t length,
 	if (adapter->current_settings & MGMT_SETTING_POWERED)
 		adapter_start(adapter);
 
+	startup_adapter_done();
+
 	return;
 
 failed:
@@ -8428,6 +9481,8 @@ failed:
 	adapter_list = g_list_remove(adapter_list, adapter);
 
 	btd_adapter_unref(adapter);
+
+	startup_adapter_done();
 }
 
 static void index_added(uint16_t index, uint16_t length, const void *param,
@@ -8467,8 +9522,11 @@ static void index_added(uint16_t index, uint16_t length, const void *param,
 	DBG("sending read info command for index %u", index);
 
 	if (mgmt_send(mgmt_master, MGMT_OP_READ_INFO, index, 0, NULL,
-					read_info_complete, adapter, NULL) > 0)
+					read_info_complete, adapter, NULL) > 0) {
+		if (startup_listing)
+			startup_pending++;
 		return;
+	}
 
 	btd_error(adapter->dev_id,
 			"Failed to read controller info for index %u", index);
@@ -8516,6 +9574,8 @@ static void read_index_list_complete(uint8_t status, uint16_t length,
 
 	DBG("Number of controllers: %d", num);
 
+	btd_startup_phase("mgmt index list");
+
 	if (num * sizeof(uint16_t) + sizeof(*rp) != length) {
 		error("Incorrect packet size for index list response");
 		return;
@@ -8534,8 +9594,13 @@ static void read_index_list_complete(uint8_t status, uint16_t length,
 		 * It is safe to just trigger the procedure for index
 		 * added notification. It does check against itself.
 		 */
+		startup_listing = true;
 		index_added(index, 0, NULL, NULL);
+		startup_listing = false;
 	}
+
+	if (!startup_pending)
+		btd_startup_complete();
 }
 
 static void read_commands_complete(uint8_t status, uint16_t length,
@@ -8604,6 +9669,8 @@ static void read_version_complete(uint8_t status, uint16_t length,
 	mgmt_version = rp->version;
 	mgmt_revision = btohs(rp->revision);
 
+	btd_startup_phase("mgmt version");
+
 	info("Bluetooth management interface %u.%u initialized",
 						mgmt_version, mgmt_revision);
 
@@ -8644,10 +9711,47 @@ static void mgmt_debug(const char *str, void *user_data)
 	info("%s%s", prefix, str);
 }
 
+static void mgmt_complete(uint16_t opcode, uint16_t index, uint8_t status,
+					uint64_t usec, void *user_data)
+{
+	btd_metrics_inc(BTD_METRIC_MGMT_COMMANDS);
+
+	if (status != MGMT_STATUS_SUCCESS)
+		btd_metrics_inc(BTD_METRIC_MGMT_ERRORS);
+
+	btd_metrics_observe(BTD_HISTOGRAM_MGMT_LATENCY, usec);
+}
+
+static void adapter_footprint(struct btd_footprint *footprint,
+							void *user_data)
+{
+	GSList *l;
+
+	for (l = adapters; l; l = l->next) {
+		struct btd_adapter *adapter = l->data;
+		struct gatt_db *db;
+
+		footprint->objects++;
+		footprint->bytes += sizeof(*adapter);
+
+		/* Only the lists that grow with the number of devices */
+		footprint->bytes += sizeof(GSList) *
+				(g_slist_length(adapter->devices) +
+				g_slist_length(adapter->connections) +
+				g_slist_length(adapter->discovery_found) +
+				g_slist_length(adapter->connect_list));
+
+		db = btd_gatt_database_get_db(adapter->database);
+		footprint->bytes += gatt_db_get_footprint(db);
+	}
+}
+
 int adapter_init(void)
 {
 	dbus_conn = btd_get_dbus_connection();
 
+	btd_metrics_register_footprint("adapter", adapter_footprint, NULL);
+
 	mgmt_master = mgmt_new_default();
 	if (!mgmt_master) {
 		error("Failed to access management interface");
@@ -8657,6 +9761,9 @@ int adapter_init(void)
 	if (getenv("MGMT_DEBUG"))
 		mgmt_set_debug(mgmt_master, mgmt_debug, "mgmt: ", NULL);
 
+	mgmt_set_max_pending(mgmt_master, MGMT_MAX_PENDING);
+	mgmt_set_complete_handler(mgmt_master, mgmt_complete, NULL, NULL);
+
 	DBG("sending read version command");
 
 	if (mgmt_send(mgmt_master, MGMT_OP_READ_VERSION,
@@ -8671,6 +9778,8 @@ int adapter_init(void)
 
 void adapter_cleanup(void)
 {
+	btd_metrics_unregister_footprint("adapter");
+
 	g_list_free(adapter_list);
 
 	while (adapters) {
@@ -67,6 +67,15 @@ typedef void (*btd_conn_fail_cb) (struct btd_device *device, uint8_t status);
 void btd_add_conn_fail_cb(btd_conn_fail_cb func);
 void btd_remove_conn_fail_cb(btd_conn_fail_cb func);
 
+typedef void (*btd_scan_params_cb) (struct btd_adapter *adapter,
+					uint16_t interval, uint16_t window);
+void btd_add_scan_params_cb(btd_scan_params_cb func);
+void btd_remove_scan_params_cb(btd_scan_params_cb func);
+
+void btd_adapter_get_scan_params(struct btd_adapter *adapter,
+					uint16_t *interval, uint16_t *window);
+void btd_adapter_scan_boost(struct btd_adapter *adapter);
+
 struct btd_adapter *adapter_find(const bdaddr_t *sba);
 struct btd_adapter *adapter_find_by_id(int id);
 void adapter_foreach(adapter_cb func, gpointer user_data);
@@ -89,6 +98,9 @@ sdp_list_t *btd_adapter_get_services(struct btd_adapter *adapter);
 struct btd_device *btd_adapter_find_device(struct btd_adapter *adapter,
 							const bdaddr_t *dst,
 							uint8_t dst_type);
+void btd_adapter_update_device_addr(struct btd_adapter *adapter,
+					struct btd_device *device,
+					const bdaddr_t *old_bdaddr);
 
 const char *adapter_get_path(struct btd_adapter *adapter);
 const bdaddr_t *btd_adapter_get_address(struct btd_adapter *adapter);
@@ -159,6 +171,14 @@ int btd_adapter_read_clock(struct btd_adapter *adapter, const bdaddr_t *bdaddr,
 				int which, int timeout, uint32_t *clock,
 				uint16_t *accuracy);
 
+int btd_adapter_load_conn_param(struct btd_adapter *adapter,
+				const bdaddr_t *peer, uint8_t bdaddr_type,
+				uint16_t min_interval, uint16_t max_interval,
+				uint16_t latency, uint16_t timeout);
+bool btd_adapter_get_conn_param(struct btd_adapter *adapter,
+				const bdaddr_t *peer, uint8_t bdaddr_type,
+				uint16_t *min_interval, uint16_t *max_interval,
+				uint16_t *latency, uint16_t *timeout);
 int btd_adapter_block_address(struct btd_adapter *adapter,
 				const bdaddr_t *bdaddr, uint8_t bdaddr_type);
 int btd_adapter_unblock_address(struct btd_adapter *adapter,
@@ -43,6 +43,17 @@
 #define LE_ADVERTISING_MGR_IFACE "org.bluez.LEAdvertisingManager1"
 #define LE_ADVERTISEMENT_IFACE "org.bluez.LEAdvertisement1"
 
+/*
+ * Advertisements beyond the controller instances are time-multiplexed:
+ * every slice the instances are handed to the clients with the highest
+ * priority and, within a priority, the least on-air time weighted by
+ * their duty cycle.
+ */
+#define ADV_MAX_CLIENTS	64
+#define ADV_SCHED_SLICE	2	/* seconds */
+#define ADV_DUTY_MAX	100
+#define ADV_STRIDE	(ADV_DUTY_MAX * 1000)
+
 struct btd_adv_manager {
 	struct btd_adapter *adapter;
 	struct queue *clients;
@@ -53,6 +64,7 @@ struct btd_adv_manager {
 	uint8_t max_ads;
 	uint32_t supported_flags;
 	unsigned int instance_bitmap;
+	unsigned int sched_id;
 };
 
 #define AD_TYPE_BROADCAST 0
@@ -75,6 +87,12 @@ struct btd_adv_client {
 	struct bt_ad *data;
 	struct bt_ad *scan;
 	uint8_t instance;
+	uint8_t priority;
+	uint8_t duty;
+	uint64_t pass;	/* Weighted time spent on a controller instance */
+	bool chosen;
+	struct mgmt_cp_add_advertising *cp;	/* Pregenerated parameters */
+	uint16_t cp_len;
 };
 
 struct dbus_obj_match {
@@ -114,6 +132,7 @@ static void client_free(void *data)
 
 	bt_ad_unref(client->data);
 	bt_ad_unref(client->scan);
+	free(client->cp);
 
 	g_dbus_proxy_unref(client->proxy);
 
@@ -166,23 +185,202 @@ static void remove_advertising(struct btd_adv_manager *manager,
 			manager->mgmt_index, sizeof(cp), &cp, NULL, NULL, NULL);
 }
 
+static void client_unschedule(struct btd_adv_client *client)
+{
+	struct btd_adv_manager *manager = client->manager;
+
+	if (!client->instance)
+		return;
+
+	remove_advertising(manager, client->instance);
+
+	util_clear_uid(&manager->instance_bitmap, client->instance);
+	client->instance = 0;
+}
+
+static void sched_add_callback(uint8_t status, uint16_t length,
+					const void *param, void *user_data)
+{
+	if (status)
+		error("Failed to schedule advertisement: %s (0x%02x)",
+						mgmt_errstr(status), status);
+}
+
+static bool client_install(struct btd_adv_client *client,
+						mgmt_request_func_t func)
+{
+	client->cp->instance = client->instance;
+
+	return mgmt_send(client->manager->mgmt, MGMT_OP_ADD_ADVERTISING,
+				client->manager->mgmt_index, client->cp_len,
+				client->cp, func, client, NULL) != 0;
+}
+
+static bool client_schedulable(const struct btd_adv_client *client)
+{
+	/* Registrations in flight keep whatever they currently hold */
+	return client->cp && !client->reg;
+}
+
+static bool client_before(const struct btd_adv_client *a,
+					const struct btd_adv_client *b)
+{
+	if (a->priority != b->priority)
+		return a->priority > b->priority;
+
+	return a->pass < b->pass;
+}
+
+static struct btd_adv_client *sched_pick(struct btd_adv_manager *manager)
+{
+	const struct queue_entry *entry;
+	struct btd_adv_client *best = NULL;
+
+	for (entry = queue_get_entries(manager->clients); entry;
+							entry = entry->next) {
+		struct btd_adv_client *client = entry->data;
+
+		if (!client_schedulable(client) || client->chosen)
+			continue;
+
+		if (!best || client_before(client, best))
+			best = client;
+	}
+
+	return best;
+}
+
+static uint64_t sched_min_pass(struct btd_adv_manager *manager)
+{
+	const struct queue_entry *entry;
+	uint64_t pass = UINT64_MAX;
+
+	for (entry = queue_get_entries(manager->clients); entry;
+							entry = entry->next) {
+		struct btd_adv_client *client = entry->data;
+
+		if (client_schedulable(client) && client->pass < pass)
+			pass = client->pass;
+	}
+
+	return pass == UINT64_MAX ? 0 : pass;
+}
+
+/*
+ * Assign the controller instances for the next slice, returns true if
+ * there are more advertisements than instances so slicing must go on.
+ * Clients are only charged for a slice when it is a scheduled one.
+ */
+static bool sched_run(struct btd_adv_manager *manager, bool charge)
+{
+	const struct queue_entry *entry;
+	struct btd_adv_client *client;
+	unsigned int slots = manager->max_ads;
+	unsigned int waiting = 0;
+	unsigned int i;
+
+	for (entry = queue_get_entries(manager->clients); entry;
+							entry = entry->next) {
+		client = entry->data;
+
+		if (client_schedulable(client))
+			waiting++;
+		else if (client->instance && slots)
+			slots--;
+	}
+
+	for (i = 0; i < slots; i++) {
+		client = sched_pick(manager);
+		if (!client)
+			break;
+
+		client->chosen = true;
+	}
+
+	/* Free the instances first so the kernel has room for the new ones */
+	for (entry = queue_get_entries(manager->clients); entry;
+							entry = entry->next) {
+		client = entry->data;
+
+		if (client_schedulable(client) && !client->chosen)
+			client_unschedule(client);
+	}
+
+	for (entry = queue_get_entries(manager->clients); entry;
+							entry = entry->next) {
+		client = entry->data;
+
+		if (!client->chosen)
+			continue;
+
+		client->chosen = false;
+
+		if (charge)
+			client->pass += ADV_STRIDE / client->duty;
+
+		if (client->instance)
+			continue;
+
+		client->instance = util_get_uid(&manager->instance_bitmap,
+							manager->max_ads);
+		if (!client->instance)
+			continue;
+
+		DBG("Scheduling %s on instance %u", client->path,
+							client->instance);
+
+		if (!client_install(client, sched_add_callback)) {
+			util_clear_uid(&manager->instance_bitmap,
+							client->instance);
+			client->instance = 0;
+		}
+	}
+
+	return waiting > slots;
+}
+
+static gboolean sched_timeout(gpointer user_data)
+{
+	struct btd_adv_manager *manager = user_data;
+
+	if (sched_run(manager, true))
+		return TRUE;
+
+	manager->sched_id = 0;
+
+	return FALSE;
+}
+
+static void sched_update(struct btd_adv_manager *manager)
+{
+	if (!sched_run(manager, false)) {
+		if (manager->sched_id) {
+			g_source_remove(manager->sched_id);
+			manager->sched_id = 0;
+		}
+		return;
+	}
+
+	if (!manager->sched_id)
+		manager->sched_id = g_timeout_add_seconds(ADV_SCHED_SLICE,
+							sched_timeout, manager);
+}
+
 static void client_remove(void *data)
 {
 	struct btd_adv_client *client = data;
-	struct mgmt_cp_remove_advertising cp;
 
 	g_dbus_client_set_disconnect_watch(client->client, NULL, NULL);
 
-	cp.instance = client->instance;
-
-	mgmt_send(client->manager->mgmt, MGMT_OP_REMOVE_ADVERTISING,
-			client->manager->mgmt_index, sizeof(cp), &cp,
-			NULL, NULL, NULL);
+	client_unschedule(client);
 
 	queue_remove(client->manager->clients, client);
 
 	g_idle_add(client_free_idle_cb, client);
 
+	/* Hand the instance over to a waiting advertisement */
+	sched_update(client->manager);
+
 	g_dbus_emit_property_changed(btd_get_dbus_connection(),
 				adapter_get_path(client->manager->adapter),
 				LE_ADVERTISING_MGR_IFACE, "SupportedInstances");
@@ -568,8 +766,8 @@ static size_t calc_max_adv_len(struct btd_adv_client *client, uint32_t flags)
 	return max;
 }
 
-static uint8_t *generate_adv_data(struct btd_adv_client *client,
-						uint32_t *flags, size_t *len)
+static bool generate_adv_data(struct btd_adv_client *client,
+				uint32_t *flags, uint8_t *buf, size_t *len)
 {
 	if ((*flags & MGMT_ADV_FLAG_APPEARANCE) ||
 					client->appearance != UINT16_MAX) {
@@ -585,18 +783,18 @@ static uint8_t *generate_adv_data(struct btd_adv_client *client,
 		bt_ad_add_appearance(client->data, appearance);
 	}
 
-	return bt_ad_generate(client->data, len);
+	return bt_ad_generate_into(client->data, buf, len);
 }
 
-static uint8_t *generate_scan_rsp(struct btd_adv_client *client,
-						uint32_t *flags, size_t *len)
+static bool generate_scan_rsp(struct btd_adv_client *client,
+				uint32_t *flags, uint8_t *buf, size_t *len)
 {
 	struct btd_adv_manager *manager = client->manager;
 	const char *name;
 
 	if (!(*flags & MGMT_ADV_FLAG_LOCAL_NAME) && !client->name) {
 		*len = 0;
-		return NULL;
+		return true;
 	}
 
 	*flags &= ~MGMT_ADV_FLAG_LOCAL_NAME;
@@ -607,34 +805,31 @@ static uint8_t *generate_scan_rsp(struct btd_adv_client *client,
 
 	bt_ad_add_name(client->scan, name);
 
-	return bt_ad_generate(client->scan, len);
+	return bt_ad_generate_into(client->scan, buf, len);
 }
 
-static int refresh_adv(struct btd_adv_client *client, mgmt_request_func_t func)
+static int generate_adv(struct btd_adv_client *client)
 {
 	struct mgmt_cp_add_advertising *cp;
 	uint8_t param_len;
-	uint8_t *adv_data;
-	size_t adv_data_len;
-	uint8_t *scan_rsp;
-	size_t scan_rsp_len = -1;
+	uint8_t adv_data[BT_AD_MAX_DATA_LEN];
+	size_t adv_data_len = sizeof(adv_data);
+	uint8_t scan_rsp[BT_AD_MAX_DATA_LEN];
+	size_t scan_rsp_len = sizeof(scan_rsp);
 	uint32_t flags = 0;
 
-	DBG("Refreshing advertisement: %s", client->path);
-
 	if (client->type == AD_TYPE_PERIPHERAL)
 		flags = MGMT_ADV_FLAG_CONNECTABLE | MGMT_ADV_FLAG_DISCOV;
 
 	flags |= client->flags;
 
-	adv_data = generate_adv_data(client, &flags, &adv_data_len);
-	if (!adv_data || (adv_data_len > calc_max_adv_len(client, flags))) {
+	if (!generate_adv_data(client, &flags, adv_data, &adv_data_len) ||
+			(adv_data_len > calc_max_adv_len(client, flags))) {
 		error("Advertising data too long or couldn't be generated.");
 		return -EINVAL;
 	}
 
-	scan_rsp = generate_scan_rsp(client, &flags, &scan_rsp_len);
-	if (!scan_rsp && scan_rsp_len) {
+	if (!generate_scan_rsp(client, &flags, scan_rsp, &scan_rsp_len)) {
 		error("Scan data couldn't be generated.");
 		return -EINVAL;
 	}
@@ -642,35 +837,49 @@ static int refresh_adv(struct btd_adv_client *client, mgmt_request_func_t func)
 	param_len = sizeof(struct mgmt_cp_add_advertising) + adv_data_len +
 							scan_rsp_len;
 
-	cp = malloc0(param_len);
-	if (!cp) {
-		error("Couldn't allocate for MGMT!");
-		free(adv_data);
-		free(scan_rsp);
-		return -ENOMEM;
+	/* Kept around so the scheduler can install it at any time */
+	cp = client->cp;
+	if (!cp || client->cp_len != param_len) {
+		cp = malloc0(param_len);
+		if (!cp) {
+			error("Couldn't allocate for MGMT!");
+			return -ENOMEM;
+		}
+
+		free(client->cp);
+		client->cp = cp;
+		client->cp_len = param_len;
 	}
 
 	cp->flags = htobl(flags);
-	cp->instance = client->instance;
 	cp->duration = client->duration;
 	cp->adv_data_len = adv_data_len;
 	cp->scan_rsp_len = scan_rsp_len;
 	memcpy(cp->data, adv_data, adv_data_len);
 	memcpy(cp->data + adv_data_len, scan_rsp, scan_rsp_len);
 
-	free(adv_data);
-	free(scan_rsp);
+	return 0;
+}
+
+static int refresh_adv(struct btd_adv_client *client, mgmt_request_func_t func)
+{
+	int err;
+
+	DBG("Refreshing advertisement: %s", client->path);
+
+	err = generate_adv(client);
+	if (err)
+		return err;
 
-	if (!mgmt_send(client->manager->mgmt, MGMT_OP_ADD_ADVERTISING,
-				client->manager->mgmt_index, param_len, cp,
-				func, client, NULL)) {
+	/* Waiting for the scheduler, picked up on its next slice */
+	if (!client->instance)
+		return 0;
+
+	if (!client_install(client, func)) {
 		error("Failed to add Advertising Data");
-		free(cp);
 		return -EINVAL;
 	}
 
-	free(cp);
-
 	return 0;
 }
 
@@ -693,6 +902,7 @@ static void properties_changed(GDBusProxy *proxy, const char *name,
 
 static void add_client_complete(struct btd_adv_client *client, uint8_t status)
 {
+	struct btd_adv_manager *manager = client->manager;
 	DBusMessage *reply;
 
 	if (status) {
@@ -700,15 +910,38 @@ static void add_client_complete(struct btd_adv_client *client, uint8_t status)
 						mgmt_errstr(status), status);
 		reply = btd_error_failed(client->reg,
 					"Failed to register advertisement");
-		queue_remove(client->manager->clients, client);
+		if (client->instance) {
+			util_clear_uid(&manager->instance_bitmap,
+							client->instance);
+			client->instance = 0;
+		}
+		queue_remove(manager->clients, client);
 		g_idle_add(client_free_idle_cb, client);
 
-	} else
+	} else {
+		g_dbus_client_set_disconnect_watch(client->client,
+						client_disconnect_cb, client);
+		DBG("Advertisement registered: %s", client->path);
+
+		g_dbus_emit_property_changed(btd_get_dbus_connection(),
+				adapter_get_path(manager->adapter),
+				LE_ADVERTISING_MGR_IFACE, "SupportedInstances");
+
+		g_dbus_emit_property_changed(btd_get_dbus_connection(),
+				adapter_get_path(manager->adapter),
+				LE_ADVERTISING_MGR_IFACE, "ActiveInstances");
+
+		g_dbus_proxy_set_property_watch(client->proxy,
+						properties_changed, client);
+
 		reply = dbus_message_new_method_return(client->reg);
+	}
 
 	g_dbus_send_message(btd_get_dbus_connection(), reply);
 	dbus_message_unref(client->reg);
 	client->reg = NULL;
+
+	sched_update(manager);
 }
 
 static void add_adv_callback(uint8_t status, uint16_t length,
@@ -727,21 +960,6 @@ static void add_adv_callback(uint8_t status, uint16_t length,
 
 	client->instance = rp->instance;
 
-	g_dbus_client_set_disconnect_watch(client->client, client_disconnect_cb,
-									client);
-	DBG("Advertisement registered: %s", client->path);
-
-	g_dbus_emit_property_changed(btd_get_dbus_connection(),
-				adapter_get_path(client->manager->adapter),
-				LE_ADVERTISING_MGR_IFACE, "SupportedInstances");
-
-	g_dbus_emit_property_changed(btd_get_dbus_connection(),
-				adapter_get_path(client->manager->adapter),
-				LE_ADVERTISING_MGR_IFACE, "ActiveInstances");
-
-	g_dbus_proxy_set_property_watch(client->proxy, properties_changed,
-								client);
-
 done:
 	add_client_complete(client, status);
 }
@@ -764,9 +982,27 @@ static DBusMessage *parse_advertisement(struct btd_adv_client *client)
 		}
 	}
 
-	err = refresh_adv(client, add_adv_callback);
-	if (!err)
-		return NULL;
+	err = generate_adv(client);
+	if (err)
+		goto fail;
+
+	client->instance = util_get_uid(&client->manager->instance_bitmap,
+						client->manager->max_ads);
+	if (client->instance) {
+		if (client_install(client, add_adv_callback))
+			return NULL;
+
+		util_clear_uid(&client->manager->instance_bitmap,
+							client->instance);
+		client->instance = 0;
+		goto fail;
+	}
+
+	/* All instances are taken, share them with the others */
+	client->pass = sched_min_pass(client->manager);
+	add_client_complete(client, MGMT_STATUS_SUCCESS);
+
+	return NULL;
 
 fail:
 	return btd_error_failed(client->reg, "Failed to parse advertisement.");
@@ -836,6 +1072,7 @@ static struct btd_adv_client *client_create(struct btd_adv_manager *manager,
 
 	client->manager = manager;
 	client->appearance = UINT16_MAX;
+	client->duty = ADV_DUTY_MAX;
 
 	return client;
 
@@ -844,6 +1081,45 @@ fail:
 	return NULL;
 }
 
+static bool parse_options(DBusMessageIter *iter, struct btd_adv_client *client)
+{
+	DBusMessageIter dict;
+
+	if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_ARRAY)
+		return false;
+
+	dbus_message_iter_recurse(iter, &dict);
+
+	while (dbus_message_iter_get_arg_type(&dict) == DBUS_TYPE_DICT_ENTRY) {
+		const char *key;
+		DBusMessageIter value, entry;
+		int var;
+
+		dbus_message_iter_recurse(&dict, &entry);
+		dbus_message_iter_get_basic(&entry, &key);
+
+		dbus_message_iter_next(&entry);
+		dbus_message_iter_recurse(&entry, &value);
+
+		var = dbus_message_iter_get_arg_type(&value);
+		if (strcmp(key, "Priority") == 0) {
+			if (var != DBUS_TYPE_BYTE)
+				return false;
+			dbus_message_iter_get_basic(&value, &client->priority);
+		} else if (strcmp(key, "DutyCycle") == 0) {
+			if (var != DBUS_TYPE_BYTE)
+				return false;
+			dbus_message_iter_get_basic(&value, &client->duty);
+			if (!client->duty || client->duty > ADV_DUTY_MAX)
+				return false;
+		}
+
+		dbus_message_iter_next(&dict);
+	}
+
+	return true;
+}
+
 static DBusMessage *register_advertisement(DBusConnection *conn,
 						DBusMessage *msg,
 						void *user_data)
@@ -873,17 +1149,18 @@ static DBusMessage *register_advertisement(DBusConnection *conn,
 	if (dbus_message_iter_get_arg_type(&args) != DBUS_TYPE_ARRAY)
 		return btd_error_invalid_args(msg);
 
+	if (queue_length(manager->clients) >= ADV_MAX_CLIENTS)
+		return btd_error_not_permitted(msg,
+					"Maximum advertisements reached");
+
 	client = client_create(manager, conn, msg, match.path);
 	if (!client)
 		return btd_error_failed(msg,
 					"Failed to register advertisement");
 
-	client->instance = util_get_uid(&manager->instance_bitmap,
-							manager->max_ads);
-	if (!client->instance) {
+	if (!parse_options(&args, client)) {
 		client_free(client);
-		return btd_error_not_permitted(msg,
-					"Maximum advertisements reached");
+		return btd_error_invalid_args(msg);
 	}
 
 	DBG("Registered advertisement at path %s", match.path);
@@ -929,7 +1206,7 @@ static gboolean get_instances(const GDBusPropertyTable *property,
 	struct btd_adv_manager *manager = data;
 	uint8_t instances;
 
-	instances = manager->max_ads - queue_length(manager->clients);
+	instances = ADV_MAX_CLIENTS - queue_length(manager->clients);
 
 	dbus_message_iter_append_basic(iter, DBUS_TYPE_BYTE, &instances);
 
@@ -1000,6 +1277,9 @@ static void manager_destroy(void *user_data)
 {
 	struct btd_adv_manager *manager = user_data;
 
+	if (manager->sched_id)
+		g_source_remove(manager->sched_id);
+
 	queue_destroy(manager->clients, client_destroy);
 
 	mgmt_unref(manager->mgmt);
@@ -776,8 +776,7 @@ static int read_device_ccc(struct btd_device *device, uint16_t handle,
 		return -ENOENT;
 	}
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_load(filename);
 
 	sprintf(group, "%hu", handle);
 
@@ -789,7 +788,7 @@ static int read_device_ccc(struct btd_device *device, uint16_t handle,
 
 	g_free(str);
 	g_free(filename);
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 
 	return err;
 }
@@ -912,8 +911,6 @@ static uint16_t write_value(struct gatt_channel *channel, uint16_t handle,
 		char *filename;
 		GKeyFile *key_file;
 		char group[6], value[5];
-		char *data;
-		gsize length = 0;
 
 		filename = btd_device_get_storage_path(channel->device, "ccc");
 		if (!filename) {
@@ -923,22 +920,16 @@ static uint16_t write_value(struct gatt_channel *channel, uint16_t handle,
 						pdu, len);
 		}
 
-		key_file = g_key_file_new();
-		g_key_file_load_from_file(key_file, filename, 0, NULL);
+		key_file = storage_load(filename);
 
 		sprintf(group, "%hu", handle);
 		sprintf(value, "%hX", cccval);
 		g_key_file_set_string(key_file, group, "Value", value);
 
-		data = g_key_file_to_data(key_file, &length, NULL);
-		if (length > 0) {
-			create_file(filename, S_IRUSR | S_IWUSR);
-			g_file_set_contents(filename, data, length, NULL);
-		}
+		storage_save(filename, key_file);
 
-		g_free(data);
 		g_free(filename);
-		g_key_file_free(key_file);
+		g_key_file_unref(key_file);
 	}
 
 	return enc_write_resp(pdu);
@@ -1188,6 +1179,7 @@ guint attrib_channel_attach(GAttrib *attrib)
 
 		filename = btd_device_get_storage_path(device, "ccc");
 		if (filename) {
+			storage_remove(filename);
 			unlink(filename);
 			g_free(filename);
 		}
@@ -0,0 +1,229 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2017  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "lib/bluetooth.h"
+#include "lib/sdp.h"
+
+#include "log.h"
+#include "hcid.h"
+#include "adapter.h"
+#include "device.h"
+#include "src/shared/att.h"
+#include "conn-policy.h"
+
+/* How often the ATT traffic of an auto managed link is looked at */
+#define SAMPLE_INTERVAL		1
+/* PDUs within one sample that count as a burst */
+#define BURST_PDUS		4
+/* Quiet samples before a link is slowed down again */
+#define IDLE_SAMPLES		10
+
+enum {
+	LINK_PEER,
+	LINK_LATENCY,
+	LINK_POWER,
+};
+
+/*
+ * Intervals in 1.25 ms units and supervision timeout in 10 ms units.
+ * The peer entry holds the kernel defaults used when the device never
+ * asked for parameters of its own.
+ */
+static const struct link_param {
+	uint16_t min_interval;
+	uint16_t max_interval;
+	uint16_t latency;
+	uint16_t timeout;
+} link_params[] = {
+	[LINK_PEER]	= { 0x0018, 0x0028, 0, 0x002a },
+	[LINK_LATENCY]	= { 0x0006, 0x000c, 0, 0x01f4 },
+	[LINK_POWER]	= { 0x0050, 0x0064, 4, 0x0258 },
+};
+
+struct btd_conn_policy {
+	struct btd_device *device;
+	bt_conn_policy_t policy;
+	int link;
+	guint timer;
+	uint64_t last_pdus;
+	unsigned int quiet;
+};
+
+static const char *policy_str[] = {
+	[BT_CONN_POLICY_PEER]		= "peer",
+	[BT_CONN_POLICY_AUTO]		= "auto",
+	[BT_CONN_POLICY_LATENCY]	= "latency",
+	[BT_CONN_POLICY_POWER]		= "power",
+};
+
+const char *btd_conn_policy_to_str(bt_conn_policy_t policy)
+{
+	if (policy >= G_N_ELEMENTS(policy_str))
+		return NULL;
+
+	return policy_str[policy];
+}
+
+bool btd_conn_policy_from_str(const char *str, bt_conn_policy_t *policy)
+{
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(policy_str); i++) {
+		if (!strcmp(str, policy_str[i])) {
+			*policy = i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void link_apply(struct btd_conn_policy *cp, int link)
+{
+	struct btd_adapter *adapter = device_get_adapter(cp->device);
+	const bdaddr_t *bdaddr = device_get_address(cp->device);
+	uint8_t bdaddr_type = btd_device_get_bdaddr_type(cp->device);
+	struct link_param param = link_params[link];
+
+	if (link == cp->link)
+		return;
+
+	cp->link = link;
+
+	/* Going back means handing over to what the peer asked for */
+	if (link == LINK_PEER)
+		btd_adapter_get_conn_param(adapter, bdaddr, bdaddr_type,
+						&param.min_interval,
+						&param.max_interval,
+						&param.latency, &param.timeout);
+
+	DBG("%s interval 0x%04x-0x%04x latency %u timeout 0x%04x",
+				device_get_path(cp->device), param.min_interval,
+				param.max_interval, param.latency,
+				param.timeout);
+
+	btd_adapter_load_conn_param(adapter, bdaddr, bdaddr_type,
+					param.min_interval, param.max_interval,
+					param.latency, param.timeout);
+}
+
+static uint64_t link_pdus(struct btd_conn_policy *cp)
+{
+	struct bt_att_pdu_stats stats;
+
+	if (!btd_device_get_att_stats(cp->device, &stats))
+		return cp->last_pdus;
+
+	return stats.rx_pdus + stats.tx_pdus;
+}
+
+/*
+ * Speed up on the first busy sample so input and transfers are not held
+ * back, but only slow down after a run of quiet ones so a link does not
+ * flip between the two on bursty traffic.
+ */
+static gboolean sample_link(gpointer user_data)
+{
+	struct btd_conn_policy *cp = user_data;
+	uint64_t pdus = link_pdus(cp);
+
+	if (pdus - cp->last_pdus >= BURST_PDUS) {
+		cp->quiet = 0;
+		link_apply(cp, LINK_LATENCY);
+	} else if (++cp->quiet >= IDLE_SAMPLES) {
+		link_apply(cp, LINK_POWER);
+	}
+
+	cp->last_pdus = pdus;
+
+	return TRUE;
+}
+
+void btd_conn_policy_set(struct btd_conn_policy *cp, bt_conn_policy_t policy)
+{
+	if (!cp)
+		return;
+
+	cp->policy = policy;
+
+	if (cp->timer > 0) {
+		g_source_remove(cp->timer);
+		cp->timer = 0;
+	}
+
+	switch (policy) {
+	case BT_CONN_POLICY_PEER:
+		link_apply(cp, LINK_PEER);
+		break;
+	case BT_CONN_POLICY_AUTO:
+		cp->last_pdus = link_pdus(cp);
+		cp->quiet = 0;
+		cp->timer = g_timeout_add_seconds(SAMPLE_INTERVAL,
+							sample_link, cp);
+		break;
+	case BT_CONN_POLICY_LATENCY:
+		link_apply(cp, LINK_LATENCY);
+		break;
+	case BT_CONN_POLICY_POWER:
+		link_apply(cp, LINK_POWER);
+		break;
+	}
+}
+
+struct btd_conn_policy *btd_conn_policy_new(struct btd_device *device,
+						bt_conn_policy_t policy)
+{
+	struct btd_conn_policy *cp;
+
+	cp = g_new0(struct btd_conn_policy, 1);
+	cp->device = device;
+	cp->link = LINK_PEER;
+
+	btd_conn_policy_set(cp, policy);
+
+	return cp;
+}
+
+void btd_conn_policy_free(struct btd_conn_policy *cp)
+{
+	if (!cp)
+		return;
+
+	if (cp->timer > 0)
+		g_source_remove(cp->timer);
+
+	/* The kernel uses the loaded values for the next connection too */
+	link_apply(cp, LINK_PEER);
+
+	g_free(cp);
+}
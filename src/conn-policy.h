@@ -0,0 +1,32 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2017  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+struct btd_conn_policy;
+
+const char *btd_conn_policy_to_str(bt_conn_policy_t policy);
+bool btd_conn_policy_from_str(const char *str, bt_conn_policy_t *policy);
+
+struct btd_conn_policy *btd_conn_policy_new(struct btd_device *device,
+						bt_conn_policy_t policy);
+void btd_conn_policy_free(struct btd_conn_policy *cp);
+void btd_conn_policy_set(struct btd_conn_policy *cp, bt_conn_policy_t policy);
@@ -51,14 +51,18 @@
 #include "src/shared/queue.h"
 #include "src/shared/gatt-db.h"
 #include "src/shared/gatt-client.h"
+#include "src/shared/gatt-batch.h"
 #include "src/shared/gatt-server.h"
 #include "src/shared/ad.h"
 #include "btio/btio.h"
 #include "lib/mgmt.h"
 #include "attrib/att.h"
 #include "hcid.h"
+#include "plugin.h"
 #include "adapter.h"
 #include "gatt-database.h"
+#include "gatt-cache.h"
+#include "sdp-cache.h"
 #include "attrib/gattrib.h"
 #include "device.h"
 #include "gatt-client.h"
@@ -74,6 +78,8 @@
 #include "storage.h"
 #include "attrib-server.h"
 #include "eir.h"
+#include "metrics.h"
+#include "conn-policy.h"
 
 #define IO_CAPABILITY_NOINPUTNOOUTPUT	0x03
 
@@ -87,11 +93,31 @@
 
 #define RSSI_THRESHOLD		8
 
+/* Properties updated from advertising reports and inquiry results */
+#define DISCOV_PROP_RSSI		(1 << 0)
+#define DISCOV_PROP_TX_POWER		(1 << 1)
+#define DISCOV_PROP_MANUFACTURER_DATA	(1 << 2)
+#define DISCOV_PROP_SERVICE_DATA	(1 << 3)
+#define DISCOV_PROP_ADV_FLAGS		(1 << 4)
+
+static const char *discov_prop_names[] = {
+	"RSSI",
+	"TxPower",
+	"ManufacturerData",
+	"ServiceData",
+	"AdvertisingFlags",
+};
+
 #define GATT_PRIM_SVC_UUID_STR "2800"
 #define GATT_SND_SVC_UUID_STR  "2801"
 #define GATT_INCLUDE_UUID_STR "2802"
 #define GATT_CHARAC_UUID_STR "2803"
 
+#define GATT_DB_HASH_LEN	16
+
+/* Bumped whenever the layout of the cached attributes changes */
+#define GATT_CACHE_VERSION	1
+
 static DBusConnection *dbus_conn = NULL;
 static unsigned service_state_cb_id;
 
@@ -190,6 +216,10 @@ struct btd_device {
 	bool		le;
 	bool		pending_paired;		/* "Paired" waiting for SDP */
 	bool		svc_refreshed;
+	bool		svc_cache_stale;
+	time_t		svc_cache_time;		/* Last SDP resolution */
+	uint32_t	svc_cache_eir;		/* EIR UUIDs at that time */
+	uint32_t	eir_hash;		/* Last seen EIR UUIDs */
 	GSList		*svc_callbacks;
 	GSList		*eir_uuids;
 	struct bt_ad	*ad;
@@ -210,8 +240,12 @@ struct btd_device {
 	GSList		*pending;		/* Pending services */
 	GSList		*watches;		/* List of disconnect_data */
 	bool		temporary;
+	bool		services_pending;	/* Lazily loaded services */
 	guint		disconn_timer;
 	guint		discov_timer;
+	guint		discov_emit_id;
+	uint8_t		discov_pending;
+	int64_t		discov_emitted;
 	struct browse_req *browse;		/* service discover request */
 	struct bonding_req *bonding;
 	struct authentication_req *authr;	/* authentication request */
@@ -222,6 +256,7 @@ struct btd_device {
 
 	struct bt_att *att;			/* The new ATT transport */
 	uint16_t att_mtu;			/* The ATT MTU */
+	int64_t gatt_start;			/* GATT client init time */
 	unsigned int att_disconn_id;
 
 	/*
@@ -232,6 +267,7 @@ struct btd_device {
 	struct gatt_db *db;			/* GATT db cache */
 	unsigned int db_id;
 	struct bt_gatt_client *client;		/* GATT client instance */
+	struct bt_gatt_batch *gatt_batch;	/* Profile read batching */
 	struct bt_gatt_server *server;		/* GATT server instance */
 	unsigned int gatt_ready_id;
 
@@ -244,12 +280,19 @@ struct btd_device {
 	struct csrk_info *remote_csrk;
 
 	sdp_list_t	*tmp_records;
+	struct sdp_cache *sdp_cache;
 
 	time_t		bredr_seen;
 	time_t		le_seen;
+	uint32_t	bredr_adv_hash;
+	uint32_t	le_adv_hash[2];
+	uint64_t	le_adv_types[2];
+	time_t		last_connected;
 
 	gboolean	trusted;
 	gboolean	blocked;
+	bt_conn_policy_t conn_policy;
+	struct btd_conn_policy *conn_mgr;
 	gboolean	auto_connect;
 	gboolean	disable_auto_connect;
 	gboolean	general_connect;
@@ -271,6 +314,8 @@ static const uint16_t uuid_list[] = {
 
 static int device_browse_gatt(struct btd_device *device, DBusMessage *msg);
 static int device_browse_sdp(struct btd_device *device, DBusMessage *msg);
+static void device_load_services(struct btd_device *device);
+static void device_set_svc_refreshed(struct btd_device *device, bool value);
 
 static struct bearer_state *get_state(struct btd_device *dev,
 							uint8_t bdaddr_type)
@@ -370,10 +415,8 @@ static gboolean store_device_info_cb(gpointer user_data)
 	char filename[PATH_MAX];
 	char adapter_addr[18];
 	char device_addr[18];
-	char *str;
 	char class[9];
 	char **uuids = NULL;
-	gsize length = 0;
 
 	device->store_id = 0;
 
@@ -382,8 +425,7 @@ static gboolean store_device_info_cb(gpointer user_data)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info", adapter_addr,
 			device_addr);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_load(filename);
 
 	g_key_file_set_string(key_file, "General", "Name", device->name);
 
@@ -415,6 +457,21 @@ static gboolean store_device_info_cb(gpointer user_data)
 	g_key_file_set_boolean(key_file, "General", "Blocked",
 							device->blocked);
 
+	/* Only an explicit choice sticks, the default follows main.conf */
+	if (device->conn_policy != main_opts.conn_policy)
+		g_key_file_set_string(key_file, "General", "ConnectionPolicy",
+			btd_conn_policy_to_str(device->conn_policy));
+	else
+		g_key_file_remove_key(key_file, "General", "ConnectionPolicy",
+									NULL);
+
+	if (device->last_connected)
+		g_key_file_set_uint64(key_file, "General", "LastConnected",
+							device->last_connected);
+	else
+		g_key_file_remove_key(key_file, "General", "LastConnected",
+									NULL);
+
 	if (device->uuids) {
 		GSList *l;
 		int i;
@@ -447,13 +504,9 @@ static gboolean store_device_info_cb(gpointer user_data)
 	if (device->remote_csrk)
 		store_csrk(device->remote_csrk, key_file, "RemoteSignatureKey");
 
-	create_file(filename, S_IRUSR | S_IWUSR);
-
-	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
+	storage_save(filename, key_file);
 
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 	g_free(uuids);
 
 	return FALSE;
@@ -492,8 +545,6 @@ void device_store_cached_name(struct btd_device *dev, const char *name)
 	char filename[PATH_MAX];
 	char s_addr[18], d_addr[18];
 	GKeyFile *key_file;
-	char *data;
-	gsize length = 0;
 
 	if (device_address_is_private(dev)) {
 		warn("Can't store name for private addressed device %s",
@@ -504,17 +555,13 @@ void device_store_cached_name(struct btd_device *dev, const char *name)
 	ba2str(btd_adapter_get_address(dev->adapter), s_addr);
 	ba2str(&dev->bdaddr, d_addr);
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", s_addr, d_addr);
-	create_file(filename, S_IRUSR | S_IWUSR);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_load(filename);
 	g_key_file_set_string(key_file, "General", "Name", name);
 
-	data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, data, length, NULL);
-	g_free(data);
+	storage_save(filename, key_file);
 
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
 static void browse_request_free(struct browse_req *req)
@@ -570,6 +617,9 @@ static void gatt_client_cleanup(struct btd_device *device)
 		device->gatt_ready_id = 0;
 	}
 
+	bt_gatt_batch_free(device->gatt_batch);
+	device->gatt_batch = NULL;
+
 	bt_gatt_client_unref(device->client);
 	device->client = NULL;
 }
@@ -598,7 +648,17 @@ static void attio_cleanup(struct btd_device *device)
 	gatt_client_cleanup(device);
 	gatt_server_cleanup(device);
 
+	btd_conn_policy_free(device->conn_mgr);
+	device->conn_mgr = NULL;
+
 	if (device->att) {
+		struct bt_att_pdu_stats stats;
+
+		if (bt_att_get_pdu_stats(device->att, &stats)) {
+			btd_metrics_add(BTD_METRIC_ATT_RX_PDUS, stats.rx_pdus);
+			btd_metrics_add(BTD_METRIC_ATT_TX_PDUS, stats.tx_pdus);
+		}
+
 		bt_att_unref(device->att);
 		device->att = NULL;
 	}
@@ -642,6 +702,8 @@ static void device_free(gpointer user_data)
 {
 	struct btd_device *device = user_data;
 
+	btd_metrics_dec(BTD_METRIC_DEVICES);
+
 	btd_gatt_client_destroy(device->client_dbus);
 	device->client_dbus = NULL;
 
@@ -662,12 +724,17 @@ static void device_free(gpointer user_data)
 		sdp_list_free(device->tmp_records,
 					(sdp_free_func_t) sdp_record_free);
 
+	sdp_cache_free(device->sdp_cache);
+
 	if (device->disconn_timer)
 		g_source_remove(device->disconn_timer);
 
 	if (device->discov_timer)
 		g_source_remove(device->discov_timer);
 
+	if (device->discov_emit_id)
+		g_source_remove(device->discov_emit_id);
+
 	if (device->connect)
 		dbus_message_unref(device->connect);
 
@@ -1009,6 +1076,57 @@ dev_property_get_flags(const GDBusPropertyTable *property,
 	return TRUE;
 }
 
+static gboolean dev_property_get_conn_policy(
+					const GDBusPropertyTable *property,
+					DBusMessageIter *iter, void *data)
+{
+	struct btd_device *device = data;
+	const char *str = btd_conn_policy_to_str(device->conn_policy);
+
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING, &str);
+
+	return TRUE;
+}
+
+static void dev_property_set_conn_policy(const GDBusPropertyTable *property,
+					DBusMessageIter *value,
+					GDBusPendingPropertySet id, void *data)
+{
+	struct btd_device *device = data;
+	bt_conn_policy_t policy;
+	const char *str;
+
+	if (dbus_message_iter_get_arg_type(value) != DBUS_TYPE_STRING) {
+		g_dbus_pending_property_error(id,
+					ERROR_INTERFACE ".InvalidArguments",
+					"Invalid arguments in method call");
+		return;
+	}
+
+	dbus_message_iter_get_basic(value, &str);
+
+	if (!btd_conn_policy_from_str(str, &policy)) {
+		g_dbus_pending_property_error(id,
+					ERROR_INTERFACE ".InvalidArguments",
+					"Invalid arguments in method call");
+		return;
+	}
+
+	g_dbus_pending_property_success(id);
+
+	if (policy == device->conn_policy)
+		return;
+
+	device->conn_policy = policy;
+
+	btd_conn_policy_set(device->conn_mgr, policy);
+
+	store_device_info(device);
+
+	g_dbus_emit_property_changed(dbus_conn, device->path,
+					DEVICE_INTERFACE, "ConnectionPolicy");
+}
+
 static gboolean dev_property_get_trusted(const GDBusPropertyTable *property,
 					DBusMessageIter *iter, void *data)
 {
@@ -1514,6 +1632,81 @@ static int connect_next(struct btd_device *dev)
 	return err;
 }
 
+/*
+ * Services resolved over SDP are trusted for ServiceCacheTimeout seconds, as
+ * long as the EIR service list of the device stays the same and it doesn't
+ * indicate a Service Changed. Until then connecting doesn't browse again.
+ */
+static bool svc_cache_valid(struct btd_device *dev)
+{
+	time_t now;
+
+	if (!main_opts.svc_cache_timeout || dev->svc_cache_stale ||
+						!dev->svc_cache_time)
+		return false;
+
+	now = time(NULL);
+	if (now < dev->svc_cache_time)
+		return false;
+
+	return now - dev->svc_cache_time < main_opts.svc_cache_timeout;
+}
+
+static void svc_cache_store(struct btd_device *dev)
+{
+	char filename[PATH_MAX];
+	char local[18], peer[18];
+	GKeyFile *key_file;
+
+	if (device_address_is_private(dev))
+		return;
+
+	ba2str(btd_adapter_get_address(dev->adapter), local);
+	ba2str(&dev->bdaddr, peer);
+
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
+
+	key_file = storage_load(filename);
+
+	g_key_file_set_uint64(key_file, "ServiceCache", "Resolved",
+							dev->svc_cache_time);
+	g_key_file_set_uint64(key_file, "ServiceCache", "EIRHash",
+							dev->svc_cache_eir);
+
+	storage_save(filename, key_file);
+	g_key_file_unref(key_file);
+}
+
+static void svc_cache_load(struct btd_device *dev, const char *local,
+							const char *peer)
+{
+	char filename[PATH_MAX];
+	GKeyFile *key_file;
+
+	if (!dev->bredr_state.svc_resolved)
+		return;
+
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
+
+	key_file = storage_load(filename);
+
+	dev->svc_cache_time = g_key_file_get_uint64(key_file, "ServiceCache",
+							"Resolved", NULL);
+	dev->svc_cache_eir = g_key_file_get_uint64(key_file, "ServiceCache",
+							"EIRHash", NULL);
+
+	g_key_file_unref(key_file);
+}
+
+static void svc_cache_update(struct btd_device *dev)
+{
+	dev->svc_cache_time = time(NULL);
+	dev->svc_cache_eir = dev->eir_hash;
+	dev->svc_cache_stale = false;
+
+	svc_cache_store(dev);
+}
+
 static void device_profile_connected(struct btd_device *dev,
 					struct btd_profile *profile, int err)
 {
@@ -1580,8 +1773,12 @@ done:
 				btd_error_failed(dev->connect, strerror(-err)));
 	} else {
 		/* Start passive SDP discovery to update known services */
-		if (dev->bredr && !dev->svc_refreshed)
-			device_browse_sdp(dev, NULL);
+		if (dev->bredr && !dev->svc_refreshed) {
+			if (svc_cache_valid(dev))
+				device_set_svc_refreshed(dev, true);
+			else
+				device_browse_sdp(dev, NULL);
+		}
 		g_dbus_send_reply(dbus_conn, dev->connect, DBUS_TYPE_INVALID);
 	}
 
@@ -1610,6 +1807,138 @@ void device_add_eir_uuids(struct btd_device *dev, GSList *uuids)
 						DEVICE_INTERFACE, "UUIDs");
 }
 
+static uint32_t eir_uuids_hash(GSList *uuids)
+{
+	uint32_t hash = 0;
+	GSList *l;
+
+	/* Summing up keeps the hash independent of the UUID order */
+	for (l = uuids; l; l = l->next)
+		hash += g_str_hash(l->data);
+
+	/* Zero is reserved for no EIR seen */
+	return hash ? hash : 1;
+}
+
+void device_update_eir_hash(struct btd_device *dev, GSList *uuids)
+{
+	if (!uuids)
+		return;
+
+	dev->eir_hash = eir_uuids_hash(uuids);
+
+	if (!dev->svc_cache_time || dev->svc_cache_stale)
+		return;
+
+	/* Services resolved without EIR take the first one as reference */
+	if (!dev->svc_cache_eir) {
+		dev->svc_cache_eir = dev->eir_hash;
+		return;
+	}
+
+	if (dev->svc_cache_eir == dev->eir_hash)
+		return;
+
+	DBG("%s EIR services changed", dev->path);
+
+	dev->svc_cache_stale = true;
+}
+
+/*
+ * Global budget for discovery updates, shared by all devices. Each update
+ * moves the theoretical arrival time ahead by one period and up to one
+ * second worth of updates may be sent in a burst.
+ */
+static int64_t discov_budget_tat;
+
+static int64_t discov_budget_wait(int64_t now)
+{
+	int64_t period, burst;
+
+	if (!main_opts.discov_limit)
+		return 0;
+
+	period = G_USEC_PER_SEC / main_opts.discov_limit;
+	burst = G_USEC_PER_SEC - period;
+
+	if (discov_budget_tat < now)
+		discov_budget_tat = now;
+
+	if (discov_budget_tat - now > burst)
+		return discov_budget_tat - now - burst;
+
+	discov_budget_tat += period;
+
+	return 0;
+}
+
+static gboolean discov_emit(gpointer user_data);
+
+static void discov_schedule(struct btd_device *dev, int64_t delay)
+{
+	guint msec = (delay + 999) / 1000;
+
+	dev->discov_emit_id = g_timeout_add(msec ? msec : 1, discov_emit, dev);
+}
+
+static gboolean discov_emit(gpointer user_data)
+{
+	struct btd_device *dev = user_data;
+	int64_t now = g_get_monotonic_time();
+	int64_t delay;
+	unsigned int i;
+
+	dev->discov_emit_id = 0;
+
+	delay = discov_budget_wait(now);
+	if (delay > 0) {
+		discov_schedule(dev, delay);
+		return FALSE;
+	}
+
+	/* The getters report the latest values, not the coalesced ones */
+	for (i = 0; i < G_N_ELEMENTS(discov_prop_names); i++) {
+		if (!(dev->discov_pending & (1 << i)))
+			continue;
+
+		g_dbus_emit_property_changed(dbus_conn, dev->path,
+					DEVICE_INTERFACE, discov_prop_names[i]);
+	}
+
+	dev->discov_pending = 0;
+	dev->discov_emitted = now;
+
+	return FALSE;
+}
+
+static void discov_property_changed(struct btd_device *dev, uint8_t prop)
+{
+	int64_t now, delay;
+
+	if (!main_opts.discov_interval && !main_opts.discov_limit) {
+		dev->discov_pending = prop;
+		discov_emit(dev);
+		return;
+	}
+
+	dev->discov_pending |= prop;
+
+	if (dev->discov_emit_id)
+		return;
+
+	/* Each device emits at most once per update interval */
+	now = g_get_monotonic_time();
+	delay = dev->discov_emitted +
+			(int64_t) main_opts.discov_interval * 1000 - now;
+
+	if (!dev->discov_emitted || delay <= 0) {
+		discov_emit(dev);
+		return;
+	}
+
+	discov_schedule(dev, delay);
+}
+
 static void add_manufacturer_data(void *data, void *user_data)
 {
 	struct eir_msd *msd = data;
@@ -1619,8 +1948,7 @@ static void add_manufacturer_data(void *data, void *user_data)
 								msd->data_len))
 		return;
 
-	g_dbus_emit_property_changed(dbus_conn, dev->path,
-					DEVICE_INTERFACE, "ManufacturerData");
+	discov_property_changed(dev, DISCOV_PROP_MANUFACTURER_DATA);
 }
 
 void device_set_manufacturer_data(struct btd_device *dev, GSList *list,
@@ -1644,8 +1972,7 @@ static void add_service_data(void *data, void *user_data)
 	if (!bt_ad_add_service_data(dev->ad, &uuid, sd->data, sd->data_len))
 		return;
 
-	g_dbus_emit_property_changed(dbus_conn, dev->path,
-					DEVICE_INTERFACE, "ServiceData");
+	discov_property_changed(dev, DISCOV_PROP_SERVICE_DATA);
 }
 
 void device_set_service_data(struct btd_device *dev, GSList *list,
@@ -1753,6 +2080,8 @@ static DBusMessage *connect_profiles(struct btd_device *dev, uint8_t bdaddr_type
 	if (dev->pending || dev->connect || dev->browse)
 		return btd_error_in_progress(msg);
 
+	device_load_services(dev);
+
 	if (!btd_adapter_get_powered(dev->adapter))
 		return btd_error_not_ready(msg);
 
@@ -1981,8 +2310,6 @@ static void store_services(struct btd_device *device)
 	char *prim_uuid;
 	GKeyFile *key_file;
 	GSList *l;
-	char *data;
-	gsize length = 0;
 
 	if (device_address_is_private(device)) {
 		warn("Can't store services for private addressed device %s",
@@ -2034,133 +2361,54 @@ static void store_services(struct btd_device *device)
 					primary->range.end);
 	}
 
-	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
+	storage_save(filename, key_file);
 
 	free(prim_uuid);
-	g_free(data);
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
-struct gatt_saver {
-	struct btd_device *device;
-	uint16_t ext_props;
-	GKeyFile *key_file;
-};
-
-static void store_desc(struct gatt_db_attribute *attr, void *user_data)
+static void get_db_hash_attr(struct gatt_db_attribute *attr, void *user_data)
 {
-	struct gatt_saver *saver = user_data;
-	GKeyFile *key_file = saver->key_file;
-	char handle[6], value[100], uuid_str[MAX_LEN_UUID_STR];
-	const bt_uuid_t *uuid;
-	bt_uuid_t ext_uuid;
-	uint16_t handle_num;
+	struct gatt_db_attribute **hash = user_data;
 
-	handle_num = gatt_db_attribute_get_handle(attr);
-	sprintf(handle, "%04hx", handle_num);
-
-	uuid = gatt_db_attribute_get_type(attr);
-	bt_uuid_to_string(uuid, uuid_str, sizeof(uuid_str));
-
-	bt_uuid16_create(&ext_uuid, GATT_CHARAC_EXT_PROPER_UUID);
-	if (!bt_uuid_cmp(uuid, &ext_uuid) && saver->ext_props)
-		sprintf(value, "%04hx:%s", saver->ext_props, uuid_str);
-	else
-		sprintf(value, "%s", uuid_str);
-
-	g_key_file_set_string(key_file, "Attributes", handle, value);
+	if (!*hash)
+		*hash = attr;
 }
 
-static void store_chrc(struct gatt_db_attribute *attr, void *user_data)
+static struct gatt_db_attribute *find_db_hash(struct gatt_db *db)
 {
-	struct gatt_saver *saver = user_data;
-	GKeyFile *key_file = saver->key_file;
-	char handle[6], value[100], uuid_str[MAX_LEN_UUID_STR];
-	uint16_t handle_num, value_handle;
-	uint8_t properties;
+	struct gatt_db_attribute *attr = NULL;
 	bt_uuid_t uuid;
 
-	if (!gatt_db_attribute_get_char_data(attr, &handle_num, &value_handle,
-						&properties, &saver->ext_props,
-						&uuid)) {
-		warn("Error storing characteristic - can't get data");
-		return;
-	}
-
-	sprintf(handle, "%04hx", handle_num);
-	bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
-	sprintf(value, GATT_CHARAC_UUID_STR ":%04hx:%02hhx:%s", value_handle,
-							properties, uuid_str);
-	g_key_file_set_string(key_file, "Attributes", handle, value);
+	bt_uuid16_create(&uuid, GATT_CHARAC_DB_HASH);
+	gatt_db_find_by_type(db, 0x0001, 0xffff, &uuid, get_db_hash_attr,
+									&attr);
 
-	gatt_db_service_foreach_desc(attr, store_desc, saver);
+	return attr;
 }
 
-static void store_incl(struct gatt_db_attribute *attr, void *user_data)
+static void gatt_cache_filename(char *filename, const char *local,
+							const char *peer)
 {
-	struct gatt_saver *saver = user_data;
-	GKeyFile *key_file = saver->key_file;
-	struct gatt_db_attribute *service;
-	char handle[6], value[100], uuid_str[MAX_LEN_UUID_STR];
-	uint16_t handle_num, start, end;
-	bt_uuid_t uuid;
-
-	if (!gatt_db_attribute_get_incl_data(attr, &handle_num, &start, &end)) {
-		warn("Error storing included service - can't get data");
-		return;
-	}
-
-	service = gatt_db_get_attribute(saver->device->db, start);
-	if (!service) {
-		warn("Error storing included service - can't find it");
-		return;
-	}
-
-	sprintf(handle, "%04hx", handle_num);
-
-	gatt_db_attribute_get_service_uuid(service, &uuid);
-	bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
-	sprintf(value, GATT_INCLUDE_UUID_STR ":%04hx:%04hx:%s", start,
-								end, uuid_str);
-
-	g_key_file_set_string(key_file, "Attributes", handle, value);
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s.gatt", local,
+									peer);
 }
 
-static void store_service(struct gatt_db_attribute *attr, void *user_data)
+/* Older versions kept the database in the text cache file */
+static void remove_gatt_db_text(const char *filename)
 {
-	struct gatt_saver *saver = user_data;
-	GKeyFile *key_file = saver->key_file;
-	char uuid_str[MAX_LEN_UUID_STR], handle[6], value[256];
-	uint16_t start, end;
-	bt_uuid_t uuid;
-	bool primary;
-	char *type;
-
-	if (!gatt_db_attribute_get_service_data(attr, &start, &end, &primary,
-								&uuid)) {
-		warn("Error storing service - can't get data");
-		return;
-	}
-
-	sprintf(handle, "%04hx", start);
-
-	bt_uuid_to_string(&uuid, uuid_str, sizeof(uuid_str));
-
-	if (primary)
-		type = GATT_PRIM_SVC_UUID_STR;
-	else
-		type = GATT_SND_SVC_UUID_STR;
+	GKeyFile *key_file;
 
-	sprintf(value, "%s:%04hx:%s", type, end, uuid_str);
+	key_file = storage_load(filename);
 
-	g_key_file_set_string(key_file, "Attributes", handle, value);
+	if (g_key_file_has_group(key_file, "Attributes") ||
+				g_key_file_has_group(key_file, "Cache")) {
+		g_key_file_remove_group(key_file, "Attributes", NULL);
+		g_key_file_remove_group(key_file, "Cache", NULL);
+		storage_save(filename, key_file);
+	}
 
-	gatt_db_service_foreach_incl(attr, store_incl, saver);
-	gatt_db_service_foreach_char(attr, store_chrc, saver);
+	g_key_file_unref(key_file);
 }
 
 static void store_gatt_db(struct btd_device *device)
@@ -2168,10 +2416,6 @@ static void store_gatt_db(struct btd_device *device)
 	struct btd_adapter *adapter = device->adapter;
 	char filename[PATH_MAX];
 	char src_addr[18], dst_addr[18];
-	GKeyFile *key_file;
-	char *data;
-	gsize length = 0;
-	struct gatt_saver saver;
 
 	if (device_address_is_private(device)) {
 		warn("Can't store GATT db for private addressed device %s",
@@ -2185,26 +2429,19 @@ static void store_gatt_db(struct btd_device *device)
 	ba2str(btd_adapter_get_address(adapter), src_addr);
 	ba2str(&device->bdaddr, dst_addr);
 
-	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", src_addr,
-								dst_addr);
+	gatt_cache_filename(filename, src_addr, dst_addr);
 	create_file(filename, S_IRUSR | S_IWUSR);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
-
-	/* Remove current attributes since it might have changed */
-	g_key_file_remove_group(key_file, "Attributes", NULL);
-
-	saver.key_file = key_file;
-	saver.device = device;
-
-	gatt_db_foreach_service(device->db, NULL, store_service, &saver);
+	if (!gatt_cache_save(device->db, filename)) {
+		warn("Unable to store gatt db for %s", dst_addr);
+		return;
+	}
 
-	data = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, data, length, NULL);
+	btd_metrics_inc(BTD_METRIC_STORAGE_WRITES);
 
-	g_free(data);
-	g_key_file_free(key_file);
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", src_addr,
+								dst_addr);
+	remove_gatt_db_text(filename);
 }
 
 
@@ -2634,6 +2871,9 @@ static const GDBusPropertyTable device_properties[] = {
 	{ "AdvertisingFlags", "ay", dev_property_get_flags, NULL,
 					dev_property_flags_exist,
 					G_DBUS_PROPERTY_FLAG_EXPERIMENTAL},
+	{ "ConnectionPolicy", "s", dev_property_get_conn_policy,
+					dev_property_set_conn_policy, NULL,
+					G_DBUS_PROPERTY_FLAG_EXPERIMENTAL },
 
 	{ }
 };
@@ -2648,9 +2888,16 @@ bool btd_device_is_connected(struct btd_device *dev)
 	return dev->bredr_state.connected || dev->le_state.connected;
 }
 
+bool btd_device_get_att_stats(struct btd_device *dev,
+					struct bt_att_pdu_stats *stats)
+{
+	return bt_att_get_pdu_stats(dev->att, stats);
+}
+
 void device_add_connection(struct btd_device *dev, uint8_t bdaddr_type)
 {
 	struct bearer_state *state = get_state(dev, bdaddr_type);
+	bdaddr_t old_bdaddr;
 
 	device_update_last_seen(dev, bdaddr_type);
 
@@ -2661,9 +2908,14 @@ void device_add_connection(struct btd_device *dev, uint8_t bdaddr_type)
 		return;
 	}
 
+	device_load_services(dev);
+
+	bacpy(&old_bdaddr, &dev->conn_bdaddr);
 	bacpy(&dev->conn_bdaddr, &dev->bdaddr);
 	dev->conn_bdaddr_type = dev->bdaddr_type;
 
+	btd_adapter_update_device_addr(dev->adapter, dev, &old_bdaddr);
+
 	/* If this is the first connection over this bearer */
 	if (bdaddr_type == BDADDR_BREDR)
 		device_set_bredr_support(dev);
@@ -2672,6 +2924,9 @@ void device_add_connection(struct btd_device *dev, uint8_t bdaddr_type)
 
 	state->connected = true;
 
+	dev->last_connected = time(NULL);
+	store_device_info(dev);
+
 	if (dev->le_state.connected && dev->bredr_state.connected)
 		return;
 
@@ -2764,10 +3019,7 @@ static char *load_cached_name(struct btd_device *device, const char *local,
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
 
-	key_file = g_key_file_new();
-
-	if (!g_key_file_load_from_file(key_file, filename, 0, NULL))
-		goto failed;
+	key_file = storage_load(filename);
 
 	str = g_key_file_get_string(key_file, "General", "Name", NULL);
 	if (str) {
@@ -2776,8 +3028,7 @@ static char *load_cached_name(struct btd_device *device, const char *local,
 			str[HCI_MAX_NAME_LENGTH] = '\0';
 	}
 
-failed:
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 
 	return str;
 }
@@ -2838,8 +3089,6 @@ static void convert_info(struct btd_device *device, GKeyFile *key_file)
 	char adapter_addr[18];
 	char device_addr[18];
 	char **uuids;
-	char *str;
-	gsize length = 0;
 
 	/* Load device profile list from legacy properties */
 	uuids = g_key_file_get_string_list(key_file, "General", "SDPServices",
@@ -2864,9 +3113,7 @@ static void convert_info(struct btd_device *device, GKeyFile *key_file)
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info", adapter_addr,
 			device_addr);
 
-	str = g_key_file_to_data(key_file, &length, NULL);
-	g_file_set_contents(filename, str, length, NULL);
-	g_free(str);
+	storage_save(filename, key_file);
 
 	store_device_info(device);
 }
@@ -2963,6 +3210,18 @@ next:
 	if (blocked)
 		device_block(device, FALSE);
 
+	/* Load connection parameter policy */
+	str = g_key_file_get_string(key_file, "General", "ConnectionPolicy",
+									NULL);
+	if (str) {
+		btd_conn_policy_from_str(str, &device->conn_policy);
+		g_free(str);
+	}
+
+	/* Load last connection time */
+	device->last_connected = g_key_file_get_uint64(key_file, "General",
+						"LastConnected", NULL);
+
 	/* Load device profile list */
 	uuids = g_key_file_get_string_list(key_file, "General", "Services",
 						NULL, NULL);
@@ -3010,8 +3269,7 @@ static void load_att_info(struct btd_device *device, const char *local,
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/attributes", local,
 			peer);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_load(filename);
 	groups = g_key_file_get_groups(key_file, NULL);
 
 	for (handle = groups; *handle; handle++) {
@@ -3076,7 +3334,7 @@ static void load_att_info(struct btd_device *device, const char *local,
 	}
 
 	g_strfreev(groups);
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 	free(prim_uuid);
 }
 
@@ -3352,34 +3610,103 @@ static int load_gatt_db_impl(GKeyFile *key_file, char **keys,
 	return 0;
 }
 
-static void load_gatt_db(struct btd_device *device, const char *local,
-							const char *peer)
+static void db_hash_write_cb(struct gatt_db_attribute *attrib, int err,
+							void *user_data)
 {
-	char **keys, filename[PATH_MAX];
-	GKeyFile *key_file;
+}
 
-	if (!gatt_cache_is_enabled(device))
-		return;
+static void load_db_hash(struct btd_device *device, GKeyFile *key_file)
+{
+	struct gatt_db_attribute *attr;
+	uint8_t hash[GATT_DB_HASH_LEN];
+	char *str;
+	int i;
 
-	DBG("Restoring %s gatt database from file", peer);
+	str = g_key_file_get_string(key_file, "Cache", "DatabaseHash", NULL);
+	if (!str)
+		return;
+
+	if (strlen(str) != GATT_DB_HASH_LEN * 2)
+		goto done;
+
+	for (i = 0; i < GATT_DB_HASH_LEN; i++) {
+		if (sscanf(str + (i * 2), "%2hhx", &hash[i]) != 1)
+			goto done;
+	}
+
+	attr = find_db_hash(device->db);
+	if (attr)
+		gatt_db_attribute_write(attr, 0, hash, sizeof(hash), 0, NULL,
+						db_hash_write_cb, NULL);
+
+done:
+	g_free(str);
+}
+
+static bool load_gatt_db_text(struct btd_device *device, const char *local,
+							const char *peer)
+{
+	char **keys, filename[PATH_MAX];
+	GKeyFile *key_file;
+	int version;
+	bool loaded = false;
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_load(filename);
+
+	/* Caches written before versioning have the same layout as v1 */
+	version = g_key_file_get_integer(key_file, "Cache", "Version", NULL);
+	if (version > GATT_CACHE_VERSION) {
+		warn("Unsupported cache version %d for %s", version, peer);
+		g_key_file_unref(key_file);
+		return false;
+	}
+
 	keys = g_key_file_get_keys(key_file, "Attributes", NULL, NULL);
 
 	if (!keys) {
 		warn("No cache for %s", peer);
-		g_key_file_free(key_file);
-		return;
+		g_key_file_unref(key_file);
+		return false;
 	}
 
-	if (load_gatt_db_impl(key_file, keys, device->db))
+	if (load_gatt_db_impl(key_file, keys, device->db)) {
 		warn("Unable to load gatt db from file for %s", peer);
+	} else {
+		load_db_hash(device, key_file);
+		loaded = true;
+	}
 
 	g_strfreev(keys);
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
+
+	return loaded;
+}
+
+static void load_gatt_db(struct btd_device *device, const char *local,
+							const char *peer)
+{
+	char filename[PATH_MAX];
+
+	if (!gatt_cache_is_enabled(device))
+		return;
+
+	DBG("Restoring %s gatt database from file", peer);
+
+	gatt_cache_filename(filename, local, peer);
+
+	if (!gatt_cache_load(device->db, filename)) {
+		if (!load_gatt_db_text(device, local, peer))
+			return;
+
+		/* Convert the database to the new format */
+		if (gatt_cache_save(device->db, filename)) {
+			snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s",
+								local, peer);
+			remove_gatt_db_text(filename);
+		}
+	}
 
 	g_slist_free_full(device->primaries, g_free);
 	device->primaries = NULL;
@@ -3483,8 +3810,13 @@ static void device_accept_gatt_profiles(struct btd_device *device)
 {
 	GSList *l;
 
+	/* Let the profiles' initial reads go out together */
+	bt_gatt_batch_hold(device->gatt_batch);
+
 	for (l = device->services; l != NULL; l = g_slist_next(l))
 		service_accept(l->data);
+
+	bt_gatt_batch_release(device->gatt_batch);
 }
 
 static void device_remove_gatt_service(struct btd_device *device,
@@ -3650,6 +3982,7 @@ static struct btd_device *device_new(struct btd_adapter *adapter,
 		return NULL;
 
 	device->tx_power = 127;
+	device->conn_policy = main_opts.conn_policy;
 
 	device->db = gatt_db_new();
 	if (!device->db) {
@@ -3657,6 +3990,8 @@ static struct btd_device *device_new(struct btd_adapter *adapter,
 		return NULL;
 	}
 
+	btd_metrics_inc(BTD_METRIC_DEVICES);
+
 	memset(device->ad_flags, INVALID_FLAGS, sizeof(device->ad_flags));
 
 	device->ad = bt_ad_new();
@@ -3719,6 +4054,15 @@ struct btd_device *device_create_from_storage(struct btd_adapter *adapter,
 	convert_info(device, key_file);
 
 	load_info(device, srcaddr, address, key_file);
+
+	svc_cache_load(device, srcaddr, address);
+
+	/* Services are loaded once the device is connected or used */
+	if (main_opts.lazy_devices) {
+		device->services_pending = true;
+		return device;
+	}
+
 	load_att_info(device, srcaddr, address);
 
 	return device;
@@ -3833,6 +4177,8 @@ void device_set_class(struct btd_device *device, uint32_t class)
 void device_update_addr(struct btd_device *device, const bdaddr_t *bdaddr,
 							uint8_t bdaddr_type)
 {
+	bdaddr_t old_bdaddr;
+
 	if (!bacmp(bdaddr, &device->bdaddr) &&
 					bdaddr_type == device->bdaddr_type)
 		return;
@@ -3842,9 +4188,12 @@ void device_update_addr(struct btd_device *device, const bdaddr_t *bdaddr,
 	 */
 	device->le = true;
 
+	bacpy(&old_bdaddr, &device->bdaddr);
 	bacpy(&device->bdaddr, bdaddr);
 	device->bdaddr_type = bdaddr_type;
 
+	btd_adapter_update_device_addr(device->adapter, device, &old_bdaddr);
+
 	store_device_info(device);
 
 	g_dbus_emit_property_changed(dbus_conn, device->path,
@@ -3871,6 +4220,11 @@ void device_set_le_support(struct btd_device *device, uint8_t bdaddr_type)
 	store_device_info(device);
 }
 
+time_t device_get_last_connected(struct btd_device *device)
+{
+	return device->last_connected;
+}
+
 void device_update_last_seen(struct btd_device *device, uint8_t bdaddr_type)
 {
 	if (bdaddr_type == BDADDR_BREDR)
@@ -3879,6 +4233,55 @@ void device_update_last_seen(struct btd_device *device, uint8_t bdaddr_type)
 		device->le_seen = time(NULL);
 }
 
+/*
+ * A hash of 0 means the last report hasn't been fully processed.
+ *
+ * During active scanning LE reports can alternate between advertising
+ * data and scan responses, which Device Found events don't tell apart.
+ * So the two most recent distinct LE payloads are kept, along with the
+ * AD types each contains. The older one only counts as unchanged when the
+ * newer payload carries none of its types, since otherwise the newer one
+ * has overwritten values derived from it.
+ */
+void device_set_adv_hash(struct btd_device *device, uint8_t bdaddr_type,
+						uint32_t hash, uint64_t types)
+{
+	if (bdaddr_type == BDADDR_BREDR) {
+		device->bredr_adv_hash = hash;
+		return;
+	}
+
+	if (!hash) {
+		memset(device->le_adv_hash, 0, sizeof(device->le_adv_hash));
+		memset(device->le_adv_types, 0, sizeof(device->le_adv_types));
+		return;
+	}
+
+	if (device->le_adv_hash[0] != hash) {
+		device->le_adv_hash[1] = device->le_adv_hash[0];
+		device->le_adv_types[1] = device->le_adv_types[0];
+		device->le_adv_hash[0] = hash;
+	}
+
+	device->le_adv_types[0] = types;
+}
+
+bool device_adv_hash_match(struct btd_device *device, uint8_t bdaddr_type,
+							uint32_t hash)
+{
+	if (!hash)
+		return false;
+
+	if (bdaddr_type == BDADDR_BREDR)
+		return device->bredr_adv_hash == hash;
+
+	if (device->le_adv_hash[0] == hash)
+		return true;
+
+	return device->le_adv_hash[1] == hash &&
+		!(device->le_adv_types[0] & device->le_adv_types[1]);
+}
+
 /* It is possible that we have two device objects for the same device in
  * case it has first been discovered over BR/EDR and has a private
  * address when discovered over LE for the first time. In such a case we
@@ -3896,6 +4299,7 @@ void device_merge_duplicate(struct btd_device *dev, struct btd_device *dup)
 
 	dev->trusted = dup->trusted;
 	dev->blocked = dup->blocked;
+	dev->conn_policy = dup->conn_policy;
 
 	for (l = dup->uuids; l; l = g_slist_next(l))
 		dev->uuids = g_slist_append(dev->uuids, g_strdup(l->data));
@@ -3969,6 +4373,96 @@ static void delete_folder_tree(const char *dirname)
 	rmdir(dirname);
 }
 
+static void sdp_cache_filename(char *filename, const char *local,
+							const char *peer)
+{
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s.sdp", local,
+									peer);
+}
+
+/* Older versions kept the records as hex strings in the text cache file */
+static bool load_sdp_records_text(struct sdp_cache *cache,
+						const char *filename)
+{
+	GKeyFile *key_file;
+	char **keys, **handle;
+	bool loaded = false;
+
+	key_file = storage_load(filename);
+	keys = g_key_file_get_keys(key_file, "ServiceRecords", NULL, NULL);
+
+	for (handle = keys; handle && *handle; handle++) {
+		sdp_record_t *rec;
+		char *str;
+
+		str = g_key_file_get_string(key_file, "ServiceRecords",
+							*handle, NULL);
+		if (!str)
+			continue;
+
+		rec = record_from_string(str);
+		g_free(str);
+
+		if (!rec)
+			continue;
+
+		if (sdp_cache_add_record(cache, rec))
+			loaded = true;
+
+		sdp_record_free(rec);
+	}
+
+	g_strfreev(keys);
+	g_key_file_unref(key_file);
+
+	return loaded;
+}
+
+static void remove_sdp_records_text(const char *filename)
+{
+	GKeyFile *key_file;
+
+	key_file = storage_load(filename);
+
+	if (g_key_file_remove_group(key_file, "ServiceRecords", NULL))
+		storage_save(filename, key_file);
+
+	g_key_file_unref(key_file);
+}
+
+static struct sdp_cache *device_get_sdp_cache(struct btd_device *device)
+{
+	char local[18], peer[18];
+	char filename[PATH_MAX];
+	char text_file[PATH_MAX];
+	struct sdp_cache *cache;
+
+	if (device->sdp_cache)
+		return device->sdp_cache;
+
+	ba2str(btd_adapter_get_address(device->adapter), local);
+	ba2str(&device->bdaddr, peer);
+
+	sdp_cache_filename(filename, local, peer);
+
+	cache = sdp_cache_load(filename);
+	if (!cache) {
+		cache = sdp_cache_new();
+
+		snprintf(text_file, PATH_MAX, STORAGEDIR "/%s/cache/%s",
+								local, peer);
+
+		/* Convert the records to the new format */
+		if (load_sdp_records_text(cache, text_file) &&
+					sdp_cache_save(cache, filename))
+			remove_sdp_records_text(text_file);
+	}
+
+	device->sdp_cache = cache;
+
+	return cache;
+}
+
 static void device_remove_stored(struct btd_device *device)
 {
 	const bdaddr_t *src = btd_adapter_get_address(device->adapter);
@@ -3976,8 +4470,6 @@ static void device_remove_stored(struct btd_device *device)
 	char device_addr[18];
 	char filename[PATH_MAX];
 	GKeyFile *key_file;
-	char *data;
-	gsize length = 0;
 
 	if (device->bredr_state.bonded) {
 		device->bredr_state.bonded = false;
@@ -4002,23 +4494,26 @@ static void device_remove_stored(struct btd_device *device)
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s", adapter_addr,
 			device_addr);
+	storage_remove(filename);
 	delete_folder_tree(filename);
 
+	sdp_cache_filename(filename, adapter_addr, device_addr);
+	unlink(filename);
+
+	sdp_cache_free(device->sdp_cache);
+	device->sdp_cache = NULL;
+
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", adapter_addr,
 			device_addr);
 
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	key_file = storage_load(filename);
 	g_key_file_remove_group(key_file, "ServiceRecords", NULL);
+	g_key_file_remove_group(key_file, "ServiceCache", NULL);
+	g_key_file_remove_group(key_file, "Endpoints", NULL);
 
-	data = g_key_file_to_data(key_file, &length, NULL);
-	if (length > 0) {
-		create_file(filename, S_IRUSR | S_IWUSR);
-		g_file_set_contents(filename, data, length, NULL);
-	}
+	storage_save(filename, key_file);
 
-	g_free(data);
-	g_key_file_free(key_file);
+	g_key_file_unref(key_file);
 }
 
 void device_remove(struct btd_device *device, gboolean remove_stored)
@@ -4177,6 +4672,10 @@ static struct btd_service *probe_service(struct btd_device *device,
 	if (!device_match_profile(device, profile, uuids))
 		return NULL;
 
+	/* A profile registered while probing has already been added */
+	if (find_service_with_profile(device->services, profile))
+		return NULL;
+
 	service = service_create(device, profile);
 
 	if (service_probe(service)) {
@@ -4193,6 +4692,17 @@ static struct btd_service *probe_service(struct btd_device *device,
 	return service;
 }
 
+static void dev_match_auto_connect(struct btd_profile *p, void *user_data)
+{
+	struct probe_data *d = user_data;
+
+	if (!p->device_probe || !p->auto_connect || !p->accept)
+		return;
+
+	if (device_match_profile(d->dev, p, d->uuids))
+		device_set_auto_connect(d->dev, TRUE);
+}
+
 static void dev_probe(struct btd_profile *p, void *user_data)
 {
 	struct probe_data *d = user_data;
@@ -4211,6 +4721,10 @@ void device_probe_profile(gpointer a, gpointer b)
 	struct btd_profile *profile = b;
 	struct btd_service *service;
 
+	/* The profile is probed along with the others once loaded */
+	if (device->services_pending)
+		return;
+
 	service = probe_service(device, profile, device->uuids);
 	if (!service)
 		return;
@@ -4247,14 +4761,28 @@ void device_probe_profiles(struct btd_device *device, GSList *uuids)
 {
 	struct probe_data d = { device, uuids };
 	char addr[18];
+	GSList *l;
 
 	ba2str(&device->bdaddr, addr);
 
+	/* Deferred plugins register their profiles as they start up */
+	for (l = uuids; l; l = g_slist_next(l))
+		plugin_require_uuid(l->data);
+
 	if (device->blocked) {
 		DBG("Skipping profiles for blocked device %s", addr);
 		goto add_uuids;
 	}
 
+	/*
+	 * Devices need to be connected to for loading their services, so
+	 * the ones with auto connect profiles still have to be marked.
+	 */
+	if (device->services_pending) {
+		btd_profile_foreach(dev_match_auto_connect, &d);
+		goto add_uuids;
+	}
+
 	DBG("Probing profiles for device %s", addr);
 
 	btd_profile_foreach(dev_probe, &d);
@@ -4263,29 +4791,23 @@ add_uuids:
 	device_add_uuids(device, uuids);
 }
 
-static void store_sdp_record(GKeyFile *key_file, sdp_record_t *rec)
+static void device_load_services(struct btd_device *device)
 {
-	char handle_str[11];
-	sdp_buf_t buf;
-	int size, i;
-	char *str;
-
-	sprintf(handle_str, "0x%8.8X", rec->handle);
+	char srcaddr[18], dstaddr[18];
 
-	if (sdp_gen_record_pdu(rec, &buf) < 0)
+	if (!device->services_pending)
 		return;
 
-	size = buf.data_size;
+	device->services_pending = false;
 
-	str = g_malloc0(size*2+1);
+	DBG("Loading services for device %s", device->path);
 
-	for (i = 0; i < size; i++)
-		sprintf(str + (i * 2), "%02X", buf.data[i]);
+	ba2str(btd_adapter_get_address(device->adapter), srcaddr);
+	ba2str(&device->bdaddr, dstaddr);
 
-	g_key_file_set_string(key_file, "ServiceRecords", handle_str, str);
+	load_att_info(device, srcaddr, dstaddr);
 
-	free(buf.data);
-	g_free(str);
+	device_probe_profiles(device, device->uuids);
 }
 
 static void store_primaries_from_sdp_record(GKeyFile *key_file,
@@ -4376,25 +4898,18 @@ static void update_bredr_services(struct browse_req *req, sdp_list_t *recs)
 	char srcaddr[18], dstaddr[18];
 	char sdp_file[PATH_MAX];
 	char att_file[PATH_MAX];
-	GKeyFile *sdp_key_file;
+	struct sdp_cache *sdp_cache;
 	GKeyFile *att_key_file;
-	char *data;
-	gsize length = 0;
 
 	ba2str(btd_adapter_get_address(device->adapter), srcaddr);
 	ba2str(&device->bdaddr, dstaddr);
 
-	snprintf(sdp_file, PATH_MAX, STORAGEDIR "/%s/cache/%s", srcaddr,
-								dstaddr);
-
-	sdp_key_file = g_key_file_new();
-	g_key_file_load_from_file(sdp_key_file, sdp_file, 0, NULL);
+	sdp_cache = device_get_sdp_cache(device);
 
 	snprintf(att_file, PATH_MAX, STORAGEDIR "/%s/%s/attributes", srcaddr,
 								dstaddr);
 
-	att_key_file = g_key_file_new();
-	g_key_file_load_from_file(att_key_file, att_file, 0, NULL);
+	att_key_file = storage_load(att_file);
 
 	for (seq = recs; seq; seq = seq->next) {
 		sdp_record_t *rec = (sdp_record_t *) seq->data;
@@ -4444,8 +4959,7 @@ static void update_bredr_services(struct browse_req *req, sdp_list_t *recs)
 		if (update_record(req, profile_uuid, rec) < 0)
 			goto next;
 
-		if (sdp_key_file)
-			store_sdp_record(sdp_key_file, rec);
+		sdp_cache_add_record(sdp_cache, rec);
 
 		if (att_key_file)
 			store_primaries_from_sdp_record(att_key_file, rec);
@@ -4455,26 +4969,19 @@ next:
 		sdp_list_free(svcclass, free);
 	}
 
-	if (sdp_key_file) {
-		data = g_key_file_to_data(sdp_key_file, &length, NULL);
-		if (length > 0) {
-			create_file(sdp_file, S_IRUSR | S_IWUSR);
-			g_file_set_contents(sdp_file, data, length, NULL);
-		}
+	if (sdp_cache_count(sdp_cache)) {
+		sdp_cache_filename(sdp_file, srcaddr, dstaddr);
+		create_file(sdp_file, S_IRUSR | S_IWUSR);
 
-		g_free(data);
-		g_key_file_free(sdp_key_file);
+		if (sdp_cache_save(sdp_cache, sdp_file))
+			btd_metrics_inc(BTD_METRIC_STORAGE_WRITES);
+		else
+			warn("Unable to store SDP records for %s", dstaddr);
 	}
 
 	if (att_key_file) {
-		data = g_key_file_to_data(att_key_file, &length, NULL);
-		if (length > 0) {
-			create_file(att_file, S_IRUSR | S_IWUSR);
-			g_file_set_contents(att_file, data, length, NULL);
-		}
-
-		g_free(data);
-		g_key_file_free(att_key_file);
+		storage_save(att_file, att_key_file);
+		g_key_file_unref(att_key_file);
 	}
 }
 
@@ -4562,6 +5069,8 @@ static void search_cb(sdp_list_t *recs, int err, gpointer user_data)
 
 	update_bredr_services(req, recs);
 
+	svc_cache_update(device);
+
 	if (device->tmp_records)
 		sdp_list_free(device->tmp_records,
 					(sdp_free_func_t) sdp_record_free);
@@ -4704,7 +5213,9 @@ static void register_gatt_services(struct btd_device *device)
 
 	device_register_primaries(device, services, -1);
 
+	bt_gatt_batch_hold(device->gatt_batch);
 	device_add_gatt_services(device);
+	bt_gatt_batch_release(device->gatt_batch);
 }
 
 static void gatt_client_init(struct btd_device *device);
@@ -4722,6 +5233,9 @@ static void gatt_client_ready_cb(bool success, uint8_t att_ecode,
 		return;
 	}
 
+	btd_metrics_observe(BTD_HISTOGRAM_GATT_DISCOVERY,
+				g_get_monotonic_time() - device->gatt_start);
+
 	register_gatt_services(device);
 
 	btd_gatt_client_ready(device->client_dbus);
@@ -4735,7 +5249,12 @@ static void gatt_client_service_changed(uint16_t start_handle,
 							uint16_t end_handle,
 							void *user_data)
 {
+	struct btd_device *device = user_data;
+
 	DBG("start 0x%04x, end: 0x%04x", start_handle, end_handle);
+
+	/* The SDP records might have changed along with the database */
+	device->svc_cache_stale = true;
 }
 
 static void gatt_debug(const char *str, void *user_data)
@@ -4747,8 +5266,16 @@ static void gatt_client_init(struct btd_device *device)
 {
 	gatt_client_cleanup(device);
 
-	device->client = bt_gatt_client_new(device->db, device->att,
-							device->att_mtu);
+	device->gatt_start = g_get_monotonic_time();
+
+	/*
+	 * Bonded devices shall indicate Service Changed on reconnection so
+	 * their cached database can be used without rediscovering it.
+	 */
+	device->client = bt_gatt_client_new_cached(device->db, device->att,
+					device->att_mtu,
+					device_is_bonded(device,
+							device->bdaddr_type));
 	if (!device->client) {
 		DBG("Failed to initialize");
 		return;
@@ -4756,6 +5283,8 @@ static void gatt_client_init(struct btd_device *device)
 
 	bt_gatt_client_set_debug(device->client, gatt_debug, NULL, NULL);
 
+	device->gatt_batch = bt_gatt_batch_new(device->client);
+
 	/*
 	 * Notify notify existing service about the new connection so they can
 	 * react to notifications while discovering services
@@ -4837,6 +5366,8 @@ bool device_attach_att(struct btd_device *dev, GIOChannel *io)
 	const bdaddr_t *src, *dst;
 	char srcaddr[18], dstaddr[18];
 
+	device_load_services(dev);
+
 	bt_io_get(io, &gerr, BT_IO_OPT_SEC_LEVEL, &sec_level,
 						BT_IO_OPT_IMTU, &mtu,
 						BT_IO_OPT_CID, &cid,
@@ -4899,6 +5430,8 @@ bool device_attach_att(struct btd_device *dev, GIOChannel *io)
 	gatt_client_init(dev);
 	gatt_server_init(dev, btd_gatt_database_get_db(database));
 
+	dev->conn_mgr = btd_conn_policy_new(dev, dev->conn_policy);
+
 	/*
 	 * Remove the device from the connect_list and give the passive
 	 * scanning another chance to be restarted in case there are
@@ -4998,6 +5531,9 @@ int device_connect_le(struct btd_device *dev)
 	else
 		sec_level = BT_IO_SEC_LOW;
 
+	/* The kernel scans with the adapter parameters until it connects */
+	btd_adapter_scan_boost(adapter);
+
 	/*
 	 * This connection will help us catch any PDUs that comes before
 	 * pairing finishes
@@ -5193,6 +5729,11 @@ const bdaddr_t *device_get_address(struct btd_device *device)
 	return &device->bdaddr;
 }
 
+const bdaddr_t *device_get_conn_address(struct btd_device *device)
+{
+	return &device->conn_bdaddr;
+}
+
 const char *device_get_path(const struct btd_device *device)
 {
 	if (!device)
@@ -5313,8 +5854,7 @@ void device_set_rssi_with_delta(struct btd_device *device, int8_t rssi,
 		device->rssi = rssi;
 	}
 
-	g_dbus_emit_property_changed(dbus_conn, device->path,
-						DEVICE_INTERFACE, "RSSI");
+	discov_property_changed(device, DISCOV_PROP_RSSI);
 }
 
 void device_set_rssi(struct btd_device *device, int8_t rssi)
@@ -5334,8 +5874,7 @@ void device_set_tx_power(struct btd_device *device, int8_t tx_power)
 
 	device->tx_power = tx_power;
 
-	g_dbus_emit_property_changed(dbus_conn, device->path,
-						DEVICE_INTERFACE, "TxPower");
+	discov_property_changed(device, DISCOV_PROP_TX_POWER);
 }
 
 void device_set_flags(struct btd_device *device, uint8_t flags)
@@ -5350,8 +5889,7 @@ void device_set_flags(struct btd_device *device, uint8_t flags)
 
 	device->ad_flags[0] = flags;
 
-	g_dbus_emit_property_changed(dbus_conn, device->path,
-					DEVICE_INTERFACE, "AdvertisingFlags");
+	discov_property_changed(device, DISCOV_PROP_ADV_FLAGS);
 }
 
 static gboolean start_discovery(gpointer user_data)
@@ -5990,6 +6528,14 @@ struct bt_gatt_client *btd_device_get_gatt_client(struct btd_device *device)
 	return device->client;
 }
 
+struct bt_gatt_batch *btd_device_get_gatt_batch(struct btd_device *device)
+{
+	if (!device)
+		return NULL;
+
+	return device->gatt_batch;
+}
+
 void *btd_device_get_attrib(struct btd_device *device)
 {
 	if (!device)
@@ -6037,42 +6583,6 @@ void btd_device_add_uuid(struct btd_device *device, const char *uuid)
 						DEVICE_INTERFACE, "UUIDs");
 }
 
-static sdp_list_t *read_device_records(struct btd_device *device)
-{
-	char local[18], peer[18];
-	char filename[PATH_MAX];
-	GKeyFile *key_file;
-	char **keys, **handle;
-	char *str;
-	sdp_list_t *recs = NULL;
-	sdp_record_t *rec;
-
-	ba2str(btd_adapter_get_address(device->adapter), local);
-	ba2str(&device->bdaddr, peer);
-
-	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", local, peer);
-
-	key_file = g_key_file_new();
-	g_key_file_load_from_file(key_file, filename, 0, NULL);
-	keys = g_key_file_get_keys(key_file, "ServiceRecords", NULL, NULL);
-
-	for (handle = keys; handle && *handle; handle++) {
-		str = g_key_file_get_string(key_file, "ServiceRecords",
-						*handle, NULL);
-		if (!str)
-			continue;
-
-		rec = record_from_string(str);
-		recs = sdp_list_append(recs, rec);
-		g_free(str);
-	}
-
-	g_strfreev(keys);
-	g_key_file_free(key_file);
-
-	return recs;
-}
-
 void btd_device_set_record(struct btd_device *device, const char *uuid,
 							const char *record)
 {
@@ -6109,14 +6619,16 @@ void btd_device_set_record(struct btd_device *device, const char *uuid,
 const sdp_record_t *btd_device_get_record(struct btd_device *device,
 							const char *uuid)
 {
-	/* Load records from storage if there is nothing in cache */
-	if (!device->tmp_records) {
-		device->tmp_records = read_device_records(device);
-		if (!device->tmp_records)
-			return NULL;
-	}
+	uuid_t sdp_uuid;
+
+	if (device->tmp_records)
+		return find_record_in_list(device->tmp_records, uuid);
 
-	return find_record_in_list(device->tmp_records, uuid);
+	/* Only the matching record is parsed from the storage cache */
+	if (bt_string2uuid(&sdp_uuid, uuid) < 0)
+		return NULL;
+
+	return sdp_cache_find(device_get_sdp_cache(device), &sdp_uuid);
 }
 
 struct btd_device *btd_device_ref(struct btd_device *device)
@@ -6215,6 +6727,8 @@ struct btd_service *btd_device_get_service(struct btd_device *dev,
 {
 	GSList *l;
 
+	device_load_services(dev);
+
 	for (l = dev->services; l != NULL; l = g_slist_next(l)) {
 		struct btd_service *service = l->data;
 		struct btd_profile *p = btd_service_get_profile(service);
@@ -6226,14 +6740,114 @@ struct btd_service *btd_device_get_service(struct btd_device *dev,
 	return NULL;
 }
 
+enum {
+	FOOTPRINT_DEVICE,
+	FOOTPRINT_GATT_DB,
+	FOOTPRINT_ATT,
+	FOOTPRINT_SDP,
+};
+
+struct footprint_walk {
+	unsigned int type;
+	struct btd_footprint *footprint;
+};
+
+static size_t str_list_footprint(GSList *list)
+{
+	size_t size = 0;
+
+	for (; list; list = list->next)
+		size += sizeof(*list) + strlen(list->data) + 1;
+
+	return size;
+}
+
+static void device_footprint(struct btd_device *device,
+					struct btd_footprint *footprint)
+{
+	footprint->objects++;
+	footprint->bytes += sizeof(*device);
+
+	if (device->path)
+		footprint->bytes += strlen(device->path) + 1;
+
+	if (device->alias)
+		footprint->bytes += strlen(device->alias) + 1;
+
+	if (device->modalias)
+		footprint->bytes += strlen(device->modalias) + 1;
+
+	footprint->bytes += str_list_footprint(device->uuids);
+	footprint->bytes += str_list_footprint(device->eir_uuids);
+	footprint->bytes += g_slist_length(device->services) * sizeof(GSList);
+}
+
+static void walk_device(struct btd_device *device, void *user_data)
+{
+	struct footprint_walk *walk = user_data;
+	struct btd_footprint *footprint = walk->footprint;
+
+	switch (walk->type) {
+	case FOOTPRINT_DEVICE:
+		device_footprint(device, footprint);
+		break;
+	case FOOTPRINT_GATT_DB:
+		if (gatt_db_isempty(device->db))
+			break;
+		footprint->objects++;
+		footprint->bytes += gatt_db_get_footprint(device->db);
+		break;
+	case FOOTPRINT_ATT:
+		if (!device->att)
+			break;
+		footprint->objects++;
+		footprint->bytes += bt_att_get_footprint(device->att);
+		break;
+	case FOOTPRINT_SDP:
+		footprint->objects += sdp_cache_count(device->sdp_cache);
+		footprint->bytes += sdp_cache_get_footprint(device->sdp_cache);
+		break;
+	}
+}
+
+static void walk_adapter(struct btd_adapter *adapter, gpointer user_data)
+{
+	btd_adapter_for_each_device(adapter, walk_device, user_data);
+}
+
+static void report_footprint(struct btd_footprint *footprint,
+							void *user_data)
+{
+	struct footprint_walk walk = {
+		.type = GPOINTER_TO_UINT(user_data),
+		.footprint = footprint,
+	};
+
+	adapter_foreach(walk_adapter, &walk);
+}
+
 void btd_device_init(void)
 {
 	dbus_conn = btd_get_dbus_connection();
 	service_state_cb_id = btd_service_add_state_cb(
 						service_state_changed, NULL);
+
+	btd_metrics_register_footprint("device", report_footprint,
+					GUINT_TO_POINTER(FOOTPRINT_DEVICE));
+	btd_metrics_register_footprint("gatt-db", report_footprint,
+					GUINT_TO_POINTER(FOOTPRINT_GATT_DB));
+	btd_metrics_register_footprint("att", report_footprint,
+					GUINT_TO_POINTER(FOOTPRINT_ATT));
+	btd_metrics_register_footprint("sdp", report_footprint,
+					GUINT_TO_POINTER(FOOTPRINT_SDP));
 }
 
 void btd_device_cleanup(void)
 {
+	btd_metrics_unregister_footprint("device");
+	btd_metrics_unregister_footprint("gatt-db");
+	btd_metrics_unregister_footprint("att");
+	btd_metrics_unregister_footprint("sdp");
+
 	btd_service_remove_state_cb(service_state_cb_id);
 }
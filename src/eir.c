@@ -226,36 +226,73 @@ static void eir_parse_uuid128_data(struct eir_data *eir, const uint8_t *data,
 	eir_parse_sd(eir, &service, data + 16, len - 16);
 }
 
-void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len)
+void eir_iter_init(struct eir_iter *iter, const uint8_t *eir_data,
+							uint8_t eir_len)
 {
-	uint16_t len = 0;
+	iter->data = eir_data;
+	iter->len = eir_data ? eir_len : 0;
+	iter->pos = 0;
+}
 
-	eir->flags = 0;
-	eir->tx_power = 127;
+bool eir_iter_next(struct eir_iter *iter, uint8_t *type,
+				const uint8_t **data, uint8_t *data_len)
+{
+	uint8_t field_len;
 
-	/* No EIR data to parse */
-	if (eir_data == NULL)
-		return;
+	/* A field needs at least the length and the type octet */
+	if (iter->pos + 2 > iter->len)
+		return false;
 
-	while (len < eir_len - 1) {
-		uint8_t field_len = eir_data[0];
-		const uint8_t *data;
-		uint8_t data_len;
+	field_len = iter->data[iter->pos];
 
-		/* Check for the end of EIR */
-		if (field_len == 0)
-			break;
+	/* Check for the end of EIR */
+	if (field_len == 0)
+		goto done;
 
-		len += field_len + 1;
+	/* Do not continue EIR Data parsing if got incorrect length */
+	if (iter->pos + field_len + 1 > iter->len)
+		goto done;
 
-		/* Do not continue EIR Data parsing if got incorrect length */
-		if (len > eir_len)
-			break;
+	*type = iter->data[iter->pos + 1];
+	*data = &iter->data[iter->pos + 2];
+	*data_len = field_len - 1;
+
+	iter->pos += field_len + 1;
+
+	return true;
 
-		data = &eir_data[2];
-		data_len = field_len - 1;
+done:
+	iter->pos = iter->len;
+	return false;
+}
+
+uint32_t eir_hash(const uint8_t *eir_data, uint8_t eir_len)
+{
+	uint32_t hash = 2166136261u;
+	uint8_t i;
 
-		switch (eir_data[1]) {
+	/* 32-bit FNV-1a, cheap enough to run for every report */
+	for (i = 0; i < eir_len; i++) {
+		hash ^= eir_data[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len)
+{
+	struct eir_iter iter;
+	const uint8_t *data;
+	uint8_t type, data_len;
+
+	eir->flags = 0;
+	eir->tx_power = 127;
+
+	eir_iter_init(&iter, eir_data, eir_len);
+
+	while (eir_iter_next(&iter, &type, &data, &data_len)) {
+		switch (type) {
 		case EIR_UUID16_SOME:
 		case EIR_UUID16_ALL:
 			eir_parse_uuid16(eir, data, data_len);
@@ -286,7 +323,7 @@ void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len)
 			g_free(eir->name);
 
 			eir->name = name2utf8(data, data_len);
-			eir->name_complete = eir_data[1] == EIR_NAME_COMPLETE;
+			eir->name_complete = type == EIR_NAME_COMPLETE;
 			break;
 
 		case EIR_TX_POWER:
@@ -347,8 +384,6 @@ void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len)
 			break;
 
 		}
-
-		eir_data += field_len + 1;
 	}
 }
 
@@ -94,6 +94,22 @@ struct eir_data {
 	GSList *sd_list;
 };
 
+/*
+ * Iterates over the raw fields of EIR or advertising data without copying
+ * anything, data points into the buffer passed to eir_iter_init().
+ */
+struct eir_iter {
+	const uint8_t *data;
+	uint8_t len;
+	uint16_t pos;
+};
+
+void eir_iter_init(struct eir_iter *iter, const uint8_t *eir_data,
+							uint8_t eir_len);
+bool eir_iter_next(struct eir_iter *iter, uint8_t *type,
+				const uint8_t **data, uint8_t *data_len);
+uint32_t eir_hash(const uint8_t *eir_data, uint8_t eir_len);
+
 void eir_data_free(struct eir_data *eir);
 void eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len);
 int eir_parse_oob(struct eir_data *eir, uint8_t *eir_data, uint16_t eir_len);
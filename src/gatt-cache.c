@@ -0,0 +1,514 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lib/bluetooth.h"
+#include "lib/uuid.h"
+
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/att.h"
+#include "src/shared/gatt-db.h"
+#include "gatt-cache.h"
+
+/*
+ * The cache file has one record per attribute declaration. All integers
+ * are little endian and UUIDs are stored in their 16 or 128 bit attribute
+ * protocol form. Service records come first, so that included services can
+ * be resolved while loading the whole database in a single pass.
+ *
+ *	header:	magic[8] version(1) reserved(3) count(4)
+ *	record:	type(1) uuid_len(1) handle(2) data(2) data(2) value_len(2)
+ *		uuid[uuid_len] value[value_len]
+ *
+ * The data fields hold the end handle of services, the start and end
+ * handles of included services, the value handle and properties of
+ * characteristics and the value of extended properties descriptors.
+ */
+#define CACHE_MAGIC		"btgattc"
+#define CACHE_VERSION		1
+
+#define CACHE_HDR_LEN		16
+#define CACHE_REC_LEN		10
+
+#define CACHE_PRIMARY		0x01
+#define CACHE_SECONDARY		0x02
+#define CACHE_INCLUDE		0x03
+#define CACHE_CHRC		0x04
+#define CACHE_DESC		0x05
+
+struct cache_buf {
+	struct gatt_db *db;
+	uint8_t *data;
+	size_t len;
+	size_t size;
+	uint32_t count;
+	uint16_t ext_prop;
+	bool failed;
+};
+
+struct cache_value {
+	uint8_t data[BT_ATT_MAX_VALUE_LEN];
+	size_t len;
+};
+
+static uint8_t *buf_reserve(struct cache_buf *buf, size_t len)
+{
+	uint8_t *ptr;
+
+	if (buf->failed)
+		return NULL;
+
+	if (buf->len + len > buf->size) {
+		size_t size = buf->size ? buf->size : 1024;
+		uint8_t *data;
+
+		while (size < buf->len + len)
+			size <<= 1;
+
+		data = realloc(buf->data, size);
+		if (!data) {
+			buf->failed = true;
+			return NULL;
+		}
+
+		buf->data = data;
+		buf->size = size;
+	}
+
+	ptr = buf->data + buf->len;
+	buf->len += len;
+
+	return ptr;
+}
+
+static void put_record(struct cache_buf *buf, uint8_t type, uint16_t handle,
+				const bt_uuid_t *uuid, uint16_t data0,
+				uint16_t data1, const struct cache_value *value)
+{
+	uint8_t uuid_len = 0;
+	uint16_t value_len = value ? value->len : 0;
+	uint8_t *ptr;
+
+	if (uuid)
+		uuid_len = uuid->type == BT_UUID16 ? 2 : 16;
+
+	ptr = buf_reserve(buf, CACHE_REC_LEN + uuid_len + value_len);
+	if (!ptr)
+		return;
+
+	ptr[0] = type;
+	ptr[1] = uuid_len;
+	put_le16(handle, ptr + 2);
+	put_le16(data0, ptr + 4);
+	put_le16(data1, ptr + 6);
+	put_le16(value_len, ptr + 8);
+	ptr += CACHE_REC_LEN;
+
+	if (uuid_len && bt_uuid_to_le(uuid, ptr) < 0)
+		buf->failed = true;
+
+	if (value_len)
+		memcpy(ptr + uuid_len, value->data, value_len);
+
+	buf->count++;
+}
+
+static void read_value_cb(struct gatt_db_attribute *attrib, int err,
+					const uint8_t *value, size_t length,
+					void *user_data)
+{
+	struct cache_value *val = user_data;
+
+	if (err || length > sizeof(val->data))
+		return;
+
+	memcpy(val->data, value, length);
+	val->len = length;
+}
+
+static void put_desc(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct cache_buf *buf = user_data;
+	const bt_uuid_t *uuid = gatt_db_attribute_get_type(attr);
+	bt_uuid_t ext_uuid;
+	uint16_t value = 0;
+
+	bt_uuid16_create(&ext_uuid, GATT_CHARAC_EXT_PROPER_UUID);
+	if (!bt_uuid_cmp(uuid, &ext_uuid))
+		value = buf->ext_prop;
+
+	put_record(buf, CACHE_DESC, gatt_db_attribute_get_handle(attr), uuid,
+							value, 0, NULL);
+}
+
+static void put_chrc(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct cache_buf *buf = user_data;
+	struct gatt_db_attribute *value_attr;
+	struct cache_value value;
+	uint16_t handle, value_handle;
+	uint8_t properties;
+	bt_uuid_t uuid, hash_uuid;
+
+	if (!gatt_db_attribute_get_char_data(attr, &handle, &value_handle,
+						&properties, &buf->ext_prop,
+						&uuid)) {
+		buf->failed = true;
+		return;
+	}
+
+	/* The database hash is the only value kept in the remote database */
+	value.len = 0;
+
+	bt_uuid16_create(&hash_uuid, GATT_CHARAC_DB_HASH);
+	if (!bt_uuid_cmp(&uuid, &hash_uuid)) {
+		value_attr = gatt_db_get_attribute(buf->db, value_handle);
+		gatt_db_attribute_read(value_attr, 0, 0, NULL, read_value_cb,
+									&value);
+	}
+
+	put_record(buf, CACHE_CHRC, handle, &uuid, value_handle, properties,
+								&value);
+
+	gatt_db_service_foreach_desc(attr, put_desc, buf);
+}
+
+static void put_incl(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct cache_buf *buf = user_data;
+	uint16_t handle, start, end;
+
+	if (!gatt_db_attribute_get_incl_data(attr, &handle, &start, &end)) {
+		buf->failed = true;
+		return;
+	}
+
+	put_record(buf, CACHE_INCLUDE, handle, NULL, start, end, NULL);
+}
+
+static void put_service(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct cache_buf *buf = user_data;
+	uint16_t start, end;
+	bool primary;
+	bt_uuid_t uuid;
+
+	if (!gatt_db_attribute_get_service_data(attr, &start, &end, &primary,
+								&uuid)) {
+		buf->failed = true;
+		return;
+	}
+
+	put_record(buf, primary ? CACHE_PRIMARY : CACHE_SECONDARY, start,
+							&uuid, end, 0, NULL);
+}
+
+static void put_service_attrs(struct gatt_db_attribute *attr,
+							void *user_data)
+{
+	struct cache_buf *buf = user_data;
+
+	gatt_db_service_foreach_incl(attr, put_incl, buf);
+	gatt_db_service_foreach_char(attr, put_chrc, buf);
+}
+
+static bool write_file(const char *filename, const uint8_t *data, size_t len)
+{
+	char tmpname[PATH_MAX];
+	ssize_t written;
+	int fd;
+
+	if (snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename) >=
+							(int) sizeof(tmpname))
+		return false;
+
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+							S_IRUSR | S_IWUSR);
+	if (fd < 0)
+		return false;
+
+	while (len > 0) {
+		written = write(fd, data, len);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+
+			goto failed;
+		}
+
+		data += written;
+		len -= written;
+	}
+
+	/* Make sure the data is on disk before replacing the old cache */
+	if (fsync(fd) < 0)
+		goto failed;
+
+	close(fd);
+
+	if (rename(tmpname, filename) < 0) {
+		unlink(tmpname);
+		return false;
+	}
+
+	return true;
+
+failed:
+	close(fd);
+	unlink(tmpname);
+	return false;
+}
+
+bool gatt_cache_save(struct gatt_db *db, const char *filename)
+{
+	struct cache_buf buf;
+	uint8_t *hdr;
+	bool result = false;
+
+	if (!db || !filename)
+		return false;
+
+	memset(&buf, 0, sizeof(buf));
+	buf.db = db;
+
+	hdr = buf_reserve(&buf, CACHE_HDR_LEN);
+	if (!hdr)
+		return false;
+
+	gatt_db_foreach_service(db, NULL, put_service, &buf);
+	gatt_db_foreach_service(db, NULL, put_service_attrs, &buf);
+
+	if (buf.failed)
+		goto done;
+
+	/* The buffer might have moved while adding records */
+	hdr = buf.data;
+	memset(hdr, 0, CACHE_HDR_LEN);
+	memcpy(hdr, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	hdr[8] = CACHE_VERSION;
+	put_le32(buf.count, hdr + 12);
+
+	result = write_file(filename, buf.data, buf.len);
+
+done:
+	free(buf.data);
+
+	return result;
+}
+
+static bool get_uuid(const uint8_t *ptr, uint8_t len, bt_uuid_t *uuid)
+{
+	uint128_t u128;
+
+	switch (len) {
+	case 2:
+		bt_uuid16_create(uuid, get_le16(ptr));
+		return true;
+	case 16:
+		bswap_128(ptr, &u128);
+		bt_uuid128_create(uuid, u128);
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void write_value_cb(struct gatt_db_attribute *attrib, int err,
+							void *user_data)
+{
+	bool *failed = user_data;
+
+	if (err)
+		*failed = true;
+}
+
+static bool load_value(struct gatt_db_attribute *attr, const uint8_t *value,
+								size_t len)
+{
+	bool failed = false;
+
+	if (!gatt_db_attribute_write(attr, 0, value, len, 0, NULL,
+						write_value_cb, &failed))
+		return false;
+
+	return !failed;
+}
+
+static bool load_record(struct gatt_db *db, uint8_t type, uint16_t handle,
+				const bt_uuid_t *uuid, uint16_t data0,
+				uint16_t data1, const uint8_t *value,
+				uint16_t value_len)
+{
+	struct gatt_db_attribute *attr;
+	uint8_t ext_prop[2];
+
+	switch (type) {
+	case CACHE_PRIMARY:
+	case CACHE_SECONDARY:
+		if (!uuid || !handle || data0 < handle)
+			return false;
+
+		return gatt_db_insert_service(db, handle, uuid,
+						type == CACHE_PRIMARY,
+						data0 - handle + 1) != NULL;
+	case CACHE_INCLUDE:
+		attr = gatt_db_get_attribute(db, data0);
+		if (!attr)
+			return false;
+
+		return gatt_db_insert_included(db, handle, attr) != NULL;
+	case CACHE_CHRC:
+		if (!uuid)
+			return false;
+
+		attr = gatt_db_insert_characteristic(db, data0, uuid, 0,
+							data1, NULL, NULL,
+							NULL);
+		if (!attr || gatt_db_attribute_get_handle(attr) != data0)
+			return false;
+
+		if (value_len)
+			return load_value(attr, value, value_len);
+
+		return true;
+	case CACHE_DESC:
+		if (!uuid)
+			return false;
+
+		attr = gatt_db_insert_descriptor(db, handle, uuid, 0, NULL,
+								NULL, NULL);
+		if (!attr || gatt_db_attribute_get_handle(attr) != handle)
+			return false;
+
+		if (data0) {
+			put_le16(data0, ext_prop);
+			return load_value(attr, ext_prop, sizeof(ext_prop));
+		}
+
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void set_active(struct gatt_db_attribute *attr, void *user_data)
+{
+	gatt_db_service_set_active(attr, true);
+}
+
+static bool load_records(struct gatt_db *db, const uint8_t *data, size_t len)
+{
+	const uint8_t *ptr = data + CACHE_HDR_LEN;
+	const uint8_t *end = data + len;
+	uint32_t count, i;
+
+	if (len < CACHE_HDR_LEN || memcmp(data, CACHE_MAGIC,
+						sizeof(CACHE_MAGIC)))
+		return false;
+
+	if (data[8] != CACHE_VERSION)
+		return false;
+
+	count = get_le32(data + 12);
+
+	for (i = 0; i < count; i++) {
+		uint8_t type, uuid_len;
+		uint16_t handle, data0, data1, value_len;
+		bt_uuid_t uuid;
+
+		if (end - ptr < CACHE_REC_LEN)
+			return false;
+
+		type = ptr[0];
+		uuid_len = ptr[1];
+		handle = get_le16(ptr + 2);
+		data0 = get_le16(ptr + 4);
+		data1 = get_le16(ptr + 6);
+		value_len = get_le16(ptr + 8);
+		ptr += CACHE_REC_LEN;
+
+		if (end - ptr < uuid_len + value_len)
+			return false;
+
+		if (uuid_len && !get_uuid(ptr, uuid_len, &uuid))
+			return false;
+
+		if (!load_record(db, type, handle, uuid_len ? &uuid : NULL,
+						data0, data1, ptr + uuid_len,
+						value_len))
+			return false;
+
+		ptr += uuid_len + value_len;
+	}
+
+	return ptr == end;
+}
+
+bool gatt_cache_load(struct gatt_db *db, const char *filename)
+{
+	struct stat st;
+	void *data;
+	bool result;
+	int fd;
+
+	if (!db || !filename)
+		return false;
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) < 0 || st.st_size < CACHE_HDR_LEN) {
+		close(fd);
+		return false;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED)
+		return false;
+
+	result = load_records(db, data, st.st_size);
+	if (result)
+		gatt_db_foreach_service(db, NULL, set_active, NULL);
+	else
+		gatt_db_clear(db);
+
+	munmap(data, st.st_size);
+
+	return result;
+}
@@ -26,6 +26,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/socket.h>
 
 #include <dbus/dbus.h>
 
@@ -56,6 +57,17 @@
 #define GATT_CHARACTERISTIC_IFACE	"org.bluez.GattCharacteristic1"
 #define GATT_DESCRIPTOR_IFACE		"org.bluez.GattDescriptor1"
 
+/* Notifications queued on an acquired notify fd before one sendmmsg */
+#define NOTIFY_IO_BATCH		16
+#define NOTIFY_IO_SLOT		BT_ATT_MAX_LE_MTU
+
+/*
+ * Write Without Response commands from an acquired write fd allowed to wait
+ * in the ATT write queue. The kernel socket queue holds what is in flight,
+ * this only keeps it fed without letting requests queue behind a backlog.
+ */
+#define WRITE_IO_WINDOW		16
+
 struct btd_gatt_client {
 	struct btd_device *device;
 	bool ready;
@@ -95,6 +107,10 @@ struct pipe_io {
 	struct io *io;
 	void (*destroy)(void *data);
 	void *data;
+	uint8_t *batch;
+	uint16_t batch_len[NOTIFY_IO_BATCH];
+	unsigned int batch_count;
+	guint batch_id;
 };
 
 struct characteristic {
@@ -110,6 +126,7 @@ struct characteristic {
 
 	unsigned int ready_id;
 	struct pipe_io *write_io;
+	unsigned int write_ready_id;
 	struct pipe_io *notify_io;
 
 	struct async_dbus_op *read_op;
@@ -1054,6 +1071,31 @@ fail:
 	return btd_error_not_supported(msg);
 }
 
+static bool chrc_pipe_read(struct io *io, void *user_data);
+
+static void chrc_write_ready(void *user_data)
+{
+	struct characteristic *chrc = user_data;
+	struct bt_gatt_client *gatt = chrc->service->client->gatt;
+
+	bt_gatt_client_unregister_write_ready(gatt, chrc->write_ready_id);
+	chrc->write_ready_id = 0;
+
+	if (chrc->write_io && chrc->write_io->io)
+		io_set_read_handler(chrc->write_io->io, chrc_pipe_read, chrc,
+									NULL);
+}
+
+static void chrc_write_ready_cancel(struct characteristic *chrc)
+{
+	if (!chrc->write_ready_id)
+		return;
+
+	bt_gatt_client_unregister_write_ready(chrc->service->client->gatt,
+							chrc->write_ready_id);
+	chrc->write_ready_id = 0;
+}
+
 static bool chrc_pipe_read(struct io *io, void *user_data)
 {
 	struct characteristic *chrc = user_data;
@@ -1073,11 +1115,29 @@ static bool chrc_pipe_read(struct io *io, void *user_data)
 					chrc->props & BT_GATT_CHRC_PROP_AUTH,
 					buf, bytes_read);
 
-	return true;
+	if (bt_gatt_client_get_write_credits(gatt))
+		return true;
+
+	/*
+	 * Out of credits: stop reading so the pipe fills up and the writer
+	 * blocks, reading resumes once queued commands have been sent.
+	 */
+	chrc->write_ready_id = bt_gatt_client_register_write_ready(gatt,
+							chrc_write_ready,
+							chrc, NULL);
+	if (!chrc->write_ready_id)
+		return true;
+
+	return false;
 }
 
 static void pipe_io_destroy(struct pipe_io *io)
 {
+	if (io->batch_id > 0)
+		g_source_remove(io->batch_id);
+
+	free(io->batch);
+
 	if (io->destroy)
 		io->destroy(io->data);
 
@@ -1094,6 +1154,7 @@ static void characteristic_destroy_pipe(struct characteristic *chrc,
 	queue_remove(chrc->service->client->ios, io);
 
 	if (chrc->write_io && io == chrc->write_io->io) {
+		chrc_write_ready_cancel(chrc);
 		pipe_io_destroy(chrc->write_io);
 		chrc->write_io = NULL;
 		g_dbus_emit_property_changed(btd_get_dbus_connection(),
@@ -1134,11 +1195,19 @@ static DBusMessage *characteristic_create_pipe(struct characteristic *chrc,
 	if (!gatt || !bt_gatt_client_is_ready(gatt))
 		return btd_error_failed(msg, "Not connected");
 
-	if (pipe2(pipefd, O_DIRECT | O_NONBLOCK | O_CLOEXEC) < 0)
-		return btd_error_failed(msg, strerror(errno));
-
 	dir = dbus_message_has_member(msg, "AcquireWrite");
 
+	/*
+	 * Notifications go over a seqpacket socket so that queued values can
+	 * be written with a single sendmmsg while keeping their boundaries.
+	 */
+	if (dir) {
+		if (pipe2(pipefd, O_DIRECT | O_NONBLOCK | O_CLOEXEC) < 0)
+			return btd_error_failed(msg, strerror(errno));
+	} else if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK |
+					SOCK_CLOEXEC, 0, pipefd) < 0)
+		return btd_error_failed(msg, strerror(errno));
+
 	io = io_new(pipefd[!dir]);
 	if (!io) {
 		close(pipefd[0]);
@@ -1164,6 +1233,7 @@ static DBusMessage *characteristic_create_pipe(struct characteristic *chrc,
 
 	if (dir) {
 		chrc->write_io->io = io;
+		bt_gatt_client_set_write_window(gatt, WRITE_IO_WINDOW);
 		g_dbus_emit_property_changed(btd_get_dbus_connection(),
 						chrc->path,
 						GATT_CHARACTERISTIC_IFACE,
@@ -1411,22 +1481,88 @@ static void register_notify_cb(uint16_t att_ecode, void *user_data)
 	create_notify_reply(op, true, 0);
 }
 
+static void notify_io_flush(struct pipe_io *pio)
+{
+	struct mmsghdr msgs[NOTIFY_IO_BATCH];
+	struct iovec iov[NOTIFY_IO_BATCH];
+	unsigned int i;
+	int sent;
+
+	if (pio->batch_id > 0) {
+		g_source_remove(pio->batch_id);
+		pio->batch_id = 0;
+	}
+
+	if (!pio->batch_count)
+		return;
+
+	memset(msgs, 0, sizeof(msgs));
+
+	for (i = 0; i < pio->batch_count; i++) {
+		iov[i].iov_base = pio->batch + i * NOTIFY_IO_SLOT;
+		iov[i].iov_len = pio->batch_len[i];
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	sent = sendmmsg(io_get_fd(pio->io), msgs, pio->batch_count,
+							MSG_NOSIGNAL);
+	if (sent < 0)
+		error("sendmmsg: %s", strerror(errno));
+	else if ((unsigned int) sent < pio->batch_count)
+		error("notify: %u notifications dropped",
+						pio->batch_count - sent);
+
+	pio->batch_count = 0;
+}
+
+static gboolean notify_io_batch_cb(gpointer user_data)
+{
+	struct pipe_io *pio = user_data;
+
+	pio->batch_id = 0;
+
+	notify_io_flush(pio);
+
+	return FALSE;
+}
+
 static void notify_io_cb(uint16_t value_handle, const uint8_t *value,
 					uint16_t length, void *user_data)
 {
 	struct iovec iov;
 	struct notify_client *client = user_data;
 	struct characteristic *chrc = client->chrc;
+	struct pipe_io *pio = chrc->notify_io;
 	int err;
 
 	/* Drop notification if the pipe is not ready */
-	if (!chrc->notify_io->io)
+	if (!pio->io)
+		return;
+
+	/*
+	 * Queue the value until the main loop goes idle, which it only does
+	 * once no more notifications are waiting to be read from the link.
+	 */
+	if (pio->batch && length <= NOTIFY_IO_SLOT) {
+		memcpy(pio->batch + pio->batch_count * NOTIFY_IO_SLOT, value,
+								length);
+		pio->batch_len[pio->batch_count++] = length;
+
+		if (pio->batch_count == NOTIFY_IO_BATCH)
+			notify_io_flush(pio);
+		else if (!pio->batch_id)
+			pio->batch_id = g_idle_add(notify_io_batch_cb, pio);
+
 		return;
+	}
+
+	notify_io_flush(pio);
 
 	iov.iov_base = (void *) value;
 	iov.iov_len = length;
 
-	err = io_send(chrc->notify_io->io, &iov, 1);
+	err = io_send(pio->io, &iov, 1);
 	if (err < 0)
 		error("io_send: %s", strerror(-err));
 }
@@ -1501,6 +1637,7 @@ static DBusMessage *characteristic_acquire_notify(DBusConnection *conn,
 	chrc->notify_io->data = client;
 	chrc->notify_io->msg = dbus_message_ref(msg);
 	chrc->notify_io->destroy = notify_io_destroy;
+	chrc->notify_io->batch = malloc(NOTIFY_IO_BATCH * NOTIFY_IO_SLOT);
 
 	return NULL;
 }
@@ -1654,6 +1791,7 @@ static void characteristic_free(void *data)
 	queue_destroy(chrc->notify_clients, NULL);
 
 	if (chrc->write_io) {
+		chrc_write_ready_cancel(chrc);
 		queue_remove(chrc->service->client->ios, chrc->write_io->io);
 		pipe_io_destroy(chrc->write_io);
 	}
@@ -24,6 +24,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include "lib/bluetooth.h"
@@ -64,6 +65,12 @@
 #define UUID_GAP	0x1800
 #define UUID_GATT	0x1801
 
+/* Values forwarded per wakeup of an acquired notify fd */
+#define NOTIFY_IO_BATCH	16
+
+/* Seconds the handles of an exited application are held for it */
+#define SVC_CACHE_TIMEOUT	5
+
 #ifndef MIN
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #endif
@@ -82,6 +89,9 @@ struct btd_gatt_database {
 	struct gatt_db_attribute *svc_chngd_ccc;
 	struct queue *apps;
 	struct queue *profiles;
+	struct queue *svc_cache;
+	struct svc_cache *svc_removed;
+	bool svc_reused;
 };
 
 struct gatt_app {
@@ -91,6 +101,7 @@ struct gatt_app {
 	DBusMessage *reg;
 	GDBusClient *client;
 	bool failed;
+	bool registered;
 	struct queue *profiles;
 	struct queue *services;
 	struct queue *proxies;
@@ -102,6 +113,7 @@ struct external_service {
 	GDBusProxy *proxy;
 	struct gatt_db_attribute *attrib;
 	uint16_t attr_cnt;
+	uint64_t hash;	/* Layout of the service objects */
 	struct queue *chrcs;
 	struct queue *descs;
 };
@@ -166,6 +178,7 @@ typedef void (*btd_gatt_database_destroy_t) (void *data);
 struct ccc_state {
 	uint16_t handle;
 	uint8_t value[2];
+	struct device_state *dev_state;
 };
 
 struct ccc_cb_data {
@@ -173,6 +186,7 @@ struct ccc_cb_data {
 	btd_gatt_database_ccc_write_t callback;
 	btd_gatt_database_destroy_t destroy;
 	void *user_data;
+	struct queue *subscribers;	/* ccc_state with a non-zero value */
 };
 
 struct device_info {
@@ -180,6 +194,26 @@ struct device_info {
 	uint8_t bdaddr_type;
 };
 
+/*
+ * Handle range of a service whose application went away. If the same
+ * application registers a service with an identical layout before the
+ * entry expires the range is reused and no Service Changed is sent.
+ */
+struct svc_cache {
+	struct btd_gatt_database *database;
+	char *app_path;
+	char *path;
+	uint64_t hash;
+	uint16_t start;
+	uint16_t end;
+	unsigned int timeout_id;
+};
+
+struct svc_range {
+	uint16_t start;
+	uint16_t end;
+};
+
 static void ccc_cb_free(void *data)
 {
 	struct ccc_cb_data *ccc_cb = data;
@@ -187,6 +221,7 @@ static void ccc_cb_free(void *data)
 	if (ccc_cb->destroy)
 		ccc_cb->destroy(ccc_cb->user_data);
 
+	queue_destroy(ccc_cb->subscribers, NULL);
 	free(ccc_cb);
 }
 
@@ -263,11 +298,27 @@ static struct device_state *device_state_create(struct btd_gatt_database *db,
 	return dev_state;
 }
 
+static void ccc_state_free(void *data)
+{
+	struct ccc_state *ccc = data;
+	struct ccc_cb_data *ccc_cb;
+
+	if (ccc->value[0]) {
+		ccc_cb = queue_find(ccc->dev_state->db->ccc_callbacks,
+						ccc_cb_match_handle,
+						UINT_TO_PTR(ccc->handle));
+		if (ccc_cb)
+			queue_remove(ccc_cb->subscribers, ccc);
+	}
+
+	free(ccc);
+}
+
 static void device_state_free(void *data)
 {
 	struct device_state *state = data;
 
-	queue_destroy(state->ccc_states, free);
+	queue_destroy(state->ccc_states, ccc_state_free);
 	free(state);
 }
 
@@ -384,6 +435,7 @@ static struct ccc_state *get_ccc_state(struct btd_gatt_database *database,
 
 	ccc = new0(struct ccc_state, 1);
 	ccc->handle = handle;
+	ccc->dev_state = dev_state;
 	queue_push_tail(dev_state->ccc_states, ccc);
 
 	return ccc;
@@ -439,16 +491,56 @@ static void desc_free(void *data)
 	free(desc);
 }
 
+static void svc_cache_free(void *data)
+{
+	struct svc_cache *cache = data;
+
+	if (!cache)
+		return;
+
+	if (cache->timeout_id)
+		g_source_remove(cache->timeout_id);
+
+	g_free(cache->app_path);
+	g_free(cache->path);
+	free(cache);
+}
+
+static struct svc_cache *svc_cache_new(struct external_service *service)
+{
+	struct svc_cache *cache;
+
+	cache = new0(struct svc_cache, 1);
+	cache->database = service->app->database;
+	cache->app_path = g_strdup(service->app->path);
+	cache->path = g_strdup(service->path);
+	cache->hash = service->hash;
+
+	return cache;
+}
+
 static void service_free(void *data)
 {
 	struct external_service *service = data;
+	struct btd_gatt_database *database = service->app->database;
 
 	queue_destroy(service->chrcs, chrc_free);
 	queue_destroy(service->descs, desc_free);
 
-	if (service->attrib)
-		gatt_db_remove_service(service->app->database->db,
-							service->attrib);
+	if (service->attrib) {
+		/*
+		 * Hand the handles of a registered service over to the
+		 * removal callback so they can be held for the application.
+		 */
+		if (service->app->registered)
+			database->svc_removed = svc_cache_new(service);
+
+		gatt_db_remove_service(database->db, service->attrib);
+
+		/* Not picked up if the service was never active */
+		svc_cache_free(database->svc_removed);
+		database->svc_removed = NULL;
+	}
 
 	if (service->app->client)
 		g_dbus_proxy_unref(service->proxy);
@@ -547,6 +639,7 @@ static void gatt_database_free(void *data)
 	queue_destroy(database->apps, app_free);
 	queue_destroy(database->profiles, profile_free);
 	queue_destroy(database->ccc_callbacks, ccc_cb_free);
+	queue_destroy(database->svc_cache, svc_cache_free);
 	database->device_states = NULL;
 	database->ccc_callbacks = NULL;
 
@@ -852,15 +945,33 @@ static void gatt_ccc_write_cb(struct gatt_db_attribute *attrib,
 		ecode = ccc_cb->callback(att, get_le16(value),
 						ccc_cb->user_data);
 
-	if (!ecode) {
-		ccc->value[0] = value[0];
-		ccc->value[1] = value[1];
-	}
+	if (ecode)
+		goto done;
+
+	/* Keep the subscriber list in sync so notifying doesn't search */
+	if (!ccc->value[0] && value[0])
+		queue_push_tail(ccc_cb->subscribers, ccc);
+	else if (ccc->value[0] && !value[0])
+		queue_remove(ccc_cb->subscribers, ccc);
+
+	ccc->value[0] = value[0];
+	ccc->value[1] = value[1];
 
 done:
 	gatt_db_attribute_write_result(attrib, id, ecode);
 }
 
+static void add_ccc_subscriber(void *data, void *user_data)
+{
+	struct device_state *dev_state = data;
+	struct ccc_cb_data *ccc_cb = user_data;
+	struct ccc_state *ccc;
+
+	ccc = find_ccc_state(dev_state, ccc_cb->handle);
+	if (ccc && ccc->value[0])
+		queue_push_tail(ccc_cb->subscribers, ccc);
+}
+
 static struct gatt_db_attribute *
 service_add_ccc(struct gatt_db_attribute *service,
 				struct btd_gatt_database *database,
@@ -873,6 +984,7 @@ service_add_ccc(struct gatt_db_attribute *service,
 	bt_uuid_t uuid;
 
 	ccc_cb = new0(struct ccc_cb_data, 1);
+	ccc_cb->subscribers = queue_new();
 
 	bt_uuid16_create(&uuid, GATT_CLIENT_CHARAC_CFG_UUID);
 	ccc = gatt_db_service_add_descriptor(service, &uuid,
@@ -880,6 +992,7 @@ service_add_ccc(struct gatt_db_attribute *service,
 				gatt_ccc_read_cb, gatt_ccc_write_cb, database);
 	if (!ccc) {
 		error("Failed to create CCC entry in database");
+		queue_destroy(ccc_cb->subscribers, NULL);
 		free(ccc_cb);
 		return NULL;
 	}
@@ -889,6 +1002,9 @@ service_add_ccc(struct gatt_db_attribute *service,
 	ccc_cb->destroy = destroy;
 	ccc_cb->user_data = user_data;
 
+	/* States survive if the handles were held for the application */
+	queue_foreach(database->device_states, add_ccc_subscriber, ccc_cb);
+
 	queue_push_tail(database->ccc_callbacks, ccc_cb);
 
 	return ccc;
@@ -925,7 +1041,7 @@ static void register_core_services(struct btd_gatt_database *database)
 
 struct notify {
 	struct btd_gatt_database *database;
-	uint16_t handle, ccc_handle;
+	uint16_t handle;
 	const uint8_t *value;
 	uint16_t len;
 	bool indicate;
@@ -945,17 +1061,13 @@ static void conf_cb(void *user_data)
 
 static void send_notification_to_device(void *data, void *user_data)
 {
-	struct device_state *device_state = data;
+	struct ccc_state *ccc = data;
+	struct device_state *device_state = ccc->dev_state;
 	struct notify *notify = user_data;
-	struct ccc_state *ccc;
 	struct btd_device *device;
 	struct bt_gatt_server *server;
 
-	ccc = find_ccc_state(device_state, notify->ccc_handle);
-	if (!ccc)
-		return;
-
-	if (!ccc->value[0] || (notify->indicate && !(ccc->value[0] & 0x02)))
+	if (notify->indicate && !(ccc->value[0] & 0x02))
 		return;
 
 	device = btd_adapter_get_device(notify->database->adapter,
@@ -1005,33 +1117,36 @@ static void send_notification_to_devices(struct btd_gatt_database *database,
 					bool indicate, GDBusProxy *proxy)
 {
 	struct notify notify;
+	struct ccc_cb_data *ccc_cb;
+
+	ccc_cb = queue_find(database->ccc_callbacks, ccc_cb_match_handle,
+						UINT_TO_PTR(ccc_handle));
+	if (!ccc_cb)
+		return;
 
 	memset(&notify, 0, sizeof(notify));
 
 	notify.database = database;
 	notify.handle = handle;
-	notify.ccc_handle = ccc_handle;
 	notify.value = value;
 	notify.len = len;
 	notify.indicate = indicate;
 	notify.proxy = proxy;
 
-	queue_foreach(database->device_states, send_notification_to_device,
+	/*
+	 * Only devices that enabled notifications or indications are in
+	 * the list. A device being removed only takes its own entry out.
+	 */
+	queue_foreach(ccc_cb->subscribers, send_notification_to_device,
 								&notify);
 }
 
 static void send_service_changed(struct btd_gatt_database *database,
-					struct gatt_db_attribute *attrib)
+						uint16_t start, uint16_t end)
 {
-	uint16_t start, end;
 	uint8_t value[4];
 	uint16_t handle, ccc_handle;
 
-	if (!gatt_db_attribute_get_service_handles(attrib, &start, &end)) {
-		error("Failed to obtain changed service handles");
-		return;
-	}
-
 	handle = gatt_db_attribute_get_handle(database->svc_chngd);
 	ccc_handle = gatt_db_attribute_get_handle(database->svc_chngd_ccc);
 
@@ -1052,43 +1167,102 @@ static void gatt_db_service_added(struct gatt_db_attribute *attrib,
 								void *user_data)
 {
 	struct btd_gatt_database *database = user_data;
+	uint16_t start, end;
 
 	DBG("GATT Service added to local database");
 
-	send_service_changed(database, attrib);
+	/* Clients still have this service cached under the same handles */
+	if (database->svc_reused)
+		return;
+
+	if (!gatt_db_attribute_get_service_handles(attrib, &start, &end)) {
+		error("Failed to obtain changed service handles");
+		return;
+	}
+
+	send_service_changed(database, start, end);
 }
 
-static bool ccc_match_service(const void *data, const void *match_data)
+static bool ccc_match_range(const void *data, const void *match_data)
 {
 	const struct ccc_state *ccc = data;
-	const struct gatt_db_attribute *attrib = match_data;
-	uint16_t start, end;
-
-	if (!gatt_db_attribute_get_service_handles(attrib, &start, &end))
-		return false;
+	const struct svc_range *range = match_data;
 
-	return ccc->handle >= start && ccc->handle <= end;
+	return ccc->handle >= range->start && ccc->handle <= range->end;
 }
 
 static void remove_device_ccc(void *data, void *user_data)
 {
 	struct device_state *state = data;
 
-	queue_remove_all(state->ccc_states, ccc_match_service, user_data, free);
+	queue_remove_all(state->ccc_states, ccc_match_range, user_data,
+							ccc_state_free);
+}
+
+static void svc_cache_release(struct svc_cache *cache)
+{
+	struct btd_gatt_database *database = cache->database;
+	struct svc_range range;
+
+	DBG("Releasing handles 0x%04x-0x%04x of %s", cache->start,
+						cache->end, cache->path);
+
+	queue_remove(database->svc_cache, cache);
+
+	range.start = cache->start;
+	range.end = cache->end;
+
+	send_service_changed(database, range.start, range.end);
+	queue_foreach(database->device_states, remove_device_ccc, &range);
+
+	svc_cache_free(cache);
+}
+
+static gboolean svc_cache_expired(gpointer user_data)
+{
+	struct svc_cache *cache = user_data;
+
+	cache->timeout_id = 0;
+	svc_cache_release(cache);
+
+	return FALSE;
 }
 
 static void gatt_db_service_removed(struct gatt_db_attribute *attrib,
 								void *user_data)
 {
 	struct btd_gatt_database *database = user_data;
+	struct svc_cache *cache = database->svc_removed;
+	struct svc_range range;
 
 	DBG("Local GATT service removed");
 
-	send_service_changed(database, attrib);
-
-	queue_foreach(database->device_states, remove_device_ccc, attrib);
 	queue_remove_all(database->ccc_callbacks, ccc_cb_match_service, attrib,
 								ccc_cb_free);
+
+	if (!gatt_db_attribute_get_service_handles(attrib, &range.start,
+								&range.end)) {
+		error("Failed to obtain changed service handles");
+		return;
+	}
+
+	/*
+	 * Keep the CCC states and defer Service Changed in case the
+	 * application comes back with the same layout.
+	 */
+	if (cache) {
+		database->svc_removed = NULL;
+		cache->start = range.start;
+		cache->end = range.end;
+		cache->timeout_id = g_timeout_add_seconds(SVC_CACHE_TIMEOUT,
+							svc_cache_expired,
+							cache);
+		queue_push_tail(database->svc_cache, cache);
+		return;
+	}
+
+	send_service_changed(database, range.start, range.end);
+	queue_foreach(database->device_states, remove_device_ccc, &range);
 }
 
 struct svc_match_data {
@@ -1895,19 +2069,36 @@ static bool pipe_io_read(struct io *io, void *user_data)
 	struct external_chrc *chrc = user_data;
 	uint8_t buf[512];
 	int fd = io_get_fd(io);
+	uint16_t handle, ccc_handle;
 	ssize_t bytes_read;
+	int i;
 
-	bytes_read = read(fd, buf, sizeof(buf));
-	if (bytes_read < 0)
-		return false;
+	handle = gatt_db_attribute_get_handle(chrc->attrib);
+	ccc_handle = gatt_db_attribute_get_handle(chrc->ccc);
 
-	send_notification_to_devices(chrc->service->app->database,
-				gatt_db_attribute_get_handle(chrc->attrib),
-				buf, bytes_read,
-				gatt_db_attribute_get_handle(chrc->ccc),
+	/*
+	 * Applications streaming values can queue several of them between
+	 * two wakeups, forward what is ready instead of one per poll.
+	 */
+	for (i = 0; i < NOTIFY_IO_BATCH; i++) {
+		bytes_read = read(fd, buf, sizeof(buf));
+		if (bytes_read < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				return true;
+
+			return false;
+		}
+
+		send_notification_to_devices(chrc->service->app->database,
+				handle, buf, bytes_read, ccc_handle,
 				chrc->props & BT_GATT_CHRC_PROP_INDICATE,
 				chrc->proxy);
 
+		/* Only the notify fd is non-blocking and safe to drain */
+		if (!bytes_read || io != chrc->notify_io)
+			break;
+	}
+
 	return true;
 }
 
@@ -2030,7 +2221,7 @@ static void acquire_notify_reply(DBusMessage *message, void *user_data)
 {
 	struct external_chrc *chrc = user_data;
 	DBusError err;
-	int fd;
+	int fd, flags;
 	uint16_t mtu;
 
 	dbus_error_init(&err);
@@ -2050,6 +2241,11 @@ static void acquire_notify_reply(DBusMessage *message, void *user_data)
 
 	DBG("AcquireNotify success: fd %d MTU %u\n", fd, mtu);
 
+	/* Let pipe_io_read drain the fd without blocking once it is empty */
+	flags = fcntl(fd, F_GETFL);
+	if (flags >= 0 && !(flags & O_NONBLOCK))
+		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
 	chrc->notify_io = pipe_io_new(fd, chrc);
 
 	__sync_fetch_and_add(&chrc->ntfy_cnt, 1);
@@ -2188,6 +2384,9 @@ static void property_changed_cb(GDBusProxy *proxy, const char *name,
 static bool database_add_ccc(struct external_service *service,
 						struct external_chrc *chrc)
 {
+	struct btd_gatt_database *database = service->app->database;
+	struct ccc_cb_data *ccc_cb;
+
 	if (!(chrc->props & BT_GATT_CHRC_PROP_NOTIFY) &&
 				!(chrc->props & BT_GATT_CHRC_PROP_INDICATE))
 		return true;
@@ -2205,6 +2404,15 @@ static bool database_add_ccc(struct external_service *service,
 		return false;
 	}
 
+	/* Resume notifying clients that stayed subscribed */
+	ccc_cb = queue_find(database->ccc_callbacks, ccc_cb_match_handle,
+			UINT_TO_PTR(gatt_db_attribute_get_handle(chrc->ccc)));
+	if (ccc_cb && !queue_isempty(ccc_cb->subscribers)) {
+		chrc->ntfy_cnt = queue_length(ccc_cb->subscribers);
+		g_dbus_proxy_method_call(chrc->proxy, "StartNotify", NULL,
+							NULL, NULL, NULL);
+	}
+
 	DBG("Created CCC entry for characteristic");
 
 	return true;
@@ -2501,8 +2709,124 @@ static bool match_desc_unhandled(const void *a, const void *b)
 	return !desc->handled;
 }
 
+static uint64_t hash_data(uint64_t hash, const void *data, size_t len)
+{
+	const uint8_t *ptr = data;
+
+	/* FNV-1a */
+	while (len--) {
+		hash ^= *ptr++;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+static uint64_t hash_attr(uint64_t hash, const bt_uuid_t *uuid,
+						uint32_t perm, uint16_t extra)
+{
+	bt_uuid_t uuid128;
+	uint8_t value[6];
+
+	bt_uuid_to_uuid128(uuid, &uuid128);
+	hash = hash_data(hash, &uuid128.value.u128,
+					sizeof(uuid128.value.u128));
+
+	put_le32(perm, value);
+	put_le16(extra, value + 4);
+
+	return hash_data(hash, value, sizeof(value));
+}
+
+static bool service_hash(struct external_service *service,
+					const bt_uuid_t *uuid, bool primary)
+{
+	const struct queue_entry *entry, *desc_entry;
+	bt_uuid_t attr_uuid;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	hash = hash_attr(hash, uuid, primary, service->attr_cnt);
+
+	for (entry = queue_get_entries(service->chrcs); entry;
+						entry = entry->next) {
+		struct external_chrc *chrc = entry->data;
+
+		if (!parse_uuid(chrc->proxy, &attr_uuid))
+			return false;
+
+		hash = hash_attr(hash, &attr_uuid, chrc->perm,
+					chrc->props | chrc->ext_props << 8);
+
+		for (desc_entry = queue_get_entries(service->descs);
+				desc_entry; desc_entry = desc_entry->next) {
+			struct external_desc *desc = desc_entry->data;
+
+			if (g_strcmp0(desc->chrc_path, chrc->path))
+				continue;
+
+			if (!parse_uuid(desc->proxy, &attr_uuid))
+				return false;
+
+			hash = hash_attr(hash, &attr_uuid, desc->perm, 0);
+		}
+	}
+
+	service->hash = hash;
+
+	return true;
+}
+
+static bool svc_cache_match(const void *data, const void *match_data)
+{
+	const struct svc_cache *cache = data;
+	const struct external_service *service = match_data;
+
+	return !strcmp(cache->app_path, service->app->path) &&
+					!strcmp(cache->path, service->path);
+}
+
+static struct gatt_db_attribute *
+service_insert_cached(struct external_service *service, const bt_uuid_t *uuid,
+								bool primary)
+{
+	struct btd_gatt_database *database = service->app->database;
+	struct gatt_db_attribute *attrib = NULL;
+	struct svc_cache *cache;
+
+	cache = queue_find(database->svc_cache, svc_cache_match, service);
+	if (!cache)
+		return NULL;
+
+	/*
+	 * Only an unoccupied range can be reused, insert would otherwise
+	 * hand back a matching service that belongs to someone else.
+	 */
+	if (cache->hash == service->hash &&
+			!gatt_db_get_attribute(database->db, cache->start))
+		attrib = gatt_db_insert_service(database->db, cache->start,
+							uuid, primary,
+							service->attr_cnt);
+
+	if (!attrib) {
+		/* Layout changed, let clients know the old range is gone */
+		g_source_remove(cache->timeout_id);
+		cache->timeout_id = 0;
+		svc_cache_release(cache);
+		return NULL;
+	}
+
+	DBG("Reusing handles 0x%04x-0x%04x for %s", cache->start, cache->end,
+								cache->path);
+
+	queue_remove(database->svc_cache, cache);
+	svc_cache_free(cache);
+
+	return attrib;
+}
+
 static bool database_add_service(struct external_service *service)
 {
+	struct btd_gatt_database *database = service->app->database;
 	bt_uuid_t uuid;
 	bool primary;
 	const struct queue_entry *entry;
@@ -2517,7 +2841,16 @@ static bool database_add_service(struct external_service *service)
 		return false;
 	}
 
-	service->attrib = gatt_db_add_service(service->app->database->db, &uuid,
+	if (!service_hash(service, &uuid, primary)) {
+		error("Failed to read \"UUID\" property of attribute");
+		return false;
+	}
+
+	service->attrib = service_insert_cached(service, &uuid, primary);
+	if (service->attrib)
+		database->svc_reused = true;
+	else
+		service->attrib = gatt_db_add_service(database->db, &uuid,
 						primary, service->attr_cnt);
 	if (!service->attrib)
 		return false;
@@ -2541,11 +2874,27 @@ static bool database_add_service(struct external_service *service)
 	}
 
 	gatt_db_service_set_active(service->attrib, true);
+	database->svc_reused = false;
 
 	return true;
 
 fail:
-	gatt_db_remove_service(service->app->database->db, service->attrib);
+	/* Inactive services don't notify, so drop a reused range here */
+	if (database->svc_reused) {
+		struct svc_range range;
+
+		database->svc_reused = false;
+
+		if (gatt_db_attribute_get_service_handles(service->attrib,
+							&range.start,
+							&range.end)) {
+			send_service_changed(database, range.start, range.end);
+			queue_foreach(database->device_states,
+						remove_device_ccc, &range);
+		}
+	}
+
+	gatt_db_remove_service(database->db, service->attrib);
 	service->attrib = NULL;
 
 	return false;
@@ -2809,6 +3158,8 @@ static void client_ready_cb(GDBusClient *client, void *user_data)
 
 	DBG("GATT application registered: %s:%s", app->owner, app->path);
 
+	app->registered = true;
+
 	reply = dbus_message_new_method_return(app->reg);
 
 reply:
@@ -2954,10 +3305,12 @@ struct btd_gatt_database *btd_gatt_database_new(struct btd_adapter *adapter)
 	database = new0(struct btd_gatt_database, 1);
 	database->adapter = btd_adapter_ref(adapter);
 	database->db = gatt_db_new();
+	gatt_db_set_handle_index(database->db, true);
 	database->device_states = queue_new();
 	database->apps = queue_new();
 	database->profiles = queue_new();
 	database->ccc_callbacks = queue_new();
+	database->svc_cache = queue_new();
 
 	addr = btd_adapter_get_address(adapter);
 	database->le_io = bt_io_listen(connect_cb, NULL, NULL, NULL, &gerr,
@@ -35,17 +35,35 @@ typedef enum {
 	BT_GATT_CACHE_NO,
 } bt_gatt_cache_t;
 
+typedef enum {
+	BT_SCAN_BALANCED,
+	BT_SCAN_LATENCY,
+	BT_SCAN_POWER,
+} bt_scan_mode_t;
+
+typedef enum {
+	BT_CONN_POLICY_PEER,
+	BT_CONN_POLICY_AUTO,
+	BT_CONN_POLICY_LATENCY,
+	BT_CONN_POLICY_POWER,
+} bt_conn_policy_t;
+
 struct main_opts {
 	char		*name;
 	uint32_t	class;
 	uint32_t	pairto;
 	uint32_t	discovto;
+	uint32_t	discov_interval;
+	uint32_t	discov_limit;
+	uint32_t	svc_cache_timeout;
 	uint8_t		privacy;
 
 	gboolean	reverse_sdp;
 	gboolean	name_resolv;
 	gboolean	debug_keys;
 	gboolean	fast_conn;
+	gboolean	lazy_devices;
+	char		**lazy_plugins;
 
 	uint16_t	did_source;
 	uint16_t	did_vendor;
@@ -54,6 +72,11 @@ struct main_opts {
 
 	bt_mode_t	mode;
 	bt_gatt_cache_t gatt_cache;
+
+	char		*metrics_socket;
+	uint32_t	max_connects;
+	bt_scan_mode_t	scan_mode;
+	bt_conn_policy_t conn_policy;
 };
 
 extern struct main_opts main_opts;
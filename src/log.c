@@ -33,7 +33,9 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <pthread.h>
 #include <sys/socket.h>
+#include <sys/eventfd.h>
 
 #include <glib.h>
 
@@ -56,6 +58,34 @@ struct log_hdr {
 
 static int logging_fd = -1;
 
+/*
+ * Asynchronous logging: messages are formatted into a single producer,
+ * single consumer ring and written out by a separate thread so syslog
+ * and the monitor socket never block the mainloop. bluetoothd only logs
+ * from the mainloop thread, which is the only producer.
+ */
+#define LOG_RING_SIZE	512	/* Power of two */
+#define LOG_MSG_MAX	256
+
+struct log_entry {
+	uint16_t index;
+	int priority;
+	char msg[LOG_MSG_MAX];
+};
+
+struct log_ring {
+	struct log_entry entries[LOG_RING_SIZE];
+	unsigned int head;	/* Written by the producer only */
+	unsigned int tail;	/* Written by the consumer only */
+	unsigned int waiting;
+	unsigned int dropped;
+	unsigned int terminate;
+	int efd;
+	pthread_t thread;
+};
+
+static struct log_ring *log_ring;
+
 static void logging_open(void)
 {
 	struct sockaddr_hci addr;
@@ -89,17 +119,12 @@ static void logging_close(void)
 	}
 }
 
-static void logging_log(uint16_t index, int priority,
-					const char *format, va_list ap)
+static void logging_send(uint16_t index, int priority, const char *str)
 {
 	struct log_hdr hdr;
 	struct msghdr msg;
 	struct iovec iov[3];
 	uint16_t len;
-	char *str;
-
-	if (vasprintf(&str, format, ap) < 0)
-		return;
 
 	len = strlen(str) + 1;
 
@@ -115,7 +140,7 @@ static void logging_log(uint16_t index, int priority,
 	iov[1].iov_base = LOG_IDENT;
 	iov[1].iov_len = LOG_IDENT_LEN;
 
-	iov[2].iov_base = str;
+	iov[2].iov_base = (void *) str;
 	iov[2].iov_len = len;
 
 	memset(&msg, 0, sizeof(msg));
@@ -128,135 +153,196 @@ static void logging_log(uint16_t index, int priority,
 			logging_fd = -1;
 		}
 	}
+}
+
+static void logging_log(uint16_t index, int priority,
+					const char *format, va_list ap)
+{
+	char *str;
+
+	if (vasprintf(&str, format, ap) < 0)
+		return;
+
+	logging_send(index, priority, str);
 
 	free(str);
 }
 
-void error(const char *format, ...)
+static void ring_wakeup(struct log_ring *ring)
 {
-	va_list ap;
+	uint64_t val = 1;
 
-	va_start(ap, format);
-	vsyslog(LOG_ERR, format, ap);
-	va_end(ap);
+	if (write(ring->efd, &val, sizeof(val)) < 0)
+		return;
+}
 
-	if (logging_fd < 0)
+static void ring_push(struct log_ring *ring, uint16_t index, int priority,
+					const char *format, va_list ap)
+{
+	struct log_entry *entry;
+	unsigned int head, tail;
+
+	head = ring->head;
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	if (head - tail >= LOG_RING_SIZE) {
+		__atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
 		return;
+	}
 
-	va_start(ap, format);
-	logging_log(HCI_DEV_NONE, LOG_ERR, format, ap);
-	va_end(ap);
+	entry = &ring->entries[head & (LOG_RING_SIZE - 1)];
+	entry->index = index;
+	entry->priority = priority;
+	vsnprintf(entry->msg, sizeof(entry->msg), format, ap);
+
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+
+	/* Only pay for the wakeup when the writer is actually asleep */
+	if (__atomic_exchange_n(&ring->waiting, 0, __ATOMIC_SEQ_CST))
+		ring_wakeup(ring);
 }
 
-void warn(const char *format, ...)
+static void ring_drain(struct log_ring *ring)
 {
-	va_list ap;
+	unsigned int tail = ring->tail;
+	unsigned int dropped;
 
-	va_start(ap, format);
-	vsyslog(LOG_WARNING, format, ap);
-	va_end(ap);
+	while (tail != __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+		struct log_entry *entry;
 
-	if (logging_fd < 0)
-		return;
+		entry = &ring->entries[tail & (LOG_RING_SIZE - 1)];
 
-	va_start(ap, format);
-	logging_log(HCI_DEV_NONE, LOG_WARNING, format, ap);
-	va_end(ap);
+		syslog(entry->priority, "%s", entry->msg);
+
+		if (logging_fd >= 0)
+			logging_send(entry->index, entry->priority,
+								entry->msg);
+
+		__atomic_store_n(&ring->tail, ++tail, __ATOMIC_RELEASE);
+	}
+
+	dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+	if (dropped)
+		syslog(LOG_WARNING, "%u log messages dropped", dropped);
 }
 
-void info(const char *format, ...)
+static void *ring_thread(void *user_data)
 {
-	va_list ap;
+	struct log_ring *ring = user_data;
+	uint64_t val;
 
-	va_start(ap, format);
-	vsyslog(LOG_INFO, format, ap);
-	va_end(ap);
+	while (1) {
+		ring_drain(ring);
 
-	if (logging_fd < 0)
-		return;
+		if (__atomic_load_n(&ring->terminate, __ATOMIC_ACQUIRE))
+			break;
 
-	va_start(ap, format);
-	logging_log(HCI_DEV_NONE, LOG_INFO, format, ap);
-	va_end(ap);
+		__atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+
+		/* Recheck so a message pushed before waiting was set isn't
+		 * left behind until the next one */
+		if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) !=
+								ring->tail) {
+			__atomic_store_n(&ring->waiting, 0, __ATOMIC_SEQ_CST);
+			continue;
+		}
+
+		if (read(ring->efd, &val, sizeof(val)) < 0 && errno != EINTR)
+			break;
+	}
+
+	return NULL;
 }
 
-void btd_log(uint16_t index, int priority, const char *format, ...)
+static void log_va(uint16_t index, int priority, const char *format,
+								va_list ap)
 {
-	va_list ap;
+	va_list aq;
 
-	va_start(ap, format);
-	vsyslog(priority, format, ap);
-	va_end(ap);
+	if (log_ring) {
+		ring_push(log_ring, index, priority, format, ap);
+		return;
+	}
+
+	va_copy(aq, ap);
+	vsyslog(priority, format, aq);
+	va_end(aq);
 
 	if (logging_fd < 0)
 		return;
 
-	va_start(ap, format);
 	logging_log(index, priority, format, ap);
-	va_end(ap);
 }
 
-void btd_error(uint16_t index, const char *format, ...)
+void error(const char *format, ...)
 {
 	va_list ap;
 
 	va_start(ap, format);
-	vsyslog(LOG_ERR, format, ap);
+	log_va(HCI_DEV_NONE, LOG_ERR, format, ap);
 	va_end(ap);
+}
 
-	if (logging_fd < 0)
-		return;
+void warn(const char *format, ...)
+{
+	va_list ap;
 
 	va_start(ap, format);
-	logging_log(index, LOG_ERR, format, ap);
+	log_va(HCI_DEV_NONE, LOG_WARNING, format, ap);
 	va_end(ap);
 }
 
-void btd_warn(uint16_t index, const char *format, ...)
+void info(const char *format, ...)
 {
 	va_list ap;
 
 	va_start(ap, format);
-	vsyslog(LOG_WARNING, format, ap);
+	log_va(HCI_DEV_NONE, LOG_INFO, format, ap);
 	va_end(ap);
+}
 
-	if (logging_fd < 0)
-		return;
+void btd_log(uint16_t index, int priority, const char *format, ...)
+{
+	va_list ap;
 
 	va_start(ap, format);
-	logging_log(index, LOG_WARNING, format, ap);
+	log_va(index, priority, format, ap);
 	va_end(ap);
 }
 
-void btd_info(uint16_t index, const char *format, ...)
+void btd_error(uint16_t index, const char *format, ...)
 {
 	va_list ap;
 
 	va_start(ap, format);
-	vsyslog(LOG_INFO, format, ap);
+	log_va(index, LOG_ERR, format, ap);
 	va_end(ap);
+}
 
-	if (logging_fd < 0)
-		return;
+void btd_warn(uint16_t index, const char *format, ...)
+{
+	va_list ap;
 
 	va_start(ap, format);
-	logging_log(index, LOG_INFO, format, ap);
+	log_va(index, LOG_WARNING, format, ap);
 	va_end(ap);
 }
 
-void btd_debug(uint16_t index, const char *format, ...)
+void btd_info(uint16_t index, const char *format, ...)
 {
 	va_list ap;
 
 	va_start(ap, format);
-	vsyslog(LOG_DEBUG, format, ap);
+	log_va(index, LOG_INFO, format, ap);
 	va_end(ap);
+}
 
-	if (logging_fd < 0)
-		return;
+void btd_debug(uint16_t index, const char *format, ...)
+{
+	va_list ap;
 
 	va_start(ap, format);
-	logging_log(index, LOG_DEBUG, format, ap);
+	log_va(index, LOG_DEBUG, format, ap);
 	va_end(ap);
 }
 
@@ -321,8 +407,55 @@ void __btd_log_init(const char *debug, int detach)
 	info("Bluetooth daemon %s", VERSION);
 }
 
+void __btd_log_async(void)
+{
+	struct log_ring *ring;
+
+	if (log_ring)
+		return;
+
+	ring = new0(struct log_ring, 1);
+
+	ring->efd = eventfd(0, EFD_CLOEXEC);
+	if (ring->efd < 0) {
+		free(ring);
+		error("Failed to set up asynchronous logging");
+		return;
+	}
+
+	if (pthread_create(&ring->thread, NULL, ring_thread, ring)) {
+		close(ring->efd);
+		free(ring);
+		error("Failed to start logging thread");
+		return;
+	}
+
+	log_ring = ring;
+}
+
+static void log_async_stop(void)
+{
+	struct log_ring *ring = log_ring;
+
+	if (!ring)
+		return;
+
+	/* Back to synchronous logging, the thread flushes what's left */
+	log_ring = NULL;
+
+	__atomic_store_n(&ring->terminate, 1, __ATOMIC_RELEASE);
+	ring_wakeup(ring);
+
+	pthread_join(ring->thread, NULL);
+
+	close(ring->efd);
+	free(ring);
+}
+
 void __btd_log_cleanup(void)
 {
+	log_async_stop();
+
 	closelog();
 
 	logging_close();
@@ -40,6 +40,7 @@ void btd_debug(uint16_t index, const char *format, ...)
 					__attribute__((format(printf, 2, 3)));
 
 void __btd_log_init(const char *debug, int detach);
+void __btd_log_async(void);
 void __btd_log_cleanup(void);
 void __btd_toggle_debug(void);
 
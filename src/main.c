@@ -47,6 +47,8 @@
 
 #include "gdbus/gdbus.h"
 
+#include "btio/btio.h"
+
 #include "log.h"
 #include "backtrace.h"
 
@@ -57,8 +59,11 @@
 #include "device.h"
 #include "dbus-common.h"
 #include "agent.h"
+#include "metrics.h"
+#include "conn-policy.h"
 #include "profile.h"
 #include "systemd.h"
+#include "storage.h"
 
 #define BLUEZ_NAME "org.bluez"
 
@@ -82,14 +87,23 @@ static const char *supported_options[] = {
 	"Class",
 	"DiscoverableTimeout",
 	"PairableTimeout",
+	"DiscoveryUpdateInterval",
+	"DiscoveryUpdateLimit",
 	"DeviceID",
 	"ReverseServiceDiscovery",
+	"ServiceCacheTimeout",
 	"NameResolving",
 	"DebugKeys",
 	"ControllerMode",
 	"MultiProfile",
 	"FastConnectable",
+	"LazyDeviceLoading",
+	"LazyPlugins",
 	"Privacy",
+	"MetricsSocket",
+	"MaxPendingConnects",
+	"ScanMode",
+	"ConnectionPolicy",
 	NULL
 };
 
@@ -97,6 +111,7 @@ static const char *policy_options[] = {
 	"ReconnectUUIDs",
 	"ReconnectAttempts",
 	"ReconnectIntervals",
+	"ReconnectConcurrency",
 	"AutoEnable",
 	NULL
 };
@@ -106,6 +121,12 @@ static const char *gatt_options[] = {
 	NULL
 };
 
+static const char *audio_options[] = {
+	"SocketPriority",
+	"RealtimePriority",
+	NULL
+};
+
 static const struct group_table {
 	const char *name;
 	const char **options;
@@ -113,6 +134,7 @@ static const struct group_table {
 	{ "General",	supported_options },
 	{ "Policy",	policy_options },
 	{ "GATT",	gatt_options },
+	{ "Audio",	audio_options },
 	{ }
 };
 
@@ -188,6 +210,20 @@ static bt_gatt_cache_t parse_gatt_cache(const char *cache)
 	}
 }
 
+static bt_scan_mode_t parse_scan_mode(const char *mode)
+{
+	if (!strcmp(mode, "balanced")) {
+		return BT_SCAN_BALANCED;
+	} else if (!strcmp(mode, "latency")) {
+		return BT_SCAN_LATENCY;
+	} else if (!strcmp(mode, "power")) {
+		return BT_SCAN_POWER;
+	} else {
+		DBG("Invalid value for ScanMode=%s", mode);
+		return BT_SCAN_BALANCED;
+	}
+}
+
 static void check_options(GKeyFile *config, const char *group,
 						const char **options)
 {
@@ -265,7 +301,7 @@ static int get_mode(const char *str)
 static void parse_config(GKeyFile *config)
 {
 	GError *err = NULL;
-	char *str;
+	char *str, **strlist;
 	int val;
 	gboolean boolean;
 
@@ -296,6 +332,42 @@ static void parse_config(GKeyFile *config)
 		main_opts.pairto = val;
 	}
 
+	val = g_key_file_get_integer(config, "General",
+					"DiscoveryUpdateInterval", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else if (val < 0) {
+		warn("Invalid DiscoveryUpdateInterval %d", val);
+	} else {
+		DBG("discov_interval=%d", val);
+		main_opts.discov_interval = val;
+	}
+
+	val = g_key_file_get_integer(config, "General",
+					"DiscoveryUpdateLimit", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else if (val < 0) {
+		warn("Invalid DiscoveryUpdateLimit %d", val);
+	} else {
+		DBG("discov_limit=%d", val);
+		main_opts.discov_limit = val;
+	}
+
+	val = g_key_file_get_integer(config, "General",
+					"ServiceCacheTimeout", &err);
+	if (err) {
+		DBG("%s", err->message);
+		g_clear_error(&err);
+	} else if (val < 0) {
+		warn("Invalid ServiceCacheTimeout %d", val);
+	} else {
+		DBG("svc_cache_timeout=%d", val);
+		main_opts.svc_cache_timeout = val;
+	}
+
 	str = g_key_file_get_string(config, "General", "Privacy", &err);
 	if (err) {
 		DBG("%s", err->message);
@@ -398,6 +470,62 @@ static void parse_config(GKeyFile *config)
 	else
 		main_opts.fast_conn = boolean;
 
+	boolean = g_key_file_get_boolean(config, "General",
+						"LazyDeviceLoading", &err);
+	if (err)
+		g_clear_error(&err);
+	else
+		main_opts.lazy_devices = boolean;
+
+	strlist = g_key_file_get_string_list(config, "General", "LazyPlugins",
+								NULL, &err);
+	if (err) {
+		g_clear_error(&err);
+	} else {
+		g_strfreev(main_opts.lazy_plugins);
+		main_opts.lazy_plugins = strlist;
+	}
+
+	str = g_key_file_get_string(config, "General", "MetricsSocket", &err);
+	if (err) {
+		g_clear_error(&err);
+	} else {
+		DBG("MetricsSocket=%s", str);
+		g_free(main_opts.metrics_socket);
+		main_opts.metrics_socket = str;
+	}
+
+	val = g_key_file_get_integer(config, "General",
+						"MaxPendingConnects", &err);
+	if (err) {
+		g_clear_error(&err);
+	} else if (val < 0) {
+		warn("Invalid MaxPendingConnects %d", val);
+	} else {
+		DBG("MaxPendingConnects=%d", val);
+		main_opts.max_connects = val;
+	}
+
+	str = g_key_file_get_string(config, "General", "ScanMode", &err);
+	if (err) {
+		g_clear_error(&err);
+	} else {
+		DBG("ScanMode=%s", str);
+		main_opts.scan_mode = parse_scan_mode(str);
+		g_free(str);
+	}
+
+	str = g_key_file_get_string(config, "General", "ConnectionPolicy",
+									&err);
+	if (err) {
+		g_clear_error(&err);
+	} else {
+		DBG("ConnectionPolicy=%s", str);
+		if (!btd_conn_policy_from_str(str, &main_opts.conn_policy))
+			warn("Invalid ConnectionPolicy %s", str);
+		g_free(str);
+	}
+
 	str = g_key_file_get_string(config, "GATT", "Cache", &err);
 	if (err) {
 		g_clear_error(&err);
@@ -492,6 +620,9 @@ static gboolean signal_handler(GIOChannel *channel, GIOCondition cond,
 
 		terminated = true;
 		break;
+	case SIGUSR1:
+		btd_metrics_log_footprint();
+		break;
 	case SIGUSR2:
 		__btd_toggle_debug();
 		break;
@@ -510,6 +641,7 @@ static guint setup_signalfd(void)
 	sigemptyset(&mask);
 	sigaddset(&mask, SIGINT);
 	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGUSR1);
 	sigaddset(&mask, SIGUSR2);
 
 	if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
@@ -546,6 +678,7 @@ static gboolean option_compat = FALSE;
 static gboolean option_detach = TRUE;
 static gboolean option_version = FALSE;
 static gboolean option_experimental = FALSE;
+static gboolean option_async_log = FALSE;
 
 static void free_options(void)
 {
@@ -641,6 +774,8 @@ static GOptionEntry options[] = {
 	{ "nodetach", 'n', G_OPTION_FLAG_REVERSE,
 				G_OPTION_ARG_NONE, &option_detach,
 				"Run with logging in foreground" },
+	{ "async-log", 'A', 0, G_OPTION_ARG_NONE, &option_async_log,
+				"Write log messages from a separate thread" },
 	{ "version", 'v', 0, G_OPTION_ARG_NONE, &option_version,
 				"Show version information and exit" },
 	{ NULL },
@@ -656,6 +791,8 @@ int main(int argc, char *argv[])
 	guint signal, watchdog;
 	const char *watchdog_usec;
 
+	btd_startup_begin();
+
 	init_defaults();
 
 	context = g_option_context_new(NULL);
@@ -687,10 +824,15 @@ int main(int argc, char *argv[])
 
 	__btd_log_init(option_debug, option_detach);
 
+	if (option_async_log)
+		__btd_log_async();
+
 	g_log_set_handler("GLib", G_LOG_LEVEL_MASK | G_LOG_FLAG_FATAL |
 							G_LOG_FLAG_RECURSION,
 							log_handler, NULL);
 
+	btd_startup_phase("init");
+
 	sd_notify(0, "STATUS=Starting up");
 
 	if (option_configfile)
@@ -702,11 +844,17 @@ int main(int argc, char *argv[])
 
 	parse_config(main_conf);
 
+	bt_io_set_max_connects(main_opts.max_connects);
+
+	btd_startup_phase("config");
+
 	if (connect_dbus() < 0) {
 		error("Unable to get on D-Bus");
 		exit(1);
 	}
 
+	btd_startup_phase("dbus");
+
 	if (option_experimental)
 		gdbus_flags = G_DBUS_FLAG_ENABLE_EXPERIMENTAL;
 
@@ -720,6 +868,9 @@ int main(int argc, char *argv[])
 	btd_device_init();
 	btd_agent_init();
 	btd_profile_init();
+	btd_metrics_init();
+
+	btd_startup_phase("core");
 
 	if (main_opts.mode != BT_MODE_LE) {
 		if (option_compat == TRUE)
@@ -737,6 +888,8 @@ int main(int argc, char *argv[])
 	if (mps != MPS_OFF)
 		register_mps(mps == MPS_MULTIPLE);
 
+	btd_startup_phase("sdp");
+
 	/* Loading plugins has to be done after D-Bus has been setup since
 	 * the plugins might wanna expose some paths on the bus. However the
 	 * best order of how to init various subsystems of the Bluetooth
@@ -748,6 +901,8 @@ int main(int argc, char *argv[])
 
 	rfkill_init();
 
+	btd_startup_phase("rfkill");
+
 	DBG("Entering main loop");
 
 	sd_notify(0, "STATUS=Running");
@@ -775,12 +930,17 @@ int main(int argc, char *argv[])
 
 	plugin_cleanup();
 
+	g_strfreev(main_opts.lazy_plugins);
+
+	btd_metrics_cleanup();
 	btd_profile_cleanup();
 	btd_agent_cleanup();
 	btd_device_cleanup();
 
 	adapter_cleanup();
 
+	storage_cleanup();
+
 	rfkill_exit();
 
 	if (main_opts.mode != BT_MODE_LE)
@@ -0,0 +1,771 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2017  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <glib.h>
+#include <dbus/dbus.h>
+
+#include "lib/bluetooth.h"
+#include "lib/sdp.h"
+
+#include "gdbus/gdbus.h"
+
+#include "btio/btio.h"
+
+#include "src/shared/att.h"
+#include "src/shared/queue.h"
+
+#include "log.h"
+#include "hcid.h"
+#include "dbus-common.h"
+#include "adapter.h"
+#include "device.h"
+#include "metrics.h"
+
+#define METRICS_INTERFACE "org.bluez.Metrics1"
+
+/*
+ * bluetoothd runs everything from its mainloop, so plain counters are
+ * enough and updating them is a single increment.
+ */
+static uint64_t counters[BTD_METRIC_MAX];
+
+static const struct {
+	const char *name;
+	const char *key;
+	const char *help;
+	bool gauge;
+} counter_info[BTD_METRIC_MAX] = {
+	[BTD_METRIC_MGMT_COMMANDS] = { "bluez_mgmt_commands_total",
+				"MgmtCommands",
+				"Management commands completed" },
+	[BTD_METRIC_MGMT_ERRORS] = { "bluez_mgmt_errors_total",
+				"MgmtErrors",
+				"Management commands that returned an error" },
+	[BTD_METRIC_ATT_RX_PDUS] = { "bluez_att_rx_pdus_total",
+				"ATTReceivedPDUs",
+				"ATT PDUs received on all bearers" },
+	[BTD_METRIC_ATT_TX_PDUS] = { "bluez_att_tx_pdus_total",
+				"ATTSentPDUs",
+				"ATT PDUs sent on all bearers" },
+	[BTD_METRIC_STORAGE_WRITES] = { "bluez_storage_writes_total",
+				"StorageWrites",
+				"Files written to the storage directory" },
+	[BTD_METRIC_DEVICES] = { "bluez_devices", "Devices",
+				"Device objects", true },
+	[BTD_METRIC_CONNECTS] = { "bluez_connects_total", "Connects",
+				"Outgoing connect attempts completed" },
+	[BTD_METRIC_CONNECT_ERRORS] = { "bluez_connect_errors_total",
+				"ConnectErrors",
+				"Outgoing connect attempts that failed" },
+};
+
+/* Upper bucket bounds in microseconds, the last bucket is unbounded */
+static const uint64_t bucket_bounds[] = {
+	1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+	1000000, 2500000, 5000000, 10000000,
+};
+
+#define NUM_BOUNDS (sizeof(bucket_bounds) / sizeof(bucket_bounds[0]))
+#define HISTOGRAM_BUCKETS (NUM_BOUNDS + 1)
+
+struct histogram {
+	uint64_t buckets[HISTOGRAM_BUCKETS];
+	uint64_t count;
+	uint64_t sum;
+};
+
+static struct histogram histograms[BTD_HISTOGRAM_MAX];
+
+static const struct {
+	const char *name;
+	const char *key;
+	const char *help;
+} histogram_info[BTD_HISTOGRAM_MAX] = {
+	[BTD_HISTOGRAM_MGMT_LATENCY] = { "bluez_mgmt_command_seconds",
+				"MgmtCommandLatency",
+				"Management command round trip time" },
+	[BTD_HISTOGRAM_GATT_DISCOVERY] = { "bluez_gatt_discovery_seconds",
+				"GattDiscoveryTime",
+				"Time until a remote GATT database is ready" },
+	[BTD_HISTOGRAM_CONNECT] = { "bluez_connect_seconds", "ConnectTime",
+				"Time an outgoing connect took to complete" },
+	[BTD_HISTOGRAM_CONNECT_QUEUED] = { "bluez_connect_queued_seconds",
+				"ConnectQueueTime",
+				"Time an outgoing connect waited for a slot" },
+};
+
+/*
+ * Startup profiling: every phase is recorded with the time it took since
+ * the previous one, up to the point where all controllers present at
+ * startup are registered.
+ */
+#define STARTUP_MAX_PHASES 64
+
+static struct {
+	char name[32];
+	int64_t usec;
+} startup_phases[STARTUP_MAX_PHASES];
+
+static unsigned int startup_count;
+static int64_t startup_begin;
+static int64_t startup_last;
+static bool startup_done;
+
+struct footprint_reporter {
+	char *name;
+	btd_footprint_func_t func;
+	void *user_data;
+};
+
+static struct queue *reporters;
+
+static int metrics_sk = -1;
+static guint metrics_watch;
+
+void btd_metrics_add(enum btd_metric metric, uint64_t value)
+{
+	if (metric < BTD_METRIC_MAX)
+		counters[metric] += value;
+}
+
+void btd_metrics_inc(enum btd_metric metric)
+{
+	btd_metrics_add(metric, 1);
+}
+
+void btd_metrics_dec(enum btd_metric metric)
+{
+	if (metric < BTD_METRIC_MAX && counters[metric] > 0)
+		counters[metric]--;
+}
+
+void btd_metrics_observe(enum btd_histogram histogram, uint64_t usec)
+{
+	struct histogram *hist;
+	unsigned int i;
+
+	if (histogram >= BTD_HISTOGRAM_MAX)
+		return;
+
+	hist = &histograms[histogram];
+
+	for (i = 0; i < NUM_BOUNDS; i++) {
+		if (usec <= bucket_bounds[i])
+			break;
+	}
+
+	hist->buckets[i]++;
+	hist->count++;
+	hist->sum += usec;
+}
+
+void btd_startup_begin(void)
+{
+	startup_begin = g_get_monotonic_time();
+	startup_last = startup_begin;
+}
+
+void btd_startup_phase(const char *format, ...)
+{
+	va_list ap;
+	int64_t now;
+
+	if (!startup_begin || startup_done ||
+					startup_count >= STARTUP_MAX_PHASES)
+		return;
+
+	now = g_get_monotonic_time();
+
+	va_start(ap, format);
+	vsnprintf(startup_phases[startup_count].name,
+			sizeof(startup_phases[startup_count].name), format, ap);
+	va_end(ap);
+
+	startup_phases[startup_count].usec = now - startup_last;
+
+	DBG("%s took %" PRId64 ".%03" PRId64 " ms (%" PRId64 " ms total)",
+			startup_phases[startup_count].name,
+			(now - startup_last) / 1000,
+			(now - startup_last) % 1000,
+			(now - startup_begin) / 1000);
+
+	startup_count++;
+	startup_last = now;
+}
+
+void btd_startup_complete(void)
+{
+	if (!startup_begin || startup_done)
+		return;
+
+	startup_done = true;
+
+	info("Startup completed in %" PRId64 " ms",
+				(startup_last - startup_begin) / 1000);
+}
+
+static void append_startup(DBusMessageIter *dict)
+{
+	DBusMessageIter entry, variant, array;
+	const char *key = "StartupPhases";
+	unsigned int i;
+
+	dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL,
+								&entry);
+	dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+	dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, "a(st)",
+								&variant);
+	dbus_message_iter_open_container(&variant, DBUS_TYPE_ARRAY, "(st)",
+								&array);
+
+	for (i = 0; i < startup_count; i++) {
+		DBusMessageIter phase;
+		const char *name = startup_phases[i].name;
+		dbus_uint64_t usec = startup_phases[i].usec;
+
+		dbus_message_iter_open_container(&array, DBUS_TYPE_STRUCT,
+								NULL, &phase);
+		dbus_message_iter_append_basic(&phase, DBUS_TYPE_STRING,
+								&name);
+		dbus_message_iter_append_basic(&phase, DBUS_TYPE_UINT64,
+								&usec);
+		dbus_message_iter_close_container(&array, &phase);
+	}
+
+	dbus_message_iter_close_container(&variant, &array);
+	dbus_message_iter_close_container(&entry, &variant);
+	dbus_message_iter_close_container(dict, &entry);
+}
+
+static bool match_reporter_name(const void *data, const void *match_data)
+{
+	const struct footprint_reporter *reporter = data;
+
+	return !strcmp(reporter->name, match_data);
+}
+
+static void reporter_free(void *data)
+{
+	struct footprint_reporter *reporter = data;
+
+	g_free(reporter->name);
+	g_free(reporter);
+}
+
+bool btd_metrics_register_footprint(const char *name,
+					btd_footprint_func_t func,
+					void *user_data)
+{
+	struct footprint_reporter *reporter;
+
+	if (!name || !func)
+		return false;
+
+	if (!reporters)
+		reporters = queue_new();
+
+	if (queue_find(reporters, match_reporter_name, name))
+		return false;
+
+	reporter = g_new0(struct footprint_reporter, 1);
+	reporter->name = g_strdup(name);
+	reporter->func = func;
+	reporter->user_data = user_data;
+
+	queue_push_tail(reporters, reporter);
+
+	return true;
+}
+
+void btd_metrics_unregister_footprint(const char *name)
+{
+	struct footprint_reporter *reporter;
+
+	reporter = queue_remove_if(reporters, match_reporter_name,
+							(void *) name);
+	if (reporter)
+		reporter_free(reporter);
+}
+
+static void get_footprint(const struct footprint_reporter *reporter,
+					struct btd_footprint *footprint)
+{
+	memset(footprint, 0, sizeof(*footprint));
+
+	reporter->func(footprint, reporter->user_data);
+}
+
+void btd_metrics_log_footprint(void)
+{
+	const struct queue_entry *entry;
+	size_t total = 0;
+
+	for (entry = queue_get_entries(reporters); entry;
+							entry = entry->next) {
+		const struct footprint_reporter *reporter = entry->data;
+		struct btd_footprint footprint;
+
+		get_footprint(reporter, &footprint);
+
+		info("Memory: %s %u objects %zu bytes", reporter->name,
+					footprint.objects, footprint.bytes);
+
+		total += footprint.bytes;
+	}
+
+	info("Memory: %zu bytes accounted in total", total);
+}
+
+static DBusMessage *get_memory_usage(DBusConnection *conn, DBusMessage *msg,
+							void *user_data)
+{
+	const struct queue_entry *entry;
+	DBusMessage *reply;
+	DBusMessageIter iter, dict;
+
+	reply = dbus_message_new_method_return(msg);
+	if (!reply)
+		return NULL;
+
+	dbus_message_iter_init_append(reply, &iter);
+
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+					DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+					DBUS_TYPE_STRING_AS_STRING
+					DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+					DBUS_TYPE_UINT32_AS_STRING
+					DBUS_TYPE_UINT64_AS_STRING
+					DBUS_STRUCT_END_CHAR_AS_STRING
+					DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
+					&dict);
+
+	for (entry = queue_get_entries(reporters); entry;
+							entry = entry->next) {
+		const struct footprint_reporter *reporter = entry->data;
+		struct btd_footprint footprint;
+		DBusMessageIter item, value;
+		dbus_uint32_t objects;
+		dbus_uint64_t bytes;
+
+		get_footprint(reporter, &footprint);
+
+		objects = footprint.objects;
+		bytes = footprint.bytes;
+
+		dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY,
+								NULL, &item);
+		dbus_message_iter_append_basic(&item, DBUS_TYPE_STRING,
+							&reporter->name);
+		dbus_message_iter_open_container(&item, DBUS_TYPE_STRUCT,
+								NULL, &value);
+		dbus_message_iter_append_basic(&value, DBUS_TYPE_UINT32,
+								&objects);
+		dbus_message_iter_append_basic(&value, DBUS_TYPE_UINT64,
+								&bytes);
+		dbus_message_iter_close_container(&item, &value);
+		dbus_message_iter_close_container(&dict, &item);
+	}
+
+	dbus_message_iter_close_container(&iter, &dict);
+
+	return reply;
+}
+
+static void append_footprint(GString *out)
+{
+	const struct queue_entry *entry;
+	GString *objects;
+
+	objects = g_string_new("# HELP bluez_memory_objects "
+					"Objects held per subsystem\n"
+				"# TYPE bluez_memory_objects gauge\n");
+
+	g_string_append(out, "# HELP bluez_memory_bytes "
+				"Approximate bytes allocated per subsystem\n"
+				"# TYPE bluez_memory_bytes gauge\n");
+
+	for (entry = queue_get_entries(reporters); entry;
+							entry = entry->next) {
+		const struct footprint_reporter *reporter = entry->data;
+		struct btd_footprint footprint;
+
+		get_footprint(reporter, &footprint);
+
+		g_string_append_printf(out,
+				"bluez_memory_bytes{subsystem=\"%s\"} %zu\n",
+				reporter->name, footprint.bytes);
+		g_string_append_printf(objects,
+				"bluez_memory_objects{subsystem=\"%s\"} %u\n",
+				reporter->name, footprint.objects);
+	}
+
+	g_string_append_len(out, objects->str, objects->len);
+	g_string_free(objects, TRUE);
+}
+
+/*
+ * The ATT counters only hold the PDUs of bearers that are gone already,
+ * the live ones are collected from the connected devices on demand.
+ */
+struct att_collect {
+	uint64_t rx_pdus;
+	uint64_t tx_pdus;
+	GString *out;
+};
+
+static void collect_device(struct btd_device *device, void *user_data)
+{
+	struct att_collect *collect = user_data;
+	struct bt_att_pdu_stats stats;
+	char addr[18];
+
+	if (!btd_device_get_att_stats(device, &stats))
+		return;
+
+	collect->rx_pdus += stats.rx_pdus;
+	collect->tx_pdus += stats.tx_pdus;
+
+	if (!collect->out)
+		return;
+
+	ba2str(device_get_address(device), addr);
+
+	g_string_append_printf(collect->out,
+			"bluez_att_connection_pdus{device=\"%s\",dir=\"rx\"} "
+			"%" PRIu64 "\n", addr, stats.rx_pdus);
+	g_string_append_printf(collect->out,
+			"bluez_att_connection_pdus{device=\"%s\",dir=\"tx\"} "
+			"%" PRIu64 "\n", addr, stats.tx_pdus);
+}
+
+static void collect_adapter(struct btd_adapter *adapter, gpointer user_data)
+{
+	btd_adapter_for_each_device(adapter, collect_device, user_data);
+}
+
+static uint64_t get_counter(enum btd_metric metric,
+					const struct att_collect *collect)
+{
+	switch (metric) {
+	case BTD_METRIC_ATT_RX_PDUS:
+		return counters[metric] + collect->rx_pdus;
+	case BTD_METRIC_ATT_TX_PDUS:
+		return counters[metric] + collect->tx_pdus;
+	default:
+		return counters[metric];
+	}
+}
+
+static DBusMessage *get_metrics(DBusConnection *conn, DBusMessage *msg,
+							void *user_data)
+{
+	struct att_collect collect = { 0, 0, NULL };
+	DBusMessage *reply;
+	DBusMessageIter iter, dict;
+	dbus_uint64_t value;
+	unsigned int i;
+
+	reply = dbus_message_new_method_return(msg);
+	if (!reply)
+		return NULL;
+
+	adapter_foreach(collect_adapter, &collect);
+
+	dbus_message_iter_init_append(reply, &iter);
+
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+					DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+					DBUS_TYPE_STRING_AS_STRING
+					DBUS_TYPE_VARIANT_AS_STRING
+					DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
+					&dict);
+
+	for (i = 0; i < BTD_METRIC_MAX; i++) {
+		value = get_counter(i, &collect);
+		dict_append_entry(&dict, counter_info[i].key,
+						DBUS_TYPE_UINT64, &value);
+	}
+
+	value = g_dbus_get_signals_sent();
+	dict_append_entry(&dict, "DBusSignals", DBUS_TYPE_UINT64, &value);
+
+	for (i = 0; i < BTD_HISTOGRAM_MAX; i++) {
+		const struct histogram *hist = &histograms[i];
+		const dbus_uint64_t *buckets = (void *) hist->buckets;
+		char key[64];
+
+		snprintf(key, sizeof(key), "%sCount", histogram_info[i].key);
+		value = hist->count;
+		dict_append_entry(&dict, key, DBUS_TYPE_UINT64, &value);
+
+		snprintf(key, sizeof(key), "%sSum", histogram_info[i].key);
+		value = hist->sum;
+		dict_append_entry(&dict, key, DBUS_TYPE_UINT64, &value);
+
+		snprintf(key, sizeof(key), "%sBuckets", histogram_info[i].key);
+		dict_append_array(&dict, key, DBUS_TYPE_UINT64, &buckets,
+							HISTOGRAM_BUCKETS);
+	}
+
+	append_startup(&dict);
+
+	dbus_message_iter_close_container(&iter, &dict);
+
+	return reply;
+}
+
+static const GDBusMethodTable methods[] = {
+	{ GDBUS_METHOD("GetMetrics", NULL,
+			GDBUS_ARGS({ "metrics", "a{sv}" }), get_metrics) },
+	{ GDBUS_METHOD("GetMemoryUsage", NULL,
+			GDBUS_ARGS({ "usage", "a{s(ut)}" }),
+			get_memory_usage) },
+	{ }
+};
+
+static void append_histogram(GString *out, unsigned int index)
+{
+	const struct histogram *hist = &histograms[index];
+	const char *name = histogram_info[index].name;
+	uint64_t total = 0;
+	unsigned int i;
+
+	g_string_append_printf(out, "# HELP %s %s\n# TYPE %s histogram\n",
+				name, histogram_info[index].help, name);
+
+	for (i = 0; i < NUM_BOUNDS; i++) {
+		total += hist->buckets[i];
+		g_string_append_printf(out,
+				"%s_bucket{le=\"%g\"} %" PRIu64 "\n", name,
+				bucket_bounds[i] / 1000000.0, total);
+	}
+
+	g_string_append_printf(out, "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n",
+							name, hist->count);
+	g_string_append_printf(out, "%s_sum %.6f\n", name,
+						hist->sum / 1000000.0);
+	g_string_append_printf(out, "%s_count %" PRIu64 "\n", name,
+							hist->count);
+}
+
+static GString *format_text(void)
+{
+	struct att_collect collect = { 0, 0, NULL };
+	GString *out;
+	unsigned int i;
+
+	out = g_string_sized_new(4096);
+
+	adapter_foreach(collect_adapter, &collect);
+
+	for (i = 0; i < BTD_METRIC_MAX; i++) {
+		const char *name = counter_info[i].name;
+
+		g_string_append_printf(out, "# HELP %s %s\n# TYPE %s %s\n",
+				name, counter_info[i].help, name,
+				counter_info[i].gauge ? "gauge" : "counter");
+		g_string_append_printf(out, "%s %" PRIu64 "\n", name,
+						get_counter(i, &collect));
+	}
+
+	g_string_append(out, "# HELP bluez_dbus_signals_total "
+					"D-Bus signals emitted\n"
+				"# TYPE bluez_dbus_signals_total counter\n");
+	g_string_append_printf(out, "bluez_dbus_signals_total %lu\n",
+						g_dbus_get_signals_sent());
+
+	for (i = 0; i < BTD_HISTOGRAM_MAX; i++)
+		append_histogram(out, i);
+
+	g_string_append(out, "# HELP bluez_startup_phase_seconds "
+					"Time taken by each startup phase\n"
+				"# TYPE bluez_startup_phase_seconds gauge\n");
+
+	for (i = 0; i < startup_count; i++)
+		g_string_append_printf(out,
+			"bluez_startup_phase_seconds{phase=\"%s\"} %.6f\n",
+			startup_phases[i].name,
+			startup_phases[i].usec / 1000000.0);
+
+	append_footprint(out);
+
+	g_string_append(out, "# HELP bluez_att_connection_pdus "
+					"ATT PDUs on the current bearer\n"
+				"# TYPE bluez_att_connection_pdus counter\n");
+
+	/* Second pass only to print the connections after their header */
+	collect.out = out;
+	adapter_foreach(collect_adapter, &collect);
+
+	return out;
+}
+
+static gboolean metrics_accept(GIOChannel *io, GIOCondition cond,
+							gpointer user_data)
+{
+	GString *out;
+	size_t offset = 0;
+	int sk;
+
+	if (cond & (G_IO_NVAL | G_IO_ERR | G_IO_HUP)) {
+		metrics_watch = 0;
+		return FALSE;
+	}
+
+	sk = accept4(metrics_sk, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+	if (sk < 0)
+		return TRUE;
+
+	out = format_text();
+
+	/*
+	 * Never block the mainloop on a slow reader, the output fits in the
+	 * socket buffer and a reader that can't keep up gets it truncated.
+	 */
+	while (offset < out->len) {
+		ssize_t len;
+
+		len = send(sk, out->str + offset, out->len - offset,
+							MSG_NOSIGNAL);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		offset += len;
+	}
+
+	g_string_free(out, TRUE);
+	close(sk);
+
+	return TRUE;
+}
+
+static void metrics_socket_init(const char *path)
+{
+	struct sockaddr_un addr;
+	GIOChannel *io;
+	int sk;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		error("Metrics socket path too long");
+		return;
+	}
+
+	sk = socket(PF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (sk < 0) {
+		error("Failed to open metrics socket: %s", strerror(errno));
+		return;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	unlink(addr.sun_path);
+
+	if (bind(sk, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+							listen(sk, 5) < 0) {
+		error("Failed to listen on %s: %s", path, strerror(errno));
+		close(sk);
+		return;
+	}
+
+	chmod(path, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+
+	io = g_io_channel_unix_new(sk);
+	metrics_watch = g_io_add_watch(io, G_IO_IN | G_IO_ERR | G_IO_HUP |
+						G_IO_NVAL, metrics_accept, NULL);
+	g_io_channel_unref(io);
+
+	metrics_sk = sk;
+
+	DBG("Metrics available on %s", path);
+}
+
+static void connect_stats(GIOChannel *io, int err, gint64 queued,
+					gint64 connect, gpointer user_data)
+{
+	DBG("connect %s (%d) queued %" G_GINT64_FORMAT " us took %"
+			G_GINT64_FORMAT " us", strerror(err), err, queued,
+			connect);
+
+	btd_metrics_inc(BTD_METRIC_CONNECTS);
+	if (err)
+		btd_metrics_inc(BTD_METRIC_CONNECT_ERRORS);
+
+	btd_metrics_observe(BTD_HISTOGRAM_CONNECT, connect);
+	btd_metrics_observe(BTD_HISTOGRAM_CONNECT_QUEUED, queued);
+}
+
+void btd_metrics_init(void)
+{
+	bt_io_set_connect_stats(connect_stats, NULL);
+
+	g_dbus_register_interface(btd_get_dbus_connection(),
+				"/org/bluez", METRICS_INTERFACE,
+				methods, NULL, NULL, NULL, NULL);
+
+	if (main_opts.metrics_socket)
+		metrics_socket_init(main_opts.metrics_socket);
+}
+
+void btd_metrics_cleanup(void)
+{
+	bt_io_set_connect_stats(NULL, NULL);
+
+	queue_destroy(reporters, reporter_free);
+	reporters = NULL;
+
+	g_dbus_unregister_interface(btd_get_dbus_connection(),
+				"/org/bluez", METRICS_INTERFACE);
+
+	if (metrics_watch > 0) {
+		g_source_remove(metrics_watch);
+		metrics_watch = 0;
+	}
+
+	if (metrics_sk >= 0) {
+		close(metrics_sk);
+		metrics_sk = -1;
+		unlink(main_opts.metrics_socket);
+	}
+}
@@ -0,0 +1,81 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2017  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+enum btd_metric {
+	BTD_METRIC_MGMT_COMMANDS,
+	BTD_METRIC_MGMT_ERRORS,
+	BTD_METRIC_ATT_RX_PDUS,
+	BTD_METRIC_ATT_TX_PDUS,
+	BTD_METRIC_STORAGE_WRITES,
+	BTD_METRIC_DEVICES,
+	BTD_METRIC_CONNECTS,
+	BTD_METRIC_CONNECT_ERRORS,
+	BTD_METRIC_MAX
+};
+
+enum btd_histogram {
+	BTD_HISTOGRAM_MGMT_LATENCY,
+	BTD_HISTOGRAM_GATT_DISCOVERY,
+	BTD_HISTOGRAM_CONNECT,
+	BTD_HISTOGRAM_CONNECT_QUEUED,
+	BTD_HISTOGRAM_MAX
+};
+
+void btd_metrics_add(enum btd_metric metric, uint64_t value);
+void btd_metrics_inc(enum btd_metric metric);
+void btd_metrics_dec(enum btd_metric metric);
+
+/* Record a duration in microseconds */
+void btd_metrics_observe(enum btd_histogram histogram, uint64_t usec);
+
+/*
+ * Startup profiling. Each phase is named when it ends and the phases are
+ * printed with -d and exported along with the other metrics.
+ */
+void btd_startup_begin(void);
+void btd_startup_phase(const char *format, ...)
+				__attribute__((format(printf, 1, 2)));
+void btd_startup_complete(void);
+
+/*
+ * Memory accounting. Subsystems report the objects they hold and the
+ * approximate bytes allocated for them, which is only computed when the
+ * footprint is requested.
+ */
+struct btd_footprint {
+	unsigned int objects;
+	size_t bytes;
+};
+
+typedef void (*btd_footprint_func_t)(struct btd_footprint *footprint,
+							void *user_data);
+
+bool btd_metrics_register_footprint(const char *name,
+					btd_footprint_func_t func,
+					void *user_data);
+void btd_metrics_unregister_footprint(const char *name);
+void btd_metrics_log_footprint(void);
+
+void btd_metrics_init(void);
+void btd_metrics_cleanup(void);
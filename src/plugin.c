@@ -28,6 +28,7 @@
 #include <errno.h>
 #include <dlfcn.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/stat.h>
 
 #include <glib.h>
@@ -38,12 +39,14 @@
 #include "src/plugin.h"
 #include "src/log.h"
 #include "src/hcid.h"
+#include "src/metrics.h"
 
 static GSList *plugins = NULL;
 
 struct bluetooth_plugin {
 	void *handle;
 	gboolean active;
+	gboolean deferred;
 	struct bluetooth_plugin_desc *desc;
 };
 
@@ -110,6 +113,69 @@ static gboolean enable_plugin(const char *name, char **cli_enable,
 	return TRUE;
 }
 
+static gboolean is_lazy(struct bluetooth_plugin_desc *desc)
+{
+	char **pattern;
+
+	if (!desc->uuids || !main_opts.lazy_plugins)
+		return FALSE;
+
+	for (pattern = main_opts.lazy_plugins; *pattern; pattern++) {
+		if (g_pattern_match_simple(*pattern, desc->name))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void start_plugin(struct bluetooth_plugin *plugin)
+{
+	int err;
+
+	err = plugin->desc->init();
+	if (err < 0) {
+		if (err == -ENOSYS)
+			warn("System does not support %s plugin",
+							plugin->desc->name);
+		else
+			error("Failed to init %s plugin", plugin->desc->name);
+		return;
+	}
+
+	plugin->active = TRUE;
+}
+
+static gboolean match_uuid(struct bluetooth_plugin_desc *desc,
+							const char *uuid)
+{
+	const char * const *l;
+
+	for (l = desc->uuids; *l; l++) {
+		if (!strcasecmp(*l, uuid))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+void plugin_require_uuid(const char *uuid)
+{
+	GSList *list;
+
+	for (list = plugins; list; list = list->next) {
+		struct bluetooth_plugin *plugin = list->data;
+
+		if (!plugin->deferred || !match_uuid(plugin->desc, uuid))
+			continue;
+
+		DBG("Starting %s plugin for %s", plugin->desc->name, uuid);
+
+		/* Cleared first as init may see the same UUID again */
+		plugin->deferred = FALSE;
+		start_plugin(plugin);
+	}
+}
+
 #include "src/builtin.h"
 
 gboolean plugin_init(const char *enable, const char *disable)
@@ -193,22 +259,20 @@ gboolean plugin_init(const char *enable, const char *disable)
 	g_dir_close(dir);
 
 start:
+	btd_startup_phase("plugin loading");
+
 	for (list = plugins; list; list = list->next) {
 		struct bluetooth_plugin *plugin = list->data;
-		int err;
 
-		err = plugin->desc->init();
-		if (err < 0) {
-			if (err == -ENOSYS)
-				warn("System does not support %s plugin",
-							plugin->desc->name);
-			else
-				error("Failed to init %s plugin",
-							plugin->desc->name);
+		if (is_lazy(plugin->desc)) {
+			DBG("Deferring %s plugin", plugin->desc->name);
+			plugin->deferred = TRUE;
 			continue;
 		}
 
-		plugin->active = TRUE;
+		start_plugin(plugin);
+
+		btd_startup_phase("plugin %s", plugin->desc->name);
 	}
 
 	g_strfreev(cli_enabled);
@@ -32,15 +32,23 @@ struct bluetooth_plugin_desc {
 	void (*exit) (void);
 	void *debug_start;
 	void *debug_stop;
+	const char * const *uuids;
 };
 
+/*
+ * Plugins defined with a list of remote UUIDs may have their init
+ * deferred, see LazyPlugins in main.conf, until one of them is seen.
+ */
 #ifdef BLUETOOTH_PLUGIN_BUILTIN
-#define BLUETOOTH_PLUGIN_DEFINE(name, version, priority, init, exit) \
+#define BLUETOOTH_PLUGIN_DEFINE_LAZY(name, version, priority, init, exit, \
+									uuids) \
 		struct bluetooth_plugin_desc __bluetooth_builtin_ ## name = { \
-			#name, version, priority, init, exit \
+			#name, version, priority, init, exit, NULL, NULL, \
+			uuids \
 		};
 #else
-#define BLUETOOTH_PLUGIN_DEFINE(name, version, priority, init, exit) \
+#define BLUETOOTH_PLUGIN_DEFINE_LAZY(name, version, priority, init, exit, \
+									uuids) \
 		extern struct btd_debug_desc __start___debug[] \
 				__attribute__ ((weak, visibility("hidden"))); \
 		extern struct btd_debug_desc __stop___debug[] \
@@ -49,6 +57,11 @@ struct bluetooth_plugin_desc {
 				__attribute__ ((visibility("default"))); \
 		struct bluetooth_plugin_desc bluetooth_plugin_desc = { \
 			#name, version, priority, init, exit, \
-			__start___debug, __stop___debug \
+			__start___debug, __stop___debug, uuids \
 		};
 #endif
+
+#define BLUETOOTH_PLUGIN_DEFINE(name, version, priority, init, exit) \
+	BLUETOOTH_PLUGIN_DEFINE_LAZY(name, version, priority, init, exit, NULL)
+
+void plugin_require_uuid(const char *uuid);
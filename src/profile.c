@@ -43,6 +43,7 @@
 #include "btio/btio.h"
 #include "sdpd.h"
 #include "log.h"
+#include "plugin.h"
 #include "error.h"
 #include "uuid-helper.h"
 #include "dbus-common.h"
@@ -652,6 +653,24 @@ struct ext_profile {
 	GSList *conns;
 
 	GSList *connects;
+
+	GSList *remote_info;
+};
+
+/*
+ * Features and version parsed from the remote record of a device, most
+ * recent first. The device and record are only compared, never followed,
+ * so entries going stale is harmless.
+ */
+#define EXT_REMOTE_INFO_MAX	8
+
+struct ext_remote_info {
+	const struct btd_device *device;
+	bdaddr_t bdaddr;
+	const sdp_record_t *rec;
+	uint32_t handle;
+	uint16_t version;
+	uint16_t features;
 };
 
 struct ext_io {
@@ -950,6 +969,47 @@ static uint16_t get_profile_version(const sdp_record_t *rec)
 	return version;
 }
 
+static void get_remote_info(struct ext_profile *ext, struct ext_io *conn,
+						const sdp_record_t *rec)
+{
+	const bdaddr_t *bdaddr = device_get_address(conn->device);
+	struct ext_remote_info *info;
+	GSList *l;
+
+	for (l = ext->remote_info; l != NULL; l = g_slist_next(l)) {
+		info = l->data;
+
+		if (info->device == conn->device && info->rec == rec &&
+					info->handle == rec->handle &&
+					!bacmp(&info->bdaddr, bdaddr))
+			break;
+	}
+
+	if (l) {
+		ext->remote_info = g_slist_delete_link(ext->remote_info, l);
+	} else {
+		info = g_new0(struct ext_remote_info, 1);
+		info->device = conn->device;
+		bacpy(&info->bdaddr, bdaddr);
+		info->rec = rec;
+		info->handle = rec->handle;
+		info->features = get_supported_features(rec);
+		info->version = get_profile_version(rec);
+
+		if (g_slist_length(ext->remote_info) >= EXT_REMOTE_INFO_MAX) {
+			l = g_slist_last(ext->remote_info);
+			g_free(l->data);
+			ext->remote_info = g_slist_delete_link(
+							ext->remote_info, l);
+		}
+	}
+
+	ext->remote_info = g_slist_prepend(ext->remote_info, info);
+
+	conn->features = info->features;
+	conn->version = info->version;
+}
+
 static bool send_new_connection(struct ext_profile *ext, struct ext_io *conn)
 {
 	DBusMessage *msg;
@@ -970,10 +1030,8 @@ static bool send_new_connection(struct ext_profile *ext, struct ext_io *conn)
 
 	if (remote_uuid) {
 		rec = btd_device_get_record(conn->device, remote_uuid);
-		if (rec) {
-			conn->features = get_supported_features(rec);
-			conn->version = get_profile_version(rec);
-		}
+		if (rec)
+			get_remote_info(ext, conn, rec);
 	}
 
 	dbus_message_iter_init_append(msg, &iter);
@@ -2327,6 +2385,7 @@ static void remove_ext(struct ext_profile *ext)
 
 	g_slist_free_full(ext->servers, ext_io_destroy);
 	g_slist_free_full(ext->conns, ext_io_destroy);
+	g_slist_free_full(ext->remote_info, g_free);
 
 	g_free(ext->remote_uuid);
 	g_free(ext->name);
@@ -2381,6 +2440,8 @@ static DBusMessage *register_profile(DBusConnection *conn,
 	if (!ext)
 		return btd_error_invalid_args(msg);
 
+	plugin_require_uuid(ext->uuid);
+
 	ext->id = g_dbus_add_disconnect_watch(conn, sender, ext_exited, ext,
 									NULL);
 
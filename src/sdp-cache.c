@@ -0,0 +1,500 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lib/bluetooth.h"
+#include "lib/sdp.h"
+#include "lib/sdp_lib.h"
+
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "sdp-cache.h"
+
+/*
+ * The cache file holds the raw PDU of every record, as generated by
+ * sdp_gen_record_pdu(), next to its handle and first service class. Loading
+ * only validates this index so records are parsed when a profile asks for
+ * them. All integers are little endian and the class is the 128 bit UUID in
+ * network order.
+ *
+ *	header:	magic[8] version(1) reserved(3) count(4)
+ *	record:	handle(4) pdu_len(4) class_len(1) reserved(3)
+ *		class[class_len] pdu[pdu_len]
+ */
+#define CACHE_MAGIC		"btsdpc"
+#define CACHE_VERSION		1
+
+#define CACHE_HDR_LEN		16
+#define CACHE_REC_LEN		12
+
+#define CACHE_CLASS_LEN		16
+
+struct sdp_cache {
+	struct queue *records;
+	bool dirty;
+};
+
+struct cache_record {
+	uint32_t handle;
+	bool has_class;
+	uint8_t class[CACHE_CLASS_LEN];
+	uint8_t *pdu;
+	uint32_t len;
+	sdp_record_t *rec;
+};
+
+static void cache_record_free(void *data)
+{
+	struct cache_record *record = data;
+
+	if (record->rec)
+		sdp_record_free(record->rec);
+
+	free(record->pdu);
+	free(record);
+}
+
+struct sdp_cache *sdp_cache_new(void)
+{
+	struct sdp_cache *cache;
+
+	cache = new0(struct sdp_cache, 1);
+	cache->records = queue_new();
+
+	return cache;
+}
+
+void sdp_cache_free(struct sdp_cache *cache)
+{
+	if (!cache)
+		return;
+
+	queue_destroy(cache->records, cache_record_free);
+	free(cache);
+}
+
+unsigned int sdp_cache_count(struct sdp_cache *cache)
+{
+	if (!cache)
+		return 0;
+
+	return queue_length(cache->records);
+}
+
+static size_t data_footprint(const sdp_data_t *data)
+{
+	const sdp_data_t *child;
+	size_t size = sizeof(*data);
+
+	switch (data->dtd) {
+	case SDP_SEQ8:
+	case SDP_SEQ16:
+	case SDP_SEQ32:
+	case SDP_ALT8:
+	case SDP_ALT16:
+	case SDP_ALT32:
+		for (child = data->val.dataseq; child; child = child->next)
+			size += data_footprint(child);
+		break;
+	case SDP_TEXT_STR8:
+	case SDP_TEXT_STR16:
+	case SDP_TEXT_STR32:
+	case SDP_URL_STR8:
+	case SDP_URL_STR16:
+	case SDP_URL_STR32:
+		size += data->unitSize;
+		break;
+	}
+
+	return size;
+}
+
+static size_t record_footprint(const sdp_record_t *rec)
+{
+	const sdp_list_t *l;
+	size_t size = sizeof(*rec);
+
+	for (l = rec->attrlist; l; l = l->next)
+		size += sizeof(*l) + data_footprint(l->data);
+
+	for (l = rec->pattern; l; l = l->next)
+		size += sizeof(*l) + sizeof(uuid_t);
+
+	return size;
+}
+
+size_t sdp_cache_get_footprint(struct sdp_cache *cache)
+{
+	const struct queue_entry *entry;
+	size_t size;
+
+	if (!cache)
+		return 0;
+
+	size = sizeof(*cache) + queue_get_footprint(cache->records);
+
+	for (entry = queue_get_entries(cache->records); entry;
+							entry = entry->next) {
+		const struct cache_record *record = entry->data;
+
+		size += sizeof(*record) + record->len;
+
+		/* Records are only parsed once a profile looked them up */
+		if (record->rec)
+			size += record_footprint(record->rec);
+	}
+
+	return size;
+}
+
+static bool uuid_to_class(const uuid_t *uuid, uint8_t *class)
+{
+	uuid_t u128;
+
+	switch (uuid->type) {
+	case SDP_UUID16:
+		sdp_uuid16_to_uuid128(&u128, uuid);
+		break;
+	case SDP_UUID32:
+		sdp_uuid32_to_uuid128(&u128, uuid);
+		break;
+	case SDP_UUID128:
+		u128 = *uuid;
+		break;
+	default:
+		return false;
+	}
+
+	memcpy(class, &u128.value.uuid128, CACHE_CLASS_LEN);
+
+	return true;
+}
+
+static bool match_handle(const void *data, const void *user_data)
+{
+	const struct cache_record *record = data;
+
+	return record->handle == PTR_TO_UINT(user_data);
+}
+
+bool sdp_cache_add_record(struct sdp_cache *cache, const sdp_record_t *rec)
+{
+	struct cache_record *record, *old;
+	sdp_list_t *svcclass = NULL;
+	sdp_buf_t buf;
+
+	if (!cache || !rec)
+		return false;
+
+	if (sdp_gen_record_pdu(rec, &buf) < 0)
+		return false;
+
+	old = queue_find(cache->records, match_handle,
+						UINT_TO_PTR(rec->handle));
+
+	/* Keep the parsed record around if nothing has changed */
+	if (old && old->len == buf.data_size &&
+				!memcmp(old->pdu, buf.data, buf.data_size)) {
+		free(buf.data);
+		return true;
+	}
+
+	record = new0(struct cache_record, 1);
+	record->handle = rec->handle;
+	record->pdu = buf.data;
+	record->len = buf.data_size;
+
+	if (sdp_get_service_classes(rec, &svcclass) == 0 && svcclass) {
+		record->has_class = uuid_to_class(svcclass->data,
+							record->class);
+		sdp_list_free(svcclass, free);
+	}
+
+	if (old) {
+		queue_remove(cache->records, old);
+		cache_record_free(old);
+	}
+
+	queue_push_tail(cache->records, record);
+	cache->dirty = true;
+
+	return true;
+}
+
+static bool match_class(const void *data, const void *user_data)
+{
+	const struct cache_record *record = data;
+
+	return record->has_class && !memcmp(record->class, user_data,
+							CACHE_CLASS_LEN);
+}
+
+const sdp_record_t *sdp_cache_find(struct sdp_cache *cache,
+							const uuid_t *uuid)
+{
+	struct cache_record *record;
+	uint8_t class[CACHE_CLASS_LEN];
+	int scanned;
+
+	if (!cache || !uuid || !uuid_to_class(uuid, class))
+		return NULL;
+
+	record = queue_find(cache->records, match_class, class);
+	if (!record)
+		return NULL;
+
+	if (!record->rec)
+		record->rec = sdp_extract_pdu(record->pdu, record->len,
+								&scanned);
+
+	return record->rec;
+}
+
+struct cache_buf {
+	uint8_t *data;
+	size_t len;
+	bool failed;
+};
+
+static void put_record(void *data, void *user_data)
+{
+	struct cache_record *record = data;
+	struct cache_buf *buf = user_data;
+	uint8_t class_len = record->has_class ? CACHE_CLASS_LEN : 0;
+	uint8_t *ptr = buf->data + buf->len;
+
+	put_le32(record->handle, ptr);
+	put_le32(record->len, ptr + 4);
+	ptr[8] = class_len;
+	memset(ptr + 9, 0, 3);
+	ptr += CACHE_REC_LEN;
+
+	memcpy(ptr, record->class, class_len);
+	ptr += class_len;
+
+	memcpy(ptr, record->pdu, record->len);
+
+	buf->len += CACHE_REC_LEN + class_len + record->len;
+}
+
+static void add_record_len(void *data, void *user_data)
+{
+	struct cache_record *record = data;
+	size_t *len = user_data;
+
+	*len += CACHE_REC_LEN + record->len;
+
+	if (record->has_class)
+		*len += CACHE_CLASS_LEN;
+}
+
+static bool write_file(const char *filename, const uint8_t *data, size_t len)
+{
+	char tmpname[PATH_MAX];
+	ssize_t written;
+	int fd;
+
+	if (snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename) >=
+							(int) sizeof(tmpname))
+		return false;
+
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+							S_IRUSR | S_IWUSR);
+	if (fd < 0)
+		return false;
+
+	while (len > 0) {
+		written = write(fd, data, len);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+
+			goto failed;
+		}
+
+		data += written;
+		len -= written;
+	}
+
+	/* Make sure the data is on disk before replacing the old cache */
+	if (fsync(fd) < 0)
+		goto failed;
+
+	close(fd);
+
+	if (rename(tmpname, filename) < 0) {
+		unlink(tmpname);
+		return false;
+	}
+
+	return true;
+
+failed:
+	close(fd);
+	unlink(tmpname);
+	return false;
+}
+
+bool sdp_cache_save(struct sdp_cache *cache, const char *filename)
+{
+	struct cache_buf buf;
+	size_t len = CACHE_HDR_LEN;
+	bool result;
+
+	if (!cache || !filename)
+		return false;
+
+	/* Nothing to do if the file already matches the cache */
+	if (!cache->dirty)
+		return true;
+
+	queue_foreach(cache->records, add_record_len, &len);
+
+	buf.data = malloc(len);
+	if (!buf.data)
+		return false;
+
+	memset(buf.data, 0, CACHE_HDR_LEN);
+	memcpy(buf.data, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	buf.data[8] = CACHE_VERSION;
+	put_le32(queue_length(cache->records), buf.data + 12);
+	buf.len = CACHE_HDR_LEN;
+
+	queue_foreach(cache->records, put_record, &buf);
+
+	result = write_file(filename, buf.data, buf.len);
+	if (result)
+		cache->dirty = false;
+
+	free(buf.data);
+
+	return result;
+}
+
+static bool load_records(struct sdp_cache *cache, const uint8_t *data,
+								size_t len)
+{
+	const uint8_t *ptr = data + CACHE_HDR_LEN;
+	const uint8_t *end = data + len;
+	uint32_t count, i;
+
+	if (len < CACHE_HDR_LEN || memcmp(data, CACHE_MAGIC,
+						sizeof(CACHE_MAGIC)))
+		return false;
+
+	if (data[8] != CACHE_VERSION)
+		return false;
+
+	count = get_le32(data + 12);
+
+	for (i = 0; i < count; i++) {
+		struct cache_record *record;
+		uint32_t handle, pdu_len;
+		uint8_t class_len;
+
+		if (end - ptr < CACHE_REC_LEN)
+			return false;
+
+		handle = get_le32(ptr);
+		pdu_len = get_le32(ptr + 4);
+		class_len = ptr[8];
+		ptr += CACHE_REC_LEN;
+
+		if (class_len && class_len != CACHE_CLASS_LEN)
+			return false;
+
+		if (!pdu_len || (size_t) (end - ptr) < class_len + pdu_len)
+			return false;
+
+		if (queue_find(cache->records, match_handle,
+						UINT_TO_PTR(handle)))
+			return false;
+
+		record = new0(struct cache_record, 1);
+		record->handle = handle;
+		record->has_class = class_len != 0;
+		memcpy(record->class, ptr, class_len);
+		ptr += class_len;
+
+		record->pdu = new0(uint8_t, pdu_len);
+		memcpy(record->pdu, ptr, pdu_len);
+		record->len = pdu_len;
+		ptr += pdu_len;
+
+		queue_push_tail(cache->records, record);
+	}
+
+	return ptr == end;
+}
+
+struct sdp_cache *sdp_cache_load(const char *filename)
+{
+	struct sdp_cache *cache;
+	struct stat st;
+	void *data;
+	bool result;
+	int fd;
+
+	if (!filename)
+		return NULL;
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || st.st_size < CACHE_HDR_LEN) {
+		close(fd);
+		return NULL;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED)
+		return NULL;
+
+	cache = sdp_cache_new();
+
+	result = load_records(cache, data, st.st_size);
+
+	munmap(data, st.st_size);
+
+	if (!result) {
+		sdp_cache_free(cache);
+		return NULL;
+	}
+
+	return cache;
+}
@@ -0,0 +1,33 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+struct sdp_cache;
+
+struct sdp_cache *sdp_cache_new(void);
+struct sdp_cache *sdp_cache_load(const char *filename);
+bool sdp_cache_save(struct sdp_cache *cache, const char *filename);
+void sdp_cache_free(struct sdp_cache *cache);
+
+bool sdp_cache_add_record(struct sdp_cache *cache, const sdp_record_t *rec);
+const sdp_record_t *sdp_cache_find(struct sdp_cache *cache,
+							const uuid_t *uuid);
+unsigned int sdp_cache_count(struct sdp_cache *cache);
+size_t sdp_cache_get_footprint(struct sdp_cache *cache);
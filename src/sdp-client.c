@@ -104,7 +104,7 @@ static gboolean disconnect_watch(GIOChannel *chan, GIOCondition cond,
 	return FALSE;
 }
 
-static void cache_sdp_session(bdaddr_t *src, bdaddr_t *dst,
+static void cache_sdp_session(const bdaddr_t *src, const bdaddr_t *dst,
 						sdp_session_t *session)
 {
 	struct cached_sdp_session *cached;
@@ -142,64 +142,130 @@ struct search_context {
 	bt_destroy_t		destroy;
 	gpointer		user_data;
 	uuid_t			uuid;
+	sdp_list_t		*recs;
+	uint16_t		flags;
+	gboolean		queued;
 	guint			io_id;
 };
 
+/*
+ * Only one search runs per device at a time. Searches started while one is
+ * in progress wait in context_list with queued set, and reuse the session
+ * of the previous search once it completes instead of connecting again.
+ */
 static GSList *context_list = NULL;
 
+static int start_search(struct search_context *ctxt);
+static int connect_search(struct search_context *ctxt);
+static void run_queued_search(const bdaddr_t *src, const bdaddr_t *dst,
+						sdp_session_t *session);
+
 static void search_context_cleanup(struct search_context *ctxt)
 {
 	context_list = g_slist_remove(context_list, ctxt);
 
+	if (ctxt->recs)
+		sdp_list_free(ctxt->recs, (sdp_free_func_t) sdp_record_free);
+
 	if (ctxt->destroy)
 		ctxt->destroy(ctxt->user_data);
 
 	g_free(ctxt);
 }
 
-static void search_completed_cb(uint8_t type, uint16_t status,
-			uint8_t *rsp, size_t size, void *user_data)
+static struct search_context *find_queued(const bdaddr_t *src,
+							const bdaddr_t *dst)
 {
-	struct search_context *ctxt = user_data;
-	sdp_list_t *recs = NULL;
-	int scanned, seqlen = 0, bytesleft = size;
-	uint8_t dataType;
-	int err = 0;
+	GSList *l;
 
-	if (status || type != SDP_SVC_SEARCH_ATTR_RSP) {
-		err = -EPROTO;
-		goto done;
+	for (l = context_list; l; l = l->next) {
+		struct search_context *ctxt = l->data;
+
+		if (ctxt->queued && !bacmp(&ctxt->src, src) &&
+						!bacmp(&ctxt->dst, dst))
+			return ctxt;
+	}
+
+	return NULL;
+}
+
+static void search_failed(struct search_context *ctxt, int err)
+{
+	bdaddr_t src, dst;
+
+	if (ctxt->session) {
+		sdp_close(ctxt->session);
+		ctxt->session = NULL;
 	}
 
-	scanned = sdp_extract_seqtype(rsp, bytesleft, &dataType, &seqlen);
-	if (!scanned || !seqlen)
-		goto done;
+	bacpy(&src, &ctxt->src);
+	bacpy(&dst, &ctxt->dst);
 
-	rsp += scanned;
-	bytesleft -= scanned;
-	do {
-		sdp_record_t *rec;
-		int recsize;
+	if (ctxt->cb)
+		ctxt->cb(NULL, err, ctxt->user_data);
 
-		recsize = 0;
-		rec = sdp_extract_pdu(rsp, bytesleft, &recsize);
-		if (!rec)
-			break;
+	search_context_cleanup(ctxt);
 
-		if (!recsize) {
-			sdp_record_free(rec);
-			break;
-		}
+	/* Searches waiting behind the failed one need their own connection */
+	run_queued_search(&src, &dst, NULL);
+}
+
+/*
+ * Start the next search queued for the device on the session left behind
+ * by the previous one, or cache the session if there is nothing to do.
+ */
+static void run_queued_search(const bdaddr_t *src, const bdaddr_t *dst,
+						sdp_session_t *session)
+{
+	struct search_context *ctxt;
+	int err;
+
+	ctxt = find_queued(src, dst);
+	if (!ctxt) {
+		if (session)
+			cache_sdp_session(src, dst, session);
+		return;
+	}
+
+	ctxt->queued = FALSE;
 
-		scanned += recsize;
-		rsp += recsize;
-		bytesleft -= recsize;
+	if (session) {
+		ctxt->session = session;
+		err = start_search(ctxt);
+	} else
+		err = connect_search(ctxt);
 
-		recs = sdp_list_append(recs, rec);
-	} while (scanned < (ssize_t) size && bytesleft > 0);
+	if (err < 0)
+		search_failed(ctxt, err);
+}
+
+static void search_record_cb(sdp_record_t *rec, void *user_data)
+{
+	struct search_context *ctxt = user_data;
+
+	ctxt->recs = sdp_list_append(ctxt->recs, rec);
+}
+
+static void search_completed_cb(uint8_t type, uint16_t status,
+			uint8_t *rsp, size_t size, void *user_data)
+{
+	struct search_context *ctxt = user_data;
+	sdp_list_t *recs = NULL;
+	sdp_session_t *session;
+	bdaddr_t src, dst;
+	int err = 0;
+
+	/* Records were already parsed while the response was streamed in */
+	if (status || type != SDP_SVC_SEARCH_ATTR_RSP)
+		err = -EPROTO;
+	else {
+		recs = ctxt->recs;
+		ctxt->recs = NULL;
+	}
 
-done:
-	cache_sdp_session(&ctxt->src, &ctxt->dst, ctxt->session);
+	bacpy(&src, &ctxt->src);
+	bacpy(&dst, &ctxt->dst);
+	session = ctxt->session;
 
 	if (ctxt->cb)
 		ctxt->cb(recs, err, ctxt->user_data);
@@ -208,6 +274,8 @@ done:
 		sdp_list_free(recs, (sdp_free_func_t) sdp_record_free);
 
 	search_context_cleanup(ctxt);
+
+	run_queued_search(&src, &dst, session);
 }
 
 static gboolean search_process_cb(GIOChannel *chan, GIOCondition cond,
@@ -216,13 +284,8 @@ static gboolean search_process_cb(GIOChannel *chan, GIOCondition cond,
 	struct search_context *ctxt = user_data;
 
 	if (cond & (G_IO_ERR | G_IO_HUP | G_IO_NVAL)) {
-		sdp_close(ctxt->session);
-		ctxt->session = NULL;
-
-		if (ctxt->cb)
-			ctxt->cb(NULL, -EIO, ctxt->user_data);
-
-		search_context_cleanup(ctxt);
+		ctxt->io_id = 0;
+		search_failed(ctxt, -EIO);
 		return FALSE;
 	}
 
@@ -233,93 +296,84 @@ static gboolean search_process_cb(GIOChannel *chan, GIOCondition cond,
 	return TRUE;
 }
 
-static gboolean connect_watch(GIOChannel *chan, GIOCondition cond,
-							gpointer user_data)
+static int start_search(struct search_context *ctxt)
 {
-	struct search_context *ctxt = user_data;
 	sdp_list_t *search, *attrids;
 	uint32_t range = 0x0000ffff;
-	socklen_t len;
-	int sk, err, sk_err = 0;
-
-	sk = g_io_channel_unix_get_fd(chan);
-	ctxt->io_id = 0;
-
-	len = sizeof(sk_err);
-	if (getsockopt(sk, SOL_SOCKET, SO_ERROR, &sk_err, &len) < 0)
-		err = -errno;
-	else
-		err = -sk_err;
+	GIOChannel *chan;
+	int err = 0;
 
-	if (err != 0)
-		goto failed;
+	if (sdp_set_notify(ctxt->session, search_completed_cb, ctxt) < 0)
+		return -EIO;
 
-	if (sdp_set_notify(ctxt->session, search_completed_cb, ctxt) < 0) {
-		err = -EIO;
-		goto failed;
-	}
+	if (sdp_set_record_notify(ctxt->session, search_record_cb, ctxt) < 0)
+		return -EIO;
 
 	search = sdp_list_append(NULL, &ctxt->uuid);
 	attrids = sdp_list_append(NULL, &range);
 	if (sdp_service_search_attr_async(ctxt->session,
-				search, SDP_ATTR_REQ_RANGE, attrids) < 0) {
-		sdp_list_free(attrids, NULL);
-		sdp_list_free(search, NULL);
+				search, SDP_ATTR_REQ_RANGE, attrids) < 0)
 		err = -EIO;
-		goto failed;
-	}
 
 	sdp_list_free(attrids, NULL);
 	sdp_list_free(search, NULL);
 
+	if (err < 0)
+		return err;
+
 	/* Set callback responsible for update the internal SDP transaction */
+	chan = g_io_channel_unix_new(sdp_get_socket(ctxt->session));
 	ctxt->io_id = g_io_add_watch(chan,
 				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
 				search_process_cb, ctxt);
-	return FALSE;
+	g_io_channel_unref(chan);
 
-failed:
-	sdp_close(ctxt->session);
-	ctxt->session = NULL;
+	return 0;
+}
 
-	if (ctxt->cb)
-		ctxt->cb(NULL, err, ctxt->user_data);
+static gboolean connect_watch(GIOChannel *chan, GIOCondition cond,
+							gpointer user_data)
+{
+	struct search_context *ctxt = user_data;
+	socklen_t len;
+	int sk, err, sk_err = 0;
 
-	search_context_cleanup(ctxt);
+	sk = g_io_channel_unix_get_fd(chan);
+	ctxt->io_id = 0;
+
+	len = sizeof(sk_err);
+	if (getsockopt(sk, SOL_SOCKET, SO_ERROR, &sk_err, &len) < 0)
+		err = -errno;
+	else
+		err = -sk_err;
+
+	if (!err)
+		err = start_search(ctxt);
+
+	if (err < 0)
+		search_failed(ctxt, err);
 
 	return FALSE;
 }
 
-static int create_search_context(struct search_context **ctxt,
-					const bdaddr_t *src,
-					const bdaddr_t *dst,
-					uuid_t *uuid, uint16_t flags)
+static int connect_search(struct search_context *ctxt)
 {
 	sdp_session_t *s;
 	GIOChannel *chan;
 	uint32_t prio = 1;
 	int sk;
 
-	if (!ctxt)
-		return -EINVAL;
-
-	s = get_cached_sdp_session(src, dst);
-	if (!s)
-		s = sdp_connect(src, dst, SDP_NON_BLOCKING | flags);
+	s = get_cached_sdp_session(&ctxt->src, &ctxt->dst);
+	if (s) {
+		ctxt->session = s;
+		return start_search(ctxt);
+	}
 
+	s = sdp_connect(&ctxt->src, &ctxt->dst, SDP_NON_BLOCKING | ctxt->flags);
 	if (!s)
 		return -errno;
 
-	*ctxt = g_try_malloc0(sizeof(struct search_context));
-	if (!*ctxt) {
-		sdp_close(s);
-		return -ENOMEM;
-	}
-
-	bacpy(&(*ctxt)->src, src);
-	bacpy(&(*ctxt)->dst, dst);
-	(*ctxt)->session = s;
-	(*ctxt)->uuid = *uuid;
+	ctxt->session = s;
 
 	sk = sdp_get_socket(s);
 	/* Set low priority for the SDP connection not to interfere with
@@ -330,27 +384,65 @@ static int create_search_context(struct search_context **ctxt,
 						strerror(errno), errno);
 
 	chan = g_io_channel_unix_new(sk);
-	(*ctxt)->io_id = g_io_add_watch(chan,
+	ctxt->io_id = g_io_add_watch(chan,
 				G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
-				connect_watch, *ctxt);
+				connect_watch, ctxt);
 	g_io_channel_unref(chan);
 
 	return 0;
 }
 
+static struct search_context *find_active(const bdaddr_t *src,
+							const bdaddr_t *dst)
+{
+	GSList *l;
+
+	for (l = context_list; l; l = l->next) {
+		struct search_context *ctxt = l->data;
+
+		if (!ctxt->queued && !bacmp(&ctxt->src, src) &&
+						!bacmp(&ctxt->dst, dst))
+			return ctxt;
+	}
+
+	return NULL;
+}
+
 int bt_search_service(const bdaddr_t *src, const bdaddr_t *dst,
 			uuid_t *uuid, bt_callback_t cb, void *user_data,
 			bt_destroy_t destroy, uint16_t flags)
 {
-	struct search_context *ctxt = NULL;
+	struct search_context *ctxt, *active;
 	int err;
 
 	if (!cb)
 		return -EINVAL;
 
-	err = create_search_context(&ctxt, src, dst, uuid, flags);
-	if (err < 0)
-		return err;
+	ctxt = g_try_malloc0(sizeof(struct search_context));
+	if (!ctxt)
+		return -ENOMEM;
+
+	bacpy(&ctxt->src, src);
+	bacpy(&ctxt->dst, dst);
+	ctxt->uuid = *uuid;
+	ctxt->flags = flags;
+
+	/*
+	 * Wait for the session of a running search when there is one, unless
+	 * the connection needs different options.
+	 */
+	active = find_active(src, dst);
+	if (active && active->flags == flags) {
+		ctxt->queued = TRUE;
+	} else {
+		err = connect_search(ctxt);
+		if (err < 0) {
+			if (ctxt->session)
+				sdp_close(ctxt->session);
+			g_free(ctxt);
+			return err;
+		}
+	}
 
 	ctxt->cb	= cb;
 	ctxt->destroy	= destroy;
@@ -361,34 +453,15 @@ int bt_search_service(const bdaddr_t *src, const bdaddr_t *dst,
 	return 0;
 }
 
-static int find_by_bdaddr(gconstpointer data, gconstpointer user_data)
-{
-	const struct search_context *ctxt = data, *search = user_data;
-	int ret;
-
-	ret = bacmp(&ctxt->src, &search->src);
-	if (ret != 0)
-		return ret;
-
-	return bacmp(&ctxt->dst, &search->dst);
-}
-
 int bt_cancel_discovery(const bdaddr_t *src, const bdaddr_t *dst)
 {
-	struct search_context match, *ctxt;
-	GSList *l;
-
-	memset(&match, 0, sizeof(match));
-	bacpy(&match.src, src);
-	bacpy(&match.dst, dst);
+	struct search_context *ctxt;
 
 	/* Ongoing SDP Discovery */
-	l = g_slist_find_custom(context_list, &match, find_by_bdaddr);
-	if (l == NULL)
+	ctxt = find_active(src, dst);
+	if (!ctxt)
 		return -ENOENT;
 
-	ctxt = l->data;
-
 	if (!ctxt->session)
 		return -ENOTCONN;
 
@@ -400,6 +473,9 @@ int bt_cancel_discovery(const bdaddr_t *src, const bdaddr_t *dst)
 
 	search_context_cleanup(ctxt);
 
+	/* The SDP transaction was aborted, so the session can't be reused */
+	run_queued_search(src, dst, NULL);
+
 	return 0;
 }
 
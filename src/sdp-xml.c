@@ -26,13 +26,13 @@
 #endif
 
 #include <stdio.h>
+#include <stdbool.h>
 #include <errno.h>
 #include <ctype.h>
 #include <string.h>
 #include <limits.h>
 #include <stdlib.h>
-
-#include <glib.h>
+#include <stdarg.h>
 
 #include "lib/sdp.h"
 #include "lib/sdp_lib.h"
@@ -47,22 +47,33 @@
 
 #define STRBUFSIZE 1024
 #define MAXINDENT 64
+#define MAXDEPTH 32
+
+/*
+ * The parser works directly on the caller's buffer. Names and attribute
+ * values are only referenced, and values are decoded into a scratch buffer
+ * that only moves to the heap for values longer than STRBUFSIZE.
+ */
+struct xml_span {
+	const char *str;
+	size_t len;
+};
 
-struct sdp_xml_data {
-	char *text;			/* Pointer to the current buffer */
-	int size;			/* Size of the current buffer */
-	sdp_data_t *data;		/* The current item being built */
-	struct sdp_xml_data *next;	/* Next item on the stack */
-	char type;			/* 0 = Text or Hexadecimal */
-	char *name;			/* Name, optional in the dtd */
-	/* TODO: What is it used for? */
+struct xml_elem {
+	struct xml_span name;
+	sdp_data_t *data;		/* Data element being built, if any */
+	sdp_data_t *tail;		/* Last entry of a sequence */
 };
 
 struct context_data {
 	sdp_record_t *record;
-	sdp_data_t attr_data;
-	struct sdp_xml_data *stack_head;
+	sdp_data_t *attr_data;
 	uint16_t attr_id;
+	struct xml_elem stack[MAXDEPTH];
+	int depth;
+	char *text;
+	size_t size;
+	char buf[STRBUFSIZE];
 };
 
 static int compute_seq_size(sdp_data_t *data)
@@ -76,83 +87,52 @@ static int compute_seq_size(sdp_data_t *data)
 	return unit_size;
 }
 
-#define DEFAULT_XML_DATA_SIZE 1024
-
-static struct sdp_xml_data *sdp_xml_data_alloc(void)
-{
-	struct sdp_xml_data *elem;
-
-	elem = malloc(sizeof(struct sdp_xml_data));
-	if (!elem)
-		return NULL;
-
-	memset(elem, 0, sizeof(struct sdp_xml_data));
-
-	/* Null terminate the text */
-	elem->size = DEFAULT_XML_DATA_SIZE;
-	elem->text = malloc(DEFAULT_XML_DATA_SIZE);
-	if (!elem->text) {
-		free(elem);
-		return NULL;
-	}
-	elem->text[0] = '\0';
-
-	return elem;
-}
-
-static struct sdp_xml_data *sdp_xml_data_expand(struct sdp_xml_data *elem)
+static int hex_value(char c)
 {
-	char *newbuf;
-
-	newbuf = malloc(elem->size * 2);
-	if (!newbuf)
-		return NULL;
-
-	memcpy(newbuf, elem->text, elem->size);
-	elem->size *= 2;
-	free(elem->text);
-
-	elem->text = newbuf;
-
-	return elem;
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
 }
 
 static sdp_data_t *sdp_xml_parse_uuid128(const char *data)
 {
 	uint128_t val;
-	unsigned int i, j;
-
-	char buf[3];
+	unsigned int j = 0;
 
 	memset(&val, 0, sizeof(val));
 
-	buf[2] = '\0';
+	while (*data && j < sizeof(val.data)) {
+		int hi, lo;
 
-	for (j = 0, i = 0; i < strlen(data);) {
-		if (data[i] == '-') {
-			i++;
+		if (*data == '-') {
+			data++;
 			continue;
 		}
 
-		buf[0] = data[i];
-		buf[1] = data[i + 1];
+		hi = hex_value(data[0]);
+		lo = hi < 0 ? -1 : hex_value(data[1]);
+		if (lo < 0)
+			return NULL;
 
-		val.data[j++] = strtoul(buf, 0, 16);
-		i += 2;
+		val.data[j++] = (hi << 4) | lo;
+		data += 2;
 	}
 
 	return sdp_data_alloc(SDP_UUID128, &val);
 }
 
-static sdp_data_t *sdp_xml_parse_uuid(const char *data, sdp_record_t *record)
+static sdp_data_t *sdp_xml_parse_uuid(const char *data, size_t len,
+							sdp_record_t *record)
 {
 	sdp_data_t *ret;
 	char *endptr;
 	uint32_t val;
 	uint16_t val2;
-	int len;
-
-	len = strlen(data);
 
 	if (len == 36) {
 		ret = sdp_xml_parse_uuid128(data);
@@ -323,84 +303,42 @@ static sdp_data_t *sdp_xml_parse_int(const char *data, uint8_t dtd)
 	return ret;
 }
 
-static char *sdp_xml_parse_string_decode(const char *data, char encoding,
-							uint32_t *length)
-{
-	int len = strlen(data);
-	char *text;
-
-	if (encoding == SDP_XML_ENCODING_NORMAL) {
-		text = strdup(data);
-		*length = len;
-	} else {
-		char buf[3], *decoded;
-		int i;
-
-		decoded = malloc((len >> 1) + 1);
-		if (!decoded)
-			return NULL;
-
-		/* Ensure the string is a power of 2 */
-		len = (len >> 1) << 1;
-
-		buf[2] = '\0';
-
-		for (i = 0; i < len; i += 2) {
-			buf[0] = data[i];
-			buf[1] = data[i + 1];
-
-			decoded[i >> 1] = strtoul(buf, 0, 16);
-		}
-
-		decoded[len >> 1] = '\0';
-		text = decoded;
-		*length = len >> 1;
-	}
-
-	return text;
-}
-
-static sdp_data_t *sdp_xml_parse_url(const char *data)
+static sdp_data_t *sdp_xml_parse_url(const char *data, size_t len)
 {
 	uint8_t dtd = SDP_URL_STR8;
-	char *url;
-	uint32_t length;
-	sdp_data_t *ret;
-
-	url = sdp_xml_parse_string_decode(data,
-				SDP_XML_ENCODING_NORMAL, &length);
-	if (!url)
-		return NULL;
 
-	if (length > UCHAR_MAX)
+	if (len > UCHAR_MAX)
 		dtd = SDP_URL_STR16;
 
-	ret = sdp_data_alloc_with_length(dtd, url, length);
-
-	free(url);
-
-	return ret;
+	return sdp_data_alloc_with_length(dtd, data, len);
 }
 
-static sdp_data_t *sdp_xml_parse_text(const char *data, char encoding)
+static sdp_data_t *sdp_xml_parse_text(char *data, size_t len, char encoding)
 {
 	uint8_t dtd = SDP_TEXT_STR8;
-	char *text;
-	uint32_t length;
-	sdp_data_t *ret;
 
-	text = sdp_xml_parse_string_decode(data, encoding, &length);
-	if (!text)
-		return NULL;
+	if (encoding == SDP_XML_ENCODING_HEX) {
+		size_t i;
 
-	if (length > UCHAR_MAX)
-		dtd = SDP_TEXT_STR16;
+		/* Decode in place, an odd trailing digit is ignored */
+		for (i = 0; i + 1 < len; i += 2) {
+			int hi = hex_value(data[i]);
+			int lo = hex_value(data[i + 1]);
+
+			if (hi < 0 || lo < 0)
+				return NULL;
 
-	ret = sdp_data_alloc_with_length(dtd, text, length);
+			data[i >> 1] = (hi << 4) | lo;
+		}
 
-	free(text);
+		len >>= 1;
+		data[len] = '\0';
+	}
 
-	return ret;
+	if (len > UCHAR_MAX)
+		dtd = SDP_TEXT_STR16;
+
+	return sdp_data_alloc_with_length(dtd, data, len);
 }
 
 static sdp_data_t *sdp_xml_parse_nil(const char *data)
@@ -408,586 +346,892 @@ static sdp_data_t *sdp_xml_parse_nil(const char *data)
 	return sdp_data_alloc(SDP_DATA_NIL, 0);
 }
 
-static sdp_data_t *sdp_xml_parse_datatype(const char *el,
-						struct sdp_xml_data *elem,
-						sdp_record_t *record)
+static bool span_eq(const struct xml_span *span, const char *str)
 {
-	const char *data = elem->text;
+	size_t len = strlen(str);
 
-	if (!strcmp(el, "boolean"))
+	return span->len == len && !memcmp(span->str, str, len);
+}
+
+static sdp_data_t *sdp_xml_parse_datatype(const struct xml_span *el,
+						char *data, size_t len,
+						char encoding,
+						sdp_record_t *record)
+{
+	if (span_eq(el, "boolean"))
 		return sdp_xml_parse_int(data, SDP_BOOL);
-	else if (!strcmp(el, "uint8"))
+	else if (span_eq(el, "uint8"))
 		return sdp_xml_parse_int(data, SDP_UINT8);
-	else if (!strcmp(el, "uint16"))
+	else if (span_eq(el, "uint16"))
 		return sdp_xml_parse_int(data, SDP_UINT16);
-	else if (!strcmp(el, "uint32"))
+	else if (span_eq(el, "uint32"))
 		return sdp_xml_parse_int(data, SDP_UINT32);
-	else if (!strcmp(el, "uint64"))
+	else if (span_eq(el, "uint64"))
 		return sdp_xml_parse_int(data, SDP_UINT64);
-	else if (!strcmp(el, "uint128"))
+	else if (span_eq(el, "uint128"))
 		return sdp_xml_parse_int(data, SDP_UINT128);
-	else if (!strcmp(el, "int8"))
+	else if (span_eq(el, "int8"))
 		return sdp_xml_parse_int(data, SDP_INT8);
-	else if (!strcmp(el, "int16"))
+	else if (span_eq(el, "int16"))
 		return sdp_xml_parse_int(data, SDP_INT16);
-	else if (!strcmp(el, "int32"))
+	else if (span_eq(el, "int32"))
 		return sdp_xml_parse_int(data, SDP_INT32);
-	else if (!strcmp(el, "int64"))
+	else if (span_eq(el, "int64"))
 		return sdp_xml_parse_int(data, SDP_INT64);
-	else if (!strcmp(el, "int128"))
+	else if (span_eq(el, "int128"))
 		return sdp_xml_parse_int(data, SDP_INT128);
-	else if (!strcmp(el, "uuid"))
-		return sdp_xml_parse_uuid(data, record);
-	else if (!strcmp(el, "url"))
-		return sdp_xml_parse_url(data);
-	else if (!strcmp(el, "text"))
-		return sdp_xml_parse_text(data, elem->type);
-	else if (!strcmp(el, "nil"))
+	else if (span_eq(el, "uuid"))
+		return sdp_xml_parse_uuid(data, len, record);
+	else if (span_eq(el, "url"))
+		return sdp_xml_parse_url(data, len);
+	else if (span_eq(el, "text"))
+		return sdp_xml_parse_text(data, len, encoding);
+	else if (span_eq(el, "nil"))
 		return sdp_xml_parse_nil(data);
 
 	return NULL;
 }
-static void element_start(GMarkupParseContext *context,
-		const char *element_name, const char **attribute_names,
-		const char **attribute_values, gpointer user_data, GError **err)
+
+static int put_utf8(unsigned long c, char *out)
 {
-	struct context_data *ctx_data = user_data;
+	if (c < 0x80) {
+		out[0] = c;
+		return 1;
+	}
 
-	if (!strcmp(element_name, "record"))
-		return;
+	if (c < 0x800) {
+		out[0] = 0xc0 | (c >> 6);
+		out[1] = 0x80 | (c & 0x3f);
+		return 2;
+	}
+
+	if (c < 0x10000) {
+		out[0] = 0xe0 | (c >> 12);
+		out[1] = 0x80 | ((c >> 6) & 0x3f);
+		out[2] = 0x80 | (c & 0x3f);
+		return 3;
+	}
+
+	out[0] = 0xf0 | (c >> 18);
+	out[1] = 0x80 | ((c >> 12) & 0x3f);
+	out[2] = 0x80 | ((c >> 6) & 0x3f);
+	out[3] = 0x80 | (c & 0x3f);
+	return 4;
+}
 
-	if (!strcmp(element_name, "attribute")) {
-		int i;
-		for (i = 0; attribute_names[i]; i++) {
-			if (!strcmp(attribute_names[i], "id")) {
-				ctx_data->attr_id = strtol(attribute_values[i], 0, 0);
-				break;
-			}
+/* Decodes the entity between '&' and ';', the output is never longer */
+static int decode_entity(const char *str, size_t len, char *out)
+{
+	unsigned long c = 0;
+	size_t i = len;
+
+	if (len == 3 && !memcmp(str, "amp", 3))
+		c = '&';
+	else if (len == 2 && !memcmp(str, "lt", 2))
+		c = '<';
+	else if (len == 2 && !memcmp(str, "gt", 2))
+		c = '>';
+	else if (len == 4 && !memcmp(str, "quot", 4))
+		c = '"';
+	else if (len == 4 && !memcmp(str, "apos", 4))
+		c = '\'';
+	else if (len > 2 && str[0] == '#' && str[1] == 'x') {
+		for (i = 2; i < len && i < 8; i++) {
+			int val = hex_value(str[i]);
+
+			if (val < 0)
+				return -1;
+
+			c = (c << 4) | val;
 		}
-		DBG("New attribute 0x%04x", ctx_data->attr_id);
-		return;
+	} else if (len > 1 && str[0] == '#') {
+		for (i = 1; i < len && i < 8; i++) {
+			if (!isdigit((unsigned char) str[i]))
+				return -1;
+
+			c = c * 10 + str[i] - '0';
+		}
+	} else
+		return -1;
+
+	if (i < len || !c || c > 0x10ffff)
+		return -1;
+
+	return put_utf8(c, out);
+}
+
+static char *decode_value(struct context_data *ctx,
+				const struct xml_span *value, size_t *length)
+{
+	const char *str = value->str;
+	const char *end = str + value->len;
+	char *out;
+
+	if (value->len >= ctx->size) {
+		char *text = malloc(value->len + 1);
+
+		if (!text)
+			return NULL;
+
+		if (ctx->text != ctx->buf)
+			free(ctx->text);
+
+		ctx->text = text;
+		ctx->size = value->len + 1;
 	}
 
-	if (ctx_data->stack_head) {
-		struct sdp_xml_data *newelem = sdp_xml_data_alloc();
-		newelem->next = ctx_data->stack_head;
-		ctx_data->stack_head = newelem;
-	} else {
-		ctx_data->stack_head = sdp_xml_data_alloc();
-		ctx_data->stack_head->next = NULL;
-	}
-
-	if (!strcmp(element_name, "sequence"))
-		ctx_data->stack_head->data = sdp_data_alloc(SDP_SEQ8, NULL);
-	else if (!strcmp(element_name, "alternate"))
-		ctx_data->stack_head->data = sdp_data_alloc(SDP_ALT8, NULL);
-	else {
-		int i;
-		/* Parse value, name, encoding */
-		for (i = 0; attribute_names[i]; i++) {
-			if (!strcmp(attribute_names[i], "value")) {
-				int curlen = strlen(ctx_data->stack_head->text);
-				int attrlen = strlen(attribute_values[i]);
-
-				/* Ensure we're big enough */
-				while ((curlen + 1 + attrlen) > ctx_data->stack_head->size)
-					sdp_xml_data_expand(ctx_data->stack_head);
-
-				memcpy(ctx_data->stack_head->text + curlen,
-						attribute_values[i], attrlen);
-				ctx_data->stack_head->text[curlen + attrlen] = '\0';
-			}
-
-			if (!strcmp(attribute_names[i], "encoding")) {
-				if (!strcmp(attribute_values[i], "hex"))
-					ctx_data->stack_head->type = 1;
-			}
-
-			if (!strcmp(attribute_names[i], "name"))
-				ctx_data->stack_head->name = strdup(attribute_values[i]);
+	out = ctx->text;
+
+	while (str < end) {
+		const char *semi;
+		int len;
+
+		if (*str != '&') {
+			*out++ = *str++;
+			continue;
 		}
 
-		ctx_data->stack_head->data = sdp_xml_parse_datatype(element_name,
-				ctx_data->stack_head, ctx_data->record);
+		semi = memchr(str, ';', end - str);
+		if (!semi)
+			return NULL;
+
+		len = decode_entity(str + 1, semi - str - 1, out);
+		if (len < 0)
+			return NULL;
 
-		if (ctx_data->stack_head->data == NULL)
-			error("Can't parse element %s", element_name);
+		out += len;
+		str = semi + 1;
 	}
+
+	*out = '\0';
+	*length = out - ctx->text;
+
+	return ctx->text;
 }
 
-static void sdp_xml_data_free(struct sdp_xml_data *elem)
+static bool is_seq(uint8_t dtd)
 {
-	if (elem->data)
-		sdp_data_free(elem->data);
+	switch (dtd) {
+	case SDP_SEQ8:
+	case SDP_SEQ16:
+	case SDP_SEQ32:
+	case SDP_ALT8:
+	case SDP_ALT16:
+	case SDP_ALT32:
+		return true;
+	default:
+		return false;
+	}
+}
 
-	free(elem->name);
-	free(elem->text);
-	free(elem);
+static void finish_seq(sdp_data_t *data, uint8_t dtd16, uint8_t dtd32)
+{
+	data->unitSize = compute_seq_size(data);
+
+	if (data->unitSize > USHRT_MAX) {
+		data->unitSize += sizeof(uint32_t);
+		data->dtd = dtd32;
+	} else if (data->unitSize > UCHAR_MAX) {
+		data->unitSize += sizeof(uint16_t);
+		data->dtd = dtd16;
+	} else {
+		data->unitSize += sizeof(uint8_t);
+	}
 }
 
-static void element_end(GMarkupParseContext *context,
-		const char *element_name, gpointer user_data, GError **err)
+static bool element_start(struct context_data *ctx,
+				const struct xml_span *name,
+				const struct xml_span *value,
+				const struct xml_span *encoding,
+				const struct xml_span *id)
 {
-	struct context_data *ctx_data = user_data;
-	struct sdp_xml_data *elem;
+	struct xml_elem *elem;
+	char *text = ctx->text;
+	size_t len = 0;
 
-	if (!strcmp(element_name, "record"))
-		return;
+	if (ctx->depth == MAXDEPTH)
+		return false;
+
+	text[0] = '\0';
+
+	elem = &ctx->stack[ctx->depth++];
+	elem->name = *name;
+	elem->data = NULL;
+	elem->tail = NULL;
+
+	if (span_eq(name, "record"))
+		return true;
 
-	if (!strcmp(element_name, "attribute")) {
-		if (ctx_data->stack_head && ctx_data->stack_head->data) {
-			int ret = sdp_attr_add(ctx_data->record, ctx_data->attr_id,
-							ctx_data->stack_head->data);
-			if (ret == -1)
-				DBG("Could not add attribute 0x%04x",
-							ctx_data->attr_id);
-
-			ctx_data->stack_head->data = NULL;
-			sdp_xml_data_free(ctx_data->stack_head);
-			ctx_data->stack_head = NULL;
-		} else {
-			DBG("No data for attribute 0x%04x", ctx_data->attr_id);
+	if (span_eq(name, "attribute")) {
+		if (id->str) {
+			text = decode_value(ctx, id, &len);
+			if (!text)
+				return false;
+
+			ctx->attr_id = strtol(text, 0, 0);
 		}
-		return;
+
+		DBG("New attribute 0x%04x", ctx->attr_id);
+		return true;
 	}
 
-	if (!ctx_data->stack_head || !ctx_data->stack_head->data) {
-		DBG("No data for %s", element_name);
-		return;
+	if (span_eq(name, "sequence")) {
+		elem->data = sdp_data_alloc(SDP_SEQ8, NULL);
+		return true;
+	}
+
+	if (span_eq(name, "alternate")) {
+		elem->data = sdp_data_alloc(SDP_ALT8, NULL);
+		return true;
 	}
 
-	if (!strcmp(element_name, "sequence")) {
-		ctx_data->stack_head->data->unitSize = compute_seq_size(ctx_data->stack_head->data);
+	if (value->str) {
+		text = decode_value(ctx, value, &len);
+		if (!text)
+			return false;
+	}
+
+	elem->data = sdp_xml_parse_datatype(name, text, len,
+				span_eq(encoding, "hex") ?
+						SDP_XML_ENCODING_HEX :
+						SDP_XML_ENCODING_NORMAL,
+				ctx->record);
+	if (!elem->data)
+		error("Can't parse element %.*s", (int) name->len, name->str);
+
+	return true;
+}
+
+static bool element_end(struct context_data *ctx,
+				const struct xml_span *name)
+{
+	struct xml_elem *elem, *parent;
+	sdp_data_t *data;
 
-		if (ctx_data->stack_head->data->unitSize > USHRT_MAX) {
-			ctx_data->stack_head->data->unitSize += sizeof(uint32_t);
-			ctx_data->stack_head->data->dtd = SDP_SEQ32;
-		} else if (ctx_data->stack_head->data->unitSize > UCHAR_MAX) {
-			ctx_data->stack_head->data->unitSize += sizeof(uint16_t);
-			ctx_data->stack_head->data->dtd = SDP_SEQ16;
-		} else {
-			ctx_data->stack_head->data->unitSize += sizeof(uint8_t);
+	if (!ctx->depth)
+		return false;
+
+	elem = &ctx->stack[ctx->depth - 1];
+	if (elem->name.len != name->len ||
+			memcmp(elem->name.str, name->str, name->len))
+		return false;
+
+	ctx->depth--;
+	parent = ctx->depth ? &ctx->stack[ctx->depth - 1] : NULL;
+
+	if (span_eq(name, "record"))
+		return true;
+
+	if (span_eq(name, "attribute")) {
+		if (!ctx->attr_data) {
+			DBG("No data for attribute 0x%04x", ctx->attr_id);
+			return true;
 		}
-	} else if (!strcmp(element_name, "alternate")) {
-		ctx_data->stack_head->data->unitSize = compute_seq_size(ctx_data->stack_head->data);
-
-		if (ctx_data->stack_head->data->unitSize > USHRT_MAX) {
-			ctx_data->stack_head->data->unitSize += sizeof(uint32_t);
-			ctx_data->stack_head->data->dtd = SDP_ALT32;
-		} else if (ctx_data->stack_head->data->unitSize > UCHAR_MAX) {
-			ctx_data->stack_head->data->unitSize += sizeof(uint16_t);
-			ctx_data->stack_head->data->dtd = SDP_ALT16;
-		} else {
-			ctx_data->stack_head->data->unitSize += sizeof(uint8_t);
+
+		if (sdp_attr_add(ctx->record, ctx->attr_id,
+						ctx->attr_data) < 0) {
+			DBG("Could not add attribute 0x%04x", ctx->attr_id);
+			sdp_data_free(ctx->attr_data);
 		}
+
+		ctx->attr_data = NULL;
+		return true;
 	}
 
-	if (ctx_data->stack_head->next && ctx_data->stack_head->data &&
-					ctx_data->stack_head->next->data) {
-		switch (ctx_data->stack_head->next->data->dtd) {
-		case SDP_SEQ8:
-		case SDP_SEQ16:
-		case SDP_SEQ32:
-		case SDP_ALT8:
-		case SDP_ALT16:
-		case SDP_ALT32:
-			ctx_data->stack_head->next->data->val.dataseq =
-				sdp_seq_append(ctx_data->stack_head->next->data->val.dataseq,
-								ctx_data->stack_head->data);
-			ctx_data->stack_head->data = NULL;
+	data = elem->data;
+	if (!data) {
+		DBG("No data for %.*s", (int) name->len, name->str);
+		return true;
+	}
+
+	if (data->dtd == SDP_SEQ8)
+		finish_seq(data, SDP_SEQ16, SDP_SEQ32);
+	else if (data->dtd == SDP_ALT8)
+		finish_seq(data, SDP_ALT16, SDP_ALT32);
+
+	if (parent && parent->data && is_seq(parent->data->dtd)) {
+		if (parent->tail)
+			parent->tail->next = data;
+		else
+			parent->data->val.dataseq = data;
+
+		parent->tail = data;
+	} else if (parent && span_eq(&parent->name, "attribute")) {
+		if (ctx->attr_data)
+			sdp_data_free(ctx->attr_data);
+
+		ctx->attr_data = data;
+	} else {
+		sdp_data_free(data);
+	}
+
+	return true;
+}
+
+static bool is_name_char(char c)
+{
+	return isalnum((unsigned char) c) || c == '_' || c == '-' ||
+							c == ':' || c == '.';
+}
+
+static const char *skip_space(const char *p, const char *end)
+{
+	while (p < end && isspace((unsigned char) *p))
+		p++;
+
+	return p;
+}
+
+static const char *scan_name(const char *p, const char *end,
+						struct xml_span *name)
+{
+	name->str = p;
+
+	while (p < end && is_name_char(*p))
+		p++;
+
+	name->len = p - name->str;
+
+	return name->len ? p : NULL;
+}
+
+static const char *find_str(const char *p, const char *end, const char *str)
+{
+	size_t len = strlen(str);
+
+	while ((size_t) (end - p) >= len) {
+		p = memchr(p, str[0], end - p - len + 1);
+		if (!p)
+			return NULL;
+
+		if (!memcmp(p, str, len))
+			return p + len;
+
+		p++;
+	}
+
+	return NULL;
+}
+
+/* Skips declarations, comments and CDATA sections */
+static const char *skip_special(const char *p, const char *end)
+{
+	if (end - p >= 4 && !memcmp(p, "<!--", 4))
+		return find_str(p + 4, end, "-->");
+
+	if (end - p >= 9 && !memcmp(p, "<![CDATA[", 9))
+		return find_str(p + 9, end, "]]>");
+
+	if (p[1] == '?')
+		return find_str(p + 2, end, "?>");
+
+	return find_str(p + 2, end, ">");
+}
+
+static const char *parse_start_tag(struct context_data *ctx, const char *p,
+							const char *end)
+{
+	struct xml_span name, attr, value;
+	struct xml_span val = { NULL, 0 }, enc = { NULL, 0 }, id = { NULL, 0 };
+	bool empty = false;
+
+	p = scan_name(p + 1, end, &name);
+	if (!p)
+		return NULL;
+
+	while (1) {
+		const char *quote;
+
+		p = skip_space(p, end);
+		if (p == end)
+			return NULL;
+
+		if (*p == '>') {
+			p++;
+			break;
+		}
+
+		if (*p == '/') {
+			if (end - p < 2 || p[1] != '>')
+				return NULL;
+
+			p += 2;
+			empty = true;
 			break;
 		}
 
-		elem = ctx_data->stack_head;
-		ctx_data->stack_head = ctx_data->stack_head->next;
+		p = scan_name(p, end, &attr);
+		if (!p)
+			return NULL;
+
+		p = skip_space(p, end);
+		if (p == end || *p != '=')
+			return NULL;
 
-		sdp_xml_data_free(elem);
+		p = skip_space(p + 1, end);
+		if (p == end || (*p != '"' && *p != '\''))
+			return NULL;
+
+		quote = memchr(p + 1, *p, end - p - 1);
+		if (!quote)
+			return NULL;
+
+		value.str = p + 1;
+		value.len = quote - value.str;
+		p = quote + 1;
+
+		if (span_eq(&attr, "value"))
+			val = value;
+		else if (span_eq(&attr, "encoding"))
+			enc = value;
+		else if (span_eq(&attr, "id"))
+			id = value;
 	}
+
+	if (!element_start(ctx, &name, &val, &enc, &id))
+		return NULL;
+
+	if (empty && !element_end(ctx, &name))
+		return NULL;
+
+	return p;
 }
 
-static GMarkupParser parser = {
-	element_start, element_end, NULL, NULL, NULL
-};
+static const char *parse_end_tag(struct context_data *ctx, const char *p,
+							const char *end)
+{
+	struct xml_span name;
+
+	p = scan_name(p + 2, end, &name);
+	if (!p)
+		return NULL;
+
+	p = skip_space(p, end);
+	if (p == end || *p != '>')
+		return NULL;
+
+	if (!element_end(ctx, &name))
+		return NULL;
+
+	return p + 1;
+}
+
+static bool parse_markup(struct context_data *ctx, const char *data,
+								size_t size)
+{
+	const char *p = data, *end = data + size;
+
+	while (p < end) {
+		/* Character data is not used by any element */
+		p = memchr(p, '<', end - p);
+		if (!p)
+			break;
+
+		if (end - p < 2)
+			return false;
+
+		if (p[1] == '!' || p[1] == '?')
+			p = skip_special(p, end);
+		else if (p[1] == '/')
+			p = parse_end_tag(ctx, p, end);
+		else
+			p = parse_start_tag(ctx, p, end);
+
+		if (!p)
+			return false;
+	}
+
+	return ctx->depth == 0;
+}
 
 sdp_record_t *sdp_xml_parse_record(const char *data, int size)
 {
-	GMarkupParseContext *ctx;
-	struct context_data *ctx_data;
+	struct context_data *ctx;
 	sdp_record_t *record;
+	bool result;
+
+	if (!data || size < 0)
+		return NULL;
 
-	ctx_data = malloc(sizeof(*ctx_data));
-	if (!ctx_data)
+	ctx = malloc(sizeof(*ctx));
+	if (!ctx)
 		return NULL;
 
 	record = sdp_record_alloc();
 	if (!record) {
-		free(ctx_data);
+		free(ctx);
 		return NULL;
 	}
 
-	memset(ctx_data, 0, sizeof(*ctx_data));
-	ctx_data->record = record;
+	ctx->record = record;
+	ctx->attr_data = NULL;
+	ctx->attr_id = 0;
+	ctx->depth = 0;
+	ctx->text = ctx->buf;
+	ctx->size = sizeof(ctx->buf);
+
+	result = parse_markup(ctx, data, size);
+
+	while (ctx->depth > 0) {
+		struct xml_elem *elem = &ctx->stack[--ctx->depth];
+
+		if (elem->data)
+			sdp_data_free(elem->data);
+	}
+
+	if (ctx->attr_data)
+		sdp_data_free(ctx->attr_data);
+
+	if (ctx->text != ctx->buf)
+		free(ctx->text);
 
-	ctx = g_markup_parse_context_new(&parser, 0, ctx_data, NULL);
+	free(ctx);
 
-	if (g_markup_parse_context_parse(ctx, data, size, NULL) == FALSE) {
+	if (!result) {
 		error("XML parsing error");
-		g_markup_parse_context_free(ctx);
 		sdp_record_free(record);
-		free(ctx_data);
 		return NULL;
 	}
 
-	g_markup_parse_context_free(ctx);
-
-	free(ctx_data);
-
 	return record;
 }
 
+/*
+ * The writer either fills a caller provided buffer or hands out chunks of
+ * its own buffer to an appender, so no allocation is needed per element.
+ */
+struct xml_writer {
+	char *buf;
+	size_t size;
+	size_t len;
+	size_t total;
+	void *data;
+	void (*appender)(void *data, const char *str);
+	char chunk[STRBUFSIZE];
+};
+
+static const char hex_digits[] = "0123456789abcdef";
 
-static void convert_raw_data_to_xml(sdp_data_t *value, int indent_level,
-		void *data, void (*appender)(void *, const char *))
+static void writer_flush(struct xml_writer *w)
 {
-	int i, hex;
-	char buf[STRBUFSIZE];
-	char indent[MAXINDENT];
-
-	if (!value)
+	if (!w->appender || !w->len)
 		return;
 
-	if (indent_level >= MAXINDENT)
-		indent_level = MAXINDENT - 2;
+	w->buf[w->len] = '\0';
+	w->appender(w->data, w->buf);
+	w->len = 0;
+}
 
-	for (i = 0; i < indent_level; i++)
-		indent[i] = '\t';
+static void writer_write(struct xml_writer *w, const char *str, size_t len)
+{
+	w->total += len;
 
-	indent[i] = '\0';
-	buf[STRBUFSIZE - 1] = '\0';
+	while (len > 0 && w->size > 0) {
+		size_t room = w->size - 1 - w->len;
 
-	switch (value->dtd) {
-	case SDP_DATA_NIL:
-		appender(data, indent);
-		appender(data, "<nil/>\n");
-		break;
+		if (!room) {
+			if (!w->appender)
+				return;
 
-	case SDP_BOOL:
-		appender(data, indent);
-		appender(data, "<boolean value=\"");
-		appender(data, value->val.uint8 ? "true" : "false");
-		appender(data, "\" />\n");
-		break;
+			writer_flush(w);
+			continue;
+		}
 
-	case SDP_UINT8:
-		appender(data, indent);
-		appender(data, "<uint8 value=\"");
-		snprintf(buf, STRBUFSIZE - 1, "0x%02x", value->val.uint8);
-		appender(data, buf);
-		appender(data, "\" />\n");
-		break;
+		if (room > len)
+			room = len;
 
-	case SDP_UINT16:
-		appender(data, indent);
-		appender(data, "<uint16 value=\"");
-		snprintf(buf, STRBUFSIZE - 1, "0x%04x", value->val.uint16);
-		appender(data, buf);
-		appender(data, "\" />\n");
-		break;
+		memcpy(w->buf + w->len, str, room);
+		w->len += room;
+		str += room;
+		len -= room;
+	}
+}
 
-	case SDP_UINT32:
-		appender(data, indent);
-		appender(data, "<uint32 value=\"");
-		snprintf(buf, STRBUFSIZE - 1, "0x%08x", value->val.uint32);
-		appender(data, buf);
-		appender(data, "\" />\n");
-		break;
+static void writer_puts(struct xml_writer *w, const char *str)
+{
+	writer_write(w, str, strlen(str));
+}
 
-	case SDP_UINT64:
-		appender(data, indent);
-		appender(data, "<uint64 value=\"");
-		snprintf(buf, STRBUFSIZE - 1, "0x%016jx", value->val.uint64);
-		appender(data, buf);
-		appender(data, "\" />\n");
-		break;
+static void writer_printf(struct xml_writer *w, const char *format, ...)
+					__attribute__((format(printf, 2, 3)));
 
-	case SDP_UINT128:
-		appender(data, indent);
-		appender(data, "<uint128 value=\"");
+static void writer_printf(struct xml_writer *w, const char *format, ...)
+{
+	char buf[64];
+	va_list ap;
+	int len;
 
-		for (i = 0; i < 16; i++) {
-			sprintf(&buf[i * 2], "%02x",
-				(unsigned char) value->val.uint128.data[i]);
-		}
+	va_start(ap, format);
+	len = vsnprintf(buf, sizeof(buf), format, ap);
+	va_end(ap);
 
-		appender(data, buf);
-		appender(data, "\" />\n");
-		break;
+	if (len > 0)
+		writer_write(w, buf, len);
+}
 
-	case SDP_INT8:
-		appender(data, indent);
-		appender(data, "<int8 value=\"");
-		snprintf(buf, STRBUFSIZE - 1, "%d", value->val.int8);
-		appender(data, buf);
-		appender(data, "\" />\n");
-		break;
+static void writer_hex(struct xml_writer *w, const uint8_t *data, size_t len)
+{
+	char buf[32];
+	size_t i, n = 0;
 
-	case SDP_INT16:
-		appender(data, indent);
-		appender(data, "<int16 value=\"");
-		snprintf(buf, STRBUFSIZE - 1, "%d", value->val.int16);
-		appender(data, buf);
-		appender(data, "\" />\n");
-		break;
+	for (i = 0; i < len; i++) {
+		buf[n++] = hex_digits[data[i] >> 4];
+		buf[n++] = hex_digits[data[i] & 0x0f];
 
-	case SDP_INT32:
-		appender(data, indent);
-		appender(data, "<int32 value=\"");
-		snprintf(buf, STRBUFSIZE - 1, "%d", value->val.int32);
-		appender(data, buf);
-		appender(data, "\" />\n");
-		break;
+		if (n == sizeof(buf)) {
+			writer_write(w, buf, n);
+			n = 0;
+		}
+	}
 
-	case SDP_INT64:
-		appender(data, indent);
-		appender(data, "<int64 value=\"");
-		snprintf(buf, STRBUFSIZE - 1, "%jd", value->val.int64);
-		appender(data, buf);
-		appender(data, "\" />\n");
-		break;
+	writer_write(w, buf, n);
+}
 
-	case SDP_INT128:
-		appender(data, indent);
-		appender(data, "<int128 value=\"");
+static void writer_escape(struct xml_writer *w, const char *str, size_t len)
+{
+	const char *start = str, *end = str + len;
 
-		for (i = 0; i < 16; i++) {
-			sprintf(&buf[i * 2], "%02x",
-				(unsigned char) value->val.int128.data[i]);
-		}
-		appender(data, buf);
+	for (; str < end; str++) {
+		const char *entity;
 
-		appender(data, "\" />\n");
-		break;
+		switch (*str) {
+		case '&':
+			entity = "&amp;";
+			break;
+		case '<':
+			entity = "&lt;";
+			break;
+		case '>':
+			entity = "&gt;";
+			break;
+		case '"':
+			entity = "&quot;";
+			break;
+		case '\0':
+			entity = " ";
+			break;
+		default:
+			continue;
+		}
 
-	case SDP_UUID16:
-		appender(data, indent);
-		appender(data, "<uuid value=\"");
-		snprintf(buf, STRBUFSIZE - 1, "0x%04x", value->val.uuid.value.uuid16);
-		appender(data, buf);
-		appender(data, "\" />\n");
-		break;
+		writer_write(w, start, str - start);
+		writer_puts(w, entity);
+		start = str + 1;
+	}
 
-	case SDP_UUID32:
-		appender(data, indent);
-		appender(data, "<uuid value=\"");
-		snprintf(buf, STRBUFSIZE - 1, "0x%08x", value->val.uuid.value.uuid32);
-		appender(data, buf);
-		appender(data, "\" />\n");
-		break;
+	writer_write(w, start, str - start);
+}
 
-	case SDP_UUID128:
-		appender(data, indent);
-		appender(data, "<uuid value=\"");
-
-		snprintf(buf, STRBUFSIZE - 1,
-			 "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
-			 (unsigned char) value->val.uuid.value.
-			 uuid128.data[0],
-			 (unsigned char) value->val.uuid.value.
-			 uuid128.data[1],
-			 (unsigned char) value->val.uuid.value.
-			 uuid128.data[2],
-			 (unsigned char) value->val.uuid.value.
-			 uuid128.data[3],
-			 (unsigned char) value->val.uuid.value.
-			 uuid128.data[4],
-			 (unsigned char) value->val.uuid.value.
-			 uuid128.data[5],
-			 (unsigned char) value->val.uuid.value.
-			 uuid128.data[6],
-			 (unsigned char) value->val.uuid.value.
-			 uuid128.data[7],
-			 (unsigned char) value->val.uuid.value.
-			 uuid128.data[8],
-			 (unsigned char) value->val.uuid.value.
-			 uuid128.data[9],
-			 (unsigned char) value->val.uuid.value.
-			 uuid128.data[10],
-			 (unsigned char) value->val.uuid.value.
-			 uuid128.data[11],
-			 (unsigned char) value->val.uuid.value.
-			 uuid128.data[12],
-			 (unsigned char) value->val.uuid.value.
-			 uuid128.data[13],
-			 (unsigned char) value->val.uuid.value.
-			 uuid128.data[14],
-			 (unsigned char) value->val.uuid.value.
-			 uuid128.data[15]);
-
-		appender(data, buf);
-		appender(data, "\" />\n");
-		break;
+static void writer_indent(struct xml_writer *w, int level)
+{
+	static const char tabs[MAXINDENT] = { [0 ... MAXINDENT - 1] = '\t' };
 
-	case SDP_TEXT_STR8:
-	case SDP_TEXT_STR16:
-	case SDP_TEXT_STR32:
-	{
-		int num_chars_to_escape = 0;
-		int length = value->unitSize - 1;
-		char *strBuf;
-
-		hex = 0;
-
-		for (i = 0; i < length; i++) {
-			if (!isprint(value->val.str[i]) &&
-					value->val.str[i] != '\0') {
-				hex = 1;
-				break;
-			}
-
-			/* XML is evil, must do this... */
-			if ((value->val.str[i] == '<') ||
-					(value->val.str[i] == '>') ||
-					(value->val.str[i] == '"') ||
-					(value->val.str[i] == '&'))
-				num_chars_to_escape++;
-		}
+	if (level >= MAXINDENT)
+		level = MAXINDENT - 2;
 
-		appender(data, indent);
+	writer_write(w, tabs, level);
+}
 
-		appender(data, "<text ");
+static void writer_value(struct xml_writer *w, int level, const char *type)
+{
+	writer_indent(w, level);
+	writer_puts(w, "<");
+	writer_puts(w, type);
+	writer_puts(w, " value=\"");
+}
 
-		if (hex) {
-			appender(data, "encoding=\"hex\" ");
-			strBuf = malloc(sizeof(char)
-						 * ((value->unitSize-1) * 2 + 1));
-			if (!strBuf) {
-				DBG("No memory to convert raw data to xml");
-				return;
-			}
-
-			/* Unit Size seems to include the size for dtd
-			   It is thus off by 1
-			   This is safe for Normal strings, but not
-			   hex encoded data */
-			for (i = 0; i < (value->unitSize-1); i++)
-				sprintf(&strBuf[i*sizeof(char)*2],
-					"%02x",
-					(unsigned char) value->val.str[i]);
-
-			strBuf[(value->unitSize-1) * 2] = '\0';
-		} else {
-			int j;
-			/* escape the XML disallowed chars */
-			strBuf = malloc(sizeof(char) *
-					(value->unitSize + 1 + num_chars_to_escape * 4));
-			if (!strBuf) {
-				DBG("No memory to convert raw data to xml");
-				return;
-			}
-			for (i = 0, j = 0; i < length; i++) {
-				if (value->val.str[i] == '&') {
-					strBuf[j++] = '&';
-					strBuf[j++] = 'a';
-					strBuf[j++] = 'm';
-					strBuf[j++] = 'p';
-				} else if (value->val.str[i] == '<') {
-					strBuf[j++] = '&';
-					strBuf[j++] = 'l';
-					strBuf[j++] = 't';
-				} else if (value->val.str[i] == '>') {
-					strBuf[j++] = '&';
-					strBuf[j++] = 'g';
-					strBuf[j++] = 't';
-				} else if (value->val.str[i] == '"') {
-					strBuf[j++] = '&';
-					strBuf[j++] = 'q';
-					strBuf[j++] = 'u';
-					strBuf[j++] = 'o';
-					strBuf[j++] = 't';
-				} else if (value->val.str[i] == '\0') {
-					strBuf[j++] = ' ';
-				} else {
-					strBuf[j++] = value->val.str[i];
-				}
-			}
-
-			strBuf[j] = '\0';
+static void convert_text_to_xml(const sdp_data_t *value,
+						struct xml_writer *w)
+{
+	int length = value->unitSize - 1;
+	bool hex = false;
+	int i;
+
+	for (i = 0; i < length; i++) {
+		if (!isprint((unsigned char) value->val.str[i]) &&
+						value->val.str[i] != '\0') {
+			hex = true;
+			break;
 		}
-
-		appender(data, "value=\"");
-		appender(data, strBuf);
-		appender(data, "\" />\n");
-		free(strBuf);
-		break;
 	}
 
-	case SDP_URL_STR8:
-	case SDP_URL_STR16:
-	case SDP_URL_STR32:
-	{
-		char *strBuf;
-
-		appender(data, indent);
-		appender(data, "<url value=\"");
-		strBuf = strndup(value->val.str, value->unitSize - 1);
-		appender(data, strBuf);
-		free(strBuf);
-		appender(data, "\" />\n");
-		break;
+	if (hex) {
+		writer_puts(w, "<text encoding=\"hex\" value=\"");
+		writer_hex(w, (const uint8_t *) value->val.str, length);
+	} else {
+		writer_puts(w, "<text value=\"");
+		writer_escape(w, value->val.str, length);
 	}
 
-	case SDP_SEQ8:
-	case SDP_SEQ16:
-	case SDP_SEQ32:
-		appender(data, indent);
-		appender(data, "<sequence>\n");
+	writer_puts(w, "\" />\n");
+}
 
-		convert_raw_data_to_xml(value->val.dataseq,
-					indent_level + 1, data, appender);
+static void convert_raw_data_to_xml(const sdp_data_t *value,
+					int indent_level,
+					struct xml_writer *w)
+{
+	const uint8_t *u128;
 
-		appender(data, indent);
-		appender(data, "</sequence>\n");
+	for (; value; value = value->next) {
+		switch (value->dtd) {
+		case SDP_DATA_NIL:
+			writer_indent(w, indent_level);
+			writer_puts(w, "<nil/>\n");
+			continue;
 
-		break;
+		case SDP_BOOL:
+			writer_value(w, indent_level, "boolean");
+			writer_puts(w, value->val.uint8 ? "true" : "false");
+			break;
 
-	case SDP_ALT8:
-	case SDP_ALT16:
-	case SDP_ALT32:
-		appender(data, indent);
+		case SDP_UINT8:
+			writer_value(w, indent_level, "uint8");
+			writer_printf(w, "0x%02x", value->val.uint8);
+			break;
+
+		case SDP_UINT16:
+			writer_value(w, indent_level, "uint16");
+			writer_printf(w, "0x%04x", value->val.uint16);
+			break;
+
+		case SDP_UINT32:
+			writer_value(w, indent_level, "uint32");
+			writer_printf(w, "0x%08x", value->val.uint32);
+			break;
 
-		appender(data, "<alternate>\n");
+		case SDP_UINT64:
+			writer_value(w, indent_level, "uint64");
+			writer_printf(w, "0x%016jx", value->val.uint64);
+			break;
 
-		convert_raw_data_to_xml(value->val.dataseq,
-					indent_level + 1, data, appender);
-		appender(data, indent);
+		case SDP_UINT128:
+			writer_value(w, indent_level, "uint128");
+			writer_hex(w, value->val.uint128.data, 16);
+			break;
 
-		appender(data, "</alternate>\n");
+		case SDP_INT8:
+			writer_value(w, indent_level, "int8");
+			writer_printf(w, "%d", value->val.int8);
+			break;
 
-		break;
-	}
+		case SDP_INT16:
+			writer_value(w, indent_level, "int16");
+			writer_printf(w, "%d", value->val.int16);
+			break;
 
-	convert_raw_data_to_xml(value->next, indent_level, data, appender);
-}
+		case SDP_INT32:
+			writer_value(w, indent_level, "int32");
+			writer_printf(w, "%d", value->val.int32);
+			break;
 
-struct conversion_data {
-	void *data;
-	void (*appender)(void *data, const char *);
-};
+		case SDP_INT64:
+			writer_value(w, indent_level, "int64");
+			writer_printf(w, "%jd", value->val.int64);
+			break;
 
-static void convert_raw_attr_to_xml_func(void *val, void *data)
+		case SDP_INT128:
+			writer_value(w, indent_level, "int128");
+			writer_hex(w, value->val.int128.data, 16);
+			break;
+
+		case SDP_UUID16:
+			writer_value(w, indent_level, "uuid");
+			writer_printf(w, "0x%04x",
+					value->val.uuid.value.uuid16);
+			break;
+
+		case SDP_UUID32:
+			writer_value(w, indent_level, "uuid");
+			writer_printf(w, "0x%08x",
+					value->val.uuid.value.uuid32);
+			break;
+
+		case SDP_UUID128:
+			u128 = value->val.uuid.value.uuid128.data;
+
+			writer_value(w, indent_level, "uuid");
+			writer_hex(w, u128, 4);
+			writer_puts(w, "-");
+			writer_hex(w, u128 + 4, 2);
+			writer_puts(w, "-");
+			writer_hex(w, u128 + 6, 2);
+			writer_puts(w, "-");
+			writer_hex(w, u128 + 8, 2);
+			writer_puts(w, "-");
+			writer_hex(w, u128 + 10, 6);
+			break;
+
+		case SDP_TEXT_STR8:
+		case SDP_TEXT_STR16:
+		case SDP_TEXT_STR32:
+			writer_indent(w, indent_level);
+			convert_text_to_xml(value, w);
+			continue;
+
+		case SDP_URL_STR8:
+		case SDP_URL_STR16:
+		case SDP_URL_STR32:
+			writer_value(w, indent_level, "url");
+			writer_escape(w, value->val.str,
+					strnlen(value->val.str,
+						value->unitSize - 1));
+			break;
+
+		case SDP_SEQ8:
+		case SDP_SEQ16:
+		case SDP_SEQ32:
+			writer_indent(w, indent_level);
+			writer_puts(w, "<sequence>\n");
+
+			convert_raw_data_to_xml(value->val.dataseq,
+							indent_level + 1, w);
+
+			writer_indent(w, indent_level);
+			writer_puts(w, "</sequence>\n");
+			continue;
+
+		case SDP_ALT8:
+		case SDP_ALT16:
+		case SDP_ALT32:
+			writer_indent(w, indent_level);
+			writer_puts(w, "<alternate>\n");
+
+			convert_raw_data_to_xml(value->val.dataseq,
+							indent_level + 1, w);
+
+			writer_indent(w, indent_level);
+			writer_puts(w, "</alternate>\n");
+			continue;
+
+		default:
+			continue;
+		}
+
+		writer_puts(w, "\" />\n");
+	}
+}
+
+static void convert_record_to_xml(const sdp_record_t *rec,
+						struct xml_writer *w)
 {
-	struct conversion_data *cd = data;
-	sdp_data_t *value = val;
-	char buf[STRBUFSIZE];
+	sdp_list_t *list;
 
-	buf[STRBUFSIZE - 1] = '\0';
-	snprintf(buf, STRBUFSIZE - 1, "\t<attribute id=\"0x%04x\">\n",
-		 value->attrId);
-	cd->appender(cd->data, buf);
+	if (!rec || !rec->attrlist)
+		return;
+
+	writer_puts(w, "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n\n");
+	writer_puts(w, "<record>\n");
 
-	convert_raw_data_to_xml(value, 2, cd->data, cd->appender);
+	for (list = rec->attrlist; list; list = list->next) {
+		const sdp_data_t *value = list->data;
 
-	cd->appender(cd->data, "\t</attribute>\n");
+		writer_printf(w, "\t<attribute id=\"0x%04x\">\n",
+							value->attrId);
+		convert_raw_data_to_xml(value, 2, w);
+		writer_puts(w, "\t</attribute>\n");
+	}
+
+	writer_puts(w, "</record>\n");
 }
 
 /*
@@ -999,16 +1243,39 @@ static void convert_raw_attr_to_xml_func(void *val, void *data)
 void convert_sdp_record_to_xml(sdp_record_t *rec,
 			void *data, void (*appender)(void *, const char *))
 {
-	struct conversion_data cd;
+	struct xml_writer w;
 
-	cd.data = data;
-	cd.appender = appender;
+	w.buf = w.chunk;
+	w.size = sizeof(w.chunk);
+	w.len = 0;
+	w.total = 0;
+	w.data = data;
+	w.appender = appender;
 
-	if (rec && rec->attrlist) {
-		appender(data, "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n\n");
-		appender(data, "<record>\n");
-		sdp_list_foreach(rec->attrlist,
-				 convert_raw_attr_to_xml_func, &cd);
-		appender(data, "</record>\n");
-	}
+	convert_record_to_xml(rec, &w);
+	writer_flush(&w);
+}
+
+/*
+ * Writes the XML form of the record to buf, which is always NUL terminated
+ * unless size is zero. Returns the length of the full output like
+ * snprintf(), so a return value of size or more means it was truncated.
+ */
+int sdp_xml_format_record(const sdp_record_t *rec, char *buf, size_t size)
+{
+	struct xml_writer w;
+
+	w.buf = buf;
+	w.size = size;
+	w.len = 0;
+	w.total = 0;
+	w.data = NULL;
+	w.appender = NULL;
+
+	convert_record_to_xml(rec, &w);
+
+	if (size)
+		buf[w.len] = '\0';
+
+	return w.total > INT_MAX ? -EOVERFLOW : (int) w.total;
 }
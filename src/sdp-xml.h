@@ -23,5 +23,6 @@
 
 void convert_sdp_record_to_xml(sdp_record_t *rec,
 		void *user_data, void (*append_func) (void *, const char *));
+int sdp_xml_format_record(const sdp_record_t *rec, char *buf, size_t size);
 
 sdp_record_t *sdp_xml_parse_record(const char *data, int size);
@@ -30,6 +30,8 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <errno.h>
 
 #include "lib/bluetooth.h"
 #include "lib/sdp.h"
@@ -41,9 +43,47 @@
 static sdp_list_t *service_db;
 static sdp_list_t *access_db;
 
+/*
+ * Inverted index from the 128-bit form of the UUIDs in the search pattern
+ * of the records to the records containing them. The index is rebuilt on
+ * the first search after the database has changed.
+ */
+typedef struct {
+	uint128_t uuid;
+	sdp_record_t **records;
+	unsigned int count;
+} sdp_posting_t;
+
+typedef struct {
+	const uint128_t *uuid;
+	sdp_record_t *rec;
+} sdp_index_entry_t;
+
+static sdp_posting_t *uuid_index;
+static unsigned int uuid_index_count;
+static sdp_record_t **uuid_index_records;
+static bool uuid_index_stale = true;
+
+/*
+ * Location of an attribute (identifier and value) inside the encoded
+ * attribute list of a record
+ */
+typedef struct {
+	uint16_t attr_id;
+	uint32_t offset;
+	uint32_t len;
+} sdp_slice_t;
+
 typedef struct {
 	uint32_t handle;
 	bdaddr_t device;
+	/*
+	 * Encoded attribute list of the record, generated on first use and
+	 * dropped whenever the record changes
+	 */
+	sdp_buf_t pdu;
+	sdp_slice_t *slices;
+	unsigned int slice_count;
 } sdp_access_t;
 
 /*
@@ -77,19 +117,44 @@ static int access_sort(const void *r1, const void *r2)
 	return rec1->handle - rec2->handle;
 }
 
+static void access_pdu_free(sdp_access_t *a)
+{
+	free(a->pdu.data);
+	memset(&a->pdu, 0, sizeof(a->pdu));
+
+	free(a->slices);
+	a->slices = NULL;
+	a->slice_count = 0;
+}
+
 static void access_free(void *p)
 {
+	access_pdu_free(p);
 	free(p);
 }
 
 /*
  * Reset the service repository by deleting its contents
  */
+static void uuid_index_free(void)
+{
+	free(uuid_index);
+	uuid_index = NULL;
+	uuid_index_count = 0;
+
+	free(uuid_index_records);
+	uuid_index_records = NULL;
+
+	uuid_index_stale = true;
+}
+
 void sdp_svcdb_reset(void)
 {
 	sdp_list_free(service_db, (sdp_free_func_t) sdp_record_free);
 	service_db = NULL;
 
+	uuid_index_free();
+
 	sdp_list_free(access_db, access_free);
 	access_db = NULL;
 }
@@ -180,8 +245,9 @@ void sdp_record_add(const bdaddr_t *device, sdp_record_t *rec)
 	SDPDBG("with handle : 0x%x", rec->handle);
 
 	service_db = sdp_list_insert_sorted(service_db, rec, record_sort);
+	uuid_index_stale = true;
 
-	dev = malloc(sizeof(*dev));
+	dev = calloc(1, sizeof(*dev));
 	if (!dev)
 		return;
 
@@ -254,6 +320,8 @@ int sdp_record_remove(uint32_t handle)
 	if (r)
 		service_db = sdp_list_remove(service_db, r);
 
+	uuid_index_stale = true;
+
 	p = access_locate(handle);
 	if (p == NULL || p->data == NULL)
 		return 0;
@@ -294,6 +362,357 @@ int sdp_check_access(uint32_t handle, bdaddr_t *device)
 	return 1;
 }
 
+static uint32_t seq_header_size(const uint8_t *p)
+{
+	switch (p[0]) {
+	case SDP_SEQ8:
+		return 2;
+	case SDP_SEQ16:
+		return 3;
+	case SDP_SEQ32:
+		return 5;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * The attribute list is the concatenation of the attributes as encoded
+ * by sdp_append_to_pdu(), so encoding each of them on its own gives the
+ * boundaries within the list.
+ */
+static int access_pdu_build(sdp_access_t *a, const sdp_record_t *rec)
+{
+	sdp_list_t *l;
+	sdp_buf_t tmp;
+	uint32_t pos;
+	unsigned int count;
+
+	if (sdp_gen_record_pdu(rec, &a->pdu) < 0)
+		return -ENOMEM;
+
+	count = sdp_list_len(rec->attrlist);
+	if (!count || !a->pdu.data_size)
+		return 0;
+
+	pos = seq_header_size(a->pdu.data);
+	if (!pos)
+		goto failed;
+
+	a->slices = malloc(count * sizeof(*a->slices));
+	if (!a->slices)
+		goto failed;
+
+	memset(&tmp, 0, sizeof(tmp));
+	tmp.buf_size = a->pdu.data_size + sizeof(uint32_t);
+	tmp.data = malloc(tmp.buf_size);
+	if (!tmp.data)
+		goto failed;
+
+	for (l = rec->attrlist; l; l = l->next) {
+		sdp_data_t *d = l->data;
+		sdp_slice_t *slice = &a->slices[a->slice_count++];
+		uint32_t hdr;
+
+		tmp.data[0] = 0;
+		tmp.data_size = 0;
+		sdp_append_to_pdu(&tmp, d);
+
+		hdr = seq_header_size(tmp.data);
+		if (!hdr || tmp.data_size < hdr)
+			break;
+
+		slice->attr_id = d->attrId;
+		slice->offset = pos;
+		slice->len = tmp.data_size - hdr;
+
+		pos += slice->len;
+		if (pos > a->pdu.data_size)
+			break;
+	}
+
+	free(tmp.data);
+
+	if (l || pos != a->pdu.data_size)
+		goto failed;
+
+	return 0;
+
+failed:
+	access_pdu_free(a);
+	return -EINVAL;
+}
+
+static sdp_access_t *access_pdu_get(const sdp_record_t *rec)
+{
+	sdp_list_t *p = access_locate(rec->handle);
+	sdp_access_t *a;
+
+	if (!p || !p->data)
+		return NULL;
+
+	a = p->data;
+
+	if (!a->pdu.data && access_pdu_build(a, rec) < 0)
+		return NULL;
+
+	return a;
+}
+
+/*
+ * Return the encoded attribute list of a record, as generated by
+ * sdp_gen_record_pdu()
+ */
+const sdp_buf_t *sdp_record_get_pdu(const sdp_record_t *rec)
+{
+	sdp_access_t *a = access_pdu_get(rec);
+
+	if (!a)
+		return NULL;
+
+	return &a->pdu;
+}
+
+/*
+ * Append the encoded attributes of a record with identifiers between
+ * low and high (inclusive) to buf
+ */
+void sdp_record_append_attrs(const sdp_record_t *rec, uint16_t low,
+					uint16_t high, sdp_buf_t *buf)
+{
+	sdp_access_t *a = access_pdu_get(rec);
+	unsigned int i;
+
+	if (!a)
+		return;
+
+	for (i = 0; i < a->slice_count; i++) {
+		sdp_slice_t *slice = &a->slices[i];
+
+		if (slice->attr_id < low)
+			continue;
+
+		if (slice->attr_id > high)
+			break;
+
+		sdp_append_to_buf(buf, a->pdu.data + slice->offset,
+								slice->len);
+	}
+}
+
+/*
+ * Drop the encoded attribute list after the record has been modified
+ */
+void sdp_record_invalidate(uint32_t handle)
+{
+	sdp_list_t *p = access_locate(handle);
+
+	/* The search pattern might have changed as well */
+	uuid_index_stale = true;
+
+	if (!p || !p->data)
+		return;
+
+	access_pdu_free(p->data);
+}
+
+static int index_entry_cmp(const void *e1, const void *e2)
+{
+	const sdp_index_entry_t *entry1 = e1;
+	const sdp_index_entry_t *entry2 = e2;
+	int ret;
+
+	ret = memcmp(entry1->uuid, entry2->uuid, sizeof(uint128_t));
+	if (ret)
+		return ret;
+
+	if (entry1->rec->handle < entry2->rec->handle)
+		return -1;
+
+	return entry1->rec->handle > entry2->rec->handle;
+}
+
+static int uuid_index_build(void)
+{
+	sdp_index_entry_t *entries;
+	sdp_list_t *l, *u;
+	unsigned int count = 0, i;
+
+	uuid_index_free();
+
+	for (l = service_db; l; l = l->next) {
+		sdp_record_t *rec = l->data;
+
+		count += sdp_list_len(rec->pattern);
+	}
+
+	if (!count) {
+		uuid_index_stale = false;
+		return 0;
+	}
+
+	entries = malloc(count * sizeof(*entries));
+	uuid_index = malloc(count * sizeof(*uuid_index));
+	uuid_index_records = malloc(count * sizeof(*uuid_index_records));
+	if (!entries || !uuid_index || !uuid_index_records) {
+		free(entries);
+		uuid_index_free();
+		return -ENOMEM;
+	}
+
+	count = 0;
+
+	for (l = service_db; l; l = l->next) {
+		sdp_record_t *rec = l->data;
+
+		for (u = rec->pattern; u; u = u->next) {
+			uuid_t *uuid = u->data;
+
+			entries[count].uuid = &uuid->value.uuid128;
+			entries[count].rec = rec;
+			count++;
+		}
+	}
+
+	qsort(entries, count, sizeof(*entries), index_entry_cmp);
+
+	for (i = 0; i < count; i++) {
+		sdp_posting_t *posting = NULL;
+
+		if (uuid_index_count)
+			posting = &uuid_index[uuid_index_count - 1];
+
+		if (!posting || memcmp(&posting->uuid, entries[i].uuid,
+							sizeof(uint128_t))) {
+			posting = &uuid_index[uuid_index_count++];
+			memcpy(&posting->uuid, entries[i].uuid,
+							sizeof(uint128_t));
+			posting->records = &uuid_index_records[i];
+			posting->count = 0;
+		}
+
+		posting->records[posting->count++] = entries[i].rec;
+	}
+
+	free(entries);
+
+	uuid_index_stale = false;
+
+	return 0;
+}
+
+static int posting_cmp(const void *key, const void *p)
+{
+	const sdp_posting_t *posting = p;
+
+	return memcmp(key, &posting->uuid, sizeof(uint128_t));
+}
+
+static int record_handle_cmp(const void *key, const void *r)
+{
+	const sdp_record_t *rec = *(sdp_record_t * const *) r;
+	uint32_t handle = *(const uint32_t *) key;
+
+	if (handle < rec->handle)
+		return -1;
+
+	return handle > rec->handle;
+}
+
+static const sdp_posting_t *uuid_index_find(const uuid_t *uuid)
+{
+	uuid_t uuid128;
+
+	memset(&uuid128, 0, sizeof(uuid128));
+
+	switch (uuid->type) {
+	case SDP_UUID128:
+		uuid128 = *uuid;
+		break;
+	case SDP_UUID32:
+		sdp_uuid32_to_uuid128(&uuid128, uuid);
+		break;
+	case SDP_UUID16:
+		sdp_uuid16_to_uuid128(&uuid128, uuid);
+		break;
+	}
+
+	return bsearch(&uuid128.value.uuid128, uuid_index, uuid_index_count,
+					sizeof(*uuid_index), posting_cmp);
+}
+
+/*
+ * Return the list of records, sorted by handle, whose search pattern
+ * contains every UUID of the search pattern. The list itself has to be
+ * freed by the caller.
+ */
+sdp_list_t *sdp_record_search(sdp_list_t *search)
+{
+	const sdp_posting_t **postings;
+	const sdp_posting_t *shortest = NULL;
+	sdp_list_t *l, *result = NULL;
+	int search_len, i, j;
+
+	if (uuid_index_stale && uuid_index_build() < 0)
+		return NULL;
+
+	/* Without any UUID to look for every record matches */
+	search_len = sdp_list_len(search);
+	if (!search_len) {
+		for (l = service_db; l; l = l->next)
+			result = sdp_list_append(result, l->data);
+
+		return result;
+	}
+
+	postings = malloc(search_len * sizeof(*postings));
+	if (!postings)
+		return NULL;
+
+	for (l = search, i = 0; l; l = l->next, i++) {
+		/* A UUID missing from the index can't be matched */
+		if (!l->data)
+			goto done;
+
+		postings[i] = uuid_index_find(l->data);
+		if (!postings[i])
+			goto done;
+
+		if (!shortest || postings[i]->count < shortest->count)
+			shortest = postings[i];
+	}
+
+	/* Walk backwards so that each record ends up at the head */
+	for (i = shortest->count - 1; i >= 0; i--) {
+		sdp_record_t *rec = shortest->records[i];
+
+		for (j = 0; j < search_len; j++) {
+			if (postings[j] == shortest)
+				continue;
+
+			if (!bsearch(&rec->handle, postings[j]->records,
+					postings[j]->count,
+					sizeof(*postings[j]->records),
+					record_handle_cmp))
+				break;
+		}
+
+		if (j < search_len)
+			continue;
+
+		/* Repeated UUIDs in the search need as many in the record */
+		if (sdp_list_len(rec->pattern) < search_len)
+			continue;
+
+		result = sdp_list_insert_sorted(result, rec, record_sort);
+	}
+
+done:
+	free(postings);
+
+	return result;
+}
+
 uint32_t sdp_next_handle(void)
 {
 	uint32_t handle = 0x10000;
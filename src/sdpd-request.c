@@ -55,41 +55,179 @@ typedef struct {
 
 #define MIN(x, y) ((x) < (y)) ? (x): (y)
 
-typedef struct _sdp_cstate_list sdp_cstate_list_t;
+/*
+ * Responses which don't fit into a single PDU are kept in a fixed pool
+ * until the client has fetched the rest of them. The pool is bounded in
+ * entries and bytes, and a single client can only hold a few entries, so
+ * the least recently used ones are dropped to make room.
+ */
+#define CSTATE_POOL_SIZE	16
+#define CSTATE_POOL_BYTES	(256 * 1024)
+#define CSTATE_CLIENT_MAX	4
 
-struct _sdp_cstate_list {
-	sdp_cstate_list_t *next;
+typedef struct {
+	int sock;
 	uint32_t timestamp;
+	uint32_t last_used;
 	sdp_buf_t buf;
-};
+} sdp_cstate_entry_t;
 
-static sdp_cstate_list_t *cstates;
+static sdp_cstate_entry_t cstate_pool[CSTATE_POOL_SIZE];
+static unsigned int cstate_pool_count;
+static size_t cstate_pool_bytes;
+static uint32_t cstate_next_id;
+static uint32_t cstate_clock;
 
-/* FIXME: should probably remove it when it's found */
-static sdp_buf_t *sdp_get_cached_rsp(sdp_cont_state_t *cstate)
+static void cstate_entry_free(sdp_cstate_entry_t *entry)
 {
-	sdp_cstate_list_t *p;
+	cstate_pool_count--;
+	cstate_pool_bytes -= entry->buf.buf_size;
 
-	for (p = cstates; p; p = p->next)
-		if (p->timestamp == cstate->timestamp)
-			return &p->buf;
-	return 0;
+	free(entry->buf.data);
+	memset(entry, 0, sizeof(*entry));
+}
+
+static sdp_cstate_entry_t *cstate_lookup(int sock, uint32_t timestamp)
+{
+	unsigned int i;
+
+	if (!timestamp)
+		return NULL;
+
+	for (i = 0; i < CSTATE_POOL_SIZE; i++) {
+		sdp_cstate_entry_t *entry = &cstate_pool[i];
+
+		/* Clients can only continue their own responses */
+		if (entry->buf.data && entry->timestamp == timestamp &&
+							entry->sock == sock)
+			return entry;
+	}
+
+	return NULL;
+}
+
+/*
+ * Find the least recently used entry, of the given client only unless
+ * sock is negative
+ */
+static sdp_cstate_entry_t *cstate_lru(int sock, unsigned int *count)
+{
+	sdp_cstate_entry_t *lru = NULL;
+	unsigned int i;
+
+	if (count)
+		*count = 0;
+
+	for (i = 0; i < CSTATE_POOL_SIZE; i++) {
+		sdp_cstate_entry_t *entry = &cstate_pool[i];
+
+		if (!entry->buf.data)
+			continue;
+
+		if (sock >= 0 && entry->sock != sock)
+			continue;
+
+		if (count)
+			(*count)++;
+
+		if (!lru || (int32_t) (entry->last_used - lru->last_used) < 0)
+			lru = entry;
+	}
+
+	return lru;
+}
+
+static sdp_buf_t *sdp_get_cached_rsp(int sock, sdp_cont_state_t *cstate)
+{
+	sdp_cstate_entry_t *entry = cstate_lookup(sock, cstate->timestamp);
+
+	if (!entry)
+		return NULL;
+
+	entry->last_used = ++cstate_clock;
+
+	return &entry->buf;
+}
+
+/* Drop the cached response once its last part has been sent */
+static void sdp_cstate_free_buf(int sock, sdp_cont_state_t *cstate)
+{
+	sdp_cstate_entry_t *entry = cstate_lookup(sock, cstate->timestamp);
+
+	if (entry)
+		cstate_entry_free(entry);
 }
 
-static uint32_t sdp_cstate_alloc_buf(sdp_buf_t *buf)
+static uint32_t sdp_cstate_alloc_buf(int sock, sdp_buf_t *buf)
 {
-	sdp_cstate_list_t *cstate = malloc(sizeof(sdp_cstate_list_t));
-	uint8_t *data = malloc(buf->data_size);
+	sdp_cstate_entry_t *entry;
+	unsigned int i, count;
+	uint8_t *data;
+
+	if (buf->data_size > CSTATE_POOL_BYTES)
+		return 0;
+
+	data = malloc(buf->data_size);
+	if (!data)
+		return 0;
 
 	memcpy(data, buf->data, buf->data_size);
-	memset((char *)cstate, 0, sizeof(sdp_cstate_list_t));
-	cstate->buf.data = data;
-	cstate->buf.data_size = buf->data_size;
-	cstate->buf.buf_size = buf->data_size;
-	cstate->timestamp = sdp_get_time();
-	cstate->next = cstates;
-	cstates = cstate;
-	return cstate->timestamp;
+
+	entry = cstate_lru(sock, &count);
+	if (entry && count >= CSTATE_CLIENT_MAX) {
+		SDPDBG("Client %d over quota, dropping 0x%x", sock,
+							entry->timestamp);
+		cstate_entry_free(entry);
+	}
+
+	while (cstate_pool_count == CSTATE_POOL_SIZE ||
+		cstate_pool_bytes + buf->data_size > CSTATE_POOL_BYTES) {
+		entry = cstate_lru(-1, NULL);
+
+		SDPDBG("Pool full, dropping 0x%x", entry->timestamp);
+		cstate_entry_free(entry);
+	}
+
+	for (i = 0; i < CSTATE_POOL_SIZE; i++) {
+		if (!cstate_pool[i].buf.data)
+			break;
+	}
+
+	entry = &cstate_pool[i];
+
+	/* Zero is never handed out, so it can't match a stale state */
+	if (!++cstate_next_id)
+		cstate_next_id++;
+
+	entry->sock = sock;
+	entry->timestamp = cstate_next_id;
+	entry->last_used = ++cstate_clock;
+	entry->buf.data = data;
+	entry->buf.data_size = buf->data_size;
+	entry->buf.buf_size = buf->data_size;
+
+	cstate_pool_count++;
+	cstate_pool_bytes += buf->data_size;
+
+	SDPDBG("Cached rsp 0x%x: %u entries, %zu bytes", entry->timestamp,
+					cstate_pool_count, cstate_pool_bytes);
+
+	return entry->timestamp;
+}
+
+/*
+ * Drop all cached responses of a client that went away
+ */
+void sdp_cstate_cleanup(int sock)
+{
+	unsigned int i;
+
+	for (i = 0; i < CSTATE_POOL_SIZE; i++) {
+		sdp_cstate_entry_t *entry = &cstate_pool[i];
+
+		if (entry->buf.data && entry->sock == sock)
+			cstate_entry_free(entry);
+	}
 }
 
 /* Additional values for checking datatype (not in spec) */
@@ -315,45 +453,6 @@ static int sdp_cstate_get(uint8_t *buffer, size_t len,
 	return 0;
 }
 
-/*
- * The matching process is defined as "each and every UUID
- * specified in the "search pattern" must be present in the
- * "target pattern". Here "search pattern" is the set of UUIDs
- * specified by the service discovery client and "target pattern"
- * is the set of UUIDs present in a service record.
- *
- * Return 1 if each and every UUID in the search
- * pattern exists in the target pattern, 0 if the
- * match succeeds and -1 on error.
- */
-static int sdp_match_uuid(sdp_list_t *search, sdp_list_t *pattern)
-{
-	/*
-	 * The target is a sorted list, so we need not look
-	 * at all elements to confirm existence of an element
-	 * from the search pattern
-	 */
-	int patlen = sdp_list_len(pattern);
-
-	if (patlen < sdp_list_len(search))
-		return -1;
-	for (; search; search = search->next) {
-		uuid_t *uuid128;
-		void *data = search->data;
-		sdp_list_t *list;
-		if (data == NULL)
-			return -1;
-
-		/* create 128-bit form of the search UUID */
-		uuid128 = sdp_uuid_to_uuid128((uuid_t *)data);
-		list = sdp_list_find(pattern, uuid128, sdp_uuid128_cmp);
-		bt_free(uuid128);
-		if (!list)
-			return 0;
-	}
-	return 1;
-}
-
 /*
  * Service search request PDU. This method extracts the search pattern
  * (a sequence of UUIDs) and calls the matching function
@@ -431,17 +530,18 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 	buf->data_size += sizeof(uint16_t);
 
 	if (cstate == NULL) {
-		/* for every record in the DB, do a pattern search */
-		sdp_list_t *list = sdp_get_record_list();
+		/* look up the records matching the pattern in the index */
+		sdp_list_t *matches = sdp_record_search(pattern);
+		sdp_list_t *list;
 
 		handleSize = 0;
-		for (; list && rsp_count < expected; list = list->next) {
+		for (list = matches; list && rsp_count < expected;
+							list = list->next) {
 			sdp_record_t *rec = list->data;
 
 			SDPDBG("Checking svcRec : 0x%x", rec->handle);
 
-			if (sdp_match_uuid(pattern, rec->pattern) > 0 &&
-					sdp_check_access(rec->handle, &req->device)) {
+			if (sdp_check_access(rec->handle, &req->device)) {
 				rsp_count++;
 				put_be32(rec->handle, pdata);
 				pdata += sizeof(uint32_t);
@@ -449,6 +549,8 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 			}
 		}
 
+		sdp_list_free(matches, NULL);
+
 		SDPDBG("Match count: %d", rsp_count);
 
 		buf->data_size += handleSize;
@@ -457,7 +559,7 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 
 		if (rsp_count > actual) {
 			/* cache the rsp and generate a continuation state */
-			cStateId = sdp_cstate_alloc_buf(buf);
+			cStateId = sdp_cstate_alloc_buf(req->sock, buf);
 			/*
 			 * subtract handleSize since we now send only
 			 * a subset of handles
@@ -478,7 +580,7 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 			 * Get the previous sdp_cont_state_t and obtain
 			 * the cached rsp
 			 */
-			sdp_buf_t *pCache = sdp_get_cached_rsp(cstate);
+			sdp_buf_t *pCache = sdp_get_cached_rsp(req->sock, cstate);
 			if (pCache) {
 				pCacheBuffer = pCache->data;
 				/* get the rsp_count from the cached buffer */
@@ -524,6 +626,9 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 		if (i == rsp_count) {
 			/* set "null" continuationState */
 			sdp_set_cstate_pdu(buf, NULL);
+
+			if (cstate)
+				sdp_cstate_free_buf(req->sock, cstate);
 		} else {
 			/*
 			 * there's more: set lastIndexSent to
@@ -561,8 +666,6 @@ done:
  */
 static int extract_attrs(sdp_record_t *rec, sdp_list_t *seq, sdp_buf_t *buf)
 {
-	sdp_buf_t pdu;
-
 	if (!rec)
 		return SDP_INVALID_RECORD_HANDLE;
 
@@ -573,8 +676,10 @@ static int extract_attrs(sdp_record_t *rec, sdp_list_t *seq, sdp_buf_t *buf)
 
 	SDPDBG("Entries in attr seq : %d", sdp_list_len(seq));
 
-	sdp_gen_record_pdu(rec, &pdu);
-
+	/*
+	 * The encoded attributes are cached along with the record, so the
+	 * response is put together from slices of that buffer.
+	 */
 	for (; seq; seq = seq->next) {
 		struct attrid *aid = seq->data;
 
@@ -582,45 +687,41 @@ static int extract_attrs(sdp_record_t *rec, sdp_list_t *seq, sdp_buf_t *buf)
 
 		if (aid->dtd == SDP_UINT16) {
 			uint16_t attr = aid->uint16;
-			sdp_data_t *a = sdp_data_get(rec, attr);
-			if (a)
-				sdp_append_to_pdu(buf, a);
+
+			sdp_record_append_attrs(rec, attr, attr, buf);
 		} else if (aid->dtd == SDP_UINT32) {
 			uint32_t range = aid->uint32;
-			uint16_t attr;
 			uint16_t low = (0xffff0000 & range) >> 16;
 			uint16_t high = 0x0000ffff & range;
-			sdp_data_t *data;
 
 			SDPDBG("attr range : 0x%x", range);
 			SDPDBG("Low id : 0x%x", low);
 			SDPDBG("High id : 0x%x", high);
 
-			if (low == 0x0000 && high == 0xffff && pdu.data_size <= buf->buf_size) {
-				/* copy it */
-				memcpy(buf->data, pdu.data, pdu.data_size);
-				buf->data_size = pdu.data_size;
-				break;
+			if (low == 0x0000 && high == 0xffff) {
+				const sdp_buf_t *pdu = sdp_record_get_pdu(rec);
+
+				if (pdu && pdu->data_size <= buf->buf_size) {
+					/* copy it */
+					memcpy(buf->data, pdu->data,
+							pdu->data_size);
+					buf->data_size = pdu->data_size;
+					break;
+				}
 			}
+
 			/* (else) sub-range of attributes */
-			for (attr = low; attr < high; attr++) {
-				data = sdp_data_get(rec, attr);
-				if (data)
-					sdp_append_to_pdu(buf, data);
-			}
-			data = sdp_data_get(rec, high);
-			if (data)
-				sdp_append_to_pdu(buf, data);
+			if (low > high)
+				low = high;
+
+			sdp_record_append_attrs(rec, low, high, buf);
 		} else {
 			error("Unexpected data type : 0x%x", aid->dtd);
 			error("Expect uint16_t or uint32_t");
-			free(pdu.data);
 			return SDP_INVALID_SYNTAX;
 		}
 	}
 
-	free(pdu.data);
-
 	return 0;
 }
 
@@ -719,7 +820,7 @@ static int service_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 	buf->buf_size -= sizeof(uint16_t);
 
 	if (cstate) {
-		sdp_buf_t *pCache = sdp_get_cached_rsp(cstate);
+		sdp_buf_t *pCache = sdp_get_cached_rsp(req->sock, cstate);
 
 		SDPDBG("Obtained cached rsp : %p", pCache);
 
@@ -732,9 +833,11 @@ static int service_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 
 			SDPDBG("Response size : %d sending now : %d bytes sent so far : %d",
 				pCache->data_size, sent, cstate->cStateValue.maxBytesSent);
-			if (cstate->cStateValue.maxBytesSent == pCache->data_size)
+			if (cstate->cStateValue.maxBytesSent ==
+							pCache->data_size) {
 				cstate_size = sdp_set_cstate_pdu(buf, NULL);
-			else
+				sdp_cstate_free_buf(req->sock, cstate);
+			} else
 				cstate_size = sdp_set_cstate_pdu(buf, cstate);
 		} else {
 			status = SDP_INVALID_CSTATE;
@@ -747,7 +850,8 @@ static int service_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 			sdp_cont_state_t newState;
 
 			memset((char *)&newState, 0, sizeof(sdp_cont_state_t));
-			newState.timestamp = sdp_cstate_alloc_buf(buf);
+			newState.timestamp = sdp_cstate_alloc_buf(req->sock,
+									buf);
 			/*
 			 * Reset the buffer size to the maximum expected and
 			 * set the sdp_cont_state_t
@@ -789,7 +893,7 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 	uint8_t *pdata, *pResponse = NULL;
 	unsigned int max;
 	int scanned, rsp_count = 0;
-	sdp_list_t *pattern = NULL, *seq = NULL, *svcList;
+	sdp_list_t *pattern = NULL, *seq = NULL, *svcList = NULL;
 	sdp_cont_state_t *cstate = NULL;
 	short cstate_size = 0;
 	uint8_t dtd = 0;
@@ -855,8 +959,6 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 		goto done;
 	}
 
-	svcList = sdp_get_record_list();
-
 	tmpbuf.data = malloc(USHRT_MAX);
 	tmpbuf.data_size = 0;
 	tmpbuf.buf_size = USHRT_MAX;
@@ -875,10 +977,12 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 	if (cstate == NULL) {
 		/* no continuation state -> create new response */
 		sdp_list_t *p;
+
+		svcList = sdp_record_search(pattern);
+
 		for (p = svcList; p; p = p->next) {
 			sdp_record_t *rec = p->data;
-			if (sdp_match_uuid(pattern, rec->pattern) > 0 &&
-					sdp_check_access(rec->handle, &req->device)) {
+			if (sdp_check_access(rec->handle, &req->device)) {
 				rsp_count++;
 				status = extract_attrs(rec, seq, &tmpbuf);
 
@@ -892,7 +996,7 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 					/* to be sure no relocations */
 					sdp_append_to_buf(buf, tmpbuf.data, tmpbuf.data_size);
 					tmpbuf.data_size = 0;
-					memset(tmpbuf.data, 0, USHRT_MAX);
+					tmpbuf.data[0] = 0;
 				} else {
 					error("Relocation needed");
 					break;
@@ -904,7 +1008,8 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 			sdp_cont_state_t newState;
 
 			memset((char *)&newState, 0, sizeof(sdp_cont_state_t));
-			newState.timestamp = sdp_cstate_alloc_buf(buf);
+			newState.timestamp = sdp_cstate_alloc_buf(req->sock,
+									buf);
 			/*
 			 * Reset the buffer size to the maximum expected and
 			 * set the sdp_cont_state_t
@@ -916,16 +1021,18 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 			cstate_size = sdp_set_cstate_pdu(buf, NULL);
 	} else {
 		/* continuation State exists -> get from cache */
-		sdp_buf_t *pCache = sdp_get_cached_rsp(cstate);
+		sdp_buf_t *pCache = sdp_get_cached_rsp(req->sock, cstate);
 		if (pCache && cstate->cStateValue.maxBytesSent < pCache->data_size) {
 			uint16_t sent = MIN(max, pCache->data_size - cstate->cStateValue.maxBytesSent);
 			pResponse = pCache->data;
 			memcpy(buf->data, pResponse + cstate->cStateValue.maxBytesSent, sent);
 			buf->data_size += sent;
 			cstate->cStateValue.maxBytesSent += sent;
-			if (cstate->cStateValue.maxBytesSent == pCache->data_size)
+			if (cstate->cStateValue.maxBytesSent ==
+							pCache->data_size) {
 				cstate_size = sdp_set_cstate_pdu(buf, NULL);
-			else
+				sdp_cstate_free_buf(req->sock, cstate);
+			} else
 				cstate_size = sdp_set_cstate_pdu(buf, cstate);
 		} else {
 			status = SDP_INVALID_CSTATE;
@@ -953,6 +1060,7 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 done:
 	free(cstate);
 	free(tmpbuf.data);
+	sdp_list_free(svcList, NULL);
 	if (pattern)
 		sdp_list_free(pattern, free);
 	if (seq)
@@ -318,6 +318,9 @@ static void update_db_timestamp(void)
 		sdp_data_t *d = sdp_data_alloc(SDP_UINT32, &dbts);
 		sdp_attr_replace(server, SDP_ATTR_SVCDB_STATE, d);
 	}
+
+	if (server)
+		sdp_record_invalidate(server->handle);
 }
 
 void set_fixed_db_timestamp(uint32_t dbts)
@@ -640,6 +643,8 @@ static void update_mps(void)
 		data = sdp_data_alloc(SDP_UINT64, &mpmd_feat);
 		sdp_attr_replace(rec, SDP_ATTR_MPMD_SCENARIOS, data);
 	}
+
+	sdp_record_invalidate(rec->handle);
 }
 
 int add_record_to_server(const bdaddr_t *src, sdp_record_t *rec)
@@ -761,6 +766,7 @@ static sdp_record_t *extract_pdu_server(bdaddr_t *device, uint8_t *p,
 	} else {
 		sdp_list_free(rec->attrlist, (sdp_free_func_t) sdp_data_free);
 		rec->attrlist = NULL;
+		sdp_record_invalidate(rec->handle);
 	}
 
 	while (localExtractedLength < seqlen) {
@@ -44,6 +44,7 @@ typedef struct request {
 
 void handle_internal_request(int sk, int mtu, void *data, int len);
 void handle_request(int sk, uint8_t *data, int len);
+void sdp_cstate_cleanup(int sock);
 
 void set_fixed_db_timestamp(uint32_t dbts);
 
@@ -67,6 +68,11 @@ void sdp_record_add(const bdaddr_t *device, sdp_record_t *rec);
 int sdp_record_remove(uint32_t handle);
 sdp_list_t *sdp_get_record_list(void);
 int sdp_check_access(uint32_t handle, bdaddr_t *device);
+const sdp_buf_t *sdp_record_get_pdu(const sdp_record_t *rec);
+void sdp_record_append_attrs(const sdp_record_t *rec, uint16_t low,
+					uint16_t high, sdp_buf_t *buf);
+void sdp_record_invalidate(uint32_t handle);
+sdp_list_t *sdp_record_search(sdp_list_t *search);
 uint32_t sdp_next_handle(void);
 
 uint32_t sdp_get_time(void);
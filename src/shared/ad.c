@@ -27,7 +27,7 @@
 #include "src/shared/queue.h"
 #include "src/shared/util.h"
 
-#define MAX_ADV_DATA_LEN 31
+#define MAX_ADV_DATA_LEN BT_AD_MAX_DATA_LEN
 
 struct bt_ad {
 	int ref_count;
@@ -37,6 +37,23 @@ struct bt_ad {
 	struct queue *manufacturer_data;
 	struct queue *solicit_uuids;
 	struct queue *service_data;
+	bool dirty;
+	uint8_t cache[MAX_ADV_DATA_LEN];
+	uint8_t cache_len;
+};
+
+/*
+ * Data entries remember where their payload ended up in the cached
+ * encoding so a same-length update can be patched in place.
+ */
+struct manuf_entry {
+	struct bt_ad_manufacturer_data data;
+	uint8_t offset;
+};
+
+struct service_data_entry {
+	struct bt_ad_service_data data;
+	uint8_t offset;
 };
 
 struct bt_ad *bt_ad_new(void)
@@ -49,6 +66,7 @@ struct bt_ad *bt_ad_new(void)
 	ad->solicit_uuids = queue_new();
 	ad->service_data = queue_new();
 	ad->appearance = UINT16_MAX;
+	ad->dirty = true;
 
 	return bt_ad_ref(ad);
 }
@@ -281,7 +299,8 @@ static void serialize_manuf_data(struct queue *manuf_data, uint8_t *buf,
 	const struct queue_entry *entry = queue_get_entries(manuf_data);
 
 	while (entry) {
-		struct bt_ad_manufacturer_data *data = entry->data;
+		struct manuf_entry *manuf = entry->data;
+		struct bt_ad_manufacturer_data *data = &manuf->data;
 
 		buf[(*pos)++] = data->len + 2 + 1;
 
@@ -291,6 +310,7 @@ static void serialize_manuf_data(struct queue *manuf_data, uint8_t *buf,
 
 		*pos += 2;
 
+		manuf->offset = *pos;
 		memcpy(buf + *pos, data->data, data->len);
 
 		*pos += data->len;
@@ -305,7 +325,8 @@ static void serialize_service_data(struct queue *service_data, uint8_t *buf,
 	const struct queue_entry *entry = queue_get_entries(service_data);
 
 	while (entry) {
-		struct bt_ad_service_data *data = entry->data;
+		struct service_data_entry *svc = entry->data;
+		struct bt_ad_service_data *data = &svc->data;
 		int uuid_len = bt_uuid_len(&data->uuid);
 
 		buf[(*pos)++] =  uuid_len + data->len + 1;
@@ -329,6 +350,7 @@ static void serialize_service_data(struct queue *service_data, uint8_t *buf,
 
 		*pos += uuid_len;
 
+		svc->offset = *pos;
 		memcpy(buf + *pos, data->data, data->len);
 
 		*pos += data->len;
@@ -370,36 +392,69 @@ static void serialize_appearance(uint16_t value, uint8_t *buf, uint8_t *pos)
 	*pos += 2;
 }
 
+static bool update_cache(struct bt_ad *ad)
+{
+	uint8_t pos = 0;
+
+	if (!ad->dirty)
+		return true;
+
+	if (calculate_length(ad) > MAX_ADV_DATA_LEN)
+		return false;
+
+	serialize_service_uuids(ad->service_uuids, ad->cache, &pos);
+
+	serialize_solicit_uuids(ad->solicit_uuids, ad->cache, &pos);
+
+	serialize_manuf_data(ad->manufacturer_data, ad->cache, &pos);
+
+	serialize_service_data(ad->service_data, ad->cache, &pos);
+
+	serialize_name(ad->name, ad->cache, &pos);
+
+	serialize_appearance(ad->appearance, ad->cache, &pos);
+
+	ad->cache_len = pos;
+	ad->dirty = false;
+
+	return true;
+}
+
 uint8_t *bt_ad_generate(struct bt_ad *ad, size_t *length)
 {
 	uint8_t *adv_data;
-	uint8_t pos = 0;
 
 	if (!ad)
 		return NULL;
 
-	*length = calculate_length(ad);
-
-	if (*length > MAX_ADV_DATA_LEN)
+	if (!update_cache(ad)) {
+		*length = calculate_length(ad);
 		return NULL;
+	}
+
+	*length = ad->cache_len;
 
 	adv_data = malloc0(*length);
 	if (!adv_data)
 		return NULL;
 
-	serialize_service_uuids(ad->service_uuids, adv_data, &pos);
-
-	serialize_solicit_uuids(ad->solicit_uuids, adv_data, &pos);
+	memcpy(adv_data, ad->cache, ad->cache_len);
 
-	serialize_manuf_data(ad->manufacturer_data, adv_data, &pos);
+	return adv_data;
+}
 
-	serialize_service_data(ad->service_data, adv_data, &pos);
+bool bt_ad_generate_into(struct bt_ad *ad, uint8_t *buf, size_t *length)
+{
+	if (!ad || !buf || !length)
+		return false;
 
-	serialize_name(ad->name, adv_data, &pos);
+	if (!update_cache(ad) || ad->cache_len > *length)
+		return false;
 
-	serialize_appearance(ad->appearance, adv_data, &pos);
+	memcpy(buf, ad->cache, ad->cache_len);
+	*length = ad->cache_len;
 
-	return adv_data;
+	return true;
 }
 
 static bool queue_add_uuid(struct queue *queue, const bt_uuid_t *uuid)
@@ -451,6 +506,8 @@ bool bt_ad_add_service_uuid(struct bt_ad *ad, const bt_uuid_t *uuid)
 	if (!ad)
 		return false;
 
+	ad->dirty = true;
+
 	return queue_add_uuid(ad->service_uuids, uuid);
 }
 
@@ -459,6 +516,8 @@ bool bt_ad_remove_service_uuid(struct bt_ad *ad, bt_uuid_t *uuid)
 	if (!ad)
 		return false;
 
+	ad->dirty = true;
+
 	return queue_remove_uuid(ad->service_uuids, uuid);
 }
 
@@ -467,6 +526,8 @@ void bt_ad_clear_service_uuid(struct bt_ad *ad)
 	if (!ad)
 		return;
 
+	ad->dirty = true;
+
 	queue_remove_all(ad->service_uuids, NULL, NULL, free);
 }
 
@@ -482,6 +543,7 @@ bool bt_ad_add_manufacturer_data(struct bt_ad *ad, uint16_t manufacturer_id,
 							void *data, size_t len)
 {
 	struct bt_ad_manufacturer_data *new_data;
+	struct manuf_entry *manuf;
 
 	if (!ad)
 		return false;
@@ -489,23 +551,32 @@ bool bt_ad_add_manufacturer_data(struct bt_ad *ad, uint16_t manufacturer_id,
 	if (len > (MAX_ADV_DATA_LEN - 2 - sizeof(uint16_t)))
 		return false;
 
-	new_data = queue_find(ad->manufacturer_data, manufacturer_id_data_match,
+	manuf = queue_find(ad->manufacturer_data, manufacturer_id_data_match,
 						UINT_TO_PTR(manufacturer_id));
-	if (new_data) {
+	if (manuf) {
+		new_data = &manuf->data;
 		if (new_data->len == len && !memcmp(new_data->data, data, len))
 			return false;
+
+		/* The layout stays the same, only patch the payload */
+		if (new_data->len == len && !ad->dirty)
+			memcpy(ad->cache + manuf->offset, data, len);
+		else
+			ad->dirty = true;
+
 		new_data->data = realloc(new_data->data, len);
 		memcpy(new_data->data, data, len);
 		new_data->len = len;
 		return true;
 	}
 
-	new_data = new0(struct bt_ad_manufacturer_data, 1);
+	manuf = new0(struct manuf_entry, 1);
+	new_data = &manuf->data;
 	new_data->manufacturer_id = manufacturer_id;
 
 	new_data->data = malloc(len);
 	if (!new_data->data) {
-		free(new_data);
+		free(manuf);
 		return false;
 	}
 
@@ -513,7 +584,9 @@ bool bt_ad_add_manufacturer_data(struct bt_ad *ad, uint16_t manufacturer_id,
 
 	new_data->len = len;
 
-	if (queue_push_tail(ad->manufacturer_data, new_data))
+	ad->dirty = true;
+
+	if (queue_push_tail(ad->manufacturer_data, manuf))
 		return true;
 
 	manuf_destroy(new_data);
@@ -569,6 +642,8 @@ bool bt_ad_remove_manufacturer_data(struct bt_ad *ad, uint16_t manufacturer_id)
 	if (!data)
 		return false;
 
+	ad->dirty = true;
+
 	manuf_destroy(data);
 
 	return true;
@@ -579,6 +654,8 @@ void bt_ad_clear_manufacturer_data(struct bt_ad *ad)
 	if (!ad)
 		return;
 
+	ad->dirty = true;
+
 	queue_remove_all(ad->manufacturer_data, NULL, NULL, manuf_destroy);
 }
 
@@ -587,6 +664,8 @@ bool bt_ad_add_solicit_uuid(struct bt_ad *ad, const bt_uuid_t *uuid)
 	if (!ad)
 		return false;
 
+	ad->dirty = true;
+
 	return queue_add_uuid(ad->solicit_uuids, uuid);
 }
 
@@ -595,6 +674,8 @@ bool bt_ad_remove_solicit_uuid(struct bt_ad *ad, bt_uuid_t *uuid)
 	if (!ad)
 		return false;
 
+	ad->dirty = true;
+
 	return queue_remove_uuid(ad->solicit_uuids, uuid);
 }
 
@@ -603,6 +684,8 @@ void bt_ad_clear_solicit_uuid(struct bt_ad *ad)
 	if (!ad)
 		return;
 
+	ad->dirty = true;
+
 	queue_remove_all(ad->solicit_uuids, NULL, NULL, free);
 }
 
@@ -619,6 +702,7 @@ bool bt_ad_add_service_data(struct bt_ad *ad, const bt_uuid_t *uuid, void *data,
 								size_t len)
 {
 	struct bt_ad_service_data *new_data;
+	struct service_data_entry *svc;
 
 	if (!ad)
 		return false;
@@ -626,23 +710,32 @@ bool bt_ad_add_service_data(struct bt_ad *ad, const bt_uuid_t *uuid, void *data,
 	if (len > (MAX_ADV_DATA_LEN - 2 - (size_t)bt_uuid_len(uuid)))
 		return false;
 
-	new_data = queue_find(ad->service_data, service_uuid_match, uuid);
-	if (new_data) {
+	svc = queue_find(ad->service_data, service_uuid_match, uuid);
+	if (svc) {
+		new_data = &svc->data;
 		if (new_data->len == len && !memcmp(new_data->data, data, len))
 			return false;
+
+		/* The layout stays the same, only patch the payload */
+		if (new_data->len == len && !ad->dirty)
+			memcpy(ad->cache + svc->offset, data, len);
+		else
+			ad->dirty = true;
+
 		new_data->data = realloc(new_data->data, len);
 		memcpy(new_data->data, data, len);
 		new_data->len = len;
 		return true;
 	}
 
-	new_data = new0(struct bt_ad_service_data, 1);
+	svc = new0(struct service_data_entry, 1);
+	new_data = &svc->data;
 
 	new_data->uuid = *uuid;
 
 	new_data->data = malloc(len);
 	if (!new_data->data) {
-		free(new_data);
+		free(svc);
 		return false;
 	}
 
@@ -650,7 +743,9 @@ bool bt_ad_add_service_data(struct bt_ad *ad, const bt_uuid_t *uuid, void *data,
 
 	new_data->len = len;
 
-	if (queue_push_tail(ad->service_data, new_data))
+	ad->dirty = true;
+
+	if (queue_push_tail(ad->service_data, svc))
 		return true;
 
 	uuid_destroy(new_data);
@@ -705,6 +800,8 @@ bool bt_ad_remove_service_data(struct bt_ad *ad, bt_uuid_t *uuid)
 	if (!data)
 		return false;
 
+	ad->dirty = true;
+
 	uuid_destroy(data);
 
 	return true;
@@ -715,6 +812,8 @@ void bt_ad_clear_service_data(struct bt_ad *ad)
 	if (!ad)
 		return;
 
+	ad->dirty = true;
+
 	queue_remove_all(ad->service_data, NULL, NULL, uuid_destroy);
 }
 
@@ -723,6 +822,11 @@ bool bt_ad_add_name(struct bt_ad *ad, const char *name)
 	if (!ad)
 		return false;
 
+	if (ad->name && !strcmp(ad->name, name))
+		return true;
+
+	ad->dirty = true;
+
 	free(ad->name);
 
 	ad->name = strdup(name);
@@ -735,6 +839,9 @@ void bt_ad_clear_name(struct bt_ad *ad)
 	if (!ad)
 		return;
 
+	if (ad->name)
+		ad->dirty = true;
+
 	free(ad->name);
 	ad->name = NULL;
 }
@@ -744,6 +851,9 @@ bool bt_ad_add_appearance(struct bt_ad *ad, uint16_t appearance)
 	if (!ad)
 		return false;
 
+	if (ad->appearance != appearance)
+		ad->dirty = true;
+
 	ad->appearance = appearance;
 
 	return true;
@@ -754,5 +864,8 @@ void bt_ad_clear_appearance(struct bt_ad *ad)
 	if (!ad)
 		return;
 
+	if (ad->appearance != UINT16_MAX)
+		ad->dirty = true;
+
 	ad->appearance = UINT16_MAX;
 }
@@ -28,11 +28,15 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "src/shared/io.h"
 #include "src/shared/queue.h"
 #include "src/shared/util.h"
 #include "src/shared/timeout.h"
+#include "src/shared/trace.h"
 #include "lib/bluetooth.h"
 #include "lib/l2cap.h"
 #include "lib/uuid.h"
@@ -43,6 +47,9 @@
 #define ATT_OP_CMD_MASK			0x40
 #define ATT_OP_SIGNED_MASK		0x80
 #define ATT_TIMEOUT_INTERVAL		30000  /* 30000 ms */
+#define ATT_MAX_READ_BATCH		64  /* PDUs per read wakeup */
+#define ATT_MAX_SEND_IOV		8   /* Caller vectors per PDU */
+#define ATT_HANDLE_BUCKETS		32  /* Handle keyed notify buckets */
 
 /* Length of signature in write signed packet */
 #define BT_ATT_SIGNATURE_LEN		12
@@ -63,7 +70,13 @@ struct bt_att {
 	struct queue *write_queue;	/* Queue of PDUs ready to send */
 	bool writer_active;
 
+	unsigned int cmd_window;	/* Max queued commands, 0 = no limit */
+	unsigned int cmd_queued;	/* Commands in write_queue */
+	struct queue *ready_list;	/* Waiting for command credits */
+
 	struct queue *notify_list;	/* List of registered callbacks */
+	struct queue *handle_notify[ATT_HANDLE_BUCKETS];
+							/* Keyed by handle */
 	struct queue *disconn_list;	/* List of disconnect handlers */
 
 	bool in_req;			/* There's a pending incoming request */
@@ -71,6 +84,10 @@ struct bt_att {
 	uint8_t *buf;
 	uint16_t mtu;
 
+	unsigned int read_batch;	/* Max PDUs handled per wakeup */
+	struct bt_att_read_stats read_stats;
+	struct bt_att_pdu_stats pdu_stats;
+
 	unsigned int next_send_id;	/* IDs for "send" ops */
 	unsigned int next_reg_id;	/* IDs for registered callbacks */
 
@@ -191,6 +208,8 @@ struct att_send_op {
 	uint8_t opcode;
 	void *pdu;
 	uint16_t len;
+	struct iovec *iov;	/* Caller owned PDU data, opcode first */
+	int iovcnt;
 	bt_att_response_func_t callback;
 	bt_att_destroy_func_t destroy;
 	void *user_data;
@@ -206,12 +225,49 @@ static void destroy_att_send_op(void *data)
 	if (op->destroy)
 		op->destroy(op->user_data);
 
+	free(op->iov);
 	free(op->pdu);
 	free(op);
 }
 
+static bool linearize_att_send_op(struct att_send_op *op)
+{
+	uint16_t offset = 0;
+	int i;
+
+	if (!op->iov)
+		return true;
+
+	op->pdu = malloc(op->len);
+	if (!op->pdu)
+		return false;
+
+	for (i = 0; i < op->iovcnt; i++) {
+		memcpy(op->pdu + offset, op->iov[i].iov_base,
+							op->iov[i].iov_len);
+		offset += op->iov[i].iov_len;
+	}
+
+	free(op->iov);
+	op->iov = NULL;
+	op->iovcnt = 0;
+
+	return true;
+}
+
 static void cancel_att_send_op(struct att_send_op *op)
 {
+	/*
+	 * A pending request may still be retried, so take a copy of any caller
+	 * owned data since the destroy callback releases it.
+	 */
+	if (!linearize_att_send_op(op)) {
+		free(op->iov);
+		op->iov = NULL;
+		op->iovcnt = 0;
+		op->len = 0;
+	}
+
 	if (op->destroy)
 		op->destroy(op->user_data);
 
@@ -223,6 +279,7 @@ static void cancel_att_send_op(struct att_send_op *op)
 struct att_notify {
 	unsigned int id;
 	uint16_t opcode;
+	uint16_t handle;
 	bt_att_notify_func_t callback;
 	bt_att_destroy_func_t destroy;
 	void *user_data;
@@ -272,6 +329,52 @@ static bool match_disconn_id(const void *a, const void *b)
 	return disconn->id == id;
 }
 
+struct att_ready {
+	unsigned int id;
+	bt_att_ready_func_t callback;
+	bt_att_destroy_func_t destroy;
+	void *user_data;
+};
+
+static void destroy_att_ready(void *data)
+{
+	struct att_ready *ready = data;
+
+	if (ready->destroy)
+		ready->destroy(ready->user_data);
+
+	free(ready);
+}
+
+static bool match_ready_id(const void *a, const void *b)
+{
+	const struct att_ready *ready = a;
+	unsigned int id = PTR_TO_UINT(b);
+
+	return ready->id == id;
+}
+
+static void ready_handler(void *data, void *user_data)
+{
+	struct att_ready *ready = data;
+
+	if (ready->callback)
+		ready->callback(ready->user_data);
+}
+
+/* A queued command left the write queue, which may give a credit back */
+static void cmd_done(struct bt_att *att)
+{
+	att->cmd_queued--;
+
+	if (!att->cmd_window || att->cmd_queued != att->cmd_window - 1)
+		return;
+
+	bt_att_ref(att);
+	queue_foreach(att->ready_list, ready_handler, NULL);
+	bt_att_unref(att);
+}
+
 static bool encode_pdu(struct bt_att *att, struct att_send_op *op,
 					const void *pdu, uint16_t length)
 {
@@ -315,6 +418,30 @@ fail:
 	return false;
 }
 
+static bool check_op_type(uint8_t opcode, bt_att_response_func_t callback,
+						enum att_op_type *type)
+{
+	*type = get_op_type(opcode);
+	if (*type == ATT_OP_TYPE_UNKNOWN)
+		return false;
+
+	/* If the opcode corresponds to an operation type that does not elicit a
+	 * response from the remote end, then no callback should have been
+	 * provided, since it will never be called.
+	 */
+	if (callback && *type != ATT_OP_TYPE_REQ && *type != ATT_OP_TYPE_IND)
+		return false;
+
+	/* Similarly, if the operation does elicit a response then a callback
+	 * must be provided.
+	 */
+	if (!callback && (*type == ATT_OP_TYPE_REQ ||
+						*type == ATT_OP_TYPE_IND))
+		return false;
+
+	return true;
+}
+
 static struct att_send_op *create_att_send_op(struct bt_att *att,
 						uint8_t opcode,
 						const void *pdu,
@@ -329,21 +456,7 @@ static struct att_send_op *create_att_send_op(struct bt_att *att,
 	if (length && !pdu)
 		return NULL;
 
-	type = get_op_type(opcode);
-	if (type == ATT_OP_TYPE_UNKNOWN)
-		return NULL;
-
-	/* If the opcode corresponds to an operation type that does not elicit a
-	 * response from the remote end, then no callback should have been
-	 * provided, since it will never be called.
-	 */
-	if (callback && type != ATT_OP_TYPE_REQ && type != ATT_OP_TYPE_IND)
-		return NULL;
-
-	/* Similarly, if the operation does elicit a response then a callback
-	 * must be provided.
-	 */
-	if (!callback && (type == ATT_OP_TYPE_REQ || type == ATT_OP_TYPE_IND))
+	if (!check_op_type(opcode, callback, &type))
 		return NULL;
 
 	op = new0(struct att_send_op, 1);
@@ -361,6 +474,58 @@ static struct att_send_op *create_att_send_op(struct bt_att *att,
 	return op;
 }
 
+static struct att_send_op *create_att_send_opv(struct bt_att *att,
+						uint8_t opcode,
+						const struct iovec *iov,
+						int iovcnt,
+						bt_att_response_func_t callback,
+						void *user_data,
+						bt_att_destroy_func_t destroy)
+{
+	struct att_send_op *op;
+	enum att_op_type type;
+	size_t pdu_len = 1;
+	int i;
+
+	if (iovcnt < 0 || iovcnt > ATT_MAX_SEND_IOV || (iovcnt && !iov))
+		return NULL;
+
+	/* Signing needs the PDU in one piece, use bt_att_send for those */
+	if (opcode & ATT_OP_SIGNED_MASK)
+		return NULL;
+
+	if (!check_op_type(opcode, callback, &type))
+		return NULL;
+
+	for (i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len && !iov[i].iov_base)
+			return NULL;
+
+		pdu_len += iov[i].iov_len;
+	}
+
+	if (pdu_len > att->mtu)
+		return NULL;
+
+	op = new0(struct att_send_op, 1);
+	op->type = type;
+	op->opcode = opcode;
+	op->callback = callback;
+	op->destroy = destroy;
+	op->user_data = user_data;
+	op->len = pdu_len;
+	op->iovcnt = iovcnt + 1;
+	op->iov = new0(struct iovec, op->iovcnt);
+
+	op->iov[0].iov_base = &op->opcode;
+	op->iov[0].iov_len = sizeof(op->opcode);
+
+	for (i = 0; i < iovcnt; i++)
+		op->iov[i + 1] = iov[i];
+
+	return op;
+}
+
 static struct att_send_op *pick_next_send_op(struct bt_att *att)
 {
 	struct att_send_op *op;
@@ -446,15 +611,23 @@ static bool can_write_data(struct io *io, void *user_data)
 	struct timeout_data *timeout;
 	ssize_t ret;
 	struct iovec iov;
+	bool cmd;
 
 	op = pick_next_send_op(att);
 	if (!op)
 		return false;
 
-	iov.iov_base = op->pdu;
-	iov.iov_len = op->len;
+	cmd = op->type == ATT_OP_TYPE_CMD;
+
+	if (op->iov) {
+		ret = io_send(io, op->iov, op->iovcnt);
+	} else {
+		iov.iov_base = op->pdu;
+		iov.iov_len = op->len;
+
+		ret = io_send(io, &iov, 1);
+	}
 
-	ret = io_send(io, &iov, 1);
 	if (ret < 0) {
 		util_debug(att->debug_callback, att->debug_data,
 					"write failed: %s", strerror(-ret));
@@ -463,13 +636,31 @@ static bool can_write_data(struct io *io, void *user_data)
 							op->user_data);
 
 		destroy_att_send_op(op);
+
+		if (cmd)
+			cmd_done(att);
+
 		return true;
 	}
 
+	BT_TRACE2(att_tx, op->opcode, ret);
+
+	att->pdu_stats.tx_pdus++;
+	att->pdu_stats.tx_bytes += ret;
+
 	util_debug(att->debug_callback, att->debug_data,
 					"ATT op 0x%02x", op->opcode);
 
-	util_hexdump('<', op->pdu, ret, att->debug_callback, att->debug_data);
+	if (op->iov) {
+		int i;
+
+		for (i = 0; i < op->iovcnt; i++)
+			util_hexdump('<', op->iov[i].iov_base,
+					op->iov[i].iov_len,
+					att->debug_callback, att->debug_data);
+	} else
+		util_hexdump('<', op->pdu, ret, att->debug_callback,
+							att->debug_data);
 
 	/* Based on the operation type, set either the pending request or the
 	 * pending indication. If it came from the write queue, then there is
@@ -492,6 +683,10 @@ static bool can_write_data(struct io *io, void *user_data)
 	case ATT_OP_TYPE_UNKNOWN:
 	default:
 		destroy_att_send_op(op);
+
+		if (cmd)
+			cmd_done(att);
+
 		return true;
 	}
 
@@ -574,6 +769,7 @@ static bool disconnect_cb(struct io *io, void *user_data)
 	queue_remove_all(att->req_queue, NULL, NULL, disc_att_send_op);
 	queue_remove_all(att->ind_queue, NULL, NULL, disc_att_send_op);
 	queue_remove_all(att->write_queue, NULL, NULL, disc_att_send_op);
+	att->cmd_queued = 0;
 
 	if (att->pending_req) {
 		disc_att_send_op(att->pending_req);
@@ -803,6 +999,57 @@ fail:
 	return false;
 }
 
+static bool is_handle_opcode(uint8_t opcode)
+{
+	return opcode == BT_ATT_OP_HANDLE_VAL_NOT ||
+					opcode == BT_ATT_OP_HANDLE_VAL_IND;
+}
+
+static struct queue *handle_bucket(struct bt_att *att, uint16_t handle)
+{
+	/* Characteristic handles are mostly contiguous, modulo spreads them */
+	return att->handle_notify[handle % ATT_HANDLE_BUCKETS];
+}
+
+static bool handle_notify_by_handle(struct bt_att *att, uint8_t opcode,
+						uint8_t *pdu, ssize_t pdu_len)
+{
+	const struct queue_entry *entry;
+	struct queue *bucket;
+	uint16_t handle;
+	bool found = false;
+
+	if (!is_handle_opcode(opcode) || pdu_len < 2)
+		return false;
+
+	handle = get_le16(pdu);
+
+	bucket = handle_bucket(att, handle);
+	if (!bucket)
+		return false;
+
+	entry = queue_get_entries(bucket);
+
+	while (entry) {
+		struct att_notify *notify = entry->data;
+
+		entry = entry->next;
+
+		if (notify->handle != handle || notify->opcode != opcode)
+			continue;
+
+		found = true;
+
+		notify->callback(opcode, pdu, pdu_len, notify->user_data);
+
+		/* callback could remove all entries from the bucket */
+		if (queue_isempty(bucket))
+			break;
+	}
+
+	return found;
+}
+
 static void handle_notify(struct bt_att *att, uint8_t opcode, uint8_t *pdu,
 								ssize_t pdu_len)
 {
@@ -817,7 +1064,7 @@ static void handle_notify(struct bt_att *att, uint8_t opcode, uint8_t *pdu,
 
 	bt_att_ref(att);
 
-	found = false;
+	found = handle_notify_by_handle(att, opcode, pdu, pdu_len);
 	entry = queue_get_entries(att->notify_list);
 
 	while (entry) {
@@ -849,39 +1096,21 @@ static void handle_notify(struct bt_att *att, uint8_t opcode, uint8_t *pdu,
 	bt_att_unref(att);
 }
 
-static bool can_read_data(struct io *io, void *user_data)
+static bool handle_pdu(struct bt_att *att, uint8_t *pdu, ssize_t pdu_len)
 {
-	struct bt_att *att = user_data;
-	uint8_t opcode;
-	uint8_t *pdu;
-	ssize_t bytes_read;
-
-	bytes_read = read(att->fd, att->buf, att->mtu);
-	if (bytes_read < 0)
-		return false;
-
-	util_hexdump('>', att->buf, bytes_read,
-					att->debug_callback, att->debug_data);
-
-	if (bytes_read < ATT_MIN_PDU_LEN)
-		return true;
-
-	pdu = att->buf;
-	opcode = pdu[0];
-
-	bt_att_ref(att);
+	uint8_t opcode = pdu[0];
 
 	/* Act on the received PDU based on the opcode type */
 	switch (get_op_type(opcode)) {
 	case ATT_OP_TYPE_RSP:
 		util_debug(att->debug_callback, att->debug_data,
 				"ATT response received: 0x%02x", opcode);
-		handle_rsp(att, opcode, pdu + 1, bytes_read - 1);
+		handle_rsp(att, opcode, pdu + 1, pdu_len - 1);
 		break;
 	case ATT_OP_TYPE_CONF:
 		util_debug(att->debug_callback, att->debug_data,
 				"ATT confirmation received: 0x%02x", opcode);
-		handle_conf(att, pdu + 1, bytes_read - 1);
+		handle_conf(att, pdu + 1, pdu_len - 1);
 		break;
 	case ATT_OP_TYPE_REQ:
 		/*
@@ -894,8 +1123,6 @@ static bool can_read_data(struct io *io, void *user_data)
 					"Received request while another is "
 					"pending: 0x%02x", opcode);
 			io_shutdown(att->io);
-			bt_att_unref(att);
-
 			return false;
 		}
 
@@ -912,13 +1139,73 @@ static bool can_read_data(struct io *io, void *user_data)
 		 */
 		util_debug(att->debug_callback, att->debug_data,
 					"ATT PDU received: 0x%02x", opcode);
-		handle_notify(att, opcode, pdu + 1, bytes_read - 1);
+		handle_notify(att, opcode, pdu + 1, pdu_len - 1);
 		break;
 	}
 
+	return true;
+}
+
+static void update_read_stats(struct bt_att *att, unsigned int count)
+{
+	att->read_stats.wakeups++;
+	att->read_stats.pdus += count;
+
+	if (count > att->read_stats.max_batch)
+		att->read_stats.max_batch = count;
+}
+
+static bool can_read_data(struct io *io, void *user_data)
+{
+	struct bt_att *att = user_data;
+	unsigned int count = 0;
+	ssize_t bytes_read;
+	bool ret = true;
+
+	bytes_read = read(att->fd, att->buf, att->mtu);
+	if (bytes_read < 0)
+		return false;
+
+	bt_att_ref(att);
+
+	/*
+	 * Handle up to read_batch PDUs before returning to the mainloop. The
+	 * first one is known to be there, the remaining ones are only picked
+	 * up if the socket has them queued already.
+	 */
+	while (1) {
+		util_hexdump('>', att->buf, bytes_read,
+					att->debug_callback, att->debug_data);
+
+		if (bytes_read >= ATT_MIN_PDU_LEN) {
+			count++;
+
+			BT_TRACE2(att_rx, att->buf[0], bytes_read);
+
+			att->pdu_stats.rx_pdus++;
+			att->pdu_stats.rx_bytes += bytes_read;
+
+			if (!handle_pdu(att, att->buf, bytes_read)) {
+				ret = false;
+				break;
+			}
+		}
+
+		/* Stop if the bearer went away while handling the PDU */
+		if (!att->io || count >= att->read_batch)
+			break;
+
+		/* The buffer may have been reallocated by bt_att_set_mtu */
+		bytes_read = recv(att->fd, att->buf, att->mtu, MSG_DONTWAIT);
+		if (bytes_read <= 0)
+			break;
+	}
+
+	update_read_stats(att, count);
+
 	bt_att_unref(att);
 
-	return true;
+	return ret;
 }
 
 static bool is_io_l2cap_based(int fd)
@@ -948,6 +1235,8 @@ static bool is_io_l2cap_based(int fd)
 
 static void bt_att_free(struct bt_att *att)
 {
+	unsigned int i;
+
 	if (att->pending_req)
 		destroy_att_send_op(att->pending_req);
 
@@ -962,6 +1251,10 @@ static void bt_att_free(struct bt_att *att)
 	queue_destroy(att->write_queue, NULL);
 	queue_destroy(att->notify_list, NULL);
 	queue_destroy(att->disconn_list, NULL);
+	queue_destroy(att->ready_list, NULL);
+
+	for (i = 0; i < ATT_HANDLE_BUCKETS; i++)
+		queue_destroy(att->handle_notify[i], NULL);
 
 	if (att->timeout_destroy)
 		att->timeout_destroy(att->timeout_data);
@@ -998,6 +1291,7 @@ struct bt_att *bt_att_new(int fd, bool ext_signed)
 
 	att = new0(struct bt_att, 1);
 	att->fd = fd;
+	att->read_batch = 1;
 
 	att->io = io_new(fd);
 	if (!att->io)
@@ -1012,6 +1306,7 @@ struct bt_att *bt_att_new(int fd, bool ext_signed)
 	att->write_queue = queue_new();
 	att->notify_list = queue_new();
 	att->disconn_list = queue_new();
+	att->ready_list = queue_new();
 
 	if (!io_set_read_handler(att->io, can_read_data, att, NULL))
 		goto fail;
@@ -1129,6 +1424,158 @@ bool bt_att_set_mtu(struct bt_att *att, uint16_t mtu)
 	return true;
 }
 
+bool bt_att_set_read_batch(struct bt_att *att, unsigned int count)
+{
+	if (!att || !count || count > ATT_MAX_READ_BATCH)
+		return false;
+
+	att->read_batch = count;
+
+	return true;
+}
+
+bool bt_att_set_cmd_window(struct bt_att *att, unsigned int window)
+{
+	if (!att)
+		return false;
+
+	att->cmd_window = window;
+
+	return true;
+}
+
+unsigned int bt_att_get_cmd_credits(struct bt_att *att)
+{
+	if (!att)
+		return 0;
+
+	if (!att->cmd_window)
+		return UINT_MAX;
+
+	if (att->cmd_queued >= att->cmd_window)
+		return 0;
+
+	return att->cmd_window - att->cmd_queued;
+}
+
+unsigned int bt_att_register_ready(struct bt_att *att,
+						bt_att_ready_func_t callback,
+						void *user_data,
+						bt_att_destroy_func_t destroy)
+{
+	struct att_ready *ready;
+
+	if (!att || !att->io || !callback)
+		return 0;
+
+	ready = new0(struct att_ready, 1);
+	ready->callback = callback;
+	ready->destroy = destroy;
+	ready->user_data = user_data;
+
+	if (att->next_reg_id < 1)
+		att->next_reg_id = 1;
+
+	ready->id = att->next_reg_id++;
+
+	if (!queue_push_tail(att->ready_list, ready)) {
+		free(ready);
+		return 0;
+	}
+
+	return ready->id;
+}
+
+bool bt_att_unregister_ready(struct bt_att *att, unsigned int id)
+{
+	struct att_ready *ready;
+
+	if (!att || !id)
+		return false;
+
+	ready = queue_remove_if(att->ready_list, match_ready_id,
+							UINT_TO_PTR(id));
+	if (!ready)
+		return false;
+
+	destroy_att_ready(ready);
+	return true;
+}
+
+bool bt_att_get_read_stats(struct bt_att *att,
+					struct bt_att_read_stats *stats)
+{
+	if (!att || !stats)
+		return false;
+
+	*stats = att->read_stats;
+
+	return true;
+}
+
+bool bt_att_get_pdu_stats(struct bt_att *att, struct bt_att_pdu_stats *stats)
+{
+	if (!att || !stats)
+		return false;
+
+	*stats = att->pdu_stats;
+
+	return true;
+}
+
+static void op_footprint(void *data, void *user_data)
+{
+	struct att_send_op *op = data;
+	size_t *size = user_data;
+
+	/* The PDU is only owned by the op when it isn't passed as iovec */
+	*size += sizeof(*op) + (op->iov ? 0 : op->len);
+}
+
+size_t bt_att_get_footprint(struct bt_att *att)
+{
+	size_t size;
+	unsigned int i;
+
+	if (!att)
+		return 0;
+
+	size = sizeof(*att) + att->mtu;
+
+	size += queue_get_footprint(att->req_queue);
+	size += queue_get_footprint(att->ind_queue);
+	size += queue_get_footprint(att->write_queue);
+	size += queue_get_footprint(att->ready_list);
+	size += queue_get_footprint(att->notify_list);
+	size += queue_get_footprint(att->disconn_list);
+
+	for (i = 0; i < ATT_HANDLE_BUCKETS; i++)
+		size += queue_get_footprint(att->handle_notify[i]);
+
+	size += queue_length(att->notify_list) * sizeof(struct att_notify);
+	size += queue_length(att->disconn_list) * sizeof(struct att_disconn);
+
+	queue_foreach(att->req_queue, op_footprint, &size);
+	queue_foreach(att->ind_queue, op_footprint, &size);
+	queue_foreach(att->write_queue, op_footprint, &size);
+
+	if (att->pending_req)
+		op_footprint(att->pending_req, &size);
+
+	if (att->pending_ind)
+		op_footprint(att->pending_ind, &size);
+
+	return size;
+}
+
+void bt_att_reset_read_stats(struct bt_att *att)
+{
+	if (!att)
+		return;
+
+	memset(&att->read_stats, 0, sizeof(att->read_stats));
+}
+
 uint8_t bt_att_get_link_type(struct bt_att *att)
 {
 	struct sockaddr_l2 src;
@@ -1223,22 +1670,11 @@ bool bt_att_unregister_disconnect(struct bt_att *att, unsigned int id)
 	return true;
 }
 
-unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
-				const void *pdu, uint16_t length,
-				bt_att_response_func_t callback, void *user_data,
-				bt_att_destroy_func_t destroy)
+static unsigned int queue_att_send_op(struct bt_att *att,
+						struct att_send_op *op)
 {
-	struct att_send_op *op;
 	bool result;
 
-	if (!att || !att->io)
-		return 0;
-
-	op = create_att_send_op(att, opcode, pdu, length, callback, user_data,
-								destroy);
-	if (!op)
-		return 0;
-
 	if (att->next_send_id < 1)
 		att->next_send_id = 1;
 
@@ -1263,16 +1699,56 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 	}
 
 	if (!result) {
+		free(op->iov);
 		free(op->pdu);
 		free(op);
 		return 0;
 	}
 
+	if (op->type == ATT_OP_TYPE_CMD)
+		att->cmd_queued++;
+
 	wakeup_writer(att);
 
 	return op->id;
 }
 
+unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
+				const void *pdu, uint16_t length,
+				bt_att_response_func_t callback, void *user_data,
+				bt_att_destroy_func_t destroy)
+{
+	struct att_send_op *op;
+
+	if (!att || !att->io)
+		return 0;
+
+	op = create_att_send_op(att, opcode, pdu, length, callback, user_data,
+								destroy);
+	if (!op)
+		return 0;
+
+	return queue_att_send_op(att, op);
+}
+
+unsigned int bt_att_sendv(struct bt_att *att, uint8_t opcode,
+				const struct iovec *iov, int iovcnt,
+				bt_att_response_func_t callback, void *user_data,
+				bt_att_destroy_func_t destroy)
+{
+	struct att_send_op *op;
+
+	if (!att || !att->io)
+		return 0;
+
+	op = create_att_send_opv(att, opcode, iov, iovcnt, callback,
+							user_data, destroy);
+	if (!op)
+		return 0;
+
+	return queue_att_send_op(att, op);
+}
+
 static bool match_op_id(const void *a, const void *b)
 {
 	const struct att_send_op *op = a;
@@ -1309,8 +1785,16 @@ bool bt_att_cancel(struct bt_att *att, unsigned int id)
 		goto done;
 
 	op = queue_remove_if(att->write_queue, match_op_id, UINT_TO_PTR(id));
-	if (op)
+	if (op) {
+		if (op->type == ATT_OP_TYPE_CMD) {
+			destroy_att_send_op(op);
+			cmd_done(att);
+			wakeup_writer(att);
+			return true;
+		}
+
 		goto done;
+	}
 
 	if (!op)
 		return false;
@@ -1331,6 +1815,7 @@ bool bt_att_cancel_all(struct bt_att *att)
 	queue_remove_all(att->req_queue, NULL, NULL, destroy_att_send_op);
 	queue_remove_all(att->ind_queue, NULL, NULL, destroy_att_send_op);
 	queue_remove_all(att->write_queue, NULL, NULL, destroy_att_send_op);
+	att->cmd_queued = 0;
 
 	if (att->pending_req)
 		/* Don't cancel the pending request; remove it's handlers */
@@ -1421,15 +1906,58 @@ unsigned int bt_att_register(struct bt_att *att, uint8_t opcode,
 	return notify->id;
 }
 
+unsigned int bt_att_register_handle(struct bt_att *att, uint8_t opcode,
+						uint16_t handle,
+						bt_att_notify_func_t callback,
+						void *user_data,
+						bt_att_destroy_func_t destroy)
+{
+	struct queue **bucket;
+	struct att_notify *notify;
+
+	if (!att || !callback || !att->io || !is_handle_opcode(opcode))
+		return 0;
+
+	bucket = &att->handle_notify[handle % ATT_HANDLE_BUCKETS];
+	if (!*bucket)
+		*bucket = queue_new();
+
+	notify = new0(struct att_notify, 1);
+	notify->opcode = opcode;
+	notify->handle = handle;
+	notify->callback = callback;
+	notify->destroy = destroy;
+	notify->user_data = user_data;
+
+	if (att->next_reg_id < 1)
+		att->next_reg_id = 1;
+
+	notify->id = att->next_reg_id++;
+
+	if (!queue_push_tail(*bucket, notify)) {
+		free(notify);
+		return 0;
+	}
+
+	return notify->id;
+}
+
 bool bt_att_unregister(struct bt_att *att, unsigned int id)
 {
 	struct att_notify *notify;
+	unsigned int i;
 
 	if (!att || !id)
 		return false;
 
 	notify = queue_remove_if(att->notify_list, match_notify_id,
 							UINT_TO_PTR(id));
+
+	/* Unregistering is rare enough to just look through every bucket */
+	for (i = 0; !notify && i < ATT_HANDLE_BUCKETS; i++)
+		notify = queue_remove_if(att->handle_notify[i],
+					match_notify_id, UINT_TO_PTR(id));
+
 	if (!notify)
 		return false;
 
@@ -1439,11 +1967,18 @@ bool bt_att_unregister(struct bt_att *att, unsigned int id)
 
 bool bt_att_unregister_all(struct bt_att *att)
 {
+	unsigned int i;
+
 	if (!att)
 		return false;
 
 	queue_remove_all(att->notify_list, NULL, NULL, destroy_att_notify);
 	queue_remove_all(att->disconn_list, NULL, NULL, destroy_att_disconn);
+	queue_remove_all(att->ready_list, NULL, NULL, destroy_att_ready);
+
+	for (i = 0; i < ATT_HANDLE_BUCKETS; i++)
+		queue_remove_all(att->handle_notify[i], NULL, NULL,
+							destroy_att_notify);
 
 	return true;
 }
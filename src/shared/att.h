@@ -23,6 +23,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/uio.h>
 
 #include "src/shared/att-types.h"
 
@@ -47,6 +48,7 @@ typedef void (*bt_att_timeout_func_t)(unsigned int id, uint8_t opcode,
 							void *user_data);
 typedef void (*bt_att_disconnect_func_t)(int err, void *user_data);
 typedef bool (*bt_att_counter_func_t)(uint32_t *sign_cnt, void *user_data);
+typedef void (*bt_att_ready_func_t)(void *user_data);
 
 bool bt_att_set_debug(struct bt_att *att, bt_att_debug_func_t callback,
 				void *user_data, bt_att_destroy_func_t destroy);
@@ -55,6 +57,43 @@ uint16_t bt_att_get_mtu(struct bt_att *att);
 bool bt_att_set_mtu(struct bt_att *att, uint16_t mtu);
 uint8_t bt_att_get_link_type(struct bt_att *att);
 
+struct bt_att_read_stats {
+	uint64_t wakeups;		/* Read handler invocations */
+	uint64_t pdus;			/* PDUs handled in total */
+	unsigned int max_batch;		/* Most PDUs handled in one wakeup */
+};
+
+bool bt_att_set_read_batch(struct bt_att *att, unsigned int count);
+bool bt_att_get_read_stats(struct bt_att *att,
+					struct bt_att_read_stats *stats);
+void bt_att_reset_read_stats(struct bt_att *att);
+
+/* PDUs sent and received over the lifetime of the bearer */
+struct bt_att_pdu_stats {
+	uint64_t rx_pdus;
+	uint64_t rx_bytes;
+	uint64_t tx_pdus;
+	uint64_t tx_bytes;
+};
+
+bool bt_att_get_pdu_stats(struct bt_att *att, struct bt_att_pdu_stats *stats);
+
+/* Approximate number of bytes allocated for the bearer and its queues */
+size_t bt_att_get_footprint(struct bt_att *att);
+
+/*
+ * Bound the number of commands (e.g. Write Without Response) waiting in
+ * the write queue. Producers check the credits left before sending more
+ * and get a ready callback once a credit frees up again.
+ */
+bool bt_att_set_cmd_window(struct bt_att *att, unsigned int window);
+unsigned int bt_att_get_cmd_credits(struct bt_att *att);
+unsigned int bt_att_register_ready(struct bt_att *att,
+						bt_att_ready_func_t callback,
+						void *user_data,
+						bt_att_destroy_func_t destroy);
+bool bt_att_unregister_ready(struct bt_att *att, unsigned int id);
+
 bool bt_att_set_timeout_cb(struct bt_att *att, bt_att_timeout_func_t callback,
 						void *user_data,
 						bt_att_destroy_func_t destroy);
@@ -64,6 +103,15 @@ unsigned int bt_att_send(struct bt_att *att, uint8_t opcode,
 					bt_att_response_func_t callback,
 					void *user_data,
 					bt_att_destroy_func_t destroy);
+/*
+ * Like bt_att_send but the PDU parameters are gathered straight from the
+ * caller's buffers, which must stay valid until destroy is called.
+ */
+unsigned int bt_att_sendv(struct bt_att *att, uint8_t opcode,
+					const struct iovec *iov, int iovcnt,
+					bt_att_response_func_t callback,
+					void *user_data,
+					bt_att_destroy_func_t destroy);
 bool bt_att_cancel(struct bt_att *att, unsigned int id);
 bool bt_att_cancel_all(struct bt_att *att);
 
@@ -74,6 +122,11 @@ unsigned int bt_att_register(struct bt_att *att, uint8_t opcode,
 						bt_att_notify_func_t callback,
 						void *user_data,
 						bt_att_destroy_func_t destroy);
+unsigned int bt_att_register_handle(struct bt_att *att, uint8_t opcode,
+						uint16_t handle,
+						bt_att_notify_func_t callback,
+						void *user_data,
+						bt_att_destroy_func_t destroy);
 bool bt_att_unregister(struct bt_att *att, unsigned int id);
 
 unsigned int bt_att_register_disconnect(struct bt_att *att,
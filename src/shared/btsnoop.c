@@ -28,16 +28,22 @@
 #include <endian.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
 #include <arpa/inet.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 
 #include "src/shared/btsnoop.h"
 
 struct btsnoop_hdr {
 	uint8_t		id[8];		/* Identification Pattern */
-	uint32_t	version;	/* Version Number = 1 */
+	uint32_t	version;	/* Version Number = 2 */
 	uint32_t	type;		/* Datalink Type */
 } __attribute__ ((packed));
 #define BTSNOOP_HDR_SIZE (sizeof(struct btsnoop_hdr))
@@ -64,6 +70,42 @@ struct pklg_pkt {
 } __attribute__ ((packed));
 #define PKLG_PKT_SIZE (sizeof(struct pklg_pkt))
 
+/*
+ * The random access index only stores every BTSNOOP_INDEX_STEP record, the
+ * records in between are found by walking the record headers. Each entry
+ * also summarizes its chunk of records, so readers can skip chunks that
+ * can't contain any record of a given controller index or handle.
+ */
+#define BTSNOOP_INDEX_STEP	256
+
+struct btsnoop_index_hdr {
+	uint8_t		id[8];		/* Identification Pattern */
+	uint32_t	version;	/* Version Number = 2 */
+	uint32_t	step;		/* Records per entry */
+	uint64_t	size;		/* Size of the trace file */
+	uint64_t	mtime;		/* Modification time of the trace */
+	uint64_t	count;		/* Number of records */
+	uint64_t	entries;	/* Number of entries */
+} __attribute__ ((packed));
+#define BTSNOOP_INDEX_HDR_SIZE (sizeof(struct btsnoop_index_hdr))
+
+struct btsnoop_index_entry {
+	uint64_t	offset;		/* File offset of the record */
+	uint64_t	ts;		/* Timestamp microseconds */
+	uint64_t	ts_last;	/* Timestamp of last record in chunk */
+	uint32_t	index_mask;	/* Controller indexes in chunk */
+	uint64_t	handle_mask;	/* Connection handles in chunk */
+} __attribute__ ((packed));
+
+/* Indexes above 30 and records without index share the last bit */
+#define INDEX_MASK_BIT(index)	(1u << ((index) < 31 ? (index) : 31))
+#define HANDLE_MASK_BIT(handle)	(1ull << ((handle) % 64))
+
+static const uint8_t btsnoop_index_id[] = { 0x62, 0x74, 0x73, 0x6e,
+					    0x69, 0x64, 0x78, 0x00 };
+
+static const uint32_t btsnoop_index_version = 2;
+
 struct btsnoop {
 	int ref_count;
 	int fd;
@@ -73,8 +115,109 @@ struct btsnoop {
 	bool aborted;
 	bool pklg_format;
 	bool pklg_v2;
+	uint8_t *map;
+	size_t map_size;
+	size_t offset;
+	uint64_t mtime;
+	struct btsnoop_index_entry *entries;
+	uint64_t entry_count;
+	uint64_t record_count;
+	uint64_t next_entry;
+	bool chunk_filter;
+	uint32_t chunk_index_mask;
+	uint64_t chunk_handle_mask;
+	bool write_index;
+	char *path;
+	size_t file_size;
+	uint64_t file_time;
+	size_t max_size;
+	unsigned int max_age;
+	unsigned int max_files;
+	struct btsnoop_buf *buf;
 };
 
+/*
+ * Records can be collected in a buffer and written out in one go, either
+ * from the calling thread or from a writer thread. With the writer thread
+ * the buffer is swapped with the spare one, so new records can be added
+ * while the previous ones are written. Optionally, records are dropped
+ * instead of blocking when the writer thread can't keep up. The number of
+ * dropped records is then carried in the cumulative drops of the next
+ * record that is written.
+ */
+struct btsnoop_buf {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_cond_t done;
+	pthread_t thread;
+	bool running;
+	bool stop;
+	bool writing;
+	bool failed;
+	bool drop;
+	uint32_t dropped;
+	uint8_t *data;
+	uint8_t *spare;
+	size_t len;
+	size_t size;
+	unsigned int interval;
+	uint64_t time;
+};
+
+#define BTSNOOP_ROTATE_SUFFIX_MAX	16
+
+static uint64_t time_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void map_file(struct btsnoop *btsnoop)
+{
+	struct stat st;
+	void *map;
+
+	if (fstat(btsnoop->fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return;
+
+	if (st.st_size <= 0 || (uint64_t) st.st_size > SIZE_MAX)
+		return;
+
+	/* Anything that can't be mapped is simply read sequentially */
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, btsnoop->fd, 0);
+	if (map == MAP_FAILED)
+		return;
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	btsnoop->map = map;
+	btsnoop->map_size = st.st_size;
+	btsnoop->mtime = st.st_mtime;
+}
+
+static ssize_t btsnoop_read(struct btsnoop *btsnoop, void *buf, size_t len)
+{
+	if (!btsnoop->map)
+		return read(btsnoop->fd, buf, len);
+
+	if (len > btsnoop->map_size - btsnoop->offset)
+		len = btsnoop->map_size - btsnoop->offset;
+
+	memcpy(buf, btsnoop->map + btsnoop->offset, len);
+	btsnoop->offset += len;
+
+	return len;
+}
+
+static size_t data_offset(struct btsnoop *btsnoop)
+{
+	/* Apple Packet Logger format has no header */
+	return btsnoop->pklg_format ? 0 : BTSNOOP_HDR_SIZE;
+}
+
 struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 {
 	struct btsnoop *btsnoop;
@@ -122,6 +265,9 @@ struct btsnoop *btsnoop_open(const char *path, unsigned long flags)
 		lseek(btsnoop->fd, 0, SEEK_SET);
 	}
 
+	map_file(btsnoop);
+	btsnoop->offset = data_offset(btsnoop);
+
 	return btsnoop_ref(btsnoop);
 
 failed:
@@ -131,38 +277,317 @@ failed:
 	return NULL;
 }
 
-struct btsnoop *btsnoop_create(const char *path, uint32_t format)
+static int create_file(const char *path, uint32_t format)
 {
-	struct btsnoop *btsnoop;
 	struct btsnoop_hdr hdr;
 	ssize_t written;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+					S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0)
+		return -1;
+
+	memcpy(hdr.id, btsnoop_id, sizeof(btsnoop_id));
+	hdr.version = htobe32(btsnoop_version);
+	hdr.type = htobe32(format);
+
+	written = write(fd, &hdr, BTSNOOP_HDR_SIZE);
+	if (written < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+struct btsnoop *btsnoop_create(const char *path, uint32_t format)
+{
+	struct btsnoop *btsnoop;
 
 	btsnoop = calloc(1, sizeof(*btsnoop));
 	if (!btsnoop)
 		return NULL;
 
-	btsnoop->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
-					S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	btsnoop->path = strdup(path);
+	if (!btsnoop->path) {
+		free(btsnoop);
+		return NULL;
+	}
+
+	btsnoop->fd = create_file(path, format);
 	if (btsnoop->fd < 0) {
+		free(btsnoop->path);
 		free(btsnoop);
 		return NULL;
 	}
 
 	btsnoop->format = format;
 	btsnoop->index = 0xffff;
+	btsnoop->file_size = BTSNOOP_HDR_SIZE;
+	btsnoop->file_time = time_now();
 
-	memcpy(hdr.id, btsnoop_id, sizeof(btsnoop_id));
-	hdr.version = htobe32(btsnoop_version);
-	hdr.type = htobe32(btsnoop->format);
+	return btsnoop_ref(btsnoop);
+}
 
-	written = write(btsnoop->fd, &hdr, BTSNOOP_HDR_SIZE);
-	if (written < 0) {
-		close(btsnoop->fd);
-		free(btsnoop);
-		return NULL;
+static void index_file(const char *path);
+static void chunk_skip(struct btsnoop *btsnoop);
+
+static void rename_index(const char *old_path, const char *new_path)
+{
+	char *old_index, *new_index;
+
+	if (asprintf(&old_index, "%s.idx", old_path) < 0)
+		return;
+
+	if (asprintf(&new_index, "%s.idx", new_path) >= 0) {
+		rename(old_index, new_index);
+		free(new_index);
 	}
 
-	return btsnoop_ref(btsnoop);
+	free(old_index);
+}
+
+static bool rotate_file(struct btsnoop *btsnoop)
+{
+	char *old_path, *new_path;
+	unsigned int i;
+	int fd;
+
+	/* Shift path.N to path.N+1 and the current file to path.1 */
+	for (i = btsnoop->max_files; i > 0; i--) {
+		if (i > 1) {
+			if (asprintf(&old_path, "%s.%u", btsnoop->path,
+								i - 1) < 0)
+				return false;
+		} else {
+			old_path = strdup(btsnoop->path);
+			if (!old_path)
+				return false;
+		}
+
+		if (asprintf(&new_path, "%s.%u", btsnoop->path, i) < 0) {
+			free(old_path);
+			return false;
+		}
+
+		rename(old_path, new_path);
+
+		if (btsnoop->write_index && i > 1)
+			rename_index(old_path, new_path);
+
+		free(new_path);
+		free(old_path);
+	}
+
+	fd = create_file(btsnoop->path, btsnoop->format);
+	if (fd < 0)
+		return false;
+
+	close(btsnoop->fd);
+	btsnoop->fd = fd;
+
+	if (btsnoop->write_index && btsnoop->max_files) {
+		if (asprintf(&old_path, "%s.1", btsnoop->path) >= 0) {
+			index_file(old_path);
+			free(old_path);
+		}
+	}
+
+	btsnoop->file_size = BTSNOOP_HDR_SIZE;
+	btsnoop->file_time = time_now();
+
+	return true;
+}
+
+static bool file_write(struct btsnoop *btsnoop, const struct iovec *iov,
+								int iovcnt)
+{
+	struct iovec vec[2], *cur = vec;
+	size_t len = 0;
+	ssize_t written;
+	int i;
+
+	if (iovcnt > 2)
+		return false;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	if (btsnoop->file_size > BTSNOOP_HDR_SIZE) {
+		bool rotate = false;
+
+		if (btsnoop->max_size &&
+				btsnoop->file_size + len > btsnoop->max_size)
+			rotate = true;
+
+		if (btsnoop->max_age && time_now() - btsnoop->file_time >=
+					btsnoop->max_age * 1000ull)
+			rotate = true;
+
+		if (rotate && !rotate_file(btsnoop))
+			return false;
+	}
+
+	memcpy(vec, iov, iovcnt * sizeof(*iov));
+
+	while (iovcnt > 0) {
+		written = writev(btsnoop->fd, cur, iovcnt);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return false;
+		}
+
+		btsnoop->file_size += written;
+
+		/* Skip over whatever a short write already took care of */
+		while (iovcnt > 0 && (size_t) written >= cur->iov_len) {
+			written -= cur->iov_len;
+			cur++;
+			iovcnt--;
+		}
+
+		if (iovcnt > 0) {
+			cur->iov_base = (uint8_t *) cur->iov_base + written;
+			cur->iov_len -= written;
+		}
+	}
+
+	return true;
+}
+
+static bool buf_write(struct btsnoop *btsnoop, uint8_t *data, size_t len)
+{
+	struct iovec iov;
+
+	if (!len)
+		return true;
+
+	iov.iov_base = data;
+	iov.iov_len = len;
+
+	return file_write(btsnoop, &iov, 1);
+}
+
+static bool buf_expired(struct btsnoop_buf *buf)
+{
+	return buf->interval && time_now() - buf->time >= buf->interval;
+}
+
+static void buf_wait(struct btsnoop_buf *buf)
+{
+	uint64_t expires = buf->time + buf->interval;
+	struct timespec ts;
+
+	if (!buf->len || !buf->interval) {
+		pthread_cond_wait(&buf->cond, &buf->lock);
+		return;
+	}
+
+	ts.tv_sec = expires / 1000;
+	ts.tv_nsec = (expires % 1000) * 1000000;
+
+	pthread_cond_timedwait(&buf->cond, &buf->lock, &ts);
+}
+
+static void *buf_thread(void *user_data)
+{
+	struct btsnoop *btsnoop = user_data;
+	struct btsnoop_buf *buf = btsnoop->buf;
+
+	pthread_mutex_lock(&buf->lock);
+
+	while (buf->len || !buf->stop) {
+		uint8_t *data;
+		size_t len;
+		bool result;
+
+		if (!buf->len || (!buf->stop && buf->len < buf->size / 2 &&
+							!buf_expired(buf))) {
+			buf_wait(buf);
+			continue;
+		}
+
+		/* Swap buffers and write the full one without the lock */
+		data = buf->data;
+		len = buf->len;
+
+		buf->data = buf->spare;
+		buf->spare = data;
+		buf->len = 0;
+		buf->writing = true;
+
+		pthread_cond_broadcast(&buf->done);
+		pthread_mutex_unlock(&buf->lock);
+
+		result = buf_write(btsnoop, data, len);
+
+		pthread_mutex_lock(&buf->lock);
+
+		if (!result)
+			buf->failed = true;
+
+		buf->writing = false;
+		pthread_cond_broadcast(&buf->done);
+	}
+
+	pthread_mutex_unlock(&buf->lock);
+
+	return NULL;
+}
+
+static bool buf_flush(struct btsnoop *btsnoop)
+{
+	struct btsnoop_buf *buf = btsnoop->buf;
+	bool result;
+
+	if (!buf)
+		return true;
+
+	pthread_mutex_lock(&buf->lock);
+
+	/* The writer thread owns the file descriptor while writing */
+	while (buf->writing)
+		pthread_cond_wait(&buf->done, &buf->lock);
+
+	result = buf_write(btsnoop, buf->data, buf->len) && !buf->failed;
+	buf->len = 0;
+	buf->failed = false;
+
+	pthread_mutex_unlock(&buf->lock);
+
+	return result;
+}
+
+static void buf_free(struct btsnoop *btsnoop)
+{
+	struct btsnoop_buf *buf = btsnoop->buf;
+
+	if (!buf)
+		return;
+
+	if (buf->running) {
+		pthread_mutex_lock(&buf->lock);
+		buf->stop = true;
+		pthread_cond_signal(&buf->cond);
+		pthread_mutex_unlock(&buf->lock);
+
+		pthread_join(buf->thread, NULL);
+	}
+
+	buf_flush(btsnoop);
+
+	pthread_cond_destroy(&buf->done);
+	pthread_cond_destroy(&buf->cond);
+	pthread_mutex_destroy(&buf->lock);
+
+	free(buf->spare);
+	free(buf->data);
+	free(buf);
+
+	btsnoop->buf = NULL;
 }
 
 struct btsnoop *btsnoop_ref(struct btsnoop *btsnoop)
@@ -183,18 +608,205 @@ void btsnoop_unref(struct btsnoop *btsnoop)
 	if (__sync_sub_and_fetch(&btsnoop->ref_count, 1))
 		return;
 
-	if (btsnoop->fd >= 0)
-		close(btsnoop->fd);
+	buf_free(btsnoop);
+
+	if (btsnoop->map)
+		munmap(btsnoop->map, btsnoop->map_size);
+
+	if (btsnoop->fd >= 0)
+		close(btsnoop->fd);
+
+	/* Files being written are indexed once they are complete */
+	if (btsnoop->write_index)
+		index_file(btsnoop->path);
+
+	free(btsnoop->entries);
+	free(btsnoop->path);
+	free(btsnoop);
+}
+
+uint32_t btsnoop_get_format(struct btsnoop *btsnoop)
+{
+	if (!btsnoop)
+		return BTSNOOP_FORMAT_INVALID;
+
+	return btsnoop->format;
+}
+
+bool btsnoop_set_buffer(struct btsnoop *btsnoop, size_t size,
+							unsigned int interval)
+{
+	struct btsnoop_buf *buf;
+	pthread_condattr_t attr;
+
+	if (!btsnoop || !btsnoop->path || btsnoop->buf)
+		return false;
+
+	if (size < BTSNOOP_PKT_SIZE + BTSNOOP_MAX_PACKET_SIZE)
+		size = BTSNOOP_PKT_SIZE + BTSNOOP_MAX_PACKET_SIZE;
+
+	buf = calloc(1, sizeof(*buf));
+	if (!buf)
+		return false;
+
+	buf->data = malloc(size);
+	buf->spare = malloc(size);
+	if (!buf->data || !buf->spare) {
+		free(buf->spare);
+		free(buf->data);
+		free(buf);
+		return false;
+	}
+
+	buf->size = size;
+	buf->interval = interval;
+
+	pthread_mutex_init(&buf->lock, NULL);
+
+	/* Flush intervals are measured with the monotonic clock */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&buf->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	pthread_cond_init(&buf->done, NULL);
+
+	btsnoop->buf = buf;
+
+	return true;
+}
+
+bool btsnoop_start_writer(struct btsnoop *btsnoop)
+{
+	struct btsnoop_buf *buf;
+
+	if (!btsnoop || !btsnoop->path)
+		return false;
+
+	if (!btsnoop->buf && !btsnoop_set_buffer(btsnoop, 0, 0))
+		return false;
+
+	buf = btsnoop->buf;
+
+	if (buf->running)
+		return true;
+
+	if (pthread_create(&buf->thread, NULL, buf_thread, btsnoop))
+		return false;
+
+	buf->running = true;
+
+	return true;
+}
+
+bool btsnoop_set_rotate(struct btsnoop *btsnoop, size_t max_size,
+				unsigned int max_age, unsigned int max_files)
+{
+	if (!btsnoop || !btsnoop->path)
+		return false;
+
+	/* The writer thread might be rotating the file at any time */
+	if (btsnoop->buf && btsnoop->buf->running)
+		return false;
+
+	if (max_files > BTSNOOP_ROTATE_SUFFIX_MAX)
+		return false;
+
+	btsnoop->max_size = max_size;
+	btsnoop->max_age = max_age;
+	btsnoop->max_files = max_files;
+
+	return true;
+}
+
+bool btsnoop_set_drop(struct btsnoop *btsnoop, bool drop)
+{
+	if (!btsnoop || !btsnoop->buf)
+		return false;
+
+	btsnoop->buf->drop = drop;
+
+	return true;
+}
+
+uint32_t btsnoop_get_drops(struct btsnoop *btsnoop)
+{
+	if (!btsnoop || !btsnoop->buf)
+		return 0;
+
+	return btsnoop->buf->dropped;
+}
+
+bool btsnoop_flush(struct btsnoop *btsnoop)
+{
+	if (!btsnoop)
+		return false;
+
+	return buf_flush(btsnoop);
+}
+
+static bool buf_add(struct btsnoop *btsnoop, const struct iovec *iov)
+{
+	struct btsnoop_buf *buf = btsnoop->buf;
+	size_t len = iov[0].iov_len + iov[1].iov_len;
+	bool result = true;
+
+	pthread_mutex_lock(&buf->lock);
+
+	if (len > buf->size) {
+		/* Records that don't fit are written directly */
+		while (buf->writing)
+			pthread_cond_wait(&buf->done, &buf->lock);
+
+		result = buf_write(btsnoop, buf->data, buf->len) &&
+					file_write(btsnoop, iov, 2);
+		buf->len = 0;
+		goto done;
+	}
+
+	if (buf->running && buf->drop && buf->len + len > buf->size) {
+		pthread_cond_signal(&buf->cond);
+		buf->dropped++;
+		result = false;
+		goto done;
+	}
+
+	if (buf->running) {
+		/* Only block when the writer thread can't keep up */
+		while (buf->len + len > buf->size) {
+			pthread_cond_signal(&buf->cond);
+			pthread_cond_wait(&buf->done, &buf->lock);
+		}
+	} else if (buf->len + len > buf->size) {
+		result = buf_write(btsnoop, buf->data, buf->len);
+		buf->len = 0;
+	}
+
+	if (!buf->len)
+		buf->time = time_now();
+
+	memcpy(buf->data + buf->len, iov[0].iov_base, iov[0].iov_len);
+	memcpy(buf->data + buf->len + iov[0].iov_len, iov[1].iov_base,
+							iov[1].iov_len);
+	buf->len += len;
+
+	if (buf->running) {
+		if (buf->len >= buf->size / 2 || buf->len == len)
+			pthread_cond_signal(&buf->cond);
+	} else if (buf_expired(buf)) {
+		result = buf_write(btsnoop, buf->data, buf->len) && result;
+		buf->len = 0;
+	}
 
-	free(btsnoop);
-}
+done:
+	if (buf->failed) {
+		buf->failed = false;
+		result = false;
+	}
 
-uint32_t btsnoop_get_format(struct btsnoop *btsnoop)
-{
-	if (!btsnoop)
-		return BTSNOOP_FORMAT_INVALID;
+	pthread_mutex_unlock(&buf->lock);
 
-	return btsnoop->format;
+	return result;
 }
 
 bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
@@ -202,8 +814,8 @@ bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 			uint16_t size)
 {
 	struct btsnoop_pkt pkt;
+	struct iovec iov[2];
 	uint64_t ts;
-	ssize_t written;
 
 	if (!btsnoop || !tv)
 		return false;
@@ -213,20 +825,22 @@ bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv,
 	pkt.size  = htobe32(size);
 	pkt.len   = htobe32(size);
 	pkt.flags = htobe32(flags);
+	/* Only the thread adding records changes the dropped count */
+	if (btsnoop->buf)
+		drops += btsnoop->buf->dropped;
+
 	pkt.drops = htobe32(drops);
 	pkt.ts    = htobe64(ts + 0x00E03AB44A676000ll);
 
-	written = write(btsnoop->fd, &pkt, BTSNOOP_PKT_SIZE);
-	if (written < 0)
-		return false;
+	iov[0].iov_base = &pkt;
+	iov[0].iov_len = BTSNOOP_PKT_SIZE;
+	iov[1].iov_base = (void *) data;
+	iov[1].iov_len = data ? size : 0;
 
-	if (data && size > 0) {
-		written = write(btsnoop->fd, data, size);
-		if (written < 0)
-			return false;
-	}
+	if (btsnoop->buf)
+		return buf_add(btsnoop, iov);
 
-	return true;
+	return file_write(btsnoop, iov, 2);
 }
 
 static uint32_t get_flags_from_opcode(uint16_t opcode)
@@ -307,16 +921,49 @@ bool btsnoop_write_phy(struct btsnoop *btsnoop, struct timeval *tv,
 	return btsnoop_write(btsnoop, tv, flags, 0, data, size);
 }
 
+static uint32_t pklg_get_len(struct btsnoop *btsnoop,
+						const struct pklg_pkt *pkt)
+{
+	if (btsnoop->pklg_v2)
+		return le32toh(pkt->len);
+
+	return be32toh(pkt->len);
+}
+
+static void pklg_get_ts(struct btsnoop *btsnoop, const struct pklg_pkt *pkt,
+							struct timeval *tv)
+{
+	uint64_t ts;
+
+	if (btsnoop->pklg_v2) {
+		ts = le64toh(pkt->ts);
+		tv->tv_sec = ts & 0xffffffff;
+		tv->tv_usec = ts >> 32;
+	} else {
+		ts = be64toh(pkt->ts);
+		tv->tv_sec = ts >> 32;
+		tv->tv_usec = ts & 0xffffffff;
+	}
+}
+
+static void btsnoop_get_ts(const struct btsnoop_pkt *pkt, struct timeval *tv)
+{
+	uint64_t ts;
+
+	ts = be64toh(pkt->ts) - 0x00E03AB44A676000ll;
+	tv->tv_sec = (ts / 1000000ll) + 946684800ll;
+	tv->tv_usec = ts % 1000000ll;
+}
+
 static bool pklg_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 					uint16_t *index, uint16_t *opcode,
 					void *data, uint16_t *size)
 {
 	struct pklg_pkt pkt;
 	uint32_t toread;
-	uint64_t ts;
 	ssize_t len;
 
-	len = read(btsnoop->fd, &pkt, PKLG_PKT_SIZE);
+	len = btsnoop_read(btsnoop, &pkt, PKLG_PKT_SIZE);
 	if (len == 0)
 		return false;
 
@@ -325,19 +972,16 @@ static bool pklg_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		return false;
 	}
 
-	if (btsnoop->pklg_v2) {
-		toread = le32toh(pkt.len) - (PKLG_PKT_SIZE - 4);
+	toread = pklg_get_len(btsnoop, &pkt);
+	if (toread < PKLG_PKT_SIZE - 4 ||
+			toread - (PKLG_PKT_SIZE - 4) > BTSNOOP_MAX_PACKET_SIZE) {
+		btsnoop->aborted = true;
+		return false;
+	}
 
-		ts = le64toh(pkt.ts);
-		tv->tv_sec = ts & 0xffffffff;
-		tv->tv_usec = ts >> 32;
-	} else {
-		toread = be32toh(pkt.len) - (PKLG_PKT_SIZE - 4);
+	toread -= PKLG_PKT_SIZE - 4;
 
-		ts = be64toh(pkt.ts);
-		tv->tv_sec = ts >> 32;
-		tv->tv_usec = ts & 0xffffffff;
-	}
+	pklg_get_ts(btsnoop, &pkt, tv);
 
 	switch (pkt.type) {
 	case 0x00:
@@ -370,7 +1014,7 @@ static bool pklg_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		break;
 	}
 
-	len = read(btsnoop->fd, data, toread);
+	len = btsnoop_read(btsnoop, data, toread);
 	if (len < 0) {
 		btsnoop->aborted = true;
 		return false;
@@ -422,17 +1066,19 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 {
 	struct btsnoop_pkt pkt;
 	uint32_t toread, flags;
-	uint64_t ts;
 	uint8_t pkt_type;
 	ssize_t len;
 
 	if (!btsnoop || btsnoop->aborted)
 		return false;
 
+	if (btsnoop->chunk_filter)
+		chunk_skip(btsnoop);
+
 	if (btsnoop->pklg_format)
 		return pklg_read_hci(btsnoop, tv, index, opcode, data, size);
 
-	len = read(btsnoop->fd, &pkt, BTSNOOP_PKT_SIZE);
+	len = btsnoop_read(btsnoop, &pkt, BTSNOOP_PKT_SIZE);
 	if (len == 0)
 		return false;
 
@@ -449,9 +1095,7 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 
 	flags = be32toh(pkt.flags);
 
-	ts = be64toh(pkt.ts) - 0x00E03AB44A676000ll;
-	tv->tv_sec = (ts / 1000000ll) + 946684800ll;
-	tv->tv_usec = ts % 1000000ll;
+	btsnoop_get_ts(&pkt, tv);
 
 	switch (btsnoop->format) {
 	case BTSNOOP_FORMAT_HCI:
@@ -460,7 +1104,7 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		break;
 
 	case BTSNOOP_FORMAT_UART:
-		len = read(btsnoop->fd, &pkt_type, 1);
+		len = btsnoop_read(btsnoop, &pkt_type, 1);
 		if (len < 0) {
 			btsnoop->aborted = true;
 			return false;
@@ -481,7 +1125,7 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 		return false;
 	}
 
-	len = read(btsnoop->fd, data, toread);
+	len = btsnoop_read(btsnoop, data, toread);
 	if (len < 0) {
 		btsnoop->aborted = true;
 		return false;
@@ -497,3 +1141,461 @@ bool btsnoop_read_phy(struct btsnoop *btsnoop, struct timeval *tv,
 {
 	return false;
 }
+
+static uint64_t tv_to_usec(const struct timeval *tv)
+{
+	return (uint64_t) tv->tv_sec * 1000000ll + tv->tv_usec;
+}
+
+static bool record_info(struct btsnoop *btsnoop, size_t offset, size_t *len,
+								uint64_t *ts)
+{
+	size_t avail = btsnoop->map_size - offset;
+	struct timeval tv;
+
+	if (btsnoop->pklg_format) {
+		struct pklg_pkt pkt;
+		uint32_t pkt_len;
+
+		if (avail < PKLG_PKT_SIZE)
+			return false;
+
+		memcpy(&pkt, btsnoop->map + offset, PKLG_PKT_SIZE);
+
+		pkt_len = pklg_get_len(btsnoop, &pkt);
+		if (pkt_len < PKLG_PKT_SIZE - 4)
+			return false;
+
+		pklg_get_ts(btsnoop, &pkt, &tv);
+		*len = (size_t) pkt_len + 4;
+	} else {
+		struct btsnoop_pkt pkt;
+
+		if (avail < BTSNOOP_PKT_SIZE)
+			return false;
+
+		memcpy(&pkt, btsnoop->map + offset, BTSNOOP_PKT_SIZE);
+
+		btsnoop_get_ts(&pkt, &tv);
+		*len = BTSNOOP_PKT_SIZE + be32toh(pkt.size);
+	}
+
+	if (*len > avail)
+		return false;
+
+	*ts = tv_to_usec(&tv);
+
+	return true;
+}
+
+static void record_summary(struct btsnoop *btsnoop, size_t offset,
+					struct btsnoop_index_entry *entry)
+{
+	struct btsnoop_pkt pkt;
+	const uint8_t *data;
+	uint16_t opcode, handle;
+	uint32_t flags, size;
+
+	/* Only monitor traces carry controller indexes */
+	if (btsnoop->pklg_format || btsnoop->format != BTSNOOP_FORMAT_MONITOR) {
+		entry->index_mask = UINT32_MAX;
+		entry->handle_mask = UINT64_MAX;
+		return;
+	}
+
+	memcpy(&pkt, btsnoop->map + offset, BTSNOOP_PKT_SIZE);
+
+	flags = be32toh(pkt.flags);
+	size = be32toh(pkt.size);
+	data = btsnoop->map + offset + BTSNOOP_PKT_SIZE;
+
+	entry->index_mask |= INDEX_MASK_BIT(flags >> 16);
+
+	opcode = flags & 0xffff;
+
+	switch (opcode) {
+	case BTSNOOP_OPCODE_NEW_INDEX:
+	case BTSNOOP_OPCODE_DEL_INDEX:
+	case BTSNOOP_OPCODE_OPEN_INDEX:
+	case BTSNOOP_OPCODE_CLOSE_INDEX:
+	case BTSNOOP_OPCODE_INDEX_INFO:
+		/* Controller details are needed whatever the handle */
+		entry->handle_mask = UINT64_MAX;
+		return;
+	case BTSNOOP_OPCODE_ACL_TX_PKT:
+	case BTSNOOP_OPCODE_ACL_RX_PKT:
+	case BTSNOOP_OPCODE_SCO_TX_PKT:
+	case BTSNOOP_OPCODE_SCO_RX_PKT:
+		if (size < 2)
+			return;
+
+		handle = data[0] | data[1] << 8;
+		break;
+	case BTSNOOP_OPCODE_EVENT_PKT:
+		/* Connection and disconnection events */
+		if (size >= 5 && (data[0] == 0x03 || data[0] == 0x05))
+			handle = data[3] | data[4] << 8;
+		else if (size >= 6 && data[0] == 0x3e &&
+					(data[2] == 0x01 || data[2] == 0x0a))
+			handle = data[4] | data[5] << 8;
+		else
+			return;
+		break;
+	default:
+		return;
+	}
+
+	entry->handle_mask |= HANDLE_MASK_BIT(handle & 0x0fff);
+}
+
+static bool index_build(struct btsnoop *btsnoop)
+{
+	size_t offset = data_offset(btsnoop);
+	uint64_t count = 0, entries = 0, size = 0;
+
+	btsnoop->entries = NULL;
+
+	while (offset < btsnoop->map_size) {
+		size_t len;
+		uint64_t ts;
+
+		/* A truncated trace is indexed up to the last full record */
+		if (!record_info(btsnoop, offset, &len, &ts))
+			break;
+
+		if (!(count % BTSNOOP_INDEX_STEP)) {
+			if (entries == size) {
+				struct btsnoop_index_entry *list;
+
+				size = size ? size * 2 : 64;
+				list = realloc(btsnoop->entries,
+						size * sizeof(*list));
+				if (!list) {
+					free(btsnoop->entries);
+					btsnoop->entries = NULL;
+					return false;
+				}
+
+				btsnoop->entries = list;
+			}
+
+			memset(&btsnoop->entries[entries], 0,
+						sizeof(*btsnoop->entries));
+			btsnoop->entries[entries].offset = offset;
+			btsnoop->entries[entries].ts = ts;
+			entries++;
+		}
+
+		btsnoop->entries[entries - 1].ts_last = ts;
+		record_summary(btsnoop, offset, &btsnoop->entries[entries - 1]);
+
+		offset += len;
+		count++;
+	}
+
+	btsnoop->entry_count = entries;
+	btsnoop->record_count = count;
+
+	return true;
+}
+
+static bool index_load(struct btsnoop *btsnoop, const char *path)
+{
+	struct btsnoop_index_hdr hdr;
+	struct btsnoop_index_entry *entries;
+	uint64_t i, count;
+	ssize_t len;
+	size_t size;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	len = read(fd, &hdr, BTSNOOP_INDEX_HDR_SIZE);
+	if (len != BTSNOOP_INDEX_HDR_SIZE)
+		goto failed;
+
+	/* Ignore any index that doesn't belong to this exact trace file */
+	if (memcmp(hdr.id, btsnoop_index_id, sizeof(btsnoop_index_id)) ||
+			le32toh(hdr.version) != btsnoop_index_version ||
+			le32toh(hdr.step) != BTSNOOP_INDEX_STEP ||
+			le64toh(hdr.size) != btsnoop->map_size ||
+			le64toh(hdr.mtime) != btsnoop->mtime)
+		goto failed;
+
+	count = le64toh(hdr.entries);
+	if (count > btsnoop->map_size / BTSNOOP_PKT_SIZE + 1 ||
+			le64toh(hdr.count) > count * BTSNOOP_INDEX_STEP)
+		goto failed;
+
+	size = count * sizeof(*entries);
+
+	entries = malloc(size ? size : 1);
+	if (!entries)
+		goto failed;
+
+	len = read(fd, entries, size);
+	if (len < 0 || (size_t) len != size) {
+		free(entries);
+		goto failed;
+	}
+
+	for (i = 0; i < count; i++) {
+		entries[i].offset = le64toh(entries[i].offset);
+		entries[i].ts = le64toh(entries[i].ts);
+		entries[i].ts_last = le64toh(entries[i].ts_last);
+		entries[i].index_mask = le32toh(entries[i].index_mask);
+		entries[i].handle_mask = le64toh(entries[i].handle_mask);
+
+		if (entries[i].offset >= btsnoop->map_size) {
+			free(entries);
+			goto failed;
+		}
+	}
+
+	close(fd);
+
+	btsnoop->entries = entries;
+	btsnoop->entry_count = count;
+	btsnoop->record_count = le64toh(hdr.count);
+
+	return true;
+
+failed:
+	close(fd);
+	return false;
+}
+
+static void index_save(struct btsnoop *btsnoop, const char *path)
+{
+	struct btsnoop_index_hdr hdr;
+	struct btsnoop_index_entry entry;
+	uint64_t i;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+					S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0)
+		return;
+
+	memcpy(hdr.id, btsnoop_index_id, sizeof(btsnoop_index_id));
+	hdr.version = htole32(btsnoop_index_version);
+	hdr.step = htole32(BTSNOOP_INDEX_STEP);
+	hdr.size = htole64(btsnoop->map_size);
+	hdr.mtime = htole64(btsnoop->mtime);
+	hdr.count = htole64(btsnoop->record_count);
+	hdr.entries = htole64(btsnoop->entry_count);
+
+	if (write(fd, &hdr, BTSNOOP_INDEX_HDR_SIZE) != BTSNOOP_INDEX_HDR_SIZE)
+		goto failed;
+
+	for (i = 0; i < btsnoop->entry_count; i++) {
+		entry.offset = htole64(btsnoop->entries[i].offset);
+		entry.ts = htole64(btsnoop->entries[i].ts);
+		entry.ts_last = htole64(btsnoop->entries[i].ts_last);
+		entry.index_mask = htole32(btsnoop->entries[i].index_mask);
+		entry.handle_mask = htole64(btsnoop->entries[i].handle_mask);
+
+		if (write(fd, &entry, sizeof(entry)) != sizeof(entry))
+			goto failed;
+	}
+
+	close(fd);
+	return;
+
+failed:
+	/* A partial index would only be rejected when loading it */
+	close(fd);
+	unlink(path);
+}
+
+bool btsnoop_index(struct btsnoop *btsnoop, const char *path)
+{
+	if (!btsnoop || !btsnoop->map)
+		return false;
+
+	if (btsnoop->entries)
+		return true;
+
+	if (path && index_load(btsnoop, path))
+		return true;
+
+	if (!index_build(btsnoop))
+		return false;
+
+	if (path)
+		index_save(btsnoop, path);
+
+	return true;
+}
+
+static void index_file(const char *path)
+{
+	struct btsnoop *btsnoop;
+	char *index_path;
+
+	if (asprintf(&index_path, "%s.idx", path) < 0)
+		return;
+
+	btsnoop = btsnoop_open(path, 0);
+	if (btsnoop) {
+		btsnoop_index(btsnoop, index_path);
+		btsnoop_unref(btsnoop);
+	}
+
+	free(index_path);
+}
+
+static void chunk_sync(struct btsnoop *btsnoop)
+{
+	uint64_t low = 0, high = btsnoop->entry_count;
+
+	/* Find the first chunk that starts at or after the read offset */
+	while (low < high) {
+		uint64_t mid = low + (high - low) / 2;
+
+		if (btsnoop->entries[mid].offset < btsnoop->offset)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	btsnoop->next_entry = low;
+}
+
+static void chunk_skip(struct btsnoop *btsnoop)
+{
+	while (btsnoop->next_entry < btsnoop->entry_count) {
+		const struct btsnoop_index_entry *entry;
+
+		entry = &btsnoop->entries[btsnoop->next_entry];
+		if (btsnoop->offset < entry->offset)
+			return;
+
+		btsnoop->next_entry++;
+
+		/* Chunks that are already partially read are finished */
+		if (btsnoop->offset > entry->offset)
+			continue;
+
+		if ((entry->index_mask & btsnoop->chunk_index_mask) &&
+				(entry->handle_mask & btsnoop->chunk_handle_mask))
+			return;
+
+		if (btsnoop->next_entry < btsnoop->entry_count)
+			btsnoop->offset =
+				btsnoop->entries[btsnoop->next_entry].offset;
+		else
+			btsnoop->offset = btsnoop->map_size;
+	}
+}
+
+bool btsnoop_set_chunk_filter(struct btsnoop *btsnoop, uint16_t index,
+							uint16_t handle)
+{
+	if (!btsnoop || !btsnoop->entries)
+		return false;
+
+	btsnoop->chunk_filter = index != 0xffff || handle != 0xffff;
+
+	if (index != 0xffff)
+		btsnoop->chunk_index_mask = INDEX_MASK_BIT(index) |
+						INDEX_MASK_BIT(0xffff);
+	else
+		btsnoop->chunk_index_mask = UINT32_MAX;
+
+	if (handle != 0xffff)
+		btsnoop->chunk_handle_mask = HANDLE_MASK_BIT(handle & 0x0fff);
+	else
+		btsnoop->chunk_handle_mask = UINT64_MAX;
+
+	chunk_sync(btsnoop);
+
+	return true;
+}
+
+bool btsnoop_set_write_index(struct btsnoop *btsnoop, bool enable)
+{
+	if (!btsnoop || !btsnoop->path)
+		return false;
+
+	btsnoop->write_index = enable;
+
+	return true;
+}
+
+uint64_t btsnoop_get_count(struct btsnoop *btsnoop)
+{
+	if (!btsnoop || !btsnoop->entries)
+		return 0;
+
+	return btsnoop->record_count;
+}
+
+static bool seek_entry(struct btsnoop *btsnoop, uint64_t entry,
+						uint64_t record, uint64_t usec)
+{
+	size_t offset = btsnoop->entries[entry].offset;
+	uint64_t n = entry * BTSNOOP_INDEX_STEP;
+
+	/* Walk from the entry to the first record matching both limits */
+	while (n < btsnoop->record_count) {
+		size_t len;
+		uint64_t ts;
+
+		if (!record_info(btsnoop, offset, &len, &ts))
+			break;
+
+		if (n >= record && ts >= usec) {
+			btsnoop->offset = offset;
+			btsnoop->aborted = false;
+			chunk_sync(btsnoop);
+			return true;
+		}
+
+		offset += len;
+		n++;
+	}
+
+	return false;
+}
+
+bool btsnoop_seek(struct btsnoop *btsnoop, uint64_t record)
+{
+	if (!btsnoop || !btsnoop->entries)
+		return false;
+
+	if (record >= btsnoop->record_count)
+		return false;
+
+	return seek_entry(btsnoop, record / BTSNOOP_INDEX_STEP, record, 0);
+}
+
+bool btsnoop_seek_time(struct btsnoop *btsnoop, const struct timeval *tv)
+{
+	uint64_t usec, low, high;
+
+	if (!btsnoop || !btsnoop->entries || !tv)
+		return false;
+
+	if (!btsnoop->entry_count)
+		return false;
+
+	usec = tv_to_usec(tv);
+
+	/* Find the last entry with a timestamp before the requested time */
+	low = 0;
+	high = btsnoop->entry_count;
+
+	while (low < high) {
+		uint64_t mid = low + (high - low) / 2;
+
+		if (btsnoop->entries[mid].ts < usec)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return seek_entry(btsnoop, low ? low - 1 : 0, 0, usec);
+}
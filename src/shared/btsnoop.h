@@ -23,6 +23,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <sys/time.h>
 
 #define BTSNOOP_FORMAT_INVALID		0
@@ -106,6 +107,15 @@ void btsnoop_unref(struct btsnoop *btsnoop);
 
 uint32_t btsnoop_get_format(struct btsnoop *btsnoop);
 
+bool btsnoop_set_buffer(struct btsnoop *btsnoop, size_t size,
+							unsigned int interval);
+bool btsnoop_start_writer(struct btsnoop *btsnoop);
+bool btsnoop_set_rotate(struct btsnoop *btsnoop, size_t max_size,
+				unsigned int max_age, unsigned int max_files);
+bool btsnoop_set_drop(struct btsnoop *btsnoop, bool drop);
+uint32_t btsnoop_get_drops(struct btsnoop *btsnoop);
+bool btsnoop_flush(struct btsnoop *btsnoop);
+
 bool btsnoop_write(struct btsnoop *btsnoop, struct timeval *tv, uint32_t flags,
 			uint32_t drops, const void *data, uint16_t size);
 bool btsnoop_write_hci(struct btsnoop *btsnoop, struct timeval *tv,
@@ -119,3 +129,11 @@ bool btsnoop_read_hci(struct btsnoop *btsnoop, struct timeval *tv,
 					void *data, uint16_t *size);
 bool btsnoop_read_phy(struct btsnoop *btsnoop, struct timeval *tv,
 			uint16_t *frequency, void *data, uint16_t *size);
+
+bool btsnoop_index(struct btsnoop *btsnoop, const char *path);
+uint64_t btsnoop_get_count(struct btsnoop *btsnoop);
+bool btsnoop_seek(struct btsnoop *btsnoop, uint64_t record);
+bool btsnoop_seek_time(struct btsnoop *btsnoop, const struct timeval *tv);
+bool btsnoop_set_chunk_filter(struct btsnoop *btsnoop, uint16_t index,
+							uint16_t handle);
+bool btsnoop_set_write_index(struct btsnoop *btsnoop, bool enable);
@@ -28,6 +28,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdbool.h>
 #include <sys/socket.h>
 
 #include "src/shared/util.h"
@@ -75,11 +76,231 @@ struct af_alg_iv {
 /* Maximum message length that can be passed to aes_cmac */
 #define CMAC_MSG_MAX	80
 
+/*
+ * When the CPU provides AES instructions, the block cipher and CMAC are
+ * computed in userspace instead of going through AF_ALG, which costs
+ * several system calls per operation. The instructions run in constant
+ * time, so there is no table based software fallback and the kernel is
+ * used whenever they are missing.
+ */
+#if defined(HAVE_AES_ACCEL) && (defined(__x86_64__) || defined(__i386__))
+#define AES_ACCEL_X86
+#include <cpuid.h>
+#include <wmmintrin.h>
+#elif defined(HAVE_AES_ACCEL) && defined(__aarch64__) && \
+					defined(__ARM_FEATURE_CRYPTO)
+#define AES_ACCEL_ARM
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#include <arm_neon.h>
+#endif
+
+struct aes_key {
+	uint8_t rk[11][16];
+};
+
+#if defined(AES_ACCEL_X86)
+static bool aes_accel_available(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+
+	return (ecx & bit_AES) && (edx & bit_SSE2);
+}
+
+__attribute__((target("aes,sse2")))
+static inline __m128i aes_expand(__m128i key, __m128i assist)
+{
+	assist = _mm_shuffle_epi32(assist, 0xff);
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+
+	return _mm_xor_si128(key, assist);
+}
+
+/* The round constant has to be an immediate operand */
+#define AES_EXPAND(round, rcon) \
+	do { \
+		k = aes_expand(k, _mm_aeskeygenassist_si128(k, rcon)); \
+		_mm_storeu_si128((__m128i *) ctx->rk[round], k); \
+	} while (0)
+
+__attribute__((target("aes,sse2")))
+static void aes_set_key(struct aes_key *ctx, const uint8_t key[16])
+{
+	__m128i k = _mm_loadu_si128((const __m128i *) key);
+
+	_mm_storeu_si128((__m128i *) ctx->rk[0], k);
+
+	AES_EXPAND(1, 0x01);
+	AES_EXPAND(2, 0x02);
+	AES_EXPAND(3, 0x04);
+	AES_EXPAND(4, 0x08);
+	AES_EXPAND(5, 0x10);
+	AES_EXPAND(6, 0x20);
+	AES_EXPAND(7, 0x40);
+	AES_EXPAND(8, 0x80);
+	AES_EXPAND(9, 0x1b);
+	AES_EXPAND(10, 0x36);
+}
+
+__attribute__((target("aes,sse2")))
+static void aes_encrypt(const struct aes_key *ctx, const uint8_t in[16],
+							uint8_t out[16])
+{
+	__m128i s = _mm_loadu_si128((const __m128i *) in);
+	int i;
+
+	s = _mm_xor_si128(s, _mm_loadu_si128((const __m128i *) ctx->rk[0]));
+
+	for (i = 1; i < 10; i++)
+		s = _mm_aesenc_si128(s,
+				_mm_loadu_si128((const __m128i *) ctx->rk[i]));
+
+	s = _mm_aesenclast_si128(s,
+				_mm_loadu_si128((const __m128i *) ctx->rk[10]));
+
+	_mm_storeu_si128((__m128i *) out, s);
+}
+#elif defined(AES_ACCEL_ARM)
+static bool aes_accel_available(void)
+{
+	return getauxval(AT_HWCAP) & HWCAP_AES;
+}
+
+static uint32_t aes_sub_word(uint32_t w)
+{
+	uint8x16_t v = vreinterpretq_u8_u32(vdupq_n_u32(w));
+
+	/*
+	 * With an all zero round key AESE is just ShiftRows and SubBytes,
+	 * and with the word repeated in every column ShiftRows is a no-op.
+	 */
+	v = vaeseq_u8(v, vdupq_n_u8(0));
+
+	return vgetq_lane_u32(vreinterpretq_u32_u8(v), 0);
+}
+
+static void aes_set_key(struct aes_key *ctx, const uint8_t key[16])
+{
+	static const uint8_t rcon[10] = { 0x01, 0x02, 0x04, 0x08, 0x10,
+					0x20, 0x40, 0x80, 0x1b, 0x36 };
+	uint32_t w[44];
+	int i;
+
+	memcpy(w, key, 16);
+
+	for (i = 4; i < 44; i++) {
+		uint32_t tmp = w[i - 1];
+
+		if (!(i % 4))
+			tmp = aes_sub_word((tmp >> 8) | (tmp << 24)) ^
+								rcon[i / 4 - 1];
+
+		w[i] = w[i - 4] ^ tmp;
+	}
+
+	memcpy(ctx->rk, w, sizeof(ctx->rk));
+}
+
+static void aes_encrypt(const struct aes_key *ctx, const uint8_t in[16],
+							uint8_t out[16])
+{
+	uint8x16_t s = vld1q_u8(in);
+	int i;
+
+	for (i = 0; i < 9; i++)
+		s = vaesmcq_u8(vaeseq_u8(s, vld1q_u8(ctx->rk[i])));
+
+	s = vaeseq_u8(s, vld1q_u8(ctx->rk[9]));
+	s = veorq_u8(s, vld1q_u8(ctx->rk[10]));
+
+	vst1q_u8(out, s);
+}
+#else
+static bool aes_accel_available(void)
+{
+	return false;
+}
+
+static void aes_set_key(struct aes_key *ctx, const uint8_t key[16])
+{
+}
+
+static void aes_encrypt(const struct aes_key *ctx, const uint8_t in[16],
+							uint8_t out[16])
+{
+}
+#endif
+
+static void cmac_subkey(const uint8_t in[16], uint8_t out[16])
+{
+	uint8_t carry = 0;
+	int i;
+
+	for (i = 15; i >= 0; i--) {
+		uint8_t msb = in[i] >> 7;
+
+		out[i] = (in[i] << 1) | carry;
+		carry = msb;
+	}
+
+	/* Constant-time conditional xor with Rb */
+	out[15] ^= 0x87 & -carry;
+}
+
+/* AES-CMAC as defined by RFC 4493, key and message are in MSB order */
+static void aes_cmac_accel(const uint8_t key[16], const uint8_t *msg,
+					size_t msg_len, uint8_t out[16])
+{
+	struct aes_key ctx;
+	uint8_t l[16], k[16], x[16], last[16];
+	size_t blocks, i, j;
+
+	aes_set_key(&ctx, key);
+
+	memset(l, 0, sizeof(l));
+	aes_encrypt(&ctx, l, l);
+	cmac_subkey(l, k);
+
+	blocks = (msg_len + 15) / 16;
+	if (!blocks)
+		blocks = 1;
+
+	/* Incomplete last blocks are padded and use the second subkey */
+	memset(last, 0, sizeof(last));
+	j = msg_len - (blocks - 1) * 16;
+	memcpy(last, msg + (blocks - 1) * 16, j);
+
+	if (j < 16) {
+		last[j] = 0x80;
+		cmac_subkey(k, k);
+	}
+
+	memset(x, 0, sizeof(x));
+
+	for (i = 0; i < blocks - 1; i++) {
+		for (j = 0; j < 16; j++)
+			x[j] ^= msg[i * 16 + j];
+
+		aes_encrypt(&ctx, x, x);
+	}
+
+	for (j = 0; j < 16; j++)
+		x[j] ^= last[j] ^ k[j];
+
+	aes_encrypt(&ctx, x, out);
+}
+
 struct bt_crypto {
 	int ref_count;
 	int ecb_aes;
 	int urandom;
 	int cmac_aes;
+	bool aes_accel;
 };
 
 static int urandom_setup(void)
@@ -143,15 +364,23 @@ struct bt_crypto *bt_crypto_new(void)
 
 	crypto = new0(struct bt_crypto, 1);
 
-	crypto->ecb_aes = ecb_aes_setup();
-	if (crypto->ecb_aes < 0) {
+	crypto->urandom = urandom_setup();
+	if (crypto->urandom < 0) {
 		free(crypto);
 		return NULL;
 	}
 
-	crypto->urandom = urandom_setup();
-	if (crypto->urandom < 0) {
-		close(crypto->ecb_aes);
+	/* The kernel is only needed without AES instructions */
+	crypto->aes_accel = aes_accel_available();
+	if (crypto->aes_accel) {
+		crypto->ecb_aes = -1;
+		crypto->cmac_aes = -1;
+		return bt_crypto_ref(crypto);
+	}
+
+	crypto->ecb_aes = ecb_aes_setup();
+	if (crypto->ecb_aes < 0) {
+		close(crypto->urandom);
 		free(crypto);
 		return NULL;
 	}
@@ -186,8 +415,11 @@ void bt_crypto_unref(struct bt_crypto *crypto)
 		return;
 
 	close(crypto->urandom);
-	close(crypto->ecb_aes);
-	close(crypto->cmac_aes);
+
+	if (!crypto->aes_accel) {
+		close(crypto->ecb_aes);
+		close(crypto->cmac_aes);
+	}
 
 	free(crypto);
 }
@@ -263,12 +495,70 @@ static inline void swap_buf(const uint8_t *src, uint8_t *dst, uint16_t len)
 		dst[len - 1 - i] = src[i];
 }
 
+/* Key, plaintext and result are in MSB order */
+static bool ecb_aes(struct bt_crypto *crypto, const uint8_t key[16],
+				const uint8_t in[16], uint8_t out[16])
+{
+	struct aes_key ctx;
+	int fd;
+
+	if (crypto->aes_accel) {
+		aes_set_key(&ctx, key);
+		aes_encrypt(&ctx, in, out);
+		return true;
+	}
+
+	fd = alg_new(crypto->ecb_aes, key, 16);
+	if (fd < 0)
+		return false;
+
+	if (!alg_encrypt(fd, in, 16, out, 16)) {
+		close(fd);
+		return false;
+	}
+
+	close(fd);
+
+	return true;
+}
+
+/* Key, message and result are in MSB order */
+static bool cmac_aes(struct bt_crypto *crypto, const uint8_t key[16],
+			const uint8_t *msg, size_t msg_len, uint8_t out[16])
+{
+	ssize_t len;
+	int fd;
+
+	if (crypto->aes_accel) {
+		aes_cmac_accel(key, msg, msg_len, out);
+		return true;
+	}
+
+	fd = alg_new(crypto->cmac_aes, key, 16);
+	if (fd < 0)
+		return false;
+
+	len = send(fd, msg, msg_len, 0);
+	if (len < 0) {
+		close(fd);
+		return false;
+	}
+
+	len = read(fd, out, 16);
+	if (len < 0) {
+		close(fd);
+		return false;
+	}
+
+	close(fd);
+
+	return true;
+}
+
 bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 				const uint8_t *m, uint16_t m_len,
 				uint32_t sign_cnt, uint8_t signature[12])
 {
-	int fd;
-	int len;
 	uint8_t tmp[16], out[16];
 	uint16_t msg_len = m_len + sizeof(uint32_t);
 	uint8_t msg[msg_len];
@@ -286,26 +576,11 @@ bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 	/* The most significant octet of key corresponds to key[0] */
 	swap_buf(key, tmp, 16);
 
-	fd = alg_new(crypto->cmac_aes, tmp, 16);
-	if (fd < 0)
-		return false;
-
 	/* Swap msg before signing */
 	swap_buf(msg, msg_s, msg_len);
 
-	len = send(fd, msg_s, msg_len, 0);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
-
-	len = read(fd, out, 16);
-	if (len < 0) {
-		close(fd);
+	if (!cmac_aes(crypto, tmp, msg_s, msg_len, out))
 		return false;
-	}
-
-	close(fd);
 
 	/*
 	 * As to BT spec. 4.1 Vol[3], Part C, chapter 10.4.1 sign counter should
@@ -340,7 +615,6 @@ bool bt_crypto_e(struct bt_crypto *crypto, const uint8_t key[16],
 			const uint8_t plaintext[16], uint8_t encrypted[16])
 {
 	uint8_t tmp[16], in[16], out[16];
-	int fd;
 
 	if (!crypto)
 		return false;
@@ -348,24 +622,15 @@ bool bt_crypto_e(struct bt_crypto *crypto, const uint8_t key[16],
 	/* The most significant octet of key corresponds to key[0] */
 	swap_buf(key, tmp, 16);
 
-	fd = alg_new(crypto->ecb_aes, tmp, 16);
-	if (fd < 0)
-		return false;
-
-
 	/* Most significant octet of plaintextData corresponds to in[0] */
 	swap_buf(plaintext, in, 16);
 
-	if (!alg_encrypt(fd, in, 16, out, 16)) {
-		close(fd);
+	if (!ecb_aes(crypto, tmp, in, out))
 		return false;
-	}
 
 	/* Most significant octet of encryptedData corresponds to out[0] */
 	swap_buf(out, encrypted, 16);
 
-	close(fd);
-
 	return true;
 }
 
@@ -424,6 +689,288 @@ bool bt_crypto_ah(struct bt_crypto *crypto, const uint8_t k[16],
 	return true;
 }
 
+/*
+ * Resolving table of identity resolving keys
+ *
+ * Resolving a random address means running ah against every known IRK.
+ * The table keeps the expanded AES key schedules of all IRKs next to each
+ * other and, on x86, runs four of them through the AES pipeline at once.
+ * Scanners see the same addresses many times before they rotate, so the
+ * results of recent lookups are cached as well.
+ */
+#define IRK_CACHE_SIZE 64
+
+struct irk_cache_entry {
+	uint8_t addr[6];
+	int index;
+	unsigned int generation;
+};
+
+struct bt_crypto_irk_table {
+	struct bt_crypto *crypto;
+	struct aes_key *schedules;
+	uint8_t (*keys)[16];
+	bool *used;
+	unsigned int size;
+	unsigned int count;
+	unsigned int generation;
+	struct irk_cache_entry cache[IRK_CACHE_SIZE];
+};
+
+#if defined(AES_ACCEL_X86)
+/* Encrypt the same block with four consecutive key schedules */
+__attribute__((target("aes,sse2")))
+static void aes_encrypt4(const struct aes_key *ctx, const uint8_t in[16],
+							uint8_t out[4][16])
+{
+	__m128i b = _mm_loadu_si128((const __m128i *) in);
+	__m128i s0, s1, s2, s3;
+	int i;
+
+#define RK(n, r) _mm_loadu_si128((const __m128i *) ctx[n].rk[r])
+	s0 = _mm_xor_si128(b, RK(0, 0));
+	s1 = _mm_xor_si128(b, RK(1, 0));
+	s2 = _mm_xor_si128(b, RK(2, 0));
+	s3 = _mm_xor_si128(b, RK(3, 0));
+
+	for (i = 1; i < 10; i++) {
+		s0 = _mm_aesenc_si128(s0, RK(0, i));
+		s1 = _mm_aesenc_si128(s1, RK(1, i));
+		s2 = _mm_aesenc_si128(s2, RK(2, i));
+		s3 = _mm_aesenc_si128(s3, RK(3, i));
+	}
+
+	s0 = _mm_aesenclast_si128(s0, RK(0, 10));
+	s1 = _mm_aesenclast_si128(s1, RK(1, 10));
+	s2 = _mm_aesenclast_si128(s2, RK(2, 10));
+	s3 = _mm_aesenclast_si128(s3, RK(3, 10));
+#undef RK
+
+	_mm_storeu_si128((__m128i *) out[0], s0);
+	_mm_storeu_si128((__m128i *) out[1], s1);
+	_mm_storeu_si128((__m128i *) out[2], s2);
+	_mm_storeu_si128((__m128i *) out[3], s3);
+}
+#else
+static void aes_encrypt4(const struct aes_key *ctx, const uint8_t in[16],
+							uint8_t out[4][16])
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		aes_encrypt(&ctx[i], in, out[i]);
+}
+#endif
+
+struct bt_crypto_irk_table *bt_crypto_irk_table_new(struct bt_crypto *crypto)
+{
+	struct bt_crypto_irk_table *table;
+
+	if (!crypto)
+		return NULL;
+
+	table = new0(struct bt_crypto_irk_table, 1);
+	table->crypto = bt_crypto_ref(crypto);
+	table->generation = 1;
+
+	return table;
+}
+
+void bt_crypto_irk_table_free(struct bt_crypto_irk_table *table)
+{
+	if (!table)
+		return;
+
+	bt_crypto_unref(table->crypto);
+
+	free(table->schedules);
+	free(table->keys);
+	free(table->used);
+	free(table);
+}
+
+static bool irk_table_grow(struct bt_crypto_irk_table *table)
+{
+	struct aes_key *schedules;
+	uint8_t (*keys)[16];
+	bool *used;
+	unsigned int size;
+
+	/* Keep the size a multiple of four for aes_encrypt4() */
+	size = table->size ? table->size * 2 : 16;
+
+	schedules = realloc(table->schedules, size * sizeof(*schedules));
+	if (!schedules)
+		return false;
+
+	table->schedules = schedules;
+
+	keys = realloc(table->keys, size * sizeof(*keys));
+	if (!keys)
+		return false;
+
+	table->keys = keys;
+
+	used = realloc(table->used, size * sizeof(*used));
+	if (!used)
+		return false;
+
+	table->used = used;
+
+	memset(schedules + table->size, 0,
+			(size - table->size) * sizeof(*schedules));
+	memset(keys + table->size, 0, (size - table->size) * sizeof(*keys));
+	memset(used + table->size, 0, (size - table->size) * sizeof(*used));
+
+	table->size = size;
+
+	return true;
+}
+
+int bt_crypto_irk_table_add(struct bt_crypto_irk_table *table,
+							const uint8_t irk[16])
+{
+	uint8_t key_msb[16];
+	unsigned int i;
+
+	if (!table)
+		return -1;
+
+	for (i = 0; i < table->count; i++) {
+		if (!table->used[i])
+			break;
+	}
+
+	if (i == table->size && !irk_table_grow(table))
+		return -1;
+
+	memcpy(table->keys[i], irk, 16);
+	table->used[i] = true;
+
+	/* The most significant octet of key corresponds to key[0] */
+	swap_buf(irk, key_msb, 16);
+	aes_set_key(&table->schedules[i], key_msb);
+
+	if (i == table->count)
+		table->count++;
+
+	/* Unresolved addresses might resolve with the new key */
+	table->generation++;
+
+	return i;
+}
+
+bool bt_crypto_irk_table_remove(struct bt_crypto_irk_table *table, int index)
+{
+	if (!table || index < 0 || (unsigned int) index >= table->count)
+		return false;
+
+	if (!table->used[index])
+		return false;
+
+	table->used[index] = false;
+	memset(table->keys[index], 0, 16);
+	memset(&table->schedules[index], 0, sizeof(struct aes_key));
+
+	while (table->count && !table->used[table->count - 1])
+		table->count--;
+
+	table->generation++;
+
+	return true;
+}
+
+static int irk_table_lookup(struct bt_crypto_irk_table *table,
+						const uint8_t addr[6])
+{
+	uint8_t in[16], out[4][16];
+	unsigned int i, j;
+
+	if (!table->crypto->aes_accel) {
+		for (i = 0; i < table->count; i++) {
+			uint8_t hash[3];
+
+			if (!table->used[i])
+				continue;
+
+			if (!bt_crypto_ah(table->crypto, table->keys[i],
+							addr + 3, hash))
+				continue;
+
+			if (!memcmp(addr, hash, 3))
+				return i;
+		}
+
+		return -1;
+	}
+
+	/* r' = padding || r, with the most significant octet first */
+	memset(in, 0, sizeof(in));
+	in[13] = addr[5];
+	in[14] = addr[4];
+	in[15] = addr[3];
+
+	for (i = 0; i < table->count; i += 4) {
+		aes_encrypt4(&table->schedules[i], in, out);
+
+		/* ah(k, r) = e(k, r') mod 2^24 */
+		for (j = 0; j < 4 && i + j < table->count; j++) {
+			if (!table->used[i + j])
+				continue;
+
+			if (out[j][15] == addr[0] && out[j][14] == addr[1] &&
+							out[j][13] == addr[2])
+				return i + j;
+		}
+	}
+
+	return -1;
+}
+
+int bt_crypto_irk_table_resolve(struct bt_crypto_irk_table *table,
+						const uint8_t addr[6])
+{
+	struct irk_cache_entry *entry;
+
+	if (!table)
+		return -1;
+
+	/* Only resolvable private addresses carry a hash */
+	if ((addr[5] & 0xc0) != 0x40)
+		return -1;
+
+	entry = &table->cache[(addr[0] ^ addr[3]) % IRK_CACHE_SIZE];
+
+	if (entry->generation == table->generation &&
+					!memcmp(entry->addr, addr, 6))
+		return entry->index;
+
+	memcpy(entry->addr, addr, 6);
+	entry->index = irk_table_lookup(table, addr);
+	entry->generation = table->generation;
+
+	return entry->index;
+}
+
+unsigned int bt_crypto_irk_table_resolve_batch(
+					struct bt_crypto_irk_table *table,
+					const uint8_t (*addr)[6],
+					unsigned int count, int *index)
+{
+	unsigned int i, resolved = 0;
+
+	if (!table || !addr || !index)
+		return 0;
+
+	for (i = 0; i < count; i++) {
+		index[i] = bt_crypto_irk_table_resolve(table, addr[i]);
+		if (index[i] >= 0)
+			resolved++;
+	}
+
+	return resolved;
+}
+
 typedef struct {
 	uint64_t a, b;
 } u128;
@@ -572,34 +1119,18 @@ static bool aes_cmac(struct bt_crypto *crypto, const uint8_t key[16],
 			const uint8_t *msg, size_t msg_len, uint8_t res[16])
 {
 	uint8_t key_msb[16], out[16], msg_msb[CMAC_MSG_MAX];
-	ssize_t len;
-	int fd;
 
 	if (msg_len > CMAC_MSG_MAX)
 		return false;
 
 	swap_buf(key, key_msb, 16);
-	fd = alg_new(crypto->cmac_aes, key_msb, 16);
-	if (fd < 0)
-		return false;
-
 	swap_buf(msg, msg_msb, msg_len);
-	len = send(fd, msg_msb, msg_len, 0);
-	if (len < 0) {
-		close(fd);
-		return false;
-	}
 
-	len = read(fd, out, 16);
-	if (len < 0) {
-		close(fd);
+	if (!cmac_aes(crypto, key_msb, msg_msb, msg_len, out))
 		return false;
-	}
 
 	swap_buf(out, res, 16);
 
-	close(fd);
-
 	return true;
 }
 
@@ -61,3 +61,19 @@ bool bt_crypto_h6(struct bt_crypto *crypto, const uint8_t w[16],
 bool bt_crypto_sign_att(struct bt_crypto *crypto, const uint8_t key[16],
 				const uint8_t *m, uint16_t m_len,
 				uint32_t sign_cnt, uint8_t signature[12]);
+
+struct bt_crypto_irk_table;
+
+struct bt_crypto_irk_table *bt_crypto_irk_table_new(struct bt_crypto *crypto);
+void bt_crypto_irk_table_free(struct bt_crypto_irk_table *table);
+
+int bt_crypto_irk_table_add(struct bt_crypto_irk_table *table,
+							const uint8_t irk[16]);
+bool bt_crypto_irk_table_remove(struct bt_crypto_irk_table *table, int index);
+
+int bt_crypto_irk_table_resolve(struct bt_crypto_irk_table *table,
+						const uint8_t addr[6]);
+unsigned int bt_crypto_irk_table_resolve_batch(
+					struct bt_crypto_irk_table *table,
+					const uint8_t (*addr)[6],
+					unsigned int count, int *index);
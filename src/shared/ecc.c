@@ -30,6 +30,8 @@
 
 #include <fcntl.h>
 #include <unistd.h>
+#include <stdlib.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <string.h>
 
@@ -101,14 +103,6 @@ static bool get_random_number(uint64_t *vli)
 	return true;
 }
 
-static void vli_clear(uint64_t *vli)
-{
-	int i;
-
-	for (i = 0; i < NUM_ECC_DIGITS; i++)
-		vli[i] = 0;
-}
-
 /* Returns true if vli == 0, false otherwise. */
 static bool vli_is_zero(const uint64_t *vli)
 {
@@ -122,43 +116,6 @@ static bool vli_is_zero(const uint64_t *vli)
 	return true;
 }
 
-/* Returns nonzero if bit bit of vli is set. */
-static uint64_t vli_test_bit(const uint64_t *vli, unsigned int bit)
-{
-	return (vli[bit / 64] & ((uint64_t) 1 << (bit % 64)));
-}
-
-/* Counts the number of 64-bit "digits" in vli. */
-static unsigned int vli_num_digits(const uint64_t *vli)
-{
-	int i;
-
-	/* Search from the end until we find a non-zero digit.
-	 * We do it in reverse because we expect that most digits will
-	 * be nonzero.
-	 */
-	for (i = NUM_ECC_DIGITS - 1; i >= 0 && vli[i] == 0; i--);
-
-	return (i + 1);
-}
-
-/* Counts the number of bits required for vli. */
-static unsigned int vli_num_bits(const uint64_t *vli)
-{
-	unsigned int i, num_digits;
-	uint64_t digit;
-
-	num_digits = vli_num_digits(vli);
-	if (num_digits == 0)
-		return 0;
-
-	digit = vli[num_digits - 1];
-	for (i = 0; digit; i++)
-		digit >>= 1;
-
-	return ((num_digits - 1) * 64 + i);
-}
-
 /* Sets dest = src. */
 static void vli_set(uint64_t *dest, const uint64_t *src)
 {
@@ -183,80 +140,7 @@ static int vli_cmp(const uint64_t *left, const uint64_t *right)
     return 0;
 }
 
-/* Computes result = in << c, returning carry. Can modify in place
- * (if result == in). 0 < shift < 64.
- */
-static uint64_t vli_lshift(uint64_t *result, const uint64_t *in,
-							unsigned int shift)
-{
-	uint64_t carry = 0;
-	int i;
-
-	for (i = 0; i < NUM_ECC_DIGITS; i++) {
-		uint64_t temp = in[i];
-
-		result[i] = (temp << shift) | carry;
-		carry = temp >> (64 - shift);
-	}
-
-	return carry;
-}
-
-/* Computes vli = vli >> 1. */
-static void vli_rshift1(uint64_t *vli)
-{
-	uint64_t *end = vli;
-	uint64_t carry = 0;
-
-	vli += NUM_ECC_DIGITS;
-
-	while (vli-- > end) {
-		uint64_t temp = *vli;
-		*vli = (temp >> 1) | carry;
-		carry = temp << 63;
-	}
-}
-
-/* Computes result = left + right, returning carry. Can modify in place. */
-static uint64_t vli_add(uint64_t *result, const uint64_t *left,
-							const uint64_t *right)
-{
-	uint64_t carry = 0;
-	int i;
-
-	for (i = 0; i < NUM_ECC_DIGITS; i++) {
-		uint64_t sum;
-
-		sum = left[i] + right[i] + carry;
-		if (sum != left[i])
-			carry = (sum < left[i]);
-
-		result[i] = sum;
-	}
-
-	return carry;
-}
-
-/* Computes result = left - right, returning borrow. Can modify in place. */
-static uint64_t vli_sub(uint64_t *result, const uint64_t *left,
-							const uint64_t *right)
-{
-	uint64_t borrow = 0;
-	int i;
-
-	for (i = 0; i < NUM_ECC_DIGITS; i++) {
-		uint64_t diff;
-
-		diff = left[i] - right[i] - borrow;
-		if (diff != left[i])
-			borrow = (diff > left[i]);
-
-		result[i] = diff;
-	}
-
-	return borrow;
-}
-
+#ifndef __SIZEOF_INT128__
 static uint128_t mul_64_64(uint64_t left, uint64_t right)
 {
 	uint64_t a0 = left & 0xffffffffull;
@@ -281,493 +165,425 @@ static uint128_t mul_64_64(uint64_t left, uint64_t right)
 
 	return result;
 }
+#endif
 
-static uint128_t add_128_128(uint128_t a, uint128_t b)
-{
-	uint128_t result;
-
-	result.m_low = a.m_low + b.m_low;
-	result.m_high = a.m_high + b.m_high + (result.m_low < a.m_low);
-
-	return result;
-}
-
-static void vli_mult(uint64_t *result, const uint64_t *left,
-							const uint64_t *right)
-{
-	uint128_t r01 = { 0, 0 };
-	uint64_t r2 = 0;
-	unsigned int i, k;
+/* ------ Field arithmetic ------ */
 
-	/* Compute each digit of result in sequence, maintaining the
-	 * carries.
-	 */
-	for (k = 0; k < NUM_ECC_DIGITS * 2 - 1; k++) {
-		unsigned int min;
+/*
+ * Field elements are kept in Montgomery form, a * 2^256 mod p, with four
+ * 64-bit limbs. All field and point operations run in constant time, so
+ * there are no branches or memory accesses that depend on secret values.
+ * For P-256 the Montgomery constant -1/p mod 2^64 is 1, which makes the
+ * reduction step cheap.
+ */
 
-		if (k < NUM_ECC_DIGITS)
-			min = 0;
-		else
-			min = (k + 1) - NUM_ECC_DIGITS;
+/* 2^512 mod p, used to convert into Montgomery form */
+static const uint64_t curve_rr[NUM_ECC_DIGITS] = {
+	0x0000000000000003ull, 0xFFFFFFFBFFFFFFFFull,
+	0xFFFFFFFFFFFFFFFEull, 0x00000004FFFFFFFDull };
 
-		for (i = min; i <= k && i < NUM_ECC_DIGITS; i++) {
-			uint128_t product;
+/* 2^256 mod p, which is 1 in Montgomery form */
+static const uint64_t curve_one[NUM_ECC_DIGITS] = {
+	0x0000000000000001ull, 0xFFFFFFFF00000000ull,
+	0xFFFFFFFFFFFFFFFFull, 0x00000000FFFFFFFEull };
 
-			product = mul_64_64(left[i], right[k - i]);
+/* p - 2, the exponent for inversion by Fermat's little theorem */
+static const uint64_t curve_p_minus_2[NUM_ECC_DIGITS] = {
+	0xFFFFFFFFFFFFFFFDull, 0x00000000FFFFFFFFull,
+	0x0000000000000000ull, 0xFFFFFFFF00000001ull };
 
-			r01 = add_128_128(r01, product);
-			r2 += (r01.m_high < product.m_high);
-		}
+/* Returns a + b + *carry and updates *carry. */
+static inline uint64_t adc(uint64_t a, uint64_t b, uint64_t *carry)
+{
+	uint64_t sum = a + *carry;
+	uint64_t c = sum < a;
 
-		result[k] = r01.m_low;
-		r01.m_low = r01.m_high;
-		r01.m_high = r2;
-		r2 = 0;
-	}
+	sum += b;
+	*carry = c | (sum < b);
 
-	result[NUM_ECC_DIGITS * 2 - 1] = r01.m_low;
+	return sum;
 }
 
-static void vli_square(uint64_t *result, const uint64_t *left)
+/* Returns a - b - *borrow and updates *borrow. */
+static inline uint64_t sbb(uint64_t a, uint64_t b, uint64_t *borrow)
 {
-	uint128_t r01 = { 0, 0 };
-	uint64_t r2 = 0;
-	int i, k;
+	uint64_t diff = a - b;
+	uint64_t result = diff - *borrow;
 
-	for (k = 0; k < NUM_ECC_DIGITS * 2 - 1; k++) {
-		unsigned int min;
+	*borrow = (a < b) | (diff < *borrow);
 
-		if (k < NUM_ECC_DIGITS)
-			min = 0;
-		else
-			min = (k + 1) - NUM_ECC_DIGITS;
+	return result;
+}
 
-		for (i = min; i <= k && i <= k - i; i++) {
-			uint128_t product;
+/* Returns the low half of a * b + c + *carry, the high half goes to *carry */
+static inline uint64_t mac(uint64_t a, uint64_t b, uint64_t c,
+							uint64_t *carry)
+{
+#ifdef __SIZEOF_INT128__
+	unsigned __int128 t = (unsigned __int128) a * b + c + *carry;
 
-			product = mul_64_64(left[i], left[k - i]);
+	*carry = t >> 64;
 
-			if (i < k - i) {
-				r2 += product.m_high >> 63;
-				product.m_high = (product.m_high << 1) |
-							(product.m_low >> 63);
-				product.m_low <<= 1;
-			}
+	return t;
+#else
+	uint128_t product = mul_64_64(a, b);
+	uint64_t low = product.m_low + c;
+	uint64_t high = product.m_high + (low < c);
 
-			r01 = add_128_128(r01, product);
-			r2 += (r01.m_high < product.m_high);
-		}
+	low += *carry;
+	high += (low < *carry);
 
-		result[k] = r01.m_low;
-		r01.m_low = r01.m_high;
-		r01.m_high = r2;
-		r2 = 0;
-	}
+	*carry = high;
 
-	result[NUM_ECC_DIGITS * 2 - 1] = r01.m_low;
+	return low;
+#endif
 }
 
-/* Computes result = (left + right) % mod.
- * Assumes that left < mod and right < mod, result != mod.
- */
-static void vli_mod_add(uint64_t *result, const uint64_t *left,
-				const uint64_t *right, const uint64_t *mod)
+/* Returns an all ones mask if a == 0 and zero otherwise. */
+static inline uint64_t mask_is_zero(uint64_t a)
 {
-	uint64_t carry;
-
-	carry = vli_add(result, left, right);
-
-	/* result > mod (result = mod + remainder), so subtract mod to
-	 * get remainder.
-	 */
-	if (carry || vli_cmp(result, mod) >= 0)
-		vli_sub(result, result, mod);
+	return ((a | (0 - a)) >> 63) - 1;
 }
 
-/* Computes result = (left - right) % mod.
- * Assumes that left < mod and right < mod, result != mod.
- */
-static void vli_mod_sub(uint64_t *result, const uint64_t *left,
-				const uint64_t *right, const uint64_t *mod)
-{
-	uint64_t borrow = vli_sub(result, left, right);
-
-	/* In this case, p_result == -diff == (max int) - diff.
-	 * Since -x % d == d - x, we can get the correct result from
-	 * result + mod (with overflow).
-	 */
-	if (borrow)
-		vli_add(result, result, mod);
-}
-
-/* Computes result = product % curve_p
-   from http://www.nsa.gov/ia/_files/nist-routines.pdf */
-static void vli_mmod_fast(uint64_t *result, const uint64_t *product)
-{
-	uint64_t tmp[NUM_ECC_DIGITS];
-	int carry;
-
-	/* t */
-	vli_set(result, product);
-
-	/* s1 */
-	tmp[0] = 0;
-	tmp[1] = product[5] & 0xffffffff00000000ull;
-	tmp[2] = product[6];
-	tmp[3] = product[7];
-	carry = vli_lshift(tmp, tmp, 1);
-	carry += vli_add(result, result, tmp);
-
-	/* s2 */
-	tmp[1] = product[6] << 32;
-	tmp[2] = (product[6] >> 32) | (product[7] << 32);
-	tmp[3] = product[7] >> 32;
-	carry += vli_lshift(tmp, tmp, 1);
-	carry += vli_add(result, result, tmp);
-
-	/* s3 */
-	tmp[0] = product[4];
-	tmp[1] = product[5] & 0xffffffff;
-	tmp[2] = 0;
-	tmp[3] = product[7];
-	carry += vli_add(result, result, tmp);
-
-	/* s4 */
-	tmp[0] = (product[4] >> 32) | (product[5] << 32);
-	tmp[1] = (product[5] >> 32) | (product[6] & 0xffffffff00000000ull);
-	tmp[2] = product[7];
-	tmp[3] = (product[6] >> 32) | (product[4] << 32);
-	carry += vli_add(result, result, tmp);
-
-	/* d1 */
-	tmp[0] = (product[5] >> 32) | (product[6] << 32);
-	tmp[1] = (product[6] >> 32);
-	tmp[2] = 0;
-	tmp[3] = (product[4] & 0xffffffff) | (product[5] << 32);
-	carry -= vli_sub(result, result, tmp);
-
-	/* d2 */
-	tmp[0] = product[6];
-	tmp[1] = product[7];
-	tmp[2] = 0;
-	tmp[3] = (product[4] >> 32) | (product[5] & 0xffffffff00000000ull);
-	carry -= vli_sub(result, result, tmp);
-
-	/* d3 */
-	tmp[0] = (product[6] >> 32) | (product[7] << 32);
-	tmp[1] = (product[7] >> 32) | (product[4] << 32);
-	tmp[2] = (product[4] >> 32) | (product[5] << 32);
-	tmp[3] = (product[6] << 32);
-	carry -= vli_sub(result, result, tmp);
-
-	/* d4 */
-	tmp[0] = product[7];
-	tmp[1] = product[4] & 0xffffffff00000000ull;
-	tmp[2] = product[5];
-	tmp[3] = product[6] & 0xffffffff00000000ull;
-	carry -= vli_sub(result, result, tmp);
-
-	if (carry < 0) {
-		do {
-			carry += vli_add(result, result, curve_p);
-		} while (carry < 0);
-	} else {
-		while (carry || vli_cmp(curve_p, result) != 1)
-			carry -= vli_sub(result, result, curve_p);
-	}
-}
-
-/* Computes result = (left * right) % curve_p. */
-static void vli_mod_mult_fast(uint64_t *result, const uint64_t *left,
-							const uint64_t *right)
+/* Sets result = mask ? a : b. */
+static void fe_select(uint64_t *result, const uint64_t *a,
+					const uint64_t *b, uint64_t mask)
 {
-	uint64_t product[2 * NUM_ECC_DIGITS];
+	int i;
 
-	vli_mult(product, left, right);
-	vli_mmod_fast(result, product);
+	for (i = 0; i < NUM_ECC_DIGITS; i++)
+		result[i] = (a[i] & mask) | (b[i] & ~mask);
 }
 
-/* Computes result = left^2 % curve_p. */
-static void vli_mod_square_fast(uint64_t *result, const uint64_t *left)
+static uint64_t fe_is_zero(const uint64_t *a)
 {
-	uint64_t product[2 * NUM_ECC_DIGITS];
-
-	vli_square(product, left);
-	vli_mmod_fast(result, product);
+	return mask_is_zero(a[0] | a[1] | a[2] | a[3]);
 }
 
-#define EVEN(vli) (!(vli[0] & 1))
-/* Computes result = (1 / p_input) % mod. All VLIs are the same size.
- * See "From Euclid's GCD to Montgomery Multiplication to the Great Divide"
- * https://labs.oracle.com/techrep/2001/smli_tr-2001-95.pdf
- */
-static void vli_mod_inv(uint64_t *result, const uint64_t *input,
-							const uint64_t *mod)
+/* Computes result = (left + right) % p. */
+static void fe_add(uint64_t *result, const uint64_t *left,
+						const uint64_t *right)
 {
-	uint64_t a[NUM_ECC_DIGITS], b[NUM_ECC_DIGITS];
-	uint64_t u[NUM_ECC_DIGITS], v[NUM_ECC_DIGITS];
-	uint64_t carry;
-	int cmp_result;
+	uint64_t sum[NUM_ECC_DIGITS], diff[NUM_ECC_DIGITS];
+	uint64_t carry = 0, borrow = 0;
+	int i;
 
-	if (vli_is_zero(input)) {
-		vli_clear(result);
-		return;
-	}
+	for (i = 0; i < NUM_ECC_DIGITS; i++)
+		sum[i] = adc(left[i], right[i], &carry);
 
-	vli_set(a, input);
-	vli_set(b, mod);
-	vli_clear(u);
-	u[0] = 1;
-	vli_clear(v);
+	for (i = 0; i < NUM_ECC_DIGITS; i++)
+		diff[i] = sbb(sum[i], curve_p[i], &borrow);
 
-	while ((cmp_result = vli_cmp(a, b)) != 0) {
-		carry = 0;
+	/* Keep the difference unless subtracting p went negative */
+	fe_select(result, diff, sum, 0 - (carry | (borrow ^ 1)));
+}
 
-		if (EVEN(a)) {
-			vli_rshift1(a);
+/* Computes result = (left - right) % p. */
+static void fe_sub(uint64_t *result, const uint64_t *left,
+						const uint64_t *right)
+{
+	uint64_t diff[NUM_ECC_DIGITS];
+	uint64_t borrow = 0, carry = 0, mask;
+	int i;
 
-			if (!EVEN(u))
-				carry = vli_add(u, u, mod);
+	for (i = 0; i < NUM_ECC_DIGITS; i++)
+		diff[i] = sbb(left[i], right[i], &borrow);
 
-			vli_rshift1(u);
-			if (carry)
-				u[NUM_ECC_DIGITS - 1] |= 0x8000000000000000ull;
-		} else if (EVEN(b)) {
-			vli_rshift1(b);
+	/* Add p back if the result went negative */
+	mask = 0 - borrow;
 
-			if (!EVEN(v))
-				carry = vli_add(v, v, mod);
+	for (i = 0; i < NUM_ECC_DIGITS; i++)
+		result[i] = adc(diff[i], curve_p[i] & mask, &carry);
+}
 
-			vli_rshift1(v);
-			if (carry)
-				v[NUM_ECC_DIGITS - 1] |= 0x8000000000000000ull;
-		} else if (cmp_result > 0) {
-			vli_sub(a, a, b);
-			vli_rshift1(a);
+/* Computes result = left * right / 2^256 % p. */
+static void fe_mul(uint64_t *result, const uint64_t *left,
+						const uint64_t *right)
+{
+	uint64_t t[NUM_ECC_DIGITS + 2], diff[NUM_ECC_DIGITS];
+	uint64_t carry, carry2, borrow, m;
+	int i, j;
 
-			if (vli_cmp(u, v) < 0)
-				vli_add(u, u, mod);
+	for (i = 0; i < NUM_ECC_DIGITS + 2; i++)
+		t[i] = 0;
 
-			vli_sub(u, u, v);
-			if (!EVEN(u))
-				carry = vli_add(u, u, mod);
+	for (i = 0; i < NUM_ECC_DIGITS; i++) {
+		carry = 0;
+		for (j = 0; j < NUM_ECC_DIGITS; j++)
+			t[j] = mac(left[j], right[i], t[j], &carry);
 
-			vli_rshift1(u);
-			if (carry)
-				u[NUM_ECC_DIGITS - 1] |= 0x8000000000000000ull;
-		} else {
-			vli_sub(b, b, a);
-			vli_rshift1(b);
+		carry2 = 0;
+		t[4] = adc(t[4], carry, &carry2);
+		t[5] = carry2;
 
-			if (vli_cmp(v, u) < 0)
-				vli_add(v, v, mod);
+		/* m = t[0] * -1/p mod 2^64, which is just t[0] */
+		m = t[0];
 
-			vli_sub(v, v, u);
-			if (!EVEN(v))
-				carry = vli_add(v, v, mod);
+		carry = 0;
+		mac(m, curve_p[0], t[0], &carry);
+		for (j = 1; j < NUM_ECC_DIGITS; j++)
+			t[j - 1] = mac(m, curve_p[j], t[j], &carry);
 
-			vli_rshift1(v);
-			if (carry)
-				v[NUM_ECC_DIGITS - 1] |= 0x8000000000000000ull;
-		}
+		carry2 = 0;
+		t[3] = adc(t[4], carry, &carry2);
+		t[4] = t[5] + carry2;
 	}
 
-	vli_set(result, u);
-}
+	/* The result is below 2p, so p needs to be subtracted at most once */
+	borrow = 0;
+	for (i = 0; i < NUM_ECC_DIGITS; i++)
+		diff[i] = sbb(t[i], curve_p[i], &borrow);
 
-/* ------ Point operations ------ */
+	fe_select(result, diff, t, 0 - (t[4] | (borrow ^ 1)));
+}
 
-/* Returns true if p_point is the point at infinity, false otherwise. */
-static bool ecc_point_is_zero(const struct ecc_point *point)
+static void fe_sqr(uint64_t *result, const uint64_t *in)
 {
-	return (vli_is_zero(point->x) && vli_is_zero(point->y));
+	fe_mul(result, in, in);
 }
 
-/* Point multiplication algorithm using Montgomery's ladder with co-Z
- * coordinates. From http://eprint.iacr.org/2011/338.pdf
- */
-
-/* Double in place */
-static void ecc_point_double_jacobian(uint64_t *x1, uint64_t *y1, uint64_t *z1)
+static void fe_to_mont(uint64_t *result, const uint64_t *in)
 {
-	/* t1 = x, t2 = y, t3 = z */
-	uint64_t t4[NUM_ECC_DIGITS];
-	uint64_t t5[NUM_ECC_DIGITS];
-
-	if (vli_is_zero(z1))
-		return;
-
-	vli_mod_square_fast(t4, y1);   /* t4 = y1^2 */
-	vli_mod_mult_fast(t5, x1, t4); /* t5 = x1*y1^2 = A */
-	vli_mod_square_fast(t4, t4);   /* t4 = y1^4 */
-	vli_mod_mult_fast(y1, y1, z1); /* t2 = y1*z1 = z3 */
-	vli_mod_square_fast(z1, z1);   /* t3 = z1^2 */
-
-	vli_mod_add(x1, x1, z1, curve_p); /* t1 = x1 + z1^2 */
-	vli_mod_add(z1, z1, z1, curve_p); /* t3 = 2*z1^2 */
-	vli_mod_sub(z1, x1, z1, curve_p); /* t3 = x1 - z1^2 */
-	vli_mod_mult_fast(x1, x1, z1);    /* t1 = x1^2 - z1^4 */
-
-	vli_mod_add(z1, x1, x1, curve_p); /* t3 = 2*(x1^2 - z1^4) */
-	vli_mod_add(x1, x1, z1, curve_p); /* t1 = 3*(x1^2 - z1^4) */
-	if (vli_test_bit(x1, 0)) {
-		uint64_t carry = vli_add(x1, x1, curve_p);
-		vli_rshift1(x1);
-		x1[NUM_ECC_DIGITS - 1] |= carry << 63;
-	} else {
-		vli_rshift1(x1);
-	}
-	/* t1 = 3/2*(x1^2 - z1^4) = B */
-
-	vli_mod_square_fast(z1, x1);      /* t3 = B^2 */
-	vli_mod_sub(z1, z1, t5, curve_p); /* t3 = B^2 - A */
-	vli_mod_sub(z1, z1, t5, curve_p); /* t3 = B^2 - 2A = x3 */
-	vli_mod_sub(t5, t5, z1, curve_p); /* t5 = A - x3 */
-	vli_mod_mult_fast(x1, x1, t5);    /* t1 = B * (A - x3) */
-	vli_mod_sub(t4, x1, t4, curve_p); /* t4 = B * (A - x3) - y1^4 = y3 */
-
-	vli_set(x1, z1);
-	vli_set(z1, y1);
-	vli_set(y1, t4);
+	fe_mul(result, in, curve_rr);
 }
 
-/* Modify (x1, y1) => (x1 * z^2, y1 * z^3) */
-static void apply_z(uint64_t *x1, uint64_t *y1, uint64_t *z)
+static void fe_from_mont(uint64_t *result, const uint64_t *in)
 {
-	uint64_t t1[NUM_ECC_DIGITS];
+	static const uint64_t one[NUM_ECC_DIGITS] = { 1, 0, 0, 0 };
 
-	vli_mod_square_fast(t1, z);    /* z^2 */
-	vli_mod_mult_fast(x1, x1, t1); /* x1 * z^2 */
-	vli_mod_mult_fast(t1, t1, z);  /* z^3 */
-	vli_mod_mult_fast(y1, y1, t1); /* y1 * z^3 */
+	fe_mul(result, in, one);
 }
 
-/* P = (x1, y1) => 2P, (x2, y2) => P' */
-static void xycz_initial_double(uint64_t *x1, uint64_t *y1, uint64_t *x2,
-					uint64_t *y2, uint64_t *p_initial_z)
+/* Computes result = 1 / in % p, which is 0 if in is 0. The exponent is
+ * public, so the branch does not leak anything about the input.
+ */
+static void fe_inv(uint64_t *result, const uint64_t *in)
 {
-	uint64_t z[NUM_ECC_DIGITS];
+	uint64_t t[NUM_ECC_DIGITS];
+	int i;
 
-	vli_set(x2, x1);
-	vli_set(y2, y1);
+	vli_set(t, curve_one);
 
-	vli_clear(z);
-	z[0] = 1;
+	for (i = 255; i >= 0; i--) {
+		fe_sqr(t, t);
 
-	if (p_initial_z)
-		vli_set(z, p_initial_z);
+		if (curve_p_minus_2[i / 64] & ((uint64_t) 1 << (i % 64)))
+			fe_mul(t, t, in);
+	}
 
-	apply_z(x1, y1, z);
+	vli_set(result, t);
+}
 
-	ecc_point_double_jacobian(x1, y1, z);
+/* ------ Point operations ------ */
 
-	apply_z(x2, y2, z);
+/* Jacobian coordinates, the point at infinity has z == 0 */
+struct jacobian_point {
+	uint64_t x[NUM_ECC_DIGITS];
+	uint64_t y[NUM_ECC_DIGITS];
+	uint64_t z[NUM_ECC_DIGITS];
+};
+
+/* Sets result = mask ? a : b. */
+static void point_select(struct jacobian_point *result,
+				const struct jacobian_point *a,
+				const struct jacobian_point *b, uint64_t mask)
+{
+	fe_select(result->x, a->x, b->x, mask);
+	fe_select(result->y, a->y, b->y, mask);
+	fe_select(result->z, a->z, b->z, mask);
 }
 
-/* Input P = (x1, y1, Z), Q = (x2, y2, Z)
- * Output P' = (x1', y1', Z3), P + Q = (x3, y3, Z3)
- * or P => P', Q => P + Q
+/* Point doubling for a = -3, "dbl-2001-b" from the Explicit-Formulas
+ * Database. The point at infinity stays at infinity.
  */
-static void xycz_add(uint64_t *x1, uint64_t *y1, uint64_t *x2, uint64_t *y2)
+static void point_double(struct jacobian_point *result,
+					const struct jacobian_point *point)
+{
+	uint64_t delta[NUM_ECC_DIGITS], gamma[NUM_ECC_DIGITS];
+	uint64_t beta[NUM_ECC_DIGITS], alpha[NUM_ECC_DIGITS];
+	uint64_t t1[NUM_ECC_DIGITS], t2[NUM_ECC_DIGITS];
+
+	fe_sqr(delta, point->z);
+	fe_sqr(gamma, point->y);
+	fe_mul(beta, point->x, gamma);
+
+	/* alpha = 3 * (x - delta) * (x + delta) */
+	fe_sub(t1, point->x, delta);
+	fe_add(t2, point->x, delta);
+	fe_mul(alpha, t1, t2);
+	fe_add(t1, alpha, alpha);
+	fe_add(alpha, alpha, t1);
+
+	/* z3 = (y + z)^2 - gamma - delta */
+	fe_add(t1, point->y, point->z);
+	fe_sqr(t1, t1);
+	fe_sub(t1, t1, gamma);
+	fe_sub(result->z, t1, delta);
+
+	/* x3 = alpha^2 - 8 * beta */
+	fe_add(beta, beta, beta);
+	fe_add(beta, beta, beta);
+	fe_add(t1, beta, beta);
+	fe_sqr(result->x, alpha);
+	fe_sub(result->x, result->x, t1);
+
+	/* y3 = alpha * (4 * beta - x3) - 8 * gamma^2 */
+	fe_sub(t1, beta, result->x);
+	fe_mul(t1, alpha, t1);
+	fe_sqr(t2, gamma);
+	fe_add(t2, t2, t2);
+	fe_add(t2, t2, t2);
+	fe_add(t2, t2, t2);
+	fe_sub(result->y, t1, t2);
+}
+
+/* Point addition, "add-2007-bl" from the Explicit-Formulas Database.
+ * Either input being the point at infinity is handled, but the points
+ * must not be equal.
+ */
+static void point_add(struct jacobian_point *result,
+				const struct jacobian_point *a,
+				const struct jacobian_point *b)
+{
+	uint64_t z1z1[NUM_ECC_DIGITS], z2z2[NUM_ECC_DIGITS];
+	uint64_t u1[NUM_ECC_DIGITS], u2[NUM_ECC_DIGITS];
+	uint64_t s1[NUM_ECC_DIGITS], s2[NUM_ECC_DIGITS];
+	uint64_t h[NUM_ECC_DIGITS], i[NUM_ECC_DIGITS], j[NUM_ECC_DIGITS];
+	uint64_t r[NUM_ECC_DIGITS], v[NUM_ECC_DIGITS], t[NUM_ECC_DIGITS];
+	struct jacobian_point sum;
+
+	fe_sqr(z1z1, a->z);
+	fe_sqr(z2z2, b->z);
+	fe_mul(u1, a->x, z2z2);
+	fe_mul(u2, b->x, z1z1);
+	fe_mul(s1, a->y, b->z);
+	fe_mul(s1, s1, z2z2);
+	fe_mul(s2, b->y, a->z);
+	fe_mul(s2, s2, z1z1);
+
+	/* h = u2 - u1, i = (2 * h)^2, j = h * i, r = 2 * (s2 - s1) */
+	fe_sub(h, u2, u1);
+	fe_add(i, h, h);
+	fe_sqr(i, i);
+	fe_mul(j, h, i);
+	fe_sub(r, s2, s1);
+	fe_add(r, r, r);
+	fe_mul(v, u1, i);
+
+	/* x3 = r^2 - j - 2 * v */
+	fe_sqr(sum.x, r);
+	fe_sub(sum.x, sum.x, j);
+	fe_sub(sum.x, sum.x, v);
+	fe_sub(sum.x, sum.x, v);
+
+	/* y3 = r * (v - x3) - 2 * s1 * j */
+	fe_sub(t, v, sum.x);
+	fe_mul(sum.y, r, t);
+	fe_mul(t, s1, j);
+	fe_add(t, t, t);
+	fe_sub(sum.y, sum.y, t);
+
+	/* z3 = ((z1 + z2)^2 - z1z1 - z2z2) * h */
+	fe_add(t, a->z, b->z);
+	fe_sqr(t, t);
+	fe_sub(t, t, z1z1);
+	fe_sub(t, t, z2z2);
+	fe_mul(sum.z, t, h);
+
+	point_select(&sum, b, &sum, fe_is_zero(a->z));
+	point_select(result, a, &sum, fe_is_zero(b->z));
+}
+
+#define WINDOW_BITS 4
+#define WINDOW_SIZE (1 << WINDOW_BITS)
+
+/* Reads table[index] without an index dependent memory access pattern */
+static void table_lookup(struct jacobian_point *result,
+				const struct jacobian_point *table,
+				uint64_t index)
 {
-	/* t1 = X1, t2 = Y1, t3 = X2, t4 = Y2 */
-	uint64_t t5[NUM_ECC_DIGITS];
-
-	vli_mod_sub(t5, x2, x1, curve_p); /* t5 = x2 - x1 */
-	vli_mod_square_fast(t5, t5);      /* t5 = (x2 - x1)^2 = A */
-	vli_mod_mult_fast(x1, x1, t5);    /* t1 = x1*A = B */
-	vli_mod_mult_fast(x2, x2, t5);    /* t3 = x2*A = C */
-	vli_mod_sub(y2, y2, y1, curve_p); /* t4 = y2 - y1 */
-	vli_mod_square_fast(t5, y2);      /* t5 = (y2 - y1)^2 = D */
+	int i;
 
-	vli_mod_sub(t5, t5, x1, curve_p); /* t5 = D - B */
-	vli_mod_sub(t5, t5, x2, curve_p); /* t5 = D - B - C = x3 */
-	vli_mod_sub(x2, x2, x1, curve_p); /* t3 = C - B */
-	vli_mod_mult_fast(y1, y1, x2);    /* t2 = y1*(C - B) */
-	vli_mod_sub(x2, x1, t5, curve_p); /* t3 = B - x3 */
-	vli_mod_mult_fast(y2, y2, x2);    /* t4 = (y2 - y1)*(B - x3) */
-	vli_mod_sub(y2, y2, y1, curve_p); /* t4 = y3 */
+	*result = table[0];
 
-	vli_set(x2, t5);
+	for (i = 1; i < WINDOW_SIZE; i++)
+		point_select(result, &table[i], result,
+						mask_is_zero(index ^ i));
 }
 
-/* Input P = (x1, y1, Z), Q = (x2, y2, Z)
- * Output P + Q = (x3, y3, Z3), P - Q = (x3', y3', Z3)
- * or P => P - Q, Q => P + Q
+/* Fixed window scalar multiplication. All 256 bits of the scalar are
+ * processed regardless of its value. The optional initial_z randomizes
+ * the projective coordinates of the input point.
  */
-static void xycz_add_c(uint64_t *x1, uint64_t *y1, uint64_t *x2, uint64_t *y2)
+static void ecc_point_mult(struct ecc_point *result,
+				const struct ecc_point *point,
+				const uint64_t *scalar,
+				const uint64_t *initial_z)
 {
-	/* t1 = X1, t2 = Y1, t3 = X2, t4 = Y2 */
-	uint64_t t5[NUM_ECC_DIGITS];
-	uint64_t t6[NUM_ECC_DIGITS];
-	uint64_t t7[NUM_ECC_DIGITS];
+	struct jacobian_point table[WINDOW_SIZE], acc, tmp;
+	uint64_t k[NUM_ECC_DIGITS], z[NUM_ECC_DIGITS], zz[NUM_ECC_DIGITS];
+	uint64_t borrow = 0;
+	int i;
 
-	vli_mod_sub(t5, x2, x1, curve_p); /* t5 = x2 - x1 */
-	vli_mod_square_fast(t5, t5);      /* t5 = (x2 - x1)^2 = A */
-	vli_mod_mult_fast(x1, x1, t5);    /* t1 = x1*A = B */
-	vli_mod_mult_fast(x2, x2, t5);    /* t3 = x2*A = C */
-	vli_mod_add(t5, y2, y1, curve_p); /* t4 = y2 + y1 */
-	vli_mod_sub(y2, y2, y1, curve_p); /* t4 = y2 - y1 */
+	/* Reduce the scalar into [0, n - 1], it is always below 2n */
+	for (i = 0; i < NUM_ECC_DIGITS; i++)
+		k[i] = sbb(scalar[i], curve_n[i], &borrow);
 
-	vli_mod_sub(t6, x2, x1, curve_p); /* t6 = C - B */
-	vli_mod_mult_fast(y1, y1, t6);    /* t2 = y1 * (C - B) */
-	vli_mod_add(t6, x1, x2, curve_p); /* t6 = B + C */
-	vli_mod_square_fast(x2, y2);      /* t3 = (y2 - y1)^2 */
-	vli_mod_sub(x2, x2, t6, curve_p); /* t3 = x3 */
+	fe_select(k, scalar, k, 0 - borrow);
 
-	vli_mod_sub(t7, x1, x2, curve_p); /* t7 = B - x3 */
-	vli_mod_mult_fast(y2, y2, t7);    /* t4 = (y2 - y1)*(B - x3) */
-	vli_mod_sub(y2, y2, y1, curve_p); /* t4 = y3 */
+	if (initial_z) {
+		fe_to_mont(z, initial_z);
+		fe_select(z, curve_one, z, fe_is_zero(z));
+	} else {
+		vli_set(z, curve_one);
+	}
 
-	vli_mod_square_fast(t7, t5);      /* t7 = (y2 + y1)^2 = F */
-	vli_mod_sub(t7, t7, t6, curve_p); /* t7 = x3' */
-	vli_mod_sub(t6, t7, x1, curve_p); /* t6 = x3' - B */
-	vli_mod_mult_fast(t6, t6, t5);    /* t6 = (y2 + y1)*(x3' - B) */
-	vli_mod_sub(y1, t6, y1, curve_p); /* t2 = y3' */
+	/* table[i] = i * point, table[0] is the point at infinity */
+	memset(&table[0], 0, sizeof(table[0]));
 
-	vli_set(x1, t7);
-}
+	fe_to_mont(table[1].x, point->x);
+	fe_to_mont(table[1].y, point->y);
+	fe_sqr(zz, z);
+	fe_mul(table[1].x, table[1].x, zz);
+	fe_mul(zz, zz, z);
+	fe_mul(table[1].y, table[1].y, zz);
+	vli_set(table[1].z, z);
 
-static void ecc_point_mult(struct ecc_point *result,
-				const struct ecc_point *point,
-				uint64_t *scalar, uint64_t *initial_z,
-				int num_bits)
-{
-	/* R0 and R1 */
-	uint64_t rx[2][NUM_ECC_DIGITS];
-	uint64_t ry[2][NUM_ECC_DIGITS];
-	uint64_t z[NUM_ECC_DIGITS];
-	int i, nb;
+	point_double(&table[2], &table[1]);
 
-	vli_set(rx[1], point->x);
-	vli_set(ry[1], point->y);
+	for (i = 3; i < WINDOW_SIZE; i++)
+		point_add(&table[i], &table[i - 1], &table[1]);
 
-	xycz_initial_double(rx[1], ry[1], rx[0], ry[0], initial_z);
+	/* Since k < n, the accumulator never equals the added point */
+	acc = table[0];
 
-	for (i = num_bits - 2; i > 0; i--) {
-		nb = !vli_test_bit(scalar, i);
-		xycz_add_c(rx[1 - nb], ry[1 - nb], rx[nb], ry[nb]);
-		xycz_add(rx[nb], ry[nb], rx[1 - nb], ry[1 - nb]);
-	}
+	for (i = 256 / WINDOW_BITS - 1; i >= 0; i--) {
+		unsigned int bit = i * WINDOW_BITS;
+		int j;
 
-	nb = !vli_test_bit(scalar, 0);
-	xycz_add_c(rx[1 - nb], ry[1 - nb], rx[nb], ry[nb]);
+		for (j = 0; j < WINDOW_BITS; j++)
+			point_double(&acc, &acc);
 
-	/* Find final 1/Z value. */
-	vli_mod_sub(z, rx[1], rx[0], curve_p); /* X1 - X0 */
-	vli_mod_mult_fast(z, z, ry[1 - nb]); /* Yb * (X1 - X0) */
-	vli_mod_mult_fast(z, z, point->x);   /* xP * Yb * (X1 - X0) */
-	vli_mod_inv(z, z, curve_p);          /* 1 / (xP * Yb * (X1 - X0)) */
-	vli_mod_mult_fast(z, z, point->y);   /* yP / (xP * Yb * (X1 - X0)) */
-	vli_mod_mult_fast(z, z, rx[1 - nb]); /* Xb * yP / (xP * Yb * (X1 - X0)) */
-	/* End 1/Z calculation */
+		table_lookup(&tmp, table, (k[bit / 64] >> (bit % 64)) &
+							(WINDOW_SIZE - 1));
+		point_add(&acc, &acc, &tmp);
+	}
 
-	xycz_add(rx[nb], ry[nb], rx[1 - nb], ry[1 - nb]);
+	/* Back to affine coordinates, infinity ends up as (0, 0) */
+	fe_inv(z, acc.z);
+	fe_sqr(zz, z);
+	fe_mul(acc.x, acc.x, zz);
+	fe_mul(zz, zz, z);
+	fe_mul(acc.y, acc.y, zz);
 
-	apply_z(rx[0], ry[0], z);
+	fe_from_mont(result->x, acc.x);
+	fe_from_mont(result->y, acc.y);
+}
 
-	vli_set(result->x, rx[0]);
-	vli_set(result->y, ry[0]);
+/* Returns true if p_point is the point at infinity, false otherwise. */
+static bool ecc_point_is_zero(const struct ecc_point *point)
+{
+	return (vli_is_zero(point->x) && vli_is_zero(point->y));
 }
 
 /* Little endian byte-array to native conversion */
@@ -828,7 +644,7 @@ bool ecc_make_key(uint8_t public_key[64], uint8_t private_key[32])
 		if (vli_cmp(curve_n, priv) != 1)
 			continue;
 
-		ecc_point_mult(&pk, &curve_g, priv, NULL, vli_num_bits(priv));
+		ecc_point_mult(&pk, &curve_g, priv, NULL);
 	} while (ecc_point_is_zero(&pk));
 
 	ecc_native2bytes(priv, private_key);
@@ -853,9 +669,146 @@ bool ecdh_shared_secret(const uint8_t public_key[64],
 	ecc_bytes2native(&public_key[32], pk.y);
 	ecc_bytes2native(private_key, priv);
 
-	ecc_point_mult(&product, &pk, priv, rand, vli_num_bits(priv));
+	ecc_point_mult(&product, &pk, priv, rand);
 
 	ecc_native2bytes(product.x, secret);
 
 	return !ecc_point_is_zero(&product);
 }
+
+struct ecc_key {
+	uint8_t public_key[64];
+	uint8_t private_key[32];
+	unsigned int uses;
+};
+
+struct ecc_key_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	bool running;
+	bool stop;
+	unsigned int max_uses;
+	unsigned int depth;
+	unsigned int head;
+	unsigned int count;
+	struct ecc_key keys[0];
+};
+
+static void *key_pool_thread(void *user_data)
+{
+	struct ecc_key_pool *pool = user_data;
+	struct ecc_key key;
+
+	pthread_mutex_lock(&pool->lock);
+
+	while (!pool->stop) {
+		if (pool->count == pool->depth) {
+			pthread_cond_wait(&pool->cond, &pool->lock);
+			continue;
+		}
+
+		/* The key generation is the slow part, so run it unlocked */
+		pthread_mutex_unlock(&pool->lock);
+
+		memset(&key, 0, sizeof(key));
+		if (!ecc_make_key(key.public_key, key.private_key)) {
+			pthread_mutex_lock(&pool->lock);
+			break;
+		}
+
+		pthread_mutex_lock(&pool->lock);
+
+		if (pool->count < pool->depth) {
+			pool->keys[(pool->head + pool->count) % pool->depth] =
+									key;
+			pool->count++;
+		}
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	memset(&key, 0, sizeof(key));
+
+	return NULL;
+}
+
+struct ecc_key_pool *ecc_key_pool_new(unsigned int depth,
+						unsigned int max_uses)
+{
+	struct ecc_key_pool *pool;
+
+	if (!depth || !max_uses)
+		return NULL;
+
+	pool = calloc(1, sizeof(*pool) + depth * sizeof(struct ecc_key));
+	if (!pool)
+		return NULL;
+
+	pool->depth = depth;
+	pool->max_uses = max_uses;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	/* Without the thread keys are simply generated on demand */
+	if (!pthread_create(&pool->thread, NULL, key_pool_thread, pool))
+		pool->running = true;
+
+	return pool;
+}
+
+void ecc_key_pool_free(struct ecc_key_pool *pool)
+{
+	if (!pool)
+		return;
+
+	if (pool->running) {
+		pthread_mutex_lock(&pool->lock);
+		pool->stop = true;
+		pthread_cond_signal(&pool->cond);
+		pthread_mutex_unlock(&pool->lock);
+
+		pthread_join(pool->thread, NULL);
+	}
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+
+	memset(pool->keys, 0, pool->depth * sizeof(struct ecc_key));
+
+	free(pool);
+}
+
+bool ecc_key_pool_get(struct ecc_key_pool *pool, uint8_t public_key[64],
+						uint8_t private_key[32])
+{
+	struct ecc_key *key;
+
+	if (!pool)
+		return ecc_make_key(public_key, private_key);
+
+	pthread_mutex_lock(&pool->lock);
+
+	if (!pool->count) {
+		pthread_mutex_unlock(&pool->lock);
+		return ecc_make_key(public_key, private_key);
+	}
+
+	key = &pool->keys[pool->head];
+
+	memcpy(public_key, key->public_key, 64);
+	memcpy(private_key, key->private_key, 32);
+
+	/* Retire the key pair once it has been handed out max_uses times */
+	if (++key->uses >= pool->max_uses) {
+		memset(key, 0, sizeof(*key));
+		pool->head = (pool->head + 1) % pool->depth;
+		pool->count--;
+		pthread_cond_signal(&pool->cond);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return true;
+}
@@ -56,3 +56,26 @@ bool ecc_make_key(uint8_t public_key[64], uint8_t private_key[32]);
 bool ecdh_shared_secret(const uint8_t public_key[64],
 				const uint8_t private_key[32],
 				uint8_t secret[32]);
+
+struct ecc_key_pool;
+
+/* Create a pool of precomputed public/private key pairs.
+ * Inputs:
+ *	depth    - Number of key pairs to keep ready.
+ *	max_uses - Number of times a key pair is handed out before it is
+ *		   discarded, 1 gives every caller a fresh key pair.
+ *
+ * The pool is refilled from a background thread. Returns NULL if the
+ * pool could not be created.
+ */
+struct ecc_key_pool *ecc_key_pool_new(unsigned int depth,
+						unsigned int max_uses);
+void ecc_key_pool_free(struct ecc_key_pool *pool);
+
+/* Take a key pair from the pool. When the pool is empty or NULL the key
+ * pair is generated on the spot like with ecc_make_key.
+ *
+ * Returns true if a key pair was provided, false if an error occurred.
+ */
+bool ecc_key_pool_get(struct ecc_key_pool *pool, uint8_t public_key[64],
+						uint8_t private_key[32]);
@@ -0,0 +1,442 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2017  Intel Corporation
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lib/bluetooth.h"
+#include "lib/uuid.h"
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/att.h"
+#include "src/shared/gatt-db.h"
+#include "src/shared/gatt-client.h"
+#include "src/shared/gatt-batch.h"
+
+/*
+ * Small fixed size reads queued while the batch is held are merged into
+ * Read Multiple requests, so a profile set probing a freshly connected
+ * device costs one round trip per MTU worth of values instead of one per
+ * characteristic. Anything of unknown length, or a peer that rejects
+ * Read Multiple, falls back to plain Read requests in priority order.
+ */
+struct bt_gatt_batch {
+	struct bt_gatt_client *client;
+	unsigned int hold;
+	unsigned int next_id;
+	struct queue *pending;
+	struct queue *active;
+	struct queue *groups;
+	bool no_read_mult;
+};
+
+struct batch_read {
+	struct bt_gatt_batch *batch;
+	unsigned int id;
+	unsigned int client_id;
+	uint16_t handle;
+	uint16_t length;
+	uint8_t priority;
+	bt_gatt_client_read_callback_t callback;
+	void *user_data;
+	bt_gatt_batch_destroy_func_t destroy;
+};
+
+struct batch_group {
+	struct bt_gatt_batch *batch;
+	unsigned int client_id;
+	struct queue *reads;
+	uint16_t length;
+};
+
+static void read_free(void *data)
+{
+	struct batch_read *read = data;
+
+	if (read->destroy)
+		read->destroy(read->user_data);
+
+	free(read);
+}
+
+static void read_complete(struct batch_read *read, bool success,
+					uint8_t att_ecode, const uint8_t *value,
+					uint16_t length)
+{
+	if (read->callback)
+		read->callback(success, att_ecode, value, length,
+							read->user_data);
+}
+
+static void single_cb(bool success, uint8_t att_ecode, const uint8_t *value,
+					uint16_t length, void *user_data)
+{
+	struct batch_read *read = user_data;
+
+	read_complete(read, success, att_ecode, value, length);
+}
+
+static void single_destroy(void *user_data)
+{
+	struct batch_read *read = user_data;
+
+	if (read->batch)
+		queue_remove(read->batch->active, read);
+
+	read_free(read);
+}
+
+static void send_single(struct bt_gatt_batch *batch, struct batch_read *read)
+{
+	read->batch = batch;
+	queue_push_tail(batch->active, read);
+
+	read->client_id = bt_gatt_client_read_value(batch->client,
+							read->handle,
+							single_cb, read,
+							single_destroy);
+	if (read->client_id)
+		return;
+
+	queue_remove(batch->active, read);
+	read_complete(read, false, 0, NULL, 0);
+	read_free(read);
+}
+
+static void group_cb(bool success, uint8_t att_ecode, const uint8_t *value,
+					uint16_t length, void *user_data)
+{
+	struct batch_group *group = user_data;
+	struct batch_read *read;
+
+	if (success && length == group->length) {
+		while ((read = queue_pop_head(group->reads))) {
+			read_complete(read, true, 0, value, read->length);
+			value += read->length;
+			read_free(read);
+		}
+
+		return;
+	}
+
+	/*
+	 * The response got truncated or one of the handles failed, which
+	 * says nothing about the others, so retry them one at a time.
+	 */
+	if (group->batch && att_ecode == BT_ATT_ERROR_REQUEST_NOT_SUPPORTED)
+		group->batch->no_read_mult = true;
+
+	while ((read = queue_pop_head(group->reads))) {
+		if (group->batch) {
+			send_single(group->batch, read);
+			continue;
+		}
+
+		read_complete(read, false, att_ecode, NULL, 0);
+		read_free(read);
+	}
+}
+
+static void group_free(void *data)
+{
+	struct batch_group *group = data;
+
+	if (group->batch)
+		queue_remove(group->batch->groups, group);
+
+	queue_destroy(group->reads, read_free);
+	free(group);
+}
+
+static void send_group(struct bt_gatt_batch *batch, struct batch_group *group)
+{
+	const struct queue_entry *entry;
+	uint16_t handles[queue_length(group->reads)];
+	uint8_t num = 0;
+	struct batch_read *read;
+
+	if (queue_length(group->reads) == 1) {
+		send_single(batch, queue_pop_head(group->reads));
+		group_free(group);
+		return;
+	}
+
+	for (entry = queue_get_entries(group->reads); entry;
+							entry = entry->next) {
+		read = entry->data;
+		handles[num++] = read->handle;
+	}
+
+	group->batch = batch;
+	queue_push_tail(batch->groups, group);
+
+	group->client_id = bt_gatt_client_read_multiple(batch->client,
+							handles, num,
+							group_cb, group,
+							group_free);
+	if (group->client_id)
+		return;
+
+	queue_remove(batch->groups, group);
+	group->batch = NULL;
+
+	while ((read = queue_pop_head(group->reads)))
+		send_single(batch, read);
+
+	group_free(group);
+}
+
+static struct batch_group *group_new(void)
+{
+	struct batch_group *group;
+
+	group = new0(struct batch_group, 1);
+	group->reads = queue_new();
+
+	return group;
+}
+
+static void batch_flush(struct bt_gatt_batch *batch)
+{
+	struct batch_group *group = NULL;
+	struct batch_read *read;
+	uint16_t max_len, max_num;
+
+	/* Read Multiple Response carries the values back to back */
+	max_len = bt_gatt_client_get_mtu(batch->client) - 1;
+	max_num = max_len / 2;
+
+	while ((read = queue_pop_head(batch->pending))) {
+		if (batch->no_read_mult || !read->length ||
+						read->length > max_len) {
+			if (group) {
+				send_group(batch, group);
+				group = NULL;
+			}
+
+			send_single(batch, read);
+			continue;
+		}
+
+		if (group && (queue_length(group->reads) >= max_num ||
+				group->length + read->length > max_len)) {
+			send_group(batch, group);
+			group = NULL;
+		}
+
+		if (!group)
+			group = group_new();
+
+		queue_push_tail(group->reads, read);
+		group->length += read->length;
+	}
+
+	if (group)
+		send_group(batch, group);
+}
+
+struct bt_gatt_batch *bt_gatt_batch_new(struct bt_gatt_client *client)
+{
+	struct bt_gatt_batch *batch;
+
+	if (!client)
+		return NULL;
+
+	batch = new0(struct bt_gatt_batch, 1);
+	batch->client = bt_gatt_client_ref(client);
+	batch->pending = queue_new();
+	batch->active = queue_new();
+	batch->groups = queue_new();
+
+	return batch;
+}
+
+static void cancel_read(void *data, void *user_data)
+{
+	struct batch_read *read = data;
+	struct bt_gatt_client *client = user_data;
+
+	read->batch = NULL;
+	bt_gatt_client_cancel(client, read->client_id);
+}
+
+static void cancel_group(void *data, void *user_data)
+{
+	struct batch_group *group = data;
+	struct bt_gatt_client *client = user_data;
+
+	group->batch = NULL;
+	bt_gatt_client_cancel(client, group->client_id);
+}
+
+void bt_gatt_batch_free(struct bt_gatt_batch *batch)
+{
+	struct queue *active, *groups;
+
+	if (!batch)
+		return;
+
+	/* Detach first, the cancels below call back into single_destroy */
+	active = batch->active;
+	groups = batch->groups;
+	batch->active = NULL;
+	batch->groups = NULL;
+
+	queue_foreach(active, cancel_read, batch->client);
+	queue_foreach(groups, cancel_group, batch->client);
+	queue_destroy(active, NULL);
+	queue_destroy(groups, NULL);
+	queue_destroy(batch->pending, read_free);
+
+	bt_gatt_client_unref(batch->client);
+	free(batch);
+}
+
+void bt_gatt_batch_hold(struct bt_gatt_batch *batch)
+{
+	if (batch)
+		batch->hold++;
+}
+
+void bt_gatt_batch_release(struct bt_gatt_batch *batch)
+{
+	if (!batch || !batch->hold)
+		return;
+
+	if (--batch->hold == 0)
+		batch_flush(batch);
+}
+
+static void insert_read(struct bt_gatt_batch *batch, struct batch_read *read)
+{
+	const struct queue_entry *entry;
+	void *prev = NULL;
+
+	/* Keep submission order among reads of the same priority */
+	for (entry = queue_get_entries(batch->pending); entry;
+							entry = entry->next) {
+		struct batch_read *queued = entry->data;
+
+		if (queued->priority > read->priority)
+			break;
+
+		prev = queued;
+	}
+
+	if (prev)
+		queue_push_after(batch->pending, prev, read);
+	else
+		queue_push_head(batch->pending, read);
+}
+
+unsigned int bt_gatt_batch_read(struct bt_gatt_batch *batch,
+				uint16_t value_handle, uint16_t length,
+				uint8_t priority,
+				bt_gatt_client_read_callback_t callback,
+				void *user_data,
+				bt_gatt_batch_destroy_func_t destroy)
+{
+	struct batch_read *read;
+	unsigned int id;
+
+	if (!batch || !value_handle)
+		return 0;
+
+	read = new0(struct batch_read, 1);
+	read->handle = value_handle;
+	read->length = length;
+	read->priority = priority;
+	read->callback = callback;
+	read->user_data = user_data;
+	read->destroy = destroy;
+
+	if (++batch->next_id == 0)
+		batch->next_id = 1;
+
+	read->id = id = batch->next_id;
+
+	if (batch->hold) {
+		insert_read(batch, read);
+		return id;
+	}
+
+	/* The read may already have failed and been freed by this */
+	send_single(batch, read);
+
+	return id;
+}
+
+static bool match_read_id(const void *a, const void *b)
+{
+	const struct batch_read *read = a;
+
+	return read->id == PTR_TO_UINT(b);
+}
+
+static bool match_group_read(const void *a, const void *b)
+{
+	const struct batch_group *group = a;
+
+	return queue_find(group->reads, match_read_id, b) != NULL;
+}
+
+bool bt_gatt_batch_cancel(struct bt_gatt_batch *batch, unsigned int id)
+{
+	struct batch_group *group;
+	struct batch_read *read;
+
+	if (!batch || !id)
+		return false;
+
+	read = queue_remove_if(batch->pending, match_read_id, UINT_TO_PTR(id));
+	if (read) {
+		read_free(read);
+		return true;
+	}
+
+	read = queue_find(batch->active, match_read_id, UINT_TO_PTR(id));
+	if (read)
+		return bt_gatt_client_cancel(batch->client, read->client_id);
+
+	/*
+	 * The other reads in the group still want their values, so only
+	 * drop the callback and let the response go to the rest.
+	 */
+	group = queue_find(batch->groups, match_group_read, UINT_TO_PTR(id));
+	if (!group)
+		return false;
+
+	read = queue_find(group->reads, match_read_id, UINT_TO_PTR(id));
+	if (read->destroy)
+		read->destroy(read->user_data);
+
+	read->callback = NULL;
+	read->destroy = NULL;
+
+	return true;
+}
@@ -0,0 +1,49 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2017  Intel Corporation
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Reads with a lower priority value are sent first */
+#define BT_GATT_BATCH_PRIORITY_HIGH	0
+#define BT_GATT_BATCH_PRIORITY_DEFAULT	128
+#define BT_GATT_BATCH_PRIORITY_LOW	255
+
+struct bt_gatt_batch;
+
+typedef void (*bt_gatt_batch_destroy_func_t)(void *user_data);
+
+struct bt_gatt_batch *bt_gatt_batch_new(struct bt_gatt_client *client);
+void bt_gatt_batch_free(struct bt_gatt_batch *batch);
+
+void bt_gatt_batch_hold(struct bt_gatt_batch *batch);
+void bt_gatt_batch_release(struct bt_gatt_batch *batch);
+
+unsigned int bt_gatt_batch_read(struct bt_gatt_batch *batch,
+				uint16_t value_handle, uint16_t length,
+				uint8_t priority,
+				bt_gatt_client_read_callback_t callback,
+				void *user_data,
+				bt_gatt_batch_destroy_func_t destroy);
+bool bt_gatt_batch_cancel(struct bt_gatt_batch *batch, unsigned int id);
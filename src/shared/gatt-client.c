@@ -30,6 +30,7 @@
 #include "lib/uuid.h"
 #include "src/shared/gatt-helpers.h"
 #include "src/shared/util.h"
+#include "src/shared/trace.h"
 #include "src/shared/queue.h"
 #include "src/shared/gatt-db.h"
 #include "src/shared/gatt-client.h"
@@ -50,6 +51,8 @@
 
 #define GATT_SVC_UUID	0x1801
 #define SVC_CHNGD_UUID	0x2a05
+#define DB_HASH_UUID	0x2b2a
+#define DB_HASH_LEN	16
 
 struct ready_cb {
 	bt_gatt_client_callback_t callback;
@@ -77,6 +80,7 @@ struct bt_gatt_client {
 	struct gatt_db *db;
 	bool in_init;
 	bool ready;
+	bool trust_cache;	/* Peer is bonded, Service Changed is reliable */
 
 	/*
 	 * Queue of long write requests. An error during "prepare write"
@@ -320,6 +324,7 @@ struct discovery_op {
 	struct queue *pending_svcs;
 	struct queue *pending_chrcs;
 	struct queue *ext_prop_desc;
+	struct queue *discovered_svcs;	/* To be activated once complete */
 	struct gatt_db_attribute *cur_svc;
 	bool success;
 	uint16_t start;
@@ -327,6 +332,8 @@ struct discovery_op {
 	uint16_t last;
 	uint16_t svc_first;
 	uint16_t svc_last;
+	uint8_t db_hash[DB_HASH_LEN];
+	bool db_hash_valid;
 	unsigned int db_id;
 	int ref_count;
 	discovery_op_complete_func_t complete_func;
@@ -341,6 +348,7 @@ static void discovery_op_free(struct discovery_op *op)
 	queue_destroy(op->pending_svcs, NULL);
 	queue_destroy(op->pending_chrcs, free);
 	queue_destroy(op->ext_prop_desc, NULL);
+	queue_destroy(op->discovered_svcs, NULL);
 	free(op);
 }
 
@@ -406,6 +414,7 @@ static struct discovery_op *discovery_op_create(struct bt_gatt_client *client,
 	op->pending_svcs = queue_new();
 	op->pending_chrcs = queue_new();
 	op->ext_prop_desc = queue_new();
+	op->discovered_svcs = queue_new();
 	op->client = client;
 	op->complete_func = complete_func;
 	op->failure_func = failure_func;
@@ -527,6 +536,8 @@ static void discover_incl_cb(bool success, uint8_t att_ecode,
 	}
 
 next:
+	BT_TRACE2(gatt_discover_chrcs, op->svc_first, op->svc_last);
+
 	client->discovery_req = bt_gatt_discover_characteristics(client->att,
 							op->svc_first,
 							op->svc_last,
@@ -555,46 +566,96 @@ static void discover_descs_cb(bool success, uint8_t att_ecode,
 						struct bt_gatt_result *result,
 						void *user_data);
 
-static bool discover_descs(struct discovery_op *op, bool *discovering)
+static bool insert_chrc(struct discovery_op *op, struct chrc *chrc_data)
 {
 	struct bt_gatt_client *client = op->client;
-	struct gatt_db_attribute *attr;
-	struct chrc *chrc_data;
-	uint16_t desc_start;
+	struct gatt_db_attribute *attr, *svc;
+
+	attr = gatt_db_insert_characteristic(client->db,
+						chrc_data->value_handle,
+						&chrc_data->uuid, 0,
+						chrc_data->properties,
+						NULL, NULL, NULL);
+	if (!attr) {
+		util_debug(client->debug_callback, client->debug_data,
+				"Failed to insert characteristic at 0x%04x",
+				chrc_data->value_handle);
+		return false;
+	}
 
-	*discovering = false;
+	if (gatt_db_attribute_get_handle(attr) != chrc_data->value_handle)
+		return false;
 
-	while ((chrc_data = queue_pop_head(op->pending_chrcs))) {
-		struct gatt_db_attribute *svc;
-		uint16_t start, end;
+	/*
+	 * Adjust current service, it is only activated once the values of its
+	 * extended properties descriptors have been read.
+	 */
+	svc = gatt_db_get_service(client->db, chrc_data->value_handle);
+	if (op->cur_svc != svc) {
+		queue_remove(op->pending_svcs, svc);
 
-		attr = gatt_db_insert_characteristic(client->db,
-							chrc_data->value_handle,
-							&chrc_data->uuid, 0,
-							chrc_data->properties,
-							NULL, NULL, NULL);
+		if (op->cur_svc)
+			queue_push_tail(op->discovered_svcs, op->cur_svc);
 
-		if (!attr) {
-			util_debug(client->debug_callback, client->debug_data,
-				"Failed to insert characteristic at 0x%04x",
-				chrc_data->value_handle);
-			goto failed;
-		}
+		op->cur_svc = svc;
+	}
 
-		if (gatt_db_attribute_get_handle(attr) !=
-							chrc_data->value_handle)
-			goto failed;
+	return true;
+}
 
-		/* Adjust current service */
-		svc = gatt_db_get_service(client->db, chrc_data->value_handle);
-		if (op->cur_svc != svc) {
-			queue_remove(op->pending_svcs, svc);
+static void activate_service(void *data, void *user_data)
+{
+	gatt_db_service_set_active(data, true);
+}
 
-			/* Done with the current service */
-			gatt_db_service_set_active(op->cur_svc, true);
-			op->cur_svc = svc;
+static void activate_discovered_services(struct discovery_op *op)
+{
+	queue_foreach(op->discovered_svcs, activate_service, NULL);
+	queue_remove_all(op->discovered_svcs, NULL, NULL, NULL);
+
+	gatt_db_service_set_active(op->cur_svc, true);
+}
+
+static bool insert_pending_chrcs(struct discovery_op *op)
+{
+	struct chrc *chrc_data;
+
+	while ((chrc_data = queue_pop_head(op->pending_chrcs))) {
+		if (!insert_chrc(op, chrc_data)) {
+			free(chrc_data);
+			return false;
 		}
 
+		free(chrc_data);
+	}
+
+	return true;
+}
+
+/*
+ * Instead of one Find Information procedure per characteristic, discover the
+ * descriptors of all pending characteristics with a single procedure over the
+ * range folding their descriptor ranges. Attributes in the result that don't
+ * fall within a characteristic descriptor range are skipped.
+ */
+static bool discover_descs(struct discovery_op *op, bool *discovering)
+{
+	struct bt_gatt_client *client = op->client;
+	const struct queue_entry *entry;
+	uint16_t desc_start = 0, desc_end = 0;
+
+	*discovering = false;
+
+	for (entry = queue_get_entries(op->pending_chrcs); entry;
+							entry = entry->next) {
+		struct chrc *chrc_data = entry->data;
+		struct gatt_db_attribute *svc;
+		uint16_t start, end;
+
+		svc = gatt_db_get_service(client->db, chrc_data->value_handle);
+		if (!svc)
+			return false;
+
 		gatt_db_attribute_get_service_handles(svc, &start, &end);
 
 		/*
@@ -609,37 +670,35 @@ static bool discover_descs(struct discovery_op *op, bool *discovering)
 		 * desc_handle and avoid integer overflow during desc_handle
 		 * intialization.
 		 */
-		if (chrc_data->value_handle >= chrc_data->end_handle) {
-			free(chrc_data);
+		if (chrc_data->value_handle >= chrc_data->end_handle)
 			continue;
-		}
 
-		desc_start = chrc_data->value_handle + 1;
+		if (!desc_start)
+			desc_start = chrc_data->value_handle + 1;
+
+		desc_end = chrc_data->end_handle;
+	}
+
+	/* None of the characteristics can have descriptors */
+	if (!desc_start)
+		return insert_pending_chrcs(op);
+
+	BT_TRACE2(gatt_discover_descs, desc_start, desc_end);
 
-		client->discovery_req = bt_gatt_discover_descriptors(
-							client->att, desc_start,
-							chrc_data->end_handle,
+	client->discovery_req = bt_gatt_discover_descriptors(client->att,
+							desc_start, desc_end,
 							discover_descs_cb,
 							discovery_op_ref(op),
 							discovery_op_unref);
-		if (client->discovery_req) {
-			*discovering = true;
-			goto done;
-		}
-
-		util_debug(client->debug_callback, client->debug_data,
-					"Failed to start descriptor discovery");
-		discovery_op_unref(op);
-
-		goto failed;
+	if (client->discovery_req) {
+		*discovering = true;
+		return true;
 	}
 
-done:
-	free(chrc_data);
-	return true;
+	util_debug(client->debug_callback, client->debug_data,
+					"Failed to start descriptor discovery");
+	discovery_op_unref(op);
 
-failed:
-	free(chrc_data);
 	return false;
 }
 
@@ -682,7 +741,6 @@ static void ext_prop_read_cb(bool success, uint8_t att_ecode,
 {
 	struct discovery_op *op = user_data;
 	struct bt_gatt_client *client = op->client;
-	bool discovering;
 	struct gatt_db_attribute *desc_attr = NULL;
 
 	util_debug(client->debug_callback, client->debug_data,
@@ -700,14 +758,8 @@ static void ext_prop_read_cb(bool success, uint8_t att_ecode,
 	if (read_ext_prop_desc(op))
 		return;
 
-	if (!discover_descs(op, &discovering))
-			goto failed;
-
-	if (discovering)
-		return;
-
-	/* Done with the current service */
-	gatt_db_service_set_active(op->cur_svc, true);
+	/* Done with the discovered services */
+	activate_discovered_services(op);
 
 	goto done;
 
@@ -726,12 +778,12 @@ static void discover_descs_cb(bool success, uint8_t att_ecode,
 	struct bt_gatt_client *client = op->client;
 	struct bt_gatt_iter iter;
 	struct gatt_db_attribute *attr;
+	struct chrc *chrc_data = NULL;
 	uint16_t handle;
 	uint128_t u128;
 	bt_uuid_t uuid;
 	char uuid_str[MAX_LEN_UUID_STR];
 	unsigned int desc_count;
-	bool discovering;
 	bt_uuid_t ext_prop_uuid;
 
 	discovery_req_clear(client);
@@ -753,11 +805,27 @@ static void discover_descs_cb(bool success, uint8_t att_ecode,
 		goto failed;
 
 	util_debug(client->debug_callback, client->debug_data,
-					"Descriptors found: %u", desc_count);
+					"Attributes found: %u", desc_count);
 
 	bt_uuid16_create(&ext_prop_uuid, GATT_CHARAC_EXT_PROPER_UUID);
 
 	while (bt_gatt_iter_next_descriptor(&iter, &handle, u128.data)) {
+		/* Move on to the characteristic owning the handle */
+		while (!chrc_data || handle > chrc_data->end_handle) {
+			free(chrc_data);
+
+			chrc_data = queue_pop_head(op->pending_chrcs);
+			if (!chrc_data)
+				goto next;
+
+			if (!insert_chrc(op, chrc_data))
+				goto failed;
+		}
+
+		/* Skip the declaration and value of the characteristics */
+		if (handle <= chrc_data->value_handle)
+			continue;
+
 		bt_uuid128_create(&uuid, u128);
 
 		/* Log debug message */
@@ -783,23 +851,25 @@ static void discover_descs_cb(bool success, uint8_t att_ecode,
 			queue_push_tail(op->ext_prop_desc, attr);
 	}
 
-	/* If we got extended prop descriptor, lets read it right away */
-	if (read_ext_prop_desc(op))
-		return;
-
 next:
-	if (!discover_descs(op, &discovering))
+	free(chrc_data);
+	chrc_data = NULL;
+
+	/* Insert the characteristics following the last descriptor */
+	if (!insert_pending_chrcs(op))
 		goto failed;
 
-	if (discovering)
+	/* If we got extended prop descriptors, lets read them now */
+	if (read_ext_prop_desc(op))
 		return;
 
-	/* Done with the current service */
-	gatt_db_service_set_active(op->cur_svc, true);
+	/* Done with the discovered services */
+	activate_discovered_services(op);
 
 	goto done;
 
 failed:
+	free(chrc_data);
 	success = false;
 
 done:
@@ -876,8 +946,8 @@ static void discover_chrcs_cb(bool success, uint8_t att_ecode,
 		return;
 
 next:
-	/* Done with the current service */
-	gatt_db_service_set_active(op->cur_svc, true);
+	/* Done with the discovered services */
+	activate_discovered_services(op);
 
 	goto done;
 
@@ -986,6 +1056,8 @@ next:
 	if (queue_isempty(op->pending_svcs))
 		goto done;
 
+	BT_TRACE2(gatt_discover_incl, op->svc_first, op->svc_last);
+
 	client->discovery_req = bt_gatt_discover_included_services(client->att,
 							op->svc_first,
 							op->svc_last,
@@ -1084,6 +1156,8 @@ secondary:
 		goto done;
 
 	/* Discover secondary services */
+	BT_TRACE2(gatt_discover_secondary, op->start, op->end);
+
 	client->discovery_req = bt_gatt_discover_secondary_services(client->att,
 						NULL, op->start, op->end,
 						discover_secondary_cb,
@@ -1119,6 +1193,8 @@ static void notify_client_ready(struct bt_gatt_client *client, bool success,
 	if (client->ready)
 		return;
 
+	BT_TRACE2(gatt_client_ready, success, att_ecode);
+
 	bt_gatt_client_ref(client);
 	client->ready = success;
 
@@ -1142,6 +1218,215 @@ static void notify_client_ready(struct bt_gatt_client *client, bool success,
 	bt_gatt_client_unref(client);
 }
 
+static void get_first_attribute(struct gatt_db_attribute *attrib,
+							void *user_data);
+
+static struct gatt_db_attribute *find_attribute_by_uuid16(
+						struct bt_gatt_client *client,
+						uint16_t uuid16)
+{
+	struct gatt_db_attribute *attr = NULL;
+	bt_uuid_t uuid;
+
+	bt_uuid16_create(&uuid, uuid16);
+
+	gatt_db_find_by_type(client->db, 0x0001, 0xffff, &uuid,
+						get_first_attribute, &attr);
+
+	return attr;
+}
+
+static void db_hash_value_cb(struct gatt_db_attribute *attrib, int err,
+					const uint8_t *value, size_t length,
+					void *user_data)
+{
+	struct iovec *iov = user_data;
+
+	if (err)
+		return;
+
+	iov->iov_base = (void *) value;
+	iov->iov_len = length;
+}
+
+static bool get_cached_db_hash(struct bt_gatt_client *client,
+							struct iovec *iov)
+{
+	struct gatt_db_attribute *attr;
+
+	attr = find_attribute_by_uuid16(client, DB_HASH_UUID);
+	if (!attr)
+		return false;
+
+	iov->iov_base = NULL;
+	iov->iov_len = 0;
+
+	/* Values of the client database are stored, so this is synchronous */
+	if (!gatt_db_attribute_read(attr, 0, 0, NULL, db_hash_value_cb, iov))
+		return false;
+
+	return iov->iov_len == DB_HASH_LEN;
+}
+
+static void db_hash_write_cb(struct gatt_db_attribute *attrib, int err,
+							void *user_data)
+{
+}
+
+static void store_db_hash(struct discovery_op *op)
+{
+	struct gatt_db_attribute *attr;
+
+	if (!op->db_hash_valid)
+		return;
+
+	attr = find_attribute_by_uuid16(op->client, DB_HASH_UUID);
+	if (!attr)
+		return;
+
+	gatt_db_attribute_write(attr, 0, op->db_hash, DB_HASH_LEN, 0, NULL,
+						db_hash_write_cb, NULL);
+}
+
+static bool discover_primary(struct discovery_op *op)
+{
+	struct bt_gatt_client *client = op->client;
+
+	BT_TRACE2(gatt_discover_primary, op->start, op->end);
+
+	client->discovery_req = bt_gatt_discover_all_primary_services(
+							client->att, NULL,
+							discover_primary_cb,
+							discovery_op_ref(op),
+							discovery_op_unref);
+	if (client->discovery_req)
+		return true;
+
+	discovery_op_unref(op);
+
+	return false;
+}
+
+static void cache_valid(struct discovery_op *op)
+{
+	util_debug(op->client->debug_callback, op->client->debug_data,
+					"Using cached attribute database");
+
+	/* Nothing is pending, everything in the cache is still there */
+	queue_remove_all(op->pending_svcs, NULL, NULL, NULL);
+	op->last = UINT16_MAX;
+
+	discovery_op_complete(op, true, 0);
+}
+
+static void db_hash_read_cb(bool success, uint8_t att_ecode,
+						struct bt_gatt_result *result,
+						void *user_data)
+{
+	struct discovery_op *op = user_data;
+	struct bt_gatt_client *client = op->client;
+	struct bt_gatt_iter iter;
+	struct iovec cached;
+	const uint8_t *value;
+	uint16_t handle, length;
+	bool has_hash;
+
+	/* Don't touch the cache if the request didn't make it through */
+	if (!success && !att_ecode) {
+		client->in_init = false;
+		notify_client_ready(client, false, att_ecode);
+		return;
+	}
+
+	if (success && result && bt_gatt_iter_init(&iter, result) &&
+			bt_gatt_iter_next_read_by_type(&iter, &handle,
+							&length, &value) &&
+			length == DB_HASH_LEN) {
+		memcpy(op->db_hash, value, DB_HASH_LEN);
+		op->db_hash_valid = true;
+	}
+
+	has_hash = get_cached_db_hash(client, &cached);
+	if (has_hash) {
+		if (op->db_hash_valid && !memcmp(cached.iov_base, op->db_hash,
+							DB_HASH_LEN)) {
+			cache_valid(op);
+			return;
+		}
+
+		/*
+		 * The database has changed since it was cached, since there is
+		 * no way to tell what changed discover everything again.
+		 */
+		util_debug(client->debug_callback, client->debug_data,
+					"Database Hash mismatch, clearing cache");
+		gatt_db_unregister(client->db, op->db_id);
+		op->db_id = 0;
+		queue_remove_all(op->pending_svcs, NULL, NULL, NULL);
+		gatt_db_clear(client->db);
+		op->last = 0;
+		goto discover;
+	}
+
+	/*
+	 * Without a hash to compare, a bonded peer shall indicate Service
+	 * Changed on reconnection if its database has changed, so the cache
+	 * can be trusted as long as it has the characteristic.
+	 */
+	if (client->trust_cache &&
+			find_attribute_by_uuid16(client, SVC_CHNGD_UUID)) {
+		cache_valid(op);
+		return;
+	}
+
+discover:
+	if (discover_primary(op))
+		return;
+
+	util_debug(client->debug_callback, client->debug_data,
+			"Failed to initiate primary service discovery");
+
+	client->in_init = false;
+	notify_client_ready(client, false, att_ecode);
+}
+
+/*
+ * Validate a preloaded database with a single Read By Type of the Database
+ * Hash instead of rediscovering all services. Only attempted if the cache
+ * has something to validate against.
+ */
+static bool discovery_from_cache(struct discovery_op *op)
+{
+	struct bt_gatt_client *client = op->client;
+	struct gatt_db_attribute *attr;
+	uint16_t start = 0x0001, end = 0xffff;
+	bt_uuid_t uuid;
+
+	if (gatt_db_isempty(client->db))
+		return false;
+
+	/* If the handle is known read just that so it takes one request */
+	attr = find_attribute_by_uuid16(client, DB_HASH_UUID);
+	if (attr) {
+		start = gatt_db_attribute_get_handle(attr);
+		end = start;
+	} else if (!client->trust_cache ||
+			!find_attribute_by_uuid16(client, SVC_CHNGD_UUID))
+		return false;
+
+	bt_uuid16_create(&uuid, DB_HASH_UUID);
+
+	if (bt_gatt_read_by_type(client->att, start, end, &uuid,
+						db_hash_read_cb,
+						discovery_op_ref(op),
+						discovery_op_unref))
+		return true;
+
+	discovery_op_unref(op);
+
+	return false;
+}
+
 static void exchange_mtu_cb(bool success, uint8_t att_ecode, void *user_data)
 {
 	struct discovery_op *op = user_data;
@@ -1175,12 +1460,7 @@ static void exchange_mtu_cb(bool success, uint8_t att_ecode, void *user_data)
 					bt_att_get_mtu(client->att));
 
 discover:
-	client->discovery_req = bt_gatt_discover_all_primary_services(
-							client->att, NULL,
-							discover_primary_cb,
-							discovery_op_ref(op),
-							discovery_op_unref);
-	if (client->discovery_req)
+	if (discovery_from_cache(op) || discover_primary(op))
 		return;
 
 	util_debug(client->debug_callback, client->debug_data,
@@ -1188,8 +1468,6 @@ discover:
 
 	client->in_init = false;
 	notify_client_ready(client, false, att_ecode);
-
-	discovery_op_unref(op);
 }
 
 struct service_changed_op {
@@ -1578,6 +1856,8 @@ static void init_complete(struct discovery_op *op, bool success,
 	if (!success)
 		goto fail;
 
+	store_db_hash(op);
+
 	if (register_service_changed(client))
 		goto done;
 
@@ -1638,16 +1918,15 @@ static bool gatt_client_init(struct bt_gatt_client *client, uint16_t mtu)
 	return true;
 
 discover:
-	client->discovery_req = bt_gatt_discover_all_primary_services(
-							client->att, NULL,
-							discover_primary_cb,
-							discovery_op_ref(op),
-							discovery_op_unref);
-	if (!client->discovery_req) {
+	discovery_op_ref(op);
+
+	if (!discovery_from_cache(op) && !discover_primary(op)) {
 		discovery_op_free(op);
 		return false;
 	}
 
+	discovery_op_unref(op);
+
 	client->in_init = true;
 	return true;
 }
@@ -1841,6 +2120,14 @@ fail:
 struct bt_gatt_client *bt_gatt_client_new(struct gatt_db *db,
 							struct bt_att *att,
 							uint16_t mtu)
+{
+	return bt_gatt_client_new_cached(db, att, mtu, false);
+}
+
+struct bt_gatt_client *bt_gatt_client_new_cached(struct gatt_db *db,
+							struct bt_att *att,
+							uint16_t mtu,
+							bool bonded)
 {
 	struct bt_gatt_client *client;
 
@@ -1851,6 +2138,8 @@ struct bt_gatt_client *bt_gatt_client_new(struct gatt_db *db,
 	if (!client)
 		return NULL;
 
+	client->trust_cache = bonded;
+
 	if (!gatt_client_init(client, mtu)) {
 		bt_gatt_client_free(client);
 		return NULL;
@@ -2264,6 +2553,7 @@ struct read_long_op {
 	uint16_t value_handle;
 	uint16_t offset;
 	struct iovec iov;
+	size_t iov_size;
 	bt_gatt_client_read_callback_t callback;
 	void *user_data;
 	bt_gatt_client_destroy_func_t destroy;
@@ -2281,19 +2571,34 @@ static void destroy_read_long_op(void *data)
 }
 
 static bool append_chunk(struct read_long_op *op, const uint8_t *data,
-								uint16_t len)
+						uint16_t len, bool more)
 {
 	void *buf;
+	size_t size;
 
 	/* Truncate if the data would exceed maximum length */
 	if (op->offset + len > BT_ATT_MAX_VALUE_LEN)
 		len = BT_ATT_MAX_VALUE_LEN - op->offset;
 
-	buf = realloc(op->iov.iov_base, op->iov.iov_len + len);
-	if (!buf)
-		return false;
+	if (op->iov.iov_len + len > op->iov_size) {
+		/*
+		 * A full sized chunk means Read Blob follows, so size the
+		 * buffer for the largest possible value at once instead of
+		 * growing it on every response.
+		 */
+		if (more)
+			size = op->iov.iov_len + BT_ATT_MAX_VALUE_LEN -
+								op->offset;
+		else
+			size = op->iov.iov_len + len;
 
-	op->iov.iov_base = buf;
+		buf = realloc(op->iov.iov_base, size);
+		if (!buf)
+			return false;
+
+		op->iov.iov_base = buf;
+		op->iov_size = size;
+	}
 
 	memcpy(op->iov.iov_base + op->iov.iov_len, data, len);
 
@@ -2308,7 +2613,7 @@ static void read_long_cb(uint8_t opcode, const void *pdu,
 {
 	struct request *req = user_data;
 	struct read_long_op *op = req->data;
-	bool success;
+	bool success, more;
 	uint8_t att_ecode = 0;
 
 	if (opcode == BT_ATT_OP_ERROR_RSP) {
@@ -2327,7 +2632,9 @@ static void read_long_cb(uint8_t opcode, const void *pdu,
 	if (!length)
 		goto success;
 
-	if (!append_chunk(op, pdu, length)) {
+	more = length >= bt_att_get_mtu(op->client->att) - 1;
+
+	if (!append_chunk(op, pdu, length, more)) {
 		success = false;
 		goto done;
 	}
@@ -2335,7 +2642,7 @@ static void read_long_cb(uint8_t opcode, const void *pdu,
 	if (op->offset >= BT_ATT_MAX_VALUE_LEN)
 		goto success;
 
-	if (length >= bt_att_get_mtu(op->client->att) - 1) {
+	if (more) {
 		uint8_t pdu[4];
 
 		put_le16(op->value_handle, pdu);
@@ -2471,6 +2778,45 @@ unsigned int bt_gatt_client_write_without_response(
 	return req->id;
 }
 
+bool bt_gatt_client_set_write_window(struct bt_gatt_client *client,
+							unsigned int window)
+{
+	if (!client)
+		return false;
+
+	return bt_att_set_cmd_window(client->att, window);
+}
+
+unsigned int bt_gatt_client_get_write_credits(struct bt_gatt_client *client)
+{
+	if (!client)
+		return 0;
+
+	return bt_att_get_cmd_credits(client->att);
+}
+
+unsigned int bt_gatt_client_register_write_ready(
+				struct bt_gatt_client *client,
+				bt_gatt_client_write_ready_func_t callback,
+				void *user_data,
+				bt_gatt_client_destroy_func_t destroy)
+{
+	if (!client)
+		return 0;
+
+	return bt_att_register_ready(client->att, callback, user_data,
+								destroy);
+}
+
+bool bt_gatt_client_unregister_write_ready(struct bt_gatt_client *client,
+							unsigned int id)
+{
+	if (!client)
+		return false;
+
+	return bt_att_unregister_ready(client->att, id);
+}
+
 struct write_op {
 	struct bt_gatt_client *client;
 	bt_gatt_client_callback_t callback;
@@ -2567,6 +2913,8 @@ struct long_write_op {
 	uint16_t offset;
 	uint16_t index;
 	uint16_t cur_length;
+	uint8_t *pdu;
+	uint16_t pdu_size;
 	bt_gatt_client_write_long_callback_t callback;
 	void *user_data;
 	bt_gatt_client_destroy_func_t destroy;
@@ -2579,10 +2927,37 @@ static void long_write_op_free(void *data)
 	if (op->destroy)
 		op->destroy(op->user_data);
 
+	free(op->pdu);
 	free(op->value);
 	free(op);
 }
 
+/*
+ * Build the Prepare Write Request for the current chunk. The buffer is kept
+ * for the whole procedure and only grows if the MTU does.
+ */
+static uint8_t *build_prep_write_pdu(struct long_write_op *op)
+{
+	uint16_t len = op->cur_length + 4;
+
+	if (len > op->pdu_size) {
+		uint8_t *pdu;
+
+		pdu = realloc(op->pdu, len);
+		if (!pdu)
+			return NULL;
+
+		op->pdu = pdu;
+		op->pdu_size = len;
+	}
+
+	put_le16(op->value_handle, op->pdu);
+	put_le16(op->offset + op->index, op->pdu + 2);
+	memcpy(op->pdu + 4, op->value + op->index, op->cur_length);
+
+	return op->pdu;
+}
+
 static void prepare_write_cb(uint8_t opcode, const void *pdu, uint16_t length,
 							void *user_data);
 static void complete_write_long_op(struct request *req, bool success,
@@ -2594,16 +2969,12 @@ static void handle_next_prep_write(struct request *req)
 	bool success = true;
 	uint8_t *pdu;
 
-	pdu = malloc(op->cur_length + 4);
+	pdu = build_prep_write_pdu(op);
 	if (!pdu) {
 		success = false;
 		goto done;
 	}
 
-	put_le16(op->value_handle, pdu);
-	put_le16(op->offset + op->index, pdu + 2);
-	memcpy(pdu + 4, op->value + op->index, op->cur_length);
-
 	req->att_id = bt_att_send(op->client->att, BT_ATT_OP_PREP_WRITE_REQ,
 							pdu, op->cur_length + 4,
 							prepare_write_cb,
@@ -2614,8 +2985,6 @@ static void handle_next_prep_write(struct request *req)
 		success = false;
 	}
 
-	free(pdu);
-
 	/* If so far successful, then the operation should continue.
 	 * Otherwise, there was an error and the procedure should be
 	 * completed.
@@ -2832,22 +3201,17 @@ unsigned int bt_gatt_client_write_long_value(struct bt_gatt_client *client,
 		return req->id;
 	}
 
-	pdu = malloc(op->cur_length + 4);
+	pdu = build_prep_write_pdu(op);
 	if (!pdu) {
-		free(op->value);
-		free(op);
+		op->destroy = NULL;
+		request_unref(req);
 		return 0;
 	}
 
-	put_le16(value_handle, pdu);
-	put_le16(offset, pdu + 2);
-	memcpy(pdu + 4, op->value, op->cur_length);
-
 	req->att_id = bt_att_send(client->att, BT_ATT_OP_PREP_WRITE_REQ,
 							pdu, op->cur_length + 4,
 							prepare_write_cb, req,
 							request_unref);
-	free(pdu);
 
 	if (!req->att_id) {
 		op->destroy = NULL;
@@ -32,6 +32,10 @@ struct bt_gatt_client;
 struct bt_gatt_client *bt_gatt_client_new(struct gatt_db *db,
 							struct bt_att *att,
 							uint16_t mtu);
+struct bt_gatt_client *bt_gatt_client_new_cached(struct gatt_db *db,
+							struct bt_att *att,
+							uint16_t mtu,
+							bool bonded);
 struct bt_gatt_client *bt_gatt_client_clone(struct bt_gatt_client *client);
 
 struct bt_gatt_client *bt_gatt_client_ref(struct bt_gatt_client *client);
@@ -41,6 +45,7 @@ typedef void (*bt_gatt_client_destroy_func_t)(void *user_data);
 typedef void (*bt_gatt_client_callback_t)(bool success, uint8_t att_ecode,
 							void *user_data);
 typedef void (*bt_gatt_client_debug_func_t)(const char *str, void *user_data);
+typedef void (*bt_gatt_client_write_ready_func_t)(void *user_data);
 typedef void (*bt_gatt_client_read_callback_t)(bool success, uint8_t att_ecode,
 					const uint8_t *value, uint16_t length,
 					void *user_data);
@@ -99,6 +104,16 @@ unsigned int bt_gatt_client_write_without_response(
 					uint16_t value_handle,
 					bool signed_write,
 					const uint8_t *value, uint16_t length);
+bool bt_gatt_client_set_write_window(struct bt_gatt_client *client,
+							unsigned int window);
+unsigned int bt_gatt_client_get_write_credits(struct bt_gatt_client *client);
+unsigned int bt_gatt_client_register_write_ready(
+				struct bt_gatt_client *client,
+				bt_gatt_client_write_ready_func_t callback,
+				void *user_data,
+				bt_gatt_client_destroy_func_t destroy);
+bool bt_gatt_client_unregister_write_ready(struct bt_gatt_client *client,
+							unsigned int id);
 unsigned int bt_gatt_client_write_value(struct bt_gatt_client *client,
 					uint16_t value_handle,
 					const uint8_t *value, uint16_t length,
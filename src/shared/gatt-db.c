@@ -43,6 +43,7 @@
 #define MAX_CHAR_DECL_VALUE_LEN 19
 #define MAX_INCLUDED_VALUE_LEN 6
 #define ATTRIBUTE_TIMEOUT 5000
+#define INDEX_MIN_SIZE 64
 
 static const bt_uuid_t primary_service_uuid = { .type = BT_UUID16,
 					.value.u16 = GATT_PRIM_SVC_UUID };
@@ -60,6 +61,10 @@ struct gatt_db {
 	uint16_t next_handle;
 	struct queue *services;
 
+	bool index_enabled;
+	unsigned int index_size;
+	struct gatt_db_attribute **index;	/* Handle to attribute index */
+
 	struct queue *notify_list;
 	unsigned int next_notify_id;
 };
@@ -92,6 +97,7 @@ struct gatt_db_attribute {
 	struct gatt_db_service *service;
 	uint16_t handle;
 	bt_uuid_t uuid;
+	unsigned int uuid_id;
 	uint32_t permissions;
 	uint16_t value_len;
 	uint8_t *value;
@@ -177,6 +183,12 @@ static struct gatt_db_attribute *new_attribute(struct gatt_db_service *service,
 	attribute->handle = handle;
 	attribute->uuid = *type;
 	attribute->value_len = len;
+
+	/* Type lookups compare the interned identifiers of the UUIDs */
+	attribute->uuid_id = bt_uuid_intern(type);
+	if (!attribute->uuid_id)
+		goto failed;
+
 	if (len) {
 		attribute->value = malloc0(len);
 		if (!attribute->value)
@@ -195,6 +207,70 @@ failed:
 	return NULL;
 }
 
+static bool index_grow(struct gatt_db *db, uint16_t handle)
+{
+	struct gatt_db_attribute **index;
+	unsigned int size;
+
+	if (handle < db->index_size)
+		return true;
+
+	size = db->index_size ? db->index_size : INDEX_MIN_SIZE;
+	while (size <= handle)
+		size <<= 1;
+
+	index = realloc(db->index, size * sizeof(*index));
+	if (!index)
+		return false;
+
+	memset(index + db->index_size, 0,
+			(size - db->index_size) * sizeof(*index));
+
+	db->index = index;
+	db->index_size = size;
+
+	return true;
+}
+
+static void index_attribute(struct gatt_db_attribute *attribute)
+{
+	struct gatt_db *db = attribute->service->db;
+
+	if (!db || !db->index_enabled)
+		return;
+
+	if (!index_grow(db, attribute->handle)) {
+		/* Fall back to walking the services */
+		gatt_db_set_handle_index(db, false);
+		return;
+	}
+
+	db->index[attribute->handle] = attribute;
+}
+
+static void unindex_attribute(struct gatt_db_attribute *attribute)
+{
+	struct gatt_db *db = attribute->service->db;
+
+	if (!db || !db->index_enabled)
+		return;
+
+	if (attribute->handle < db->index_size &&
+				db->index[attribute->handle] == attribute)
+		db->index[attribute->handle] = NULL;
+}
+
+static void index_service(void *data, void *user_data)
+{
+	struct gatt_db_service *service = data;
+	int i;
+
+	for (i = 0; i < service->num_handles; i++) {
+		if (service->attributes[i])
+			index_attribute(service->attributes[i]);
+	}
+}
+
 struct gatt_db *gatt_db_ref(struct gatt_db *db)
 {
 	if (!db)
@@ -278,8 +354,12 @@ static void gatt_db_service_destroy(void *data)
 	if (service->active)
 		notify_service_changed(service->db, service, false);
 
-	for (i = 0; i < service->num_handles; i++)
+	for (i = 0; i < service->num_handles; i++) {
+		if (service->attributes[i])
+			unindex_attribute(service->attributes[i]);
+
 		attribute_destroy(service->attributes[i]);
+	}
 
 	free(service->attributes);
 	free(service);
@@ -298,6 +378,7 @@ static void gatt_db_destroy(struct gatt_db *db)
 	db->notify_list = NULL;
 
 	queue_destroy(db->services, gatt_db_service_destroy);
+	free(db->index);
 	free(db);
 }
 
@@ -320,6 +401,64 @@ bool gatt_db_isempty(struct gatt_db *db)
 	return queue_isempty(db->services);
 }
 
+size_t gatt_db_get_footprint(struct gatt_db *db)
+{
+	const struct queue_entry *entry;
+	size_t size;
+
+	if (!db)
+		return 0;
+
+	size = sizeof(*db) + db->index_size * sizeof(*db->index);
+	size += queue_get_footprint(db->services);
+	size += queue_get_footprint(db->notify_list);
+	size += queue_length(db->notify_list) * sizeof(struct notify);
+
+	for (entry = queue_get_entries(db->services); entry;
+							entry = entry->next) {
+		struct gatt_db_service *service = entry->data;
+		unsigned int i;
+
+		size += sizeof(*service);
+		size += service->num_handles * sizeof(*service->attributes);
+
+		for (i = 0; i < service->num_handles; i++) {
+			struct gatt_db_attribute *attr = service->attributes[i];
+
+			if (!attr)
+				continue;
+
+			size += sizeof(*attr) + attr->value_len;
+			size += queue_get_footprint(attr->pending_reads);
+			size += queue_get_footprint(attr->pending_writes);
+		}
+	}
+
+	return size;
+}
+
+bool gatt_db_set_handle_index(struct gatt_db *db, bool enable)
+{
+	if (!db)
+		return false;
+
+	if (db->index_enabled == enable)
+		return true;
+
+	db->index_enabled = enable;
+
+	if (enable) {
+		queue_foreach(db->services, index_service, NULL);
+		return db->index_enabled;
+	}
+
+	free(db->index);
+	db->index = NULL;
+	db->index_size = 0;
+
+	return true;
+}
+
 static int uuid_to_le(const bt_uuid_t *uuid, uint8_t *dst)
 {
 	bt_uuid_t uuid128;
@@ -556,6 +695,8 @@ struct gatt_db_attribute *gatt_db_insert_service(struct gatt_db *db,
 	service->attributes[0]->handle = handle;
 	service->num_handles = num_handles;
 
+	index_attribute(service->attributes[0]);
+
 	/* Fast-forward next_handle if the new service was added to the end */
 	db->next_handle = MAX(handle + num_handles, db->next_handle);
 
@@ -729,6 +870,9 @@ service_insert_characteristic(struct gatt_db_service *service,
 	set_attribute_data(service->attributes[i], read_func, write_func,
 							permissions, user_data);
 
+	index_attribute(service->attributes[i - 1]);
+	index_attribute(service->attributes[i]);
+
 	return service->attributes[i];
 }
 
@@ -820,6 +964,8 @@ service_insert_descriptor(struct gatt_db_service *service,
 	set_attribute_data(service->attributes[i], read_func, write_func,
 							permissions, user_data);
 
+	index_attribute(service->attributes[i]);
+
 	return service->attributes[i];
 }
 
@@ -931,7 +1077,11 @@ service_insert_included(struct gatt_db_service *service, uint16_t handle,
 	 */
 	set_attribute_data(service->attributes[index], NULL, NULL, 0, NULL);
 
-	return attribute_update(service, index);
+	include = attribute_update(service, index);
+
+	index_attribute(include);
+
+	return include;
 }
 
 struct gatt_db_attribute *
@@ -1058,7 +1208,7 @@ next_service:
 }
 
 struct find_by_type_value_data {
-	bt_uuid_t uuid;
+	unsigned int uuid_id;
 	uint16_t start_handle;
 	uint16_t end_handle;
 	gatt_db_attribute_cb_t func;
@@ -1088,7 +1238,7 @@ static void find_by_type(void *data, void *user_data)
 				(attribute->handle > search_data->end_handle))
 			continue;
 
-		if (bt_uuid_cmp(&search_data->uuid, &attribute->uuid))
+		if (search_data->uuid_id != attribute->uuid_id)
 			continue;
 
 		/* TODO: fix for read-callback based attributes */
@@ -1117,7 +1267,11 @@ unsigned int gatt_db_find_by_type(struct gatt_db *db, uint16_t start_handle,
 
 	memset(&data, 0, sizeof(data));
 
-	data.uuid = *type;
+	/* No attribute can have a type which was never interned */
+	data.uuid_id = bt_uuid_intern_lookup(type);
+	if (!data.uuid_id)
+		return 0;
+
 	data.start_handle = start_handle;
 	data.end_handle = end_handle;
 	data.func = func;
@@ -1139,7 +1293,10 @@ unsigned int gatt_db_find_by_type_value(struct gatt_db *db,
 {
 	struct find_by_type_value_data data;
 
-	data.uuid = *type;
+	data.uuid_id = bt_uuid_intern_lookup(type);
+	if (!data.uuid_id)
+		return 0;
+
 	data.start_handle = start_handle;
 	data.end_handle = end_handle;
 	data.func = func;
@@ -1154,7 +1311,7 @@ unsigned int gatt_db_find_by_type_value(struct gatt_db *db,
 
 struct read_by_type_data {
 	struct queue *queue;
-	bt_uuid_t uuid;
+	unsigned int uuid_id;
 	uint16_t start_handle;
 	uint16_t end_handle;
 };
@@ -1180,7 +1337,7 @@ static void read_by_type(void *data, void *user_data)
 		if (attribute->handle > search_data->end_handle)
 			return;
 
-		if (bt_uuid_cmp(&search_data->uuid, &attribute->uuid))
+		if (search_data->uuid_id != attribute->uuid_id)
 			continue;
 
 		queue_push_tail(search_data->queue, attribute);
@@ -1193,7 +1350,11 @@ void gatt_db_read_by_type(struct gatt_db *db, uint16_t start_handle,
 						struct queue *queue)
 {
 	struct read_by_type_data data;
-	data.uuid = type;
+
+	data.uuid_id = bt_uuid_intern_lookup(&type);
+	if (!data.uuid_id)
+		return;
+
 	data.start_handle = start_handle;
 	data.end_handle = end_handle;
 	data.queue = queue;
@@ -1408,6 +1569,10 @@ struct gatt_db_attribute *gatt_db_get_service(struct gatt_db *db,
 	if (!db || !handle)
 		return NULL;
 
+	if (db->index_enabled && handle < db->index_size &&
+							db->index[handle])
+		return db->index[handle]->service->attributes[0];
+
 	service = queue_find(db->services, find_service_for_handle,
 						UINT_TO_PTR(handle));
 	if (!service)
@@ -1423,6 +1588,13 @@ struct gatt_db_attribute *gatt_db_get_attribute(struct gatt_db *db,
 	struct gatt_db_service *service;
 	int i;
 
+	if (db && db->index_enabled) {
+		if (handle < db->index_size)
+			return db->index[handle];
+
+		return NULL;
+	}
+
 	attrib = gatt_db_get_service(db, handle);
 	if (!attrib)
 		return NULL;
@@ -31,6 +31,11 @@ void gatt_db_unref(struct gatt_db *db);
 
 bool gatt_db_isempty(struct gatt_db *db);
 
+/* Approximate number of bytes allocated for the database */
+size_t gatt_db_get_footprint(struct gatt_db *db);
+
+bool gatt_db_set_handle_index(struct gatt_db *db, bool enable);
+
 struct gatt_db_attribute *gatt_db_add_service(struct gatt_db *db,
 						const bt_uuid_t *uuid,
 						bool primary,
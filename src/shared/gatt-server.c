@@ -51,6 +51,13 @@
  */
 #define DEFAULT_MAX_PREP_QUEUE_LEN 30
 
+/*
+ * Maximum number of discovery responses kept per database. Discovery of a
+ * database is a short and well known sequence of requests so this covers the
+ * requests issued by clients using the usual MTU sizes.
+ */
+#define DISC_CACHE_MAX_ENTRIES 64
+
 struct async_read_op {
 	struct bt_gatt_server *server;
 	uint8_t opcode;
@@ -66,6 +73,31 @@ struct async_write_op {
 	uint8_t opcode;
 };
 
+/*
+ * Discovery responses only depend on the database layout, so they are shared
+ * by all servers using the same database and dropped whenever a service is
+ * added or removed.
+ */
+struct disc_cache {
+	struct gatt_db *db;
+	int ref_count;
+	unsigned int db_id;
+	struct queue *entries;
+};
+
+struct disc_cache_entry {
+	uint8_t opcode;
+	uint16_t start;
+	uint16_t end;
+	uint16_t mtu;
+	uint16_t type;
+	uint8_t ecode;
+	uint16_t len;
+	uint8_t pdu[0];
+};
+
+static struct queue *disc_caches;
+
 struct prep_write_data {
 	struct bt_gatt_server *server;
 	uint8_t *value;
@@ -109,11 +141,184 @@ struct bt_gatt_server {
 	struct async_read_op *pending_read_op;
 	struct async_write_op *pending_write_op;
 
+	struct disc_cache *disc_cache;
+
+	struct queue *pending_notify;	/* Notifications not yet written */
+	struct queue *conflate_handles;
+	unsigned int max_notify_queue_len;
+
 	bt_gatt_server_debug_func_t debug_callback;
 	bt_gatt_server_destroy_func_t debug_destroy;
 	void *debug_data;
 };
 
+static void disc_cache_clear(struct gatt_db_attribute *attrib,
+							void *user_data)
+{
+	struct disc_cache *cache = user_data;
+
+	queue_remove_all(cache->entries, NULL, NULL, free);
+}
+
+static bool match_disc_cache_db(const void *a, const void *b)
+{
+	const struct disc_cache *cache = a;
+
+	return cache->db == b;
+}
+
+static struct disc_cache *disc_cache_ref(struct gatt_db *db)
+{
+	struct disc_cache *cache;
+
+	if (!disc_caches)
+		disc_caches = queue_new();
+
+	cache = queue_find(disc_caches, match_disc_cache_db, db);
+	if (cache) {
+		cache->ref_count++;
+		return cache;
+	}
+
+	cache = new0(struct disc_cache, 1);
+	cache->db = db;
+	cache->entries = queue_new();
+	cache->db_id = gatt_db_register(db, disc_cache_clear,
+						disc_cache_clear, cache, NULL);
+	if (!cache->db_id) {
+		queue_destroy(cache->entries, NULL);
+		free(cache);
+		return NULL;
+	}
+
+	cache->ref_count = 1;
+	queue_push_tail(disc_caches, cache);
+
+	return cache;
+}
+
+static void disc_cache_unref(struct disc_cache *cache)
+{
+	if (!cache || --cache->ref_count)
+		return;
+
+	gatt_db_unregister(cache->db, cache->db_id);
+	queue_destroy(cache->entries, free);
+	queue_remove(disc_caches, cache);
+	free(cache);
+
+	if (queue_isempty(disc_caches)) {
+		queue_destroy(disc_caches, NULL);
+		disc_caches = NULL;
+	}
+}
+
+struct disc_cache_match {
+	uint8_t opcode;
+	uint16_t start;
+	uint16_t end;
+	uint16_t mtu;
+	uint16_t type;
+};
+
+static bool match_disc_cache_entry(const void *a, const void *b)
+{
+	const struct disc_cache_entry *entry = a;
+	const struct disc_cache_match *match = b;
+
+	return entry->opcode == match->opcode &&
+				entry->start == match->start &&
+				entry->end == match->end &&
+				entry->mtu == match->mtu &&
+				entry->type == match->type;
+}
+
+static struct disc_cache_entry *disc_cache_lookup(struct disc_cache *cache,
+						uint8_t opcode, uint16_t start,
+						uint16_t end, uint16_t mtu,
+						uint16_t type)
+{
+	struct disc_cache_match match;
+
+	if (!cache)
+		return NULL;
+
+	match.opcode = opcode;
+	match.start = start;
+	match.end = end;
+	match.mtu = mtu;
+	match.type = type;
+
+	return queue_find(cache->entries, match_disc_cache_entry, &match);
+}
+
+static void disc_cache_add(struct disc_cache *cache, uint8_t opcode,
+					uint16_t start, uint16_t end,
+					uint16_t mtu, uint16_t type,
+					uint8_t ecode, const uint8_t *pdu,
+					uint16_t len)
+{
+	struct disc_cache_entry *entry;
+
+	if (!cache)
+		return;
+
+	if (queue_length(cache->entries) >= DISC_CACHE_MAX_ENTRIES) {
+		entry = queue_peek_tail(cache->entries);
+		queue_remove(cache->entries, entry);
+		free(entry);
+	}
+
+	entry = malloc(sizeof(*entry) + len);
+	if (!entry)
+		return;
+
+	entry->opcode = opcode;
+	entry->start = start;
+	entry->end = end;
+	entry->mtu = mtu;
+	entry->type = type;
+	entry->ecode = ecode;
+	entry->len = len;
+
+	if (len)
+		memcpy(entry->pdu, pdu, len);
+
+	queue_push_head(cache->entries, entry);
+}
+
+struct notify_op {
+	struct bt_gatt_server *server;
+	uint16_t handle;
+	unsigned int id;
+	uint8_t *pdu;
+};
+
+static void notify_op_destroy(void *user_data)
+{
+	struct notify_op *op = user_data;
+
+	if (op->server)
+		queue_remove(op->server->pending_notify, op);
+
+	free(op->pdu);
+	free(op);
+}
+
+static void notify_op_detach(void *data, void *user_data)
+{
+	struct notify_op *op = data;
+
+	op->server = NULL;
+}
+
+static bool match_notify_op_handle(const void *a, const void *b)
+{
+	const struct notify_op *op = a;
+
+	return op->handle == PTR_TO_UINT(b);
+}
+
 static void bt_gatt_server_free(struct bt_gatt_server *server)
 {
 	if (server->debug_destroy)
@@ -140,6 +345,13 @@ static void bt_gatt_server_free(struct bt_gatt_server *server)
 
 	queue_destroy(server->prep_queue, prep_write_data_destroy);
 
+	disc_cache_unref(server->disc_cache);
+
+	/* Queued notifications are owned by bt_att from now on */
+	queue_foreach(server->pending_notify, notify_op_detach, NULL);
+	queue_destroy(server->pending_notify, NULL);
+	queue_destroy(server->conflate_handles, NULL);
+
 	gatt_db_unref(server->db);
 	bt_att_unref(server->att);
 	free(server);
@@ -244,9 +456,11 @@ static void read_by_grp_type_cb(uint8_t opcode, const void *pdu,
 	uint16_t mtu = bt_att_get_mtu(server->att);
 	uint8_t rsp_pdu[mtu];
 	uint16_t rsp_len;
+	uint16_t svc_type;
 	uint8_t ecode = 0;
 	uint16_t ehandle = 0;
 	struct queue *q = NULL;
+	struct disc_cache_entry *entry;
 
 	if (length != 6 && length != 20) {
 		ecode = BT_ATT_ERROR_INVALID_PDU;
@@ -288,10 +502,35 @@ static void read_by_grp_type_cb(uint8_t opcode, const void *pdu,
 		goto error;
 	}
 
+	/*
+	 * Key the cache on the resolved group type, since the 128-bit forms
+	 * of both service UUIDs have no meaningful 16-bit value.
+	 */
+	svc_type = bt_uuid_cmp(&type, &prim) ? GATT_SND_SVC_UUID :
+							GATT_PRIM_SVC_UUID;
+
+	entry = disc_cache_lookup(server->disc_cache, opcode, start, end, mtu,
+								svc_type);
+	if (entry) {
+		ecode = entry->ecode;
+		if (ecode)
+			goto error;
+
+		queue_destroy(q, NULL);
+
+		bt_att_send(server->att, BT_ATT_OP_READ_BY_GRP_TYPE_RSP,
+						entry->pdu, entry->len,
+						NULL, NULL, NULL);
+
+		return;
+	}
+
 	gatt_db_read_by_group_type(server->db, start, end, type, q);
 
 	if (queue_isempty(q)) {
 		ecode = BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND;
+		disc_cache_add(server->disc_cache, opcode, start, end, mtu,
+					svc_type, ecode, NULL, 0);
 		goto error;
 	}
 
@@ -303,6 +542,9 @@ static void read_by_grp_type_cb(uint8_t opcode, const void *pdu,
 
 	queue_destroy(q, NULL);
 
+	disc_cache_add(server->disc_cache, opcode, start, end, mtu,
+					svc_type, 0, rsp_pdu, rsp_len);
+
 	bt_att_send(server->att, BT_ATT_OP_READ_BY_GRP_TYPE_RSP,
 							rsp_pdu, rsp_len,
 							NULL, NULL, NULL);
@@ -582,6 +824,7 @@ static void find_info_cb(uint8_t opcode, const void *pdu,
 	uint8_t ecode = 0;
 	uint16_t ehandle = 0;
 	struct queue *q = NULL;
+	struct disc_cache_entry *entry;
 
 	if (length != 4) {
 		ecode = BT_ATT_ERROR_INVALID_PDU;
@@ -609,10 +852,26 @@ static void find_info_cb(uint8_t opcode, const void *pdu,
 		goto error;
 	}
 
+	entry = disc_cache_lookup(server->disc_cache, opcode, start, end, mtu,
+									0);
+	if (entry) {
+		ecode = entry->ecode;
+		if (ecode)
+			goto error;
+
+		bt_att_send(server->att, BT_ATT_OP_FIND_INFO_RSP, entry->pdu,
+						entry->len, NULL, NULL, NULL);
+		queue_destroy(q, NULL);
+
+		return;
+	}
+
 	gatt_db_find_information(server->db, start, end, q);
 
 	if (queue_isempty(q)) {
 		ecode = BT_ATT_ERROR_ATTRIBUTE_NOT_FOUND;
+		disc_cache_add(server->disc_cache, opcode, start, end, mtu, 0,
+							ecode, NULL, 0);
 		goto error;
 	}
 
@@ -621,6 +880,9 @@ static void find_info_cb(uint8_t opcode, const void *pdu,
 		goto error;
 	}
 
+	disc_cache_add(server->disc_cache, opcode, start, end, mtu, 0, 0,
+							rsp_pdu, rsp_len);
+
 	bt_att_send(server->att, BT_ATT_OP_FIND_INFO_RSP, rsp_pdu, rsp_len,
 							NULL, NULL, NULL);
 	queue_destroy(q, NULL);
@@ -1494,6 +1756,9 @@ struct bt_gatt_server *bt_gatt_server_new(struct gatt_db *db,
 	server->mtu = MAX(mtu, BT_ATT_DEFAULT_LE_MTU);
 	server->max_prep_queue_len = DEFAULT_MAX_PREP_QUEUE_LEN;
 	server->prep_queue = queue_new();
+	server->disc_cache = disc_cache_ref(db);
+	server->pending_notify = queue_new();
+	server->conflate_handles = queue_new();
 
 	if (!gatt_server_register_att_handlers(server)) {
 		bt_gatt_server_free(server);
@@ -1550,30 +1815,108 @@ bool bt_gatt_server_set_debug(struct bt_gatt_server *server,
 	return true;
 }
 
+bool bt_gatt_server_set_conflation(struct bt_gatt_server *server,
+						uint16_t handle, bool enable)
+{
+	void *data = UINT_TO_PTR(handle);
+
+	if (!server || !handle)
+		return false;
+
+	if (!enable) {
+		queue_remove(server->conflate_handles, data);
+		return true;
+	}
+
+	if (queue_find(server->conflate_handles, NULL, data))
+		return true;
+
+	return queue_push_tail(server->conflate_handles, data);
+}
+
+bool bt_gatt_server_set_notify_queue_len(struct bt_gatt_server *server,
+							unsigned int len)
+{
+	if (!server)
+		return false;
+
+	server->max_notify_queue_len = len;
+
+	return true;
+}
+
+unsigned int bt_gatt_server_get_notify_queued(struct bt_gatt_server *server)
+{
+	if (!server)
+		return 0;
+
+	return queue_length(server->pending_notify);
+}
+
 bool bt_gatt_server_send_notification(struct bt_gatt_server *server,
 					uint16_t handle, const uint8_t *value,
 					uint16_t length)
 {
 	uint16_t pdu_len;
-	uint8_t *pdu;
-	bool result;
+	struct notify_op *op;
+	struct iovec iov;
 
 	if (!server || (length && !value))
 		return false;
 
+	/*
+	 * If conflation is enabled for the handle drop the older value still
+	 * waiting in the ATT write queue, cancelling it releases its op.
+	 */
+	if (queue_find(server->conflate_handles, NULL, UINT_TO_PTR(handle))) {
+		op = queue_find(server->pending_notify, match_notify_op_handle,
+							UINT_TO_PTR(handle));
+		if (op) {
+			util_debug(server->debug_callback, server->debug_data,
+					"Conflating notification for 0x%04x",
+					handle);
+			bt_att_cancel(server->att, op->id);
+		}
+	}
+
+	if (server->max_notify_queue_len &&
+			queue_length(server->pending_notify) >=
+						server->max_notify_queue_len) {
+		util_debug(server->debug_callback, server->debug_data,
+					"Notification queue full, dropping 0x%04x",
+					handle);
+		return false;
+	}
+
 	pdu_len = MIN(bt_att_get_mtu(server->att) - 1, length + 2);
-	pdu = malloc(pdu_len);
-	if (!pdu)
+
+	op = new0(struct notify_op, 1);
+	op->pdu = malloc(pdu_len);
+	if (!op->pdu) {
+		free(op);
 		return false;
+	}
 
-	put_le16(handle, pdu);
-	memcpy(pdu + 2, value, pdu_len - 2);
+	op->server = server;
+	op->handle = handle;
 
-	result = !!bt_att_send(server->att, BT_ATT_OP_HANDLE_VAL_NOT, pdu,
-						pdu_len, NULL, NULL, NULL);
-	free(pdu);
+	put_le16(handle, op->pdu);
+	memcpy(op->pdu + 2, value, pdu_len - 2);
 
-	return result;
+	iov.iov_base = op->pdu;
+	iov.iov_len = pdu_len;
+
+	queue_push_tail(server->pending_notify, op);
+
+	/* Hand the PDU over to bt_att instead of having it copied again */
+	op->id = bt_att_sendv(server->att, BT_ATT_OP_HANDLE_VAL_NOT, &iov, 1,
+						NULL, op, notify_op_destroy);
+	if (!op->id) {
+		notify_op_destroy(op);
+		return false;
+	}
+
+	return true;
 }
 
 struct ind_data {
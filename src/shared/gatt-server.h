@@ -41,6 +41,12 @@ bool bt_gatt_server_set_debug(struct bt_gatt_server *server,
 					void *user_data,
 					bt_gatt_server_destroy_func_t destroy);
 
+bool bt_gatt_server_set_conflation(struct bt_gatt_server *server,
+						uint16_t handle, bool enable);
+bool bt_gatt_server_set_notify_queue_len(struct bt_gatt_server *server,
+							unsigned int len);
+unsigned int bt_gatt_server_get_notify_queued(struct bt_gatt_server *server);
+
 bool bt_gatt_server_send_notification(struct bt_gatt_server *server,
 					uint16_t handle, const uint8_t *value,
 					uint16_t length);
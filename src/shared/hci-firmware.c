@@ -0,0 +1,323 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2017  Intel Corporation
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "monitor/bt.h"
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/hci.h"
+#include "src/shared/hci-firmware.h"
+
+#define DEFAULT_WINDOW 4
+
+#define BCM_LAUNCH_RAM 0xfc4e
+
+/*
+ * Patch commands are handed to bt_hci, which writes them as the
+ * controller grants command credits. The window only bounds how many
+ * are queued there at once, so other users of the bt_hci still get a
+ * turn in between.
+ */
+struct bt_hci_fw {
+	struct bt_hci *hci;
+	unsigned int window;
+	unsigned int retries;
+	struct queue *pending;
+	struct queue *active;
+	struct timespec start;
+	struct bt_hci_fw_stats stats;
+	bool started;
+	bool done;
+	bt_hci_fw_complete_func_t callback;
+	void *user_data;
+	bt_hci_fw_destroy_func_t destroy;
+};
+
+struct fw_cmd {
+	struct bt_hci_fw *fw;
+	unsigned int id;
+	unsigned int tries;
+	bool sync;
+	uint16_t opcode;
+	uint8_t size;
+	uint8_t data[0];
+};
+
+static void cmd_cancel(void *data)
+{
+	struct fw_cmd *cmd = data;
+
+	bt_hci_cancel(cmd->fw->hci, cmd->id);
+	free(cmd);
+}
+
+struct bt_hci_fw *bt_hci_fw_new(struct bt_hci *hci)
+{
+	struct bt_hci_fw *fw;
+
+	if (!hci)
+		return NULL;
+
+	fw = new0(struct bt_hci_fw, 1);
+	fw->hci = bt_hci_ref(hci);
+	fw->window = DEFAULT_WINDOW;
+	fw->pending = queue_new();
+	fw->active = queue_new();
+
+	return fw;
+}
+
+void bt_hci_fw_free(struct bt_hci_fw *fw)
+{
+	if (!fw)
+		return;
+
+	queue_destroy(fw->active, cmd_cancel);
+	queue_destroy(fw->pending, free);
+
+	bt_hci_unref(fw->hci);
+
+	if (fw->destroy)
+		fw->destroy(fw->user_data);
+
+	free(fw);
+}
+
+bool bt_hci_fw_set_window(struct bt_hci_fw *fw, unsigned int window)
+{
+	if (!fw || !window)
+		return false;
+
+	fw->window = window;
+
+	return true;
+}
+
+bool bt_hci_fw_set_retries(struct bt_hci_fw *fw, unsigned int retries)
+{
+	if (!fw)
+		return false;
+
+	fw->retries = retries;
+
+	return true;
+}
+
+static bool fw_add(struct bt_hci_fw *fw, uint16_t opcode, const void *data,
+						uint8_t size, bool sync)
+{
+	struct fw_cmd *cmd;
+
+	if (!fw || fw->started || (size && !data))
+		return false;
+
+	cmd = malloc(sizeof(*cmd) + size);
+	if (!cmd)
+		return false;
+
+	memset(cmd, 0, sizeof(*cmd));
+	cmd->fw = fw;
+	cmd->sync = sync;
+	cmd->opcode = opcode;
+	cmd->size = size;
+
+	if (size)
+		memcpy(cmd->data, data, size);
+
+	if (!queue_push_tail(fw->pending, cmd)) {
+		free(cmd);
+		return false;
+	}
+
+	return true;
+}
+
+bool bt_hci_fw_add(struct bt_hci_fw *fw, uint16_t opcode,
+					const void *data, uint8_t size)
+{
+	return fw_add(fw, opcode, data, size, false);
+}
+
+/*
+ * The command is only sent once all earlier ones completed, and later
+ * ones wait for it in turn. Used for commands that switch the firmware.
+ */
+bool bt_hci_fw_add_sync(struct bt_hci_fw *fw, uint16_t opcode,
+					const void *data, uint8_t size)
+{
+	return fw_add(fw, opcode, data, size, true);
+}
+
+/* Broadcom .hcd files, as generated by hex2hcd */
+bool bt_hci_fw_add_hcd(struct bt_hci_fw *fw, const void *data, size_t size)
+{
+	const uint8_t *ptr = data;
+
+	if (!fw || !data)
+		return false;
+
+	while (size > 0) {
+		uint16_t opcode;
+		uint8_t len;
+		bool ret;
+
+		if (size < 3)
+			return false;
+
+		opcode = get_le16(ptr);
+		len = ptr[2];
+
+		if (size < 3u + len)
+			return false;
+
+		if (opcode == BCM_LAUNCH_RAM)
+			ret = bt_hci_fw_add_sync(fw, opcode, ptr + 3, len);
+		else
+			ret = bt_hci_fw_add(fw, opcode, ptr + 3, len);
+
+		if (!ret)
+			return false;
+
+		ptr += 3 + len;
+		size -= 3 + len;
+	}
+
+	return true;
+}
+
+static void fw_finish(struct bt_hci_fw *fw, uint8_t status)
+{
+	struct timespec now;
+
+	if (fw->done)
+		return;
+
+	fw->done = true;
+
+	queue_remove_all(fw->active, NULL, NULL, cmd_cancel);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	fw->stats.usec = (now.tv_sec - fw->start.tv_sec) * 1000000ULL +
+				(now.tv_nsec - fw->start.tv_nsec) / 1000;
+
+	if (fw->callback)
+		fw->callback(status, &fw->stats, fw->user_data);
+}
+
+static void fw_cmd_complete(const void *data, uint8_t size, void *user_data);
+
+static void fw_send_next(struct bt_hci_fw *fw)
+{
+	while (queue_length(fw->active) < fw->window) {
+		struct fw_cmd *cmd = queue_peek_head(fw->pending);
+
+		if (!cmd)
+			break;
+
+		if (cmd->sync && !queue_isempty(fw->active))
+			break;
+
+		queue_pop_head(fw->pending);
+
+		cmd->id = bt_hci_send(fw->hci, cmd->opcode, cmd->data,
+					cmd->size, fw_cmd_complete, cmd, NULL);
+		if (!cmd->id) {
+			free(cmd);
+			fw_finish(fw, BT_HCI_ERR_UNSPECIFIED_ERROR);
+			return;
+		}
+
+		queue_push_tail(fw->active, cmd);
+
+		if (cmd->sync)
+			break;
+	}
+
+	if (queue_isempty(fw->active) && queue_isempty(fw->pending))
+		fw_finish(fw, BT_HCI_ERR_SUCCESS);
+}
+
+static void fw_cmd_complete(const void *data, uint8_t size, void *user_data)
+{
+	struct fw_cmd *cmd = user_data;
+	struct bt_hci_fw *fw = cmd->fw;
+	uint8_t status;
+
+	queue_remove(fw->active, cmd);
+
+	status = size ? *((const uint8_t *) data) :
+					BT_HCI_ERR_UNSPECIFIED_ERROR;
+
+	/*
+	 * A record that failed, e.g. on a checksum error of the controller,
+	 * is sent again ahead of the remaining ones instead of restarting
+	 * the whole download.
+	 */
+	if (status && cmd->tries < fw->retries) {
+		cmd->tries++;
+		fw->stats.retries++;
+		queue_push_head(fw->pending, cmd);
+		fw_send_next(fw);
+		return;
+	}
+
+	if (status) {
+		free(cmd);
+		fw_finish(fw, status);
+		return;
+	}
+
+	fw->stats.commands++;
+	fw->stats.bytes += cmd->size;
+	free(cmd);
+
+	fw_send_next(fw);
+}
+
+bool bt_hci_fw_start(struct bt_hci_fw *fw,
+				bt_hci_fw_complete_func_t callback,
+				void *user_data,
+				bt_hci_fw_destroy_func_t destroy)
+{
+	if (!fw || fw->started)
+		return false;
+
+	fw->started = true;
+	fw->callback = callback;
+	fw->user_data = user_data;
+	fw->destroy = destroy;
+
+	clock_gettime(CLOCK_MONOTONIC, &fw->start);
+
+	fw_send_next(fw);
+
+	return true;
+}
@@ -0,0 +1,59 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2017  Intel Corporation
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+struct bt_hci;
+struct bt_hci_fw;
+
+struct bt_hci_fw_stats {
+	unsigned int commands;
+	unsigned int retries;
+	size_t bytes;
+	uint64_t usec;
+};
+
+typedef void (*bt_hci_fw_destroy_func_t)(void *user_data);
+typedef void (*bt_hci_fw_complete_func_t)(uint8_t status,
+					const struct bt_hci_fw_stats *stats,
+					void *user_data);
+
+struct bt_hci_fw *bt_hci_fw_new(struct bt_hci *hci);
+void bt_hci_fw_free(struct bt_hci_fw *fw);
+
+bool bt_hci_fw_set_window(struct bt_hci_fw *fw, unsigned int window);
+bool bt_hci_fw_set_retries(struct bt_hci_fw *fw, unsigned int retries);
+
+bool bt_hci_fw_add(struct bt_hci_fw *fw, uint16_t opcode,
+					const void *data, uint8_t size);
+bool bt_hci_fw_add_sync(struct bt_hci_fw *fw, uint16_t opcode,
+					const void *data, uint8_t size);
+bool bt_hci_fw_add_hcd(struct bt_hci_fw *fw, const void *data, size_t size);
+
+bool bt_hci_fw_start(struct bt_hci_fw *fw,
+				bt_hci_fw_complete_func_t callback,
+				void *user_data,
+				bt_hci_fw_destroy_func_t destroy);
@@ -0,0 +1,450 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2017  Intel Corporation
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "monitor/bt.h"
+#include "src/shared/util.h"
+#include "src/shared/hci.h"
+#include "src/shared/hci-scan.h"
+
+#define RSSI_INVALID 127
+
+struct bt_hci_inquiry {
+	struct bt_hci *hci;
+	unsigned int cmd_id;
+	unsigned int result_id;
+	unsigned int rssi_id;
+	unsigned int ext_id;
+	unsigned int complete_id;
+	bt_hci_inquiry_func_t result;
+	bt_hci_scan_status_func_t complete;
+	void *user_data;
+	bt_hci_scan_destroy_func_t destroy;
+	bool in_callback;
+	bool removed;
+};
+
+struct bt_hci_le_scan {
+	struct bt_hci *hci;
+	unsigned int params_id;
+	unsigned int enable_id;
+	unsigned int report_id;
+	uint8_t status;
+	bt_hci_le_scan_func_t result;
+	bt_hci_scan_status_func_t started;
+	void *user_data;
+	bt_hci_scan_destroy_func_t destroy;
+	bool in_callback;
+	bool removed;
+};
+
+static uint8_t rsp_status(const void *data, uint8_t size)
+{
+	if (!size)
+		return BT_HCI_ERR_UNSPECIFIED_ERROR;
+
+	return *((const uint8_t *) data);
+}
+
+static void inquiry_free(struct bt_hci_inquiry *inquiry)
+{
+	bt_hci_cancel(inquiry->hci, inquiry->cmd_id);
+	bt_hci_unregister(inquiry->hci, inquiry->result_id);
+	bt_hci_unregister(inquiry->hci, inquiry->rssi_id);
+	bt_hci_unregister(inquiry->hci, inquiry->ext_id);
+	bt_hci_unregister(inquiry->hci, inquiry->complete_id);
+	bt_hci_unref(inquiry->hci);
+
+	if (inquiry->destroy)
+		inquiry->destroy(inquiry->user_data);
+
+	free(inquiry);
+}
+
+static void inquiry_result(struct bt_hci_inquiry *inquiry,
+				const struct bt_hci_inquiry_result *result)
+{
+	inquiry->in_callback = true;
+	inquiry->result(result, inquiry->user_data);
+	inquiry->in_callback = false;
+}
+
+static void inquiry_done(struct bt_hci_inquiry *inquiry, uint8_t status)
+{
+	/* No further events are of interest, even if cancel is not used */
+	inquiry->in_callback = true;
+	if (inquiry->complete)
+		inquiry->complete(status, inquiry->user_data);
+	inquiry->in_callback = false;
+
+	inquiry_free(inquiry);
+}
+
+static void inquiry_cmd_status(const void *data, uint8_t size,
+							void *user_data)
+{
+	struct bt_hci_inquiry *inquiry = user_data;
+	uint8_t status = rsp_status(data, size);
+
+	inquiry->cmd_id = 0;
+
+	if (status)
+		inquiry_done(inquiry, status);
+}
+
+/*
+ * Like the kernel, treat the responses of the older result events as an
+ * array of entries rather than an array per parameter.
+ */
+static void inquiry_result_evt(const void *data, uint8_t size,
+							void *user_data)
+{
+	struct bt_hci_inquiry *inquiry = user_data;
+	const struct bt_hci_evt_inquiry_result *evt = data;
+	struct bt_hci_inquiry_result result;
+	const size_t entry = sizeof(*evt) - 1;
+	uint8_t i;
+
+	if (size < 1 || size < 1 + evt->num_resp * entry)
+		return;
+
+	for (i = 0; i < evt->num_resp && !inquiry->removed; i++) {
+		const uint8_t *ptr = data + 1 + i * entry;
+
+		memset(&result, 0, sizeof(result));
+		memcpy(result.addr, ptr, 6);
+		result.pscan_rep_mode = ptr[6];
+		memcpy(result.dev_class, ptr + 9, 3);
+		result.clock_offset = get_le16(ptr + 12);
+		result.rssi = RSSI_INVALID;
+
+		inquiry_result(inquiry, &result);
+	}
+
+	if (inquiry->removed)
+		inquiry_free(inquiry);
+}
+
+static void inquiry_rssi_evt(const void *data, uint8_t size,
+							void *user_data)
+{
+	struct bt_hci_inquiry *inquiry = user_data;
+	const struct bt_hci_evt_inquiry_result_with_rssi *evt = data;
+	struct bt_hci_inquiry_result result;
+	const size_t entry = sizeof(*evt) - 1;
+	uint8_t i;
+
+	if (size < 1 || size < 1 + evt->num_resp * entry)
+		return;
+
+	for (i = 0; i < evt->num_resp && !inquiry->removed; i++) {
+		const uint8_t *ptr = data + 1 + i * entry;
+
+		memset(&result, 0, sizeof(result));
+		memcpy(result.addr, ptr, 6);
+		result.pscan_rep_mode = ptr[6];
+		memcpy(result.dev_class, ptr + 8, 3);
+		result.clock_offset = get_le16(ptr + 11);
+		result.rssi = ptr[13];
+
+		inquiry_result(inquiry, &result);
+	}
+
+	if (inquiry->removed)
+		inquiry_free(inquiry);
+}
+
+static void inquiry_ext_evt(const void *data, uint8_t size,
+							void *user_data)
+{
+	struct bt_hci_inquiry *inquiry = user_data;
+	const struct bt_hci_evt_ext_inquiry_result *evt = data;
+	struct bt_hci_inquiry_result result;
+
+	if (size < sizeof(*evt))
+		return;
+
+	memset(&result, 0, sizeof(result));
+	memcpy(result.addr, evt->bdaddr, 6);
+	result.pscan_rep_mode = evt->pscan_rep_mode;
+	memcpy(result.dev_class, evt->dev_class, 3);
+	result.clock_offset = le16_to_cpu(evt->clock_offset);
+	result.rssi = evt->rssi;
+	result.eir = evt->data;
+	result.eir_len = sizeof(evt->data);
+
+	inquiry_result(inquiry, &result);
+
+	if (inquiry->removed)
+		inquiry_free(inquiry);
+}
+
+static void inquiry_complete_evt(const void *data, uint8_t size,
+							void *user_data)
+{
+	struct bt_hci_inquiry *inquiry = user_data;
+	const struct bt_hci_evt_inquiry_complete *evt = data;
+
+	if (size < sizeof(*evt))
+		return;
+
+	inquiry_done(inquiry, evt->status);
+}
+
+struct bt_hci_inquiry *bt_hci_inquiry_start(struct bt_hci *hci,
+				const uint8_t lap[3], uint8_t length,
+				uint8_t num_resp, bt_hci_inquiry_func_t result,
+				bt_hci_scan_status_func_t complete,
+				void *user_data,
+				bt_hci_scan_destroy_func_t destroy)
+{
+	struct bt_hci_inquiry *inquiry;
+	struct bt_hci_cmd_inquiry cmd;
+
+	if (!hci || !lap || !result)
+		return NULL;
+
+	inquiry = new0(struct bt_hci_inquiry, 1);
+	inquiry->hci = bt_hci_ref(hci);
+	inquiry->result = result;
+	inquiry->complete = complete;
+	inquiry->user_data = user_data;
+	inquiry->destroy = destroy;
+
+	/* Register first so no result can slip in before the handlers */
+	inquiry->result_id = bt_hci_register(hci, BT_HCI_EVT_INQUIRY_RESULT,
+					inquiry_result_evt, inquiry, NULL);
+	inquiry->rssi_id = bt_hci_register(hci,
+					BT_HCI_EVT_INQUIRY_RESULT_WITH_RSSI,
+					inquiry_rssi_evt, inquiry, NULL);
+	inquiry->ext_id = bt_hci_register(hci, BT_HCI_EVT_EXT_INQUIRY_RESULT,
+					inquiry_ext_evt, inquiry, NULL);
+	inquiry->complete_id = bt_hci_register(hci,
+					BT_HCI_EVT_INQUIRY_COMPLETE,
+					inquiry_complete_evt, inquiry, NULL);
+
+	memcpy(cmd.lap, lap, 3);
+	cmd.length = length;
+	cmd.num_resp = num_resp;
+
+	inquiry->cmd_id = bt_hci_send(hci, BT_HCI_CMD_INQUIRY, &cmd,
+					sizeof(cmd), inquiry_cmd_status,
+					inquiry, NULL);
+
+	if (!inquiry->result_id || !inquiry->rssi_id || !inquiry->ext_id ||
+				!inquiry->complete_id || !inquiry->cmd_id) {
+		inquiry->destroy = NULL;
+		inquiry_free(inquiry);
+		return NULL;
+	}
+
+	return inquiry;
+}
+
+void bt_hci_inquiry_cancel(struct bt_hci_inquiry *inquiry)
+{
+	if (!inquiry || inquiry->removed)
+		return;
+
+	bt_hci_send(inquiry->hci, BT_HCI_CMD_INQUIRY_CANCEL, NULL, 0,
+							NULL, NULL, NULL);
+
+	/* Freed once the result handler returns */
+	if (inquiry->in_callback) {
+		inquiry->removed = true;
+		return;
+	}
+
+	inquiry_free(inquiry);
+}
+
+static void le_scan_free(struct bt_hci_le_scan *scan)
+{
+	bt_hci_cancel(scan->hci, scan->params_id);
+	bt_hci_cancel(scan->hci, scan->enable_id);
+	bt_hci_unregister(scan->hci, scan->report_id);
+	bt_hci_unref(scan->hci);
+
+	if (scan->destroy)
+		scan->destroy(scan->user_data);
+
+	free(scan);
+}
+
+static void le_scan_params_cb(const void *data, uint8_t size,
+							void *user_data)
+{
+	struct bt_hci_le_scan *scan = user_data;
+	uint8_t status = rsp_status(data, size);
+
+	scan->params_id = 0;
+
+	if (!scan->status)
+		scan->status = status;
+}
+
+static void le_scan_enable_cb(const void *data, uint8_t size,
+							void *user_data)
+{
+	struct bt_hci_le_scan *scan = user_data;
+	uint8_t status = rsp_status(data, size);
+
+	scan->enable_id = 0;
+
+	if (!scan->status)
+		scan->status = status;
+
+	if (!scan->started)
+		return;
+
+	scan->in_callback = true;
+	scan->started(scan->status, scan->user_data);
+	scan->in_callback = false;
+
+	if (scan->removed)
+		le_scan_free(scan);
+}
+
+static void le_meta_evt(const void *data, uint8_t size, void *user_data)
+{
+	struct bt_hci_le_scan *scan = user_data;
+	struct bt_hci_le_scan_result result;
+	const uint8_t *ptr = data;
+	uint8_t num_reports;
+
+	if (size < 2 || ptr[0] != BT_HCI_EVT_LE_ADV_REPORT)
+		return;
+
+	num_reports = ptr[1];
+	ptr += 2;
+	size -= 2;
+
+	scan->in_callback = true;
+
+	while (num_reports-- && !scan->removed) {
+		/* Event type, address type, address and data length */
+		if (size < 9 || size < 9 + ptr[8] + 1)
+			break;
+
+		result.event_type = ptr[0];
+		result.addr_type = ptr[1];
+		memcpy(result.addr, ptr + 2, 6);
+		result.data_len = ptr[8];
+		result.data = ptr + 9;
+		result.rssi = ptr[9 + result.data_len];
+
+		scan->result(&result, scan->user_data);
+
+		size -= 9 + result.data_len + 1;
+		ptr += 9 + result.data_len + 1;
+	}
+
+	scan->in_callback = false;
+
+	if (scan->removed)
+		le_scan_free(scan);
+}
+
+struct bt_hci_le_scan *bt_hci_le_scan_start(struct bt_hci *hci,
+				uint8_t type, uint16_t interval,
+				uint16_t window, uint8_t own_addr_type,
+				uint8_t filter_policy, bool filter_dup,
+				bt_hci_le_scan_func_t result,
+				bt_hci_scan_status_func_t started,
+				void *user_data,
+				bt_hci_scan_destroy_func_t destroy)
+{
+	struct bt_hci_le_scan *scan;
+	struct bt_hci_cmd_le_set_scan_parameters params;
+	struct bt_hci_cmd_le_set_scan_enable enable;
+
+	if (!hci || !result)
+		return NULL;
+
+	scan = new0(struct bt_hci_le_scan, 1);
+	scan->hci = bt_hci_ref(hci);
+	scan->result = result;
+	scan->started = started;
+	scan->user_data = user_data;
+	scan->destroy = destroy;
+
+	scan->report_id = bt_hci_register(hci, BT_HCI_EVT_LE_META_EVENT,
+						le_meta_evt, scan, NULL);
+
+	params.type = type;
+	params.interval = cpu_to_le16(interval);
+	params.window = cpu_to_le16(window);
+	params.own_addr_type = own_addr_type;
+	params.filter_policy = filter_policy;
+
+	enable.enable = 0x01;
+	enable.filter_dup = filter_dup ? 0x01 : 0x00;
+
+	/*
+	 * Both commands go into the queue right away, so the enable is
+	 * written as soon as the controller has a command credit instead
+	 * of waiting for the parameters to complete.
+	 */
+	scan->params_id = bt_hci_send(hci, BT_HCI_CMD_LE_SET_SCAN_PARAMETERS,
+					&params, sizeof(params),
+					le_scan_params_cb, scan, NULL);
+	scan->enable_id = bt_hci_send(hci, BT_HCI_CMD_LE_SET_SCAN_ENABLE,
+					&enable, sizeof(enable),
+					le_scan_enable_cb, scan, NULL);
+
+	if (!scan->report_id || !scan->params_id || !scan->enable_id) {
+		scan->destroy = NULL;
+		le_scan_free(scan);
+		return NULL;
+	}
+
+	return scan;
+}
+
+void bt_hci_le_scan_stop(struct bt_hci_le_scan *scan)
+{
+	struct bt_hci_cmd_le_set_scan_enable enable;
+
+	if (!scan || scan->removed)
+		return;
+
+	enable.enable = 0x00;
+	enable.filter_dup = 0x00;
+
+	bt_hci_send(scan->hci, BT_HCI_CMD_LE_SET_SCAN_ENABLE, &enable,
+					sizeof(enable), NULL, NULL, NULL);
+
+	if (scan->in_callback) {
+		scan->removed = true;
+		return;
+	}
+
+	le_scan_free(scan);
+}
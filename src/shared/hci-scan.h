@@ -0,0 +1,88 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2017  Intel Corporation
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct bt_hci;
+struct bt_hci_inquiry;
+struct bt_hci_le_scan;
+
+struct bt_hci_inquiry_result {
+	uint8_t addr[6];
+	uint8_t pscan_rep_mode;
+	uint8_t dev_class[3];
+	uint16_t clock_offset;
+	int8_t rssi;			/* 127 if not available */
+	const uint8_t *eir;
+	uint8_t eir_len;
+};
+
+struct bt_hci_le_scan_result {
+	uint8_t event_type;
+	uint8_t addr_type;
+	uint8_t addr[6];
+	int8_t rssi;
+	const uint8_t *data;
+	uint8_t data_len;
+};
+
+typedef void (*bt_hci_scan_destroy_func_t)(void *user_data);
+typedef void (*bt_hci_scan_status_func_t)(uint8_t status, void *user_data);
+typedef void (*bt_hci_inquiry_func_t)(
+				const struct bt_hci_inquiry_result *result,
+				void *user_data);
+typedef void (*bt_hci_le_scan_func_t)(
+				const struct bt_hci_le_scan_result *result,
+				void *user_data);
+
+/*
+ * The complete callback is called once the inquiry has ended, either with
+ * the status of the Inquiry command or of the Inquiry Complete event. The
+ * handle is freed right after, so bt_hci_inquiry_cancel must only be used
+ * before that.
+ */
+struct bt_hci_inquiry *bt_hci_inquiry_start(struct bt_hci *hci,
+				const uint8_t lap[3], uint8_t length,
+				uint8_t num_resp, bt_hci_inquiry_func_t result,
+				bt_hci_scan_status_func_t complete,
+				void *user_data,
+				bt_hci_scan_destroy_func_t destroy);
+void bt_hci_inquiry_cancel(struct bt_hci_inquiry *inquiry);
+
+/*
+ * The scan parameters and the enable command are queued together, the
+ * started callback reports the first error of either of them. The scan
+ * runs until bt_hci_le_scan_stop is called, which needs to be done even
+ * if it failed to start.
+ */
+struct bt_hci_le_scan *bt_hci_le_scan_start(struct bt_hci *hci,
+				uint8_t type, uint16_t interval,
+				uint16_t window, uint8_t own_addr_type,
+				uint8_t filter_policy, bool filter_dup,
+				bt_hci_le_scan_func_t result,
+				bt_hci_scan_status_func_t started,
+				void *user_data,
+				bt_hci_scan_destroy_func_t destroy);
+void bt_hci_le_scan_stop(struct bt_hci_le_scan *scan);
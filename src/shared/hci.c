@@ -55,6 +55,13 @@ struct hci_filter {
 	uint16_t opcode;
 };
 
+/*
+ * All registrations are kept in evt_list for lookup by id, and in addition
+ * in one bucket per event code, so events are only matched against their
+ * own handlers.
+ */
+#define EVT_TABLE_SIZE 256
+
 struct bt_hci {
 	int ref_count;
 	struct io *io;
@@ -66,6 +73,7 @@ struct bt_hci {
 	struct queue *cmd_queue;
 	struct queue *rsp_queue;
 	struct queue *evt_list;
+	struct queue *evt_table[EVT_TABLE_SIZE];
 };
 
 struct cmd {
@@ -150,6 +158,13 @@ static bool io_write_callback(struct io *io, void *user_data)
 		queue_push_tail(hci->rsp_queue, cmd);
 	}
 
+	/*
+	 * Keep writing while the controller grants command credits, so
+	 * Num_HCI_Command_Packets above one actually pipelines commands.
+	 */
+	if (hci->num_cmds > 0 && !queue_isempty(hci->cmd_queue))
+		return true;
+
 	hci->writer_active = false;
 
 	return false;
@@ -247,7 +262,8 @@ static void process_event(struct bt_hci *hci, const void *data, size_t size)
 		break;
 
 	default:
-		queue_foreach(hci->evt_list, process_notify, (void *) hdr);
+		queue_foreach(hci->evt_table[hdr->evt], process_notify,
+								(void *) hdr);
 		break;
 	}
 }
@@ -419,12 +435,17 @@ struct bt_hci *bt_hci_ref(struct bt_hci *hci)
 
 void bt_hci_unref(struct bt_hci *hci)
 {
+	unsigned int i;
+
 	if (!hci)
 		return;
 
 	if (__sync_sub_and_fetch(&hci->ref_count, 1))
 		return;
 
+	for (i = 0; i < EVT_TABLE_SIZE; i++)
+		queue_destroy(hci->evt_table[i], NULL);
+
 	queue_destroy(hci->evt_list, evt_free);
 	queue_destroy(hci->cmd_queue, cmd_free);
 	queue_destroy(hci->rsp_queue, cmd_free);
@@ -537,10 +558,15 @@ unsigned int bt_hci_register(struct bt_hci *hci, uint8_t event,
 				void *user_data, bt_hci_destroy_func_t destroy)
 {
 	struct evt *evt;
+	struct queue **bucket;
 
 	if (!hci)
 		return 0;
 
+	bucket = &hci->evt_table[event];
+	if (!*bucket)
+		*bucket = queue_new();
+
 	evt = new0(struct evt, 1);
 	evt->event = event;
 
@@ -558,6 +584,8 @@ unsigned int bt_hci_register(struct bt_hci *hci, uint8_t event,
 		return 0;
 	}
 
+	queue_push_tail(*bucket, evt);
+
 	return evt->id;
 }
 
@@ -580,6 +608,8 @@ bool bt_hci_unregister(struct bt_hci *hci, unsigned int id)
 	if (!evt)
 		return false;
 
+	queue_remove(hci->evt_table[evt->event], evt);
+
 	evt_free(evt);
 
 	return true;
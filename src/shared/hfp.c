@@ -45,6 +45,7 @@ struct hfp_gw {
 	struct ringbuf *read_buf;
 	struct ringbuf *write_buf;
 	struct queue *cmd_handlers;
+	struct prefix_node *cmd_prefixes;
 	bool writer_active;
 	bool result_pending;
 	hfp_command_func_t command_callback;
@@ -74,6 +75,7 @@ struct hfp_hf {
 	struct queue *cmd_queue;
 
 	struct queue *event_handlers;
+	struct prefix_node *event_prefixes;
 
 	hfp_debug_func_t debug_callback;
 	hfp_destroy_func_t debug_destroy;
@@ -99,6 +101,18 @@ struct hfp_context {
 	unsigned int offset;
 };
 
+/*
+ * Registered prefixes are indexed by a trie, one node per character with
+ * children kept as a sibling list, so looking up a command costs one step
+ * per character of its prefix regardless of how many handlers there are.
+ */
+struct prefix_node {
+	char c;
+	struct prefix_node *child;
+	struct prefix_node *next;
+	void *handler;
+};
+
 struct cmd_response {
 	hfp_response_func_t resp_cb;
 	struct hfp_context *response;
@@ -113,6 +127,107 @@ struct event_handler {
 	hfp_hf_result_func_t callback;
 };
 
+static bool prefix_insert(struct prefix_node **link, const char *prefix,
+								void *handler)
+{
+	struct prefix_node *node = NULL;
+
+	if (!*prefix)
+		return false;
+
+	for (; *prefix; prefix++) {
+		for (node = *link; node; node = node->next) {
+			if (node->c == *prefix)
+				break;
+		}
+
+		if (!node) {
+			node = new0(struct prefix_node, 1);
+			node->c = *prefix;
+			node->next = *link;
+			*link = node;
+		}
+
+		link = &node->child;
+	}
+
+	if (node->handler)
+		return false;
+
+	node->handler = handler;
+
+	return true;
+}
+
+/* Commands are matched case insensitively against the data in place */
+static void *prefix_lookup(struct prefix_node *node, const char *prefix,
+								size_t len)
+{
+	struct prefix_node *last = NULL;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		char c = toupper(prefix[i]);
+
+		for (; node; node = node->next) {
+			if (node->c == c)
+				break;
+		}
+
+		if (!node)
+			return NULL;
+
+		last = node;
+		node = node->child;
+	}
+
+	return last ? last->handler : NULL;
+}
+
+static void *prefix_remove(struct prefix_node **link, const char *prefix)
+{
+	struct prefix_node *node;
+	void *handler;
+
+	if (!*prefix)
+		return NULL;
+
+	for (; *link; link = &(*link)->next) {
+		if ((*link)->c == *prefix)
+			break;
+	}
+
+	node = *link;
+	if (!node)
+		return NULL;
+
+	if (prefix[1] == '\0') {
+		handler = node->handler;
+		node->handler = NULL;
+	} else {
+		handler = prefix_remove(&node->child, prefix + 1);
+	}
+
+	/* Drop nodes no other prefix goes through */
+	if (!node->handler && !node->child) {
+		*link = node->next;
+		free(node);
+	}
+
+	return handler;
+}
+
+static void prefix_free(struct prefix_node *node)
+{
+	while (node) {
+		struct prefix_node *next = node->next;
+
+		prefix_free(node->child);
+		free(node);
+		node = next;
+	}
+}
+
 static void destroy_cmd_handler(void *data)
 {
 	struct cmd_handler *handler = data;
@@ -125,17 +240,6 @@ static void destroy_cmd_handler(void *data)
 	free(handler);
 }
 
-static bool match_handler_prefix(const void *a, const void *b)
-{
-	const struct cmd_handler *handler = a;
-	const char *prefix = b;
-
-	if (strcmp(handler->prefix, prefix) != 0)
-		return false;
-
-	return true;
-}
-
 static void write_watch_destroy(void *user_data)
 {
 	struct hfp_gw *hfp = user_data;
@@ -196,10 +300,8 @@ static bool handle_at_command(struct hfp_gw *hfp, const char *data)
 	const char *separators = ";?=\0";
 	struct hfp_context context;
 	enum hfp_gw_cmd_type type;
-	char lookup_prefix[18];
 	uint8_t pref_len = 0;
 	const char *prefix;
-	int i;
 
 	context.offset = 0;
 	context.data = data;
@@ -217,20 +319,16 @@ static bool handle_at_command(struct hfp_gw *hfp, const char *data)
 	prefix = data + context.offset;
 
 	if (isalpha(prefix[0])) {
-		lookup_prefix[pref_len++] = toupper(prefix[0]);
+		pref_len = 1;
 	} else {
 		pref_len = strcspn(prefix, separators);
 		if (pref_len > 17 || pref_len < 2)
 			return false;
-
-		for (i = 0; i < pref_len; i++)
-			lookup_prefix[i] = toupper(prefix[i]);
 	}
 
-	lookup_prefix[pref_len] = '\0';
 	context.offset += pref_len;
 
-	if (lookup_prefix[0] == 'D') {
+	if (toupper(prefix[0]) == 'D') {
 		type = HFP_GW_CMD_TYPE_SET;
 		goto done;
 	}
@@ -256,8 +354,7 @@ static bool handle_at_command(struct hfp_gw *hfp, const char *data)
 
 done:
 
-	handler = queue_find(hfp->cmd_handlers, match_handler_prefix,
-								lookup_prefix);
+	handler = prefix_lookup(hfp->cmd_prefixes, prefix, pref_len);
 	if (!handler) {
 		handle_unknown_at_command(hfp, data);
 		return true;
@@ -578,7 +675,10 @@ struct hfp_gw *hfp_gw_new(int fd)
 	hfp->fd = fd;
 	hfp->close_on_unref = false;
 
-	hfp->read_buf = ringbuf_new(4096);
+	/* Commands can be parsed in place when they don't wrap around */
+	hfp->read_buf = ringbuf_new_mirrored(4096);
+	if (!hfp->read_buf)
+		hfp->read_buf = ringbuf_new(4096);
 	if (!hfp->read_buf) {
 		free(hfp);
 		return NULL;
@@ -655,6 +755,9 @@ void hfp_gw_unref(struct hfp_gw *hfp)
 	ringbuf_free(hfp->write_buf);
 	hfp->write_buf = NULL;
 
+	prefix_free(hfp->cmd_prefixes);
+	hfp->cmd_prefixes = NULL;
+
 	queue_destroy(hfp->cmd_handlers, destroy_cmd_handler);
 	hfp->cmd_handlers = NULL;
 
@@ -843,8 +946,7 @@ bool hfp_gw_register(struct hfp_gw *hfp, hfp_result_func_t callback,
 		return false;
 	}
 
-	if (queue_find(hfp->cmd_handlers, match_handler_prefix,
-							handler->prefix)) {
+	if (!prefix_insert(&hfp->cmd_prefixes, handler->prefix, handler)) {
 		destroy_cmd_handler(handler);
 		return false;
 	}
@@ -857,19 +959,13 @@ bool hfp_gw_register(struct hfp_gw *hfp, hfp_result_func_t callback,
 bool hfp_gw_unregister(struct hfp_gw *hfp, const char *prefix)
 {
 	struct cmd_handler *handler;
-	char *lookup_prefix;
-
-	lookup_prefix = strdup(prefix);
-	if (!lookup_prefix)
-		return false;
-
-	handler = queue_remove_if(hfp->cmd_handlers, match_handler_prefix,
-								lookup_prefix);
-	free(lookup_prefix);
 
+	handler = prefix_remove(&hfp->cmd_prefixes, prefix);
 	if (!handler)
 		return false;
 
+	queue_remove(hfp->cmd_handlers, handler);
+
 	destroy_cmd_handler(handler);
 
 	return true;
@@ -934,17 +1030,6 @@ bool hfp_gw_disconnect(struct hfp_gw *hfp)
 	return io_shutdown(hfp->io);
 }
 
-static bool match_handler_event_prefix(const void *a, const void *b)
-{
-	const struct event_handler *handler = a;
-	const char *prefix = b;
-
-	if (strcmp(handler->prefix, prefix) != 0)
-		return false;
-
-	return true;
-}
-
 static void destroy_event_handler(void *data)
 {
 	struct event_handler *handler = data;
@@ -1115,8 +1200,7 @@ static void hf_call_prefix_handler(struct hfp_hf *hfp, const char *data)
 		return;
 	}
 
-	handler = queue_find(hfp->event_handlers, match_handler_event_prefix,
-								lookup_prefix);
+	handler = prefix_lookup(hfp->event_prefixes, prefix, pref_len);
 	if (!handler)
 		return;
 
@@ -1252,7 +1336,10 @@ struct hfp_hf *hfp_hf_new(int fd)
 	hfp->fd = fd;
 	hfp->close_on_unref = false;
 
-	hfp->read_buf = ringbuf_new(4096);
+	/* Commands can be parsed in place when they don't wrap around */
+	hfp->read_buf = ringbuf_new_mirrored(4096);
+	if (!hfp->read_buf)
+		hfp->read_buf = ringbuf_new(4096);
 	if (!hfp->read_buf) {
 		free(hfp);
 		return NULL;
@@ -1327,6 +1414,9 @@ void hfp_hf_unref(struct hfp_hf *hfp)
 	ringbuf_free(hfp->write_buf);
 	hfp->write_buf = NULL;
 
+	prefix_free(hfp->event_prefixes);
+	hfp->event_prefixes = NULL;
+
 	queue_destroy(hfp->event_handlers, destroy_event_handler);
 	hfp->event_handlers = NULL;
 
@@ -1453,8 +1543,7 @@ bool hfp_hf_register(struct hfp_hf *hfp, hfp_hf_result_func_t callback,
 		return false;
 	}
 
-	if (queue_find(hfp->event_handlers, match_handler_event_prefix,
-							handler->prefix)) {
+	if (!prefix_insert(&hfp->event_prefixes, handler->prefix, handler)) {
 		destroy_event_handler(handler);
 		return false;
 	}
@@ -1466,16 +1555,14 @@ bool hfp_hf_register(struct hfp_hf *hfp, hfp_hf_result_func_t callback,
 
 bool hfp_hf_unregister(struct hfp_hf *hfp, const char *prefix)
 {
-	struct cmd_handler *handler;
-
-	/* Cast to void as queue_remove needs that */
-	handler = queue_remove_if(hfp->event_handlers,
-						match_handler_event_prefix,
-						(void *) prefix);
+	struct event_handler *handler;
 
+	handler = prefix_remove(&hfp->event_prefixes, prefix);
 	if (!handler)
 		return false;
 
+	queue_remove(hfp->event_handlers, handler);
+
 	destroy_event_handler(handler);
 
 	return true;
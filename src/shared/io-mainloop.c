@@ -37,6 +37,7 @@ struct io {
 	int ref_count;
 	int fd;
 	uint32_t events;
+	unsigned int worker;
 	bool close_on_destroy;
 	io_callback_func_t read_callback;
 	io_destroy_func_t read_destroy;
@@ -162,6 +163,7 @@ struct io *io_new(int fd)
 	io = new0(struct io, 1);
 	io->fd = fd;
 	io->events = 0;
+	io->worker = mainloop_get_worker();
 	io->close_on_destroy = false;
 
 	if (mainloop_add_fd(io->fd, io->events, io_callback,
@@ -173,6 +175,15 @@ struct io *io_new(int fd)
 	return io_ref(io);
 }
 
+static void io_destroy_post(void *user_data)
+{
+	struct io *io = user_data;
+
+	mainloop_remove_fd(io->fd);
+
+	io_unref(io);
+}
+
 void io_destroy(struct io *io)
 {
 	if (!io)
@@ -182,6 +193,11 @@ void io_destroy(struct io *io)
 	io->write_callback = NULL;
 	io->disconnect_callback = NULL;
 
+	/* Only the worker the io is pinned to can remove it from its loop */
+	if (io->worker != mainloop_get_worker() &&
+			!mainloop_post(io->worker, io_destroy_post, io, NULL))
+		return;
+
 	mainloop_remove_fd(io->fd);
 
 	io_unref(io);
@@ -28,19 +28,29 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <pthread.h>
 #include <sys/signalfd.h>
 #include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #include <sys/epoll.h>
 
 #include "mainloop.h"
 
-#define MAX_EPOLL_EVENTS 10
+#define MAX_EPOLL_EVENTS 64
 
-static int epoll_fd;
+/*
+ * Every worker thread runs its own epoll loop, so everything describing the
+ * fds and timeouts of a loop is thread local. Only the main thread exists
+ * unless mainloop_set_workers() is used.
+ */
+static __thread int epoll_fd;
 static int epoll_terminate;
 static int exit_status;
 
@@ -52,17 +62,75 @@ struct mainloop_data {
 	void *user_data;
 };
 
-#define MAX_MAINLOOP_ENTRIES 128
+#define MIN_MAINLOOP_ENTRIES 128
 
-static struct mainloop_data *mainloop_list[MAX_MAINLOOP_ENTRIES];
+static __thread struct mainloop_data **mainloop_list;
+static __thread unsigned int mainloop_list_size;
 
 struct timeout_data {
-	int fd;
+	int id;
+	uint64_t expires;
+	unsigned int level;
+	struct timeout_data *next;
+	struct timeout_data **pprev;
 	mainloop_timeout_func callback;
 	mainloop_destroy_func destroy;
 	void *user_data;
 };
 
+#define MIN_TIMEOUT_ENTRIES 32
+
+static __thread struct timeout_data **timeout_list;
+static __thread unsigned int timeout_list_size;
+static __thread unsigned int timeout_list_hint;
+
+/*
+ * All timeouts are kept in a hierarchical timer wheel with a resolution of
+ * one millisecond and multiplexed over a single timerfd. Each level covers
+ * WHEEL_SIZE times the range of the level below it, entries of the upper
+ * levels are cascaded down once their slot is reached. The extra count at
+ * WHEEL_LEVELS is for the timeouts whose callbacks are about to be called.
+ */
+#define WHEEL_BITS 8
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_RANGE (1ULL << (WHEEL_BITS * WHEEL_LEVELS))
+
+static __thread struct timeout_data *wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static __thread struct timeout_data *wheel_expired;
+static __thread unsigned int wheel_count[WHEEL_LEVELS + 1];
+static __thread uint64_t wheel_now;
+static __thread uint64_t wheel_armed;
+static __thread bool wheel_running;
+static __thread int wheel_fd = -1;
+
+struct post_data {
+	struct post_data *next;
+	mainloop_post_func callback;
+	mainloop_destroy_func destroy;
+	void *user_data;
+};
+
+/*
+ * Work is posted to a worker through a lock-free multiple producer, single
+ * consumer queue and the worker is woken up through its eventfd.
+ */
+struct mainloop_worker {
+	unsigned int index;
+	pthread_t thread;
+	int event_fd;
+	struct post_data *head;
+	struct post_data *tail;
+	struct post_data stub;
+};
+
+#define MAX_MAINLOOP_WORKERS 64
+
+static struct mainloop_worker *workers;
+static unsigned int worker_count;
+static __thread struct mainloop_worker *current_worker;
+
 struct signal_data {
 	int fd;
 	sigset_t mask;
@@ -75,31 +143,72 @@ static struct signal_data *signal_data;
 
 void mainloop_init(void)
 {
-	unsigned int i;
-
 	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 
-	for (i = 0; i < MAX_MAINLOOP_ENTRIES; i++)
-		mainloop_list[i] = NULL;
+	free(mainloop_list);
+	mainloop_list = NULL;
+	mainloop_list_size = 0;
+
+	free(timeout_list);
+	timeout_list = NULL;
+	timeout_list_size = 0;
+	timeout_list_hint = 0;
+
+	memset(wheel, 0, sizeof(wheel));
+	memset(wheel_count, 0, sizeof(wheel_count));
+	wheel_expired = NULL;
+	wheel_now = 0;
+	wheel_armed = UINT64_MAX;
+	wheel_running = false;
+	wheel_fd = -1;
 
 	epoll_terminate = 0;
 }
 
+static void worker_wakeup(struct mainloop_worker *worker)
+{
+	uint64_t value = 1;
+
+	if (write(worker->event_fd, &value, sizeof(value)) < 0)
+		return;
+}
+
+static void terminate(void)
+{
+	unsigned int i;
+
+	__atomic_store_n(&epoll_terminate, 1, __ATOMIC_RELEASE);
+
+	/* The call might come from any thread, so wake all of them up */
+	for (i = 0; i < worker_count; i++) {
+		if (&workers[i] != current_worker)
+			worker_wakeup(&workers[i]);
+	}
+}
+
 void mainloop_quit(void)
 {
-	epoll_terminate = 1;
+	terminate();
 }
 
 void mainloop_exit_success(void)
 {
 	exit_status = EXIT_SUCCESS;
-	epoll_terminate = 1;
+	terminate();
 }
 
 void mainloop_exit_failure(void)
 {
 	exit_status = EXIT_FAILURE;
-	epoll_terminate = 1;
+	terminate();
+}
+
+static struct mainloop_data *mainloop_lookup(int fd)
+{
+	if (fd < 0 || (unsigned int) fd >= mainloop_list_size)
+		return NULL;
+
+	return mainloop_list[fd];
 }
 
 static void signal_callback(int fd, uint32_t events, void *user_data)
@@ -121,10 +230,209 @@ static void signal_callback(int fd, uint32_t events, void *user_data)
 		data->callback(si.ssi_signo, data->user_data);
 }
 
-int mainloop_run(void)
+static void mainloop_dispatch(void)
+{
+	while (!__atomic_load_n(&epoll_terminate, __ATOMIC_ACQUIRE)) {
+		struct epoll_event events[MAX_EPOLL_EVENTS];
+		int n, nfds;
+
+		nfds = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+		if (nfds < 0)
+			continue;
+
+		for (n = 0; n < nfds; n++) {
+			struct mainloop_data *data;
+
+			/* Callbacks might have removed some of the other fds */
+			data = mainloop_lookup(events[n].data.fd);
+			if (!data)
+				continue;
+
+			data->callback(data->fd, events[n].events,
+							data->user_data);
+		}
+	}
+}
+
+static void mainloop_cleanup(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < mainloop_list_size; i++) {
+		struct mainloop_data *data = mainloop_list[i];
+
+		mainloop_list[i] = NULL;
+
+		if (data) {
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, data->fd, NULL);
+
+			if (data->destroy)
+				data->destroy(data->user_data);
+
+			free(data);
+		}
+	}
+
+	free(mainloop_list);
+	mainloop_list = NULL;
+	mainloop_list_size = 0;
+
+	close(epoll_fd);
+	epoll_fd = 0;
+}
+
+static void post_push(struct mainloop_worker *worker, struct post_data *post)
+{
+	struct post_data *prev;
+
+	__atomic_store_n(&post->next, NULL, __ATOMIC_RELAXED);
+
+	prev = __atomic_exchange_n(&worker->head, post, __ATOMIC_ACQ_REL);
+
+	__atomic_store_n(&prev->next, post, __ATOMIC_RELEASE);
+}
+
+static struct post_data *post_pop(struct mainloop_worker *worker)
+{
+	struct post_data *tail = worker->tail;
+	struct post_data *next;
+
+	next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+	if (tail == &worker->stub) {
+		if (!next)
+			return NULL;
+
+		worker->tail = next;
+		tail = next;
+		next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+	}
+
+	if (next) {
+		worker->tail = next;
+		return tail;
+	}
+
+	/*
+	 * A producer is in the middle of pushing, its entry is picked up on
+	 * the wakeup following the push.
+	 */
+	if (tail != __atomic_load_n(&worker->head, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	post_push(worker, &worker->stub);
+
+	next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (next) {
+		worker->tail = next;
+		return tail;
+	}
+
+	return NULL;
+}
+
+static void post_callback(int fd, uint32_t events, void *user_data)
+{
+	struct mainloop_worker *worker = user_data;
+	struct post_data *post;
+	uint64_t value;
+
+	if (events & (EPOLLERR | EPOLLHUP))
+		return;
+
+	if (read(fd, &value, sizeof(value)) != sizeof(value))
+		return;
+
+	while (!__atomic_load_n(&epoll_terminate, __ATOMIC_ACQUIRE) &&
+					(post = post_pop(worker))) {
+		post->callback(post->user_data);
+
+		if (post->destroy)
+			post->destroy(post->user_data);
+
+		free(post);
+	}
+}
+
+static void *worker_thread(void *user_data)
+{
+	struct mainloop_worker *worker = user_data;
+
+	current_worker = worker;
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		mainloop_exit_failure();
+		return NULL;
+	}
+
+	if (mainloop_add_fd(worker->event_fd, EPOLLIN, post_callback,
+							worker, NULL) < 0) {
+		close(epoll_fd);
+		mainloop_exit_failure();
+		return NULL;
+	}
+
+	mainloop_dispatch();
+
+	mainloop_cleanup();
+
+	return NULL;
+}
+
+static void workers_start(void)
 {
 	unsigned int i;
 
+	for (i = 1; i < worker_count; i++) {
+		struct mainloop_worker *worker = &workers[i];
+
+		if (pthread_create(&worker->thread, NULL, worker_thread,
+								worker)) {
+			close(worker->event_fd);
+			worker->event_fd = -1;
+			mainloop_exit_failure();
+		}
+	}
+}
+
+static void workers_stop(void)
+{
+	unsigned int i;
+
+	for (i = 1; i < worker_count; i++) {
+		if (workers[i].event_fd >= 0)
+			pthread_join(workers[i].thread, NULL);
+	}
+}
+
+static void workers_free(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < worker_count; i++) {
+		struct mainloop_worker *worker = &workers[i];
+		struct post_data *post;
+
+		while ((post = post_pop(worker))) {
+			if (post->destroy)
+				post->destroy(post->user_data);
+
+			free(post);
+		}
+
+		if (worker->event_fd >= 0)
+			close(worker->event_fd);
+	}
+
+	free(workers);
+	workers = NULL;
+	worker_count = 0;
+	current_worker = NULL;
+}
+
+int mainloop_run(void)
+{
 	if (signal_data) {
 		if (sigprocmask(SIG_BLOCK, &signal_data->mask, NULL) < 0)
 			return EXIT_FAILURE;
@@ -143,21 +451,12 @@ int mainloop_run(void)
 
 	exit_status = EXIT_SUCCESS;
 
-	while (!epoll_terminate) {
-		struct epoll_event events[MAX_EPOLL_EVENTS];
-		int n, nfds;
-
-		nfds = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
-		if (nfds < 0)
-			continue;
+	/* Signals are blocked at this point, so only this thread gets them */
+	workers_start();
 
-		for (n = 0; n < nfds; n++) {
-			struct mainloop_data *data = events[n].data.ptr;
+	mainloop_dispatch();
 
-			data->callback(data->fd, events[n].events,
-							data->user_data);
-		}
-	}
+	workers_stop();
 
 	if (signal_data) {
 		mainloop_remove_fd(signal_data->fd);
@@ -167,25 +466,111 @@ int mainloop_run(void)
 			signal_data->destroy(signal_data->user_data);
 	}
 
-	for (i = 0; i < MAX_MAINLOOP_ENTRIES; i++) {
-		struct mainloop_data *data = mainloop_list[i];
+	mainloop_cleanup();
 
-		mainloop_list[i] = NULL;
+	workers_free();
 
-		if (data) {
-			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, data->fd, NULL);
+	return exit_status;
+}
 
-			if (data->destroy)
-				data->destroy(data->user_data);
+int mainloop_set_workers(unsigned int count)
+{
+	unsigned int i;
 
-			free(data);
-		}
+	if (!count || count > MAX_MAINLOOP_WORKERS)
+		return -EINVAL;
+
+	if (workers)
+		return -EALREADY;
+
+	workers = calloc(count, sizeof(*workers));
+	if (!workers)
+		return -ENOMEM;
+
+	for (i = 0; i < count; i++) {
+		struct mainloop_worker *worker = &workers[i];
+
+		worker->index = i;
+		worker->head = &worker->stub;
+		worker->tail = &worker->stub;
+		worker->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (worker->event_fd < 0)
+			goto failed;
+
+		worker_count = i + 1;
 	}
 
-	close(epoll_fd);
-	epoll_fd = 0;
+	/* The main thread takes the role of the first worker */
+	current_worker = &workers[0];
 
-	return exit_status;
+	if (mainloop_add_fd(workers[0].event_fd, EPOLLIN, post_callback,
+						&workers[0], NULL) < 0)
+		goto failed;
+
+	return 0;
+
+failed:
+	workers_free();
+	return -EIO;
+}
+
+unsigned int mainloop_get_workers(void)
+{
+	return worker_count ? worker_count : 1;
+}
+
+unsigned int mainloop_get_worker(void)
+{
+	return current_worker ? current_worker->index : 0;
+}
+
+int mainloop_post(unsigned int worker, mainloop_post_func callback,
+				void *user_data, mainloop_destroy_func destroy)
+{
+	struct post_data *post;
+
+	if (!callback || worker >= worker_count)
+		return -EINVAL;
+
+	post = malloc(sizeof(*post));
+	if (!post)
+		return -ENOMEM;
+
+	memset(post, 0, sizeof(*post));
+	post->callback = callback;
+	post->destroy = destroy;
+	post->user_data = user_data;
+
+	post_push(&workers[worker], post);
+
+	worker_wakeup(&workers[worker]);
+
+	return 0;
+}
+
+static int mainloop_list_grow(int fd)
+{
+	struct mainloop_data **list;
+	unsigned int size;
+
+	if ((unsigned int) fd < mainloop_list_size)
+		return 0;
+
+	size = mainloop_list_size ? mainloop_list_size : MIN_MAINLOOP_ENTRIES;
+	while (size <= (unsigned int) fd)
+		size <<= 1;
+
+	list = realloc(mainloop_list, size * sizeof(*list));
+	if (!list)
+		return -ENOMEM;
+
+	memset(list + mainloop_list_size, 0,
+			(size - mainloop_list_size) * sizeof(*list));
+
+	mainloop_list = list;
+	mainloop_list_size = size;
+
+	return 0;
 }
 
 int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
@@ -195,9 +580,12 @@ int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
 	struct epoll_event ev;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1 || !callback)
+	if (fd < 0 || !callback)
 		return -EINVAL;
 
+	if (mainloop_list_grow(fd) < 0)
+		return -ENOMEM;
+
 	data = malloc(sizeof(*data));
 	if (!data)
 		return -ENOMEM;
@@ -211,7 +599,7 @@ int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
 
 	memset(&ev, 0, sizeof(ev));
 	ev.events = events;
-	ev.data.ptr = data;
+	ev.data.fd = fd;
 
 	err = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, data->fd, &ev);
 	if (err < 0) {
@@ -230,16 +618,16 @@ int mainloop_modify_fd(int fd, uint32_t events)
 	struct epoll_event ev;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1)
+	if (fd < 0)
 		return -EINVAL;
 
-	data = mainloop_list[fd];
+	data = mainloop_lookup(fd);
 	if (!data)
 		return -ENXIO;
 
 	memset(&ev, 0, sizeof(ev));
 	ev.events = events;
-	ev.data.ptr = data;
+	ev.data.fd = fd;
 
 	err = epoll_ctl(epoll_fd, EPOLL_CTL_MOD, data->fd, &ev);
 	if (err < 0)
@@ -255,10 +643,10 @@ int mainloop_remove_fd(int fd)
 	struct mainloop_data *data;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1)
+	if (fd < 0)
 		return -EINVAL;
 
-	data = mainloop_list[fd];
+	data = mainloop_lookup(fd);
 	if (!data)
 		return -ENXIO;
 
@@ -274,48 +662,364 @@ int mainloop_remove_fd(int fd)
 	return err;
 }
 
-static void timeout_destroy(void *user_data)
+static uint64_t time_now(bool round_up)
 {
-	struct timeout_data *data = user_data;
+	struct timespec ts;
+	uint64_t msec;
 
-	close(data->fd);
-	data->fd = -1;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	if (data->destroy)
-		data->destroy(data->user_data);
+	msec = ts.tv_nsec / 1000000;
+	if (round_up && ts.tv_nsec % 1000000)
+		msec++;
 
-	free(data);
+	return (uint64_t) ts.tv_sec * 1000 + msec;
+}
+
+static void timeout_link(struct timeout_data **head, unsigned int level,
+						struct timeout_data *data)
+{
+	data->next = *head;
+	if (data->next)
+		data->next->pprev = &data->next;
+
+	data->pprev = head;
+	*head = data;
+
+	data->level = level;
+	wheel_count[level]++;
+}
+
+static void timeout_unlink(struct timeout_data *data)
+{
+	if (!data->pprev)
+		return;
+
+	*data->pprev = data->next;
+	if (data->next)
+		data->next->pprev = data->pprev;
+
+	data->next = NULL;
+	data->pprev = NULL;
+
+	wheel_count[data->level]--;
+}
+
+static bool wheel_pending(void)
+{
+	unsigned int level;
+
+	for (level = 0; level <= WHEEL_LEVELS; level++) {
+		if (wheel_count[level])
+			return true;
+	}
+
+	return false;
+}
+
+static void wheel_insert(struct timeout_data *data)
+{
+	uint64_t expires = data->expires;
+	uint64_t delta;
+	unsigned int level, shift;
+
+	if (expires < wheel_now)
+		expires = wheel_now;
+
+	delta = expires - wheel_now;
+
+	/* Timeouts beyond the range of the wheel are cascaded until due */
+	if (delta >= WHEEL_RANGE)
+		expires = wheel_now + WHEEL_RANGE - 1;
+
+	for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+		if (delta < (1ULL << (WHEEL_BITS * (level + 1))))
+			break;
+	}
+
+	shift = WHEEL_BITS * level;
+
+	timeout_link(&wheel[level][(expires >> shift) & WHEEL_MASK], level,
+									data);
+}
+
+static void wheel_cascade(unsigned int level, unsigned int slot)
+{
+	struct timeout_data *data;
+
+	while ((data = wheel[level][slot])) {
+		timeout_unlink(data);
+		wheel_insert(data);
+	}
 }
 
-static void timeout_callback(int fd, uint32_t events, void *user_data)
+static void wheel_expire(unsigned int slot)
+{
+	struct timeout_data *data;
+
+	/*
+	 * Move the whole slot out of the wheel first, so timeouts being
+	 * rescheduled from the callbacks don't end up in the slot again.
+	 */
+	while ((data = wheel[0][slot])) {
+		timeout_unlink(data);
+		timeout_link(&wheel_expired, WHEEL_LEVELS, data);
+	}
+
+	while ((data = wheel_expired)) {
+		timeout_unlink(data);
+
+		if (data->callback)
+			data->callback(data->id, data->user_data);
+	}
+}
+
+static void wheel_skip(uint64_t now)
+{
+	uint64_t next;
+	unsigned int level;
+
+	if (wheel_count[0])
+		return;
+
+	for (level = 1; level < WHEEL_LEVELS; level++) {
+		if (wheel_count[level])
+			break;
+	}
+
+	/*
+	 * Nothing happens until the next slot of the lowest non-empty level
+	 * is cascaded, so jump straight there.
+	 */
+	if (level < WHEEL_LEVELS) {
+		uint64_t mask = (1ULL << (WHEEL_BITS * level)) - 1;
+
+		next = (wheel_now + mask) & ~mask;
+	} else
+		next = now + 1;
+
+	if (next > now + 1)
+		next = now + 1;
+
+	if (next > wheel_now)
+		wheel_now = next;
+}
+
+static void wheel_run(uint64_t now)
+{
+	while (wheel_now <= now) {
+		uint64_t tick = wheel_now;
+		unsigned int level;
+
+		for (level = WHEEL_LEVELS - 1; level > 0; level--) {
+			unsigned int shift = WHEEL_BITS * level;
+
+			if (tick & ((1ULL << shift) - 1))
+				continue;
+
+			wheel_cascade(level, (tick >> shift) & WHEEL_MASK);
+		}
+
+		wheel_now = tick + 1;
+
+		wheel_expire(tick & WHEEL_MASK);
+
+		wheel_skip(now);
+	}
+}
+
+static uint64_t wheel_next(void)
+{
+	uint64_t next = UINT64_MAX;
+	unsigned int level;
+
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		unsigned int shift = WHEEL_BITS * level;
+		unsigned int cur, i;
+		uint64_t expires;
+
+		if (!wheel_count[level])
+			continue;
+
+		cur = (wheel_now >> shift) & WHEEL_MASK;
+
+		for (i = 0; i < WHEEL_SIZE; i++) {
+			if (wheel[level][(cur + i) & WHEEL_MASK])
+				break;
+		}
+
+		if (!level) {
+			expires = wheel_now + i;
+		} else {
+			/*
+			 * Upper levels only tell when their slot is cascaded,
+			 * the slot of the current position is only cascaded
+			 * again once the level wraps around.
+			 */
+			if (!i && (wheel_now & ((1ULL << shift) - 1)))
+				i = WHEEL_SIZE;
+
+			expires = ((wheel_now >> shift) + i) << shift;
+		}
+
+		if (expires < next)
+			next = expires;
+	}
+
+	return next;
+}
+
+static int wheel_arm(uint64_t expires)
+{
+	struct itimerspec itimer;
+
+	memset(&itimer, 0, sizeof(itimer));
+
+	if (expires != UINT64_MAX) {
+		itimer.it_value.tv_sec = expires / 1000;
+		itimer.it_value.tv_nsec = (expires % 1000) * 1000 * 1000;
+
+		/* An all zero value would disarm the timer */
+		if (!itimer.it_value.tv_sec && !itimer.it_value.tv_nsec)
+			itimer.it_value.tv_nsec = 1;
+	}
+
+	if (timerfd_settime(wheel_fd, TFD_TIMER_ABSTIME, &itimer, NULL) < 0)
+		return -EIO;
+
+	wheel_armed = expires;
+
+	return 0;
+}
+
+static void wheel_callback(int fd, uint32_t events, void *user_data)
 {
-	struct timeout_data *data = user_data;
 	uint64_t expired;
 	ssize_t result;
 
 	if (events & (EPOLLERR | EPOLLHUP))
 		return;
 
-	result = read(data->fd, &expired, sizeof(expired));
+	result = read(wheel_fd, &expired, sizeof(expired));
 	if (result != sizeof(expired))
 		return;
 
-	if (data->callback)
-		data->callback(data->fd, data->user_data);
+	wheel_armed = UINT64_MAX;
+
+	wheel_running = true;
+	wheel_run(time_now(false));
+	wheel_running = false;
+
+	wheel_arm(wheel_next());
 }
 
-static inline int timeout_set(int fd, unsigned int msec)
+static void wheel_destroy(void *user_data)
 {
-	struct itimerspec itimer;
-	unsigned int sec = msec / 1000;
+	unsigned int i;
 
-	memset(&itimer, 0, sizeof(itimer));
-	itimer.it_interval.tv_sec = 0;
-	itimer.it_interval.tv_nsec = 0;
-	itimer.it_value.tv_sec = sec;
-	itimer.it_value.tv_nsec = (msec - (sec * 1000)) * 1000 * 1000;
+	for (i = 0; i < timeout_list_size; i++) {
+		struct timeout_data *data = timeout_list[i];
+
+		if (!data)
+			continue;
 
-	return timerfd_settime(fd, 0, &itimer, NULL);
+		timeout_list[i] = NULL;
+		timeout_unlink(data);
+
+		if (data->destroy)
+			data->destroy(data->user_data);
+
+		free(data);
+	}
+
+	free(timeout_list);
+	timeout_list = NULL;
+	timeout_list_size = 0;
+	timeout_list_hint = 0;
+
+	close(wheel_fd);
+	wheel_fd = -1;
+	wheel_armed = UINT64_MAX;
+}
+
+static int wheel_init(void)
+{
+	wheel_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (wheel_fd < 0)
+		return -EIO;
+
+	if (mainloop_add_fd(wheel_fd, EPOLLIN, wheel_callback, NULL,
+						wheel_destroy) < 0) {
+		close(wheel_fd);
+		wheel_fd = -1;
+		return -EIO;
+	}
+
+	wheel_now = time_now(false);
+	wheel_armed = UINT64_MAX;
+
+	return 0;
+}
+
+static int timeout_list_add(struct timeout_data *data)
+{
+	struct timeout_data **list;
+	unsigned int i, size;
+
+	for (i = timeout_list_hint; i < timeout_list_size; i++) {
+		if (!timeout_list[i])
+			goto done;
+	}
+
+	size = timeout_list_size ? timeout_list_size << 1 :
+							MIN_TIMEOUT_ENTRIES;
+
+	list = realloc(timeout_list, size * sizeof(*list));
+	if (!list)
+		return -ENOMEM;
+
+	memset(list + timeout_list_size, 0,
+			(size - timeout_list_size) * sizeof(*list));
+
+	i = timeout_list_size;
+	timeout_list = list;
+	timeout_list_size = size;
+
+done:
+	timeout_list[i] = data;
+	timeout_list_hint = i + 1;
+
+	/* Identifiers start at 1 so 0 can be used as invalid */
+	data->id = i + 1;
+
+	return 0;
+}
+
+static struct timeout_data *timeout_lookup(int id)
+{
+	if (id <= 0 || (unsigned int) id > timeout_list_size)
+		return NULL;
+
+	return timeout_list[id - 1];
+}
+
+static int timeout_set(struct timeout_data *data, unsigned int msec)
+{
+	timeout_unlink(data);
+
+	/* Don't let an idle wheel lag behind */
+	if (!wheel_running && !wheel_pending())
+		wheel_now = time_now(false);
+
+	data->expires = time_now(true) + msec;
+
+	wheel_insert(data);
+
+	/* The timer is only rearmed when the timeout is the earliest one */
+	if (wheel_running || data->expires >= wheel_armed)
+		return 0;
+
+	return wheel_arm(data->expires);
 }
 
 int mainloop_add_timeout(unsigned int msec, mainloop_timeout_func callback,
@@ -326,6 +1030,9 @@ int mainloop_add_timeout(unsigned int msec, mainloop_timeout_func callback,
 	if (!callback)
 		return -EINVAL;
 
+	if (wheel_fd < 0 && wheel_init() < 0)
+		return -EIO;
+
 	data = malloc(sizeof(*data));
 	if (!data)
 		return -ENOMEM;
@@ -335,46 +1042,62 @@ int mainloop_add_timeout(unsigned int msec, mainloop_timeout_func callback,
 	data->destroy = destroy;
 	data->user_data = user_data;
 
-	data->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
-	if (data->fd < 0) {
+	if (timeout_list_add(data) < 0) {
 		free(data);
-		return -EIO;
+		return -ENOMEM;
 	}
 
 	if (msec > 0) {
-		if (timeout_set(data->fd, msec) < 0) {
-			close(data->fd);
+		if (timeout_set(data, msec) < 0) {
+			timeout_list[data->id - 1] = NULL;
+			timeout_unlink(data);
 			free(data);
 			return -EIO;
 		}
 	}
 
-	if (mainloop_add_fd(data->fd, EPOLLIN | EPOLLONESHOT,
-				timeout_callback, data, timeout_destroy) < 0) {
-		close(data->fd);
-		free(data);
-		return -EIO;
-	}
-
-	return data->fd;
+	return data->id;
 }
 
 int mainloop_modify_timeout(int id, unsigned int msec)
 {
+	struct timeout_data *data;
+
+	data = timeout_lookup(id);
+	if (!data)
+		return -EIO;
+
 	if (msec > 0) {
-		if (timeout_set(id, msec) < 0)
+		if (timeout_set(data, msec) < 0)
 			return -EIO;
 	}
 
-	if (mainloop_modify_fd(id, EPOLLIN | EPOLLONESHOT) < 0)
-		return -EIO;
-
 	return 0;
 }
 
 int mainloop_remove_timeout(int id)
 {
-	return mainloop_remove_fd(id);
+	struct timeout_data *data;
+
+	if (id <= 0)
+		return -EINVAL;
+
+	data = timeout_lookup(id);
+	if (!data)
+		return -ENXIO;
+
+	timeout_list[id - 1] = NULL;
+	if ((unsigned int) id - 1 < timeout_list_hint)
+		timeout_list_hint = id - 1;
+
+	timeout_unlink(data);
+
+	if (data->destroy)
+		data->destroy(data->user_data);
+
+	free(data);
+
+	return 0;
 }
 
 int mainloop_set_signal(sigset_t *mask, mainloop_signal_func callback,
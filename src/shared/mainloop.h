@@ -30,6 +30,7 @@ typedef void (*mainloop_destroy_func) (void *user_data);
 typedef void (*mainloop_event_func) (int fd, uint32_t events, void *user_data);
 typedef void (*mainloop_timeout_func) (int id, void *user_data);
 typedef void (*mainloop_signal_func) (int signum, void *user_data);
+typedef void (*mainloop_post_func) (void *user_data);
 
 void mainloop_init(void);
 void mainloop_quit(void);
@@ -49,3 +50,9 @@ int mainloop_remove_timeout(int id);
 
 int mainloop_set_signal(sigset_t *mask, mainloop_signal_func callback,
 				void *user_data, mainloop_destroy_func destroy);
+
+int mainloop_set_workers(unsigned int count);
+unsigned int mainloop_get_workers(void);
+unsigned int mainloop_get_worker(void);
+int mainloop_post(unsigned int worker, mainloop_post_func callback,
+				void *user_data, mainloop_destroy_func destroy);
@@ -29,6 +29,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #include "lib/bluetooth.h"
 #include "lib/mgmt.h"
@@ -37,8 +38,17 @@
 #include "src/shared/io.h"
 #include "src/shared/queue.h"
 #include "src/shared/util.h"
+#include "src/shared/trace.h"
 #include "src/shared/mgmt.h"
 
+/*
+ * Event handlers are kept in per event code buckets, so dispatching an
+ * event only walks the handlers registered for it. Event codes are small
+ * and dense, so the low bits are used as bucket index.
+ */
+#define NOTIFY_TABLE_SIZE 64
+#define NOTIFY_TABLE_MASK (NOTIFY_TABLE_SIZE - 1)
+
 struct mgmt {
 	int ref_count;
 	int fd;
@@ -48,7 +58,8 @@ struct mgmt {
 	struct queue *request_queue;
 	struct queue *reply_queue;
 	struct queue *pending_list;
-	struct queue *notify_list;
+	struct queue *notify_table[NOTIFY_TABLE_SIZE];
+	unsigned int max_pending;
 	unsigned int next_request_id;
 	unsigned int next_notify_id;
 	bool need_notify_cleanup;
@@ -58,6 +69,9 @@ struct mgmt {
 	mgmt_debug_func_t debug_callback;
 	mgmt_destroy_func_t debug_destroy;
 	void *debug_data;
+	mgmt_complete_func_t complete_callback;
+	mgmt_destroy_func_t complete_destroy;
+	void *complete_data;
 };
 
 struct mgmt_request {
@@ -69,6 +83,16 @@ struct mgmt_request {
 	mgmt_request_func_t callback;
 	mgmt_destroy_func_t destroy;
 	void *user_data;
+	struct timespec sent;
+};
+
+struct mgmt_bulk {
+	int ref_count;
+	unsigned int remaining;
+	uint8_t status;
+	mgmt_request_func_t callback;
+	mgmt_destroy_func_t destroy;
+	void *user_data;
 };
 
 struct mgmt_notify {
@@ -183,11 +207,43 @@ static bool send_request(struct mgmt *mgmt, struct mgmt_request *request)
 	util_hexdump('<', request->buf, ret, mgmt->debug_callback,
 							mgmt->debug_data);
 
+	/* Only pay for the clock read when someone tracks the latency */
+	if (mgmt->complete_callback)
+		clock_gettime(CLOCK_MONOTONIC, &request->sent);
+
 	queue_push_tail(mgmt->pending_list, request);
 
 	return true;
 }
 
+/*
+ * Replies are matched by opcode and index, and the kernel rejects some
+ * commands while others are pending for the same controller. So even when
+ * pipelining only one command per controller index is ever in flight.
+ */
+static struct mgmt_request *next_request(struct mgmt *mgmt)
+{
+	const struct queue_entry *entry;
+
+	if (queue_length(mgmt->pending_list) >= mgmt->max_pending)
+		return NULL;
+
+	for (entry = queue_get_entries(mgmt->request_queue); entry;
+							entry = entry->next) {
+		struct mgmt_request *request = entry->data;
+
+		if (queue_find(mgmt->pending_list, match_request_index,
+						UINT_TO_PTR(request->index)))
+			continue;
+
+		queue_remove(mgmt->request_queue, request);
+
+		return request;
+	}
+
+	return NULL;
+}
+
 static bool can_write_data(struct io *io, void *user_data)
 {
 	struct mgmt *mgmt = user_data;
@@ -197,14 +253,12 @@ static bool can_write_data(struct io *io, void *user_data)
 	request = queue_pop_head(mgmt->reply_queue);
 	if (!request) {
 		/* only reply commands can jump the queue */
-		if (!queue_isempty(mgmt->pending_list))
-			return false;
-
-		request = queue_pop_head(mgmt->request_queue);
+		request = next_request(mgmt);
 		if (!request)
 			return false;
 
-		can_write = false;
+		can_write = queue_length(mgmt->pending_list) + 1 <
+							mgmt->max_pending;
 	} else {
 		/* allow multiple replies to jump the queue */
 		can_write = !queue_isempty(mgmt->reply_queue);
@@ -218,7 +272,7 @@ static bool can_write_data(struct io *io, void *user_data)
 
 static void wakeup_writer(struct mgmt *mgmt)
 {
-	if (!queue_isempty(mgmt->pending_list)) {
+	if (queue_length(mgmt->pending_list) >= mgmt->max_pending) {
 		/* only queued reply commands trigger wakeup */
 		if (queue_isempty(mgmt->reply_queue))
 			return;
@@ -257,6 +311,18 @@ static void request_complete(struct mgmt *mgmt, uint8_t status,
 	request = queue_remove_if(mgmt->pending_list,
 					match_request_opcode_index, &match);
 	if (request) {
+		if (mgmt->complete_callback) {
+			struct timespec now;
+			uint64_t usec;
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			usec = (now.tv_sec - request->sent.tv_sec) * 1000000ULL +
+				(now.tv_nsec - request->sent.tv_nsec) / 1000;
+
+			mgmt->complete_callback(opcode, index, status, usec,
+							mgmt->complete_data);
+		}
+
 		if (request->callback)
 			request->callback(status, length, param,
 							request->user_data);
@@ -293,23 +359,35 @@ static void notify_handler(void *data, void *user_data)
 							notify->user_data);
 }
 
+static void notify_cleanup(struct mgmt *mgmt)
+{
+	unsigned int i;
+
+	for (i = 0; i < NOTIFY_TABLE_SIZE; i++)
+		queue_remove_all(mgmt->notify_table[i], match_notify_removed,
+							NULL, destroy_notify);
+
+	mgmt->need_notify_cleanup = false;
+}
+
 static void process_notify(struct mgmt *mgmt, uint16_t event, uint16_t index,
 					uint16_t length, const void *param)
 {
 	struct event_index match = { .event = event, .index = index,
 					.length = length, .param = param };
+	struct queue *bucket = mgmt->notify_table[event & NOTIFY_TABLE_MASK];
+
+	if (!bucket)
+		return;
 
 	mgmt->in_notify = true;
 
-	queue_foreach(mgmt->notify_list, notify_handler, &match);
+	queue_foreach(bucket, notify_handler, &match);
 
 	mgmt->in_notify = false;
 
-	if (mgmt->need_notify_cleanup) {
-		queue_remove_all(mgmt->notify_list, match_notify_removed,
-							NULL, destroy_notify);
-		mgmt->need_notify_cleanup = false;
-	}
+	if (mgmt->need_notify_cleanup)
+		notify_cleanup(mgmt);
 }
 
 static bool can_read_data(struct io *io, void *user_data)
@@ -336,6 +414,8 @@ static bool can_read_data(struct io *io, void *user_data)
 	index = btohs(hdr->index);
 	length = btohs(hdr->len);
 
+	BT_TRACE3(mgmt_rx, event, index, length);
+
 	if (bytes_read < length + MGMT_HDR_SIZE)
 		return true;
 
@@ -405,10 +485,9 @@ struct mgmt *mgmt_new(int fd)
 	mgmt->request_queue = queue_new();
 	mgmt->reply_queue = queue_new();
 	mgmt->pending_list = queue_new();
-	mgmt->notify_list = queue_new();
+	mgmt->max_pending = 1;
 
 	if (!io_set_read_handler(mgmt->io, can_read_data, mgmt, NULL)) {
-		queue_destroy(mgmt->notify_list, NULL);
 		queue_destroy(mgmt->pending_list, NULL);
 		queue_destroy(mgmt->reply_queue, NULL);
 		queue_destroy(mgmt->request_queue, NULL);
@@ -494,11 +573,18 @@ void mgmt_unref(struct mgmt *mgmt)
 	if (mgmt->debug_destroy)
 		mgmt->debug_destroy(mgmt->debug_data);
 
+	if (mgmt->complete_destroy)
+		mgmt->complete_destroy(mgmt->complete_data);
+
 	free(mgmt->buf);
 	mgmt->buf = NULL;
 
 	if (!mgmt->in_notify) {
-		queue_destroy(mgmt->notify_list, NULL);
+		unsigned int i;
+
+		for (i = 0; i < NOTIFY_TABLE_SIZE; i++)
+			queue_destroy(mgmt->notify_table[i], NULL);
+
 		queue_destroy(mgmt->pending_list, NULL);
 		free(mgmt);
 		return;
@@ -521,6 +607,23 @@ bool mgmt_set_debug(struct mgmt *mgmt, mgmt_debug_func_t callback,
 	return true;
 }
 
+bool mgmt_set_complete_handler(struct mgmt *mgmt,
+				mgmt_complete_func_t callback,
+				void *user_data, mgmt_destroy_func_t destroy)
+{
+	if (!mgmt)
+		return false;
+
+	if (mgmt->complete_destroy)
+		mgmt->complete_destroy(mgmt->complete_data);
+
+	mgmt->complete_callback = callback;
+	mgmt->complete_destroy = destroy;
+	mgmt->complete_data = user_data;
+
+	return true;
+}
+
 bool mgmt_set_close_on_unref(struct mgmt *mgmt, bool do_close)
 {
 	if (!mgmt)
@@ -531,13 +634,50 @@ bool mgmt_set_close_on_unref(struct mgmt *mgmt, bool do_close)
 	return true;
 }
 
+bool mgmt_set_max_pending(struct mgmt *mgmt, unsigned int max_pending)
+{
+	if (!mgmt || !max_pending)
+		return false;
+
+	mgmt->max_pending = max_pending;
+
+	wakeup_writer(mgmt);
+
+	return true;
+}
+
+static struct mgmt_request *new_request(uint16_t opcode, uint16_t index,
+				uint16_t length, void *buf,
+				mgmt_request_func_t callback,
+				void *user_data, mgmt_destroy_func_t destroy)
+{
+	struct mgmt_request *request;
+	struct mgmt_hdr *hdr = buf;
+
+	hdr->opcode = htobs(opcode);
+	hdr->index = htobs(index);
+	hdr->len = htobs(length);
+
+	request = new0(struct mgmt_request, 1);
+	request->len = length + MGMT_HDR_SIZE;
+	request->buf = buf;
+
+	request->opcode = opcode;
+	request->index = index;
+
+	request->callback = callback;
+	request->destroy = destroy;
+	request->user_data = user_data;
+
+	return request;
+}
+
 static struct mgmt_request *create_request(uint16_t opcode, uint16_t index,
 				uint16_t length, const void *param,
 				mgmt_request_func_t callback,
 				void *user_data, mgmt_destroy_func_t destroy)
 {
-	struct mgmt_request *request;
-	struct mgmt_hdr *hdr;
+	uint8_t *buf;
 
 	if (!opcode)
 		return NULL;
@@ -545,30 +685,34 @@ static struct mgmt_request *create_request(uint16_t opcode, uint16_t index,
 	if (length > 0 && !param)
 		return NULL;
 
-	request = new0(struct mgmt_request, 1);
-	request->len = length + MGMT_HDR_SIZE;
-	request->buf = malloc(request->len);
-	if (!request->buf) {
-		free(request);
+	buf = malloc(length + MGMT_HDR_SIZE);
+	if (!buf)
 		return NULL;
-	}
 
 	if (length > 0)
-		memcpy(request->buf + MGMT_HDR_SIZE, param, length);
+		memcpy(buf + MGMT_HDR_SIZE, param, length);
 
-	hdr = request->buf;
-	hdr->opcode = htobs(opcode);
-	hdr->index = htobs(index);
-	hdr->len = htobs(length);
+	return new_request(opcode, index, length, buf, callback, user_data,
+								destroy);
+}
 
-	request->opcode = opcode;
-	request->index = index;
+static unsigned int queue_request(struct mgmt *mgmt,
+					struct mgmt_request *request)
+{
+	if (mgmt->next_request_id < 1)
+		mgmt->next_request_id = 1;
 
-	request->callback = callback;
-	request->destroy = destroy;
-	request->user_data = user_data;
+	request->id = mgmt->next_request_id++;
 
-	return request;
+	if (!queue_push_tail(mgmt->request_queue, request)) {
+		free(request->buf);
+		free(request);
+		return 0;
+	}
+
+	wakeup_writer(mgmt);
+
+	return request->id;
 }
 
 unsigned int mgmt_send(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
@@ -586,20 +730,61 @@ unsigned int mgmt_send(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
 	if (!request)
 		return 0;
 
-	if (mgmt->next_request_id < 1)
-		mgmt->next_request_id = 1;
+	return queue_request(mgmt, request);
+}
 
-	request->id = mgmt->next_request_id++;
+void *mgmt_buf_new(uint16_t length)
+{
+	uint8_t *buf;
 
-	if (!queue_push_tail(mgmt->request_queue, request)) {
-		free(request->buf);
-		free(request);
+	buf = calloc(1, length + MGMT_HDR_SIZE);
+	if (!buf)
+		return NULL;
+
+	return buf + MGMT_HDR_SIZE;
+}
+
+void *mgmt_buf_resize(void *param, uint16_t length)
+{
+	uint8_t *buf;
+
+	if (!param)
+		return mgmt_buf_new(length);
+
+	buf = realloc((uint8_t *) param - MGMT_HDR_SIZE,
+						length + MGMT_HDR_SIZE);
+	if (!buf)
+		return NULL;
+
+	return buf + MGMT_HDR_SIZE;
+}
+
+void mgmt_buf_free(void *param)
+{
+	if (param)
+		free((uint8_t *) param - MGMT_HDR_SIZE);
+}
+
+unsigned int mgmt_send_buf(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
+				uint16_t length, void *param,
+				mgmt_request_func_t callback,
+				void *user_data, mgmt_destroy_func_t destroy)
+{
+	struct mgmt_request *request;
+
+	if (!param)
+		return 0;
+
+	if (!mgmt || !opcode) {
+		mgmt_buf_free(param);
 		return 0;
 	}
 
-	wakeup_writer(mgmt);
+	request = new_request(opcode, index, length,
+				(uint8_t *) param - MGMT_HDR_SIZE,
+				callback, user_data, destroy);
 
-	return request->id;
+	return queue_request(mgmt, request);
 }
 
 unsigned int mgmt_send_nowait(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
@@ -659,6 +844,99 @@ unsigned int mgmt_reply(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
 	return request->id;
 }
 
+static struct mgmt_bulk *bulk_ref(struct mgmt_bulk *bulk)
+{
+	__sync_fetch_and_add(&bulk->ref_count, 1);
+
+	return bulk;
+}
+
+static void bulk_unref(void *data)
+{
+	struct mgmt_bulk *bulk = data;
+
+	if (__sync_sub_and_fetch(&bulk->ref_count, 1))
+		return;
+
+	if (bulk->destroy)
+		bulk->destroy(bulk->user_data);
+
+	free(bulk);
+}
+
+static void bulk_complete(uint8_t status, uint16_t length, const void *param,
+							void *user_data)
+{
+	struct mgmt_bulk *bulk = user_data;
+
+	/* Report the status of the first command that failed */
+	if (status && !bulk->status)
+		bulk->status = status;
+
+	if (--bulk->remaining)
+		return;
+
+	if (bulk->callback)
+		bulk->callback(bulk->status, 0, NULL, bulk->user_data);
+}
+
+bool mgmt_send_bulk(struct mgmt *mgmt, uint16_t index,
+				const struct mgmt_bulk_request *requests,
+				unsigned int count, mgmt_request_func_t callback,
+				void *user_data, mgmt_destroy_func_t destroy)
+{
+	struct mgmt_request **list;
+	struct mgmt_bulk *bulk;
+	unsigned int i;
+
+	if (!mgmt || !requests || !count)
+		return false;
+
+	list = new0(struct mgmt_request *, count);
+	bulk = new0(struct mgmt_bulk, 1);
+
+	/* Create all requests first, so that none is sent on failure */
+	for (i = 0; i < count; i++) {
+		list[i] = create_request(requests[i].opcode, index,
+					requests[i].length, requests[i].param,
+					bulk_complete, bulk, bulk_unref);
+		if (!list[i])
+			goto failed;
+	}
+
+	bulk->remaining = count;
+	bulk->callback = callback;
+	bulk->destroy = destroy;
+	bulk->user_data = user_data;
+
+	for (i = 0; i < count; i++) {
+		if (mgmt->next_request_id < 1)
+			mgmt->next_request_id = 1;
+
+		list[i]->id = mgmt->next_request_id++;
+
+		bulk_ref(bulk);
+		queue_push_tail(mgmt->request_queue, list[i]);
+	}
+
+	free(list);
+
+	wakeup_writer(mgmt);
+
+	return true;
+
+failed:
+	while (i--) {
+		free(list[i]->buf);
+		free(list[i]);
+	}
+
+	free(list);
+	free(bulk);
+
+	return false;
+}
+
 bool mgmt_cancel(struct mgmt *mgmt, unsigned int id)
 {
 	struct mgmt_request *request;
@@ -721,10 +999,15 @@ unsigned int mgmt_register(struct mgmt *mgmt, uint16_t event, uint16_t index,
 				void *user_data, mgmt_destroy_func_t destroy)
 {
 	struct mgmt_notify *notify;
+	struct queue **bucket;
 
 	if (!mgmt || !event)
 		return 0;
 
+	bucket = &mgmt->notify_table[event & NOTIFY_TABLE_MASK];
+	if (!*bucket)
+		*bucket = queue_new();
+
 	notify = new0(struct mgmt_notify, 1);
 	notify->event = event;
 	notify->index = index;
@@ -738,7 +1021,7 @@ unsigned int mgmt_register(struct mgmt *mgmt, uint16_t event, uint16_t index,
 
 	notify->id = mgmt->next_notify_id++;
 
-	if (!queue_push_tail(mgmt->notify_list, notify)) {
+	if (!queue_push_tail(*bucket, notify)) {
 		free(notify);
 		return 0;
 	}
@@ -749,53 +1032,76 @@ unsigned int mgmt_register(struct mgmt *mgmt, uint16_t event, uint16_t index,
 bool mgmt_unregister(struct mgmt *mgmt, unsigned int id)
 {
 	struct mgmt_notify *notify;
+	unsigned int i;
 
 	if (!mgmt || !id)
 		return false;
 
-	notify = queue_remove_if(mgmt->notify_list, match_notify_id,
+	for (i = 0; i < NOTIFY_TABLE_SIZE; i++) {
+		struct queue *bucket = mgmt->notify_table[i];
+
+		if (mgmt->in_notify) {
+			notify = queue_find(bucket, match_notify_id,
 							UINT_TO_PTR(id));
-	if (!notify)
-		return false;
+			if (!notify || notify->removed)
+				continue;
 
-	if (!mgmt->in_notify) {
-		destroy_notify(notify);
-		return true;
-	}
+			notify->removed = true;
+			mgmt->need_notify_cleanup = true;
 
-	notify->removed = true;
-	mgmt->need_notify_cleanup = true;
+			return true;
+		}
 
-	return true;
+		notify = queue_remove_if(bucket, match_notify_id,
+							UINT_TO_PTR(id));
+		if (notify) {
+			destroy_notify(notify);
+			return true;
+		}
+	}
+
+	return false;
 }
 
 bool mgmt_unregister_index(struct mgmt *mgmt, uint16_t index)
 {
+	unsigned int i;
+
 	if (!mgmt)
 		return false;
 
-	if (mgmt->in_notify) {
-		queue_foreach(mgmt->notify_list, mark_notify_removed,
+	for (i = 0; i < NOTIFY_TABLE_SIZE; i++) {
+		struct queue *bucket = mgmt->notify_table[i];
+
+		if (mgmt->in_notify) {
+			queue_foreach(bucket, mark_notify_removed,
 							UINT_TO_PTR(index));
-		mgmt->need_notify_cleanup = true;
-	} else
-		queue_remove_all(mgmt->notify_list, match_notify_index,
+			mgmt->need_notify_cleanup = true;
+		} else
+			queue_remove_all(bucket, match_notify_index,
 					UINT_TO_PTR(index), destroy_notify);
+	}
 
 	return true;
 }
 
 bool mgmt_unregister_all(struct mgmt *mgmt)
 {
+	unsigned int i;
+
 	if (!mgmt)
 		return false;
 
-	if (mgmt->in_notify) {
-		queue_foreach(mgmt->notify_list, mark_notify_removed,
+	for (i = 0; i < NOTIFY_TABLE_SIZE; i++) {
+		struct queue *bucket = mgmt->notify_table[i];
+
+		if (mgmt->in_notify) {
+			queue_foreach(bucket, mark_notify_removed,
 						UINT_TO_PTR(MGMT_INDEX_NONE));
-		mgmt->need_notify_cleanup = true;
-	} else
-		queue_remove_all(mgmt->notify_list, NULL, NULL, destroy_notify);
+			mgmt->need_notify_cleanup = true;
+		} else
+			queue_remove_all(bucket, NULL, NULL, destroy_notify);
+	}
 
 	return true;
 }
@@ -41,7 +41,20 @@ typedef void (*mgmt_debug_func_t)(const char *str, void *user_data);
 bool mgmt_set_debug(struct mgmt *mgmt, mgmt_debug_func_t callback,
 				void *user_data, mgmt_destroy_func_t destroy);
 
+/*
+ * Called for every command reply with the time in microseconds between
+ * writing the command and receiving its Command Complete/Status event.
+ */
+typedef void (*mgmt_complete_func_t)(uint16_t opcode, uint16_t index,
+					uint8_t status, uint64_t usec,
+					void *user_data);
+
+bool mgmt_set_complete_handler(struct mgmt *mgmt,
+				mgmt_complete_func_t callback,
+				void *user_data, mgmt_destroy_func_t destroy);
+
 bool mgmt_set_close_on_unref(struct mgmt *mgmt, bool do_close);
+bool mgmt_set_max_pending(struct mgmt *mgmt, unsigned int max_pending);
 
 typedef void (*mgmt_request_func_t)(uint8_t status, uint16_t length,
 					const void *param, void *user_data);
@@ -50,6 +63,18 @@ unsigned int mgmt_send(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
 				uint16_t length, const void *param,
 				mgmt_request_func_t callback,
 				void *user_data, mgmt_destroy_func_t destroy);
+/*
+ * Command buffers with room for the mgmt header in front of the parameters,
+ * so that large commands can be built in place and queued without a copy.
+ * mgmt_send_buf takes ownership of the buffer, also on failure.
+ */
+void *mgmt_buf_new(uint16_t length);
+void *mgmt_buf_resize(void *param, uint16_t length);
+void mgmt_buf_free(void *param);
+unsigned int mgmt_send_buf(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
+				uint16_t length, void *param,
+				mgmt_request_func_t callback,
+				void *user_data, mgmt_destroy_func_t destroy);
 unsigned int mgmt_send_nowait(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
 				uint16_t length, const void *param,
 				mgmt_request_func_t callback,
@@ -58,6 +83,17 @@ unsigned int mgmt_reply(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
 				uint16_t length, const void *param,
 				mgmt_request_func_t callback,
 				void *user_data, mgmt_destroy_func_t destroy);
+
+struct mgmt_bulk_request {
+	uint16_t opcode;
+	uint16_t length;
+	const void *param;
+};
+
+bool mgmt_send_bulk(struct mgmt *mgmt, uint16_t index,
+				const struct mgmt_bulk_request *requests,
+				unsigned int count, mgmt_request_func_t callback,
+				void *user_data, mgmt_destroy_func_t destroy);
 bool mgmt_cancel(struct mgmt *mgmt, unsigned int id);
 bool mgmt_cancel_index(struct mgmt *mgmt, uint16_t index);
 bool mgmt_cancel_all(struct mgmt *mgmt);
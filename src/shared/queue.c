@@ -25,6 +25,8 @@
 #include <config.h>
 #endif
 
+#include <pthread.h>
+
 #include "src/shared/util.h"
 #include "src/shared/queue.h"
 
@@ -35,6 +37,8 @@ struct queue {
 	unsigned int entries;
 };
 
+static __thread struct queue_alloc_stats queue_stats;
+
 static struct queue *queue_ref(struct queue *queue)
 {
 	if (!queue)
@@ -75,16 +79,193 @@ void queue_destroy(struct queue *queue, queue_destroy_func_t destroy)
 	queue_unref(queue);
 }
 
+#ifdef HAVE_QUEUE_SLABS
+/*
+ * Entries are carved out of slabs and recycled through a per thread free
+ * list instead of going through malloc and free on every push and pop.
+ *
+ * Each slab counts its entries in use plus one reference held by the
+ * owning thread. Entries freed by another thread are not put on that
+ * thread's free list, they only drop their slab reference; the owner
+ * reclaims a slab once all of its entries are back. When the owning
+ * thread exits it drops its reference, and the last entry released frees
+ * the slab.
+ */
+#define QUEUE_SLAB_ENTRIES 64
+
+struct queue_slab {
+	struct queue_slab *next;
+	const void *owner;
+	int refs;
+	struct queue_entry entries[QUEUE_SLAB_ENTRIES];
+};
+
+static __thread struct queue_slab *queue_slabs;
+static __thread struct queue_entry *queue_free_entries;
+
+static pthread_key_t queue_slab_key;
+static pthread_once_t queue_slab_once = PTHREAD_ONCE_INIT;
+
+static void queue_slab_unref(struct queue_slab *slab)
+{
+	if (!__sync_sub_and_fetch(&slab->refs, 1))
+		free(slab);
+}
+
+static void queue_slabs_release(void *data)
+{
+	struct queue_slab *slab = data;
+
+	queue_slabs = NULL;
+	queue_free_entries = NULL;
+
+	while (slab) {
+		struct queue_slab *next = slab->next;
+
+		slab->owner = NULL;
+		queue_slab_unref(slab);
+		slab = next;
+	}
+}
+
+static void queue_slab_key_init(void)
+{
+	pthread_key_create(&queue_slab_key, queue_slabs_release);
+}
+
+static void queue_slab_fill(struct queue_slab *slab)
+{
+	unsigned int i;
+
+	for (i = 0; i < QUEUE_SLAB_ENTRIES; i++) {
+		slab->entries[i].next = queue_free_entries;
+		queue_free_entries = &slab->entries[i];
+	}
+
+	queue_stats.cached += QUEUE_SLAB_ENTRIES;
+}
+
+static bool queue_slab_reclaim(void)
+{
+	struct queue_slab *slab;
+
+	/*
+	 * Only called with an empty free list, so a slab without entries
+	 * in use has none of them on the list either.
+	 */
+	for (slab = queue_slabs; slab; slab = slab->next) {
+		if (__sync_fetch_and_add(&slab->refs, 0) == 1) {
+			queue_slab_fill(slab);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void queue_slab_new(void)
+{
+	struct queue_slab *slab;
+	unsigned int i;
+
+	pthread_once(&queue_slab_once, queue_slab_key_init);
+
+	slab = new0(struct queue_slab, 1);
+	slab->owner = &queue_free_entries;
+	slab->refs = 1;
+	slab->next = queue_slabs;
+	queue_slabs = slab;
+
+	for (i = 0; i < QUEUE_SLAB_ENTRIES; i++)
+		slab->entries[i].slab = slab;
+
+	pthread_setspecific(queue_slab_key, queue_slabs);
+
+	queue_slab_fill(slab);
+	queue_stats.slabs++;
+}
+
+static struct queue_entry *queue_entry_alloc(void)
+{
+	struct queue_entry *entry;
+
+	if (!queue_free_entries && !queue_slab_reclaim())
+		queue_slab_new();
+
+	entry = queue_free_entries;
+	queue_free_entries = entry->next;
+
+	__sync_fetch_and_add(&entry->slab->refs, 1);
+	queue_stats.cached--;
+
+	return entry;
+}
+
+static void queue_entry_release(struct queue_entry *entry)
+{
+	struct queue_slab *slab = entry->slab;
+
+	if (slab->owner == &queue_free_entries) {
+		entry->data = NULL;
+		entry->next = queue_free_entries;
+		queue_free_entries = entry;
+		queue_stats.cached++;
+	}
+
+	queue_slab_unref(slab);
+}
+#else
+/* Plain allocations keep use after free of entries visible to debuggers */
+static struct queue_entry *queue_entry_alloc(void)
+{
+	return new0(struct queue_entry, 1);
+}
+
+static void queue_entry_release(struct queue_entry *entry)
+{
+	free(entry);
+}
+#endif
+
 static struct queue_entry *queue_entry_new(void *data)
 {
 	struct queue_entry *entry;
 
-	entry = new0(struct queue_entry, 1);
+	entry = queue_entry_alloc();
 	entry->data = data;
+	entry->next = NULL;
+	entry->ref_count = 1;
+
+	queue_stats.allocs++;
+	queue_stats.in_use++;
 
 	return entry;
 }
 
+static struct queue_entry *queue_entry_ref(struct queue_entry *entry)
+{
+	entry->ref_count++;
+
+	return entry;
+}
+
+static void queue_entry_unref(struct queue_entry *entry)
+{
+	if (--entry->ref_count)
+		return;
+
+	queue_stats.frees++;
+	queue_stats.in_use--;
+
+	queue_entry_release(entry);
+}
+
+void queue_get_alloc_stats(struct queue_alloc_stats *stats)
+{
+	if (stats)
+		*stats = queue_stats;
+}
+
 bool queue_push_tail(struct queue *queue, void *data)
 {
 	struct queue_entry *entry;
@@ -178,7 +359,7 @@ void *queue_pop_head(struct queue *queue)
 
 	data = entry->data;
 
-	free(entry);
+	queue_entry_unref(entry);
 	queue->entries--;
 
 	return data;
@@ -212,12 +393,20 @@ void queue_foreach(struct queue *queue, queue_foreach_func_t function,
 	if (!entry)
 		return;
 
+	/*
+	 * The current entry is kept alive across the callback and its next
+	 * pointer is only read afterwards, so the callback may remove the
+	 * current or the following entry. Removing the current entry and
+	 * then the one following it from the same callback is not supported.
+	 */
 	queue_ref(queue);
 	while (entry && queue->head && queue->ref_count > 1) {
 		struct queue_entry *next;
 
-		next = entry->next;
+		queue_entry_ref(entry);
 		function(entry->data, user_data);
+		next = entry->next;
+		queue_entry_unref(entry);
 		entry = next;
 	}
 	queue_unref(queue);
@@ -266,7 +455,7 @@ bool queue_remove(struct queue *queue, void *data)
 		if (!entry->next)
 			queue->tail = prev;
 
-		free(entry);
+		queue_entry_unref(entry);
 		queue->entries--;
 
 		return true;
@@ -299,7 +488,7 @@ void *queue_remove_if(struct queue *queue, queue_match_func_t function,
 
 			data = entry->data;
 
-			free(entry);
+			queue_entry_unref(entry);
 			queue->entries--;
 
 			return data;
@@ -350,7 +539,7 @@ unsigned int queue_remove_all(struct queue *queue, queue_match_func_t function,
 			if (destroy)
 				destroy(tmp->data);
 
-			free(tmp);
+			queue_entry_unref(tmp);
 			count++;
 		}
 	}
@@ -374,6 +563,14 @@ unsigned int queue_length(struct queue *queue)
 	return queue->entries;
 }
 
+size_t queue_get_footprint(struct queue *queue)
+{
+	if (!queue)
+		return 0;
+
+	return sizeof(*queue) + queue->entries * sizeof(struct queue_entry);
+}
+
 bool queue_isempty(struct queue *queue)
 {
 	if (!queue)
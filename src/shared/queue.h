@@ -22,6 +22,7 @@
  */
 
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef void (*queue_destroy_func_t)(void *data);
 
@@ -30,6 +31,9 @@ struct queue;
 struct queue_entry {
 	void *data;
 	struct queue_entry *next;
+	/* Private to the queue implementation */
+	int ref_count;
+	struct queue_slab *slab;
 };
 
 struct queue *queue_new(void);
@@ -61,4 +65,15 @@ unsigned int queue_remove_all(struct queue *queue, queue_match_func_t function,
 const struct queue_entry *queue_get_entries(struct queue *queue);
 
 unsigned int queue_length(struct queue *queue);
+size_t queue_get_footprint(struct queue *queue);
 bool queue_isempty(struct queue *queue);
+
+struct queue_alloc_stats {
+	unsigned long allocs;
+	unsigned long frees;
+	unsigned long slabs;
+	unsigned long in_use;
+	unsigned long cached;
+};
+
+void queue_get_alloc_stats(struct queue_alloc_stats *stats);
@@ -27,8 +27,11 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
 #include <sys/param.h>
+#include <sys/syscall.h>
 
 #include "src/shared/util.h"
 #include "src/shared/ringbuf.h"
@@ -37,11 +40,16 @@
 #define MIN(x,y) ((x)<(y)?(x):(y))
 #endif
 
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
 struct ringbuf {
 	void *buffer;
 	size_t size;
 	size_t in;
 	size_t out;
+	bool mirrored;
 	ringbuf_tracing_func_t in_tracing;
 	void *in_data;
 };
@@ -85,15 +93,114 @@ struct ringbuf *ringbuf_new(size_t size)
 	return ringbuf;
 }
 
+static int mirror_memfd(void)
+{
+#ifdef SYS_memfd_create
+	return syscall(SYS_memfd_create, "ringbuf", MFD_CLOEXEC);
+#else
+	return -1;
+#endif
+}
+
+/*
+ * Map the same pages twice back to back, so that any span of up to size
+ * bytes starting within the first mapping is contiguous in memory.
+ */
+static void *mirror_alloc(size_t size)
+{
+	void *addr;
+	int fd;
+
+	fd = mirror_memfd();
+	if (fd < 0)
+		return NULL;
+
+	if (ftruncate(fd, size) < 0)
+		goto failed;
+
+	addr = mmap(NULL, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+								-1, 0);
+	if (addr == MAP_FAILED)
+		goto failed;
+
+	if (mmap(addr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+						fd, 0) == MAP_FAILED ||
+			mmap(addr + size, size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap(addr, size * 2);
+		goto failed;
+	}
+
+	close(fd);
+
+	return addr;
+
+failed:
+	close(fd);
+	return NULL;
+}
+
+struct ringbuf *ringbuf_new_mirrored(size_t size)
+{
+	struct ringbuf *ringbuf;
+	size_t real_size;
+	long page_size;
+
+	if (size < 2 || size > UINT_MAX / 2)
+		return NULL;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (page_size <= 0)
+		return NULL;
+
+	/* Mappings need to cover whole pages */
+	real_size = align_power2(MAX(size, (size_t) page_size));
+
+	ringbuf = new0(struct ringbuf, 1);
+	ringbuf->buffer = mirror_alloc(real_size);
+	if (!ringbuf->buffer) {
+		free(ringbuf);
+		return NULL;
+	}
+
+	ringbuf->size = real_size;
+	ringbuf->in = RINGBUF_RESET;
+	ringbuf->out = RINGBUF_RESET;
+	ringbuf->mirrored = true;
+
+	return ringbuf;
+}
+
 void ringbuf_free(struct ringbuf *ringbuf)
 {
 	if (!ringbuf)
 		return;
 
-	free(ringbuf->buffer);
+	if (ringbuf->mirrored)
+		munmap(ringbuf->buffer, ringbuf->size * 2);
+	else
+		free(ringbuf->buffer);
+
 	free(ringbuf);
 }
 
+bool ringbuf_is_mirrored(struct ringbuf *ringbuf)
+{
+	if (!ringbuf)
+		return false;
+
+	return ringbuf->mirrored;
+}
+
+/* Length of a span starting at offset that can be accessed without wrapping */
+static size_t span_nowrap(struct ringbuf *ringbuf, size_t offset, size_t len)
+{
+	if (ringbuf->mirrored)
+		return len;
+
+	return MIN(len, ringbuf->size - offset);
+}
+
 bool ringbuf_set_input_tracing(struct ringbuf *ringbuf,
 			ringbuf_tracing_func_t callback, void *user_data)
 {
@@ -152,7 +259,9 @@ void *ringbuf_peek(struct ringbuf *ringbuf, size_t offset, size_t *len_nowrap)
 
 	if (len_nowrap) {
 		size_t len = ringbuf->in - ringbuf->out;
-		*len_nowrap = MIN(len, ringbuf->size - offset);
+
+		/* Mirrored buffers hand out the whole readable span at once */
+		*len_nowrap = span_nowrap(ringbuf, offset, len);
 	}
 
 	return ringbuf->buffer + offset;
@@ -174,7 +283,7 @@ ssize_t ringbuf_write(struct ringbuf *ringbuf, int fd)
 
 	/* Grab data from buffer starting at offset until the end */
 	offset = ringbuf->out & (ringbuf->size - 1);
-	end = MIN(len, ringbuf->size - offset);
+	end = span_nowrap(ringbuf, offset, len);
 
 	iov[0].iov_base = ringbuf->buffer + offset;
 	iov[0].iov_len = end;
@@ -242,7 +351,7 @@ int ringbuf_vprintf(struct ringbuf *ringbuf, const char *format, va_list ap)
 
 	/* Determine possible length of string before wrapping */
 	offset = ringbuf->in & (ringbuf->size - 1);
-	end = MIN((size_t) len, ringbuf->size - offset);
+	end = span_nowrap(ringbuf, offset, len);
 	memcpy(ringbuf->buffer + offset, str, end);
 
 	if (ringbuf->in_tracing)
@@ -281,7 +390,7 @@ ssize_t ringbuf_read(struct ringbuf *ringbuf, int fd)
 
 	/* Determine how much to consume before wrapping */
 	offset = ringbuf->in & (ringbuf->size - 1);
-	end = MIN(avail, ringbuf->size - offset);
+	end = span_nowrap(ringbuf, offset, avail);
 
 	iov[0].iov_base = ringbuf->buffer + offset;
 	iov[0].iov_len = end;
@@ -31,8 +31,11 @@ typedef void (*ringbuf_tracing_func_t)(const void *buf, size_t count,
 struct ringbuf;
 
 struct ringbuf *ringbuf_new(size_t size);
+struct ringbuf *ringbuf_new_mirrored(size_t size);
 void ringbuf_free(struct ringbuf *ringbuf);
 
+bool ringbuf_is_mirrored(struct ringbuf *ringbuf);
+
 bool ringbuf_set_input_tracing(struct ringbuf *ringbuf,
 			ringbuf_tracing_func_t callback, void *user_data);
 
@@ -27,11 +27,15 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <time.h>
+#include <poll.h>
 #include <sys/signalfd.h>
+#include <sys/wait.h>
 
 #include <glib.h>
 
@@ -40,6 +44,7 @@
 #endif
 
 #include "src/shared/util.h"
+#include "src/shared/timeout.h"
 #include "src/shared/tester.h"
 
 #define COLOR_OFF	"\x1B[0m"
@@ -71,6 +76,24 @@ enum test_result {
 	TEST_RESULT_TIMED_OUT,
 };
 
+/* Minimum duration of one benchmark sample */
+#define BENCH_SAMPLE_NSEC	1000000
+#define BENCH_MAX_COUNT		(1 << 24)
+#define BENCH_WARMUP		3
+#define BENCH_SAMPLES		20
+
+struct bench_result {
+	unsigned int count;
+	unsigned int samples;
+	double wall_min;
+	double wall_mean;
+	double wall_p50;
+	double wall_p90;
+	double wall_p99;
+	double wall_max;
+	double cpu_mean;
+};
+
 enum test_stage {
 	TEST_STAGE_INVALID,
 	TEST_STAGE_PRE_SETUP,
@@ -81,6 +104,7 @@ enum test_stage {
 };
 
 struct test_case {
+	unsigned int index;
 	char *name;
 	enum test_result result;
 	enum test_stage stage;
@@ -90,6 +114,8 @@ struct test_case {
 	tester_data_func_t test_func;
 	tester_data_func_t teardown_func;
 	tester_data_func_t post_teardown_func;
+	tester_bench_func_t bench_func;
+	struct bench_result *bench;
 	gdouble start_time;
 	gdouble end_time;
 	unsigned int timeout;
@@ -109,7 +135,19 @@ static gboolean option_version = FALSE;
 static gboolean option_quiet = FALSE;
 static gboolean option_debug = FALSE;
 static gboolean option_list = FALSE;
+static gboolean option_virtual = FALSE;
 static const char *option_prefix = NULL;
+static gint option_samples = BENCH_SAMPLES;
+static const char *option_json = NULL;
+static gint option_workers = 0;
+static const char *option_shard = NULL;
+
+/* Only every shard_count-th test starting at shard_index is run */
+static unsigned int shard_index = 0;
+static unsigned int shard_count = 0;
+static unsigned int shard_seen = 0;
+
+static unsigned int test_count = 0;
 
 static void test_destroy(gpointer data)
 {
@@ -124,6 +162,7 @@ static void test_destroy(gpointer data)
 	if (test->destroy)
 		test->destroy(test->user_data);
 
+	free(test->bench);
 	free(test->name);
 	free(test);
 }
@@ -187,7 +226,7 @@ static void default_post_teardown(const void *test_data)
 	tester_post_teardown_complete();
 }
 
-void tester_add_full(const char *name, const void *test_data,
+static struct test_case *add_test(const char *name, const void *test_data,
 				tester_data_func_t pre_setup_func,
 				tester_data_func_t setup_func,
 				tester_data_func_t test_func,
@@ -198,23 +237,27 @@ void tester_add_full(const char *name, const void *test_data,
 {
 	struct test_case *test;
 
-	if (!test_func)
-		return;
-
 	if (option_prefix && !g_str_has_prefix(name, option_prefix)) {
 		if (destroy)
 			destroy(user_data);
-		return;
+		return NULL;
+	}
+
+	if (shard_count && shard_seen++ % shard_count != shard_index) {
+		if (destroy)
+			destroy(user_data);
+		return NULL;
 	}
 
 	if (option_list) {
 		printf("%s\n", name);
 		if (destroy)
 			destroy(user_data);
-		return;
+		return NULL;
 	}
 
 	test = new0(struct test_case, 1);
+	test->index = test_count++;
 	test->name = strdup(name);
 	test->result = TEST_RESULT_NOT_RUN;
 	test->stage = TEST_STAGE_INVALID;
@@ -249,6 +292,25 @@ void tester_add_full(const char *name, const void *test_data,
 	test->user_data = user_data;
 
 	test_list = g_list_append(test_list, test);
+
+	return test;
+}
+
+void tester_add_full(const char *name, const void *test_data,
+				tester_data_func_t pre_setup_func,
+				tester_data_func_t setup_func,
+				tester_data_func_t test_func,
+				tester_data_func_t teardown_func,
+				tester_data_func_t post_teardown_func,
+				unsigned int timeout,
+				void *user_data, tester_destroy_func_t destroy)
+{
+	if (!test_func)
+		return;
+
+	add_test(name, test_data, pre_setup_func, setup_func, test_func,
+				teardown_func, post_teardown_func, timeout,
+				user_data, destroy);
 }
 
 void tester_add(const char *name, const void *test_data,
@@ -260,6 +322,22 @@ void tester_add(const char *name, const void *test_data,
 					teardown_func, NULL, 0, NULL, NULL);
 }
 
+void tester_add_bench(const char *name, const void *test_data,
+					tester_data_func_t setup_func,
+					tester_bench_func_t bench_func,
+					tester_data_func_t teardown_func)
+{
+	struct test_case *test;
+
+	if (!bench_func)
+		return;
+
+	test = add_test(name, test_data, NULL, setup_func, NULL,
+					teardown_func, NULL, 0, NULL, NULL);
+	if (test)
+		test->bench_func = bench_func;
+}
+
 void *tester_get_data(void)
 {
 	struct test_case *test;
@@ -272,6 +350,175 @@ void *tester_get_data(void)
 	return test->user_data;
 }
 
+static uint64_t bench_clock(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+	double da = *(const double *) a;
+	double db = *(const double *) b;
+
+	return da < db ? -1 : da > db;
+}
+
+static uint64_t bench_sample(struct test_case *test, unsigned int count,
+								uint64_t *cpu)
+{
+	uint64_t wall_start, cpu_start;
+
+	cpu_start = bench_clock(CLOCK_PROCESS_CPUTIME_ID);
+	wall_start = bench_clock(CLOCK_MONOTONIC);
+
+	test->bench_func(test->test_data, count);
+
+	if (cpu)
+		*cpu = bench_clock(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+
+	return bench_clock(CLOCK_MONOTONIC) - wall_start;
+}
+
+static void bench_run(struct test_case *test)
+{
+	struct bench_result *res;
+	unsigned int count = 1, samples, i;
+	uint64_t wall, cpu, cpu_total = 0;
+	double *per_op, total = 0;
+
+	samples = option_samples > 0 ? option_samples : 1;
+
+	/*
+	 * Grow the operation count until one sample takes long enough to
+	 * be measured reliably. This doubles as the first part of warmup.
+	 */
+	while (count < BENCH_MAX_COUNT) {
+		wall = bench_sample(test, count, NULL);
+		if (wall >= BENCH_SAMPLE_NSEC)
+			break;
+
+		count *= 2;
+	}
+
+	for (i = 0; i < BENCH_WARMUP; i++)
+		bench_sample(test, count, NULL);
+
+	per_op = new0(double, samples);
+
+	for (i = 0; i < samples; i++) {
+		wall = bench_sample(test, count, &cpu);
+
+		per_op[i] = (double) wall / count;
+		total += per_op[i];
+		cpu_total += cpu;
+	}
+
+	qsort(per_op, samples, sizeof(*per_op), bench_cmp);
+
+	res = new0(struct bench_result, 1);
+	res->count = count;
+	res->samples = samples;
+	res->wall_min = per_op[0];
+	res->wall_mean = total / samples;
+	res->wall_p50 = per_op[(samples - 1) * 50 / 100];
+	res->wall_p90 = per_op[(samples - 1) * 90 / 100];
+	res->wall_p99 = per_op[(samples - 1) * 99 / 100];
+	res->wall_max = per_op[samples - 1];
+	res->cpu_mean = (double) cpu_total / samples / count;
+
+	free(per_op);
+
+	free(test->bench);
+	test->bench = res;
+
+	print_progress(test->name, COLOR_BLACK,
+			"%u x %u ops, %.1f ns/op (p99 %.1f, cpu %.1f)",
+			samples, count, res->wall_p50, res->wall_p99,
+			res->cpu_mean);
+}
+
+static void bench_summarize(void)
+{
+	bool header = false;
+	GList *list;
+
+	for (list = g_list_first(test_list); list; list = g_list_next(list)) {
+		struct test_case *test = list->data;
+		struct bench_result *res = test->bench;
+
+		if (!res)
+			continue;
+
+		if (!header) {
+			printf("\n");
+			print_text(COLOR_HIGHLIGHT, "Benchmark Summary");
+			print_text(COLOR_HIGHLIGHT, "-----------------");
+			printf("%-52s %12s %12s %12s\n", "", "p50 ns/op",
+						"p99 ns/op", "cpu ns/op");
+			header = true;
+		}
+
+		printf("%-52s %12.1f %12.1f %12.1f\n", test->name,
+				res->wall_p50, res->wall_p99, res->cpu_mean);
+	}
+}
+
+static void bench_print_string(FILE *fp, const char *str)
+{
+	fputc('"', fp);
+
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fputc('\\', fp);
+		fputc(*str, fp);
+	}
+
+	fputc('"', fp);
+}
+
+static void bench_write_json(const char *path)
+{
+	const char *sep = "";
+	GList *list;
+	FILE *fp;
+
+	fp = fopen(path, "w");
+	if (!fp) {
+		fprintf(stderr, "Failed to open %s: %s\n", path,
+							strerror(errno));
+		return;
+	}
+
+	fprintf(fp, "{\n\t\"benchmarks\": [");
+
+	for (list = g_list_first(test_list); list; list = g_list_next(list)) {
+		struct test_case *test = list->data;
+		struct bench_result *res = test->bench;
+
+		if (!res)
+			continue;
+
+		fprintf(fp, "%s\n\t\t{ \"name\": ", sep);
+		bench_print_string(fp, test->name);
+		fprintf(fp, ", \"count\": %u, \"samples\": %u, "
+			"\"wall_ns\": { \"min\": %.1f, \"mean\": %.1f, "
+			"\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, "
+			"\"max\": %.1f }, \"cpu_ns\": { \"mean\": %.1f } }",
+			res->count, res->samples, res->wall_min,
+			res->wall_mean, res->wall_p50, res->wall_p90,
+			res->wall_p99, res->wall_max, res->cpu_mean);
+		sep = ",";
+	}
+
+	fprintf(fp, "\n\t]\n}\n");
+
+	fclose(fp);
+}
+
 static int tester_summarize(void)
 {
 	unsigned int not_run = 0, passed = 0, failed = 0;
@@ -324,6 +571,8 @@ static int tester_summarize(void)
 	execution_time = g_timer_elapsed(test_timer, NULL);
 	printf("Overall execution time: %.3g seconds\n", execution_time);
 
+	bench_summarize();
+
 	return failed;
 }
 
@@ -412,6 +661,13 @@ static gboolean run_callback(gpointer user_data)
 	test->stage = TEST_STAGE_RUN;
 
 	print_progress(test->name, COLOR_BLACK, "run");
+
+	if (test->bench_func) {
+		bench_run(test);
+		tester_test_passed();
+		return FALSE;
+	}
+
 	test->test_func(test->test_data);
 
 	return FALSE;
@@ -641,7 +897,7 @@ struct wait_data {
 	void *user_data;
 };
 
-static gboolean wait_callback(gpointer user_data)
+static bool wait_callback(void *user_data)
 {
 	struct wait_data *wait = user_data;
 	struct test_case *test = wait->test;
@@ -651,7 +907,7 @@ static gboolean wait_callback(gpointer user_data)
 	if (wait->seconds > 0) {
 		print_progress(test->name, COLOR_BLACK, "%u seconds left",
 								wait->seconds);
-		return TRUE;
+		return true;
 	}
 
 	print_progress(test->name, COLOR_BLACK, "waiting done");
@@ -660,7 +916,7 @@ static gboolean wait_callback(gpointer user_data)
 
 	free(wait);
 
-	return FALSE;
+	return false;
 }
 
 void tester_wait(unsigned int seconds, tester_wait_func_t func,
@@ -683,7 +939,7 @@ void tester_wait(unsigned int seconds, tester_wait_func_t func,
 	wait->func = func;
 	wait->user_data = user_data;
 
-	g_timeout_add(1000, wait_callback, wait);
+	timeout_add(1000, wait_callback, wait, NULL);
 
 	print_progress(test->name, COLOR_BLACK, "waiting %u seconds", seconds);
 }
@@ -778,6 +1034,16 @@ static GOptionEntry options[] = {
 				"Only list the tests to be run" },
 	{ "prefix", 'p', 0, G_OPTION_ARG_STRING, &option_prefix,
 				"Run tests matching provided prefix" },
+	{ "virtual-time", 't', 0, G_OPTION_ARG_NONE, &option_virtual,
+				"Run timeouts on a virtual clock" },
+	{ "bench-samples", 's', 0, G_OPTION_ARG_INT, &option_samples,
+				"Number of samples taken per benchmark" },
+	{ "json", 'j', 0, G_OPTION_ARG_STRING, &option_json,
+				"Write benchmark results as JSON to file" },
+	{ "workers", 'w', 0, G_OPTION_ARG_INT, &option_workers,
+				"Run tests in parallel worker processes" },
+	{ "shard", 0, 0, G_OPTION_ARG_STRING, &option_shard,
+				"Only run shard K of N (K/N, K from 0)" },
 	{ NULL },
 };
 
@@ -805,12 +1071,290 @@ void tester_init(int *argc, char ***argv)
 		exit(EXIT_SUCCESS);
 	}
 
+	if (option_shard) {
+		if (sscanf(option_shard, "%u/%u", &shard_index,
+						&shard_count) != 2 ||
+				!shard_count || shard_index >= shard_count) {
+			g_printerr("Invalid shard: %s\n", option_shard);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (option_virtual == TRUE && !timeout_set_virtual(true)) {
+		g_printerr("Virtual time is not supported\n");
+		exit(EXIT_FAILURE);
+	}
+
 	main_loop = g_main_loop_new(NULL, FALSE);
 
 	test_list = NULL;
 	test_current = NULL;
 }
 
+struct worker {
+	pid_t pid;
+	int log_fd;
+	int result_fd;
+	GString *log;
+	GString *results;
+	bool crashed;
+};
+
+struct worker_result {
+	uint32_t index;
+	uint32_t result;
+	gdouble start_time;
+	gdouble end_time;
+	uint8_t has_bench;
+	struct bench_result bench;
+};
+
+static void worker_run(unsigned int id, unsigned int count, int result_fd)
+{
+	GList *list, *next;
+	guint signal;
+
+	/* Drop the test cases that other workers take care of */
+	for (list = g_list_first(test_list); list; list = next) {
+		struct test_case *test = list->data;
+
+		next = g_list_next(list);
+
+		if (test->index % count == id)
+			continue;
+
+		test_list = g_list_delete_link(test_list, list);
+		test_destroy(test);
+	}
+
+	signal = setup_signalfd();
+
+	g_idle_add(start_tester, NULL);
+	g_main_loop_run(main_loop);
+
+	g_source_remove(signal);
+
+	for (list = g_list_first(test_list); list; list = g_list_next(list)) {
+		struct test_case *test = list->data;
+		struct worker_result res;
+
+		memset(&res, 0, sizeof(res));
+		res.index = test->index;
+		res.result = test->result;
+		res.start_time = test->start_time;
+		res.end_time = test->end_time;
+
+		if (test->bench) {
+			res.has_bench = 1;
+			res.bench = *test->bench;
+		}
+
+		if (write(result_fd, &res, sizeof(res)) != sizeof(res))
+			break;
+	}
+
+	fflush(stdout);
+
+	exit(EXIT_SUCCESS);
+}
+
+static bool worker_start(struct worker *worker, unsigned int id,
+							unsigned int count)
+{
+	int log_fds[2], result_fds[2];
+	pid_t pid;
+
+	if (pipe2(log_fds, O_CLOEXEC) < 0)
+		return false;
+
+	if (pipe2(result_fds, O_CLOEXEC) < 0) {
+		close(log_fds[0]);
+		close(log_fds[1]);
+		return false;
+	}
+
+	fflush(stdout);
+
+	pid = fork();
+	if (pid < 0) {
+		close(log_fds[0]);
+		close(log_fds[1]);
+		close(result_fds[0]);
+		close(result_fds[1]);
+		return false;
+	}
+
+	if (pid == 0) {
+		close(log_fds[0]);
+		close(result_fds[0]);
+
+		dup2(log_fds[1], STDOUT_FILENO);
+		close(log_fds[1]);
+
+		worker_run(id, count, result_fds[1]);
+	}
+
+	close(log_fds[1]);
+	close(result_fds[1]);
+
+	worker->pid = pid;
+	worker->log_fd = log_fds[0];
+	worker->result_fd = result_fds[0];
+	worker->log = g_string_new(NULL);
+	worker->results = g_string_new(NULL);
+
+	return true;
+}
+
+static bool worker_read(int *fd, GString *str)
+{
+	char buf[4096];
+	ssize_t len;
+
+	len = read(*fd, buf, sizeof(buf));
+	if (len < 0 && (errno == EINTR || errno == EAGAIN))
+		return true;
+
+	if (len <= 0) {
+		close(*fd);
+		*fd = -1;
+		return false;
+	}
+
+	g_string_append_len(str, buf, len);
+
+	return true;
+}
+
+static void worker_finish(struct worker *worker, unsigned int id,
+							unsigned int count)
+{
+	struct worker_result res;
+	GList *list;
+	size_t off;
+	int status;
+
+	if (waitpid(worker->pid, &status, 0) < 0 || !WIFEXITED(status) ||
+					WEXITSTATUS(status) != EXIT_SUCCESS)
+		worker->crashed = true;
+
+	print_text(COLOR_HIGHLIGHT, "Worker %u", id);
+	fwrite(worker->log->str, 1, worker->log->len, stdout);
+
+	for (off = 0; off + sizeof(res) <= worker->results->len;
+							off += sizeof(res)) {
+		struct test_case *test;
+
+		memcpy(&res, worker->results->str + off, sizeof(res));
+
+		test = g_list_nth_data(test_list, res.index);
+		if (!test)
+			continue;
+
+		test->result = res.result;
+		test->start_time = res.start_time;
+		test->end_time = res.end_time;
+		test->stage = TEST_STAGE_POST_TEARDOWN;
+
+		if (res.has_bench) {
+			free(test->bench);
+			test->bench = new0(struct bench_result, 1);
+			*test->bench = res.bench;
+		}
+	}
+
+	if (!worker->crashed)
+		return;
+
+	print_text(COLOR_RED, "Worker %u terminated abnormally", id);
+
+	/* Whatever the worker did not report back counts as failed */
+	for (list = g_list_first(test_list); list; list = g_list_next(list)) {
+		struct test_case *test = list->data;
+
+		if (test->index % count == id &&
+				test->stage != TEST_STAGE_POST_TEARDOWN)
+			test->result = TEST_RESULT_FAILED;
+	}
+}
+
+static void run_workers(unsigned int count)
+{
+	struct worker *workers;
+	struct pollfd *fds;
+	sigset_t mask;
+	unsigned int i, active = 0;
+
+	/* Workers handle SIGINT and SIGTERM and report what they have */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	test_timer = g_timer_new();
+
+	workers = new0(struct worker, count);
+	fds = new0(struct pollfd, count * 2);
+
+	for (i = 0; i < count; i++) {
+		if (!worker_start(&workers[i], i, count)) {
+			perror("Failed to start worker");
+			workers[i].log_fd = -1;
+			workers[i].result_fd = -1;
+			workers[i].crashed = true;
+			continue;
+		}
+
+		active++;
+	}
+
+	while (active) {
+		for (i = 0; i < count; i++) {
+			fds[i * 2].fd = workers[i].log_fd;
+			fds[i * 2].events = POLLIN;
+			fds[i * 2 + 1].fd = workers[i].result_fd;
+			fds[i * 2 + 1].events = POLLIN;
+		}
+
+		if (poll(fds, count * 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (i = 0; i < count; i++) {
+			struct worker *worker = &workers[i];
+
+			if (worker->log_fd < 0 && worker->result_fd < 0)
+				continue;
+
+			if (fds[i * 2].revents)
+				worker_read(&worker->log_fd, worker->log);
+
+			if (fds[i * 2 + 1].revents)
+				worker_read(&worker->result_fd,
+							worker->results);
+
+			if (worker->log_fd < 0 && worker->result_fd < 0) {
+				worker_finish(worker, i, count);
+				active--;
+			}
+		}
+	}
+
+	g_timer_stop(test_timer);
+
+	for (i = 0; i < count; i++) {
+		if (workers[i].log)
+			g_string_free(workers[i].log, TRUE);
+		if (workers[i].results)
+			g_string_free(workers[i].results, TRUE);
+	}
+
+	free(fds);
+	free(workers);
+}
+
 int tester_run(void)
 {
 	guint signal;
@@ -824,17 +1368,24 @@ int tester_run(void)
 		return EXIT_SUCCESS;
 	}
 
-	signal = setup_signalfd();
+	if (option_workers > 1 && test_list) {
+		run_workers(option_workers);
+	} else {
+		signal = setup_signalfd();
 
-	g_idle_add(start_tester, NULL);
-	g_main_loop_run(main_loop);
+		g_idle_add(start_tester, NULL);
+		g_main_loop_run(main_loop);
 
-	g_source_remove(signal);
+		g_source_remove(signal);
+	}
 
 	g_main_loop_unref(main_loop);
 
 	ret = tester_summarize();
 
+	if (option_json)
+		bench_write_json(option_json);
+
 	g_list_free_full(test_list, test_destroy);
 
 	return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
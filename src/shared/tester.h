@@ -53,6 +53,14 @@ void tester_add(const char *name, const void *test_data,
 					tester_data_func_t test_func,
 					tester_data_func_t teardown_func);
 
+typedef void (*tester_bench_func_t)(const void *test_data,
+							unsigned int count);
+
+void tester_add_bench(const char *name, const void *test_data,
+					tester_data_func_t setup_func,
+					tester_bench_func_t bench_func,
+					tester_data_func_t teardown_func);
+
 void *tester_get_data(void);
 
 void tester_pre_setup_complete(void);
@@ -19,14 +19,37 @@
 
 #include "timeout.h"
 
+#include <stdint.h>
 #include <glib.h>
 
+/*
+ * Virtual timeout IDs use the upper half of the ID space so they never
+ * collide with GLib source IDs of timeouts added in real time mode.
+ */
+#define VIRTUAL_ID_BASE	0x80000000u
+
 struct timeout_data {
 	timeout_func_t func;
 	timeout_destroy_func_t destroy;
 	void *user_data;
+	unsigned int id;
+	unsigned int timeout;
+	uint64_t expire;
+	bool removed;
 };
 
+/*
+ * In virtual time mode timeouts do not wait for the wall clock. Instead
+ * the clock jumps to the next expiry whenever the main loop has nothing
+ * else to do, which is what long emulator based test runs need.
+ */
+static bool virtual_time;
+static uint64_t virtual_now;
+static unsigned int virtual_id;
+static GList *virtual_list;
+static guint virtual_idle;
+static struct timeout_data *virtual_current;
+
 static gboolean timeout_callback(gpointer user_data)
 {
 	struct timeout_data *data  = user_data;
@@ -47,6 +70,104 @@ static void timeout_destroy(gpointer user_data)
 	g_free(data);
 }
 
+static gint virtual_compare(gconstpointer a, gconstpointer b)
+{
+	const struct timeout_data *data_a = a;
+	const struct timeout_data *data_b = b;
+
+	/* Equal expiry times fire in the order they were scheduled */
+	if (data_a->expire != data_b->expire)
+		return data_a->expire < data_b->expire ? -1 : 1;
+
+	return data_a->id < data_b->id ? -1 : 1;
+}
+
+static gboolean virtual_advance(gpointer user_data);
+
+static void virtual_schedule(struct timeout_data *data)
+{
+	data->expire = virtual_now + data->timeout;
+
+	virtual_list = g_list_insert_sorted(virtual_list, data,
+							virtual_compare);
+
+	if (!virtual_idle)
+		virtual_idle = g_idle_add_full(G_PRIORITY_LOW, virtual_advance,
+								NULL, NULL);
+}
+
+static gboolean virtual_advance(gpointer user_data)
+{
+	struct timeout_data *data;
+
+	if (!virtual_list) {
+		virtual_idle = 0;
+		return FALSE;
+	}
+
+	data = virtual_list->data;
+	virtual_list = g_list_delete_link(virtual_list, virtual_list);
+
+	virtual_now = data->expire;
+
+	virtual_current = data;
+	if (data->func(data->user_data) && !data->removed) {
+		virtual_current = NULL;
+		virtual_schedule(data);
+	} else {
+		virtual_current = NULL;
+		timeout_destroy(data);
+	}
+
+	if (virtual_list)
+		return TRUE;
+
+	virtual_idle = 0;
+	return FALSE;
+}
+
+static unsigned int virtual_add(struct timeout_data *data)
+{
+	if (++virtual_id >= VIRTUAL_ID_BASE)
+		virtual_id = 1;
+
+	data->id = VIRTUAL_ID_BASE | virtual_id;
+
+	virtual_schedule(data);
+
+	return data->id;
+}
+
+static bool virtual_remove(unsigned int id)
+{
+	GList *l;
+
+	if (virtual_current && virtual_current->id == id) {
+		virtual_current->removed = true;
+		return true;
+	}
+
+	for (l = virtual_list; l; l = g_list_next(l)) {
+		struct timeout_data *data = l->data;
+
+		if (data->id != id)
+			continue;
+
+		virtual_list = g_list_delete_link(virtual_list, l);
+		timeout_destroy(data);
+		return true;
+	}
+
+	return false;
+}
+
+bool timeout_set_virtual(bool enable)
+{
+	virtual_time = enable;
+
+	return true;
+}
+
 unsigned int timeout_add(unsigned int timeout, timeout_func_t func,
 			void *user_data, timeout_destroy_func_t destroy)
 {
@@ -60,6 +181,10 @@ unsigned int timeout_add(unsigned int timeout, timeout_func_t func,
 	data->func = func;
 	data->destroy = destroy;
 	data->user_data = user_data;
+	data->timeout = timeout;
+
+	if (virtual_time)
+		return virtual_add(data);
 
 	id = g_timeout_add_full(G_PRIORITY_DEFAULT, timeout, timeout_callback,
 						data, timeout_destroy);
@@ -71,7 +196,14 @@ unsigned int timeout_add(unsigned int timeout, timeout_func_t func,
 
 void timeout_remove(unsigned int id)
 {
-	GSource *source = g_main_context_find_source_by_id(NULL, id);
+	GSource *source;
+
+	if (id & VIRTUAL_ID_BASE) {
+		virtual_remove(id);
+		return;
+	}
+
+	source = g_main_context_find_source_by_id(NULL, id);
 
 	if (source)
 		g_source_destroy(source);
@@ -80,3 +80,9 @@ void timeout_remove(unsigned int id)
 
 	mainloop_remove_timeout((int) id);
 }
+
+bool timeout_set_virtual(bool enable)
+{
+	/* Virtual time is only available with the GLib main loop */
+	return !enable;
+}
@@ -0,0 +1,38 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2017  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ */
+
+/*
+ * Static tracepoints in the "bluez" provider. With systemtap's sys/sdt.h
+ * available these compile to a single nop plus an ELF note, so they cost
+ * nothing until a tracer (perf, bpftrace, stap) attaches to them.
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define BT_TRACE0(name)			DTRACE_PROBE(bluez, name)
+#define BT_TRACE1(name, a)		DTRACE_PROBE1(bluez, name, a)
+#define BT_TRACE2(name, a, b)		DTRACE_PROBE2(bluez, name, a, b)
+#define BT_TRACE3(name, a, b, c)	DTRACE_PROBE3(bluez, name, a, b, c)
+#else
+#define BT_TRACE0(name)			do { } while (0)
+#define BT_TRACE1(name, a)		do { } while (0)
+#define BT_TRACE2(name, a, b)		do { } while (0)
+#define BT_TRACE3(name, a, b, c)	do { } while (0)
+#endif
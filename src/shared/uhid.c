@@ -30,6 +30,8 @@
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "src/shared/io.h"
 #include "src/shared/util.h"
@@ -37,12 +39,18 @@
 #include "src/shared/uhid.h"
 
 #define UHID_DEVICE_FILE "/dev/uhid"
+#define UHID_MAX_BATCH 64
 
 struct bt_uhid {
 	int ref_count;
 	struct io *io;
 	unsigned int notify_id;
 	struct queue *notify_list;
+	unsigned int read_batch;	/* Max events handled per wakeup */
+	unsigned int write_batch;	/* Max input events per write */
+	struct uhid_event *pending;	/* Input events waiting for flush */
+	unsigned int num_pending;
+	bool flush_armed;
 };
 
 struct uhid_notify {
@@ -60,6 +68,7 @@ static void uhid_free(struct bt_uhid *uhid)
 	if (uhid->notify_list)
 		queue_destroy(uhid->notify_list, free);
 
+	free(uhid->pending);
 	free(uhid);
 }
 
@@ -78,6 +87,7 @@ static void notify_handler(void *data, void *user_data)
 static bool uhid_read_handler(struct io *io, void *user_data)
 {
 	struct bt_uhid *uhid = user_data;
+	unsigned int count;
 	int fd;
 	ssize_t len;
 	struct uhid_event ev;
@@ -86,18 +96,36 @@ static bool uhid_read_handler(struct io *io, void *user_data)
 	if (fd < 0)
 		return false;
 
-	memset(&ev, 0, sizeof(ev));
+	bt_uhid_ref(uhid);
 
-	len = read(fd, &ev, sizeof(ev));
-	if (len < 0)
-		return false;
+	/*
+	 * With batching enabled the fd is non-blocking, so keep reading
+	 * until it runs dry or the batch limit is hit.
+	 */
+	for (count = 0; count < uhid->read_batch && uhid->io; count++) {
+		memset(&ev, 0, sizeof(ev));
 
-	if ((size_t) len < sizeof(ev.type))
-		return false;
+		len = read(fd, &ev, sizeof(ev));
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				break;
+			goto failed;
+		}
+
+		if ((size_t) len < sizeof(ev.type))
+			goto failed;
+
+		queue_foreach(uhid->notify_list, notify_handler, &ev);
+	}
 
-	queue_foreach(uhid->notify_list, notify_handler, &ev);
+	bt_uhid_unref(uhid);
 
 	return true;
+
+failed:
+	bt_uhid_unref(uhid);
+
+	return false;
 }
 
 struct bt_uhid *bt_uhid_new_default(void)
@@ -130,6 +158,8 @@ struct bt_uhid *bt_uhid_new(int fd)
 		goto failed;
 
 	uhid->notify_list = queue_new();
+	uhid->read_batch = 1;
+	uhid->write_batch = 1;
 
 	if (!io_set_read_handler(uhid->io, uhid_read_handler, uhid, NULL))
 		goto failed;
@@ -218,20 +248,135 @@ bool bt_uhid_unregister(struct bt_uhid *uhid, unsigned int id)
 	return true;
 }
 
+static int uhid_flush(struct bt_uhid *uhid)
+{
+	struct iovec iov[UHID_MAX_BATCH];
+	unsigned int i, count = uhid->num_pending;
+	ssize_t len;
+
+	if (!count)
+		return 0;
+
+	uhid->num_pending = 0;
+
+	/*
+	 * The uHID character device has no write_iter, so the kernel hands
+	 * every vector to the driver as an event of its own. That turns a
+	 * burst of input reports into a single syscall.
+	 */
+	for (i = 0; i < count; i++) {
+		iov[i].iov_base = &uhid->pending[i];
+		iov[i].iov_len = sizeof(uhid->pending[i]);
+	}
+
+	len = io_send(uhid->io, iov, count);
+	if (len < 0)
+		return len;
+
+	return (size_t) len != count * sizeof(*uhid->pending) ? -EIO : 0;
+}
+
+static bool uhid_write_handler(struct io *io, void *user_data)
+{
+	struct bt_uhid *uhid = user_data;
+
+	uhid->flush_armed = false;
+	uhid_flush(uhid);
+
+	return false;
+}
+
+bool bt_uhid_set_batch(struct bt_uhid *uhid, unsigned int count)
+{
+	struct stat st;
+	int fd, flags;
+
+	if (!uhid || !uhid->io || !count || count > UHID_MAX_BATCH)
+		return false;
+
+	fd = io_get_fd(uhid->io);
+
+	if (uhid_flush(uhid) < 0)
+		return false;
+
+	if (count > 1 && !uhid->pending) {
+		uhid->pending = new0(struct uhid_event, UHID_MAX_BATCH);
+		if (!uhid->pending)
+			return false;
+	}
+
+	/* Draining several events per wakeup needs a non-blocking fd */
+	flags = fcntl(fd, F_GETFL);
+	if (flags < 0)
+		return false;
+
+	if (count > 1)
+		flags |= O_NONBLOCK;
+	else
+		flags &= ~O_NONBLOCK;
+
+	if (fcntl(fd, F_SETFL, flags) < 0)
+		return false;
+
+	uhid->read_batch = count;
+
+	/*
+	 * Only the character device splits a vectored write into separate
+	 * events, anything else (e.g. a socket in tests) would see one big
+	 * message, so keep writing event by event there.
+	 */
+	if (!fstat(fd, &st) && S_ISCHR(st.st_mode))
+		uhid->write_batch = count;
+	else
+		uhid->write_batch = 1;
+
+	return true;
+}
+
 int bt_uhid_send(struct bt_uhid *uhid, const struct uhid_event *ev)
 {
 	ssize_t len;
 	struct iovec iov;
+	int err;
 
 	if (!uhid->io)
 		return -ENOTCONN;
 
+	if (uhid->write_batch > 1) {
+		/*
+		 * The first report goes out right away and arms the write
+		 * handler. Reports arriving before the mainloop comes round
+		 * again belong to the same burst and are queued, then
+		 * written together once the handler runs.
+		 */
+		if (uhid->flush_armed && ev->type == UHID_INPUT) {
+			if (uhid->num_pending == uhid->write_batch) {
+				err = uhid_flush(uhid);
+				if (err < 0)
+					return err;
+			}
+
+			memcpy(&uhid->pending[uhid->num_pending++], ev,
+								sizeof(*ev));
+			return 0;
+		}
+
+		/* Keep ordering with anything still waiting to go out */
+		err = uhid_flush(uhid);
+		if (err < 0)
+			return err;
+
+		if (ev->type == UHID_INPUT && io_set_write_handler(uhid->io,
+						uhid_write_handler, uhid, NULL))
+			uhid->flush_armed = true;
+	}
+
 	iov.iov_base = (void *) ev;
 	iov.iov_len = sizeof(*ev);
 
 	len = io_send(uhid->io, &iov, 1);
 	if (len < 0)
-		return -errno;
+		return len;
 
 	/* uHID kernel driver does not handle partial writes */
 	return len != sizeof(*ev) ? -EIO : 0;
@@ -35,6 +35,7 @@ struct bt_uhid *bt_uhid_ref(struct bt_uhid *uhid);
 void bt_uhid_unref(struct bt_uhid *uhid);
 
 bool bt_uhid_set_close_on_unref(struct bt_uhid *uhid, bool do_close);
+bool bt_uhid_set_batch(struct bt_uhid *uhid, unsigned int count);
 
 typedef void (*bt_uhid_callback_t)(struct uhid_event *ev, void *user_data);
 unsigned int bt_uhid_register(struct bt_uhid *uhid, uint32_t event,
@@ -32,6 +32,8 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
 #include <time.h>
 #include <sys/file.h>
 #include <sys/stat.h>
@@ -46,6 +48,7 @@
 #include "textfile.h"
 #include "uuid-helper.h"
 #include "storage.h"
+#include "metrics.h"
 
 /* When all services should trust a remote device */
 #define GLOBAL_TRUST "[all]"
@@ -196,3 +199,176 @@ sdp_record_t *find_record_in_list(sdp_list_t *recs, const char *uuid)
 	}
 	return NULL;
 }
+
+/*
+ * Key files below STORAGEDIR are cached in memory and written back in
+ * batches, so bursts of updates to the same file only cost a single write.
+ */
+#define STORAGE_FLUSH_DELAY 2
+
+struct storage_file {
+	char *filename;
+	GKeyFile *key_file;
+	bool dirty;
+};
+
+static GHashTable *storage_files;
+static guint storage_flush_id;
+
+static void storage_file_write(struct storage_file *file)
+{
+	char *data;
+	gsize length = 0;
+
+	file->dirty = false;
+
+	data = g_key_file_to_data(file->key_file, &length, NULL);
+
+	/* Don't leave empty files behind for data that was never stored */
+	if (length > 0 || g_file_test(file->filename, G_FILE_TEST_EXISTS)) {
+		create_file(file->filename, S_IRUSR | S_IWUSR);
+		g_file_set_contents(file->filename, data, length, NULL);
+		btd_metrics_inc(BTD_METRIC_STORAGE_WRITES);
+	}
+
+	g_free(data);
+}
+
+static void storage_file_free(gpointer data)
+{
+	struct storage_file *file = data;
+
+	g_key_file_unref(file->key_file);
+	g_free(file->filename);
+	g_free(file);
+}
+
+static void storage_flush_file(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	struct storage_file *file = value;
+
+	if (file->dirty)
+		storage_file_write(file);
+}
+
+static gboolean storage_flush_cb(gpointer user_data)
+{
+	storage_flush_id = 0;
+
+	g_hash_table_foreach(storage_files, storage_flush_file, NULL);
+
+	return FALSE;
+}
+
+static struct storage_file *storage_file_new(const char *filename,
+							GKeyFile *key_file)
+{
+	struct storage_file *file;
+
+	if (!storage_files)
+		storage_files = g_hash_table_new_full(g_str_hash, g_str_equal,
+						NULL, storage_file_free);
+
+	file = g_new0(struct storage_file, 1);
+	file->filename = g_strdup(filename);
+	file->key_file = key_file;
+	g_hash_table_insert(storage_files, file->filename, file);
+
+	return file;
+}
+
+static struct storage_file *storage_lookup(const char *filename)
+{
+	if (!storage_files)
+		return NULL;
+
+	return g_hash_table_lookup(storage_files, filename);
+}
+
+/*
+ * Returns a reference to the cached key file of filename, loading it from
+ * disk the first time. The reference must be dropped with g_key_file_unref
+ * and not g_key_file_free since the latter clears the cached data.
+ */
+GKeyFile *storage_load(const char *filename)
+{
+	struct storage_file *file;
+
+	file = storage_lookup(filename);
+	if (!file) {
+		GKeyFile *key_file = g_key_file_new();
+
+		g_key_file_load_from_file(key_file, filename, 0, NULL);
+		file = storage_file_new(filename, key_file);
+	}
+
+	return g_key_file_ref(file->key_file);
+}
+
+/* Marks the key file as modified, it is written to disk shortly after */
+void storage_save(const char *filename, GKeyFile *key_file)
+{
+	struct storage_file *file;
+
+	file = storage_lookup(filename);
+	if (!file) {
+		file = storage_file_new(filename, g_key_file_ref(key_file));
+	} else if (file->key_file != key_file) {
+		g_key_file_unref(file->key_file);
+		file->key_file = g_key_file_ref(key_file);
+	}
+
+	file->dirty = true;
+
+	if (!storage_flush_id)
+		storage_flush_id = g_timeout_add_seconds(STORAGE_FLUSH_DELAY,
+							storage_flush_cb, NULL);
+}
+
+static gboolean storage_match_path(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	const char *filename = key;
+	const char *path = user_data;
+	size_t len = strlen(path);
+
+	if (strncmp(filename, path, len))
+		return FALSE;
+
+	return filename[len] == '\0' || filename[len] == '/';
+}
+
+/*
+ * Drops the cached files at or below path without writing them, to be used
+ * before removing the files from disk.
+ */
+void storage_remove(const char *path)
+{
+	if (!storage_files)
+		return;
+
+	g_hash_table_foreach_remove(storage_files, storage_match_path,
+							(gpointer) path);
+}
+
+void storage_flush(void)
+{
+	if (storage_flush_id) {
+		g_source_remove(storage_flush_id);
+		storage_flush_id = 0;
+	}
+
+	if (storage_files)
+		g_hash_table_foreach(storage_files, storage_flush_file, NULL);
+}
+
+void storage_cleanup(void)
+{
+	storage_flush();
+
+	if (storage_files) {
+		g_hash_table_destroy(storage_files);
+		storage_files = NULL;
+	}
+}
@@ -27,3 +27,9 @@ int read_on_mode(const char *src, char *mode, int length);
 int read_local_name(const bdaddr_t *bdaddr, char *name);
 sdp_record_t *record_from_string(const char *str);
 sdp_record_t *find_record_in_list(sdp_list_t *recs, const char *uuid);
+
+GKeyFile *storage_load(const char *filename);
+void storage_save(const char *filename, GKeyFile *key_file);
+void storage_remove(const char *path);
+void storage_flush(void);
+void storage_cleanup(void);
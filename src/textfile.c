@@ -27,7 +27,6 @@
 
 #include <stdio.h>
 #include <errno.h>
-#include <ctype.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -93,43 +92,39 @@ int create_name(char *buf, size_t size, const char *path, const char *address, c
 	return snprintf(buf, size, "%s/%s/%s", path, address, name);
 }
 
-static inline char *find_key(char *map, size_t size, const char *key, size_t len, int icase)
-{
-	char *ptr = map;
-	size_t ptrlen = size;
-
-	while (ptrlen > len + 1) {
-		int cmp = (icase) ? strncasecmp(ptr, key, len) : strncmp(ptr, key, len);
-		if (cmp == 0) {
-			if (ptr == map && *(ptr + len) == ' ')
-				return ptr;
-
-			if ((*(ptr - 1) == '\r' || *(ptr - 1) == '\n') &&
-							*(ptr + len) == ' ')
-				return ptr;
-		}
-
-		if (icase) {
-			char *p1 = memchr(ptr + 1, tolower(*key), ptrlen - 1);
-			char *p2 = memchr(ptr + 1, toupper(*key), ptrlen - 1);
-
-			if (!p1)
-				ptr = p2;
-			else if (!p2)
-				ptr = p1;
-			else
-				ptr = (p1 < p2) ? p1 : p2;
-		} else
-			ptr = memchr(ptr + 1, *key, ptrlen - 1);
-
-		if (!ptr)
-			return NULL;
-
-		ptrlen = size - (ptr - map);
-	}
-
-	return NULL;
-}
+/*
+ * Each file keeps a sorted in-memory index of its entries. Updates are only
+ * appended to the file, so a key may show up multiple times and the last
+ * entry wins. Once the superseded lines outnumber the live ones the file is
+ * compacted by rewriting it from the index. The index is validated against
+ * the file status on every access, so changes behind our back only cause
+ * the file to be parsed again.
+ */
+#define MAX_TEXTFILE_INDEX	8
+#define MIN_TEXTFILE_STALE	16
+
+struct textfile_entry {
+	char *key;
+	char *value;
+	size_t line;
+};
+
+struct textfile_index {
+	char *pathname;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	struct textfile_entry *entries;
+	size_t count;
+	size_t alloc;
+	size_t stale;
+	int newline;
+	unsigned int used;
+};
+
+static struct textfile_index *index_list[MAX_TEXTFILE_INDEX];
+static unsigned int index_used;
 
 static inline int write_key_value(int fd, const char *key, const char *value)
 {
@@ -141,7 +136,7 @@ static inline int write_key_value(int fd, const char *key, const char *value)
 
 	str = malloc(size + 1);
 	if (!str)
-		return ENOMEM;
+		return -ENOMEM;
 
 	sprintf(str, "%s %s\n", key, value);
 
@@ -153,139 +148,406 @@ static inline int write_key_value(int fd, const char *key, const char *value)
 	return err;
 }
 
-static char *strnpbrk(const char *s, ssize_t len, const char *accept)
+static void index_clear(struct textfile_index *index)
+{
+	size_t i;
+
+	for (i = 0; i < index->count; i++) {
+		free(index->entries[i].key);
+		free(index->entries[i].value);
+	}
+
+	free(index->entries);
+	index->entries = NULL;
+	index->count = 0;
+	index->alloc = 0;
+	index->stale = 0;
+}
+
+static void index_free(struct textfile_index *index)
+{
+	index_clear(index);
+	free(index->pathname);
+	free(index);
+}
+
+static void index_stat(struct textfile_index *index, const struct stat *st)
+{
+	index->dev = st->st_dev;
+	index->ino = st->st_ino;
+	index->size = st->st_size;
+	index->mtime = st->st_mtim;
+}
+
+static int index_valid(struct textfile_index *index, const struct stat *st)
+{
+	return index->dev == st->st_dev && index->ino == st->st_ino &&
+			index->size == st->st_size &&
+			index->mtime.tv_sec == st->st_mtim.tv_sec &&
+			index->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static int entry_cmp(const void *a, const void *b)
+{
+	const struct textfile_entry *e1 = a, *e2 = b;
+	int cmp;
+
+	cmp = strcmp(e1->key, e2->key);
+	if (cmp)
+		return cmp;
+
+	return (e1->line > e2->line) - (e1->line < e2->line);
+}
+
+/* Returns the position of the key, or the position it has to be inserted */
+static size_t index_search(struct textfile_index *index, const char *key,
+								int *found)
 {
-	const char *p = s;
-	const char *end;
+	size_t lo = 0, hi = index->count;
 
-	end = s + len - 1;
+	*found = 0;
 
-	while (p <= end && *p) {
-		const char *a = accept;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int cmp = strcmp(key, index->entries[mid].key);
 
-		while (*a) {
-			if (*p == *a)
-				return (char *) p;
-			a++;
+		if (!cmp) {
+			*found = 1;
+			return mid;
 		}
 
-		p++;
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
 	}
 
-	return NULL;
+	return lo;
 }
 
-static int write_key(const char *pathname, const char *key, const char *value, int icase)
+static int index_reserve(struct textfile_index *index, size_t count)
 {
-	struct stat st;
-	char *map, *off, *end, *str;
-	off_t size;
-	size_t base;
-	int fd, len, err = 0;
+	struct textfile_entry *entries;
+	size_t alloc;
 
-	fd = open(pathname, O_RDWR);
-	if (fd < 0)
+	if (count <= index->alloc)
+		return 0;
+
+	alloc = index->alloc ? index->alloc : 16;
+	while (alloc < count)
+		alloc <<= 1;
+
+	entries = realloc(index->entries, alloc * sizeof(*entries));
+	if (!entries)
+		return -ENOMEM;
+
+	index->entries = entries;
+	index->alloc = alloc;
+
+	return 0;
+}
+
+static int index_append(struct textfile_index *index, const char *key,
+				size_t key_len, const char *value,
+				size_t value_len)
+{
+	struct textfile_entry *entry;
+
+	if (index_reserve(index, index->count + 1) < 0)
+		return -ENOMEM;
+
+	entry = &index->entries[index->count];
+
+	entry->key = strndup(key, key_len);
+	entry->value = strndup(value, value_len);
+	if (!entry->key || !entry->value) {
+		free(entry->key);
+		free(entry->value);
+		return -ENOMEM;
+	}
+
+	entry->line = index->count++;
+
+	return 0;
+}
+
+static int index_parse(struct textfile_index *index, int fd, off_t size)
+{
+	const char *map, *ptr, *end;
+	size_t i, count;
+	int err = 0;
+
+	index_clear(index);
+	index->newline = 1;
+
+	if (!size)
+		return 0;
+
+	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (!map || map == MAP_FAILED)
 		return -errno;
 
-	if (flock(fd, LOCK_EX) < 0) {
-		err = -errno;
-		goto close;
+	ptr = map;
+	end = map + size;
+
+	while (ptr < end) {
+		const char *eol, *sep, *key_end, *value_end;
+
+		for (eol = ptr; eol < end && *eol != '\r' && *eol != '\n';
+									eol++);
+
+		/* Lines without a key are skipped, same as before */
+		sep = memchr(ptr, ' ', eol - ptr);
+		if (sep && sep > ptr) {
+			key_end = memchr(ptr, '\0', sep - ptr);
+			value_end = memchr(sep + 1, '\0', eol - sep - 1);
+
+			err = index_append(index, ptr,
+					(key_end ? key_end : sep) - ptr,
+					sep + 1,
+					(value_end ? value_end : eol) - sep - 1);
+			if (err < 0)
+				break;
+		}
+
+		ptr = eol;
+		while (ptr < end && (*ptr == '\r' || *ptr == '\n'))
+			ptr++;
 	}
 
-	if (fstat(fd, &st) < 0) {
-		err = -errno;
-		goto unlock;
+	index->newline = (end[-1] == '\r' || end[-1] == '\n');
+
+	munmap((void *) map, size);
+
+	if (err < 0) {
+		index_clear(index);
+		return err;
 	}
 
-	size = st.st_size;
+	/* Sort by key and line, so only the last entry of each key is kept */
+	if (index->count > 1)
+		qsort(index->entries, index->count, sizeof(*index->entries),
+								entry_cmp);
+
+	for (i = 0, count = 0; i < index->count; i++) {
+		struct textfile_entry *entry = &index->entries[i];
 
-	if (!size) {
-		if (value) {
-			lseek(fd, size, SEEK_SET);
-			err = write_key_value(fd, key, value);
+		if (i + 1 < index->count &&
+				!strcmp(entry->key, entry[1].key)) {
+			free(entry->key);
+			free(entry->value);
+			continue;
 		}
-		goto unlock;
-	}
 
-	map = mmap(NULL, size, PROT_READ | PROT_WRITE,
-					MAP_PRIVATE | MAP_LOCKED, fd, 0);
-	if (!map || map == MAP_FAILED) {
-		err = -errno;
-		goto unlock;
+		index->entries[count++] = *entry;
 	}
 
-	len = strlen(key);
-	off = find_key(map, size, key, len, icase);
-	if (!off) {
-		munmap(map, size);
-		if (value) {
-			lseek(fd, size, SEEK_SET);
-			err = write_key_value(fd, key, value);
+	index->stale = index->count - count;
+	index->count = count;
+
+	return 0;
+}
+
+static void index_drop(struct textfile_index *index)
+{
+	unsigned int i;
+
+	for (i = 0; i < MAX_TEXTFILE_INDEX; i++) {
+		if (index_list[i] == index) {
+			index_list[i] = NULL;
+			break;
 		}
-		goto unlock;
 	}
 
-	base = off - map;
+	index_free(index);
+}
+
+static struct textfile_index *index_get(const char *pathname, int fd)
+{
+	struct textfile_index *index = NULL;
+	struct stat st;
+	unsigned int i, slot = 0;
 
-	end = strnpbrk(off, size, "\r\n");
-	if (!end) {
-		err = -EILSEQ;
-		goto unmap;
+	if (fstat(fd, &st) < 0)
+		return NULL;
+
+	for (i = 0; i < MAX_TEXTFILE_INDEX; i++) {
+		if (!index_list[i]) {
+			slot = i;
+			continue;
+		}
+
+		if (!strcmp(index_list[i]->pathname, pathname)) {
+			index = index_list[i];
+			break;
+		}
+
+		if (index_list[slot] && index_list[i]->used <
+						index_list[slot]->used)
+			slot = i;
 	}
 
-	if (value && ((ssize_t) strlen(value) == end - off - len - 1) &&
-			!strncmp(off + len + 1, value, end - off - len - 1))
-		goto unmap;
+	if (index) {
+		index->used = ++index_used;
 
-	len = strspn(end, "\r\n");
-	end += len;
+		if (index_valid(index, &st))
+			return index;
+	} else {
+		index = calloc(1, sizeof(*index));
+		if (!index)
+			return NULL;
 
-	len = size - (end - map);
-	if (!len) {
-		munmap(map, size);
-		if (ftruncate(fd, base) < 0) {
-			err = -errno;
-			goto unlock;
+		index->pathname = strdup(pathname);
+		if (!index->pathname) {
+			free(index);
+			return NULL;
 		}
-		lseek(fd, base, SEEK_SET);
-		if (value)
-			err = write_key_value(fd, key, value);
 
-		goto unlock;
+		/* Evict the least recently used index */
+		if (index_list[slot])
+			index_free(index_list[slot]);
+
+		index_list[slot] = index;
+		index->used = ++index_used;
 	}
 
-	if (len < 0 || len > size) {
-		err = -EILSEQ;
-		goto unmap;
+	if (index_parse(index, fd, st.st_size) < 0) {
+		index_drop(index);
+		return NULL;
 	}
 
-	str = malloc(len);
-	if (!str) {
-		err = -errno;
-		goto unmap;
+	index_stat(index, &st);
+
+	return index;
+}
+
+static int index_compact(struct textfile_index *index, int fd)
+{
+	size_t i;
+	int err;
+
+	if (ftruncate(fd, 0) < 0)
+		return -errno;
+
+	lseek(fd, 0, SEEK_SET);
+
+	for (i = 0; i < index->count; i++) {
+		struct textfile_entry *entry = &index->entries[i];
+
+		err = write_key_value(fd, entry->key, entry->value);
+		if (err < 0)
+			return err;
 	}
 
-	memcpy(str, end, len);
+	index->stale = 0;
+	index->newline = 1;
+
+	return 0;
+}
+
+static int write_key(const char *pathname, const char *key, const char *value)
+{
+	struct textfile_index *index;
+	struct textfile_entry *entry;
+	struct stat st;
+	size_t pos;
+	int fd, found, err = 0;
+
+	fd = open(pathname, O_RDWR);
+	if (fd < 0)
+		return -errno;
 
-	munmap(map, size);
-	if (ftruncate(fd, base) < 0) {
+	if (flock(fd, LOCK_EX) < 0) {
 		err = -errno;
-		free(str);
+		goto close;
+	}
+
+	index = index_get(pathname, fd);
+	if (!index) {
+		err = -EIO;
+		goto unlock;
+	}
+
+	pos = index_search(index, key, &found);
+	entry = found ? &index->entries[pos] : NULL;
+
+	if (!value) {
+		if (!entry)
+			goto unlock;
+
+		free(entry->key);
+		free(entry->value);
+		index->count--;
+		memmove(entry, entry + 1,
+				(index->count - pos) * sizeof(*entry));
+
+		/* Removals have no journal entry, so compact right away */
+		err = index_compact(index, fd);
+		goto update;
+	}
+
+	if (entry && !strcmp(entry->value, value))
 		goto unlock;
+
+	if (entry) {
+		char *str = strdup(value);
+
+		if (!str) {
+			err = -ENOMEM;
+			goto unlock;
+		}
+
+		free(entry->value);
+		entry->value = str;
+		index->stale++;
+	} else {
+		if (index_reserve(index, index->count + 1) < 0) {
+			err = -ENOMEM;
+			goto unlock;
+		}
+
+		entry = &index->entries[pos];
+		memmove(entry + 1, entry,
+				(index->count - pos) * sizeof(*entry));
+
+		entry->key = strdup(key);
+		entry->value = strdup(value);
+		entry->line = 0;
+		if (!entry->key || !entry->value) {
+			free(entry->key);
+			free(entry->value);
+			memmove(entry, entry + 1,
+				(index->count - pos) * sizeof(*entry));
+			err = -ENOMEM;
+			goto unlock;
+		}
+
+		index->count++;
 	}
-	lseek(fd, base, SEEK_SET);
-	if (value)
-		err = write_key_value(fd, key, value);
 
-	if (write(fd, str, len) < 0)
+	if (index->stale >= MIN_TEXTFILE_STALE &&
+					index->stale > index->count) {
+		err = index_compact(index, fd);
+		goto update;
+	}
+
+	lseek(fd, 0, SEEK_END);
+
+	if (!index->newline && write(fd, "\n", 1) < 0) {
 		err = -errno;
+		goto update;
+	}
 
-	free(str);
+	index->newline = 1;
 
-	goto unlock;
+	err = write_key_value(fd, key, value);
 
-unmap:
-	munmap(map, size);
+update:
+	/* On failure the file content is unknown, so it needs parsing */
+	if (err < 0 || fstat(fd, &st) < 0)
+		index_drop(index);
+	else
+		index_stat(index, &st);
 
 unlock:
 	flock(fd, LOCK_UN);
@@ -299,12 +561,12 @@ close:
 	return err;
 }
 
-static char *read_key(const char *pathname, const char *key, int icase)
+static char *read_key(const char *pathname, const char *key)
 {
-	struct stat st;
-	char *map, *off, *end, *str = NULL;
-	off_t size; size_t len;
-	int fd, err = 0;
+	struct textfile_index *index;
+	char *str = NULL;
+	size_t pos;
+	int fd, found, err = 0;
 
 	fd = open(pathname, O_RDONLY);
 	if (fd < 0)
@@ -315,43 +577,21 @@ static char *read_key(const char *pathname, const char *key, int icase)
 		goto close;
 	}
 
-	if (fstat(fd, &st) < 0) {
-		err = -errno;
-		goto unlock;
-	}
-
-	size = st.st_size;
-
-	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
-	if (!map || map == MAP_FAILED) {
-		err = -errno;
+	index = index_get(pathname, fd);
+	if (!index) {
+		err = -EIO;
 		goto unlock;
 	}
 
-	len = strlen(key);
-	off = find_key(map, size, key, len, icase);
-	if (!off) {
-		err = -EILSEQ;
-		goto unmap;
-	}
-
-	end = strnpbrk(off, size - (off - map), "\r\n");
-	if (!end) {
-		err = -EILSEQ;
-		goto unmap;
-	}
-
-	str = malloc(end - off - len);
-	if (!str) {
+	pos = index_search(index, key, &found);
+	if (!found) {
 		err = -EILSEQ;
-		goto unmap;
+		goto unlock;
 	}
 
-	memset(str, 0, end - off - len);
-	strncpy(str, off + len + 1, end - off - len - 1);
-
-unmap:
-	munmap(map, size);
+	str = strdup(index->entries[pos].value);
+	if (!str)
+		err = -ENOMEM;
 
 unlock:
 	flock(fd, LOCK_UN);
@@ -365,24 +605,24 @@ close:
 
 int textfile_put(const char *pathname, const char *key, const char *value)
 {
-	return write_key(pathname, key, value, 0);
+	return write_key(pathname, key, value);
 }
 
 int textfile_del(const char *pathname, const char *key)
 {
-	return write_key(pathname, key, NULL, 0);
+	return write_key(pathname, key, NULL);
 }
 
 char *textfile_get(const char *pathname, const char *key)
 {
-	return read_key(pathname, key, 0);
+	return read_key(pathname, key);
 }
 
 int textfile_foreach(const char *pathname, textfile_cb func, void *data)
 {
+	struct textfile_index index;
 	struct stat st;
-	char *map, *off, *end, *key, *value;
-	off_t size; size_t len;
+	size_t i;
 	int fd, err = 0;
 
 	fd = open(pathname, O_RDONLY);
@@ -399,70 +639,25 @@ int textfile_foreach(const char *pathname, textfile_cb func, void *data)
 		goto unlock;
 	}
 
-	size = st.st_size;
+	/*
+	 * The callbacks are free to access other files, so iterate over a
+	 * private index instead of one that might get evicted meanwhile.
+	 */
+	memset(&index, 0, sizeof(index));
 
-	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
-	if (!map || map == MAP_FAILED) {
-		err = -errno;
+	err = index_parse(&index, fd, st.st_size);
+	if (err < 0)
 		goto unlock;
-	}
 
-	off = map;
-
-	while (size - (off - map) > 0) {
-		end = strnpbrk(off, size - (off - map), " ");
-		if (!end) {
-			err = -EILSEQ;
-			break;
-		}
-
-		len = end - off;
-
-		key = malloc(len + 1);
-		if (!key) {
-			err = -errno;
-			break;
-		}
-
-		memset(key, 0, len + 1);
-		memcpy(key, off, len);
-
-		off = end + 1;
-
-		if (size - (off - map) < 0) {
-			err = -EILSEQ;
-			free(key);
-			break;
-		}
-
-		end = strnpbrk(off, size - (off - map), "\r\n");
-		if (!end) {
-			err = -EILSEQ;
-			free(key);
-			break;
-		}
-
-		len = end - off;
-
-		value = malloc(len + 1);
-		if (!value) {
-			err = -errno;
-			free(key);
-			break;
-		}
-
-		memset(value, 0, len + 1);
-		memcpy(value, off, len);
-
-		func(key, value, data);
+	flock(fd, LOCK_UN);
+	close(fd);
 
-		free(key);
-		free(value);
+	for (i = 0; i < index.count; i++)
+		func(index.entries[i].key, index.entries[i].value, data);
 
-		off = end + 1;
-	}
+	index_clear(&index);
 
-	munmap(map, size);
+	return 0;
 
 unlock:
 	flock(fd, LOCK_UN);
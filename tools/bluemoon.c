@@ -39,6 +39,7 @@
 #include "src/shared/mainloop.h"
 #include "src/shared/util.h"
 #include "src/shared/hci.h"
+#include "src/shared/hci-firmware.h"
 
 #define CMD_RESET		0xfc01
 struct cmd_reset {
@@ -155,6 +156,7 @@ static const char *load_firmware_value = NULL;
 static uint8_t *firmware_data = NULL;
 static size_t firmware_size = 0;
 static size_t firmware_offset = 0;
+static struct bt_hci_fw *firmware = NULL;
 static bool check_firmware = false;
 static const char *check_firmware_value = NULL;
 uint8_t manufacturer_mode_reset = 0x00;
@@ -223,6 +225,9 @@ static void shutdown_device(void)
 
 	free(firmware_data);
 
+	bt_hci_fw_free(firmware);
+	firmware = NULL;
+
 	if (use_manufacturer_mode) {
 		struct cmd_manufacturer_mode cmd;
 
@@ -399,11 +404,10 @@ static void read_bd_data_complete(const void *data, uint8_t size,
 	shutdown_device();
 }
 
-static void firmware_command_complete(const void *data, uint8_t size,
-							void *user_data)
+static void firmware_complete(uint8_t status,
+				const struct bt_hci_fw_stats *stats,
+				void *user_data)
 {
-	uint8_t status = *((uint8_t *) data);
-
 	if (status) {
 		fprintf(stderr, "Failed to load firmware (0x%02x)\n", status);
 		manufacturer_mode_reset = 0x01;
@@ -411,37 +415,19 @@ static void firmware_command_complete(const void *data, uint8_t size,
 		return;
 	}
 
-	if (firmware_offset >= firmware_size) {
-		printf("Activating firmware\n");
-		manufacturer_mode_reset = 0x02;
-		shutdown_device();
-		return;
-	}
-
-	if (firmware_data[firmware_offset] == 0x01) {
-		uint16_t opcode;
-		uint8_t dlen;
-
-		opcode = firmware_data[firmware_offset + 2] << 8 |
-					firmware_data[firmware_offset + 1];
-		dlen = firmware_data[firmware_offset + 3];
+	printf("Loaded %u commands with %zu bytes in %llu ms",
+				stats->commands, stats->bytes,
+				(unsigned long long) stats->usec / 1000);
 
-		bt_hci_send(hci_dev, opcode, firmware_data +
-						firmware_offset + 4, dlen,
-					firmware_command_complete, NULL, NULL);
+	if (stats->usec)
+		printf(" (%llu bytes/s)", (unsigned long long)
+				(stats->bytes * 1000000ULL / stats->usec));
 
-		firmware_offset += dlen + 4;
-
-		if (firmware_data[firmware_offset] == 0x02) {
-			dlen = firmware_data[firmware_offset + 2];
-			firmware_offset += dlen + 3;
-		}
-	} else {
-		fprintf(stderr, "Invalid packet in firmware\n");
-		manufacturer_mode_reset = 0x01;
-		shutdown_device();
-	}
+	printf("\n");
 
+	printf("Activating firmware\n");
+	manufacturer_mode_reset = 0x02;
+	shutdown_device();
 }
 
 static void enter_manufacturer_mode_complete(const void *data, uint8_t size,
@@ -457,8 +443,11 @@ static void enter_manufacturer_mode_complete(const void *data, uint8_t size,
 	}
 
 	if (load_firmware) {
-		uint8_t status = BT_HCI_ERR_SUCCESS;
-		firmware_command_complete(&status, sizeof(status), NULL);
+		if (!bt_hci_fw_start(firmware, firmware_complete, NULL, NULL)) {
+			fprintf(stderr, "Failed to start firmware download\n");
+			manufacturer_mode_reset = 0x01;
+			shutdown_device();
+		}
 		return;
 	}
 
@@ -529,9 +518,20 @@ static void request_firmware(const char *path)
 
 	firmware_size = len;
 
+	firmware = bt_hci_fw_new(hci_dev);
+	if (!firmware) {
+		fprintf(stderr, "Failed to allocate firmware download\n");
+		shutdown_device();
+		return;
+	}
+
 	if (firmware_data[0] == 0xff)
 		firmware_offset = 1;
 
+	/*
+	 * Only the commands are downloaded, the events in between are the
+	 * Command Complete events they are expected to produce.
+	 */
 	while (firmware_offset < firmware_size) {
 		uint16_t opcode;
 		uint8_t evt, dlen;
@@ -545,6 +545,9 @@ static void request_firmware(const char *path)
 			if (opcode != CMD_MEMORY_WRITE)
 				printf("Unexpected opcode 0x%02x\n", opcode);
 
+			bt_hci_fw_add(firmware, opcode,
+				firmware_data + firmware_offset + 4, dlen);
+
 			firmware_offset += dlen + 4;
 			cmd_num++;
 			break;
@@ -568,9 +571,6 @@ static void request_firmware(const char *path)
 	}
 
 	printf("Firmware with %u commands and %u events\n", cmd_num, evt_num);
-
-	if (firmware_data[0] == 0xff)
-		firmware_offset = 1;
 }
 
 static void read_boot_params_complete(const void *data, uint8_t size,
@@ -61,6 +61,7 @@ static struct bnep *session;
 
 static int mode;
 static bool no_close_after_disconn;
+static bool use_userspace;
 static int send_frame_timeout;
 
 static bdaddr_t src_addr, dst_addr;
@@ -502,6 +503,14 @@ static void exit_handler(int sig)
 	exit(0);
 }
 
+static int init_bnep(void)
+{
+	if (use_userspace)
+		return bnep_set_userspace(true) ? 0 : -ENOSYS;
+
+	return bnep_init();
+}
+
 static void usage(void)
 {
 	printf("bneptest - BNEP testing ver %s\n", VERSION);
@@ -531,7 +540,8 @@ static void usage(void)
 		"\t-f set dst mac addr <xx:xx:xx:xx:xx:xx>, def. 0\n");
 	printf("Options:\n"
 		"\t-T send message timeout after setup <seconds>\n"
-		"\t-N don't close bneptest after disconnect\n");
+		"\t-N don't close bneptest after disconnect\n"
+		"\t-U handle the data path in userspace over a tap device\n");
 }
 
 static struct option main_options[] = {
@@ -552,6 +562,7 @@ static struct option main_options[] = {
 	{ "bridge name",		1, 0, 'b' },
 	{ "iface name",			1, 0, 'n' },
 	{ "no_close",			0, 0, 'N' },
+	{ "userspace",			0, 0, 'U' },
 	{ "retrans_ctrl_nb",		0, 0, 'y' },
 	{ "retrans_bnep_nb",		0, 0, 'u' },
 	{ "help",			0, 0, 'h' },
@@ -579,7 +590,7 @@ int main(int argc, char *argv[])
 	}
 
 	while ((opt = getopt_long(argc, argv,
-				"+i:c:b:n:t:T:d:e:g:j:k:f:w:l:r:y:u:Nsh",
+				"+i:c:b:n:t:T:d:e:g:j:k:f:w:l:r:y:u:NUsh",
 				main_options, NULL)) != EOF) {
 		switch (opt) {
 		case 'i':
@@ -650,6 +661,9 @@ int main(int argc, char *argv[])
 		case 'N':
 			no_close_after_disconn = true;
 			break;
+		case 'U':
+			use_userspace = true;
+			break;
 		case 'y':
 			ctrl_msg_retransmition_nb = atoi(optarg);
 			break;
@@ -670,7 +684,7 @@ int main(int argc, char *argv[])
 
 	switch (mode) {
 	case MODE_CONNECT:
-		err = bnep_init();
+		err = init_bnep();
 		if (err < 0) {
 			printf("cannot initialize bnep\n");
 			exit(1);
@@ -681,7 +695,7 @@ int main(int argc, char *argv[])
 
 		break;
 	case MODE_LISTEN:
-		err = bnep_init();
+		err = init_bnep();
 		if (err < 0) {
 			printf("cannot initialize bnep\n");
 			exit(1);
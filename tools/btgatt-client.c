@@ -31,7 +31,9 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <limits.h>
+#include <inttypes.h>
 #include <errno.h>
+#include <time.h>
 
 #include "lib/bluetooth.h"
 #include "lib/hci.h"
@@ -43,11 +45,24 @@
 #include "src/shared/util.h"
 #include "src/shared/att.h"
 #include "src/shared/queue.h"
+#include "src/shared/timeout.h"
 #include "src/shared/gatt-db.h"
 #include "src/shared/gatt-client.h"
 
 #define ATT_CID 4
 
+/* Benchmark service, shared with btgatt-server */
+#define UUID_BENCH			"a5b1e100-31c6-4d5c-9b1b-f6105604f0d4"
+#define UUID_BENCH_DATA			"a5b1e101-31c6-4d5c-9b1b-f6105604f0d4"
+#define UUID_BENCH_CTRL			"a5b1e102-31c6-4d5c-9b1b-f6105604f0d4"
+
+#define BENCH_OP_STREAM			0x01
+#define BENCH_OP_RESET			0x02
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
 #define PRLOG(...) \
 	printf(__VA_ARGS__); print_prompt();
 
@@ -61,6 +76,7 @@
 #define COLOR_BOLDWHITE	"\x1B[1;37m"
 
 static bool verbose = false;
+static char *bench_args;
 
 struct client {
 	int fd;
@@ -71,6 +87,8 @@ struct client {
 	unsigned int reliable_session_id;
 };
 
+static bool bench_run(struct client *cli, char *cmd_str, bool quit);
+
 static void print_prompt(void)
 {
 	printf(COLOR_BLUE "[GATT client]" COLOR_OFF "# ");
@@ -372,6 +390,15 @@ static void ready_cb(bool success, uint8_t att_ecode, void *user_data)
 
 	PRLOG("GATT discovery procedures complete\n");
 
+	if (bench_args) {
+		char *args = bench_args;
+
+		bench_args = NULL;
+		if (!bench_run(cli, args, true))
+			mainloop_quit();
+		return;
+	}
+
 	print_services(cli);
 	print_prompt();
 }
@@ -1306,6 +1333,585 @@ static void cmd_set_sign_key(struct client *cli, char *cmd_str)
 		set_sign_key_usage();
 }
 
+#define BENCH_STALL_TIMEOUT	2000
+
+struct bench {
+	struct client *cli;
+	bool quit;
+	uint16_t data_handle;
+	uint16_t ctrl_handle;
+
+	bool indicate;
+	uint16_t size;
+	uint32_t count;
+	uint16_t interval;
+	uint32_t writes;
+	uint32_t reads;
+
+	unsigned int notify_id;
+	unsigned int timeout_id;
+	bool activity;
+	uint32_t received;
+	uint32_t lost;
+	uint32_t next_seq;
+	uint64_t rx_bytes;
+	uint64_t first;
+	uint64_t last;
+	int64_t prev_gap;
+	double jitter;
+
+	uint16_t write_len;
+	uint32_t write_bytes;
+	uint32_t acked_bytes;
+	uint64_t write_start;
+	uint64_t write_end;
+
+	uint32_t *latency;
+	uint32_t read_count;
+	uint64_t read_start;
+};
+
+static struct bench *bench;
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static uint64_t bench_rate(uint64_t bytes, uint64_t usec)
+{
+	if (!usec)
+		return 0;
+
+	return bytes * 8 * 1000000 / usec;
+}
+
+static int bench_latency_cmp(const void *a, const void *b)
+{
+	uint32_t la = *(const uint32_t *) a;
+	uint32_t lb = *(const uint32_t *) b;
+
+	return la < lb ? -1 : la > lb;
+}
+
+static uint32_t bench_percentile(struct bench *b, unsigned int pct)
+{
+	return b->latency[(b->read_count - 1) * pct / 100];
+}
+
+static void bench_free(struct bench *b)
+{
+	timeout_remove(b->timeout_id);
+
+	if (b->notify_id)
+		bt_gatt_client_unregister_notify(b->cli->gatt, b->notify_id);
+
+	free(b->latency);
+	free(b);
+
+	bench = NULL;
+}
+
+static void bench_report(struct bench *b)
+{
+	printf("{\n\t\"mtu\": %u", bt_att_get_mtu(b->cli->att));
+
+	if (b->count) {
+		uint64_t duration = b->last - b->first;
+
+		printf(",\n\t\"stream\": { \"type\": \"%s\", \"size\": %u, "
+			"\"count\": %u, \"interval_ms\": %u, "
+			"\"received\": %u, \"lost\": %u, "
+			"\"duration_us\": %" PRIu64 ", "
+			"\"goodput_bps\": %" PRIu64 ", "
+			"\"jitter_us\": %.1f }",
+			b->indicate ? "indicate" : "notify", b->size,
+			b->count, b->interval, b->received, b->lost,
+			duration, bench_rate(b->rx_bytes, duration),
+			b->jitter);
+	}
+
+	if (b->writes) {
+		uint64_t duration = b->write_end - b->write_start;
+
+		printf(",\n\t\"write_without_response\": { \"count\": %u, "
+			"\"size\": %u, \"bytes\": %u, "
+			"\"acked_bytes\": %u, "
+			"\"duration_us\": %" PRIu64 ", "
+			"\"throughput_bps\": %" PRIu64 " }",
+			b->writes, b->write_len, b->write_bytes,
+			b->acked_bytes, duration,
+			bench_rate(b->acked_bytes, duration));
+	}
+
+	if (b->read_count) {
+		qsort(b->latency, b->read_count, sizeof(*b->latency),
+							bench_latency_cmp);
+
+		printf(",\n\t\"read\": { \"count\": %u, \"min_us\": %u, "
+			"\"p50_us\": %u, \"p90_us\": %u, \"p99_us\": %u, "
+			"\"max_us\": %u }",
+			b->read_count, b->latency[0],
+			bench_percentile(b, 50), bench_percentile(b, 90),
+			bench_percentile(b, 99),
+			b->latency[b->read_count - 1]);
+	}
+
+	printf("\n}\n");
+}
+
+static void bench_done(struct bench *b, bool success)
+{
+	bool quit = b->quit;
+
+	if (success)
+		bench_report(b);
+	else
+		printf("Benchmark failed\n");
+
+	bench_free(b);
+
+	if (quit)
+		mainloop_quit();
+	else
+		print_prompt();
+}
+
+static void bench_read_cb(bool success, uint8_t att_ecode,
+					const uint8_t *value, uint16_t length,
+					void *user_data);
+
+static void bench_read_next(struct bench *b)
+{
+	if (b->read_count >= b->reads) {
+		bench_done(b, true);
+		return;
+	}
+
+	b->read_start = bench_now();
+
+	if (!bt_gatt_client_read_value(b->cli->gatt, b->data_handle,
+						bench_read_cb, b, NULL))
+		bench_done(b, false);
+}
+
+static void bench_read_cb(bool success, uint8_t att_ecode,
+					const uint8_t *value, uint16_t length,
+					void *user_data)
+{
+	struct bench *b = user_data;
+
+	if (!success) {
+		printf("Benchmark read failed: %s (0x%02x)\n",
+				ecode_to_string(att_ecode), att_ecode);
+		bench_done(b, false);
+		return;
+	}
+
+	b->latency[b->read_count++] = bench_now() - b->read_start;
+
+	bench_read_next(b);
+}
+
+static void bench_read_start(struct bench *b)
+{
+	if (!b->reads) {
+		bench_done(b, true);
+		return;
+	}
+
+	b->latency = new0(uint32_t, b->reads);
+
+	bench_read_next(b);
+}
+
+static void bench_poll_cb(bool success, uint8_t att_ecode,
+					const uint8_t *value, uint16_t length,
+					void *user_data)
+{
+	struct bench *b = user_data;
+	uint64_t now = bench_now();
+	uint32_t acked;
+
+	if (!success || length < 8) {
+		printf("Benchmark control read failed: %s (0x%02x)\n",
+				ecode_to_string(att_ecode), att_ecode);
+		bench_done(b, false);
+		return;
+	}
+
+	acked = get_le32(value);
+	if (acked != b->acked_bytes) {
+		b->acked_bytes = acked;
+		b->write_end = now;
+	}
+
+	/* Done once the server got everything or stopped making progress */
+	if (acked >= b->write_bytes ||
+			now - b->write_end > BENCH_STALL_TIMEOUT * 1000) {
+		bench_read_start(b);
+		return;
+	}
+
+	if (!bt_gatt_client_read_value(b->cli->gatt, b->ctrl_handle,
+						bench_poll_cb, b, NULL))
+		bench_done(b, false);
+}
+
+static void bench_reset_cb(bool success, uint8_t att_ecode, void *user_data)
+{
+	struct bench *b = user_data;
+	uint8_t value[BT_ATT_MAX_VALUE_LEN];
+	uint32_t i;
+
+	if (!success) {
+		printf("Benchmark reset failed: %s (0x%02x)\n",
+				ecode_to_string(att_ecode), att_ecode);
+		bench_done(b, false);
+		return;
+	}
+
+	memset(value, 0xc3, b->write_len);
+
+	b->write_start = bench_now();
+	b->write_end = b->write_start;
+
+	for (i = 0; i < b->writes; i++) {
+		if (!bt_gatt_client_write_without_response(b->cli->gatt,
+						b->data_handle, false,
+						value, b->write_len))
+			break;
+
+		b->write_bytes += b->write_len;
+	}
+
+	b->writes = i;
+
+	if (!bt_gatt_client_read_value(b->cli->gatt, b->ctrl_handle,
+						bench_poll_cb, b, NULL))
+		bench_done(b, false);
+}
+
+static void bench_write_start(struct bench *b)
+{
+	uint8_t op = BENCH_OP_RESET;
+
+	if (!b->writes) {
+		bench_read_start(b);
+		return;
+	}
+
+	b->write_len = MIN(b->size ? b->size : BT_ATT_MAX_VALUE_LEN,
+					bt_att_get_mtu(b->cli->att) - 3);
+
+	if (!bt_gatt_client_write_value(b->cli->gatt, b->ctrl_handle, &op,
+						sizeof(op), bench_reset_cb,
+						b, NULL))
+		bench_done(b, false);
+}
+
+static void bench_stream_end(struct bench *b)
+{
+	timeout_remove(b->timeout_id);
+	b->timeout_id = 0;
+
+	/* Unsubscribing also stops the server from streaming */
+	bt_gatt_client_unregister_notify(b->cli->gatt, b->notify_id);
+	b->notify_id = 0;
+
+	if (b->next_seq < b->count)
+		b->lost += b->count - b->next_seq;
+
+	bench_write_start(b);
+}
+
+static bool bench_stream_end_cb(void *user_data)
+{
+	struct bench *b = user_data;
+
+	b->timeout_id = 0;
+	bench_stream_end(b);
+
+	return false;
+}
+
+static bool bench_stall_cb(void *user_data)
+{
+	struct bench *b = user_data;
+
+	if (b->activity) {
+		b->activity = false;
+		return true;
+	}
+
+	printf("Benchmark stream stalled\n");
+
+	b->timeout_id = 0;
+	bench_stream_end(b);
+
+	return false;
+}
+
+static void bench_notify_cb(uint16_t value_handle, const uint8_t *value,
+					uint16_t length, void *user_data)
+{
+	struct bench *b = user_data;
+	uint64_t now = bench_now();
+	uint32_t seq;
+
+	if (length < 4 || b->next_seq >= b->count)
+		return;
+
+	seq = get_le32(value);
+	if (seq < b->next_seq)
+		return;
+
+	if (!b->received)
+		b->first = now;
+	else {
+		int64_t gap = now - b->last;
+
+		/* Interarrival jitter estimate as in RFC 3550 */
+		if (b->received > 1) {
+			int64_t d = gap - b->prev_gap;
+
+			b->jitter += ((d < 0 ? -d : d) - b->jitter) / 16;
+		}
+
+		b->prev_gap = gap;
+	}
+
+	b->last = now;
+	b->received++;
+	b->rx_bytes += length;
+	b->lost += seq - b->next_seq;
+	b->next_seq = seq + 1;
+	b->activity = true;
+
+	if (b->next_seq < b->count)
+		return;
+
+	/* Leave the notification handler before unsubscribing */
+	timeout_remove(b->timeout_id);
+	b->timeout_id = timeout_add(0, bench_stream_end_cb, b, NULL);
+}
+
+static void bench_stream_cb(bool success, uint8_t att_ecode, void *user_data)
+{
+	struct bench *b = user_data;
+
+	if (success)
+		return;
+
+	printf("Benchmark stream start failed: %s (0x%02x)\n",
+				ecode_to_string(att_ecode), att_ecode);
+	bench_done(b, false);
+}
+
+static void bench_register_cb(uint16_t att_ecode, void *user_data)
+{
+	struct bench *b = user_data;
+	uint8_t value[10];
+
+	if (att_ecode) {
+		printf("Benchmark subscribe failed: 0x%02x\n", att_ecode);
+		bench_done(b, false);
+		return;
+	}
+
+	value[0] = BENCH_OP_STREAM;
+	value[1] = b->indicate ? 0x01 : 0x00;
+	put_le16(b->size, value + 2);
+	put_le32(b->count, value + 4);
+	put_le16(b->interval, value + 8);
+
+	b->timeout_id = timeout_add(BENCH_STALL_TIMEOUT, bench_stall_cb, b,
+									NULL);
+
+	if (!bt_gatt_client_write_value(b->cli->gatt, b->ctrl_handle, value,
+						sizeof(value), bench_stream_cb,
+						b, NULL))
+		bench_done(b, false);
+}
+
+static void bench_find_chrc(struct gatt_db_attribute *attr, void *user_data)
+{
+	struct bench *b = user_data;
+	uint16_t value_handle;
+	bt_uuid_t uuid, data_uuid, ctrl_uuid;
+
+	if (!gatt_db_attribute_get_char_data(attr, NULL, &value_handle, NULL,
+								NULL, &uuid))
+		return;
+
+	bt_string_to_uuid(&data_uuid, UUID_BENCH_DATA);
+	bt_string_to_uuid(&ctrl_uuid, UUID_BENCH_CTRL);
+
+	if (!bt_uuid_cmp(&uuid, &data_uuid))
+		b->data_handle = value_handle;
+	else if (!bt_uuid_cmp(&uuid, &ctrl_uuid))
+		b->ctrl_handle = value_handle;
+}
+
+static void bench_find_service(struct gatt_db_attribute *attr,
+							void *user_data)
+{
+	gatt_db_service_foreach_char(attr, bench_find_chrc, user_data);
+}
+
+static void bench_usage(void)
+{
+	printf("Usage: bench [options]\nOptions:\n"
+		"\t -i, --indicate\t\tStream indications\n"
+		"\t -s, --size <bytes>\tValue size, 0 for the largest\n"
+		"\t -c, --count <num>\tNumber of values to stream\n"
+		"\t -r, --interval <ms>\tStream interval\n"
+		"\t -w, --writes <num>\tNumber of writes without response\n"
+		"\t -l, --reads <num>\tNumber of reads for latency\n"
+		"e.g.:\n"
+		"\tbench -s 244 -c 5000 -w 5000 -l 200\n");
+}
+
+static struct option bench_options[] = {
+	{ "indicate",	0, 0, 'i' },
+	{ "size",	1, 0, 's' },
+	{ "count",	1, 0, 'c' },
+	{ "interval",	1, 0, 'r' },
+	{ "writes",	1, 0, 'w' },
+	{ "reads",	1, 0, 'l' },
+	{ }
+};
+
+static bool bench_parse_num(const char *str, unsigned long max,
+							unsigned long *num)
+{
+	char *endptr = NULL;
+
+	errno = 0;
+	*num = strtoul(str, &endptr, 0);
+	if (!endptr || *endptr != '\0' || errno == ERANGE || *num > max) {
+		printf("Invalid number: %s\n", str);
+		return false;
+	}
+
+	return true;
+}
+
+static bool bench_run(struct client *cli, char *cmd_str, bool quit)
+{
+	char *argvbuf[14];
+	char **argv = argvbuf;
+	int argc = 1;
+	int opt;
+	unsigned long num;
+	bt_uuid_t uuid;
+	struct bench *b;
+
+	if (!bt_gatt_client_is_ready(cli->gatt)) {
+		printf("GATT client not initialized\n");
+		return false;
+	}
+
+	if (bench) {
+		printf("Benchmark already running\n");
+		return false;
+	}
+
+	if (!parse_args(cmd_str, 12, argv + 1, &argc)) {
+		printf("Too many arguments\n");
+		bench_usage();
+		return false;
+	}
+
+	b = new0(struct bench, 1);
+	b->cli = cli;
+	b->quit = quit;
+	b->count = 1000;
+	b->writes = 1000;
+	b->reads = 100;
+
+	optind = 0;
+	argv[0] = "bench";
+	while ((opt = getopt_long(argc, argv, "+is:c:r:w:l:", bench_options,
+								NULL)) != -1) {
+		switch (opt) {
+		case 'i':
+			b->indicate = true;
+			break;
+		case 's':
+			if (!bench_parse_num(optarg, BT_ATT_MAX_VALUE_LEN,
+									&num))
+				goto fail;
+			b->size = num;
+			break;
+		case 'c':
+			if (!bench_parse_num(optarg, UINT32_MAX, &num))
+				goto fail;
+			b->count = num;
+			break;
+		case 'r':
+			if (!bench_parse_num(optarg, UINT16_MAX, &num))
+				goto fail;
+			b->interval = num;
+			break;
+		case 'w':
+			if (!bench_parse_num(optarg, UINT32_MAX, &num))
+				goto fail;
+			b->writes = num;
+			break;
+		case 'l':
+			if (!bench_parse_num(optarg, UINT32_MAX, &num))
+				goto fail;
+			b->reads = num;
+			break;
+		default:
+			bench_usage();
+			goto fail;
+		}
+	}
+
+	bt_string_to_uuid(&uuid, UUID_BENCH);
+	gatt_db_foreach_service(cli->db, &uuid, bench_find_service, b);
+
+	if (!b->data_handle || !b->ctrl_handle) {
+		printf("Benchmark service not found\n");
+		goto fail;
+	}
+
+	bench = b;
+
+	if (!b->count) {
+		bench_write_start(b);
+		return true;
+	}
+
+	b->notify_id = bt_gatt_client_register_notify(cli->gatt,
+							b->data_handle,
+							bench_register_cb,
+							bench_notify_cb, b,
+							NULL);
+	if (!b->notify_id) {
+		printf("Failed to subscribe to benchmark data\n");
+		bench = NULL;
+		goto fail;
+	}
+
+	return true;
+
+fail:
+	free(b);
+	return false;
+}
+
+static void cmd_bench(struct client *cli, char *cmd_str)
+{
+	bench_run(cli, cmd_str, false);
+}
+
 static void cmd_help(struct client *cli, char *cmd_str);
 
 typedef void (*command_func_t)(struct client *cli, char *cmd_str);
@@ -1340,6 +1946,8 @@ static struct {
 				"\tGet security level on le connection"},
 	{ "set-sign-key", cmd_set_sign_key,
 				"\tSet signing key for signed write command"},
+	{ "bench", cmd_bench,
+			"\tRun throughput and latency benchmark" },
 	{ }
 };
 
@@ -1494,12 +2102,14 @@ static void usage(void)
 		"\t-s, --security-level <sec> \tSet security level (low|"
 								"medium|high)\n"
 		"\t-v, --verbose\t\t\tEnable extra logging\n"
+		"\t-B, --bench <options>\t\tRun benchmark and exit\n"
 		"\t-h, --help\t\t\tDisplay help\n");
 }
 
 static struct option main_options[] = {
 	{ "index",		1, 0, 'i' },
 	{ "dest",		1, 0, 'd' },
+	{ "bench",		1, 0, 'B' },
 	{ "type",		1, 0, 't' },
 	{ "mtu",		1, 0, 'm' },
 	{ "security-level",	1, 0, 's' },
@@ -1521,7 +2131,7 @@ int main(int argc, char *argv[])
 	sigset_t mask;
 	struct client *cli;
 
-	while ((opt = getopt_long(argc, argv, "+hvs:m:t:d:i:",
+	while ((opt = getopt_long(argc, argv, "+hvs:m:t:d:i:B:",
 						main_options, NULL)) != -1) {
 		switch (opt) {
 		case 'h':
@@ -1530,6 +2140,9 @@ int main(int argc, char *argv[])
 		case 'v':
 			verbose = true;
 			break;
+		case 'B':
+			bench_args = optarg;
+			break;
 		case 's':
 			if (strcmp(optarg, "low") == 0)
 				sec = BT_SECURITY_LOW;
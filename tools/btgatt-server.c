@@ -50,6 +50,14 @@
 #define UUID_HEART_RATE_BODY		0x2a38
 #define UUID_HEART_RATE_CTRL		0x2a39
 
+/* Benchmark service, shared with btgatt-client */
+#define UUID_BENCH			"a5b1e100-31c6-4d5c-9b1b-f6105604f0d4"
+#define UUID_BENCH_DATA			"a5b1e101-31c6-4d5c-9b1b-f6105604f0d4"
+#define UUID_BENCH_CTRL			"a5b1e102-31c6-4d5c-9b1b-f6105604f0d4"
+
+#define BENCH_OP_STREAM			0x01
+#define BENCH_OP_RESET			0x02
+
 #define ATT_CID 4
 
 #define PRLOG(...) \
@@ -94,6 +102,16 @@ struct server {
 	bool hr_msrmt_enabled;
 	int hr_ee_count;
 	unsigned int hr_timeout_id;
+
+	uint16_t bench_data_handle;
+	bool bench_indicate;
+	uint16_t bench_size;
+	uint16_t bench_interval;
+	uint32_t bench_count;
+	uint32_t bench_seq;
+	unsigned int bench_timeout_id;
+	uint32_t bench_rx_bytes;
+	uint32_t bench_rx_packets;
 };
 
 static void print_prompt(void)
@@ -392,6 +410,225 @@ done:
 	gatt_db_attribute_write_result(attrib, id, ecode);
 }
 
+static void bench_stop(struct server *server)
+{
+	timeout_remove(server->bench_timeout_id);
+	server->bench_timeout_id = 0;
+	server->bench_count = 0;
+}
+
+static bool bench_send(struct server *server);
+
+static void bench_conf_cb(void *user_data)
+{
+	struct server *server = user_data;
+
+	/* Indications are paced by their confirmations */
+	if (!server->bench_interval && server->bench_count)
+		bench_send(server);
+}
+
+static bool bench_send(struct server *server)
+{
+	uint8_t pdu[BT_ATT_MAX_VALUE_LEN];
+	uint16_t len;
+	bool sent;
+
+	if (server->bench_seq >= server->bench_count) {
+		PRLOG("Benchmark: sent %u %s\n", server->bench_seq,
+				server->bench_indicate ? "indications" :
+							"notifications");
+		server->bench_timeout_id = 0;
+		server->bench_count = 0;
+		return false;
+	}
+
+	len = MIN(server->bench_size, bt_att_get_mtu(server->att) - 3);
+	len = MIN(len, sizeof(pdu));
+	if (len < 4)
+		len = 4;
+
+	memset(pdu, 0xa5, len);
+	put_le32(server->bench_seq++, pdu);
+
+	if (server->bench_indicate)
+		sent = bt_gatt_server_send_indication(server->gatt,
+						server->bench_data_handle,
+						pdu, len, bench_conf_cb,
+						server, NULL);
+	else
+		sent = bt_gatt_server_send_notification(server->gatt,
+						server->bench_data_handle,
+						pdu, len);
+
+	if (!sent) {
+		PRLOG("Benchmark: failed to send value\n");
+		server->bench_timeout_id = 0;
+		server->bench_count = 0;
+		return false;
+	}
+
+	/* Only notifications and paced indications use the timer */
+	return server->bench_interval || !server->bench_indicate;
+}
+
+static bool bench_timeout_cb(void *user_data)
+{
+	return bench_send(user_data);
+}
+
+static void bench_data_read_cb(struct gatt_db_attribute *attrib,
+					unsigned int id, uint16_t offset,
+					uint8_t opcode, struct bt_att *att,
+					void *user_data)
+{
+	struct server *server = user_data;
+	uint8_t value[BT_ATT_MAX_VALUE_LEN];
+	uint16_t len;
+
+	len = MIN(server->bench_size, bt_att_get_mtu(server->att) - 1);
+	len = MIN(len, sizeof(value));
+
+	if (offset > len) {
+		gatt_db_attribute_read_result(attrib, id,
+					BT_ATT_ERROR_INVALID_OFFSET, NULL, 0);
+		return;
+	}
+
+	memset(value, 0x5a, len);
+
+	gatt_db_attribute_read_result(attrib, id, 0, value + offset,
+								len - offset);
+}
+
+static void bench_data_write_cb(struct gatt_db_attribute *attrib,
+					unsigned int id, uint16_t offset,
+					const uint8_t *value, size_t len,
+					uint8_t opcode, struct bt_att *att,
+					void *user_data)
+{
+	struct server *server = user_data;
+
+	server->bench_rx_bytes += len;
+	server->bench_rx_packets++;
+
+	gatt_db_attribute_write_result(attrib, id, 0);
+}
+
+static void bench_data_ccc_read_cb(struct gatt_db_attribute *attrib,
+					unsigned int id, uint16_t offset,
+					uint8_t opcode, struct bt_att *att,
+					void *user_data)
+{
+	uint8_t value[2] = { 0x00, 0x00 };
+
+	gatt_db_attribute_read_result(attrib, id, 0, value, 2);
+}
+
+static void bench_data_ccc_write_cb(struct gatt_db_attribute *attrib,
+					unsigned int id, uint16_t offset,
+					const uint8_t *value, size_t len,
+					uint8_t opcode, struct bt_att *att,
+					void *user_data)
+{
+	struct server *server = user_data;
+	uint8_t ecode = 0;
+
+	if (!value || len != 2) {
+		ecode = BT_ATT_ERROR_INVALID_ATTRIBUTE_VALUE_LEN;
+		goto done;
+	}
+
+	if (offset) {
+		ecode = BT_ATT_ERROR_INVALID_OFFSET;
+		goto done;
+	}
+
+	/* Streams are started from the control point, only stop here */
+	if (value[0] == 0x00)
+		bench_stop(server);
+
+done:
+	gatt_db_attribute_write_result(attrib, id, ecode);
+}
+
+static void bench_ctrl_read_cb(struct gatt_db_attribute *attrib,
+					unsigned int id, uint16_t offset,
+					uint8_t opcode, struct bt_att *att,
+					void *user_data)
+{
+	struct server *server = user_data;
+	uint8_t value[8];
+
+	put_le32(server->bench_rx_bytes, value);
+	put_le32(server->bench_rx_packets, value + 4);
+
+	gatt_db_attribute_read_result(attrib, id, 0, value, sizeof(value));
+}
+
+static void bench_ctrl_write_cb(struct gatt_db_attribute *attrib,
+					unsigned int id, uint16_t offset,
+					const uint8_t *value, size_t len,
+					uint8_t opcode, struct bt_att *att,
+					void *user_data)
+{
+	struct server *server = user_data;
+	uint8_t ecode = 0;
+
+	if (!value || len < 1) {
+		ecode = BT_ATT_ERROR_INVALID_ATTRIBUTE_VALUE_LEN;
+		goto done;
+	}
+
+	if (offset) {
+		ecode = BT_ATT_ERROR_INVALID_OFFSET;
+		goto done;
+	}
+
+	switch (value[0]) {
+	case BENCH_OP_STREAM:
+		/* Mode, value size, value count, interval in msec */
+		if (len != 10) {
+			ecode = BT_ATT_ERROR_INVALID_ATTRIBUTE_VALUE_LEN;
+			goto done;
+		}
+
+		bench_stop(server);
+
+		server->bench_indicate = value[1];
+		server->bench_size = get_le16(value + 2);
+		server->bench_count = get_le32(value + 4);
+		server->bench_interval = get_le16(value + 8);
+		server->bench_seq = 0;
+
+		PRLOG("Benchmark: streaming %u %s of %u bytes every %u ms\n",
+				server->bench_count,
+				server->bench_indicate ? "indications" :
+							"notifications",
+				server->bench_size, server->bench_interval);
+
+		if (server->bench_indicate && !server->bench_interval) {
+			bench_send(server);
+			break;
+		}
+
+		server->bench_timeout_id = timeout_add(server->bench_interval,
+							bench_timeout_cb,
+							server, NULL);
+		break;
+	case BENCH_OP_RESET:
+		server->bench_rx_bytes = 0;
+		server->bench_rx_packets = 0;
+		break;
+	default:
+		ecode = 0x80;
+		break;
+	}
+
+done:
+	gatt_db_attribute_write_result(attrib, id, ecode);
+}
+
 static void confirm_write(struct gatt_db_attribute *attr, int err,
 							void *user_data)
 {
@@ -531,14 +768,56 @@ static void populate_hr_service(struct server *server)
 		gatt_db_service_set_active(service, true);
 }
 
-static void populate_db(struct server *server)
+static void populate_bench_service(struct server *server)
+{
+	bt_uuid_t uuid;
+	struct gatt_db_attribute *service, *data;
+
+	bt_string_to_uuid(&uuid, UUID_BENCH);
+	service = gatt_db_add_service(server->db, &uuid, true, 6);
+
+	/* Data Characteristic: read, write and not/ind throughput */
+	bt_string_to_uuid(&uuid, UUID_BENCH_DATA);
+	data = gatt_db_service_add_characteristic(service, &uuid,
+					BT_ATT_PERM_READ | BT_ATT_PERM_WRITE,
+					BT_GATT_CHRC_PROP_READ |
+					BT_GATT_CHRC_PROP_WRITE_WITHOUT_RESP |
+					BT_GATT_CHRC_PROP_NOTIFY |
+					BT_GATT_CHRC_PROP_INDICATE,
+					bench_data_read_cb,
+					bench_data_write_cb, server);
+	server->bench_data_handle = gatt_db_attribute_get_handle(data);
+
+	bt_uuid16_create(&uuid, GATT_CLIENT_CHARAC_CFG_UUID);
+	gatt_db_service_add_descriptor(service, &uuid,
+					BT_ATT_PERM_READ | BT_ATT_PERM_WRITE,
+					bench_data_ccc_read_cb,
+					bench_data_ccc_write_cb, server);
+
+	/* Control Point: starts streams and reports received writes */
+	bt_string_to_uuid(&uuid, UUID_BENCH_CTRL);
+	gatt_db_service_add_characteristic(service, &uuid,
+					BT_ATT_PERM_READ | BT_ATT_PERM_WRITE,
+					BT_GATT_CHRC_PROP_READ |
+					BT_GATT_CHRC_PROP_WRITE,
+					bench_ctrl_read_cb,
+					bench_ctrl_write_cb, server);
+
+	gatt_db_service_set_active(service, true);
+}
+
+static void populate_db(struct server *server, bool bench)
 {
 	populate_gap_service(server);
 	populate_gatt_service(server);
 	populate_hr_service(server);
+
+	if (bench)
+		populate_bench_service(server);
 }
 
-static struct server *server_create(int fd, uint16_t mtu, bool hr_visible)
+static struct server *server_create(int fd, uint16_t mtu, bool hr_visible,
+								bool bench)
 {
 	struct server *server;
 	size_t name_len = strlen(test_device_name);
@@ -601,7 +880,7 @@ static struct server *server_create(int fd, uint16_t mtu, bool hr_visible)
 	srand(time(NULL));
 
 	/* bt_gatt_server already holds a reference */
-	populate_db(server);
+	populate_db(server, bench);
 
 	return server;
 
@@ -617,6 +896,7 @@ fail:
 static void server_destroy(struct server *server)
 {
 	timeout_remove(server->hr_timeout_id);
+	timeout_remove(server->bench_timeout_id);
 	bt_gatt_server_unref(server->gatt);
 	gatt_db_unref(server->db);
 }
@@ -634,6 +914,7 @@ static void usage(void)
 		"\t-t, --type [random|public] \t The source address type\n"
 		"\t-v, --verbose\t\t\tEnable extra logging\n"
 		"\t-r, --heart-rate\t\tEnable Heart Rate service\n"
+		"\t-b, --benchmark\t\t\tEnable benchmark service\n"
 		"\t-h, --help\t\t\tDisplay help\n");
 }
 
@@ -644,6 +925,7 @@ static struct option main_options[] = {
 	{ "type",		1, 0, 't' },
 	{ "verbose",		0, 0, 'v' },
 	{ "heart-rate",		0, 0, 'r' },
+	{ "benchmark",		0, 0, 'b' },
 	{ "help",		0, 0, 'h' },
 	{ }
 };
@@ -1141,9 +1423,10 @@ int main(int argc, char *argv[])
 	uint16_t mtu = 0;
 	sigset_t mask;
 	bool hr_visible = false;
+	bool bench = false;
 	struct server *server;
 
-	while ((opt = getopt_long(argc, argv, "+hvrs:t:m:i:",
+	while ((opt = getopt_long(argc, argv, "+hvrbs:t:m:i:",
 						main_options, NULL)) != -1) {
 		switch (opt) {
 		case 'h':
@@ -1155,6 +1438,9 @@ int main(int argc, char *argv[])
 		case 'r':
 			hr_visible = true;
 			break;
+		case 'b':
+			bench = true;
+			break;
 		case 's':
 			if (strcmp(optarg, "low") == 0)
 				sec = BT_SECURITY_LOW;
@@ -1233,7 +1519,7 @@ int main(int argc, char *argv[])
 
 	mainloop_init();
 
-	server = server_create(fd, mtu, hr_visible);
+	server = server_create(fd, mtu, hr_visible, bench);
 	if (!server) {
 		close(fd);
 		return EXIT_FAILURE;
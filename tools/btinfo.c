@@ -27,11 +27,14 @@
 #endif
 
 #include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <inttypes.h>
+#include <time.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 
@@ -40,6 +43,7 @@
 #include "src/shared/timeout.h"
 #include "src/shared/util.h"
 #include "src/shared/hci.h"
+#include "src/shared/mgmt.h"
 
 #define BTPROTO_HCI	1
 
@@ -82,6 +86,11 @@ struct hci_dev_info {
 #define HCI_PRIMARY	0x00
 #define HCI_AMP		0x01
 
+#define MGMT_INDEX_NONE		0xffff
+#define MGMT_OP_READ_VERSION	0x0001
+#define MGMT_OP_READ_COMMANDS	0x0002
+#define MGMT_OP_READ_INFO	0x0004
+
 static struct hci_dev_info hci_info;
 static uint8_t hci_type;
 static struct bt_hci *hci_dev;
@@ -169,6 +178,447 @@ static bool cmd_local(int argc, char *argv[])
 	return true;
 }
 
+#define PROFILE_TIMER_MS	10
+#define PROFILE_STALL_MS	5000
+
+#define PROFILE_HCI	0
+#define PROFILE_MGMT	1
+
+static const struct {
+	const char *name;
+	uint8_t type;
+	uint16_t opcode;
+} profile_cmds[] = {
+	{ "version", PROFILE_HCI, BT_HCI_CMD_READ_LOCAL_VERSION },
+	{ "features", PROFILE_HCI, BT_HCI_CMD_READ_LOCAL_FEATURES },
+	{ "commands", PROFILE_HCI, BT_HCI_CMD_READ_LOCAL_COMMANDS },
+	{ "name", PROFILE_HCI, BT_HCI_CMD_READ_LOCAL_NAME },
+	{ "bdaddr", PROFILE_HCI, BT_HCI_CMD_READ_BD_ADDR },
+	{ "buffer", PROFILE_HCI, BT_HCI_CMD_READ_BUFFER_SIZE },
+	{ "le-features", PROFILE_HCI, BT_HCI_CMD_LE_READ_LOCAL_FEATURES },
+	{ "mgmt-version", PROFILE_MGMT, MGMT_OP_READ_VERSION },
+	{ "mgmt-commands", PROFILE_MGMT, MGMT_OP_READ_COMMANDS },
+	{ "mgmt-info", PROFILE_MGMT, MGMT_OP_READ_INFO },
+	{ }
+};
+
+#define PROFILE_CMDS_MAX	(sizeof(profile_cmds) / sizeof(profile_cmds[0]))
+
+struct profile_entry {
+	unsigned int cmd;
+	unsigned int weight;
+	uint32_t *latency;
+	unsigned int completed;
+	unsigned int failed;
+};
+
+struct profile_req {
+	struct profile_entry *entry;
+	uint64_t start;
+};
+
+static struct {
+	struct profile_entry entries[PROFILE_CMDS_MAX];
+	unsigned int num_entries;
+	unsigned int total_weight;
+	unsigned int count;
+	unsigned int rate;
+	unsigned int depth;
+	unsigned int sent;
+	unsigned int completed;
+	unsigned int pending;
+	unsigned int timer;
+	uint64_t start;
+	uint64_t last_completion;
+} profile;
+
+static struct mgmt *mgmt_dev;
+static uint16_t hci_index;
+
+static uint64_t profile_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static int latency_cmp(const void *a, const void *b)
+{
+	uint32_t la = *(const uint32_t *) a, lb = *(const uint32_t *) b;
+
+	return la < lb ? -1 : la > lb;
+}
+
+static void profile_print(const char *name, uint32_t *latency,
+				unsigned int completed, unsigned int failed)
+{
+	uint64_t sum = 0;
+	unsigned int i;
+
+	printf("%-16s %7u %6u", name, completed, failed);
+
+	if (!completed) {
+		printf("\n");
+		return;
+	}
+
+	qsort(latency, completed, sizeof(*latency), latency_cmp);
+
+	for (i = 0; i < completed; i++)
+		sum += latency[i];
+
+	printf(" %8u %8" PRIu64 " %8u %8u %8u %8u\n", latency[0],
+				sum / completed, latency[completed / 2],
+				latency[completed * 90 / 100],
+				latency[completed * 99 / 100],
+				latency[completed - 1]);
+}
+
+static void profile_report(void)
+{
+	uint64_t elapsed = profile_usec() - profile.start;
+	unsigned int i, n = 0, failed = 0;
+	uint32_t *all;
+
+	printf("\n%u of %u commands completed in %.3f sec (%.1f cmd/sec",
+				profile.completed, profile.count,
+				elapsed / 1e6, elapsed ?
+				profile.completed * 1e6 / elapsed : 0.0);
+	if (profile.rate)
+		printf(", target %u", profile.rate);
+	printf(")\n");
+
+	if (profile.pending)
+		printf("%u commands still outstanding\n", profile.pending);
+
+	printf("%-16s %7s %6s %8s %8s %8s %8s %8s %8s\n", "Command",
+				"Done", "Failed", "Min", "Avg", "P50", "P90",
+				"P99", "Max");
+
+	all = malloc(profile.completed * sizeof(*all) + 1);
+
+	for (i = 0; i < profile.num_entries; i++) {
+		struct profile_entry *entry = &profile.entries[i];
+
+		if (all) {
+			memcpy(all + n, entry->latency,
+					entry->completed * sizeof(*all));
+			n += entry->completed;
+		}
+
+		failed += entry->failed;
+
+		profile_print(profile_cmds[entry->cmd].name, entry->latency,
+					entry->completed, entry->failed);
+	}
+
+	if (all && profile.num_entries > 1)
+		profile_print("all", all, n, failed);
+
+	printf("Latencies in usec\n");
+
+	free(all);
+}
+
+static void profile_finish(void)
+{
+	unsigned int i;
+
+	if (profile.timer) {
+		timeout_remove(profile.timer);
+		profile.timer = 0;
+	}
+
+	profile_report();
+
+	for (i = 0; i < profile.num_entries; i++)
+		free(profile.entries[i].latency);
+
+	if (mgmt_dev) {
+		mgmt_unref(mgmt_dev);
+		mgmt_dev = NULL;
+	}
+
+	shutdown_device();
+}
+
+static void profile_send_next(void);
+
+static void profile_complete(struct profile_req *req, bool success)
+{
+	struct profile_entry *entry = req->entry;
+	uint64_t now = profile_usec();
+
+	entry->latency[entry->completed++] = now - req->start;
+	if (!success)
+		entry->failed++;
+
+	profile.completed++;
+	profile.pending--;
+	profile.last_completion = now;
+
+	free(req);
+
+	if (profile.completed == profile.count) {
+		profile_finish();
+		return;
+	}
+
+	/* Without a target rate keep the queue full */
+	if (!profile.rate)
+		profile_send_next();
+}
+
+static void profile_hci_callback(const void *data, uint8_t size,
+							void *user_data)
+{
+	const uint8_t *status = data;
+
+	profile_complete(user_data, size > 0 && !status[0]);
+}
+
+static void profile_mgmt_callback(uint8_t status, uint16_t length,
+					const void *param, void *user_data)
+{
+	profile_complete(user_data, !status);
+}
+
+static struct profile_entry *profile_pick(void)
+{
+	unsigned int i, slot;
+
+	/* Weighted round robin over the sequence number */
+	slot = profile.sent % profile.total_weight;
+
+	for (i = 0; i < profile.num_entries; i++) {
+		if (slot < profile.entries[i].weight)
+			break;
+		slot -= profile.entries[i].weight;
+	}
+
+	return &profile.entries[i];
+}
+
+static bool profile_send(void)
+{
+	struct profile_req *req;
+	unsigned int cmd, id;
+
+	if (profile.sent == profile.count || profile.pending >= profile.depth)
+		return false;
+
+	req = new0(struct profile_req, 1);
+	req->entry = profile_pick();
+	req->start = profile_usec();
+
+	cmd = req->entry->cmd;
+
+	if (profile_cmds[cmd].type == PROFILE_MGMT)
+		id = mgmt_send(mgmt_dev, profile_cmds[cmd].opcode,
+				profile_cmds[cmd].opcode == MGMT_OP_READ_INFO ?
+				hci_index : MGMT_INDEX_NONE, 0, NULL,
+				profile_mgmt_callback, req, NULL);
+	else
+		id = bt_hci_send(hci_dev, profile_cmds[cmd].opcode, NULL, 0,
+					profile_hci_callback, req, NULL);
+
+	if (!id) {
+		fprintf(stderr, "Failed to send %s\n", profile_cmds[cmd].name);
+		free(req);
+		profile.count = profile.sent;
+		return false;
+	}
+
+	profile.sent++;
+	profile.pending++;
+
+	return true;
+}
+
+static void profile_send_next(void)
+{
+	while (profile_send());
+}
+
+static bool profile_timeout(void *user_data)
+{
+	uint64_t now = profile_usec();
+
+	if (profile.pending && now - profile.last_completion >
+					PROFILE_STALL_MS * 1000ull) {
+		printf("No completion for %u ms, giving up\n",
+							PROFILE_STALL_MS);
+		profile.timer = 0;
+		profile_finish();
+		return false;
+	}
+
+	if (profile.rate) {
+		uint64_t due = (now - profile.start) * profile.rate / 1000000;
+
+		while (profile.sent < due && profile_send());
+	}
+
+	if (profile.sent == profile.count && !profile.pending) {
+		profile.timer = 0;
+		profile_finish();
+		return false;
+	}
+
+	return true;
+}
+
+static int profile_add(const char *name, unsigned int weight)
+{
+	unsigned int i;
+
+	for (i = 0; profile_cmds[i].name; i++) {
+		if (!strcmp(profile_cmds[i].name, name))
+			break;
+	}
+
+	if (!profile_cmds[i].name) {
+		fprintf(stderr, "Unknown command %s\n", name);
+		return -EINVAL;
+	}
+
+	if (profile_cmds[i].type == PROFILE_MGMT && !mgmt_dev) {
+		mgmt_dev = mgmt_new_default();
+		if (!mgmt_dev) {
+			fprintf(stderr, "Failed to open management socket\n");
+			return -EIO;
+		}
+	}
+
+	profile.entries[profile.num_entries].cmd = i;
+	profile.entries[profile.num_entries].weight = weight ? weight : 1;
+	profile.total_weight += profile.entries[profile.num_entries].weight;
+	profile.num_entries++;
+
+	return 0;
+}
+
+static int profile_parse_mix(char *mix)
+{
+	char *name, *saveptr = NULL;
+
+	for (name = strtok_r(mix, ",", &saveptr); name;
+				name = strtok_r(NULL, ",", &saveptr)) {
+		char *weight = strchr(name, ':');
+		int err;
+
+		if (profile.num_entries == PROFILE_CMDS_MAX - 1)
+			return -E2BIG;
+
+		if (weight)
+			*weight++ = '\0';
+
+		err = profile_add(name, weight ? atoi(weight) : 1);
+		if (err < 0)
+			return err;
+	}
+
+	return profile.num_entries ? 0 : -EINVAL;
+}
+
+static const struct option profile_options[] = {
+	{ "count",	required_argument,	NULL, 'n' },
+	{ "rate",	required_argument,	NULL, 'r' },
+	{ "depth",	required_argument,	NULL, 'd' },
+	{ "mix",	required_argument,	NULL, 'm' },
+	{ }
+};
+
+static void profile_usage(void)
+{
+	unsigned int i;
+
+	printf("Usage: btinfo profile [options]\n"
+		"\t-n, --count <num>      Number of commands (default 1000)\n"
+		"\t-r, --rate <num>       Target commands per second\n"
+		"\t-d, --depth <num>      Outstanding commands (default 1)\n"
+		"\t-m, --mix <list>       Commands as name[:weight],...\n");
+	printf("commands:\n\t");
+	for (i = 0; profile_cmds[i].name; i++)
+		printf("%s%s", profile_cmds[i].name,
+					profile_cmds[i + 1].name ? ", " : "\n");
+	printf("\tmgmt-info needs --raw to reach the controller\n");
+}
+
+static bool cmd_profile(int argc, char *argv[])
+{
+	char default_mix[] = "version,bdaddr";
+	char *mix = default_mix;
+	unsigned int i;
+
+	memset(&profile, 0, sizeof(profile));
+	profile.count = 1000;
+	profile.depth = 1;
+
+	/* Sub-command options follow the command name */
+	optind = 0;
+
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc + 1, argv - 1, "n:r:d:m:",
+						profile_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'n':
+			profile.count = atoi(optarg);
+			break;
+		case 'r':
+			profile.rate = atoi(optarg);
+			break;
+		case 'd':
+			profile.depth = atoi(optarg);
+			break;
+		case 'm':
+			mix = optarg;
+			break;
+		default:
+			profile_usage();
+			return false;
+		}
+	}
+
+	if (!profile.count || !profile.depth) {
+		profile_usage();
+		return false;
+	}
+
+	if (profile_parse_mix(mix) < 0)
+		return false;
+
+	for (i = 0; i < profile.num_entries; i++)
+		profile.entries[i].latency = new0(uint32_t, profile.count);
+
+	if (reset_on_init)
+		bt_hci_send(hci_dev, BT_HCI_CMD_RESET, NULL, 0,
+						NULL, NULL, NULL);
+
+	printf("Profiling %u commands", profile.count);
+	if (profile.rate)
+		printf(" at %u cmd/sec", profile.rate);
+	printf(" with depth %u\n", profile.depth);
+
+	profile.start = profile_usec();
+	profile.last_completion = profile.start;
+
+	profile.timer = timeout_add(PROFILE_TIMER_MS, profile_timeout,
+								NULL, NULL);
+
+	if (!profile.rate)
+		profile_send_next();
+
+	return true;
+}
+
 typedef bool (*cmd_func_t)(int argc, char *argv[]);
 
 static const struct {
@@ -177,6 +627,7 @@ static const struct {
 	const char *help;
 } cmd_table[] = {
 	{ "local", cmd_local, "Print local controller details" },
+	{ "profile", cmd_profile, "Measure command round-trip latency" },
 	{ }
 };
 
@@ -188,7 +639,11 @@ static void signal_callback(int signum, void *user_data)
 	case SIGINT:
 	case SIGTERM:
 		if (!terminated) {
-			shutdown_device();
+			/* Report what was measured before going away */
+			if (profile.timer)
+				profile_finish();
+			else
+				shutdown_device();
 			terminated = true;
 		}
 		break;
@@ -322,6 +777,7 @@ int main(int argc, char *argv[])
 	close(fd);
 
 	hci_type = (hci_info.type & 0x30) >> 4;
+	hci_index = index;
 
 	if (use_raw) {
 		hci_dev = bt_hci_new_raw_device(index);
@@ -37,11 +37,15 @@
 #include <getopt.h>
 #include <stdbool.h>
 #include <termios.h>
+#include <poll.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 
 #include "src/shared/util.h"
@@ -65,6 +69,17 @@ static bool client_active = false;
 static bool debug_enabled = false;
 static bool emulate_ecc = false;
 static bool skip_first_zero = false;
+static bool batch_enabled = false;
+static bool tcp_nodelay = false;
+static bool tcp_cork = false;
+
+/* Large enough for several maximum sized ACL packets */
+#define PROXY_BUF_SIZE		(128 * 1024)
+
+/* Free space required to read one packet from a packet based descriptor */
+#define PROXY_READ_SIZE		4096
+
+#define PROXY_IOV_MAX		64
 
 static void hexdump_print(const char *str, void *user_data)
 {
@@ -74,22 +89,45 @@ static void hexdump_print(const char *str, void *user_data)
 struct proxy {
 	/* Receive commands, ACL and SCO data */
 	int host_fd;
-	uint8_t host_buf[4096];
-	uint16_t host_len;
+	uint8_t host_buf[PROXY_BUF_SIZE];
+	size_t host_len;
 	bool host_shutdown;
 	bool host_skip_first_zero;
+	bool host_stream;
+	bool host_tcp;
+
+	/* Host packets waiting to be written to the device descriptor */
+	struct iovec dev_iov[PROXY_IOV_MAX];
+	int dev_iovcnt;
 
 	/* Receive events, ACL and SCO data */
 	int dev_fd;
-	uint8_t dev_buf[4096];
-	uint16_t dev_len;
+	uint8_t dev_buf[PROXY_BUF_SIZE];
+	size_t dev_len;
 	bool dev_shutdown;
+	bool dev_stream;
+	bool dev_tcp;
+
+	/* Device packets waiting to be written to the host descriptor */
+	struct iovec host_iov[PROXY_IOV_MAX];
+	int host_iovcnt;
 
 	/* ECC emulation */
 	uint8_t event_mask[8];
 	uint8_t local_sk256[32];
 };
 
+static void wait_writable(int fd)
+{
+	struct pollfd p;
+
+	p.fd = fd;
+	p.events = POLLOUT;
+	p.revents = 0;
+
+	poll(&p, 1, -1);
+}
+
 static bool write_packet(int fd, const void *data, size_t size,
 							void *user_data)
 {
@@ -98,6 +136,8 @@ static bool write_packet(int fd, const void *data, size_t size,
 
 		written = write(fd, data, size);
 		if (written < 0) {
+			if (errno == EAGAIN)
+				wait_writable(fd);
 			if (errno == EAGAIN || errno == EINTR)
 				continue;
 			return false;
@@ -114,23 +154,158 @@ static bool write_packet(int fd, const void *data, size_t size,
 	return true;
 }
 
-static void host_write_packet(struct proxy *proxy, void *buf, uint16_t len)
+static void set_cork(int fd, int cork)
+{
+	setsockopt(fd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork));
+}
+
+static bool write_batch(int fd, struct iovec *iov, int iovcnt, bool tcp,
+							void *user_data)
+{
+	int i;
+
+	if (debug_enabled) {
+		for (i = 0; i < iovcnt; i++)
+			util_hexdump('<', iov[i].iov_base, iov[i].iov_len,
+						hexdump_print, user_data);
+	}
+
+	/* Let TCP fill whole segments while writing the batch */
+	if (tcp && tcp_cork)
+		set_cork(fd, 1);
+
+	while (iovcnt > 0) {
+		ssize_t written;
+
+		written = writev(fd, iov, iovcnt);
+		if (written < 0) {
+			if (errno == EAGAIN)
+				wait_writable(fd);
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			return false;
+		}
+
+		while (iovcnt > 0 && (size_t) written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+
+		if (iovcnt > 0) {
+			iov->iov_base += written;
+			iov->iov_len -= written;
+		}
+	}
+
+	if (tcp && tcp_cork)
+		set_cork(fd, 0);
+
+	return true;
+}
+
+static bool host_flush(struct proxy *proxy)
 {
+	int iovcnt = proxy->dev_iovcnt;
+
+	if (!iovcnt)
+		return true;
+
+	proxy->dev_iovcnt = 0;
+
+	if (!write_batch(proxy->dev_fd, proxy->dev_iov, iovcnt,
+						proxy->dev_tcp, "D: ")) {
+		fprintf(stderr, "Write to device descriptor failed\n");
+		mainloop_remove_fd(proxy->dev_fd);
+		return false;
+	}
+
+	return true;
+}
+
+static bool dev_flush(struct proxy *proxy)
+{
+	int iovcnt = proxy->host_iovcnt;
+
+	if (!iovcnt)
+		return true;
+
+	proxy->host_iovcnt = 0;
+
+	if (!write_batch(proxy->host_fd, proxy->host_iov, iovcnt,
+						proxy->host_tcp, "H: ")) {
+		fprintf(stderr, "Write to host descriptor failed\n");
+		mainloop_remove_fd(proxy->host_fd);
+		return false;
+	}
+
+	return true;
+}
+
+static bool host_write_packet(struct proxy *proxy, void *buf, uint16_t len)
+{
+	if (!host_flush(proxy))
+		return false;
+
 	if (!write_packet(proxy->dev_fd, buf, len, "D: ")) {
 		fprintf(stderr, "Write to device descriptor failed\n");
 		mainloop_remove_fd(proxy->dev_fd);
+		return false;
 	}
+
+	return true;
 }
 
-static void dev_write_packet(struct proxy *proxy, void *buf, uint16_t len)
+static bool dev_write_packet(struct proxy *proxy, void *buf, uint16_t len)
 {
+	if (!dev_flush(proxy))
+		return false;
+
 	if (!write_packet(proxy->host_fd, buf, len, "H: ")) {
 		fprintf(stderr, "Write to host descriptor failed\n");
 		mainloop_remove_fd(proxy->host_fd);
+		return false;
 	}
+
+	return true;
+}
+
+/*
+ * Forward a packet that stays valid in the receive buffer until the next
+ * flush. Packets for a stream descriptor are queued and written together,
+ * while packet based descriptors need one write per packet.
+ */
+static bool host_forward_packet(struct proxy *proxy, void *buf, uint16_t len)
+{
+	if (!batch_enabled || !proxy->dev_stream)
+		return host_write_packet(proxy, buf, len);
+
+	if (proxy->dev_iovcnt == PROXY_IOV_MAX && !host_flush(proxy))
+		return false;
+
+	proxy->dev_iov[proxy->dev_iovcnt].iov_base = buf;
+	proxy->dev_iov[proxy->dev_iovcnt].iov_len = len;
+	proxy->dev_iovcnt++;
+
+	return true;
 }
 
-static void cmd_status(struct proxy *proxy, uint8_t status, uint16_t opcode)
+static bool dev_forward_packet(struct proxy *proxy, void *buf, uint16_t len)
+{
+	if (!batch_enabled || !proxy->host_stream)
+		return dev_write_packet(proxy, buf, len);
+
+	if (proxy->host_iovcnt == PROXY_IOV_MAX && !dev_flush(proxy))
+		return false;
+
+	proxy->host_iov[proxy->host_iovcnt].iov_base = buf;
+	proxy->host_iov[proxy->host_iovcnt].iov_len = len;
+	proxy->host_iovcnt++;
+
+	return true;
+}
+
+static bool cmd_status(struct proxy *proxy, uint8_t status, uint16_t opcode)
 {
 	size_t buf_size = 1 + sizeof(struct bt_hci_evt_hdr) +
 					sizeof(struct bt_hci_evt_cmd_status);
@@ -147,10 +322,10 @@ static void cmd_status(struct proxy *proxy, uint8_t status, uint16_t opcode)
 	cs->ncmd = 0x01;
 	cs->opcode = cpu_to_le16(opcode);
 
-	dev_write_packet(proxy, buf, buf_size);
+	return dev_write_packet(proxy, buf, buf_size);
 }
 
-static void le_meta_event(struct proxy *proxy, uint8_t event,
+static bool le_meta_event(struct proxy *proxy, uint8_t event,
 						void *data, uint8_t len)
 {
 	size_t buf_size = 1 + sizeof(struct bt_hci_evt_hdr) + 1 + len;
@@ -167,10 +342,10 @@ static void le_meta_event(struct proxy *proxy, uint8_t event,
 	if (len > 0)
 		memcpy(buf + 1 + sizeof(*hdr) + 1, data, len);
 
-	dev_write_packet(proxy, buf, buf_size);
+	return dev_write_packet(proxy, buf, buf_size);
 }
 
-static void host_emulate_ecc(struct proxy *proxy, void *buf, uint16_t len)
+static bool host_emulate_ecc(struct proxy *proxy, void *buf, uint16_t len)
 {
 	uint8_t pkt_type = *((uint8_t *) buf);
 	struct bt_hci_cmd_hdr *hdr = buf + 1;
@@ -179,10 +354,8 @@ static void host_emulate_ecc(struct proxy *proxy, void *buf, uint16_t len)
 	struct bt_hci_evt_le_read_local_pk256_complete lrlpkc;
 	struct bt_hci_evt_le_generate_dhkey_complete lgdc;
 
-	if (pkt_type != BT_H4_CMD_PKT) {
-		host_write_packet(proxy, buf, len);
-		return;
-	}
+	if (pkt_type != BT_H4_CMD_PKT)
+		return host_forward_packet(proxy, buf, len);
 
 	switch (le16_to_cpu(hdr->opcode)) {
 	case BT_HCI_CMD_LE_SET_EVENT_MASK:
@@ -192,62 +365,60 @@ static void host_emulate_ecc(struct proxy *proxy, void *buf, uint16_t len)
 		lsem->mask[0] &= ~0x80;		/* P-256 Public Key Complete */
 		lsem->mask[1] &= ~0x01;		/* Generate DHKey Complete */
 
-		host_write_packet(proxy, buf, len);
-		break;
+		return host_forward_packet(proxy, buf, len);
 
 	case BT_HCI_CMD_LE_READ_LOCAL_PK256:
-		if (!ecc_make_key(lrlpkc.local_pk256, proxy->local_sk256)) {
-			cmd_status(proxy, BT_HCI_ERR_COMMAND_DISALLOWED,
-					BT_HCI_CMD_LE_READ_LOCAL_PK256);
-			break;
-		}
-		cmd_status(proxy, BT_HCI_ERR_SUCCESS,
+		if (!ecc_make_key(lrlpkc.local_pk256, proxy->local_sk256))
+			return cmd_status(proxy, BT_HCI_ERR_COMMAND_DISALLOWED,
 					BT_HCI_CMD_LE_READ_LOCAL_PK256);
 
+		if (!cmd_status(proxy, BT_HCI_ERR_SUCCESS,
+					BT_HCI_CMD_LE_READ_LOCAL_PK256))
+			return false;
+
 		if (!(proxy->event_mask[0] & 0x80))
 			break;
 
 		lrlpkc.status = BT_HCI_ERR_SUCCESS;
-		le_meta_event(proxy, BT_HCI_EVT_LE_READ_LOCAL_PK256_COMPLETE,
-						&lrlpkc, sizeof(lrlpkc));
-		break;
+		return le_meta_event(proxy,
+				BT_HCI_EVT_LE_READ_LOCAL_PK256_COMPLETE,
+				&lrlpkc, sizeof(lrlpkc));
 
 	case BT_HCI_CMD_LE_GENERATE_DHKEY:
 		lgd = buf + 1 + sizeof(*hdr);
 		if (!ecdh_shared_secret(lgd->remote_pk256, proxy->local_sk256,
-								lgdc.dhkey)) {
-			cmd_status(proxy, BT_HCI_ERR_COMMAND_DISALLOWED,
+								lgdc.dhkey))
+			return cmd_status(proxy, BT_HCI_ERR_COMMAND_DISALLOWED,
 						BT_HCI_CMD_LE_GENERATE_DHKEY);
-			break;
-		}
-		cmd_status(proxy, BT_HCI_ERR_SUCCESS,
-					BT_HCI_CMD_LE_GENERATE_DHKEY);
+
+		if (!cmd_status(proxy, BT_HCI_ERR_SUCCESS,
+					BT_HCI_CMD_LE_GENERATE_DHKEY))
+			return false;
 
 		if (!(proxy->event_mask[1] & 0x01))
 			break;
 
 		lgdc.status = BT_HCI_ERR_SUCCESS;
-		le_meta_event(proxy, BT_HCI_EVT_LE_GENERATE_DHKEY_COMPLETE,
-							&lgdc, sizeof(lgdc));
-		break;
+		return le_meta_event(proxy,
+				BT_HCI_EVT_LE_GENERATE_DHKEY_COMPLETE,
+				&lgdc, sizeof(lgdc));
 
 	default:
-		host_write_packet(proxy, buf, len);
-		break;
+		return host_forward_packet(proxy, buf, len);
 	}
+
+	return true;
 }
 
-static void dev_emulate_ecc(struct proxy *proxy, void *buf, uint16_t len)
+static bool dev_emulate_ecc(struct proxy *proxy, void *buf, uint16_t len)
 {
 	uint8_t pkt_type = *((uint8_t *) buf);
 	struct bt_hci_evt_hdr *hdr = buf + 1;
 	struct bt_hci_evt_cmd_complete *cc;
 	struct bt_hci_rsp_read_local_commands *rlc;
 
-	if (pkt_type != BT_H4_EVT_PKT) {
-		dev_write_packet(proxy, buf, len);
-		return;
-	}
+	if (pkt_type != BT_H4_EVT_PKT)
+		return dev_forward_packet(proxy, buf, len);
 
 	switch (hdr->evt) {
 	case BT_HCI_EVT_CMD_COMPLETE:
@@ -261,12 +432,10 @@ static void dev_emulate_ecc(struct proxy *proxy, void *buf, uint16_t len)
 			break;
 		}
 
-		dev_write_packet(proxy, buf, len);
-		break;
+		return dev_forward_packet(proxy, buf, len);
 
 	default:
-		dev_write_packet(proxy, buf, len);
-		break;
+		return dev_forward_packet(proxy, buf, len);
 	}
 }
 
@@ -295,6 +464,8 @@ static void host_read_callback(int fd, uint32_t events, void *user_data)
 	struct bt_hci_cmd_hdr *cmd_hdr;
 	struct bt_hci_acl_hdr *acl_hdr;
 	struct bt_hci_sco_hdr *sco_hdr;
+	uint8_t *pkt;
+	size_t avail, off = 0;
 	ssize_t len;
 	uint16_t pktlen;
 
@@ -310,86 +481,101 @@ static void host_read_callback(int fd, uint32_t events, void *user_data)
 		return;
 	}
 
-	len = read(proxy->host_fd, proxy->host_buf + proxy->host_len,
+	/* In batch mode keep reading until the descriptor runs dry */
+	do {
+		len = read(proxy->host_fd, proxy->host_buf + proxy->host_len,
 				sizeof(proxy->host_buf) - proxy->host_len);
-	if (len < 0) {
-		if (errno == EAGAIN || errno == EINTR)
-			return;
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				break;
 
-		fprintf(stderr, "Read from host descriptor failed\n");
-		mainloop_remove_fd(proxy->host_fd);
-		return;
-	}
+			fprintf(stderr, "Read from host descriptor failed\n");
+			mainloop_remove_fd(proxy->host_fd);
+			return;
+		}
 
-	if (debug_enabled)
-		util_hexdump('>', proxy->host_buf + proxy->host_len, len,
-						hexdump_print, "H: ");
+		if (len == 0)
+			break;
 
-	if (proxy->host_skip_first_zero && len > 0) {
-		proxy->host_skip_first_zero = false;
-		if (proxy->host_buf[proxy->host_len] == '\0') {
-			printf("Skipping initial zero byte\n");
-			len--;
-			memmove(proxy->host_buf + proxy->host_len,
-				proxy->host_buf + proxy->host_len + 1, len);
+		if (debug_enabled)
+			util_hexdump('>', proxy->host_buf + proxy->host_len,
+						len, hexdump_print, "H: ");
+
+		if (proxy->host_skip_first_zero) {
+			proxy->host_skip_first_zero = false;
+			if (proxy->host_buf[proxy->host_len] == '\0') {
+				printf("Skipping initial zero byte\n");
+				len--;
+				memmove(proxy->host_buf + proxy->host_len,
+					proxy->host_buf + proxy->host_len + 1,
+					len);
+			}
 		}
-	}
 
-	proxy->host_len += len;
+		proxy->host_len += len;
+	} while (batch_enabled && sizeof(proxy->host_buf) - proxy->host_len >=
+							PROXY_READ_SIZE);
 
-process_packet:
-	if (proxy->host_len < 1)
-		return;
+	while (off < proxy->host_len) {
+		pkt = proxy->host_buf + off;
+		avail = proxy->host_len - off;
 
-	switch (proxy->host_buf[0]) {
-	case BT_H4_CMD_PKT:
-		if (proxy->host_len < 1 + sizeof(*cmd_hdr))
-			return;
+		switch (pkt[0]) {
+		case BT_H4_CMD_PKT:
+			if (avail < 1 + sizeof(*cmd_hdr))
+				goto done;
 
-		cmd_hdr = (void *) (proxy->host_buf + 1);
-		pktlen = 1 + sizeof(*cmd_hdr) + cmd_hdr->plen;
-		break;
-	case BT_H4_ACL_PKT:
-		if (proxy->host_len < 1 + sizeof(*acl_hdr))
+			cmd_hdr = (void *) (pkt + 1);
+			pktlen = 1 + sizeof(*cmd_hdr) + cmd_hdr->plen;
+			break;
+		case BT_H4_ACL_PKT:
+			if (avail < 1 + sizeof(*acl_hdr))
+				goto done;
+
+			acl_hdr = (void *) (pkt + 1);
+			pktlen = 1 + sizeof(*acl_hdr) +
+						cpu_to_le16(acl_hdr->dlen);
+			break;
+		case BT_H4_SCO_PKT:
+			if (avail < 1 + sizeof(*sco_hdr))
+				goto done;
+
+			sco_hdr = (void *) (pkt + 1);
+			pktlen = 1 + sizeof(*sco_hdr) + sco_hdr->dlen;
+			break;
+		case 0xff:
+			/* Notification packet from /dev/vhci - ignore */
+			off = proxy->host_len;
+			goto done;
+		default:
+			fprintf(stderr, "Received unknown host packet "
+						"type 0x%02x\n", pkt[0]);
+			mainloop_remove_fd(proxy->host_fd);
 			return;
+		}
 
-		acl_hdr = (void *) (proxy->host_buf + 1);
-		pktlen = 1 + sizeof(*acl_hdr) + cpu_to_le16(acl_hdr->dlen);
-		break;
-	case BT_H4_SCO_PKT:
-		if (proxy->host_len < 1 + sizeof(*sco_hdr))
+		if (avail < pktlen)
+			break;
+
+		if (emulate_ecc) {
+			if (!host_emulate_ecc(proxy, pkt, pktlen))
+				return;
+		} else if (!host_forward_packet(proxy, pkt, pktlen))
 			return;
 
-		sco_hdr = (void *) (proxy->host_buf + 1);
-		pktlen = 1 + sizeof(*sco_hdr) + sco_hdr->dlen;
-		break;
-	case 0xff:
-		/* Notification packet from /dev/vhci - ignore */
-		proxy->host_len = 0;
-		return;
-	default:
-		fprintf(stderr, "Received unknown host packet type 0x%02x\n",
-							proxy->host_buf[0]);
-		mainloop_remove_fd(proxy->host_fd);
-		return;
+		off += pktlen;
 	}
 
-	if (proxy->host_len < pktlen)
+done:
+	/* Queued packets point into the buffer, so write them out first */
+	if (!host_flush(proxy))
 		return;
 
-	if (emulate_ecc)
-		host_emulate_ecc(proxy, proxy->host_buf, pktlen);
-	else
-		host_write_packet(proxy, proxy->host_buf, pktlen);
-
-	if (proxy->host_len > pktlen) {
-		memmove(proxy->host_buf, proxy->host_buf + pktlen,
-						proxy->host_len - pktlen);
-		proxy->host_len -= pktlen;
-		goto process_packet;
-	}
+	if (off < proxy->host_len)
+		memmove(proxy->host_buf, proxy->host_buf + off,
+						proxy->host_len - off);
 
-	proxy->host_len = 0;
+	proxy->host_len -= off;
 }
 
 static void dev_read_destroy(void *user_data)
@@ -417,6 +603,8 @@ static void dev_read_callback(int fd, uint32_t events, void *user_data)
 	struct bt_hci_evt_hdr *evt_hdr;
 	struct bt_hci_acl_hdr *acl_hdr;
 	struct bt_hci_sco_hdr *sco_hdr;
+	uint8_t *pkt;
+	size_t avail, off = 0;
 	ssize_t len;
 	uint16_t pktlen;
 
@@ -432,72 +620,112 @@ static void dev_read_callback(int fd, uint32_t events, void *user_data)
 		return;
 	}
 
-	len = read(proxy->dev_fd, proxy->dev_buf + proxy->dev_len,
+	/* In batch mode keep reading until the descriptor runs dry */
+	do {
+		len = read(proxy->dev_fd, proxy->dev_buf + proxy->dev_len,
 				sizeof(proxy->dev_buf) - proxy->dev_len);
-	if (len < 0) {
-		if (errno == EAGAIN || errno == EINTR)
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				break;
+
+			fprintf(stderr, "Read from device descriptor failed\n");
+			mainloop_remove_fd(proxy->dev_fd);
 			return;
+		}
 
-		fprintf(stderr, "Read from device descriptor failed\n");
-		mainloop_remove_fd(proxy->dev_fd);
-		return;
-	}
+		if (len == 0)
+			break;
 
-	if (debug_enabled)
-		util_hexdump('>', proxy->dev_buf + proxy->dev_len, len,
-						hexdump_print, "D: ");
+		if (debug_enabled)
+			util_hexdump('>', proxy->dev_buf + proxy->dev_len,
+						len, hexdump_print, "D: ");
 
-	proxy->dev_len += len;
+		proxy->dev_len += len;
+	} while (batch_enabled && sizeof(proxy->dev_buf) - proxy->dev_len >=
+							PROXY_READ_SIZE);
 
-process_packet:
-	if (proxy->dev_len < 1)
-		return;
+	while (off < proxy->dev_len) {
+		pkt = proxy->dev_buf + off;
+		avail = proxy->dev_len - off;
 
-	switch (proxy->dev_buf[0]) {
-	case BT_H4_EVT_PKT:
-		if (proxy->dev_len < 1 + sizeof(*evt_hdr))
-			return;
+		switch (pkt[0]) {
+		case BT_H4_EVT_PKT:
+			if (avail < 1 + sizeof(*evt_hdr))
+				goto done;
 
-		evt_hdr = (void *) (proxy->dev_buf + 1);
-		pktlen = 1 + sizeof(*evt_hdr) + evt_hdr->plen;
-		break;
-	case BT_H4_ACL_PKT:
-		if (proxy->dev_len < 1 + sizeof(*acl_hdr))
+			evt_hdr = (void *) (pkt + 1);
+			pktlen = 1 + sizeof(*evt_hdr) + evt_hdr->plen;
+			break;
+		case BT_H4_ACL_PKT:
+			if (avail < 1 + sizeof(*acl_hdr))
+				goto done;
+
+			acl_hdr = (void *) (pkt + 1);
+			pktlen = 1 + sizeof(*acl_hdr) +
+						cpu_to_le16(acl_hdr->dlen);
+			break;
+		case BT_H4_SCO_PKT:
+			if (avail < 1 + sizeof(*sco_hdr))
+				goto done;
+
+			sco_hdr = (void *) (pkt + 1);
+			pktlen = 1 + sizeof(*sco_hdr) + sco_hdr->dlen;
+			break;
+		default:
+			fprintf(stderr, "Received unknown device packet "
+						"type 0x%02x\n", pkt[0]);
+			mainloop_remove_fd(proxy->dev_fd);
 			return;
+		}
 
-		acl_hdr = (void *) (proxy->dev_buf + 1);
-		pktlen = 1 + sizeof(*acl_hdr) + cpu_to_le16(acl_hdr->dlen);
-		break;
-	case BT_H4_SCO_PKT:
-		if (proxy->dev_len < 1 + sizeof(*sco_hdr))
+		if (avail < pktlen)
+			break;
+
+		if (emulate_ecc) {
+			if (!dev_emulate_ecc(proxy, pkt, pktlen))
+				return;
+		} else if (!dev_forward_packet(proxy, pkt, pktlen))
 			return;
 
-		sco_hdr = (void *) (proxy->dev_buf + 1);
-		pktlen = 1 + sizeof(*sco_hdr) + sco_hdr->dlen;
-		break;
-	default:
-		fprintf(stderr, "Received unknown device packet type 0x%02x\n",
-							proxy->dev_buf[0]);
-		mainloop_remove_fd(proxy->dev_fd);
-		return;
+		off += pktlen;
 	}
 
-	if (proxy->dev_len < pktlen)
+done:
+	/* Queued packets point into the buffer, so write them out first */
+	if (!dev_flush(proxy))
 		return;
 
-	if (emulate_ecc)
-		dev_emulate_ecc(proxy, proxy->dev_buf, pktlen);
-	else
-		dev_write_packet(proxy, proxy->dev_buf, pktlen);
+	if (off < proxy->dev_len)
+		memmove(proxy->dev_buf, proxy->dev_buf + off,
+						proxy->dev_len - off);
 
-	if (proxy->dev_len > pktlen) {
-		memmove(proxy->dev_buf, proxy->dev_buf + pktlen,
-						proxy->dev_len - pktlen);
-		proxy->dev_len -= pktlen;
-		goto process_packet;
-	}
+	proxy->dev_len -= off;
+}
+
+static void setup_descriptor(int fd, bool *stream, bool *tcp)
+{
+	struct sockaddr_storage addr;
+	socklen_t len;
+	int type, flags, opt = 1;
+
+	len = sizeof(type);
+	*stream = getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == 0 &&
+							type == SOCK_STREAM;
+
+	len = sizeof(addr);
+	*tcp = *stream && getsockname(fd, (struct sockaddr *) &addr,
+					&len) == 0 && addr.ss_family == AF_INET;
+
+	if (*tcp && tcp_nodelay && setsockopt(fd, IPPROTO_TCP, TCP_NODELAY,
+						&opt, sizeof(opt)) < 0)
+		perror("Failed to enable TCP_NODELAY");
 
-	proxy->dev_len = 0;
+	if (!batch_enabled)
+		return;
+
+	flags = fcntl(fd, F_GETFL);
+	if (flags >= 0)
+		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
 static bool setup_proxy(int host_fd, bool host_shutdown,
@@ -519,6 +747,9 @@ static bool setup_proxy(int host_fd, bool host_shutdown,
 	proxy->dev_fd = dev_fd;
 	proxy->dev_shutdown = dev_shutdown;
 
+	setup_descriptor(host_fd, &proxy->host_stream, &proxy->host_tcp);
+	setup_descriptor(dev_fd, &proxy->dev_stream, &proxy->dev_tcp);
+
 	mainloop_add_fd(proxy->host_fd, EPOLLIN | EPOLLRDHUP,
 				host_read_callback, proxy, host_read_destroy);
 
@@ -752,6 +983,9 @@ static void usage(void)
 		"\t-i, --index <num>           Use specified controller\n"
 		"\t-a, --amp                   Create AMP controller\n"
 		"\t-e, --ecc                   Emulate ECC support\n"
+		"\t-b, --batch                 Batch packet forwarding\n"
+		"\t-n, --nodelay               Enable TCP_NODELAY\n"
+		"\t-k, --cork                  Cork TCP while writing batches\n"
 		"\t-d, --debug                 Enable debugging output\n"
 		"\t-h, --help                  Show help options\n");
 }
@@ -765,6 +999,9 @@ static const struct option main_options[] = {
 	{ "index",    required_argument, NULL, 'i' },
 	{ "amp",      no_argument,       NULL, 'a' },
 	{ "ecc",      no_argument,       NULL, 'e' },
+	{ "batch",    no_argument,       NULL, 'b' },
+	{ "nodelay",  no_argument,       NULL, 'n' },
+	{ "cork",     no_argument,       NULL, 'k' },
 	{ "debug",    no_argument,       NULL, 'd' },
 	{ "version",  no_argument,       NULL, 'v' },
 	{ "help",     no_argument,       NULL, 'h' },
@@ -785,7 +1022,7 @@ int main(int argc, char *argv[])
 	for (;;) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "rc:l::u::p:i:aezdvh",
+		opt = getopt_long(argc, argv, "rc:l::u::p:i:aebnkzdvh",
 						main_options, NULL);
 		if (opt < 0)
 			break;
@@ -836,6 +1073,15 @@ int main(int argc, char *argv[])
 		case 'e':
 			emulate_ecc = true;
 			break;
+		case 'b':
+			batch_enabled = true;
+			break;
+		case 'n':
+			tcp_nodelay = true;
+			break;
+		case 'k':
+			tcp_cork = true;
+			break;
 		case 'z':
 			skip_first_zero = true;
 			break;
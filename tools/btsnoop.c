@@ -510,6 +510,38 @@ close_input:
 	close(fd);
 }
 
+static void command_index(const char *input)
+{
+	struct btsnoop *btsnoop;
+	char *index_path;
+	uint64_t count;
+
+	btsnoop = btsnoop_open(input, BTSNOOP_FLAG_PKLG_SUPPORT);
+	if (!btsnoop) {
+		fprintf(stderr, "failed to open %s\n", input);
+		return;
+	}
+
+	if (asprintf(&index_path, "%s.idx", input) < 0) {
+		btsnoop_unref(btsnoop);
+		return;
+	}
+
+	if (!btsnoop_index(btsnoop, index_path)) {
+		fprintf(stderr, "failed to index %s\n", input);
+		goto done;
+	}
+
+	count = btsnoop_get_count(btsnoop);
+
+	printf("%llu records indexed in %s\n", (unsigned long long) count,
+								index_path);
+
+done:
+	free(index_path);
+	btsnoop_unref(btsnoop);
+}
+
 static void usage(void)
 {
 	printf("btsnoop trace file handling tool\n"
@@ -518,19 +550,21 @@ static void usage(void)
 	printf("commands:\n"
 		"\t-m, --merge <output>   Merge multiple btsnoop files\n"
 		"\t-e, --extract <input>  Extract data from btsnoop file\n"
+		"\t-i, --index <input>    Create random access index file\n"
 		"\t-h, --help             Show help options\n");
 }
 
 static const struct option main_options[] = {
 	{ "merge",   required_argument, NULL, 'm' },
 	{ "extract", required_argument, NULL, 'e' },
+	{ "index",   required_argument, NULL, 'i' },
 	{ "type",    required_argument, NULL, 't' },
 	{ "version", no_argument,       NULL, 'v' },
 	{ "help",    no_argument,       NULL, 'h' },
 	{ }
 };
 
-enum { INVALID, MERGE, EXTRACT };
+enum { INVALID, MERGE, EXTRACT, INDEX };
 
 int main(int argc, char *argv[])
 {
@@ -542,7 +576,7 @@ int main(int argc, char *argv[])
 	for (;;) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "m:e:t:vh", main_options, NULL);
+		opt = getopt_long(argc, argv, "m:e:i:t:vh", main_options, NULL);
 		if (opt < 0)
 			break;
 
@@ -555,6 +589,10 @@ int main(int argc, char *argv[])
 			command = EXTRACT;
 			input_path = optarg;
 			break;
+		case 'i':
+			command = INDEX;
+			input_path = optarg;
+			break;
 		case 't':
 			type = optarg;
 			break;
@@ -600,6 +638,15 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "extract type not supported\n");
 		break;
 
+	case INDEX:
+		if (argc - optind > 0) {
+			fprintf(stderr, "extra arguments not allowed\n");
+			return EXIT_FAILURE;
+		}
+
+		command_index(input_path);
+		break;
+
 	default:
 		usage();
 		return EXIT_FAILURE;
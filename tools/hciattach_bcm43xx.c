@@ -40,6 +40,8 @@
 #include "lib/hci.h"
 #include "lib/hci_lib.h"
 
+#include "src/shared/tty.h"
+
 #include "hciattach.h"
 
 #ifndef FIRMWARE_DIR
@@ -55,6 +57,9 @@
 
 #define CC_MIN_SIZE 7
 
+/* Upper bound for firmware commands in flight, on top of the HCI credits */
+#define FW_WINDOW 4
+
 #define MIN(X,Y) ((X) < (Y) ? (X) : (Y))
 
 static int bcm43xx_read_local_name(int fd, char *name, size_t size)
@@ -183,6 +188,25 @@ static int bcm43xx_set_clock(int fd, unsigned char clock)
 	return 0;
 }
 
+static const uint32_t bcm43xx_speeds[] = {
+	4000000, 3000000, 2000000, 1500000, 1000000,
+	921600, 460800, 230400, 115200,
+};
+
+static unsigned int elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1000 +
+				(now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/*
+ * Returns -EOPNOTSUPP if either side can't do the speed, in which case
+ * the controller is still running at the previous one.
+ */
 static int bcm43xx_set_speed(int fd, struct termios *ti, uint32_t speed)
 {
 	unsigned char cmd[] =
@@ -190,8 +214,13 @@ static int bcm43xx_set_speed(int fd, struct termios *ti, uint32_t speed)
 				0x00, 0x00, 0x00, 0x00 };
 	unsigned char resp[CC_MIN_SIZE];
 
+	if (!tty_get_speed(speed)) {
+		fprintf(stderr, "Host doesn't support %d bit/s\n", speed);
+		return -EOPNOTSUPP;
+	}
+
 	if (speed > 3000000 && bcm43xx_set_clock(fd, BCM43XX_CLOCK_48))
-		return -1;
+		return -EOPNOTSUPP;
 
 	printf("Set Controller UART speed to %d bit/s\n", speed);
 
@@ -204,27 +233,59 @@ static int bcm43xx_set_speed(int fd, struct termios *ti, uint32_t speed)
 
 	if (write(fd, cmd, sizeof(cmd)) != sizeof(cmd)) {
 		fprintf(stderr, "Failed to write update baudrate command\n");
-		return -1;
+		return -EIO;
 	}
 
 	if (read_hci_event(fd, resp, sizeof(resp)) < CC_MIN_SIZE) {
 		fprintf(stderr, "Failed to update baudrate, invalid HCI event\n");
-		return -1;
+		return -EIO;
 	}
 
 	if (resp[4] != cmd[1] || resp[5] != cmd[2] || resp[6] != CMD_SUCCESS) {
 		fprintf(stderr, "Failed to update baudrate, command failure\n");
-		return -1;
+		return -EOPNOTSUPP;
 	}
 
 	if (set_speed(fd, ti, speed) < 0) {
 		perror("Can't set host baud rate");
-		return -1;
+		return -EIO;
 	}
 
 	return 0;
 }
 
+/*
+ * Use the requested speed if possible, otherwise the fastest one below
+ * it that both the controller and the host accept.
+ */
+static int bcm43xx_negotiate_speed(int fd, struct termios *ti, int speed)
+{
+	struct timespec start;
+	unsigned int i;
+	int err;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	err = bcm43xx_set_speed(fd, ti, speed);
+
+	for (i = 0; err == -EOPNOTSUPP && i < sizeof(bcm43xx_speeds) /
+					sizeof(bcm43xx_speeds[0]); i++) {
+		if (bcm43xx_speeds[i] >= (uint32_t) speed)
+			continue;
+
+		speed = bcm43xx_speeds[i];
+		err = bcm43xx_set_speed(fd, ti, speed);
+	}
+
+	if (err < 0)
+		return -1;
+
+	printf("UART speed %d bit/s set in %u ms\n", speed,
+							elapsed_ms(&start));
+
+	return speed;
+}
+
 static int bcm43xx_load_firmware(int fd, const char *fw)
 {
 	unsigned char cmd[] = { HCI_COMMAND_PKT, 0x2e, 0xfc, 0x00 };
@@ -232,10 +293,14 @@ static int bcm43xx_load_firmware(int fd, const char *fw)
 	struct timespec tm_ready = { 0, 200000000 };
 	unsigned char resp[CC_MIN_SIZE];
 	unsigned char tx_buf[1024];
-	int len, fd_fw, n;
+	unsigned int in_flight = 0, credits = 1, cmds = 0, bytes = 0;
+	struct timespec start;
+	int len, fd_fw, n = 1;
 
 	printf("Flash firmware %s\n", fw);
 
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
 	fd_fw = open(fw, O_RDONLY);
 	if (fd_fw < 0) {
 		fprintf(stderr, "Unable to open firmware (%s)\n", fw);
@@ -264,30 +329,73 @@ static int bcm43xx_load_firmware(int fd, const char *fw)
 
 	tcflush(fd, TCIOFLUSH);
 
-	while ((n = read(fd_fw, &tx_buf[1], 3))) {
-		if (n < 0) {
-			fprintf(stderr, "Failed to read firmware\n");
-			goto fail;
-		}
+	/*
+	 * Keep as many patch commands in flight as the controller grants
+	 * command credits for, instead of a full round trip per command.
+	 * The responses must not be flushed since later ones may already
+	 * be on their way.
+	 */
+	while (n || in_flight) {
+		while (n && credits && in_flight < FW_WINDOW) {
+			n = read(fd_fw, &tx_buf[1], 3);
+			if (n < 0) {
+				fprintf(stderr, "Failed to read firmware\n");
+				goto fail;
+			}
+
+			if (!n)
+				break;
 
-		tx_buf[0] = HCI_COMMAND_PKT;
+			tx_buf[0] = HCI_COMMAND_PKT;
 
-		len = tx_buf[3];
+			len = tx_buf[3];
 
-		if (read(fd_fw, &tx_buf[4], len) < 0) {
-			fprintf(stderr, "Failed to read firmware\n");
-			goto fail;
+			if (read(fd_fw, &tx_buf[4], len) < 0) {
+				fprintf(stderr, "Failed to read firmware\n");
+				goto fail;
+			}
+
+			if (write(fd, tx_buf, len + 4) != (len + 4)) {
+				fprintf(stderr, "Failed to write firmware\n");
+				goto fail;
+			}
+
+			credits--;
+			in_flight++;
+			cmds++;
+			bytes += len;
 		}
 
-		if (write(fd, tx_buf, len + 4) != (len + 4)) {
-			fprintf(stderr, "Failed to write firmware\n");
+		if (!in_flight)
+			break;
+
+		if (read_hci_event(fd, resp, sizeof(resp)) < CC_MIN_SIZE) {
+			fprintf(stderr, "Failed to write firmware, "
+						"invalid HCI event\n");
 			goto fail;
 		}
 
-		read_hci_event(fd, resp, sizeof(resp));
-		tcflush(fd, TCIOFLUSH);
+		if (resp[1] != EVT_CMD_COMPLETE)
+			continue;
+
+		/* A NOP only updates the credits */
+		if (resp[4] || resp[5])
+			in_flight--;
+
+		credits = resp[3];
+		if (!credits && !in_flight)
+			credits = 1;
+
+		if (resp[6] != CMD_SUCCESS) {
+			fprintf(stderr, "Failed to write firmware, "
+					"command failure 0x%2.2x\n", resp[6]);
+			goto fail;
+		}
 	}
 
+	printf("Firmware loaded, %u commands and %u bytes in %u ms\n",
+					cmds, bytes, elapsed_ms(&start));
+
 	/* Wait for firmware ready */
 	nanosleep(&tm_ready, NULL);
 
@@ -356,9 +464,12 @@ int bcm43xx_init(int fd, int def_speed, int speed, struct termios *ti,
 {
 	char chip_name[20];
 	char fw_path[PATH_MAX];
+	struct timespec start;
 
 	printf("bcm43xx_init\n");
 
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
 	if (bcm43xx_reset(fd))
 		return -1;
 
@@ -368,7 +479,8 @@ int bcm43xx_init(int fd, int def_speed, int speed, struct termios *ti,
 	if (bcm43xx_locate_patch(FIRMWARE_DIR, chip_name, fw_path)) {
 		fprintf(stderr, "Patch not found, continue anyway\n");
 	} else {
-		if (bcm43xx_set_speed(fd, ti, speed))
+		speed = bcm43xx_negotiate_speed(fd, ti, speed);
+		if (speed < 0)
 			return -1;
 
 		if (bcm43xx_load_firmware(fd, fw_path))
@@ -387,8 +499,10 @@ int bcm43xx_init(int fd, int def_speed, int speed, struct termios *ti,
 	if (bdaddr)
 		bcm43xx_set_bdaddr(fd, bdaddr);
 
-	if (bcm43xx_set_speed(fd, ti, speed))
+	if (bcm43xx_negotiate_speed(fd, ti, speed) < 0)
 		return -1;
 
+	printf("Controller initialized in %u ms\n", elapsed_ms(&start));
+
 	return 0;
 }
@@ -635,6 +635,9 @@ static void usage(void)
 	"  -D, --pppdump=file         Extract PPP traffic\n"
 	"  -A, --audio=file           Extract SCO audio data\n"
 	"  -Y, --novendor             No vendor commands or events\n"
+	"  -F, --fields               Print decoded fields, one line per packet\n"
+	"  -J, --json                 Print decoded fields as JSON\n"
+	"  -M, --match=field=value    Only show packets with matching field\n"
 	"  -h, --help                 Give this help list\n"
 	"  -v, --version              Give version information\n"
 	"      --usage                Give a short usage message\n"
@@ -661,6 +664,9 @@ static struct option main_options[] = {
 	{ "pppdump",		1, 0, 'D' },
 	{ "audio",		1, 0, 'A' },
 	{ "novendor",		0, 0, 'Y' },
+	{ "fields",		0, 0, 'F' },
+	{ "json",		0, 0, 'J' },
+	{ "match",		1, 0, 'M' },
 	{ "help",		0, 0, 'h' },
 	{ "version",		0, 0, 'v' },
 	{ 0 }
@@ -677,7 +683,7 @@ int main(int argc, char *argv[])
 	uint16_t obex_port;
 
 	while ((opt = getopt_long(argc, argv,
-				"i:l:p:m:w:r:taxXRC:H:O:P:S:D:A:Yhv",
+				"i:l:p:m:w:r:taxXRC:H:O:P:S:D:A:YFJM:hv",
 				main_options, NULL)) != -1) {
 		switch(opt) {
 		case 'i':
@@ -765,6 +771,21 @@ int main(int argc, char *argv[])
 			flags |= DUMP_NOVENDOR;
 			break;
 
+		case 'F':
+			flags |= DUMP_FIELDS;
+			break;
+
+		case 'J':
+			flags |= DUMP_JSON;
+			break;
+
+		case 'M':
+			if (decode_add_match(optarg) < 0) {
+				fprintf(stderr, "Invalid match: %s\n", optarg);
+				exit(1);
+			}
+			break;
+
 		case 'v':
 			printf("%s\n", VERSION);
 			exit(0);
@@ -35,6 +35,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/param.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
@@ -2481,6 +2483,334 @@ done:
 	return 0;
 }
 
+#define SCAN_TABLE_MIN		256
+
+struct scan_dev {
+	bdaddr_t bdaddr;
+	uint8_t bdaddr_type;
+	uint8_t used;
+	uint8_t has_name;
+	int8_t rssi_min;
+	int8_t rssi_max;
+	int64_t rssi_sum;
+	uint32_t rssi_count;
+	uint32_t count;
+	uint32_t period_count;
+	char name[30];
+};
+
+struct scan_table {
+	struct scan_dev *devs;
+	size_t size;
+	size_t used;
+	uint64_t reports;
+	uint64_t period_reports;
+};
+
+static size_t scan_hash(const bdaddr_t *bdaddr, uint8_t bdaddr_type)
+{
+	uint32_t hash = 2166136261u;
+	int i;
+
+	/* FNV-1a over address and address type */
+	for (i = 0; i < 6; i++) {
+		hash ^= bdaddr->b[i];
+		hash *= 16777619u;
+	}
+
+	hash ^= bdaddr_type;
+	hash *= 16777619u;
+
+	return hash;
+}
+
+static struct scan_dev *scan_slot(struct scan_dev *devs, size_t size,
+				const bdaddr_t *bdaddr, uint8_t bdaddr_type)
+{
+	size_t i = scan_hash(bdaddr, bdaddr_type) & (size - 1);
+
+	/* Linear probing, the table is never allowed to become full */
+	while (devs[i].used) {
+		if (devs[i].bdaddr_type == bdaddr_type &&
+				!bacmp(&devs[i].bdaddr, bdaddr))
+			break;
+
+		i = (i + 1) & (size - 1);
+	}
+
+	return &devs[i];
+}
+
+static int scan_table_grow(struct scan_table *table)
+{
+	struct scan_dev *devs;
+	size_t size, i;
+
+	size = table->size ? table->size * 2 : SCAN_TABLE_MIN;
+
+	devs = calloc(size, sizeof(*devs));
+	if (!devs)
+		return -ENOMEM;
+
+	for (i = 0; i < table->size; i++) {
+		struct scan_dev *dev = &table->devs[i];
+
+		if (dev->used)
+			*scan_slot(devs, size, &dev->bdaddr,
+						dev->bdaddr_type) = *dev;
+	}
+
+	free(table->devs);
+	table->devs = devs;
+	table->size = size;
+
+	return 0;
+}
+
+static struct scan_dev *scan_table_get(struct scan_table *table,
+				const bdaddr_t *bdaddr, uint8_t bdaddr_type)
+{
+	struct scan_dev *dev;
+
+	/* Keep the load factor below 3/4 */
+	if ((table->used + 1) * 4 > table->size * 3 &&
+					scan_table_grow(table) < 0)
+		return NULL;
+
+	dev = scan_slot(table->devs, table->size, bdaddr, bdaddr_type);
+	if (!dev->used) {
+		dev->used = 1;
+		bacpy(&dev->bdaddr, bdaddr);
+		dev->bdaddr_type = bdaddr_type;
+		dev->rssi_min = 127;
+		dev->rssi_max = -128;
+		table->used++;
+	}
+
+	return dev;
+}
+
+static void scan_table_update(struct scan_table *table,
+				le_advertising_info *info, int8_t rssi)
+{
+	struct scan_dev *dev;
+
+	dev = scan_table_get(table, &info->bdaddr, info->bdaddr_type);
+	if (!dev)
+		return;
+
+	table->reports++;
+	table->period_reports++;
+
+	dev->count++;
+	dev->period_count++;
+
+	/* 127 means RSSI is not available */
+	if (rssi != 127) {
+		if (rssi < dev->rssi_min)
+			dev->rssi_min = rssi;
+		if (rssi > dev->rssi_max)
+			dev->rssi_max = rssi;
+		dev->rssi_sum += rssi;
+		dev->rssi_count++;
+	}
+
+	/* Names usually only show up in some of the reports */
+	if (!dev->has_name) {
+		memset(dev->name, 0, sizeof(dev->name));
+		eir_parse_name(info->data, info->length, dev->name,
+						sizeof(dev->name) - 1);
+		dev->has_name = strcmp(dev->name, "(unknown)") != 0;
+	}
+}
+
+static int scan_dev_cmp(const void *a, const void *b)
+{
+	const struct scan_dev *dev1 = *(const struct scan_dev **) a;
+	const struct scan_dev *dev2 = *(const struct scan_dev **) b;
+
+	if (dev1->count != dev2->count)
+		return dev1->count < dev2->count ? 1 : -1;
+
+	return bacmp(&dev1->bdaddr, &dev2->bdaddr);
+}
+
+static double timespec_diff(const struct timespec *a,
+						const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) + (a->tv_nsec - b->tv_nsec) / 1e9;
+}
+
+static void scan_table_print(struct scan_table *table, double elapsed,
+							double period)
+{
+	struct scan_dev **list;
+	size_t i, n = 0;
+
+	printf("\n%zu devices, %llu reports in %.1f sec (%.1f reports/sec)\n",
+				table->used, (unsigned long long) table->reports,
+				elapsed, period > 0 ?
+				table->period_reports / period : 0.0);
+
+	list = malloc(table->used * sizeof(*list));
+	if (!list)
+		goto done;
+
+	for (i = 0; i < table->size; i++) {
+		if (table->devs[i].used)
+			list[n++] = &table->devs[i];
+	}
+
+	qsort(list, n, sizeof(*list), scan_dev_cmp);
+
+	printf("%-17s %-6s %8s %7s %4s %4s %4s  %s\n", "Address", "Type",
+				"Reports", "Rate/s", "Min", "Avg", "Max", "Name");
+
+	for (i = 0; i < n; i++) {
+		struct scan_dev *dev = list[i];
+		char addr[18];
+
+		ba2str(&dev->bdaddr, addr);
+		printf("%-17s %-6s %8u %7.1f ", addr,
+				dev->bdaddr_type ? "random" : "public",
+				dev->count, period > 0 ?
+				dev->period_count / period : 0.0);
+
+		if (dev->rssi_count)
+			printf("%4d %4d %4d", dev->rssi_min,
+					(int) (dev->rssi_sum / dev->rssi_count),
+					dev->rssi_max);
+		else
+			printf("%4s %4s %4s", "-", "-", "-");
+
+		printf("  %s\n", dev->name);
+
+		dev->period_count = 0;
+	}
+
+	free(list);
+
+done:
+	table->period_reports = 0;
+	fflush(stdout);
+}
+
+static int scan_advertising_stats(int dd, uint8_t filter_type,
+							unsigned int interval)
+{
+	unsigned char buf[HCI_MAX_EVENT_SIZE];
+	struct scan_table table;
+	struct timespec start, last, now;
+	struct hci_filter nf, of;
+	struct sigaction sa;
+	socklen_t olen;
+	int err = 0;
+
+	olen = sizeof(of);
+	if (getsockopt(dd, SOL_HCI, HCI_FILTER, &of, &olen) < 0) {
+		printf("Could not get socket options\n");
+		return -1;
+	}
+
+	hci_filter_clear(&nf);
+	hci_filter_set_ptype(HCI_EVENT_PKT, &nf);
+	hci_filter_set_event(EVT_LE_META_EVENT, &nf);
+
+	if (setsockopt(dd, SOL_HCI, HCI_FILTER, &nf, sizeof(nf)) < 0) {
+		printf("Could not set socket options\n");
+		return -1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_flags = SA_NOCLDSTOP;
+	sa.sa_handler = sigint_handler;
+	sigaction(SIGINT, &sa, NULL);
+
+	memset(&table, 0, sizeof(table));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	last = start;
+
+	while (!signal_received) {
+		evt_le_meta_event *meta;
+		struct pollfd pfd;
+		uint8_t num_reports, *ptr, *end;
+		int len, timeout;
+		double since;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		since = timespec_diff(&now, &last);
+
+		if (since >= interval) {
+			scan_table_print(&table, timespec_diff(&now, &start),
+									since);
+			last = now;
+			since = 0;
+		}
+
+		timeout = (interval - since) * 1000 + 1;
+
+		pfd.fd = dd;
+		pfd.events = POLLIN;
+
+		if (poll(&pfd, 1, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			err = -1;
+			break;
+		}
+
+		if (!(pfd.revents & POLLIN))
+			continue;
+
+		len = read(dd, buf, sizeof(buf));
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			err = -1;
+			break;
+		}
+
+		if (len < 1 + HCI_EVENT_HDR_SIZE + 2)
+			continue;
+
+		meta = (void *) (buf + 1 + HCI_EVENT_HDR_SIZE);
+		if (meta->subevent != EVT_LE_ADVERTISING_REPORT)
+			continue;
+
+		/* Walk every report, the controller may batch them */
+		num_reports = meta->data[0];
+		ptr = meta->data + 1;
+		end = buf + len;
+
+		while (num_reports--) {
+			le_advertising_info *info = (void *) ptr;
+
+			if (ptr + LE_ADVERTISING_INFO_SIZE > end ||
+					ptr + LE_ADVERTISING_INFO_SIZE +
+					info->length + 1 > end)
+				break;
+
+			ptr += LE_ADVERTISING_INFO_SIZE + info->length;
+
+			if (check_report_filter(filter_type, info))
+				scan_table_update(&table, info, *ptr);
+
+			ptr++;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	scan_table_print(&table, timespec_diff(&now, &start),
+						timespec_diff(&now, &last));
+
+	free(table.devs);
+
+	setsockopt(dd, SOL_HCI, HCI_FILTER, &of, sizeof(of));
+
+	return err;
+}
+
 static struct option lescan_options[] = {
 	{ "help",	0, 0, 'h' },
 	{ "static",	0, 0, 's' },
@@ -2489,6 +2819,7 @@ static struct option lescan_options[] = {
 	{ "whitelist",	0, 0, 'w' },
 	{ "discovery",	1, 0, 'd' },
 	{ "duplicates",	0, 0, 'D' },
+	{ "stats",	2, 0, 'S' },
 	{ 0, 0, 0, 0 }
 };
 
@@ -2499,7 +2830,9 @@ static const char *lescan_help =
 	"\tlescan [--whitelist] scan for address in the whitelist only\n"
 	"\tlescan [--discovery=g|l] enable general or limited discovery"
 		"procedure\n"
-	"\tlescan [--duplicates] don't filter duplicates\n";
+	"\tlescan [--duplicates] don't filter duplicates\n"
+	"\tlescan [--stats[=seconds]] print per device statistics"
+		" periodically\n";
 
 static void cmd_lescan(int dev_id, int argc, char **argv)
 {
@@ -2511,6 +2844,7 @@ static void cmd_lescan(int dev_id, int argc, char **argv)
 	uint16_t interval = htobs(0x0010);
 	uint16_t window = htobs(0x0010);
 	uint8_t filter_dup = 0x01;
+	unsigned int stats = 0;
 
 	for_each_opt(opt, lescan_options, NULL) {
 		switch (opt) {
@@ -2539,6 +2873,16 @@ static void cmd_lescan(int dev_id, int argc, char **argv)
 		case 'D':
 			filter_dup = 0x00;
 			break;
+		case 'S':
+			stats = optarg ? atoi(optarg) : 5;
+			if (!stats) {
+				fprintf(stderr, "Invalid statistics interval\n");
+				exit(1);
+			}
+
+			/* Every report is needed for the RSSI statistics */
+			filter_dup = 0x00;
+			break;
 		default:
 			printf("%s", lescan_help);
 			return;
@@ -2570,7 +2914,10 @@ static void cmd_lescan(int dev_id, int argc, char **argv)
 
 	printf("LE Scan ...\n");
 
-	err = print_advertising_devices(dd, filter_type);
+	if (stats)
+		err = scan_advertising_stats(dd, filter_type, stats);
+	else
+		err = print_advertising_devices(dd, filter_type);
 	if (err < 0) {
 		perror("Could not receive advertising events");
 		exit(1);
@@ -29,6 +29,7 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <inttypes.h>
 #include <errno.h>
 #include <ctype.h>
 #include <fcntl.h>
@@ -37,8 +38,10 @@
 #include <getopt.h>
 #include <syslog.h>
 #include <signal.h>
+#include <time.h>
 #include <sys/time.h>
 #include <poll.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 
@@ -70,6 +73,7 @@ enum {
 	CSENDRECV,
 	INFOREQ,
 	PAIRING,
+	STRESS,
 };
 
 static unsigned char *buf;
@@ -102,6 +106,9 @@ static int num_frames = -1;
 /* Default number of consecutive frames before the delay */
 static int count = 1;
 
+/* Number of concurrent channels in stress mode */
+static int stress_channels = 0;
+
 /* Default delay after sending count number of frames */
 static unsigned long send_delay = 0;
 
@@ -301,14 +308,12 @@ static int setopts(int sk, struct l2cap_options *opts)
 							sizeof(opts->imtu));
 }
 
-static int do_connect(char *svr)
+static int create_socket(void)
 {
 	struct sockaddr_l2 addr;
 	struct l2cap_options opts;
-	struct l2cap_conninfo conn;
 	socklen_t optlen;
 	int sk, opt;
-	char ba[18];
 
 	/* Create socket */
 	sk = socket(PF_BLUETOOTH, socktype, BTPROTO_L2CAP);
@@ -421,17 +426,43 @@ static int do_connect(char *svr)
 		goto error;
 	}
 
-	/* Connect to remote device */
-	memset(&addr, 0, sizeof(addr));
-	addr.l2_family = AF_BLUETOOTH;
-	str2ba(svr, &addr.l2_bdaddr);
-	addr.l2_bdaddr_type = bdaddr_type;
+	return sk;
+
+error:
+	close(sk);
+	return -1;
+}
+
+static void set_remote_addr(struct sockaddr_l2 *addr, char *svr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->l2_family = AF_BLUETOOTH;
+	str2ba(svr, &addr->l2_bdaddr);
+	addr->l2_bdaddr_type = bdaddr_type;
 	if (cid)
-		addr.l2_cid = htobs(cid);
-	else if (psm)
-		addr.l2_psm = htobs(psm);
+		addr->l2_cid = htobs(cid);
 	else
-		goto error;
+		addr->l2_psm = htobs(psm);
+}
+
+static int do_connect(char *svr)
+{
+	struct sockaddr_l2 addr;
+	struct l2cap_options opts;
+	struct l2cap_conninfo conn;
+	socklen_t optlen;
+	int sk, opt;
+	char ba[18];
+
+	if (!cid && !psm)
+		return -1;
+
+	sk = create_socket();
+	if (sk < 0)
+		return -1;
+
+	/* Connect to remote device */
+	set_remote_addr(&addr, svr);
 
 	if (connect(sk, (struct sockaddr *) &addr, sizeof(addr)) < 0 ) {
 		syslog(LOG_ERR, "Can't connect: %s (%d)",
@@ -1103,6 +1134,417 @@ static void multi_connect_mode(int argc, char *argv[])
 	}
 }
 
+struct stress_chan {
+	int index;
+	int sk;
+	bool connected;
+	uint16_t omtu;
+	uint32_t seq;
+	long frames;
+	uint64_t connect_start;
+	uint64_t connect_time;
+	uint64_t first_tx;
+	uint64_t last_tx;
+	uint64_t tx_bytes;
+	uint64_t tx_packets;
+	uint64_t rx_bytes;
+	uint64_t rx_packets;
+	uint64_t stall_start;
+	uint64_t stall_time;
+	uint64_t stall_max;
+	unsigned int stalls;
+};
+
+static volatile sig_atomic_t stress_quit = 0;
+
+static uint64_t stress_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static double stress_rate(uint64_t bytes, uint64_t usec)
+{
+	if (!usec)
+		return 0;
+
+	return bytes * 1000000.0 / usec / 1024.0;
+}
+
+static void stress_signal(int sig)
+{
+	stress_quit = 1;
+}
+
+static void stress_close(int epfd, struct stress_chan *chan)
+{
+	uint64_t now = stress_now();
+
+	if (chan->sk < 0)
+		return;
+
+	if (chan->stall_start) {
+		uint64_t stall = now - chan->stall_start;
+
+		chan->stall_time += stall;
+		if (stall > chan->stall_max)
+			chan->stall_max = stall;
+		chan->stall_start = 0;
+	}
+
+	epoll_ctl(epfd, EPOLL_CTL_DEL, chan->sk, NULL);
+
+	if (chan->connected && shutdown(chan->sk, SHUT_RDWR) < 0)
+		syslog(LOG_INFO, "Channel %d close failed: %m", chan->index);
+
+	close(chan->sk);
+	chan->sk = -1;
+}
+
+static int stress_open(int epfd, struct stress_chan *chan, char *svr)
+{
+	struct sockaddr_l2 addr;
+	struct epoll_event ev;
+	int sk, flags;
+
+	sk = create_socket();
+	if (sk < 0)
+		return -1;
+
+	flags = fcntl(sk, F_GETFL, 0);
+	if (flags < 0 || fcntl(sk, F_SETFL, flags | O_NONBLOCK) < 0) {
+		syslog(LOG_ERR, "Can't set non-blocking mode: %s (%d)",
+							strerror(errno), errno);
+		close(sk);
+		return -1;
+	}
+
+	set_remote_addr(&addr, svr);
+
+	chan->connect_start = stress_now();
+
+	if (connect(sk, (struct sockaddr *) &addr, sizeof(addr)) < 0 &&
+							errno != EINPROGRESS) {
+		syslog(LOG_ERR, "Channel %d can't connect: %s (%d)",
+					chan->index, strerror(errno), errno);
+		close(sk);
+		return -1;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLOUT | EPOLLIN;
+	ev.data.ptr = chan;
+
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, sk, &ev) < 0) {
+		syslog(LOG_ERR, "Can't add channel to epoll: %s (%d)",
+							strerror(errno), errno);
+		close(sk);
+		return -1;
+	}
+
+	chan->sk = sk;
+
+	return 0;
+}
+
+static int stress_connected(struct stress_chan *chan)
+{
+	struct l2cap_options opts;
+	socklen_t optlen;
+	int err = 0;
+
+	optlen = sizeof(err);
+	if (getsockopt(chan->sk, SOL_SOCKET, SO_ERROR, &err, &optlen) < 0)
+		err = errno;
+
+	if (err) {
+		syslog(LOG_ERR, "Channel %d can't connect: %s (%d)",
+						chan->index, strerror(err), err);
+		return -1;
+	}
+
+	if (getopts(chan->sk, &opts, true) < 0) {
+		syslog(LOG_ERR, "Channel %d can't get L2CAP options: %s (%d)",
+					chan->index, strerror(errno), errno);
+		return -1;
+	}
+
+	chan->connected = true;
+	chan->connect_time = stress_now() - chan->connect_start;
+	chan->omtu = (opts.omtu > buffer_size) ? buffer_size : opts.omtu;
+	chan->seq = seq_start;
+	chan->frames = num_frames;
+
+	syslog(LOG_INFO, "Channel %d connected in %.3f ms (omtu %d)",
+				chan->index, chan->connect_time / 1000.0,
+				chan->omtu);
+
+	return 0;
+}
+
+static int stress_send(struct stress_chan *chan)
+{
+	uint64_t now = stress_now();
+	int size, len;
+
+	size = (data_size < 0 || data_size > chan->omtu) ?
+						chan->omtu : data_size;
+
+	/* The stall is over as soon as the channel accepts data again */
+	if (chan->stall_start) {
+		uint64_t stall = now - chan->stall_start;
+
+		chan->stall_time += stall;
+		if (stall > chan->stall_max)
+			chan->stall_max = stall;
+		chan->stall_start = 0;
+	}
+
+	while (chan->frames == -1 || chan->frames > 0) {
+		put_le32(chan->seq, buf);
+		put_le16(size, buf + 4);
+
+		len = send(chan->sk, buf, size, 0);
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				/* Out of credits or socket buffer space */
+				chan->stall_start = stress_now();
+				chan->stalls++;
+				return 0;
+			}
+
+			syslog(LOG_ERR, "Channel %d send failed: %s (%d)",
+					chan->index, strerror(errno), errno);
+			return -1;
+		}
+
+		if (!chan->tx_packets)
+			chan->first_tx = now;
+
+		chan->last_tx = stress_now();
+		chan->tx_bytes += len;
+		chan->tx_packets++;
+		chan->seq++;
+
+		if (chan->frames > 0)
+			chan->frames--;
+	}
+
+	return 1;
+}
+
+static int stress_recv(struct stress_chan *chan)
+{
+	int len;
+
+	while (1) {
+		len = recv(chan->sk, buf, buffer_size, 0);
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+
+			syslog(LOG_ERR, "Channel %d read failed: %s (%d)",
+					chan->index, strerror(errno), errno);
+			return -1;
+		}
+
+		/* Orderly shutdown from the remote side */
+		if (!len)
+			return -1;
+
+		chan->rx_bytes += len;
+		chan->rx_packets++;
+	}
+}
+
+static void stress_report(struct stress_chan *chans, int num,
+							uint64_t duration)
+{
+	uint64_t tx_bytes = 0, rx_bytes = 0, tx_packets = 0, rx_packets = 0;
+	uint64_t connect_total = 0, connect_max = 0, stall_time = 0;
+	uint64_t stall_max = 0;
+	unsigned int stalls = 0;
+	int i, connected = 0;
+
+	for (i = 0; i < num; i++) {
+		struct stress_chan *chan = &chans[i];
+
+		syslog(LOG_INFO, "Channel %d: %s, connect %.3f ms, "
+			"tx %" PRIu64 " bytes %" PRIu64 " packets %.2f kB/s, "
+			"rx %" PRIu64 " bytes %.2f kB/s, "
+			"%u stalls %.3f ms (max %.3f ms)", chan->index,
+			chan->connected ? "connected" : "failed",
+			chan->connect_time / 1000.0,
+			chan->tx_bytes, chan->tx_packets,
+			stress_rate(chan->tx_bytes,
+					chan->last_tx - chan->first_tx),
+			chan->rx_bytes, stress_rate(chan->rx_bytes, duration),
+			chan->stalls, chan->stall_time / 1000.0,
+			chan->stall_max / 1000.0);
+
+		if (!chan->connected)
+			continue;
+
+		connected++;
+		connect_total += chan->connect_time;
+		if (chan->connect_time > connect_max)
+			connect_max = chan->connect_time;
+
+		tx_bytes += chan->tx_bytes;
+		tx_packets += chan->tx_packets;
+		rx_bytes += chan->rx_bytes;
+		rx_packets += chan->rx_packets;
+		stalls += chan->stalls;
+		stall_time += chan->stall_time;
+		if (chan->stall_max > stall_max)
+			stall_max = chan->stall_max;
+	}
+
+	syslog(LOG_INFO, "Total: %d/%d channels in %.2f sec, "
+		"connect avg %.3f ms max %.3f ms", connected, num,
+		duration / 1000000.0,
+		connected ? connect_total / 1000.0 / connected : 0,
+		connect_max / 1000.0);
+
+	syslog(LOG_INFO, "Total: tx %" PRIu64 " bytes %" PRIu64 " packets "
+		"%.2f kB/s, rx %" PRIu64 " bytes %" PRIu64 " packets "
+		"%.2f kB/s", tx_bytes, tx_packets,
+		stress_rate(tx_bytes, duration), rx_bytes, rx_packets,
+		stress_rate(rx_bytes, duration));
+
+	syslog(LOG_INFO, "Total: %u stalls %.3f ms (avg %.3f ms max %.3f ms)",
+		stalls, stall_time / 1000.0,
+		stalls ? stall_time / 1000.0 / stalls : 0,
+		stall_max / 1000.0);
+}
+
+static void stress_mode(int argc, char *argv[])
+{
+	struct epoll_event events[64];
+	struct stress_chan *chans;
+	struct sigaction sa;
+	uint64_t start, last_report, last_tx = 0, last_rx = 0;
+	int epfd, i, n, active = 0;
+
+	chans = calloc(stress_channels, sizeof(*chans));
+	if (!chans) {
+		perror("Can't allocate channels");
+		exit(1);
+	}
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		syslog(LOG_ERR, "Can't create epoll: %s (%d)",
+							strerror(errno), errno);
+		exit(1);
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stress_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	for (i = 6; i < buffer_size; i++)
+		buf[i] = 0x7f;
+
+	syslog(LOG_INFO, "Opening %d channels ...", stress_channels);
+
+	start = stress_now();
+	last_report = start;
+
+	/* Spread the channels over the given remote devices */
+	for (i = 0; i < stress_channels; i++) {
+		chans[i].index = i;
+		chans[i].sk = -1;
+
+		if (stress_open(epfd, &chans[i], argv[i % argc]) == 0)
+			active++;
+	}
+
+	while (active && !stress_quit) {
+		uint64_t now, tx = 0, rx = 0;
+
+		n = epoll_wait(epfd, events, 64, 1000);
+		if (n < 0 && errno != EINTR) {
+			syslog(LOG_ERR, "Poll failed: %s (%d)",
+							strerror(errno), errno);
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			struct stress_chan *chan = events[i].data.ptr;
+			uint32_t mask = events[i].events;
+			int err = 0;
+
+			if (!chan->connected) {
+				if (stress_connected(chan) < 0) {
+					stress_close(epfd, chan);
+					active--;
+					continue;
+				}
+
+				mask |= EPOLLOUT;
+			}
+
+			if (mask & EPOLLIN)
+				err = stress_recv(chan);
+
+			if (!err && (mask & EPOLLOUT)) {
+				err = stress_send(chan);
+
+				/* All frames sent, stop waiting for EPOLLOUT */
+				if (err > 0) {
+					struct epoll_event ev;
+
+					memset(&ev, 0, sizeof(ev));
+					ev.events = EPOLLIN;
+					ev.data.ptr = chan;
+					epoll_ctl(epfd, EPOLL_CTL_MOD, chan->sk,
+									&ev);
+					err = num_frames < 0 ? 0 : -1;
+				}
+			}
+
+			if (!err && (mask & (EPOLLERR | EPOLLHUP)))
+				err = -1;
+
+			if (err < 0) {
+				stress_close(epfd, chan);
+				active--;
+			}
+		}
+
+		now = stress_now();
+		if (now - last_report < 1000000)
+			continue;
+
+		for (i = 0; i < stress_channels; i++) {
+			tx += chans[i].tx_bytes;
+			rx += chans[i].rx_bytes;
+		}
+
+		syslog(LOG_INFO, "%d channels, tx %.2f kB/s, rx %.2f kB/s",
+				active, stress_rate(tx - last_tx,
+						now - last_report),
+				stress_rate(rx - last_rx, now - last_report));
+
+		last_tx = tx;
+		last_rx = rx;
+		last_report = now;
+	}
+
+	for (i = 0; i < stress_channels; i++)
+		stress_close(epfd, &chans[i]);
+
+	stress_report(chans, stress_channels, stress_now() - start);
+
+	close(epfd);
+	free(chans);
+}
+
 static void info_request(char *svr)
 {
 	unsigned char buf[48];
@@ -1313,6 +1755,7 @@ static void usage(void)
 		"\t-y connect, then send, then dump incoming data\n"
 		"\t-c connect, disconnect, connect, ...\n"
 		"\t-m multiple connects\n"
+		"\t-k num open num channels and send on all of them\n"
 		"\t-p trigger dedicated bonding\n"
 		"\t-z information request\n");
 
@@ -1353,7 +1796,7 @@ int main(int argc, char *argv[])
 
 	bacpy(&bdaddr, BDADDR_ANY);
 
-	while ((opt = getopt(argc, argv, "a:b:cde:g:i:mnpqrstuwxyz"
+	while ((opt = getopt(argc, argv, "a:b:cde:g:i:k:mnpqrstuwxyz"
 		"AB:C:D:EF:GH:I:J:K:L:MN:O:P:Q:RSTUV:W:X:Y:Z:")) != EOF) {
 		switch (opt) {
 		case 'r':
@@ -1393,6 +1836,16 @@ int main(int argc, char *argv[])
 			need_addr = 1;
 			break;
 
+		case 'k':
+			mode = STRESS;
+			need_addr = 1;
+			stress_channels = atoi(optarg);
+			if (stress_channels <= 0) {
+				usage();
+				exit(1);
+			}
+			break;
+
 		case 't':
 			mode = LSENDRECV;
 			break;
@@ -1642,6 +2095,10 @@ int main(int argc, char *argv[])
 			connect_mode(argv[optind]);
 			break;
 
+		case STRESS:
+			stress_mode(argc - optind, argv + optind);
+			break;
+
 		case SENDDUMP:
 			sk = do_connect(argv[optind]);
 			if (sk < 0)
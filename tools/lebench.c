@@ -0,0 +1,729 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2014  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "lib/bluetooth.h"
+#include "lib/l2cap.h"
+#include "lib/uuid.h"
+
+#include "monitor/bt.h"
+#include "src/shared/mainloop.h"
+#include "src/shared/timeout.h"
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/hci.h"
+#include "src/shared/att.h"
+#include "src/shared/gatt-db.h"
+#include "src/shared/gatt-helpers.h"
+#include "src/shared/gatt-client.h"
+
+#define ATT_CID 4
+
+enum stage {
+	STAGE_SCAN,
+	STAGE_CONNECT,
+	STAGE_MTU,
+	STAGE_DISCOVER,
+	STAGE_DISCONNECT,
+	STAGE_MAX,
+};
+
+static const char *stage_names[STAGE_MAX] = {
+	"scan", "connect", "mtu", "discover", "disconnect",
+};
+
+static struct bt_hci *hci_dev;
+
+static bdaddr_t src_addr;
+static bdaddr_t dst_addr;
+static uint8_t dst_type = BDADDR_LE_PUBLIC;
+static unsigned int iterations = 10;
+static unsigned int iter_delay = 100;
+static unsigned int stage_timeout = 10000;
+static uint16_t mtu = 185;
+static bool use_cache = false;
+static bool verbose = false;
+
+static struct {
+	enum stage stage;
+	unsigned int iteration;
+	uint64_t stage_start;
+	uint64_t iter_start;
+	unsigned int timer;
+	int fd;
+	uint16_t handle;
+	struct bt_att *att;
+	struct bt_gatt_client *client;
+	struct gatt_db *db;
+} run;
+
+static uint32_t *latency[STAGE_MAX + 1];
+static unsigned int completed[STAGE_MAX + 1];
+static unsigned int failed[STAGE_MAX];
+
+static void start_iteration(void);
+
+static uint64_t get_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static bool stage_timeout_cb(void *user_data);
+
+static void enter_stage(enum stage stage)
+{
+	run.stage = stage;
+	run.stage_start = get_usec();
+
+	if (run.timer)
+		timeout_remove(run.timer);
+
+	run.timer = timeout_add(stage_timeout, stage_timeout_cb, NULL, NULL);
+}
+
+static void stage_done(void)
+{
+	uint64_t now = get_usec();
+
+	latency[run.stage][completed[run.stage]++] = now - run.stage_start;
+
+	if (verbose)
+		printf("  %-10s %8.3f ms\n", stage_names[run.stage],
+					(now - run.stage_start) / 1000.0);
+
+	if (run.stage == STAGE_DISCOVER)
+		latency[STAGE_MAX][completed[STAGE_MAX]++] =
+							now - run.iter_start;
+}
+
+static int latency_cmp(const void *a, const void *b)
+{
+	uint32_t la = *(const uint32_t *) a, lb = *(const uint32_t *) b;
+
+	return la < lb ? -1 : la > lb;
+}
+
+static void print_stage(const char *name, uint32_t *values, unsigned int num,
+							unsigned int fails)
+{
+	uint64_t sum = 0;
+	unsigned int i;
+
+	printf("%-12s %5u %6u", name, num, fails);
+
+	if (!num) {
+		printf("\n");
+		return;
+	}
+
+	qsort(values, num, sizeof(*values), latency_cmp);
+
+	for (i = 0; i < num; i++)
+		sum += values[i];
+
+	printf(" %9.3f %9.3f %9.3f %9.3f %9.3f\n", values[0] / 1000.0,
+					sum / num / 1000.0,
+					values[num / 2] / 1000.0,
+					values[num * 90 / 100] / 1000.0,
+					values[num - 1] / 1000.0);
+}
+
+static void print_report(void)
+{
+	unsigned int i;
+
+	printf("\n%-12s %5s %6s %9s %9s %9s %9s %9s\n", "Stage", "Done",
+				"Failed", "Min", "Avg", "P50", "P90", "Max");
+
+	for (i = 0; i < STAGE_MAX; i++)
+		print_stage(stage_names[i], latency[i], completed[i],
+								failed[i]);
+
+	print_stage("ready", latency[STAGE_MAX], completed[STAGE_MAX], 0);
+
+	printf("Latencies in ms, ready is scan start to GATT ready\n");
+}
+
+static void set_scan(bool enable)
+{
+	struct bt_hci_cmd_le_set_scan_enable cmd;
+
+	cmd.enable = enable ? 0x01 : 0x00;
+	cmd.filter_dup = 0x00;
+
+	bt_hci_send(hci_dev, BT_HCI_CMD_LE_SET_SCAN_ENABLE, &cmd, sizeof(cmd),
+							NULL, NULL, NULL);
+}
+
+static void release_link(void)
+{
+	if (run.client) {
+		bt_gatt_client_unref(run.client);
+		run.client = NULL;
+	}
+
+	if (run.att) {
+		bt_att_unref(run.att);
+		run.att = NULL;
+		run.fd = -1;
+	}
+
+	if (run.fd >= 0) {
+		mainloop_remove_fd(run.fd);
+		close(run.fd);
+		run.fd = -1;
+	}
+
+	if (!use_cache && run.db) {
+		gatt_db_unref(run.db);
+		run.db = NULL;
+	}
+}
+
+static bool next_iteration(void *user_data)
+{
+	start_iteration();
+
+	return false;
+}
+
+static void finish_iteration(void)
+{
+	if (run.timer) {
+		timeout_remove(run.timer);
+		run.timer = 0;
+	}
+
+	run.handle = 0;
+
+	if (++run.iteration == iterations) {
+		print_report();
+		mainloop_quit();
+		return;
+	}
+
+	timeout_add(iter_delay, next_iteration, NULL, NULL);
+}
+
+static void start_disconnect(void)
+{
+	enter_stage(STAGE_DISCONNECT);
+
+	/* Closing the ATT socket lets the kernel drop the link */
+	release_link();
+
+	/* Without a link there is no disconnect event to wait for */
+	if (!run.handle)
+		finish_iteration();
+}
+
+static bool stage_timeout_cb(void *user_data)
+{
+	run.timer = 0;
+
+	printf("Iteration %u: %s timed out\n", run.iteration + 1,
+						stage_names[run.stage]);
+
+	failed[run.stage]++;
+
+	switch (run.stage) {
+	case STAGE_SCAN:
+		set_scan(false);
+		finish_iteration();
+		break;
+	case STAGE_CONNECT:
+	case STAGE_MTU:
+	case STAGE_DISCOVER:
+		start_disconnect();
+		break;
+	case STAGE_DISCONNECT:
+	case STAGE_MAX:
+		finish_iteration();
+		break;
+	}
+
+	return false;
+}
+
+static void ready_cb(bool success, uint8_t att_ecode, void *user_data)
+{
+	if (run.stage != STAGE_DISCOVER)
+		return;
+
+	if (!success) {
+		printf("Iteration %u: discovery failed (0x%02x)\n",
+						run.iteration + 1, att_ecode);
+		failed[STAGE_DISCOVER]++;
+	} else
+		stage_done();
+
+	start_disconnect();
+}
+
+static void start_discovery(void)
+{
+	enter_stage(STAGE_DISCOVER);
+
+	if (!run.db)
+		run.db = gatt_db_new();
+
+	/* MTU was exchanged already, keep the client from doing it again */
+	run.client = bt_gatt_client_new_cached(run.db, run.att,
+					BT_ATT_DEFAULT_LE_MTU, use_cache);
+	if (!run.client) {
+		failed[STAGE_DISCOVER]++;
+		start_disconnect();
+		return;
+	}
+
+	bt_gatt_client_ready_register(run.client, ready_cb, NULL, NULL);
+}
+
+static void mtu_cb(bool success, uint8_t att_ecode, void *user_data)
+{
+	if (run.stage != STAGE_MTU)
+		return;
+
+	if (!success) {
+		printf("Iteration %u: MTU exchange failed (0x%02x)\n",
+						run.iteration + 1, att_ecode);
+		failed[STAGE_MTU]++;
+		start_disconnect();
+		return;
+	}
+
+	stage_done();
+	start_discovery();
+}
+
+static void att_disconnect_cb(int err, void *user_data)
+{
+	if (run.stage == STAGE_MTU || run.stage == STAGE_DISCOVER) {
+		printf("Iteration %u: link lost during %s (%s)\n",
+					run.iteration + 1,
+					stage_names[run.stage], strerror(err));
+		failed[run.stage]++;
+		start_disconnect();
+	}
+}
+
+static void connect_cb(int fd, uint32_t events, void *user_data)
+{
+	socklen_t len;
+	int err = 0;
+
+	len = sizeof(err);
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+		err = errno;
+
+	mainloop_remove_fd(fd);
+
+	if (err) {
+		printf("Iteration %u: connect failed (%s)\n",
+					run.iteration + 1, strerror(err));
+		failed[STAGE_CONNECT]++;
+		start_disconnect();
+		return;
+	}
+
+	stage_done();
+
+	run.att = bt_att_new(fd, false);
+	if (!run.att) {
+		failed[STAGE_MTU]++;
+		start_disconnect();
+		return;
+	}
+
+	bt_att_set_close_on_unref(run.att, true);
+	bt_att_register_disconnect(run.att, att_disconnect_cb, NULL, NULL);
+
+	enter_stage(STAGE_MTU);
+
+	if (mtu <= BT_ATT_DEFAULT_LE_MTU) {
+		stage_done();
+		start_discovery();
+		return;
+	}
+
+	if (!bt_gatt_exchange_mtu(run.att, mtu, mtu_cb, NULL, NULL)) {
+		failed[STAGE_MTU]++;
+		start_disconnect();
+	}
+}
+
+static void start_connect(void)
+{
+	struct sockaddr_l2 addr;
+	int fd;
+
+	enter_stage(STAGE_CONNECT);
+
+	fd = socket(PF_BLUETOOTH, SOCK_SEQPACKET | SOCK_NONBLOCK,
+							BTPROTO_L2CAP);
+	if (fd < 0) {
+		perror("Failed to create L2CAP socket");
+		goto failed;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.l2_family = AF_BLUETOOTH;
+	addr.l2_cid = htobs(ATT_CID);
+	addr.l2_bdaddr_type = BDADDR_LE_PUBLIC;
+	bacpy(&addr.l2_bdaddr, &src_addr);
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		perror("Failed to bind L2CAP socket");
+		close(fd);
+		goto failed;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.l2_family = AF_BLUETOOTH;
+	addr.l2_cid = htobs(ATT_CID);
+	addr.l2_bdaddr_type = dst_type;
+	bacpy(&addr.l2_bdaddr, &dst_addr);
+
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 &&
+							errno != EINPROGRESS) {
+		perror("Failed to connect");
+		close(fd);
+		goto failed;
+	}
+
+	run.fd = fd;
+	mainloop_add_fd(fd, EPOLLOUT, connect_cb, NULL, NULL);
+
+	return;
+
+failed:
+	failed[STAGE_CONNECT]++;
+	finish_iteration();
+}
+
+static void adv_report_cb(const void *data, uint8_t size, void *user_data)
+{
+	const uint8_t *ptr = data;
+	uint8_t num_reports;
+
+	if (run.stage != STAGE_SCAN || size < 2)
+		return;
+
+	num_reports = ptr[1];
+	ptr += 2;
+	size -= 2;
+
+	/* event_type, addr_type, addr, data_len, data and rssi per report */
+	while (num_reports--) {
+		size_t len;
+
+		if (size < 9)
+			return;
+
+		len = 9 + ptr[8] + 1;
+		if (size < len)
+			return;
+
+		if (!memcmp(ptr + 2, &dst_addr, 6) &&
+				ptr[1] == (dst_type == BDADDR_LE_RANDOM)) {
+			stage_done();
+			set_scan(false);
+			start_connect();
+			return;
+		}
+
+		ptr += len;
+		size -= len;
+	}
+}
+
+static void conn_complete_cb(const void *data, uint8_t size,
+							void *user_data)
+{
+	const struct bt_hci_evt_le_conn_complete *evt = data;
+
+	if (run.stage != STAGE_CONNECT || size < sizeof(*evt) || evt->status)
+		return;
+
+	/* Remember the handle so the disconnect can be timed */
+	if (!memcmp(evt->peer_addr, &dst_addr, 6))
+		run.handle = le16_to_cpu(evt->handle);
+}
+
+static void le_meta_cb(const void *data, uint8_t size, void *user_data)
+{
+	const uint8_t *subevent = data;
+
+	if (size < 1)
+		return;
+
+	switch (subevent[0]) {
+	case BT_HCI_EVT_LE_ADV_REPORT:
+		adv_report_cb(data, size, user_data);
+		break;
+	case BT_HCI_EVT_LE_CONN_COMPLETE:
+		conn_complete_cb(data + 1, size - 1, user_data);
+		break;
+	}
+}
+
+static void disconn_cb(const void *data, uint8_t size, void *user_data)
+{
+	const struct bt_hci_evt_disconnect_complete *evt = data;
+
+	if (size < sizeof(*evt) || evt->status || !run.handle ||
+				le16_to_cpu(evt->handle) != run.handle)
+		return;
+
+	run.handle = 0;
+
+	if (run.stage == STAGE_DISCONNECT) {
+		stage_done();
+		finish_iteration();
+		return;
+	}
+
+	/* Link dropped underneath us, the ATT disconnect handles cleanup */
+}
+
+static void start_iteration(void)
+{
+	struct bt_hci_cmd_le_set_scan_parameters cmd;
+
+	if (verbose)
+		printf("Iteration %u\n", run.iteration + 1);
+
+	run.iter_start = get_usec();
+
+	/* Stop any scan in progress so the parameters can be changed */
+	set_scan(false);
+
+	cmd.type = 0x00;
+	cmd.interval = cpu_to_le16(0x0010);
+	cmd.window = cpu_to_le16(0x0010);
+	cmd.own_addr_type = 0x00;
+	cmd.filter_policy = 0x00;
+
+	bt_hci_send(hci_dev, BT_HCI_CMD_LE_SET_SCAN_PARAMETERS, &cmd,
+					sizeof(cmd), NULL, NULL, NULL);
+
+	enter_stage(STAGE_SCAN);
+	set_scan(true);
+}
+
+static void bdaddr_cb(const void *data, uint8_t size, void *user_data)
+{
+	const struct bt_hci_rsp_read_bd_addr *rsp = data;
+
+	if (size < sizeof(*rsp) || rsp->status) {
+		fprintf(stderr, "Failed to read controller address\n");
+		mainloop_exit_failure();
+		return;
+	}
+
+	memcpy(&src_addr, rsp->bdaddr, 6);
+
+	start_iteration();
+}
+
+static void signal_callback(int signum, void *user_data)
+{
+	switch (signum) {
+	case SIGINT:
+	case SIGTERM:
+		print_report();
+		mainloop_quit();
+		break;
+	}
+}
+
+static void usage(void)
+{
+	printf("lebench - LE scan to GATT ready latency benchmark\n"
+		"Usage:\n");
+	printf("\tlebench [options] -d <address>\n");
+	printf("options:\n"
+		"\t-i, --index <num>      Use specified controller\n"
+		"\t-d, --dest <addr>      Remote device address\n"
+		"\t-t, --type <type>      Remote address type (public, random)\n"
+		"\t-n, --count <num>      Number of iterations (default 10)\n"
+		"\t-m, --mtu <mtu>        ATT MTU to request (default 185)\n"
+		"\t-w, --wait <ms>        Delay between iterations\n"
+		"\t-T, --timeout <ms>     Timeout per stage (default 10000)\n"
+		"\t-c, --cache            Keep the GATT cache across runs\n"
+		"\t-v, --verbose          Print every stage\n"
+		"\t-h, --help             Show help options\n");
+}
+
+static const struct option main_options[] = {
+	{ "index",   required_argument, NULL, 'i' },
+	{ "dest",    required_argument, NULL, 'd' },
+	{ "type",    required_argument, NULL, 't' },
+	{ "count",   required_argument, NULL, 'n' },
+	{ "mtu",     required_argument, NULL, 'm' },
+	{ "wait",    required_argument, NULL, 'w' },
+	{ "timeout", required_argument, NULL, 'T' },
+	{ "cache",   no_argument,       NULL, 'c' },
+	{ "verbose", no_argument,       NULL, 'v' },
+	{ "help",    no_argument,       NULL, 'h' },
+	{ }
+};
+
+int main(int argc, char *argv[])
+{
+	uint16_t index = 0;
+	bool have_dest = false;
+	sigset_t mask;
+	int exit_status;
+	unsigned int i;
+
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "i:d:t:n:m:w:T:cvh",
+						main_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'i':
+			if (strlen(optarg) > 3 && !strncmp(optarg, "hci", 3))
+				index = atoi(optarg + 3);
+			else
+				index = atoi(optarg);
+			break;
+		case 'd':
+			if (str2ba(optarg, &dst_addr) < 0) {
+				fprintf(stderr, "Invalid address: %s\n",
+								optarg);
+				return EXIT_FAILURE;
+			}
+			have_dest = true;
+			break;
+		case 't':
+			if (!strcmp(optarg, "random"))
+				dst_type = BDADDR_LE_RANDOM;
+			else if (!strcmp(optarg, "public"))
+				dst_type = BDADDR_LE_PUBLIC;
+			else {
+				fprintf(stderr, "Invalid address type\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'm':
+			mtu = atoi(optarg);
+			break;
+		case 'w':
+			iter_delay = atoi(optarg);
+			break;
+		case 'T':
+			stage_timeout = atoi(optarg);
+			break;
+		case 'c':
+			use_cache = true;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!have_dest || !iterations || !stage_timeout) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i <= STAGE_MAX; i++)
+		latency[i] = new0(uint32_t, iterations);
+
+	mainloop_init();
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+
+	mainloop_set_signal(&mask, signal_callback, NULL, NULL);
+
+	/*
+	 * The raw device leaves the kernel in charge of the controller,
+	 * so the connection itself goes through a regular ATT socket.
+	 */
+	hci_dev = bt_hci_new_raw_device(index);
+	if (!hci_dev) {
+		fprintf(stderr, "Failed to open HCI raw device\n");
+		return EXIT_FAILURE;
+	}
+
+	run.fd = -1;
+
+	bt_hci_register(hci_dev, BT_HCI_EVT_LE_META_EVENT, le_meta_cb,
+								NULL, NULL);
+	bt_hci_register(hci_dev, BT_HCI_EVT_DISCONNECT_COMPLETE, disconn_cb,
+								NULL, NULL);
+
+	bt_hci_send(hci_dev, BT_HCI_CMD_READ_BD_ADDR, NULL, 0,
+						bdaddr_cb, NULL, NULL);
+
+	exit_status = mainloop_run();
+
+	release_link();
+
+	if (run.db)
+		gatt_db_unref(run.db);
+
+	bt_hci_unref(hci_dev);
+
+	for (i = 0; i <= STAGE_MAX; i++)
+		free(latency[i]);
+
+	return exit_status;
+}
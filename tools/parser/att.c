@@ -634,3 +634,35 @@ void att_dump(int level, struct frame *frm)
 			break;
 	}
 }
+
+void att_decode(struct decode_rec *rec, struct frame *frm)
+{
+	uint8_t *ptr = frm->ptr;
+	uint8_t op = ptr[0];
+
+	decode_push(rec, "att");
+	decode_hex(rec, "opcode", op);
+	decode_str(rec, "name", attop2str(op));
+
+	switch (op) {
+	case ATT_OP_ERROR:
+		if (frm->len < 5)
+			break;
+		decode_hex(rec, "request", ptr[1]);
+		decode_hex(rec, "handle", get_le16(ptr + 2));
+		decode_hex(rec, "error", ptr[4]);
+		decode_str(rec, "error_name", atterror2str(ptr[4]));
+		break;
+	case ATT_OP_READ_REQ:
+	case ATT_OP_WRITE_REQ:
+	case ATT_OP_WRITE_CMD:
+	case ATT_OP_HANDLE_NOTIFY:
+	case ATT_OP_HANDLE_IND:
+		if (frm->len < 3)
+			break;
+		decode_hex(rec, "handle", get_le16(ptr + 1));
+		break;
+	}
+
+	decode_pop(rec);
+}
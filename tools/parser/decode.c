@@ -0,0 +1,405 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2003-2011  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+
+#include "parser.h"
+
+#define MATCH_MAX	8
+
+static struct {
+	char path[DECODE_MAX_DEPTH][32];
+	unsigned int depth;
+	char value[64];
+	bool has_value;
+} match_table[MATCH_MAX];
+
+static unsigned int match_count;
+
+/* Only one record is ever decoded at a time, so reuse it */
+static struct decode_rec decode_record;
+
+static struct decode_node *decode_add(struct decode_rec *rec,
+					const char *name, uint8_t type)
+{
+	struct decode_node *node;
+
+	if (rec->num_nodes >= DECODE_MAX_NODES)
+		return NULL;
+
+	node = &rec->nodes[rec->num_nodes++];
+	node->name = name;
+	node->level = rec->level;
+	node->type = type;
+	node->num = 0;
+	node->str = NULL;
+
+	return node;
+}
+
+static const char *decode_strdup(struct decode_rec *rec, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *ptr;
+
+	if (rec->str_len + len > sizeof(rec->str_buf))
+		return "";
+
+	ptr = rec->str_buf + rec->str_len;
+	memcpy(ptr, str, len);
+	rec->str_len += len;
+
+	return ptr;
+}
+
+void decode_push(struct decode_rec *rec, const char *name)
+{
+	if (rec->level >= DECODE_MAX_DEPTH - 1)
+		return;
+
+	if (decode_add(rec, name, DECODE_OBJECT))
+		rec->level++;
+}
+
+void decode_pop(struct decode_rec *rec)
+{
+	if (rec->level > 0)
+		rec->level--;
+}
+
+void decode_uint(struct decode_rec *rec, const char *name, uint64_t val)
+{
+	struct decode_node *node = decode_add(rec, name, DECODE_UINT);
+
+	if (node)
+		node->num = val;
+}
+
+void decode_hex(struct decode_rec *rec, const char *name, uint64_t val)
+{
+	struct decode_node *node = decode_add(rec, name, DECODE_HEX);
+
+	if (node)
+		node->num = val;
+}
+
+void decode_str(struct decode_rec *rec, const char *name, const char *str)
+{
+	struct decode_node *node = decode_add(rec, name, DECODE_STR);
+
+	if (node)
+		node->str = str;
+}
+
+void decode_strf(struct decode_rec *rec, const char *name,
+						const char *format, ...)
+{
+	char buf[128];
+	va_list ap;
+
+	va_start(ap, format);
+	vsnprintf(buf, sizeof(buf), format, ap);
+	va_end(ap);
+
+	decode_str(rec, name, decode_strdup(rec, buf));
+}
+
+void decode_bdaddr(struct decode_rec *rec, const char *name,
+						const bdaddr_t *bdaddr)
+{
+	char addr[18];
+
+	p_ba2str(bdaddr, addr);
+	decode_str(rec, name, decode_strdup(rec, addr));
+}
+
+struct decode_rec *decode_frame(struct frame *frm)
+{
+	struct decode_rec *rec = &decode_record;
+	struct frame copy = *frm;
+
+	rec->num_nodes = 0;
+	rec->level = 0;
+	rec->str_len = 0;
+
+	decode_strf(rec, "ts", "%lu.%06lu", (unsigned long) frm->ts.tv_sec,
+					(unsigned long) frm->ts.tv_usec);
+	decode_str(rec, "dir", frm->in ? "in" : "out");
+	decode_uint(rec, "dev", frm->dev_id);
+
+	/* Decoders work on a copy so the frame stays usable for printing */
+	if (copy.len > 0)
+		hci_decode(rec, &copy);
+
+	return rec;
+}
+
+const struct decode_node *decode_find(const struct decode_rec *rec,
+							const char *path)
+{
+	const char *stack[DECODE_MAX_DEPTH];
+	unsigned int i;
+
+	for (i = 0; i < rec->num_nodes; i++) {
+		const struct decode_node *node = &rec->nodes[i];
+		const char *ptr = path;
+		unsigned int n;
+
+		stack[node->level] = node->name;
+
+		for (n = 0; n <= node->level; n++) {
+			size_t len = strlen(stack[n]);
+
+			if (strncmp(ptr, stack[n], len))
+				break;
+
+			ptr += len;
+
+			if (n < node->level) {
+				if (*ptr != '.')
+					break;
+				ptr++;
+			}
+		}
+
+		if (n > node->level && *ptr == '\0')
+			return node;
+	}
+
+	return NULL;
+}
+
+int decode_add_match(const char *expr)
+{
+	const char *eq = strchr(expr, '=');
+	const char *ptr, *end;
+	unsigned int depth = 0;
+
+	if (match_count >= MATCH_MAX)
+		return -ENOSPC;
+
+	end = eq ? eq : expr + strlen(expr);
+
+	for (ptr = expr; ptr < end; ) {
+		const char *dot = memchr(ptr, '.', end - ptr);
+		size_t len = (dot ? dot : end) - ptr;
+
+		if (!len || len >= sizeof(match_table[0].path[0]) ||
+						depth >= DECODE_MAX_DEPTH)
+			return -EINVAL;
+
+		memcpy(match_table[match_count].path[depth], ptr, len);
+		match_table[match_count].path[depth][len] = '\0';
+		depth++;
+
+		ptr += len + (dot ? 1 : 0);
+	}
+
+	if (!depth)
+		return -EINVAL;
+
+	match_table[match_count].depth = depth;
+	match_table[match_count].has_value = eq != NULL;
+
+	if (eq) {
+		if (strlen(eq + 1) >= sizeof(match_table[0].value))
+			return -EINVAL;
+		strcpy(match_table[match_count].value, eq + 1);
+	}
+
+	match_count++;
+
+	return 0;
+}
+
+bool decode_has_match(void)
+{
+	return match_count > 0;
+}
+
+static bool node_match(const struct decode_node *node, const char *value)
+{
+	unsigned long long num;
+	char *end;
+
+	switch (node->type) {
+	case DECODE_UINT:
+	case DECODE_HEX:
+		num = strtoull(value, &end, 0);
+		return *end == '\0' && num == node->num;
+	case DECODE_STR:
+		return !strcasecmp(node->str, value);
+	}
+
+	return false;
+}
+
+bool decode_match(const struct decode_rec *rec)
+{
+	const char *stack[DECODE_MAX_DEPTH];
+	bool found[MATCH_MAX];
+	unsigned int i, m;
+
+	memset(found, 0, sizeof(found));
+
+	for (i = 0; i < rec->num_nodes; i++) {
+		const struct decode_node *node = &rec->nodes[i];
+
+		stack[node->level] = node->name;
+
+		for (m = 0; m < match_count; m++) {
+			unsigned int n;
+
+			if (found[m] || match_table[m].depth != node->level + 1u)
+				continue;
+
+			for (n = 0; n <= node->level; n++) {
+				if (strcmp(stack[n], match_table[m].path[n]))
+					break;
+			}
+
+			if (n <= node->level)
+				continue;
+
+			if (!match_table[m].has_value ||
+					node_match(node, match_table[m].value))
+				found[m] = true;
+		}
+	}
+
+	for (m = 0; m < match_count; m++) {
+		if (!found[m])
+			return false;
+	}
+
+	return true;
+}
+
+static void print_json_str(const char *str)
+{
+	putchar('"');
+
+	for (; *str; str++) {
+		unsigned char c = *str;
+
+		if (c == '"' || c == '\\')
+			printf("\\%c", c);
+		else if (c < 0x20)
+			printf("\\u%4.4x", c);
+		else
+			putchar(c);
+	}
+
+	putchar('"');
+}
+
+void decode_print_json(const struct decode_rec *rec)
+{
+	bool first[DECODE_MAX_DEPTH];
+	unsigned int i, depth = 0;
+
+	first[0] = true;
+	putchar('{');
+
+	for (i = 0; i < rec->num_nodes; i++) {
+		const struct decode_node *node = &rec->nodes[i];
+
+		for (; depth > node->level; depth--)
+			putchar('}');
+
+		if (!first[depth])
+			putchar(',');
+		first[depth] = false;
+
+		print_json_str(node->name);
+		putchar(':');
+
+		switch (node->type) {
+		case DECODE_OBJECT:
+			putchar('{');
+			first[++depth] = true;
+			break;
+		case DECODE_UINT:
+		case DECODE_HEX:
+			printf("%llu", (unsigned long long) node->num);
+			break;
+		case DECODE_STR:
+			print_json_str(node->str);
+			break;
+		}
+	}
+
+	for (; depth > 0; depth--)
+		putchar('}');
+
+	printf("}\n");
+}
+
+void decode_print_text(const struct decode_rec *rec)
+{
+	const char *stack[DECODE_MAX_DEPTH];
+	unsigned int i, n;
+
+	for (i = 0; i < rec->num_nodes; i++) {
+		const struct decode_node *node = &rec->nodes[i];
+
+		stack[node->level] = node->name;
+
+		if (node->type == DECODE_OBJECT)
+			continue;
+
+		if (i > 0)
+			putchar(' ');
+
+		for (n = 0; n < node->level; n++)
+			printf("%s.", stack[n]);
+
+		switch (node->type) {
+		case DECODE_UINT:
+			printf("%s=%llu", node->name,
+					(unsigned long long) node->num);
+			break;
+		case DECODE_HEX:
+			printf("%s=0x%llx", node->name,
+					(unsigned long long) node->num);
+			break;
+		case DECODE_STR:
+			if (strpbrk(node->str, " \t") || !*node->str)
+				printf("%s=\"%s\"", node->name, node->str);
+			else
+				printf("%s=%s", node->name, node->str);
+			break;
+		}
+	}
+
+	putchar('\n');
+}
@@ -4138,3 +4138,138 @@ void hci_dump(int level, struct frame *frm)
 		break;
 	}
 }
+
+static void event_decode(struct decode_rec *rec, struct frame *frm)
+{
+	hci_event_hdr *hdr = frm->ptr;
+	uint8_t *ptr = frm->ptr + HCI_EVENT_HDR_SIZE;
+	uint32_t len = frm->len - HCI_EVENT_HDR_SIZE;
+	uint16_t opcode;
+
+	decode_str(rec, "type", "event");
+	decode_hex(rec, "code", hdr->evt);
+
+	if (hdr->evt <= EVENT_NUM)
+		decode_str(rec, "name", event_str[hdr->evt]);
+
+	decode_uint(rec, "plen", hdr->plen);
+
+	switch (hdr->evt) {
+	case EVT_CMD_COMPLETE:
+		if (len < EVT_CMD_COMPLETE_SIZE)
+			break;
+		opcode = get_le16(ptr + 1);
+		decode_uint(rec, "ncmd", ptr[0]);
+		decode_hex(rec, "opcode", opcode);
+		decode_str(rec, "command", opcode2str(opcode));
+		if (len > EVT_CMD_COMPLETE_SIZE)
+			decode_hex(rec, "status", ptr[EVT_CMD_COMPLETE_SIZE]);
+		break;
+	case EVT_CMD_STATUS:
+		if (len < EVT_CMD_STATUS_SIZE)
+			break;
+		opcode = get_le16(ptr + 2);
+		decode_hex(rec, "status", ptr[0]);
+		decode_uint(rec, "ncmd", ptr[1]);
+		decode_hex(rec, "opcode", opcode);
+		decode_str(rec, "command", opcode2str(opcode));
+		break;
+	case EVT_CONN_COMPLETE:
+		if (len < EVT_CONN_COMPLETE_SIZE)
+			break;
+		decode_hex(rec, "status", ptr[0]);
+		decode_uint(rec, "handle", get_le16(ptr + 1));
+		decode_bdaddr(rec, "bdaddr", (bdaddr_t *) (ptr + 3));
+		break;
+	case EVT_DISCONN_COMPLETE:
+		if (len < EVT_DISCONN_COMPLETE_SIZE)
+			break;
+		decode_hex(rec, "status", ptr[0]);
+		decode_uint(rec, "handle", get_le16(ptr + 1));
+		decode_hex(rec, "reason", ptr[3]);
+		break;
+	case EVT_LE_META_EVENT:
+		if (len < 1)
+			break;
+		decode_hex(rec, "subevent", ptr[0]);
+		if (ptr[0] <= LE_EV_NUM)
+			decode_str(rec, "subevent_name", ev_le_meta_str[ptr[0]]);
+		if (ptr[0] == EVT_LE_CONN_COMPLETE &&
+				len > EVT_LE_CONN_COMPLETE_SIZE) {
+			decode_hex(rec, "status", ptr[1]);
+			decode_uint(rec, "handle", get_le16(ptr + 2));
+			decode_bdaddr(rec, "bdaddr", (bdaddr_t *) (ptr + 6));
+		}
+		break;
+	}
+}
+
+void hci_decode(struct decode_rec *rec, struct frame *frm)
+{
+	uint8_t type = *(uint8_t *) frm->ptr;
+	uint16_t handle, opcode;
+
+	frm->ptr++; frm->len--;
+
+	decode_push(rec, "hci");
+
+	switch (type) {
+	case HCI_COMMAND_PKT:
+		if (frm->len < HCI_COMMAND_HDR_SIZE)
+			break;
+		opcode = get_le16(frm->ptr);
+		decode_str(rec, "type", "command");
+		decode_hex(rec, "opcode", opcode);
+		decode_uint(rec, "ogf", cmd_opcode_ogf(opcode));
+		decode_uint(rec, "ocf", cmd_opcode_ocf(opcode));
+		decode_str(rec, "name", opcode2str(opcode));
+		decode_uint(rec, "plen", ((hci_command_hdr *) frm->ptr)->plen);
+		break;
+
+	case HCI_EVENT_PKT:
+		if (frm->len < HCI_EVENT_HDR_SIZE)
+			break;
+		event_decode(rec, frm);
+		break;
+
+	case HCI_ACLDATA_PKT:
+		if (frm->len < HCI_ACL_HDR_SIZE)
+			break;
+		handle = get_le16(frm->ptr);
+		decode_str(rec, "type", "acl");
+		decode_uint(rec, "handle", acl_handle(handle));
+		decode_hex(rec, "flags", acl_flags(handle));
+		decode_uint(rec, "dlen", get_le16(frm->ptr + 2));
+		decode_pop(rec);
+
+		frm->ptr += HCI_ACL_HDR_SIZE;
+		frm->len -= HCI_ACL_HDR_SIZE;
+		frm->flags  = acl_flags(handle);
+		frm->handle = acl_handle(handle);
+
+		l2cap_decode(rec, frm);
+		return;
+
+	case HCI_SCODATA_PKT:
+		if (frm->len < HCI_SCO_HDR_SIZE)
+			break;
+		handle = get_le16(frm->ptr);
+		decode_str(rec, "type", "sco");
+		decode_uint(rec, "handle", acl_handle(handle));
+		decode_hex(rec, "flags", acl_flags(handle));
+		decode_uint(rec, "dlen", ((hci_sco_hdr *) frm->ptr)->dlen);
+		break;
+
+	case HCI_VENDOR_PKT:
+		decode_str(rec, "type", "vendor");
+		decode_uint(rec, "len", frm->len);
+		break;
+
+	default:
+		decode_hex(rec, "type", type);
+		decode_uint(rec, "len", frm->len);
+		break;
+	}
+
+	decode_pop(rec);
+}
@@ -1633,3 +1633,62 @@ void l2cap_clear(uint16_t handle)
 {
 	del_handle(handle);
 }
+
+void l2cap_decode(struct decode_rec *rec, struct frame *frm)
+{
+	uint16_t len, cid, psm;
+
+	decode_push(rec, "l2cap");
+
+	if (!(frm->flags & ACL_START) && frm->flags != ACL_START_NO_FLUSH) {
+		decode_str(rec, "fragment", "continuation");
+		decode_pop(rec);
+		return;
+	}
+
+	if (frm->len < L2CAP_HDR_SIZE) {
+		decode_pop(rec);
+		return;
+	}
+
+	len = get_le16(frm->ptr);
+	cid = get_le16(frm->ptr + 2);
+
+	decode_uint(rec, "len", len);
+	decode_hex(rec, "cid", cid);
+
+	if (frm->len < (uint32_t) len + L2CAP_HDR_SIZE)
+		decode_str(rec, "fragment", "start");
+
+	frm->ptr += L2CAP_HDR_SIZE;
+	frm->len -= L2CAP_HDR_SIZE;
+
+	switch (cid) {
+	case 0x0001:
+	case 0x0005:
+		if (frm->len >= L2CAP_CMD_HDR_SIZE) {
+			l2cap_cmd_hdr *cmd = frm->ptr;
+
+			decode_hex(rec, "code", cmd->code);
+			decode_uint(rec, "ident", cmd->ident);
+		}
+		decode_pop(rec);
+		break;
+	case 0x0004:
+		decode_pop(rec);
+		if (frm->len > 0)
+			att_decode(rec, frm);
+		break;
+	case 0x0006:
+		decode_pop(rec);
+		if (frm->len > 0)
+			smp_decode(rec, frm);
+		break;
+	default:
+		psm = get_psm(!frm->in, frm->handle, cid);
+		if (psm)
+			decode_hex(rec, "psm", psm);
+		decode_pop(rec);
+		break;
+	}
+}
@@ -25,6 +25,7 @@
 #ifndef __PARSER_H
 #define __PARSER_H
 
+#include <stdbool.h>
 #include <time.h>
 #include <sys/time.h>
 #include <netinet/in.h>
@@ -59,6 +60,8 @@ struct frame {
 #define DUMP_EXT	0x0004
 #define DUMP_RAW	0x0008
 #define DUMP_BPA	0x0010
+#define DUMP_FIELDS	0x0020
+#define DUMP_JSON	0x0040
 #define DUMP_TSTAMP	0x0100
 #define DUMP_VERBOSE	0x0200
 #define DUMP_BTSNOOP	0x1000
@@ -251,8 +254,77 @@ void bpa_dump(int level, struct frame *frm);
 
 void amp_assoc_dump(int level, uint8_t *assoc, uint16_t len);
 
+/* Structured decoding */
+#define DECODE_MAX_NODES	64
+#define DECODE_MAX_DEPTH	8
+
+#define DECODE_OBJECT	0
+#define DECODE_UINT	1
+#define DECODE_HEX	2
+#define DECODE_STR	3
+
+struct decode_node {
+	const char	*name;
+	uint8_t		level;
+	uint8_t		type;
+	uint64_t	num;
+	const char	*str;
+};
+
+struct decode_rec {
+	struct decode_node nodes[DECODE_MAX_NODES];
+	unsigned int	num_nodes;
+	uint8_t		level;
+	char		str_buf[512];
+	size_t		str_len;
+};
+
+void decode_push(struct decode_rec *rec, const char *name);
+void decode_pop(struct decode_rec *rec);
+void decode_uint(struct decode_rec *rec, const char *name, uint64_t val);
+void decode_hex(struct decode_rec *rec, const char *name, uint64_t val);
+void decode_str(struct decode_rec *rec, const char *name, const char *str);
+void decode_strf(struct decode_rec *rec, const char *name,
+					const char *format, ...)
+					__attribute__((format(printf, 3, 4)));
+void decode_bdaddr(struct decode_rec *rec, const char *name,
+					const bdaddr_t *bdaddr);
+
+struct decode_rec *decode_frame(struct frame *frm);
+const struct decode_node *decode_find(const struct decode_rec *rec,
+							const char *path);
+
+int decode_add_match(const char *expr);
+bool decode_has_match(void);
+bool decode_match(const struct decode_rec *rec);
+
+void decode_print_text(const struct decode_rec *rec);
+void decode_print_json(const struct decode_rec *rec);
+
+void hci_decode(struct decode_rec *rec, struct frame *frm);
+void l2cap_decode(struct decode_rec *rec, struct frame *frm);
+void att_decode(struct decode_rec *rec, struct frame *frm);
+void smp_decode(struct decode_rec *rec, struct frame *frm);
+
 static inline void parse(struct frame *frm)
 {
+	if (decode_has_match() || (parser.flags & (DUMP_FIELDS | DUMP_JSON))) {
+		struct decode_rec *rec = decode_frame(frm);
+
+		/* Frames that do not match are never rendered */
+		if (!decode_match(rec))
+			return;
+
+		if (parser.flags & (DUMP_FIELDS | DUMP_JSON)) {
+			if (parser.flags & DUMP_JSON)
+				decode_print_json(rec);
+			else
+				decode_print_text(rec);
+			fflush(stdout);
+			return;
+		}
+	}
+
 	p_indent(-1, NULL);
 	if (parser.flags & DUMP_RAW)
 		raw_dump(0, frm);
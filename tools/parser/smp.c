@@ -334,3 +334,13 @@ void smp_dump(int level, struct frame *frm)
 		raw_dump(level, frm);
 	}
 }
+
+void smp_decode(struct decode_rec *rec, struct frame *frm)
+{
+	uint8_t cmd = *(uint8_t *) frm->ptr;
+
+	decode_push(rec, "smp");
+	decode_hex(rec, "code", cmd);
+	decode_str(rec, "name", smpcmd2str(cmd));
+	decode_pop(rec);
+}
@@ -62,6 +62,8 @@ static bool start_dbus = false;
 static int num_devs = 0;
 static const char *qemu_binary = NULL;
 static const char *kernel_image = NULL;
+static unsigned int num_jobs = 1;
+static const char *test_shard = NULL;
 
 static const char *qemu_table[] = {
 	"qemu-system-x86_64",
@@ -260,8 +262,9 @@ static void start_qemu(void)
 				"rootflags=trans=virtio,version=9p2000.L "
 				"acpi=off pci=noacpi noapic quiet ro init=%s "
 				"TESTHOME=%s TESTDBUS=%u TESTDEVS=%d "
-				"TESTAUTO=%u TESTARGS=\'%s\'", initcmd, cwd,
-				start_dbus, num_devs, run_auto, testargs);
+				"TESTAUTO=%u TESTSHARD=%s TESTARGS=\'%s\'",
+				initcmd, cwd, start_dbus, num_devs, run_auto,
+				test_shard ? test_shard : "", testargs);
 
 	argv = alloca(sizeof(qemu_argv) +
 				(sizeof(char *) * (4 + (num_devs * 4))));
@@ -297,6 +300,209 @@ static void start_qemu(void)
 	execve(argv[0], argv, qemu_envp);
 }
 
+struct job {
+	pid_t pid;
+	int fd;
+	char buf[1024];
+	size_t len;
+};
+
+struct job_totals {
+	unsigned int total;
+	unsigned int passed;
+	unsigned int failed;
+	unsigned int not_run;
+};
+
+static void job_line(unsigned int id, char *line, struct job_totals *totals)
+{
+	unsigned int total, passed, failed, not_run;
+	char plain[1024];
+	size_t i, len = 0;
+
+	line[strcspn(line, "\r")] = '\0';
+
+	printf("[%u] %s\n", id, line);
+
+	/* Strip color escapes before looking for the tester summary */
+	for (i = 0; line[i] && len < sizeof(plain) - 1; i++) {
+		if (line[i] == '\x1b') {
+			while (line[i] && line[i] != 'm')
+				i++;
+			if (!line[i])
+				break;
+			continue;
+		}
+
+		plain[len++] = line[i];
+	}
+
+	plain[len] = '\0';
+
+	if (sscanf(plain, "Total: %u, Passed: %u (%*f%%), Failed: %u, "
+				"Not Run: %u", &total, &passed, &failed,
+				&not_run) != 4)
+		return;
+
+	totals->total += total;
+	totals->passed += passed;
+	totals->failed += failed;
+	totals->not_run += not_run;
+}
+
+static bool job_read(struct job *job, unsigned int id,
+						struct job_totals *totals)
+{
+	ssize_t len;
+	char *ptr;
+
+	len = read(job->fd, job->buf + job->len, sizeof(job->buf) - 1 -
+								job->len);
+	if (len < 0 && errno == EINTR)
+		return true;
+
+	if (len <= 0) {
+		if (job->len) {
+			job->buf[job->len] = '\0';
+			job_line(id, job->buf, totals);
+			job->len = 0;
+		}
+
+		close(job->fd);
+		job->fd = -1;
+		return false;
+	}
+
+	job->len += len;
+	job->buf[job->len] = '\0';
+
+	while ((ptr = strchr(job->buf, '\n'))) {
+		*ptr = '\0';
+		job_line(id, job->buf, totals);
+
+		job->len -= ptr + 1 - job->buf;
+		memmove(job->buf, ptr + 1, job->len + 1);
+	}
+
+	/* Flush overly long lines as they are */
+	if (job->len == sizeof(job->buf) - 1) {
+		job_line(id, job->buf, totals);
+		job->len = 0;
+	}
+
+	return true;
+}
+
+static bool job_start(struct job *job, unsigned int id, unsigned int count)
+{
+	static char shard[32];
+	int fds[2], null_fd;
+	pid_t pid;
+
+	if (pipe(fds) < 0)
+		return false;
+
+	fflush(stdout);
+
+	pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+
+	if (pid == 0) {
+		close(fds[0]);
+
+		null_fd = open("/dev/null", O_RDONLY);
+		if (null_fd >= 0) {
+			dup2(null_fd, STDIN_FILENO);
+			close(null_fd);
+		}
+
+		dup2(fds[1], STDOUT_FILENO);
+		dup2(fds[1], STDERR_FILENO);
+		close(fds[1]);
+
+		snprintf(shard, sizeof(shard), "%u/%u", id, count);
+		test_shard = shard;
+
+		start_qemu();
+		exit(EXIT_FAILURE);
+	}
+
+	close(fds[1]);
+
+	job->pid = pid;
+	job->fd = fds[0];
+
+	return true;
+}
+
+static void run_jobs(unsigned int count)
+{
+	struct job_totals totals;
+	struct job *jobs;
+	struct pollfd *fds;
+	unsigned int i, active = 0;
+
+	memset(&totals, 0, sizeof(totals));
+
+	jobs = calloc(count, sizeof(*jobs));
+	fds = calloc(count, sizeof(*fds));
+	if (!jobs || !fds) {
+		free(jobs);
+		free(fds);
+		return;
+	}
+
+	printf("Running %u virtual machines in parallel\n", count);
+
+	for (i = 0; i < count; i++) {
+		if (!job_start(&jobs[i], i, count)) {
+			perror("Failed to start virtual machine");
+			jobs[i].fd = -1;
+			continue;
+		}
+
+		active++;
+	}
+
+	while (active) {
+		for (i = 0; i < count; i++) {
+			fds[i].fd = jobs[i].fd;
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+		}
+
+		if (poll(fds, count, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (i = 0; i < count; i++) {
+			if (jobs[i].fd < 0 || !fds[i].revents)
+				continue;
+
+			if (!job_read(&jobs[i], i, &totals))
+				active--;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (jobs[i].pid > 0)
+			waitpid(jobs[i].pid, NULL, 0);
+	}
+
+	printf("\nCombined: Total: %u, Passed: %u, Failed: %u, Not Run: %u\n",
+			totals.total, totals.passed, totals.failed,
+			totals.not_run);
+
+	free(fds);
+	free(jobs);
+}
+
 static int open_serial(const char *path)
 {
 	struct termios ti;
@@ -546,9 +752,9 @@ static const char *test_table[] = {
 	NULL
 };
 
-static void run_command(char *cmdname, char *home)
+static void run_command(char *cmdname, char *home, char *shard)
 {
-	char *argv[9], *envp[3];
+	char *argv[12], *envp[3];
 	int pos = 0, idx = 0;
 	int serial_fd;
 	pid_t pid, dbus_pid, daemon_pid;
@@ -597,7 +803,7 @@ start_next:
 
 		argv[0] = (char *) test_table[idx];
 		argv[1] = "-q";
-		argv[2] = NULL;
+		pos = 2;
 	} else {
 		while (1) {
 			char *ptr;
@@ -615,10 +821,16 @@ start_next:
 
 			cmdname = ptr + 1;
 		}
+	}
 
-		argv[pos] = NULL;
+	/* Only run this virtual machine's share of the test cases */
+	if (shard) {
+		argv[pos++] = "--shard";
+		argv[pos++] = shard;
 	}
 
+	argv[pos] = NULL;
+
 	pos = 0;
 	envp[pos++] = "TERM=linux";
 	if (home)
@@ -700,7 +912,7 @@ start_next:
 
 static void run_tests(void)
 {
-	char cmdline[CMDLINE_MAX], *ptr, *cmds, *home = NULL;
+	char cmdline[CMDLINE_MAX], *ptr, *cmds, *home = NULL, *shard = NULL;
 	FILE *fp;
 
 	fp = fopen("/proc/cmdline", "re");
@@ -750,6 +962,13 @@ static void run_tests(void)
 		start_dbus = true;
 	}
 
+	ptr = strstr(cmdline, "TESTSHARD=");
+	if (ptr && ptr[10] != ' ' && ptr[10] != '\0') {
+		shard = ptr + 10;
+		shard[strcspn(shard, " \r\n")] = '\0';
+		printf("Running test shard %s\n", shard);
+	}
+
 	ptr = strstr(cmdline, "TESTHOME=");
 	if (ptr) {
 		home = ptr + 4;
@@ -758,7 +977,7 @@ static void run_tests(void)
 			*ptr = '\0';
 	}
 
-	run_command(cmds, home);
+	run_command(cmds, home, shard);
 }
 
 static void usage(void)
@@ -772,6 +991,7 @@ static void usage(void)
 		"\t-u, --unix [path]      Provide serial device\n"
 		"\t-q, --qemu <path>      QEMU binary\n"
 		"\t-k, --kernel <image>   Kernel image (bzImage)\n"
+		"\t-j, --jobs <num>       Split tests over num machines\n"
 		"\t-h, --help             Show help options\n");
 }
 
@@ -782,6 +1002,7 @@ static const struct option main_options[] = {
 	{ "dbus",    no_argument,       NULL, 'd' },
 	{ "qemu",    required_argument, NULL, 'q' },
 	{ "kernel",  required_argument, NULL, 'k' },
+	{ "jobs",    required_argument, NULL, 'j' },
 	{ "version", no_argument,       NULL, 'v' },
 	{ "help",    no_argument,       NULL, 'h' },
 	{ }
@@ -801,7 +1022,7 @@ int main(int argc, char *argv[])
 	for (;;) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "audq:k:vh", main_options, NULL);
+		opt = getopt_long(argc, argv, "audq:k:j:vh", main_options, NULL);
 		if (opt < 0)
 			break;
 
@@ -821,6 +1042,13 @@ int main(int argc, char *argv[])
 		case 'k':
 			kernel_image = optarg;
 			break;
+		case 'j':
+			num_jobs = atoi(optarg);
+			if (num_jobs < 1) {
+				fprintf(stderr, "Invalid number of jobs\n");
+				return EXIT_FAILURE;
+			}
+			break;
 		case 'v':
 			printf("%s\n", VERSION);
 			return EXIT_SUCCESS;
@@ -867,6 +1095,11 @@ int main(int argc, char *argv[])
 	printf("Using QEMU binary %s\n", qemu_binary);
 	printf("Using kernel image %s\n", kernel_image);
 
+	if (num_jobs > 1) {
+		run_jobs(num_jobs);
+		return EXIT_SUCCESS;
+	}
+
 	start_qemu();
 
 	return EXIT_SUCCESS;
@@ -76,6 +76,85 @@ static void test_h6(gconstpointer data)
 	tester_test_passed();
 }
 
+static void test_ah(gconstpointer data)
+{
+	const uint8_t k[16] = {
+			0x9b, 0x7d, 0x39, 0x0a, 0xa6, 0x10, 0x10, 0x34,
+			0x05, 0xad, 0xc8, 0x57, 0xa3, 0x34, 0x02, 0xec };
+	const uint8_t r[3] = { 0x94, 0x81, 0x70 };
+	const uint8_t exp[3] = { 0xaa, 0xfb, 0x0d };
+	uint8_t res[3];
+
+	tester_debug("K:");
+	util_hexdump(' ', k, 16, print_debug, NULL);
+
+	tester_debug("R:");
+	util_hexdump(' ', r, 3, print_debug, NULL);
+
+	if (!bt_crypto_ah(crypto, k, r, res)) {
+		tester_test_failed();
+		return;
+	}
+
+	tester_debug("Expected:");
+	util_hexdump(' ', exp, 3, print_debug, NULL);
+
+	tester_debug("Result:");
+	util_hexdump(' ', res, 3, print_debug, NULL);
+
+	if (memcmp(res, exp, 3)) {
+		tester_test_failed();
+		return;
+	}
+
+	tester_test_passed();
+}
+
+static void test_irk_table(gconstpointer data)
+{
+	const uint8_t k[16] = {
+			0x9b, 0x7d, 0x39, 0x0a, 0xa6, 0x10, 0x10, 0x34,
+			0x05, 0xad, 0xc8, 0x57, 0xa3, 0x34, 0x02, 0xec };
+	const uint8_t addr[3][6] = {
+			{ 0xaa, 0xfb, 0x0d, 0x94, 0x81, 0x70 },
+			{ 0xab, 0xfb, 0x0d, 0x94, 0x81, 0x70 },
+			{ 0xaa, 0xfb, 0x0d, 0x94, 0x81, 0xb0 } };
+	struct bt_crypto_irk_table *table;
+	uint8_t irk[16];
+	int index[3];
+	int i, id = -1;
+
+	table = bt_crypto_irk_table_new(crypto);
+	g_assert(table);
+
+	/* Put the key in the middle of unrelated ones */
+	for (i = 0; i < 7; i++) {
+		memset(irk, i + 1, sizeof(irk));
+		g_assert(bt_crypto_irk_table_add(table, irk) >= 0);
+
+		if (i == 4)
+			id = bt_crypto_irk_table_add(table, k);
+	}
+
+	g_assert(id == 5);
+
+	/* Only the first address matches, the last one is not an RPA */
+	g_assert(bt_crypto_irk_table_resolve_batch(table, addr, 3, index) == 1);
+	g_assert(index[0] == id);
+	g_assert(index[1] < 0);
+	g_assert(index[2] < 0);
+
+	/* Repeated lookups are served from the cache */
+	g_assert(bt_crypto_irk_table_resolve(table, addr[0]) == id);
+
+	g_assert(bt_crypto_irk_table_remove(table, id));
+	g_assert(bt_crypto_irk_table_resolve(table, addr[0]) < 0);
+
+	bt_crypto_irk_table_free(table);
+
+	tester_test_passed();
+}
+
 struct test_data {
 	const uint8_t *msg;
 	uint16_t msg_len;
@@ -208,6 +287,54 @@ static void test_sign(gconstpointer data)
 	tester_test_passed();
 }
 
+static void bench_ah(const void *data, unsigned int count)
+{
+	const uint8_t k[16] = {
+			0x9b, 0x7d, 0x39, 0x0a, 0xa6, 0x10, 0x10, 0x34,
+			0x05, 0xad, 0xc8, 0x57, 0xa3, 0x34, 0x02, 0xec };
+	const uint8_t r[3] = { 0x94, 0x81, 0x70 };
+	uint8_t res[3];
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		g_assert(bt_crypto_ah(crypto, k, r, res));
+}
+
+static void bench_sign_att(const void *data, unsigned int count)
+{
+	const struct test_data *d = data;
+	uint8_t t[12];
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		g_assert(bt_crypto_sign_att(crypto, d->key, d->msg, d->msg_len,
+								d->cnt, t));
+}
+
+#define BENCH_IRK_COUNT 32
+
+static void bench_irk_resolve(const void *data, unsigned int count)
+{
+	const uint8_t addr[6] = { 0x11, 0x22, 0x33, 0x44, 0x55, 0x66 };
+	struct bt_crypto_irk_table *table;
+	uint8_t irk[16];
+	unsigned int i;
+
+	table = bt_crypto_irk_table_new(crypto);
+	g_assert(table);
+
+	for (i = 0; i < BENCH_IRK_COUNT; i++) {
+		memset(irk, i + 1, sizeof(irk));
+		g_assert(bt_crypto_irk_table_add(table, irk) >= 0);
+	}
+
+	/* Unresolvable address, so every key in the table is tried */
+	for (i = 0; i < count; i++)
+		g_assert(bt_crypto_irk_table_resolve(table, addr) < 0);
+
+	bt_crypto_irk_table_free(table);
+}
+
 int main(int argc, char *argv[])
 {
 	int exit_status;
@@ -220,12 +347,21 @@ int main(int argc, char *argv[])
 
 	tester_add("/crypto/h6", NULL, NULL, test_h6, NULL);
 
+	tester_add("/crypto/ah", NULL, NULL, test_ah, NULL);
+	tester_add("/crypto/irk_table", NULL, NULL, test_irk_table, NULL);
+
 	tester_add("/crypto/sign_att_1", &test_data_1, NULL, test_sign, NULL);
 	tester_add("/crypto/sign_att_2", &test_data_2, NULL, test_sign, NULL);
 	tester_add("/crypto/sign_att_3", &test_data_3, NULL, test_sign, NULL);
 	tester_add("/crypto/sign_att_4", &test_data_4, NULL, test_sign, NULL);
 	tester_add("/crypto/sign_att_5", &test_data_5, NULL, test_sign, NULL);
 
+	tester_add_bench("/crypto/bench/ah", NULL, NULL, bench_ah, NULL);
+	tester_add_bench("/crypto/bench/sign_att", &test_data_5, NULL,
+						bench_sign_att, NULL);
+	tester_add_bench("/crypto/bench/irk_resolve", NULL, NULL,
+						bench_irk_resolve, NULL);
+
 	exit_status = tester_run();
 
 	bt_crypto_unref(crypto);
@@ -87,6 +87,61 @@ static void test_multi(const void *data)
 	tester_test_passed();
 }
 
+static void test_pool(const void *data)
+{
+	struct ecc_key_pool *pool;
+	uint8_t public1[64], public2[64], public3[64];
+	uint8_t private1[32], private2[32], private3[32];
+	uint8_t shared1[32], shared2[32];
+
+	pool = ecc_key_pool_new(2, 2);
+	g_assert(pool);
+
+	/* A key pair is handed out twice before it is rotated */
+	g_assert(ecc_key_pool_get(pool, public1, private1));
+	g_assert(ecc_key_pool_get(pool, public2, private2));
+	g_assert(ecc_key_pool_get(pool, public3, private3));
+
+	g_assert(memcmp(public1, public3, sizeof(public1)));
+	g_assert(memcmp(private1, private3, sizeof(private1)));
+
+	if (memcmp(public1, public2, sizeof(public1))) {
+		/* The pool was still empty and keys were made on demand */
+		tester_debug("Key pool not filled yet");
+	} else {
+		g_assert(!memcmp(private1, private2, sizeof(private1)));
+	}
+
+	g_assert(ecdh_shared_secret(public1, private3, shared1));
+	g_assert(ecdh_shared_secret(public3, private1, shared2));
+	g_assert(!memcmp(shared1, shared2, sizeof(shared1)));
+
+	ecc_key_pool_free(pool);
+
+	tester_test_passed();
+}
+
+static void bench_make_key(const void *data, unsigned int count)
+{
+	uint8_t public[64], private[32];
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		g_assert(ecc_make_key(public, private));
+}
+
+static void bench_shared_secret(const void *data, unsigned int count)
+{
+	uint8_t public1[64], private1[32], private2[32], shared[32];
+	unsigned int i;
+
+	g_assert(ecc_make_key(public1, private1));
+	g_assert(ecc_make_key(public1, private2));
+
+	for (i = 0; i < count; i++)
+		g_assert(ecdh_shared_secret(public1, private2, shared));
+}
+
 static int test_sample(uint8_t priv_a[32], uint8_t priv_b[32],
 				uint8_t pub_a[64], uint8_t pub_b[64],
 				uint8_t dhkey[32])
@@ -253,5 +308,12 @@ int main(int argc, char *argv[])
 	tester_add("/ecdh/sample/2", NULL, NULL, test_sample_2, NULL);
 	tester_add("/ecdh/sample/3", NULL, NULL, test_sample_3, NULL);
 
+	tester_add("/ecdh/pool", NULL, NULL, test_pool, NULL);
+
+	tester_add_bench("/ecdh/bench/make_key", NULL, NULL,
+						bench_make_key, NULL);
+	tester_add_bench("/ecdh/bench/shared_secret", NULL, NULL,
+						bench_shared_secret, NULL);
+
 	return tester_run();
 }
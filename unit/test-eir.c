@@ -654,6 +654,65 @@ static const struct test_data uri_beacon_test = {
 	.uuid = uri_beacon_uuid,
 };
 
+static void test_iter(const void *data)
+{
+	static const uint8_t truncated[] = { 0x02, 0x01, 0x06, 0x05, 0x09,
+								'a', 'b' };
+	struct eir_iter iter;
+	const uint8_t *field;
+	uint8_t type, len;
+	unsigned int count = 0;
+
+	eir_iter_init(&iter, gigaset_gtag_data, sizeof(gigaset_gtag_data));
+
+	g_assert(eir_iter_next(&iter, &type, &field, &len));
+	g_assert(type == EIR_FLAGS && len == 1 && field[0] == 0x06);
+
+	g_assert(eir_iter_next(&iter, &type, &field, &len));
+	g_assert(type == EIR_MANUFACTURER_DATA && len == 12);
+	g_assert(field == &gigaset_gtag_data[5]);
+
+	g_assert(eir_iter_next(&iter, &type, &field, &len));
+	g_assert(type == EIR_UUID16_SOME && len == 2);
+	g_assert(get_le16(field) == 0x180f);
+
+	/* The zero padding terminates the data */
+	g_assert(!eir_iter_next(&iter, &type, &field, &len));
+	g_assert(!eir_iter_next(&iter, &type, &field, &len));
+
+	/* Fields running past the end are not returned */
+	eir_iter_init(&iter, truncated, sizeof(truncated));
+
+	while (eir_iter_next(&iter, &type, &field, &len))
+		count++;
+
+	g_assert(count == 1);
+
+	eir_iter_init(&iter, NULL, 0);
+	g_assert(!eir_iter_next(&iter, &type, &field, &len));
+
+	tester_test_passed();
+}
+
+static void test_hash(const void *data)
+{
+	uint8_t buf[sizeof(uri_beacon_data)];
+	uint32_t hash;
+
+	memcpy(buf, uri_beacon_data, sizeof(buf));
+
+	hash = eir_hash(buf, sizeof(buf));
+	g_assert(hash == eir_hash(uri_beacon_data, sizeof(uri_beacon_data)));
+
+	/* Any change of the payload or its length shows up in the hash */
+	buf[sizeof(buf) - 1] ^= 0x01;
+	g_assert(hash != eir_hash(buf, sizeof(buf)));
+	g_assert(hash != eir_hash(uri_beacon_data,
+					sizeof(uri_beacon_data) - 1));
+
+	tester_test_passed();
+}
+
 int main(int argc, char *argv[])
 {
 	tester_init(&argc, &argv);
@@ -680,5 +739,8 @@ int main(int argc, char *argv[])
 	tester_add("ad/g-tag", &gigaset_gtag_test, NULL, test_parsing, NULL);
 	tester_add("ad/uri-beacon", &uri_beacon_test, NULL, test_parsing, NULL);
 
+	tester_add("/eir/iter", NULL, NULL, test_iter, NULL);
+	tester_add("/eir/hash", NULL, NULL, test_hash, NULL);
+
 	return tester_run();
 }
@@ -0,0 +1,274 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "lib/bluetooth.h"
+#include "lib/uuid.h"
+#include "src/shared/util.h"
+#include "src/shared/queue.h"
+#include "src/shared/att.h"
+#include "src/shared/gatt-db.h"
+#include "src/shared/tester.h"
+#include "src/gatt-cache.h"
+
+static const char test_pathname[] = "/tmp/gatt-cache";
+
+static void write_cb(struct gatt_db_attribute *attrib, int err,
+							void *user_data)
+{
+	g_assert(!err);
+}
+
+static void write_value(struct gatt_db_attribute *attr, const uint8_t *value,
+								size_t len)
+{
+	g_assert(gatt_db_attribute_write(attr, 0, value, len, 0, NULL,
+							write_cb, NULL));
+}
+
+static void set_active(struct gatt_db_attribute *attr, void *user_data)
+{
+	gatt_db_service_set_active(attr, true);
+}
+
+static struct gatt_db *create_db(void)
+{
+	const uint8_t hash[16] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+					0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d,
+					0x0e, 0x0f, 0x10 };
+	const uint8_t ext_prop[2] = { 0x01, 0x00 };
+	struct gatt_db_attribute *attr, *incl;
+	struct gatt_db *db;
+	bt_uuid_t uuid;
+	uint128_t u128;
+	unsigned int i;
+
+	db = gatt_db_new();
+
+	bt_uuid16_create(&uuid, 0x1801);
+	attr = gatt_db_insert_service(db, 0x0001, &uuid, true, 5);
+	g_assert(attr);
+
+	bt_uuid16_create(&uuid, GATT_CHARAC_DB_HASH);
+	attr = gatt_db_insert_characteristic(db, 0x0003, &uuid, 0, 0x02,
+							NULL, NULL, NULL);
+	g_assert(attr);
+	write_value(attr, hash, sizeof(hash));
+
+	bt_uuid16_create(&uuid, 0x180f);
+	incl = gatt_db_insert_service(db, 0x0020, &uuid, false, 3);
+	g_assert(incl);
+
+	bt_uuid16_create(&uuid, 0x2a19);
+	g_assert(gatt_db_insert_characteristic(db, 0x0022, &uuid, 0, 0x12,
+							NULL, NULL, NULL));
+
+	for (i = 0; i < 16; i++)
+		u128.data[i] = i;
+
+	bt_uuid128_create(&uuid, u128);
+	attr = gatt_db_insert_service(db, 0x0010, &uuid, true, 8);
+	g_assert(attr);
+
+	g_assert(gatt_db_insert_included(db, 0x0011, incl));
+
+	bt_uuid16_create(&uuid, 0x2a37);
+	g_assert(gatt_db_insert_characteristic(db, 0x0013, &uuid, 0, 0x90,
+							NULL, NULL, NULL));
+
+	bt_uuid16_create(&uuid, GATT_CHARAC_EXT_PROPER_UUID);
+	attr = gatt_db_insert_descriptor(db, 0x0014, &uuid, 0, NULL, NULL,
+									NULL);
+	g_assert(attr);
+	write_value(attr, ext_prop, sizeof(ext_prop));
+
+	bt_uuid16_create(&uuid, GATT_CLIENT_CHARAC_CFG_UUID);
+	g_assert(gatt_db_insert_descriptor(db, 0x0015, &uuid, 0, NULL, NULL,
+									NULL));
+
+	gatt_db_foreach_service(db, NULL, set_active, NULL);
+
+	return db;
+}
+
+struct read_data {
+	uint8_t value[BT_ATT_MAX_VALUE_LEN];
+	size_t len;
+};
+
+static void read_cb(struct gatt_db_attribute *attrib, int err,
+					const uint8_t *value, size_t length,
+					void *user_data)
+{
+	struct read_data *data = user_data;
+
+	g_assert(!err);
+
+	if (length)
+		memcpy(data->value, value, length);
+
+	data->len = length;
+}
+
+static void compare_db(struct gatt_db *db1, struct gatt_db *db2)
+{
+	unsigned int handle;
+
+	for (handle = 0x0001; handle <= 0xffff; handle++) {
+		struct gatt_db_attribute *attr1, *attr2;
+		struct read_data value1, value2;
+
+		attr1 = gatt_db_get_attribute(db1, handle);
+		attr2 = gatt_db_get_attribute(db2, handle);
+
+		if (!attr1) {
+			g_assert(!attr2);
+			continue;
+		}
+
+		g_assert(attr2);
+		g_assert(!bt_uuid_cmp(gatt_db_attribute_get_type(attr1),
+					gatt_db_attribute_get_type(attr2)));
+
+		g_assert(gatt_db_attribute_read(attr1, 0, 0, NULL, read_cb,
+								&value1));
+		g_assert(gatt_db_attribute_read(attr2, 0, 0, NULL, read_cb,
+								&value2));
+
+		tester_debug("handle 0x%04x length %zu", handle, value1.len);
+
+		g_assert(value1.len == value2.len);
+		g_assert(!memcmp(value1.value, value2.value, value1.len));
+	}
+}
+
+static void count_service(struct gatt_db_attribute *attr, void *user_data)
+{
+	unsigned int *count = user_data;
+
+	(*count)++;
+}
+
+static unsigned int service_count(struct gatt_db *db)
+{
+	unsigned int count = 0;
+
+	gatt_db_foreach_service(db, NULL, count_service, &count);
+
+	return count;
+}
+
+static void test_roundtrip(const void *test_data)
+{
+	struct gatt_db *db1, *db2;
+
+	db1 = create_db();
+	db2 = gatt_db_new();
+
+	g_assert(gatt_cache_save(db1, test_pathname));
+	g_assert(gatt_cache_load(db2, test_pathname));
+
+	g_assert(service_count(db1) == service_count(db2));
+
+	compare_db(db1, db2);
+
+	gatt_db_unref(db2);
+	gatt_db_unref(db1);
+
+	unlink(test_pathname);
+
+	tester_test_passed();
+}
+
+static void test_corrupted(const void *test_data)
+{
+	struct gatt_db *db;
+	off_t size;
+	int fd;
+
+	db = create_db();
+	g_assert(gatt_cache_save(db, test_pathname));
+	gatt_db_unref(db);
+
+	fd = open(test_pathname, O_RDWR);
+	g_assert(fd >= 0);
+
+	size = lseek(fd, 0, SEEK_END);
+	g_assert(size > 0);
+	g_assert(ftruncate(fd, size - 1) == 0);
+	close(fd);
+
+	db = gatt_db_new();
+	g_assert(!gatt_cache_load(db, test_pathname));
+	g_assert(gatt_db_isempty(db));
+	gatt_db_unref(db);
+
+	unlink(test_pathname);
+
+	tester_test_passed();
+}
+
+static void test_version(const void *test_data)
+{
+	struct gatt_db *db;
+	uint8_t version = 0xff;
+	int fd;
+
+	db = create_db();
+	g_assert(gatt_cache_save(db, test_pathname));
+	gatt_db_unref(db);
+
+	fd = open(test_pathname, O_RDWR);
+	g_assert(fd >= 0);
+	g_assert(pwrite(fd, &version, 1, 8) == 1);
+	close(fd);
+
+	db = gatt_db_new();
+	g_assert(!gatt_cache_load(db, test_pathname));
+	g_assert(gatt_db_isempty(db));
+	gatt_db_unref(db);
+
+	unlink(test_pathname);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/gatt-cache/roundtrip", NULL, NULL, test_roundtrip, NULL);
+	tester_add("/gatt-cache/corrupted", NULL, NULL, test_corrupted, NULL);
+	tester_add("/gatt-cache/version", NULL, NULL, test_version, NULL);
+
+	return tester_run();
+}
@@ -144,10 +144,10 @@ struct context {
 				0x2a),					\
 		raw_pdu(0x08, 0x07, 0x00, 0x08, 0x00, 0x03, 0x28),	\
 		raw_pdu(0x01, 0x08, 0x07, 0x00, 0x0a),			\
-		raw_pdu(0x04, 0x04, 0x00, 0x04, 0x00),			\
-		raw_pdu(0x05, 0x01, 0x04, 0x00, 0x01, 0x29),		\
-		raw_pdu(0x04, 0x08, 0x00, 0x08, 0x00),			\
-		raw_pdu(0x05, 0x01, 0x08, 0x00, 0x01, 0x29)
+		raw_pdu(0x04, 0x04, 0x00, 0x08, 0x00),			\
+		raw_pdu(0x05, 0x01, 0x04, 0x00, 0x01, 0x29, 0x05, 0x00,	\
+			0x00, 0x28, 0x06, 0x00, 0x03, 0x28, 0x07, 0x00,	\
+			0x29, 0x2a, 0x08, 0x00, 0x01, 0x29)
 
 #define SERVICE_DATA_2_PDUS						\
 		MTU_EXCHANGE_CLIENT_PDUS,				\
@@ -169,10 +169,10 @@ struct context {
 				0x2a),					\
 		raw_pdu(0x08, 0x08, 0x00, 0x0a, 0x00, 0x03, 0x28),	\
 		raw_pdu(0x01, 0x08, 0x08, 0x00, 0x0a),			\
-		raw_pdu(0x04, 0x04, 0x00, 0x04, 0x00),			\
-		raw_pdu(0x05, 0x01, 0x04, 0x00, 0x01, 0x29),		\
-		raw_pdu(0x04, 0x09, 0x00, 0x0a, 0x00),			\
-		raw_pdu(0x05, 0x01, 0x0a, 0x00, 0x01, 0x29)
+		raw_pdu(0x04, 0x04, 0x00, 0x0a, 0x00),			\
+		raw_pdu(0x05, 0x01, 0x04, 0x00, 0x01, 0x29, 0x05, 0x00,	\
+			0x00, 0x28, 0x07, 0x00, 0x03, 0x28, 0x08, 0x00,	\
+			0x29, 0x2a, 0x0a, 0x00, 0x01, 0x29)
 
 #define SERVICE_DATA_3_PDUS						\
 		MTU_EXCHANGE_CLIENT_PDUS,				\
@@ -195,10 +195,11 @@ struct context {
 			0x2a),						\
 		raw_pdu(0x08, 0x11, 0x03, 0x20, 0x03, 0x03, 0x28),	\
 		raw_pdu(0x01, 0x08, 0x11, 0x03, 0x0a),			\
-		raw_pdu(0x04, 0x12, 0x01, 0x1f, 0x01),			\
-		raw_pdu(0x01, 0x04, 0x12, 0x01, 0x0a),			\
-		raw_pdu(0x04, 0x12, 0x03, 0x20, 0x03),			\
-		raw_pdu(0x05, 0x01, 0x20, 0x03, 0x02, 0x29)
+		raw_pdu(0x04, 0x12, 0x01, 0x20, 0x03),			\
+		raw_pdu(0x05, 0x01, 0x20, 0x01, 0x03, 0x28, 0x21, 0x01,	\
+			0x01, 0x2a, 0x00, 0x02, 0x00, 0x28, 0x00, 0x03,	\
+			0x00, 0x28, 0x10, 0x03, 0x03, 0x28, 0x11, 0x03,	\
+			0x29, 0x2a, 0x20, 0x03, 0x02, 0x29)
 
 #define PRIMARY_DISC_SMALL_DB						\
 		raw_pdu(0x10, 0x01, 0x00, 0xff, 0xff, 0x00, 0x28),	\
@@ -261,11 +262,15 @@ struct context {
 		raw_pdu(0x01, 0x08, 0x18, 0xf0, 0x0a)
 
 #define DESCRIPTOR_DISC_SMALL_DB					\
-		raw_pdu(0x04, 0x04, 0x00, 0x10, 0x00),			\
+		raw_pdu(0x04, 0x04, 0x00, 0x16, 0xf0),			\
 		raw_pdu(0x05, 0x01, 0x04, 0x00, 0x02, 0x29, 0x05, 0x00,	\
-			0x01, 0x29),					\
-		raw_pdu(0x04, 0x06, 0x00, 0x10, 0x00),			\
-		raw_pdu(0x01, 0x04, 0x06, 0x00, 0x0a),			\
+			0x01, 0x29, 0x10, 0xf0, 0x00, 0x28, 0x11, 0xf0,	\
+			0x02, 0x28, 0x12, 0xf0, 0x03, 0x28, 0x13, 0xf0,	\
+			0x00, 0x2a, 0x14, 0xf0, 0x03, 0x28),		\
+		raw_pdu(0x04, 0x15, 0xf0, 0x16, 0xf0),			\
+		raw_pdu(0x05, 0x02, 0x15, 0xf0, 0xef, 0xcd, 0xab, 0x89,	\
+			0x67, 0x45, 0x23, 0x01, 0x00, 0x00, 0x00, 0x00,	\
+			0x09, 0xb0, 0x00, 0x00),			\
 		raw_pdu(0x04, 0x16, 0xf0, 0x16, 0xf0),			\
 		raw_pdu(0x05, 0x01, 0x16, 0xf0, 0x00, 0x29),		\
 		raw_pdu(0x0a, 0x16, 0xf0),				\
@@ -2330,6 +2335,90 @@ static const struct test_step test_indication_server_1 = {
 	.length = 0x03,
 };
 
+static void bench_db_read_by_group_type(const void *data, unsigned int count)
+{
+	struct gatt_db *db = (void *) data;
+	struct queue *q;
+	bt_uuid_t uuid;
+	unsigned int i;
+
+	bt_uuid16_create(&uuid, GATT_PRIM_SVC_UUID);
+	q = queue_new();
+
+	for (i = 0; i < count; i++) {
+		gatt_db_read_by_group_type(db, 0x0001, 0xffff, uuid, q);
+		g_assert(!queue_isempty(q));
+		queue_remove_all(q, NULL, NULL, NULL);
+	}
+
+	queue_destroy(q, NULL);
+}
+
+static void bench_db_get_attribute(const void *data, unsigned int count)
+{
+	struct gatt_db *db = (void *) data;
+	unsigned int i;
+
+	/* The large test database uses handles up to 0x00b1 */
+	for (i = 0; i < count; i++)
+		gatt_db_get_attribute(db, i % 0x00b1 + 1);
+}
+
+static struct bt_att *bench_client;
+static struct bt_att *bench_server;
+static unsigned int bench_received;
+
+static void bench_write_cb(uint8_t opcode, const void *pdu, uint16_t length,
+							void *user_data)
+{
+	bench_received++;
+}
+
+static void setup_bench_att(const void *data)
+{
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+		tester_setup_failed();
+		return;
+	}
+
+	bench_client = bt_att_new(fds[0], false);
+	bench_server = bt_att_new(fds[1], false);
+	g_assert(bench_client && bench_server);
+
+	bt_att_set_close_on_unref(bench_client, true);
+	bt_att_set_close_on_unref(bench_server, true);
+
+	bt_att_register(bench_server, BT_ATT_OP_WRITE_CMD, bench_write_cb,
+								NULL, NULL);
+	bench_received = 0;
+
+	tester_setup_complete();
+}
+
+static void teardown_bench_att(const void *data)
+{
+	bt_att_unref(bench_client);
+	bt_att_unref(bench_server);
+
+	tester_teardown_complete();
+}
+
+static void bench_att_write_cmd(const void *data, unsigned int count)
+{
+	uint8_t pdu[22] = { 0x03, 0x00 };
+	unsigned int i, target = bench_received + count;
+
+	for (i = 0; i < count; i++)
+		g_assert(bt_att_send(bench_client, BT_ATT_OP_WRITE_CMD, pdu,
+					sizeof(pdu), NULL, NULL, NULL));
+
+	/* Run the main loop until the server side saw every command */
+	while (bench_received < target)
+		g_main_context_iteration(NULL, TRUE);
+}
+
 int main(int argc, char *argv[])
 {
 	struct gatt_db *service_db_1, *service_db_2, *service_db_3;
@@ -4471,5 +4560,27 @@ int main(int argc, char *argv[])
 			raw_pdu(0xff, 0x00),
 			raw_pdu());
 
+	define_test_server("/robustness/read-by-grp-type-128",
+			test_server, service_db_1, NULL,
+			raw_pdu(0x03, 0x00, 0x02),
+			raw_pdu(0x10, 0x01, 0x00, 0xff, 0xff, 0xfb, 0x34, 0x9b,
+					0x5f, 0x80, 0x00, 0x00, 0x80, 0x00,
+					0x10, 0x00, 0x00, 0x00, 0x28, 0x00,
+					0x00),
+			raw_pdu(0x11, 0x06, 0x01, 0x00, 0x04, 0x00, 0x01, 0x18,
+					0x05, 0x00, 0x08, 0x00, 0x0d, 0x18),
+			raw_pdu(0x10, 0x01, 0x00, 0xff, 0xff, 0xfb, 0x34, 0x9b,
+					0x5f, 0x80, 0x00, 0x00, 0x80, 0x00,
+					0x10, 0x00, 0x00, 0x01, 0x28, 0x00,
+					0x00),
+			raw_pdu(0x01, 0x10, 0x01, 0x00, 0x0a));
+
+	tester_add_bench("/bench/gatt-db/read_by_group_type", ts_large_db_1,
+				NULL, bench_db_read_by_group_type, NULL);
+	tester_add_bench("/bench/gatt-db/get_attribute", ts_large_db_1,
+				NULL, bench_db_get_attribute, NULL);
+	tester_add_bench("/bench/att/write_cmd", NULL, setup_bench_att,
+				bench_att_write_cmd, teardown_bench_att);
+
 	return tester_run();
 }
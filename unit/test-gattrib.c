@@ -378,6 +378,7 @@ static void send_test_pdus(gpointer context, struct test_pdu *pdus)
 #define PDU_IND_NODATA pdu(ATT_OP_HANDLE_IND, 0x01, 0x00)
 #define PDU_INVALID_IND pdu(ATT_OP_HANDLE_IND, 0x14)
 #define PDU_IND_DATA pdu(ATT_OP_HANDLE_IND, 0x14, 0x00, 0x01)
+#define PDU_IND_COLLIDE pdu(ATT_OP_HANDLE_IND, 0x34, 0x00, 0x02)
 
 struct expect_test_data {
 	struct test_pdu *expected;
@@ -442,6 +443,10 @@ static void test_register(struct context *cxt, gconstpointer user_data)
 		 * Matched PDU opcode
 		 * Matched handle */
 		PDU_IND_DATA,
+		/*
+		 * Matched PDU opcode
+		 * Unmatched handle sharing the dispatch bucket of 0x0014 */
+		PDU_IND_COLLIDE,
 		{ },
 	};
 	struct test_pdu req_pdus[] = { PDU_FIND_INFO_REQ, { } };
@@ -449,6 +454,7 @@ static void test_register(struct context *cxt, gconstpointer user_data)
 		PDU_IND_NODATA,
 		PDU_INVALID_IND,
 		PDU_IND_DATA,
+		PDU_IND_COLLIDE,
 		{ },
 	};
 	struct test_pdu followed_ind_pdus[] = { PDU_IND_DATA, { } };
@@ -26,6 +26,7 @@
 
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
 
 #include "gobex/gobex.h"
 #include "gobex/gobex-apparam.h"
@@ -376,6 +377,50 @@ static void test_apparam_set_multi(void)
 	len = g_obex_apparam_encode(apparam, buf, sizeof(buf));
 
 	g_assert_cmpuint(len, ==, sizeof(tag_multi));
+	assert_memequal(tag_multi, sizeof(tag_multi), buf, len);
+
+	g_obex_apparam_free(apparam);
+}
+
+static void test_apparam_set_replace(void)
+{
+	GObexApparam *apparam;
+	guint8 buf[1024];
+	gsize len;
+
+	apparam = g_obex_apparam_set_uint8(NULL, TAG_U16, 0x01);
+	g_assert(apparam != NULL);
+
+	apparam = g_obex_apparam_set_uint16(apparam, TAG_U16, 0x0102);
+	g_assert(apparam != NULL);
+
+	len = g_obex_apparam_encode(apparam, buf, sizeof(buf));
+	assert_memequal(tag_uint16, sizeof(tag_uint16), buf, len);
+
+	g_obex_apparam_free(apparam);
+}
+
+static void test_apparam_set_large(void)
+{
+	GObexApparam *apparam;
+	guint8 buf[1024];
+	gsize len;
+
+	apparam = g_obex_apparam_set_uint32(NULL, TAG_U32, 0x01020304);
+	g_assert(apparam != NULL);
+
+	apparam = g_obex_apparam_set_bytes(apparam, TAG_BYTES, tag_bytes + 2,
+							sizeof(tag_bytes) - 2);
+	g_assert(apparam != NULL);
+
+	len = g_obex_apparam_encode(apparam, buf, sizeof(buf));
+	g_assert_cmpuint(len, ==, sizeof(tag_uint32) + sizeof(tag_bytes));
+	assert_memequal(tag_uint32, sizeof(tag_uint32), buf,
+							sizeof(tag_uint32));
+	assert_memequal(tag_bytes, sizeof(tag_bytes), buf + sizeof(tag_uint32),
+							sizeof(tag_bytes));
+
+	g_assert(g_obex_apparam_encode(apparam, buf, len - 1) == -ENOBUFS);
 
 	g_obex_apparam_free(apparam);
 }
@@ -423,6 +468,10 @@ int main(int argc, char *argv[])
 						test_apparam_set_bytes);
 	g_test_add_func("/gobex/test_apparam_set_multi",
 						test_apparam_set_multi);
+	g_test_add_func("/gobex/test_apparam_set_replace",
+						test_apparam_set_replace);
+	g_test_add_func("/gobex/test_apparam_set_large",
+						test_apparam_set_large);
 
 	return g_test_run();
 }
@@ -24,8 +24,10 @@
 #include "config.h"
 #endif
 
+#include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
 #include <errno.h>
 
 #include "gobex/gobex.h"
@@ -211,6 +213,86 @@ static void test_encode_on_demand_fail(void)
 	g_obex_packet_free(pkt);
 }
 
+static gssize get_body_fd(int *fd, off_t *offset, gsize len,
+							gpointer user_data)
+{
+	FILE *file = user_data;
+
+	*fd = fileno(file);
+	*offset = 1;
+
+	return 4;
+}
+
+static FILE *create_body_file(void)
+{
+	uint8_t data[] = { 0xff, 1, 2, 3, 4, 0xff };
+	FILE *file;
+
+	file = tmpfile();
+	g_assert(file != NULL);
+
+	g_assert(write(fileno(file), data, sizeof(data)) == sizeof(data));
+
+	return file;
+}
+
+static void test_encode_fd(void)
+{
+	GObexPacket *pkt;
+	uint8_t buf[255];
+	FILE *file;
+	gssize len;
+
+	file = create_body_file();
+
+	pkt = g_obex_packet_new(G_OBEX_OP_PUT, FALSE, G_OBEX_HDR_INVALID);
+	g_obex_packet_add_body_fd(pkt, get_body_fd, file);
+
+	len = g_obex_packet_encode(pkt, buf, sizeof(buf));
+	if (len < 0) {
+		g_printerr("Encoding failed: %s\n", g_strerror(-len));
+		g_assert_not_reached();
+	}
+
+	assert_memequal(pkt_put_body, sizeof(pkt_put_body), buf, len);
+
+	g_obex_packet_free(pkt);
+	fclose(file);
+}
+
+static void test_encode_fd_ref(void)
+{
+	GObexPacket *pkt;
+	uint8_t buf[255];
+	FILE *file;
+	gssize len;
+	gsize fd_len;
+	off_t offset;
+	int fd;
+
+	file = create_body_file();
+
+	pkt = g_obex_packet_new(G_OBEX_OP_PUT, FALSE, G_OBEX_HDR_INVALID);
+	g_obex_packet_add_body_fd(pkt, get_body_fd, file);
+
+	len = g_obex_packet_encode_fd(pkt, buf, sizeof(buf), &fd, &offset,
+								&fd_len);
+	if (len < 0) {
+		g_printerr("Encoding failed: %s\n", g_strerror(-len));
+		g_assert_not_reached();
+	}
+
+	/* Only the header bytes are encoded, the body stays in the file */
+	assert_memequal(pkt_put_body, sizeof(pkt_put_body) - 4, buf, len);
+	g_assert_cmpint(fd, ==, fileno(file));
+	g_assert_cmpint(offset, ==, 1);
+	g_assert_cmpuint(fd_len, ==, 4);
+
+	g_obex_packet_free(pkt);
+	fclose(file);
+}
+
 static void test_create_args(void)
 {
 	GObexPacket *pkt;
@@ -253,6 +335,8 @@ int main(int argc, char *argv[])
 	g_test_add_func("/gobex/test_encode_on_demand", test_encode_on_demand);
 	g_test_add_func("/gobex/test_encode_on_demand_fail",
 						test_encode_on_demand_fail);
+	g_test_add_func("/gobex/test_encode_fd", test_encode_fd);
+	g_test_add_func("/gobex/test_encode_fd_ref", test_encode_fd_ref);
 
 	g_test_add_func("/gobex/test_create_args", test_create_args);
 
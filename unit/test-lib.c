@@ -29,6 +29,9 @@
 #include <glib.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
 #include "src/shared/util.h"
 #include "src/shared/tester.h"
@@ -54,6 +57,52 @@ static void test_hton64(const void *data)
 	tester_test_passed();
 }
 
+static void test_ba2str(const void *data)
+{
+	const bdaddr_t ba = { { 0x0f, 0xa0, 0x5b, 0xc4, 0x37, 0x00 } };
+	char str[18];
+
+	memset(str, 0xff, sizeof(str));
+
+	g_assert(ba2str(&ba, str) == 17);
+	g_assert(strcmp(str, "00:37:C4:5B:A0:0F") == 0);
+	tester_test_passed();
+}
+
+static void test_str2ba(const void *data)
+{
+	static const char *invalid[] = {
+		"",
+		"00:37:C4:5B:A0",
+		"00:37:C4:5B:A0:0",
+		"00:37:C4:5B:A0:0F:",
+		"00:37:C4:5B:A0:0F0",
+		"00-37-C4-5B-A0-0F",
+		"00:37:C4:5B:A0:0G",
+		"0:037:C4:5B:A0:0F",
+		" 0:37:C4:5B:A0:0F",
+		NULL,
+	};
+	const bdaddr_t ba = { { 0x0f, 0xa0, 0x5b, 0xc4, 0x37, 0x00 } };
+	bdaddr_t result;
+	int i;
+
+	g_assert(str2ba("00:37:C4:5B:A0:0F", &result) == 0);
+	g_assert(bacmp(&result, &ba) == 0);
+
+	g_assert(str2ba("00:37:c4:5b:a0:0f", &result) == 0);
+	g_assert(bacmp(&result, &ba) == 0);
+
+	for (i = 0; invalid[i]; i++) {
+		result = ba;
+		g_assert(str2ba(invalid[i], &result) < 0);
+		g_assert(bacmp(&result, BDADDR_ANY) == 0);
+		g_assert(bachk(invalid[i]) < 0);
+	}
+
+	tester_test_passed();
+}
+
 static void test_sdp_get_access_protos_valid(const void *data)
 {
 	sdp_record_t *rec;
@@ -468,12 +517,275 @@ static void test_sdp_get_server_ver(const void *tdata)
 	tester_test_passed();
 }
 
+static sdp_record_t *create_arena_test_record(void)
+{
+	sdp_record_t *rec;
+	sdp_list_t *svclass, *pfseq, *apseq, *proto[2], *root, *aproto;
+	uuid_t root_uuid, svclass_uuid, l2cap_uuid, rfcomm_uuid;
+	sdp_profile_desc_t profile;
+	uint8_t channel = 3;
+	sdp_data_t *chan;
+
+	rec = sdp_record_alloc();
+	rec->handle = 0x10001;
+	sdp_set_record_state(rec, 0x1234);
+
+	sdp_uuid16_create(&root_uuid, PUBLIC_BROWSE_GROUP);
+	root = sdp_list_append(NULL, &root_uuid);
+	sdp_set_browse_groups(rec, root);
+
+	sdp_uuid16_create(&svclass_uuid, SERIAL_PORT_SVCLASS_ID);
+	svclass = sdp_list_append(NULL, &svclass_uuid);
+	sdp_set_service_classes(rec, svclass);
+
+	sdp_uuid16_create(&profile.uuid, SERIAL_PORT_PROFILE_ID);
+	profile.version = 0x0102;
+	pfseq = sdp_list_append(NULL, &profile);
+	sdp_set_profile_descs(rec, pfseq);
+
+	sdp_uuid16_create(&l2cap_uuid, L2CAP_UUID);
+	proto[0] = sdp_list_append(NULL, &l2cap_uuid);
+	apseq = sdp_list_append(NULL, proto[0]);
+
+	sdp_uuid16_create(&rfcomm_uuid, RFCOMM_UUID);
+	proto[1] = sdp_list_append(NULL, &rfcomm_uuid);
+	chan = sdp_data_alloc(SDP_UINT8, &channel);
+	proto[1] = sdp_list_append(proto[1], chan);
+	apseq = sdp_list_append(apseq, proto[1]);
+
+	aproto = sdp_list_append(NULL, apseq);
+	sdp_set_access_protos(rec, aproto);
+
+	sdp_set_info_attr(rec, "Serial Port", "BlueZ", "Arena test record");
+
+	sdp_data_free(chan);
+	sdp_list_free(proto[0], NULL);
+	sdp_list_free(proto[1], NULL);
+	sdp_list_free(apseq, NULL);
+	sdp_list_free(aproto, NULL);
+	sdp_list_free(pfseq, NULL);
+	sdp_list_free(svclass, NULL);
+	sdp_list_free(root, NULL);
+
+	return rec;
+}
+
+static void compare_records(sdp_record_t *rec1, sdp_record_t *rec2)
+{
+	sdp_buf_t buf1, buf2;
+	sdp_list_t *l1, *l2;
+
+	g_assert(rec1->handle == rec2->handle);
+
+	for (l1 = rec1->pattern, l2 = rec2->pattern; l1 && l2;
+					l1 = l1->next, l2 = l2->next)
+		g_assert(sdp_uuid128_cmp(l1->data, l2->data) == 0);
+	g_assert(l1 == NULL && l2 == NULL);
+
+	g_assert(sdp_gen_record_pdu(rec1, &buf1) == 0);
+	g_assert(sdp_gen_record_pdu(rec2, &buf2) == 0);
+	g_assert(buf1.data_size == buf2.data_size);
+	g_assert(memcmp(buf1.data, buf2.data, buf1.data_size) == 0);
+
+	free(buf1.data);
+	free(buf2.data);
+}
+
+static void test_sdp_extract_pdu_arena(const void *tdata)
+{
+	sdp_record_t *rec, *heap, *arena_rec;
+	sdp_list_t *protos;
+	sdp_arena_t *arena;
+	sdp_buf_t pdu;
+	int scanned, i;
+
+	rec = create_arena_test_record();
+	g_assert(sdp_gen_record_pdu(rec, &pdu) == 0);
+
+	heap = sdp_extract_pdu(pdu.data, pdu.data_size, &scanned);
+	g_assert(heap != NULL);
+	g_assert(scanned == (int) pdu.data_size);
+
+	arena = sdp_arena_new();
+	g_assert(arena != NULL);
+
+	/* Reusing the arena must give the very same record every time */
+	for (i = 0; i < 16; i++) {
+		sdp_arena_reset(arena);
+
+		arena_rec = sdp_extract_pdu_arena(arena, pdu.data,
+						pdu.data_size, &scanned);
+		g_assert(arena_rec != NULL);
+		g_assert(scanned == (int) pdu.data_size);
+
+		compare_records(heap, arena_rec);
+	}
+
+	/* The regular accessors work on records stored in the arena */
+	g_assert(sdp_get_access_protos(arena_rec, &protos) == 0);
+	g_assert(sdp_get_proto_port(protos, RFCOMM_UUID) == 3);
+	sdp_list_foreach(protos, (sdp_list_func_t) sdp_list_free, NULL);
+	sdp_list_free(protos, NULL);
+
+	/* Truncated data is handled the same way as for the heap */
+	sdp_record_free(heap);
+	heap = sdp_extract_pdu(pdu.data, pdu.data_size / 2, &scanned);
+	arena_rec = sdp_extract_pdu_arena(arena, pdu.data, pdu.data_size / 2,
+								&scanned);
+	g_assert(heap != NULL && arena_rec != NULL);
+	compare_records(heap, arena_rec);
+
+	sdp_arena_free(arena);
+	sdp_record_free(heap);
+	sdp_record_free(rec);
+	free(pdu.data);
+	tester_test_passed();
+}
+
+struct stream_data {
+	sdp_list_t *recs;
+	int completed;
+	uint16_t status;
+	size_t size;
+};
+
+static void stream_record_cb(sdp_record_t *rec, void *user_data)
+{
+	struct stream_data *data = user_data;
+
+	data->recs = sdp_list_append(data->recs, rec);
+}
+
+static void stream_completed_cb(uint8_t type, uint16_t status, uint8_t *rsp,
+						size_t size, void *user_data)
+{
+	struct stream_data *data = user_data;
+
+	g_assert(type == SDP_SVC_SEARCH_ATTR_RSP);
+
+	data->completed++;
+	data->status = status;
+	data->size = size;
+}
+
+#define STREAM_RECORDS 3
+#define STREAM_FRAGMENT 23
+
+static void test_sdp_search_attr_stream(const void *tdata)
+{
+	uint8_t rsp[STREAM_FRAGMENT + 64], req[SDP_REQ_BUFFER_SIZE];
+	uint8_t attrs[STREAM_RECORDS * 256];
+	struct stream_data data;
+	sdp_record_t *rec;
+	sdp_session_t *session;
+	sdp_list_t *search, *attrids, *l;
+	uint32_t range = 0x0000ffff;
+	size_t len = 3, off = 0;
+	sdp_buf_t pdu;
+	uuid_t uuid;
+	int sv[2], i;
+
+	memset(&data, 0, sizeof(data));
+
+	/* Response attribute lists: SEQ16 of the records */
+	rec = create_arena_test_record();
+	g_assert(sdp_gen_record_pdu(rec, &pdu) == 0);
+	g_assert(pdu.data_size * STREAM_RECORDS + 3 <= sizeof(attrs));
+
+	for (i = 0; i < STREAM_RECORDS; i++) {
+		memcpy(attrs + len, pdu.data, pdu.data_size);
+		len += pdu.data_size;
+	}
+
+	attrs[0] = SDP_SEQ16;
+	bt_put_be16(len - 3, attrs + 1);
+
+	g_assert(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) == 0);
+
+	session = sdp_create(sv[0], 0);
+	g_assert(session != NULL);
+	g_assert(sdp_set_notify(session, stream_completed_cb, &data) == 0);
+	g_assert(sdp_set_record_notify(session, stream_record_cb, &data) == 0);
+
+	sdp_uuid16_create(&uuid, SERIAL_PORT_SVCLASS_ID);
+	search = sdp_list_append(NULL, &uuid);
+	attrids = sdp_list_append(NULL, &range);
+	g_assert(sdp_service_search_attr_async(session, search,
+					SDP_ATTR_REQ_RANGE, attrids) == 0);
+	sdp_list_free(attrids, NULL);
+	sdp_list_free(search, NULL);
+
+	while (off < len) {
+		size_t count = len - off;
+		sdp_pdu_hdr_t *hdr = (sdp_pdu_hdr_t *) rsp;
+		uint8_t *ptr = rsp + sizeof(*hdr);
+		ssize_t n;
+
+		if (count > STREAM_FRAGMENT)
+			count = STREAM_FRAGMENT;
+
+		n = recv(sv[1], req, sizeof(req), 0);
+		g_assert(n >= (ssize_t) sizeof(*hdr));
+
+		hdr->pdu_id = SDP_SVC_SEARCH_ATTR_RSP;
+		hdr->tid = ((sdp_pdu_hdr_t *) req)->tid;
+
+		bt_put_be16(count, ptr);
+		ptr += sizeof(uint16_t);
+		memcpy(ptr, attrs + off, count);
+		ptr += count;
+		off += count;
+
+		/* Continuation state for every but the last fragment */
+		if (off < len) {
+			*ptr++ = sizeof(uint32_t);
+			bt_put_be32(off, ptr);
+			ptr += sizeof(uint32_t);
+		} else
+			*ptr++ = 0;
+
+		hdr->plen = htons(ptr - rsp - sizeof(*hdr));
+		g_assert(send(sv[1], rsp, ptr - rsp, 0) == ptr - rsp);
+
+		sdp_process(session);
+
+		/* Records show up as soon as their last byte arrived */
+		g_assert((int) sdp_list_len(data.recs) ==
+				(int) ((off - 3) / pdu.data_size));
+
+		if (off < len)
+			g_assert(data.completed == 0);
+	}
+
+	g_assert(data.completed == 1);
+	g_assert(data.status == 0);
+	g_assert(data.size == 0);
+
+	for (l = data.recs; l; l = l->next) {
+		sdp_buf_t buf;
+
+		g_assert(sdp_gen_record_pdu(l->data, &buf) == 0);
+		g_assert(buf.data_size == pdu.data_size);
+		g_assert(memcmp(buf.data, pdu.data, buf.data_size) == 0);
+		free(buf.data);
+	}
+
+	sdp_list_free(data.recs, (sdp_free_func_t) sdp_record_free);
+	sdp_close(session);
+	close(sv[1]);
+	sdp_record_free(rec);
+	free(pdu.data);
+	tester_test_passed();
+}
+
 int main(int argc, char *argv[])
 {
 	tester_init(&argc, &argv);
 
 	tester_add("/lib/ntoh64", NULL, NULL, test_ntoh64, NULL);
 	tester_add("/lib/hton64", NULL, NULL, test_hton64, NULL);
+	tester_add("/lib/ba2str", NULL, NULL, test_ba2str, NULL);
+	tester_add("/lib/str2ba", NULL, NULL, test_str2ba, NULL);
 
 	tester_add("/lib/sdp_get_access_protos/valid", NULL, NULL,
 				test_sdp_get_access_protos_valid, NULL);
@@ -504,5 +816,10 @@ int main(int argc, char *argv[])
 	tester_add("/lib/sdp_get_server_ver", NULL, NULL,
 					test_sdp_get_server_ver, NULL);
 
+	tester_add("/lib/sdp_extract_pdu_arena", NULL, NULL,
+					test_sdp_extract_pdu_arena, NULL);
+	tester_add("/lib/sdp_search_attr_stream", NULL, NULL,
+					test_sdp_search_attr_stream, NULL);
+
 	return tester_run();
 }
@@ -26,6 +26,7 @@
 #endif
 
 #include <stdbool.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
 
@@ -256,6 +257,19 @@ static const struct command_test_data command_test_3 = {
 	.rsp_status = MGMT_STATUS_INVALID_INDEX,
 };
 
+static const unsigned char set_powered_param[] = { 0x01 };
+static const unsigned char set_powered_command[] =
+				{ 0x05, 0x00, 0x00, 0x00, 0x01, 0x00, 0x01 };
+
+static const struct command_test_data command_test_4 = {
+	.opcode = MGMT_OP_SET_POWERED,
+	.index = 0,
+	.length = sizeof(set_powered_param),
+	.param = set_powered_param,
+	.cmd_data = set_powered_command,
+	.cmd_size = sizeof(set_powered_command),
+};
+
 static const unsigned char event_index_added[] =
 				{ 0x04, 0x00, 0x01, 0x00, 0x00, 0x00 };
 
@@ -429,6 +443,80 @@ static void test_destroy(gconstpointer data)
 	execute_context(context);
 }
 
+static void test_pipeline(gconstpointer data)
+{
+	struct context *context = create_context();
+
+	/* The first command never completes, the second one is still sent */
+	add_action(context, command_test_2.cmd_data, command_test_2.cmd_size,
+					NULL, 0, 0, false, ACTION_IGNORE);
+	add_action(context, command_test_1.cmd_data, command_test_1.cmd_size,
+					NULL, 0, 0, false, ACTION_PASSED);
+
+	g_assert(mgmt_set_max_pending(context->mgmt_client, 2));
+
+	mgmt_send(context->mgmt_client, command_test_2.opcode,
+					command_test_2.index, 0, NULL,
+					NULL, NULL, NULL);
+	mgmt_send(context->mgmt_client, command_test_1.opcode,
+					command_test_1.index, 0, NULL,
+					NULL, NULL, NULL);
+
+	execute_context(context);
+}
+
+static void bulk_cb(uint8_t status, uint16_t length, const void *param,
+							void *user_data)
+{
+	struct context *context = user_data;
+
+	g_assert_cmpint(status, ==, MGMT_STATUS_SUCCESS);
+	g_assert_cmpint(length, ==, 0);
+
+	context_quit(context);
+}
+
+static void test_bulk(gconstpointer data)
+{
+	const struct command_test_data *test = data;
+	struct context *context = create_context();
+	struct mgmt_bulk_request requests[] = {
+		{ .opcode = test->opcode },
+		{ .opcode = test->opcode },
+	};
+
+	add_action(context, test->cmd_data, test->cmd_size,
+			test->rsp_data, test->rsp_size, test->rsp_status,
+			false, ACTION_RESPOND);
+
+	g_assert(mgmt_send_bulk(context->mgmt_client, test->index, requests,
+					G_N_ELEMENTS(requests), bulk_cb,
+					context, NULL));
+
+	execute_context(context);
+}
+
+static void test_buf(gconstpointer data)
+{
+	const struct command_test_data *test = data;
+	struct context *context = create_context();
+	void *param;
+
+	add_action(context, test->cmd_data, test->cmd_size,
+			test->rsp_data, test->rsp_size, test->rsp_status,
+			false, ACTION_PASSED);
+
+	param = mgmt_buf_new(test->length);
+	g_assert(param);
+	memcpy(param, test->param, test->length);
+
+	g_assert(mgmt_send_buf(context->mgmt_client, test->opcode,
+					test->index, test->length, param,
+					NULL, NULL, NULL));
+
+	execute_context(context);
+}
+
 int main(int argc, char *argv[])
 {
 	g_test_init(&argc, &argv, NULL);
@@ -441,6 +529,12 @@ int main(int argc, char *argv[])
 	g_test_add_data_func("/mgmt/response/2", &command_test_3,
 								test_response);
 
+	g_test_add_data_func("/mgmt/pipeline/1", NULL, test_pipeline);
+
+	g_test_add_data_func("/mgmt/bulk/1", &command_test_1, test_bulk);
+
+	g_test_add_data_func("/mgmt/buf/1", &command_test_4, test_buf);
+
 	g_test_add_data_func("/mgmt/event/1", &event_test_1, test_event);
 	g_test_add_data_func("/mgmt/event/2", &event_test_1, test_event2);
 
@@ -49,6 +49,7 @@ struct midi_read_test {
 	size_t ble_packet_size;
 	const snd_seq_event_t *event;
 	size_t event_size;
+	const int64_t *event_time; /* ms relative to the first event */
 };
 
 #define BLE_READ_TEST_INIT(_ble_packet, _event) \
@@ -59,6 +60,15 @@ struct midi_read_test {
 		.event_size = G_N_ELEMENTS(_event), \
 	}
 
+#define BLE_READ_TEST_INIT_TIME(_ble_packet, _event, _time) \
+	{ \
+		.ble_packet = (_ble_packet), \
+		.ble_packet_size = G_N_ELEMENTS(_ble_packet), \
+		.event = (_event), \
+		.event_size = G_N_ELEMENTS(_event), \
+		.event_time = (_time), \
+	}
+
 struct midi_write_test {
 	const snd_seq_event_t *event;
 	size_t event_size;
@@ -248,6 +258,35 @@ static const snd_seq_event_t event2[] = {
 
 static const struct midi_read_test midi2 = BLE_READ_TEST_INIT(packet2, event2);
 
+/* Timestamps rolling over timestampLow and the 13-bit timestamp range */
+static const uint8_t packet6_1[] = {
+	0xbf, 0xfe, 0x90, 0x40, 0x7f, 0xff, 0x41, 0x7f,
+	0x80, 0x42, 0x7f, 0x81, 0x43, 0x7f
+};
+
+static const uint8_t packet6_2[] = {
+	0x80, 0x85, 0x80, 0x40, 0x00
+};
+
+static const struct ble_midi_packet packet6[] = {
+	BLE_MIDI_PACKET_INIT(packet6_1),
+	BLE_MIDI_PACKET_INIT(packet6_2),
+};
+
+static const snd_seq_event_t event6[] = {
+	NOTE_EVENT(NOTEON, 0, 64, 127),     /* Note On at 8190 */
+	NOTE_EVENT(NOTEON, 0, 65, 127),     /* Note On at 8191 */
+	NOTE_EVENT(NOTEON, 0, 66, 127),     /* Note On at 0 */
+	NOTE_EVENT(NOTEON, 0, 67, 127),     /* Note On at 1 */
+	NOTE_EVENT(NOTEOFF, 0, 64, 0),      /* Note Off at 5 */
+};
+
+static const int64_t event6_time[] = { 0, 1, 2, 3, 7 };
+
+static const struct midi_read_test midi6 = BLE_READ_TEST_INIT_TIME(packet6,
+                                                                   event6,
+                                                                   event6_time);
+
 static void compare_events(const snd_seq_event_t *ev1,
                            const snd_seq_event_t *ev2)
 {
@@ -303,6 +342,7 @@ static void test_midi_reader(gconstpointer data)
 	size_t i; /* ble_packet counter */
 	size_t j; /* ble_packet length counter */
 	size_t k = 0; /* event counter */
+	int64_t time_first = -1;
 
 	err = midi_read_init(&midi);
 	g_assert_cmpint(err, ==, 0);
@@ -334,6 +374,18 @@ static void test_midi_reader(gconstpointer data)
 
 			compare_events(ev_expect, &ev);
 
+			if (midi_test->event_time) {
+				int64_t time = ev.time.time.tv_sec * 1000 +
+				               ev.time.time.tv_nsec / 1000000;
+
+				if (time_first < 0)
+					time_first = time;
+
+				g_assert_cmpint(time - time_first,
+				                ==,
+				                midi_test->event_time[k - 1]);
+			}
+
 		_continue_loop:
 			j += count;
 		}
@@ -344,6 +396,64 @@ static void test_midi_reader(gconstpointer data)
 	tester_test_passed();
 }
 
+/* Dense stream of running status Note On messages filling a 247 bytes MTU */
+#define BENCH_PACKET_SIZE 244
+#define BENCH_PACKET_EVENTS ((BENCH_PACKET_SIZE - 2) / 3)
+
+static uint8_t bench_packet[BENCH_PACKET_SIZE];
+static size_t bench_packet_len;
+
+static void setup_bench(const void *data)
+{
+	size_t i = 0;
+	int n;
+
+	bench_packet[i++] = 0x80;
+
+	for (n = 0; n < BENCH_PACKET_EVENTS; n++) {
+		bench_packet[i++] = 0x80 | (n & 0x7f);
+		if (n == 0)
+			bench_packet[i++] = 0x90;
+		bench_packet[i++] = n & 0x7f;
+		bench_packet[i++] = 0x7f;
+	}
+
+	g_assert_cmpint(i, <=, BENCH_PACKET_SIZE);
+	bench_packet_len = i;
+
+	tester_setup_complete();
+}
+
+static void bench_midi_reader(const void *data, unsigned int count)
+{
+	struct midi_read_parser midi;
+	snd_seq_event_t ev;
+	unsigned int n;
+
+	snd_seq_ev_clear(&ev);
+
+	g_assert_cmpint(midi_read_init(&midi), ==, 0);
+
+	for (n = 0; n < count; n++) {
+		size_t events = 0;
+		size_t i = 0;
+
+		midi_read_reset(&midi);
+
+		while (i < bench_packet_len) {
+			i += midi_read_raw(&midi, bench_packet + i,
+			                   bench_packet_len - i, &ev);
+
+			if (ev.type != SND_SEQ_EVENT_NONE)
+				events++;
+		}
+
+		g_assert_cmpuint(events, ==, BENCH_PACKET_EVENTS);
+	}
+
+	midi_read_free(&midi);
+}
+
 static const snd_seq_event_t event3[] = {
 	CONTROL_EVENT(PITCHBEND, 8, 0, 0),    /* Pitch Bend */
 	CONTROL_EVENT(CONTROLLER, 8, 63, 74), /* Control Change */
@@ -539,6 +649,18 @@ static const snd_seq_event_t event5_expect[] = {
 
 static const struct midi_write_test midi5 = BLE_WRITE_TEST_INIT(event5, event5_expect);
 
+/* Running status across channels needs a status byte, and a timestamp */
+static const snd_seq_event_t event7[] = {
+	NOTE_EVENT(NOTEON, 0, 60, 100),       /* Note On */
+	NOTE_EVENT(NOTEON, 1, 64, 100),       /* Note On, other channel */
+	NOTE_EVENT(NOTEON, 1, 67, 100),       /* Note On, running status */
+	NOTE_EVENT(NOTEON, 0, 72, 100),       /* Note On, back to channel 0 */
+	CONTROL_EVENT(CONTROLLER, 0, 1, 7),   /* Control Change */
+	CONTROL_EVENT(CONTROLLER, 0, 2, 7),   /* Control Change */
+};
+
+static const struct midi_write_test midi7 = BLE_WRITE_TEST_INIT_BASIC(event7);
+
 static void test_midi_writer(gconstpointer data)
 {
 	const struct midi_write_test *midi_test = data;
@@ -622,12 +744,18 @@ int main(int argc, char *argv[])
 	           &midi1, NULL, test_midi_reader, NULL);
 	tester_add("Raw BLE packets SysEx read",
 	           &midi2, NULL, test_midi_reader, NULL);
+	tester_add("Raw BLE packets timestamp rollover read",
+	           &midi6, NULL, test_midi_reader, NULL);
 	tester_add("ALSA Seq events to Raw BLE packets",
 	           &midi3, NULL, test_midi_writer, NULL);
 	tester_add("ALSA SysEx events to Raw BLE packets",
 	           &midi4, NULL, test_midi_writer, NULL);
 	tester_add("Split ALSA SysEx events to raw BLE packets",
 	           &midi5, NULL, test_midi_writer, NULL);
+	tester_add("ALSA Seq events on several channels to Raw BLE packets",
+	           &midi7, NULL, test_midi_writer, NULL);
+	tester_add_bench("Raw BLE packets read throughput",
+	                 NULL, setup_bench, bench_midi_reader, NULL);
 
 	return tester_run();
 }
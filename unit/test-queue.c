@@ -148,6 +148,34 @@ static void test_foreach_remove_backward(const void *data)
 	tester_test_passed();
 }
 
+static void foreach_remove_next(void *data, void *user_data)
+{
+	struct queue *queue = user_data;
+
+	g_assert(data != NULL);
+
+	if (PTR_TO_UINT(data) == 1)
+		g_assert(queue_remove(queue, UINT_TO_PTR(2)));
+}
+
+static void test_foreach_remove_next(const void *data)
+{
+	struct queue *queue;
+
+	queue = queue_new();
+	g_assert(queue != NULL);
+
+	queue_push_tail(queue, UINT_TO_PTR(1));
+	queue_push_tail(queue, UINT_TO_PTR(2));
+	queue_push_tail(queue, UINT_TO_PTR(3));
+
+	queue_foreach(queue, foreach_remove_next, queue);
+	g_assert(queue_length(queue) == 2);
+
+	queue_destroy(queue, NULL);
+	tester_test_passed();
+}
+
 static struct queue *static_queue;
 
 static void destroy_remove(void *user_data)
@@ -259,6 +287,75 @@ static void test_remove_all(const void *data)
 	tester_test_passed();
 }
 
+static void test_alloc_stats(const void *data)
+{
+	struct queue_alloc_stats before, after;
+	struct queue *queue;
+	unsigned int n, i;
+
+	queue_get_alloc_stats(&before);
+
+	queue = queue_new();
+	g_assert(queue != NULL);
+
+	for (n = 0; n < 16; n++) {
+		for (i = 0; i < 1000; i++)
+			g_assert(queue_push_tail(queue, UINT_TO_PTR(i)));
+
+		while (!queue_isempty(queue))
+			queue_pop_head(queue);
+	}
+
+	queue_destroy(queue, NULL);
+
+	queue_get_alloc_stats(&after);
+
+	g_assert(after.allocs - before.allocs == 16 * 1000);
+	g_assert(after.frees - before.frees == 16 * 1000);
+	g_assert(after.in_use == before.in_use);
+
+	/* Entries are recycled, so only the peak usage needs slabs */
+	g_assert(after.slabs - before.slabs <= 1000 / 64 + 1);
+
+	tester_test_passed();
+}
+
+static void bench_push_pop(const void *data, unsigned int count)
+{
+	struct queue *queue;
+	unsigned int i;
+
+	queue = queue_new();
+
+	for (i = 0; i < count; i++)
+		queue_push_tail(queue, UINT_TO_PTR(i + 1));
+
+	for (i = 0; i < count; i++)
+		queue_pop_head(queue);
+
+	queue_destroy(queue, NULL);
+}
+
+#define BENCH_QUEUE_LEN 64
+
+static void bench_find(const void *data, unsigned int count)
+{
+	struct queue *queue;
+	unsigned int i;
+
+	queue = queue_new();
+
+	for (i = 0; i < BENCH_QUEUE_LEN; i++)
+		queue_push_tail(queue, UINT_TO_PTR(i + 1));
+
+	/* Look up entries spread over the whole queue */
+	for (i = 0; i < count; i++)
+		g_assert(queue_find(queue, NULL,
+				UINT_TO_PTR(i % BENCH_QUEUE_LEN + 1)));
+
+	queue_destroy(queue, NULL);
+}
+
 int main(int argc, char *argv[])
 {
 	tester_init(&argc, &argv);
@@ -272,10 +369,17 @@ int main(int argc, char *argv[])
 						test_foreach_remove_all, NULL);
 	tester_add("/queue/foreach_remove_backward", NULL, NULL,
 					test_foreach_remove_backward, NULL);
+	tester_add("/queue/foreach_remove_next", NULL, NULL,
+					test_foreach_remove_next, NULL);
 	tester_add("/queue/destroy_remove",  NULL, NULL,
 						test_destroy_remove, NULL);
 	tester_add("/queue/push_after",  NULL, NULL, test_push_after, NULL);
 	tester_add("/queue/remove_all",  NULL, NULL, test_remove_all, NULL);
+	tester_add("/queue/alloc_stats",  NULL, NULL, test_alloc_stats, NULL);
+
+	tester_add_bench("/queue/bench/push_pop", NULL, NULL,
+						bench_push_pop, NULL);
+	tester_add_bench("/queue/bench/find", NULL, NULL, bench_find, NULL);
 
 	return tester_run();
 }
@@ -145,6 +145,94 @@ static void test_printf(const void *data)
 	tester_test_passed();
 }
 
+static void test_mirrored(const void *data)
+{
+	struct ringbuf *rb;
+	size_t capa, len;
+	char *str, *ptr;
+	int i;
+
+	rb = ringbuf_new_mirrored(4096);
+	if (!rb) {
+		tester_test_abort();
+		return;
+	}
+
+	g_assert(ringbuf_is_mirrored(rb));
+
+	capa = ringbuf_capacity(rb);
+	g_assert(ringbuf_avail(rb) == capa);
+
+	/* Leave some data behind to make the next write wrap around */
+	len = ringbuf_printf(rb, "%*c", (int) (capa - 10), 'x');
+	g_assert(len == capa - 10);
+	g_assert(ringbuf_drain(rb, capa - 20) == capa - 20);
+
+	for (i = 0; i < 5; i++) {
+		len = ringbuf_printf(rb, "%*c", (int) (capa / 2), 'y');
+		g_assert(len == capa / 2);
+
+		len = asprintf(&str, "%*c%*c", 10, i ? 'y' : 'x',
+						(int) (capa / 2), 'y');
+		g_assert(len == capa / 2 + 10);
+
+		/* The whole readable span is contiguous */
+		ptr = ringbuf_peek(rb, 0, &len);
+		g_assert(ptr != NULL);
+		g_assert(len == ringbuf_len(rb));
+		g_assert(len == capa / 2 + 10);
+		g_assert(memcmp(ptr, str, len) == 0);
+
+		g_assert(ringbuf_drain(rb, capa / 2) == capa / 2);
+
+		free(str);
+	}
+
+	ringbuf_free(rb);
+	tester_test_passed();
+}
+
+static void bench_printf(const void *data, unsigned int count)
+{
+	struct ringbuf *rb;
+	unsigned int i;
+	int len;
+
+	rb = ringbuf_new(4096);
+	g_assert(rb != NULL);
+
+	for (i = 0; i < count; i++) {
+		len = ringbuf_printf(rb, "%s %u", "Bluetooth", i);
+		g_assert(len > 0);
+		g_assert(ringbuf_drain(rb, len) == (size_t) len);
+	}
+
+	ringbuf_free(rb);
+}
+
+static void bench_peek_drain(const void *data, unsigned int count)
+{
+	static const char str[] = "0123456789abcdefghijklmnopqrstuv";
+	struct ringbuf *rb;
+	unsigned int i;
+	size_t len;
+
+	rb = ringbuf_new_mirrored(4096);
+	if (!rb)
+		rb = ringbuf_new(4096);
+	g_assert(rb != NULL);
+
+	/* Short writes make the readable span wrap around regularly */
+	for (i = 0; i < count; i++) {
+		g_assert(ringbuf_printf(rb, "%s", str) == sizeof(str) - 1);
+		g_assert(ringbuf_peek(rb, 0, &len) != NULL);
+		g_assert(ringbuf_drain(rb, sizeof(str) - 1) ==
+							sizeof(str) - 1);
+	}
+
+	ringbuf_free(rb);
+}
+
 int main(int argc, char *argv[])
 {
 	tester_init(&argc, &argv);
@@ -152,6 +240,12 @@ int main(int argc, char *argv[])
 	tester_add("/ringbuf/power2", NULL, NULL, test_power2, NULL);
 	tester_add("/ringbuf/alloc", NULL, NULL, test_alloc, NULL);
 	tester_add("/ringbuf/printf", NULL, NULL, test_printf, NULL);
+	tester_add("/ringbuf/mirrored", NULL, NULL, test_mirrored, NULL);
+
+	tester_add_bench("/ringbuf/bench/printf", NULL, NULL,
+						bench_printf, NULL);
+	tester_add_bench("/ringbuf/bench/peek_drain", NULL, NULL,
+						bench_peek_drain, NULL);
 
 	return tester_run();
 }
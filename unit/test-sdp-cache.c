@@ -0,0 +1,230 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "lib/bluetooth.h"
+#include "lib/sdp.h"
+#include "lib/sdp_lib.h"
+#include "src/shared/util.h"
+#include "src/shared/tester.h"
+#include "src/sdp-cache.h"
+
+static const char test_pathname[] = "/tmp/sdp-cache";
+
+static sdp_record_t *create_record(uint32_t handle, uint16_t class,
+							uint16_t version)
+{
+	sdp_list_t *classes;
+	sdp_record_t *rec;
+	uuid_t uuid;
+
+	rec = sdp_record_alloc();
+	g_assert(rec);
+
+	rec->handle = handle;
+	sdp_attr_add_new(rec, SDP_ATTR_RECORD_HANDLE, SDP_UINT32, &handle);
+
+	sdp_uuid16_create(&uuid, class);
+	classes = sdp_list_append(NULL, &uuid);
+	g_assert(sdp_set_service_classes(rec, classes) == 0);
+	sdp_list_free(classes, NULL);
+
+	sdp_attr_add_new(rec, SDP_ATTR_VERSION, SDP_UINT16, &version);
+
+	return rec;
+}
+
+static struct sdp_cache *create_cache(void)
+{
+	struct sdp_cache *cache;
+	sdp_record_t *rec;
+
+	cache = sdp_cache_new();
+
+	rec = create_record(0x10000, SERIAL_PORT_SVCLASS_ID, 0x0100);
+	g_assert(sdp_cache_add_record(cache, rec));
+	sdp_record_free(rec);
+
+	rec = create_record(0x10001, HANDSFREE_SVCLASS_ID, 0x0107);
+	g_assert(sdp_cache_add_record(cache, rec));
+	sdp_record_free(rec);
+
+	rec = create_record(0x10002, PNP_INFO_SVCLASS_ID, 0x0103);
+	g_assert(sdp_cache_add_record(cache, rec));
+	sdp_record_free(rec);
+
+	return cache;
+}
+
+static void check_record(struct sdp_cache *cache, uint16_t class,
+					uint32_t handle, uint16_t version)
+{
+	const sdp_record_t *rec;
+	sdp_data_t *data;
+	uuid_t uuid;
+
+	sdp_uuid16_create(&uuid, class);
+
+	rec = sdp_cache_find(cache, &uuid);
+	g_assert(rec);
+	g_assert(rec->handle == handle);
+
+	data = sdp_data_get(rec, SDP_ATTR_VERSION);
+	g_assert(data);
+	g_assert(data->val.uint16 == version);
+
+	/* The parsed record is kept for later lookups */
+	g_assert(sdp_cache_find(cache, &uuid) == rec);
+}
+
+static void test_roundtrip(const void *test_data)
+{
+	struct sdp_cache *cache;
+	uuid_t uuid, uuid128;
+
+	cache = create_cache();
+	g_assert(sdp_cache_save(cache, test_pathname));
+	sdp_cache_free(cache);
+
+	cache = sdp_cache_load(test_pathname);
+	g_assert(cache);
+	g_assert(sdp_cache_count(cache) == 3);
+
+	check_record(cache, HANDSFREE_SVCLASS_ID, 0x10001, 0x0107);
+	check_record(cache, SERIAL_PORT_SVCLASS_ID, 0x10000, 0x0100);
+	check_record(cache, PNP_INFO_SVCLASS_ID, 0x10002, 0x0103);
+
+	/* Full 128 bit UUIDs match the short class of the record */
+	sdp_uuid16_create(&uuid, HANDSFREE_SVCLASS_ID);
+	sdp_uuid16_to_uuid128(&uuid128, &uuid);
+	g_assert(sdp_cache_find(cache, &uuid128));
+
+	sdp_uuid16_create(&uuid, AUDIO_SINK_SVCLASS_ID);
+	g_assert(!sdp_cache_find(cache, &uuid));
+
+	sdp_cache_free(cache);
+
+	unlink(test_pathname);
+
+	tester_test_passed();
+}
+
+static void test_replace(const void *test_data)
+{
+	struct sdp_cache *cache;
+	const sdp_record_t *found;
+	sdp_record_t *rec;
+	uuid_t uuid;
+
+	cache = create_cache();
+
+	sdp_uuid16_create(&uuid, HANDSFREE_SVCLASS_ID);
+	found = sdp_cache_find(cache, &uuid);
+	g_assert(found);
+
+	/* An identical record keeps the parsed one */
+	rec = create_record(0x10001, HANDSFREE_SVCLASS_ID, 0x0107);
+	g_assert(sdp_cache_add_record(cache, rec));
+	sdp_record_free(rec);
+
+	g_assert(sdp_cache_find(cache, &uuid) == found);
+
+	rec = create_record(0x10001, HANDSFREE_SVCLASS_ID, 0x0108);
+	g_assert(sdp_cache_add_record(cache, rec));
+	sdp_record_free(rec);
+
+	g_assert(sdp_cache_count(cache) == 3);
+	check_record(cache, HANDSFREE_SVCLASS_ID, 0x10001, 0x0108);
+
+	sdp_cache_free(cache);
+
+	tester_test_passed();
+}
+
+static void test_corrupted(const void *test_data)
+{
+	struct sdp_cache *cache;
+	off_t size;
+	int fd;
+
+	cache = create_cache();
+	g_assert(sdp_cache_save(cache, test_pathname));
+	sdp_cache_free(cache);
+
+	fd = open(test_pathname, O_RDWR);
+	g_assert(fd >= 0);
+
+	size = lseek(fd, 0, SEEK_END);
+	g_assert(size > 0);
+	g_assert(ftruncate(fd, size - 1) == 0);
+	close(fd);
+
+	g_assert(!sdp_cache_load(test_pathname));
+
+	unlink(test_pathname);
+
+	tester_test_passed();
+}
+
+static void test_version(const void *test_data)
+{
+	struct sdp_cache *cache;
+	uint8_t version = 0xff;
+	int fd;
+
+	cache = create_cache();
+	g_assert(sdp_cache_save(cache, test_pathname));
+	sdp_cache_free(cache);
+
+	fd = open(test_pathname, O_RDWR);
+	g_assert(fd >= 0);
+	g_assert(pwrite(fd, &version, 1, 8) == 1);
+	close(fd);
+
+	g_assert(!sdp_cache_load(test_pathname));
+
+	unlink(test_pathname);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/sdp-cache/roundtrip", NULL, NULL, test_roundtrip, NULL);
+	tester_add("/sdp-cache/replace", NULL, NULL, test_replace, NULL);
+	tester_add("/sdp-cache/corrupted", NULL, NULL, test_corrupted, NULL);
+	tester_add("/sdp-cache/version", NULL, NULL, test_version, NULL);
+
+	return tester_run();
+}
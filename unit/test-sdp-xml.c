@@ -0,0 +1,259 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "lib/sdp.h"
+#include "lib/sdp_lib.h"
+#include "src/shared/util.h"
+#include "src/shared/tester.h"
+#include "src/sdp-xml.h"
+
+static const char hfp_record[] =
+	"<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n"
+	"<!-- Hands-Free unit -->\n"
+	"<record>\n"
+	"  <attribute id=\"0x0001\">\n"
+	"    <sequence>\n"
+	"      <uuid value=\"0x111e\" />\n"
+	"      <uuid value='0x1203'/>\n"
+	"    </sequence>\n"
+	"  </attribute>\n"
+	"  <attribute id=\"0x0004\">\n"
+	"    <sequence>\n"
+	"      <sequence><uuid value=\"0x0100\" /></sequence>\n"
+	"      <sequence>\n"
+	"        <uuid value=\"0x0003\" />\n"
+	"        <uint8 value=\"0x07\" />\n"
+	"      </sequence>\n"
+	"    </sequence>\n"
+	"  </attribute>\n"
+	"  <attribute id=\"0x0100\">\n"
+	"    <text value=\"Hands &amp; &#x46;ree &lt;1&gt;\" />\n"
+	"  </attribute>\n"
+	"  <attribute id=\"0x0101\">\n"
+	"    <text encoding=\"hex\" value=\"0001ff\" />\n"
+	"  </attribute>\n"
+	"  <attribute id=\"0x0311\">\n"
+	"    <uint16 value=\"0x003f\" />\n"
+	"  </attribute>\n"
+	"</record>\n";
+
+static const char hfp_xml[] =
+	"<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n\n"
+	"<record>\n"
+	"\t<attribute id=\"0x0001\">\n"
+	"\t\t<sequence>\n"
+	"\t\t\t<uuid value=\"0x111e\" />\n"
+	"\t\t\t<uuid value=\"0x1203\" />\n"
+	"\t\t</sequence>\n"
+	"\t</attribute>\n"
+	"\t<attribute id=\"0x0004\">\n"
+	"\t\t<sequence>\n"
+	"\t\t\t<sequence>\n"
+	"\t\t\t\t<uuid value=\"0x0100\" />\n"
+	"\t\t\t</sequence>\n"
+	"\t\t\t<sequence>\n"
+	"\t\t\t\t<uuid value=\"0x0003\" />\n"
+	"\t\t\t\t<uint8 value=\"0x07\" />\n"
+	"\t\t\t</sequence>\n"
+	"\t\t</sequence>\n"
+	"\t</attribute>\n"
+	"\t<attribute id=\"0x0100\">\n"
+	"\t\t<text value=\"Hands &amp; Free &lt;1&gt;\" />\n"
+	"\t</attribute>\n"
+	"\t<attribute id=\"0x0101\">\n"
+	"\t\t<text encoding=\"hex\" value=\"0001ff\" />\n"
+	"\t</attribute>\n"
+	"\t<attribute id=\"0x0311\">\n"
+	"\t\t<uint16 value=\"0x003f\" />\n"
+	"\t</attribute>\n"
+	"</record>\n";
+
+static sdp_record_t *parse_record(const char *xml)
+{
+	return sdp_xml_parse_record(xml, strlen(xml));
+}
+
+static void check_text(const sdp_data_t *data, const char *str, int len)
+{
+	g_assert(data);
+	g_assert(data->unitSize - 1 == len);
+	g_assert(!memcmp(data->val.str, str, len));
+}
+
+static void test_parse(const void *test_data)
+{
+	sdp_record_t *rec;
+	sdp_data_t *data;
+	uuid_t uuid;
+
+	rec = parse_record(hfp_record);
+	g_assert(rec);
+
+	data = sdp_data_get(rec, SDP_ATTR_SVCLASS_ID_LIST);
+	g_assert(data);
+	g_assert(data->dtd == SDP_SEQ8);
+	g_assert(data->val.dataseq->val.uuid.value.uuid16 == 0x111e);
+	g_assert(data->val.dataseq->next->val.uuid.value.uuid16 == 0x1203);
+	g_assert(!data->val.dataseq->next->next);
+
+	data = sdp_data_get(rec, SDP_ATTR_PROTO_DESC_LIST);
+	g_assert(data);
+	data = data->val.dataseq->next->val.dataseq->next;
+	g_assert(data->dtd == SDP_UINT8);
+	g_assert(data->val.uint8 == 0x07);
+
+	data = sdp_data_get(rec, SDP_ATTR_SVCNAME_PRIMARY);
+	check_text(data, "Hands & Free <1>", 16);
+	g_assert(data->dtd == SDP_TEXT_STR8);
+
+	data = sdp_data_get(rec, SDP_ATTR_SVCDESC_PRIMARY);
+	check_text(data, "\x00\x01\xff", 3);
+
+	data = sdp_data_get(rec, SDP_ATTR_SUPPORTED_FEATURES);
+	g_assert(data);
+	g_assert(data->val.uint16 == 0x003f);
+
+	/* UUIDs are added to the search pattern */
+	sdp_uuid16_create(&uuid, HANDSFREE_SVCLASS_ID);
+	g_assert(sdp_list_find(rec->pattern, &uuid, sdp_uuid_cmp));
+
+	sdp_record_free(rec);
+
+	tester_test_passed();
+}
+
+static void test_format(const void *test_data)
+{
+	sdp_record_t *rec;
+	char buf[2048];
+	int len;
+
+	rec = parse_record(hfp_record);
+	g_assert(rec);
+
+	len = sdp_xml_format_record(rec, buf, sizeof(buf));
+	g_assert(len == (int) strlen(hfp_xml));
+	g_assert(!strcmp(buf, hfp_xml));
+
+	/* Output is truncated like snprintf */
+	len = sdp_xml_format_record(rec, buf, 10);
+	g_assert(len == (int) strlen(hfp_xml));
+	g_assert(strlen(buf) == 9);
+	g_assert(!strncmp(buf, hfp_xml, 9));
+
+	g_assert(sdp_xml_format_record(rec, NULL, 0) == len);
+
+	sdp_record_free(rec);
+
+	tester_test_passed();
+}
+
+static void append_cb(void *data, const char *str)
+{
+	GString *string = data;
+
+	g_assert(strlen(str) > 0);
+	g_string_append(string, str);
+}
+
+static void test_convert(const void *test_data)
+{
+	sdp_record_t *rec;
+	GString *string;
+	char *text;
+	int i;
+
+	rec = sdp_record_alloc();
+	g_assert(rec);
+
+	/* Long enough to need several chunks */
+	text = g_malloc0(3000);
+	for (i = 0; i < 2999; i++)
+		text[i] = 'a' + i % 26;
+
+	sdp_attr_add_new(rec, SDP_ATTR_SVCNAME_PRIMARY, SDP_TEXT_STR16, text);
+
+	string = g_string_new(NULL);
+	convert_sdp_record_to_xml(rec, string, append_cb);
+	g_assert(strstr(string->str, text));
+
+	sdp_record_free(rec);
+
+	rec = parse_record(string->str);
+	g_assert(rec);
+	check_text(sdp_data_get(rec, SDP_ATTR_SVCNAME_PRIMARY), text, 2999);
+	sdp_record_free(rec);
+
+	g_string_free(string, TRUE);
+	g_free(text);
+
+	tester_test_passed();
+}
+
+static void test_invalid(const void *test_data)
+{
+	sdp_record_t *rec;
+
+	g_assert(!parse_record("<record><attribute id=\"0x0100\">"
+					"</record></attribute>"));
+	g_assert(!parse_record("<record><attribute id=\"0x0100\">"
+					"<text value=\"&bogus;\" />"
+					"</attribute></record>"));
+	g_assert(!parse_record("<record><attribute id=\"0x0100\">"
+					"<text value=\"a\" /></attribute>"));
+	g_assert(!parse_record("<record><attribute id=0x0100>"
+					"</attribute></record>"));
+
+	/* Values that can't be parsed are skipped */
+	rec = parse_record("<record><attribute id=\"0x0100\">"
+				"<text encoding=\"hex\" value=\"zz\" />"
+				"</attribute><attribute id=\"0x0101\">"
+				"<uint8 value=\"0x01\" />"
+				"</attribute></record>");
+	g_assert(rec);
+	g_assert(!sdp_data_get(rec, SDP_ATTR_SVCNAME_PRIMARY));
+	g_assert(sdp_data_get(rec, SDP_ATTR_SVCDESC_PRIMARY));
+	sdp_record_free(rec);
+
+	tester_test_passed();
+}
+
+int main(int argc, char *argv[])
+{
+	tester_init(&argc, &argv);
+
+	tester_add("/sdp-xml/parse", NULL, NULL, test_parse, NULL);
+	tester_add("/sdp-xml/format", NULL, NULL, test_format, NULL);
+	tester_add("/sdp-xml/convert", NULL, NULL, test_convert, NULL);
+	tester_add("/sdp-xml/invalid", NULL, NULL, test_invalid, NULL);
+
+	return tester_run();
+}
@@ -276,20 +276,13 @@ static void update_db_timestamp(void)
 {
 }
 
-static void register_serial_port(void)
+static void add_serial_port_attrs(sdp_record_t *record)
 {
 	sdp_list_t *svclass_id, *apseq, *proto[2], *profiles, *root, *aproto;
 	uuid_t root_uuid, sp_uuid, l2cap, rfcomm;
 	sdp_profile_desc_t profile;
 	uint8_t u8 = 1;
-	sdp_data_t *sdp_data, *channel;
-	sdp_record_t *record = sdp_record_alloc();
-
-	record->handle = sdp_next_handle();
-
-	sdp_record_add(BDADDR_ANY, record);
-	sdp_data = sdp_data_alloc(SDP_UINT32, &record->handle);
-	sdp_attr_add(record, SDP_ATTR_RECORD_HANDLE, sdp_data);
+	sdp_data_t *channel;
 
 	sdp_uuid16_create(&root_uuid, PUBLIC_BROWSE_GROUP);
 	root = sdp_list_append(0, &root_uuid);
@@ -337,6 +330,20 @@ static void register_serial_port(void)
 	sdp_list_free(proto[1], 0);
 	sdp_list_free(apseq, 0);
 	sdp_list_free(aproto, 0);
+}
+
+static void register_serial_port(void)
+{
+	sdp_data_t *sdp_data;
+	sdp_record_t *record = sdp_record_alloc();
+
+	record->handle = sdp_next_handle();
+
+	sdp_record_add(BDADDR_ANY, record);
+	sdp_data = sdp_data_alloc(SDP_UINT32, &record->handle);
+	sdp_attr_add(record, SDP_ATTR_RECORD_HANDLE, sdp_data);
+
+	add_serial_port_attrs(record);
 
 	update_db_timestamp();
 }
@@ -777,6 +784,83 @@ static void test_sdp_de_attr(gconstpointer data)
 	tester_test_passed();
 }
 
+static sdp_buf_t bench_pdu;
+
+static void setup_bench(const void *data)
+{
+	sdp_record_t *record = sdp_record_alloc();
+	uint32_t handle = 0x00010000;
+
+	sdp_attr_add(record, SDP_ATTR_RECORD_HANDLE,
+				sdp_data_alloc(SDP_UINT32, &handle));
+	add_serial_port_attrs(record);
+
+	g_assert(sdp_gen_record_pdu(record, &bench_pdu) == 0);
+
+	sdp_record_free(record);
+
+	tester_setup_complete();
+}
+
+static void teardown_bench(const void *data)
+{
+	free(bench_pdu.data);
+	memset(&bench_pdu, 0, sizeof(bench_pdu));
+
+	tester_teardown_complete();
+}
+
+static void bench_extract(const void *data, unsigned int count)
+{
+	sdp_record_t *record;
+	unsigned int i;
+	int scanned;
+
+	for (i = 0; i < count; i++) {
+		record = sdp_extract_pdu(bench_pdu.data, bench_pdu.data_size,
+								&scanned);
+		g_assert(record != NULL);
+		sdp_record_free(record);
+	}
+}
+
+static void bench_extract_arena(const void *data, unsigned int count)
+{
+	sdp_arena_t *arena;
+	unsigned int i;
+	int scanned;
+
+	arena = sdp_arena_new();
+	g_assert(arena != NULL);
+
+	for (i = 0; i < count; i++) {
+		g_assert(sdp_extract_pdu_arena(arena, bench_pdu.data,
+					bench_pdu.data_size, &scanned));
+		sdp_arena_reset(arena);
+	}
+
+	sdp_arena_free(arena);
+}
+
+static void bench_gen(const void *data, unsigned int count)
+{
+	sdp_record_t *record;
+	sdp_buf_t pdu;
+	unsigned int i;
+	int scanned;
+
+	record = sdp_extract_pdu(bench_pdu.data, bench_pdu.data_size,
+								&scanned);
+	g_assert(record != NULL);
+
+	for (i = 0; i < count; i++) {
+		g_assert(sdp_gen_record_pdu(record, &pdu) == 0);
+		free(pdu.data);
+	}
+
+	sdp_record_free(record);
+}
+
 int main(int argc, char *argv[])
 {
 	tester_init(&argc, &argv);
@@ -2810,5 +2894,12 @@ int main(int argc, char *argv[])
 						0x00, 0x00, 0x00, 0x00, 0x00,
 						0x00, 0x00, 0x00, 0x00, 0x00)));
 
+	tester_add_bench("/sdp/bench/extract", NULL, setup_bench,
+					bench_extract, teardown_bench);
+	tester_add_bench("/sdp/bench/extract_arena", NULL, setup_bench,
+					bench_extract_arena, teardown_bench);
+	tester_add_bench("/sdp/bench/gen", NULL, setup_bench, bench_gen,
+							teardown_bench);
+
 	return tester_run();
 }
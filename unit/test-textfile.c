@@ -261,6 +261,126 @@ static void test_multiple(const void *data)
 	tester_test_passed();
 }
 
+static unsigned int util_count_lines(void)
+{
+	unsigned int lines = 0;
+	FILE *fp;
+	int ch;
+
+	fp = fopen(test_pathname, "r");
+	if (!fp)
+		return 0;
+
+	while ((ch = fgetc(fp)) != EOF) {
+		if (ch == '\n')
+			lines++;
+	}
+
+	fclose(fp);
+
+	return lines;
+}
+
+static void util_append(const char *str)
+{
+	int fd;
+
+	fd = open(test_pathname, O_WRONLY | O_APPEND);
+	if (fd < 0)
+		return;
+
+	if (write(fd, str, strlen(str)) < 0)
+		goto done;
+
+done:
+	close(fd);
+}
+
+static void test_compact(const void *data)
+{
+	char key[18], value[512], *str;
+	unsigned int i;
+
+	util_create_empty();
+
+	sprintf(key, "00:00:00:00:00:01");
+	g_assert(textfile_put(test_pathname, key, "first") == 0);
+
+	sprintf(key, "00:00:00:00:00:00");
+
+	for (i = 0; i < 100; i++) {
+		snprintf(value, sizeof(value), "%u", i);
+		g_assert(textfile_put(test_pathname, key, value) == 0);
+
+		str = textfile_get(test_pathname, key);
+		g_assert(str != NULL);
+		g_assert(strcmp(str, value) == 0);
+		free(str);
+	}
+
+	tester_debug("%u lines for 2 keys\n", util_count_lines());
+
+	/* Superseded entries must not keep piling up */
+	g_assert(util_count_lines() < 40);
+
+	sprintf(key, "00:00:00:00:00:01");
+	str = textfile_get(test_pathname, key);
+	g_assert(str != NULL);
+	g_assert(strcmp(str, "first") == 0);
+	free(str);
+
+	tester_test_passed();
+}
+
+static void test_external(const void *data)
+{
+	char *str;
+
+	util_create_empty();
+
+	g_assert(textfile_put(test_pathname, "key", "one") == 0);
+
+	str = textfile_get(test_pathname, "key");
+	g_assert(str != NULL);
+	g_assert(strcmp(str, "one") == 0);
+	free(str);
+
+	/* Changes made behind our back have to be picked up */
+	util_append("other value\nkey two");
+
+	str = textfile_get(test_pathname, "key");
+	g_assert(str != NULL);
+	g_assert(strcmp(str, "two") == 0);
+	free(str);
+
+	str = textfile_get(test_pathname, "other");
+	g_assert(str != NULL);
+	g_assert(strcmp(str, "value") == 0);
+	free(str);
+
+	/* The unterminated last line must not be extended */
+	g_assert(textfile_put(test_pathname, "last", "three") == 0);
+
+	str = textfile_get(test_pathname, "key");
+	g_assert(str != NULL);
+	g_assert(strcmp(str, "two") == 0);
+	free(str);
+
+	g_assert(textfile_del(test_pathname, "key") == 0);
+
+	str = textfile_get(test_pathname, "key");
+	g_assert(str == NULL);
+
+	str = textfile_get(test_pathname, "last");
+	g_assert(str != NULL);
+	g_assert(strcmp(str, "three") == 0);
+	free(str);
+
+	g_assert(util_count_lines() == 2);
+
+	tester_test_passed();
+}
+
 int main(int argc, char *argv[])
 {
 	tester_init(&argc, &argv);
@@ -269,6 +389,8 @@ int main(int argc, char *argv[])
 	tester_add("/textfile/delete", NULL, NULL, test_delete, NULL);
 	tester_add("/textfile/overwrite", NULL, NULL, test_overwrite, NULL);
 	tester_add("/textfile/multiple", NULL, NULL, test_multiple, NULL);
+	tester_add("/textfile/compact", NULL, NULL, test_compact, NULL);
+	tester_add("/textfile/external", NULL, NULL, test_external, NULL);
 
 	return tester_run();
 }
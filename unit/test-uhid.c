@@ -255,6 +255,13 @@ static void test_client(gconstpointer data)
 	if (g_str_equal(context->data->test_name, "/uhid/command/input"))
 		bt_uhid_send(context->uhid, &ev_input);
 
+	if (g_str_equal(context->data->test_name,
+						"/uhid/command/input_batch")) {
+		g_assert(bt_uhid_set_batch(context->uhid, 8));
+		bt_uhid_send(context->uhid, &ev_input);
+		bt_uhid_send(context->uhid, &ev_input);
+	}
+
 	context_quit(context);
 }
 
@@ -291,6 +298,8 @@ int main(int argc, char *argv[])
 	define_test("/uhid/command/feature_answer", test_client,
 						event(&ev_feature_answer));
 	define_test("/uhid/command/input", test_client, event(&ev_input));
+	define_test("/uhid/command/input_batch", test_client,
+					event(&ev_input), event(&ev_input));
 
 	define_test("/uhid/event/output", test_server, event(&ev_output));
 	define_test("/uhid/event/feature", test_server, event(&ev_feature));
@@ -26,6 +26,7 @@
 #endif
 
 #include <glib.h>
+#include <string.h>
 
 #include "lib/bluetooth.h"
 #include "lib/uuid.h"
@@ -182,6 +183,112 @@ static void test_cmp(gconstpointer data)
 	tester_test_passed();
 }
 
+static int cmp128(const bt_uuid_t *uuid1, const bt_uuid_t *uuid2)
+{
+	bt_uuid_t u1, u2;
+
+	bt_uuid_to_uuid128(uuid1, &u1);
+	bt_uuid_to_uuid128(uuid2, &u2);
+
+	return memcmp(&u1.value.u128, &u2.value.u128, sizeof(uint128_t));
+}
+
+static int sign(int value)
+{
+	return value < 0 ? -1 : value > 0;
+}
+
+static void test_cmp_short(gconstpointer data)
+{
+	static const uint32_t values[] = { 0x0000, 0x0001, 0x1234, 0x12ff,
+					0xffff, 0x10000, 0x12340000, 0xffffffff };
+	bt_uuid_t uuid1, uuid2;
+	size_t i, j;
+
+	/* The short UUID fast path must order like the 128-bit compare */
+	for (i = 0; i < G_N_ELEMENTS(values); i++) {
+		for (j = 0; j < G_N_ELEMENTS(values); j++) {
+			if (values[i] <= 0xffff)
+				bt_uuid16_create(&uuid1, values[i]);
+			else
+				bt_uuid32_create(&uuid1, values[i]);
+
+			bt_uuid32_create(&uuid2, values[j]);
+
+			g_assert(sign(bt_uuid_cmp(&uuid1, &uuid2)) ==
+						sign(cmp128(&uuid1, &uuid2)));
+			g_assert(sign(bt_uuid_cmp(&uuid2, &uuid1)) ==
+						sign(cmp128(&uuid2, &uuid1)));
+		}
+	}
+
+	tester_test_passed();
+}
+
+static void test_intern(gconstpointer data)
+{
+	bt_uuid_t uuid16, uuid32, uuid128, other;
+	unsigned int id, i;
+
+	bt_uuid16_create(&uuid16, 0x2a00);
+	bt_uuid32_create(&uuid32, 0x2a00);
+	bt_uuid_to_uuid128(&uuid16, &uuid128);
+	bt_uuid16_create(&other, 0x2a01);
+
+	g_assert(bt_uuid_intern_lookup(&other) == 0);
+
+	id = bt_uuid_intern(&uuid16);
+	g_assert(id != 0);
+	g_assert(bt_uuid_intern(&uuid16) == id);
+	g_assert(bt_uuid_intern(&uuid32) == id);
+	g_assert(bt_uuid_intern(&uuid128) == id);
+	g_assert(bt_uuid_intern_lookup(&uuid128) == id);
+	g_assert(bt_uuid_intern_lookup(&other) == 0);
+
+	/* Identifiers survive the table being resized */
+	for (i = 0; i < 1000; i++) {
+		bt_uuid32_create(&other, 0x10000 + i);
+		g_assert(bt_uuid_intern(&other) != 0);
+		g_assert(bt_uuid_intern(&other) != id);
+	}
+
+	g_assert(bt_uuid_intern_lookup(&uuid32) == id);
+
+	for (i = 0; i < 1000; i++) {
+		bt_uuid32_create(&other, 0x10000 + i);
+		g_assert(bt_uuid_intern_lookup(&other) ==
+						bt_uuid_intern(&other));
+	}
+
+	tester_test_passed();
+}
+
+static void test_str_truncate(gconstpointer data)
+{
+	const char *upper = "12345678-9ABC-DEF0-1234-56789ABCDEF0";
+	const char *str = "12345678-9abc-def0-1234-56789abcdef0";
+	char buf[MAX_LEN_UUID_STR];
+	bt_uuid_t uuid;
+
+	g_assert(bt_string_to_uuid(&uuid, upper) == 0);
+	g_assert(uuid.type == BT_UUID128);
+
+	/* Output is always lower case and truncated like snprintf() */
+	g_assert(bt_uuid_to_string(&uuid, buf, sizeof(buf)) == 0);
+	g_assert(strcmp(buf, str) == 0);
+
+	memset(buf, 'x', sizeof(buf));
+	g_assert(bt_uuid_to_string(&uuid, buf, 9) == 0);
+	g_assert(strcmp(buf, "12345678") == 0);
+	g_assert(buf[9] == 'x');
+
+	memset(buf, 'x', sizeof(buf));
+	g_assert(bt_uuid_to_string(&uuid, buf, 0) == 0);
+	g_assert(buf[0] == 'x');
+
+	tester_test_passed();
+}
+
 static const struct uuid_test_data compress[] = {
 	{
 		.str = "00001234-0000-1000-8000-00805f9b34fb",
@@ -218,6 +325,9 @@ static const char *malformed[] = {
 	"00001234-0000-1000-8000 00805F9B34FB",
 	"00001234-0000-1000-8000-00805F9B34FBC",
 	"00001234-0000-1000-800G-00805F9B34FB",
+	"0000123G-0000-1000-8000-00805F9B34FB",
+	"+0001234-0000-1000-8000-00805F9B34FB",
+	"00001234-0000-1000-8000- 0805F9B34FB",
 	NULL,
 };
 
@@ -260,6 +370,10 @@ int main(int argc, char *argv[])
 	tester_add("/uuid/onetwentyeight/str", &uuid_128, NULL, test_str, NULL);
 	tester_add("/uuid/onetwentyeight/cmp", &uuid_128, NULL, test_cmp, NULL);
 
+	tester_add("/uuid/cmp/short", NULL, NULL, test_cmp_short, NULL);
+	tester_add("/uuid/intern", NULL, NULL, test_intern, NULL);
+	tester_add("/uuid/str/truncate", NULL, NULL, test_str_truncate, NULL);
+
 	for (i = 0; malformed[i]; i++) {
 		char *testpath;
 